@@ -105,6 +105,14 @@ macro(ADD_OSQUERY_TEST IS_CORE)
   endif()
 endmacro(ADD_OSQUERY_TEST)
 
+# Benchmark sources, built into osquery_benchmarks outside of the SDK.
+macro(ADD_OSQUERY_BENCHMARK)
+  if(NOT DEFINED ENV{SKIP_TESTS} AND NOT OSQUERY_BUILD_SDK_ONLY)
+    list(APPEND OSQUERY_BENCHMARKS ${ARGN})
+    set(OSQUERY_BENCHMARKS ${OSQUERY_BENCHMARKS} PARENT_SCOPE)
+  endif()
+endmacro(ADD_OSQUERY_BENCHMARK)
+
 macro(ADD_OSQUERY_TABLE_TEST)
   if(NOT DEFINED ENV{SKIP_TESTS} AND NOT OSQUERY_BUILD_SDK_ONLY)
     list(APPEND OSQUERY_TABLES_TESTS ${ARGN})
@@ -259,6 +267,25 @@ macro(GENERATE_TABLE TABLE_FILE NAME BASE_PATH OUTPUT)
   )
 
   list(APPEND ${OUTPUT} "${TABLE_FILE_GEN}")
+
+  # Generators include a row_struct table's header, it is generated when
+  # configuring so it exists before any generator is compiled.
+  file(STRINGS "${TABLE_FILE}" TABLE_ROW_STRUCT REGEX "row_struct=True")
+  if(TABLE_ROW_STRUCT)
+    string(REGEX REPLACE
+      ".*/specs.*/(.*)\\.table"
+      "${CMAKE_BINARY_DIR}/generated/rows/\\1.h"
+      TABLE_ROW_GEN
+      ${TABLE_FILE}
+    )
+    execute_process(
+      COMMAND ${PYTHON_EXECUTABLE} "${BASE_PATH}/tools/codegen/gentable.py"
+        --header "${TABLE_FILE}" "${TABLE_ROW_GEN}"
+      WORKING_DIRECTORY "${CMAKE_SOURCE_DIR}"
+    )
+    set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS
+      "${TABLE_FILE}")
+  endif()
 endmacro(GENERATE_TABLE)
 
 macro(AMALGAMATE BASE_PATH NAME OUTPUT)
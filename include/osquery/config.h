@@ -12,12 +12,13 @@
 
 #include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <vector>
 
 #include <boost/noncopyable.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
-#include <boost/thread/shared_mutex.hpp>
 
 #include <osquery/database.h>
 #include <osquery/flags.h>
@@ -57,11 +58,73 @@ struct ConfigData {
   std::map<std::string, std::vector<std::string> > files;
   /// All data catches optional/plugin-parsed configuration keys.
   pt::ptree all_data;
+  /// The data of each config parser after the parsers were updated.
+  std::map<std::string, pt::ptree> parsed_data;
+};
+
+/**
+ * @brief The performance of a scheduled query's executions.
+ *
+ * Performance is recorded apart from the config data, which is immutable once
+ * published. It is kept while the scheduled query is unchanged by updates.
+ */
+struct QueryPerformance {
+  /// Number of executions.
+  size_t executions{0};
+
+  /// Total wall time taken, in microseconds.
+  unsigned long long int wall_time{0};
+
+  /// Total user time, in microseconds.
+  unsigned long long int user_time{0};
+
+  /// Total system time, in microseconds.
+  unsigned long long int system_time{0};
+
+  /// Average growth of the peak resident memory. This should be near 0.
+  unsigned long long int memory{0};
+
+  /// Total bytes allocated by the executing thread.
+  unsigned long long int allocated{0};
+
+  /// The highest peak of bytes allocated and not freed by one execution.
+  unsigned long long int peak_allocated{0};
+
+  /// Total bytes allocated while generating, diffing, and serializing.
+  unsigned long long int generate_allocated{0};
+  unsigned long long int diff_allocated{0};
+  unsigned long long int serialize_allocated{0};
+
+  /// Total characters, bytes, generated by query.
+  unsigned long long int output_size{0};
+
+  /// Total microseconds spent in each phase of execution.
+  unsigned long long int plan_time{0};
+  unsigned long long int generate_time{0};
+  unsigned long long int diff_time{0};
+  unsigned long long int serialize_time{0};
+  unsigned long long int log_time{0};
+
+  /// Total microseconds spent generating each table.
+  std::map<std::string, unsigned long long int> table_times;
+
+  /// Total hardware and software event counts, see --enable_perf_counters.
+  unsigned long long int instructions{0};
+  unsigned long long int cycles{0};
+  unsigned long long int cache_misses{0};
+  unsigned long long int context_switches{0};
+  unsigned long long int page_faults{0};
+
+  /// Executions stopped at the results size limit, and the last one's size.
+  size_t oversized{0};
+  unsigned long long int oversized_size{0};
 };
 
 class ConfigParserPlugin;
 typedef std::shared_ptr<ConfigParserPlugin> ConfigPluginRef;
 
+struct QueryProfile;
+
 /**
  * @brief A singleton that exposes accessors to osquery's configuration data.
  *
@@ -100,6 +163,9 @@ class Config : private boost::noncopyable {
   /**
    * @brief Update the internal config data.
    *
+   * Each config parser is only updated when the merged data of a key it
+   * requested changed.
+   *
    * @param config A map of domain or namespace to config data.
    * @return If the config changes were applied.
    */
@@ -115,10 +181,22 @@ class Config : private boost::noncopyable {
   /**
    * @brief Adds a new query to the scheduled queries.
    *
+   * @param shard The percent of hosts executing the query, see
+   * ScheduledQuery::shard.
    */
   static void addScheduledQuery(const std::string& name,
                                 const std::string& query,
-                                int interval);
+                                int interval,
+                                size_t shard = 100,
+                                const std::string& worker = "");
+
+  /**
+   * @brief A counter incremented each time the schedule may have changed.
+   *
+   * The scheduler compares generations instead of reading the schedule on
+   * each step.
+   */
+  static size_t getGeneration();
 
   /**
    * @brief Checks if a query exists in the query schedule.
@@ -148,7 +226,9 @@ class Config : private boost::noncopyable {
    * Since instances of Config should only be created via getInstance(),
    * Config's constructor is private
    */
-  Config() : force_merge_success_(false) {}
+  Config()
+      : data_(std::make_shared<const ConfigData>()),
+        force_merge_success_(false) {}
   ~Config(){}
   Config(Config const&);
   void operator=(Config const&);
@@ -169,45 +249,75 @@ class Config : private boost::noncopyable {
   /// Merge a retrieved config source JSON into a working ConfigData.
   static Status mergeConfig(const std::string& source, ConfigData& conf);
 
+  /// The published config data, an immutable snapshot.
+  static std::shared_ptr<const ConfigData> snapshot();
+
+  /// Publish new config data, readers holding the previous snapshot keep it.
+  static void publish(std::shared_ptr<const ConfigData> data);
+
  public:
   /**
    * @brief Record performance (monitoring) information about a scheduled query.
    *
-   * The daemon and query scheduler will optionally record process metadata
-   * before and after executing each query. This can be compared and reported
-   * on an interval or within the osquery_schedule table.
+   * The daemon and query scheduler will optionally profile each execution of
+   * a query, see ScopedQueryProfile. The totals are reported within the
+   * osquery_schedule table.
    *
-   * The config consumes and calculates the optional performance differentials.
    * It would also be possible to store this in the RocksDB backing store or
    * report directly to a LoggerPlugin sink. The Config is the most appropriate
    * as the metrics are transient to the process running the schedule and apply
    * to the updates/changes reflected in the schedule, from the config.
    *
    * @param name The unique name of the scheduled item
-   * @param delay Number of seconds (wall time) taken by the query
+   * @param profile The resources used by one execution of the query
    * @param size Number of characters generated by query
-   * @param t0 the process row before the query
-   * @param t1 the process row after the query
    */
   static void recordQueryPerformance(const std::string& name,
-                                     size_t delay,
-                                     size_t size,
-                                     const Row& t0,
-                                     const Row& t1);
+                                     const QueryProfile& profile,
+                                     size_t size);
+
+  /**
+   * @brief Record an execution stopped at the results size limit.
+   *
+   * This is recorded with or without the schedule monitor.
+   *
+   * @param name The unique name of the scheduled item
+   * @param size Bytes of results held when the execution was stopped
+   */
+  static void recordQueryOversized(const std::string& name, size_t size);
+
+  /// The recorded performance of a scheduled query, empty if it has not run.
+  static QueryPerformance getQueryPerformance(const std::string& name);
 
  private:
-  /// The raw osquery config data in a native format
-  ConfigData data_;
+  /// The raw osquery config data in a native format, replaced on updates.
+  std::shared_ptr<const ConfigData> data_;
 
   /// The raw JSON source map from the config plugin.
   std::map<std::string, std::string> raw_;
 
-  /// The reader/writer config data mutex.
-  boost::shared_mutex mutex_;
+  /// Serializes updates, readers never wait for an update. Parsers may add
+  /// scheduled queries while the config is updated.
+  std::recursive_mutex update_mutex_;
+
+  /// The performance of each scheduled query.
+  std::map<std::string, QueryPerformance> performance_;
+
+  /// Protects the recorded performance.
+  std::mutex performance_mutex_;
 
   /// Enforce merge success.
   bool force_merge_success_;
 
+  /// Parsers updated at least once, with the merged data of their keys.
+  std::set<std::string> updated_parsers_;
+
+  /// Queries scheduled by each parser, kept while a parser is not updated.
+  std::map<std::string, std::map<std::string, ScheduledQuery>> parser_queries_;
+
+  /// The parser being updated, the queries it schedules are recorded.
+  std::string updating_parser_;
+
  private:
   static const pt::ptree& getParsedData(const std::string& parser);
   static const ConfigPluginRef getParser(const std::string& parser);
@@ -217,43 +327,45 @@ class Config : private boost::noncopyable {
 
  private:
   /// Config accessors, `ConfigDataInstance`, are the forced use of the config
-  /// data. This forces the caller to use a shared read lock.
+  /// data. This forces the caller to hold a snapshot.
   friend class ConfigDataInstance;
-
- private:
-  FRIEND_TEST(ConfigTests, test_locking);
 };
 
 /**
  * @brief All accesses to the Config's data must request a ConfigDataInstance.
  *
- * This class will request a read-only lock of the config's changeable internal
- * data structures such as query schedule, options, monitored files, etc.
+ * This class holds a snapshot of the config's changeable internal data
+ * structures such as query schedule, options, monitored files, etc.
  *
- * Since a variable config plugin may implement `update` calls, internal uses
- * of config data needs simple read and write locking.
+ * Since a variable config plugin may implement `update` calls, an update
+ * publishes a new snapshot. Instances keep reading the snapshot taken when
+ * they were created, and never block an update.
  */
 class ConfigDataInstance {
  public:
-  ConfigDataInstance() : lock_(Config::getInstance().mutex_) {}
-  ~ConfigDataInstance() { lock_.unlock(); }
+  ConfigDataInstance() : data_(Config::snapshot()) {}
 
   /// Helper accessor for Config::data_.schedule.
-  const std::map<std::string, ScheduledQuery> schedule() const {
-    return Config::getInstance().data_.schedule;
+  const std::map<std::string, ScheduledQuery>& schedule() const {
+    return data_->schedule;
   }
 
   /// Helper accessor for Config::data_.options.
   const std::map<std::string, std::string>& options() const {
-    return Config::getInstance().data_.options;
+    return data_->options;
   }
 
   /// Helper accessor for Config::data_.files.
   const std::map<std::string, std::vector<std::string> >& files() const {
-    return Config::getInstance().data_.files;
+    return data_->files;
   }
 
   const pt::ptree& getParsedData(const std::string& parser) const {
+    auto data = data_->parsed_data.find(parser);
+    if (data != data_->parsed_data.end()) {
+      return data->second;
+    }
+    // Parsers that were not updated since the snapshot have their defaults.
     return Config::getParsedData(parser);
   }
 
@@ -262,11 +374,11 @@ class ConfigDataInstance {
   }
 
   /// Helper accessor for Config::data_.all_data.
-  const pt::ptree& data() const { return Config::getInstance().data_.all_data; }
+  const pt::ptree& data() const { return data_->all_data; }
 
  private:
-  /// A read lock on the reader/writer config data accessor/update mutex.
-  boost::shared_lock<boost::shared_mutex> lock_;
+  /// The config data published when the instance was created.
+  std::shared_ptr<const ConfigData> data_;
 };
 
 /**
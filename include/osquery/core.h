@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <string>
 #include <vector>
 
@@ -161,6 +163,65 @@ std::vector<std::string> split(const std::string& s,
                                const std::string& delim,
                                size_t occurences);
 
+/**
+ * @brief Iterate the fields of a string without copying them.
+ *
+ * Fields are separated by any of the delimiter characters, empty fields are
+ * skipped and each field is trimmed of whitespace: the same fields as split.
+ * A field is a pointer and size into the tokenized content, which must
+ * outlive the Tokenizer.
+ *
+ * @code{.cpp}
+ *   Tokenizer lines(content, "\n");
+ *   while (lines.next()) {
+ *     Tokenizer fields(lines.data(), lines.size(), " ");
+ *     ...
+ *   }
+ * @endcode
+ */
+class Tokenizer {
+ public:
+  explicit Tokenizer(const std::string& s, const std::string& delim = "\t ")
+      : Tokenizer(s.data(), s.size(), delim) {}
+
+  Tokenizer(const char* data, size_t size, const std::string& delim = "\t ");
+
+  /// Advance to the next field, false if there are no more fields.
+  bool next();
+
+  /// Advance past count fields, false if the content ends first.
+  bool skip(size_t count);
+
+  /// The current field, not NULL-terminated.
+  const char* data() const { return field_; }
+
+  /// The size of the current field.
+  size_t size() const { return size_; }
+
+  /// Copy the current field.
+  std::string str() const { return std::string(field_, size_); }
+
+  /// Compare the current field with a NULL-terminated string.
+  bool equals(const char* s) const;
+
+  /// Copy the content after the current field, trimmed of delimiters.
+  std::string rest() const;
+
+ private:
+  /// Find the next delimiter from position, or the end of the content.
+  const char* find(const char* position) const;
+
+ private:
+  const char* position_;
+  const char* end_;
+  const char* field_;
+  size_t size_;
+
+  /// A single delimiter is found with memchr, otherwise using the table.
+  int single_;
+  bool delimiters_[256];
+};
+
 /**
  * @brief In-line replace all instances of from with to.
  *
@@ -264,4 +325,48 @@ inline size_t utf8StringSize(const std::string& str) {
  * @return A status object indicating the success or failure of the operation
  */
 Status createPidFile();
+
+/**
+ * @brief A query's deadline and cancellation, shared with table generators.
+ *
+ * sqlite3_interrupt only stops a query between VM steps, and a virtual table
+ * generates all of its rows within a single step. Long-running generators and
+ * the filesystem helpers they use check the cancellation periodically, and
+ * stop early. A cancelled query fails rather than returning partial results.
+ */
+class QueryCancellation {
+ public:
+  /// Create a cancellation with a timeout in seconds, 0 for no deadline.
+  explicit QueryCancellation(size_t timeout);
+
+  /// Cancel the query, this may be called from any thread.
+  void cancel() { cancelled_ = true; }
+
+  /// Check if the query was cancelled or is past its deadline.
+  bool cancelled() const;
+
+ private:
+  std::atomic<bool> cancelled_{false};
+  bool has_deadline_{false};
+  std::chrono::steady_clock::time_point deadline_;
+};
+
+/// Set the cancellation of queries run by the calling thread for a scope.
+class ScopedQueryCancellation {
+ public:
+  explicit ScopedQueryCancellation(const QueryCancellation* cancellation);
+  ~ScopedQueryCancellation();
+
+ private:
+  const QueryCancellation* previous_;
+};
+
+/// The cancellation of the query run by the calling thread, if any.
+const QueryCancellation* getQueryCancellation();
+
+/// Check if the query run by the calling thread was cancelled.
+inline bool isQueryCancelled() {
+  auto cancellation = getQueryCancellation();
+  return (cancellation != nullptr && cancellation->cancelled());
+}
 }
@@ -11,6 +11,7 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -36,9 +37,59 @@ extern const std::string kPersistentSettings;
 /// The "domain" where the results of scheduled queries are stored.
 extern const std::string kQueries;
 
+/// The "domain" where row fingerprints of scheduled query results are stored.
+extern const std::string kQueryFingerprints;
+
+/**
+ * @brief The "domain" where scheduled query result sets are stored by content.
+ *
+ * Each query name in kQueries references a result set by its hash, so query
+ * names with identical results share a single stored copy.
+ */
+extern const std::string kQueryResults;
+
+/**
+ * @brief The "domain" where past generations of scheduled query results are
+ * kept as differentials, when enabled with --schedule_history.
+ */
+extern const std::string kQueryHistory;
+
 /// The "domain" where event results are stored, queued for querytime retrieval.
 extern const std::string kEvents;
 
+/**
+ * @brief The "domain" where results computed from file content are cached.
+ *
+ * Hashes and signature scan results are keyed by path and stored with the
+ * identity of the file when it was read, see getFileIdentity. The read
+ * offsets of tailed files are also kept here, see readTailedFile.
+ */
+extern const std::string kFileCache;
+
+/**
+ * @brief The "domain" where the file inventory is stored.
+ *
+ * Rows describing each path matched by the config's file_paths, keyed by
+ * path, crawled once and kept current from file change events.
+ */
+extern const std::string kFileInventory;
+
+/**
+ * @brief The "domain" where executed distributed request IDs are stored.
+ *
+ * Each request ID is stored with the time its results were returned, so
+ * duplicate requests are not executed again after a restart.
+ */
+extern const std::string kDistributed;
+
+/**
+ * @brief The "domain" where pages of distributed query results are spilled.
+ *
+ * Results larger than a request's page limits are returned one page at a
+ * time, the pages after the first wait here until the master requests them.
+ */
+extern const std::string kDistributedResults;
+
 /**
  * @brief The "domain" where buffered log results are stored.
  *
@@ -143,6 +194,261 @@ Status deserializeQueryData(const pt::ptree& tree, QueryData& qd);
 /// Inverse of serializeQueryDataJSON, convert a JSON string to QueryData.
 Status deserializeQueryDataJSON(const std::string& json, QueryData& qd);
 
+/**
+ * @brief Serialize a QueryData object into the binary storage format
+ *
+ * The versioned format stores a dictionary of column names followed by each
+ * row's column indexes and length-prefixed values. The payload may be
+ * compressed, see the `database_compress_results` flag.
+ *
+ * @param q the QueryData to serialize
+ * @param raw the output binary string
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status serializeQueryDataBinary(const QueryData& q, std::string& raw);
+
+/**
+ * @brief Serialize a QueryData object into the column-major binary format
+ *
+ * Values are stored by column, a column with few distinct values, such as an
+ * event action or category, stores a dictionary and an index per row. Larger
+ * payloads are compressed. This suits blocks of similar rows, like events
+ * added in a batch, and is read with deserializeQueryDataBinary.
+ *
+ * @param q the QueryData to serialize
+ * @param raw the output binary string
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status serializeQueryDataColumnar(const QueryData& q, std::string& raw);
+
+/**
+ * @brief Inverse of serializeQueryDataBinary
+ *
+ * Content that is not in the binary format is parsed as JSON, so results
+ * stored by earlier versions are migrated transparently.
+ */
+Status deserializeQueryDataBinary(const std::string& raw, QueryData& qd);
+
+/////////////////////////////////////////////////////////////////////////////
+// ResultSet
+/////////////////////////////////////////////////////////////////////////////
+
+class ColumnSchema;
+
+/// Schemas are interned and shared by every ResultSet with the same columns.
+typedef std::shared_ptr<const ColumnSchema> ColumnSchemaRef;
+
+/**
+ * @brief An ordered, interned list of result column names
+ *
+ * Column names are stored once per distinct schema rather than in every Row.
+ * Use ColumnSchema::get to find or create the shared schema for a list of
+ * column names.
+ */
+class ColumnSchema {
+ public:
+  /// Find or create the interned schema for an ordered list of column names.
+  static ColumnSchemaRef get(const std::vector<std::string>& columns);
+
+  /// The number of columns.
+  size_t size() const { return columns_.size(); }
+
+  /// The name of a column by index.
+  const std::string& name(size_t column) const { return columns_[column]; }
+
+  /// Column indexes in the order of their names, the order of a Row.
+  const std::vector<size_t>& sorted() const { return sorted_; }
+
+  /// Find a column's index by name, returns false if it is not in the schema.
+  bool index(const std::string& name, size_t& column) const;
+
+ private:
+  explicit ColumnSchema(const std::vector<std::string>& columns);
+
+ private:
+  /// The column names, in result order.
+  std::vector<std::string> columns_;
+
+  /// Column indexes ordered by name.
+  std::vector<size_t> sorted_;
+};
+
+/// A reference to a value stored in a ResultSet, valid while it is unchanged.
+struct ResultValue {
+  const char* data;
+  size_t size;
+
+  /// Copy the referenced value into a string.
+  std::string str() const { return std::string(data, size); }
+
+  bool operator==(const ResultValue& comp) const;
+  bool operator!=(const ResultValue& comp) const { return !(*this == comp); }
+};
+
+/**
+ * @brief A result set with a shared column schema and a single value arena
+ *
+ * Each cell is an offset and size into contiguous text storage owned by the
+ * result set, so appending a row does not allocate per value or per column
+ * name. A cell may be absent, the way a Row may omit a column.
+ *
+ * Rows are convertible to and from Row and QueryData so that consumers can
+ * migrate incrementally.
+ */
+class ResultSet {
+ public:
+  ResultSet() {}
+  explicit ResultSet(ColumnSchemaRef schema) : schema_(std::move(schema)) {}
+
+  /// Build a result set from rows, the schema is every column in any row.
+  static ResultSet fromQueryData(const QueryData& qd);
+
+  /// The shared column schema, nullptr if none was set.
+  const ColumnSchemaRef& schema() const { return schema_; }
+
+  /// Remove all rows and set a new schema, keeping allocated storage.
+  void reset(ColumnSchemaRef schema);
+
+  /// The number of rows.
+  size_t rows() const {
+    return (columns() == 0) ? 0 : cells_.size() / columns();
+  }
+
+  /// The number of columns.
+  size_t columns() const { return (schema_ == nullptr) ? 0 : schema_->size(); }
+
+  /// Append a row with every cell absent, returns the row index.
+  size_t addRow();
+
+  /// Set a cell of the last row, copying the value into the arena.
+  void setValue(size_t column, const char* data, size_t size);
+
+  /// Set a cell of the last row from a string.
+  void setValue(size_t column, const std::string& value) {
+    setValue(column, value.data(), value.size());
+  }
+
+  /// Append a copy of a Row, columns missing from the schema are ignored.
+  void append(const Row& r);
+
+  /// Check if a cell is present.
+  bool hasValue(size_t row, size_t column) const {
+    return cells_[row * columns() + column].offset != kAbsent;
+  }
+
+  /// Reference a cell, an absent cell is an empty value.
+  ResultValue value(size_t row, size_t column) const;
+
+  /// Convert a row to a Row, omitting absent cells.
+  Row toRow(size_t row) const;
+
+  /// Convert every row to QueryData.
+  QueryData toQueryData() const;
+
+  /// Bytes of value storage, for accounting.
+  size_t arenaSize() const { return arena_.size(); }
+
+ private:
+  /// The offset of an absent cell.
+  static const size_t kAbsent = static_cast<size_t>(-1);
+
+  struct Cell {
+    size_t offset;
+    size_t size;
+  };
+
+ private:
+  /// The shared column schema.
+  ColumnSchemaRef schema_{nullptr};
+
+  /// Row-major cells, rows() * columns() in total.
+  std::vector<Cell> cells_;
+
+  /// Contiguous storage for every value.
+  std::string arena_;
+};
+
+/**
+ * @brief Serialize a ResultSet into the binary storage format
+ *
+ * The output is identical to serializeQueryDataBinary of the equivalent
+ * QueryData, and is read with deserializeQueryDataBinary.
+ */
+Status serializeResultSetBinary(const ResultSet& rs, std::string& raw);
+
+/**
+ * @brief A consumer of result rows as they are produced
+ *
+ * A producer, such as the SQL layer, calls begin with the shared column schema
+ * of each statement's rows, then row with each row's values in schema order.
+ * Values reference the producer's buffers and are only valid during the call,
+ * so consumers that keep rows copy only what they need.
+ */
+class ResultSink {
+ public:
+  virtual ~ResultSink() {}
+
+  /// Start a statement's rows, return false if the schema is not accepted.
+  virtual bool begin(const ColumnSchemaRef& schema) = 0;
+
+  /// Consume a row, one value for each column of the schema.
+  virtual void row(const ResultValue* values) = 0;
+
+  /// Check if the sink accepts no more rows, the producer stops and fails.
+  virtual bool full() const { return false; }
+};
+
+/**
+ * @brief A ResultSink appending each row to QueryData.
+ *
+ * The sink is full once the rows' values exceed an optional size limit.
+ */
+class QueryDataSink : public ResultSink {
+ public:
+  explicit QueryDataSink(QueryData& results, size_t max_bytes = 0)
+      : results_(results), max_bytes_(max_bytes) {}
+
+  bool begin(const ColumnSchemaRef& schema);
+  void row(const ResultValue* values);
+  bool full() const { return max_bytes_ > 0 && bytes_ > max_bytes_; }
+
+  /// Bytes of the values of every row.
+  size_t bytes() const { return bytes_; }
+
+ private:
+  QueryData& results_;
+  ColumnSchemaRef schema_{nullptr};
+  size_t max_bytes_;
+  size_t bytes_{0};
+};
+
+/**
+ * @brief A ResultSink appending each row to a ResultSet
+ *
+ * Every statement must have the same schema, unless the result set is empty.
+ * The sink is full once the rows' values exceed an optional size limit.
+ */
+class ResultSetSink : public ResultSink {
+ public:
+  explicit ResultSetSink(ResultSet& results, size_t max_bytes = 0)
+      : results_(results), max_bytes_(max_bytes) {}
+
+  bool begin(const ColumnSchemaRef& schema);
+  void row(const ResultValue* values);
+  bool full() const {
+    return max_bytes_ > 0 && results_.arenaSize() > max_bytes_;
+  }
+
+ private:
+  ResultSet& results_;
+  size_t max_bytes_;
+};
+
+/// Send the rows of a ResultSet to a sink, absent cells are empty values.
+void sendResultSet(const ResultSet& rs, ResultSink& sink);
+
 /////////////////////////////////////////////////////////////////////////////
 // DiffResults
 /////////////////////////////////////////////////////////////////////////////
@@ -162,9 +468,23 @@ struct DiffResults {
   /// vector of removed rows
   QueryData removed;
 
+  /**
+   * @brief Rows matched by their key columns with changed values.
+   *
+   * When the results have key columns, a removed and added row with the same
+   * key is reported as a changed row: the key columns and changed values.
+   */
+  QueryData changed;
+
+  /// Check if there are added, removed, or changed rows.
+  bool empty() const {
+    return added.empty() && removed.empty() && changed.empty();
+  }
+
   /// equals operator
   bool operator==(const DiffResults& comp) const {
-    return (comp.added == added) && (comp.removed == removed);
+    return (comp.added == added) && (comp.removed == removed) &&
+           (comp.changed == changed);
   }
 
   /// not equals operator
@@ -192,9 +512,49 @@ Status serializeDiffResults(const DiffResults& d, pt::ptree& tree);
  */
 Status serializeDiffResultsJSON(const DiffResults& d, std::string& json);
 
+/// A 64-bit hash of a Row's canonicalized column names and values.
+typedef uint64_t RowFingerprint;
+
+/// The fingerprints of each Row in a QueryData, in order.
+typedef std::vector<RowFingerprint> QueryDataFingerprints;
+
+/**
+ * @brief Compute the fingerprint of a Row
+ *
+ * Rows are ordered maps, so equal rows always produce equal fingerprints.
+ * The column name and value lengths are included to avoid ambiguous
+ * concatenations.
+ *
+ * @param r the Row to fingerprint
+ *
+ * @return the 64-bit row fingerprint
+ */
+RowFingerprint fingerprintRow(const Row& r);
+
+/// Compute the fingerprint of every Row in a QueryData.
+QueryDataFingerprints fingerprintQueryData(const QueryData& qd);
+
+/**
+ * @brief Compute the fingerprint of every row in a ResultSet
+ *
+ * Columns are visited in name order, and absent cells are skipped, so each
+ * fingerprint equals the fingerprintRow of the equivalent Row.
+ */
+QueryDataFingerprints fingerprintResultSet(const ResultSet& rs);
+
+/// Serialize a set of fingerprints into a compact binary string.
+std::string serializeFingerprints(const QueryDataFingerprints& fps);
+
+/// Inverse of serializeFingerprints.
+Status deserializeFingerprints(const std::string& raw,
+                               QueryDataFingerprints& fps);
+
 /**
  * @brief Diff two QueryData objects and create a DiffResults object
  *
+ * Rows are matched by fingerprint, then by value, so the differential is
+ * computed in O(n+m) expected time.
+ *
  * @param old_ the "old" set of results
  * @param new_ the "new" set of results
  *
@@ -204,6 +564,40 @@ Status serializeDiffResultsJSON(const DiffResults& d, std::string& json);
  */
 DiffResults diff(const QueryData& old_, const QueryData& new_);
 
+/**
+ * @brief Diff two QueryData objects using precomputed fingerprints
+ *
+ * @param old_ the "old" set of results
+ * @param old_fps the fingerprints of old_
+ * @param new_ the "new" set of results
+ * @param new_fps the fingerprints of new_
+ *
+ * @return a DiffResults object which indicates the change from old_ to new_
+ */
+DiffResults diff(const QueryData& old_,
+                 const QueryDataFingerprints& old_fps,
+                 const QueryData& new_,
+                 const QueryDataFingerprints& new_fps);
+
+/**
+ * @brief Diff two QueryData objects, reporting rows with the same key as
+ * changed rather than removed and added.
+ *
+ * Removed and added rows are matched by the values of the key columns. Rows
+ * without every key column, or whose key is not unique among the removed or
+ * added rows, are reported as removed and added. Without key columns this is
+ * the whole-row diff.
+ *
+ * @param keys the names of the key columns
+ *
+ * @return a DiffResults object which indicates the change from old_ to new_
+ */
+DiffResults diff(const QueryData& old_,
+                 const QueryDataFingerprints& old_fps,
+                 const QueryData& new_,
+                 const QueryDataFingerprints& new_fps,
+                 const std::vector<std::string>& keys);
+
 /**
  * @brief Add a Row to a QueryData if the Row hasn't appeared in the QueryData
  * already
@@ -234,6 +628,30 @@ bool addUniqueRowToQueryData(QueryData& q, const Row& r);
  */
 void escapeQueryData(const QueryData& oldData, QueryData& newData);
 
+/**
+ * @brief Escape the non-printable bytes of QueryData values in place.
+ *
+ * Only values that need escaping are replaced, printable values and the rows
+ * themselves are not copied.
+ *
+ * @param data the QueryData to escape
+ */
+void escapeQueryData(QueryData& data);
+
+/**
+ * @brief Check if escapeQueryData would change any value.
+ *
+ * Most results are printable ASCII, callers may use them directly instead of
+ * making an escaped copy.
+ *
+ * @param data the QueryData to check
+ * @return true if any value contains a byte that must be escaped
+ */
+bool queryDataNeedsEscaping(const QueryData& data);
+
+/// Check if escapeQueryData would change any value of a ResultSet's rows.
+bool resultSetNeedsEscaping(const ResultSet& rs);
+
 /**
  * @brief represents the relevant parameters of a scheduled query.
  *
@@ -250,23 +668,23 @@ struct ScheduledQuery {
   /// A temporary splayed internal.
   size_t splayed_interval;
 
-  /// Number of executions.
-  size_t executions;
+  /// Seconds before an execution is interrupted, 0 uses the default.
+  size_t timeout;
 
-  /// Total wall time taken
-  unsigned long long int wall_time;
+  /// The probability the query executes at each of its intervals.
+  double sampling;
 
-  /// Total user time (cycles)
-  unsigned long long int user_time;
+  /// The longest interval, in seconds, an unchanging query backs off to.
+  size_t max_interval;
 
-  /// Total system time (cycles)
-  unsigned long long int system_time;
+  /// Bytes of results an execution may hold, 0 uses the default.
+  size_t max_result_bytes;
 
-  /// Average memory differentials. This should be near 0.
-  unsigned long long int memory;
+  /// Percent of hosts, chosen by their host identifier, executing the query.
+  size_t shard;
 
-  /// Total characters, bytes, generated by query.
-  unsigned long long int output_size;
+  /// The worker class executing the query, empty for the default worker.
+  std::string worker;
 
   /// Set of query options.
   std::map<std::string, bool> options;
@@ -274,16 +692,19 @@ struct ScheduledQuery {
   ScheduledQuery()
       : interval(0),
         splayed_interval(0),
-        executions(0),
-        wall_time(0),
-        user_time(0),
-        system_time(0),
-        memory(0),
-        output_size(0) {}
+        timeout(0),
+        sampling(1.0),
+        max_interval(0),
+        max_result_bytes(0),
+        shard(100) {}
 
   /// equals operator
   bool operator==(const ScheduledQuery& comp) const {
-    return (comp.query == query) && (comp.interval == interval);
+    return (comp.query == query) && (comp.interval == interval) &&
+           (comp.timeout == timeout) && (comp.sampling == sampling) &&
+           (comp.max_interval == max_interval) &&
+           (comp.max_result_bytes == max_result_bytes) &&
+           (comp.shard == shard) && (comp.worker == worker);
   }
 
   /// not equals operator
@@ -378,6 +799,76 @@ Status serializeQueryLogItemAsEvents(const QueryLogItem& item, pt::ptree& tree);
 Status serializeQueryLogItemAsEventsJSON(const QueryLogItem& i,
                                          std::string& json);
 
+/**
+ * @brief Serialize a QueryLogItem's differential results as columns.
+ *
+ * The log item's metadata and the column names are written once, and each
+ * added and removed row is a list of values in column order. Rows without a
+ * column report an empty value.
+ *
+ * With delta encoding, every row after the first in a list is an object of
+ * only the values that differ from the previous row, keyed by column index.
+ *
+ * @param i the QueryLogItem to serialize
+ * @param json the output JSON string
+ * @param delta omit values that are equal to the previous row's
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status serializeQueryLogItemAsColumnsJSON(const QueryLogItem& i,
+                                          std::string& json,
+                                          bool delta = false);
+
+/// Inverse of serializeQueryLogItemAsColumnsJSON, with or without deltas.
+Status deserializeQueryLogItemColumnsJSON(const std::string& json,
+                                          QueryLogItem& item);
+
+/**
+ * @brief A set of puts and removes applied to the backing store together.
+ *
+ * Components performing many small writes should combine them into a batch.
+ * A backing store applies the operations in order, and atomically with a
+ * single commit when the store supports it.
+ */
+class DatabaseBatch {
+ public:
+  /// A single put, or remove, within a batch.
+  struct Operation {
+    std::string domain;
+    std::string key;
+    std::string value;
+    bool remove;
+  };
+
+ public:
+  /// Add a put of a value for a domain and key.
+  void put(const std::string& domain,
+           const std::string& key,
+           const std::string& value) {
+    operations_.push_back({domain, key, value, false});
+  }
+
+  /// Add a removal of a domain and key.
+  void remove(const std::string& domain, const std::string& key) {
+    operations_.push_back({domain, key, "", true});
+  }
+
+  /// The ordered list of batched operations.
+  const std::vector<Operation>& operations() const { return operations_; }
+
+  /// The number of batched operations.
+  size_t size() const { return operations_.size(); }
+
+  /// Check if the batch has no operations.
+  bool empty() const { return operations_.empty(); }
+
+  /// Remove every batched operation.
+  void clear() { operations_.clear(); }
+
+ private:
+  std::vector<Operation> operations_;
+};
+
 /**
  * @brief An osquery backing storage (database) type that persists executions.
  *
@@ -434,6 +925,32 @@ class DatabasePlugin : public Plugin {
     return Status(0, "Not used");
   }
 
+  /**
+   * @brief Key/index lookup bounded by a key prefix and a result count.
+   *
+   * The default implementation filters the results of an unbounded scan.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param results The output keys beginning with prefix.
+   * @param prefix Only return keys beginning with this prefix.
+   * @param max The maximum number of keys to return, 0 for no limit.
+   */
+  virtual Status scan(const std::string& domain,
+                      std::vector<std::string>& results,
+                      const std::string& prefix,
+                      size_t max) const;
+
+  /**
+   * @brief Apply a batch of puts and removes.
+   *
+   * The default implementation applies each operation in order using put and
+   * remove. Backing stores supporting atomic batches should override this.
+   *
+   * @param batch The set of operations.
+   * @return Failure if any operation could not be applied.
+   */
+  virtual Status write(const DatabaseBatch& batch);
+
  public:
   Status call(const PluginRequest& request, PluginResponse& response);
 };
@@ -477,6 +994,20 @@ Status deleteDatabaseValue(const std::string& domain, const std::string& key);
 Status scanDatabaseKeys(const std::string& domain,
                         std::vector<std::string>& keys);
 
+/// Get a list of at most max (0 for all) keys beginning with a prefix.
+Status scanDatabaseKeys(const std::string& domain,
+                        std::vector<std::string>& keys,
+                        const std::string& prefix,
+                        size_t max = 0);
+
+/**
+ * @brief Apply a batch of puts and removes to the active DatabasePlugin.
+ *
+ * @param batch The set of operations, applied in order.
+ * @return Storage operation status.
+ */
+Status writeDatabaseBatch(const DatabaseBatch& batch);
+
 /// Generate a specific-use registry for database access abstraction.
 CREATE_REGISTRY(DatabasePlugin, "database");
 }
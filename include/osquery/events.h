@@ -10,9 +10,11 @@
 
 #pragma once
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <map>
+#include <set>
 #include <vector>
 
 #include <boost/make_shared.hpp>
@@ -30,6 +32,9 @@ struct Subscription;
 template <class SC, class EC> class EventPublisher;
 template <class PUB> class EventSubscriber;
 class EventFactory;
+class EventQueue;
+class SubscriberQueue;
+struct EventDelivery;
 
 typedef const std::string EventPublisherID;
 typedef const std::string EventSubscriberID;
@@ -38,6 +43,31 @@ typedef uint32_t EventContextID;
 typedef uint32_t EventTime;
 typedef std::pair<EventID, EventTime> EventRecord;
 
+/**
+ * @brief Retention limits for an EventSubscriber's records, 0 for no limit.
+ *
+ * Limits are read from the "events" config key. When a limit is exceeded the
+ * oldest partitions of records are removed, see kEventPartitionSeconds.
+ */
+struct EventRetention {
+  /// Seconds to keep records, replacing the events_expiry flag.
+  size_t max_age;
+  /// The number of events kept.
+  size_t max_events;
+  /// The serialized size of the records kept.
+  size_t max_bytes;
+
+  EventRetention() : max_age(0), max_events(0), max_bytes(0) {}
+};
+
+/// The number of events and serialized bytes stored within a time partition.
+struct EventUsage {
+  size_t events;
+  size_t bytes;
+
+  EventUsage() : events(0), bytes(0) {}
+};
+
 /**
  * @brief An EventPublisher will define a SubscriptionContext for
  * EventSubscriber%s to use.
@@ -70,7 +100,15 @@ struct EventContext {
   /// The string representation of the time, often used for indexing.
   std::string time_string;
 
-  EventContext() : id(0), time(0) {}
+  /// The number of identical events coalesced into this event.
+  size_t count;
+  /// The time of the first coalesced event, time is the last event's time.
+  EventTime first_time;
+  /// A coalesced event is only fired to the Subscription that held it.
+  const Subscription* subscription;
+
+  EventContext()
+      : id(0), time(0), count(1), first_time(0), subscription(nullptr) {}
 };
 
 typedef std::shared_ptr<Subscription> SubscriptionRef;
@@ -113,9 +151,6 @@ typedef std::function<Status(const EventContextRef&, const void*)>
 /// An EventPublisher must track every subscription added.
 typedef std::vector<SubscriptionRef> SubscriptionVector;
 
-/// The set of search-time binned lookup tables.
-extern const std::vector<size_t> kEventTimeLists;
-
 /**
  * @brief DECLARE_PUBLISHER supplies needed boilerplate code that applies a
  * string-type EventPublisherID to identify the publisher declaration.
@@ -214,11 +249,47 @@ class EventPublisherPlugin : public Plugin {
   /**
    * @brief Implement a "step" of an optional run loop.
    *
+   * A step should block until it has events, `run` is called again as soon
+   * as it returns. Publishers with a pollable handle implement `process`.
+   *
    * @return A SUCCESS status will immediately call `run` again. A FAILED status
    * will exit the run loop and the thread.
    */
   virtual Status run() { return Status(1, "No run loop required"); }
 
+  /**
+   * @brief A descriptor that becomes readable when the publisher has events.
+   *
+   * Publishers with a pollable handle do not need a run loop thread. A single
+   * event loop waits on the handles of every such publisher, and calls
+   * `process` when a handle is readable or a publisher's timeout passes.
+   *
+   * @return The handle, or -1 if the publisher implements `run`.
+   */
+  virtual int getPollHandle() const { return -1; }
+
+  /**
+   * @brief Handle every pending event without blocking.
+   *
+   * @return A FAILED status stops the publisher and calls tearDown.
+   */
+  virtual Status process() { return Status(1, "No pollable handle"); }
+
+  /// Milliseconds until `process` is needed without events, -1 for none.
+  virtual int getPollTimeout() { return -1; }
+
+  /**
+   * @brief Schedule callback-driven event sources on a shared run loop.
+   *
+   * Publishers whose events arrive in callbacks on a platform run loop, such
+   * as a CFRunLoop, may attach to one loop shared by every publisher instead
+   * of running their own. An attached publisher has no thread, it removes its
+   * sources in tearDown and must not stop the shared loop.
+   *
+   * @return A FAILED status if the publisher needs a thread for `run`.
+   */
+  virtual Status attach() { return Status(1, "No shared run loop"); }
+
   /**
    * @brief Allow the EventFactory to interrupt the run loop.
    *
@@ -249,11 +320,27 @@ class EventPublisherPlugin : public Plugin {
    * It is NOT recommended to override `fire`. The simple logic of enumerating
    * the Subscription%s and using `shouldFire` is more appropriate.
    *
+   * When the publisher's run loop is started by the EventFactory, fired events
+   * are added to a bounded queue and the Subscription callbacks are called
+   * from a dispatch thread, so slow subscribers do not stall the publisher.
+   * Events fired while the queue is full are dropped and counted.
+   *
    * @param ec The EventContext created and fired by the EventPublisher.
    * @param time The most accurate time associated with the event.
    */
   void fire(const EventContextRef& ec, EventTime time = 0);
 
+  /**
+   * @brief Fire the events read from a single OS API callback or read.
+   *
+   * Equivalent to calling `fire` for each event in order, but the event IDs
+   * are reserved and the time is found once for the batch.
+   *
+   * @param ecs The EventContext%s created by the EventPublisher.
+   * @param time The time of events without their own time.
+   */
+  void fireBatch(const std::vector<EventContextRef>& ecs, EventTime time = 0);
+
   /// Number of Subscription%s watching this EventPublisher.
   size_t numSubscriptions() const { return subscriptions_.size(); }
 
@@ -264,8 +351,24 @@ class EventPublisherPlugin : public Plugin {
    */
   size_t numEvents() const { return next_ec_id_; }
 
+  /// The number of fired events dropped because the queue was full.
+  size_t numDropped() const { return dropped_; }
+
+  /// The number of fired events waiting for the dispatch thread.
+  size_t numQueued() const;
+
+  /// The most events waiting for the dispatch thread at once.
+  size_t peakQueued() const { return peak_queued_; }
+
   /// Overriding the EventPublisher constructor is not recommended.
-  EventPublisherPlugin() : next_ec_id_(0), ending_(false), started_(false) {};
+  EventPublisherPlugin()
+      : next_ec_id_(0),
+        ending_(false),
+        started_(false),
+        attached_(false),
+        dispatching_(false),
+        dropped_(0),
+        peak_queued_(0) {};
   virtual ~EventPublisherPlugin() {}
 
   /// Return a string identifier associated with this EventPublisher.
@@ -283,11 +386,37 @@ class EventPublisherPlugin : public Plugin {
   /// Set the run or started status for this publisher.
   void hasStarted(bool started) { started_ = started; }
 
+  /// Check if the publisher's sources are on a shared run loop.
+  bool isAttached() const { return attached_; }
+
  protected:
   /// The internal fire method used by the typed EventPublisher.
   virtual void fireCallback(const SubscriptionRef& sub,
                             const EventContextRef& ec) const = 0;
 
+  /// The internal match used when a subscriber's thread calls the callback.
+  virtual bool shouldFireCallback(const SubscriptionRef& sub,
+                                  const EventContextRef& ec) const = 0;
+
+  /// Call each Subscription's callback for a fired event.
+  void dispatch(const EventContextRef& ec);
+
+  /**
+   * @brief Select the Subscription%s that may match a fired event.
+   *
+   * Publishers with many Subscription%s may index them in `configure`, then
+   * `dispatch` only checks the selected candidates with `shouldFire`.
+   *
+   * @param ec The event that was fired.
+   * @param matches The output candidate Subscription%s.
+   *
+   * @return false if every Subscription should be checked.
+   */
+  virtual bool matchSubscriptions(const EventContextRef& ec,
+                                  SubscriptionVector& matches) const {
+    return false;
+  }
+
   /// The EventPublisher will keep track of Subscription%s that contain callins.
   SubscriptionVector subscriptions_;
 
@@ -306,12 +435,49 @@ class EventPublisherPlugin : public Plugin {
   /// Set to indicate whether the event run loop ever started.
   bool started_;
 
+  /// Set when `attach` scheduled the publisher on a shared run loop.
+  bool attached_;
+
   /// A lock for incrementing the next EventContextID.
   boost::mutex ec_id_lock_;
 
  private:
+  /// Queue fired events and start a dispatch thread for the subscribers.
+  void startDispatch(size_t capacity);
+
+  /// Stop the dispatch thread and dispatch any remaining queued events.
+  void stopDispatch();
+
+  /// Start or stop the callback queue of each subscriber.
+  void setSubscriberQueues(bool start);
+
+  /// Assign the ID and time of a fired event, then queue or dispatch it.
+  void enqueue(const EventContextRef& ec, EventContextID ec_id, EventTime time);
+
+  /// The dispatch thread's entry-point.
+  void dispatchQueue();
+
+  /// Events fired from the publisher waiting for the dispatch thread.
+  std::shared_ptr<EventQueue> queue_;
+
+  /// The dispatch thread, calling Subscription callbacks.
+  std::shared_ptr<boost::thread> dispatcher_;
+
+  /// Set while the dispatch thread is consuming the queue.
+  std::atomic<bool> dispatching_;
+
+  /// Backpressure accounting for the queue.
+  std::atomic<size_t> dropped_;
+  std::atomic<size_t> peak_queued_;
+
+ private:
+  friend class EventFactory;
   FRIEND_TEST(EventsTests, test_event_pub);
   FRIEND_TEST(EventsTests, test_fire_event);
+  FRIEND_TEST(EventsTests, test_fire_queued_event);
+  FRIEND_TEST(EventsTests, test_fire_queue_drops);
+  FRIEND_TEST(EventsTests, test_subscriber_queue);
+  FRIEND_TEST(EventsTests, test_subscriber_queue_shed);
 };
 
 /**
@@ -398,6 +564,13 @@ class EventPublisher : public EventPublisherPlugin {
     }
   }
 
+  /// Up-cast the contexts and check `shouldFire` without the callback.
+  bool shouldFireCallback(const SubscriptionRef& sub,
+                          const EventContextRef& ec) const {
+    return shouldFire(getSubscriptionContext(sub->context),
+                      getEventContext(ec));
+  }
+
  protected:
   /**
    * @brief The generic `fire` will call `shouldFire` for each Subscription.
@@ -437,6 +610,19 @@ class EventSubscriberPlugin : public Plugin {
    */
   virtual Status add(const osquery::Row& r, EventTime time) final;
 
+  /**
+   * @brief Store several parsed events that occurred at the same time.
+   *
+   * The rows are stored as a single column-major, compressed block, with
+   * dictionaries for columns with repeated values.
+   *
+   * @param rows The osquery Row elements.
+   * @param time The time the added events occurred.
+   *
+   * @return Were the elements added to the backing store.
+   */
+  virtual Status addBatch(const std::vector<Row>& rows, EventTime time) final;
+
   /**
    * @brief Return all events added by this EventSubscriber within start, stop.
    *
@@ -448,19 +634,31 @@ class EventSubscriberPlugin : public Plugin {
    */
   virtual QueryData get(EventTime start, EventTime stop);
 
+  /**
+   * @brief Yield the events added by this EventSubscriber within start, stop.
+   *
+   * Records are read in time order and in chunks, only records within the
+   * range are decoded. Reading stops when the yield returns false.
+   *
+   * @param start Inclusive lower bound time limit.
+   * @param stop Inclusive upper bound time limit, 0 for no limit.
+   * @param yield The row sink.
+   */
+  void get(EventTime start, EventTime stop, const RowYield& yield);
+
  private:
   /*
-   * @brief When `get`ing event results, return EventID%s from time indexes.
+   * @brief Return the EventID, EventTime records within start, stop.
    *
-   * Used by EventSubscriber::get to retrieve EventID, EventTime indexes. This
-   * applies the lookup-efficiency checks for time list appropriate bins.
-   * If the time range in 24 hours and there is a 24-hour list bin it will
-   * be queried using a single backing store `Get` followed by two `Get`s of
-   * the most-specific boundary lists.
+   * Records are stored with time-ordered keys, a time range is a single
+   * backing store range iteration. A record added with addBatch is a block
+   * of rows, and uses the block's first EventID.
    *
-   * @return List of EventID, EventTime%s
+   * @param start Inclusive lower bound time limit.
+   * @param stop Inclusive upper bound time limit, 0 for no limit.
+   * @return List of EventID, EventTime%s in time order.
    */
-  std::vector<EventRecord> getRecords(const std::vector<std::string>& indexes);
+  std::vector<EventRecord> getRecords(EventTime start, EventTime stop);
 
   /**
    * @brief Get a unique storage-related EventID.
@@ -473,50 +671,57 @@ class EventSubscriberPlugin : public Plugin {
    * indexing is required within-EventCallback consider an
    * EventSubscriber%-unique indexing, counting mechanic.
    *
+   * IDs are allocated from an in-memory counter. The backing store only
+   * records the end of each reserved block of IDs, so a restart continues
+   * after the last reservation.
+   *
    * @return A unique ID for backing storage.
    */
   EventID getEventID();
 
   /**
-   * @brief Plan the best set of indexes for event record access.
+   * @brief Remove every record that occurred before an expire time.
    *
-   * @param start an inclusive time to begin searching.
-   * @param stop an inclusive time to end searching.
-   * @param list_key optional key to bind to a specific index binning.
+   * @param expire_time records with an earlier EventTime are removed.
    *
-   * @return List of 'index.step' index strings.
+   * @return status if the records were removed.
    */
-  std::vector<std::string> getIndexes(EventTime start,
-                                      EventTime stop,
-                                      int list_key = 0);
+  Status expireRecords(EventTime expire_time);
 
-  /**
-   * @brief Expire indexes and eventually records.
-   *
-   * @param list_type the string representation of list binning type.
-   * @param indexes complete set of 'index.step' indexes for the list_type.
-   * @param expirations of the indexes, the set to expire.
-   *
-   * @return status if the indexes and records were removed.
-   */
-  Status expireIndexes(const std::string& list_type,
-                       const std::vector<std::string>& indexes,
-                       const std::vector<std::string>& expirations);
+  /// Remove the bin lists and data written by previous event store versions.
+  void expireLegacyRecords();
 
   /**
-   * @brief Add an EventID, EventTime pair to all matching list types.
-   *
-   * The list types are defined by time size. Based on the EventTime this pair
-   * is added to the list bin for each list type. If there are two list types:
-   * 60 seconds and 3600 seconds and `time` is 92, this pair will be added to
-   * list type 1 bin 4 and list type 2 bin 1.
+   * @brief Remove records older than the retention age or beyond its quotas.
    *
-   * @param eid A unique EventID.
-   * @param time The time when this EventID%'s event occurred.
-   *
-   * @return Were the indexes recorded.
+   * The quotas are enforced by removing the oldest partitions of records,
+   * the newest partition is always kept.
    */
-  Status recordEvent(EventID& eid, EventTime time);
+  void expire();
+
+  /// The expire time for the retention age or the events_expiry flag.
+  EventTime getAgeExpireTime(const EventRetention& retention) const;
+
+  /// The expire time removing the oldest partitions exceeding the quotas.
+  EventTime getQuotaExpireTime(const EventRetention& retention);
+
+  /// Read the partition usage from the backing store, once.
+  void loadUsage();
+
+  /// The key for a partition's usage: "usage.<namespace>.<partition>".
+  std::string usageKey(EventTime partition) const;
+
+  /// Iterate the record keys, and optionally data, within start, stop.
+  Status scanRecords(EventTime start,
+                     EventTime stop,
+                     bool values,
+                     std::vector<std::pair<std::string, std::string>>& records);
+
+  /// The key prefix shared by every record for this subscriber.
+  std::string recordPrefix() const;
+
+  /// The time-ordered key for an event record: prefix, time, then EventID.
+  std::string recordKey(EventTime time, const std::string& eid) const;
 
  public:
   /**
@@ -530,6 +735,11 @@ class EventSubscriberPlugin : public Plugin {
   EventSubscriberPlugin() {
     expire_events_ = true;
     expire_time_ = 0;
+    legacy_expired_ = false;
+    eid_loaded_ = false;
+    eid_next_ = 0;
+    eid_reserved_ = 0;
+    usage_loaded_ = false;
   }
   virtual ~EventSubscriberPlugin() {}
 
@@ -543,9 +753,41 @@ class EventSubscriberPlugin : public Plugin {
    * @return The query-time table data, retrieved from a backing store.
    */
   virtual QueryData genTable(QueryContext& context) __attribute__((used)) {
-    return get(0, 0);
+    QueryData results;
+    genTable(context, [&results](Row& r) {
+      results.push_back(std::move(r));
+      return true;
+    });
+    return results;
   }
 
+  /**
+   * @brief Streaming entrypoint for table generation.
+   *
+   * Constraints on the `time` column select the range of records read from
+   * the backing store, for example `WHERE time > <now> - 60` only decodes
+   * the last minute of events.
+   *
+   * @param context The query context, its time constraints bound the read.
+   * @param yield The row sink.
+   */
+  virtual void genTable(QueryContext& context, const RowYield& yield);
+
+  /**
+   * @brief Convert the `time` constraints of a query into a record range.
+   *
+   * @param context The query context.
+   * @param start Output inclusive lower bound time.
+   * @param stop Output inclusive upper bound time, 0 for no limit.
+   * @return false if no record time can match the constraints.
+   */
+  static bool getTimeRange(const QueryContext& context,
+                           EventTime& start,
+                           EventTime& stop);
+
+  /// The events and bytes stored for this subscriber.
+  EventUsage getUsage();
+
  protected:
   /// Backing storage indexing namespace definition methods.
   EventPublisherID dbNamespace() const { return type() + "." + getName(); }
@@ -556,6 +798,25 @@ class EventSubscriberPlugin : public Plugin {
   /// Disable event expiration for this subscriber.
   void doNotExpire() { expire_events_ = false; }
 
+ public:
+  /// The number of matched events waiting for the subscriber's callbacks.
+  size_t numQueued() const;
+
+  /// The number of matched events dropped, or shed, before their callbacks.
+  size_t numDropped() const { return dropped_; }
+
+  /// Milliseconds the last event waited for the subscriber's callback.
+  size_t lag() const { return lag_; }
+
+  /// The most milliseconds an event waited for the subscriber's callback.
+  size_t peakLag() const { return peak_lag_; }
+
+  /// Check if the subscriber's events are shed while queues back up.
+  bool isLowPriority() const { return low_priority_; }
+
+  /// Set if the subscriber's events are shed while queues back up.
+  void isLowPriority(bool low_priority) { low_priority_ = low_priority; }
+
  private:
   EventSubscriberPlugin(EventSubscriberPlugin const&);
   EventSubscriberPlugin& operator=(EventSubscriberPlugin const&);
@@ -568,19 +829,85 @@ class EventSubscriberPlugin : public Plugin {
   bool expire_events_;
 
   /// Events before the expire_time_ are invalid and will be purged.
-  EventTime expire_time_;
+  std::atomic<EventTime> expire_time_;
 
-  /// Lock used when incrementing the EventID database index.
+  /// Set after records from previous event store versions are removed.
+  bool legacy_expired_;
+
+  /// Lock used when loading or reserving EventID%s in the database.
   boost::mutex event_id_lock_;
 
-  /// Lock used when recording an EventID and time into search bins.
-  boost::mutex event_record_lock_;
+  /// Set once the last EventID reservation was read from the database.
+  std::atomic<bool> eid_loaded_;
+
+  /// The last EventID allocated.
+  std::atomic<size_t> eid_next_;
+
+  /// The last EventID reserved in the database.
+  std::atomic<size_t> eid_reserved_;
+
+  /// Lock used when loading or updating the partition usage.
+  boost::mutex usage_lock_;
+
+  /// Set once the partition usage was read from the database.
+  bool usage_loaded_;
+
+  /// Usage of each partition of records, by the partition's first time.
+  std::map<EventTime, EventUsage> partitions_;
+
+ private:
+  /// Queue matched events and start a thread calling their callbacks.
+  void startQueue(size_t capacity);
+
+  /// Stop the callback thread and call any remaining queued callbacks.
+  void stopQueue();
+
+  /**
+   * @brief Queue an event matched by one of the subscriber's Subscription%s.
+   *
+   * @param shed Drop the event if the subscriber is low priority.
+   * @return false if the event was dropped.
+   */
+  bool deliver(const SubscriptionRef& sub,
+               const EventContextRef& ec,
+               bool shed);
+
+  /// Call a queued event's callback and account for its lag.
+  void callback(const EventDelivery& delivery);
+
+  /// The callback thread's entry-point.
+  void consumeQueue();
+
+  /// Matched events waiting for the callback thread.
+  std::shared_ptr<SubscriberQueue> queue_;
+
+  /// The callback thread.
+  std::shared_ptr<boost::thread> consumer_;
+
+  /// Set while the callback thread is consuming the queue.
+  std::atomic<bool> consuming_{false};
+
+  /// Set if the subscriber's events are shed while queues back up.
+  std::atomic<bool> low_priority_{false};
+
+  /// Backpressure and lag accounting for the queue.
+  std::atomic<size_t> dropped_{0};
+  std::atomic<size_t> lag_{0};
+  std::atomic<size_t> peak_lag_{0};
 
  private:
   FRIEND_TEST(EventsDatabaseTests, test_event_module_id);
-  FRIEND_TEST(EventsDatabaseTests, test_record_indexing);
+  FRIEND_TEST(EventsDatabaseTests, test_event_id_concurrency);
+  FRIEND_TEST(EventsDatabaseTests, test_record_keys);
   FRIEND_TEST(EventsDatabaseTests, test_record_range);
   FRIEND_TEST(EventsDatabaseTests, test_record_expiration);
+  FRIEND_TEST(EventsDatabaseTests, test_expire);
+  FRIEND_TEST(EventsDatabaseTests, test_add_batch);
+  FRIEND_TEST(EventsDatabaseTests, test_retention);
+  FRIEND_TEST(EventsTests, test_subscriber_queue);
+  FRIEND_TEST(EventsTests, test_subscriber_queue_shed);
+  friend class EventFactory;
+  friend class EventPublisherPlugin;
 };
 
 /**
@@ -709,13 +1036,33 @@ class EventFactory : private boost::noncopyable {
   static std::vector<std::string> publisherTypes();
   static std::vector<std::string> subscriberNames();
 
+  /// Replace the retention limits, by EventSubscriber name, from the config.
+  static void setRetention(const std::map<std::string, EventRetention>& limits);
+
+  /// The retention limits for an EventSubscriber.
+  static EventRetention getRetention(const std::string& name);
+
+  /// Replace the EventSubscriber%s whose events are shed under load.
+  static void setLowPriority(const std::set<std::string>& names);
+
  public:
   /// The dispatched event thread's entry-point (if needed).
   static Status run(EventPublisherID& type_id);
 
-  /// An initializer's entry-point for spawning all event type run loops.
+  /**
+   * @brief An initializer's entry-point for spawning all event type run loops.
+   *
+   * Publishers with a pollable handle share a single event loop thread, every
+   * other publisher runs in its own thread.
+   */
   static void delay();
 
+  /// Wake the event loops, each recomputes its publishers' poll timeouts.
+  static void wake();
+
+  /// Remove expired records for every EventSubscriber.
+  static void expire();
+
   /// If a static EventPublisher callback wants to fire
   template <typename PUB>
   static void fire(const EventContextRef& ec) {
@@ -723,6 +1070,13 @@ class EventFactory : private boost::noncopyable {
     event_pub->fire(ec);
   }
 
+  /// Fire a batch of events from a static EventPublisher callback.
+  template <typename PUB>
+  static void fireBatch(const std::vector<EventContextRef>& ecs) {
+    auto event_pub = getEventPublisher(BaseEventPublisher::getType<PUB>());
+    event_pub->fireBatch(ecs);
+  }
+
   /**
    * @brief End all EventPublisher run loops and deregister.
    *
@@ -751,6 +1105,35 @@ class EventFactory : private boost::noncopyable {
 
   /// Set of running EventPublisher run loop threads.
   std::vector<std::shared_ptr<boost::thread> > threads_;
+
+  /// Expires records every events_expiry_interval, independent of queries.
+  std::shared_ptr<boost::thread> expire_thread_;
+
+  /// The wake handle of each running event loop.
+  std::set<int> wake_handles_;
+
+  /// Event loops start and stop while publishers wake them.
+  boost::mutex wake_lock_;
+
+  /// Retention limits by EventSubscriber name.
+  std::map<std::string, EventRetention> retention_;
+
+  /// EventSubscriber%s whose events are shed under load, from the config.
+  std::set<std::string> low_priority_;
+
+  /// The config updates retention limits while subscribers expire records.
+  boost::mutex retention_lock_;
+
+ private:
+  /// The expiration service's entry-point.
+  static void expireLoop();
+
+  /// Wait on the handles of publishers and process each as it is readable.
+  static Status runEventLoop(std::vector<EventPublisherRef> publishers);
+
+  /// Stop dispatching, tear down, and remove a publisher after its loop.
+  static void endPublisher(const EventPublisherRef& publisher,
+                           const Status& status);
 };
 
 /**
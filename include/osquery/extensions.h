@@ -25,6 +25,9 @@ DECLARE_bool(disable_extensions);
 /// A millisecond internal applied to extension initialization.
 extern const size_t kExtensionInitializeLatencyUS;
 
+/// The extensions_timeout in microseconds, at least ten initialization pings.
+size_t getExtensionsTimeout();
+
 /**
  * @brief Helper struct for managing extenion metadata.
  *
@@ -141,6 +144,25 @@ Status callExtension(const std::string& extension_path,
                      const PluginRequest& request,
                      PluginResponse& response);
 
+/// A table plugin name and its generate request.
+typedef std::pair<std::string, PluginRequest> TableRequest;
+
+/**
+ * @brief Generate several tables exposed by an Extension in one round trip.
+ *
+ * Rows are returned by column, so column names are sent once per table
+ * rather than once per row. Extensions built before the batched API are
+ * called once for each table.
+ *
+ * @param extension_path The Extension's UNIX domain socket path.
+ * @param requests The table plugin names and generate requests.
+ * @param responses The rows of each table, in request order.
+ * @return Success if every table was generated.
+ */
+Status callExtensionTables(const std::string& extension_path,
+                           const std::vector<TableRequest>& requests,
+                           std::vector<PluginResponse>& responses);
+
 /// The main runloop entered by an Extension, start an ExtensionRunner thread.
 Status startExtension(const std::string& name, const std::string& version);
 
@@ -10,14 +10,21 @@
 
 #pragma once
 
+#include <functional>
+#include <iterator>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <vector>
 
+#include <sys/stat.h>
+
 #include <boost/filesystem/path.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/property_tree/ptree.hpp>
 
+#include <osquery/database.h>
 #include <osquery/status.h>
 
 namespace osquery {
@@ -32,6 +39,29 @@ enum {
   GLOB_ALL = GLOB_FILES | GLOB_FOLDERS,
 };
 
+/// Called with each resolved path, returning false stops the resolution.
+typedef std::function<bool(const std::string&)> GlobYield;
+
+/// Options for resolving a filesystem pattern.
+struct GlobOptions {
+  /// Return files, folders, or both.
+  GlobLimits limits{GLOB_ALL};
+
+  /// Levels of subdirectories expanded by a recursive wildcard.
+  size_t max_depth{kMaxDirectoryTraversalDepth};
+
+  /// Stop after this many paths, 0 for no limit.
+  size_t max_results{0};
+
+  /**
+   * @brief Threads expanding the subdirectories of a recursive wildcard.
+   *
+   * Each subdirectory's paths are buffered by its thread, then yielded in
+   * order by the calling thread.
+   */
+  size_t threads{1};
+};
+
 /// Globbing wildcard character.
 const std::string kWildcardCharacter = "%";
 /// Globbing wildcard recursive character (double wildcard).
@@ -84,6 +114,74 @@ Status isReadable(const boost::filesystem::path& path);
  */
 Status pathExists(const boost::filesystem::path& path);
 
+/**
+ * @brief Identify the content of a regular file by its inode, size, and times.
+ *
+ * The identity combines the device, inode, size, mtime, and ctime of a file.
+ * A write changes the size, mtime, or ctime and a replaced file has a new
+ * inode, so results cached with an identity are valid while it matches.
+ *
+ * @param path The file path.
+ * @param identity Output identity of the file.
+ * @return Failure if the path cannot be stat'd or is not a regular file.
+ */
+Status getFileIdentity(const boost::filesystem::path& path,
+                       std::string& identity);
+
+/// Generate rows from the content of a file.
+typedef std::function<void(const std::string& content, QueryData& results)>
+    FileRowGenerator;
+
+/**
+ * @brief Generate rows from a file, reusing the rows of an unchanged file.
+ *
+ * Rows are cached by path with the file's identity. While the identity
+ * matches the file is only stat'd, otherwise it is read and the generator
+ * parses its content. Tables that re-parse small configuration files on every
+ * query, such as /etc/hosts, should read them through this.
+ *
+ * Cached rows are bounded by --table_cache_max_bytes, when full the cache is
+ * emptied.
+ *
+ * @param path The file path.
+ * @param generator Appends the rows parsed from the file's content.
+ * @param results Output rows, appended to.
+ * @return Failure if the file cannot be identified or read.
+ */
+Status genParsedFile(const boost::filesystem::path& path,
+                     const FileRowGenerator& generator,
+                     QueryData& results);
+
+/// Remove the cached rows of every parsed file.
+void clearParsedFileCache();
+
+/**
+ * @brief Read the complete lines appended to a file since the last read.
+ *
+ * The file's inode and the offset after the last complete line read are kept
+ * in the backing store for each tail name and path. A replaced or truncated
+ * file is read after the line matching the last line read, or from its end
+ * if none matches, so rewritten lines are not read again. A trailing line
+ * without a newline is read once the newline is written.
+ *
+ * @param name The consumer of the lines, each name keeps its own offset.
+ * @param path The append-only file.
+ * @param lines Output lines, without their newlines.
+ * @return Failure if the file cannot be read.
+ */
+Status readTailedFile(const std::string& name,
+                      const boost::filesystem::path& path,
+                      std::vector<std::string>& lines);
+
+/**
+ * @brief Start tailing a file at its current end, if it was not tailed.
+ *
+ * Consumers that report appended lines as events use this so the existing
+ * content is not reported.
+ */
+Status initTailedFile(const std::string& name,
+                      const boost::filesystem::path& path);
+
 /**
  * @brief List all of the files in a specific directory, non-recursively.
  *
@@ -127,11 +225,14 @@ Status listDirectoriesInDirectory(const boost::filesystem::path& path,
  *   }
  * @endcode
  *
+ * Each level of a recursive (double star) pattern checks if the calling
+ * thread's query was cancelled, see QueryCancellation.
+ *
  * @param fs_path The filesystem pattern
  * @param results The vector in which all results will be returned
  *
  * @return An instance of osquery::Status which indicates the success or
- * failure of the operation
+ * failure of the operation, failure if the query was cancelled
  */
 Status resolveFilePattern(const boost::filesystem::path& fs_path,
                           std::vector<std::string>& results);
@@ -160,6 +261,106 @@ Status resolveFilePattern(const boost::filesystem::path& fs_path,
                           std::vector<std::string>& results,
                           GlobLimits setting);
 
+/**
+ * @brief Resolve a wildcard filesystem pattern, yielding each path.
+ *
+ * Paths are yielded as directories are read, rather than collected first.
+ * Directories are walked relative to their parent's descriptor, entry types
+ * are read without a stat where the platform reports them, and a recursive
+ * wildcard does not descend into a directory linked from within itself.
+ *
+ * @code{.cpp}
+ *   GlobOptions options;
+ *   options.limits = GLOB_FILES;
+ *   options.max_results = 1000;
+ *   resolveFilePattern("/Users/%/Downloads/%%", [](const std::string& path) {
+ *     LOG(INFO) << path;
+ *     return true;
+ *   }, options);
+ * @endcode
+ *
+ * @param fs_path The filesystem pattern
+ * @param yield Called with each path, returning false stops the resolution
+ * @param options The limits of the resolution
+ *
+ * @return An instance of osquery::Status which indicates the success or
+ * failure of the operation, failure if the query was cancelled
+ */
+Status resolveFilePattern(const boost::filesystem::path& fs_path,
+                          const GlobYield& yield,
+                          const GlobOptions& options);
+
+/// An entry found while walking a directory tree.
+struct FileTreeEntry {
+  /// The entry's path, the root joined with each directory name.
+  std::string path;
+
+  /// The entry's own status, symlinks are not followed.
+  struct stat status;
+
+  /// Entries within the root are at depth 1.
+  size_t depth;
+};
+
+/**
+ * @brief Called with a walking thread's index and each entry it finds.
+ *
+ * Returning false stops the walk. Threads call the visitor concurrently, so
+ * callers keep results per thread index and merge them after the walk.
+ */
+typedef std::function<bool(size_t worker, const FileTreeEntry& entry)>
+    FileTreeVisitor;
+
+/// Options for walking a directory tree.
+struct FileTreeOptions {
+  /// Walking threads, 0 uses fileTreeThreadCount.
+  size_t threads{0};
+
+  /// Levels of subdirectories walked below the root.
+  size_t max_depth{kMaxDirectoryTraversalDepth};
+
+  /// Do not descend into directories on a different device than the root.
+  bool same_device{false};
+};
+
+/**
+ * @brief The number of threads a parallel scan uses.
+ *
+ * A nonzero flag value is used as set, otherwise the watchdog level chooses.
+ * The count is at most the number of cores.
+ *
+ * @param threads The scan's thread flag, 0 uses the watchdog level.
+ */
+size_t scanThreadCount(size_t threads);
+
+/**
+ * @brief The default number of threads walking a directory tree.
+ *
+ * Set by --crawl_threads, or the watchdog level, see scanThreadCount.
+ */
+size_t fileTreeThreadCount();
+
+/**
+ * @brief Walk every entry below a root directory.
+ *
+ * Each entry is stat'd once, relative to its parent's descriptor, and
+ * symlinks are neither followed nor descended into. Each thread walks its
+ * own queue of directories, newest first. An idle thread steals the oldest
+ * directory from another thread's queue, so one large subtree is shared out.
+ * An exception thrown by the visitor is rethrown on the calling thread.
+ *
+ * @param root The directory to walk, it may be a symlink.
+ * @param visitor Called once for every entry.
+ * @param options The limits of the walk.
+ *
+ * @return An instance of osquery::Status which indicates the success or
+ * failure of the operation, failure if the root is not a directory or the
+ * query was cancelled
+ */
+Status walkFileTree(const std::string& root,
+                    const FileTreeVisitor& visitor,
+                    const FileTreeOptions& options);
+
 /**
  * @brief Get directory portion of a path.
  *
@@ -259,6 +460,77 @@ Status parsePlist(const boost::filesystem::path& path,
  */
 Status parsePlistContent(const std::string& content,
                          boost::property_tree::ptree& tree);
+
+/**
+ * @brief Parse a property list on disk, reusing a previous parse.
+ *
+ * Parsed trees are cached by path and reused while the file's identity, see
+ * getFileIdentity, is unchanged. Tables reading many property lists on every
+ * query should use this instead of parsePlist.
+ *
+ * @param path the input path to a property list
+ * @param tree the output reference to a Boost property tree
+ *
+ * @return an instance of Status, indicating the success or failure
+ * of the operation.
+ */
+Status parsePlistCached(const boost::filesystem::path& path,
+                        boost::property_tree::ptree& tree);
+
+/// Drop cached property list parses for a path and the paths below it.
+void invalidatePlistCache(const std::string& path);
+#endif
+
+#if defined(__linux__) || defined(__FreeBSD__)
+/// Called with a shard index and pid from the shard's scanning thread.
+typedef std::function<void(size_t shard, const std::string& pid)>
+    ProcessIterator;
+
+/**
+ * @brief The number of shards procShardProcesses uses for a pid count.
+ *
+ * Small process lists are scanned on the calling thread. Otherwise the thread
+ * count is set by --proc_scan_threads, or the watchdog level.
+ */
+size_t procShardCount(size_t pids);
+
+/**
+ * @brief Iterate over a set of pids using a small pool of scanning threads.
+ *
+ * The ordered pids are split into procShardCount contiguous shards, each
+ * iterated in order by a single thread. Callers keep results per shard and
+ * merge them in shard order to preserve the pid order. An exception thrown by
+ * the iterator is rethrown on the calling thread after every shard finished.
+ *
+ * @param pids The process pids, usually from procProcesses.
+ * @param iterator Called once for every pid.
+ */
+void procShardProcesses(const std::set<std::string>& pids,
+                        const ProcessIterator& iterator);
+
+/**
+ * @brief Generate rows for a set of pids in parallel, in pid order.
+ *
+ * @param pids The process pids, usually from procProcesses.
+ * @param generator Called with a pid and the shard's rows to append to.
+ * @param results Output rows, merged from each shard.
+ */
+template <typename Rows, typename Generator>
+void procProcessRows(const std::set<std::string>& pids,
+                     const Generator& generator,
+                     Rows& results) {
+  std::vector<Rows> shards(procShardCount(pids.size()));
+  procShardProcesses(pids, [&shards, &generator](size_t shard,
+                                                  const std::string& pid) {
+    generator(pid, shards[shard]);
+  });
+
+  for (auto& shard : shards) {
+    results.insert(results.end(),
+                   std::make_move_iterator(shard.begin()),
+                   std::make_move_iterator(shard.end()));
+  }
+}
 #endif
 
 #ifdef __linux__
@@ -295,6 +567,98 @@ Status procReadDescriptor(const std::string& process,
                           const std::string& descriptor,
                           std::string& result);
 
+/**
+ * @brief A process's /proc directory, opened once and read relative to it.
+ *
+ * The directory is opened with O_PATH, attributes are opened with openat and
+ * links are read with readlinkat, so the attribute paths are not rebuilt. If
+ * the process exits, and its pid is reused, reads fail instead of reading the
+ * new process.
+ */
+class ProcDirectory : private boost::noncopyable {
+ public:
+  explicit ProcDirectory(const std::string& pid);
+  ~ProcDirectory();
+
+  /// True if the process directory was opened.
+  bool ok() const { return fd_ >= 0; }
+
+  /// Open an attribute, such as "status", for reading. The caller closes it.
+  int open(const char* attr) const;
+
+  /// Read the target of an attribute symlink, such as "exe" or "fd/3".
+  Status readLink(const char* attr, std::string& target) const;
+
+  /// Read the process's descriptor numbers and link targets.
+  Status descriptors(std::map<std::string, std::string>& descriptors) const;
+
+ private:
+  int fd_{-1};
+};
+
+typedef std::shared_ptr<ProcDirectory> ProcDirectoryRef;
+
+/**
+ * @brief The open /proc directories of a set of processes.
+ *
+ * The process tables used within a query, such as a join of processes and
+ * process_open_files, read the same process instances from one snapshot.
+ * Directories are kept open up to a limit below the descriptor limit, other
+ * pids are opened when they are read.
+ */
+class ProcSnapshot : private boost::noncopyable {
+ public:
+  explicit ProcSnapshot(const std::set<std::string>& pids);
+
+  /// The pids of the snapshot, in order, without pids that had exited.
+  const std::set<std::string>& pids() const { return pids_; }
+
+  /// A pid's directory, check ok() before reading.
+  ProcDirectoryRef directory(const std::string& pid) const;
+
+ private:
+  std::set<std::string> pids_;
+  std::map<std::string, ProcDirectoryRef> directories_;
+};
+
+typedef std::shared_ptr<const ProcSnapshot> ProcSnapshotRef;
+
+/**
+ * @brief Snapshot every process, shared for a short period.
+ *
+ * The snapshot is reopened once older than a second.
+ */
+ProcSnapshotRef procSnapshot();
+
+/// Snapshot specific processes, without sharing.
+ProcSnapshotRef procSnapshot(const std::set<std::string>& pids);
+
+/// The descriptors of a set of processes.
+struct ProcDescriptorIndex {
+  /// Each process's descriptor numbers and link targets.
+  std::map<std::string, std::map<std::string, std::string>> descriptors;
+  /// Socket inodes and the process holding them, the last in pid order.
+  std::map<std::string, std::string> sockets;
+};
+
+typedef std::shared_ptr<const ProcDescriptorIndex> ProcDescriptorIndexRef;
+
+/**
+ * @brief Index the descriptors of every process, shared for a short period.
+ *
+ * Reading every process's descriptors resolves a symlink per descriptor.
+ * Tables used together, for example when joining process_open_files and
+ * process_open_sockets, reuse one index instead of repeating the walk. The
+ * index is rebuilt once older than a second.
+ */
+ProcDescriptorIndexRef procDescriptorIndex();
+
+/// Index the descriptors of specific processes, without sharing.
+ProcDescriptorIndexRef procDescriptorIndex(const std::set<std::string>& pids);
+
+/// Index the descriptors of the processes of a snapshot.
+ProcDescriptorIndexRef procDescriptorIndex(const ProcSnapshot& snapshot);
+
 /**
  * @brief Read bytes from Linux's raw memory.
  *
@@ -318,5 +682,22 @@ Status procReadDescriptor(const std::string& process,
  */
 Status readRawMem(size_t base, size_t length, void** buffer);
 
+/// Called with a bounded window of physical memory, see mapRawMem.
+typedef std::function<void(const uint8_t* data, size_t length)> RawMemVisitor;
+
+/**
+ * @brief Read bytes from Linux's raw memory in place.
+ *
+ * Like readRawMem, but the pages are mapped and passed to a visitor without
+ * allocating and copying. The window is only valid during the visit. If the
+ * pages cannot be mapped they are read into a temporary buffer.
+ *
+ * @param base The absolute memory address to read from.
+ * @param length The length of the window with a max of 0x10000.
+ * @param visitor Called once with the window if the read succeeds.
+ * @return status The status of the read.
+ */
+Status mapRawMem(size_t base, size_t length, const RawMemVisitor& visitor);
+
 #endif
 }
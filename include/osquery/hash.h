@@ -8,6 +8,8 @@
  *
  */
 
+#pragma once
+
 #include <string>
 
 namespace osquery {
@@ -108,4 +110,42 @@ std::string hashFromBuffer(HashType hash_type, const void* buffer, size_t size);
  * @return A string (hex) representation of the hash digest.
  */
 std::string hashFromFile(HashType hash_type, const std::string& path);
+
+/// The hex digests of a file, only the requested digests are set.
+struct MultiHashes {
+  /// The computed HashType%s as a bitwise OR.
+  int mask;
+
+  std::string md5;
+  std::string sha1;
+  std::string sha256;
+
+  MultiHashes() : mask(0) {}
+};
+
+/**
+ * @brief Compute several hash digests from one read of the file content.
+ *
+ * Each chunk of the file is read once and fed to every requested digest,
+ * instead of reading the file for each hashFromFile call.
+ *
+ * @param mask A bitwise OR of the osquery::HashType%s to compute.
+ * @param path Filesystem path, the hash target.
+ * @return The digests, which are empty if the file cannot be read.
+ */
+MultiHashes hashMultiFromFile(int mask, const std::string& path);
+
+/**
+ * @brief Compute several hash digests of a file, or reuse cached digests.
+ *
+ * Digests are cached in the backing store with the identity of the file when
+ * it was hashed. If the file's device, inode, size, mtime, and ctime match,
+ * the file is only stat'd. The result may include digests that were cached
+ * but not requested.
+ *
+ * @param mask A bitwise OR of the osquery::HashType%s to compute.
+ * @param path Filesystem path, the hash target.
+ * @return The digests, which are empty if the file cannot be read.
+ */
+MultiHashes hashMultiFromFileCached(int mask, const std::string& path);
 }
@@ -204,7 +204,18 @@ void initStatusLogger(const std::string& name);
 void initLogger(const std::string& name, bool forward_all = false);
 
 /**
- * @brief Log a string using the default logger receiver.
+ * @brief The logger plugins receiving results and status logs.
+ *
+ * --logger_plugin is a comma-separated list of plugins. The first is the
+ * registry's active logger, the others also receive every log. Each plugin
+ * has its own asynchronous queue when --logger_async is set.
+ *
+ * @return The active logger plugin, followed by the other configured plugins.
+ */
+std::vector<std::string> getLoggerPlugins();
+
+/**
+ * @brief Log a string using the default logger receivers.
  *
  * Note that this method should only be used to log results. If you'd like to
  * log normal osquery operations, use Google Logging.
@@ -233,7 +244,10 @@ Status logString(const std::string& message,
                  const std::string& receiver);
 
 /**
- * @brief Log results of scheduled queries to the default receiver
+ * @brief Log results of scheduled queries to the default receivers
+ *
+ * The results are serialized once, and each logger plugin receives the same
+ * serialized buffer.
  *
  * @param item a struct representing the results of a scheduled query
  *
@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <map>
 #include <mutex>
 #include <vector>
@@ -67,8 +68,9 @@ namespace osquery {
  * @brief A boilerplate code helper to register a plugin.
  *
  * Like CREATE_REGISTRY, REGISTER creates a boilerplate global instance to
- * create an instance of the plugin type within the whole-process-lived registry
- * single instance. Registry items must derive from the `RegistryType` defined
+ * add the plugin type within the whole-process-lived registry single
+ * instance. Only a factory is added, the plugin is constructed when it is
+ * first used. Registry items must derive from the `RegistryType` defined
  * by the CREATE_REGISTRY and Registry::create call.
  *
  * @param type A typename that derives from the RegistryType.
@@ -185,6 +187,9 @@ class Plugin : private boost::noncopyable {
   Plugin& operator=(Plugin const&);
 };
 
+/// Constructs a registry item's plugin when it is first used.
+typedef std::function<std::shared_ptr<Plugin>()> PluginCreator;
+
 class RegistryHelperCore : private boost::noncopyable {
  public:
   explicit RegistryHelperCore(bool auto_setup = false)
@@ -200,6 +205,18 @@ class RegistryHelperCore : private boost::noncopyable {
 
   RegistryRoutes getRoutes() const;
 
+  /**
+   * @brief Get an item's route info without calling the item.
+   *
+   * Local items build their route info, an extension's items use the route
+   * info broadcast when the extension registered.
+   *
+   * @param item_name The plugin identifier.
+   * @param route If successful, the item's route info.
+   * @return Failure if the item has no local plugin or broadcast route.
+   */
+  Status getRoute(const std::string& item_name, PluginResponse& route) const;
+
   /**
    * @brief The only method a plugin user should call.
    *
@@ -220,7 +237,9 @@ class RegistryHelperCore : private boost::noncopyable {
                       const PluginRequest& request,
                       PluginResponse& response);
 
-  Status add(const std::string& item_name, bool internal = false);
+  Status add(const std::string& item_name,
+             const PluginCreator& creator,
+             bool internal = false);
 
   /**
    * @brief Allow a plugin to perform some setup functions when osquery starts.
@@ -230,14 +249,30 @@ class RegistryHelperCore : private boost::noncopyable {
    * instantiation. To have a reliable state (aka, flags have been parsed,
    * and logs are ready to stream), do construction work in Plugin::setUp.
    *
-   * The registry `setUp` will iterate over all of its registry items and call
-   * their setup unless the registry is lazy (see CREATE_REGISTRY).
+   * The registry `setUp` will call the setup of each of its constructed
+   * registry items unless the registry is lazy (see CREATE_REGISTRY). Items
+   * constructed later are set up when they are first used.
    */
   virtual void setUp();
 
   /// Facility method to check if a registry item exists.
   bool exists(const std::string& item_name, bool local = false) const;
 
+  /**
+   * @brief A local item's plugin, constructed when it is first used.
+   *
+   * Items of a lazy registry constructed after the registry's setUp are set
+   * up before they are returned. If that setUp fails the item is removed and
+   * the plugin is nullptr.
+   *
+   * @param item_name An identifier for a local registry plugin.
+   * @return The plugin, this will throw out_of_range if there is no item.
+   */
+  std::shared_ptr<Plugin> getPlugin(const std::string& item_name) const;
+
+  /// Check if a local item's plugin has been constructed.
+  bool constructed(const std::string& item_name) const;
+
   /// Create a registry item alias for a given item name.
   Status addAlias(const std::string& item_name, const std::string& alias);
 
@@ -247,6 +282,9 @@ class RegistryHelperCore : private boost::noncopyable {
   /// Facility method to list the registry item identifiers.
   std::vector<std::string> names() const;
 
+  /// List the local registry item identifiers, without constructing them.
+  std::vector<std::string> localNames() const;
+
   /// Facility method to count the number of items in this registry.
   size_t count() const;
 
@@ -270,15 +308,27 @@ class RegistryHelperCore : private boost::noncopyable {
   /// Get the 'active' plugin, return success with the active plugin name.
   const std::string& getActive() const;
 
+  /// The generation of every registry, changed when items or routes change.
+  static size_t generation() { return generation_; }
+
  protected:
   /// The identifier for this registry, used to register items.
   std::string name_;
   /// Does this registry run setUp on each registry item at initialization.
   bool auto_setup_;
+  /// Set once a lazy registry ran setUp, later items are set up on first use.
+  bool setup_{false};
 
  protected:
-  /// A map of registered plugin instances to their registered identifier.
-  std::map<std::string, std::shared_ptr<Plugin> > items_;
+  /**
+   * @brief A map of registered plugin instances to their registered
+   * identifier, nullptr until the item is first used.
+   */
+  mutable std::map<std::string, std::shared_ptr<Plugin> > items_;
+  /// The factory of each local item.
+  mutable std::map<std::string, PluginCreator> creators_;
+  /// Protects every access to items_, and constructing items on first use.
+  mutable std::recursive_mutex items_mutex_;
   /// If aliases are used, a map of alias to item name.
   std::map<std::string, std::string> aliases_;
   /// Keep a lookup of the external item name to assigned extension UUID.
@@ -293,6 +343,19 @@ class RegistryHelperCore : private boost::noncopyable {
   std::string active_;
   /// If a module was initialized/declared then store lookup information.
   std::map<std::string, RouteUUID> modules_;
+  /// Invalidates resolved PluginHandle%s when any registry changes.
+  static std::atomic<size_t> generation_;
+
+ private:
+  /**
+   * @brief Find a local item and construct its plugin on first use.
+   *
+   * @param item_name An identifier for a local registry plugin.
+   * @param plugin The output plugin, nullptr if its first setUp failed.
+   * @return false if there is no such local item.
+   */
+  bool findPlugin(const std::string& item_name,
+                  std::shared_ptr<Plugin>& plugin) const;
 };
 
 /**
@@ -333,6 +396,7 @@ class RegistryHelper : public RegistryHelperCore {
       routes_[route.first] = route.second;
       auto status = add_(route.first, route.second);
       external_[route.first] = uuid;
+      generation_++;
       if (!status.ok()) {
         return status;
       }
@@ -355,11 +419,12 @@ class RegistryHelper : public RegistryHelperCore {
       external_.erase(item);
       routes_.erase(item);
     }
+    generation_++;
   }
 
   /**
-   * @brief Add a plugin to this registry by allocating and indexing
-   * a type Item and a key identifier.
+   * @brief Add a plugin to this registry by indexing a factory for a type
+   * Item and a key identifier. The Item is allocated on first use.
    *
    * @code{.cpp}
    *   /// Instead of calling RegistryFactory::add use:
@@ -371,16 +436,16 @@ class RegistryHelper : public RegistryHelperCore {
    */
   template <class Item>
   Status add(const std::string& item_name, bool internal = false) {
-    if (items_.count(item_name) > 0) {
+    if (exists(item_name, true)) {
       return Status(1, "Duplicate registry item exists: " + item_name);
     }
 
     // Cast the specific registry-type derived item as the API type of the
     // registry used when created using the registry factory.
-    std::shared_ptr<RegistryType> item((RegistryType*)new Item());
-    item->setName(item_name);
-    items_[item_name] = item;
-    return RegistryHelperCore::add(item_name, internal);
+    auto creator = []() {
+      return std::shared_ptr<Plugin>((RegistryType*)new Item());
+    };
+    return RegistryHelperCore::add(item_name, creator, internal);
   }
 
   /**
@@ -393,13 +458,17 @@ class RegistryHelper : public RegistryHelperCore {
    * @return A std::shared_ptr of type RegistryType.
    */
   RegistryTypeRef get(const std::string& item_name) const {
-    return std::dynamic_pointer_cast<RegistryType>(items_.at(item_name));
+    return std::dynamic_pointer_cast<RegistryType>(getPlugin(item_name));
   }
 
+  /// Every local plugin, this constructs each item not yet used.
   const std::map<std::string, RegistryTypeRef> all() const {
     std::map<std::string, RegistryTypeRef> ditems;
-    for (const auto& item : items_) {
-      ditems[item.first] = std::dynamic_pointer_cast<RegistryType>(item.second);
+    for (const auto& name : localNames()) {
+      auto item = get(name);
+      if (item != nullptr) {
+        ditems[name] = item;
+      }
     }
 
     return ditems;
@@ -580,6 +649,17 @@ class RegistryFactory : private boost::noncopyable {
                      const std::string& item_name,
                      const PluginRequest& request);
 
+  /**
+   * @brief Get a registry item's route info without calling the item.
+   *
+   * A table's route info is its column information. For an extension's table
+   * this avoids a call to the extension, the columns were broadcast when the
+   * extension registered.
+   */
+  static Status getRoute(const std::string& registry_name,
+                         const std::string& item_name,
+                         PluginResponse& route);
+
   /// A helper call that uses the active plugin (if the registry has one).
   static Status call(const std::string& registry_name,
                      const PluginRequest& request,
@@ -721,4 +801,40 @@ class RegistryFactory : private boost::noncopyable {
  * implement the Plugin and RegistryType interfaces.
  */
 class Registry : public RegistryFactory {};
+
+/**
+ * @brief A registry item resolved once for repeated calls.
+ *
+ * Registry::call looks up the registry and item by name, and then the item's
+ * extension routes, for every call. A handle keeps the resolved local plugin
+ * and calls it directly. Adding or removing registry items, extensions, or
+ * routes changes the registry generation, and the handle resolves the item
+ * again on its next use.
+ *
+ * Items that are not local, such as extension plugins, are called through
+ * Registry::call.
+ */
+class PluginHandle {
+ public:
+  PluginHandle() {}
+  PluginHandle(const std::string& registry_name, const std::string& item_name)
+      : registry_name_(registry_name), item_name_(item_name) {}
+
+  /// Call the plugin, the same as Registry::call with the handle's names.
+  Status call(const PluginRequest& request, PluginResponse& response);
+
+  /// The local plugin, nullptr if the item is external or does not exist.
+  const PluginRef& get();
+
+  /// The registry item name.
+  const std::string& getName() const { return item_name_; }
+
+ private:
+  std::string registry_name_;
+  std::string item_name_;
+
+  /// The registry generation when the plugin was resolved, 0 if unresolved.
+  size_t generation_{0};
+  PluginRef plugin_;
+};
 }
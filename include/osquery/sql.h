@@ -22,6 +22,9 @@ namespace osquery {
 
 DECLARE_int32(value_max);
 
+/// The status message prefix of a query stopped at its results size limit.
+extern const std::string kQueryResultsLimitError;
+
 /**
  * @brief The core interface to executing osquery SQL commands
  *
@@ -49,33 +52,62 @@ class SQL {
    */
   explicit SQL(const std::string& q);
 
+  /**
+   * @brief Instantiate an instance of the class with a query and deadline
+   *
+   * @param q An osquery SQL query
+   * @param timeout Seconds before the query may be interrupted, 0 for none
+   */
+  SQL(const std::string& q, size_t timeout);
+
+  /**
+   * @brief Instantiate an instance with a deadline and a results size limit
+   *
+   * A query producing more than max_bytes of values fails without rows.
+   *
+   * @param q An osquery SQL query
+   * @param timeout Seconds before the query may be interrupted, 0 for none
+   * @param max_bytes Bytes of result values, 0 for no limit
+   */
+  SQL(const std::string& q, size_t timeout, size_t max_bytes);
+
   /**
    * @brief Accessor for the rows returned by the query
    *
    * @return A QueryData object of the query results
    */
-  const QueryData& rows();
+  const QueryData& rows() const &;
+
+  /**
+   * @brief Move the rows out of a temporary SQL object
+   *
+   * Both SQL(q).rows() and std::move(sql).rows() take the results without
+   * copying each Row.
+   *
+   * @return A QueryData object of the query results
+   */
+  QueryData rows() &&;
 
   /**
    * @brief Accessor to switch off of when checking the success of a query
    *
    * @return A bool indicating the success or failure of the operation
    */
-  bool ok();
+  bool ok() const;
 
   /**
    * @brief Get the status returned by the query
    *
    * @return The query status
    */
-  Status getStatus();
+  Status getStatus() const;
 
   /**
    * @brief Accessor for the message string indicating the status of the query
    *
    * @return The message string indicating the status of the query
    */
-  std::string getMessageString();
+  std::string getMessageString() const;
 
   /**
    * @brief Add host info columns onto existing QueryData
@@ -154,11 +186,49 @@ class SQLPlugin : public Plugin {
  public:
   /// Run a SQL query string against the SQL implementation.
   virtual Status query(const std::string& q, QueryData& results) const = 0;
+
+  /**
+   * @brief Run a SQL query string that may be interrupted after a timeout.
+   *
+   * Implementations that cannot interrupt a query ignore the timeout.
+   */
+  virtual Status query(const std::string& q,
+                       QueryData& results,
+                       size_t timeout) const {
+    return query(q, results);
+  }
+
+  /**
+   * @brief Run a SQL query string, sending each result row to a sink.
+   *
+   * The default implementation runs the query into QueryData first.
+   */
+  virtual Status query(const std::string& q,
+                       ResultSink& results,
+                       size_t timeout) const {
+    QueryData rows;
+    auto status = query(q, rows, timeout);
+    if (status.ok()) {
+      sendResultSet(ResultSet::fromQueryData(rows), results);
+    }
+    return status;
+  }
+
+  /// Interrupt queries running beyond their timeout, return the count.
+  virtual size_t interruptExpired() const { return 0; }
+
   /// Use the SQL implementation to parse a query string and return details
   /// (name, type) about the columns.
   virtual Status getQueryColumns(const std::string& q,
                                  TableColumns& columns) const = 0;
 
+  /// Get the columns identifying a query's result rows, if it has any.
+  virtual Status getQueryKeys(const std::string& q,
+                              std::vector<std::string>& keys) const {
+    keys.clear();
+    return Status(0, "OK");
+  }
+
   /**
    * @brief Attach a table at runtime.
    *
@@ -202,6 +272,37 @@ class SQLPlugin : public Plugin {
  */
 Status query(const std::string& query, QueryData& results);
 
+/**
+ * @brief Execute a query with a deadline
+ *
+ * See `query`, the query is interrupted by `interruptExpiredQueries` if it
+ * is still running `timeout` seconds after it started.
+ *
+ * @param q the query to execute
+ * @param results A QueryData structure to emit result rows on success.
+ * @param timeout Seconds before the query may be interrupted, 0 for none.
+ * @return A status indicating query success.
+ */
+Status query(const std::string& query, QueryData& results, size_t timeout);
+
+/**
+ * @brief Execute a query, sending each result row to a sink
+ *
+ * Consumers that do not need QueryData, such as the scheduler's differential
+ * and result serializers, take rows directly from the SQL implementation.
+ * When the SQL implementation is not in this process the rows are copied
+ * from the registry response.
+ *
+ * @param q the query to execute
+ * @param results A ResultSink for each row, discard the rows on failure.
+ * @param timeout Seconds before the query may be interrupted, 0 for none.
+ * @return A status indicating query success.
+ */
+Status query(const std::string& q, ResultSink& results, size_t timeout = 0);
+
+/// Interrupt queries running beyond their timeout, return the count.
+size_t interruptExpiredQueries();
+
 /**
  * @brief Analyze a query, providing information about the result columns
  *
@@ -217,6 +318,20 @@ Status query(const std::string& query, QueryData& results);
  */
 Status getQueryColumns(const std::string& q, TableColumns& columns);
 
+/**
+ * @brief Get the key columns identifying a query's result rows
+ *
+ * A query selecting from a single table, including every column the table
+ * spec declares with key=True, has those key columns. Differential results
+ * use them to report changed rows.
+ *
+ * @param q the query to analyze
+ * @param keys the output key column names, empty if the rows have no key
+ *
+ * @return status indicating success or failure of the operation
+ */
+Status getQueryKeyColumns(const std::string& q, std::vector<std::string>& keys);
+
 /*
  * @brief A mocked subclass of SQL useful for testing
  */
@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <string.h>
+
 #include <sstream>
 #include <string>
 
@@ -37,7 +39,7 @@ class Status {
    * Note that the default constructor initialized an osquery::Status instance
    * to a state such that a successful operation is indicated.
    */
-  Status() : code_(0), message_("OK") {}
+  Status() : code_(0) {}
 
   /**
    * @brief A constructor which can be used to concisely express the status of
@@ -50,8 +52,22 @@ class Status {
    * If all operations were successful, this message should be "OK".
    * Otherwise, it doesn't matter what the string is, as long as both the
    * setter and caller agree.
+   *
+   * A successful "OK" status does not store its message, so the common
+   * success paths do not copy or allocate a string.
    */
-  Status(int c, std::string m) : code_(c), message_(m) {}
+  Status(int c, std::string m) : code_(c) {
+    if (c != 0 || m != "OK") {
+      message_ = std::move(m);
+    }
+  }
+
+  /// Construct from a literal message without a temporary string.
+  Status(int c, const char* m) : code_(c) {
+    if (c != 0 || strcmp(m, "OK") != 0) {
+      message_ = m;
+    }
+  }
 
  public:
   /**
@@ -68,7 +84,12 @@ class Status {
    * success or failure of an operation. On successful operations, the idiom
    * is for the message to be "OK"
    */
-  std::string getMessage() const { return message_; }
+  const std::string& getMessage() const {
+    if (code_ == 0 && message_.empty()) {
+      return okMessage();
+    }
+    return message_;
+  }
 
   /**
    * @brief A convenience method to check if the return code is 0
@@ -91,8 +112,8 @@ class Status {
    *
    * @see getMessage()
    */
-  std::string toString() const { return getMessage(); }
-  std::string what() const { return getMessage(); }
+  const std::string& toString() const { return getMessage(); }
+  const std::string& what() const { return getMessage(); }
 
   /**
    * @brief implicit conversion to bool
@@ -111,7 +132,7 @@ class Status {
 
   // Enables use of gtest (ASSERT|EXPECT)_EQ
   bool operator==(const Status& rhs) const {
-    return (code_ == rhs.getCode()) && (message_ == rhs.getMessage());
+    return (code_ == rhs.getCode()) && (getMessage() == rhs.getMessage());
   }
 
   // Enables use of gtest (ASSERT|EXPECT)_NE
@@ -120,11 +141,18 @@ class Status {
   // Enables pretty-printing in gtest (ASSERT|EXPECT)_(EQ|NE)
   friend ::std::ostream& operator<<(::std::ostream& os, const Status& s);
 
+ private:
+  /// The message of a successful status without a stored message.
+  static const std::string& okMessage() {
+    static const std::string ok("OK");
+    return ok;
+  }
+
  private:
   /// the internal storage of the status code
   int code_;
 
-  /// the internal storage of the status message
+  /// the internal storage of the status message, empty for "OK"
   std::string message_;
 };
 }
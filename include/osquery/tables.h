@@ -10,10 +10,13 @@
 
 #pragma once
 
+#include <functional>
 #include <map>
 #include <memory>
 #include <vector>
 #include <set>
+#include <string>
+#include <type_traits>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/property_tree/ptree.hpp>
@@ -34,6 +37,44 @@
 
 namespace osquery {
 
+class JSONWriter;
+
+/// Character types are formatted as text, as boost::lexical_cast does.
+template <typename T>
+struct IsCharacter
+    : std::integral_constant<
+          bool,
+          std::is_same<typename std::remove_cv<T>::type, char>::value ||
+              std::is_same<typename std::remove_cv<T>::type,
+                           signed char>::value ||
+              std::is_same<typename std::remove_cv<T>::type,
+                           unsigned char>::value ||
+              std::is_same<typename std::remove_cv<T>::type, wchar_t>::value> {
+};
+
+/**
+ * @brief Format the value of an integer affinity macro.
+ *
+ * Integers are formatted directly rather than through a stream, generators
+ * format integers for nearly every row. Other values, such as strings, are
+ * lexically casted.
+ */
+template <typename T>
+inline typename std::enable_if<
+    std::is_integral<T>::value && !IsCharacter<T>::value,
+    std::string>::type
+integerText(const T& value) {
+  return std::to_string(value);
+}
+
+template <typename T>
+inline typename std::enable_if<
+    !std::is_integral<T>::value || IsCharacter<T>::value,
+    std::string>::type
+integerText(const T& value) {
+  return boost::lexical_cast<std::string>(value);
+}
+
 /**
  * @brief The SQLite type affinities are available as macros
  *
@@ -46,11 +87,11 @@ namespace osquery {
  */
 #define TEXT(x) boost::lexical_cast<std::string>(x)
 /// See the affinity type documentation for TEXT.
-#define INTEGER(x) boost::lexical_cast<std::string>(x)
+#define INTEGER(x) ::osquery::integerText(x)
 /// See the affinity type documentation for TEXT.
-#define BIGINT(x) boost::lexical_cast<std::string>(x)
+#define BIGINT(x) ::osquery::integerText(x)
 /// See the affinity type documentation for TEXT.
-#define UNSIGNED_BIGINT(x) boost::lexical_cast<std::string>(x)
+#define UNSIGNED_BIGINT(x) ::osquery::integerText(x)
 /// See the affinity type documentation for TEXT.
 #define DOUBLE(x) boost::lexical_cast<std::string>(x)
 
@@ -79,6 +120,46 @@ typedef std::string TableName;
 typedef std::vector<std::pair<std::string, std::string> > TableColumns;
 typedef std::map<std::string, std::vector<std::string> > TableData;
 
+/**
+ * @brief Column options are hints for the virtual table query planner.
+ *
+ * Table specs declare options using the Column keyword arguments of the same
+ * name. Options are a bitmask and are reported alongside each column.
+ */
+enum ColumnOptions : unsigned char {
+  /// The column has no options.
+  COLUMN_DEFAULT = 0,
+  /// The generator uses EQUALS constraints on this column for a lookup.
+  COLUMN_INDEX = 1,
+  /// The generator requires an EQUALS constraint on this (or another
+  /// required) column to produce rows.
+  COLUMN_REQUIRED = 2,
+  /// Constraints on the column generate additional or non-default rows.
+  COLUMN_ADDITIONAL = 4,
+  /// The column is part of the key identifying a row across executions.
+  COLUMN_KEY = 8,
+};
+
+/// Map of column names to their ColumnOptions bitmask.
+typedef std::map<std::string, unsigned char> TableColumnOptions;
+
+/**
+ * @brief How long a table's results remain valid without a TTL.
+ *
+ * Table specs declare the `cacheable` attribute for tables that only change
+ * with a reboot, or when hardware is added or removed. Their results are
+ * cached for the life of the process, hotplug results until a
+ * hardware_events subscriber sees a device added or removed.
+ */
+enum TableCacheable : unsigned char {
+  /// Results are only cached with a TTL.
+  CACHE_NONE = 0,
+  /// Results do not change while the system is up.
+  CACHE_BOOT = 1,
+  /// Results change when hardware is added or removed.
+  CACHE_HOTPLUG = 2,
+};
+
 /**
  * @brief A ConstraintOperator is applied in an query predicate.
  *
@@ -90,9 +171,33 @@ enum ConstraintOperator : unsigned char {
   GREATER_THAN = 4,
   LESS_THAN_OR_EQUALS = 8,
   LESS_THAN = 16,
-  GREATER_THAN_OR_EQUALS = 32
+  GREATER_THAN_OR_EQUALS = 32,
+  MATCHES = 64,
+  LIKE = 65,
+  GLOB = 66,
+  REGEXP = 67,
+  NOT_EQUALS = 68,
 };
 
+/**
+ * @brief The SQLite affinity of a column, compared by constraint predicates.
+ *
+ * Affinities without a literal comparison, such as DOUBLE, never match.
+ */
+enum ColumnAffinity : unsigned char {
+  AFFINITY_UNKNOWN = 0,
+  AFFINITY_TEXT,
+  AFFINITY_INTEGER,
+  AFFINITY_BIGINT,
+  AFFINITY_UNSIGNED_BIGINT,
+};
+
+/// Get the ColumnAffinity of a column type name such as "BIGINT".
+ColumnAffinity columnAffinity(const std::string& type);
+
+/// The parsed constraints of a ConstraintList, see ConstraintList::compile.
+struct ConstraintPredicate;
+
 /// Type for flags for what constraint operators are admissible.
 typedef unsigned char ConstraintOperatorFlag;
 /// Flag for any operator type.
@@ -136,7 +241,8 @@ struct ConstraintList {
    * expression. The affinity of the constraint will be used as the affinite
    * and lexical type of the expression and set of constraint expressions.
    * If there are no predicate constraints in this list, all expression will
-   * match. Constraints are limitations.
+   * match. Constraints are limitations. An expression that does not cast to
+   * the affinity's literal type does not match.
    *
    * @param expr a SQL type expression of the column literal type to check.
    * @return If the expression matched all constraints.
@@ -155,9 +261,20 @@ struct ConstraintList {
    */
   template <typename T>
   bool matches(const T& expr) const {
-    return matches(TEXT(expr));
+    return integerMatches(expr, std::integral_constant<bool, isInteger<T>()>());
   }
 
+  /**
+   * @brief Parse the constraints once for repeated calls to `matches`.
+   *
+   * The affinity is resolved and each constraint expression is cast to the
+   * affinity's literal type. Comparisons are reduced to an equality, the
+   * tightest bounds, and a sorted list of excluded values. Compile after the
+   * affinity and constraints are set, adding a constraint discards the
+   * compiled predicate and `matches` parses expressions for every call.
+   */
+  void compile();
+
   /**
    * @brief Check and return if there are constraints on this column.
    *
@@ -210,6 +327,18 @@ struct ConstraintList {
     return (!exists() || matches(expr));
   }
 
+  /**
+   * @brief Check if every constraint operator is evaluated by `matches`.
+   *
+   * Pattern operators such as LIKE and GLOB are applied by SQLite after the
+   * table generates rows, `matches` does not restrict on them. A generator
+   * may only assume a matching row will be returned by the query if all of
+   * the constraints are comparable.
+   *
+   * @return true if all constraints use comparison operators.
+   */
+  bool comparable() const;
+
   /**
    * @brief Helper templated function for ConstraintList::matches.
    */
@@ -244,6 +373,7 @@ struct ConstraintList {
    */
   void add(const struct Constraint& constraint) {
     constraints_.push_back(constraint);
+    predicate_ = nullptr;
   }
 
   /**
@@ -260,12 +390,45 @@ struct ConstraintList {
   void serialize(boost::property_tree::ptree& tree) const;
   void unserialize(const boost::property_tree::ptree& tree);
 
+  /// Write the list and affinity members of the serialized format.
+  void serialize(JSONWriter& writer) const;
+
   ConstraintList() : affinity("TEXT") {}
 
+ private:
+  /// Integers other than characters and bools may skip a TEXT conversion.
+  template <typename T>
+  static constexpr bool isInteger() {
+    return std::is_integral<T>::value && !std::is_same<T, bool>::value &&
+           !std::is_same<T, char>::value &&
+           !std::is_same<T, signed char>::value &&
+           !std::is_same<T, unsigned char>::value;
+  }
+
+  template <typename T>
+  bool integerMatches(const T& expr, std::false_type) const {
+    return matches(TEXT(expr));
+  }
+
+  template <typename T>
+  bool integerMatches(const T& expr, std::true_type) const {
+    if (std::is_signed<T>::value) {
+      return signedMatches(static_cast<long long>(expr));
+    }
+    return unsignedMatches(static_cast<unsigned long long>(expr));
+  }
+
+  /// Compare an integer to a compiled integer predicate without casting.
+  bool signedMatches(long long expr) const;
+  bool unsignedMatches(unsigned long long expr) const;
+
  private:
   /// List of constraint operator/expressions.
   std::vector<struct Constraint> constraints_;
 
+  /// The compiled constraints, shared by copies of the list.
+  std::shared_ptr<const ConstraintPredicate> predicate_;
+
  private:
   FRIEND_TEST(TablesTests, test_constraint_list);
 };
@@ -275,21 +438,184 @@ typedef std::map<std::string, struct ConstraintList> ConstraintMap;
 /// Populate a constraint list from a query's parsed predicate.
 typedef std::vector<std::pair<std::string, struct Constraint> > ConstraintSet;
 
+/**
+ * @brief A generated column value kept in its native type.
+ *
+ * Typed table generators set integer and double values directly, they are
+ * stored into the virtual table's result buffer without a TEXT round trip.
+ * Values are only formatted as TEXT when rows are serialized, for example for
+ * an extension or a logger.
+ */
+class RowValue {
+ public:
+  enum Type : unsigned char {
+    TEXT_VALUE = 0,
+    INTEGER_VALUE,
+    DOUBLE_VALUE,
+  };
+
+  RowValue() : type_(TEXT_VALUE), integer_(0) {}
+  RowValue(const std::string& value)
+      : type_(TEXT_VALUE), integer_(0), text_(value) {}
+  RowValue(std::string&& value)
+      : type_(TEXT_VALUE), integer_(0), text_(std::move(value)) {}
+  RowValue(const char* value) : type_(TEXT_VALUE), integer_(0), text_(value) {}
+  RowValue(double value) : type_(DOUBLE_VALUE), real_(value) {}
+
+  /// Integers, but not characters, are stored natively.
+  template <typename T,
+            typename = typename std::enable_if<
+                std::is_integral<T>::value && !std::is_same<T, char>::value &&
+                !std::is_same<T, bool>::value>::type>
+  RowValue(T value)
+      : type_(INTEGER_VALUE), integer_(static_cast<long long>(value)) {
+    if (std::is_unsigned<T>::value && integer_ < 0) {
+      // Unsigned values beyond a BIGINT are kept as TEXT.
+      type_ = TEXT_VALUE;
+      text_ = TEXT(value);
+    }
+  }
+
+  Type type() const { return type_; }
+  long long integer() const { return integer_; }
+  double real() const { return real_; }
+  const std::string& text() const { return text_; }
+  std::string& text() { return text_; }
+
+  /// Format the value as TEXT, as the BIGINT and DOUBLE macros would.
+  std::string toString() const;
+
+ private:
+  Type type_;
+  union {
+    long long integer_;
+    double real_;
+  };
+  std::string text_;
+};
+
+/**
+ * @brief A single generated row with natively typed values.
+ *
+ * See RowValue, a TypedRow may be assigned TEXT values like a Row.
+ */
+typedef std::map<std::string, RowValue> TypedRow;
+
+/// Format each value of a TypedRow, moving TEXT values.
+Row toRow(TypedRow& row);
+
+/**
+ * @brief A generated row with natively typed values, in column order.
+ *
+ * Tables declared with the row_struct attribute have a struct generated from
+ * their spec, such as SharedMemoryRow, with a natively typed setter and an
+ * ordinal for each column. The struct's values are a ColumnRow, buffered by
+ * the virtual table module by index, without column name lookups or a map
+ * node for every value.
+ */
+typedef std::vector<RowValue> ColumnRow;
+
+/// Format each value of a ColumnRow into a Row of the table's columns.
+Row toRow(ColumnRow& row, const TableColumns& columns);
+
 /**
  * @brief A QueryContext is provided to every table generator for optimization
  * on query components like predicate constraints and limits.
  */
 struct QueryContext {
   ConstraintMap constraints;
-  /// Support a limit to the number of results.
+  /**
+   * @brief Support a limit to the number of results.
+   *
+   * The limit is only set when SQLite allows the LIMIT (and OFFSET) to be
+   * pushed into the virtual table, and every constraint is comparable. It
+   * includes the OFFSET, 0 means there is no limit. SQLite still applies the
+   * query's LIMIT, generators may use this to stop early.
+   */
   int limit;
 
-  QueryContext() : limit(0) {}
+  /**
+   * @brief The columns referenced by the query, if known.
+   *
+   * SQLite reports the columns a statement reads from the table, including
+   * columns used in constraints. Generators may skip expensive work for the
+   * other columns and leave them out of generated rows.
+   */
+  std::set<std::string> used_columns;
+  /// Set when column usage is unknown, or every column is referenced.
+  bool all_columns_used;
+
+  /// Check if a column is referenced by the query.
+  bool isColumnUsed(const std::string& column) const {
+    return all_columns_used || used_columns.count(column) > 0;
+  }
+
+  /**
+   * @brief Check if a generated row matches all column constraints.
+   *
+   * Columns without constraints are not checked. A constrained column that is
+   * missing from the row, or fails to cast to the column affinity, does not
+   * match.
+   *
+   * @param row A generated row.
+   * @return true if the row matches every column's constraint list.
+   */
+  bool matches(const Row& row) const;
+
+  /// Check if a typed row matches, integers are compared without casting.
+  bool matchesTyped(const TypedRow& row) const;
+
+  /// Check if a row of column ordered values matches, see matchesTyped.
+  bool matchesColumns(const ColumnRow& row, const TableColumns& columns) const;
+
+  /// Compile each column's constraints, see ConstraintList::compile.
+  void compile();
+
+  /**
+   * @brief Check if a generator has produced enough rows.
+   *
+   * @param matched The number of generated rows that matched the constraints.
+   * @return true if there is a limit and it is satisfied.
+   */
+  bool limitReached(size_t matched) const {
+    return (limit > 0 && matched >= static_cast<size_t>(limit));
+  }
+
+  /**
+   * @brief The query's deadline and cancellation, if it has a timeout.
+   *
+   * Streaming generators see cancellation as a yield returning false. Others
+   * with long-running loops should check isCancelled periodically and return.
+   */
+  const QueryCancellation* cancellation;
+
+  /// Check if the query was cancelled or exceeded its timeout.
+  bool isCancelled() const {
+    return (cancellation != nullptr && cancellation->cancelled());
+  }
+
+  QueryContext() : limit(0), all_columns_used(true), cancellation(nullptr) {}
 };
 
 typedef struct QueryContext QueryContext;
 typedef struct Constraint Constraint;
 
+/**
+ * @brief A row sink used by streaming table generators.
+ *
+ * A generator calls the yield once per generated row. The consumer may take
+ * (move) the row content. If the yield returns false the consumer does not
+ * want additional rows, for example a query LIMIT has been satisfied, and the
+ * generator should stop as soon as possible.
+ */
+typedef std::function<bool(Row&)> RowYield;
+
+/// A row sink used by typed streaming table generators, see RowYield.
+typedef std::function<bool(TypedRow&)> TypedRowYield;
+
+/// A row sink used by row struct table generators, see RowYield.
+typedef std::function<bool(ColumnRow&)> ColumnRowYield;
+
 /**
  * @brief The TablePlugin defines the name, types, and column information.
  *
@@ -312,10 +638,96 @@ class TablePlugin : public Plugin {
     return data;
   }
 
+  /// Optional planner hints for columns, columns omitted have no options.
+  virtual TableColumnOptions columnOptions() const {
+    TableColumnOptions options;
+    return options;
+  }
+
+  /// A rough estimate of the number of rows generated without constraints.
+  virtual size_t cardinality() const { return 0; }
+
+  /// Seconds that generated results may be reused, 0 disables caching.
+  virtual size_t cacheTTL() const { return 0; }
+
+  /// Reuse generated results until a reboot or hotplug event.
+  virtual TableCacheable cacheable() const { return CACHE_NONE; }
+
  protected:
   std::string columnDefinition() const;
   PluginResponse routeInfo() const;
 
+ public:
+  /**
+   * @brief Generate rows incrementally into a RowYield.
+   *
+   * Tables with large or expensive result sets should override this method
+   * and yield rows as they are generated, stopping when the yield returns
+   * false. The default implementation yields each row from `generate`.
+   *
+   * @param context The query context with constraints and an optional limit.
+   * @param yield The row sink.
+   */
+  virtual void generateRows(QueryContext& context, const RowYield& yield) {
+    if (columnRows()) {
+      auto table_columns = columns();
+      generateColumnRows(
+          context, [&yield, &table_columns](ColumnRow& column_row) {
+            auto row = toRow(column_row, table_columns);
+            return yield(row);
+          });
+      return;
+    }
+
+    if (typedRows()) {
+      // Values are formatted for consumers of TEXT rows.
+      generateTypedRows(context, [&yield](TypedRow& typed_row) {
+        auto row = toRow(typed_row);
+        return yield(row);
+      });
+      return;
+    }
+
+    auto rows = generate(context);
+    for (auto& row : rows) {
+      if (!yield(row)) {
+        break;
+      }
+    }
+  }
+
+  /**
+   * @brief Generate rows with natively typed values into a TypedRowYield.
+   *
+   * Tables declared with the typed attribute override this method and
+   * typedRows. The virtual table module then buffers values without casting
+   * them from TEXT. The default implementation yields nothing.
+   *
+   * @param context The query context with constraints and an optional limit.
+   * @param yield The typed row sink.
+   */
+  virtual void generateTypedRows(QueryContext& context,
+                                 const TypedRowYield& yield) {}
+
+  /// Check if the table generates rows using generateTypedRows.
+  virtual bool typedRows() const { return false; }
+
+  /**
+   * @brief Generate rows of column ordered values into a ColumnRowYield.
+   *
+   * Tables declared with the row_struct attribute override this method and
+   * columnRows, their generators fill the row struct generated from the
+   * table's spec. The default implementation yields nothing.
+   *
+   * @param context The query context with constraints and an optional limit.
+   * @param yield The column row sink.
+   */
+  virtual void generateColumnRows(QueryContext& context,
+                                  const ColumnRowYield& yield) {}
+
+  /// Check if the table generates rows using generateColumnRows.
+  virtual bool columnRows() const { return false; }
+
  public:
   /// Public API methods.
   Status call(const PluginRequest& request, PluginResponse& response);
@@ -329,6 +741,21 @@ class TablePlugin : public Plugin {
   static void setContextFromRequest(const PluginRequest& request,
                                     QueryContext& context);
 
+  /**
+   * @brief Generate a table's rows for a QueryContext.
+   *
+   * Tables implemented by this process are passed the context directly. The
+   * context is only serialized into a PluginRequest when the table is routed
+   * to an extension.
+   *
+   * @param table The table name.
+   * @param context The query context with constraints and an optional limit.
+   * @param response The output rows.
+   */
+  static Status generateFromContext(const std::string& table,
+                                    QueryContext& context,
+                                    PluginResponse& response);
+
  public:
   /// When external table plugins are registered the core will attach them
   /// as virtual tables to the SQL internal implementation
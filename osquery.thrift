@@ -51,6 +51,29 @@ struct ExtensionResponse {
   2:ExtensionPluginResponse response,
 }
 
+/// A table plugin generate request, batched in Extension.generate.
+struct ExtensionTableRequest {
+  /// The table plugin name.
+  1:string item,
+  /// The thrift-equivilent of an osquery::PluginRequest.
+  2:ExtensionPluginRequest request,
+  /// The caller accepts large results in a shared memory page.
+  3:bool shared_memory,
+}
+
+/// Table rows sent by column: each column name is sent once and each row is
+/// a list of values in column order.
+struct ExtensionTableResponse {
+  1:ExtensionStatus status,
+  2:list<string> columns,
+  3:list<list<string>> rows,
+  /// Sorted cell indexes (row * column count + column) missing from a row.
+  4:list<i64> absent,
+  /// The name of a POSIX shared memory object holding the rows, which the
+  /// caller reads and unlinks. When set the columns and rows are empty.
+  5:string shared_memory,
+}
+
 exception ExtensionException {
   1:i32 code,
   2:string message,
@@ -68,6 +91,9 @@ service Extension {
     2:string item,
     /// The thrift-equivilent of an osquery::PluginRequest.
     3:ExtensionPluginRequest request),
+  /// Generate the rows of several table plugins in one round trip.
+  list<ExtensionTableResponse> generate(
+    1:list<ExtensionTableRequest> requests),
 }
 
 /// The extension manager is run by the osquery core process.
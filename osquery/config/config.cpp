@@ -8,6 +8,8 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <mutex>
 #include <random>
@@ -21,6 +23,8 @@
 #include <osquery/registry.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/profiler.h"
+
 namespace pt = boost::property_tree;
 
 namespace osquery {
@@ -33,6 +37,9 @@ CLI_FLAG(string, config_plugin, "filesystem", "Config plugin name");
 
 FLAG(int32, schedule_splay_percent, 10, "Percent to splay config times");
 
+/// Incremented on each published change, starting above a scheduler's 0.
+static std::atomic<size_t> kConfigGeneration{1};
+
 Status Config::load() {
   auto& config_plugin = Registry::getActive("config");
   if (!Registry::exists("config", config_plugin)) {
@@ -60,8 +67,10 @@ Status Config::update(const std::map<std::string, std::string>& config) {
     }
   }
 
-  // Request a unique write lock when updating config.
-  boost::unique_lock<boost::shared_mutex> unique_lock(getInstance().mutex_);
+  // Updates are serialized, readers keep the snapshot they hold.
+  auto& instance = getInstance();
+  std::lock_guard<std::recursive_mutex> lock(instance.update_mutex_);
+  auto previous = snapshot();
 
   ConfigData conf;
   for (const auto& source : config) {
@@ -81,8 +90,12 @@ Status Config::update(const std::map<std::string, std::string>& config) {
     }
   }
 
+  // Publish the merged data, parsers may add scheduled queries to it.
+  publish(std::make_shared<const ConfigData>(std::move(conf)));
+
   // Call each parser with the optionally-empty, requested, top level keys.
-  getInstance().data_ = conf;
+  auto merged = snapshot();
+  std::map<std::string, std::shared_ptr<ConfigParserPlugin>> parsers;
   for (const auto& plugin : Registry::all("config_parser")) {
     auto parser = std::static_pointer_cast<ConfigParserPlugin>(plugin.second);
     if (parser == nullptr || parser.get() == nullptr) {
@@ -90,20 +103,85 @@ Status Config::update(const std::map<std::string, std::string>& config) {
     }
 
     // For each key requested by the parser, add a property tree reference.
+    // The parser is only updated if a key's data changed.
+    bool parser_changed = instance.updated_parsers_.count(plugin.first) == 0;
     std::map<std::string, ConfigTree> parser_config;
     for (const auto& key : parser->keys()) {
-      if (conf.all_data.count(key) > 0) {
-        parser_config[key] = conf.all_data.get_child(key);
+      if (merged->all_data.count(key) > 0) {
+        parser_config[key] = merged->all_data.get_child(key);
       } else {
         parser_config[key] = pt::ptree();
       }
+      if (!parser_changed) {
+        auto before = previous->all_data.get_child_optional(key);
+        parser_changed = (before) ? !(*before == parser_config[key])
+                                  : !parser_config[key].empty();
+      }
     }
-    parser->update(parser_config);
+    parsers[plugin.first] = parser;
+
+    // Queries scheduled by the parser are recorded, and scheduled again if
+    // the parser is not updated.
+    auto queries = std::move(instance.parser_queries_[plugin.first]);
+    instance.parser_queries_[plugin.first].clear();
+    instance.updating_parser_ = plugin.first;
+    if (parser_changed) {
+      parser->update(parser_config);
+      instance.updated_parsers_.insert(plugin.first);
+    } else {
+      for (const auto& query : queries) {
+        addScheduledQuery(query.first,
+                          query.second.query,
+                          query.second.interval,
+                          query.second.shard,
+                          query.second.worker);
+      }
+    }
+    instance.updating_parser_.clear();
+  }
+
+  // The final snapshot includes each parser's data.
+  auto data = std::make_shared<ConfigData>(*snapshot());
+  for (const auto& parser : parsers) {
+    data->parsed_data[parser.first] = parser.second->data_;
   }
 
+  // Unchanged queries keep their splay and their recorded performance.
+  for (auto& query : data->schedule) {
+    auto it = previous->schedule.find(query.first);
+    if (it != previous->schedule.end() && it->second == query.second) {
+      query.second.splayed_interval = it->second.splayed_interval;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> performance_lock(
+        getInstance().performance_mutex_);
+    auto& performance = getInstance().performance_;
+    for (auto it = performance.begin(); it != performance.end();) {
+      auto query = data->schedule.find(it->first);
+      auto before = previous->schedule.find(it->first);
+      if (query == data->schedule.end() ||
+          before == previous->schedule.end() ||
+          !(query->second == before->second)) {
+        it = performance.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  publish(data);
   return Status(0, "OK");
 }
 
+std::shared_ptr<const ConfigData> Config::snapshot() {
+  return std::atomic_load(&getInstance().data_);
+}
+
+void Config::publish(std::shared_ptr<const ConfigData> data) {
+  std::atomic_store(&getInstance().data_, data);
+  kConfigGeneration++;
+}
+
 Status Config::genConfig() {
   PluginResponse response;
   auto status = Registry::call("config", {{"action", "genConfig"}}, response);
@@ -150,9 +228,27 @@ inline void additionalScheduledQuery(const std::string& name,
   }
 
   // This is a candidate for a catch-all iterator with a catch for boolean type.
+  query.timeout = node.second.get<size_t>("timeout", 0);
+  query.sampling = node.second.get<double>("sampling", 1.0);
+  query.sampling = std::min(std::max(query.sampling, 0.0), 1.0);
+  query.max_interval = node.second.get<size_t>("max_interval", 0);
+  query.max_result_bytes = node.second.get<size_t>("max_result_bytes", 0);
+  query.shard = node.second.get<size_t>("shard", 100);
+  if (query.shard == 0 || query.shard > 100) {
+    LOG(WARNING) << "Invalid shard " << query.shard << " for query: " << name;
+    query.shard = 100;
+  }
+  query.worker = node.second.get<std::string>("worker", "");
   query.options["snapshot"] = node.second.get<bool>("snapshot", false);
   query.options["removed"] = node.second.get<bool>("removed", true);
 
+  // A background query executes at idle CPU and IO priority.
+  auto priority = node.second.get<std::string>("priority", "normal");
+  if (priority != "normal" && priority != "background") {
+    LOG(WARNING) << "Unknown priority " << priority << " for query: " << name;
+  }
+  query.options["background"] = (priority == "background");
+
   // Check if this query exists, if so, check if it was changed.
   if (conf.schedule.count(name) > 0) {
     if (query == conf.schedule.at(name)) {
@@ -301,23 +397,38 @@ Status Config::getMD5(std::string& hash_string) {
 
 void Config::addScheduledQuery(const std::string& name,
                                const std::string& query,
-                               const int interval) {
+                               const int interval,
+                               size_t shard,
+                               const std::string& worker) {
   // Create structure to add to the schedule.
   tree_node node;
   node.second.put("query", query);
   node.second.put("interval", interval);
-
-  // Call to the inline function.
-  additionalScheduledQuery(name, node, getInstance().data_);
+  node.second.put("shard", shard);
+  node.second.put("worker", worker);
+
+  // Copy the published data, add the query, and publish the copy.
+  auto& instance = getInstance();
+  std::lock_guard<std::recursive_mutex> lock(instance.update_mutex_);
+  auto data = std::make_shared<ConfigData>(*snapshot());
+  additionalScheduledQuery(name, node, *data);
+  publish(data);
+
+  if (!instance.updating_parser_.empty() && data->schedule.count(name) > 0) {
+    instance.parser_queries_[instance.updating_parser_][name] =
+        data->schedule.at(name);
+  }
 }
 
+size_t Config::getGeneration() { return kConfigGeneration; }
+
 Status Config::checkConfig() {
   getInstance().force_merge_success_ = true;
   return load();
 }
 
 bool Config::checkScheduledQuery(const std::string& query) {
-  for (const auto& scheduled_query : getInstance().data_.schedule) {
+  for (const auto& scheduled_query : snapshot()->schedule) {
     if (scheduled_query.second.query == query) {
       return true;
     }
@@ -327,46 +438,72 @@ bool Config::checkScheduledQuery(const std::string& query) {
 }
 
 bool Config::checkScheduledQueryName(const std::string& query_name) {
-  return (getInstance().data_.schedule.count(query_name) == 0) ? false : true;
+  return (snapshot()->schedule.count(query_name) == 0) ? false : true;
 }
 
 void Config::recordQueryPerformance(const std::string& name,
-                                    size_t delay,
-                                    size_t size,
-                                    const Row& r0,
-                                    const Row& r1) {
-  // Grab a lock on the schedule structure and check the name.
-  ConfigDataInstance config;
-  if (config.schedule().count(name) == 0) {
+                                    const QueryProfile& profile,
+                                    size_t size) {
+  // Check the name against the published schedule.
+  if (snapshot()->schedule.count(name) == 0) {
     // Unknown query schedule name.
     return;
   }
 
-  // Grab access to the non-const schedule item.
-  auto& query = getInstance().data_.schedule.at(name);
-  auto diff = AS_LITERAL(BIGINT_LITERAL, r1.at("user_time")) -
-              AS_LITERAL(BIGINT_LITERAL, r0.at("user_time"));
-  if (diff > 0) {
-    query.user_time += diff;
+  // Performance is recorded apart from the immutable config data.
+  std::lock_guard<std::mutex> lock(getInstance().performance_mutex_);
+  auto& query = getInstance().performance_[name];
+  query.user_time += profile.user_time;
+  query.system_time += profile.system_time;
+
+  // Memory is stored as an average of peak RSS growth between executions.
+  query.memory = (query.memory * query.executions) + profile.memory;
+  query.memory = (query.memory / (query.executions + 1));
+
+  query.allocated += profile.allocated;
+  query.peak_allocated = std::max<unsigned long long int>(
+      query.peak_allocated, profile.peak_allocated);
+  query.generate_allocated += profile.generate_allocated;
+  query.diff_allocated += profile.diff_allocated;
+  query.serialize_allocated += profile.serialize_allocated;
+
+  query.wall_time += profile.wall_time;
+  query.plan_time += profile.plan_time;
+  query.generate_time += profile.generate_time;
+  query.diff_time += profile.diff_time;
+  query.serialize_time += profile.serialize_time;
+  query.log_time += profile.log_time;
+  for (const auto& table : profile.table_times) {
+    query.table_times[table.first] += table.second;
   }
+  query.instructions += profile.counters.instructions;
+  query.cycles += profile.counters.cycles;
+  query.cache_misses += profile.counters.cache_misses;
+  query.context_switches += profile.counters.context_switches;
+  query.page_faults += profile.counters.page_faults;
 
-  diff = AS_LITERAL(BIGINT_LITERAL, r1.at("system_time")) -
-         AS_LITERAL(BIGINT_LITERAL, r0.at("system_time"));
-  if (diff > 0) {
-    query.system_time += diff;
-  }
+  query.output_size += size;
+  query.executions += 1;
+}
 
-  diff = AS_LITERAL(BIGINT_LITERAL, r1.at("resident_size")) -
-         AS_LITERAL(BIGINT_LITERAL, r0.at("resident_size"));
-  if (diff > 0) {
-    // Memory is stored as an average of RSS changes between query executions.
-    query.memory = (query.memory * query.executions) + diff;
-    query.memory = (query.memory / (query.executions + 1));
+void Config::recordQueryOversized(const std::string& name, size_t size) {
+  if (snapshot()->schedule.count(name) == 0) {
+    return;
   }
 
-  query.wall_time += delay;
-  query.output_size += size;
-  query.executions += 1;
+  std::lock_guard<std::mutex> lock(getInstance().performance_mutex_);
+  auto& query = getInstance().performance_[name];
+  query.oversized += 1;
+  query.oversized_size = size;
+}
+
+QueryPerformance Config::getQueryPerformance(const std::string& name) {
+  std::lock_guard<std::mutex> lock(getInstance().performance_mutex_);
+  auto performance = getInstance().performance_.find(name);
+  if (performance == getInstance().performance_.end()) {
+    return QueryPerformance();
+  }
+  return performance->second;
 }
 
 Status ConfigPlugin::call(const PluginRequest& request,
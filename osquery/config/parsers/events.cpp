@@ -0,0 +1,70 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <map>
+#include <set>
+#include <string>
+
+#include <osquery/config.h>
+#include <osquery/events.h>
+#include <osquery/logger.h>
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+/**
+ * @brief A ConfigParserPlugin for the event subscriber retention limits.
+ *
+ * The "events" key is a dictionary of subscriber names, each with optional
+ * "max_age", "max_events", and "max_bytes" limits, and a "priority".
+ */
+class EventsConfigParserPlugin : public ConfigParserPlugin {
+ public:
+  /// Request "events" top level key.
+  std::vector<std::string> keys() { return {"events"}; }
+
+ private:
+  /// Replace the retention limits and priorities of every subscriber.
+  Status update(const ConfigTreeMap& config);
+};
+
+Status EventsConfigParserPlugin::update(const ConfigTreeMap& config) {
+  std::map<std::string, EventRetention> limits;
+  std::set<std::string> low_priority;
+  for (const auto& subscriber : config.at("events")) {
+    // A low priority subscriber's events are shed when its callbacks lag.
+    if (subscriber.second.get("priority", "") == "low") {
+      low_priority.insert(subscriber.first);
+    }
+
+    EventRetention retention;
+    try {
+      retention.max_age = subscriber.second.get<size_t>("max_age", 0);
+      retention.max_events = subscriber.second.get<size_t>("max_events", 0);
+      retention.max_bytes = subscriber.second.get<size_t>("max_bytes", 0);
+    } catch (const pt::ptree_error& e) {
+      LOG(WARNING) << "Invalid event retention for " << subscriber.first
+                   << ": " << e.what();
+      continue;
+    }
+    limits[subscriber.first] = retention;
+  }
+
+  // Save the limits for config introspection.
+  data_ = config.at("events");
+  EventFactory::setRetention(limits);
+  EventFactory::setLowPriority(low_priority);
+  return Status(0, "OK");
+}
+
+/// Call the events retention ConfigParserPlugin "events".
+REGISTER_INTERNAL(EventsConfigParserPlugin, "config_parser", "events");
+}
@@ -91,6 +91,11 @@ Status parsePack(const std::string& name, const pt::ptree& data) {
     return Status(0, "Platform version mismatch");
   }
 
+  // A pack-wide shard applies to queries without their own.
+  auto pack_shard = data.get<size_t>("shard", 100);
+  // And a pack-wide worker class.
+  auto pack_worker = data.get<std::string>("worker", "");
+
   // For each query in the pack's queries, check their version/platform.
   for (const auto& query : data.get_child("queries")) {
     auto query_string = query.second.get("query", "");
@@ -117,7 +122,10 @@ Status parsePack(const std::string& name, const pt::ptree& data) {
     auto query_interval = query.second.get("interval", 0);
     if (query_interval > 0) {
       auto query_name = "pack_" + name + "_" + query.first;
-      Config::addScheduledQuery(query_name, query_string, query_interval);
+      auto shard = query.second.get<size_t>("shard", pack_shard);
+      auto worker = query.second.get<std::string>("worker", pack_worker);
+      Config::addScheduledQuery(
+          query_name, query_string, query_interval, shard, worker);
     }
   }
 
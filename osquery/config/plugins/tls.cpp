@@ -37,21 +37,39 @@ CLI_FLAG(string,
 class TLSConfigPlugin : public ConfigPlugin {
  public:
   Status genConfig(std::map<std::string, std::string>& config);
+
+ private:
+  /// The entity tag of the last config, sent to skip unchanged configs.
+  std::string etag_;
+
+  /// The last config, reused when the server replies it is not modified.
+  std::string config_;
 };
 
 REGISTER(TLSConfigPlugin, "config", "tls");
 
-Status makeTLSConfigRequest(const std::string& uri, pt::ptree& output) {
+Status makeTLSConfigRequest(const std::string& uri,
+                            std::string& etag,
+                            pt::ptree& output) {
   // Make a request to the config endpoint, providing the node secret.
   pt::ptree params;
   params.put<std::string>("node_key", getNodeKey("tls"));
 
   auto request = Request<TLSTransport, JSONSerializer>(uri);
+  if (!etag.empty()) {
+    request.setHeader("If-None-Match", etag);
+  }
   auto status = request.call(params);
   if (!status.ok()) {
     return status;
   }
 
+  // The server may reply that the config with the entity tag is unchanged.
+  if (request.getResponseCode() == 304) {
+    return Status(0, "Not Modified");
+  }
+  etag = request.getResponseHeader("etag");
+
   // The call succeeded, store the enrolled key.
   status = request.getResponse(output);
   if (!status.ok()) {
@@ -71,11 +89,18 @@ Status TLSConfigPlugin::genConfig(std::map<std::string, std::string>& config) {
 
   pt::ptree recv;
   for (size_t i = 1; i <= CONFIG_TLS_MAX_ATTEMPTS; i++) {
-    auto status = makeTLSConfigRequest(uri, recv);
-    if (status.ok()) {
+    // An unchanged config is not requested without a previous config.
+    auto etag = (config_.empty()) ? "" : etag_;
+    auto status = makeTLSConfigRequest(uri, etag, recv);
+    if (status.ok() && status.getMessage() == "Not Modified") {
+      config["tls_plugin"] = config_;
+      return Status(0, "OK");
+    } else if (status.ok()) {
       std::stringstream ss;
       write_json(ss, recv);
-      config["tls_plugin"] = ss.str();
+      config_ = ss.str();
+      etag_ = etag;
+      config["tls_plugin"] = config_;
       return Status(0, "OK");
     } else if (i == CONFIG_TLS_MAX_ATTEMPTS) {
       break;
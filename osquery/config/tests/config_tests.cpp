@@ -17,6 +17,7 @@
 #include <osquery/registry.h>
 #include <osquery/sql.h>
 
+#include "osquery/core/profiler.h"
 #include "osquery/core/test_util.h"
 
 namespace osquery {
@@ -81,24 +82,34 @@ TEST_F(ConfigTests, test_watched_files) {
   EXPECT_EQ(config.files().at("system_binaries").size(), 3);
 }
 
-TEST_F(ConfigTests, test_locking) {
-  {
-    // Assume multiple instance accessors will be active.
-    ConfigDataInstance config1;
-    ConfigDataInstance config2;
-
-    // But a unique lock cannot be acquired.
-    boost::unique_lock<boost::shared_mutex> lock(Config::getInstance().mutex_,
-                                                 boost::defer_lock);
-    ASSERT_FALSE(lock.try_lock());
-  }
+TEST_F(ConfigTests, test_snapshots) {
+  ConfigDataInstance config;
+  auto size = config.schedule().size();
 
-  {
-    // However, a unique lock can be obtained when without instances accessors.
-    boost::unique_lock<boost::shared_mutex> lock(Config::getInstance().mutex_,
-                                                 boost::defer_lock);
-    ASSERT_TRUE(lock.try_lock());
-  }
+  // An update is not blocked by the instance, which keeps its snapshot.
+  Config::addScheduledQuery("snapshot_query", "select 1", 10);
+  EXPECT_EQ(config.schedule().size(), size);
+  EXPECT_EQ(config.schedule().count("snapshot_query"), 0U);
+
+  ConfigDataInstance updated;
+  EXPECT_EQ(updated.schedule().count("snapshot_query"), 1U);
+}
+
+TEST_F(ConfigTests, test_query_performance) {
+  Config::addScheduledQuery("performance_query", "select 1", 10);
+
+  QueryProfile profile;
+  profile.user_time = 10;
+  Config::recordQueryPerformance("performance_query", profile, 5);
+  Config::recordQueryPerformance("performance_query", profile, 5);
+  auto performance = Config::getQueryPerformance("performance_query");
+  EXPECT_EQ(performance.executions, 2U);
+  EXPECT_EQ(performance.user_time, 20U);
+  EXPECT_EQ(performance.output_size, 10U);
+
+  // Unscheduled queries are not recorded.
+  Config::recordQueryPerformance("not_scheduled", profile, 5);
+  EXPECT_EQ(Config::getQueryPerformance("not_scheduled").executions, 0U);
 }
 
 TEST_F(ConfigTests, test_config_update) {
@@ -236,6 +247,41 @@ TEST_F(ConfigTests, test_config_parser) {
   }
 }
 
+class CountingConfigParserPlugin : public ConfigParserPlugin {
+ public:
+  std::vector<std::string> keys() { return {"counted"}; }
+
+  Status update(const std::map<std::string, ConfigTree>& config) {
+    updates++;
+    // Parsers may schedule queries, as query packs do.
+    Config::addScheduledQuery("counted_query", "SELECT 1", 100);
+    return Status(0, "OK");
+  }
+
+  static size_t updates;
+};
+
+size_t CountingConfigParserPlugin::updates = 0;
+
+TEST_F(ConfigTests, test_config_parser_changes) {
+  Registry::add<CountingConfigParserPlugin>("config_parser", "counting");
+  Registry::get("config_parser", "counting")->setUp();
+
+  // The first update always updates the parser.
+  Config::update({{"counted_source", "{\"counted\": {\"key\": \"1\"}}"}});
+  EXPECT_EQ(CountingConfigParserPlugin::updates, 1U);
+
+  // Changes to other keys do not update the parser, its queries are kept.
+  Config::update({{"other_source", "{\"other\": {\"key\": \"1\"}}"}});
+  EXPECT_EQ(CountingConfigParserPlugin::updates, 1U);
+  EXPECT_TRUE(Config::checkScheduledQueryName("counted_query"));
+
+  // A change to the parser's key updates the parser.
+  Config::update({{"counted_source", "{\"counted\": {\"key\": \"2\"}}"}});
+  EXPECT_EQ(CountingConfigParserPlugin::updates, 2U);
+  EXPECT_TRUE(Config::checkScheduledQueryName("counted_query"));
+}
+
 TEST_F(ConfigTests, test_splay) {
   auto val1 = splayValue(100, 10);
   EXPECT_GE(val1, 90);
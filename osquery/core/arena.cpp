@@ -0,0 +1,96 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <cstdint>
+
+#include "osquery/core/arena.h"
+
+namespace osquery {
+
+/// The arena installed by the innermost ScopedArena on this thread.
+static thread_local Arena* kCurrentArena = nullptr;
+
+/// Align a position upward, alignment is a power of two.
+inline char* alignUp(char* position, size_t alignment) {
+  auto address = reinterpret_cast<uintptr_t>(position);
+  address = (address + alignment - 1) & ~(uintptr_t)(alignment - 1);
+  return reinterpret_cast<char*>(address);
+}
+
+Arena::Arena(size_t block_size) : block_size_(block_size) {}
+
+Arena::~Arena() {
+  for (auto block : blocks_) {
+    delete[] block;
+  }
+  for (auto block : large_) {
+    delete[] block;
+  }
+}
+
+void* Arena::allocate(size_t size, size_t alignment) {
+  if (position_ != nullptr) {
+    auto start = alignUp(position_, alignment);
+    if (start <= end_ && size <= (size_t)(end_ - start)) {
+      position_ = start + size;
+      allocated_ += size;
+      return start;
+    }
+  }
+  return allocateBlock(size, alignment);
+}
+
+void* Arena::allocateBlock(size_t size, size_t alignment) {
+  allocated_ += size;
+
+  // Large allocations would waste most of a regular block.
+  if (size + alignment > block_size_ / 4) {
+    auto block = new char[size + alignment];
+    large_.push_back(block);
+    return alignUp(block, alignment);
+  }
+
+  auto block = new char[block_size_];
+  blocks_.push_back(block);
+  auto start = alignUp(block, alignment);
+  position_ = start + size;
+  end_ = block + block_size_;
+  return start;
+}
+
+void Arena::reset() {
+  for (auto block : large_) {
+    delete[] block;
+  }
+  large_.clear();
+
+  if (!blocks_.empty()) {
+    for (size_t i = 1; i < blocks_.size(); ++i) {
+      delete[] blocks_[i];
+    }
+    blocks_.resize(1);
+    position_ = blocks_[0];
+    end_ = blocks_[0] + block_size_;
+  }
+  allocated_ = 0;
+}
+
+Arena* Arena::current() { return kCurrentArena; }
+
+ScopedArena::ScopedArena(Arena& arena)
+    : arena_(arena), previous_(kCurrentArena) {
+  kCurrentArena = &arena_;
+}
+
+ScopedArena::~ScopedArena() {
+  kCurrentArena = previous_;
+  arena_.reset();
+}
+}
@@ -0,0 +1,156 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace osquery {
+
+/// The default size of each block of arena storage.
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+/**
+ * @brief A monotonic allocator for short-lived, single-threaded work.
+ *
+ * Allocations are carved from large blocks and are never freed individually,
+ * all storage is released at once by reset. The first block is kept across
+ * resets so a thread reusing an arena does not allocate in steady state.
+ *
+ * An Arena is not thread safe.
+ */
+class Arena : private boost::noncopyable {
+ public:
+  explicit Arena(size_t block_size = ARENA_BLOCK_SIZE);
+  ~Arena();
+
+  /// Allocate uninitialized storage, valid until the next reset.
+  void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+  /// Release every allocation, keeping the first block for reuse.
+  void reset();
+
+  /// Bytes handed out since the last reset.
+  size_t allocated() const { return allocated_; }
+
+  /// The arena installed on this thread by a ScopedArena, or nullptr.
+  static Arena* current();
+
+ private:
+  /// Add a block of at least size bytes and allocate from it.
+  void* allocateBlock(size_t size, size_t alignment);
+
+ private:
+  /// The size of regular blocks.
+  size_t block_size_;
+
+  /// Regular blocks, the last is being allocated from.
+  std::vector<char*> blocks_;
+
+  /// Oversized allocations, each in its own block.
+  std::vector<char*> large_;
+
+  /// The next free byte and the end of the current block.
+  char* position_{nullptr};
+  char* end_{nullptr};
+
+  /// Bytes handed out since the last reset.
+  size_t allocated_{0};
+};
+
+/**
+ * @brief Install an arena as the current arena for this thread.
+ *
+ * When the scope ends the previous arena is restored and this arena is reset.
+ * Containers using an ArenaAllocator created within the scope must not
+ * outlive it.
+ */
+class ScopedArena : private boost::noncopyable {
+ public:
+  explicit ScopedArena(Arena& arena);
+  ~ScopedArena();
+
+ private:
+  Arena& arena_;
+  Arena* previous_{nullptr};
+};
+
+/**
+ * @brief A standard allocator that allocates from the current thread's arena.
+ *
+ * The arena is captured when the allocator is constructed. Without a current
+ * arena, such as outside of a scheduled query, the heap is used instead, so
+ * arena-aware containers work in any context.
+ */
+template <typename T>
+class ArenaAllocator {
+ public:
+  typedef T value_type;
+
+  template <typename U>
+  struct rebind {
+    typedef ArenaAllocator<U> other;
+  };
+
+  ArenaAllocator() : arena_(Arena::current()) {}
+  explicit ArenaAllocator(Arena* arena) : arena_(arena) {}
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena()) {}
+
+  T* allocate(size_t n) {
+    if (arena_ != nullptr) {
+      return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t) {
+    // Arena storage is released when the arena is reset.
+    if (arena_ == nullptr) {
+      ::operator delete(p);
+    }
+  }
+
+  Arena* arena() const { return arena_; }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U>& other) const {
+    return arena_ == other.arena();
+  }
+
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U>& other) const {
+    return arena_ != other.arena();
+  }
+
+ private:
+  Arena* arena_{nullptr};
+};
+
+/// A vector allocated from the current arena.
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+/// An unordered map allocated from the current arena.
+template <typename K, typename V>
+using ArenaUnorderedMap =
+    std::unordered_map<K,
+                       V,
+                       std::hash<K>,
+                       std::equal_to<K>,
+                       ArenaAllocator<std::pair<const K, V>>>;
+}
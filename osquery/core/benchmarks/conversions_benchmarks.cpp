@@ -0,0 +1,79 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <boost/lexical_cast.hpp>
+
+#include <gtest/gtest.h>
+
+#include <osquery/tables.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/core/test_util.h"
+
+namespace osquery {
+
+class ConversionsBenchmarks : public testing::Test {
+ protected:
+  void SetUp() {
+    // Integer cells as a generator would format them.
+    for (size_t i = 0; i < 64; ++i) {
+      values_.push_back(std::to_string(i * 104729 + 7));
+    }
+  }
+
+  std::vector<std::string> values_;
+};
+
+TEST_F(ConversionsBenchmarks, bench_lexical_cast_parse) {
+  long long total = 0;
+  runBenchmark([this, &total]() {
+                 for (const auto& value : values_) {
+                   total += boost::lexical_cast<long long>(value);
+                 }
+               },
+               values_.size());
+  EXPECT_GT(total, 0);
+}
+
+TEST_F(ConversionsBenchmarks, bench_parse_integer) {
+  long long total = 0;
+  runBenchmark([this, &total]() {
+                 for (const auto& value : values_) {
+                   long long integer = 0;
+                   parseInteger(value, integer);
+                   total += integer;
+                 }
+               },
+               values_.size());
+  EXPECT_GT(total, 0);
+}
+
+TEST_F(ConversionsBenchmarks, bench_lexical_cast_format) {
+  size_t size = 0;
+  runBenchmark([&size]() {
+                 for (long long i = 0; i < 64; ++i) {
+                   size += boost::lexical_cast<std::string>(i * 104729).size();
+                 }
+               },
+               64);
+  EXPECT_GT(size, 0U);
+}
+
+TEST_F(ConversionsBenchmarks, bench_bigint_format) {
+  size_t size = 0;
+  runBenchmark([&size]() {
+                 for (long long i = 0; i < 64; ++i) {
+                   size += BIGINT(i * 104729).size();
+                 }
+               },
+               64);
+  EXPECT_GT(size, 0U);
+}
+}
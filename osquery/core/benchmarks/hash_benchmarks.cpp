@@ -0,0 +1,64 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/filesystem.h>
+#include <osquery/hash.h>
+
+#include "osquery/core/test_util.h"
+
+namespace osquery {
+
+/// The size of the hashed file, large enough to defeat the read buffer.
+const size_t kHashBenchmarkSize = 1024 * 1024 * 1024;
+
+class HashBenchmarks : public testing::Test {
+ protected:
+  void SetUp() {
+    // A sparse file reads as zeros without writing a gigabyte to disk.
+    path_ = kTestWorkingDirectory + "hash-benchmark.bin";
+    int fd = ::open(path_.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0600);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(::ftruncate(fd, kHashBenchmarkSize), 0);
+    ::close(fd);
+  }
+
+  void TearDown() { remove(path_); }
+
+  std::string path_;
+};
+
+TEST_F(HashBenchmarks, bench_hash_buffer_sha256) {
+  std::string buffer(64 * 1024 * 1024, 0);
+  runBenchmark(
+      [&buffer]() {
+        hashFromBuffer(HASH_TYPE_SHA256, buffer.data(), buffer.size());
+      },
+      1,
+      buffer.size());
+}
+
+TEST_F(HashBenchmarks, bench_hash_file_sha256) {
+  runBenchmark([this]() { hashFromFile(HASH_TYPE_SHA256, path_); },
+               1,
+               kHashBenchmarkSize);
+}
+
+TEST_F(HashBenchmarks, bench_hash_file_multi) {
+  int mask = HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256;
+  runBenchmark([this, mask]() { hashMultiFromFile(mask, path_); },
+               1,
+               kHashBenchmarkSize);
+}
+}
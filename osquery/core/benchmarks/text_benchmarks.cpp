@@ -0,0 +1,69 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/core.h>
+
+#include "osquery/core/test_util.h"
+
+namespace osquery {
+
+class TextBenchmarks : public testing::Test {
+ protected:
+  void SetUp() {
+    // A /proc-like line of whitespace-delimited fields.
+    for (size_t i = 0; i < 64; ++i) {
+      fields_.push_back("field" + std::to_string(i));
+    }
+    line_ = join(fields_, " ");
+  }
+
+  std::vector<std::string> fields_;
+  std::string line_;
+};
+
+TEST_F(TextBenchmarks, bench_split) {
+  size_t count = 0;
+  runBenchmark([this, &count]() { count += split(line_).size(); },
+               fields_.size(),
+               line_.size());
+  EXPECT_EQ(count % fields_.size(), 0U);
+}
+
+TEST_F(TextBenchmarks, bench_split_occurrences) {
+  size_t count = 0;
+  runBenchmark([this, &count]() { count += split(line_, " ", 8).size(); },
+               9,
+               line_.size());
+  EXPECT_EQ(count % 9, 0U);
+}
+
+TEST_F(TextBenchmarks, bench_tokenizer) {
+  size_t count = 0;
+  runBenchmark([this, &count]() {
+                 Tokenizer fields(line_);
+                 while (fields.next()) {
+                   count++;
+                 }
+               },
+               fields_.size(),
+               line_.size());
+  EXPECT_EQ(count % fields_.size(), 0U);
+}
+
+TEST_F(TextBenchmarks, bench_join) {
+  size_t size = 0;
+  runBenchmark([this, &size]() { size += join(fields_, " ").size(); },
+               fields_.size(),
+               line_.size());
+  EXPECT_EQ(size % line_.size(), 0U);
+}
+}
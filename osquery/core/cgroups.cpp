@@ -0,0 +1,225 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <osquery/core.h>
+#include <osquery/filesystem.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/cgroups.h"
+
+namespace osquery {
+
+/// The cgroup v2 unified hierarchy mount.
+const std::string kCgroupMount = "/sys/fs/cgroup";
+
+/// Controllers delegated to the child cgroups.
+const std::vector<std::string> kCgroupControllers = {"cpu", "memory", "io"};
+
+/// The cpu.max period in microseconds.
+const size_t kCgroupCPUPeriod = 100000;
+
+/// Report 100ms of memory stalls within a second.
+const std::string kMemoryPressureTrigger = "some 100000 1000000";
+
+/// Report 250ms of CPU stalls within a second.
+const std::string kCPUPressureTrigger = "some 250000 1000000";
+
+WatcherCgroups::~WatcherCgroups() {
+  while (!triggers_.empty()) {
+    closeTriggers(triggers_.begin()->first);
+  }
+}
+
+Status WatcherCgroups::getProcessCgroup(std::string& root) {
+  if (!pathExists(kCgroupMount + "/cgroup.controllers").ok()) {
+    return Status(1, "No cgroup v2 unified hierarchy");
+  }
+
+  std::string content;
+  if (!readFile("/proc/self/cgroup", content).ok()) {
+    return Status(1, "Cannot read process cgroup");
+  }
+
+  // The unified hierarchy's line is "0::<path>".
+  for (const auto& line : split(content, "\n")) {
+    if (line.compare(0, 3, "0::") == 0) {
+      auto path = line.substr(3);
+      root = kCgroupMount + ((path == "/") ? "" : path);
+      return Status(0, "OK");
+    }
+  }
+  return Status(1, "Process has no cgroup v2 cgroup");
+}
+
+Status WatcherCgroups::setUp(const std::string& root) {
+  std::string content;
+  if (!readFile(root + "/cgroup.controllers", content).ok()) {
+    return Status(1, "Cannot read cgroup controllers: " + root);
+  }
+  auto available = split(content, " \n");
+
+  // Processes cannot share a cgroup with enabled child controllers.
+  auto watcher = root + "/watcher";
+  if (::mkdir(watcher.c_str(), 0755) != 0 && errno != EEXIST) {
+    return Status(1, "Cannot create cgroup: " + watcher);
+  }
+  if (!writeFile(watcher + "/cgroup.procs", std::to_string(getpid()))) {
+    return Status(1, "Cannot move the watcher to cgroup: " + watcher);
+  }
+
+  for (const auto& controller : kCgroupControllers) {
+    if (std::find(available.begin(), available.end(), controller) ==
+        available.end()) {
+      continue;
+    }
+    if (writeFile(root + "/cgroup.subtree_control", "+" + controller)) {
+      controllers_.insert(controller);
+    } else {
+      VLOG(1) << "Cannot enable cgroup controller: " << controller;
+    }
+  }
+
+  if (controllers_.empty()) {
+    return Status(1, "No cgroup controllers could be enabled: " + root);
+  }
+  root_ = root;
+  return Status(0, "OK");
+}
+
+std::string WatcherCgroups::prepare(const std::string& name,
+                                    const CgroupLimits& limits) {
+  if (!active()) {
+    return "";
+  }
+
+  auto path = root_ + "/" + name;
+  if (::mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+    VLOG(1) << "Cannot create cgroup: " << path;
+    return "";
+  }
+
+  // A limit that cannot be written is left to the watcher's checks.
+  if (controllers_.count("cpu") > 0) {
+    auto quota = (limits.cpu_percent > 0)
+                     ? std::to_string(limits.cpu_percent * kCgroupCPUPeriod /
+                                      100)
+                     : "max";
+    writeFile(path + "/cpu.max",
+              quota + " " + std::to_string(kCgroupCPUPeriod));
+  }
+  if (controllers_.count("memory") > 0) {
+    writeFile(path + "/memory.high",
+              (limits.memory_high > 0) ? std::to_string(limits.memory_high)
+                                       : "max");
+    writeFile(path + "/memory.max",
+              (limits.memory_max > 0) ? std::to_string(limits.memory_max)
+                                      : "max");
+  }
+  if (controllers_.count("io") > 0 && limits.io_weight > 0) {
+    writeFile(path + "/io.weight",
+              "default " + std::to_string(limits.io_weight));
+  }
+
+  closeTriggers(name);
+  triggers_[name] =
+      std::make_pair(openTrigger(path + "/memory.pressure",
+                                 kMemoryPressureTrigger),
+                     openTrigger(path + "/cpu.pressure", kCPUPressureTrigger));
+  return path + "/cgroup.procs";
+}
+
+CgroupPressure WatcherCgroups::pressure(const std::string& name) {
+  CgroupPressure pressure;
+  auto triggers = triggers_.find(name);
+  if (triggers == triggers_.end()) {
+    return pressure;
+  }
+
+  struct pollfd fds[2];
+  fds[0].fd = triggers->second.first;
+  fds[1].fd = triggers->second.second;
+  for (auto& fd : fds) {
+    fd.events = POLLPRI;
+    fd.revents = 0;
+  }
+
+  // Negative descriptors are ignored, the kernel latches each event.
+  if (::poll(fds, 2, 0) <= 0) {
+    return pressure;
+  }
+  pressure.memory = (fds[0].revents & POLLPRI) != 0;
+  pressure.cpu = (fds[1].revents & POLLPRI) != 0;
+  if ((fds[0].revents | fds[1].revents) & POLLERR) {
+    // The cgroup was removed.
+    closeTriggers(name);
+  }
+  return pressure;
+}
+
+bool WatcherCgroups::writeFile(const std::string& path,
+                               const std::string& value) {
+  int fd = ::open(path.c_str(), O_WRONLY | O_TRUNC | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  auto written = ::write(fd, value.c_str(), value.size());
+  ::close(fd);
+  return written == (ssize_t)value.size();
+}
+
+int WatcherCgroups::openTrigger(const std::string& path,
+                                const std::string& trigger) {
+  int fd = ::open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  // The trigger string includes its terminator.
+  if (::write(fd, trigger.c_str(), trigger.size() + 1) < 0) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void WatcherCgroups::closeTriggers(const std::string& name) {
+  auto triggers = triggers_.find(name);
+  if (triggers == triggers_.end()) {
+    return;
+  }
+
+  if (triggers->second.first >= 0) {
+    ::close(triggers->second.first);
+  }
+  if (triggers->second.second >= 0) {
+    ::close(triggers->second.second);
+  }
+  triggers_.erase(triggers);
+}
+
+void joinCgroup(const char* procs) {
+  int fd = ::open(procs, O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  // Writing 0 moves the writing process, else it stays with the watcher.
+  auto written = ::write(fd, "0", 1);
+  (void)written;
+  ::close(fd);
+}
+}
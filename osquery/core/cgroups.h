@@ -0,0 +1,122 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/// Resource limits applied to a watched process's cgroup.
+struct CgroupLimits {
+  /// Percent of one CPU the cgroup may use each period, 0 for no quota.
+  size_t cpu_percent{0};
+  /// Bytes above which the kernel throttles and reclaims, 0 for no limit.
+  uint64_t memory_high{0};
+  /// Bytes above which the kernel OOM kills, 0 for no limit.
+  uint64_t memory_max{0};
+  /// The proportional IO weight, 1 to 10000, 0 leaves the default (100).
+  size_t io_weight{0};
+};
+
+/// Pressure stalls reported by a cgroup's PSI triggers.
+struct CgroupPressure {
+  bool memory{false};
+  bool cpu{false};
+};
+
+/**
+ * @brief Linux cgroup v2 placement for the worker and managed extensions.
+ *
+ * The watcher's own cgroup becomes the parent of one cgroup for each child,
+ * with the CPU, memory, and IO controllers enabled. A cgroup v2 parent with
+ * enabled controllers cannot hold processes, so the watcher moves itself to
+ * a "watcher" leaf. Under systemd the unit needs Delegate=yes.
+ *
+ * The kernel enforces the limits as they are crossed, and pressure stall
+ * (PSI) triggers report when a child is stalled on memory or CPU. The
+ * watcher's polling checks remain, cgroups are only a first line.
+ */
+class WatcherCgroups : private boost::noncopyable {
+ public:
+  WatcherCgroups() {}
+  ~WatcherCgroups();
+
+  /**
+   * @brief Find the cgroup v2 directory of the calling process.
+   *
+   * @param root Output directory, within the unified hierarchy mount.
+   * @return Failure if there is no unified hierarchy, such as on OS X.
+   */
+  static Status getProcessCgroup(std::string& root);
+
+  /**
+   * @brief Delegate a cgroup's controllers to child cgroups.
+   *
+   * @param root The watcher's cgroup directory.
+   * @return Failure if the cgroup is not writable or has no controllers.
+   */
+  Status setUp(const std::string& root);
+
+  /// True if children are placed in cgroups.
+  bool active() const { return !root_.empty(); }
+
+  /**
+   * @brief Create, or reuse, a child's cgroup and apply its limits.
+   *
+   * Call before forking the child, the child joins with joinCgroup. The
+   * cgroup's PSI triggers are opened here, and replace earlier triggers.
+   *
+   * @param name The cgroup name, reused when the child respawns.
+   * @param limits The limits written to the cgroup's controller files.
+   * @return The cgroup.procs path the child joins, empty on failure.
+   */
+  std::string prepare(const std::string& name, const CgroupLimits& limits);
+
+  /// Take the pressure reported by a cgroup's triggers since the last check.
+  CgroupPressure pressure(const std::string& name);
+
+ private:
+  /// Write a value to a cgroup file.
+  static bool writeFile(const std::string& path, const std::string& value);
+
+  /// Open a PSI trigger, -1 if the kernel does not support them.
+  static int openTrigger(const std::string& path, const std::string& trigger);
+
+  /// Close the PSI triggers of a cgroup.
+  void closeTriggers(const std::string& name);
+
+ private:
+  /// The watcher's cgroup, the parent of each child's cgroup.
+  std::string root_;
+
+  /// Controllers enabled for the child cgroups.
+  std::set<std::string> controllers_;
+
+  /// The memory and CPU PSI trigger descriptors of each child cgroup.
+  std::map<std::string, std::pair<int, int>> triggers_;
+};
+
+/**
+ * @brief Join a cgroup from a forked child before it executes.
+ *
+ * Only async-signal-safe calls are used, the watcher has many threads.
+ *
+ * @param procs The cgroup.procs path returned by WatcherCgroups::prepare.
+ */
+void joinCgroup(const char* procs);
+}
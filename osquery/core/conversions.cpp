@@ -8,8 +8,20 @@
  *
  */
 
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <sstream>
 
+#include <zlib.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 #include <boost/algorithm/string.hpp>
 #include <boost/archive/iterators/transform_width.hpp>
 #include <boost/archive/iterators/binary_from_base64.hpp>
@@ -76,4 +88,268 @@ bool isPrintable(const std::string& check) {
   }
   return true;
 }
+
+size_t findNonPrintable(const char* data, size_t size) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256i space32 = _mm256_set1_epi8(0x20);
+  for (; i + 32 <= size; i += 32) {
+    auto chunk =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    // As signed bytes, 0x80-0xFF are negative and compare below 0x20.
+    int mask = _mm256_movemask_epi8(_mm256_cmpgt_epi8(space32, chunk));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i space = _mm_set1_epi8(0x20);
+  for (; i + 16 <= size; i += 16) {
+    auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    int mask = _mm_movemask_epi8(_mm_cmplt_epi8(chunk, space));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; i < size; ++i) {
+    auto c = (unsigned char)data[i];
+    if (c < 0x20 || c >= 0x80) {
+      return i;
+    }
+  }
+  return size;
+}
+
+/// Parse the digits of an unsigned magnitude no greater than max.
+static bool parseDigits(const char* data,
+                        size_t size,
+                        unsigned long long max,
+                        unsigned long long& value) {
+  if (size == 0) {
+    return false;
+  }
+
+  unsigned long long result = 0;
+  for (size_t i = 0; i < size; ++i) {
+    unsigned digit = static_cast<unsigned char>(data[i]) - '0';
+    if (digit > 9 || result > (max - digit) / 10) {
+      return false;
+    }
+    result = result * 10 + digit;
+  }
+  value = result;
+  return true;
+}
+
+bool parseInteger(const char* data, size_t size, long long& value) {
+  bool negative = size > 0 && data[0] == '-';
+  size_t sign = (size > 0 && (negative || data[0] == '+')) ? 1 : 0;
+  unsigned long long max = std::numeric_limits<long long>::max();
+  unsigned long long magnitude = 0;
+  if (!parseDigits(data + sign, size - sign, max + negative, magnitude)) {
+    return false;
+  }
+  // The magnitude of the minimum is not representable as a long long.
+  value = negative ? static_cast<long long>(0 - magnitude)
+                   : static_cast<long long>(magnitude);
+  return true;
+}
+
+bool parseInteger(const char* data, size_t size, unsigned long long& value) {
+  size_t sign = (size > 0 && data[0] == '+') ? 1 : 0;
+  return parseDigits(data + sign,
+                     size - sign,
+                     std::numeric_limits<unsigned long long>::max(),
+                     value);
+}
+
+bool parseDouble(const std::string& text, double& value) {
+  if (text.empty() || isspace(static_cast<unsigned char>(text[0]))) {
+    return false;
+  }
+
+  char* end = nullptr;
+  errno = 0;
+  double result = strtod(text.c_str(), &end);
+  if (end != text.c_str() + text.size() || errno == ERANGE) {
+    return false;
+  }
+  value = result;
+  return true;
+}
+
+/// Write the digits of a value ending at the end of a buffer.
+static char* writeDigits(char* end, unsigned long long value) {
+  do {
+    *--end = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  return end;
+}
+
+void appendInteger(std::string& text, long long value) {
+  char buffer[24];
+  auto magnitude = static_cast<unsigned long long>(value);
+  auto start = writeDigits(buffer + sizeof(buffer),
+                           (value < 0) ? 0 - magnitude : magnitude);
+  if (value < 0) {
+    *--start = '-';
+  }
+  text.append(start, buffer + sizeof(buffer) - start);
+}
+
+void appendInteger(std::string& text, unsigned long long value) {
+  char buffer[24];
+  auto start = writeDigits(buffer + sizeof(buffer), value);
+  text.append(start, buffer + sizeof(buffer) - start);
+}
+
+void appendDouble(std::string& text, double value) {
+  // The precision boost::lexical_cast uses, so values round trip.
+  char buffer[32];
+  int size = snprintf(buffer, sizeof(buffer), "%.17g", value);
+  if (size > 0) {
+    text.append(buffer, std::min((size_t)size, sizeof(buffer) - 1));
+  }
+}
+
+Status compressGzip(const std::string& data, std::string& compressed) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  // A window of 15 bits, plus 16 to write a gzip header and trailer.
+  if (deflateInit2(&stream,
+                   Z_DEFAULT_COMPRESSION,
+                   Z_DEFLATED,
+                   15 + 16,
+                   8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return Status(1, "Cannot initialize gzip compression");
+  }
+
+  // The bound includes the gzip wrapper, so a single deflate call finishes.
+  compressed.resize(deflateBound(&stream, data.size()));
+  stream.next_in = (Bytef*)data.data();
+  stream.avail_in = data.size();
+  stream.next_out = (Bytef*)&compressed[0];
+  stream.avail_out = compressed.size();
+
+  auto result = deflate(&stream, Z_FINISH);
+  compressed.resize(stream.total_out);
+  deflateEnd(&stream);
+  if (result != Z_STREAM_END) {
+    compressed.clear();
+    return Status(1, "Cannot compress gzip stream");
+  }
+  return Status(0, "OK");
+}
+
+/// Bytes added to a zlib output buffer when it is filled.
+const size_t kGzipChunkSize = 16 * 1024;
+
+GzipCompressor::GzipCompressor(std::string& compressed)
+    : compressed_(compressed), stream_(new z_stream) {
+  memset(stream_.get(), 0, sizeof(z_stream));
+  // A window of 15 bits, plus 16 to write a gzip header and trailer.
+  if (deflateInit2(stream_.get(),
+                   Z_DEFAULT_COMPRESSION,
+                   Z_DEFLATED,
+                   15 + 16,
+                   8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    stream_.reset();
+  }
+}
+
+GzipCompressor::~GzipCompressor() {
+  if (stream_ != nullptr) {
+    deflateEnd(stream_.get());
+  }
+}
+
+Status GzipCompressor::deflate(const char* data, size_t size, int flush) {
+  if (stream_ == nullptr || finished_) {
+    return Status(1, "Cannot compress gzip stream");
+  }
+
+  stream_->next_in = (Bytef*)data;
+  stream_->avail_in = size;
+  int result = Z_OK;
+  do {
+    // Compressed bytes are written directly to the end of the output.
+    size_t written = compressed_.size();
+    compressed_.resize(written + kGzipChunkSize);
+    stream_->next_out = (Bytef*)&compressed_[written];
+    stream_->avail_out = kGzipChunkSize;
+    result = ::deflate(stream_.get(), flush);
+    compressed_.resize(compressed_.size() - stream_->avail_out);
+    if (result == Z_STREAM_ERROR) {
+      return Status(1, "Cannot compress gzip stream");
+    }
+  } while (stream_->avail_out == 0 ||
+           (flush == Z_FINISH && result != Z_STREAM_END));
+  return Status(0, "OK");
+}
+
+Status GzipCompressor::compress(const char* data, size_t size) {
+  return deflate(data, size, Z_NO_FLUSH);
+}
+
+Status GzipCompressor::finish() {
+  auto status = deflate(nullptr, 0, Z_FINISH);
+  finished_ = true;
+  return status;
+}
+
+size_t GzipCompressor::size() const {
+  return (stream_ == nullptr) ? 0 : stream_->total_in;
+}
+
+Status decompressGzip(const std::string& compressed,
+                      std::string& data,
+                      size_t max) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  // A window of 15 bits, plus 32 to detect a gzip or zlib wrapper.
+  if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+    return Status(1, "Cannot initialize gzip decompression");
+  }
+
+  data.clear();
+  stream.next_in = (Bytef*)compressed.data();
+  stream.avail_in = compressed.size();
+  int result = Z_OK;
+  while (result == Z_OK) {
+    // Compressed JSON is usually several times smaller than its content.
+    size_t written = data.size();
+    size_t chunk = std::max(compressed.size() * 4, kGzipChunkSize);
+    if (max > 0 && written + chunk > max) {
+      if (written >= max) {
+        result = Z_MEM_ERROR;
+        break;
+      }
+      chunk = max - written;
+    }
+    data.resize(written + chunk);
+    stream.next_out = (Bytef*)&data[written];
+    stream.avail_out = chunk;
+    result = inflate(&stream, Z_NO_FLUSH);
+    data.resize(data.size() - stream.avail_out);
+    if (result == Z_BUF_ERROR && stream.avail_out > 0) {
+      // The input ended before the stream did.
+      break;
+    }
+    if (result == Z_BUF_ERROR) {
+      result = Z_OK;
+    }
+  }
+  inflateEnd(&stream);
+
+  if (result != Z_STREAM_END) {
+    data.clear();
+    return Status(1, "Cannot decompress gzip stream");
+  }
+  return Status(0, "OK");
+}
 }
@@ -10,15 +10,25 @@
 
 #pragma once
 
+#include <cstddef>
+#include <limits>
 #include <memory>
+#include <string>
+#include <type_traits>
 
 #include <boost/bind.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
 
+#include <osquery/status.h>
+
 #ifdef DARWIN
 #include <CoreFoundation/CoreFoundation.h>
 #endif
 
+/// The zlib stream, see zlib.h.
+struct z_stream_s;
+
 namespace osquery {
 
 template <typename T>
@@ -69,6 +79,123 @@ std::string base64Encode(const std::string& unencoded);
  */
 bool isPrintable(const std::string& check);
 
+/**
+ * @brief Find the first byte outside of 0x20-0x7F.
+ *
+ * Clean data is scanned 16 or 32 bytes at a time where SSE2 or AVX2 is
+ * available, so callers can skip copying and escaping strings that do not
+ * need it.
+ *
+ * @param data The bytes to scan.
+ * @param size The number of bytes.
+ * @return The offset of the first such byte, or size if there are none.
+ */
+size_t findNonPrintable(const char* data, size_t size);
+
+/**
+ * @brief Parse a base 10 integer without exceptions or the locale.
+ *
+ * The text must be an optional sign and digits, as boost::lexical_cast
+ * requires, without whitespace. Unlike boost::lexical_cast a negative value
+ * is not wrapped into an unsigned type.
+ *
+ * @param data The text to parse.
+ * @param size The length of the text.
+ * @param value The output integer, unchanged on failure.
+ * @return false if the text is not an integer or does not fit.
+ */
+bool parseInteger(const char* data, size_t size, long long& value);
+bool parseInteger(const char* data, size_t size, unsigned long long& value);
+
+/// Parse a base 10 integer into any integral type, see parseInteger.
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value, bool>::type parseInteger(
+    const std::string& text, T& value) {
+  typedef typename std::conditional<std::is_signed<T>::value,
+                                    long long,
+                                    unsigned long long>::type Wide;
+  Wide wide;
+  if (!parseInteger(text.data(), text.size(), wide) ||
+      wide < static_cast<Wide>(std::numeric_limits<T>::min()) ||
+      wide > static_cast<Wide>(std::numeric_limits<T>::max())) {
+    return false;
+  }
+  value = static_cast<T>(wide);
+  return true;
+}
+
+/**
+ * @brief Parse a decimal floating point number without exceptions.
+ *
+ * The whole text must be consumed, leading whitespace is not allowed.
+ *
+ * @return false if the text is not a number or is out of range.
+ */
+bool parseDouble(const std::string& text, double& value);
+
+/// Append the base 10 text of an integer without a temporary string.
+void appendInteger(std::string& text, long long value);
+void appendInteger(std::string& text, unsigned long long value);
+
+/// Append a double as the DOUBLE macro formats it, with 17 digits.
+void appendDouble(std::string& text, double value);
+
+/**
+ * @brief Compress a string into a gzip stream.
+ *
+ * The output is suitable for an HTTP body with "Content-Encoding: gzip".
+ *
+ * @param data The bytes to compress.
+ * @param compressed The output gzip stream.
+ * @return Failure if zlib could not compress the input.
+ */
+Status compressGzip(const std::string& data, std::string& compressed);
+
+/**
+ * @brief Compress appended pieces of data into a gzip stream.
+ *
+ * Callers building large bodies compress each piece as it is written, and
+ * only hold the compressed body and the current piece in memory.
+ */
+class GzipCompressor : private boost::noncopyable {
+ public:
+  /// Append the gzip stream to compressed.
+  explicit GzipCompressor(std::string& compressed);
+  ~GzipCompressor();
+
+  /// Compress the next piece of data.
+  Status compress(const char* data, size_t size);
+  Status compress(const std::string& data) {
+    return compress(data.data(), data.size());
+  }
+
+  /// Flush the remaining input and write the gzip trailer.
+  Status finish();
+
+  /// Bytes of data compressed.
+  size_t size() const;
+
+ private:
+  Status deflate(const char* data, size_t size, int flush);
+
+ private:
+  std::string& compressed_;
+  std::unique_ptr<z_stream_s> stream_;
+  bool finished_{false};
+};
+
+/**
+ * @brief Decompress a gzip or zlib stream.
+ *
+ * @param compressed The compressed stream.
+ * @param data The output decompressed bytes.
+ * @param max Fail if more than max bytes would be written, 0 for no limit.
+ * @return Failure if the stream is corrupt, truncated, or too large.
+ */
+Status decompressGzip(const std::string& compressed,
+                      std::string& data,
+                      size_t max = 0);
+
 #ifdef DARWIN
 /**
  * @brief Convert a CFStringRef to a std::string.
@@ -9,8 +9,21 @@
  */
 
 #include <iomanip>
+#include <memory>
 #include <sstream>
+#include <vector>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
+
+#include <osquery/database.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/hash.h>
 #include <osquery/logger.h>
 
@@ -20,23 +33,36 @@ namespace osquery {
   #import <CommonCrypto/CommonDigest.h>
   #define __HASH_API(name) CC_##name
 #else
-  #include <openssl/sha.h>
-  #include <openssl/md5.h>
-  #define __HASH_API(name) name
-
-  #define SHA1_DIGEST_LENGTH SHA_DIGEST_LENGTH
-  #define SHA1_CTX SHA_CTX
+  // The EVP interface selects the CPU's SHA and AES-NI/AVX implementations.
+  #include <openssl/evp.h>
 #endif
 
-#define HASH_CHUNK_SIZE 1024
+/// Files are read in large chunks, each chunk updates every digest.
+#define HASH_CHUNK_SIZE (1024 * 1024)
+
+/// Read buffers are page aligned, letting the kernel copy whole pages.
+#define HASH_BUFFER_ALIGNMENT 4096
+
+FLAG(bool,
+     disable_hash_cache,
+     false,
+     "Disable caching file hashes and YARA results in the backing store");
+
+/// Cached digests are keyed by the hashed path.
+const std::string kHashCachePrefix = "hash.";
 
 Hash::~Hash() {
   if (ctx_ != nullptr) {
+#ifdef __APPLE__
     free(ctx_);
+#else
+    EVP_MD_CTX_destroy((EVP_MD_CTX*)ctx_);
+#endif
   }
 }
 
 Hash::Hash(HashType algorithm) : algorithm_(algorithm) {
+#ifdef __APPLE__
   if (algorithm_ == HASH_TYPE_MD5) {
     length_ = __HASH_API(MD5_DIGEST_LENGTH);
     ctx_ = (__HASH_API(MD5_CTX)*)malloc(sizeof(__HASH_API(MD5_CTX)));
@@ -52,9 +78,29 @@ Hash::Hash(HashType algorithm) : algorithm_(algorithm) {
   } else {
     throw std::domain_error("Unknown hash function");
   }
+#else
+  const EVP_MD* md = nullptr;
+  if (algorithm_ == HASH_TYPE_MD5) {
+    md = EVP_md5();
+  } else if (algorithm_ == HASH_TYPE_SHA1) {
+    md = EVP_sha1();
+  } else if (algorithm_ == HASH_TYPE_SHA256) {
+    md = EVP_sha256();
+  } else {
+    throw std::domain_error("Unknown hash function");
+  }
+
+  length_ = EVP_MD_size(md);
+  ctx_ = EVP_MD_CTX_create();
+  if (ctx_ == nullptr ||
+      EVP_DigestInit_ex((EVP_MD_CTX*)ctx_, md, nullptr) != 1) {
+    throw std::runtime_error("Cannot initialize hash function");
+  }
+#endif
 }
 
 void Hash::update(const void* buffer, size_t size) {
+#ifdef __APPLE__
   if (algorithm_ == HASH_TYPE_MD5) {
     __HASH_API(MD5_Update)((__HASH_API(MD5_CTX)*)ctx_, buffer, size);
   } else if (algorithm_ == HASH_TYPE_SHA1) {
@@ -62,11 +108,15 @@ void Hash::update(const void* buffer, size_t size) {
   } else if (algorithm_ == HASH_TYPE_SHA256) {
     __HASH_API(SHA256_Update)((__HASH_API(SHA256_CTX)*)ctx_, buffer, size);
   }
+#else
+  EVP_DigestUpdate((EVP_MD_CTX*)ctx_, buffer, size);
+#endif
 }
 
 std::string Hash::digest() {
   unsigned char hash[length_];
 
+#ifdef __APPLE__
   if (algorithm_ == HASH_TYPE_MD5) {
     __HASH_API(MD5_Final)(hash, (__HASH_API(MD5_CTX)*)ctx_);
   } else if (algorithm_ == HASH_TYPE_SHA1) {
@@ -74,6 +124,9 @@ std::string Hash::digest() {
   } else if (algorithm_ == HASH_TYPE_SHA256) {
     __HASH_API(SHA256_Final)(hash, (__HASH_API(SHA256_CTX)*)ctx_);
   }
+#else
+  EVP_DigestFinal_ex((EVP_MD_CTX*)ctx_, hash, nullptr);
+#endif
 
   // The hash value is only relevant as a hex digest.
   std::stringstream digest;
@@ -91,22 +144,118 @@ std::string hashFromBuffer(HashType hash_type, const void* buffer, size_t size)
 }
 
 std::string hashFromFile(HashType hash_type, const std::string& path) {
-  Hash hash(hash_type);
+  auto hashes = hashMultiFromFile(hash_type, path);
+  if (hash_type == HASH_TYPE_MD5) {
+    return hashes.md5;
+  } else if (hash_type == HASH_TYPE_SHA1) {
+    return hashes.sha1;
+  }
+  return hashes.sha256;
+}
+
+MultiHashes hashMultiFromFile(int mask, const std::string& path) {
+  MultiHashes hashes;
+  std::vector<std::pair<std::string*, std::unique_ptr<Hash>>> digests;
+  for (const auto& type : {HASH_TYPE_MD5, HASH_TYPE_SHA1, HASH_TYPE_SHA256}) {
+    if ((mask & type) == 0) {
+      continue;
+    }
 
-  FILE* file = fopen(path.c_str(), "rb");
-  if (file == nullptr) {
+    auto digest = (type == HASH_TYPE_MD5)
+                      ? &hashes.md5
+                      : ((type == HASH_TYPE_SHA1) ? &hashes.sha1
+                                                  : &hashes.sha256);
+    digests.emplace_back(digest, std::unique_ptr<Hash>(new Hash(type)));
+  }
+
+  if (digests.empty()) {
+    return hashes;
+  }
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
     VLOG(1) << "Cannot hash/open file " << path;
-    return "";
+    return hashes;
   }
 
-  // Then call updates with read chunks.
-  size_t bytes_read = 0;
-  unsigned char buffer[HASH_CHUNK_SIZE];
-  while ((bytes_read = fread(buffer, 1, HASH_CHUNK_SIZE, file))) {
-    hash.update(buffer, bytes_read);
+  // The file is read once, front to back, ask for aggressive readahead.
+  // Files are read rather than mapped, a file truncated while it is hashed
+  // would fault a mapping with SIGBUS.
+#ifdef POSIX_FADV_SEQUENTIAL
+  ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  void* aligned = nullptr;
+  if (::posix_memalign(&aligned, HASH_BUFFER_ALIGNMENT, HASH_CHUNK_SIZE) != 0) {
+    ::close(fd);
+    return hashes;
   }
+  std::unique_ptr<void, decltype(&free)> buffer(aligned, free);
 
-  fclose(file);
-  return hash.digest();
+  // Then call each digest's update with the same read chunks.
+  bool failed = false;
+  ssize_t bytes_read = 0;
+  while ((bytes_read = ::read(fd, buffer.get(), HASH_CHUNK_SIZE)) != 0) {
+    if (bytes_read < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      failed = true;
+      break;
+    }
+
+    for (auto& digest : digests) {
+      digest.second->update(buffer.get(), bytes_read);
+    }
+  }
+
+  ::close(fd);
+  if (failed) {
+    VLOG(1) << "Cannot hash/read file " << path;
+    return hashes;
+  }
+
+  for (auto& digest : digests) {
+    *digest.first = digest.second->digest();
+  }
+  hashes.mask = mask;
+  return hashes;
+}
+
+MultiHashes hashMultiFromFileCached(int mask, const std::string& path) {
+  std::string identity;
+  if (FLAGS_disable_hash_cache || !getFileIdentity(path, identity).ok()) {
+    return hashMultiFromFile(mask, path);
+  }
+
+  // A cache entry is formatted: identity, mask, md5, sha1, sha256.
+  std::string content;
+  std::vector<std::string> cached;
+  if (getDatabaseValue(kFileCache, kHashCachePrefix + path, content).ok()) {
+    boost::split(cached, content, boost::is_any_of("\n"));
+  }
+
+  MultiHashes hashes;
+  if (cached.size() == 5 && cached[0] == identity) {
+    hashes.mask = std::atoi(cached[1].c_str());
+    if ((hashes.mask & mask) == mask) {
+      hashes.md5 = std::move(cached[2]);
+      hashes.sha1 = std::move(cached[3]);
+      hashes.sha256 = std::move(cached[4]);
+      return hashes;
+    }
+    // Recompute the cached digests too, so the entry keeps them.
+    mask |= hashes.mask;
+  }
+
+  // The identity is read before hashing, a write while hashing changes the
+  // identity and the cached digests are not reused.
+  hashes = hashMultiFromFile(mask, path);
+  if (hashes.mask != 0) {
+    content = identity + "\n" + std::to_string(hashes.mask) + "\n" +
+              hashes.md5 + "\n" + hashes.sha1 + "\n" + hashes.sha256;
+    setDatabaseValue(kFileCache, kHashCachePrefix + path, content);
+  }
+  return hashes;
 }
 }
@@ -28,8 +28,10 @@
 #include <osquery/logger.h>
 #include <osquery/registry.h>
 
+#include "osquery/core/tracing.h"
 #include "osquery/core/watcher.h"
 #include "osquery/database/db_handle.h"
+#include "osquery/logger/result_stream.h"
 
 #ifdef __linux__
 #include <sys/resource.h>
@@ -276,17 +278,38 @@ void Initializer::initWorker(const std::string& name) {
     }
   }
 
-  // Set the worker's process name.
-  if (name.size() < name_size) {
-    std::copy(name.begin(), name.end(), (*argv_)[0]);
-    (*argv_)[0][name.size()] = '\0';
+  // Set the worker's process name, a class worker's name includes its class.
+  auto worker_class = getWorkerClass();
+  auto worker_name = (worker_class.empty()) ? name : name + " " + worker_class;
+  if (worker_name.size() < name_size) {
+    std::copy(worker_name.begin(), worker_name.end(), (*argv_)[0]);
+    (*argv_)[0][worker_name.size()] = '\0';
   } else {
     std::copy(original_name.begin(), original_name.end(), (*argv_)[0]);
     (*argv_)[0][original_name.size()] = '\0';
   }
 
+  // A class worker owns a backing store of its own and executes only its
+  // class's scheduled queries. Events, extensions, distributed queries, the
+  // result stream, and enrollment belong to the default worker; the class
+  // worker reads the node key and host identifier from its store.
+  if (!worker_class.empty()) {
+    FLAGS_database_path += "." + worker_class;
+    auto level = getWorkerLevel(worker_class);
+    if (level >= 0) {
+      FLAGS_watchdog_level = level;
+    }
+    FLAGS_disable_extensions = true;
+    Flag::updateValue("disable_events", "true");
+    Flag::updateValue("distributed_tls_read_endpoint", "");
+    Flag::updateValue("logger_stream_socket", "");
+  }
+
   // Start a watcher watcher thread to exit the process if the watcher exits.
   Dispatcher::addService(std::make_shared<WatcherWatcherRunner>(getppid()));
+
+  // The watcher signals before killing a worker that nears its limits.
+  initWatchdogPressure();
 }
 
 void Initializer::initWorkerWatcher(const std::string& name) {
@@ -304,11 +327,8 @@ void Initializer::initActivePlugin(const std::string& type,
                                    const std::string& name) {
   // Use a delay, meaning the amount of milliseconds waited for extensions.
   size_t delay = 0;
-  // The timeout is the maximum microseconds in seconds to wait for extensions.
-  size_t timeout = atoi(FLAGS_extensions_timeout.c_str()) * 1000000;
-  if (timeout < kExtensionInitializeLatencyUS * 10) {
-    timeout = kExtensionInitializeLatencyUS * 10;
-  }
+  // The timeout is the maximum microseconds to wait for extensions.
+  size_t timeout = getExtensionsTimeout();
   while (!Registry::setActive(type, name)) {
     if (!Watcher::hasManagedExtensions() || delay > timeout) {
       LOG(ERROR) << "Active " << type << " plugin not found: " << name;
@@ -323,6 +343,13 @@ void Initializer::start() {
   // Load registry/extension modules before extensions.
   osquery::loadModules();
 
+  // Record spans from the first query when a trace file is requested.
+  initTracing();
+
+  // A standby worker waits here, before opening the backing store, until the
+  // watcher promotes it.
+  waitStandbyHandoff();
+
   // Pre-extension manager initialization options checking.
   if (FLAGS_config_check && !Watcher::hasManagedExtensions()) {
     FLAGS_disable_extensions = true;
@@ -360,9 +387,14 @@ void Initializer::start() {
   // Load the osquery config using the default/active config plugin.
   Config::load();
 
-  // Initialize the status and result plugin logger.
-  initActivePlugin("logger", FLAGS_logger_plugin);
+  // Initialize the status and result plugin loggers, the first is active.
+  auto loggers = split(FLAGS_logger_plugin, ",");
+  initActivePlugin("logger", (loggers.empty()) ? "" : loggers.front());
   initLogger(binary_);
+  if (tool_ == OSQUERY_TOOL_DAEMON) {
+    // Publish scheduled results to local readers.
+    startResultStream();
+  }
 
   // Start event threads.
   osquery::attachEvents();
@@ -373,6 +405,9 @@ void Initializer::shutdown() {
   // End any event type run loops.
   EventFactory::end();
 
+  // Write the spans recorded since the last requested trace.
+  endTracing();
+
   // Hopefully release memory used by global string constructors in gflags.
   GFLAGS_NAMESPACE::ShutDownCommandLineFlags();
 }
@@ -0,0 +1,456 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <cctype>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "osquery/core/json.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+/// Nested containers beyond this depth are a parse error.
+const size_t kJSONMaxDepth = 512;
+
+/// Find the first byte that escapeJSONString must escape.
+static size_t findJSONEscape(const char* data, size_t size) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i space = _mm_set1_epi8(0x20);
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i slash = _mm_set1_epi8('/');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  for (; i + 16 <= size; i += 16) {
+    auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    // As signed bytes, 0x80-0xFF are negative and compare below 0x20.
+    auto escaped = _mm_cmplt_epi8(chunk, space);
+    escaped = _mm_or_si128(escaped, _mm_cmpeq_epi8(chunk, quote));
+    escaped = _mm_or_si128(escaped, _mm_cmpeq_epi8(chunk, slash));
+    escaped = _mm_or_si128(escaped, _mm_cmpeq_epi8(chunk, backslash));
+    int mask = _mm_movemask_epi8(escaped);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; i < size; ++i) {
+    auto c = (unsigned char)data[i];
+    if (c < 0x20 || c >= 0x80 || c == '"' || c == '/' || c == '\\') {
+      return i;
+    }
+  }
+  return size;
+}
+
+void escapeJSONString(const char* data, size_t size, std::string& output) {
+  const char* hex_chars = "0123456789ABCDEF";
+  output.reserve(output.size() + size);
+  size_t i = 0;
+  while (i < size) {
+    // Copy runs of bytes that need no escaping at once.
+    size_t clean = findJSONEscape(data + i, size - i);
+    output.append(data + i, clean);
+    i += clean;
+    if (i == size) {
+      break;
+    }
+
+    auto c = (unsigned char)data[i++];
+    if (c == '\b') {
+      output.append("\\b");
+    } else if (c == '\f') {
+      output.append("\\f");
+    } else if (c == '\n') {
+      output.append("\\n");
+    } else if (c == '\r') {
+      output.append("\\r");
+    } else if (c == '\t') {
+      output.append("\\t");
+    } else if (c == '/') {
+      output.append("\\/");
+    } else if (c == '"') {
+      output.append("\\\"");
+    } else if (c == '\\') {
+      output.append("\\\\");
+    } else {
+      output.append("\\u00");
+      output.push_back(hex_chars[c >> 4]);
+      output.push_back(hex_chars[c & 0x0F]);
+    }
+  }
+}
+
+void JSONWriter::separate() {
+  if (after_key_) {
+    after_key_ = false;
+    return;
+  }
+
+  if (!written_.empty()) {
+    if (written_.back()) {
+      output_.push_back(',');
+    }
+    written_.back() = true;
+  }
+}
+
+void JSONWriter::startObject() {
+  separate();
+  output_.push_back('{');
+  written_.push_back(false);
+}
+
+void JSONWriter::endObject() {
+  output_.push_back('}');
+  written_.pop_back();
+}
+
+void JSONWriter::startArray() {
+  separate();
+  output_.push_back('[');
+  written_.push_back(false);
+}
+
+void JSONWriter::endArray() {
+  output_.push_back(']');
+  written_.pop_back();
+}
+
+void JSONWriter::key(const std::string& name) {
+  separate();
+  output_.push_back('"');
+  escapeJSONString(name.data(), name.size(), output_);
+  output_.append("\":");
+  after_key_ = true;
+}
+
+void JSONWriter::value(const char* data, size_t size) {
+  separate();
+  output_.push_back('"');
+  escapeJSONString(data, size, output_);
+  output_.push_back('"');
+}
+
+void JSONWriter::raw(const char* data, size_t size) {
+  separate();
+  output_.append(data, size);
+}
+
+/// A recursive descent JSON parser calling a JSONHandler.
+class JSONParser {
+ public:
+  JSONParser(const std::string& json, JSONHandler& handler)
+      : json_(json), handler_(handler) {}
+
+  Status parse() {
+    skipWhitespace();
+    if (!parseValue(0)) {
+      return error();
+    }
+    skipWhitespace();
+    if (pos_ != json_.size()) {
+      return error();
+    }
+    return Status(0, "OK");
+  }
+
+ private:
+  Status error() const {
+    return Status(1, "Invalid JSON at offset " + std::to_string(pos_));
+  }
+
+  void skipWhitespace() {
+    while (pos_ < json_.size()) {
+      char c = json_[pos_];
+      if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+        break;
+      }
+      ++pos_;
+    }
+  }
+
+  bool consume(char c) {
+    skipWhitespace();
+    if (pos_ < json_.size() && json_[pos_] == c) {
+      ++pos_;
+      return true;
+    }
+    return false;
+  }
+
+  bool parseValue(size_t depth) {
+    if (pos_ >= json_.size() || depth > kJSONMaxDepth) {
+      return false;
+    }
+
+    char c = json_[pos_];
+    if (c == '{') {
+      return parseObject(depth);
+    } else if (c == '[') {
+      return parseArray(depth);
+    } else if (c == '"') {
+      std::string data;
+      if (!parseString(data)) {
+        return false;
+      }
+      handler_.value(data);
+      return true;
+    }
+    return parseLiteral();
+  }
+
+  bool parseObject(size_t depth) {
+    ++pos_;
+    handler_.startObject();
+    if (consume('}')) {
+      handler_.endObject();
+      return true;
+    }
+
+    do {
+      skipWhitespace();
+      std::string name;
+      if (pos_ >= json_.size() || json_[pos_] != '"' || !parseString(name)) {
+        return false;
+      }
+      handler_.key(name);
+      if (!consume(':')) {
+        return false;
+      }
+      skipWhitespace();
+      if (!parseValue(depth + 1)) {
+        return false;
+      }
+    } while (consume(','));
+
+    if (!consume('}')) {
+      return false;
+    }
+    handler_.endObject();
+    return true;
+  }
+
+  bool parseArray(size_t depth) {
+    ++pos_;
+    handler_.startArray();
+    if (consume(']')) {
+      handler_.endArray();
+      return true;
+    }
+
+    do {
+      skipWhitespace();
+      if (!parseValue(depth + 1)) {
+        return false;
+      }
+    } while (consume(','));
+
+    if (!consume(']')) {
+      return false;
+    }
+    handler_.endArray();
+    return true;
+  }
+
+  /// Numbers, true, false, and null are passed as their literal text.
+  bool parseLiteral() {
+    size_t start = pos_;
+    while (pos_ < json_.size() &&
+           (isalnum((unsigned char)json_[pos_]) || json_[pos_] == '-' ||
+            json_[pos_] == '+' || json_[pos_] == '.')) {
+      ++pos_;
+    }
+    if (pos_ == start) {
+      return false;
+    }
+
+    std::string data = json_.substr(start, pos_ - start);
+    if (!isdigit((unsigned char)data[0]) && data[0] != '-' &&
+        data != "true" && data != "false" && data != "null") {
+      pos_ = start;
+      return false;
+    }
+    handler_.value(data);
+    return true;
+  }
+
+  bool parseHex(unsigned long& code) {
+    if (json_.size() - pos_ < 4) {
+      return false;
+    }
+    code = 0;
+    for (size_t i = 0; i < 4; ++i) {
+      char c = json_[pos_++];
+      code <<= 4;
+      if (c >= '0' && c <= '9') {
+        code |= c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        code |= c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+        code |= c - 'A' + 10;
+      } else {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// Append a code point as UTF-8.
+  static void appendUTF8(unsigned long code, std::string& data) {
+    if (code < 0x80) {
+      data.push_back((char)code);
+    } else if (code < 0x800) {
+      data.push_back((char)(0xC0 | (code >> 6)));
+      data.push_back((char)(0x80 | (code & 0x3F)));
+    } else if (code < 0x10000) {
+      data.push_back((char)(0xE0 | (code >> 12)));
+      data.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+      data.push_back((char)(0x80 | (code & 0x3F)));
+    } else {
+      data.push_back((char)(0xF0 | (code >> 18)));
+      data.push_back((char)(0x80 | ((code >> 12) & 0x3F)));
+      data.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+      data.push_back((char)(0x80 | (code & 0x3F)));
+    }
+  }
+
+  bool parseString(std::string& data) {
+    ++pos_;
+    while (pos_ < json_.size()) {
+      // Copy runs of unescaped characters at once.
+      size_t start = pos_;
+      while (pos_ < json_.size() && json_[pos_] != '"' && json_[pos_] != '\\') {
+        ++pos_;
+      }
+      data.append(json_, start, pos_ - start);
+      if (pos_ >= json_.size()) {
+        return false;
+      }
+
+      if (json_[pos_++] == '"') {
+        return true;
+      }
+
+      if (pos_ >= json_.size()) {
+        return false;
+      }
+      char c = json_[pos_++];
+      if (c == '"' || c == '\\' || c == '/') {
+        data.push_back(c);
+      } else if (c == 'b') {
+        data.push_back('\b');
+      } else if (c == 'f') {
+        data.push_back('\f');
+      } else if (c == 'n') {
+        data.push_back('\n');
+      } else if (c == 'r') {
+        data.push_back('\r');
+      } else if (c == 't') {
+        data.push_back('\t');
+      } else if (c == 'u') {
+        unsigned long code = 0;
+        if (!parseHex(code)) {
+          return false;
+        }
+        // Combine a UTF-16 surrogate pair.
+        if (code >= 0xD800 && code < 0xDC00 && json_.size() - pos_ >= 6 &&
+            json_[pos_] == '\\' && json_[pos_ + 1] == 'u') {
+          pos_ += 2;
+          unsigned long low = 0;
+          if (!parseHex(low) || low < 0xDC00 || low >= 0xE000) {
+            return false;
+          }
+          code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        }
+        appendUTF8(code, data);
+      } else {
+        return false;
+      }
+    }
+    return false;
+  }
+
+ private:
+  const std::string& json_;
+  JSONHandler& handler_;
+  size_t pos_{0};
+};
+
+Status parseJSON(const std::string& json, JSONHandler& handler) {
+  return JSONParser(json, handler).parse();
+}
+
+/// Write a node as property_tree's write_json_helper does.
+static void writePtreeNode(JSONWriter& writer,
+                           const pt::ptree& tree,
+                           size_t indent) {
+  if (indent > 0 && tree.empty()) {
+    writer.value(tree.data());
+  } else if (indent > 0 && tree.count("") == tree.size()) {
+    writer.startArray();
+    for (const auto& child : tree) {
+      writePtreeNode(writer, child.second, indent + 1);
+    }
+    writer.endArray();
+  } else {
+    writer.startObject();
+    for (const auto& child : tree) {
+      writer.key(child.first);
+      writePtreeNode(writer, child.second, indent + 1);
+    }
+    writer.endObject();
+  }
+}
+
+void writePtreeJSON(const pt::ptree& tree, std::string& output) {
+  JSONWriter writer(output);
+  writePtreeNode(writer, tree, 0);
+  writer.endDocument();
+}
+
+/// Build a property tree from parse events, as read_json does.
+class PtreeJSONHandler : public JSONHandler {
+ public:
+  explicit PtreeJSONHandler(pt::ptree& root) : root_(root) {}
+
+  void startObject() { stack_.push_back(addNode()); }
+  void endObject() { stack_.pop_back(); }
+  void startArray() { stack_.push_back(addNode()); }
+  void endArray() { stack_.pop_back(); }
+  void key(std::string& name) { key_.swap(name); }
+
+  void value(std::string& data) { addNode()->data().swap(data); }
+
+ private:
+  /// Add a child to the open container, array items have empty keys.
+  pt::ptree* addNode() {
+    if (stack_.empty()) {
+      return &root_;
+    }
+    auto child = stack_.back()->push_back(std::make_pair(key_, pt::ptree()));
+    key_.clear();
+    return &child->second;
+  }
+
+ private:
+  pt::ptree& root_;
+  std::vector<pt::ptree*> stack_;
+  std::string key_;
+};
+
+Status readPtreeJSON(const std::string& json, pt::ptree& tree) {
+  PtreeJSONHandler handler(tree);
+  return parseJSON(json, handler);
+}
+}
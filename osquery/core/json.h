@@ -0,0 +1,104 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/**
+ * @brief Append a JSON-escaped string, matching boost::property_tree.
+ *
+ * Like property_tree's write_json, '/' is escaped and bytes outside of
+ * printable ASCII are written as \u00XX escapes.
+ */
+void escapeJSONString(const char* data, size_t size, std::string& output);
+
+/**
+ * @brief A streaming JSON writer that appends directly to a string.
+ *
+ * The writer produces the same bytes as boost::property_tree's write_json
+ * without building a tree: there is no whitespace, and every value is a
+ * string. Callers are responsible for property_tree's structural quirks,
+ * such as writing an empty nested node as "" and top-level lists as objects
+ * with empty keys.
+ */
+class JSONWriter {
+ public:
+  explicit JSONWriter(std::string& output) : output_(output) {}
+
+  void startObject();
+  void endObject();
+  void startArray();
+  void endArray();
+
+  /// Write an object key, the next call writes its value.
+  void key(const std::string& name);
+
+  /// Write a string value.
+  void value(const char* data, size_t size);
+  void value(const std::string& data) { value(data.data(), data.size()); }
+
+  /// Write a value that is already serialized JSON, without validation.
+  void raw(const char* data, size_t size);
+
+  /// End a document, write_json terminates each document with a newline.
+  void endDocument() { output_.push_back('\n'); }
+
+ private:
+  /// Write a separator if this is not the first item in a container.
+  void separate();
+
+ private:
+  /// The output buffer.
+  std::string& output_;
+
+  /// For each open container, whether an item was written.
+  std::vector<char> written_;
+
+  /// A key was written and its value is next.
+  bool after_key_{false};
+};
+
+/**
+ * @brief The callbacks of a streaming JSON parse.
+ *
+ * Like property_tree, numbers, booleans, and null are passed to value as
+ * their literal text.
+ */
+class JSONHandler {
+ public:
+  virtual ~JSONHandler() {}
+
+  virtual void startObject() {}
+  virtual void endObject() {}
+  virtual void startArray() {}
+  virtual void endArray() {}
+  virtual void key(std::string& name) {}
+  virtual void value(std::string& data) {}
+};
+
+/// Parse a JSON document, calling the handler for each event.
+Status parseJSON(const std::string& json, JSONHandler& handler);
+
+/// Write a property tree as write_json(tree, false) would.
+void writePtreeJSON(const boost::property_tree::ptree& tree,
+                    std::string& output);
+
+/// Read a JSON document into a property tree as read_json would.
+Status readPtreeJSON(const std::string& json,
+                     boost::property_tree::ptree& tree);
+}
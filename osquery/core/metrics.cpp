@@ -0,0 +1,358 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+
+#include <boost/noncopyable.hpp>
+
+#include "osquery/core/metrics.h"
+
+namespace osquery {
+
+const size_t kMetricsMax = 256;
+
+/// Each power of two is split into 2^3 linear sub-buckets.
+const size_t kMetricSubBucketBits = 3;
+const size_t kMetricSubBuckets = 1 << kMetricSubBucketBits;
+
+/// Values with more significant bits share the last bucket.
+const size_t kMetricHistogramBits = 40;
+
+const size_t kMetricHistogramBuckets =
+    (kMetricHistogramBits - kMetricSubBucketBits + 1) * kMetricSubBuckets;
+
+size_t getMetricBucket(uint64_t value) {
+  if (value < kMetricSubBuckets) {
+    return value;
+  }
+
+  size_t msb = 63 - __builtin_clzll(value);
+  if (msb >= kMetricHistogramBits) {
+    return kMetricHistogramBuckets - 1;
+  }
+  size_t shift = msb - kMetricSubBucketBits;
+  return (shift + 1) * kMetricSubBuckets +
+         ((value >> shift) & (kMetricSubBuckets - 1));
+}
+
+uint64_t getMetricBucketValue(size_t bucket) {
+  if (bucket < kMetricSubBuckets) {
+    return bucket;
+  }
+  size_t shift = bucket / kMetricSubBuckets - 1;
+  return (uint64_t)(kMetricSubBuckets + bucket % kMetricSubBuckets) << shift;
+}
+
+/// Add to a value that only the calling thread writes.
+template <typename T>
+inline void addRelaxed(std::atomic<T>& target, T value) {
+  target.store(target.load(std::memory_order_relaxed) + value,
+               std::memory_order_relaxed);
+}
+
+/// One thread's values for a metric.
+struct MetricCell {
+  explicit MetricCell(bool histogram) {
+    if (histogram) {
+      buckets.reset(new std::atomic<uint64_t>[kMetricHistogramBuckets]);
+      for (size_t i = 0; i < kMetricHistogramBuckets; ++i) {
+        buckets[i].store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  std::atomic<int64_t> value{0};
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> sum{0};
+  std::atomic<uint64_t> min{UINT64_MAX};
+  std::atomic<uint64_t> max{0};
+  std::unique_ptr<std::atomic<uint64_t>[]> buckets;
+};
+
+/// A thread's values for every metric, allocated on first update.
+struct ThreadMetrics : private boost::noncopyable {
+  ThreadMetrics() {
+    for (size_t i = 0; i < kMetricsMax; ++i) {
+      cells[i].store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  ~ThreadMetrics() {
+    for (size_t i = 0; i < kMetricsMax; ++i) {
+      delete cells[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  std::atomic<MetricCell*> cells[kMetricsMax];
+};
+
+class MetricsRegistry : private boost::noncopyable {
+ public:
+  static MetricsRegistry& instance() {
+    static MetricsRegistry registry;
+    return registry;
+  }
+
+  /// Find or add a metric by name.
+  size_t add(const std::string& name, MetricType type);
+
+  /// Start aggregating a thread's metrics.
+  void attach(ThreadMetrics* metrics);
+
+  /// Merge an exiting thread's metrics into the retired values.
+  void detach(ThreadMetrics* metrics);
+
+  /// Aggregate every metric.
+  std::vector<MetricValue> values();
+
+  std::atomic<int64_t>& gauge(size_t id) { return gauges_[id]; }
+
+  bool isHistogram(size_t id) const { return histograms_[id]; }
+
+ private:
+  MetricsRegistry() {
+    for (size_t i = 0; i < kMetricsMax; ++i) {
+      gauges_[i].store(0, std::memory_order_relaxed);
+      histograms_[i] = false;
+    }
+  }
+
+  /// Add a cell's values to a metric's aggregate.
+  void merge(const MetricCell& cell,
+             MetricValue& value,
+             std::vector<uint64_t>& buckets) const;
+
+ private:
+  std::mutex mutex_;
+
+  /// Metric names and types, indexed by metric id.
+  std::vector<std::pair<std::string, MetricType>> metrics_;
+  std::map<std::string, size_t> ids_;
+
+  std::atomic<int64_t> gauges_[kMetricsMax];
+  bool histograms_[kMetricsMax];
+
+  /// Live threads, their cells are read while holding the lock.
+  std::set<ThreadMetrics*> threads_;
+
+  /// The values of exited threads.
+  ThreadMetrics retired_;
+};
+
+/// Attach a thread's metrics on first use, and detach them at thread exit.
+class ThreadMetricsHolder : private boost::noncopyable {
+ public:
+  ThreadMetricsHolder() : registry_(MetricsRegistry::instance()) {
+    registry_.attach(&metrics_);
+  }
+
+  ~ThreadMetricsHolder() { registry_.detach(&metrics_); }
+
+  /// The calling thread's cell for a metric.
+  MetricCell& cell(size_t id) {
+    auto cell = metrics_.cells[id].load(std::memory_order_relaxed);
+    if (cell == nullptr) {
+      cell = new MetricCell(registry_.isHistogram(id));
+      metrics_.cells[id].store(cell, std::memory_order_release);
+    }
+    return *cell;
+  }
+
+ private:
+  MetricsRegistry& registry_;
+  ThreadMetrics metrics_;
+};
+
+static MetricCell& threadCell(size_t id) {
+  static thread_local ThreadMetricsHolder holder;
+  return holder.cell(id);
+}
+
+size_t MetricsRegistry::add(const std::string& name, MetricType type) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto id = ids_.find(name);
+  if (id != ids_.end()) {
+    // A name cannot be reused for a different type of metric.
+    return (metrics_[id->second].second == type) ? id->second : kMetricsMax;
+  }
+  if (metrics_.size() >= kMetricsMax) {
+    return kMetricsMax;
+  }
+
+  histograms_[metrics_.size()] = (type == METRIC_HISTOGRAM);
+  metrics_.push_back(std::make_pair(name, type));
+  ids_[name] = metrics_.size() - 1;
+  return metrics_.size() - 1;
+}
+
+void MetricsRegistry::attach(ThreadMetrics* metrics) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  threads_.insert(metrics);
+}
+
+void MetricsRegistry::detach(ThreadMetrics* metrics) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  threads_.erase(metrics);
+  for (size_t id = 0; id < kMetricsMax; ++id) {
+    auto cell = metrics->cells[id].load(std::memory_order_acquire);
+    if (cell == nullptr) {
+      continue;
+    }
+
+    auto retired = retired_.cells[id].load(std::memory_order_relaxed);
+    if (retired == nullptr) {
+      retired = new MetricCell(histograms_[id]);
+      retired_.cells[id].store(retired, std::memory_order_relaxed);
+    }
+    addRelaxed(retired->value, cell->value.load(std::memory_order_relaxed));
+    addRelaxed(retired->count, cell->count.load(std::memory_order_relaxed));
+    addRelaxed(retired->sum, cell->sum.load(std::memory_order_relaxed));
+    retired->min.store(std::min(retired->min.load(std::memory_order_relaxed),
+                                cell->min.load(std::memory_order_relaxed)),
+                       std::memory_order_relaxed);
+    retired->max.store(std::max(retired->max.load(std::memory_order_relaxed),
+                                cell->max.load(std::memory_order_relaxed)),
+                       std::memory_order_relaxed);
+    if (cell->buckets != nullptr) {
+      for (size_t i = 0; i < kMetricHistogramBuckets; ++i) {
+        addRelaxed(retired->buckets[i],
+                   cell->buckets[i].load(std::memory_order_relaxed));
+      }
+    }
+  }
+}
+
+void MetricsRegistry::merge(const MetricCell& cell,
+                            MetricValue& value,
+                            std::vector<uint64_t>& buckets) const {
+  value.value += cell.value.load(std::memory_order_relaxed);
+  auto count = cell.count.load(std::memory_order_relaxed);
+  if (count == 0) {
+    return;
+  }
+
+  auto min = cell.min.load(std::memory_order_relaxed);
+  value.min = (value.count == 0) ? min : std::min(value.min, min);
+  value.max = std::max(value.max, cell.max.load(std::memory_order_relaxed));
+  value.count += count;
+  value.sum += cell.sum.load(std::memory_order_relaxed);
+  if (cell.buckets != nullptr) {
+    for (size_t i = 0; i < kMetricHistogramBuckets; ++i) {
+      buckets[i] += cell.buckets[i].load(std::memory_order_relaxed);
+    }
+  }
+}
+
+/// The lower bound of the bucket holding a percentile, within min and max.
+static uint64_t getPercentile(const MetricValue& value,
+                              const std::vector<uint64_t>& buckets,
+                              double percentile) {
+  // Racing updates may leave the bucket total behind the count.
+  uint64_t total = 0;
+  for (const auto& bucket : buckets) {
+    total += bucket;
+  }
+
+  auto rank = (uint64_t)(percentile * total);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    seen += buckets[i];
+    if (seen > rank) {
+      auto lower = getMetricBucketValue(i);
+      return std::min(std::max(lower, value.min), value.max);
+    }
+  }
+  return value.max;
+}
+
+std::vector<MetricValue> MetricsRegistry::values() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<MetricValue> values;
+  for (size_t id = 0; id < metrics_.size(); ++id) {
+    MetricValue value;
+    value.name = metrics_[id].first;
+    value.type = metrics_[id].second;
+    if (value.type == METRIC_GAUGE) {
+      value.value = gauges_[id].load(std::memory_order_relaxed);
+      values.push_back(value);
+      continue;
+    }
+
+    std::vector<uint64_t> buckets(
+        (value.type == METRIC_HISTOGRAM) ? kMetricHistogramBuckets : 0, 0);
+    auto retired = retired_.cells[id].load(std::memory_order_relaxed);
+    if (retired != nullptr) {
+      merge(*retired, value, buckets);
+    }
+    for (const auto& thread : threads_) {
+      auto cell = thread->cells[id].load(std::memory_order_acquire);
+      if (cell != nullptr) {
+        merge(*cell, value, buckets);
+      }
+    }
+
+    if (value.type == METRIC_HISTOGRAM && value.count > 0) {
+      value.p50 = getPercentile(value, buckets, 0.50);
+      value.p95 = getPercentile(value, buckets, 0.95);
+      value.p99 = getPercentile(value, buckets, 0.99);
+    }
+    values.push_back(value);
+  }
+
+  std::sort(values.begin(),
+            values.end(),
+            [](const MetricValue& a, const MetricValue& b) {
+              return a.name < b.name;
+            });
+  return values;
+}
+
+Metric::Metric(const std::string& name, MetricType type)
+    : id_(MetricsRegistry::instance().add(name, type)) {}
+
+void MetricCounter::add(int64_t value) {
+  if (id_ < kMetricsMax) {
+    addRelaxed(threadCell(id_).value, value);
+  }
+}
+
+void MetricGauge::set(int64_t value) {
+  if (id_ < kMetricsMax) {
+    MetricsRegistry::instance().gauge(id_).store(value,
+                                                 std::memory_order_relaxed);
+  }
+}
+
+void MetricHistogram::record(uint64_t value) {
+  if (id_ >= kMetricsMax) {
+    return;
+  }
+
+  auto& cell = threadCell(id_);
+  addRelaxed(cell.count, (uint64_t)1);
+  addRelaxed(cell.sum, value);
+  if (value < cell.min.load(std::memory_order_relaxed)) {
+    cell.min.store(value, std::memory_order_relaxed);
+  }
+  if (value > cell.max.load(std::memory_order_relaxed)) {
+    cell.max.store(value, std::memory_order_relaxed);
+  }
+  addRelaxed(cell.buckets[getMetricBucket(value)], (uint64_t)1);
+}
+
+std::vector<MetricValue> getMetrics() {
+  return MetricsRegistry::instance().values();
+}
+}
@@ -0,0 +1,130 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace osquery {
+
+/// The maximum number of distinct metrics, later metrics are not recorded.
+extern const size_t kMetricsMax;
+
+/// The number of buckets in each histogram.
+extern const size_t kMetricHistogramBuckets;
+
+enum MetricType {
+  METRIC_COUNTER = 0,
+  METRIC_GAUGE = 1,
+  METRIC_HISTOGRAM = 2,
+};
+
+/// A metric's value, aggregated across every thread that updated it.
+struct MetricValue {
+  std::string name;
+  MetricType type;
+
+  /// The total of a counter, or the value of a gauge.
+  int64_t value{0};
+
+  /// The number of values recorded in a histogram.
+  uint64_t count{0};
+
+  /// The sum of a histogram's values.
+  uint64_t sum{0};
+
+  uint64_t min{0};
+  uint64_t max{0};
+
+  /// Percentiles, accurate to a histogram bucket (within 12.5%).
+  uint64_t p50{0};
+  uint64_t p95{0};
+  uint64_t p99{0};
+};
+
+/**
+ * @brief A named, process-wide performance metric.
+ *
+ * Metrics are meant to be static objects near the code they measure. Updates
+ * are written to the calling thread's own storage without locks or atomic
+ * read-modify-writes, and are only aggregated when read by getMetrics.
+ * Metrics with the same name share their values.
+ */
+class Metric {
+ public:
+  Metric(const std::string& name, MetricType type);
+
+ protected:
+  /// The metric's index, or kMetricsMax if there were too many metrics.
+  size_t id_;
+};
+
+/// A counter, the sum of every update.
+class MetricCounter : public Metric {
+ public:
+  explicit MetricCounter(const std::string& name)
+      : Metric(name, METRIC_COUNTER) {}
+
+  void add(int64_t value = 1);
+};
+
+/// A gauge, the most recent value set.
+class MetricGauge : public Metric {
+ public:
+  explicit MetricGauge(const std::string& name) : Metric(name, METRIC_GAUGE) {}
+
+  void set(int64_t value);
+};
+
+/**
+ * @brief A histogram of values, usually latencies in microseconds.
+ *
+ * Like an HDR histogram, each power of two is split into 8 linear buckets, so
+ * any recorded value is within 12.5% of its bucket's lower bound. Values of
+ * 2^40 and above share the last bucket.
+ */
+class MetricHistogram : public Metric {
+ public:
+  explicit MetricHistogram(const std::string& name)
+      : Metric(name, METRIC_HISTOGRAM) {}
+
+  void record(uint64_t value);
+};
+
+/// Record the microseconds from construction to destruction in a histogram.
+class MetricTimer {
+ public:
+  explicit MetricTimer(MetricHistogram& histogram)
+      : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+
+  ~MetricTimer() {
+    auto elapsed = std::chrono::steady_clock::now() - start_;
+    histogram_.record(
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+            .count());
+  }
+
+ private:
+  MetricHistogram& histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+/// Aggregate the value of every metric, sorted by name.
+std::vector<MetricValue> getMetrics();
+
+/// The histogram bucket of a value.
+size_t getMetricBucket(uint64_t value);
+
+/// The lower bound of a histogram bucket's values.
+uint64_t getMetricBucketValue(size_t bucket);
+}
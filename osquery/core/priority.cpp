@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#include <sys/resource.h>
+#endif
+
+#include <osquery/logger.h>
+
+#include "osquery/core/priority.h"
+
+namespace osquery {
+
+#if defined(__linux__)
+/// IO priority classes and targets from linux/ioprio.h, without the header.
+const int kIOPriorityClassShift = 13;
+const int kIOPriorityClassIdle = 3;
+const int kIOPriorityWhoProcess = 1;
+
+ScopedBackgroundPriority::ScopedBackgroundPriority(bool background) {
+  if (!background) {
+    return;
+  }
+
+  // A pid of 0 is the calling thread, not the whole process.
+  struct sched_param param;
+  policy_ = sched_getscheduler(0);
+  if (policy_ < 0 || sched_getparam(0, &param) != 0) {
+    return;
+  }
+  sched_priority_ = param.sched_priority;
+
+  param.sched_priority = 0;
+  if (sched_setscheduler(0, SCHED_IDLE, &param) != 0) {
+    VLOG(1) << "Cannot set the idle scheduling policy";
+    return;
+  }
+  active_ = true;
+
+  io_priority_ = syscall(SYS_ioprio_get, kIOPriorityWhoProcess, 0);
+  if (io_priority_ >= 0 &&
+      syscall(SYS_ioprio_set,
+              kIOPriorityWhoProcess,
+              0,
+              kIOPriorityClassIdle << kIOPriorityClassShift) != 0) {
+    io_priority_ = -1;
+  }
+}
+
+ScopedBackgroundPriority::~ScopedBackgroundPriority() {
+  if (!active_) {
+    return;
+  }
+
+  if (io_priority_ >= 0) {
+    syscall(SYS_ioprio_set, kIOPriorityWhoProcess, 0, io_priority_);
+  }
+  struct sched_param param;
+  param.sched_priority = sched_priority_;
+  if (sched_setscheduler(0, policy_, &param) != 0) {
+    LOG(WARNING) << "Cannot restore the scheduling policy of a thread";
+  }
+}
+#elif defined(__APPLE__)
+ScopedBackgroundPriority::ScopedBackgroundPriority(bool background) {
+  if (!background) {
+    return;
+  }
+
+  policy_ = qos_class_self();
+  if (pthread_set_qos_class_self_np(QOS_CLASS_BACKGROUND, 0) != 0) {
+    VLOG(1) << "Cannot set the background QoS class";
+    return;
+  }
+  active_ = true;
+
+  io_priority_ = getiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD);
+  if (io_priority_ >= 0 &&
+      setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD, IOPOL_THROTTLE) !=
+          0) {
+    io_priority_ = -1;
+  }
+}
+
+ScopedBackgroundPriority::~ScopedBackgroundPriority() {
+  if (!active_) {
+    return;
+  }
+
+  if (io_priority_ >= 0) {
+    setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD, io_priority_);
+  }
+  pthread_set_qos_class_self_np((qos_class_t)policy_, 0);
+}
+#else
+ScopedBackgroundPriority::ScopedBackgroundPriority(bool background) {}
+
+ScopedBackgroundPriority::~ScopedBackgroundPriority() {}
+#endif
+}
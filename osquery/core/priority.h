@@ -0,0 +1,45 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+namespace osquery {
+
+/**
+ * @brief Run the calling thread at background CPU and IO priority.
+ *
+ * On Linux the thread uses the SCHED_IDLE policy and the idle IO class, on
+ * OS X the background QoS class and throttled disk IO. Threads created while
+ * in scope, such as a table's helper threads, inherit the priority. The
+ * thread's previous priority is restored on destruction, Dispatcher threads
+ * are shared by every scheduled query.
+ */
+class ScopedBackgroundPriority : private boost::noncopyable {
+ public:
+  /// Lower the calling thread's priority if background is true.
+  explicit ScopedBackgroundPriority(bool background);
+  ~ScopedBackgroundPriority();
+
+  /// True if the thread's priority was lowered.
+  bool active() const { return active_; }
+
+ private:
+  bool active_{false};
+
+  /// The thread's previous scheduling policy and priority.
+  int policy_{0};
+  int sched_priority_{0};
+
+  /// The thread's previous IO priority or policy, -1 if unknown.
+  int io_priority_{-1};
+};
+}
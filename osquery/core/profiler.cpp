@@ -0,0 +1,369 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#elif defined(__FreeBSD__)
+#include <malloc_np.h>
+#else
+#include <malloc.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+#include <osquery/flags.h>
+
+#include "osquery/core/profiler.h"
+
+namespace osquery {
+
+FLAG(bool,
+     enable_perf_counters,
+     false,
+     "Count hardware and software events for profiled queries (Linux)");
+
+#if defined(RUSAGE_THREAD)
+const bool kQueryProfileThreadUsage = true;
+#else
+const bool kQueryProfileThreadUsage = false;
+#endif
+
+/// The profile of the query executing on this thread.
+static thread_local QueryProfile* kThreadProfile = nullptr;
+
+/**
+ * @brief The allocations made on this thread while it is profiled.
+ *
+ * The counters are plain integers so the operator new and delete replacements
+ * never allocate, or run a thread_local constructor, themselves.
+ */
+struct AllocationCounters {
+  /// Bytes allocated.
+  uint64_t allocated;
+
+  /// Bytes allocated less bytes freed, negative when freeing older memory.
+  int64_t live;
+
+  /// The highest live count since the current profile started.
+  int64_t peak;
+};
+
+static thread_local AllocationCounters kThreadAllocations = {0, 0, 0};
+
+inline size_t allocationSize(void* ptr) {
+#if defined(__APPLE__)
+  return malloc_size(ptr);
+#else
+  return malloc_usable_size(ptr);
+#endif
+}
+
+void* allocateProfiled(size_t size) {
+  void* ptr = malloc((size > 0) ? size : 1);
+  if (ptr != nullptr && kThreadProfile != nullptr) {
+    auto& counters = kThreadAllocations;
+    auto bytes = allocationSize(ptr);
+    counters.allocated += bytes;
+    counters.live += bytes;
+    if (counters.live > counters.peak) {
+      counters.peak = counters.live;
+    }
+  }
+  return ptr;
+}
+
+void deallocateProfiled(void* ptr) {
+  if (ptr != nullptr && kThreadProfile != nullptr) {
+    kThreadAllocations.live -= allocationSize(ptr);
+  }
+  free(ptr);
+}
+
+QueryProfile* getQueryProfile() {
+  return kThreadProfile;
+}
+
+inline uint64_t difference(uint64_t before, uint64_t after) {
+  return (after > before) ? after - before : 0;
+}
+
+PerfCounters& PerfCounters::operator+=(const PerfCounters& other) {
+  instructions += other.instructions;
+  cycles += other.cycles;
+  cache_misses += other.cache_misses;
+  context_switches += other.context_switches;
+  page_faults += other.page_faults;
+  return *this;
+}
+
+#if defined(__linux__)
+/// An event counted for each thread, and its PerfCounters member.
+struct PerfEvent {
+  uint32_t type;
+  uint64_t config;
+  uint64_t PerfCounters::*counter;
+};
+
+/// Hardware events are first, so software events may join their group.
+static const PerfEvent kPerfEvents[] = {
+    {PERF_TYPE_HARDWARE,
+     PERF_COUNT_HW_INSTRUCTIONS,
+     &PerfCounters::instructions},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, &PerfCounters::cycles},
+    {PERF_TYPE_HARDWARE,
+     PERF_COUNT_HW_CACHE_MISSES,
+     &PerfCounters::cache_misses},
+    {PERF_TYPE_SOFTWARE,
+     PERF_COUNT_SW_CONTEXT_SWITCHES,
+     &PerfCounters::context_switches},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, &PerfCounters::page_faults},
+};
+
+static const size_t kPerfEventCount =
+    sizeof(kPerfEvents) / sizeof(kPerfEvents[0]);
+
+/**
+ * @brief The event counters of one thread, read as a group.
+ *
+ * Events are opened as one group so a single read returns every count. Each
+ * event that cannot be opened is skipped, and kernel events are excluded
+ * when perf_event_paranoid does not allow counting them.
+ */
+class PerfCounterGroup {
+ public:
+  ~PerfCounterGroup() {
+    for (const auto& fd : fds_) {
+      ::close(fd);
+    }
+  }
+
+  bool read(PerfCounters& counters) {
+    if (!opened_) {
+      open();
+    }
+    if (fds_.empty()) {
+      return false;
+    }
+
+    // A group read returns the number of events, then each event's count in
+    // the order they were opened.
+    uint64_t values[kPerfEventCount + 1];
+    if (::read(fds_[0], values, sizeof(values)) < (ssize_t)sizeof(uint64_t)) {
+      return false;
+    }
+    for (size_t i = 0; i < values[0] && i < events_.size(); ++i) {
+      counters.*(events_[i]->counter) = values[i + 1];
+    }
+    return true;
+  }
+
+ private:
+  void open() {
+    opened_ = true;
+    for (const auto& event : kPerfEvents) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = event.type;
+      attr.config = event.config;
+      attr.read_format = PERF_FORMAT_GROUP;
+      attr.exclude_hv = 1;
+
+      int leader = (fds_.empty()) ? -1 : fds_[0];
+      int fd = openEvent(attr, leader);
+      if (fd == -1 && (errno == EACCES || errno == EPERM)) {
+        attr.exclude_kernel = 1;
+        fd = openEvent(attr, leader);
+      }
+      if (fd != -1) {
+        fds_.push_back(fd);
+        events_.push_back(&event);
+      }
+    }
+  }
+
+  static int openEvent(struct perf_event_attr& attr, int leader) {
+    // Count the calling thread on any CPU.
+    return (int)::syscall(
+        __NR_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC);
+  }
+
+ private:
+  bool opened_{false};
+  /// The open events, the first is the group leader.
+  std::vector<int> fds_;
+  std::vector<const PerfEvent*> events_;
+};
+
+static thread_local PerfCounterGroup kThreadPerfCounters;
+#endif
+
+bool readPerfCounters(PerfCounters& counters) {
+  if (!FLAGS_enable_perf_counters) {
+    return false;
+  }
+#if defined(__linux__)
+  return kThreadPerfCounters.read(counters);
+#else
+  return false;
+#endif
+}
+
+ScopedPerfCounters::ScopedPerfCounters(PerfCounters& total) : total_(total) {
+  counting_ = readPerfCounters(start_);
+}
+
+ScopedPerfCounters::~ScopedPerfCounters() {
+  PerfCounters end;
+  if (!counting_ || !readPerfCounters(end)) {
+    return;
+  }
+
+  total_.instructions += difference(start_.instructions, end.instructions);
+  total_.cycles += difference(start_.cycles, end.cycles);
+  total_.cache_misses += difference(start_.cache_misses, end.cache_misses);
+  total_.context_switches +=
+      difference(start_.context_switches, end.context_switches);
+  total_.page_faults += difference(start_.page_faults, end.page_faults);
+}
+
+inline uint64_t toMicroseconds(const struct timeval& time) {
+  return (uint64_t)time.tv_sec * 1000000 + time.tv_usec;
+}
+
+static void getUsage(uint64_t& user_time,
+                     uint64_t& system_time,
+                     uint64_t& memory) {
+  struct rusage usage;
+#if defined(RUSAGE_THREAD)
+  int status = getrusage(RUSAGE_THREAD, &usage);
+#else
+  int status = getrusage(RUSAGE_SELF, &usage);
+#endif
+  if (status != 0) {
+    return;
+  }
+
+  user_time = toMicroseconds(usage.ru_utime);
+  system_time = toMicroseconds(usage.ru_stime);
+#if defined(__APPLE__)
+  memory = usage.ru_maxrss;
+#else
+  // Linux reports the peak resident size in kilobytes.
+  memory = (uint64_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+inline uint64_t elapsedMicroseconds(
+    const std::chrono::steady_clock::time_point& start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+
+ScopedQueryProfile::ScopedQueryProfile(QueryProfile& profile)
+    : profile_(profile),
+      previous_(kThreadProfile),
+      counters_(profile.counters) {
+  getUsage(user_time_, system_time_, memory_);
+
+  // The peak is measured from this profile's start, the enclosing profile's
+  // peak is restored when this one ends.
+  auto& counters = kThreadAllocations;
+  allocated_ = counters.allocated;
+  live_ = counters.live;
+  peak_ = counters.peak;
+  counters.peak = counters.live;
+
+  kThreadProfile = &profile_;
+  start_ = std::chrono::steady_clock::now();
+}
+
+ScopedQueryProfile::~ScopedQueryProfile() {
+  profile_.wall_time += elapsedMicroseconds(start_);
+
+  auto& counters = kThreadAllocations;
+  profile_.allocated += counters.allocated - allocated_;
+  if (counters.peak > live_) {
+    profile_.peak_allocated = std::max(profile_.peak_allocated,
+                                       (uint64_t)(counters.peak - live_));
+  }
+  counters.peak = std::max(peak_, counters.peak);
+  kThreadProfile = previous_;
+
+  uint64_t user_time = 0, system_time = 0, memory = 0;
+  getUsage(user_time, system_time, memory);
+  profile_.user_time += difference(user_time_, user_time);
+  profile_.system_time += difference(system_time_, system_time);
+  profile_.memory += difference(memory_, memory);
+}
+
+/// The allocation counter of a phase, nullptr if its bytes are not counted.
+static uint64_t QueryProfile::*getAllocatedPhase(
+    uint64_t QueryProfile::*phase) {
+  if (phase == &QueryProfile::generate_time) {
+    return &QueryProfile::generate_allocated;
+  } else if (phase == &QueryProfile::diff_time) {
+    return &QueryProfile::diff_allocated;
+  } else if (phase == &QueryProfile::serialize_time) {
+    return &QueryProfile::serialize_allocated;
+  }
+  return nullptr;
+}
+
+ProfilePhase::ProfilePhase(uint64_t QueryProfile::*phase)
+    : profile_(kThreadProfile), phase_(phase) {
+  if (profile_ != nullptr) {
+    allocated_phase_ = getAllocatedPhase(phase);
+    allocated_ = kThreadAllocations.allocated;
+    start_ = std::chrono::steady_clock::now();
+  }
+}
+
+ProfilePhase::ProfilePhase(uint64_t QueryProfile::*phase,
+                           const std::string& table)
+    : profile_(kThreadProfile), phase_(phase) {
+  if (profile_ != nullptr) {
+    table_ = table;
+    allocated_phase_ = getAllocatedPhase(phase);
+    allocated_ = kThreadAllocations.allocated;
+    start_ = std::chrono::steady_clock::now();
+  }
+}
+
+ProfilePhase::~ProfilePhase() {
+  if (profile_ == nullptr) {
+    return;
+  }
+
+  auto elapsed = elapsedMicroseconds(start_);
+  profile_->*phase_ += elapsed;
+  if (allocated_phase_ != nullptr) {
+    profile_->*allocated_phase_ += kThreadAllocations.allocated - allocated_;
+  }
+  if (!table_.empty()) {
+    profile_->table_times[table_] += elapsed;
+  }
+}
+}
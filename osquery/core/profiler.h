@@ -0,0 +1,219 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace osquery {
+
+/// Whether CPU time is measured for the profiled thread alone.
+extern const bool kQueryProfileThreadUsage;
+
+/**
+ * @brief Hardware and software event counts of a thread.
+ *
+ * Counts are read with perf_event_open on Linux when --enable_perf_counters
+ * is set. Counters the CPU or kernel does not provide, such as hardware
+ * events within some virtual machines, are 0.
+ */
+struct PerfCounters {
+  uint64_t instructions{0};
+  uint64_t cycles{0};
+  uint64_t cache_misses{0};
+  uint64_t context_switches{0};
+  uint64_t page_faults{0};
+
+  PerfCounters& operator+=(const PerfCounters& other);
+};
+
+/// A virtual table plan chosen by xBestIndex while a query was planned.
+struct TablePlanProfile {
+  /// The plan's xBestIndex idxStr, which identifies it within xFilter.
+  std::string plan;
+
+  /// The constraints passed to the table generator, such as "pid =".
+  std::string constraints;
+
+  /// The estimated cost and rows reported to SQLite.
+  double cost{0};
+  uint64_t estimated_rows{0};
+
+  /// The number of xFilter calls using the plan.
+  uint64_t filters{0};
+};
+
+/// The virtual table work for one table used by a query.
+struct TableProfile {
+  /// Each distinct plan, in the order xBestIndex reported them.
+  std::vector<TablePlanProfile> plans;
+
+  /// The number of xFilter calls, and those answered without generating.
+  uint64_t filters{0};
+  uint64_t cache_hits{0};
+  uint64_t memo_hits{0};
+
+  /// Rows returned to SQLite by every xFilter.
+  uint64_t rows{0};
+};
+
+/// The resources used, in microseconds, by one execution of a query.
+struct QueryProfile {
+  uint64_t wall_time{0};
+  uint64_t user_time{0};
+  uint64_t system_time{0};
+
+  /// Growth of the peak resident memory, in bytes.
+  uint64_t memory{0};
+
+  /// Bytes allocated on the profiled thread.
+  uint64_t allocated{0};
+
+  /// The most bytes allocated and not yet freed, above the profile's start.
+  uint64_t peak_allocated{0};
+
+  /// Bytes allocated while generating, diffing, and serializing.
+  uint64_t generate_allocated{0};
+  uint64_t diff_allocated{0};
+  uint64_t serialize_allocated{0};
+
+  /// Parsing and planning the SQL, including each table's xBestIndex.
+  uint64_t plan_time{0};
+
+  /// Generating table rows, the total of table_times.
+  uint64_t generate_time{0};
+
+  /// Comparing results to the previous execution.
+  uint64_t diff_time{0};
+
+  /// Serializing results for the logger.
+  uint64_t serialize_time{0};
+
+  /// Adding serialized results to the logger.
+  uint64_t log_time{0};
+
+  /// Generate time for each table used by the query.
+  std::map<std::string, uint64_t> table_times;
+
+  /// Plans and xFilter calls for each table used by the query.
+  std::map<std::string, TableProfile> tables;
+
+  /// Event counts of the profiled thread, if --enable_perf_counters is set.
+  PerfCounters counters;
+
+  /// Event counts of each table's xFilter calls.
+  std::map<std::string, PerfCounters> table_counters;
+};
+
+/// The profile of the calling thread, nullptr if it is not profiled.
+QueryProfile* getQueryProfile();
+
+/**
+ * @brief Allocate memory, counting it for the calling thread's profile.
+ *
+ * libosquery does not replace the global allocation functions, so SDK and
+ * extension consumers keep their own. The osqueryi, osqueryd, and test
+ * executables link osquery/main/allocator.cpp, routing operator new and
+ * delete through these functions. Without it profiles count no allocations.
+ */
+void* allocateProfiled(size_t size);
+
+/// Free memory from allocateProfiled.
+void deallocateProfiled(void* ptr);
+
+/**
+ * @brief Read the calling thread's event counts.
+ *
+ * The thread's counters are opened on its first read and stay open until the
+ * thread ends.
+ *
+ * @return false if --enable_perf_counters is not set or counting failed.
+ */
+bool readPerfCounters(PerfCounters& counters);
+
+/**
+ * @brief Add the calling thread's event counts within a scope to a total.
+ *
+ * Without --enable_perf_counters the scope only checks the flag.
+ */
+class ScopedPerfCounters {
+ public:
+  explicit ScopedPerfCounters(PerfCounters& total);
+  ~ScopedPerfCounters();
+
+  /// Check if the scope is counting.
+  bool counting() const { return counting_; }
+
+ private:
+  PerfCounters& total_;
+  PerfCounters start_;
+  bool counting_{false};
+};
+
+/**
+ * @brief Profile the calling thread until destruction.
+ *
+ * Wall time is read from the monotonic clock and CPU time from getrusage,
+ * using the thread's own usage where the platform supports RUSAGE_THREAD.
+ * The operator new and delete replacements, where linked, count the thread's
+ * allocations while it is profiled. Memory allocated for the query by other
+ * threads, such as process scan shards, is not counted. Event counts are added
+ * when --enable_perf_counters is set.
+ * While in scope, ProfilePhase objects on the same thread add their times to
+ * the profile. Profiles do not nest, an inner profile replaces the outer one
+ * until it is destroyed.
+ */
+class ScopedQueryProfile {
+ public:
+  explicit ScopedQueryProfile(QueryProfile& profile);
+  ~ScopedQueryProfile();
+
+ private:
+  QueryProfile& profile_;
+  QueryProfile* previous_;
+  std::chrono::steady_clock::time_point start_;
+  uint64_t user_time_{0};
+  uint64_t system_time_{0};
+  uint64_t memory_{0};
+  uint64_t allocated_{0};
+  int64_t live_{0};
+  int64_t peak_{0};
+  ScopedPerfCounters counters_;
+};
+
+/**
+ * @brief Add the time spent in a scope to a phase of the thread's profile.
+ *
+ * The bytes allocated within the generate, diff, and serialize phases are
+ * also added. Without a ScopedQueryProfile on the calling thread the phase
+ * does nothing, it does not read the clock.
+ */
+class ProfilePhase {
+ public:
+  explicit ProfilePhase(uint64_t QueryProfile::*phase);
+
+  /// Time table generation, also adding to the table's own total.
+  ProfilePhase(uint64_t QueryProfile::*phase, const std::string& table);
+
+  ~ProfilePhase();
+
+ private:
+  QueryProfile* profile_;
+  uint64_t QueryProfile::*phase_;
+  std::string table_;
+  std::chrono::steady_clock::time_point start_;
+  uint64_t QueryProfile::*allocated_phase_{nullptr};
+  uint64_t allocated_{0};
+};
+}
@@ -167,4 +167,33 @@ Status createPidFile() {
   auto status = writeTextFile(FLAGS_pidfile, pid, 0644);
   return status;
 }
+
+/// The cancellation of the query run by this thread.
+static thread_local const QueryCancellation* kQueryCancellation = nullptr;
+
+QueryCancellation::QueryCancellation(size_t timeout) {
+  if (timeout > 0) {
+    has_deadline_ = true;
+    deadline_ = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+  }
+}
+
+bool QueryCancellation::cancelled() const {
+  if (cancelled_) {
+    return true;
+  }
+  return (has_deadline_ && std::chrono::steady_clock::now() >= deadline_);
+}
+
+ScopedQueryCancellation::ScopedQueryCancellation(
+    const QueryCancellation* cancellation)
+    : previous_(kQueryCancellation) {
+  kQueryCancellation = cancellation;
+}
+
+ScopedQueryCancellation::~ScopedQueryCancellation() {
+  kQueryCancellation = previous_;
+}
+
+const QueryCancellation* getQueryCancellation() { return kQueryCancellation; }
 }
@@ -8,11 +8,17 @@
  *
  */
 
+#include <algorithm>
+#include <limits>
+
 #include <boost/property_tree/json_parser.hpp>
 
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
+#include "osquery/core/json.h"
+
 namespace pt = boost::property_tree;
 
 namespace osquery {
@@ -36,25 +42,47 @@ void TablePlugin::removeExternal(const std::string& name) {
 
 void TablePlugin::setRequestFromContext(const QueryContext& context,
                                         PluginRequest& request) {
-  pt::ptree tree;
-  tree.put("limit", context.limit);
+  // The context is written as a property tree would be, empty lists are "".
+  auto& output = request["context"];
+  output.clear();
+  JSONWriter writer(output);
+  writer.startObject();
+  writer.key("limit");
+  writer.value(std::to_string(context.limit));
 
   // The QueryContext contains a constraint map from column to type information
   // and the list of operand/expression constraints applied to that column from
   // the query given.
-  pt::ptree constraints;
-  for (const auto& constraint : context.constraints) {
-    pt::ptree child;
-    child.put("name", constraint.first);
-    constraint.second.serialize(child);
-    constraints.push_back(std::make_pair("", child));
+  writer.key("constraints");
+  if (context.constraints.empty()) {
+    writer.value("", 0);
+  } else {
+    writer.startArray();
+    for (const auto& constraint : context.constraints) {
+      writer.startObject();
+      writer.key("name");
+      writer.value(constraint.first);
+      constraint.second.serialize(writer);
+      writer.endObject();
+    }
+    writer.endArray();
   }
-  tree.add_child("constraints", constraints);
 
-  // Write the property tree as a JSON string into the PluginRequest.
-  std::ostringstream output;
-  pt::write_json(output, tree, false);
-  request["context"] = output.str();
+  // Generators may skip columns the query does not reference.
+  if (!context.all_columns_used) {
+    writer.key("used_columns");
+    if (context.used_columns.empty()) {
+      writer.value("", 0);
+    } else {
+      writer.startArray();
+      for (const auto& column : context.used_columns) {
+        writer.value(column);
+      }
+      writer.endArray();
+    }
+  }
+  writer.endObject();
+  writer.endDocument();
 }
 
 void TablePlugin::setResponseFromQueryData(const QueryData& data,
@@ -62,6 +90,116 @@ void TablePlugin::setResponseFromQueryData(const QueryData& data,
   response = std::move(data);
 }
 
+/**
+ * @brief Parse a serialized QueryContext without an intermediate tree.
+ *
+ * The path of keys to each value identifies the limit, a constraint's name,
+ * affinity, and operator/expression list, or a used column.
+ */
+class QueryContextJSONHandler : public JSONHandler {
+ public:
+  explicit QueryContextJSONHandler(QueryContext& context) : context_(context) {}
+
+  void startObject() { start(); }
+  void endObject() { end(); }
+  void startArray() { start(); }
+  void endArray() { end(); }
+  void key(std::string& name) { key_.swap(name); }
+
+  void value(std::string& data) {
+    if (path_.empty() && key_ == "limit") {
+      context_.limit = std::atoi(data.c_str());
+    } else if (path_.empty() && key_ == "used_columns") {
+      // An empty set of used columns is written as "".
+      context_.all_columns_used = false;
+    } else if (inUsedColumns()) {
+      context_.used_columns.insert(data);
+    } else if (inConstraint()) {
+      if (key_ == "name") {
+        name_.swap(data);
+      } else if (key_ == "affinity") {
+        affinity_.swap(data);
+        has_affinity_ = true;
+      }
+    } else if (inConstraintExpression()) {
+      if (key_ == "op") {
+        op_ = (unsigned char)std::atoi(data.c_str());
+      } else if (key_ == "expr") {
+        expr_.swap(data);
+      }
+    }
+    key_.clear();
+  }
+
+ private:
+  void start() {
+    if (started_) {
+      path_.push_back(key_);
+    }
+    started_ = true;
+    key_.clear();
+
+    if (path_.size() == 1 && path_[0] == "used_columns") {
+      context_.all_columns_used = false;
+    } else if (inConstraint()) {
+      name_.clear();
+      list_.clear();
+      has_affinity_ = false;
+    } else if (inConstraintExpression()) {
+      op_ = 0;
+      expr_.clear();
+    }
+  }
+
+  void end() {
+    if (inConstraint()) {
+      auto& constraints = context_.constraints[name_];
+      for (const auto& constraint : list_) {
+        constraints.add(constraint);
+      }
+      if (has_affinity_) {
+        constraints.affinity = affinity_;
+      }
+    } else if (inConstraintExpression()) {
+      list_.push_back(Constraint(op_, expr_));
+    }
+
+    if (!path_.empty()) {
+      path_.pop_back();
+    }
+  }
+
+  bool inUsedColumns() const {
+    return path_.size() == 1 && path_[0] == "used_columns";
+  }
+
+  bool inConstraint() const {
+    return path_.size() == 2 && path_[0] == "constraints";
+  }
+
+  bool inConstraintExpression() const {
+    return path_.size() == 4 && path_[0] == "constraints" && path_[2] == "list";
+  }
+
+ private:
+  QueryContext& context_;
+
+  /// The keys of the open containers below the document, "" in lists.
+  std::vector<std::string> path_;
+  std::string key_;
+  bool started_{false};
+
+  /// The constraint being read.
+  std::string name_;
+  std::string affinity_;
+  bool has_affinity_{false};
+  std::vector<Constraint> list_;
+
+  /// The operator/expression being read.
+  unsigned char op_{0};
+  std::string expr_;
+};
+
 void TablePlugin::setContextFromRequest(const PluginRequest& request,
                                         QueryContext& context) {
   if (request.count("context") == 0) {
@@ -69,21 +207,42 @@ void TablePlugin::setContextFromRequest(const PluginRequest& request,
   }
 
   // Read serialized context from PluginRequest.
-  pt::ptree tree;
-  try {
-    std::stringstream input;
-    input << request.at("context");
-    pt::read_json(input, tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    return;
+  QueryContextJSONHandler handler(context);
+  parseJSON(request.at("context"), handler);
+  context.compile();
+}
+
+Status TablePlugin::generateFromContext(const std::string& table,
+                                        QueryContext& context,
+                                        PluginResponse& response) {
+  response.clear();
+  if (!Registry::exists("table", table, true)) {
+    // Extension tables receive the context serialized in the request.
+    PluginRequest request = {{"action", "generate"}};
+    setRequestFromContext(context, request);
+    return Registry::call("table", table, request, response);
   }
 
-  // Set the context limit and deserialize each column constraint list.
-  context.limit = tree.get<int>("limit");
-  for (const auto& constraint : tree.get_child("constraints")) {
-    auto column_name = constraint.second.get<std::string>("name");
-    context.constraints[column_name].unserialize(constraint.second);
+  try {
+    auto plugin =
+        std::dynamic_pointer_cast<TablePlugin>(Registry::get("table", table));
+    if (plugin == nullptr) {
+      return Status(1, "Cannot call registry item: " + table);
+    }
+    plugin->generateRows(context, [&response](Row& row) {
+      response.push_back(std::move(row));
+      return true;
+    });
+  } catch (const std::exception& e) {
+    LOG(ERROR) << "table registry " << table
+               << " plugin caused exception: " << e.what();
+    return Status(1, e.what());
+  } catch (...) {
+    LOG(ERROR) << "table registry " << table
+               << " plugin caused unknown exception";
+    return Status(2, "Unknown exception");
   }
+  return Status(0, "OK");
 }
 
 Status TablePlugin::call(const PluginRequest& request,
@@ -102,14 +261,19 @@ Status TablePlugin::call(const PluginRequest& request,
     if (request.count("context") > 0) {
       setContextFromRequest(request, context);
     }
-    setResponseFromQueryData(generate(context), response);
+    generateRows(context, [&response](Row& row) {
+      response.push_back(std::move(row));
+      return true;
+    });
   } else if (request.at("action") == "columns") {
     // "columns" returns a PluginRequest filled with column information
-    // such as name and type.
-    const auto& column_list = columns();
-    for (const auto& column : column_list) {
-      response.push_back({{"name", column.first}, {"type", column.second}});
-    }
+    // such as name, type, and planner options.
+    response = routeInfo();
+  } else if (request.at("action") == "attributes") {
+    // "attributes" returns table-level planner and cache hints.
+    response.push_back({{"cardinality", std::to_string(cardinality())},
+                        {"cache_ttl", std::to_string(cacheTTL())},
+                        {"cacheable", std::to_string(cacheable())}});
   } else if (request.at("action") == "definition") {
     response.push_back({{"definition", columnDefinition()}});
   } else {
@@ -126,8 +290,12 @@ std::string TablePlugin::columnDefinition() const {
 PluginResponse TablePlugin::routeInfo() const {
   // Route info consists of only the serialized column information.
   PluginResponse response;
+  auto options = columnOptions();
   for (const auto& column : columns()) {
     response.push_back({{"name", column.first}, {"type", column.second}});
+    if (options.count(column.first) > 0) {
+      response.back()["op"] = std::to_string(options.at(column.first));
+    }
   }
   return response;
 }
@@ -151,30 +319,280 @@ std::string columnDefinition(const PluginResponse& response) {
   return columnDefinition(columns);
 }
 
+std::string RowValue::toString() const {
+  switch (type_) {
+  case INTEGER_VALUE:
+    return std::to_string(integer_);
+  case DOUBLE_VALUE: {
+    std::string text;
+    appendDouble(text, real_);
+    return text;
+  }
+  default:
+    return text_;
+  }
+}
+
+Row toRow(TypedRow& row) {
+  Row result;
+  for (auto& column : row) {
+    if (column.second.type() == RowValue::TEXT_VALUE) {
+      result[column.first] = std::move(column.second.text());
+    } else {
+      result[column.first] = column.second.toString();
+    }
+  }
+  return result;
+}
+
+Row toRow(ColumnRow& row, const TableColumns& columns) {
+  Row result;
+  for (size_t i = 0; i < row.size() && i < columns.size(); ++i) {
+    if (row[i].type() == RowValue::TEXT_VALUE) {
+      result[columns[i].first] = std::move(row[i].text());
+    } else {
+      result[columns[i].first] = row[i].toString();
+    }
+  }
+  return result;
+}
+
+ColumnAffinity columnAffinity(const std::string& type) {
+  if (type == "TEXT") {
+    return AFFINITY_TEXT;
+  } else if (type == "INTEGER") {
+    return AFFINITY_INTEGER;
+  } else if (type == "BIGINT") {
+    return AFFINITY_BIGINT;
+  } else if (type == "UNSIGNED_BIGINT") {
+    return AFFINITY_UNSIGNED_BIGINT;
+  }
+  return AFFINITY_UNKNOWN;
+}
+
+/**
+ * @brief The comparisons of a constraint list reduced for a literal type.
+ *
+ * ANDed comparisons on an ordered type are equivalent to at most one required
+ * value, a lower and upper bound, and a set of excluded values.
+ */
+template <typename T>
+struct ConstraintBounds {
+  bool has_equals{false};
+  T equals;
+
+  bool has_lower{false};
+  bool lower_inclusive{false};
+  T lower;
+
+  bool has_upper{false};
+  bool upper_inclusive{false};
+  T upper;
+
+  /// Sorted NOT_EQUALS values, found with a binary search.
+  std::vector<T> excluded;
+
+  /// Set when two EQUALS constraints disagree, nothing matches.
+  bool empty{false};
+
+  void add(unsigned char op, const T& literal) {
+    if (op == EQUALS) {
+      empty = empty || (has_equals && !(equals == literal));
+      has_equals = true;
+      equals = literal;
+    } else if (op == GREATER_THAN || op == GREATER_THAN_OR_EQUALS) {
+      bool inclusive = (op == GREATER_THAN_OR_EQUALS);
+      if (!has_lower || lower < literal ||
+          (literal == lower && lower_inclusive && !inclusive)) {
+        has_lower = true;
+        lower = literal;
+        lower_inclusive = inclusive;
+      }
+    } else if (op == LESS_THAN || op == LESS_THAN_OR_EQUALS) {
+      bool inclusive = (op == LESS_THAN_OR_EQUALS);
+      if (!has_upper || literal < upper ||
+          (literal == upper && upper_inclusive && !inclusive)) {
+        has_upper = true;
+        upper = literal;
+        upper_inclusive = inclusive;
+      }
+    } else if (op == NOT_EQUALS) {
+      excluded.push_back(literal);
+    }
+  }
+
+  void finish() {
+    std::sort(excluded.begin(), excluded.end());
+    excluded.erase(std::unique(excluded.begin(), excluded.end()),
+                   excluded.end());
+  }
+
+  bool matches(const T& value) const {
+    if (empty || (has_equals && !(value == equals))) {
+      return false;
+    }
+    if (has_lower && (lower_inclusive ? value < lower : !(lower < value))) {
+      return false;
+    }
+    if (has_upper && (upper_inclusive ? upper < value : !(value < upper))) {
+      return false;
+    }
+    return excluded.empty() ||
+           !std::binary_search(excluded.begin(), excluded.end(), value);
+  }
+};
+
+struct ConstraintPredicate {
+  ColumnAffinity affinity{AFFINITY_UNKNOWN};
+
+  /// Set if an operator is unsupported or an expression does not cast.
+  bool invalid{false};
+
+  /// Bounds for TEXT, INTEGER and BIGINT, and UNSIGNED_BIGINT affinities.
+  ConstraintBounds<TEXT_LITERAL> text;
+  ConstraintBounds<BIGINT_LITERAL> signed_bounds;
+  ConstraintBounds<UNSIGNED_BIGINT_LITERAL> unsigned_bounds;
+};
+
+void ConstraintList::compile() {
+  auto predicate = std::make_shared<ConstraintPredicate>();
+  predicate->affinity = columnAffinity(affinity);
+  for (const auto& constraint : constraints_) {
+    auto op = constraint.op;
+    if (op >= MATCHES && op <= REGEXP) {
+      // Pattern operators are applied by SQLite to the generated rows.
+      continue;
+    } else if (op != EQUALS && op != GREATER_THAN && op != LESS_THAN &&
+               op != GREATER_THAN_OR_EQUALS && op != LESS_THAN_OR_EQUALS &&
+               op != NOT_EQUALS) {
+      predicate->invalid = true;
+      break;
+    }
+
+    bool cast = true;
+    if (predicate->affinity == AFFINITY_TEXT) {
+      predicate->text.add(op, constraint.expr);
+    } else if (predicate->affinity == AFFINITY_INTEGER) {
+      INTEGER_LITERAL lexpr = 0;
+      cast = parseInteger(constraint.expr, lexpr);
+      predicate->signed_bounds.add(op, lexpr);
+    } else if (predicate->affinity == AFFINITY_BIGINT) {
+      BIGINT_LITERAL lexpr = 0;
+      cast = parseInteger(constraint.expr, lexpr);
+      predicate->signed_bounds.add(op, lexpr);
+    } else if (predicate->affinity == AFFINITY_UNSIGNED_BIGINT) {
+      UNSIGNED_BIGINT_LITERAL lexpr = 0;
+      cast = parseInteger(constraint.expr, lexpr);
+      predicate->unsigned_bounds.add(op, lexpr);
+    }
+    if (!cast) {
+      predicate->invalid = true;
+      break;
+    }
+  }
+
+  predicate->text.finish();
+  predicate->signed_bounds.finish();
+  predicate->unsigned_bounds.finish();
+  predicate_ = predicate;
+}
+
 bool ConstraintList::matches(const std::string& expr) const {
+  if (predicate_ != nullptr) {
+    // The expression is cast before checking the predicate, as it is when
+    // the constraint expressions are parsed for each call.
+    const auto& predicate = *predicate_;
+    switch (predicate.affinity) {
+    case AFFINITY_TEXT:
+      return !predicate.invalid && predicate.text.matches(expr);
+    case AFFINITY_INTEGER: {
+      INTEGER_LITERAL lexpr = 0;
+      return parseInteger(expr, lexpr) && !predicate.invalid &&
+             predicate.signed_bounds.matches(lexpr);
+    }
+    case AFFINITY_BIGINT: {
+      BIGINT_LITERAL lexpr = 0;
+      return parseInteger(expr, lexpr) && !predicate.invalid &&
+             predicate.signed_bounds.matches(lexpr);
+    }
+    case AFFINITY_UNSIGNED_BIGINT: {
+      UNSIGNED_BIGINT_LITERAL lexpr = 0;
+      return parseInteger(expr, lexpr) && !predicate.invalid &&
+             predicate.unsigned_bounds.matches(lexpr);
+    }
+    default:
+      return false;
+    }
+  }
+
   // Support each SQL affinity type casting.
   if (affinity == "TEXT") {
     return literal_matches<TEXT_LITERAL>(expr);
   } else if (affinity == "INTEGER") {
-    INTEGER_LITERAL lexpr = AS_LITERAL(INTEGER_LITERAL, expr);
-    return literal_matches<INTEGER_LITERAL>(lexpr);
+    INTEGER_LITERAL lexpr = 0;
+    return parseInteger(expr, lexpr) && literal_matches<INTEGER_LITERAL>(lexpr);
   } else if (affinity == "BIGINT") {
-    BIGINT_LITERAL lexpr = AS_LITERAL(BIGINT_LITERAL, expr);
-    return literal_matches<BIGINT_LITERAL>(lexpr);
+    BIGINT_LITERAL lexpr = 0;
+    return parseInteger(expr, lexpr) && literal_matches<BIGINT_LITERAL>(lexpr);
   } else if (affinity == "UNSIGNED_BIGINT") {
-    UNSIGNED_BIGINT_LITERAL lexpr = AS_LITERAL(UNSIGNED_BIGINT_LITERAL, expr);
-    return literal_matches<UNSIGNED_BIGINT_LITERAL>(lexpr);
+    UNSIGNED_BIGINT_LITERAL lexpr = 0;
+    return parseInteger(expr, lexpr) &&
+           literal_matches<UNSIGNED_BIGINT_LITERAL>(lexpr);
   } else {
     // Unsupprted affinity type.
     return false;
   }
 }
 
+bool ConstraintList::signedMatches(long long expr) const {
+  if (predicate_ != nullptr && !predicate_->invalid) {
+    if (predicate_->affinity == AFFINITY_BIGINT ||
+        (predicate_->affinity == AFFINITY_INTEGER &&
+         expr >= std::numeric_limits<INTEGER_LITERAL>::min() &&
+         expr <= std::numeric_limits<INTEGER_LITERAL>::max())) {
+      return predicate_->signed_bounds.matches(expr);
+    } else if (predicate_->affinity == AFFINITY_UNSIGNED_BIGINT && expr >= 0) {
+      return predicate_->unsigned_bounds.matches(expr);
+    }
+  }
+  return matches(TEXT(expr));
+}
+
+bool ConstraintList::unsignedMatches(unsigned long long expr) const {
+  if (predicate_ != nullptr && !predicate_->invalid) {
+    if (predicate_->affinity == AFFINITY_UNSIGNED_BIGINT) {
+      return predicate_->unsigned_bounds.matches(expr);
+    } else if (expr <= (unsigned long long)
+                           std::numeric_limits<BIGINT_LITERAL>::max()) {
+      return signedMatches(static_cast<long long>(expr));
+    }
+  }
+  return matches(TEXT(expr));
+}
+
+/// Cast a constraint expression to a literal type, without exceptions.
+template <typename T>
+static bool castLiteral(const std::string& expr, T& value) {
+  return parseInteger(expr, value);
+}
+
+static bool castLiteral(const std::string& expr, std::string& value) {
+  value = expr;
+  return true;
+}
+
 template <typename T>
 bool ConstraintList::literal_matches(const T& base_expr) const {
   bool aggregate = true;
   for (size_t i = 0; i < constraints_.size(); ++i) {
-    T constraint_expr = AS_LITERAL(T, constraints_[i].expr);
+    if (constraints_[i].op >= MATCHES && constraints_[i].op <= REGEXP) {
+      // Pattern operators are applied by SQLite to the generated rows.
+      continue;
+    }
+    T constraint_expr;
+    if (!castLiteral(constraints_[i].expr, constraint_expr)) {
+      return false;
+    }
     if (constraints_[i].op == EQUALS) {
       aggregate = aggregate && (base_expr == constraint_expr);
     } else if (constraints_[i].op == GREATER_THAN) {
@@ -185,6 +603,8 @@ bool ConstraintList::literal_matches(const T& base_expr) const {
       aggregate = aggregate && (base_expr >= constraint_expr);
     } else if (constraints_[i].op == LESS_THAN_OR_EQUALS) {
       aggregate = aggregate && (base_expr <= constraint_expr);
+    } else if (constraints_[i].op == NOT_EQUALS) {
+      aggregate = aggregate && (base_expr != constraint_expr);
     } else {
       // Unsupported constraint.
       return false;
@@ -197,6 +617,17 @@ bool ConstraintList::literal_matches(const T& base_expr) const {
   return true;
 }
 
+bool ConstraintList::comparable() const {
+  for (const auto& constraint : constraints_) {
+    if (constraint.op != EQUALS && constraint.op != GREATER_THAN &&
+        constraint.op != LESS_THAN && constraint.op != GREATER_THAN_OR_EQUALS &&
+        constraint.op != LESS_THAN_OR_EQUALS && constraint.op != NOT_EQUALS) {
+      return false;
+    }
+  }
+  return true;
+}
+
 std::set<std::string> ConstraintList::getAll(ConstraintOperator op) const {
   std::set<std::string> set;
   for (size_t i = 0; i < constraints_.size(); ++i) {
@@ -220,6 +651,26 @@ void ConstraintList::serialize(boost::property_tree::ptree& tree) const {
   tree.put("affinity", affinity);
 }
 
+void ConstraintList::serialize(JSONWriter& writer) const {
+  writer.key("list");
+  if (constraints_.empty()) {
+    writer.value("", 0);
+  } else {
+    writer.startArray();
+    for (const auto& constraint : constraints_) {
+      writer.startObject();
+      writer.key("op");
+      writer.value(std::to_string(constraint.op));
+      writer.key("expr");
+      writer.value(constraint.expr);
+      writer.endObject();
+    }
+    writer.endArray();
+  }
+  writer.key("affinity");
+  writer.value(affinity);
+}
+
 void ConstraintList::unserialize(const boost::property_tree::ptree& tree) {
   // Iterate through the list of operand/expressions, then set the constraint
   // type affinity.
@@ -229,5 +680,83 @@ void ConstraintList::unserialize(const boost::property_tree::ptree& tree) {
     constraints_.push_back(constraint);
   }
   affinity = tree.get<std::string>("affinity");
+  predicate_ = nullptr;
+}
+
+bool QueryContext::matches(const Row& row) const {
+  for (const auto& column : constraints) {
+    if (!column.second.exists()) {
+      continue;
+    }
+
+    auto value = row.find(column.first);
+    if (value == row.end()) {
+      return false;
+    }
+
+    if (!column.second.matches(value->second)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool QueryContext::matchesTyped(const TypedRow& row) const {
+  for (const auto& column : constraints) {
+    if (!column.second.exists()) {
+      continue;
+    }
+
+    auto value = row.find(column.first);
+    if (value == row.end()) {
+      return false;
+    }
+
+    bool matched = false;
+    if (value->second.type() == RowValue::INTEGER_VALUE) {
+      matched = column.second.matches(value->second.integer());
+    } else if (value->second.type() == RowValue::TEXT_VALUE) {
+      matched = column.second.matches(value->second.text());
+    } else {
+      matched = column.second.matches(value->second.toString());
+    }
+    if (!matched) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool QueryContext::matchesColumns(const ColumnRow& row,
+                                  const TableColumns& columns) const {
+  for (size_t i = 0; i < columns.size(); ++i) {
+    auto column = constraints.find(columns[i].first);
+    if (column == constraints.end() || !column->second.exists()) {
+      continue;
+    }
+
+    if (i >= row.size()) {
+      return false;
+    }
+    const auto& value = row[i];
+    bool matched = false;
+    if (value.type() == RowValue::INTEGER_VALUE) {
+      matched = column->second.matches(value.integer());
+    } else if (value.type() == RowValue::TEXT_VALUE) {
+      matched = column->second.matches(value.text());
+    } else {
+      matched = column->second.matches(value.toString());
+    }
+    if (!matched) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void QueryContext::compile() {
+  for (auto& column : constraints) {
+    column.second.compile();
+  }
 }
 }
@@ -8,19 +8,30 @@
  *
  */
 
+#include <algorithm>
+#include <chrono>
 #include <deque>
+#include <iostream>
 #include <sstream>
 
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/filesystem/operations.hpp>
 
+#include <gtest/gtest.h>
+
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
 #include "osquery/core/test_util.h"
 
 namespace osquery {
 
+FLAG(int32,
+     benchmark_min_time,
+     500,
+     "Minimum milliseconds of each benchmark's measured batch");
+
 /// Most tests will use binary or disk-backed content for parsing tests.
 #ifndef OSQUERY_BUILD_SDK
 std::string kTestDataPath = "../../../tools/tests/";
@@ -273,4 +284,76 @@ void createMockFileStructure() {
 void tearDownMockFileStructure() {
   boost::filesystem::remove_all(kFakeDirectory);
 }
+
+BenchmarkResult runBenchmark(const std::function<void()>& body,
+                             size_t items,
+                             size_t bytes) {
+  typedef std::chrono::steady_clock clock;
+  auto min_time = std::chrono::milliseconds(
+      (FLAGS_benchmark_min_time > 0) ? FLAGS_benchmark_min_time : 1);
+
+  BenchmarkResult result;
+  clock::duration elapsed(0);
+  for (size_t iterations = 1;; iterations *= 2) {
+    auto start = clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+      body();
+    }
+    elapsed = clock::now() - start;
+    result.iterations = iterations;
+    if (elapsed >= min_time) {
+      break;
+    }
+  }
+
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+  result.ns_per_iteration = (double)ns.count() / result.iterations;
+
+  const auto* info = testing::UnitTest::GetInstance()->current_test_info();
+  std::string name = (info != nullptr)
+                         ? std::string(info->test_case_name()) + "." +
+                               info->name()
+                         : "benchmark";
+  std::cout << "[ BENCH    ] " << name << " " << result.iterations
+            << " iterations " << (size_t)result.ns_per_iteration
+            << " ns/iteration";
+
+  if (info != nullptr) {
+    testing::Test::RecordProperty("iterations", (int)result.iterations);
+    testing::Test::RecordProperty("ns_per_iteration",
+                                  std::to_string(result.ns_per_iteration));
+  }
+
+  double per_second = 1e9 / result.ns_per_iteration;
+  if (items > 0) {
+    std::cout << " " << (size_t)(items * per_second) << " items/s";
+    if (info != nullptr) {
+      testing::Test::RecordProperty("items_per_second",
+                                    std::to_string(items * per_second));
+    }
+  }
+  if (bytes > 0) {
+    std::cout << " " << (size_t)(bytes * per_second) << " bytes/s";
+    if (info != nullptr) {
+      testing::Test::RecordProperty("bytes_per_second",
+                                    std::to_string(bytes * per_second));
+    }
+  }
+  std::cout << std::endl;
+  return result;
+}
+
+QueryData generateBenchmarkRows(size_t rows, size_t columns, size_t size) {
+  QueryData results;
+  for (size_t i = 0; i < rows; ++i) {
+    Row r;
+    for (size_t c = 0; c < columns; ++c) {
+      auto value = std::to_string(i * columns + c);
+      value.resize(std::max(size, value.size()), 'x');
+      r["column_" + std::to_string(c)] = value;
+    }
+    results.push_back(r);
+  }
+  return results;
+}
 }
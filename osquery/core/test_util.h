@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <functional>
 #include <string>
 #include <utility>
 #include <vector>
@@ -104,4 +105,33 @@ std::vector<SplitStringTestData> generateSplitStringTestData();
 void createMockFileStructure();
 // remove the small directory structure used for testing
 void tearDownMockFileStructure();
+
+/// The measurements of a benchmark.
+struct BenchmarkResult {
+  /// The number of times the body was run in the measured batch.
+  size_t iterations{0};
+
+  /// Nanoseconds per iteration.
+  double ns_per_iteration{0};
+};
+
+/**
+ * @brief Time a benchmark body from within a gtest test.
+ *
+ * The body runs in batches of doubling size until a batch takes at least
+ * --benchmark_min_time milliseconds. The result is printed and recorded as
+ * test properties (iterations, ns_per_iteration, and optionally
+ * items_per_second and bytes_per_second), such that --gtest_output=xml
+ * writes it in a machine-readable report.
+ *
+ * @param body The work measured, run once per iteration.
+ * @param items Optional number of items processed by each iteration.
+ * @param bytes Optional number of bytes processed by each iteration.
+ */
+BenchmarkResult runBenchmark(const std::function<void()>& body,
+                             size_t items = 0,
+                             size_t bytes = 0);
+
+/// Generate rows with the given number of columns and value size.
+QueryData generateBenchmarkRows(size_t rows, size_t columns, size_t size);
 }
@@ -0,0 +1,69 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <cstdint>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/arena.h"
+
+namespace osquery {
+
+class ArenaTests : public testing::Test {};
+
+TEST_F(ArenaTests, test_arena_allocate) {
+  Arena arena(1024);
+  auto first = arena.allocate(3, 1);
+  auto second = arena.allocate(8, 8);
+  EXPECT_NE(first, second);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(second) % 8, 0U);
+  EXPECT_EQ(arena.allocated(), 11U);
+
+  // Allocations larger than a block are supported.
+  auto large = static_cast<char*>(arena.allocate(4096));
+  large[4095] = 0;
+
+  // The first block is reused after a reset.
+  arena.reset();
+  EXPECT_EQ(arena.allocated(), 0U);
+  EXPECT_EQ(arena.allocate(3, 1), first);
+}
+
+TEST_F(ArenaTests, test_scoped_arena) {
+  EXPECT_EQ(Arena::current(), nullptr);
+
+  Arena arena;
+  {
+    ScopedArena scope(arena);
+    EXPECT_EQ(Arena::current(), &arena);
+
+    ArenaVector<int> values;
+    EXPECT_EQ(values.get_allocator().arena(), &arena);
+    for (int i = 0; i < 1000; ++i) {
+      values.push_back(i);
+    }
+    EXPECT_EQ(values[999], 999);
+    EXPECT_GE(arena.allocated(), 1000 * sizeof(int));
+
+    ArenaUnorderedMap<int, ArenaVector<int>> index;
+    index[1].push_back(2);
+    EXPECT_EQ(index[1][0], 2);
+  }
+
+  // The scope resets the arena and uninstalls it.
+  EXPECT_EQ(Arena::current(), nullptr);
+  EXPECT_EQ(arena.allocated(), 0U);
+
+  // Without an arena containers use the heap.
+  ArenaVector<int> values = {1, 2, 3};
+  EXPECT_EQ(values.get_allocator().arena(), nullptr);
+  EXPECT_EQ(values.size(), 3U);
+}
+}
@@ -0,0 +1,88 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <boost/filesystem.hpp>
+
+#include <gtest/gtest.h>
+
+#include <osquery/filesystem.h>
+
+#include "osquery/core/test_util.h"
+#include "osquery/core/watcher.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+class CgroupsTests : public testing::Test {
+ protected:
+  void SetUp() {
+    // A fake cgroup has the files the kernel would create.
+    root_ = kTestWorkingDirectory + "cgroup";
+    fs::remove_all(root_);
+    fs::create_directories(root_ + "/watcher");
+    fs::create_directories(root_ + "/worker");
+    writeTextFile(root_ + "/cgroup.controllers", "cpuset cpu io memory pids\n");
+    for (const auto& file : {"/cgroup.subtree_control",
+                             "/watcher/cgroup.procs",
+                             "/worker/cgroup.procs",
+                             "/worker/cpu.max",
+                             "/worker/memory.high",
+                             "/worker/memory.max",
+                             "/worker/io.weight"}) {
+      writeTextFile(root_ + file, "");
+    }
+  }
+
+  void TearDown() { fs::remove_all(root_); }
+
+  std::string content(const std::string& file) {
+    std::string value;
+    readFile(root_ + file, value);
+    return value;
+  }
+
+  std::string root_;
+};
+
+TEST_F(CgroupsTests, test_cgroup_limits) {
+  WatcherCgroups cgroups;
+  EXPECT_FALSE(cgroups.active());
+  EXPECT_EQ(cgroups.prepare("worker", getCgroupLimits()), "");
+
+  ASSERT_TRUE(cgroups.setUp(root_).ok());
+  EXPECT_TRUE(cgroups.active());
+  EXPECT_EQ(content("/watcher/cgroup.procs"), std::to_string(getpid()));
+
+  // Limits follow the watchdog level.
+  auto procs = cgroups.prepare("worker", getCgroupLimits(1));
+  EXPECT_EQ(procs, root_ + "/worker/cgroup.procs");
+  EXPECT_EQ(content("/worker/cpu.max"), "80000 100000");
+  EXPECT_EQ(content("/worker/memory.high"), std::to_string(50 * 1024 * 1024));
+  EXPECT_EQ(content("/worker/memory.max"), std::to_string(100 * 1024 * 1024));
+  EXPECT_EQ(content("/worker/io.weight"), "default 50");
+
+  // Without limits the controllers are unbounded.
+  cgroups.prepare("worker", CgroupLimits());
+  EXPECT_EQ(content("/worker/cpu.max"), "max 100000");
+  EXPECT_EQ(content("/worker/memory.max"), "max");
+
+  // A fake cgroup has no PSI triggers.
+  auto pressure = cgroups.pressure("worker");
+  EXPECT_FALSE(pressure.memory);
+  EXPECT_FALSE(pressure.cpu);
+}
+
+TEST_F(CgroupsTests, test_cgroup_missing) {
+  WatcherCgroups cgroups;
+  EXPECT_FALSE(cgroups.setUp(root_ + "/missing").ok());
+  EXPECT_FALSE(cgroups.active());
+}
+}
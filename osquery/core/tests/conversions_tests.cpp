@@ -11,6 +11,10 @@
 #include <boost/make_shared.hpp>
 #include <boost/shared_ptr.hpp>
 
+#include <limits>
+
+#include <zlib.h>
+
 #include <gtest/gtest.h>
 
 #include "osquery/core/conversions.h"
@@ -51,4 +55,149 @@ TEST_F(ConversionsTests, test_ascii_false) {
   auto result = isPrintable(unencoded);
   EXPECT_FALSE(result);
 }
+
+TEST_F(ConversionsTests, test_find_non_printable) {
+  std::string data(100, 'a');
+  EXPECT_EQ(findNonPrintable(data.data(), data.size()), data.size());
+  EXPECT_EQ(findNonPrintable(data.data(), 0), 0U);
+
+  // Check each offset, within and after the vectorized chunks.
+  for (size_t i = 0; i < data.size(); ++i) {
+    auto check = data;
+    check[i] = (i % 2 == 0) ? '\n' : '\xE3';
+    EXPECT_EQ(findNonPrintable(check.data(), check.size()), i);
+  }
+
+  std::string edges = " ~\x7F";
+  EXPECT_EQ(findNonPrintable(edges.data(), edges.size()), edges.size());
+}
+
+TEST_F(ConversionsTests, test_parse_integer) {
+  long long value = 0;
+  EXPECT_TRUE(parseInteger("-42", value));
+  EXPECT_EQ(-42, value);
+  EXPECT_TRUE(parseInteger("+7", value));
+  EXPECT_EQ(7, value);
+  EXPECT_TRUE(parseInteger("-9223372036854775808", value));
+  EXPECT_EQ(std::numeric_limits<long long>::min(), value);
+  EXPECT_FALSE(parseInteger("9223372036854775808", value));
+
+  // Malformed input fails and leaves the value unchanged.
+  value = 3;
+  for (const auto& text : {"", "-", " 1", "1 ", "1.0", "0x10", "1e3"}) {
+    EXPECT_FALSE(parseInteger(std::string(text), value)) << text;
+  }
+  EXPECT_EQ(3, value);
+
+  unsigned long long uvalue = 0;
+  EXPECT_TRUE(parseInteger("18446744073709551615", uvalue));
+  EXPECT_EQ(std::numeric_limits<unsigned long long>::max(), uvalue);
+  EXPECT_FALSE(parseInteger("18446744073709551616", uvalue));
+  EXPECT_FALSE(parseInteger("-1", uvalue));
+
+  // Narrower types are range checked.
+  int ivalue = 0;
+  EXPECT_TRUE(parseInteger("0002147483647", ivalue));
+  EXPECT_EQ(std::numeric_limits<int>::max(), ivalue);
+  EXPECT_FALSE(parseInteger("2147483648", ivalue));
+  uint32_t u32 = 0;
+  EXPECT_FALSE(parseInteger("4294967296", u32));
+}
+
+TEST_F(ConversionsTests, test_parse_double) {
+  double value = 0;
+  EXPECT_TRUE(parseDouble("1.5", value));
+  EXPECT_EQ(1.5, value);
+  EXPECT_TRUE(parseDouble("-2e3", value));
+  EXPECT_EQ(-2000, value);
+  EXPECT_FALSE(parseDouble("", value));
+  EXPECT_FALSE(parseDouble(" 1", value));
+  EXPECT_FALSE(parseDouble("1.5a", value));
+  EXPECT_FALSE(parseDouble("1e400", value));
+  EXPECT_EQ(-2000, value);
+}
+
+TEST_F(ConversionsTests, test_append_numbers) {
+  std::string text;
+  appendInteger(text, 0LL);
+  text += ",";
+  appendInteger(text, std::numeric_limits<long long>::min());
+  text += ",";
+  appendInteger(text, std::numeric_limits<unsigned long long>::max());
+  EXPECT_EQ("0,-9223372036854775808,18446744073709551615", text);
+
+  // Doubles are formatted as boost::lexical_cast formats them.
+  text.clear();
+  appendDouble(text, 0.1);
+  EXPECT_EQ("0.10000000000000001", text);
+  text.clear();
+  appendDouble(text, 1.5);
+  EXPECT_EQ("1.5", text);
+}
+
+TEST_F(ConversionsTests, test_compress_gzip) {
+  std::string data;
+  for (size_t i = 0; i < 1000; ++i) {
+    data += "{\"name\":\"osqueryd\",\"pid\":\"" + std::to_string(i) + "\"}\n";
+  }
+
+  std::string compressed;
+  EXPECT_TRUE(compressGzip(data, compressed).ok());
+  EXPECT_LT(compressed.size(), data.size());
+  // The gzip magic bytes.
+  ASSERT_GT(compressed.size(), 2U);
+  EXPECT_EQ(compressed[0], '\x1F');
+  EXPECT_EQ(compressed[1], '\x8B');
+
+  // Inflate the stream, expecting a gzip wrapper.
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  ASSERT_EQ(inflateInit2(&stream, 15 + 16), Z_OK);
+  std::string inflated(data.size(), '\0');
+  stream.next_in = (Bytef*)compressed.data();
+  stream.avail_in = compressed.size();
+  stream.next_out = (Bytef*)&inflated[0];
+  stream.avail_out = inflated.size();
+  EXPECT_EQ(inflate(&stream, Z_FINISH), Z_STREAM_END);
+  EXPECT_EQ(stream.total_out, data.size());
+  inflateEnd(&stream);
+  EXPECT_EQ(inflated, data);
+
+  EXPECT_TRUE(compressGzip("", compressed).ok());
+  EXPECT_FALSE(compressed.empty());
+}
+
+TEST_F(ConversionsTests, test_gzip_compressor) {
+  std::string data;
+  std::string compressed;
+  {
+    GzipCompressor compressor(compressed);
+    for (size_t i = 0; i < 10000; ++i) {
+      auto piece = "{\"name\":\"osqueryd\",\"pid\":\"" + std::to_string(i) +
+                   "\"}\n";
+      EXPECT_TRUE(compressor.compress(piece).ok());
+      data += piece;
+    }
+    EXPECT_TRUE(compressor.finish().ok());
+    EXPECT_EQ(compressor.size(), data.size());
+    EXPECT_FALSE(compressor.compress("more").ok());
+  }
+  EXPECT_LT(compressed.size(), data.size());
+
+  std::string inflated;
+  EXPECT_TRUE(decompressGzip(compressed, inflated).ok());
+  EXPECT_EQ(inflated, data);
+
+  // A stream larger than the maximum, or truncated, is not decompressed.
+  EXPECT_FALSE(decompressGzip(compressed, inflated, data.size() - 1).ok());
+  EXPECT_TRUE(inflated.empty());
+  EXPECT_TRUE(decompressGzip(compressed, inflated, data.size()).ok());
+  compressed.resize(compressed.size() / 2);
+  EXPECT_FALSE(decompressGzip(compressed, inflated).ok());
+
+  // Single-call compression is also decompressed.
+  EXPECT_TRUE(compressGzip(data, compressed).ok());
+  EXPECT_TRUE(decompressGzip(compressed, inflated).ok());
+  EXPECT_EQ(inflated, data);
+}
 }
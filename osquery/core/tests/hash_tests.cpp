@@ -10,6 +10,8 @@
 
 #include <gtest/gtest.h>
 
+#include <osquery/database.h>
+#include <osquery/filesystem.h>
 #include <osquery/hash.h>
 
 #include "osquery/core/test_util.h"
@@ -46,4 +48,57 @@ TEST_F(HashTests, test_file_hashing) {
   auto digest = hashFromFile(HASH_TYPE_MD5, kTestDataPath + "test_hashing.bin");
   EXPECT_EQ(digest, "88ee11f2aa7903f34b8b8785d92208b1");
 }
+
+TEST_F(HashTests, test_multi_file_hashing) {
+  auto path = kTestDataPath + "test_hashing.bin";
+  auto hashes = hashMultiFromFile(HASH_TYPE_MD5 | HASH_TYPE_SHA256, path);
+  EXPECT_EQ(hashes.mask, HASH_TYPE_MD5 | HASH_TYPE_SHA256);
+  EXPECT_EQ(hashes.md5, "88ee11f2aa7903f34b8b8785d92208b1");
+  EXPECT_EQ(hashes.sha256, hashFromFile(HASH_TYPE_SHA256, path));
+
+  // Only the requested digests are computed.
+  EXPECT_TRUE(hashes.sha1.empty());
+
+  hashes = hashMultiFromFile(HASH_TYPE_SHA1, "/does_not_exist");
+  EXPECT_EQ(hashes.mask, 0);
+  EXPECT_TRUE(hashes.sha1.empty());
+}
+
+TEST_F(HashTests, test_large_file_hashing) {
+  // Content spanning several read chunks is hashed as one buffer.
+  std::string content(3 * 1024 * 1024 + 17, 'a');
+  for (size_t i = 0; i < content.size(); i += 4093) {
+    content[i] = (char)(i % 251);
+  }
+
+  auto path = kTestWorkingDirectory + "hash-large-file";
+  writeTextFile(path, content);
+  auto hashes = hashMultiFromFile(HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path);
+  EXPECT_EQ(hashes.sha1,
+            hashFromBuffer(HASH_TYPE_SHA1, content.data(), content.size()));
+  EXPECT_EQ(hashes.sha256,
+            hashFromBuffer(HASH_TYPE_SHA256, content.data(), content.size()));
+  remove(path);
+}
+
+TEST_F(HashTests, test_cached_file_hashing) {
+  auto path = kTestWorkingDirectory + "hash-cache-file";
+  writeTextFile(path, "cached");
+  auto hashes = hashMultiFromFileCached(HASH_TYPE_MD5, path);
+  EXPECT_EQ(hashes.md5, hashFromBuffer(HASH_TYPE_MD5, "cached", 6));
+
+  // The cached digests are returned, and missing digests are added.
+  hashes = hashMultiFromFileCached(HASH_TYPE_MD5 | HASH_TYPE_SHA1, path);
+  EXPECT_EQ(hashes.md5, hashFromBuffer(HASH_TYPE_MD5, "cached", 6));
+  EXPECT_EQ(hashes.sha1, hashFromBuffer(HASH_TYPE_SHA1, "cached", 6));
+
+  std::string content;
+  EXPECT_TRUE(getDatabaseValue(kFileCache, "hash." + path, content).ok());
+
+  // A changed file is hashed again.
+  writeTextFile(path, "changed");
+  hashes = hashMultiFromFileCached(HASH_TYPE_MD5, path);
+  EXPECT_EQ(hashes.md5, hashFromBuffer(HASH_TYPE_MD5, "changed", 7));
+  remove(path);
+}
 }
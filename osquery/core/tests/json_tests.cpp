@@ -0,0 +1,138 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sstream>
+
+#include <boost/property_tree/json_parser.hpp>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/json.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+class JSONTests : public testing::Test {};
+
+/// Write a tree using property_tree's own writer.
+static std::string writeJSON(const pt::ptree& tree) {
+  std::ostringstream output;
+  pt::write_json(output, tree, false);
+  return output.str();
+}
+
+TEST_F(JSONTests, test_escape) {
+  std::string input = "a\"b\\c/d\b\f\n\r\t\x01 e";
+  std::string output;
+  escapeJSONString(input.data(), input.size(), output);
+  EXPECT_EQ(output, "a\\\"b\\\\c\\/d\\b\\f\\n\\r\\t\\u0001 e");
+
+  pt::ptree tree;
+  tree.put("key", input);
+  EXPECT_EQ(writeJSON(tree), "{\"key\":\"" + output + "\"}\n");
+
+  // Escapes within and after the vectorized chunks.
+  std::string long_input = std::string(40, 'a') + "/" + std::string(20, 'b') +
+                           "\"" + std::string(3, 'c');
+  output.clear();
+  escapeJSONString(long_input.data(), long_input.size(), output);
+  tree.put("key", long_input);
+  EXPECT_EQ(writeJSON(tree), "{\"key\":\"" + output + "\"}\n");
+}
+
+TEST_F(JSONTests, test_writer) {
+  std::string output;
+  JSONWriter writer(output);
+  writer.startObject();
+  writer.key("a");
+  writer.value("1");
+  writer.key("b");
+  writer.startArray();
+  writer.value("2");
+  writer.startObject();
+  writer.endObject();
+  writer.endArray();
+  writer.key("c");
+  writer.value("");
+  writer.key("d");
+  writer.startArray();
+  writer.raw("{\"e\":1}", 7);
+  writer.raw("true", 4);
+  writer.endArray();
+  writer.endObject();
+  writer.endDocument();
+  EXPECT_EQ(output,
+            "{\"a\":\"1\",\"b\":[\"2\",{}],\"c\":\"\",\"d\":[{\"e\":1},true]}\n");
+}
+
+TEST_F(JSONTests, test_write_ptree) {
+  pt::ptree row;
+  row.put<std::string>("name", "osqueryd");
+  row.put<std::string>("path", "/usr/local/bin/osqueryd");
+  pt::ptree rows;
+  rows.push_back(std::make_pair("", row));
+  rows.push_back(std::make_pair("", row));
+
+  pt::ptree tree;
+  tree.add_child("added", rows);
+  tree.add_child("removed", pt::ptree());
+  tree.put<std::string>("name", "processes");
+  tree.put<int>("unixTime", 1408993857);
+
+  std::string output;
+  writePtreeJSON(tree, output);
+  EXPECT_EQ(output, writeJSON(tree));
+
+  // A top-level list is written as an object with empty keys.
+  output.clear();
+  writePtreeJSON(rows, output);
+  EXPECT_EQ(output, writeJSON(rows));
+}
+
+TEST_F(JSONTests, test_read_ptree) {
+  std::string input =
+      "{\"a\": \"1\", \"b\": [\"2\", {\"c\": 3}], \"d\": {}, "
+      "\"e\": true, \"f\": null, \"g\": \"\\u00e9\\/\"}";
+
+  pt::ptree tree;
+  auto s = readPtreeJSON(input, tree);
+  EXPECT_TRUE(s.ok());
+
+  pt::ptree expected;
+  std::stringstream stream(input);
+  pt::read_json(stream, expected);
+  EXPECT_EQ(tree, expected);
+  EXPECT_EQ(tree.get<std::string>("g"), "\xC3\xA9/");
+}
+
+TEST_F(JSONTests, test_read_invalid) {
+  pt::ptree tree;
+  EXPECT_FALSE(readPtreeJSON("", tree).ok());
+  EXPECT_FALSE(readPtreeJSON("{\"a\":}", tree).ok());
+  EXPECT_FALSE(readPtreeJSON("{\"a\":\"1\"", tree).ok());
+  EXPECT_FALSE(readPtreeJSON("[\"a\"] x", tree).ok());
+  EXPECT_FALSE(readPtreeJSON("{\"a\":\"\\q\"}", tree).ok());
+  EXPECT_FALSE(readPtreeJSON(std::string(1024, '['), tree).ok());
+}
+
+TEST_F(JSONTests, test_round_trip) {
+  pt::ptree tree;
+  tree.put<std::string>("a", "line\nbreak \"quoted\"");
+  tree.put<std::string>("b.c", "nested");
+
+  std::string output;
+  writePtreeJSON(tree, output);
+
+  pt::ptree result;
+  EXPECT_TRUE(readPtreeJSON(output, result).ok());
+  EXPECT_EQ(result, tree);
+}
+}
@@ -0,0 +1,107 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/metrics.h"
+
+namespace osquery {
+
+class MetricsTests : public testing::Test {};
+
+/// Find a metric's aggregated value by name.
+static MetricValue getMetric(const std::string& name) {
+  for (const auto& value : getMetrics()) {
+    if (value.name == name) {
+      return value;
+    }
+  }
+  return MetricValue();
+}
+
+TEST_F(MetricsTests, test_buckets) {
+  for (uint64_t value = 0; value < 8; ++value) {
+    EXPECT_EQ(getMetricBucket(value), value);
+  }
+
+  // Each bucket's lower bound maps back to the bucket.
+  for (size_t bucket = 0; bucket < kMetricHistogramBuckets; ++bucket) {
+    auto lower = getMetricBucketValue(bucket);
+    EXPECT_EQ(getMetricBucket(lower), bucket);
+    EXPECT_LE(lower, getMetricBucketValue(bucket + 1) - 1);
+  }
+
+  // Values are within 12.5% of their bucket's lower bound.
+  for (uint64_t value = 8; value < 100000; value += 7) {
+    auto lower = getMetricBucketValue(getMetricBucket(value));
+    EXPECT_LE(lower, value);
+    EXPECT_LT(value - lower, value / 8 + 1);
+  }
+  EXPECT_EQ(getMetricBucket(UINT64_MAX), kMetricHistogramBuckets - 1);
+}
+
+TEST_F(MetricsTests, test_counter) {
+  static MetricCounter counter("test.counter");
+  counter.add();
+  counter.add(2);
+
+  // Updates from exited threads are kept.
+  std::thread thread([]() { counter.add(4); });
+  thread.join();
+
+  auto value = getMetric("test.counter");
+  EXPECT_EQ(value.type, METRIC_COUNTER);
+  EXPECT_EQ(value.value, 7);
+
+  // Metrics with the same name share values.
+  MetricCounter same("test.counter");
+  same.add();
+  EXPECT_EQ(getMetric("test.counter").value, 8);
+}
+
+TEST_F(MetricsTests, test_gauge) {
+  static MetricGauge gauge("test.gauge");
+  gauge.set(10);
+  gauge.set(3);
+  EXPECT_EQ(getMetric("test.gauge").value, 3);
+}
+
+TEST_F(MetricsTests, test_histogram) {
+  static MetricHistogram histogram("test.histogram");
+  std::thread thread([]() {
+    for (uint64_t value = 1; value <= 50; ++value) {
+      histogram.record(value);
+    }
+  });
+  for (uint64_t value = 51; value <= 100; ++value) {
+    histogram.record(value);
+  }
+  thread.join();
+
+  auto value = getMetric("test.histogram");
+  EXPECT_EQ(value.type, METRIC_HISTOGRAM);
+  EXPECT_EQ(value.count, 100U);
+  EXPECT_EQ(value.sum, 5050U);
+  EXPECT_EQ(value.min, 1U);
+  EXPECT_EQ(value.max, 100U);
+  // Percentiles are the lower bound of their bucket.
+  EXPECT_LE(value.p50, 51U);
+  EXPECT_GE(value.p50, 51U - 51U / 8);
+  EXPECT_LE(value.p99, 100U);
+  EXPECT_GE(value.p99, 100U - 100U / 8);
+
+  // A name cannot be reused for another type.
+  MetricCounter counter("test.histogram");
+  counter.add();
+  EXPECT_EQ(getMetric("test.histogram").value, 0);
+}
+}
@@ -0,0 +1,41 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/priority.h"
+
+namespace osquery {
+
+class PriorityTests : public testing::Test {};
+
+TEST_F(PriorityTests, test_background_priority) {
+  {
+    ScopedBackgroundPriority priority(false);
+    EXPECT_FALSE(priority.active());
+  }
+
+#if defined(__linux__)
+  auto policy = sched_getscheduler(0);
+  {
+    ScopedBackgroundPriority priority(true);
+    if (priority.active()) {
+      EXPECT_EQ(sched_getscheduler(0), SCHED_IDLE);
+    }
+  }
+  // The thread's policy is restored.
+  EXPECT_EQ(sched_getscheduler(0), policy);
+#endif
+}
+}
@@ -0,0 +1,156 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/core/profiler.h"
+
+namespace osquery {
+
+DECLARE_bool(enable_perf_counters);
+
+class ProfilerTests : public testing::Test {};
+
+TEST_F(ProfilerTests, test_phases) {
+  QueryProfile profile;
+  {
+    ScopedQueryProfile profiler(profile);
+    {
+      ProfilePhase phase(&QueryProfile::plan_time);
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    {
+      ProfilePhase phase(&QueryProfile::generate_time, "processes");
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    {
+      ProfilePhase phase(&QueryProfile::generate_time, "users");
+    }
+  }
+
+  EXPECT_GE(profile.plan_time, 2000U);
+  EXPECT_GE(profile.generate_time, 2000U);
+  EXPECT_EQ(profile.table_times.size(), 2U);
+  EXPECT_GE(profile.table_times["processes"], 2000U);
+  EXPECT_EQ(profile.generate_time,
+            profile.table_times["processes"] + profile.table_times["users"]);
+  EXPECT_GE(profile.wall_time, profile.plan_time + profile.generate_time);
+  EXPECT_EQ(profile.diff_time, 0U);
+}
+
+TEST_F(ProfilerTests, test_inactive) {
+  QueryProfile profile;
+  {
+    ScopedQueryProfile profiler(profile);
+  }
+
+  // Phases outside of a profile, or on another thread, are not recorded.
+  {
+    ProfilePhase phase(&QueryProfile::plan_time);
+  }
+  {
+    ScopedQueryProfile profiler(profile);
+    std::thread([]() {
+      ProfilePhase phase(&QueryProfile::diff_time);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }).join();
+  }
+  EXPECT_EQ(profile.plan_time, 0U);
+  EXPECT_EQ(profile.diff_time, 0U);
+}
+
+TEST_F(ProfilerTests, test_cpu_time) {
+  QueryProfile profile;
+  {
+    ScopedQueryProfile profiler(profile);
+    // Spin for CPU time measurable in microseconds.
+    auto start = std::chrono::steady_clock::now();
+    volatile size_t count = 0;
+    while (std::chrono::steady_clock::now() - start <
+           std::chrono::milliseconds(20)) {
+      count = count + 1;
+    }
+  }
+  EXPECT_GT(profile.user_time + profile.system_time, 0U);
+  EXPECT_GE(profile.wall_time, 20000U);
+}
+
+/// Keep an allocation from being optimized away.
+static volatile char* kSink = nullptr;
+
+TEST_F(ProfilerTests, test_allocations) {
+  QueryProfile profile;
+  {
+    ScopedQueryProfile profiler(profile);
+    {
+      ProfilePhase phase(&QueryProfile::generate_time, "processes");
+      std::vector<char> rows(4096);
+      std::vector<char> more_rows(4096);
+      kSink = rows.data();
+      kSink = more_rows.data();
+    }
+    {
+      ProfilePhase phase(&QueryProfile::serialize_time);
+      std::vector<char> buffer(1024);
+      kSink = buffer.data();
+    }
+  }
+
+  // Both generate buffers were live at once, the serialize buffer was not.
+  EXPECT_GE(profile.generate_allocated, 8192U);
+  EXPECT_GE(profile.serialize_allocated, 1024U);
+  EXPECT_EQ(profile.diff_allocated, 0U);
+  EXPECT_GE(profile.allocated,
+            profile.generate_allocated + profile.serialize_allocated);
+  EXPECT_GE(profile.peak_allocated, 8192U);
+  EXPECT_LT(profile.peak_allocated, profile.allocated);
+
+  // Allocations on other threads are not counted.
+  QueryProfile other;
+  {
+    ScopedQueryProfile profiler(other);
+    std::thread([]() {
+      std::vector<char> rows(4096);
+      kSink = rows.data();
+    }).join();
+  }
+  EXPECT_LT(other.allocated, 4096U);
+}
+
+TEST_F(ProfilerTests, test_perf_counters) {
+  PerfCounters counters;
+  {
+    ScopedPerfCounters perf(counters);
+    EXPECT_FALSE(perf.counting());
+  }
+  EXPECT_EQ(0U, counters.page_faults);
+
+  FLAGS_enable_perf_counters = true;
+  {
+    ScopedPerfCounters perf(counters);
+    std::vector<char> pages(1 << 22, 1);
+    kSink = pages.data();
+    if (!perf.counting()) {
+      // The kernel may not allow perf events for unprivileged users.
+      FLAGS_enable_perf_counters = false;
+      return;
+    }
+  }
+  FLAGS_enable_perf_counters = false;
+
+  // Touching freshly mapped pages faults at least once.
+  EXPECT_GT(counters.page_faults, 0U);
+}
+}
@@ -39,4 +39,16 @@ TEST_F(StatusTests, test_to_string) {
   auto s = Status(0, "foobar");
   EXPECT_EQ(s.toString(), "foobar");
 }
+
+TEST_F(StatusTests, test_ok_message) {
+  // Success statuses compare equal however their "OK" was constructed.
+  std::string ok = "OK";
+  EXPECT_EQ(Status(), Status(0, "OK"));
+  EXPECT_EQ(Status(), Status(0, ok));
+  EXPECT_EQ(Status(0, ok).getMessage(), "OK");
+  EXPECT_NE(Status(), Status(0, "foobar"));
+  EXPECT_NE(Status(), Status(1, "OK"));
+  EXPECT_EQ(Status(1, "OK").getMessage(), "OK");
+  EXPECT_EQ(Status(1, "").getMessage(), "");
+}
 }
@@ -130,4 +130,118 @@ TEST_F(TablesTests, test_constraint_map) {
   EXPECT_TRUE(cm["path"].exists());
   EXPECT_TRUE(cm["path"].existsAndMatches("some"));
 }
+
+TEST_F(TablesTests, test_constraint_operators) {
+  ConstraintList cl;
+  cl.add(Constraint(NOT_EQUALS, "some"));
+  EXPECT_TRUE(cl.comparable());
+  EXPECT_TRUE(cl.matches("not_some"));
+  EXPECT_FALSE(cl.matches("some"));
+
+  // Pattern operators are not evaluated by the list.
+  cl.add(Constraint(LIKE, "%other%"));
+  EXPECT_FALSE(cl.comparable());
+  EXPECT_TRUE(cl.matches("not_some"));
+}
+
+TEST_F(TablesTests, test_constraint_compile) {
+  ConstraintList cl;
+  cl.affinity = "BIGINT";
+  cl.add(Constraint(GREATER_THAN, "1"));
+  cl.add(Constraint(GREATER_THAN_OR_EQUALS, "5"));
+  cl.add(Constraint(LESS_THAN, "100"));
+  cl.add(Constraint(NOT_EQUALS, "50"));
+  cl.add(Constraint(NOT_EQUALS, "7"));
+  cl.add(Constraint(LIKE, "%"));
+  cl.compile();
+
+  // Compiled predicates match the same values as each constraint.
+  for (long long value = -10; value < 110; ++value) {
+    bool expected =
+        (value > 1 && value >= 5 && value < 100 && value != 50 && value != 7);
+    EXPECT_EQ(expected, cl.matches(value));
+    EXPECT_EQ(expected, cl.matches(std::to_string(value)));
+  }
+  EXPECT_TRUE(cl.matches((unsigned int)5));
+  EXPECT_FALSE(cl.matches((size_t)50));
+  // An expression that does not cast does not match.
+  EXPECT_FALSE(cl.matches("not_a_number"));
+
+  // Adding a constraint discards the compiled predicate.
+  cl.add(Constraint(EQUALS, "6"));
+  EXPECT_TRUE(cl.matches(6));
+  EXPECT_FALSE(cl.matches(8));
+  cl.compile();
+  EXPECT_TRUE(cl.matches(6));
+  EXPECT_FALSE(cl.matches(8));
+
+  // Conflicting equalities, or an uncastable expression, match nothing.
+  cl.add(Constraint(EQUALS, "8"));
+  cl.compile();
+  EXPECT_FALSE(cl.matches(6));
+  EXPECT_FALSE(cl.matches(8));
+
+  ConstraintList invalid;
+  invalid.affinity = "INTEGER";
+  invalid.add(Constraint(EQUALS, "not_a_number"));
+  invalid.compile();
+  EXPECT_FALSE(invalid.matches(1));
+
+  ConstraintList text;
+  text.add(Constraint(GREATER_THAN, "b"));
+  text.add(Constraint(NOT_EQUALS, "c"));
+  text.compile();
+  EXPECT_TRUE(text.matches("bb"));
+  EXPECT_FALSE(text.matches("c"));
+  EXPECT_FALSE(text.matches("a"));
+  // Integers are compared as TEXT for TEXT columns.
+  EXPECT_FALSE(text.matches(10));
+
+  EXPECT_EQ(AFFINITY_UNSIGNED_BIGINT, columnAffinity("UNSIGNED_BIGINT"));
+  EXPECT_EQ(AFFINITY_UNKNOWN, columnAffinity("DOUBLE"));
+}
+
+TEST_F(TablesTests, test_typed_row) {
+  TypedRow r;
+  r["pid"] = 10;
+  r["size"] = (unsigned long long)-1;
+  r["ratio"] = 0.25;
+  r["name"] = "osqueryd";
+  EXPECT_EQ(RowValue::INTEGER_VALUE, r["pid"].type());
+  // Unsigned values beyond a BIGINT are kept as TEXT.
+  EXPECT_EQ(RowValue::TEXT_VALUE, r["size"].type());
+  EXPECT_EQ(RowValue::DOUBLE_VALUE, r["ratio"].type());
+
+  QueryContext context;
+  context.constraints["pid"].affinity = "INTEGER";
+  context.constraints["pid"].add(Constraint(GREATER_THAN, "9"));
+  context.compile();
+  EXPECT_TRUE(context.matchesTyped(r));
+  r["pid"] = 9;
+  EXPECT_FALSE(context.matchesTyped(r));
+
+  auto row = toRow(r);
+  EXPECT_EQ(row["pid"], "9");
+  EXPECT_EQ(row["size"], "18446744073709551615");
+  EXPECT_EQ(row["ratio"], "0.25");
+  EXPECT_EQ(row["name"], "osqueryd");
+}
+
+TEST_F(TablesTests, test_query_context_matches) {
+  QueryContext context;
+  context.constraints["pid"].affinity = "INTEGER";
+  context.constraints["pid"].add(Constraint(GREATER_THAN, "10"));
+  context.constraints["name"];
+
+  EXPECT_TRUE(context.matches({{"pid", "11"}, {"name", "osqueryd"}}));
+  EXPECT_FALSE(context.matches({{"pid", "10"}, {"name", "osqueryd"}}));
+  // A missing or uncastable constrained column does not match.
+  EXPECT_FALSE(context.matches({{"name", "osqueryd"}}));
+  EXPECT_FALSE(context.matches({{"pid", "not_a_pid"}}));
+
+  EXPECT_FALSE(context.limitReached(100));
+  context.limit = 2;
+  EXPECT_FALSE(context.limitReached(1));
+  EXPECT_TRUE(context.limitReached(2));
+}
 }
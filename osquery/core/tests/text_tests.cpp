@@ -38,5 +38,36 @@ TEST_F(TextTests, test_split_occurences) {
       "T", "'S:S'",
   };
   EXPECT_EQ(split(content, ":", 1), expected);
+
+  // The remaining content is not split and joined.
+  content = "a: b::c :";
+  expected = {"a", "b::c"};
+  EXPECT_EQ(split(content, ":", 1), expected);
+}
+
+TEST_F(TextTests, test_tokenizer) {
+  std::string content = "  one\ttwo  ,, three ";
+  Tokenizer fields(content, "\t ,");
+  std::vector<std::string> expected = {"one", "two", "three"};
+  for (const auto& field : expected) {
+    ASSERT_TRUE(fields.next());
+    EXPECT_TRUE(fields.equals(field.c_str()));
+    EXPECT_EQ(fields.str(), field);
+  }
+  EXPECT_FALSE(fields.next());
+  EXPECT_EQ(fields.size(), 0U);
+
+  // Fields are trimmed of whitespace that is not a delimiter.
+  Tokenizer lines(content, ",");
+  ASSERT_TRUE(lines.next());
+  EXPECT_EQ(lines.str(), "one\ttwo");
+  ASSERT_TRUE(lines.next());
+  EXPECT_EQ(lines.str(), "three");
+
+  Tokenizer tail(content, " ");
+  EXPECT_TRUE(tail.skip(1));
+  EXPECT_EQ(tail.str(), "one\ttwo");
+  EXPECT_EQ(tail.rest(), ",, three");
+  EXPECT_FALSE(tail.skip(4));
 }
 }
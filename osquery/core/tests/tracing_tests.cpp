@@ -0,0 +1,117 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <boost/property_tree/json_parser.hpp>
+
+#include <gtest/gtest.h>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+
+#include "osquery/core/test_util.h"
+#include "osquery/core/tracing.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+DECLARE_uint64(trace_sample);
+
+class TracingTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    clearTraceEvents();
+    setTracing(true);
+  }
+
+  void TearDown() override {
+    setTracing(false);
+    FLAGS_trace_sample = 1;
+  }
+};
+
+TEST_F(TracingTests, test_spans) {
+  {
+    TraceSpan outer("scheduler", "launchQuery", "pack_query");
+    TraceSpan inner("sql", "xFilter", "processes");
+  }
+  std::thread([]() { TraceSpan span("logger", "send"); }).join();
+
+  setTracing(false);
+  { TraceSpan span("database", "write"); }
+
+  auto events = getTraceEvents();
+  ASSERT_EQ(3U, events.size());
+  EXPECT_STREQ("launchQuery", events[0].name);
+  EXPECT_STREQ("pack_query", events[0].detail);
+  EXPECT_STREQ("xFilter", events[1].name);
+  EXPECT_STREQ("sql", events[1].category);
+  EXPECT_STREQ("send", events[2].name);
+  EXPECT_EQ(nullptr, events[2].detail);
+
+  // The outer span contains the inner span, the other thread's is separate.
+  EXPECT_LE(events[0].begin, events[1].begin);
+  EXPECT_GE(events[0].begin + events[0].duration,
+            events[1].begin + events[1].duration);
+  EXPECT_EQ(events[0].thread, events[1].thread);
+  EXPECT_NE(events[0].thread, events[2].thread);
+}
+
+TEST_F(TracingTests, test_sampling) {
+  FLAGS_trace_sample = 4;
+  for (size_t i = 0; i < 8; ++i) {
+    TraceSpan root("scheduler", "tick");
+    TraceSpan child("database", "put");
+  }
+
+  // Each sampled root is recorded with its child.
+  auto events = getTraceEvents();
+  ASSERT_EQ(4U, events.size());
+  EXPECT_STREQ("tick", events[0].name);
+  EXPECT_STREQ("put", events[1].name);
+}
+
+TEST_F(TracingTests, test_ring_buffer) {
+  for (size_t i = 0; i < kTraceBufferSpans + 10; ++i) {
+    TraceSpan span("events", "dispatch");
+  }
+  EXPECT_EQ(kTraceBufferSpans, getTraceEvents().size());
+
+  clearTraceEvents();
+  EXPECT_TRUE(getTraceEvents().empty());
+}
+
+TEST_F(TracingTests, test_dump) {
+  {
+    TraceSpan span("sql", "xFilter", "quote\"table");
+  }
+
+  auto path = kTestWorkingDirectory + "osquery.trace";
+  ASSERT_TRUE(dumpTrace(path).ok());
+
+  std::string content;
+  ASSERT_TRUE(readFile(path, content).ok());
+  pt::ptree tree;
+  std::stringstream stream(content);
+  pt::read_json(stream, tree);
+
+  auto& events = tree.get_child("traceEvents");
+  ASSERT_EQ(1U, events.size());
+  auto& event = events.front().second;
+  EXPECT_EQ("xFilter", event.get<std::string>("name"));
+  EXPECT_EQ("X", event.get<std::string>("ph"));
+  EXPECT_EQ("quote\"table", event.get<std::string>("args.detail"));
+  EXPECT_GE(event.get<double>("dur"), 0.0);
+}
+}
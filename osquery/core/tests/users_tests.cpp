@@ -0,0 +1,51 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/users.h"
+
+namespace osquery {
+
+class UsersTests : public testing::Test {};
+
+TEST_F(UsersTests, test_get_user) {
+  UserInfo user;
+  EXPECT_TRUE(getUser(0, user));
+  EXPECT_EQ(user.uid, 0U);
+  EXPECT_FALSE(user.name.empty());
+
+  // The same entry is found by name, and again from the cache.
+  UserInfo named;
+  EXPECT_TRUE(getUserByName(user.name, named));
+  EXPECT_EQ(named.uid, 0U);
+  EXPECT_EQ(named.directory, user.directory);
+  EXPECT_TRUE(getUser(0, named));
+  EXPECT_EQ(named.name, user.name);
+
+  // Unknown users are not found, before and after an invalidation.
+  EXPECT_FALSE(getUserByName("osquery-unknown-user", named));
+  invalidateUserCache();
+  EXPECT_FALSE(getUserByName("osquery-unknown-user", named));
+  EXPECT_TRUE(getUser(0, named));
+}
+
+TEST_F(UsersTests, test_get_group) {
+  GroupInfo group;
+  EXPECT_TRUE(getGroup(0, group));
+  EXPECT_EQ(group.gid, 0U);
+  EXPECT_FALSE(group.name.empty());
+
+  GroupInfo named;
+  EXPECT_TRUE(getGroupByName(group.name, named));
+  EXPECT_EQ(named.gid, 0U);
+  EXPECT_FALSE(getGroupByName("osquery-unknown-group", named));
+}
+}
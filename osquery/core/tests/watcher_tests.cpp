@@ -0,0 +1,97 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <cstring>
+#include <memory>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/watcher.h"
+
+namespace osquery {
+
+class WatcherTests : public testing::Test {};
+
+TEST_F(WatcherTests, test_process_usage) {
+  ProcessUsage usage;
+  ASSERT_TRUE(getProcessUsage(getpid(), usage).ok());
+  EXPECT_EQ(usage.parent, getppid());
+
+  // Writing to an allocation adds to the private dirty footprint.
+  size_t size = 16 * 1024 * 1024;
+  std::unique_ptr<char[]> buffer(new char[size]);
+  memset(buffer.get(), 1, size);
+
+  ProcessUsage after;
+  ASSERT_TRUE(getProcessUsage(getpid(), after).ok());
+  EXPECT_GE(after.footprint, usage.footprint + size / 2);
+  EXPECT_GE(after.user_time + after.system_time,
+            usage.user_time + usage.system_time);
+  EXPECT_EQ(buffer[size - 1], 1);
+}
+
+TEST_F(WatcherTests, test_process_usage_missing) {
+  ProcessUsage usage;
+  // Pids are never this large.
+  EXPECT_FALSE(getProcessUsage(0x7FFFFFFF, usage).ok());
+}
+
+TEST_F(WatcherTests, test_worker_classes) {
+  auto classes = FLAGS_worker_classes;
+  FLAGS_worker_classes = "heavy:0,light,bad/name,invalid:level";
+  auto workers = getWorkerClasses();
+  ASSERT_EQ(2U, workers.size());
+  EXPECT_EQ("heavy", workers[0].name);
+  EXPECT_EQ(0, workers[0].level);
+  EXPECT_EQ("light", workers[1].name);
+  EXPECT_EQ(-1, workers[1].level);
+  EXPECT_EQ(0, getWorkerLevel("heavy"));
+  EXPECT_EQ(-1, getWorkerLevel("missing"));
+
+  // Without a watchdog every query executes in the one process.
+  unsetenv("OSQUERY_WORKER");
+  unsetenv("OSQUERY_WORKER_CLASS");
+  EXPECT_TRUE(isWorkerClassMember("heavy"));
+
+  // The default worker executes queries without a known class.
+  setenv("OSQUERY_WORKER", "1", 1);
+  EXPECT_TRUE(isWorkerClassMember(""));
+  EXPECT_TRUE(isWorkerClassMember("missing"));
+  EXPECT_FALSE(isWorkerClassMember("heavy"));
+
+  // A class worker executes only its class.
+  setenv("OSQUERY_WORKER_CLASS", "heavy", 1);
+  EXPECT_EQ("heavy", getWorkerClass());
+  EXPECT_TRUE(isWorkerClassMember("heavy"));
+  EXPECT_FALSE(isWorkerClassMember("light"));
+  EXPECT_FALSE(isWorkerClassMember(""));
+  EXPECT_FALSE(isWorkerClassMember("missing"));
+
+  unsetenv("OSQUERY_WORKER_CLASS");
+  unsetenv("OSQUERY_WORKER");
+  FLAGS_worker_classes = classes;
+}
+
+TEST_F(WatcherTests, test_standby_handoff) {
+  // Processes that are not a standby do not wait.
+  unsetenv("OSQUERY_WORKER_STANDBY");
+  waitStandbyHandoff();
+
+  // A standby continues once the watcher writes to its handoff pipe.
+  int handoff[2];
+  ASSERT_EQ(0, ::pipe(handoff));
+  setenv("OSQUERY_WORKER_STANDBY", std::to_string(handoff[0]).c_str(), 1);
+  char byte = 1;
+  ASSERT_EQ(1, ::write(handoff[1], &byte, 1));
+  waitStandbyHandoff();
+  EXPECT_EQ(nullptr, getenv("OSQUERY_WORKER_STANDBY"));
+  ::close(handoff[1]);
+}
+}
@@ -10,22 +10,97 @@
 
 #include <vector>
 
+#include <ctype.h>
+#include <string.h>
+
 #include <osquery/core.h>
 
 #include <boost/algorithm/string/join.hpp>
-#include <boost/algorithm/string/split.hpp>
-#include <boost/algorithm/string/trim.hpp>
 
 namespace osquery {
 
+Tokenizer::Tokenizer(const char* data, size_t size, const std::string& delim)
+    : position_(data),
+      end_(data + size),
+      field_(data),
+      size_(0),
+      single_((delim.size() == 1) ? (unsigned char)delim[0] : -1) {
+  memset(delimiters_, 0, sizeof(delimiters_));
+  for (const auto& c : delim) {
+    delimiters_[(unsigned char)c] = true;
+  }
+}
+
+const char* Tokenizer::find(const char* position) const {
+  if (single_ >= 0) {
+    auto found = memchr(position, single_, end_ - position);
+    return (found != nullptr) ? static_cast<const char*>(found) : end_;
+  }
+
+  while (position < end_ && !delimiters_[(unsigned char)*position]) {
+    position++;
+  }
+  return position;
+}
+
+bool Tokenizer::next() {
+  while (position_ < end_) {
+    const char* start = position_;
+    const char* stop = find(start);
+    position_ = (stop < end_) ? stop + 1 : end_;
+    if (stop == start) {
+      // Adjacent delimiters do not produce empty fields.
+      continue;
+    }
+
+    while (start < stop && isspace((unsigned char)*start)) {
+      start++;
+    }
+    while (stop > start && isspace((unsigned char)*(stop - 1))) {
+      stop--;
+    }
+    field_ = start;
+    size_ = stop - start;
+    return true;
+  }
+
+  field_ = end_;
+  size_ = 0;
+  return false;
+}
+
+bool Tokenizer::skip(size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    if (!next()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Tokenizer::equals(const char* s) const {
+  return strlen(s) == size_ && memcmp(field_, s, size_) == 0;
+}
+
+std::string Tokenizer::rest() const {
+  const char* start = position_;
+  const char* stop = end_;
+  while (start < stop && (delimiters_[(unsigned char)*start] ||
+                          isspace((unsigned char)*start))) {
+    start++;
+  }
+  while (stop > start && (delimiters_[(unsigned char)*(stop - 1)] ||
+                          isspace((unsigned char)*(stop - 1)))) {
+    stop--;
+  }
+  return std::string(start, stop - start);
+}
+
 std::vector<std::string> split(const std::string& s, const std::string& delim) {
   std::vector<std::string> elems;
-  boost::split(elems, s, boost::is_any_of(delim));
-  auto start = std::remove_if(
-      elems.begin(), elems.end(), [](const std::string& s) { return s == ""; });
-  elems.erase(start, elems.end());
-  for (auto& each : elems) {
-    boost::algorithm::trim(each);
+  Tokenizer fields(s, delim);
+  while (fields.next()) {
+    elems.push_back(fields.str());
   }
   return elems;
 }
@@ -33,21 +108,16 @@ std::vector<std::string> split(const std::string& s, const std::string& delim) {
 std::vector<std::string> split(const std::string& s,
                                const std::string& delim,
                                size_t occurences) {
-  // Split the string normally with the required delimiter.
-  auto content = split(s, delim);
-  // While the result split exceeds the number of requested occurences, join.
-  std::vector<std::string> accumulator;
   std::vector<std::string> elems;
-  for (size_t i = 0; i < content.size(); i++) {
-    if (i < occurences) {
-      elems.push_back(content.at(i));
-    } else {
-      accumulator.push_back(content.at(i));
-    }
+  Tokenizer fields(s, delim);
+  while (elems.size() < occurences && fields.next()) {
+    elems.push_back(fields.str());
   }
-  // Join the optional accumulator.
-  if (accumulator.size() > 0) {
-    elems.push_back(join(accumulator, delim));
+
+  // The remaining content is kept as it is, not split and joined again.
+  auto rest = fields.rest();
+  if (!rest.empty()) {
+    elems.push_back(std::move(rest));
   }
   return elems;
 }
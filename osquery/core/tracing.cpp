@@ -0,0 +1,392 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/json.h"
+#include "osquery/core/tracing.h"
+
+namespace osquery {
+
+FLAG(string,
+     trace_file,
+     "",
+     "Write spans of the scheduler, SQL, database, logger, and event "
+     "publishers to this path as Chrome trace JSON");
+
+FLAG(uint64,
+     trace_sample,
+     1,
+     "Trace one of every N top-level spans on each thread");
+
+const size_t kTraceBufferSpans = 4096;
+
+/// The buffers of exited threads kept for the next dump.
+const size_t kTraceRetiredThreads = 32;
+
+/// The maximum number of distinct span details, later details are dropped.
+const size_t kTraceNamesMax = 4096;
+
+std::atomic<bool> kTracing{false};
+
+/// Set by the SIGPROF handler, the next dumpRequestedTrace writes the trace.
+static std::atomic<bool> kTraceDumpRequested{false};
+
+/// A span in a thread's buffer, its fields are read while being rewritten.
+struct TraceSlot {
+  std::atomic<const char*> category;
+  std::atomic<const char*> name;
+  std::atomic<const char*> detail;
+  std::atomic<uint64_t> begin;
+  std::atomic<uint64_t> duration;
+};
+
+/// A thread's ring of completed spans and its sampling state.
+struct TraceThread : private boost::noncopyable {
+  TraceThread() : slots(new TraceSlot[kTraceBufferSpans]) {
+#ifdef __linux__
+    id = static_cast<uint64_t>(::syscall(SYS_gettid));
+#else
+    id = std::hash<std::thread::id>()(std::this_thread::get_id());
+#endif
+  }
+
+  uint64_t id{0};
+  std::unique_ptr<TraceSlot[]> slots;
+
+  /// The spans started being written, and the spans completely written.
+  std::atomic<uint64_t> started{0};
+  std::atomic<uint64_t> written{0};
+
+  /// The first span not cleared.
+  std::atomic<uint64_t> first{0};
+
+  /// The owning thread's open spans, and whether the outermost is sampled.
+  size_t depth{0};
+  uint64_t roots{0};
+  bool sampled{false};
+
+  /// The thread exited, guarded by the registry's lock.
+  bool exited{false};
+};
+
+class TraceRegistry : private boost::noncopyable {
+ public:
+  static TraceRegistry& instance() {
+    static TraceRegistry registry;
+    return registry;
+  }
+
+  /// Start dumping a thread's buffer.
+  void attach(const std::shared_ptr<TraceThread>& thread);
+
+  /// Keep an exiting thread's buffer until it is one of too many.
+  void detach(const std::shared_ptr<TraceThread>& thread);
+
+  /// Copy a detail into the name table, its pointer is never freed.
+  const char* intern(const std::string& detail);
+
+  std::vector<TraceEvent> events();
+
+  void clear();
+
+ private:
+  TraceRegistry() {}
+
+ private:
+  std::mutex mutex_;
+
+  /// Every live thread that traced, and retired threads by exit order.
+  std::list<std::shared_ptr<TraceThread>> threads_;
+  size_t retired_{0};
+
+  /// Interned details, set nodes do not move.
+  std::mutex names_mutex_;
+  std::set<std::string> names_;
+};
+
+/// Attach a thread's buffer on its first span while tracing.
+class TraceThreadHolder : private boost::noncopyable {
+ public:
+  TraceThreadHolder()
+      : registry_(TraceRegistry::instance()),
+        thread_(std::make_shared<TraceThread>()) {
+    registry_.attach(thread_);
+  }
+
+  ~TraceThreadHolder() { registry_.detach(thread_); }
+
+  TraceThread& thread() { return *thread_; }
+
+ private:
+  TraceRegistry& registry_;
+  std::shared_ptr<TraceThread> thread_;
+};
+
+static TraceThread& traceThread() {
+  static thread_local TraceThreadHolder holder;
+  return holder.thread();
+}
+
+/// Nanoseconds since the first traced span.
+static uint64_t traceNow() {
+  static const auto epoch = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - epoch)
+      .count();
+}
+
+void TraceRegistry::attach(const std::shared_ptr<TraceThread>& thread) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  threads_.push_back(thread);
+}
+
+void TraceRegistry::detach(const std::shared_ptr<TraceThread>& thread) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  thread->exited = true;
+  threads_.remove(thread);
+  threads_.push_back(thread);
+  if (++retired_ <= kTraceRetiredThreads) {
+    return;
+  }
+
+  for (auto it = threads_.begin(); it != threads_.end(); ++it) {
+    if ((*it)->exited) {
+      threads_.erase(it);
+      retired_--;
+      break;
+    }
+  }
+}
+
+const char* TraceRegistry::intern(const std::string& detail) {
+  std::lock_guard<std::mutex> lock(names_mutex_);
+  auto name = names_.find(detail);
+  if (name == names_.end()) {
+    if (names_.size() >= kTraceNamesMax) {
+      return nullptr;
+    }
+    name = names_.insert(detail).first;
+  }
+  return name->c_str();
+}
+
+std::vector<TraceEvent> TraceRegistry::events() {
+  std::vector<TraceEvent> events;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& thread : threads_) {
+    auto written = thread->written.load(std::memory_order_acquire);
+    auto first = thread->first.load(std::memory_order_relaxed);
+    if (written > kTraceBufferSpans) {
+      first = std::max(first, written - kTraceBufferSpans);
+    }
+
+    size_t copied = events.size();
+    for (auto i = first; i < written; ++i) {
+      const auto& slot = thread->slots[i % kTraceBufferSpans];
+      TraceEvent event;
+      event.category = slot.category.load(std::memory_order_relaxed);
+      event.name = slot.name.load(std::memory_order_relaxed);
+      event.detail = slot.detail.load(std::memory_order_relaxed);
+      event.thread = thread->id;
+      event.begin = slot.begin.load(std::memory_order_relaxed);
+      event.duration = slot.duration.load(std::memory_order_relaxed);
+      events.push_back(event);
+    }
+
+    // Spans the thread started rewriting during the copy are dropped.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    auto started = thread->started.load(std::memory_order_relaxed);
+    if (started > kTraceBufferSpans && started - kTraceBufferSpans > first) {
+      auto overwritten = std::min<uint64_t>(
+          started - kTraceBufferSpans - first, events.size() - copied);
+      events.erase(events.begin() + copied,
+                   events.begin() + copied + overwritten);
+    }
+  }
+
+  std::stable_sort(events.begin(),
+                   events.end(),
+                   [](const TraceEvent& a, const TraceEvent& b) {
+                     return a.begin < b.begin;
+                   });
+  return events;
+}
+
+void TraceRegistry::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& thread : threads_) {
+    thread->first.store(thread->written.load(std::memory_order_acquire),
+                        std::memory_order_relaxed);
+  }
+}
+
+void TraceSpan::begin(const char* category,
+                      const char* name,
+                      const std::string* detail) {
+  auto& thread = traceThread();
+  active_ = true;
+  if (thread.depth++ == 0) {
+    auto sample = (FLAGS_trace_sample > 1) ? FLAGS_trace_sample : 1;
+    thread.sampled = (thread.roots++ % sample == 0);
+  }
+  if (!thread.sampled) {
+    return;
+  }
+
+  recorded_ = true;
+  category_ = category;
+  name_ = name;
+  if (detail != nullptr) {
+    detail_ = TraceRegistry::instance().intern(*detail);
+  }
+  begin_ = traceNow();
+}
+
+void TraceSpan::end() {
+  auto& thread = traceThread();
+  thread.depth--;
+  if (!recorded_) {
+    return;
+  }
+
+  // Readers drop the slot being rewritten once they see it started.
+  auto index = thread.started.load(std::memory_order_relaxed);
+  thread.started.store(index + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  auto& slot = thread.slots[index % kTraceBufferSpans];
+  slot.category.store(category_, std::memory_order_relaxed);
+  slot.name.store(name_, std::memory_order_relaxed);
+  slot.detail.store(detail_, std::memory_order_relaxed);
+  slot.begin.store(begin_, std::memory_order_relaxed);
+  slot.duration.store(traceNow() - begin_, std::memory_order_relaxed);
+  thread.written.store(index + 1, std::memory_order_release);
+}
+
+static void traceDumpHandler(int signum) {
+  kTraceDumpRequested.store(true, std::memory_order_relaxed);
+}
+
+void initTracing() {
+  if (FLAGS_trace_file.empty()) {
+    return;
+  }
+  signal(SIGPROF, traceDumpHandler);
+  setTracing(true);
+}
+
+void setTracing(bool enabled) {
+  kTracing.store(enabled, std::memory_order_relaxed);
+}
+
+std::vector<TraceEvent> getTraceEvents() {
+  return TraceRegistry::instance().events();
+}
+
+void clearTraceEvents() { TraceRegistry::instance().clear(); }
+
+/// Append microseconds, with the nanoseconds as a fraction.
+static void writeMicroseconds(JSONWriter& writer, uint64_t nanoseconds) {
+  char buffer[32];
+  auto size = snprintf(buffer,
+                       sizeof(buffer),
+                       "%llu.%03llu",
+                       (unsigned long long)(nanoseconds / 1000),
+                       (unsigned long long)(nanoseconds % 1000));
+  writer.raw(buffer, size);
+}
+
+Status dumpTrace(const std::string& path) {
+  auto events = getTraceEvents();
+  auto pid = std::to_string(::getpid());
+
+  std::string output;
+  JSONWriter writer(output);
+  writer.startObject();
+  writer.key("traceEvents");
+  writer.startArray();
+  for (const auto& event : events) {
+    writer.startObject();
+    writer.key("name");
+    writer.value(event.name, strlen(event.name));
+    writer.key("cat");
+    writer.value(event.category, strlen(event.category));
+    writer.key("ph");
+    writer.value("X", 1);
+    writer.key("pid");
+    writer.raw(pid.data(), pid.size());
+    writer.key("tid");
+    auto tid = std::to_string(event.thread);
+    writer.raw(tid.data(), tid.size());
+    writer.key("ts");
+    writeMicroseconds(writer, event.begin);
+    writer.key("dur");
+    writeMicroseconds(writer, event.duration);
+    if (event.detail != nullptr) {
+      writer.key("args");
+      writer.startObject();
+      writer.key("detail");
+      writer.value(event.detail, strlen(event.detail));
+      writer.endObject();
+    }
+    writer.endObject();
+  }
+  writer.endArray();
+  writer.key("displayTimeUnit");
+  writer.value("ms", 2);
+  writer.endObject();
+  writer.endDocument();
+  return writeTextFile(path, output, 0600, true);
+}
+
+void dumpRequestedTrace() {
+  if (!kTraceDumpRequested.exchange(false) || FLAGS_trace_file.empty()) {
+    return;
+  }
+
+  auto status = dumpTrace(FLAGS_trace_file);
+  if (!status.ok()) {
+    LOG(WARNING) << "Could not write trace: " << status.getMessage();
+  }
+}
+
+void endTracing() {
+  if (FLAGS_trace_file.empty()) {
+    return;
+  }
+
+  setTracing(false);
+  auto status = dumpTrace(FLAGS_trace_file);
+  if (!status.ok()) {
+    LOG(WARNING) << "Could not write trace: " << status.getMessage();
+  }
+}
+}
@@ -0,0 +1,127 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/// The number of spans kept by each thread, older spans are overwritten.
+extern const size_t kTraceBufferSpans;
+
+/// Set while spans are recorded.
+extern std::atomic<bool> kTracing;
+
+/// A completed span, read from a thread's trace buffer.
+struct TraceEvent {
+  /// The component, such as "scheduler" or "sql".
+  const char* category{nullptr};
+
+  /// The operation, such as "launchQuery" or "xFilter".
+  const char* name{nullptr};
+
+  /// The operation's subject, such as a query or table name, or nullptr.
+  const char* detail{nullptr};
+
+  /// The recording thread's identifier.
+  uint64_t thread{0};
+
+  /// Nanoseconds since tracing started.
+  uint64_t begin{0};
+  uint64_t duration{0};
+};
+
+/**
+ * @brief Record the span from construction to destruction to the trace.
+ *
+ * Each thread writes its completed spans into a ring buffer of its own, with
+ * relaxed stores and without locks. Spans nest: with --trace_sample=N, one of
+ * every N top-level spans on a thread is recorded along with the spans it
+ * contains, and the others only count their depth. While tracing is disabled
+ * a span only checks kTracing.
+ *
+ * The category and name must be string literals, the detail is copied into
+ * an interned name table only when the span is recorded.
+ */
+class TraceSpan : private boost::noncopyable {
+ public:
+  TraceSpan(const char* category, const char* name) {
+    if (kTracing.load(std::memory_order_relaxed)) {
+      begin(category, name, nullptr);
+    }
+  }
+
+  TraceSpan(const char* category,
+            const char* name,
+            const std::string& detail) {
+    if (kTracing.load(std::memory_order_relaxed)) {
+      begin(category, name, &detail);
+    }
+  }
+
+  ~TraceSpan() {
+    if (active_) {
+      end();
+    }
+  }
+
+ private:
+  void begin(const char* category,
+             const char* name,
+             const std::string* detail);
+  void end();
+
+ private:
+  /// The span was counted in the thread's depth.
+  bool active_{false};
+
+  /// The span is written to the thread's buffer when it ends.
+  bool recorded_{false};
+
+  const char* category_{nullptr};
+  const char* name_{nullptr};
+  const char* detail_{nullptr};
+  uint64_t begin_{0};
+};
+
+/**
+ * @brief Start tracing if --trace_file is set.
+ *
+ * The trace is written to the file at the next call to dumpRequestedTrace
+ * after SIGPROF is received, and by endTracing when the process shuts down.
+ */
+void initTracing();
+
+/// Enable or disable recording spans, without changing the file.
+void setTracing(bool enabled);
+
+/// Read the spans held by every thread's buffer, ordered by begin time.
+std::vector<TraceEvent> getTraceEvents();
+
+/// Forget every recorded span.
+void clearTraceEvents();
+
+/// Write the recorded spans to a file as Chrome trace event JSON.
+Status dumpTrace(const std::string& path);
+
+/// Write the trace to --trace_file if SIGPROF requested it.
+void dumpRequestedTrace();
+
+/// Stop tracing and write the trace to --trace_file, if it is set.
+void endTracing();
+}
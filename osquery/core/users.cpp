@@ -0,0 +1,193 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <grp.h>
+#include <pwd.h>
+
+#include "osquery/core/users.h"
+
+namespace osquery {
+
+const size_t kUserCacheTTL = 60;
+
+/// The most entries kept for each lookup, a full cache is emptied.
+const size_t kUserCacheMax = 16 * 1024;
+
+/// The initial buffer size for the reentrant passwd and group lookups.
+const size_t kUserBufferSize = 16 * 1024;
+
+/// The largest buffer a passwd or group lookup may grow to.
+const size_t kUserBufferMax = 1024 * 1024;
+
+/**
+ * @brief A lookup's resolved entries, and misses, until they expire.
+ *
+ * Lookups resolve without holding the lock, concurrent misses of the same key
+ * may both resolve it.
+ */
+template <typename Key, typename Value>
+class UserCache {
+ public:
+  typedef std::function<bool(const Key&, Value&)> Resolver;
+
+  bool get(const Key& key, Value& value, const Resolver& resolve) {
+    auto now = std::chrono::steady_clock::now();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = entries_.find(key);
+      if (it != entries_.end() && it->second.expires > now) {
+        value = it->second.value;
+        return it->second.found;
+      }
+    }
+
+    Entry entry;
+    entry.found = resolve(key, entry.value);
+    entry.expires = now + std::chrono::seconds(kUserCacheTTL);
+    value = entry.value;
+    bool found = entry.found;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (entries_.size() >= kUserCacheMax) {
+      entries_.clear();
+    }
+    entries_[key] = std::move(entry);
+    return found;
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+  }
+
+ private:
+  struct Entry {
+    bool found{false};
+    Value value;
+    std::chrono::steady_clock::time_point expires;
+  };
+
+  std::map<Key, Entry> entries_;
+  std::mutex mutex_;
+};
+
+static UserCache<uid_t, UserInfo> kUsersByID;
+static UserCache<std::string, UserInfo> kUsersByName;
+static UserCache<gid_t, GroupInfo> kGroupsByID;
+static UserCache<std::string, GroupInfo> kGroupsByName;
+
+/**
+ * @brief Call a reentrant passwd or group lookup, growing its buffer.
+ *
+ * The entry's strings point into the buffer, copy is called before the
+ * buffer is released.
+ *
+ * @return true if an entry was found.
+ */
+template <typename Entry, typename Lookup, typename Copy>
+static bool lookupEntry(const Lookup& lookup, const Copy& copy) {
+  std::vector<char> buffer(kUserBufferSize);
+  while (true) {
+    Entry entry;
+    Entry* result = nullptr;
+    int error = lookup(&entry, buffer.data(), buffer.size(), &result);
+    if (error == ERANGE && buffer.size() < kUserBufferMax) {
+      buffer.resize(buffer.size() * 2);
+      continue;
+    }
+
+    if (error != 0 || result == nullptr) {
+      return false;
+    }
+    copy(*result);
+    return true;
+  }
+}
+
+static bool lookupUser(
+    const std::function<int(struct passwd*, char*, size_t, struct passwd**)>&
+        lookup,
+    UserInfo& user) {
+  return lookupEntry<struct passwd>(lookup, [&user](const struct passwd& pwd) {
+    user.uid = pwd.pw_uid;
+    user.gid = pwd.pw_gid;
+    user.name = (pwd.pw_name != nullptr) ? pwd.pw_name : "";
+    user.description = (pwd.pw_gecos != nullptr) ? pwd.pw_gecos : "";
+    user.directory = (pwd.pw_dir != nullptr) ? pwd.pw_dir : "";
+    user.shell = (pwd.pw_shell != nullptr) ? pwd.pw_shell : "";
+  });
+}
+
+static bool lookupGroup(
+    const std::function<int(struct group*, char*, size_t, struct group**)>&
+        lookup,
+    GroupInfo& group) {
+  return lookupEntry<struct group>(lookup, [&group](const struct group& grp) {
+    group.gid = grp.gr_gid;
+    group.name = (grp.gr_name != nullptr) ? grp.gr_name : "";
+  });
+}
+
+bool getUser(uid_t uid, UserInfo& user) {
+  return kUsersByID.get(uid, user, [](const uid_t& key, UserInfo& value) {
+    return lookupUser(
+        [key](struct passwd* p, char* b, size_t s, struct passwd** r) {
+          return getpwuid_r(key, p, b, s, r);
+        },
+        value);
+  });
+}
+
+bool getUserByName(const std::string& name, UserInfo& user) {
+  return kUsersByName.get(
+      name, user, [](const std::string& key, UserInfo& value) {
+        return lookupUser(
+            [&key](struct passwd* p, char* b, size_t s, struct passwd** r) {
+              return getpwnam_r(key.c_str(), p, b, s, r);
+            },
+            value);
+      });
+}
+
+bool getGroup(gid_t gid, GroupInfo& group) {
+  return kGroupsByID.get(gid, group, [](const gid_t& key, GroupInfo& value) {
+    return lookupGroup(
+        [key](struct group* g, char* b, size_t s, struct group** r) {
+          return getgrgid_r(key, g, b, s, r);
+        },
+        value);
+  });
+}
+
+bool getGroupByName(const std::string& name, GroupInfo& group) {
+  return kGroupsByName.get(
+      name, group, [](const std::string& key, GroupInfo& value) {
+        return lookupGroup(
+            [&key](struct group* g, char* b, size_t s, struct group** r) {
+              return getgrnam_r(key.c_str(), g, b, s, r);
+            },
+            value);
+      });
+}
+
+void invalidateUserCache() {
+  kUsersByID.clear();
+  kUsersByName.clear();
+  kGroupsByID.clear();
+  kGroupsByName.clear();
+}
+}
@@ -0,0 +1,60 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <string>
+
+#include <sys/types.h>
+
+namespace osquery {
+
+/// Seconds a resolved, or unknown, user or group is reused.
+extern const size_t kUserCacheTTL;
+
+/// A user's passwd entry.
+struct UserInfo {
+  uid_t uid{0};
+  gid_t gid{0};
+  std::string name;
+  std::string description;
+  std::string directory;
+  std::string shell;
+};
+
+/// A group's entry, without its members.
+struct GroupInfo {
+  gid_t gid{0};
+  std::string name;
+};
+
+/**
+ * @brief Resolve a uid to its passwd entry, using a process-wide cache.
+ *
+ * With NSS backed by a directory service each lookup may be a network round
+ * trip. Entries, and uids without an entry, are reused for kUserCacheTTL
+ * seconds. Lookups are safe to call from any thread.
+ *
+ * @return false if the uid has no passwd entry.
+ */
+bool getUser(uid_t uid, UserInfo& user);
+
+/// See getUser, resolve a username to its passwd entry.
+bool getUserByName(const std::string& name, UserInfo& user);
+
+/// See getUser, resolve a gid to its group entry.
+bool getGroup(gid_t gid, GroupInfo& group);
+
+/// See getUser, resolve a group name to its group entry.
+bool getGroupByName(const std::string& name, GroupInfo& group);
+
+/// Drop every cached user and group, for example when /etc/passwd changes.
+void invalidateUserCache();
+}
@@ -8,12 +8,20 @@
  *
  */
 
+#include <atomic>
 #include <cstring>
 
+#include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 #include <sys/wait.h>
 #include <signal.h>
 
+#if defined(__APPLE__)
+#include <libproc.h>
+#include <mach/mach_time.h>
+#endif
+
 #include <boost/filesystem.hpp>
 
 #include <osquery/events.h>
@@ -21,7 +29,9 @@
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/core/watcher.h"
+#include "osquery/database/db_handle.h"
 #include "osquery/dispatcher/dispatcher.h"
 
 extern char** environ;
@@ -44,6 +54,8 @@ const std::map<WatchdogLimitType, std::vector<size_t> > kWatchdogLimits = {
     {LATENCY_LIMIT, {12, 6, 3, 1}},
     // How often to poll for performance limit violations.
     {INTERVAL, {3, 3, 3, 1}},
+    // Proportional IO weight of a cgroup, the default weight is 100.
+    {IO_WEIGHT, {100, 50, 25, 100}},
 };
 
 const std::string kExtensionExtension = ".ext";
@@ -55,6 +67,75 @@ CLI_FLAG(int32,
 
 CLI_FLAG(bool, disable_watchdog, false, "Disable userland watchdog process");
 
+CLI_FLAG(int32,
+         watchdog_throttle_percent,
+         75,
+         "Percent of a limit at which the worker is asked to throttle queries");
+
+CLI_FLAG(bool,
+         watchdog_cgroups,
+         false,
+         "Place the worker and extensions in cgroups limited by the watchdog "
+         "level (Linux cgroup v2)");
+
+CLI_FLAG(bool,
+         watchdog_standby,
+         false,
+         "Keep a parked standby worker to take over when the worker fails");
+
+CLI_FLAG(string,
+         worker_classes,
+         "",
+         "Comma-separated worker classes, each executing its scheduled queries "
+         "in a separate worker (class[:watchdog_level])");
+
+FLAG(uint64,
+     query_max_result_bytes,
+     0,
+     "Bytes of results a scheduled or distributed query may hold (0 uses the "
+     "watchdog level)");
+
+/// Pressure signaled by the watcher, a WatchdogPressure mask.
+static std::atomic<int> kWatchdogPressure{PRESSURE_NONE};
+
+static void watchdogPressureHandler(int signum) {
+  kWatchdogPressure.fetch_or(
+      (signum == SIGUSR2) ? PRESSURE_MEMORY : PRESSURE_UTILIZATION);
+}
+
+void initWatchdogPressure() {
+  signal(SIGUSR1, watchdogPressureHandler);
+  signal(SIGUSR2, watchdogPressureHandler);
+}
+
+int takeWatchdogPressure() { return kWatchdogPressure.exchange(PRESSURE_NONE); }
+
+void waitStandbyHandoff() {
+  auto standby = getenv("OSQUERY_WORKER_STANDBY");
+  if (standby == nullptr) {
+    return;
+  }
+
+  long long handoff = -1;
+  if (!parseInteger(standby, handoff) || handoff < 0) {
+    return;
+  }
+  unsetenv("OSQUERY_WORKER_STANDBY");
+
+  // The watcher writes a byte to promote the standby.
+  char byte = 0;
+  ssize_t bytes = 0;
+  do {
+    bytes = ::read(handoff, &byte, 1);
+  } while (bytes < 0 && errno == EINTR);
+  ::close(handoff);
+  if (bytes != 1) {
+    // The watcher exited or replaced the standby.
+    ::exit(EXIT_SUCCESS);
+  }
+  VLOG(1) << "osqueryd standby worker (" << getpid() << ") taking over";
+}
+
 /// If the worker exits the watcher will inspect the return code.
 void childHandler(int signum) {
   siginfo_t info;
@@ -67,9 +148,101 @@ void childHandler(int signum) {
   }
 }
 
-void Watcher::resetWorkerCounters(size_t respawn_time) {
+std::vector<WorkerClass> getWorkerClasses() {
+  std::vector<WorkerClass> classes;
+  for (const auto& item : split(FLAGS_worker_classes, ",")) {
+    WorkerClass worker;
+    auto separator = item.find(':');
+    worker.name = item.substr(0, separator);
+    if (separator != std::string::npos) {
+      long long level = 0;
+      if (!parseInteger(item.substr(separator + 1), level) || level < 0) {
+        LOG(WARNING) << "Invalid watchdog level for worker class: " << item;
+        continue;
+      }
+      worker.level = static_cast<int>(level);
+    }
+
+    // Class names are used in database paths and cgroup names.
+    bool valid = !worker.name.empty();
+    for (const auto& c : worker.name) {
+      valid = valid && (isalnum(c) || c == '_' || c == '-');
+    }
+    if (!valid) {
+      LOG(WARNING) << "Invalid worker class name: " << item;
+      continue;
+    }
+    classes.push_back(worker);
+  }
+  return classes;
+}
+
+std::string getWorkerClass() {
+  auto worker = getenv("OSQUERY_WORKER_CLASS");
+  return (worker == nullptr) ? "" : worker;
+}
+
+int getWorkerLevel(const std::string& name) {
+  for (const auto& worker : getWorkerClasses()) {
+    if (worker.name == name) {
+      return worker.level;
+    }
+  }
+  return -1;
+}
+
+Status getDefaultWorkerSetting(const std::string& key, std::string& value) {
+  auto worker = getWorkerClass();
+  if (worker.empty()) {
+    return Status(1, "Not a class worker");
+  }
+
+  // The class worker's backing store is the default worker's path and class.
+  auto suffix = "." + worker;
+  const auto& path = FLAGS_database_path;
+  if (path.size() <= suffix.size() ||
+      path.compare(path.size() - suffix.size(), suffix.size(), suffix) != 0) {
+    return Status(1, "Unknown default worker backing store");
+  }
+
+  std::map<std::string, std::string> values;
+  auto status =
+      DBHandle::getValuesAtPath(path.substr(0, path.size() - suffix.size()),
+                                kPersistentSettings,
+                                {key},
+                                values);
+  if (!status.ok()) {
+    return status;
+  }
+  if (values.count(key) == 0 || values.at(key).empty()) {
+    return Status(1, "Default worker has not set " + key);
+  }
+  value = values.at(key);
+  return Status(0, "OK");
+}
+
+bool isWorkerClassMember(const std::string& worker) {
+  if (!Initializer::isWorker()) {
+    // Without a watchdog every query executes in the daemon.
+    return true;
+  }
+
+  auto own = getWorkerClass();
+  if (!worker.empty()) {
+    for (const auto& item : getWorkerClasses()) {
+      if (item.name == worker) {
+        return worker == own;
+      }
+    }
+  }
+  // The default worker executes queries without a configured class.
+  return own.empty();
+}
+
+void Watcher::resetWorkerCounters(size_t respawn_time,
+                                  const std::string& worker) {
   // Reset the monitoring counters for the watcher.
-  auto& state = instance().state_;
+  auto& state = instance().worker_states_[worker];
   state.sustained_latency = 0;
   state.user_time = 0;
   state.system_time = 0;
@@ -101,9 +274,29 @@ void Watcher::removeExtensionPath(const std::string& extension) {
   instance().extension_states_.erase(extension);
 }
 
+pid_t Watcher::getWorker(const std::string& worker) {
+  auto child = instance().workers_.find(worker);
+  return (child == instance().workers_.end()) ? -1 : child->second;
+}
+
+void Watcher::setWorker(pid_t child, const std::string& worker) {
+  instance().workers_[worker] = child;
+}
+
+bool Watcher::getWorkerClass(pid_t child, std::string& worker) {
+  for (const auto& item : instance().workers_) {
+    if (item.second == child) {
+      worker = item.first;
+      return true;
+    }
+  }
+  return false;
+}
+
 PerformanceState& Watcher::getState(pid_t child) {
-  if (child == instance().worker_) {
-    return instance().state_;
+  std::string worker;
+  if (getWorkerClass(child, worker)) {
+    return instance().worker_states_[worker];
   } else {
     return instance().extension_states_[getExtensionPath(child)];
   }
@@ -119,9 +312,10 @@ void Watcher::setExtension(const std::string& extension, pid_t child) {
 }
 
 void Watcher::reset(pid_t child) {
-  if (child == instance().worker_) {
-    instance().worker_ = 0;
-    resetWorkerCounters(0);
+  std::string worker;
+  if (getWorkerClass(child, worker)) {
+    setWorker(0, worker);
+    resetWorkerCounters(0, worker);
     return;
   }
 
@@ -172,19 +366,34 @@ bool WatcherRunner::ok() {
   return (Watcher::getWorker() >= 0 || Watcher::hasManagedExtensions());
 }
 
+/// The cgroup name of a worker class.
+static std::string getWorkerCgroup(const std::string& worker) {
+  return (worker.empty()) ? "worker" : "worker-" + worker;
+}
+
 void WatcherRunner::start() {
   // Set worker performance counters to an initial state.
   Watcher::resetWorkerCounters(0);
   signal(SIGCHLD, childHandler);
 
-  // Enter the watch loop.
-  do {
-    if (use_worker_ && !watch(Watcher::getWorker())) {
-      // The watcher failed, create a worker.
-      createWorker();
+  if (FLAGS_watchdog_cgroups) {
+    // The kernel enforces the limits, the polling checks remain a fallback.
+    std::string root;
+    auto status = WatcherCgroups::getProcessCgroup(root);
+    if (status.ok()) {
+      status = cgroups_.setUp(root);
     }
+    if (!status.ok()) {
+      LOG(WARNING) << "Cannot place osqueryd children in cgroups: "
+                   << status.getMessage();
+    }
+  }
 
-    // Loop over every managed extension and check sanity.
+  // Enter the watch loop.
+  do {
+    // Loop over every managed extension and check sanity. Extensions are
+    // created without waiting for their sockets, every missing extension is
+    // started before the worker, which may back off before respawning.
     std::vector<std::string> failing_extensions;
     for (const auto& extension : Watcher::extensions()) {
       if (!watch(extension.second)) {
@@ -197,6 +406,25 @@ void WatcherRunner::start() {
     for (const auto& failed_extension : failing_extensions) {
       Watcher::removeExtensionPath(failed_extension);
     }
+
+    if (use_worker_) {
+      // The default worker, then a worker for each class of queries.
+      std::vector<std::string> workers = {""};
+      for (const auto& worker : getWorkerClasses()) {
+        workers.push_back(worker.name);
+      }
+      for (const auto& worker : workers) {
+        if (!watch(Watcher::getWorker(worker))) {
+          // The watcher failed, hand off to the standby or create a worker.
+          if (!worker.empty() || !promoteStandby()) {
+            createWorker(worker);
+          }
+        }
+      }
+      if (FLAGS_watchdog_standby) {
+        createStandby();
+      }
+    }
   } while (ok());
 }
 
@@ -223,80 +451,245 @@ void WatcherRunner::stopChild(pid_t child) {
   waitpid(-1, 0, WNOHANG);
 }
 
-bool WatcherRunner::isChildSane(pid_t child) {
-  auto rows = SQL::selectAllFrom("processes", "pid", EQUALS, INTEGER(child));
+#if defined(__linux__)
+/// Read a small /proc file, these report a size of 0 so stat is not used.
+static bool readProcFile(const std::string& path, std::string& content) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  char buffer[4096];
+  ssize_t bytes = 0;
+  content.clear();
+  while ((bytes = ::read(fd, buffer, sizeof(buffer))) > 0) {
+    content.append(buffer, bytes);
+  }
+  ::close(fd);
+  return bytes == 0 && !content.empty();
+}
+
+/// The private dirty kilobytes summed by smaps_rollup, if the kernel has it.
+static bool getPrivateDirty(const std::string& pid, uint64_t& footprint) {
+  std::string content;
+  if (!readProcFile("/proc/" + pid + "/smaps_rollup", content)) {
+    return false;
+  }
+
+  footprint = 0;
+  bool found = false;
+  size_t line = 0;
+  while (line < content.size()) {
+    // Both Private_Dirty and Private_Hugetlb are written by the process.
+    if (content.compare(line, 13, "Private_Dirty") == 0 ||
+        content.compare(line, 15, "Private_Hugetlb") == 0) {
+      auto value = content.find(':', line);
+      if (value != std::string::npos) {
+        footprint += strtoull(content.c_str() + value + 1, nullptr, 10) * 1024;
+        found = true;
+      }
+    }
+    line = content.find('\n', line);
+    line = (line == std::string::npos) ? content.size() : line + 1;
+  }
+  return found;
+}
+
+Status getProcessUsage(pid_t pid, ProcessUsage& usage) {
+  auto process = std::to_string(pid);
+  std::string stat;
+  if (!readProcFile("/proc/" + process + "/stat", stat)) {
+    return Status(1, "Cannot read process stat");
+  }
+
+  // The comm field may contain spaces and parentheses.
+  auto fields = stat.rfind(')');
+  if (fields == std::string::npos) {
+    return Status(1, "Cannot parse process stat");
+  }
+  // Fields after comm: state, ppid, ..., utime (11), stime (12).
+  Tokenizer values(stat.data() + fields + 1, stat.size() - fields - 1, " ");
+  if (!values.skip(2)) {
+    return Status(1, "Cannot parse process stat");
+  }
+  usage.parent = strtol(values.str().c_str(), nullptr, 10);
+  if (!values.skip(10)) {
+    return Status(1, "Cannot parse process stat");
+  }
+  uint64_t user_time = strtoull(values.str().c_str(), nullptr, 10);
+  if (!values.next()) {
+    return Status(1, "Cannot parse process stat");
+  }
+  uint64_t system_time = strtoull(values.str().c_str(), nullptr, 10);
+
+  static const uint64_t ticks = std::max(sysconf(_SC_CLK_TCK), 1L);
+  usage.user_time = user_time * 1000 / ticks;
+  usage.system_time = system_time * 1000 / ticks;
+
+  if (getPrivateDirty(process, usage.footprint)) {
+    return Status(0, "OK");
+  }
+
+  // Without smaps_rollup use resident pages not shared with a file.
+  std::string statm;
+  if (!readProcFile("/proc/" + process + "/statm", statm)) {
+    return Status(1, "Cannot read process statm");
+  }
+  auto pages = split(statm, " ");
+  if (pages.size() < 3) {
+    return Status(1, "Cannot parse process statm");
+  }
+  uint64_t resident = strtoull(pages[1].c_str(), nullptr, 10);
+  uint64_t shared = strtoull(pages[2].c_str(), nullptr, 10);
+  usage.footprint =
+      (resident > shared) ? (resident - shared) * getpagesize() : 0;
+  return Status(0, "OK");
+}
+#elif defined(__APPLE__)
+Status getProcessUsage(pid_t pid, ProcessUsage& usage) {
+  struct proc_bsdshortinfo info;
+  if (proc_pidinfo(pid, PROC_PIDT_SHORTBSDINFO, 0, &info, sizeof(info)) !=
+      sizeof(info)) {
+    return Status(1, "Cannot read process info");
+  }
+
+  struct rusage_info_v2 rusage;
+  if (proc_pid_rusage(pid, RUSAGE_INFO_V2, (rusage_info_t*)&rusage) != 0) {
+    return Status(1, "Cannot read process usage");
+  }
+
+  // CPU times are in Mach absolute time units.
+  static mach_timebase_info_data_t timebase;
+  if (timebase.denom == 0) {
+    mach_timebase_info(&timebase);
+  }
+  auto toMilliseconds = [](uint64_t time) {
+    return time * timebase.numer / timebase.denom / 1000000;
+  };
+
+  usage.parent = info.pbsi_ppid;
+  usage.user_time = toMilliseconds(rusage.ri_user_time);
+  usage.system_time = toMilliseconds(rusage.ri_system_time);
+  // The physical footprint is the process's dirty private memory.
+  usage.footprint = rusage.ri_phys_footprint;
+  return Status(0, "OK");
+}
+#else
+Status getProcessUsage(pid_t pid, ProcessUsage& usage) {
+  auto rows = SQL::selectAllFrom("processes", "pid", EQUALS, INTEGER(pid));
   if (rows.size() == 0) {
+    return Status(1, "Cannot find process");
+  }
+
+  try {
+    usage.parent = AS_LITERAL(BIGINT_LITERAL, rows[0].at("parent"));
+    // The processes table reports CPU time in seconds.
+    usage.user_time =
+        AS_LITERAL(BIGINT_LITERAL, rows[0].at("user_time")) * 1000;
+    usage.system_time =
+        AS_LITERAL(BIGINT_LITERAL, rows[0].at("system_time")) * 1000;
+    usage.footprint = AS_LITERAL(BIGINT_LITERAL, rows[0].at("resident_size"));
+  } catch (const std::exception& e) {
+    return Status(1, "Cannot parse process usage");
+  }
+  return Status(0, "OK");
+}
+#endif
+
+bool WatcherRunner::isChildSane(pid_t child) {
+  ProcessUsage usage;
+  if (!getProcessUsage(child, usage).ok()) {
     // Could not find worker process?
     return false;
   }
 
+  // A class worker is limited by its class's watchdog level.
+  std::string worker;
+  bool is_worker = Watcher::getWorkerClass(child, worker);
+  auto level = (is_worker) ? getWorkerLevel(worker) : -1;
+
   // Get the performance state for the worker or extension.
   size_t sustained_latency = 0;
-  // Compare CPU utilization since last check.
-  BIGINT_LITERAL footprint = 0, user_time = 0, system_time = 0, parent = 0;
   // IV is the check interval in seconds, and utilization is set per-second.
   auto iv = std::max(getWorkerLimit(INTERVAL), (size_t)1);
+  // The CPU milliseconds in an interval at the utilization limit (percent).
+  auto limit = getWorkerLimit(UTILIZATION_LIMIT, level) * iv * 10;
+  auto memory_limit = getWorkerLimit(MEMORY_LIMIT, level) * 1024 * 1024;
+  auto throttle = std::max(FLAGS_watchdog_throttle_percent, 0);
+  int pressure = PRESSURE_NONE;
 
   {
     WatcherLocker locker;
     auto& state = Watcher::getState(child);
-    try {
-      parent = AS_LITERAL(BIGINT_LITERAL, rows[0].at("parent"));
-      user_time = AS_LITERAL(BIGINT_LITERAL, rows[0].at("user_time")) / iv;
-      system_time = AS_LITERAL(BIGINT_LITERAL, rows[0].at("system_time")) / iv;
-      footprint = AS_LITERAL(BIGINT_LITERAL, rows[0].at("resident_size"));
-    } catch (const std::exception& e) {
-      state.sustained_latency = 0;
+
+    // Signal pressure when nearing the limits, before the worker is killed.
+    if (throttle > 0) {
+      auto soft_limit = limit * throttle / 100;
+      if (usage.user_time > state.user_time + soft_limit ||
+          usage.system_time > state.system_time + soft_limit) {
+        pressure |= PRESSURE_UTILIZATION;
+      }
+      if (usage.footprint > memory_limit * throttle / 100) {
+        pressure |= PRESSURE_MEMORY;
+      }
     }
 
     // Check the difference of CPU time used since last check.
-    if (user_time - state.user_time > getWorkerLimit(UTILIZATION_LIMIT) ||
-        system_time - state.system_time > getWorkerLimit(UTILIZATION_LIMIT)) {
+    if (usage.user_time > state.user_time + limit ||
+        usage.system_time > state.system_time + limit) {
       state.sustained_latency++;
     } else {
       state.sustained_latency = 0;
     }
     // Update the current CPU time.
-    state.user_time = user_time;
-    state.system_time = system_time;
+    state.user_time = usage.user_time;
+    state.system_time = usage.system_time;
 
     // Check if the sustained difference exceeded the acceptable latency limit.
     sustained_latency = state.sustained_latency;
-
-    // Set the memory footprint as the amount of resident bytes allocated
-    // since the process image was created (estimate).
-    // A more-meaningful check would limit this to writable regions.
-    if (state.initial_footprint == 0) {
-      state.initial_footprint = footprint;
-    }
-
-    // Set the measured/limit-applied footprint to the post-launch allocations.
-    if (footprint < state.initial_footprint) {
-      footprint = 0;
-    } else {
-      footprint = footprint - state.initial_footprint;
-    }
   }
 
   // Only make a decision about the child sanity if it is still the watcher's
   // child. It's possible for the child to die, and its pid reused.
-  if (parent != getpid()) {
+  if (usage.parent != getpid()) {
     // The child's parent is not the watcher.
     Watcher::reset(child);
     // Do not stop or call the child insane, since it is not our child.
     return true;
   }
 
+  // Stalls reported by the worker's cgroup since the last check.
+  if (throttle > 0 && is_worker && cgroups_.active()) {
+    auto stall = cgroups_.pressure(getWorkerCgroup(worker));
+    if (stall.memory) {
+      pressure |= PRESSURE_MEMORY;
+    }
+    if (stall.cpu) {
+      pressure |= PRESSURE_UTILIZATION;
+    }
+  }
+
+  // Only workers run the schedule and handle pressure signals.
+  if (pressure != PRESSURE_NONE && is_worker) {
+    VLOG(1) << "osqueryd worker (" << child << ") nearing performance limits";
+    if (pressure & PRESSURE_UTILIZATION) {
+      kill(child, SIGUSR1);
+    }
+    if (pressure & PRESSURE_MEMORY) {
+      kill(child, SIGUSR2);
+    }
+  }
+
   if (sustained_latency > 0 &&
-      sustained_latency * iv >= getWorkerLimit(LATENCY_LIMIT)) {
+      sustained_latency * iv >= getWorkerLimit(LATENCY_LIMIT, level)) {
     LOG(WARNING) << "osqueryd worker (" << child
                  << ") system performance limits exceeded";
     return false;
   }
   // Check if the private memory exceeds a memory limit.
-  if (footprint > 0 && footprint > getWorkerLimit(MEMORY_LIMIT) * 1024 * 1024) {
+  if (usage.footprint > memory_limit) {
     LOG(WARNING) << "osqueryd worker (" << child
-                 << ") memory limits exceeded: " << footprint;
+                 << ") memory limits exceeded: " << usage.footprint;
     return false;
   }
 
@@ -306,10 +699,10 @@ bool WatcherRunner::isChildSane(pid_t child) {
   return true;
 }
 
-void WatcherRunner::createWorker() {
+void WatcherRunner::createWorker(const std::string& worker) {
   {
     WatcherLocker locker;
-    if (Watcher::getState(Watcher::getWorker()).last_respawn_time >
+    if (Watcher::instance().worker_states_[worker].last_respawn_time >
         getUnixTime() - getWorkerLimit(RESPAWN_LIMIT)) {
       LOG(WARNING) << "osqueryd worker respawning too quickly: "
                    << Watcher::workerRestartCount() << " times";
@@ -320,6 +713,89 @@ void WatcherRunner::createWorker() {
     }
   }
 
+  auto worker_pid = forkWorker(worker);
+  Watcher::setWorker(worker_pid, worker);
+  Watcher::resetWorkerCounters(getUnixTime(), worker);
+  VLOG(1) << "osqueryd watcher (" << getpid() << ") executing worker ("
+          << worker_pid << ")" << (worker.empty() ? "" : ": " + worker);
+}
+
+void WatcherRunner::createStandby() {
+  if (standby_ > 0) {
+    if (waitpid(standby_, nullptr, WNOHANG) == 0) {
+      // The standby is parked.
+      return;
+    }
+    ::close(handoff_);
+    handoff_ = -1;
+    standby_ = 0;
+  }
+
+  // Let a new worker initialize before forking its standby, and do not
+  // respawn a failing standby quickly.
+  auto now = getUnixTime();
+  auto limit = getWorkerLimit(RESPAWN_LIMIT);
+  {
+    WatcherLocker locker;
+    if (Watcher::getWorker() <= 0 ||
+        Watcher::instance().worker_states_[""].last_respawn_time + limit >
+            now ||
+        standby_time_ + limit > now) {
+      return;
+    }
+  }
+
+  int handoff[2];
+  if (::pipe(handoff) != 0) {
+    return;
+  }
+  // Only the standby inherits the read end of the pipe.
+  ::fcntl(handoff[1], F_SETFD, FD_CLOEXEC);
+  standby_time_ = now;
+  standby_ = forkWorker("", handoff[0]);
+  handoff_ = handoff[1];
+  ::close(handoff[0]);
+  VLOG(1) << "osqueryd watcher (" << getpid() << ") parked standby worker ("
+          << standby_ << ")";
+}
+
+bool WatcherRunner::promoteStandby() {
+  if (standby_ <= 0) {
+    return false;
+  }
+
+  auto standby = standby_;
+  auto handoff = handoff_;
+  standby_ = 0;
+  handoff_ = -1;
+
+  // The failed worker must exit, releasing the backing store's lock, before
+  // the standby continues. Its pid is reaped, or was reaped by watch.
+  auto worker = Watcher::getWorker();
+  for (size_t i = 0; worker > 0 && i < 100; ++i) {
+    if (waitpid(worker, nullptr, WNOHANG) != 0) {
+      break;
+    }
+    ::usleep(10 * 1000);
+  }
+
+  // Closing the pipe without a write tells a standby to exit.
+  char byte = 1;
+  bool promoted = waitpid(standby, nullptr, WNOHANG) == 0 &&
+                  ::write(handoff, &byte, 1) == 1;
+  ::close(handoff);
+  if (!promoted) {
+    return false;
+  }
+
+  Watcher::setWorker(standby);
+  Watcher::resetWorkerCounters(getUnixTime());
+  VLOG(1) << "osqueryd watcher (" << getpid() << ") promoted standby worker ("
+          << standby << ")";
+  return true;
+}
+
+pid_t WatcherRunner::forkWorker(const std::string& worker, int handoff) {
   // Get the path of the current process.
   auto qd = SQL::selectAllFrom("processes", "pid", EQUALS, INTEGER(getpid()));
   if (qd.size() != 1 || qd[0].count("path") == 0 || qd[0]["path"].size() == 0) {
@@ -342,6 +818,8 @@ void WatcherRunner::createWorker() {
     ::exit(EXIT_FAILURE);
   }
 
+  auto cgroup = cgroups_.prepare(getWorkerCgroup(worker),
+                                 getCgroupLimits(getWorkerLevel(worker)));
   auto worker_pid = fork();
   if (worker_pid < 0) {
     // Unrecoverable error, cannot create a worker process.
@@ -349,17 +827,24 @@ void WatcherRunner::createWorker() {
     ::exit(EXIT_FAILURE);
   } else if (worker_pid == 0) {
     // This is the new worker process, no watching needed.
+    if (!cgroup.empty()) {
+      joinCgroup(cgroup.c_str());
+    }
     setenv("OSQUERY_WORKER", std::to_string(getpid()).c_str(), 1);
+    if (handoff >= 0) {
+      setenv("OSQUERY_WORKER_STANDBY", std::to_string(handoff).c_str(), 1);
+    }
+    if (!worker.empty()) {
+      // A class worker does not host extensions, so it does not wait for them.
+      setenv("OSQUERY_WORKER_CLASS", worker.c_str(), 1);
+      unsetenv("OSQUERY_EXTENSIONS");
+    }
     execve(exec_path.string().c_str(), argv_, environ);
     // Code should never reach this point.
     LOG(ERROR) << "osqueryd could not start worker process";
     ::exit(EXIT_CATASTROPHIC);
   }
-
-  Watcher::setWorker(worker_pid);
-  Watcher::resetWorkerCounters(getUnixTime());
-  VLOG(1) << "osqueryd watcher (" << getpid() << ") executing worker ("
-          << worker_pid << ")";
+  return worker_pid;
 }
 
 bool WatcherRunner::createExtension(const std::string& extension) {
@@ -382,12 +867,17 @@ bool WatcherRunner::createExtension(const std::string& extension) {
     return false;
   }
 
+  auto cgroup = cgroups_.prepare("extension-" + exec_path.filename().string(),
+                                 getCgroupLimits());
   auto ext_pid = fork();
   if (ext_pid < 0) {
     // Unrecoverable error, cannot create an extension process.
     LOG(ERROR) << "Cannot create extension process: " << extension;
     ::exit(EXIT_FAILURE);
   } else if (ext_pid == 0) {
+    if (!cgroup.empty()) {
+      joinCgroup(cgroup.c_str());
+    }
     // Pass the current extension socket and a set timeout to the extension.
     setenv("OSQUERY_EXTENSION", std::to_string(getpid()).c_str(), 1);
     // Execute extension with very specific arguments.
@@ -428,6 +918,28 @@ void WatcherWatcherRunner::start() {
   }
 }
 
+CgroupLimits getCgroupLimits(int level) {
+  CgroupLimits limits;
+  limits.cpu_percent = getWorkerLimit(UTILIZATION_LIMIT, level);
+  // The kernel reclaims above the watchdog's limit, the watchdog kills the
+  // process before the hard maximum unless its allocations are very fast.
+  limits.memory_high = getWorkerLimit(MEMORY_LIMIT, level) * 1024 * 1024;
+  limits.memory_max = limits.memory_high * 2;
+  limits.io_weight = getWorkerLimit(IO_WEIGHT, level);
+  return limits;
+}
+
+size_t getQueryResultsLimit() {
+  if (FLAGS_query_max_result_bytes > 0) {
+    return FLAGS_query_max_result_bytes;
+  } else if (!Initializer::isWorker()) {
+    return 0;
+  }
+
+  // Results are copied to diff and log them, leave room for the copies.
+  return getWorkerLimit(MEMORY_LIMIT) * 1024 * 1024 / 4;
+}
+
 size_t getWorkerLimit(WatchdogLimitType name, int level) {
   if (kWatchdogLimits.count(name) == 0) {
     return 0;
@@ -10,7 +10,10 @@
 
 #pragma once
 
+#include <cstdint>
+#include <map>
 #include <string>
+#include <vector>
 
 #include <unistd.h>
 
@@ -19,6 +22,7 @@
 
 #include <osquery/flags.h>
 
+#include "osquery/core/cgroups.h"
 #include "osquery/dispatcher/dispatcher.h"
 
 /// Define a special debug/testing watchdog level.
@@ -30,6 +34,8 @@ namespace osquery {
 
 DECLARE_bool(disable_watchdog);
 DECLARE_int32(watchdog_level);
+DECLARE_string(worker_classes);
+DECLARE_bool(watchdog_standby);
 
 class WatcherRunner;
 
@@ -48,6 +54,7 @@ enum WatchdogLimitType {
   RESPAWN_DELAY,
   LATENCY_LIMIT,
   INTERVAL,
+  IO_WEIGHT,
 };
 
 /**
@@ -59,25 +66,90 @@ enum WatchdogLimitType {
 struct PerformanceState {
   /// A counter of how many intervals the process exceeded performance limits.
   size_t sustained_latency;
-  /// The last checked user CPU time.
+  /// The last checked user CPU time in milliseconds.
   size_t user_time;
-  /// The last checked system CPU time.
+  /// The last checked system CPU time in milliseconds.
   size_t system_time;
   /// A timestamp when the process/worker was last created.
   size_t last_respawn_time;
 
-  /// The initial (or as close as possible) process image footprint.
-  size_t initial_footprint;
-
   PerformanceState() {
     sustained_latency = 0;
     user_time = 0;
     system_time = 0;
     last_respawn_time = 0;
-    initial_footprint = 0;
   }
 };
 
+/// A sample of a watched process's resource use.
+struct ProcessUsage {
+  /// The process's parent pid.
+  pid_t parent{0};
+  /// Cumulative user CPU time in milliseconds.
+  uint64_t user_time{0};
+  /// Cumulative system CPU time in milliseconds.
+  uint64_t system_time{0};
+  /// Private dirty memory in bytes, memory the process itself has written.
+  uint64_t footprint{0};
+};
+
+/**
+ * @brief A class of scheduled queries executed by its own worker process.
+ *
+ * Each class named in --worker_classes adds a worker, watched with the limits
+ * of the class's watchdog level, executing the scheduled queries with a
+ * matching "worker" option. The default worker executes every other query.
+ */
+struct WorkerClass {
+  /// The class name, matched with a scheduled query's "worker" option.
+  std::string name;
+  /// The class's watchdog level, -1 uses --watchdog_level.
+  int level{-1};
+};
+
+/// The worker classes, in addition to the default worker, from the flag.
+std::vector<WorkerClass> getWorkerClasses();
+
+/// The worker class of this process, empty for the default worker.
+std::string getWorkerClass();
+
+/// The watchdog level of a worker class, -1 uses --watchdog_level.
+int getWorkerLevel(const std::string& name);
+
+/**
+ * @brief Read a persistent setting of the default worker from a class worker.
+ *
+ * The node key and host identifier belong to the host. A class worker opens
+ * the default worker's backing store read-only to use them, rather than
+ * enrolling or generating an identity of its own.
+ *
+ * @param key A key in the persistent settings domain.
+ * @param value Output value, valid if the status is OK.
+ * @return Failure for the default worker or if the key is not yet set.
+ */
+Status getDefaultWorkerSetting(const std::string& key, std::string& value);
+
+/**
+ * @brief Whether this process executes a scheduled query's worker class.
+ *
+ * A class worker executes only its class's queries. The default worker, or an
+ * unwatched daemon, executes queries without a class or with a class not
+ * named in --worker_classes.
+ */
+bool isWorkerClassMember(const std::string& worker);
+
+/**
+ * @brief Sample a process's CPU time and memory for the watchdog.
+ *
+ * Reads /proc/<pid>/stat and the private dirty total of smaps_rollup (or
+ * statm) on Linux, and proc_pid_rusage on OS X, without using the SQL layer.
+ *
+ * @param pid The process to sample.
+ * @param usage Output usage, valid if the status is OK.
+ * @return Failure if the process does not exist.
+ */
+Status getProcessUsage(pid_t pid, ProcessUsage& usage);
+
 /**
  * @brief Thread-safe watched child process state manager.
  *
@@ -100,8 +172,9 @@ class Watcher : private boost::noncopyable {
     return instance;
   }
 
-  /// Reset counters after a worker exits.
-  static void resetWorkerCounters(size_t respawn_time);
+  /// Reset counters after a worker of a class exits.
+  static void resetWorkerCounters(size_t respawn_time,
+                                  const std::string& worker = "");
 
   /// Reset counters for an extension path.
   static void resetExtensionCounters(const std::string& extension,
@@ -131,11 +204,14 @@ class Watcher : private boost::noncopyable {
   static PerformanceState& getState(pid_t child);
   static PerformanceState& getState(const std::string& extension);
 
-  /// Accessor for the worker process.
-  static pid_t getWorker() { return instance().worker_; }
+  /// Accessor for the worker process of a class, -1 if it was never created.
+  static pid_t getWorker(const std::string& worker = "");
+
+  /// Setter for the worker process of a class.
+  static void setWorker(pid_t child, const std::string& worker = "");
 
-  /// Setter for worker process.
-  static void setWorker(pid_t child) { instance().worker_ = child; }
+  /// Lookup the class of a worker pid, false if the pid is not a worker.
+  static bool getWorkerClass(pid_t child, std::string& worker);
 
   /// Setter for an extension process.
   static void setExtension(const std::string& extension, pid_t child);
@@ -157,8 +233,7 @@ class Watcher : private boost::noncopyable {
 
  private:
   /// Do not request the lock until extensions are used.
-  Watcher()
-      : worker_(-1), worker_restarts_(0), lock_(mutex_, boost::defer_lock) {}
+  Watcher() : worker_restarts_(0), lock_(mutex_, boost::defer_lock) {}
   Watcher(Watcher const&);
   void operator=(Watcher const&);
   virtual ~Watcher() {}
@@ -168,14 +243,14 @@ class Watcher : private boost::noncopyable {
   static void workerRestarted() { instance().worker_restarts_++; }
 
  private:
-  /// Performance state for the worker process.
-  PerformanceState state_;
+  /// Performance states for the worker process of each class.
+  std::map<std::string, PerformanceState> worker_states_;
   /// Performance states for each autoloadable extension binary.
   std::map<std::string, PerformanceState> extension_states_;
 
  private:
-  /// Keep the single worker process/thread ID for inspection.
-  pid_t worker_;
+  /// Keep the worker process IDs, by class, for inspection.
+  std::map<std::string, pid_t> workers_;
   /// Number of worker restarts NOT induced by a watchdog process.
   size_t worker_restarts_;
   /// Keep a list of resolved extension paths and their managed pids.
@@ -240,8 +315,14 @@ class WatcherRunner : public InternalRunnable {
   bool isChildSane(pid_t child);
 
  private:
-  /// Fork and execute a worker process.
-  void createWorker();
+  /// Fork and execute the worker process of a class.
+  void createWorker(const std::string& worker = "");
+  /// Fork and execute a standby for the default worker, if one is needed.
+  void createStandby();
+  /// Hand the default worker's role to the standby, false without one.
+  bool promoteStandby();
+  /// Fork and execute a worker, a standby reads its handoff from a pipe.
+  pid_t forkWorker(const std::string& worker, int handoff = -1);
   /// Fork an extension process.
   bool createExtension(const std::string& extension);
   /// If a worker/extension has otherwise gone insane, stop it.
@@ -254,6 +335,14 @@ class WatcherRunner : public InternalRunnable {
   char** argv_;
   /// Spawn/monitor a worker process.
   bool use_worker_;
+  /// The cgroups of the worker and extensions, if enabled.
+  WatcherCgroups cgroups_;
+  /// A standby worker, parked before its initialization, or 0.
+  pid_t standby_{0};
+  /// The write end of the standby's handoff pipe.
+  int handoff_{-1};
+  /// The time the standby was last created.
+  size_t standby_time_{0};
 };
 
 /// The WatcherWatcher is spawned within the worker and watches the watcher.
@@ -271,4 +360,46 @@ class WatcherWatcherRunner : public InternalRunnable {
 
 /// Get a performance limit by name and optional level.
 size_t getWorkerLimit(WatchdogLimitType limit, int level = -1);
+
+/// Get the cgroup limits of a worker or extension at an optional level.
+CgroupLimits getCgroupLimits(int level = -1);
+
+/**
+ * @brief The bytes of results a scheduled or distributed query may hold.
+ *
+ * Set with --query_max_result_bytes, otherwise a worker uses a quarter of its
+ * watchdog memory limit. Unwatched processes have no limit, 0.
+ */
+size_t getQueryResultsLimit();
+
+/// Limits the worker is approaching, reported by the watcher before a kill.
+enum WatchdogPressure {
+  PRESSURE_NONE = 0,
+  PRESSURE_UTILIZATION = 1,
+  PRESSURE_MEMORY = 2,
+};
+
+/**
+ * @brief Handle the watcher's pressure signals in a worker.
+ *
+ * The watcher signals a worker nearing its utilization (SIGUSR1) or memory
+ * (SIGUSR2) limit, giving the scheduler a chance to throttle the queries
+ * responsible before the worker is killed.
+ */
+void initWatchdogPressure();
+
+/// Take the pressure signaled since the last call, a WatchdogPressure mask.
+int takeWatchdogPressure();
+
+/**
+ * @brief Park a standby worker until the watcher hands it the worker's role.
+ *
+ * With --watchdog_standby the watcher keeps a second default worker, loaded
+ * but not yet holding the backing store, extension socket, or event
+ * publishers. When the worker fails the standby continues its initialization
+ * instead of the watcher executing a new worker. A standby exits if the
+ * watcher exits or closes the handoff without promoting it. Other processes
+ * return immediately.
+ */
+void waitStandbyHandoff();
 }
@@ -0,0 +1,99 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/database.h>
+
+#include "osquery/core/test_util.h"
+
+namespace osquery {
+
+/// A processes-sized result set: 1000 rows of 16 columns.
+const size_t kBenchmarkRows = 1000;
+const size_t kBenchmarkColumns = 16;
+
+class DatabaseBenchmarks : public testing::Test {
+ protected:
+  void SetUp() {
+    old_ = generateBenchmarkRows(kBenchmarkRows, kBenchmarkColumns, 16);
+    // Change 10% of the rows between executions.
+    current_ = old_;
+    for (size_t i = 0; i < current_.size(); i += 10) {
+      current_[i]["column_0"] = "changed";
+    }
+  }
+
+  QueryData old_;
+  QueryData current_;
+};
+
+TEST_F(DatabaseBenchmarks, bench_diff) {
+  size_t added = 0;
+  runBenchmark([this, &added]() { added += diff(old_, current_).added.size(); },
+               kBenchmarkRows);
+  EXPECT_GT(added, 0U);
+}
+
+TEST_F(DatabaseBenchmarks, bench_diff_fingerprinted) {
+  // Scheduled queries store the previous fingerprints with the results.
+  auto old_fps = fingerprintQueryData(old_);
+  auto current_fps = fingerprintQueryData(current_);
+  size_t added = 0;
+  runBenchmark([&]() {
+    added += diff(old_, old_fps, current_, current_fps).added.size();
+  }, kBenchmarkRows);
+  EXPECT_GT(added, 0U);
+}
+
+TEST_F(DatabaseBenchmarks, bench_serialize_row_json) {
+  const auto& row = old_[0];
+  std::string json;
+  serializeRowJSON(row, json);
+  size_t bytes = json.size();
+
+  runBenchmark([&row, &json]() {
+    json.clear();
+    serializeRowJSON(row, json);
+  }, 1, bytes);
+  EXPECT_EQ(json.size(), bytes);
+}
+
+TEST_F(DatabaseBenchmarks, bench_serialize_query_log_item_json) {
+  QueryLogItem item;
+  item.name = "benchmark";
+  item.identifier = "host";
+  item.time = 0;
+  item.results.added = current_;
+
+  std::string json;
+  serializeQueryLogItemJSON(item, json);
+  size_t bytes = json.size();
+
+  runBenchmark([&item, &json]() {
+    json.clear();
+    serializeQueryLogItemJSON(item, json);
+  }, kBenchmarkRows, bytes);
+  EXPECT_EQ(json.size(), bytes);
+}
+
+TEST_F(DatabaseBenchmarks, bench_deserialize_query_data_json) {
+  std::string json;
+  serializeQueryDataJSON(old_, json);
+
+  size_t rows = 0;
+  runBenchmark([&json, &rows]() {
+    QueryData results;
+    deserializeQueryDataJSON(json, results);
+    rows += results.size();
+  }, kBenchmarkRows, json.size());
+  EXPECT_EQ(rows % kBenchmarkRows, 0U);
+}
+}
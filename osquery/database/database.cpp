@@ -9,24 +9,58 @@
  */
 
 #include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <sstream>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
+#include <snappy.h>
+
 #include <osquery/database.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/arena.h"
+#include "osquery/core/conversions.h"
+#include "osquery/core/json.h"
+#include "osquery/core/metrics.h"
+
 namespace pt = boost::property_tree;
 
 namespace osquery {
 
 typedef unsigned char byte;
 
+FLAG(bool,
+     database_compress_results,
+     true,
+     "Compress scheduled query results in the backing store");
+
+/// Binary results begin with a NUL, which never begins a JSON document.
+const char kBinaryResultsMagic = '\0';
+/// The version of the binary results encoding.
+const byte kBinaryResultsVersion = 1;
+/// The version of the column-major binary encoding.
+const byte kBinaryColumnarVersion = 2;
+/// Column-major payloads smaller than this are not compressed.
+const size_t kBinaryColumnarCompressMin = 128;
+/// A column's values are stored inline.
+const byte kColumnPlain = 0;
+/// A column's values are indexes into a dictionary of distinct values.
+const byte kColumnDictionary = 1;
+/// The binary results payload is snappy-compressed.
+const byte kBinaryResultsCompressed = 1;
+/// Magic, version, and flags.
+const size_t kBinaryResultsHeaderSize = 3;
+
 /////////////////////////////////////////////////////////////////////////////
 // Row - the representation of a row in a set of database results. Row is a
 // simple map where individual column names are keys, which map to the Row's
@@ -34,32 +68,80 @@ typedef unsigned char byte;
 /////////////////////////////////////////////////////////////////////////////
 
 std::string escapeNonPrintableBytes(const std::string& data) {
+  size_t clean = findNonPrintable(data.data(), data.size());
+  if (clean == data.size()) {
+    return data;
+  }
+
   std::string escaped;
+  escaped.reserve(data.size() + 16);
   // clang-format off
   char const hex_chars[16] = {
     '0', '1', '2', '3', '4', '5', '6', '7', '8', '9',
     'A', 'B', 'C', 'D', 'E', 'F',
   };
   // clang-format on
-  for (int i = 0; i < data.length(); i++) {
-    if (((byte)data[i]) < 0x20 || ((byte)data[i]) >= 0x80) {
-      escaped += "\\x";
-      escaped += hex_chars[(((byte)data[i])) >> 4];
-      escaped += hex_chars[((byte)data[i] & 0x0F) >> 0];
-    } else {
-      escaped += data[i];
+  size_t i = 0;
+  while (i < data.size()) {
+    // Copy runs of printable bytes at once.
+    escaped.append(data, i, clean);
+    i += clean;
+    if (i == data.size()) {
+      break;
     }
+
+    escaped += "\\x";
+    escaped += hex_chars[((byte)data[i]) >> 4];
+    escaped += hex_chars[(byte)data[i] & 0x0F];
+    ++i;
+    clean = findNonPrintable(data.data() + i, data.size() - i);
   }
   return escaped;
 }
 
+bool resultSetNeedsEscaping(const ResultSet& rs) {
+  for (size_t row = 0; row < rs.rows(); ++row) {
+    for (size_t i = 0; i < rs.columns(); ++i) {
+      auto value = rs.value(row, i);
+      if (findNonPrintable(value.data, value.size) != value.size) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool queryDataNeedsEscaping(const QueryData& data) {
+  for (const auto& r : data) {
+    for (const auto& i : r) {
+      if (findNonPrintable(i.second.data(), i.second.size()) !=
+          i.second.size()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
 void escapeQueryData(const QueryData& oldData, QueryData& newData) {
+  newData.reserve(newData.size() + oldData.size());
   for (const auto& r : oldData) {
     Row newRow;
     for (auto& i : r) {
       newRow[i.first] = escapeNonPrintableBytes(i.second);
     }
-    newData.push_back(newRow);
+    newData.push_back(std::move(newRow));
+  }
+}
+
+void escapeQueryData(QueryData& data) {
+  for (auto& r : data) {
+    for (auto& i : r) {
+      if (findNonPrintable(i.second.data(), i.second.size()) !=
+          i.second.size()) {
+        i.second = escapeNonPrintableBytes(i.second);
+      }
+    }
   }
 }
 
@@ -74,16 +156,40 @@ Status serializeRow(const Row& r, pt::ptree& tree) {
   return Status(0, "OK");
 }
 
-Status serializeRowJSON(const Row& r, std::string& json) {
-  pt::ptree tree;
-  auto status = serializeRow(r, tree);
-  if (!status.ok()) {
-    return status;
+/// Write a Row as a property tree would be written, a nested empty Row is "".
+static void writeRowJSON(JSONWriter& writer, const Row& r, bool nested) {
+  if (nested && r.empty()) {
+    writer.value("", 0);
+    return;
+  }
+
+  writer.startObject();
+  for (const auto& i : r) {
+    writer.key(i.first);
+    writer.value(i.second);
+  }
+  writer.endObject();
+}
+
+/// Write a nested QueryData as a list of rows, an empty QueryData is "".
+static void writeQueryDataJSON(JSONWriter& writer, const QueryData& q) {
+  if (q.empty()) {
+    writer.value("", 0);
+    return;
   }
 
-  std::ostringstream output;
-  pt::write_json(output, tree, false);
-  json = output.str();
+  writer.startArray();
+  for (const auto& r : q) {
+    writeRowJSON(writer, r, true);
+  }
+  writer.endArray();
+}
+
+Status serializeRowJSON(const Row& r, std::string& json) {
+  json.clear();
+  JSONWriter writer(json);
+  writeRowJSON(writer, r, false);
+  writer.endDocument();
   return Status(0, "OK");
 }
 
@@ -96,16 +202,72 @@ Status deserializeRow(const pt::ptree& tree, Row& r) {
   return Status(0, "OK");
 }
 
+/**
+ * @brief Parse rows as deserializeRow reads a property tree.
+ *
+ * Rows are the objects at a depth, 1 for a single Row and 2 for QueryData.
+ * Keyed scalar members are columns, and nested members are empty columns.
+ */
+class RowJSONHandler : public JSONHandler {
+ public:
+  RowJSONHandler(QueryData& rows, size_t row_depth)
+      : rows_(rows), row_depth_(row_depth) {}
+
+  void startObject() { start(); }
+  void endObject() { --depth_; }
+  void startArray() { start(); }
+  void endArray() { --depth_; }
+  void key(std::string& name) { key_.swap(name); }
+
+  void value(std::string& data) {
+    if (depth_ + 1 == row_depth_) {
+      // A row that is not an object, such as an empty row, has no columns.
+      rows_.push_back(Row());
+    } else if (depth_ == row_depth_) {
+      setColumn(data);
+    }
+    key_.clear();
+  }
+
+ private:
+  void start() {
+    if (depth_ + 1 == row_depth_) {
+      rows_.push_back(Row());
+    } else if (depth_ == row_depth_) {
+      std::string empty;
+      setColumn(empty);
+    }
+    key_.clear();
+    ++depth_;
+  }
+
+  void setColumn(std::string& data) {
+    if (!key_.empty()) {
+      rows_.back()[key_].swap(data);
+    }
+  }
+
+ private:
+  QueryData& rows_;
+  size_t row_depth_;
+  size_t depth_{0};
+  std::string key_;
+};
+
 Status deserializeRowJSON(const std::string& json, Row& r) {
-  pt::ptree tree;
-  try {
-    std::stringstream input;
-    input << json;
-    pt::read_json(input, tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    return Status(1, e.what());
+  QueryData rows;
+  RowJSONHandler handler(rows, 1);
+  auto status = parseJSON(json, handler);
+  if (!status.ok()) {
+    return status;
   }
-  return deserializeRow(tree, r);
+
+  if (!rows.empty()) {
+    for (auto& column : rows[0]) {
+      r[column.first].swap(column.second);
+    }
+  }
+  return Status(0, "OK");
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -126,15 +288,290 @@ Status serializeQueryData(const QueryData& q, pt::ptree& tree) {
 }
 
 Status serializeQueryDataJSON(const QueryData& q, std::string& json) {
-  pt::ptree tree;
-  auto status = serializeQueryData(q, tree);
-  if (!status.ok()) {
-    return status;
+  json.clear();
+  JSONWriter writer(json);
+
+  // A top-level list is written as an object with empty keys.
+  writer.startObject();
+  for (const auto& r : q) {
+    writer.key("");
+    writeRowJSON(writer, r, true);
+  }
+  writer.endObject();
+  writer.endDocument();
+  return Status(0, "OK");
+}
+
+inline void putVarint(std::string& raw, uint64_t value) {
+  while (value >= 0x80) {
+    raw.push_back((char)((value & 0x7f) | 0x80));
+    value >>= 7;
   }
+  raw.push_back((char)value);
+}
+
+inline bool getVarint(const std::string& raw, size_t& pos, uint64_t& value) {
+  value = 0;
+  for (size_t shift = 0; shift < 64 && pos < raw.size(); shift += 7) {
+    byte b = raw[pos++];
+    value |= (uint64_t)(b & 0x7f) << shift;
+    if ((b & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
 
-  std::ostringstream output;
-  pt::write_json(output, tree, false);
-  json = output.str();
+inline bool getString(const std::string& raw, size_t& pos, std::string& s) {
+  uint64_t size = 0;
+  if (!getVarint(raw, pos, size) || size > raw.size() - pos) {
+    return false;
+  }
+  s.assign(raw, pos, size);
+  pos += size;
+  return true;
+}
+
+/// Add the binary results header and optionally compress the payload.
+static Status finishBinaryResults(const std::string& payload,
+                                  std::string& raw,
+                                  byte version = kBinaryResultsVersion,
+                                  bool compress = true) {
+  raw.clear();
+  raw.push_back(kBinaryResultsMagic);
+  raw.push_back((char)version);
+  if (compress && FLAGS_database_compress_results) {
+    raw.push_back((char)kBinaryResultsCompressed);
+    std::string compressed;
+    snappy::Compress(payload.data(), payload.size(), &compressed);
+    raw.append(compressed);
+  } else {
+    raw.push_back(0);
+    raw.append(payload);
+  }
+  return Status(0, "OK");
+}
+
+/// Write the column name dictionary shared by both binary encodings.
+static void putColumns(std::string& payload,
+                       std::map<std::string, size_t>& columns) {
+  putVarint(payload, columns.size());
+  size_t index = 0;
+  for (auto& column : columns) {
+    column.second = index++;
+    putVarint(payload, column.first.size());
+    payload.append(column.first);
+  }
+}
+
+Status serializeQueryDataBinary(const QueryData& q, std::string& raw) {
+  // Build a dictionary of column names, most rows share the same columns.
+  std::map<std::string, size_t> columns;
+  for (const auto& r : q) {
+    for (const auto& i : r) {
+      columns.insert({i.first, 0});
+    }
+  }
+
+  std::string payload;
+  putColumns(payload, columns);
+  putVarint(payload, q.size());
+  for (const auto& r : q) {
+    putVarint(payload, r.size());
+    for (const auto& i : r) {
+      putVarint(payload, columns.at(i.first));
+      putVarint(payload, i.second.size());
+      payload.append(i.second);
+    }
+  }
+
+  return finishBinaryResults(payload, raw);
+}
+
+Status serializeQueryDataColumnar(const QueryData& q, std::string& raw) {
+  std::map<std::string, size_t> columns;
+  for (const auto& r : q) {
+    for (const auto& i : r) {
+      columns.insert({i.first, 0});
+    }
+  }
+
+  std::string payload;
+  putColumns(payload, columns);
+  putVarint(payload, q.size());
+  for (const auto& column : columns) {
+    // Count the distinct values, repetitive columns use a dictionary.
+    std::map<std::string, size_t> values;
+    for (const auto& r : q) {
+      auto value = r.find(column.first);
+      if (value != r.end()) {
+        values.insert({value->second, 0});
+      }
+    }
+
+    // Each cell is 0 if the row omits the column, otherwise the dictionary
+    // index + 1, or the value's length + 1 followed by the value.
+    if (values.size() * 2 <= q.size()) {
+      payload.push_back((char)kColumnDictionary);
+      putVarint(payload, values.size());
+      size_t index = 0;
+      for (auto& value : values) {
+        value.second = ++index;
+        putVarint(payload, value.first.size());
+        payload.append(value.first);
+      }
+      for (const auto& r : q) {
+        auto value = r.find(column.first);
+        putVarint(payload, (value == r.end()) ? 0 : values.at(value->second));
+      }
+    } else {
+      payload.push_back((char)kColumnPlain);
+      for (const auto& r : q) {
+        auto value = r.find(column.first);
+        if (value == r.end()) {
+          putVarint(payload, 0);
+        } else {
+          putVarint(payload, value->second.size() + 1);
+          payload.append(value->second);
+        }
+      }
+    }
+  }
+
+  return finishBinaryResults(payload,
+                             raw,
+                             kBinaryColumnarVersion,
+                             payload.size() >= kBinaryColumnarCompressMin);
+}
+
+/// Read the column-major encoding, the column dictionary has been read.
+static Status deserializeColumnar(const std::string& payload,
+                                  size_t pos,
+                                  const std::vector<std::string>& columns,
+                                  QueryData& qd) {
+  uint64_t count = 0;
+  if (!getVarint(payload, pos, count) || count > payload.size()) {
+    return Status(1, "Invalid binary results row count");
+  }
+
+  auto first = qd.size();
+  qd.resize(first + count);
+  for (const auto& column : columns) {
+    if (pos >= payload.size()) {
+      return Status(1, "Invalid binary results column");
+    }
+
+    auto encoding = (byte)payload[pos++];
+    std::vector<std::string> values;
+    if (encoding == kColumnDictionary) {
+      uint64_t size = 0;
+      if (!getVarint(payload, pos, size) || size > payload.size()) {
+        return Status(1, "Invalid binary results value dictionary");
+      }
+      values.resize(size);
+      for (auto& value : values) {
+        if (!getString(payload, pos, value)) {
+          return Status(1, "Invalid binary results value");
+        }
+      }
+    } else if (encoding != kColumnPlain) {
+      return Status(1, "Unknown binary results column encoding");
+    }
+
+    for (uint64_t i = 0; i < count; ++i) {
+      uint64_t cell = 0;
+      if (!getVarint(payload, pos, cell)) {
+        return Status(1, "Invalid binary results value");
+      } else if (cell == 0) {
+        continue;
+      }
+
+      auto& r = qd[first + i];
+      if (encoding == kColumnDictionary) {
+        if (cell > values.size()) {
+          return Status(1, "Invalid binary results value index");
+        }
+        r[column] = values[cell - 1];
+      } else {
+        if (cell - 1 > payload.size() - pos) {
+          return Status(1, "Invalid binary results value");
+        }
+        r[column].assign(payload, pos, cell - 1);
+        pos += cell - 1;
+      }
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status deserializeQueryDataBinary(const std::string& raw, QueryData& qd) {
+  if (raw.empty() || raw[0] != kBinaryResultsMagic) {
+    // Results stored before the binary encoding are JSON.
+    return deserializeQueryDataJSON(raw, qd);
+  }
+
+  if (raw.size() < kBinaryResultsHeaderSize) {
+    return Status(1, "Truncated binary results");
+  }
+
+  auto version = (byte)raw[1];
+  if (version != kBinaryResultsVersion && version != kBinaryColumnarVersion) {
+    return Status(1, "Unknown binary results version");
+  }
+
+  std::string uncompressed;
+  std::string payload;
+  if ((byte)raw[2] & kBinaryResultsCompressed) {
+    if (!snappy::Uncompress(raw.data() + kBinaryResultsHeaderSize,
+                            raw.size() - kBinaryResultsHeaderSize,
+                            &uncompressed)) {
+      return Status(1, "Cannot decompress binary results");
+    }
+    payload.swap(uncompressed);
+  } else {
+    payload = raw.substr(kBinaryResultsHeaderSize);
+  }
+
+  size_t pos = 0;
+  uint64_t count = 0;
+  if (!getVarint(payload, pos, count) || count > payload.size()) {
+    return Status(1, "Invalid binary results column dictionary");
+  }
+
+  std::vector<std::string> columns(count);
+  for (auto& column : columns) {
+    if (!getString(payload, pos, column)) {
+      return Status(1, "Invalid binary results column name");
+    }
+  }
+
+  if (version == kBinaryColumnarVersion) {
+    return deserializeColumnar(payload, pos, columns, qd);
+  }
+
+  if (!getVarint(payload, pos, count) || count > payload.size()) {
+    return Status(1, "Invalid binary results row count");
+  }
+
+  qd.reserve(qd.size() + count);
+  for (uint64_t i = 0; i < count; ++i) {
+    uint64_t size = 0;
+    if (!getVarint(payload, pos, size)) {
+      return Status(1, "Invalid binary results row");
+    }
+
+    Row r;
+    for (uint64_t j = 0; j < size; ++j) {
+      uint64_t column = 0;
+      if (!getVarint(payload, pos, column) || column >= columns.size()) {
+        return Status(1, "Invalid binary results column index");
+      }
+      if (!getString(payload, pos, r[columns[column]])) {
+        return Status(1, "Invalid binary results value");
+      }
+    }
+    qd.push_back(std::move(r));
+  }
   return Status(0, "OK");
 }
 
@@ -151,15 +588,249 @@ Status deserializeQueryData(const pt::ptree& tree, QueryData& qd) {
 }
 
 Status deserializeQueryDataJSON(const std::string& json, QueryData& qd) {
-  pt::ptree tree;
-  try {
-    std::stringstream input;
-    input << json;
-    pt::read_json(input, tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    return Status(1, e.what());
+  QueryData rows;
+  RowJSONHandler handler(rows, 2);
+  auto status = parseJSON(json, handler);
+  if (!status.ok()) {
+    return status;
+  }
+
+  qd.reserve(qd.size() + rows.size());
+  for (auto& r : rows) {
+    qd.push_back(std::move(r));
+  }
+  return Status(0, "OK");
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// ResultSet - a result set with an interned column schema and values stored
+// in a single arena
+/////////////////////////////////////////////////////////////////////////////
+
+/// Interned schemas, released when no ResultSet uses them.
+static std::map<std::vector<std::string>, std::weak_ptr<const ColumnSchema>>
+    kColumnSchemas;
+
+/// Protects the interned schemas.
+static std::mutex kColumnSchemasMutex;
+
+ColumnSchema::ColumnSchema(const std::vector<std::string>& columns)
+    : columns_(columns) {
+  for (size_t i = 0; i < columns_.size(); ++i) {
+    sorted_.push_back(i);
+  }
+  std::stable_sort(sorted_.begin(), sorted_.end(), [this](size_t a, size_t b) {
+    return columns_[a] < columns_[b];
+  });
+}
+
+ColumnSchemaRef ColumnSchema::get(const std::vector<std::string>& columns) {
+  std::lock_guard<std::mutex> lock(kColumnSchemasMutex);
+  auto it = kColumnSchemas.find(columns);
+  if (it != kColumnSchemas.end()) {
+    auto schema = it->second.lock();
+    if (schema != nullptr) {
+      return schema;
+    }
+  }
+
+  // Drop schemas of queries that no longer exist before adding a new one.
+  for (auto expired = kColumnSchemas.begin();
+       expired != kColumnSchemas.end();) {
+    if (expired->second.expired()) {
+      expired = kColumnSchemas.erase(expired);
+    } else {
+      ++expired;
+    }
+  }
+
+  ColumnSchemaRef schema(new ColumnSchema(columns));
+  kColumnSchemas[columns] = schema;
+  return schema;
+}
+
+bool ColumnSchema::index(const std::string& name, size_t& column) const {
+  auto it = std::lower_bound(sorted_.begin(),
+                             sorted_.end(),
+                             name,
+                             [this](size_t a, const std::string& b) {
+                               return columns_[a] < b;
+                             });
+  if (it == sorted_.end() || columns_[*it] != name) {
+    return false;
+  }
+  column = *it;
+  return true;
+}
+
+bool ResultValue::operator==(const ResultValue& comp) const {
+  return size == comp.size &&
+         (size == 0 || std::equal(data, data + size, comp.data));
+}
+
+ResultSet ResultSet::fromQueryData(const QueryData& qd) {
+  std::set<std::string> columns;
+  for (const auto& r : qd) {
+    for (const auto& i : r) {
+      columns.insert(i.first);
+    }
+  }
+
+  ResultSet rs(ColumnSchema::get({columns.begin(), columns.end()}));
+  for (const auto& r : qd) {
+    rs.append(r);
+  }
+  return rs;
+}
+
+void ResultSet::reset(ColumnSchemaRef schema) {
+  schema_ = std::move(schema);
+  cells_.clear();
+  arena_.clear();
+}
+
+size_t ResultSet::addRow() {
+  cells_.resize(cells_.size() + columns(), Cell{kAbsent, 0});
+  return rows() - 1;
+}
+
+void ResultSet::setValue(size_t column, const char* data, size_t size) {
+  auto& cell = cells_[cells_.size() - columns() + column];
+  cell.offset = arena_.size();
+  cell.size = size;
+  arena_.append(data, size);
+}
+
+void ResultSet::append(const Row& r) {
+  addRow();
+  size_t column = 0;
+  for (const auto& i : r) {
+    if (schema_->index(i.first, column)) {
+      setValue(column, i.second);
+    }
+  }
+}
+
+ResultValue ResultSet::value(size_t row, size_t column) const {
+  const auto& cell = cells_[row * columns() + column];
+  if (cell.offset == kAbsent) {
+    return ResultValue{arena_.data(), 0};
+  }
+  return ResultValue{arena_.data() + cell.offset, cell.size};
+}
+
+Row ResultSet::toRow(size_t row) const {
+  Row r;
+  for (size_t i = 0; i < columns(); ++i) {
+    if (hasValue(row, i)) {
+      auto v = value(row, i);
+      r[schema_->name(i)].assign(v.data, v.size);
+    }
+  }
+  return r;
+}
+
+QueryData ResultSet::toQueryData() const {
+  QueryData qd;
+  qd.reserve(rows());
+  for (size_t i = 0; i < rows(); ++i) {
+    qd.push_back(toRow(i));
+  }
+  return qd;
+}
+
+bool QueryDataSink::begin(const ColumnSchemaRef& schema) {
+  schema_ = schema;
+  return true;
+}
+
+void QueryDataSink::row(const ResultValue* values) {
+  // Columns are inserted in name order, each at the end of the Row.
+  Row r;
+  for (auto column : schema_->sorted()) {
+    r.emplace_hint(r.end(),
+                   schema_->name(column),
+                   std::string(values[column].data, values[column].size));
+    bytes_ += values[column].size;
+  }
+  results_.push_back(std::move(r));
+}
+
+bool ResultSetSink::begin(const ColumnSchemaRef& schema) {
+  if (results_.schema() == nullptr || results_.rows() == 0) {
+    results_.reset(schema);
+    return true;
+  }
+  return results_.schema() == schema;
+}
+
+void ResultSetSink::row(const ResultValue* values) {
+  results_.addRow();
+  for (size_t i = 0; i < results_.columns(); ++i) {
+    results_.setValue(i, values[i].data, values[i].size);
+  }
+}
+
+void sendResultSet(const ResultSet& rs, ResultSink& sink) {
+  if (rs.schema() == nullptr || !sink.begin(rs.schema())) {
+    return;
+  }
+
+  std::vector<ResultValue> values(rs.columns());
+  for (size_t row = 0; row < rs.rows(); ++row) {
+    for (size_t i = 0; i < rs.columns(); ++i) {
+      values[i] = rs.value(row, i);
+    }
+    sink.row(values.data());
+  }
+}
+
+Status serializeResultSetBinary(const ResultSet& rs, std::string& raw) {
+  if (rs.schema() == nullptr) {
+    return serializeQueryDataBinary({}, raw);
+  }
+
+  // The dictionary has the columns present in any row, ordered by name.
+  std::vector<size_t> dictionary(rs.columns(), 0);
+  std::vector<bool> present(rs.columns(), false);
+  for (size_t row = 0; row < rs.rows(); ++row) {
+    for (size_t i = 0; i < rs.columns(); ++i) {
+      if (rs.hasValue(row, i)) {
+        present[i] = true;
+      }
+    }
+  }
+
+  std::string payload;
+  putVarint(payload, std::count(present.begin(), present.end(), true));
+  size_t index = 0;
+  for (auto column : rs.schema()->sorted()) {
+    if (present[column]) {
+      dictionary[column] = index++;
+      const auto& name = rs.schema()->name(column);
+      putVarint(payload, name.size());
+      payload.append(name);
+    }
+  }
+
+  putVarint(payload, rs.rows());
+  for (size_t row = 0; row < rs.rows(); ++row) {
+    size_t size = 0;
+    for (size_t i = 0; i < rs.columns(); ++i) {
+      size += (rs.hasValue(row, i)) ? 1 : 0;
+    }
+
+    putVarint(payload, size);
+    for (auto column : rs.schema()->sorted()) {
+      if (rs.hasValue(row, column)) {
+        auto value = rs.value(row, column);
+        putVarint(payload, dictionary[column]);
+        putVarint(payload, value.size);
+        payload.append(value.data, value.size);
+      }
+    }
   }
-  return deserializeQueryData(tree, qd);
+  return finishBinaryResults(payload, raw);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -182,6 +853,15 @@ Status serializeDiffResults(const DiffResults& d, pt::ptree& tree) {
     return status;
   }
   tree.add_child("removed", removed);
+
+  if (!d.changed.empty()) {
+    pt::ptree changed;
+    status = serializeQueryData(d.changed, changed);
+    if (!status.ok()) {
+      return status;
+    }
+    tree.add_child("changed", changed);
+  }
   return Status(0, "OK");
 }
 
@@ -199,42 +879,268 @@ Status deserializeDiffResults(const pt::ptree& tree, DiffResults& dr) {
       return status;
     }
   }
+
+  if (tree.count("changed") > 0) {
+    auto status = deserializeQueryData(tree.get_child("changed"), dr.changed);
+    if (!status.ok()) {
+      return status;
+    }
+  }
   return Status(0, "OK");
 }
 
+/// Write DiffResults as serializeDiffResults would be written.
+static void writeDiffResultsJSON(JSONWriter& writer, const DiffResults& d) {
+  writer.startObject();
+  writer.key("added");
+  writeQueryDataJSON(writer, d.added);
+  writer.key("removed");
+  writeQueryDataJSON(writer, d.removed);
+  if (!d.changed.empty()) {
+    writer.key("changed");
+    writeQueryDataJSON(writer, d.changed);
+  }
+  writer.endObject();
+}
+
 Status serializeDiffResultsJSON(const DiffResults& d, std::string& json) {
-  pt::ptree tree;
-  auto status = serializeDiffResults(d, tree);
-  if (!status.ok()) {
-    return status;
+  json.clear();
+  JSONWriter writer(json);
+  writeDiffResultsJSON(writer, d);
+  writer.endDocument();
+  return Status(0, "OK");
+}
+
+/// FNV-1a 64-bit parameters.
+const RowFingerprint kFingerprintBasis = 14695981039346656037ULL;
+const RowFingerprint kFingerprintPrime = 1099511628211ULL;
+
+inline void fingerprintBytes(RowFingerprint& fp, const char* data, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    fp ^= (unsigned char)data[i];
+    fp *= kFingerprintPrime;
+  }
+}
+
+inline void fingerprintString(RowFingerprint& fp, const std::string& s) {
+  uint64_t size = s.size();
+  fingerprintBytes(fp, (const char*)&size, sizeof(size));
+  fingerprintBytes(fp, s.data(), s.size());
+}
+
+RowFingerprint fingerprintRow(const Row& r) {
+  RowFingerprint fp = kFingerprintBasis;
+  for (const auto& column : r) {
+    fingerprintString(fp, column.first);
+    fingerprintString(fp, column.second);
+  }
+  return fp;
+}
+
+QueryDataFingerprints fingerprintQueryData(const QueryData& qd) {
+  QueryDataFingerprints fps;
+  fps.reserve(qd.size());
+  for (const auto& r : qd) {
+    fps.push_back(fingerprintRow(r));
+  }
+  return fps;
+}
+
+QueryDataFingerprints fingerprintResultSet(const ResultSet& rs) {
+  QueryDataFingerprints fps;
+  fps.reserve(rs.rows());
+  for (size_t row = 0; row < rs.rows(); ++row) {
+    // Equivalent to fingerprintString of the column name and value.
+    RowFingerprint fp = kFingerprintBasis;
+    for (auto column : rs.schema()->sorted()) {
+      if (rs.hasValue(row, column)) {
+        auto value = rs.value(row, column);
+        fingerprintString(fp, rs.schema()->name(column));
+        uint64_t size = value.size;
+        fingerprintBytes(fp, (const char*)&size, sizeof(size));
+        fingerprintBytes(fp, value.data, value.size);
+      }
+    }
+    fps.push_back(fp);
+  }
+  return fps;
+}
+
+std::string serializeFingerprints(const QueryDataFingerprints& fps) {
+  std::string raw;
+  raw.reserve(fps.size() * sizeof(RowFingerprint));
+  for (const auto& fp : fps) {
+    // Store little-endian regardless of the host.
+    for (size_t i = 0; i < sizeof(RowFingerprint); ++i) {
+      raw.push_back((char)((fp >> (i * 8)) & 0xff));
+    }
+  }
+  return raw;
+}
+
+Status deserializeFingerprints(const std::string& raw,
+                               QueryDataFingerprints& fps) {
+  if (raw.size() % sizeof(RowFingerprint) != 0) {
+    return Status(1, "Invalid fingerprint data");
   }
 
-  std::ostringstream output;
-  pt::write_json(output, tree, false);
-  json = output.str();
+  fps.clear();
+  fps.reserve(raw.size() / sizeof(RowFingerprint));
+  for (size_t pos = 0; pos < raw.size(); pos += sizeof(RowFingerprint)) {
+    RowFingerprint fp = 0;
+    for (size_t i = 0; i < sizeof(RowFingerprint); ++i) {
+      fp |= (RowFingerprint)(unsigned char)raw[pos + i] << (i * 8);
+    }
+    fps.push_back(fp);
+  }
   return Status(0, "OK");
 }
 
 DiffResults diff(const QueryData& old, const QueryData& current) {
+  return diff(
+      old, fingerprintQueryData(old), current, fingerprintQueryData(current));
+}
+
+DiffResults diff(const QueryData& old,
+                 const QueryDataFingerprints& old_fps,
+                 const QueryData& current,
+                 const QueryDataFingerprints& current_fps) {
   DiffResults r;
-  QueryData overlap;
 
-  for (const auto& i : current) {
-    auto item = std::find(old.begin(), old.end(), i);
-    if (item != old.end()) {
-      overlap.push_back(i);
-    } else {
-      r.added.push_back(i);
+  // Index the old rows by fingerprint, collisions are resolved by value.
+  // The index is scratch space, allocated from the query's arena if any.
+  ArenaUnorderedMap<RowFingerprint, ArenaVector<size_t>> index;
+  index.reserve(old.size());
+  for (size_t i = 0; i < old.size(); ++i) {
+    index[old_fps[i]].push_back(i);
+  }
+
+  // A current row that exists in the old results is not "added", each match
+  // also consumes one equal old row so it is not "removed".
+  ArenaVector<bool> matched(old.size(), false);
+  for (size_t i = 0; i < current.size(); ++i) {
+    bool found = false;
+    auto bucket = index.find(current_fps[i]);
+    if (bucket != index.end()) {
+      for (const auto& j : bucket->second) {
+        if (old[j] != current[i]) {
+          continue;
+        }
+        found = true;
+        if (!matched[j]) {
+          matched[j] = true;
+          break;
+        }
+      }
+    }
+
+    if (!found) {
+      r.added.push_back(current[i]);
+    }
+  }
+
+  for (size_t i = 0; i < old.size(); ++i) {
+    if (!matched[i]) {
+      r.removed.push_back(old[i]);
     }
   }
+  return r;
+}
+
+/// Join the values of a row's key columns, false if a key column is missing.
+static bool getRowKey(const Row& r,
+                      const std::vector<std::string>& keys,
+                      std::string& key) {
+  key.clear();
+  for (const auto& column : keys) {
+    auto value = r.find(column);
+    if (value == r.end()) {
+      return false;
+    }
+    key.append(value->second);
+    key.push_back('\0');
+  }
+  return true;
+}
+
+/// Index rows by key, rows with a missing or repeated key are not indexed.
+static void indexRowKeys(const QueryData& q,
+                         const std::vector<std::string>& keys,
+                         std::unordered_map<std::string, size_t>& index) {
+  std::set<std::string> repeated;
+  std::string key;
+  for (size_t i = 0; i < q.size(); ++i) {
+    if (!getRowKey(q[i], keys, key)) {
+      continue;
+    }
+    if (!index.emplace(key, i).second) {
+      repeated.insert(key);
+    }
+  }
+  for (const auto& key : repeated) {
+    index.erase(key);
+  }
+}
 
-  std::multiset<Row> overlap_set(overlap.begin(), overlap.end());
-  std::multiset<Row> old_set(old.begin(), old.end());
-  std::set_difference(old_set.begin(),
-                      old_set.end(),
-                      overlap_set.begin(),
-                      overlap_set.end(),
-                      std::back_inserter(r.removed));
+DiffResults diff(const QueryData& old,
+                 const QueryDataFingerprints& old_fps,
+                 const QueryData& current,
+                 const QueryDataFingerprints& current_fps,
+                 const std::vector<std::string>& keys) {
+  auto r = diff(old, old_fps, current, current_fps);
+  if (keys.empty() || r.added.empty() || r.removed.empty()) {
+    return r;
+  }
+
+  // Only rows that changed are matched by key, a key must identify one row.
+  std::unordered_map<std::string, size_t> removed_keys;
+  std::unordered_map<std::string, size_t> added_keys;
+  indexRowKeys(r.removed, keys, removed_keys);
+  indexRowKeys(r.added, keys, added_keys);
+
+  std::vector<bool> removed_matched(r.removed.size(), false);
+  for (const auto& key : added_keys) {
+    auto removed = removed_keys.find(key.first);
+    if (removed == removed_keys.end()) {
+      continue;
+    }
+
+    // The changed row has the key columns and the changed values.
+    const auto& before = r.removed[removed->second];
+    auto& after = r.added[key.second];
+    Row changed;
+    for (auto& column : after) {
+      auto previous = before.find(column.first);
+      if (previous == before.end() || previous->second != column.second ||
+          std::find(keys.begin(), keys.end(), column.first) != keys.end()) {
+        changed[column.first] = column.second;
+      }
+    }
+    r.changed.push_back(std::move(changed));
+    removed_matched[removed->second] = true;
+    after.clear();
+  }
+
+  if (r.changed.empty()) {
+    return r;
+  }
+
+  // Remove the matched rows, keeping the order of the remaining rows.
+  size_t kept = 0;
+  for (size_t i = 0; i < r.removed.size(); ++i) {
+    if (removed_matched[i]) {
+      continue;
+    }
+    if (kept != i) {
+      r.removed[kept] = std::move(r.removed[i]);
+    }
+    kept++;
+  }
+  r.removed.resize(kept);
+  r.added.erase(std::remove_if(r.added.begin(),
+                               r.added.end(),
+                               [](const Row& row) { return row.empty(); }),
+                r.added.end());
   return r;
 }
 
@@ -245,7 +1151,7 @@ DiffResults diff(const QueryData& old, const QueryData& current) {
 
 Status serializeQueryLogItem(const QueryLogItem& i, pt::ptree& tree) {
   pt::ptree results_tree;
-  if (i.results.added.size() > 0 || i.results.removed.size() > 0) {
+  if (!i.results.empty()) {
     auto status = serializeDiffResults(i.results, results_tree);
     if (!status.ok()) {
       return status;
@@ -266,16 +1172,33 @@ Status serializeQueryLogItem(const QueryLogItem& i, pt::ptree& tree) {
   return Status(0, "OK");
 }
 
+/// Write the members describing the query of a log item.
+static void writeQueryLogItemMetadata(JSONWriter& writer,
+                                      const QueryLogItem& i) {
+  writer.key("name");
+  writer.value(i.name);
+  writer.key("hostIdentifier");
+  writer.value(i.identifier);
+  writer.key("calendarTime");
+  writer.value(i.calendar_time);
+  writer.key("unixTime");
+  writer.value(std::to_string((int)i.time));
+}
+
 Status serializeQueryLogItemJSON(const QueryLogItem& i, std::string& json) {
-  pt::ptree tree;
-  auto status = serializeQueryLogItem(i, tree);
-  if (!status.ok()) {
-    return status;
+  json.clear();
+  JSONWriter writer(json);
+  writer.startObject();
+  if (!i.results.empty()) {
+    writer.key("diffResults");
+    writeDiffResultsJSON(writer, i.results);
+  } else {
+    writer.key("snapshot");
+    writeQueryDataJSON(writer, i.snapshot_results);
   }
-
-  std::ostringstream output;
-  pt::write_json(output, tree, false);
-  json = output.str();
+  writeQueryLogItemMetadata(writer, i);
+  writer.endObject();
+  writer.endDocument();
   return Status(0, "OK");
 }
 
@@ -304,12 +1227,9 @@ Status deserializeQueryLogItem(const pt::ptree& tree, QueryLogItem& item) {
 Status deserializeQueryLogItemJSON(const std::string& json,
                                    QueryLogItem& item) {
   pt::ptree tree;
-  try {
-    std::stringstream input;
-    input << json;
-    pt::read_json(input, tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    return Status(1, e.what());
+  auto status = readPtreeJSON(json, tree);
+  if (!status.ok()) {
+    return status;
   }
   return deserializeQueryLogItem(tree, item);
 }
@@ -352,18 +1272,209 @@ Status serializeQueryLogItemAsEvents(const QueryLogItem& i, pt::ptree& tree) {
 
 Status serializeQueryLogItemAsEventsJSON(const QueryLogItem& i,
                                          std::string& json) {
+  json.clear();
+  JSONWriter writer(json);
+  for (const auto& action : {std::make_pair("added", &i.results.added),
+                             std::make_pair("removed", &i.results.removed),
+                             std::make_pair("changed", &i.results.changed)}) {
+    for (const auto& r : *action.second) {
+      // Each event is a separate document, as serializeEvent would write it.
+      writer.startObject();
+      writeQueryLogItemMetadata(writer, i);
+      writer.key("columns");
+      writeRowJSON(writer, r, true);
+      writer.key("action");
+      writer.value(action.first, strlen(action.first));
+      writer.endObject();
+      writer.endDocument();
+    }
+  }
+  return Status(0, "OK");
+}
+
+/// Check if a row has exactly the given (sorted) columns.
+static bool hasColumns(const Row& r, const std::vector<std::string>& columns) {
+  if (r.size() != columns.size()) {
+    return false;
+  }
+  size_t index = 0;
+  for (const auto& column : r) {
+    if (column.first != columns[index++]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Write rows as lists of values, or objects of values changed from the
+/// previous row.
+static void writeColumnarRowsJSON(JSONWriter& writer,
+                                  const QueryData& q,
+                                  const std::vector<std::string>& columns,
+                                  bool delta) {
+  static const std::string kEmpty;
+
+  writer.startArray();
+  std::vector<const std::string*> previous;
+  std::vector<const std::string*> values(columns.size());
+  for (const auto& r : q) {
+    for (size_t i = 0; i < columns.size(); ++i) {
+      auto value = r.find(columns[i]);
+      values[i] = (value != r.end()) ? &value->second : &kEmpty;
+    }
+
+    if (!delta || previous.empty()) {
+      writer.startArray();
+      for (const auto& value : values) {
+        writer.value(*value);
+      }
+      writer.endArray();
+    } else {
+      writer.startObject();
+      for (size_t i = 0; i < columns.size(); ++i) {
+        if (*values[i] != *previous[i]) {
+          writer.key(std::to_string(i));
+          writer.value(*values[i]);
+        }
+      }
+      writer.endObject();
+    }
+    previous.swap(values);
+    values.resize(columns.size());
+  }
+  writer.endArray();
+}
+
+/// Write rows as objects of their values by column index.
+static void writeSparseColumnarRowsJSON(
+    JSONWriter& writer,
+    const QueryData& q,
+    const std::vector<std::string>& columns) {
+  writer.startArray();
+  for (const auto& r : q) {
+    writer.startObject();
+    for (size_t i = 0; i < columns.size(); ++i) {
+      auto value = r.find(columns[i]);
+      if (value != r.end()) {
+        writer.key(std::to_string(i));
+        writer.value(value->second);
+      }
+    }
+    writer.endObject();
+  }
+  writer.endArray();
+}
+
+Status serializeQueryLogItemAsColumnsJSON(const QueryLogItem& i,
+                                          std::string& json,
+                                          bool delta) {
+  // Rows of a query have the same columns, others are merged in.
+  std::vector<std::string> columns;
+  for (const auto& rows :
+       {&i.results.added, &i.results.removed, &i.results.changed}) {
+    for (const auto& r : *rows) {
+      if (hasColumns(r, columns)) {
+        continue;
+      }
+      std::set<std::string> merged(columns.begin(), columns.end());
+      for (const auto& column : r) {
+        merged.insert(column.first);
+      }
+      columns.assign(merged.begin(), merged.end());
+    }
+  }
+
+  json.clear();
+  JSONWriter writer(json);
+  writer.startObject();
+  writeQueryLogItemMetadata(writer, i);
+  writer.key("columns");
+  writer.startArray();
+  for (const auto& column : columns) {
+    writer.value(column);
+  }
+  writer.endArray();
+  writer.key("added");
+  writeColumnarRowsJSON(writer, i.results.added, columns, delta);
+  writer.key("removed");
+  writeColumnarRowsJSON(writer, i.results.removed, columns, delta);
+  if (!i.results.changed.empty()) {
+    // Changed rows only have their key and changed columns.
+    writer.key("changed");
+    writeSparseColumnarRowsJSON(writer, i.results.changed, columns);
+  }
+  writer.endObject();
+  writer.endDocument();
+  return Status(0, "OK");
+}
+
+/// Read rows written by writeColumnarRowsJSON or writeSparseColumnarRowsJSON.
+static Status readColumnarRows(const pt::ptree& tree,
+                               const std::vector<std::string>& columns,
+                               QueryData& q,
+                               bool sparse = false) {
+  Row previous;
+  for (const auto& row : tree) {
+    Row r;
+    if (!row.second.empty() && row.second.front().first.empty()) {
+      // A list of every value in column order.
+      if (row.second.size() != columns.size()) {
+        return Status(1, "Columnar row does not match the columns");
+      }
+      size_t index = 0;
+      for (const auto& value : row.second) {
+        r[columns[index++]] = value.second.data();
+      }
+    } else {
+      // The values changed from the previous row, by column index.
+      if (!sparse) {
+        r = previous;
+      }
+      for (const auto& value : row.second) {
+        auto index = std::strtoul(value.first.c_str(), nullptr, 10);
+        if (index >= columns.size()) {
+          return Status(1, "Columnar row does not match the columns");
+        }
+        r[columns[index]] = value.second.data();
+      }
+    }
+    q.push_back(r);
+    previous = std::move(r);
+  }
+  return Status(0, "OK");
+}
+
+Status deserializeQueryLogItemColumnsJSON(const std::string& json,
+                                          QueryLogItem& item) {
   pt::ptree tree;
-  auto status = serializeQueryLogItemAsEvents(i, tree);
+  auto status = readPtreeJSON(json, tree);
   if (!status.ok()) {
     return status;
   }
 
-  std::ostringstream output;
-  for (auto& event : tree) {
-    pt::write_json(output, event.second, false);
+  std::vector<std::string> columns;
+  for (const auto& column : tree.get_child("columns", pt::ptree())) {
+    columns.push_back(column.second.data());
   }
-  json = output.str();
-  return Status(0, "OK");
+
+  status = readColumnarRows(
+      tree.get_child("added", pt::ptree()), columns, item.results.added);
+  if (status.ok()) {
+    status = readColumnarRows(
+        tree.get_child("removed", pt::ptree()), columns, item.results.removed);
+  }
+  if (status.ok()) {
+    status = readColumnarRows(tree.get_child("changed", pt::ptree()),
+                              columns,
+                              item.results.changed,
+                              true);
+  }
+
+  item.name = tree.get<std::string>("name", "");
+  item.identifier = tree.get<std::string>("hostIdentifier", "");
+  item.calendar_time = tree.get<std::string>("calendarTime", "");
+  item.time = tree.get<int>("unixTime", 0);
+  return status;
 }
 
 bool addUniqueRowToQueryData(QueryData& q, const Row& r) {
@@ -374,6 +1485,39 @@ bool addUniqueRowToQueryData(QueryData& q, const Row& r) {
   return true;
 }
 
+Status DatabasePlugin::scan(const std::string& domain,
+                            std::vector<std::string>& results,
+                            const std::string& prefix,
+                            size_t max) const {
+  std::vector<std::string> keys;
+  auto status = this->scan(domain, keys);
+  for (const auto& key : keys) {
+    if (max > 0 && results.size() >= max) {
+      break;
+    }
+    if (key.compare(0, prefix.size(), prefix) == 0) {
+      results.push_back(key);
+    }
+  }
+  return status;
+}
+
+Status DatabasePlugin::write(const DatabaseBatch& batch) {
+  for (const auto& op : batch.operations()) {
+    auto status = (op.remove) ? this->remove(op.domain, op.key)
+                              : this->put(op.domain, op.key, op.value);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return Status(0, "OK");
+}
+
+/// Batches are flattened into a request using indexed keys.
+inline std::string batchKey(const std::string& field, size_t i) {
+  return field + "." + std::to_string(i);
+}
+
 Status DatabasePlugin::call(const PluginRequest& request,
                             PluginResponse& response) {
   if (request.count("action") == 0) {
@@ -399,19 +1543,69 @@ Status DatabasePlugin::call(const PluginRequest& request,
     return this->remove(domain, key);
   } else if (request.at("action") == "scan") {
     std::vector<std::string> keys;
-    auto status = this->scan(domain, keys);
+    Status status;
+    if (request.count("prefix") > 0 || request.count("max") > 0) {
+      size_t max = 0;
+      try {
+        max = (request.count("max") > 0)
+                  ? boost::lexical_cast<size_t>(request.at("max"))
+                  : 0;
+      } catch (const boost::bad_lexical_cast& e) {
+        return Status(1, "Database plugin scan max is invalid");
+      }
+      auto prefix = (request.count("prefix") > 0) ? request.at("prefix") : "";
+      status = this->scan(domain, keys, prefix, max);
+    } else {
+      status = this->scan(domain, keys);
+    }
     for (const auto& key : keys) {
       response.push_back({{"k", key}});
     }
     return status;
+  } else if (request.at("action") == "batch") {
+    size_t count = 0;
+    try {
+      count = boost::lexical_cast<size_t>(request.at("count"));
+    } catch (const std::exception& e) {
+      return Status(1, "Database plugin batch action requires a count");
+    }
+
+    DatabaseBatch batch;
+    for (size_t i = 0; i < count; ++i) {
+      auto op = request.find(batchKey("op", i));
+      auto op_domain = request.find(batchKey("domain", i));
+      auto op_key = request.find(batchKey("key", i));
+      if (op == request.end() || op_domain == request.end() ||
+          op_key == request.end()) {
+        return Status(1, "Database plugin batch operation is incomplete");
+      }
+
+      if (op->second == "remove") {
+        batch.remove(op_domain->second, op_key->second);
+      } else {
+        auto op_value = request.find(batchKey("value", i));
+        batch.put(op_domain->second,
+                  op_key->second,
+                  (op_value != request.end()) ? op_value->second : "");
+      }
+    }
+    return this->write(batch);
   }
 
   return Status(1, "Unknown database plugin action");
 }
 
+/// Latencies, in microseconds, of calls to the active database plugin.
+static MetricHistogram kDatabaseGetLatency("database.get");
+static MetricHistogram kDatabasePutLatency("database.put");
+static MetricHistogram kDatabaseRemoveLatency("database.remove");
+static MetricHistogram kDatabaseScanLatency("database.scan");
+static MetricHistogram kDatabaseWriteLatency("database.write");
+
 Status getDatabaseValue(const std::string& domain,
                         const std::string& key,
                         std::string& value) {
+  MetricTimer timer(kDatabaseGetLatency);
   PluginRequest request = {{"action", "get"}, {"domain", domain}, {"key", key}};
   PluginResponse response;
   auto status = Registry::call("database", "rocks", request, response);
@@ -431,19 +1625,63 @@ Status getDatabaseValue(const std::string& domain,
 Status setDatabaseValue(const std::string& domain,
                         const std::string& key,
                         const std::string& value) {
+  MetricTimer timer(kDatabasePutLatency);
   PluginRequest request = {
       {"action", "put"}, {"domain", domain}, {"key", key}, {"value", value}};
   return Registry::call("database", "rocks", request);
 }
 
 Status deleteDatabaseValue(const std::string& domain, const std::string& key) {
+  MetricTimer timer(kDatabaseRemoveLatency);
   PluginRequest request = {
       {"action", "remove"}, {"domain", domain}, {"key", key}};
   return Registry::call("database", "rocks", request);
 }
 
+Status scanDatabaseKeys(const std::string& domain,
+                        std::vector<std::string>& keys,
+                        const std::string& prefix,
+                        size_t max) {
+  MetricTimer timer(kDatabaseScanLatency);
+  PluginRequest request = {{"action", "scan"},
+                           {"domain", domain},
+                           {"prefix", prefix},
+                           {"max", std::to_string(max)}};
+  PluginResponse response;
+  auto status = Registry::call("database", "rocks", request, response);
+
+  for (const auto& item : response) {
+    if (item.count("k") > 0) {
+      keys.push_back(item.at("k"));
+    }
+  }
+  return status;
+}
+
+Status writeDatabaseBatch(const DatabaseBatch& batch) {
+  if (batch.empty()) {
+    return Status(0, "OK");
+  }
+
+  MetricTimer timer(kDatabaseWriteLatency);
+  PluginRequest request = {{"action", "batch"},
+                           {"count", std::to_string(batch.size())}};
+  size_t i = 0;
+  for (const auto& op : batch.operations()) {
+    request[batchKey("op", i)] = (op.remove) ? "remove" : "put";
+    request[batchKey("domain", i)] = op.domain;
+    request[batchKey("key", i)] = op.key;
+    if (!op.remove) {
+      request[batchKey("value", i)] = op.value;
+    }
+    i++;
+  }
+  return Registry::call("database", "rocks", request);
+}
+
 Status scanDatabaseKeys(const std::string& domain,
                         std::vector<std::string>& keys) {
+  MetricTimer timer(kDatabaseScanLatency);
   PluginRequest request = {{"action", "scan"}, {"domain", domain}};
   PluginResponse response;
   auto status = Registry::call("database", "rocks", request, response);
@@ -9,20 +9,30 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <map>
 #include <mutex>
+#include <set>
 #include <stdexcept>
 
 #include <sys/stat.h>
 
+#include <rocksdb/cache.h>
 #include <rocksdb/env.h>
+#include <rocksdb/filter_policy.h>
 #include <rocksdb/options.h>
+#include <rocksdb/table.h>
+#include <rocksdb/write_batch.h>
 #include <snappy.h>
 
+#include <osquery/core.h>
 #include <osquery/database.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/status.h>
 
+#include "osquery/core/conversions.h"
+#include "osquery/core/tracing.h"
 #include "osquery/database/db_handle.h"
 
 namespace osquery {
@@ -45,6 +55,15 @@ class RocksDatabasePlugin : public DatabasePlugin {
   /// Key/index lookup method.
   Status scan(const std::string& domain,
               std::vector<std::string>& results) const;
+
+  /// Key/index lookup method, bounded by a prefix and count.
+  Status scan(const std::string& domain,
+              std::vector<std::string>& results,
+              const std::string& prefix,
+              size_t max) const;
+
+  /// Atomic batch write method.
+  Status write(const DatabaseBatch& batch);
 };
 
 /// Backing-storage provider for osquery internal/core.
@@ -56,7 +75,14 @@ REGISTER_INTERNAL(RocksDatabasePlugin, "database", "rocks");
 
 const std::string kPersistentSettings = "configurations";
 const std::string kQueries = "queries";
+const std::string kQueryFingerprints = "query_fingerprints";
+const std::string kQueryResults = "query_results";
+const std::string kQueryHistory = "query_history";
 const std::string kEvents = "events";
+const std::string kFileCache = "file_cache";
+const std::string kFileInventory = "file_inventory";
+const std::string kDistributed = "distributed";
+const std::string kDistributedResults = "distributed_results";
 const std::string kLogs = "logs";
 
 /**
@@ -68,7 +94,17 @@ const std::string kLogs = "logs";
  * database.
  */
 const std::vector<std::string> kDomains = {
-    kPersistentSettings, kQueries, kEvents, kLogs
+    kPersistentSettings,
+    kQueries,
+    kQueryFingerprints,
+    kQueryResults,
+    kQueryHistory,
+    kEvents,
+    kFileCache,
+    kFileInventory,
+    kDistributed,
+    kDistributedResults,
+    kLogs,
 };
 
 CLI_FLAG(string,
@@ -83,22 +119,391 @@ CLI_FLAG(bool,
          "Keep osquery backing-store in memory");
 FLAG_ALIAS(bool, use_in_memory_database, database_in_memory);
 
+CLI_FLAG(uint64,
+         database_block_cache_mb,
+         8,
+         "Size of the block cache shared by every backing-store domain (MB)");
+
+CLI_FLAG(uint64,
+         database_write_buffer_mb,
+         2,
+         "Backing-store memtable size for each domain (MB)");
+
+CLI_FLAG(int32,
+         database_bloom_bits,
+         10,
+         "Bloom filter bits per key for backing-store lookups, 0 to disable");
+
+CLI_FLAG(uint64,
+         database_max_wal_mb,
+         16,
+         "Flush backing-store memtables when the write-ahead log exceeds (MB)");
+
+CLI_FLAG(string,
+         database_logs_compaction,
+         "universal",
+         "Compaction style for buffered logs: level, universal, fifo");
+
+CLI_FLAG(uint64,
+         database_memory_limit_mb,
+         64,
+         "Evict oldest events when the in-memory backing-store exceeds (MB)");
+
+CLI_FLAG(uint64,
+         database_io_rate_mb,
+         16,
+         "Limit backing-store flush and compaction writes (MB/s), 0 to disable");
+
+/// Memtables are sized in these units.
+const size_t kDatabaseMB = 1024 * 1024;
+
+/// Buffered logs compacted FIFO are dropped beyond this size.
+const size_t kDatabaseLogsMaxSize = 64 * kDatabaseMB;
+
+/**
+ * @brief Build the RocksDB options profile for a domain
+ *
+ * Every domain shares one capped block cache. Domains with point lookups use
+ * bloom filters, the write-heavy events domain keeps more memtables, and the
+ * append-then-delete logs buffer avoids leveled compaction write
+ * amplification.
+ */
+static rocksdb::ColumnFamilyOptions getDomainOptions(
+    const std::string& domain, const std::shared_ptr<rocksdb::Cache>& cache) {
+  rocksdb::ColumnFamilyOptions options;
+  options.write_buffer_size = FLAGS_database_write_buffer_mb * kDatabaseMB;
+  options.max_write_buffer_number = 2;
+
+  rocksdb::BlockBasedTableOptions table_options;
+  table_options.block_cache = cache;
+  if (FLAGS_database_bloom_bits > 0 && domain != kLogs) {
+    table_options.filter_policy.reset(
+        rocksdb::NewBloomFilterPolicy(FLAGS_database_bloom_bits));
+  }
+
+  if (domain == kEvents) {
+    // Events are small, frequent, writes and time-ordered range deletes.
+    options.write_buffer_size *= 2;
+    options.max_write_buffer_number = 3;
+    options.level0_file_num_compaction_trigger = 4;
+  } else if (domain == kQueries) {
+    // Results are large blobs replaced on each execution, compact early to
+    // reclaim the space held by stale versions.
+    options.level0_file_num_compaction_trigger = 2;
+  } else if (domain == kLogs) {
+    if (FLAGS_database_logs_compaction == "fifo") {
+      options.compaction_style = rocksdb::kCompactionStyleFIFO;
+      options.compaction_options_fifo.max_table_files_size =
+          kDatabaseLogsMaxSize;
+    } else if (FLAGS_database_logs_compaction == "universal") {
+      options.compaction_style = rocksdb::kCompactionStyleUniversal;
+    }
+  } else {
+    // Settings, fingerprints, and cached file results are small key lookups.
+    options.write_buffer_size = kDatabaseMB;
+  }
+
+  options.table_factory.reset(
+      rocksdb::NewBlockBasedTableFactory(table_options));
+  return options;
+}
+
+/**
+ * @brief A native backing store used when RocksDB is not kept on disk.
+ *
+ * Each domain is an ordered map with its own lock, so prefix and range scans
+ * keep the same key ordering as RocksDB. Event records are tracked by time
+ * and the oldest are evicted when the store exceeds its memory limit.
+ */
+class MemoryDatabase : private boost::noncopyable {
+ public:
+  /// Create every domain, a limit of 0 disables eviction.
+  explicit MemoryDatabase(size_t limit);
+
+  bool hasDomain(const std::string& domain) const {
+    return domains_.count(domain) > 0;
+  }
+
+  Status get(const std::string& domain,
+             const std::string& key,
+             std::string& value);
+
+  Status put(const std::string& domain,
+             const std::string& key,
+             const std::string& value);
+
+  Status remove(const std::string& domain, const std::string& key);
+
+  /// Apply every operation while holding each domain's lock.
+  Status write(const DatabaseBatch& batch);
+
+  /// Remove every key from start, inclusive, to stop, exclusive.
+  Status removeRange(const std::string& domain,
+                     const std::string& start,
+                     const std::string& stop);
+
+  /// Visit keys from start while the key is before stop and has the prefix.
+  Status scan(const std::string& domain,
+              const std::string& start,
+              const std::string& stop,
+              const std::string& prefix,
+              std::vector<std::pair<std::string, std::string>>& results,
+              bool values,
+              size_t max);
+
+  /// The approximate number of bytes stored.
+  size_t size() const { return size_; }
+
+ private:
+  struct Domain {
+    std::mutex lock;
+    std::map<std::string, std::string> data;
+    /// Event record keys ordered by their time.
+    std::set<std::pair<std::string, std::string>> records;
+  };
+
+  /// Each operation requires a domain lock.
+  void putLocked(const std::string& domain,
+                 Domain& store,
+                 const std::string& key,
+                 const std::string& value);
+  void removeLocked(const std::string& domain,
+                    Domain& store,
+                    const std::string& key);
+
+  /// Remove the oldest event records until the store is within the limit.
+  void evict();
+
+ private:
+  std::map<std::string, std::unique_ptr<Domain>> domains_;
+  std::atomic<size_t> size_{0};
+  size_t limit_;
+};
+
+/// Keys removed by each write of a range delete.
+const size_t kDeleteRangeBatchSize = 4096;
+
+/// Deleted ranges remembered for each domain, more are merged into one.
+const size_t kMaxDeletedRanges = 64;
+
+/// Per-entry map overhead included in the size of the in-memory store.
+const size_t kMemoryEntryOverhead = 64;
+
+/// Convert a RocksDB status, success is not formatted into a message.
+static Status toStatus(const rocksdb::Status& s) {
+  if (s.ok()) {
+    return Status();
+  }
+  return Status(s.code(), s.ToString());
+}
+
+/**
+ * @brief Parse the time token from an event record key
+ *
+ * Record keys are event.<namespace>.<time>.<eid>, the time is the token
+ * before the last separator. Other keys in the events domain are not records.
+ */
+static std::string getRecordTime(const std::string& key) {
+  if (key.compare(0, 6, "event.") != 0) {
+    return "";
+  }
+  auto eid_sep = key.rfind('.');
+  if (eid_sep == std::string::npos || eid_sep <= 6) {
+    return "";
+  }
+  auto time_sep = key.rfind('.', eid_sep - 1);
+  if (time_sep == std::string::npos || time_sep < 6) {
+    return "";
+  }
+  return key.substr(time_sep + 1, eid_sep - time_sep - 1);
+}
+
+MemoryDatabase::MemoryDatabase(size_t limit) : limit_(limit) {
+  for (const auto& domain : kDomains) {
+    domains_[domain] = std::unique_ptr<Domain>(new Domain());
+  }
+}
+
+void MemoryDatabase::putLocked(const std::string& domain,
+                               Domain& store,
+                               const std::string& key,
+                               const std::string& value) {
+  auto it = store.data.find(key);
+  if (it != store.data.end()) {
+    size_ -= it->second.size();
+    it->second = value;
+    size_ += value.size();
+    return;
+  }
+
+  store.data[key] = value;
+  size_ += key.size() + value.size() + kMemoryEntryOverhead;
+  if (domain == kEvents) {
+    auto time = getRecordTime(key);
+    if (!time.empty()) {
+      store.records.insert(std::make_pair(time, key));
+    }
+  }
+}
+
+void MemoryDatabase::removeLocked(const std::string& domain,
+                                  Domain& store,
+                                  const std::string& key) {
+  auto it = store.data.find(key);
+  if (it == store.data.end()) {
+    return;
+  }
+
+  size_ -= key.size() + it->second.size() + kMemoryEntryOverhead;
+  store.data.erase(it);
+  if (domain == kEvents) {
+    store.records.erase(std::make_pair(getRecordTime(key), key));
+  }
+}
+
+Status MemoryDatabase::get(const std::string& domain,
+                           const std::string& key,
+                           std::string& value) {
+  auto& store = *domains_.at(domain);
+  std::lock_guard<std::mutex> lock(store.lock);
+  auto it = store.data.find(key);
+  if (it == store.data.end()) {
+    return Status(1, "NotFound: ");
+  }
+  value = it->second;
+  return Status(0, "OK");
+}
+
+Status MemoryDatabase::put(const std::string& domain,
+                           const std::string& key,
+                           const std::string& value) {
+  {
+    auto& store = *domains_.at(domain);
+    std::lock_guard<std::mutex> lock(store.lock);
+    putLocked(domain, store, key, value);
+  }
+  evict();
+  return Status(0, "OK");
+}
+
+Status MemoryDatabase::remove(const std::string& domain,
+                              const std::string& key) {
+  auto& store = *domains_.at(domain);
+  std::lock_guard<std::mutex> lock(store.lock);
+  removeLocked(domain, store, key);
+  return Status(0, "OK");
+}
+
+Status MemoryDatabase::removeRange(const std::string& domain,
+                                   const std::string& start,
+                                   const std::string& stop) {
+  auto& store = *domains_.at(domain);
+  std::lock_guard<std::mutex> lock(store.lock);
+  auto it = store.data.lower_bound(start);
+  while (it != store.data.end() && it->first < stop) {
+    auto key = (it++)->first;
+    removeLocked(domain, store, key);
+  }
+  return Status(0, "OK");
+}
+
+Status MemoryDatabase::write(const DatabaseBatch& batch) {
+  for (const auto& op : batch.operations()) {
+    if (!hasDomain(op.domain)) {
+      return Status(1, "Could not get column family for " + op.domain);
+    }
+  }
+
+  {
+    // Locks are always acquired in domain order.
+    std::vector<std::unique_lock<std::mutex>> locks;
+    for (auto& domain : domains_) {
+      locks.push_back(std::unique_lock<std::mutex>(domain.second->lock));
+    }
+
+    for (const auto& op : batch.operations()) {
+      auto& store = *domains_.at(op.domain);
+      if (op.remove) {
+        removeLocked(op.domain, store, op.key);
+      } else {
+        putLocked(op.domain, store, op.key, op.value);
+      }
+    }
+  }
+  evict();
+  return Status(0, "OK");
+}
+
+Status MemoryDatabase::scan(
+    const std::string& domain,
+    const std::string& start,
+    const std::string& stop,
+    const std::string& prefix,
+    std::vector<std::pair<std::string, std::string>>& results,
+    bool values,
+    size_t max) {
+  auto& store = *domains_.at(domain);
+  std::lock_guard<std::mutex> lock(store.lock);
+  size_t count = 0;
+  for (auto it = store.data.lower_bound(start); it != store.data.end(); ++it) {
+    if ((!stop.empty() && it->first >= stop) ||
+        it->first.compare(0, prefix.size(), prefix) != 0 ||
+        (max > 0 && count >= max)) {
+      break;
+    }
+    results.push_back(
+        std::make_pair(it->first, (values) ? it->second : ""));
+    count++;
+  }
+  return Status(0, "OK");
+}
+
+void MemoryDatabase::evict() {
+  if (limit_ == 0 || size_ <= limit_) {
+    return;
+  }
+
+  auto& store = *domains_.at(kEvents);
+  std::lock_guard<std::mutex> lock(store.lock);
+  size_t evicted = 0;
+  while (size_ > limit_ && !store.records.empty()) {
+    auto key = store.records.begin()->second;
+    removeLocked(kEvents, store, key);
+    evicted++;
+  }
+
+  if (evicted > 0) {
+    VLOG(1) << "Evicted " << evicted << " events from the in-memory database";
+  }
+}
+
 /////////////////////////////////////////////////////////////////////////////
 // constructors and destructors
 /////////////////////////////////////////////////////////////////////////////
 
-DBHandle::DBHandle(const std::string& path, bool in_memory) {
+DBHandle::DBHandle(const std::string& path, bool in_memory) : db_(nullptr) {
   options_.create_if_missing = true;
   options_.create_missing_column_families = true;
   options_.info_log_level = rocksdb::WARN_LEVEL;
   options_.log_file_time_to_roll = 0;
   options_.keep_log_file_num = 10;
   options_.max_log_file_size = 1024 * 1024 * 1;
+  // Keep background work and the write-ahead log bounded for endpoints.
+  options_.max_background_flushes = 1;
+  options_.max_background_compactions = 1;
+  options_.max_total_wal_size = FLAGS_database_max_wal_mb * kDatabaseMB;
+  if (FLAGS_database_io_rate_mb > 0) {
+    // Background writes are paced so they do not compete with event bursts.
+    options_.rate_limiter.reset(rocksdb::NewGenericRateLimiter(
+        FLAGS_database_io_rate_mb * kDatabaseMB));
+  }
 
   if (in_memory) {
-    // Remove when MemEnv is included in librocksdb
-    // options_.env = rocksdb::NewMemEnv(rocksdb::Env::Default());
-    throw std::runtime_error("Requires MemEnv");
+    // The bundled librocksdb does not include MemEnv, use a native store.
+    VLOG(1) << "Opening in-memory database handle";
+    memory_ = std::unique_ptr<MemoryDatabase>(
+        new MemoryDatabase(FLAGS_database_memory_limit_mb * kDatabaseMB));
+    return;
   }
 
   if (pathExists(path).ok() && !isWritable(path).ok()) {
@@ -108,9 +513,11 @@ DBHandle::DBHandle(const std::string& path, bool in_memory) {
   column_families_.push_back(rocksdb::ColumnFamilyDescriptor(
       rocksdb::kDefaultColumnFamilyName, rocksdb::ColumnFamilyOptions()));
 
+  auto cache =
+      rocksdb::NewLRUCache(FLAGS_database_block_cache_mb * kDatabaseMB);
   for (const auto& cf_name : kDomains) {
     column_families_.push_back(rocksdb::ColumnFamilyDescriptor(
-        cf_name, rocksdb::ColumnFamilyOptions()));
+        cf_name, getDomainOptions(cf_name, cache)));
   }
 
   VLOG(1) << "Opening RocksDB handle: " << path;
@@ -142,13 +549,48 @@ DBHandleRef DBHandle::getInstance() {
 
 bool DBHandle::checkDB() {
   try {
-    auto handle = DBHandle(FLAGS_database_path, FLAGS_database_in_memory);
+    DBHandle handle(FLAGS_database_path, FLAGS_database_in_memory);
   } catch (const std::exception& e) {
     return false;
   }
   return true;
 }
 
+Status DBHandle::getValuesAtPath(const std::string& path,
+                                 const std::string& domain,
+                                 const std::vector<std::string>& keys,
+                                 std::map<std::string, std::string>& values) {
+  auto cache = rocksdb::NewLRUCache(kDatabaseMB);
+  std::vector<rocksdb::ColumnFamilyDescriptor> families = {
+      rocksdb::ColumnFamilyDescriptor(rocksdb::kDefaultColumnFamilyName,
+                                      rocksdb::ColumnFamilyOptions()),
+      rocksdb::ColumnFamilyDescriptor(domain, getDomainOptions(domain, cache)),
+  };
+
+  rocksdb::Options options;
+  options.info_log_level = rocksdb::WARN_LEVEL;
+  rocksdb::DB* db = nullptr;
+  std::vector<rocksdb::ColumnFamilyHandle*> handles;
+  auto s =
+      rocksdb::DB::OpenForReadOnly(options, path, families, &handles, &db);
+  if (!s.ok()) {
+    return toStatus(s);
+  }
+
+  for (const auto& key : keys) {
+    std::string value;
+    if (db->Get(rocksdb::ReadOptions(), handles[1], key, &value).ok()) {
+      values[key] = std::move(value);
+    }
+  }
+
+  for (auto handle : handles) {
+    delete handle;
+  }
+  delete db;
+  return Status(0, "OK");
+}
+
 DBHandleRef DBHandle::getInstanceInMemory() {
   return getInstance("", true);
 }
@@ -170,14 +612,12 @@ rocksdb::DB* DBHandle::getDB() { return db_; }
 
 rocksdb::ColumnFamilyHandle* DBHandle::getHandleForColumnFamily(
     const std::string& cf) {
-  try {
-    for (int i = 0; i < kDomains.size(); i++) {
-      if (kDomains[i] == cf) {
-        return handles_[i];
-      }
+  // Handles follow the descriptors, the first is the default column family.
+  for (size_t i = 0; i < column_families_.size() && i < handles_.size(); i++) {
+    if (column_families_[i].name == cf &&
+        cf != rocksdb::kDefaultColumnFamilyName) {
+      return handles_[i];
     }
-  } catch (const std::exception& e) {
-    // pass through and return nullptr
   }
   return nullptr;
 }
@@ -189,36 +629,320 @@ rocksdb::ColumnFamilyHandle* DBHandle::getHandleForColumnFamily(
 Status DBHandle::Get(const std::string& domain,
                      const std::string& key,
                      std::string& value) {
+  if (memory_ != nullptr) {
+    if (!memory_->hasDomain(domain)) {
+      return Status(1, "Could not get column family for " + domain);
+    }
+    return memory_->get(domain, key, value);
+  }
+
   auto cfh = getHandleForColumnFamily(domain);
   if (cfh == nullptr) {
     return Status(1, "Could not get column family for " + domain);
   }
   auto s = getDB()->Get(rocksdb::ReadOptions(), cfh, key, &value);
-  return Status(s.code(), s.ToString());
+  return toStatus(s);
 }
 
 Status DBHandle::Put(const std::string& domain,
                      const std::string& key,
                      const std::string& value) {
+  TraceSpan span("database", "put", domain);
+  if (memory_ != nullptr) {
+    if (!memory_->hasDomain(domain)) {
+      return Status(1, "Could not get column family for " + domain);
+    }
+    return memory_->put(domain, key, value);
+  }
+
   auto cfh = getHandleForColumnFamily(domain);
   if (cfh == nullptr) {
     return Status(1, "Could not get column family for " + domain);
   }
   auto s = getDB()->Put(rocksdb::WriteOptions(), cfh, key, value);
-  return Status(s.code(), s.ToString());
+  return toStatus(s);
 }
 
 Status DBHandle::Delete(const std::string& domain, const std::string& key) {
+  TraceSpan span("database", "delete", domain);
+  if (memory_ != nullptr) {
+    if (!memory_->hasDomain(domain)) {
+      return Status(1, "Could not get column family for " + domain);
+    }
+    return memory_->remove(domain, key);
+  }
+
   auto cfh = getHandleForColumnFamily(domain);
   if (cfh == nullptr) {
     return Status(1, "Could not get column family for " + domain);
   }
   auto s = getDB()->Delete(rocksdb::WriteOptions(), cfh, key);
-  return Status(s.code(), s.ToString());
+  return toStatus(s);
+}
+
+Status DBHandle::Write(const DatabaseBatch& batch) {
+  TraceSpan span("database", "write");
+  if (memory_ != nullptr) {
+    return memory_->write(batch);
+  }
+
+  rocksdb::WriteBatch rocks_batch;
+  for (const auto& op : batch.operations()) {
+    auto cfh = getHandleForColumnFamily(op.domain);
+    if (cfh == nullptr) {
+      return Status(1, "Could not get column family for " + op.domain);
+    }
+
+    if (op.remove) {
+      rocks_batch.Delete(cfh, op.key);
+    } else {
+      rocks_batch.Put(cfh, op.key, op.value);
+    }
+  }
+
+  auto s = getDB()->Write(rocksdb::WriteOptions(), &rocks_batch);
+  return toStatus(s);
+}
+
+Status DBHandle::DeleteRange(const std::string& domain,
+                             const std::string& start,
+                             const std::string& stop) {
+  TraceSpan span("database", "deleteRange", domain);
+  if (memory_ != nullptr) {
+    if (!memory_->hasDomain(domain)) {
+      return Status(1, "Could not get column family for " + domain);
+    }
+    return memory_->removeRange(domain, start, stop);
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+
+  // Keys are visited without reading their values and removed in bounded
+  // batches, so a large range does not hold every key in memory.
+  rocksdb::ReadOptions options;
+  options.fill_cache = false;
+  auto it = getDB()->NewIterator(options, cfh);
+  if (it == nullptr) {
+    return Status(1, "Could not get iterator for " + domain);
+  }
+
+  rocksdb::Status s;
+  rocksdb::WriteBatch rocks_batch;
+  size_t count = 0;
+  for (it->Seek(start); it->Valid() && s.ok(); it->Next()) {
+    if (it->key().compare(stop) >= 0) {
+      break;
+    }
+    rocks_batch.Delete(cfh, it->key());
+    if (++count % kDeleteRangeBatchSize == 0) {
+      s = getDB()->Write(rocksdb::WriteOptions(), &rocks_batch);
+      rocks_batch.Clear();
+    }
+  }
+  delete it;
+
+  if (s.ok() && count % kDeleteRangeBatchSize != 0) {
+    s = getDB()->Write(rocksdb::WriteOptions(), &rocks_batch);
+  }
+  if (s.ok() && count > 0 && (domain == kEvents || domain == kLogs)) {
+    addDeletedRange(domain, start, stop);
+  }
+  return toStatus(s);
+}
+
+void DBHandle::addDeletedRange(const std::string& domain,
+                               const std::string& start,
+                               const std::string& stop) {
+  std::lock_guard<std::mutex> lock(maintenance_mutex_);
+  auto& ranges = maintenance_[domain].ranges;
+  for (auto& range : ranges) {
+    if (start <= range.second && range.first <= stop) {
+      // Overlapping and adjacent ranges are compacted together.
+      range.first = std::min(range.first, start);
+      range.second = std::max(range.second, stop);
+      return;
+    }
+  }
+
+  ranges.push_back(std::make_pair(start, stop));
+  if (ranges.size() > kMaxDeletedRanges) {
+    // Compact one range covering every deleted range.
+    auto covering = ranges.front();
+    for (const auto& range : ranges) {
+      covering.first = std::min(covering.first, range.first);
+      covering.second = std::max(covering.second, range.second);
+    }
+    ranges = {covering};
+  }
+}
+
+bool DBHandle::hasDeletedRanges() {
+  std::lock_guard<std::mutex> lock(maintenance_mutex_);
+  for (const auto& domain : maintenance_) {
+    if (!domain.second.ranges.empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Status DBHandle::compactDeletedRanges() {
+  if (memory_ != nullptr) {
+    return Status(0, "OK");
+  }
+
+  // Take the ranges so concurrent deletes are remembered for the next call.
+  std::map<std::string, std::vector<std::pair<std::string, std::string>>>
+      pending;
+  {
+    std::lock_guard<std::mutex> lock(maintenance_mutex_);
+    for (auto& domain : maintenance_) {
+      pending[domain.first].swap(domain.second.ranges);
+    }
+  }
+
+  Status status;
+  for (const auto& domain : pending) {
+    auto cfh = getHandleForColumnFamily(domain.first);
+    for (const auto& range : domain.second) {
+      rocksdb::Slice begin(range.first);
+      rocksdb::Slice end(range.second);
+      auto s = (cfh == nullptr) ? rocksdb::Status::NotFound(domain.first)
+                                : getDB()->CompactRange(cfh, &begin, &end);
+      if (!s.ok()) {
+        status = toStatus(s);
+        addDeletedRange(domain.first, range.first, range.second);
+        continue;
+      }
+
+      std::lock_guard<std::mutex> lock(maintenance_mutex_);
+      auto& maintenance = maintenance_[domain.first];
+      maintenance.compactions++;
+      maintenance.last_compaction = getUnixTime();
+    }
+  }
+  return status;
+}
+
+/// Read an integer RocksDB property of a column family, 0 if unavailable.
+static uint64_t getIntProperty(rocksdb::DB* db,
+                               rocksdb::ColumnFamilyHandle* cfh,
+                               const std::string& property) {
+  std::string value;
+  uint64_t result = 0;
+  if (db->GetProperty(cfh, property, &value)) {
+    parseInteger(value, result);
+  }
+  return result;
+}
+
+std::vector<DatabaseDomainStats> DBHandle::getStats() {
+  std::vector<DatabaseDomainStats> stats;
+  if (memory_ != nullptr) {
+    return stats;
+  }
+
+  for (const auto& domain : kDomains) {
+    auto cfh = getHandleForColumnFamily(domain);
+    if (cfh == nullptr) {
+      continue;
+    }
+
+    DatabaseDomainStats domain_stats;
+    domain_stats.domain = domain;
+    auto db = getDB();
+    domain_stats.keys = getIntProperty(db, cfh, "rocksdb.estimate-num-keys");
+    domain_stats.memtable_bytes =
+        getIntProperty(db, cfh, "rocksdb.cur-size-active-mem-table");
+    domain_stats.immutable_memtables =
+        getIntProperty(db, cfh, "rocksdb.num-immutable-mem-table");
+    domain_stats.flush_pending =
+        getIntProperty(db, cfh, "rocksdb.mem-table-flush-pending") > 0;
+    domain_stats.compaction_pending =
+        getIntProperty(db, cfh, "rocksdb.compaction-pending") > 0;
+    domain_stats.level0_files =
+        getIntProperty(db, cfh, "rocksdb.num-files-at-level0");
+
+    std::lock_guard<std::mutex> lock(maintenance_mutex_);
+    auto maintenance = maintenance_.find(domain);
+    if (maintenance != maintenance_.end()) {
+      domain_stats.deleted_ranges = maintenance->second.ranges.size();
+      domain_stats.compactions = maintenance->second.compactions;
+      domain_stats.last_compaction = maintenance->second.last_compaction;
+    }
+    stats.push_back(domain_stats);
+  }
+  return stats;
 }
 
 Status DBHandle::Scan(const std::string& domain,
                       std::vector<std::string>& results) {
+  return Scan(domain, results, "", 0);
+}
+
+Status DBHandle::Scan(const std::string& domain,
+                      std::vector<std::string>& results,
+                      const std::string& prefix,
+                      size_t max) {
+  std::vector<std::pair<std::string, std::string>> keys;
+  auto status = ScanPrefix(domain, prefix, keys, false, max);
+  for (const auto& key : keys) {
+    results.push_back(key.first);
+  }
+  return status;
+}
+
+Status DBHandle::ScanPrefix(
+    const std::string& domain,
+    const std::string& prefix,
+    std::vector<std::pair<std::string, std::string>>& results,
+    bool values,
+    size_t max) {
+  if (memory_ != nullptr) {
+    if (!memory_->hasDomain(domain)) {
+      return Status(1, "Could not get column family for " + domain);
+    }
+    return memory_->scan(domain, prefix, "", prefix, results, values, max);
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+  auto it = getDB()->NewIterator(rocksdb::ReadOptions(), cfh);
+  if (it == nullptr) {
+    return Status(1, "Could not get iterator for " + domain);
+  }
+  size_t count = 0;
+  for (it->Seek(prefix); it->Valid(); it->Next()) {
+    if (!it->key().starts_with(prefix) || (max > 0 && count >= max)) {
+      break;
+    }
+    results.push_back(std::make_pair(
+        it->key().ToString(), (values) ? it->value().ToString() : ""));
+    count++;
+  }
+  delete it;
+  return Status(0, "OK");
+}
+
+Status DBHandle::ScanRange(
+    const std::string& domain,
+    const std::string& start,
+    const std::string& stop,
+    std::vector<std::pair<std::string, std::string>>& results,
+    bool values,
+    size_t max) {
+  if (memory_ != nullptr) {
+    if (!memory_->hasDomain(domain)) {
+      return Status(1, "Could not get column family for " + domain);
+    }
+    return memory_->scan(domain, start, stop, "", results, values, max);
+  }
+
   auto cfh = getHandleForColumnFamily(domain);
   if (cfh == nullptr) {
     return Status(1, "Could not get column family for " + domain);
@@ -227,13 +951,35 @@ Status DBHandle::Scan(const std::string& domain,
   if (it == nullptr) {
     return Status(1, "Could not get iterator for " + domain);
   }
-  for (it->SeekToFirst(); it->Valid(); it->Next()) {
-    results.push_back(it->key().ToString());
+  size_t count = 0;
+  for (it->Seek(start); it->Valid(); it->Next()) {
+    auto key = it->key().ToString();
+    if (key >= stop || (max > 0 && count >= max)) {
+      break;
+    }
+    results.push_back(
+        std::make_pair(key, (values) ? it->value().ToString() : ""));
+    count++;
   }
   delete it;
   return Status(0, "OK");
 }
 
+bool DBHandle::Exists(const std::string& domain, const std::string& key) {
+  if (memory_ != nullptr) {
+    std::string value;
+    return memory_->hasDomain(domain) &&
+           memory_->get(domain, key, value).ok();
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return false;
+  }
+  std::string value;
+  return getDB()->Get(rocksdb::ReadOptions(), cfh, key, &value).ok();
+}
+
 Status RocksDatabasePlugin::get(const std::string& domain,
                                 const std::string& key,
                                 std::string& value) const {
@@ -251,6 +997,17 @@ Status RocksDatabasePlugin::remove(const std::string& domain,
   return DBHandle::getInstance()->Delete(domain, key);
 }
 
+Status RocksDatabasePlugin::scan(const std::string& domain,
+                                 std::vector<std::string>& results,
+                                 const std::string& prefix,
+                                 size_t max) const {
+  return DBHandle::getInstance()->Scan(domain, results, prefix, max);
+}
+
+Status RocksDatabasePlugin::write(const DatabaseBatch& batch) {
+  return DBHandle::getInstance()->Write(batch);
+}
+
 Status RocksDatabasePlugin::scan(const std::string& domain,
                                  std::vector<std::string>& results) const {
   return DBHandle::getInstance()->Scan(domain, results);
@@ -10,7 +10,9 @@
 
 #pragma once
 
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -19,6 +21,7 @@
 #include <boost/noncopyable.hpp>
 
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/flags.h>
 
 namespace osquery {
@@ -28,6 +31,28 @@ DECLARE_string(database_path);
 class DBHandle;
 typedef std::shared_ptr<DBHandle> DBHandleRef;
 
+/// Compaction and flush statistics of a backing-store domain.
+struct DatabaseDomainStats {
+  std::string domain;
+  /// RocksDB's estimate of the number of keys.
+  uint64_t keys{0};
+  /// Bytes in the active memtable.
+  uint64_t memtable_bytes{0};
+  /// Memtables waiting to be flushed.
+  uint64_t immutable_memtables{0};
+  bool flush_pending{false};
+  bool compaction_pending{false};
+  /// Level 0 files, a flush adds one and compactions remove them.
+  uint64_t level0_files{0};
+  /// Deleted ranges waiting for an idle compaction.
+  size_t deleted_ranges{0};
+  /// Idle compactions completed, and the UNIX time of the last.
+  size_t compactions{0};
+  size_t last_compaction{0};
+};
+
+class MemoryDatabase;
+
 /**
  * @brief RAII singleton around RocksDB database access.
  *
@@ -69,6 +94,40 @@ class DBHandle {
    */
   static bool checkDB();
 
+  /**
+   * @brief Read values from a RocksDB store owned by another process.
+   *
+   * The store is opened read-only, so the owner keeps writing it. Values the
+   * owner wrote since its last flush are read from the write-ahead log.
+   *
+   * @param path The store's path.
+   * @param domain The domain of the keys.
+   * @param keys The keys to read.
+   * @param values The output values of the keys that exist.
+   */
+  static Status getValuesAtPath(const std::string& path,
+                                const std::string& domain,
+                                const std::vector<std::string>& keys,
+                                std::map<std::string, std::string>& values);
+
+  /**
+   * @brief Compact the ranges deleted from the events and logs domains.
+   *
+   * A range delete leaves a tombstone for each key until a compaction reaches
+   * it, and expired ranges slow scans and hold disk space until then. The
+   * ranges are remembered and compacted when the scheduler is idle, instead
+   * of waiting for RocksDB's compaction triggers during an event burst.
+   *
+   * @return Failure if a compaction failed, its range is kept for later.
+   */
+  Status compactDeletedRanges();
+
+  /// Whether deleted ranges are waiting for compaction.
+  bool hasDeletedRanges();
+
+  /// Statistics of each domain, empty for the in-memory store.
+  std::vector<DatabaseDomainStats> getStats();
+
  private:
   /////////////////////////////////////////////////////////////////////////////
   // Data access methods
@@ -117,6 +176,19 @@ class DBHandle {
    */
   Status Delete(const std::string& domain, const std::string& key);
 
+  /**
+   * @brief Apply a batch of puts and deletes with a single RocksDB write
+   *
+   * The batch is committed atomically. Concurrent writers are grouped into
+   * a shared commit by RocksDB's write group.
+   *
+   * @param batch the ordered set of operations
+   *
+   * @return an instance of osquery::Status indicating the success or failure
+   * of the operation.
+   */
+  Status Write(const DatabaseBatch& batch);
+
   /**
    * @brief List the data in a "domain"
    *
@@ -130,6 +202,91 @@ class DBHandle {
    */
   Status Scan(const std::string& domain, std::vector<std::string>& results);
 
+  /**
+   * @brief List the keys in a "domain" beginning with a prefix
+   *
+   * @param domain the "domain" or "column family" to list keys from
+   * @param results an output vector of the matching keys, in order
+   * @param prefix only list keys beginning with prefix
+   * @param max the maximum number of keys to list, 0 for no limit
+   *
+   * @return an instance of osquery::Status indicating the success or failure
+   * of the operation.
+   */
+  Status Scan(const std::string& domain,
+              std::vector<std::string>& results,
+              const std::string& prefix,
+              size_t max = 0);
+
+  /**
+   * @brief List the keys and values in a "domain" beginning with a prefix
+   *
+   * The iteration seeks to the prefix and stops at the first key without it.
+   *
+   * @param domain the "domain" or "column family" to iterate
+   * @param prefix only visit keys beginning with prefix
+   * @param results an output vector of key, value pairs
+   * @param values set to false to only read keys, each value is empty
+   * @param max the maximum number of pairs to read, 0 for no limit
+   *
+   * @return an instance of osquery::Status indicating the success or failure
+   * of the operation.
+   */
+  Status ScanPrefix(const std::string& domain,
+                    const std::string& prefix,
+                    std::vector<std::pair<std::string, std::string>>& results,
+                    bool values = true,
+                    size_t max = 0);
+
+  /**
+   * @brief List the keys and values in a "domain" within a key range
+   *
+   * Keys are visited in order using a single RocksDB iterator.
+   *
+   * @param domain the "domain" or "column family" to iterate
+   * @param start the inclusive first key
+   * @param stop the exclusive last key
+   * @param results an output vector of key, value pairs
+   * @param values set to false to only read keys, each value is empty
+   * @param max the maximum number of pairs to read, 0 for no limit
+   *
+   * @return an instance of osquery::Status indicating the success or failure
+   * of the operation.
+   */
+  Status ScanRange(const std::string& domain,
+                   const std::string& start,
+                   const std::string& stop,
+                   std::vector<std::pair<std::string, std::string>>& results,
+                   bool values = true,
+                   size_t max = 0);
+
+  /**
+   * @brief Remove every key in a "domain" within a key range
+   *
+   * Only the keys are read, and they are removed in bounded batches. The
+   * range is not removed atomically.
+   *
+   * @param domain the "domain" or "column family" to modify
+   * @param start the inclusive first key
+   * @param stop the exclusive last key
+   *
+   * @return an instance of osquery::Status indicating the success or failure
+   * of the operation.
+   */
+  Status DeleteRange(const std::string& domain,
+                     const std::string& start,
+                     const std::string& stop);
+
+  /**
+   * @brief Check if a key exists in a "domain"
+   *
+   * @param domain the "domain" or "column family" to check
+   * @param key the string key to look up
+   *
+   * @return true if the key exists.
+   */
+  bool Exists(const std::string& domain, const std::string& key);
+
  private:
   /**
    * @brief Default constructor
@@ -151,7 +308,8 @@ class DBHandle {
    *
    * @param path the path to create/access the database
    * @param in_memory a boolean indicating whether or not the database should
-   * be creating in memory or not.
+   * be creating in memory or not. An in-memory handle uses a native store and
+   * does not open RocksDB.
    */
   DBHandle(const std::string& path, bool in_memory);
 
@@ -200,10 +358,16 @@ class DBHandle {
    * You probably shouldn't use this. DBHandle::getDB() should only be used
    * when you're positive that it's the right thing to use.
    *
-   * @return a pointer to the underlying RocksDB database handle
+   * @return a pointer to the underlying RocksDB database handle, nullptr if
+   * the handle is in memory
    */
   rocksdb::DB* getDB();
 
+  /// Remember a deleted range for compactDeletedRanges.
+  void addDeletedRange(const std::string& domain,
+                       const std::string& start,
+                       const std::string& stop);
+
  private:
   /////////////////////////////////////////////////////////////////////////////
   // Private members
@@ -221,10 +385,28 @@ class DBHandle {
   /// The RocksDB connection options that are used to connect to RocksDB
   rocksdb::Options options_;
 
+  /// The native backing store used instead of RocksDB when in memory
+  std::unique_ptr<MemoryDatabase> memory_;
+
+  /// Deleted ranges and idle compactions of a domain.
+  struct Maintenance {
+    std::vector<std::pair<std::string, std::string>> ranges;
+    size_t compactions{0};
+    size_t last_compaction{0};
+  };
+
+  /// Maintenance of the events and logs domains.
+  std::map<std::string, Maintenance> maintenance_;
+
+  /// Protects the maintenance state.
+  std::mutex maintenance_mutex_;
+
  private:
   friend class RocksDatabasePlugin;
   friend class Query;
   friend class EventSubscriberPlugin;
+  friend class TLSLoggerPlugin;
+  friend class TLSLogForwarderRunner;
 
   /////////////////////////////////////////////////////////////////////////////
   // Unit tests which can access private members
@@ -235,11 +417,23 @@ class DBHandle {
   FRIEND_TEST(DBHandleTests, test_put);
   FRIEND_TEST(DBHandleTests, test_delete);
   FRIEND_TEST(DBHandleTests, test_scan);
+  FRIEND_TEST(DBHandleTests, test_scan_range);
+  FRIEND_TEST(DBHandleTests, test_delete_range);
+  FRIEND_TEST(DBHandleTests, test_scan_prefix);
+  FRIEND_TEST(DBHandleTests, test_exists);
+  FRIEND_TEST(DBHandleTests, test_write_batch);
+  FRIEND_TEST(DBHandleTests, test_in_memory);
+  FRIEND_TEST(DBHandleTests, test_in_memory_eviction);
+  FRIEND_TEST(DBHandleTests, test_compact_deleted_ranges);
   friend class QueryTests;
   FRIEND_TEST(QueryTests, test_get_query_results);
   FRIEND_TEST(QueryTests, test_is_query_name_in_database);
   FRIEND_TEST(QueryTests, test_get_stored_query_names);
+  FRIEND_TEST(QueryTests, test_shared_results);
+  FRIEND_TEST(QueryTests, test_previous_results_in_memory);
+  FRIEND_TEST(QueryTests, test_query_history);
   friend class EventsTests;
   friend class EventsDatabaseTests;
+  friend class TLSLoggerTests;
 };
 }
@@ -9,11 +9,236 @@
  */
 
 #include <algorithm>
+#include <iomanip>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
 
+#include <osquery/core.h>
+#include <osquery/hash.h>
+
+#include "osquery/core/arena.h"
 #include "osquery/database/query.h"
 
 namespace osquery {
 
+FLAG(uint64,
+     schedule_history,
+     0,
+     "Result changes kept for each scheduled query's query_history, 0 to "
+     "disable");
+
+/// A kQueries value referencing a result set in kQueryResults by its hash.
+const char kResultsReference = '#';
+
+/// Separates the query name and generation of kQueryHistory keys.
+const char kHistorySeparator = '\n';
+
+/// kQueryResults key prefixes of the result sets and their reference counts.
+const std::string kResultsPrefix = "results.";
+const std::string kReferencesPrefix = "references.";
+
+/// Reference counts are read and written by concurrently executing queries.
+static std::mutex kResultsMutex;
+
+/// The most row fingerprints kept in memory, across every query name.
+const size_t kPreviousFingerprintsMax = 1024 * 1024;
+
+inline bool isResultsReference(const std::string& value) {
+  return !value.empty() && value[0] == kResultsReference;
+}
+
+/**
+ * @brief The fingerprints and stored results reference of recent query runs.
+ *
+ * Each execution of a scheduled query compares its results to the previous
+ * run's fingerprints. Keeping them in memory, least recently used first out,
+ * means unchanged results are compared without reading the backing store.
+ * Entries are only set after the store is written, the store is read for
+ * query names that are not in memory, such as after a restart.
+ */
+class PreviousResultsCache {
+ public:
+  /// Copy the fingerprints and kQueries value of a name's previous run.
+  bool get(const DBHandle* db,
+           const std::string& name,
+           QueryDataFingerprints& fps,
+           std::string& reference) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto entry = entries_.find(name);
+    if (entry == entries_.end() || entry->second.db != db) {
+      return false;
+    }
+
+    recent_.splice(recent_.begin(), recent_, entry->second.position);
+    fps = entry->second.fps;
+    reference = entry->second.reference;
+    return true;
+  }
+
+  /// Replace a name's entry after its results are stored.
+  void set(const DBHandle* db,
+           const std::string& name,
+           const QueryDataFingerprints& fps,
+           const std::string& reference) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    erase(name);
+    if (fps.size() > kPreviousFingerprintsMax) {
+      return;
+    }
+
+    while (size_ + fps.size() > kPreviousFingerprintsMax) {
+      erase(recent_.back());
+    }
+    recent_.push_front(name);
+    auto& entry = entries_[name];
+    entry.db = db;
+    entry.fps = fps;
+    entry.reference = reference;
+    entry.position = recent_.begin();
+    size_ += fps.size();
+  }
+
+  /// Remove a name's entry, the backing store is read on its next run.
+  void remove(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    erase(name);
+  }
+
+ private:
+  void erase(const std::string& name) {
+    auto entry = entries_.find(name);
+    if (entry != entries_.end()) {
+      size_ -= entry->second.fps.size();
+      recent_.erase(entry->second.position);
+      entries_.erase(entry);
+    }
+  }
+
+ private:
+  struct Entry {
+    const DBHandle* db;
+    QueryDataFingerprints fps;
+    std::string reference;
+    std::list<std::string>::iterator position;
+  };
+
+  std::map<std::string, Entry> entries_;
+  /// Query names, the most recently used first.
+  std::list<std::string> recent_;
+  /// The number of fingerprints in every entry.
+  size_t size_{0};
+  std::mutex mutex_;
+};
+
+static PreviousResultsCache kPreviousResults;
+
+/**
+ * @brief A change to a query's results, kept in kQueryHistory.
+ *
+ * The fingerprint sums of the results before and after the change link each
+ * generation to the next. The sums do not depend on row order, a reordering
+ * of unchanged rows does not break the link.
+ */
+struct HistoryGeneration {
+  size_t time{0};
+  RowFingerprint previous{0};
+  RowFingerprint current{0};
+  DiffResults changes;
+};
+
+inline RowFingerprint sumFingerprints(const QueryDataFingerprints& fps) {
+  RowFingerprint sum = 0;
+  for (const auto& fp : fps) {
+    sum += fp;
+  }
+  return sum;
+}
+
+/// Generation keys are zero-padded so they are ordered numerically.
+static std::string getHistoryKey(const std::string& name, size_t generation) {
+  std::stringstream key;
+  key << name << kHistorySeparator << std::setw(20) << std::setfill('0')
+      << generation;
+  return key.str();
+}
+
+static size_t getHistoryGeneration(const std::string& key) {
+  auto separator = key.rfind(kHistorySeparator);
+  if (separator == std::string::npos) {
+    return 0;
+  }
+  return strtoull(key.c_str() + separator + 1, nullptr, 10);
+}
+
+/// A generation is its header lines followed by the added and removed rows.
+static Status serializeHistory(const HistoryGeneration& generation,
+                               std::string& raw) {
+  std::string added, removed;
+  auto status = serializeQueryDataBinary(generation.changes.added, added);
+  if (!status.ok()) {
+    return status;
+  }
+  status = serializeQueryDataBinary(generation.changes.removed, removed);
+  if (!status.ok()) {
+    return status;
+  }
+
+  raw = std::to_string(generation.time) + "\n" +
+        std::to_string(generation.previous) + "\n" +
+        std::to_string(generation.current) + "\n" +
+        std::to_string(added.size()) + "\n";
+  raw += added;
+  raw += removed;
+  return Status(0, "OK");
+}
+
+static Status deserializeHistory(const std::string& raw,
+                                 HistoryGeneration& generation) {
+  uint64_t header[4];
+  size_t offset = 0;
+  for (size_t i = 0; i < 4; ++i) {
+    auto end = raw.find('\n', offset);
+    if (end == std::string::npos) {
+      return Status(1, "Invalid query history");
+    }
+    header[i] = strtoull(raw.c_str() + offset, nullptr, 10);
+    offset = end + 1;
+  }
+  if (header[3] > raw.size() - offset) {
+    return Status(1, "Invalid query history");
+  }
+
+  generation.time = header[0];
+  generation.previous = header[1];
+  generation.current = header[2];
+  auto status = deserializeQueryDataBinary(raw.substr(offset, header[3]),
+                                           generation.changes.added);
+  if (!status.ok()) {
+    return status;
+  }
+  return deserializeQueryDataBinary(raw.substr(offset + header[3]),
+                                    generation.changes.removed);
+}
+
+Status Query::getStoredResults(const std::string& value,
+                               QueryData& results,
+                               DBHandleRef db) {
+  if (!isResultsReference(value)) {
+    return deserializeQueryDataBinary(value, results);
+  }
+
+  // Results are stored once for every query name that produced them.
+  std::string raw;
+  auto status = db->Get(kQueryResults, kResultsPrefix + value.substr(1), raw);
+  if (!status.ok()) {
+    return status;
+  }
+  return deserializeQueryDataBinary(raw, results);
+}
+
 /////////////////////////////////////////////////////////////////////////////
 // Getters and setters
 /////////////////////////////////////////////////////////////////////////////
@@ -33,7 +258,7 @@ Status Query::getPreviousQueryResults(QueryData& results) {
 }
 
 Status Query::getPreviousQueryResults(QueryData& results, DBHandleRef db) {
-  if (!isQueryNameInDatabase()) {
+  if (!isQueryNameInDatabase(db)) {
     return Status(0, "Query name not found in database");
   }
 
@@ -43,7 +268,7 @@ Status Query::getPreviousQueryResults(QueryData& results, DBHandleRef db) {
     return status;
   }
 
-  status = deserializeQueryDataJSON(raw, results);
+  status = getStoredResults(raw, results, db);
   if (!status.ok()) {
     return status;
   }
@@ -65,8 +290,7 @@ bool Query::isQueryNameInDatabase() {
 }
 
 bool Query::isQueryNameInDatabase(DBHandleRef db) {
-  auto names = Query::getStoredQueryNames(db);
-  return std::find(names.begin(), names.end(), name_) != names.end();
+  return db->Exists(kQueries, name_);
 }
 
 Status Query::addNewResults(const osquery::QueryData& qd) {
@@ -82,36 +306,281 @@ Status Query::addNewResults(const QueryData& qd, DiffResults& dr) {
   return addNewResults(qd, dr, true, DBHandle::getInstance());
 }
 
+Status Query::addNewResults(QueryData&& qd, DiffResults& dr) {
+  escapeQueryData(qd);
+  return addNewResults(qd, dr, true, DBHandle::getInstance());
+}
+
+Status Query::getPreviousFingerprints(QueryDataFingerprints& fps,
+                                      DBHandleRef db) {
+  std::string raw;
+  auto status = db->Get(kQueryFingerprints, name_, raw);
+  if (!status.ok() || raw.empty()) {
+    return Status(1, "No previous fingerprints");
+  }
+  return deserializeFingerprints(raw, fps);
+}
+
+Status Query::addNewResults(const ResultSet& current, DiffResults& dr) {
+  if (resultSetNeedsEscaping(current)) {
+    // Rare, the converted rows are escaped in place.
+    return addNewResults(current.toQueryData(), dr);
+  }
+
+  // Rows are only converted to QueryData when the results changed.
+  QueryData current_qd;
+  return addNewResults(fingerprintResultSet(current),
+                       [&current, &current_qd]() -> const QueryData& {
+                         current_qd = current.toQueryData();
+                         return current_qd;
+                       },
+                       [&current](std::string& raw) {
+                         return serializeResultSetBinary(current, raw);
+                       },
+                       dr,
+                       true,
+                       DBHandle::getInstance());
+}
+
 Status Query::addNewResults(const QueryData& current_qd,
                             DiffResults& dr,
                             bool calculate_diff,
                             DBHandleRef db) {
-  // Get the rows from the last run of this query name.
-  QueryData previous_qd;
-  auto status = getPreviousQueryResults(previous_qd);
-  if (!status.ok()) {
-    return status;
+  // Sanitize all non-ASCII characters from the query data values, results
+  // that are already printable are used without a copy.
+  QueryData escaped_qd;
+  bool needs_escaping = queryDataNeedsEscaping(current_qd);
+  if (needs_escaping) {
+    escapeQueryData(current_qd, escaped_qd);
+  }
+  const auto& escaped_current_qd = needs_escaping ? escaped_qd : current_qd;
+  return addNewResults(fingerprintQueryData(escaped_current_qd),
+                       [&escaped_current_qd]() -> const QueryData& {
+                         return escaped_current_qd;
+                       },
+                       [&escaped_current_qd](std::string& raw) {
+                         return serializeQueryDataBinary(escaped_current_qd,
+                                                         raw);
+                       },
+                       dr,
+                       calculate_diff,
+                       db);
+}
+
+Status Query::addNewResults(
+    const QueryDataFingerprints& current_fps,
+    const std::function<const QueryData&()>& current,
+    const std::function<Status(std::string&)>& serialize,
+    DiffResults& dr,
+    bool calculate_diff,
+    DBHandleRef db) {
+  // Compare against the fingerprints of the last run of this query name.
+  // When the results are unchanged the previous rows are never parsed.
+  QueryDataFingerprints previous_fps;
+  std::string previous;
+  bool cached = kPreviousResults.get(db.get(), name_, previous_fps, previous);
+  bool have_fps = cached;
+  if (!cached && isQueryNameInDatabase(db)) {
+    have_fps = getPreviousFingerprints(previous_fps, db).ok();
+  }
+
+  if (have_fps && previous_fps.size() == current_fps.size()) {
+    if (previous_fps == current_fps) {
+      // Identical results in an identical order, nothing to store.
+      dr = DiffResults();
+      return Status(0, "OK");
+    }
+
+    ArenaVector<RowFingerprint> sorted_previous(previous_fps.begin(),
+                                                previous_fps.end());
+    ArenaVector<RowFingerprint> sorted_current(current_fps.begin(),
+                                               current_fps.end());
+    std::sort(sorted_previous.begin(), sorted_previous.end());
+    std::sort(sorted_current.begin(), sorted_current.end());
+    if (sorted_previous == sorted_current) {
+      // The same rows in a new order, there is no differential.
+      dr = DiffResults();
+      calculate_diff = false;
+    }
   }
 
-  // Sanitize all non-ASCII characters from the query data values.
-  QueryData escaped_current_qd;
-  escapeQueryData(current_qd, escaped_current_qd);
-  // Calculate the differential between previous and current query results.
+  // History compares whole rows, key columns report changed rows instead.
+  bool record_history = calculate_diff && FLAGS_schedule_history > 0;
+  DiffResults history;
   if (calculate_diff) {
-    dr = diff(previous_qd, escaped_current_qd);
+    // Get the rows from the last run of this query name.
+    QueryData previous_qd;
+    auto status = (cached) ? getStoredResults(previous, previous_qd, db)
+                           : getPreviousQueryResults(previous_qd, db);
+    if (!status.ok()) {
+      return status;
+    }
+
+    if (!have_fps || previous_fps.size() != previous_qd.size()) {
+      previous_fps = fingerprintQueryData(previous_qd);
+    }
+    // Calculate the differential between previous and current query results.
+    dr = diff(previous_qd, previous_fps, current(), current_fps, keys_);
+    if (record_history) {
+      history = (keys_.empty())
+                    ? dr
+                    : diff(previous_qd, previous_fps, current(), current_fps);
+    }
   }
 
   // Replace the "previous" query data with the current.
-  std::string json;
-  status = serializeQueryDataJSON(escaped_current_qd, json);
+  std::string raw;
+  auto status = serialize(raw);
   if (!status.ok()) {
     return status;
   }
 
-  status = db->Put(kQueries, name_, json);
-  if (!status.ok()) {
-    return status;
+  // Query names with identical results reference the same stored copy.
+  auto hash = hashFromBuffer(HASH_TYPE_SHA1, raw.data(), raw.size());
+  std::lock_guard<std::mutex> lock(kResultsMutex);
+  if (!cached) {
+    db->Get(kQueries, name_, previous);
+  }
+
+  // The results, the reference, and the fingerprints are committed together.
+  DatabaseBatch batch;
+  if (previous != kResultsReference + hash) {
+    addResultsReference(hash, raw, db, batch);
+    if (isResultsReference(previous)) {
+      removeResultsReference(previous.substr(1), db, batch);
+    }
+    batch.put(kQueries, name_, kResultsReference + hash);
+  }
+  batch.put(kQueryFingerprints, name_, serializeFingerprints(current_fps));
+  if (record_history && !history.empty()) {
+    addHistory(history, previous_fps, current_fps, db, batch);
+  }
+  status = db->Write(batch);
+  if (status.ok()) {
+    kPreviousResults.set(
+        db.get(), name_, current_fps, kResultsReference + hash);
+  } else {
+    kPreviousResults.remove(name_);
+  }
+  return status;
+}
+
+void Query::addHistory(const DiffResults& changes,
+                       const QueryDataFingerprints& previous_fps,
+                       const QueryDataFingerprints& current_fps,
+                       DBHandleRef db,
+                       DatabaseBatch& batch) {
+  std::vector<std::string> keys;
+  db->Scan(kQueryHistory, keys, name_ + kHistorySeparator);
+
+  HistoryGeneration generation;
+  generation.time = getUnixTime();
+  generation.previous = sumFingerprints(previous_fps);
+  generation.current = sumFingerprints(current_fps);
+  generation.changes.added = changes.added;
+  generation.changes.removed = changes.removed;
+  std::string raw;
+  if (!serializeHistory(generation, raw).ok()) {
+    return;
+  }
+
+  size_t next = (keys.empty()) ? 1 : getHistoryGeneration(keys.back()) + 1;
+  batch.put(kQueryHistory, getHistoryKey(name_, next), raw);
+  for (size_t i = 0; i + FLAGS_schedule_history < keys.size() + 1; ++i) {
+    batch.remove(kQueryHistory, keys[i]);
+  }
+}
+
+Status Query::getHistoricalResults(size_t time,
+                                   QueryData& results,
+                                   size_t& generation,
+                                   size_t& generation_time) {
+  return getHistoricalResults(
+      time, results, generation, generation_time, DBHandle::getInstance());
+}
+
+Status Query::getHistoricalResults(size_t time,
+                                   QueryData& results,
+                                   size_t& generation,
+                                   size_t& generation_time,
+                                   DBHandleRef db) {
+  std::vector<std::pair<std::string, std::string>> entries;
+  QueryData current;
+  {
+    // Read the current results and their history from the same commit.
+    std::lock_guard<std::mutex> lock(kResultsMutex);
+    db->ScanPrefix(kQueryHistory, name_ + kHistorySeparator, entries);
+    auto status = getPreviousQueryResults(current, db);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  // Undo each change made after the time, the newest first.
+  std::multiset<Row> state(current.begin(), current.end());
+  auto expected = sumFingerprints(fingerprintQueryData(current));
+  for (auto entry = entries.rbegin(); entry != entries.rend(); ++entry) {
+    HistoryGeneration change;
+    auto status = deserializeHistory(entry->second, change);
+    if (!status.ok()) {
+      return status;
+    }
+    if (change.current != expected) {
+      // Results were stored while history was disabled.
+      return Status(1, "Query history is incomplete");
+    }
+
+    if (change.time <= time) {
+      results.assign(state.begin(), state.end());
+      generation = getHistoryGeneration(entry->first);
+      generation_time = change.time;
+      return Status(0, "OK");
+    }
+
+    for (const auto& row : change.changes.added) {
+      auto it = state.find(row);
+      if (it != state.end()) {
+        state.erase(it);
+      }
+    }
+    state.insert(change.changes.removed.begin(), change.changes.removed.end());
+    expected = change.previous;
+  }
+  return Status(1, "Query history does not reach the time");
+}
+
+size_t Query::getResultsReferences(const std::string& hash, DBHandleRef db) {
+  std::string value;
+  if (!db->Get(kQueryResults, kReferencesPrefix + hash, value).ok()) {
+    return 0;
+  }
+  return strtoull(value.c_str(), nullptr, 10);
+}
+
+void Query::addResultsReference(const std::string& hash,
+                                const std::string& raw,
+                                DBHandleRef db,
+                                DatabaseBatch& batch) {
+  auto references = getResultsReferences(hash, db);
+  if (references == 0) {
+    batch.put(kQueryResults, kResultsPrefix + hash, raw);
+  }
+  batch.put(kQueryResults,
+            kReferencesPrefix + hash,
+            std::to_string(references + 1));
+}
+
+void Query::removeResultsReference(const std::string& hash,
+                                   DBHandleRef db,
+                                   DatabaseBatch& batch) {
+  auto references = getResultsReferences(hash, db);
+  if (references <= 1) {
+    batch.remove(kQueryResults, kResultsPrefix + hash);
+    batch.remove(kQueryResults, kReferencesPrefix + hash);
+  } else {
+    batch.put(kQueryResults,
+              kReferencesPrefix + hash,
+              std::to_string(references - 1));
   }
-  return Status(0, "OK");
 }
 }
@@ -10,17 +10,21 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
 
-#include <osquery/status.h>
 #include <osquery/database.h>
+#include <osquery/flags.h>
+#include <osquery/status.h>
 
 #include "osquery/database/db_handle.h"
 
 namespace osquery {
 
+DECLARE_uint64(schedule_history);
+
 /// Error message used when a query name isn't found in the database
 extern const std::string kQueryNameNotFoundError;
 
@@ -66,6 +70,16 @@ class Query {
    */
   int getInterval();
 
+  /**
+   * @brief Set the columns identifying a row across executions
+   *
+   * Differential results match removed and added rows by these columns and
+   * report them as changed rows.
+   *
+   * @param keys the key column names, empty to compare whole rows
+   */
+  void setKeyColumns(const std::vector<std::string>& keys) { keys_ = keys; }
+
   /////////////////////////////////////////////////////////////////////////////
   // Data access methods
   /////////////////////////////////////////////////////////////////////////////
@@ -205,6 +219,33 @@ class Query {
    */
   Status addNewResults(const QueryData& qd, DiffResults& dr);
 
+  /**
+   * @brief Add a new set of results, escaping them in place.
+   *
+   * The same as addNewResults with a const QueryData, but values are
+   * escaped within qd instead of within an escaped copy of the results.
+   *
+   * @param qd the QueryData object containing query results to store
+   * @param dr an output to a DiffResults object populated based on last run
+   *
+   * @return the success or failure of the operation
+   */
+  Status addNewResults(QueryData&& qd, DiffResults& dr);
+
+  /**
+   * @brief Add a new ResultSet to the persistent storage and get back the
+   * differential results.
+   *
+   * The same as addNewResults with QueryData, but unchanged results are
+   * compared and stored without a Row for each result.
+   *
+   * @param rs the ResultSet containing query results to store
+   * @param dr an output to a DiffResults object populated based on last run
+   *
+   * @return the success or failure of the operation
+   */
+  Status addNewResults(const ResultSet& rs, DiffResults& dr);
+
  private:
   /**
    * @brief Add a new set of results to the persistent storage and get back
@@ -223,6 +264,25 @@ class Query {
                        bool calculate_diff,
                        DBHandleRef db);
 
+  /**
+   * @brief Diff and store results given their fingerprints.
+   *
+   * @param current_fps the fingerprints of the escaped current results
+   * @param current get the escaped current results, called to diff them
+   * @param serialize serialize the escaped current results for storage
+   * @param dr an output to a DiffResults object populated based on last run
+   * @param calculate_diff false to store the results without a diff
+   * @param db a custom RocksDB database handle
+   *
+   * @return the success or failure of the operation
+   */
+  Status addNewResults(const QueryDataFingerprints& current_fps,
+                       const std::function<const QueryData&()>& current,
+                       const std::function<Status(std::string&)>& serialize,
+                       DiffResults& dr,
+                       bool calculate_diff,
+                       DBHandleRef db);
+
  public:
   /**
    * @brief A getter for the most recent result set for a scheduled query
@@ -249,6 +309,78 @@ class Query {
    */
   Status getCurrentResults(QueryData& qd, DBHandleRef db);
 
+ public:
+  /**
+   * @brief Get the results the query had at a time in the past
+   *
+   * With --schedule_history each change to a query's results keeps the rows
+   * added and removed by the change. Starting from the current results, the
+   * changes made after the time are undone.
+   *
+   * @param time the UNIX time
+   * @param results the output results as of the time
+   * @param generation the output generation of the results
+   * @param generation_time the output UNIX time the results were stored
+   *
+   * @return failure if the results at the time are no longer kept
+   */
+  Status getHistoricalResults(size_t time,
+                              QueryData& results,
+                              size_t& generation,
+                              size_t& generation_time);
+
+ private:
+  /// Get historical results using a custom database handle.
+  Status getHistoricalResults(size_t time,
+                              QueryData& results,
+                              size_t& generation,
+                              size_t& generation_time,
+                              DBHandleRef db);
+
+  /**
+   * @brief Keep a change to the query's results as a new generation
+   *
+   * Generations beyond --schedule_history are removed, the oldest first.
+   *
+   * @param changes the rows added and removed, compared as whole rows
+   * @param previous_fps the fingerprints of the previous results
+   * @param current_fps the fingerprints of the current results
+   */
+  void addHistory(const DiffResults& changes,
+                  const QueryDataFingerprints& previous_fps,
+                  const QueryDataFingerprints& current_fps,
+                  DBHandleRef db,
+                  DatabaseBatch& batch);
+
+  /**
+   * @brief Get the row fingerprints stored with the most recent results
+   *
+   * @param fps the output fingerprints, in the order of the stored rows
+   * @param db a custom RocksDB database handle
+   *
+   * @return the success or failure of the operation
+   */
+  Status getPreviousFingerprints(QueryDataFingerprints& fps, DBHandleRef db);
+
+  /// Read the results a kQueries value stores or references.
+  static Status getStoredResults(const std::string& value,
+                                 QueryData& results,
+                                 DBHandleRef db);
+
+  /// The number of query names referencing a stored result set.
+  static size_t getResultsReferences(const std::string& hash, DBHandleRef db);
+
+  /// Add a reference to a result set, storing it when it is not yet stored.
+  static void addResultsReference(const std::string& hash,
+                                  const std::string& raw,
+                                  DBHandleRef db,
+                                  DatabaseBatch& batch);
+
+  /// Remove a reference to a result set, removing the last referenced copy.
+  static void removeResultsReference(const std::string& hash,
+                                     DBHandleRef db,
+                                     DatabaseBatch& batch);
+
  private:
   /////////////////////////////////////////////////////////////////////////////
   // Private members
@@ -258,6 +390,8 @@ class Query {
   ScheduledQuery query_;
   /// The scheduled query name.
   std::string name_;
+  /// The columns identifying a row, optional.
+  std::vector<std::string> keys_;
 
  private:
   /////////////////////////////////////////////////////////////////////////////
@@ -271,5 +405,8 @@ class Query {
   FRIEND_TEST(QueryTests, test_get_executions);
   FRIEND_TEST(QueryTests, test_get_query_results);
   FRIEND_TEST(QueryTests, test_query_name_not_found_in_db);
+  FRIEND_TEST(QueryTests, test_shared_results);
+  FRIEND_TEST(QueryTests, test_previous_results_in_memory);
+  FRIEND_TEST(QueryTests, test_query_history);
 };
 }
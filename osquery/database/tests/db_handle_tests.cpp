@@ -23,6 +23,8 @@ const std::string kTestingDBHandlePath = "/tmp/rocksdb-osquery-dbhandletests";
 
 namespace osquery {
 
+DECLARE_uint64(database_memory_limit_mb);
+
 class DBHandleTests : public testing::Test {
  public:
   void SetUp() {
@@ -90,4 +92,183 @@ TEST_F(DBHandleTests, test_scan) {
     EXPECT_NE(std::find(keys.begin(), keys.end(), i), keys.end());
   }
 }
+
+TEST_F(DBHandleTests, test_scan_range) {
+  db->Put(kQueries, "test_range_1", "one");
+  db->Put(kQueries, "test_range_2", "two");
+  db->Put(kQueries, "test_range_3", "three");
+  std::vector<std::pair<std::string, std::string>> results;
+  auto s = db->ScanRange(kQueries, "test_range_1", "test_range_3", results);
+  EXPECT_TRUE(s.ok());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[0].first, "test_range_1");
+  EXPECT_EQ(results[1].second, "two");
+
+  // Values are optional.
+  results.clear();
+  db->ScanRange(kQueries, "test_range_2", "test_range_4", results, false);
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[1].first, "test_range_3");
+  EXPECT_TRUE(results[1].second.empty());
+}
+
+TEST_F(DBHandleTests, test_delete_range) {
+  db->Put(kQueries, "test_delete_1", "one");
+  db->Put(kQueries, "test_delete_2", "two");
+  db->Put(kQueries, "test_delete_3", "three");
+  auto s = db->DeleteRange(kQueries, "test_delete_1", "test_delete_3");
+  EXPECT_TRUE(s.ok());
+
+  std::vector<std::pair<std::string, std::string>> results;
+  db->ScanRange(kQueries, "test_delete_", "test_delete_4", results);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0].first, "test_delete_3");
+  EXPECT_FALSE(db->DeleteRange("foobartest", "a", "b").ok());
+}
+
+TEST_F(DBHandleTests, test_compact_deleted_ranges) {
+  db->Put(kEvents, "event.test.0000000001.0000000001", "one");
+  db->Put(kEvents, "event.test.0000000002.0000000002", "two");
+  db->Put(kQueries, "test_compact", "three");
+
+  // Only ranges deleted from the events and logs domains are compacted.
+  db->DeleteRange(kQueries, "test_compact", "test_compact_");
+  db->DeleteRange(kEvents, "event.test.0000000001", "event.test.0000000002");
+  db->DeleteRange(kEvents, "event.test.0000000002", "event.test.0000000003");
+  EXPECT_TRUE(db->hasDeletedRanges());
+
+  auto stats = db->getStats();
+  auto events = std::find_if(
+      stats.begin(), stats.end(), [](const DatabaseDomainStats& domain) {
+        return domain.domain == kEvents;
+      });
+  ASSERT_TRUE(events != stats.end());
+  // Adjacent ranges are merged.
+  EXPECT_EQ(events->deleted_ranges, 1U);
+
+  EXPECT_TRUE(db->compactDeletedRanges().ok());
+  EXPECT_FALSE(db->hasDeletedRanges());
+  for (const auto& domain : db->getStats()) {
+    EXPECT_EQ(domain.deleted_ranges, 0U);
+    EXPECT_EQ(domain.compactions, (domain.domain == kEvents) ? 1U : 0U);
+  }
+}
+
+TEST_F(DBHandleTests, test_write_batch) {
+  db->Put(kQueries, "test_batch_delete", "baz");
+
+  DatabaseBatch batch;
+  batch.put(kQueries, "test_batch_put", "bar");
+  batch.put(kEvents, "test_batch_put", "foo");
+  batch.remove(kQueries, "test_batch_delete");
+  EXPECT_EQ(batch.size(), 3U);
+  auto s = db->Write(batch);
+  EXPECT_TRUE(s.ok());
+
+  std::string r;
+  EXPECT_TRUE(db->Get(kQueries, "test_batch_put", r).ok());
+  EXPECT_EQ(r, "bar");
+  EXPECT_TRUE(db->Get(kEvents, "test_batch_put", r).ok());
+  EXPECT_EQ(r, "foo");
+  EXPECT_FALSE(db->Get(kQueries, "test_batch_delete", r).ok());
+
+  // An unknown domain fails the entire batch.
+  batch.clear();
+  batch.put(kQueries, "test_batch_partial", "bar");
+  batch.put("foobartest", "test_batch_partial", "bar");
+  EXPECT_FALSE(db->Write(batch).ok());
+  EXPECT_FALSE(db->Get(kQueries, "test_batch_partial", r).ok());
+
+  // The batch is also available through the database plugin.
+  batch.clear();
+  batch.put(kQueries, "test_batch_plugin", "plugin");
+  batch.remove(kQueries, "test_batch_put");
+  EXPECT_TRUE(writeDatabaseBatch(batch).ok());
+  EXPECT_TRUE(db->Get(kQueries, "test_batch_plugin", r).ok());
+  EXPECT_EQ(r, "plugin");
+  EXPECT_FALSE(db->Get(kQueries, "test_batch_put", r).ok());
+}
+
+TEST_F(DBHandleTests, test_scan_prefix) {
+  db->Put(kQueries, "test_prefix_a1", "one");
+  db->Put(kQueries, "test_prefix_a2", "two");
+  db->Put(kQueries, "test_prefix_b1", "three");
+  std::vector<std::pair<std::string, std::string>> results;
+  auto s = db->ScanPrefix(kQueries, "test_prefix_a", results);
+  EXPECT_TRUE(s.ok());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[0].second, "one");
+  EXPECT_EQ(results[1].first, "test_prefix_a2");
+
+  // The number of results may be bounded.
+  std::vector<std::string> keys;
+  s = db->Scan(kQueries, keys, "test_prefix_", 2);
+  EXPECT_TRUE(s.ok());
+  std::vector<std::string> expected = {"test_prefix_a1", "test_prefix_a2"};
+  EXPECT_EQ(keys, expected);
+
+  keys.clear();
+  EXPECT_TRUE(scanDatabaseKeys(kQueries, keys, "test_prefix_b").ok());
+  EXPECT_EQ(keys, std::vector<std::string>({"test_prefix_b1"}));
+}
+
+TEST_F(DBHandleTests, test_exists) {
+  db->Put(kQueries, "test_exists", "");
+  EXPECT_TRUE(db->Exists(kQueries, "test_exists"));
+  EXPECT_FALSE(db->Exists(kQueries, "test_exists_not"));
+  EXPECT_FALSE(db->Exists("foobartest", "test_exists"));
+}
+
+TEST_F(DBHandleTests, test_in_memory) {
+  DBHandle memory("", true);
+  EXPECT_EQ(memory.getDB(), nullptr);
+  EXPECT_TRUE(memory.Put(kQueries, "test_memory_a", "one").ok());
+  EXPECT_TRUE(memory.Put(kQueries, "test_memory_b", "two").ok());
+  EXPECT_FALSE(memory.Put("foobartest", "test_memory_a", "one").ok());
+
+  std::string r;
+  EXPECT_TRUE(memory.Get(kQueries, "test_memory_a", r).ok());
+  EXPECT_EQ(r, "one");
+  EXPECT_TRUE(memory.Exists(kQueries, "test_memory_b"));
+  EXPECT_FALSE(memory.Exists(kEvents, "test_memory_b"));
+
+  // Scans keep the key ordering of the on-disk store.
+  std::vector<std::pair<std::string, std::string>> results;
+  memory.ScanRange(kQueries, "test_memory_a", "test_memory_b", results);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0].second, "one");
+
+  DatabaseBatch batch;
+  batch.remove(kQueries, "test_memory_a");
+  batch.put(kQueries, "test_memory_c", "three");
+  EXPECT_TRUE(memory.Write(batch).ok());
+  std::vector<std::string> keys;
+  memory.Scan(kQueries, keys, "test_memory_");
+  EXPECT_EQ(keys, std::vector<std::string>({"test_memory_b", "test_memory_c"}));
+
+  // The on-disk handle is not affected.
+  EXPECT_FALSE(db->Exists(kQueries, "test_memory_b"));
+}
+
+TEST_F(DBHandleTests, test_in_memory_eviction) {
+  auto limit = FLAGS_database_memory_limit_mb;
+  FLAGS_database_memory_limit_mb = 1;
+  DBHandle memory("", true);
+  FLAGS_database_memory_limit_mb = limit;
+
+  // Settings are never evicted, only the oldest event records.
+  memory.Put(kPersistentSettings, "test_setting", "value");
+  std::string value(100 * 1024, 'A');
+  for (size_t i = 0; i < 20; i++) {
+    auto time = std::to_string(1000 + i);
+    memory.Put(kEvents, "event.test." + time + ".0" + time, value);
+  }
+
+  EXPECT_TRUE(memory.Exists(kPersistentSettings, "test_setting"));
+  EXPECT_FALSE(memory.Exists(kEvents, "event.test.1000.01000"));
+  EXPECT_TRUE(memory.Exists(kEvents, "event.test.1019.01019"));
+  std::vector<std::string> keys;
+  memory.Scan(kEvents, keys, "event.test.");
+  EXPECT_LT(keys.size(), 11U);
+}
 }
@@ -11,6 +11,7 @@
 #include <algorithm>
 #include <ctime>
 #include <deque>
+#include <thread>
 
 #include <boost/filesystem/operations.hpp>
 
@@ -135,4 +136,117 @@ TEST_F(QueryTests, test_get_stored_query_names) {
   auto in_vector = std::find(names.begin(), names.end(), "foobar");
   EXPECT_NE(in_vector, names.end());
 }
+
+TEST_F(QueryTests, test_shared_results) {
+  // Two query names producing identical results store a single copy.
+  auto query = getOsqueryScheduledQuery();
+  auto first = Query("shared_first", query);
+  auto second = Query("shared_second", query);
+  auto results = getTestDBExpectedResults();
+  EXPECT_TRUE(first.addNewResults(results, db_).ok());
+  EXPECT_TRUE(second.addNewResults(results, db_).ok());
+
+  std::vector<std::string> keys;
+  db_->Scan(kQueryResults, keys, "results.");
+  EXPECT_EQ(keys.size(), 1U);
+
+  // Each name diffs and reads back its own results.
+  QueryData changed = {{{"changed", "1"}}};
+  DiffResults dr;
+  EXPECT_TRUE(first.addNewResults(changed, dr, true, db_).ok());
+  EXPECT_EQ(dr.added.size(), 1U);
+
+  QueryData qd;
+  EXPECT_TRUE(first.getPreviousQueryResults(qd, db_).ok());
+  EXPECT_EQ(qd, changed);
+  qd.clear();
+  EXPECT_TRUE(second.getPreviousQueryResults(qd, db_).ok());
+  EXPECT_EQ(qd, results);
+
+  // The unreferenced copy is removed.
+  EXPECT_TRUE(second.addNewResults(changed, dr, true, db_).ok());
+  keys.clear();
+  db_->Scan(kQueryResults, keys, "results.");
+  EXPECT_EQ(keys.size(), 1U);
+}
+
+TEST_F(QueryTests, test_previous_results_in_memory) {
+  auto query = getOsqueryScheduledQuery();
+  auto cf = Query("in_memory", query);
+  auto results = getTestDBExpectedResults();
+  EXPECT_TRUE(cf.addNewResults(results, db_).ok());
+
+  // Unchanged results are compared to the fingerprints kept in memory.
+  EXPECT_TRUE(db_->Delete(kQueryFingerprints, "in_memory").ok());
+  DiffResults dr;
+  EXPECT_TRUE(cf.addNewResults(results, dr, true, db_).ok());
+  EXPECT_TRUE(dr.added.empty());
+  EXPECT_TRUE(dr.removed.empty());
+
+  // Changed results are diffed with the stored rows and stored again.
+  QueryData changed = {{{"changed", "1"}}};
+  EXPECT_TRUE(cf.addNewResults(changed, dr, true, db_).ok());
+  EXPECT_EQ(dr.added.size(), 1U);
+  EXPECT_EQ(dr.removed.size(), results.size());
+
+  QueryDataFingerprints fps;
+  EXPECT_TRUE(cf.getPreviousFingerprints(fps, db_).ok());
+  EXPECT_EQ(fps, fingerprintQueryData(changed));
+}
+
+TEST_F(QueryTests, test_query_history) {
+  auto query = getOsqueryScheduledQuery();
+  auto cf = Query("history", query);
+  auto history = FLAGS_schedule_history;
+  FLAGS_schedule_history = 2;
+
+  QueryData first = {{{"name", "a"}}};
+  QueryData second = {{{"name", "a"}}, {{"name", "b"}}};
+  QueryData third = {{{"name", "b"}}, {{"name", "c"}}};
+
+  // Each generation is stored in a different second.
+  DiffResults dr;
+  size_t first_time = getUnixTime();
+  EXPECT_TRUE(cf.addNewResults(first, dr, true, db_).ok());
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+  size_t second_time = getUnixTime();
+  EXPECT_TRUE(cf.addNewResults(second, dr, true, db_).ok());
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+  size_t third_time = getUnixTime();
+  EXPECT_TRUE(cf.addNewResults(third, dr, true, db_).ok());
+
+  QueryData results;
+  size_t generation = 0;
+  size_t generation_time = 0;
+  EXPECT_TRUE(cf.getHistoricalResults(
+                    third_time, results, generation, generation_time, db_)
+                  .ok());
+  EXPECT_EQ(results, third);
+  EXPECT_EQ(generation, 3U);
+  EXPECT_EQ(generation_time, third_time);
+
+  // The change from the second generation is undone.
+  results.clear();
+  EXPECT_TRUE(cf.getHistoricalResults(
+                    second_time, results, generation, generation_time, db_)
+                  .ok());
+  EXPECT_EQ(results, second);
+  EXPECT_EQ(generation, 2U);
+
+  // Only two generations are kept.
+  std::vector<std::string> keys;
+  db_->Scan(kQueryHistory, keys, "history\n");
+  EXPECT_EQ(keys.size(), 2U);
+  EXPECT_FALSE(cf.getHistoricalResults(
+                     first_time, results, generation, generation_time, db_)
+                   .ok());
+
+  // Results stored without history cannot be undone.
+  FLAGS_schedule_history = 0;
+  EXPECT_TRUE(cf.addNewResults(first, dr, true, db_).ok());
+  EXPECT_FALSE(cf.getHistoricalResults(
+                     getUnixTime(), results, generation, generation_time, db_)
+                   .ok());
+  FLAGS_schedule_history = history;
+}
 }
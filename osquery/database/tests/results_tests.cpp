@@ -15,14 +15,18 @@
 #include <gtest/gtest.h>
 
 #include <osquery/database.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/profiler.h"
 #include "osquery/core/test_util.h"
 
 namespace pt = boost::property_tree;
 
 namespace osquery {
 
+DECLARE_bool(database_compress_results);
+
 class ResultsTests : public testing::Test {};
 std::string escapeNonPrintableBytes(const std::string& data);
 
@@ -39,6 +43,131 @@ TEST_F(ResultsTests, test_simple_diff) {
   EXPECT_EQ(results.removed, o);
 }
 
+TEST_F(ResultsTests, test_diff_duplicates) {
+  Row r1 = {{"foo", "bar"}};
+  Row r2 = {{"foo", "baz"}};
+  Row r3 = {{"fo", "obar"}};
+
+  QueryData o = {r1, r1, r2};
+  QueryData n = {r1, r3};
+  auto results = diff(o, n);
+  // One copy of r1 remains, the extra copy and r2 were removed.
+  EXPECT_EQ(results.added, QueryData({r3}));
+  EXPECT_EQ(results.removed, QueryData({r1, r2}));
+
+  // Unchanged results in a different order have no differential.
+  results = diff(o, {r2, r1, r1});
+  EXPECT_TRUE(results.added.empty());
+  EXPECT_TRUE(results.removed.empty());
+}
+
+TEST_F(ResultsTests, test_keyed_diff) {
+  Row r1 = {{"pid", "1"}, {"name", "a"}, {"state", "R"}};
+  Row r2 = {{"pid", "2"}, {"name", "b"}, {"state", "S"}};
+  Row r3 = {{"pid", "3"}, {"name", "c"}, {"state", "S"}};
+  Row r2_changed = {{"pid", "2"}, {"name", "b"}, {"state", "R"}};
+
+  QueryData o = {r1, r2};
+  QueryData n = {r2_changed, r3};
+  std::vector<std::string> keys = {"pid"};
+  auto results = diff(
+      o, fingerprintQueryData(o), n, fingerprintQueryData(n), keys);
+  // The changed row has the key columns and the changed values.
+  EXPECT_EQ(results.changed, QueryData({{{"pid", "2"}, {"state", "R"}}}));
+  EXPECT_EQ(results.added, QueryData({r3}));
+  EXPECT_EQ(results.removed, QueryData({r1}));
+
+  // Without keys rows are compared whole.
+  results = diff(o, n);
+  EXPECT_TRUE(results.changed.empty());
+  EXPECT_EQ(results.added, n);
+  EXPECT_EQ(results.removed, o);
+
+  // A key repeated within the results does not identify a row.
+  n = {r2_changed, {{"pid", "2"}, {"name", "d"}, {"state", "R"}}};
+  results = diff(
+      o, fingerprintQueryData(o), n, fingerprintQueryData(n), keys);
+  EXPECT_TRUE(results.changed.empty());
+  EXPECT_EQ(results.added, n);
+  EXPECT_FALSE(results.empty());
+}
+
+TEST_F(ResultsTests, test_row_fingerprints) {
+  Row r1 = {{"foo", "bar"}};
+  Row r2 = {{"fo", "obar"}};
+  Row r3 = {{"foo", "bar"}, {"baz", ""}};
+  EXPECT_EQ(fingerprintRow(r1), fingerprintRow({{"foo", "bar"}}));
+  EXPECT_NE(fingerprintRow(r1), fingerprintRow(r2));
+  EXPECT_NE(fingerprintRow(r1), fingerprintRow(r3));
+
+  auto fps = fingerprintQueryData({r1, r2, r3});
+  ASSERT_EQ(fps.size(), 3U);
+  auto raw = serializeFingerprints(fps);
+  EXPECT_EQ(raw.size(), 3 * sizeof(RowFingerprint));
+
+  QueryDataFingerprints output;
+  EXPECT_TRUE(deserializeFingerprints(raw, output).ok());
+  EXPECT_EQ(output, fps);
+  EXPECT_FALSE(deserializeFingerprints("bad", output).ok());
+}
+
+TEST_F(ResultsTests, test_serialize_query_data_binary) {
+  auto results = getSerializedQueryData();
+  for (const auto compress : {true, false}) {
+    FLAGS_database_compress_results = compress;
+    std::string raw;
+    EXPECT_TRUE(serializeQueryDataBinary(results.second, raw).ok());
+
+    QueryData output;
+    EXPECT_TRUE(deserializeQueryDataBinary(raw, output).ok());
+    EXPECT_EQ(output, results.second);
+
+    // A truncated encoding is an error, not a partial result.
+    output.clear();
+    raw.resize(raw.size() - 1);
+    EXPECT_FALSE(deserializeQueryDataBinary(raw, output).ok());
+  }
+  FLAGS_database_compress_results = true;
+
+  // Results stored as JSON are still readable.
+  std::string json;
+  serializeQueryDataJSON(results.second, json);
+  QueryData output;
+  EXPECT_TRUE(deserializeQueryDataBinary(json, output).ok());
+  EXPECT_EQ(output, results.second);
+}
+
+TEST_F(ResultsTests, test_serialize_query_data_columnar) {
+  QueryData rows;
+  for (size_t i = 0; i < 20; i++) {
+    Row r;
+    r["action"] = (i % 2 == 0) ? "CREATED" : "UPDATED";
+    r["target_path"] = "/etc/file" + std::to_string(i);
+    if (i != 3) {
+      r["category"] = "etc";
+    }
+    rows.push_back(r);
+  }
+
+  std::string raw;
+  EXPECT_TRUE(serializeQueryDataColumnar(rows, raw).ok());
+  QueryData output;
+  EXPECT_TRUE(deserializeQueryDataBinary(raw, output).ok());
+  EXPECT_EQ(output, rows);
+
+  // Repeated values are stored once.
+  std::string row_raw;
+  serializeQueryDataBinary(rows, row_raw);
+  FLAGS_database_compress_results = false;
+  serializeQueryDataColumnar(rows, raw);
+  FLAGS_database_compress_results = true;
+  EXPECT_LT(raw.size(), row_raw.size());
+
+  output.clear();
+  raw.resize(raw.size() - 1);
+  EXPECT_FALSE(deserializeQueryDataBinary(raw, output).ok());
+}
+
 TEST_F(ResultsTests, test_serialize_row) {
   auto results = getSerializedRow();
   pt::ptree tree;
@@ -137,6 +266,50 @@ TEST_F(ResultsTests, test_deserialize_query_log_item_json) {
   EXPECT_EQ(output, results.second);
 }
 
+TEST_F(ResultsTests, test_serialize_query_log_item_as_columns) {
+  QueryLogItem item;
+  item.name = "sockets";
+  item.identifier = "host";
+  item.calendar_time = "Tue Sep 30 17:37:30 2014";
+  item.time = 1412123850;
+  item.results.added = {{{"pid", "1"}, {"path", "a"}},
+                        {{"pid", "2"}, {"path", "a"}}};
+  item.results.removed = {{{"pid", "3"}, {"path", "b"}}};
+
+  std::string json;
+  EXPECT_TRUE(serializeQueryLogItemAsColumnsJSON(item, json).ok());
+  EXPECT_EQ(json,
+            "{\"name\":\"sockets\",\"hostIdentifier\":\"host\","
+            "\"calendarTime\":\"Tue Sep 30 17:37:30 2014\","
+            "\"unixTime\":\"1412123850\",\"columns\":[\"path\",\"pid\"],"
+            "\"added\":[[\"a\",\"1\"],[\"a\",\"2\"]],"
+            "\"removed\":[[\"b\",\"3\"]]}\n");
+
+  QueryLogItem output;
+  EXPECT_TRUE(deserializeQueryLogItemColumnsJSON(json, output).ok());
+  EXPECT_EQ(output.results, item.results);
+  EXPECT_EQ(output.time, item.time);
+
+  // Delta rows only include the changed values, by column index.
+  EXPECT_TRUE(serializeQueryLogItemAsColumnsJSON(item, json, true).ok());
+  EXPECT_NE(json.find("\"added\":[[\"a\",\"1\"],{\"1\":\"2\"}]"),
+            std::string::npos);
+
+  output = QueryLogItem();
+  EXPECT_TRUE(deserializeQueryLogItemColumnsJSON(json, output).ok());
+  EXPECT_EQ(output.results, item.results);
+  // Changed rows only include their key and changed values.
+  item.results.changed = {{{"pid", "4"}, {"path", "c"}}, {{"pid", "5"}}};
+  EXPECT_TRUE(serializeQueryLogItemAsColumnsJSON(item, json).ok());
+  EXPECT_NE(
+      json.find("\"changed\":[{\"0\":\"c\",\"1\":\"4\"},{\"1\":\"5\"}]"),
+      std::string::npos);
+
+  output = QueryLogItem();
+  EXPECT_TRUE(deserializeQueryLogItemColumnsJSON(json, output).ok());
+  EXPECT_EQ(output.results, item.results);
+}
+
 TEST_F(ResultsTests, test_unicode_to_ascii_conversion) {
   EXPECT_EQ(escapeNonPrintableBytes("しかたがない"),
             "\\xE3\\x81\\x97\\xE3\\x81\\x8B\\xE3\\x81\\x9F\\xE3\\x81\\x8C\\xE3"
@@ -162,6 +335,85 @@ TEST_F(ResultsTests, test_unicode_to_ascii_conversion) {
   EXPECT_EQ(
       escapeNonPrintableBytes("The quick brown fox jumps over the lazy dog."),
       "The quick brown fox jumps over the lazy dog.");
+  EXPECT_EQ(escapeNonPrintableBytes(std::string(40, 'a') + "\t" +
+                                    std::string(20, 'b') + "\xFF"),
+            std::string(40, 'a') + "\\x09" + std::string(20, 'b') + "\\xFF");
+}
+
+TEST_F(ResultsTests, test_query_data_needs_escaping) {
+  QueryData qd = {{{"name", "osqueryd"}}, {{"path", "/usr/bin"}}};
+  EXPECT_FALSE(queryDataNeedsEscaping(qd));
+
+  qd[1]["path"] = "/usr/\xE3";
+  EXPECT_TRUE(queryDataNeedsEscaping(qd));
+  QueryData escaped;
+  escapeQueryData(qd, escaped);
+  EXPECT_FALSE(queryDataNeedsEscaping(escaped));
+  EXPECT_EQ(escaped[1]["path"], "/usr/\\xE3");
+
+  escapeQueryData(qd);
+  EXPECT_EQ(qd, escaped);
+}
+
+TEST_F(ResultsTests, test_escape_query_data_in_place) {
+  // A large result where one value in every hundred rows needs escaping.
+  QueryData qd;
+  size_t total_bytes = 0;
+  for (size_t i = 0; i < 10000; i++) {
+    Row r;
+    r["path"] = "/usr/local/bin/" + std::to_string(i) + std::string(32, 'a');
+    r["name"] = (i % 100 == 0) ? "bin\xE3" : "binary";
+    for (const auto& column : r) {
+      total_bytes += column.first.size() + column.second.size();
+    }
+    qd.push_back(std::move(r));
+  }
+  auto expected = qd;
+  for (size_t i = 0; i < expected.size(); i += 100) {
+    expected[i]["name"] = "bin\\xE3";
+  }
+
+  // Only the 100 escaped values are allocated, rows are not copied.
+  QueryProfile profile;
+  {
+    ScopedQueryProfile profiler(profile);
+    escapeQueryData(qd);
+  }
+  EXPECT_EQ(qd, expected);
+  EXPECT_LE(profile.allocated, 100U * 64);
+  EXPECT_LT(profile.allocated * 100, total_bytes);
+}
+
+TEST_F(ResultsTests, test_result_set) {
+  QueryData qd = {{{"b", "1"}, {"a", "x"}}, {{"a", ""}}};
+  auto rs = ResultSet::fromQueryData(qd);
+  ASSERT_EQ(rs.rows(), 2U);
+  ASSERT_EQ(rs.columns(), 2U);
+  EXPECT_EQ(rs.toQueryData(), qd);
+
+  // Schemas are interned, and a missing column is not an empty value.
+  EXPECT_EQ(rs.schema(), ColumnSchema::get({"a", "b"}));
+  size_t column = 0;
+  EXPECT_TRUE(rs.schema()->index("b", column));
+  EXPECT_EQ(rs.value(0, column).str(), "1");
+  EXPECT_FALSE(rs.hasValue(1, column));
+  EXPECT_TRUE(rs.hasValue(1, 0));
+  EXPECT_FALSE(rs.schema()->index("c", column));
+
+  // Fingerprints and the binary encoding match the equivalent QueryData.
+  EXPECT_EQ(fingerprintResultSet(rs), fingerprintQueryData(qd));
+  std::string raw;
+  std::string expected;
+  EXPECT_TRUE(serializeResultSetBinary(rs, raw).ok());
+  EXPECT_TRUE(serializeQueryDataBinary(qd, expected).ok());
+  EXPECT_EQ(raw, expected);
+
+  // Columns in result order are fingerprinted in name order.
+  ResultSet ordered(ColumnSchema::get({"b", "a"}));
+  ordered.addRow();
+  ordered.setValue(0, "1");
+  ordered.setValue(1, "x");
+  EXPECT_EQ(fingerprintResultSet(ordered)[0], fingerprintRow(qd[0]));
 }
 
 TEST_F(ResultsTests, test_adding_duplicate_rows_to_query_data) {
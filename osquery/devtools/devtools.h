@@ -59,6 +59,62 @@ void prettyPrint(const QueryData& results,
                  const std::vector<std::string>& columns,
                  std::map<std::string, size_t>& lengths);
 
+/**
+ * @brief Pretty print rows as a query generates them
+ *
+ * The first rows are held to compute the column widths. When the sample is
+ * full the header and held rows are printed, and each later row is printed
+ * as it is added. A later value wider than its column extends past it.
+ * Results smaller than the sample print the same as prettyPrint.
+ */
+class PrettyPrinter {
+ public:
+  /// Hold up to sample rows before printing.
+  explicit PrettyPrinter(size_t sample) : sample_(sample), printed_(false) {}
+
+  /**
+   * @brief Add a result row, printing it when the columns are sized
+   *
+   * @param columns The order of the keys (since maps are unordered)
+   * @param r The result row
+   */
+  void addRow(const std::vector<std::string>& columns, const Row& r);
+
+  /// Print any held rows and the closing separator, then reset.
+  void finish();
+
+ private:
+  /// Size the columns, then print the header and held rows.
+  void printHeld();
+
+ private:
+  size_t sample_;
+  bool printed_;
+  QueryData rows_;
+  std::vector<std::string> columns_;
+  std::map<std::string, size_t> lengths_;
+  std::string separator_;
+};
+
+/**
+ * @brief JSON print a row of a streamed JSON array
+ *
+ * The first row opens the array, later rows follow a separator.
+ *
+ * @param r The row to print
+ * @param index The number of rows printed before this row
+ *
+ * @return false if the row could not be serialized and was not printed
+ */
+bool jsonPrintRow(const Row& r, size_t index);
+
+/**
+ * @brief Close a streamed JSON array
+ *
+ * @param count The number of rows printed with jsonPrintRow
+ */
+void jsonPrintEnd(size_t count);
+
 /**
  * @brief JSON print a QueryData object
  *
@@ -85,10 +85,10 @@ std::string generateRow(const Row& r,
     }
     // Print a terminator for the previous value or lhs, followed by spaces.
 
+    // A value wider than its column extends past it.
     int buffer_size = lengths.at(column) - utf8StringSize(r.at(column)) + 1;
-    if (buffer_size > 0) {
-      out += kToken + " " + r.at(column) + std::string(buffer_size, ' ');
-    }
+    out += kToken + " " + r.at(column) +
+           std::string((buffer_size > 0) ? buffer_size : 1, ' ');
   }
 
   if (out.size() > 0) {
@@ -121,19 +121,75 @@ void prettyPrint(const QueryData& results,
   printf("%s", separator.c_str());
 }
 
+void PrettyPrinter::addRow(const std::vector<std::string>& columns,
+                           const Row& r) {
+  if (printed_) {
+    printf("%s", generateRow(r, lengths_, columns_).c_str());
+    return;
+  }
+
+  if (columns_.empty()) {
+    columns_ = columns;
+  }
+  computeRowLengths(r, lengths_);
+  rows_.push_back(r);
+  if (rows_.size() >= sample_) {
+    printHeld();
+  }
+}
+
+void PrettyPrinter::printHeld() {
+  // Call a final compute using the column names as minimum lengths.
+  computeRowLengths(rows_.front(), lengths_, true);
+
+  separator_ = generateToken(lengths_, columns_);
+  auto header = separator_ + generateHeader(lengths_, columns_) + separator_;
+  printf("%s", header.c_str());
+  for (const auto& row : rows_) {
+    printf("%s", generateRow(row, lengths_, columns_).c_str());
+  }
+  rows_.clear();
+  printed_ = true;
+}
+
+void PrettyPrinter::finish() {
+  if (!printed_ && !rows_.empty()) {
+    printHeld();
+  }
+
+  if (printed_) {
+    printf("%s", separator_.c_str());
+  }
+
+  printed_ = false;
+  rows_.clear();
+  columns_.clear();
+  lengths_.clear();
+  separator_.clear();
+}
+
+bool jsonPrintRow(const Row& r, size_t index) {
+  std::string row_string;
+  if (!serializeRowJSON(r, row_string).ok()) {
+    return false;
+  }
+  row_string.pop_back();
+  printf((index == 0) ? "[\n  %s" : ",\n  %s", row_string.c_str());
+  return true;
+}
+
+void jsonPrintEnd(size_t count) {
+  printf((count == 0) ? "[\n\n]\n" : "\n]\n");
+}
+
 void jsonPrint(const QueryData& q) {
-  printf("[\n");
-  for (int i = 0; i < q.size(); ++i) {
-    std::string row_string;
-    if (serializeRowJSON(q[i], row_string).ok()) {
-      row_string.pop_back();
-      printf("  %s", row_string.c_str());
-      if (i < q.size() - 1) {
-        printf(",\n");
-      }
+  size_t count = 0;
+  for (const auto& row : q) {
+    if (jsonPrintRow(row, count)) {
+      count++;
     }
   }
-  printf("\n]\n");
+  jsonPrintEnd(count);
 }
 
 void computeRowLengths(const Row& r,
@@ -18,6 +18,10 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <readline/readline.h>
 #include <readline/history.h>
 
@@ -29,6 +33,7 @@
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
 
+#include "osquery/core/profiler.h"
 #include "osquery/devtools/devtools.h"
 #include "osquery/sql/virtual_table.h"
 
@@ -41,6 +46,10 @@ SHELL_FLAG(bool, line, false, "Set output mode to 'line'");
 SHELL_FLAG(bool, list, false, "Set output mode to 'list'");
 SHELL_FLAG(string, nullvalue, "", "Set string for NULL values, default ''");
 SHELL_FLAG(string, separator, "|", "Set output field separator, default '|'");
+SHELL_FLAG(uint64,
+           pretty_sample,
+           1000,
+           "Rows sampled for pretty column widths before rows are printed");
 
 /// Define short-hand shell switches.
 SHELL_FLAG(bool, L, false, "List all table names");
@@ -68,6 +77,7 @@ static char zHelp[] =
     "                     pretty   Pretty printed SQL results\n"
     ".nullvalue STR     Use STRING in place of NULL values\n"
     ".print STR...      Print literal STRING\n"
+    ".profile ON|OFF    Show table plans, scans, and times for each query\n"
     ".quit              Exit this program\n"
     ".schema [TABLE]    Show the CREATE statements\n"
     ".separator STR     Change separator used by output mode and .import\n"
@@ -105,6 +115,9 @@ extern int isatty(int);
 /* True if the timer is enabled */
 static int enableTimer = 0;
 
+/* True if each statement's virtual table work is profiled */
+static int enableProfile = 0;
+
 /* Return the current wall-clock time */
 static sqlite3_int64 timeOfDay(void) {
   static sqlite3_vfs *clockVfs = 0;
@@ -300,9 +313,10 @@ struct previous_mode_data {
 ** Pretty print structure
  */
 struct prettyprint_data {
-  osquery::QueryData results;
   std::vector<std::string> columns;
-  std::map<std::string, size_t> lengths;
+  /* Rows are printed as they are generated */
+  osquery::PrettyPrinter printer{osquery::FLAGS_pretty_sample};
+  size_t json_rows{0};
 };
 
 /*
@@ -492,8 +506,13 @@ static int shell_callback(
         r[std::string(azCol[i])] = std::string(azArg[i]);
       }
     }
-    osquery::computeRowLengths(r, p->prettyPrint->lengths);
-    p->prettyPrint->results.push_back(r);
+    if (osquery::FLAGS_json) {
+      if (osquery::jsonPrintRow(r, p->prettyPrint->json_rows)) {
+        p->prettyPrint->json_rows++;
+      }
+    } else {
+      p->prettyPrint->printer.addRow(p->prettyPrint->columns, r);
+    }
     break;
   }
   case MODE_Line: {
@@ -707,6 +726,76 @@ static char *save_err_msg(sqlite3 *db /* Database to query */
   return zErrMsg;
 }
 
+/* Format microseconds as milliseconds */
+static double toMilliseconds(uint64_t time) { return time / 1000.0; }
+
+/*
+** Print event counts, read when osqueryi runs with --enable_perf_counters.
+*/
+static void print_counters(FILE *out,
+                           const char *indent,
+                           const osquery::PerfCounters &counters) {
+  if (counters.instructions == 0 && counters.context_switches == 0 &&
+      counters.page_faults == 0) {
+    return;
+  }
+  fprintf(out,
+          "%sCounters: %llu instructions %llu cycles %llu cache misses "
+          "%llu context switches %llu page faults\n",
+          indent,
+          (unsigned long long)counters.instructions,
+          (unsigned long long)counters.cycles,
+          (unsigned long long)counters.cache_misses,
+          (unsigned long long)counters.context_switches,
+          (unsigned long long)counters.page_faults);
+}
+
+/*
+** Print the virtual table plans, scans, and times of a profiled statement.
+*/
+static void print_profile(FILE *out,
+                          const std::string &sql,
+                          const osquery::QueryProfile &profile) {
+  fprintf(out, "Profile: %s\n", sql.c_str());
+  fprintf(out,
+          "  Time: real %.3fms user %.3fms sys %.3fms\n",
+          toMilliseconds(profile.wall_time),
+          toMilliseconds(profile.user_time),
+          toMilliseconds(profile.system_time));
+  fprintf(out,
+          "  Phases: plan %.3fms generate %.3fms serialize %.3fms\n",
+          toMilliseconds(profile.plan_time),
+          toMilliseconds(profile.generate_time),
+          toMilliseconds(profile.serialize_time));
+  print_counters(out, "  ", profile.counters);
+  for (const auto &table : profile.tables) {
+    const auto &stats = table.second;
+    auto time = profile.table_times.find(table.first);
+    fprintf(out,
+            "  Table %s: %llu filter(s) (%llu cached, %llu memoized), "
+            "%llu row(s), generate %.3fms\n",
+            table.first.c_str(),
+            (unsigned long long)stats.filters,
+            (unsigned long long)stats.cache_hits,
+            (unsigned long long)stats.memo_hits,
+            (unsigned long long)stats.rows,
+            toMilliseconds(
+                (time != profile.table_times.end()) ? time->second : 0));
+    auto counters = profile.table_counters.find(table.first);
+    if (counters != profile.table_counters.end()) {
+      print_counters(out, "    ", counters->second);
+    }
+    for (const auto &plan : stats.plans) {
+      fprintf(out,
+              "    Plan [%s]: cost %.1f rows %llu, %llu filter(s)\n",
+              plan.constraints.c_str(),
+              plan.cost,
+              (unsigned long long)plan.estimated_rows,
+              (unsigned long long)plan.filters);
+    }
+  }
+}
+
 /*
 ** Execute a statement or set of statements.  Print
 ** any result rows/columns depending on the current mode
@@ -737,8 +826,20 @@ static int shell_exec(
     *pzErrMsg = nullptr;
   }
 
+  /* profiles are printed after the results of every statement */
+  std::vector<std::pair<std::string, osquery::QueryProfile> > profiles;
+
   while (zSql[0] && (SQLITE_OK == rc)) {
-    rc = sqlite3_prepare_v2(db, zSql, -1, &pStmt, &zLeftover);
+    osquery::QueryProfile profile;
+    std::unique_ptr<osquery::ScopedQueryProfile> profiler;
+    if (enableProfile) {
+      profiler.reset(new osquery::ScopedQueryProfile(profile));
+    }
+
+    {
+      osquery::ProfilePhase phase(&osquery::QueryProfile::plan_time);
+      rc = sqlite3_prepare_v2(db, zSql, -1, &pStmt, &zLeftover);
+    }
     if (SQLITE_OK != rc) {
       if (pzErrMsg) {
         *pzErrMsg = save_err_msg(db);
@@ -801,7 +902,13 @@ static int shell_exec(
               /* if data and types extracted successfully... */
               if (SQLITE_ROW == rc) {
                 /* call the supplied callback with the result row data */
-                if (xCallback(pArg, nCol, azVals, azCols, aiTypes)) {
+                int aborted;
+                {
+                  osquery::ProfilePhase phase(
+                      &osquery::QueryProfile::serialize_time);
+                  aborted = xCallback(pArg, nCol, azVals, azCols, aiTypes);
+                }
+                if (aborted) {
                   rc = SQLITE_ABORT;
                 } else {
                   rc = sqlite3_step(pStmt);
@@ -817,6 +924,12 @@ static int shell_exec(
         }
       }
 
+      if (profiler != nullptr) {
+        const char *zStmtSql = sqlite3_sql(pStmt);
+        profiler.reset();
+        profiles.push_back(std::make_pair(zStmtSql ? zStmtSql : "", profile));
+      }
+
       /* Finalize the statement just executed. If this fails, save a
       ** copy of the error message. Otherwise, set zSql to point to the
       ** next statement to execute. */
@@ -839,16 +952,23 @@ static int shell_exec(
   } /* end while */
 
   if (pArg && pArg->mode == MODE_Pretty) {
+    /* pretty results are printed with the last statement's serialization */
+    std::unique_ptr<osquery::ScopedQueryProfile> profiler;
+    if (!profiles.empty()) {
+      profiler.reset(new osquery::ScopedQueryProfile(profiles.back().second));
+    }
+    osquery::ProfilePhase phase(&osquery::QueryProfile::serialize_time);
     if (osquery::FLAGS_json) {
-      osquery::jsonPrint(pArg->prettyPrint->results);
+      osquery::jsonPrintEnd(pArg->prettyPrint->json_rows);
     } else {
-      osquery::prettyPrint(pArg->prettyPrint->results,
-                           pArg->prettyPrint->columns,
-                           pArg->prettyPrint->lengths);
+      pArg->prettyPrint->printer.finish();
     }
-    pArg->prettyPrint->results.clear();
+    pArg->prettyPrint->json_rows = 0;
     pArg->prettyPrint->columns.clear();
-    pArg->prettyPrint->lengths.clear();
+  }
+
+  for (const auto &profile : profiles) {
+    print_profile(stderr, profile.first, profile.second);
   }
 
   return rc;
@@ -1172,6 +1292,9 @@ static int do_meta_command(char *zLine, struct callback_data *p) {
       fprintf(p->out, "%s", azArg[i]);
     }
     fprintf(p->out, "\n");
+  } else if (c == 'p' && n >= 3 && strncmp(azArg[0], "profile", n) == 0 &&
+             nArg == 2) {
+    enableProfile = booleanValue(azArg[1]);
   } else if (c == 'q' && strncmp(azArg[0], "quit", n) == 0 && nArg == 1) {
     rc = 2;
   } else if (c == 's' && strncmp(azArg[0], "schema", n) == 0 && nArg < 3) {
@@ -1187,6 +1310,7 @@ static int do_meta_command(char *zLine, struct callback_data *p) {
     fprintf(p->out, "%9.9s: %s\n", "echo", p->echoOn ? "on" : "off");
     fprintf(p->out, "%9.9s: %s\n", "headers", p->showHeader ? "on" : "off");
     fprintf(p->out, "%9.9s: %s\n", "mode", modeDescr[p->mode]);
+    fprintf(p->out, "%9.9s: %s\n", "profile", enableProfile ? "on" : "off");
     fprintf(p->out, "%9.9s: ", "nullvalue");
     output_c_string(p->out, p->nullvalue);
     fprintf(p->out, "\n");
@@ -95,6 +95,61 @@ TEST_F(PrinterTests, test_generate_row) {
   EXPECT_EQ(results, expected);
 }
 
+TEST_F(PrinterTests, test_pretty_printer) {
+  std::map<std::string, size_t> lengths;
+  for (const auto& row : q) {
+    computeRowLengths(row, lengths);
+  }
+
+  // A result within the sample prints the same as prettyPrint.
+  testing::internal::CaptureStdout();
+  prettyPrint(q, order, lengths);
+  auto expected = testing::internal::GetCapturedStdout();
+
+  PrettyPrinter printer(q.size());
+  testing::internal::CaptureStdout();
+  for (const auto& row : q) {
+    printer.addRow(order, row);
+  }
+  printer.finish();
+  EXPECT_EQ(testing::internal::GetCapturedStdout(), expected);
+
+  // Rows after the sample are printed as they are added.
+  PrettyPrinter streaming(1);
+  testing::internal::CaptureStdout();
+  streaming.addRow(order, q[0]);
+  auto header = testing::internal::GetCapturedStdout();
+  EXPECT_NE(header.find("| Mike Jones |"), std::string::npos);
+
+  testing::internal::CaptureStdout();
+  streaming.addRow(order, q[1]);
+  EXPECT_EQ(testing::internal::GetCapturedStdout(),
+            "| John Smith | 44  | peanut butter and jelly | 2      |\n");
+  testing::internal::CaptureStdout();
+  streaming.finish();
+  EXPECT_EQ(testing::internal::GetCapturedStdout(),
+            "+------------+-----+----------------+--------+\n");
+}
+
+TEST_F(PrinterTests, test_json_print) {
+  testing::internal::CaptureStdout();
+  jsonPrint(q);
+  auto expected = testing::internal::GetCapturedStdout();
+  EXPECT_EQ(expected.find("[\n  {"), 0U);
+
+  // Streamed rows match the printed QueryData.
+  testing::internal::CaptureStdout();
+  for (size_t i = 0; i < q.size(); ++i) {
+    EXPECT_TRUE(jsonPrintRow(q[i], i));
+  }
+  jsonPrintEnd(q.size());
+  EXPECT_EQ(testing::internal::GetCapturedStdout(), expected);
+
+  testing::internal::CaptureStdout();
+  jsonPrintEnd(0);
+  EXPECT_EQ(testing::internal::GetCapturedStdout(), "[\n\n]\n");
+}
+
 TEST_F(PrinterTests, test_unicode) {
   Row r = {{"name", "Àlex Smith"}};
   std::map<std::string, size_t> lengths;
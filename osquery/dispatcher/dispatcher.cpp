@@ -14,42 +14,146 @@
 #include <osquery/logger.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/core/metrics.h"
 #include "osquery/dispatcher/dispatcher.h"
 
-using namespace apache::thrift::concurrency;
-
 namespace osquery {
 
 /// The worker_threads define the default thread pool size.
 FLAG(int32, worker_threads, 4, "Number of work dispatch threads");
 
+/// Tasks queued and not yet taken by a worker.
+static MetricGauge kDispatcherPending("dispatcher.pending");
+
+/// Tasks taken from another worker's deque.
+static MetricCounter kDispatcherStolen("dispatcher.stolen");
+
+/// Microseconds between adding a task and a worker taking it.
+static MetricHistogram kDispatcherWait("dispatcher.wait");
+
+/// The deque index of a Dispatcher worker thread, -1 for other threads.
+static thread_local long kWorkerIndex = -1;
+
 void interruptableSleep(size_t milli) {
   boost::this_thread::sleep(boost::posix_time::milliseconds(milli));
 }
 
 Dispatcher::Dispatcher() {
-  thread_manager_ = InternalThreadManager::newSimpleThreadManager(
-          (size_t)FLAGS_worker_threads, 0);
-  auto thread_factory = ThriftThreadFactory(new PosixThreadFactory());
-  thread_manager_->threadFactory(thread_factory);
-  thread_manager_->start();
+  std::lock_guard<std::mutex> lock(mutex_);
+  startWorkers();
 }
 
 Dispatcher::~Dispatcher() { join(); }
 
-Status Dispatcher::add(ThriftInternalRunnableRef task) {
+void Dispatcher::startWorkers() {
+  // Workers of an earlier generation exit once their task completes.
+  stopping_ = false;
+  generation_++;
+  size_t threads = (FLAGS_worker_threads > 1) ? FLAGS_worker_threads : 1;
+  while (queues_.size() < threads) {
+    queues_.emplace_back(new TaskQueue());
+  }
+  for (size_t i = 0; i < threads; ++i) {
+    workers_.emplace_back(
+        new boost::thread(boost::bind(&Dispatcher::work, this, i, generation_)));
+  }
+}
+
+Status Dispatcher::add(InternalRunnableRef task, TaskPriority priority) {
+  if (task == nullptr) {
+    return Status(1, "Cannot add an empty task");
+  }
+
   auto& self = instance();
-  try {
-    if (self.state() != InternalThreadManager::STARTED) {
-      self.thread_manager_->start();
+  {
+    std::lock_guard<std::mutex> lock(self.mutex_);
+    if (self.workers_.empty()) {
+      self.startWorkers();
     }
-    instance().thread_manager_->add(task, 0, 0);
-  } catch (std::exception& e) {
-    return Status(1, e.what());
+
+    // A worker's tasks stay on its own deque, others are spread.
+    TaskQueue* queue = &self.priority_;
+    if (priority == TASK_NORMAL) {
+      size_t index = (kWorkerIndex >= 0 &&
+                      (size_t)kWorkerIndex < self.queues_.size())
+                         ? kWorkerIndex
+                         : self.next_++ % self.queues_.size();
+      queue = self.queues_[index].get();
+    }
+    {
+      std::lock_guard<std::mutex> queue_lock(queue->mutex);
+      queue->tasks.push_back({task, std::chrono::steady_clock::now()});
+    }
+    kDispatcherPending.set(++self.pending_);
   }
+  self.available_.notify_one();
   return Status(0, "OK");
 }
 
+bool Dispatcher::take(size_t index, PendingTask& task) {
+  auto pop = [this, &task](TaskQueue& queue, bool back) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+      return false;
+    }
+    if (back) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    } else {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+    // Count the task as executing before it stops being pending.
+    executing_++;
+    kDispatcherPending.set(--pending_);
+    return true;
+  };
+
+  if (pop(priority_, false) || pop(*queues_[index], false)) {
+    return true;
+  }
+
+  // Steal the most recently added task of another worker.
+  for (size_t i = 1; i < queues_.size(); ++i) {
+    if (pop(*queues_[(index + i) % queues_.size()], true)) {
+      kDispatcherStolen.add();
+      return true;
+    }
+  }
+  return false;
+}
+
+void Dispatcher::work(size_t index, size_t generation) {
+  kWorkerIndex = index;
+  while (true) {
+    PendingTask pending;
+    if (take(index, pending)) {
+      auto waited = std::chrono::steady_clock::now() - pending.added;
+      kDispatcherWait.record(
+          std::chrono::duration_cast<std::chrono::microseconds>(waited)
+              .count());
+      try {
+        pending.task->run();
+      } catch (const std::exception& e) {
+        LOG(ERROR) << "Dispatcher task failed: " << e.what();
+      }
+      pending.task.reset();
+      executing_--;
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (generation != generation_ || (stopping_ && pending_ <= 0)) {
+      return;
+    }
+    idle_++;
+    available_.wait(lock, [this, generation]() {
+      return pending_ > 0 || stopping_ || generation != generation_;
+    });
+    idle_--;
+  }
+}
+
 Status Dispatcher::addService(InternalRunnableRef service) {
   if (service->hasRun()) {
     return Status(1, "Cannot schedule a service twice");
@@ -63,14 +167,23 @@ Status Dispatcher::addService(InternalRunnableRef service) {
   return Status(0, "OK");
 }
 
-InternalThreadManagerRef Dispatcher::getThreadManager() const {
-  return instance().thread_manager_;
-}
-
 void Dispatcher::join() {
-  if (instance().thread_manager_ != nullptr) {
-    instance().thread_manager_->stop();
-    instance().thread_manager_->join();
+  auto& self = instance();
+  std::vector<std::unique_ptr<boost::thread>> workers;
+  {
+    std::lock_guard<std::mutex> lock(self.mutex_);
+    self.stopping_ = true;
+    workers.swap(self.workers_);
+  }
+  self.available_.notify_all();
+
+  // A task joining the pool would wait for itself.
+  for (auto& worker : workers) {
+    if (worker->get_id() != boost::this_thread::get_id()) {
+      worker->join();
+    } else {
+      worker->detach();
+    }
   }
 }
 
@@ -101,39 +214,19 @@ void Dispatcher::stopServices() {
   }
 }
 
-InternalThreadManager::STATE Dispatcher::state() const {
-  return instance().thread_manager_->state();
-}
-
-void Dispatcher::addWorker(size_t value) {
-  instance().thread_manager_->addWorker(value);
-}
-
-void Dispatcher::removeWorker(size_t value) {
-  instance().thread_manager_->removeWorker(value);
-}
-
-size_t Dispatcher::idleWorkerCount() const {
-  return instance().thread_manager_->idleWorkerCount();
-}
+size_t Dispatcher::idleWorkerCount() const { return instance().idle_; }
 
 size_t Dispatcher::workerCount() const {
-  return instance().thread_manager_->workerCount();
+  std::lock_guard<std::mutex> lock(instance().mutex_);
+  return instance().workers_.size();
 }
 
 size_t Dispatcher::pendingTaskCount() const {
-  return instance().thread_manager_->pendingTaskCount();
+  long pending = instance().pending_;
+  return (pending > 0) ? pending : 0;
 }
 
 size_t Dispatcher::totalTaskCount() const {
-  return instance().thread_manager_->totalTaskCount();
-}
-
-size_t Dispatcher::pendingTaskCountMax() const {
-  return instance().thread_manager_->pendingTaskCountMax();
-}
-
-size_t Dispatcher::expiredTaskCount() const {
-  return instance().thread_manager_->expiredTaskCount();
+  return pendingTaskCount() + instance().executing_;
 }
 }
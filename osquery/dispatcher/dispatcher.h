@@ -10,7 +10,12 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <vector>
@@ -20,24 +25,8 @@
 
 #include <osquery/core.h>
 
-// osquery is built with various versions of thrift that use different search
-// paths for their includes. Unfortunately, changing include paths is not
-// possible in every build system.
-// clang-format off
-#include CONCAT(OSQUERY_THRIFT_LIB,/concurrency/Thread.h)
-#include CONCAT(OSQUERY_THRIFT_LIB,/concurrency/ThreadManager.h)
-#include CONCAT(OSQUERY_THRIFT_LIB,/concurrency/PosixThreadFactory.h)
-// clang-format on
-
 namespace osquery {
 
-using namespace apache::thrift::concurrency;
-
-/// Create easier to reference typedefs for Thrift layer implementations.
-#define SHARED_PTR_IMPL OSQUERY_THRIFT_POINTER::shared_ptr
-typedef apache::thrift::concurrency::ThreadManager InternalThreadManager;
-typedef SHARED_PTR_IMPL<InternalThreadManager> InternalThreadManagerRef;
-
 /**
  * @brief Default number of threads in the thread pool.
  *
@@ -46,7 +35,7 @@ typedef SHARED_PTR_IMPL<InternalThreadManager> InternalThreadManagerRef;
  */
 extern const int kDefaultThreadPoolSize;
 
-class InternalRunnable : public Runnable {
+class InternalRunnable {
  public:
   virtual ~InternalRunnable() {}
   InternalRunnable() : run_(false) {}
@@ -77,16 +66,24 @@ class InternalRunnable : public Runnable {
 /// An internal runnable used throughout osquery as dispatcher services.
 typedef std::shared_ptr<InternalRunnable> InternalRunnableRef;
 typedef std::shared_ptr<boost::thread> InternalThreadRef;
-/// A thrift internal runnable with variable pointer wrapping.
-typedef SHARED_PTR_IMPL<InternalRunnable> ThriftInternalRunnableRef;
-typedef SHARED_PTR_IMPL<PosixThreadFactory> ThriftThreadFactory;
+
+/// The lane of a Dispatcher task, high priority tasks are taken first.
+enum TaskPriority {
+  TASK_NORMAL = 0,
+  TASK_HIGH = 1,
+};
 
 /**
  * @brief Singleton for queuing asynchronous tasks to be executed in parallel
  *
  * Dispatcher is a singleton which can be used to coordinate the parallel
- * execution of asynchronous tasks across an application. Internally,
- * Dispatcher is back by the Apache Thrift thread pool.
+ * execution of asynchronous tasks across an application. Long-running
+ * services each own a thread, short tasks share a pool of worker threads.
+ *
+ * Each worker has its own deque of tasks. Tasks added by a worker stay on its
+ * deque, other tasks are spread across the deques. A worker takes from the
+ * front of its own deque and, when that is empty, steals from the back of
+ * another's. A shared priority lane is checked before any deque.
  */
 class Dispatcher : private boost::noncopyable {
  public:
@@ -106,60 +103,39 @@ class Dispatcher : private boost::noncopyable {
    * @brief Add a task to the dispatcher.
    *
    * Adding tasks to the Dispatcher's thread pool requires you to create a
-   * "runnable" class which publicly implements Apache Thrift's Runnable
-   * class. Create a shared pointer to the class and you're all set to
-   * schedule work.
+   * "runnable" class which publicly implements InternalRunnable. Create a
+   * shared pointer to the class and you're all set to schedule work.
    *
    * @code{.cpp}
-   *   class TestRunnable : public apache::thrift::concurrency::Runnable {
+   *   class TestRunnable : public InternalRunnable {
    *    public:
    *     int* i;
    *     TestRunnable(int* i) : i(i) {}
-   *     virtual void run() { ++*i; }
+   *     virtual void start() { ++*i; }
    *   };
    *
    *   int i = 5;
-   *   Dispatcher::add(std::make_shared<TestRunnable>(&i);
-   *   while (dispatch->totalTaskCount() > 0) {}
+   *   Dispatcher::add(std::make_shared<TestRunnable>(&i));
+   *   while (Dispatcher::instance().totalTaskCount() > 0) {}
    *   assert(i == 6);
    * @endcode
    *
-   * @param task a C++11 std shared pointer to an instance of a class which
-   * publicly inherits from `apache::thrift::concurrency::Runnable`.
+   * @param task a shared pointer to an InternalRunnable.
+   * @param priority the lane of the task.
    *
    * @return osquery success status
    */
-  static Status add(ThriftInternalRunnableRef task);
+  static Status add(InternalRunnableRef task,
+                    TaskPriority priority = TASK_NORMAL);
 
   /// See `add`, but services are not limited to a thread poll size.
   static Status addService(InternalRunnableRef service);
 
   /**
-   * @brief Getter for the underlying thread manager instance.
-   *
-   * Use this getter if you'd like to perform some operations which the
-   * Dispatcher API doesn't support, but you are certain are supported by the
-   * backing Apache Thrift thread manager.
+   * @brief Joins the thread pool.
    *
-   * Use this method with caution, as it only exists to allow developers to
-   * iterate quickly in the event that the pragmatic decision to access the
-   * underlying thread manager has been determined to be necessary.
-   *
-   * @code{.cpp}
-   *   auto t = osquery::Dispatcher::getThreadManager();
-   * @endcode
-   *
-   * @return a shared pointer to the Apache Thrift `ThreadManager` instance
-   * which is currently being used to orchestrate multi-threaded operations.
-   */
-  InternalThreadManagerRef getThreadManager() const;
-
-  /**
-   * @brief Joins the thread manager.
-   *
-   * This is the same as stop, except that it will block until all the workers
-   * have finished their work. At that point the ThreadManager will transition
-   * into the STOPPED state.
+   * Pending tasks are executed, then the workers exit. A later `add` starts
+   * the workers again.
    */
   static void join();
 
@@ -169,39 +145,6 @@ class Dispatcher : private boost::noncopyable {
   /// Destroy and stop all osquery service threads and service objects.
   static void stopServices();
 
-  /**
-   * @brief Get the current state of the thread manager.
-   *
-   * @return an Apache Thrift STATE enum.
-   */
-  InternalThreadManager::STATE state() const;
-
-  /**
-   * @brief Add a worker thread.
-   *
-   * Use this method to add an additional thread to the thread pool.
-   *
-   * @param value is a size_t indicating how many additional worker threads
-   * should be added to the thread group. If not parameter is supplied, one
-   * worker thread is added.
-   *
-   * @see osquery::Dispatcher::removeWorker
-   */
-  static void addWorker(size_t value = 1);
-
-  /**
-   * @brief Remove a worker thread.
-   *
-   * Use this method to remove a thread from the thread pool.
-   *
-   * @param value is a size_t indicating how many additional worker threads
-   * should be removed from the thread group. If not parameter is supplied,
-   * one worker thread is removed.
-   *
-   * @see osquery::Dispatcher::addWorker
-   */
-  static void removeWorker(size_t value = 1);
-
   /**
    * @brief Gets the current number of idle worker threads.
    *
@@ -230,21 +173,6 @@ class Dispatcher : private boost::noncopyable {
    */
   size_t totalTaskCount() const;
 
-  /**
-   * @brief Gets the maximum pending task count. 0 indicates no maximum.
-   *
-   * @return the maximum pending task count. 0 indicates no maximum.
-   */
-  size_t pendingTaskCountMax() const;
-
-  /**
-   * @brief Gets the number of tasks which have been expired without being
-   * run.
-   *
-   * @return he number of tasks which have been expired without being run.
-   */
-  size_t expiredTaskCount() const;
-
  private:
   /**
    * @brief Default constructor.
@@ -258,17 +186,49 @@ class Dispatcher : private boost::noncopyable {
   virtual ~Dispatcher();
 
  private:
-  /**
-   * @brief Internal shared pointer which references Thrift's thread manager
-   *
-   * All thread operations occur via Apache Thrift's ThreadManager class. This
-   * private member represents a shared pointer to an instantiation of that
-   * thread manager, which can be used to accomplish various threading
-   * objectives.
-   *
-   * @see getThreadManager
-   */
-  InternalThreadManagerRef thread_manager_;
+  /// A queued task and the time it was added.
+  struct PendingTask {
+    InternalRunnableRef task;
+    std::chrono::steady_clock::time_point added;
+  };
+
+  /// A deque of tasks, the priority lane or a worker's own deque.
+  struct TaskQueue {
+    std::mutex mutex;
+    std::deque<PendingTask> tasks;
+  };
+
+  /// Start the worker threads, the caller holds mutex_.
+  void startWorkers();
+
+  /// A worker thread's loop, taking and executing tasks until joined.
+  void work(size_t index, size_t generation);
+
+  /// Take the next task for a worker, stealing if its deque is empty.
+  bool take(size_t index, PendingTask& task);
+
+ private:
+  /// Protects the workers and the stopping state, and wakes idle workers.
+  std::mutex mutex_;
+  std::condition_variable available_;
+  bool stopping_{false};
+  /// Incremented each time the workers are started.
+  size_t generation_{0};
+
+  /// The pool's worker threads and their deques.
+  std::vector<std::unique_ptr<boost::thread>> workers_;
+  std::vector<std::unique_ptr<TaskQueue>> queues_;
+
+  /// High priority tasks, taken by any worker before its own deque.
+  TaskQueue priority_;
+
+  /// The deque receiving the next task added by a non-worker thread.
+  std::atomic<size_t> next_{0};
+
+  /// Queued tasks, executing tasks, and workers waiting for tasks.
+  std::atomic<long> pending_{0};
+  std::atomic<size_t> executing_{0};
+  std::atomic<size_t> idle_{0};
 
   /// The set of shared osquery service threads.
   std::vector<InternalThreadRef> service_threads_;
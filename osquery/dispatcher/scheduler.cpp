@@ -8,15 +8,26 @@
  *
  */
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <ctime>
+#include <mutex>
 
 #include <osquery/config.h>
 #include <osquery/core.h>
 #include <osquery/database.h>
+#include <osquery/extensions.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 
+#include "osquery/core/arena.h"
+#include "osquery/core/priority.h"
+#include "osquery/core/profiler.h"
+#include "osquery/core/tracing.h"
+#include "osquery/core/watcher.h"
+#include "osquery/database/db_handle.h"
 #include "osquery/database/query.h"
 #include "osquery/dispatcher/scheduler.h"
 
@@ -31,6 +42,50 @@ FLAG(bool, enable_monitor, false, "Enable the schedule monitor");
 
 FLAG(uint64, schedule_timeout, 0, "Limit the schedule, 0 for no limit")
 
+FLAG(uint64,
+     metrics_log_interval,
+     0,
+     "Seconds between health logs of osquery_metrics, 0 to disable");
+
+FLAG(uint64,
+     schedule_query_timeout,
+     0,
+     "Seconds before a scheduled query is interrupted, 0 for no limit");
+
+FLAG(uint64,
+     database_maintenance_idle,
+     60,
+     "Seconds without scheduled queries before compacting expired events");
+
+FLAG(uint64,
+     schedule_denylist_duration,
+     86400,
+     "Seconds a query driving the worker to watchdog limits is denylisted");
+
+/// Persisted keys of denylisted queries and of queries executing in a worker.
+const std::string kDenylistPrefix = "denylist.";
+const std::string kExecutingPrefix = "executing.";
+
+/// Persisted keys of each scheduled query's most recent execution.
+const std::string kQueryStatePrefix = "schedule.";
+
+/// A throttled query's interval is doubled up to this multiple.
+const size_t kMaxBackoff = 8;
+
+/// Steps without watchdog pressure before backed off intervals are halved.
+const size_t kBackoffRecoverySteps = 600;
+
+/// Steps of the schedule balanced when placing queries.
+const size_t kScheduleHorizon = 3600;
+
+/// Phases, following a query's hashed phase, considered when placing it.
+const size_t kPlacementCandidates = 16;
+
+/// The deadline for a scheduled query, its own timeout or the default.
+inline size_t queryTimeout(const ScheduledQuery& query) {
+  return (query.timeout > 0) ? query.timeout : FLAGS_schedule_query_timeout;
+}
+
 Status getHostIdentifier(std::string& ident) {
   if (FLAGS_host_identifier != "uuid") {
     // use the hostname as the default machine identifier
@@ -38,6 +93,21 @@ Status getHostIdentifier(std::string& ident) {
     return Status(0, "OK");
   }
 
+  if (!getWorkerClass().empty()) {
+    // A class worker reports the default worker's identifier, which never
+    // changes once the default worker has generated it.
+    static std::mutex mutex;
+    static std::string default_ident;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (default_ident.empty() &&
+        !getDefaultWorkerSetting("hostIdentifier", default_ident).ok()) {
+      ident = osquery::getHostname();
+      return Status(1, "Default worker host identifier is not available");
+    }
+    ident = default_ident;
+    return Status(0, "OK");
+  }
+
   // Lookup the host identifier (UUID) previously generated and stored.
   auto status = getDatabaseValue(kPersistentSettings, "hostIdentifier", ident);
   if (!status.ok()) {
@@ -56,39 +126,96 @@ Status getHostIdentifier(std::string& ident) {
   return status;
 }
 
-inline SQL monitor(const std::string& name, const ScheduledQuery& query) {
-  // Snapshot the performance and times for the worker before running.
-  auto pid = std::to_string(getpid());
-  auto r0 = SQL::selectAllFrom("processes", "pid", EQUALS, pid);
-  auto t0 = time(nullptr);
-  auto sql = SQL(query.query);
-  // Snapshot the performance after, and compare.
-  auto t1 = time(nullptr);
-  auto r1 = SQL::selectAllFrom("processes", "pid", EQUALS, pid);
-  if (r0.size() > 0 && r1.size() > 0) {
-    size_t size = 0;
-    for (const auto& row : sql.rows()) {
-      for (const auto& column : row) {
-        size += column.first.size();
-        size += column.second.size();
-      }
+std::string normalizeQuery(const std::string& query) {
+  // Collapse whitespace outside of string literals, and drop the terminator.
+  std::string normalized;
+  char quote = 0;
+  bool space = false;
+  for (const auto& c : query) {
+    if (quote == 0 && std::isspace(static_cast<unsigned char>(c))) {
+      space = !normalized.empty();
+      continue;
+    }
+    if (space) {
+      normalized.push_back(' ');
+      space = false;
+    }
+    if (quote == 0 && (c == '\'' || c == '"')) {
+      quote = c;
+    } else if (c == quote) {
+      quote = 0;
     }
-    Config::recordQueryPerformance(name, t1 - t0, size, r0[0], r1[0]);
+    normalized.push_back(c);
+  }
+
+  while (!normalized.empty() &&
+         (normalized.back() == ';' || normalized.back() == ' ')) {
+    normalized.pop_back();
   }
-  return sql;
+  return normalized;
 }
 
-void launchQuery(const std::string& name, const ScheduledQuery& query) {
-  // Execute the scheduled query and create a named query object.
-  VLOG(1) << "Executing query: " << query.query;
-  auto sql = (FLAGS_enable_monitor) ? monitor(name, query) : SQL(query.query);
+std::vector<ScheduledQueryGroup> groupQueries(
+    const std::map<std::string, ScheduledQuery>& queries) {
+  std::vector<ScheduledQueryGroup> groups;
+  std::map<std::string, size_t> indexes;
+  for (const auto& query : queries) {
+    auto normalized = normalizeQuery(query.second.query);
+    auto index = indexes.find(normalized);
+    if (index == indexes.end()) {
+      indexes[normalized] = groups.size();
+      groups.push_back({query});
+    } else {
+      groups[index->second].push_back(query);
+    }
+  }
+  return groups;
+}
 
-  if (!sql.ok()) {
-    LOG(ERROR) << "Error executing query (" << query.query
-               << "): " << sql.getMessageString();
-    return;
+/// The deadline of a group, the longest of its queries' deadlines.
+inline size_t groupTimeout(const ScheduledQueryGroup& group) {
+  size_t timeout = 0;
+  for (const auto& query : group) {
+    auto query_timeout = queryTimeout(query.second);
+    if (query_timeout == 0) {
+      return 0;
+    }
+    timeout = std::max(timeout, query_timeout);
+  }
+  return timeout;
+}
+
+/// The results size limit of a group, 0 if any query has no limit.
+inline size_t groupResultsLimit(const ScheduledQueryGroup& group) {
+  size_t limit = 0;
+  for (const auto& query : group) {
+    auto query_limit = (query.second.max_result_bytes > 0)
+                           ? query.second.max_result_bytes
+                           : getQueryResultsLimit();
+    if (query_limit == 0) {
+      return 0;
+    }
+    limit = std::max(limit, query_limit);
+  }
+  return limit;
+}
+
+/// True if every query of a group executes at background priority.
+inline bool groupBackground(const ScheduledQueryGroup& group) {
+  for (const auto& query : group) {
+    if (query.second.options.count("background") == 0 ||
+        !query.second.options.at("background")) {
+      return false;
+    }
   }
+  return true;
+}
 
+/// Diff and log the results of a query, true if results were logged.
+static bool logQueryResults(const std::string& name,
+                            const ScheduledQuery& query,
+                            const std::vector<std::string>& keys,
+                            const ResultSet& results) {
   // Fill in a host identifier fields based on configuration or availability.
   std::string ident;
   auto status = getHostIdentifier(ident);
@@ -106,30 +233,34 @@ void launchQuery(const std::string& name, const ScheduledQuery& query) {
 
   if (query.options.count("snapshot") && query.options.at("snapshot")) {
     // This is a snapshot query, emit results with a differential or state.
-    item.snapshot_results = std::move(sql.rows());
+    item.snapshot_results = results.toQueryData();
     logSnapshotQuery(item);
-    return;
+    return true;
   }
 
   // Create a database-backed set of query results.
   auto dbQuery = Query(name, query);
+  dbQuery.setKeyColumns(keys);
   DiffResults diff_results;
   // Add this execution's set of results to the database-tracked named query.
   // We can then ask for a differential from the last time this named query
-  // was executed by exact matching each row.
-  status = dbQuery.addNewResults(sql.rows(), diff_results);
+  // was executed by exact matching each row, or matching key columns.
+  {
+    ProfilePhase phase(&QueryProfile::diff_time);
+    status = dbQuery.addNewResults(results, diff_results);
+  }
   if (!status.ok()) {
     LOG(ERROR) << "Error adding new results to database: " << status.what();
-    return;
+    return false;
   }
 
-  if (diff_results.added.size() == 0 && diff_results.removed.size() == 0) {
+  if (diff_results.empty()) {
     // No diff results or events to emit.
-    return;
+    return false;
   }
 
   VLOG(1) << "Found results for query (" << name << ") for host: " << ident;
-  item.results = diff_results;
+  item.results = std::move(diff_results);
   if (query.options.count("removed") && !query.options.at("removed")) {
     item.results.removed.clear();
   }
@@ -139,21 +270,768 @@ void launchQuery(const std::string& name, const ScheduledQuery& query) {
     LOG(ERROR) << "Error logging the results of query (" << query.query
                << "): " << status.toString();
   }
+  return true;
+}
+
+/// Execute a group's SQL once, diff and log the results of each query name.
+static void executeQueries(const ScheduledQueryGroup& group,
+                           size_t* size,
+                           std::set<std::string>& changed) {
+  // Execute the scheduled query and create a named query object.
+  const auto& query = group.front().second;
+  VLOG(1) << "Executing query: " << query.query;
+  // Rows are stepped into a ResultSet shared by every query name.
+  ResultSet results;
+  auto limit = groupResultsLimit(group);
+  ResultSetSink sink(results, limit);
+  auto status = osquery::query(query.query, sink, groupTimeout(group));
+  if (sink.full()) {
+    // Diffing and logging the results would exhaust the worker's memory.
+    for (const auto& item : group) {
+      LOG(ERROR) << "Scheduled query " << item.first << " results exceeded "
+                 << limit << " bytes, the results are discarded";
+      Config::recordQueryOversized(item.first, results.arenaSize());
+    }
+    return;
+  } else if (!status.ok()) {
+    LOG(ERROR) << "Error executing query (" << query.query
+               << "): " << status.getMessage();
+    return;
+  }
+
+  if (size != nullptr) {
+    for (size_t row = 0; row < results.rows(); ++row) {
+      for (size_t i = 0; i < results.columns(); ++i) {
+        if (results.hasValue(row, i)) {
+          *size += results.schema()->name(i).size() +
+                   results.value(row, i).size;
+        }
+      }
+    }
+  }
+
+  // Rows of a table with key columns are diffed by key.
+  std::vector<std::string> keys;
+  getQueryKeyColumns(query.query, keys);
+
+  // Each query name keeps its own differential of the same results.
+  for (const auto& item : group) {
+    if (logQueryResults(item.first, item.second, keys, results)) {
+      changed.insert(item.first);
+    }
+  }
+}
+
+QueryCost launchQuery(const std::string& name, const ScheduledQuery& query) {
+  return launchQueries({{name, query}});
+}
+
+QueryCost launchQueries(const ScheduledQueryGroup& group) {
+  TraceSpan span("scheduler", "launchQuery", group.front().first);
+
+  // Scratch allocations for this execution come from the worker's arena,
+  // which is reset when the query completes.
+  static thread_local Arena arena;
+  ScopedArena scope(arena);
+
+  // A worker killed by the watcher while executing the query will find this
+  // marker when respawned, and denylist the query.
+  bool watched = Initializer::isWorker();
+  if (watched) {
+    for (const auto& query : group) {
+      setDatabaseValue(kPersistentSettings,
+                       kExecutingPrefix + query.first,
+                       std::to_string(getUnixTime()));
+    }
+  }
+
+  // Profile the execution's wall and CPU time, and the time of each phase.
+  QueryProfile profile;
+  size_t size = 0;
+  size_t start = getUnixTime();
+  std::set<std::string> changed;
+  {
+    ScopedBackgroundPriority priority(groupBackground(group));
+    ScopedQueryProfile profiler(profile);
+    executeQueries(group, (FLAGS_enable_monitor) ? &size : nullptr, changed);
+  }
+
+  QueryState state;
+  state.last_run = start;
+  state.cost.cpu_time = profile.user_time + profile.system_time;
+  // The allocation peak is exact, peak RSS only grows when the process's own
+  // high-water mark does.
+  state.cost.memory = (profile.peak_allocated > 0) ? profile.peak_allocated
+                                                   : profile.memory;
+  for (const auto& query : group) {
+    if (watched) {
+      deleteDatabaseValue(kPersistentSettings, kExecutingPrefix + query.first);
+    }
+    if (FLAGS_enable_monitor) {
+      Config::recordQueryPerformance(query.first, profile, size);
+    }
+
+    // Count the executions without results for adaptive intervals.
+    state.unchanged = 0;
+    if (changed.count(query.first) == 0) {
+      QueryState previous;
+      getQueryState(query.first, previous);
+      state.unchanged = previous.unchanged + 1;
+    }
+    persistQueryState(query.first, state);
+  }
+  return state.cost;
+}
+
+/// FNV-1a, stable across restarts and platforms.
+inline uint64_t stableHash(const std::string& value) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (const auto& c : value) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+size_t queryPhase(const std::string& key, size_t interval) {
+  if (interval == 0) {
+    return 0;
+  }
+  return stableHash(key) % interval;
+}
+
+bool isShardMember(const std::string& ident,
+                   const std::string& name,
+                   size_t shard) {
+  if (shard >= 100) {
+    return true;
+  }
+  // Use the high bits, a sharded query's phase uses the low bits of a hash
+  // of the name and identifier.
+  return (stableHash(ident + "\n" + name) >> 32) % 100 < shard;
+}
+
+size_t adaptiveBackoff(const ScheduledQuery& query, size_t unchanged) {
+  if (query.interval == 0 || query.max_interval <= query.interval) {
+    return 1;
+  }
+
+  size_t limit = query.max_interval / query.interval;
+  size_t backoff = 1;
+  for (size_t i = 0; i < unchanged && backoff * 2 <= limit; ++i) {
+    backoff *= 2;
+  }
+  return backoff;
+}
+
+/// The expected cost of an execution, its average CPU milliseconds.
+inline uint64_t queryCost(const QueryPerformance& performance) {
+  if (performance.executions == 0) {
+    return 1;
+  }
+  return 1 +
+         (performance.user_time + performance.system_time) /
+             performance.executions / 1000;
+}
+
+Status denylistQuery(const std::string& name, size_t expiration) {
+  return setDatabaseValue(
+      kPersistentSettings, kDenylistPrefix + name, std::to_string(expiration));
+}
+
+Status getQueryDenylist(std::map<std::string, size_t>& denylist) {
+  size_t now = getUnixTime();
+  std::vector<std::string> keys;
+  auto status = scanDatabaseKeys(kPersistentSettings, keys, kExecutingPrefix);
+  if (!status.ok()) {
+    return status;
+  }
+
+  for (const auto& key : keys) {
+    auto name = key.substr(kExecutingPrefix.size());
+    if (FLAGS_schedule_denylist_duration > 0) {
+      LOG(WARNING) << "Scheduled query " << name
+                   << " was executing when the worker stopped, denylisting";
+      denylistQuery(name, now + FLAGS_schedule_denylist_duration);
+    }
+    deleteDatabaseValue(kPersistentSettings, key);
+  }
+
+  keys.clear();
+  status = scanDatabaseKeys(kPersistentSettings, keys, kDenylistPrefix);
+  if (!status.ok()) {
+    return status;
+  }
+
+  for (const auto& key : keys) {
+    std::string value;
+    getDatabaseValue(kPersistentSettings, key, value);
+    size_t expiration = strtoull(value.c_str(), nullptr, 10);
+    if (expiration <= now) {
+      deleteDatabaseValue(kPersistentSettings, key);
+      continue;
+    }
+    denylist[key.substr(kDenylistPrefix.size())] = expiration;
+  }
+  return Status(0, "OK");
+}
+
+Status persistQueryState(const std::string& name, const QueryState& state) {
+  return setDatabaseValue(kPersistentSettings,
+                          kQueryStatePrefix + name,
+                          std::to_string(state.last_run) + " " +
+                              std::to_string(state.cost.cpu_time) + " " +
+                              std::to_string(state.cost.memory) + " " +
+                              std::to_string(state.unchanged));
+}
+
+/// Parse a persisted QueryState, fields missing from older values are 0.
+static QueryState parseQueryState(const std::string& value) {
+  char* end = nullptr;
+  QueryState state;
+  state.last_run = strtoull(value.c_str(), &end, 10);
+  state.cost.cpu_time = strtoull(end, &end, 10);
+  state.cost.memory = strtoull(end, &end, 10);
+  state.unchanged = strtoull(end, &end, 10);
+  return state;
+}
+
+Status getQueryStates(std::map<std::string, QueryState>& states) {
+  std::vector<std::string> keys;
+  auto status = scanDatabaseKeys(kPersistentSettings, keys, kQueryStatePrefix);
+  if (!status.ok()) {
+    return status;
+  }
+
+  for (const auto& key : keys) {
+    std::string value;
+    getDatabaseValue(kPersistentSettings, key, value);
+    states[key.substr(kQueryStatePrefix.size())] = parseQueryState(value);
+  }
+  return Status(0, "OK");
+}
+
+Status getQueryState(const std::string& name, QueryState& state) {
+  std::string value;
+  auto status =
+      getDatabaseValue(kPersistentSettings, kQueryStatePrefix + name, value);
+  if (!status.ok()) {
+    return status;
+  }
+  state = parseQueryState(value);
+  return Status(0, "OK");
+}
+
+/**
+ * @brief Wait for autoloaded extensions to register the scheduled tables.
+ *
+ * A worker starts alongside its extensions. Only scheduled queries reading a
+ * table that is not yet attached wait, at most extensions_timeout in total.
+ */
+static void waitForScheduledTables() {
+  std::vector<std::string> queries;
+  {
+    ConfigDataInstance config;
+    for (const auto& query : config.schedule()) {
+      queries.push_back(query.second.query);
+    }
+  }
+
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::microseconds(getExtensionsTimeout());
+  for (const auto& query : queries) {
+    TableColumns columns;
+    auto status = getQueryColumns(query, columns);
+    while (!status.ok() &&
+           status.getMessage().find("no such table: ") == 0) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        VLOG(1) << "Scheduled table not registered: "
+                << status.getMessage().substr(15);
+        return;
+      }
+      ::usleep(kExtensionInitializeLatencyUS);
+      status = getQueryColumns(query, columns);
+    }
+  }
+}
+
+/// Log a snapshot of the process metrics as a health status.
+static void logMetrics() {
+  std::string ident;
+  auto status = getHostIdentifier(ident);
+  if (!status.ok() || ident.empty()) {
+    ident = "<unknown>";
+  }
+
+  QueryLogItem item;
+  item.name = "osquery_metrics";
+  item.identifier = ident;
+  item.time = osquery::getUnixTime();
+  item.calendar_time = osquery::getAsciiTime();
+  item.snapshot_results = SQL::selectAllFrom("osquery_metrics");
+  status = logHealthStatus(item);
+  if (!status.ok()) {
+    VLOG(1) << "Could not log metrics: " << status.getMessage();
+  }
+}
+
+void ScheduledQueryRunnable::start() {
+  auto t0 = time(nullptr);
+  auto cost = launchQueries(group_);
+  auto t1 = time(nullptr);
+
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  for (const auto& query : group_) {
+    state_->durations[query.first] = t1 - t0;
+    state_->costs[query.first] = cost;
+    state_->running.erase(query.first);
+  }
+}
+
+void DatabaseMaintenanceRunnable::start() {
+  auto status = DBHandle::getInstance()->compactDeletedRanges();
+  if (!status.ok()) {
+    VLOG(1) << "Could not compact deleted ranges: " << status.getMessage();
+  }
+}
+
+void SchedulerRunner::maintain(bool idle, size_t step) {
+  if (idle) {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    idle = state_->running.empty();
+  }
+  if (!idle) {
+    busy_step_ = step;
+    return;
+  }
+
+  if (FLAGS_database_maintenance_idle == 0 ||
+      (step - busy_step_) * interval_ < FLAGS_database_maintenance_idle) {
+    return;
+  }
+  busy_step_ = step;
+  if (DBHandle::getInstance()->hasDeletedRanges()) {
+    Dispatcher::add(std::make_shared<DatabaseMaintenanceRunnable>());
+  }
+}
+
+void SchedulerRunner::dispatch(std::map<std::string, ScheduledQuery>& due) {
+  std::vector<std::pair<size_t, size_t>> order;
+  std::vector<ScheduledQueryGroup> groups;
+  size_t long_running = 0;
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    for (const auto& name : state_->running) {
+      // Never overlap executions of the same query.
+      due.erase(name);
+      if (state_->durations[name] >= interval_) {
+        long_running++;
+      }
+    }
+
+    // Queries with the same SQL are executed once.
+    groups = groupQueries(due);
+
+    // Run the historically-fastest queries first.
+    for (size_t i = 0; i < groups.size(); ++i) {
+      size_t duration = 0;
+      for (const auto& query : groups[i]) {
+        duration = std::max(duration, state_->durations[query.first]);
+      }
+      order.push_back({duration, i});
+    }
+  }
+  std::sort(order.begin(), order.end());
+
+  // Leave at least one worker for short queries.
+  size_t workers = (FLAGS_worker_threads > 1) ? FLAGS_worker_threads : 1;
+  size_t long_limit = (workers > 1) ? workers - 1 : 1;
+  for (const auto& item : order) {
+    const auto& group = groups[item.second];
+    if (item.first >= interval_) {
+      if (long_running >= long_limit) {
+        for (const auto& query : group) {
+          deferred_[query.first] = query.second;
+        }
+        continue;
+      }
+      long_running++;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      for (const auto& query : group) {
+        state_->running.insert(query.first);
+      }
+    }
+    // Short queries take the priority lane, ahead of long queries and tasks
+    // such as file crawls.
+    auto task = std::make_shared<ScheduledQueryRunnable>(group, state_);
+    auto priority = (item.first < interval_) ? TASK_HIGH : TASK_NORMAL;
+    if (!Dispatcher::add(task, priority).ok()) {
+      // The worker pool is unavailable, run the query on the scheduler.
+      task->run();
+    }
+  }
+}
+
+void SchedulerRunner::throttle(int pressure, size_t step) {
+  pressure_step_ = step;
+  std::map<std::string, QueryCost> costs;
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    costs.swap(state_->costs);
+  }
+
+  // Attribute the pressure to the query using the most of the resource.
+  std::string name;
+  uint64_t highest = 0;
+  for (const auto& cost : costs) {
+    auto value = (pressure & PRESSURE_MEMORY) ? cost.second.memory
+                                              : cost.second.cpu_time;
+    if (value > highest) {
+      highest = value;
+      name = cost.first;
+    }
+  }
+  if (name.empty()) {
+    return;
+  }
+
+  auto& backoff = backoff_[name];
+  backoff = (backoff == 0) ? 2 : backoff * 2;
+  if (backoff <= kMaxBackoff || FLAGS_schedule_denylist_duration == 0) {
+    backoff = std::min(backoff, kMaxBackoff);
+    LOG(WARNING) << "Scheduled query " << name
+                 << " is nearing watchdog limits, running it every " << backoff
+                 << " intervals";
+    return;
+  }
+
+  backoff_.erase(name);
+  size_t expiration = getUnixTime() + FLAGS_schedule_denylist_duration;
+  denylist_[name] = expiration;
+  LOG(WARNING) << "Scheduled query " << name << " denylisted for "
+               << FLAGS_schedule_denylist_duration
+               << " seconds after nearing watchdog limits";
+  auto status = denylistQuery(name, expiration);
+  if (!status.ok()) {
+    VLOG(1) << "Could not persist denylisted query: " << status.getMessage();
+  }
+}
+
+bool SchedulerRunner::isThrottled(const std::string& name,
+                                  const ScheduledQuery& query,
+                                  size_t step) {
+  auto denied = denylist_.find(name);
+  if (denied != denylist_.end()) {
+    if (denied->second > (size_t)getUnixTime()) {
+      return true;
+    }
+    deleteDatabaseValue(kPersistentSettings, kDenylistPrefix + name);
+    denylist_.erase(denied);
+  }
+
+  auto backoff = backoff_.find(name);
+  if (backoff == backoff_.end() || query.splayed_interval == 0) {
+    return false;
+  }
+
+  // A backed off query runs on every Nth of its placed steps.
+  auto placement = placements_.find(name);
+  size_t phase = (placement != placements_.end()) ? placement->second.phase : 0;
+  size_t executions = (step - std::min(step, phase)) / query.splayed_interval;
+  return executions % backoff->second != 0;
+}
+
+bool SchedulerRunner::isSkipped(const std::string& name,
+                                const ScheduledQuery& query,
+                                size_t step) {
+  if (query.sampling < 1.0) {
+    std::uniform_real_distribution<double> sample(0.0, 1.0);
+    if (sample(generator_) >= query.sampling) {
+      return true;
+    }
+  }
+
+  if (query.max_interval <= query.interval || query.splayed_interval == 0) {
+    return false;
+  }
+
+  // An adaptive query runs on every Nth of its placed steps.
+  QueryState state;
+  if (!getQueryState(name, state).ok()) {
+    return false;
+  }
+  auto backoff = adaptiveBackoff(query, state.unchanged);
+  auto placement = placements_.find(name);
+  size_t phase = (placement != placements_.end()) ? placement->second.phase : 0;
+  size_t executions = (step - std::min(step, phase)) / query.splayed_interval;
+  return executions % backoff != 0;
+}
+
+void SchedulerRunner::addLoad(const QueryPlacement& placement, bool remove) {
+  if (load_.size() != kScheduleHorizon) {
+    load_.assign(kScheduleHorizon, 0);
+  }
+
+  // Intervals that do not divide the horizon are approximated.
+  for (size_t step = placement.phase % kScheduleHorizon;
+       step < kScheduleHorizon;
+       step += placement.interval) {
+    if (remove) {
+      load_[step] -= std::min(load_[step], placement.cost);
+    } else {
+      load_[step] += placement.cost;
+    }
+  }
+}
+
+size_t SchedulerRunner::choosePhase(const std::string& key,
+                                    size_t interval) const {
+  auto phase = queryPhase(key, interval);
+  if (load_.empty()) {
+    return phase;
+  }
+
+  size_t best = phase;
+  uint64_t lowest = 0;
+  auto candidates = std::min(interval, kPlacementCandidates);
+  for (size_t i = 0; i < candidates; ++i) {
+    auto candidate = (phase + i) % interval;
+    uint64_t load = 0;
+    for (size_t step = candidate % kScheduleHorizon; step < kScheduleHorizon;
+         step += interval) {
+      load += load_[step];
+    }
+    if (i == 0 || load < lowest) {
+      best = candidate;
+      lowest = load;
+    }
+  }
+  return best;
+}
+
+bool SchedulerRunner::isPlaced(const std::string& name,
+                               const ScheduledQuery& query) {
+  if (!isWorkerClassMember(query.worker)) {
+    // Another worker process executes the query's class.
+    return false;
+  }
+  if (query.shard >= 100) {
+    return true;
+  }
+  if (ident_.empty() && (!getHostIdentifier(ident_).ok() || ident_.empty())) {
+    // Without an identity every host would make the same choice. A class
+    // worker asks again until the default worker's identity is available.
+    ident_.clear();
+    return true;
+  }
+  return isShardMember(ident_, name, query.shard);
+}
+
+void SchedulerRunner::plan(const std::map<std::string, ScheduledQuery>& schedule,
+                           size_t step) {
+  // Keep the placements of unchanged queries.
+  for (auto it = placements_.begin(); it != placements_.end();) {
+    auto query = schedule.find(it->first);
+    if (query == schedule.end() ||
+        query->second.splayed_interval != it->second.interval ||
+        !isPlaced(it->first, query->second)) {
+      addLoad(it->second, true);
+      it = placements_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  // The most expensive new queries choose their phases first.
+  std::vector<std::pair<uint64_t, std::string>> placing;
+  for (const auto& query : schedule) {
+    if (placements_.count(query.first) == 0 &&
+        query.second.splayed_interval > 0 &&
+        isPlaced(query.first, query.second)) {
+      auto performance = Config::getQueryPerformance(query.first);
+      auto cost = queryCost(performance);
+      auto state = restored_.find(query.first);
+      if (performance.executions == 0 && state != restored_.end()) {
+        // Costs recorded before a restart stand in until the query runs.
+        cost = 1 + state->second.cost.cpu_time / 1000;
+      }
+      placing.push_back({cost, query.first});
+    }
+  }
+  std::sort(placing.rbegin(), placing.rend());
+
+  // Queries with the same SQL and interval share a phase, so they are due in
+  // the same step and groupQueries executes the SQL once.
+  std::map<std::string, size_t> group_phases;
+  for (const auto& placement : placements_) {
+    const auto& query = schedule.at(placement.first);
+    group_phases[normalizeQuery(query.query) + "\n" +
+                 std::to_string(placement.second.interval)] =
+        placement.second.phase;
+  }
+
+  size_t now = getUnixTime();
+  size_t seconds = std::max(interval_, (size_t)1);
+  for (const auto& item : placing) {
+    QueryPlacement placement;
+    placement.interval = schedule.at(item.second).splayed_interval;
+    const auto& query = schedule.at(item.second);
+    auto normalized = normalizeQuery(query.query);
+    auto group = normalized + "\n" + std::to_string(placement.interval);
+    auto group_phase = group_phases.find(group);
+    if (group_phase != group_phases.end()) {
+      placement.phase = group_phase->second;
+    } else {
+      // The hosts of a sharded query spread its executions over the interval.
+      placement.phase = choosePhase(
+          (query.shard < 100) ? normalized + "\n" + ident_ : normalized,
+          placement.interval);
+    }
+    placement.cost = item.first;
+
+    // A query that ran before a restart resumes at its next execution. Missed
+    // executions run at the query's placed phase, not all at once.
+    auto state = restored_.find(item.second);
+    if (state != restored_.end()) {
+      auto next = state->second.last_run + placement.interval * seconds;
+      if (next > now) {
+        auto remaining = std::min((next - now + seconds - 1) / seconds,
+                                  placement.interval);
+        placement.phase = (step + remaining) % placement.interval;
+      }
+    }
+    group_phases[group] = placement.phase;
+    addLoad(placement);
+    placements_[item.second] = placement;
+  }
+
+  // Persisted executions of queries no longer scheduled are removed.
+  if (!schedule.empty()) {
+    for (const auto& state : restored_) {
+      if (schedule.count(state.first) == 0) {
+        deleteDatabaseValue(kPersistentSettings,
+                            kQueryStatePrefix + state.first);
+      }
+    }
+    restored_.clear();
+  }
+
+  queue_ = decltype(queue_)();
+  for (const auto& placement : placements_) {
+    const auto& interval = placement.second.interval;
+    auto next =
+        step + (placement.second.phase + interval - step % interval) % interval;
+    queue_.push({next, placement.first});
+  }
+}
+
+void SchedulerRunner::takeDue(
+    const std::map<std::string, ScheduledQuery>& schedule,
+    size_t step,
+    std::map<std::string, ScheduledQuery>& due) {
+  while (!queue_.empty() && queue_.top().first <= step) {
+    auto name = queue_.top().second;
+    queue_.pop();
+
+    auto query = schedule.find(name);
+    auto placement = placements_.find(name);
+    if (query == schedule.end() || placement == placements_.end()) {
+      continue;
+    }
+    queue_.push({step + placement->second.interval, name});
+    if (!isThrottled(name, query->second, step) &&
+        !isSkipped(name, query->second, step)) {
+      due[name] = query->second;
+    }
+  }
 }
 
 void SchedulerRunner::start() {
+  if (Watcher::hasManagedExtensions()) {
+    waitForScheduledTables();
+  }
+
+  auto status = getQueryDenylist(denylist_);
+  if (!status.ok()) {
+    VLOG(1) << "Could not read denylisted queries: " << status.getMessage();
+  }
+
+  // Resume the schedule of queries that ran before a restart.
+  status = getQueryStates(restored_);
+  if (!status.ok()) {
+    VLOG(1) << "Could not read scheduled query state: " << status.getMessage();
+  }
+
   time_t t = std::time(nullptr);
   struct tm* local = std::localtime(&t);
   unsigned long int i = local->tm_sec;
   for (; (timeout_ == 0) || (i <= timeout_); ++i) {
     {
-      ConfigDataInstance config;
-      for (const auto& query : config.schedule()) {
-        if (i % query.second.splayed_interval == 0) {
-          launchQuery(query.first, query.second);
+      // The tick's span ends before the sleep.
+      TraceSpan tick("scheduler", "tick");
+
+      // Stop queries that have exceeded their deadlines.
+      interruptExpiredQueries();
+
+      // Throttle queries before the watcher kills the worker.
+      auto pressure = takeWatchdogPressure();
+      if (pressure != PRESSURE_NONE) {
+        throttle(pressure, i);
+      } else if (!backoff_.empty() &&
+                 i - pressure_step_ >= kBackoffRecoverySteps) {
+        // Recover backed off intervals after a period without pressure.
+        for (auto it = backoff_.begin(); it != backoff_.end();) {
+          it->second /= 2;
+          if (it->second <= 1) {
+            it = backoff_.erase(it);
+          } else {
+            ++it;
+          }
+        }
+        pressure_step_ = i;
+      }
+
+      std::map<std::string, ScheduledQuery> due;
+      due.swap(deferred_);
+      {
+        ConfigDataInstance config;
+        auto generation = Config::getGeneration();
+        if (generation != generation_) {
+          // The schedule changed, place new queries and requeue every query.
+          plan(config.schedule(), i);
+          generation_ = generation;
         }
+        takeDue(config.schedule(), i, due);
+      }
+
+      // Compact expired events while the schedule is idle.
+      maintain(due.empty() && pressure == PRESSURE_NONE, i);
+
+      if (FLAGS_enable_monitor && !kQueryProfileThreadUsage) {
+        // Without per-thread CPU usage, run profiled queries serially.
+        for (const auto& group : groupQueries(due)) {
+          auto cost = launchQueries(group);
+          std::lock_guard<std::mutex> lock(state_->mutex);
+          for (const auto& query : group) {
+            state_->costs[query.first] = cost;
+          }
+        }
+      } else {
+        dispatch(due);
+      }
+
+      if (FLAGS_metrics_log_interval > 0 &&
+          i % FLAGS_metrics_log_interval == 0) {
+        logMetrics();
       }
     }
+
+    // Write a trace requested by SIGPROF.
+    dumpRequestedTrace();
+
     // Put the thread into an interruptible sleep without a config instance.
     osquery::interruptableSleep(interval_ * 1000);
   }
@@ -10,21 +10,177 @@
 
 #pragma once
 
+#include <cstdint>
+#include <map>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <osquery/database.h>
+
 #include "osquery/dispatcher/dispatcher.h"
 
 namespace osquery {
 
+/// The resources used by a scheduled query's most recent execution.
+struct QueryCost {
+  /// User and system CPU time in microseconds.
+  uint64_t cpu_time{0};
+  /// Peak bytes allocated, or the growth of the peak resident memory.
+  uint64_t memory{0};
+};
+
+/// A scheduled query's most recent execution, persisted across restarts.
+struct QueryState {
+  /// The UNIX time the execution started.
+  size_t last_run{0};
+  /// The resources used by the execution.
+  QueryCost cost;
+  /// Consecutive executions without differential results.
+  size_t unchanged{0};
+};
+
+/// Scheduled queries, by name, due in the same step with the same SQL.
+typedef std::vector<std::pair<std::string, ScheduledQuery>> ScheduledQueryGroup;
+
+/// Bookkeeping shared by the scheduler and its dispatched queries.
+struct SchedulerState {
+  /// Protects the running set, durations, and costs.
+  std::mutex mutex;
+  /// Names of scheduled queries dispatched and not yet complete.
+  std::set<std::string> running;
+  /// Wall time in seconds of each scheduled query's most recent execution.
+  std::map<std::string, size_t> durations;
+  /// Costs of queries executed since the last watchdog pressure.
+  std::map<std::string, QueryCost> costs;
+};
+
+/// A Dispatcher worker task executing a group of scheduled queries once.
+class ScheduledQueryRunnable : public InternalRunnable {
+ public:
+  virtual ~ScheduledQueryRunnable() {}
+  ScheduledQueryRunnable(const ScheduledQueryGroup& group,
+                         std::shared_ptr<SchedulerState> state)
+      : group_(group), state_(state) {}
+
+ public:
+  /// The Dispatcher worker entry point.
+  void start();
+
+ private:
+  /// Copies of the scheduled queries, the config may change while they run.
+  ScheduledQueryGroup group_;
+  /// Bookkeeping owned by the scheduler.
+  std::shared_ptr<SchedulerState> state_;
+};
+
+/// A Dispatcher worker task compacting deleted backing-store ranges.
+class DatabaseMaintenanceRunnable : public InternalRunnable {
+ public:
+  /// The Dispatcher worker entry point.
+  void start();
+};
+
+/// A scheduled query's place in the schedule, due when step % interval is phase.
+struct QueryPlacement {
+  /// The splayed interval the query was placed with.
+  size_t interval{0};
+  /// The step offset of each execution within the interval.
+  size_t phase{0};
+  /// The expected cost of an execution when the query was placed.
+  uint64_t cost{0};
+};
+
 /// A Dispatcher service thread that watches an ExtensionManagerHandler.
 class SchedulerRunner : public InternalRunnable {
  public:
   virtual ~SchedulerRunner() {}
   SchedulerRunner(unsigned long int timeout, size_t interval)
-      : interval_(interval), timeout_(timeout) {}
+      : interval_(interval),
+        timeout_(timeout),
+        state_(std::make_shared<SchedulerState>()) {}
 
  public:
   /// The Dispatcher thread entry point.
   void start();
 
+ protected:
+  /// Dispatch the queries due this step onto the Dispatcher's workers.
+  void dispatch(std::map<std::string, ScheduledQuery>& due);
+
+  /**
+   * @brief Throttle the most expensive recent query under watchdog pressure.
+   *
+   * The query's interval is doubled on each pressure, up to a limit, then it
+   * is denylisted for --schedule_denylist_duration seconds.
+   *
+   * @param pressure A WatchdogPressure mask signaled by the watcher.
+   * @param step The scheduler step the pressure was taken.
+   */
+  void throttle(int pressure, size_t step);
+
+  /// Whether a denylisted or backed-off query should be skipped this step.
+  bool isThrottled(const std::string& name,
+                   const ScheduledQuery& query,
+                   size_t step);
+
+  /**
+   * @brief Whether a sampled or adaptive query should be skipped this step.
+   *
+   * A sampled query is executed at each interval with its sampling
+   * probability. An adaptive query, with a max_interval, runs on every Nth of
+   * its placed steps, where N grows with its persisted unchanged executions.
+   */
+  bool isSkipped(const std::string& name,
+                 const ScheduledQuery& query,
+                 size_t step);
+
+  /**
+   * @brief Place new and changed queries, and queue each query's next step.
+   *
+   * Unchanged queries keep their placement, new queries are placed in order
+   * of their expected cost. Queries that ran before a restart resume their
+   * schedule, unless their next execution was missed.
+   *
+   * @param schedule The config's schedule.
+   * @param step The current step, queued queries are due at or after it.
+   */
+  void plan(const std::map<std::string, ScheduledQuery>& schedule,
+            size_t step);
+
+  /// Move the queries due at a step from the queue to the due queries.
+  void takeDue(const std::map<std::string, ScheduledQuery>& schedule,
+               size_t step,
+               std::map<std::string, ScheduledQuery>& due);
+
+  /**
+   * @brief Choose the least loaded phase near a query's hashed phase.
+   *
+   * The key is the query's normalized SQL, so queries with the same SQL start
+   * from the same phase. Each candidate's load is the expected cost of the
+   * queries placed on the steps it would execute.
+   */
+  size_t choosePhase(const std::string& key, size_t interval) const;
+
+  /// Add or remove the expected cost of a placement from the step loads.
+  void addLoad(const QueryPlacement& placement, bool remove = false);
+
+  /// Whether this host and worker execute a query, see isShardMember.
+  bool isPlaced(const std::string& name, const ScheduledQuery& query);
+
+  /**
+   * @brief Start backing-store maintenance after a period without queries.
+   *
+   * @param idle Whether no queries were due or running this step.
+   * @param step The current step.
+   */
+  void maintain(bool idle, size_t step);
+
  protected:
   /// The UNIX domain socket path for the ExtensionManager.
   std::map<std::string, size_t> splay_;
@@ -32,8 +188,118 @@ class SchedulerRunner : public InternalRunnable {
   size_t interval_;
   /// Maximum number of steps.
   unsigned long int timeout_;
+  /// Long-running queries held back to keep workers free for short queries.
+  std::map<std::string, ScheduledQuery> deferred_;
+  /// Bookkeeping shared with dispatched queries.
+  std::shared_ptr<SchedulerState> state_;
+  /// Interval multipliers of queries backed off under watchdog pressure.
+  std::map<std::string, size_t> backoff_;
+  /// Denylisted queries and the UNIX time their denylisting expires.
+  std::map<std::string, size_t> denylist_;
+  /// The step of the most recent watchdog pressure.
+  size_t pressure_step_{0};
+  /// The most recent step that was not idle, or that started maintenance.
+  size_t busy_step_{0};
+
+  /// The placement of each scheduled query.
+  std::map<std::string, QueryPlacement> placements_;
+  /// Expected cost of each step over the planning horizon.
+  std::vector<uint64_t> load_;
+  /// Each query's next step, the earliest first.
+  std::priority_queue<std::pair<size_t, std::string>,
+                      std::vector<std::pair<size_t, std::string>>,
+                      std::greater<std::pair<size_t, std::string>>> queue_;
+  /// The config generation the placements were planned with.
+  size_t generation_{0};
+  /// Persisted executions from before a restart, used by the first plan.
+  std::map<std::string, QueryState> restored_;
+  /// The host identifier sharded queries are placed with, read once.
+  std::string ident_;
+  /// Random source for sampled queries.
+  std::mt19937 generator_{std::random_device{}()};
 };
 
+/// Execute a scheduled query and log its results, returning its cost.
+QueryCost launchQuery(const std::string& name, const ScheduledQuery& query);
+
+/**
+ * @brief Execute a group's SQL once and log the results of each query name.
+ *
+ * Each query name keeps its own differential and log options, the results
+ * are only generated once.
+ */
+QueryCost launchQueries(const ScheduledQueryGroup& group);
+
+/**
+ * @brief Normalize a query's SQL for comparison with other queries.
+ *
+ * Whitespace outside of string literals is collapsed and a trailing
+ * terminator is removed.
+ */
+std::string normalizeQuery(const std::string& query);
+
+/// A stable step offset within an interval, a hash of a query's key.
+size_t queryPhase(const std::string& key, size_t interval);
+
+/**
+ * @brief Whether a host executes a sharded query.
+ *
+ * A stable hash of the host identifier and query name places the host in one
+ * of 100 buckets, the query executes on hosts in the buckets below its shard.
+ * Each query selects a different set of hosts.
+ *
+ * @param ident The host identifier.
+ * @param name The scheduled query name.
+ * @param shard The percent of hosts executing the query.
+ */
+bool isShardMember(const std::string& ident,
+                   const std::string& name,
+                   size_t shard);
+
+/**
+ * @brief The interval multiplier of an adaptive query.
+ *
+ * The multiplier doubles with each unchanged execution, and is at most the
+ * query's max_interval divided by its interval. Changed results reset it.
+ *
+ * @param query The scheduled query.
+ * @param unchanged Consecutive executions without differential results.
+ */
+size_t adaptiveBackoff(const ScheduledQuery& query, size_t unchanged);
+
+/// Group queries with the same normalized SQL.
+std::vector<ScheduledQueryGroup> groupQueries(
+    const std::map<std::string, ScheduledQuery>& queries);
+
+/**
+ * @brief Denylist a scheduled query, persisted across worker restarts.
+ *
+ * @param name The scheduled query name.
+ * @param expiration The UNIX time the query may run again.
+ */
+Status denylistQuery(const std::string& name, size_t expiration);
+
+/**
+ * @brief Read the persisted denylist, removing expired entries.
+ *
+ * Queries that were executing when a worker was killed are denylisted first.
+ */
+Status getQueryDenylist(std::map<std::string, size_t>& denylist);
+
+/**
+ * @brief Persist a scheduled query's most recent execution.
+ *
+ * A restarted scheduler resumes each query's schedule from its last run
+ * instead of executing the whole schedule at once.
+ */
+Status persistQueryState(const std::string& name, const QueryState& state);
+
+/// Read the persisted executions of each scheduled query.
+Status getQueryStates(std::map<std::string, QueryState>& states);
+
+/// Read the persisted most recent execution of a scheduled query.
+Status getQueryState(const std::string& name, QueryState& state);
+
 /// Start quering according to the config's schedule
 Status startScheduler();
 
@@ -8,7 +8,11 @@
  *
  */
 
-#include <boost/make_shared.hpp>
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -21,7 +25,7 @@ class DispatcherTests : public testing::Test {};
 TEST_F(DispatcherTests, test_singleton) {
   auto& one = Dispatcher::instance();
   auto& two = Dispatcher::instance();
-  EXPECT_EQ(one.getThreadManager().get(), two.getThreadManager().get());
+  EXPECT_EQ(&one, &two);
 }
 
 class TestRunnable : public InternalRunnable {
@@ -38,11 +42,89 @@ TEST_F(DispatcherTests, test_add_work) {
 
   int i = base;
   for (int c = 0; c < repetitions; ++c) {
-    dispatcher.add(OSQUERY_THRIFT_POINTER::make_shared<TestRunnable>(&i));
+    dispatcher.add(std::make_shared<TestRunnable>(&i));
   }
   while (dispatcher.totalTaskCount() > 0) {
   }
 
   EXPECT_EQ(i, base + repetitions);
 }
+
+class BlockingRunnable : public InternalRunnable {
+ public:
+  BlockingRunnable(std::mutex& mutex,
+                   std::condition_variable& cv,
+                   bool& released,
+                   std::vector<int>& order,
+                   int id)
+      : mutex_(mutex), cv_(cv), released_(released), order_(order), id_(id) {}
+
+  virtual void start() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    order_.push_back(id_);
+    cv_.wait(lock, [this]() { return released_; });
+  }
+
+ private:
+  std::mutex& mutex_;
+  std::condition_variable& cv_;
+  bool& released_;
+  std::vector<int>& order_;
+  int id_;
+};
+
+TEST_F(DispatcherTests, test_priority_lane) {
+  auto& dispatcher = Dispatcher::instance();
+  size_t workers = dispatcher.workerCount();
+  ASSERT_GT(workers, 0U);
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool released = false;
+  std::vector<int> order;
+
+  // Occupy every worker, then queue normal tasks before a priority task.
+  for (size_t i = 0; i < workers; ++i) {
+    dispatcher.add(
+        std::make_shared<BlockingRunnable>(mutex, cv, released, order, 0));
+  }
+  while (dispatcher.pendingTaskCount() > 0) {
+  }
+  for (size_t i = 0; i < workers * 2; ++i) {
+    dispatcher.add(
+        std::make_shared<BlockingRunnable>(mutex, cv, released, order, 1));
+  }
+  dispatcher.add(
+      std::make_shared<BlockingRunnable>(mutex, cv, released, order, 2),
+      TASK_HIGH);
+  EXPECT_EQ(dispatcher.pendingTaskCount(), workers * 2 + 1);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    released = true;
+  }
+  cv.notify_all();
+  while (dispatcher.totalTaskCount() > 0) {
+  }
+
+  // The priority task is the first taken, workers may record theirs first.
+  ASSERT_EQ(order.size(), workers * 3 + 1);
+  auto position = std::find(order.begin(), order.end(), 2) - order.begin();
+  EXPECT_GE(position, workers);
+  EXPECT_LT(position, workers * 2);
+}
+
+TEST_F(DispatcherTests, test_join_restarts) {
+  auto& dispatcher = Dispatcher::instance();
+  Dispatcher::join();
+  EXPECT_EQ(dispatcher.workerCount(), 0U);
+
+  // Adding a task starts the workers again.
+  int i = 0;
+  dispatcher.add(std::make_shared<TestRunnable>(&i));
+  while (dispatcher.totalTaskCount() > 0) {
+  }
+  EXPECT_EQ(i, 1);
+  EXPECT_GT(dispatcher.workerCount(), 0U);
+}
 }
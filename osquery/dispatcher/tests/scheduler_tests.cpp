@@ -0,0 +1,304 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/core.h>
+#include <osquery/database.h>
+
+#include "osquery/core/watcher.h"
+#include "osquery/dispatcher/scheduler.h"
+
+namespace osquery {
+
+class SchedulerTests : public testing::Test {
+ protected:
+  void TearDown() {
+    std::vector<std::string> keys;
+    scanDatabaseKeys(kPersistentSettings, keys, "denylist.");
+    scanDatabaseKeys(kPersistentSettings, keys, "executing.");
+    scanDatabaseKeys(kPersistentSettings, keys, "schedule.");
+    for (const auto& key : keys) {
+      deleteDatabaseValue(kPersistentSettings, key);
+    }
+  }
+};
+
+/// Expose the scheduler's throttling.
+class TestSchedulerRunner : public SchedulerRunner {
+ public:
+  TestSchedulerRunner() : SchedulerRunner(1, 1) {}
+
+  void setCost(const std::string& name, uint64_t cpu_time, uint64_t memory) {
+    state_->costs[name].cpu_time = cpu_time;
+    state_->costs[name].memory = memory;
+  }
+
+  const std::map<std::string, QueryPlacement>& placements() const {
+    return placements_;
+  }
+
+  using SchedulerRunner::throttle;
+  using SchedulerRunner::isThrottled;
+  using SchedulerRunner::isSkipped;
+  using SchedulerRunner::plan;
+  using SchedulerRunner::takeDue;
+  using SchedulerRunner::restored_;
+  using SchedulerRunner::ident_;
+};
+
+TEST_F(SchedulerTests, test_query_denylist) {
+  size_t now = getUnixTime();
+  EXPECT_TRUE(denylistQuery("denied", now + 60).ok());
+  EXPECT_TRUE(denylistQuery("expired", now - 1).ok());
+  // A worker stopped while executing this query.
+  setDatabaseValue(kPersistentSettings, "executing.killed", "0");
+
+  std::map<std::string, size_t> denylist;
+  ASSERT_TRUE(getQueryDenylist(denylist).ok());
+  EXPECT_EQ(denylist.size(), 2U);
+  EXPECT_EQ(denylist["denied"], now + 60);
+  EXPECT_GT(denylist["killed"], now);
+
+  // Expired denylistings and executing markers are removed.
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kPersistentSettings, keys, "executing.");
+  scanDatabaseKeys(kPersistentSettings, keys, "denylist.expired");
+  EXPECT_TRUE(keys.empty());
+}
+
+TEST_F(SchedulerTests, test_throttle) {
+  TestSchedulerRunner runner;
+  ScheduledQuery query;
+  query.splayed_interval = 10;
+
+  runner.setCost("cheap", 10, 1 << 20);
+  runner.setCost("expensive", 1000, 0);
+  runner.throttle(PRESSURE_UTILIZATION, 1);
+
+  // The most expensive query runs every other interval.
+  EXPECT_TRUE(runner.isThrottled("expensive", query, 10));
+  EXPECT_FALSE(runner.isThrottled("expensive", query, 20));
+  EXPECT_FALSE(runner.isThrottled("cheap", query, 10));
+
+  // Continued pressure backs off further, then denylists the query.
+  for (size_t i = 0; i < 3; i++) {
+    runner.setCost("expensive", 1000, 0);
+    runner.throttle(PRESSURE_UTILIZATION, 2 + i);
+  }
+  EXPECT_TRUE(runner.isThrottled("expensive", query, 80));
+
+  std::map<std::string, size_t> denylist;
+  ASSERT_TRUE(getQueryDenylist(denylist).ok());
+  EXPECT_EQ(denylist.count("expensive"), 1U);
+
+  // Memory pressure is attributed to the query with the most memory growth.
+  runner.setCost("cheap", 10, 1 << 20);
+  runner.setCost("expensive", 1000, 0);
+  runner.throttle(PRESSURE_MEMORY, 5);
+  EXPECT_TRUE(runner.isThrottled("cheap", query, 10));
+}
+
+TEST_F(SchedulerTests, test_group_queries) {
+  EXPECT_EQ(normalizeQuery("  SELECT *\n  FROM time;  "), "SELECT * FROM time");
+  EXPECT_EQ(normalizeQuery("select 'a  b'"), "select 'a  b'");
+  EXPECT_NE(normalizeQuery("select 'a  b'"), normalizeQuery("select 'a b'"));
+
+  std::map<std::string, ScheduledQuery> due;
+  due["first"].query = "SELECT * FROM time";
+  due["second"].query = "SELECT *  FROM time;";
+  due["third"].query = "SELECT * FROM osquery_info";
+  auto groups = groupQueries(due);
+  ASSERT_EQ(groups.size(), 2U);
+  ASSERT_EQ(groups[0].size(), 2U);
+  EXPECT_EQ(groups[0][0].first, "first");
+  EXPECT_EQ(groups[0][1].first, "second");
+  EXPECT_EQ(groups[1][0].first, "third");
+}
+
+TEST_F(SchedulerTests, test_query_placement) {
+  EXPECT_EQ(queryPhase("query", 60), queryPhase("query", 60));
+  EXPECT_LT(queryPhase("query", 60), 60U);
+
+  // Queries sharing an interval are spread across its steps.
+  std::map<std::string, ScheduledQuery> schedule;
+  for (size_t i = 0; i < 60; i++) {
+    auto& query = schedule["query_" + std::to_string(i)];
+    query.query = "select " + std::to_string(i);
+    query.interval = query.splayed_interval = 60;
+  }
+  // An expensive query is placed first and keeps its step to itself.
+  auto& expensive = schedule["expensive"];
+  expensive.query = "select * from processes";
+  expensive.interval = expensive.splayed_interval = 60;
+
+  TestSchedulerRunner runner;
+  runner.restored_["expensive"].cost.cpu_time = 1000000;
+  runner.plan(schedule, 0);
+  ASSERT_EQ(runner.placements().size(), schedule.size());
+  auto expensive_phase = runner.placements().at("expensive").phase;
+
+  // Each query is due once per interval.
+  std::map<std::string, size_t> executions;
+  size_t most_due = 0;
+  for (size_t step = 0; step < 60; step++) {
+    std::map<std::string, ScheduledQuery> due;
+    runner.takeDue(schedule, step, due);
+    most_due = std::max(most_due, due.size());
+    for (const auto& query : due) {
+      executions[query.first]++;
+      EXPECT_EQ(step, runner.placements().at(query.first).phase);
+    }
+    if (step == expensive_phase) {
+      EXPECT_EQ(due.size(), 1U);
+    }
+  }
+  EXPECT_EQ(executions.size(), schedule.size());
+  EXPECT_LE(most_due, 3U);
+
+  // Unchanged queries keep their placement when the schedule changes.
+  auto phase = runner.placements().at("query_1").phase;
+  schedule.erase("query_0");
+  runner.plan(schedule, 60);
+  EXPECT_EQ(runner.placements().count("query_0"), 0U);
+  EXPECT_EQ(runner.placements().at("query_1").phase, phase);
+
+  // A query with the same SQL and interval is placed with its group.
+  auto& duplicate = schedule["duplicate"];
+  duplicate.query = "select  1;";
+  duplicate.interval = duplicate.splayed_interval = 60;
+  runner.plan(schedule, 60);
+  EXPECT_EQ(runner.placements().at("duplicate").phase, phase);
+}
+
+TEST_F(SchedulerTests, test_resume_schedule) {
+  size_t now = getUnixTime();
+  QueryState state;
+  state.last_run = now - 10;
+  state.cost.cpu_time = 2000;
+  EXPECT_TRUE(persistQueryState("recent", state).ok());
+  state.last_run = now - 120;
+  EXPECT_TRUE(persistQueryState("missed", state).ok());
+  EXPECT_TRUE(persistQueryState("removed", state).ok());
+
+  TestSchedulerRunner runner;
+  ASSERT_TRUE(getQueryStates(runner.restored_).ok());
+  ASSERT_EQ(runner.restored_.size(), 3U);
+  EXPECT_EQ(runner.restored_["recent"].last_run, now - 10);
+  EXPECT_EQ(runner.restored_["recent"].cost.cpu_time, 2000U);
+
+  std::map<std::string, ScheduledQuery> schedule;
+  schedule["recent"].query = "select * from time";
+  schedule["recent"].interval = schedule["recent"].splayed_interval = 60;
+  schedule["missed"].query = "select * from uptime";
+  schedule["missed"].interval = schedule["missed"].splayed_interval = 60;
+  runner.plan(schedule, 0);
+
+  // The recent query resumes an interval after its last run, within a second
+  // of the time the test started.
+  auto phase = runner.placements().at("recent").phase;
+  EXPECT_GE(phase, 49U);
+  EXPECT_LE(phase, 50U);
+  EXPECT_EQ(runner.placements().at("missed").phase,
+            queryPhase("select * from uptime", 60));
+
+  std::map<std::string, QueryState> states;
+  getQueryStates(states);
+  EXPECT_EQ(states.count("removed"), 0U);
+}
+
+TEST_F(SchedulerTests, test_adaptive_interval) {
+  ScheduledQuery query;
+  query.interval = query.splayed_interval = 10;
+  EXPECT_EQ(adaptiveBackoff(query, 5), 1U);
+
+  // Unchanged executions double the interval up to the max interval.
+  query.max_interval = 60;
+  EXPECT_EQ(adaptiveBackoff(query, 0), 1U);
+  EXPECT_EQ(adaptiveBackoff(query, 1), 2U);
+  EXPECT_EQ(adaptiveBackoff(query, 2), 4U);
+  EXPECT_EQ(adaptiveBackoff(query, 10), 4U);
+
+  TestSchedulerRunner runner;
+  std::map<std::string, ScheduledQuery> schedule = {{"adaptive", query}};
+  runner.plan(schedule, 0);
+  auto phase = runner.placements().at("adaptive").phase;
+
+  QueryState state;
+  state.unchanged = 2;
+  EXPECT_TRUE(persistQueryState("adaptive", state).ok());
+  EXPECT_FALSE(runner.isSkipped("adaptive", query, phase));
+  EXPECT_TRUE(runner.isSkipped("adaptive", query, phase + 10));
+  EXPECT_TRUE(runner.isSkipped("adaptive", query, phase + 30));
+  EXPECT_FALSE(runner.isSkipped("adaptive", query, phase + 40));
+
+  // A changed execution restores the interval.
+  state.unchanged = 0;
+  EXPECT_TRUE(persistQueryState("adaptive", state).ok());
+  EXPECT_FALSE(runner.isSkipped("adaptive", query, phase + 10));
+}
+
+TEST_F(SchedulerTests, test_sampled_query) {
+  TestSchedulerRunner runner;
+  ScheduledQuery query;
+  query.interval = query.splayed_interval = 10;
+
+  query.sampling = 0.0;
+  EXPECT_TRUE(runner.isSkipped("sampled", query, 0));
+  query.sampling = 1.0;
+  EXPECT_FALSE(runner.isSkipped("sampled", query, 0));
+
+  query.sampling = 0.5;
+  size_t skipped = 0;
+  for (size_t i = 0; i < 1000; ++i) {
+    skipped += runner.isSkipped("sampled", query, 0) ? 1 : 0;
+  }
+  EXPECT_GT(skipped, 300U);
+  EXPECT_LT(skipped, 700U);
+}
+
+TEST_F(SchedulerTests, test_sharded_query) {
+  EXPECT_TRUE(isShardMember("host", "query", 100));
+  EXPECT_EQ(isShardMember("host", "query", 10),
+            isShardMember("host", "query", 10));
+
+  // About a tenth of hosts execute a query, each query selects other hosts.
+  size_t members = 0, both = 0;
+  for (size_t i = 0; i < 1000; ++i) {
+    auto ident = "host_" + std::to_string(i);
+    bool first = isShardMember(ident, "first", 10);
+    members += first ? 1 : 0;
+    both += (first && isShardMember(ident, "second", 10)) ? 1 : 0;
+  }
+  EXPECT_GT(members, 60U);
+  EXPECT_LT(members, 140U);
+  EXPECT_LT(both, 40U);
+
+  // Hosts outside a query's shard do not place it.
+  std::map<std::string, ScheduledQuery> schedule;
+  for (size_t i = 0; i < 20; i++) {
+    auto& query = schedule["sharded_" + std::to_string(i)];
+    query.interval = query.splayed_interval = 60;
+    query.shard = 50;
+  }
+
+  TestSchedulerRunner runner;
+  runner.ident_ = "host";
+  runner.plan(schedule, 0);
+  for (const auto& query : schedule) {
+    EXPECT_EQ(runner.placements().count(query.first) > 0,
+              isShardMember("host", query.first, 50));
+  }
+  auto placed = runner.placements().size();
+  EXPECT_GT(placed, 0U);
+  EXPECT_LT(placed, schedule.size());
+
+}
+}
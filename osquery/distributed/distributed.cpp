@@ -8,13 +8,27 @@
  *
  */
 
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <random>
 #include <sstream>
+#include <thread>
 
+#include <boost/lexical_cast.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/json.h"
+#include "osquery/core/watcher.h"
+#include "osquery/dispatcher/scheduler.h"
 #include "osquery/distributed/distributed.h"
 
 namespace pt = boost::property_tree;
@@ -26,6 +40,79 @@ FLAG(int32,
      3,
      "Times to retry reading/writing distributed queries");
 
+FLAG(int32,
+     distributed_threads,
+     4,
+     "Distributed queries executed concurrently");
+
+FLAG(int32,
+     distributed_timeout,
+     0,
+     "Seconds before a distributed query is interrupted (0 for no limit)");
+
+FLAG(int32,
+     distributed_interval,
+     60,
+     "Seconds between distributed query reads for polling providers");
+
+FLAG(int32,
+     distributed_request_ttl,
+     86400,
+     "Seconds an executed distributed request ID is not executed again");
+
+FLAG(bool,
+     distributed_persist_requests,
+     false,
+     "Keep executed distributed request IDs in the backing store");
+
+FLAG(int32,
+     distributed_cache_ttl,
+     10,
+     "Seconds identical distributed queries reuse results (0 disables)");
+
+FLAG(int32,
+     distributed_page_rows,
+     0,
+     "Most rows in each page of distributed query results (0 for no limit)");
+
+FLAG(int32,
+     distributed_page_bytes,
+     0,
+     "Most bytes in each page of distributed query results (0 for no limit)");
+
+FLAG(int32,
+     distributed_spill_ttl,
+     3600,
+     "Seconds unrequested pages of distributed query results are kept");
+
+FLAG(uint64,
+     distributed_spill_max_bytes,
+     64 * 1024 * 1024,
+     "Most bytes of distributed query result pages kept in the backing store");
+
+DECLARE_uint64(table_cache_max_bytes);
+
+/// The most executed distributed request IDs remembered.
+const size_t kDistributedRequestsMax = 4096;
+
+/// Seconds between checks for distributed queries past their deadline.
+const size_t kDistributedInterruptInterval = 1;
+
+/// Milliseconds to wait after the first failed distributed read or write.
+const size_t kDistributedBackoffMin = 1000;
+
+/// The most milliseconds to wait after failed distributed reads or writes.
+const size_t kDistributedBackoffMax = 300 * 1000;
+
+/// Long-polling reads are at least this many milliseconds apart.
+const size_t kDistributedLongPollMin = 1000;
+
+/// The key prefix of a spilled result's page count, size, and time.
+const std::string kDistributedSpillPrefix = "m:";
+
+/// The key prefix of a spilled result's pages.
+const std::string kDistributedPagePrefix = "p:";
+
 Status MockDistributedProvider::getQueriesJSON(std::string& query_json) {
   query_json = queriesJSON_;
   return Status();
@@ -36,6 +123,12 @@ Status MockDistributedProvider::writeResultsJSON(const std::string& results) {
     return Status();
 }
 
+Status MockChunkedDistributedProvider::writeResultChunkJSON(
+    const std::string& chunk) {
+  resultChunksJSON_.push_back(chunk);
+  return Status();
+}
+
 Status DistributedQueryHandler::parseQueriesJSON(
     const std::string& query_json,
     std::vector<DistributedQueryRequest>& requests) {
@@ -54,8 +147,14 @@ Status DistributedQueryHandler::parseQueriesJSON(
     const auto& request_tree = node.second;
     DistributedQueryRequest request;
     try {
-      request.query = request_tree.get_child("query").get_value<std::string>();
       request.id = request_tree.get_child("id").get_value<std::string>();
+      request.cursor = request_tree.get<std::string>("cursor", "");
+      if (request.cursor.empty()) {
+        request.query =
+            request_tree.get_child("query").get_value<std::string>();
+      }
+      request.limit = request_tree.get<size_t>("limit", 0);
+      request.max_bytes = request_tree.get<size_t>("max_bytes", 0);
     } catch (const std::exception& e) {
       return Status(1, std::string("Error parsing queries: ") + e.what());
     }
@@ -67,20 +166,388 @@ Status DistributedQueryHandler::parseQueriesJSON(
   return Status();
 }
 
-SQL DistributedQueryHandler::handleQuery(const std::string& query_string) {
-  SQL query = SQL(query_string);
+bool DistributedResultCache::get(const std::string& query,
+                                 std::string& rows,
+                                 size_t& age) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto entry = entries_.find(normalizeQuery(query));
+  if (entry == entries_.end()) {
+    return false;
+  }
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
+                     Clock::now() - entry->second.first)
+                     .count();
+  if (elapsed >= std::max(FLAGS_distributed_cache_ttl, 0)) {
+    bytes_ -= entry->second.second.size();
+    entries_.erase(entry);
+    return false;
+  }
+
+  rows = entry->second.second;
+  age = static_cast<size_t>(elapsed);
+  return true;
+}
+
+void DistributedResultCache::set(const std::string& query,
+                                 const std::string& rows) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto key = normalizeQuery(query);
+  auto now = Clock::now();
+  auto ttl = std::chrono::seconds(std::max(FLAGS_distributed_cache_ttl, 0));
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (it->second.first + ttl <= now || it->first == key) {
+      bytes_ -= it->second.second.size();
+      it = entries_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  if (rows.size() > FLAGS_table_cache_max_bytes) {
+    return;
+  }
+
+  // Evict the oldest results until these results fit.
+  while (bytes_ + rows.size() > FLAGS_table_cache_max_bytes) {
+    auto oldest = entries_.begin();
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      if (it->second.first < oldest->second.first) {
+        oldest = it;
+      }
+    }
+    bytes_ -= oldest->second.second.size();
+    entries_.erase(oldest);
+  }
+
+  entries_[key] = std::make_pair(now, rows);
+  bytes_ += rows.size();
+}
+
+void DistributedResultCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+  bytes_ = 0;
+}
+
+SQL DistributedQueryHandler::handleQuery(const std::string& query_string,
+                                         size_t timeout) {
+  SQL query = SQL(query_string, timeout, getQueryResultsLimit());
   query.annotateHostInfo();
   return query;
 }
 
+/// Serialize a row as serializeResults' property tree would, empty rows are "".
+static void writeRowJSON(const Row& r, std::string& json) {
+  JSONWriter writer(json);
+  if (r.empty()) {
+    writer.value("", 0);
+    return;
+  }
+
+  writer.startObject();
+  for (const auto& column : r) {
+    writer.key(column.first);
+    writer.value(column.second);
+  }
+  writer.endObject();
+}
+
+/// Serialize rows as serializeResults' property tree would, empty nodes are "".
+static void serializeRowsJSON(const QueryData& rows, std::string& json) {
+  JSONWriter writer(json);
+  if (rows.empty()) {
+    writer.value("", 0);
+    return;
+  }
+
+  writer.startArray();
+  std::string row;
+  for (const auto& r : rows) {
+    row.clear();
+    writeRowJSON(r, row);
+    writer.raw(row.data(), row.size());
+  }
+  writer.endArray();
+}
+
+/// Write a request's status and serialized rows, with the age of cached rows.
+static void writeResultJSON(int code,
+                            const std::string& rows,
+                            const size_t* age,
+                            std::string& json,
+                            const std::string& cursor = "",
+                            bool truncated = false) {
+  JSONWriter writer(json);
+  writer.startObject();
+  writer.key("status");
+  writer.value(std::to_string(code));
+  writer.key("rows");
+  writer.raw(rows.data(), rows.size());
+  if (age != nullptr) {
+    writer.key("cache_age");
+    writer.value(std::to_string(*age));
+  }
+  if (!cursor.empty()) {
+    writer.key("cursor");
+    writer.value(cursor);
+  }
+  if (truncated) {
+    writer.key("truncated");
+    writer.value("1", 1);
+  }
+  writer.endObject();
+}
+
+void DistributedQueryHandler::serializeResultJSON(const SQL& sql,
+                                                 std::string& json) {
+  std::string rows;
+  serializeRowsJSON(sql.rows(), rows);
+  writeResultJSON(sql.getStatus().getCode(), rows, nullptr, json);
+}
+
+void DistributedQueryHandler::serializeCachedResultJSON(const std::string& rows,
+                                                       size_t age,
+                                                       std::string& json) {
+  writeResultJSON(0, rows, &age, json);
+}
+
+void DistributedQueryHandler::paginateRows(const QueryData& rows,
+                                           size_t limit,
+                                           size_t max_bytes,
+                                           std::vector<std::string>& pages) {
+  pages.clear();
+  if (rows.empty()) {
+    pages.emplace_back();
+    serializeRowsJSON(rows, pages.back());
+    return;
+  }
+
+  std::unique_ptr<JSONWriter> writer;
+  size_t count = 0;
+  std::string row;
+  for (const auto& r : rows) {
+    row.clear();
+    writeRowJSON(r, row);
+    // The row, a separator, and the closing bracket must fit in the page.
+    if (writer != nullptr &&
+        ((limit > 0 && count >= limit) ||
+         (max_bytes > 0 && pages.back().size() + row.size() + 2 > max_bytes))) {
+      writer->endArray();
+      writer.reset();
+    }
+
+    if (writer == nullptr) {
+      pages.emplace_back();
+      writer.reset(new JSONWriter(pages.back()));
+      writer->startArray();
+      count = 0;
+    }
+    writer->raw(row.data(), row.size());
+    count++;
+  }
+  writer->endArray();
+}
+
+/// A spilled result's page count, including the returned first page.
+struct DistributedSpill {
+  std::string token;
+  size_t time{0};
+  size_t pages{0};
+  size_t bytes{0};
+};
+
+static std::string getPageKey(const std::string& token, size_t page) {
+  char index[21] = {0};
+  snprintf(index, sizeof(index), "%08zu", page);
+  return kDistributedPagePrefix + token + ":" + index;
+}
+
+/// Read a spilled result's metadata, stored as "time pages bytes".
+static bool getSpill(const std::string& token, DistributedSpill& spill) {
+  std::string content;
+  if (!getDatabaseValue(kDistributedResults,
+                        kDistributedSpillPrefix + token,
+                        content)
+           .ok()) {
+    return false;
+  }
+
+  std::istringstream stream(content);
+  spill.token = token;
+  return static_cast<bool>(stream >> spill.time >> spill.pages >> spill.bytes);
+}
+
+/// Remove a spilled result's metadata and every page.
+static void removeSpill(const DistributedSpill& spill) {
+  DatabaseBatch batch;
+  for (size_t page = 1; page < spill.pages; ++page) {
+    batch.remove(kDistributedResults, getPageKey(spill.token, page));
+  }
+  batch.remove(kDistributedResults, kDistributedSpillPrefix + spill.token);
+  writeDatabaseBatch(batch);
+}
+
+/// Split a cursor into the spilled result's token and a page index.
+static bool parseCursor(const std::string& cursor,
+                        std::string& token,
+                        size_t& page) {
+  auto separator = cursor.rfind(':');
+  if (separator == std::string::npos || separator == 0) {
+    return false;
+  }
+
+  try {
+    page = boost::lexical_cast<size_t>(cursor.substr(separator + 1));
+  } catch (const boost::bad_lexical_cast& e) {
+    return false;
+  }
+  token = cursor.substr(0, separator);
+  return page > 0;
+}
+
+void DistributedQueryHandler::expireSpills() {
+  std::lock_guard<std::mutex> lock(spill_mutex_);
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kDistributedResults, keys, kDistributedSpillPrefix);
+  size_t now = getUnixTime();
+  size_t ttl = std::max(FLAGS_distributed_spill_ttl, 0);
+  for (const auto& key : keys) {
+    DistributedSpill spill;
+    auto token = key.substr(kDistributedSpillPrefix.size());
+    if (!getSpill(token, spill)) {
+      spill.token = token;
+      removeSpill(spill);
+    } else if (spill.time + ttl <= now) {
+      removeSpill(spill);
+    }
+  }
+}
+
+std::string DistributedQueryHandler::spillPages(
+    const std::vector<std::string>& pages, bool& truncated) {
+  truncated = false;
+  std::lock_guard<std::mutex> lock(spill_mutex_);
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kDistributedResults, keys, kDistributedSpillPrefix);
+  std::vector<DistributedSpill> spills;
+  size_t total = 0;
+  for (const auto& key : keys) {
+    DistributedSpill spill;
+    if (getSpill(key.substr(kDistributedSpillPrefix.size()), spill)) {
+      total += spill.bytes;
+      spills.push_back(std::move(spill));
+    }
+  }
+
+  // Keep the pages that fit, every other spilled result may be evicted.
+  auto max = FLAGS_distributed_spill_max_bytes;
+  size_t bytes = 0;
+  size_t count = 1;
+  for (; count < pages.size(); ++count) {
+    if (bytes + pages[count].size() > max) {
+      truncated = true;
+      break;
+    }
+    bytes += pages[count].size();
+  }
+  if (count == 1) {
+    return "";
+  }
+
+  // Evict the oldest spilled results until these pages fit.
+  std::sort(spills.begin(),
+            spills.end(),
+            [](const DistributedSpill& a, const DistributedSpill& b) {
+              return a.time < b.time;
+            });
+  for (const auto& spill : spills) {
+    if (total + bytes <= max) {
+      break;
+    }
+    removeSpill(spill);
+    total -= std::min(total, spill.bytes);
+  }
+
+  static std::mt19937_64 generator(std::random_device{}());
+  std::ostringstream token;
+  token << std::hex << generator() << generator();
+
+  DatabaseBatch batch;
+  for (size_t page = 1; page < count; ++page) {
+    batch.put(kDistributedResults, getPageKey(token.str(), page), pages[page]);
+  }
+  batch.put(kDistributedResults,
+            kDistributedSpillPrefix + token.str(),
+            std::to_string(getUnixTime()) + " " + std::to_string(count) + " " +
+                std::to_string(bytes));
+  if (!writeDatabaseBatch(batch).ok()) {
+    truncated = true;
+    return "";
+  }
+  return token.str() + ":1";
+}
+
+Status DistributedQueryHandler::readPage(const std::string& cursor,
+                                         std::string& rows,
+                                         std::string& next) {
+  std::string token;
+  size_t page = 0;
+  if (!parseCursor(cursor, token, page)) {
+    return Status(1, "Invalid cursor: " + cursor);
+  }
+
+  DistributedSpill spill;
+  if (!getSpill(token, spill) || page >= spill.pages) {
+    return Status(1, "Unknown cursor: " + cursor);
+  }
+
+  auto status =
+      getDatabaseValue(kDistributedResults, getPageKey(token, page), rows);
+  if (!status.ok()) {
+    return Status(1, "Unknown cursor: " + cursor);
+  }
+  next = (page + 1 < spill.pages) ? token + ":" + std::to_string(page + 1) : "";
+  return Status();
+}
+
+void DistributedQueryHandler::releasePage(const std::string& cursor) {
+  std::string token;
+  size_t page = 0;
+  if (!parseCursor(cursor, token, page)) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(spill_mutex_);
+  DistributedSpill spill;
+  if (!getSpill(token, spill)) {
+    return;
+  }
+
+  if (page + 1 >= spill.pages) {
+    removeSpill(spill);
+  } else {
+    deleteDatabaseValue(kDistributedResults, getPageKey(token, page));
+  }
+}
+
+void DistributedQueryHandler::completeRequest(
+    const DistributedQueryRequest& request) {
+  if (request.cursor.empty()) {
+    markExecuted(request.id);
+  } else {
+    releasePage(request.cursor);
+  }
+}
+
 Status DistributedQueryHandler::serializeResults(
     const std::vector<std::pair<DistributedQueryRequest, SQL> >& results,
     pt::ptree& tree) {
   try {
     pt::ptree& res_tree = tree.put_child("results", pt::ptree());
     for (const auto& result : results) {
-      DistributedQueryRequest request = result.first;
-      SQL sql = result.second;
+      const auto& request = result.first;
+      const auto& sql = result.second;
       pt::ptree& child = res_tree.put_child(request.id, pt::ptree());
       child.put("status", sql.getStatus().getCode());
       pt::ptree& rows_child = child.put_child("rows", pt::ptree());
@@ -115,50 +582,290 @@ Status DistributedQueryHandler::doQueries() {
     return status;
   }
 
-  // Run the queries
-  std::vector<std::pair<DistributedQueryRequest, SQL> > query_results;
-  std::set<std::string> successful_query_ids;
-  for (const auto& request : requests) {
-    if (executedRequestIds_.find(request.id) != executedRequestIds_.end()) {
-      // We've already successfully returned results for this request, don't
-      // process it again.
-      continue;
+  // Requests with results already returned are not processed again, pages of
+  // spilled results may be requested again until they are returned.
+  loadExecuted();
+  expireExecuted();
+  expireSpills();
+  std::vector<DistributedQueryRequest> pending;
+  for (auto& request : requests) {
+    if (!request.cursor.empty() || !isExecuted(request.id)) {
+      pending.push_back(std::move(request));
     }
-    SQL query_result = handleQuery(request.query);
-    if (query_result.ok()) {
-      successful_query_ids.insert(request.id);
+  }
+
+  // Run the queries concurrently, each result is serialized as it completes
+  // so only one result set per thread is held in memory.
+  bool chunked = provider_->supportsResultChunks();
+  std::vector<std::string> fragments(pending.size());
+  std::vector<char> succeeded(pending.size(), 0);
+  std::atomic<size_t> next(0);
+  size_t running = 0;
+  std::mutex mutex;
+  std::condition_variable done;
+
+  auto worker = [&]() {
+    size_t i;
+    while ((i = next++) < pending.size()) {
+      const auto& request = pending[i];
+      std::string fragment;
+      bool ok = false;
+      std::string rows;
+      size_t age = 0;
+      size_t limit = (request.limit > 0)
+                         ? request.limit
+                         : std::max(FLAGS_distributed_page_rows, 0);
+      size_t max_bytes = (request.max_bytes > 0)
+                             ? request.max_bytes
+                             : std::max(FLAGS_distributed_page_bytes, 0);
+      if (!request.cursor.empty()) {
+        // The next page of a result is read from the backing store.
+        std::string next;
+        auto status = readPage(request.cursor, rows, next);
+        ok = status.ok();
+        if (!ok) {
+          VLOG(1) << status.getMessage();
+          rows = "\"\"";
+        }
+        writeResultJSON(status.getCode(), rows, nullptr, fragment, next);
+      } else if (limit > 0 || max_bytes > 0) {
+        // Pages after the first are spilled, rather than returned at once.
+        auto sql = handleQuery(request.query,
+                               std::max(FLAGS_distributed_timeout, 0));
+        ok = sql.ok();
+        std::vector<std::string> pages;
+        paginateRows(sql.rows(), limit, max_bytes, pages);
+        std::string cursor;
+        bool truncated = false;
+        if (pages.size() > 1) {
+          cursor = spillPages(pages, truncated);
+        }
+        writeResultJSON(sql.getStatus().getCode(),
+                        pages[0],
+                        nullptr,
+                        fragment,
+                        cursor,
+                        truncated);
+      } else if (FLAGS_distributed_cache_ttl > 0 &&
+                 DistributedResultCache::instance().get(
+                     request.query, rows, age)) {
+        // A repeated query within the TTL is answered without executing it.
+        ok = true;
+        serializeCachedResultJSON(rows, age, fragment);
+      } else {
+        auto sql = handleQuery(request.query,
+                               std::max(FLAGS_distributed_timeout, 0));
+        ok = sql.ok();
+        serializeRowsJSON(sql.rows(), rows);
+        writeResultJSON(sql.getStatus().getCode(), rows, nullptr, fragment);
+        if (ok && FLAGS_distributed_cache_ttl > 0) {
+          DistributedResultCache::instance().set(request.query, rows);
+        }
+      }
+
+      if (chunked) {
+        std::string chunk;
+        JSONWriter writer(chunk);
+        writer.startObject();
+        writer.key("results");
+        writer.startObject();
+        writer.key(request.id);
+        writer.raw(fragment.data(), fragment.size());
+        writer.endObject();
+        writer.endObject();
+        writer.endDocument();
+        ok = writeResults(chunk, true).ok() && ok;
+      } else {
+        fragments[i] = std::move(fragment);
+      }
+      succeeded[i] = ok;
     }
-    query_results.push_back({request, query_result});
+
+    std::lock_guard<std::mutex> lock(mutex);
+    running--;
+    done.notify_all();
+  };
+
+  size_t threads = std::min(
+      (size_t)std::max(FLAGS_distributed_threads, 1), pending.size());
+  std::vector<std::thread> workers;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    running = threads;
+  }
+  for (size_t i = 0; i < threads; ++i) {
+    workers.emplace_back(worker);
+  }
+
+  {
+    // Deadlines are enforced by interrupting expired queries while waiting.
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running > 0) {
+      done.wait_for(lock, std::chrono::seconds(kDistributedInterruptInterval));
+      if (FLAGS_distributed_timeout > 0) {
+        interruptExpiredQueries();
+      }
+    }
+  }
+  for (auto& thread : workers) {
+    thread.join();
+  }
+
+  if (chunked) {
+    for (size_t i = 0; i < pending.size(); ++i) {
+      if (succeeded[i]) {
+        completeRequest(pending[i]);
+      }
+    }
+    return Status();
   }
 
   // Serialize the results
-  pt::ptree serialized_results;
-  serializeResults(query_results, serialized_results);
   std::string json;
-  try {
-    std::ostringstream ss;
-    pt::write_json(ss, serialized_results, false);
-    json = ss.str();
-  }
-  catch (const std::exception& e) {
-    return Status(1, e.what());
+  JSONWriter writer(json);
+  writer.startObject();
+  writer.key("results");
+  if (pending.empty()) {
+    writer.value("", 0);
+  } else {
+    writer.startObject();
+    for (size_t i = 0; i < pending.size(); ++i) {
+      writer.key(pending[i].id);
+      writer.raw(fragments[i].data(), fragments[i].size());
+    }
+    writer.endObject();
   }
+  writer.endObject();
+  writer.endDocument();
+  fragments.clear();
 
   // Write the results
-  retries = 0;
-  do {
-    status = provider_->writeResultsJSON(json);
-    ++retries;
-  } while (!status.ok() && retries <= FLAGS_distributed_retries);
+  status = writeResults(json, false);
   if (!status.ok()) {
     return status;
   }
 
   // Only note that the queries were successfully completed if we were actually
   // able to write the results.
-  executedRequestIds_.insert(successful_query_ids.begin(),
-                             successful_query_ids.end());
+  for (size_t i = 0; i < pending.size(); ++i) {
+    if (succeeded[i]) {
+      completeRequest(pending[i]);
+    }
+  }
 
   return status;
 }
+
+Status DistributedQueryHandler::writeResults(const std::string& json,
+                                             bool chunk) {
+  std::lock_guard<std::mutex> lock(provider_mutex_);
+  Status status;
+  int retries = 0;
+  do {
+    status = (chunk) ? provider_->writeResultChunkJSON(json)
+                     : provider_->writeResultsJSON(json);
+    ++retries;
+  } while (!status.ok() && retries <= FLAGS_distributed_retries);
+  return status;
+}
+
+bool DistributedQueryHandler::isExecuted(const std::string& id) {
+  return executedRequestIds_.count(id) > 0;
+}
+
+void DistributedQueryHandler::markExecuted(const std::string& id) {
+  size_t now = getUnixTime();
+  if (!executedRequestIds_.emplace(id, now).second) {
+    return;
+  }
+  executedRequestOrder_.emplace_back(now, id);
+  if (FLAGS_distributed_persist_requests) {
+    setDatabaseValue(kDistributed, id, std::to_string(now));
+  }
+  expireExecuted();
+}
+
+void DistributedQueryHandler::expireExecuted() {
+  size_t now = getUnixTime();
+  size_t ttl = std::max(FLAGS_distributed_request_ttl, 0);
+  while (!executedRequestOrder_.empty()) {
+    const auto& oldest = executedRequestOrder_.front();
+    if (executedRequestOrder_.size() <= kDistributedRequestsMax &&
+        oldest.first + ttl > now) {
+      break;
+    }
+    executedRequestIds_.erase(oldest.second);
+    if (FLAGS_distributed_persist_requests) {
+      deleteDatabaseValue(kDistributed, oldest.second);
+    }
+    executedRequestOrder_.pop_front();
+  }
+}
+
+void DistributedQueryHandler::loadExecuted() {
+  if (executedLoaded_ || !FLAGS_distributed_persist_requests) {
+    return;
+  }
+  executedLoaded_ = true;
+
+  std::vector<std::string> ids;
+  scanDatabaseKeys(kDistributed, ids);
+  for (const auto& id : ids) {
+    std::string content;
+    if (!getDatabaseValue(kDistributed, id, content).ok() ||
+        executedRequestIds_.count(id) > 0) {
+      continue;
+    }
+
+    try {
+      auto time = boost::lexical_cast<size_t>(content);
+      executedRequestIds_[id] = time;
+      executedRequestOrder_.emplace_back(time, id);
+    } catch (const boost::bad_lexical_cast& e) {
+      deleteDatabaseValue(kDistributed, id);
+    }
+  }
+  std::sort(executedRequestOrder_.begin(), executedRequestOrder_.end());
+}
+
+size_t getDistributedBackoff(size_t failures) {
+  size_t backoff = kDistributedBackoffMax;
+  if (failures > 0 && failures < 32) {
+    backoff = std::min(kDistributedBackoffMin << (failures - 1),
+                       kDistributedBackoffMax);
+  }
+
+  static std::mt19937 generator(std::random_device{}());
+  std::uniform_int_distribution<size_t> jitter(backoff / 2, backoff);
+  return jitter(generator);
+}
+
+void DistributedRunner::start() {
+  size_t failures = 0;
+  while (true) {
+    auto started = std::chrono::steady_clock::now();
+    auto status = handler_.doQueries();
+    if (!status.ok()) {
+      failures++;
+      VLOG(1) << "Distributed queries failed (" << status.getMessage()
+              << "), retrying";
+      osquery::interruptableSleep(getDistributedBackoff(failures));
+      continue;
+    }
+    failures = 0;
+
+    if (!long_poll_) {
+      osquery::interruptableSleep(FLAGS_distributed_interval * 1000);
+      continue;
+    }
+
+    // A master that does not hold reads open must not be read in a busy loop.
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - started)
+                       .count();
+    if (elapsed < (long long)kDistributedLongPollMin) {
+      osquery::interruptableSleep(kDistributedLongPollMin - elapsed);
+    }
+  }
+}
 }
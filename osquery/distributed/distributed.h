@@ -10,13 +10,20 @@
 
 #pragma once
 
-#include <set>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 
+#include <boost/noncopyable.hpp>
 #include <boost/property_tree/ptree.hpp>
 
 #include <osquery/sql.h>
 
+#include "osquery/dispatcher/dispatcher.h"
+
 namespace osquery {
 
 /**
@@ -48,6 +55,36 @@ public:
    * @return osquery::Status indicating success or failure of the operation
    */
   virtual Status writeResultsJSON(const std::string& results) = 0;
+
+  /*
+   * @brief Check if the provider accepts results as each query completes
+   *
+   * Providers that return true receive each request's results through
+   * writeResultChunkJSON instead of a single writeResultsJSON.
+   */
+  virtual bool supportsResultChunks() const { return false; }
+
+  /*
+   * @brief Write a single request's results JSON back to the master
+   *
+   * The chunk has the same format as the writeResultsJSON document, with one
+   * request in "results". Chunks may be written in any order.
+   *
+   * @param chunk A string containing the results JSON of one request
+   *
+   * @return osquery::Status indicating success or failure of the operation
+   */
+  virtual Status writeResultChunkJSON(const std::string& chunk) {
+    return Status(1, "Result chunks are not supported");
+  }
+
+  /*
+   * @brief Check if getQueriesJSON waits for queries to become available
+   *
+   * Long-polling providers hold each read open until the master has queries,
+   * or a timeout passes, so they are read again without a polling interval.
+   */
+  virtual bool isLongPoll() const { return false; }
 };
 
 /**
@@ -66,6 +103,17 @@ public:
   std::string resultsJSON_;
 };
 
+/**
+ * @brief A mocked IDistributedProvider accepting result chunks
+ */
+class MockChunkedDistributedProvider : public MockDistributedProvider {
+public:
+  bool supportsResultChunks() const override { return true; }
+  Status writeResultChunkJSON(const std::string& chunk) override;
+
+  std::vector<std::string> resultChunksJSON_;
+};
+
 /**
  * @brief Small struct containing the query and ID information for a
  * distributed query
@@ -77,6 +125,59 @@ public:
      : query(q), id(i) {}
   std::string query;
   std::string id;
+
+  /// The most rows in each page of results, 0 for --distributed_page_rows.
+  size_t limit{0};
+  /// The most serialized bytes of rows in each page, 0 for the flag's value.
+  size_t max_bytes{0};
+  /// Request the page of a previous result instead of executing a query.
+  std::string cursor;
+};
+
+/**
+ * @brief Recent distributed query results, keyed by normalized SQL
+ *
+ * Masters often send the same query again within seconds, as users refresh
+ * or retry. The serialized rows of successful queries are kept for
+ * --distributed_cache_ttl seconds and answer identical queries without
+ * executing them. Cached results are bounded by --table_cache_max_bytes, as
+ * cached table results are, and the oldest are evicted first.
+ */
+class DistributedResultCache : private boost::noncopyable {
+ public:
+  static DistributedResultCache& instance() {
+    static DistributedResultCache instance;
+    return instance;
+  }
+
+  /**
+   * @brief Find the unexpired results of a query
+   *
+   * @param query The query SQL, before normalization
+   * @param rows The output serialized rows
+   * @param age The output seconds since the rows were generated
+   * @return true if the query's results are cached
+   */
+  bool get(const std::string& query, std::string& rows, size_t& age);
+
+  /// Cache a query's serialized rows, expired results are removed.
+  void set(const std::string& query, const std::string& rows);
+
+  /// Remove all cached results.
+  void clear();
+
+ private:
+  DistributedResultCache() : bytes_(0) {}
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  /// Map of normalized SQL to the generation time and serialized rows.
+  std::map<std::string, std::pair<Clock::time_point, std::string> > entries_;
+  /// The size of every cached entry's rows.
+  size_t bytes_;
+  /// Distributed queries are executed by several threads.
+  std::mutex mutex_;
 };
 
 /**
@@ -112,10 +213,36 @@ public:
   * @brief Run and annotate an individual query
   *
   * @param query_string A string containing the query to be executed
+  * @param timeout Seconds before the query may be interrupted, 0 for none
   *
   * @return A SQL object containing the (annotated) query results
   */
- static SQL handleQuery(const std::string& query_string);
+ static SQL handleQuery(const std::string& query_string, size_t timeout = 0);
+
+ /**
+  * @brief Serialize the results of one request as a JSON object
+  *
+  * The object holds the request's status and rows, as serializeResults would
+  * write for the request, without building a tree.
+  *
+  * @param sql The request's results
+  * @param json The string to append the object to
+  */
+ static void serializeResultJSON(const SQL& sql, std::string& json);
+
+ /**
+  * @brief Serialize a request answered by the result cache
+  *
+  * The object also holds "cache_age", the seconds since the rows were
+  * generated.
+  *
+  * @param rows The cached serialized rows
+  * @param age The age of the cached rows
+  * @param json The string to append the object to
+  */
+ static void serializeCachedResultJSON(const std::string& rows,
+                                       size_t age,
+                                       std::string& json);
 
  /**
   * @brief Serialize the results of all requests into a ptree
@@ -129,6 +256,24 @@ public:
      const std::vector<std::pair<DistributedQueryRequest, SQL> >& results,
      boost::property_tree::ptree& tree);
 
+ /**
+  * @brief Split rows into pages of serialized rows
+  *
+  * Each page is a JSON array, as serializeResultJSON writes "rows", holding at
+  * most limit rows and max_bytes bytes. A page always holds at least one row,
+  * so a row larger than max_bytes is a page alone. Without rows there is a
+  * single page.
+  *
+  * @param rows The results to split
+  * @param limit The most rows in a page, 0 for no limit
+  * @param max_bytes The most bytes in a page, 0 for no limit
+  * @param pages The output serialized pages
+  */
+ static void paginateRows(const QueryData& rows,
+                          size_t limit,
+                          size_t max_bytes,
+                          std::vector<std::string>& pages);
+
  /**
   * @brief Parse the query JSON into the individual query objects
   *
@@ -140,6 +285,50 @@ public:
   static Status parseQueriesJSON(const std::string& query_json,
                                  std::vector<DistributedQueryRequest>& requests);
 
+private:
+  /// Write a results document, retrying failures.
+  Status writeResults(const std::string& json, bool chunk);
+
+  /// Check if a request's results were already returned.
+  bool isExecuted(const std::string& id);
+
+  /// Note that a request's results were returned.
+  void markExecuted(const std::string& id);
+
+  /// Forget requests past the TTL, or the oldest past the maximum count.
+  void expireExecuted();
+
+  /// Read executed requests from the backing store, once.
+  void loadExecuted();
+
+  /// Note that a request's results were returned, releasing a served page.
+  void completeRequest(const DistributedQueryRequest& request);
+
+  /**
+   * @brief Spill the pages after the first into the backing store
+   *
+   * Expired and, if needed, the oldest spilled results are removed to keep
+   * spilled pages within --distributed_spill_max_bytes. The last pages that
+   * still do not fit are dropped.
+   *
+   * @param pages Every page of a result
+   * @param truncated Set if pages were dropped
+   * @return The cursor of the second page, empty if no page was spilled
+   */
+  std::string spillPages(const std::vector<std::string>& pages,
+                         bool& truncated);
+
+  /// Read a spilled page and the cursor of the next, empty for the last.
+  Status readPage(const std::string& cursor,
+                  std::string& rows,
+                  std::string& next);
+
+  /// Remove a page that was returned, and the result after its last page.
+  void releasePage(const std::string& cursor);
+
+  /// Remove spilled results older than --distributed_spill_ttl.
+  void expireSpills();
+
 private:
   // The provider used to read and write queries and results
   std::unique_ptr<IDistributedProvider> provider_;
@@ -147,7 +336,54 @@ private:
   // Used to store already executed queries to avoid duplication. (Some master
   // configurations may asynchronously process the results of requests, so a
   // request might be seen by the host after it has already been executed.)
-  std::set<std::string> executedRequestIds_;
+  // Each ID maps to the time it was executed, and expires after a TTL.
+  std::unordered_map<std::string, size_t> executedRequestIds_;
+
+  // Executed request IDs, oldest first, for expiration.
+  std::deque<std::pair<size_t, std::string>> executedRequestOrder_;
+
+  // Set when persisted executed requests are read.
+  bool executedLoaded_{false};
+
+  // Providers are not required to be thread safe, writes are serialized.
+  std::mutex provider_mutex_;
+
+  // Spilled results are added and evicted by several query threads.
+  std::mutex spill_mutex_;
+};
+
+/**
+ * @brief Milliseconds to wait before retrying after consecutive failures
+ *
+ * The wait doubles with each failure up to a maximum, and is jittered between
+ * half and all of that so a fleet reconnecting to a restarted master spreads
+ * its requests out.
+ *
+ * @param failures The number of consecutive failures, at least 1
+ */
+size_t getDistributedBackoff(size_t failures);
+
+/**
+ * @brief A service reading and executing distributed queries from a provider
+ *
+ * Polling providers are read every distributed_interval seconds. Long-polling
+ * providers are read again as soon as a read returns, so queries execute as
+ * soon as the master has them while idle hosts make few requests. Failures
+ * back off with getDistributedBackoff.
+ */
+class DistributedRunner : public InternalRunnable {
+ public:
+  explicit DistributedRunner(std::unique_ptr<IDistributedProvider> provider)
+      : long_poll_(provider->isLongPoll()), handler_(std::move(provider)) {}
+
+  /// Read and execute queries until the service is interrupted.
+  void start();
+
+ private:
+  /// Read the provider again without an interval.
+  bool long_poll_;
+
+  DistributedQueryHandler handler_;
 };
 
 } // namespace osquery
@@ -0,0 +1,136 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <osquery/enroll.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/json.h"
+#include "osquery/distributed/plugins/tls.h"
+#include "osquery/remote/requests.h"
+#include "osquery/remote/serializers/json.h"
+#include "osquery/remote/transports/tls.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+FLAG(string,
+     distributed_tls_read_endpoint,
+     "",
+     "TLS/HTTPS endpoint for distributed query reads");
+
+FLAG(string,
+     distributed_tls_write_endpoint,
+     "",
+     "TLS/HTTPS endpoint for distributed query results");
+
+FLAG(int32,
+     distributed_tls_max_wait,
+     60,
+     "Seconds the TLS/HTTPS server may hold a distributed query read open");
+
+FLAG(bool,
+     distributed_tls_compress,
+     false,
+     "GZip compress TLS/HTTPS distributed query results");
+
+/// Seconds added to the read wait before the read request fails.
+const size_t kTLSDistributedWaitMargin = 5;
+
+std::string TLSDistributedProvider::getKey() {
+  if (node_key_.empty()) {
+    node_key_ = getNodeKey("tls");
+  }
+  return node_key_;
+}
+
+Status TLSDistributedProvider::getQueriesJSON(std::string& query_json) {
+  auto uri =
+      "https://" + FLAGS_tls_hostname + FLAGS_distributed_tls_read_endpoint;
+  size_t wait = std::max(FLAGS_distributed_tls_max_wait, 0);
+
+  pt::ptree params;
+  params.put<std::string>("node_key", getKey());
+  params.put<size_t>("wait", wait);
+
+  auto request = Request<TLSTransport, JSONSerializer>(uri);
+  request.setTimeout(wait + kTLSDistributedWaitMargin);
+  auto status = request.call(params);
+  if (!status.ok()) {
+    return status;
+  }
+
+  pt::ptree recv;
+  status = request.getResponse(recv);
+  if (!status.ok()) {
+    return status;
+  }
+
+  if (recv.count("node_invalid") > 0) {
+    node_key_ = getNodeKey("tls", true);
+    return Status(1, "Distributed read failed: Invalid node key");
+  }
+
+  // An empty list of queries has no children to write as a list.
+  query_json.clear();
+  auto queries = recv.get_child_optional("queries");
+  if (!queries || queries->empty()) {
+    query_json = "[]";
+    return Status(0, "OK");
+  }
+  writePtreeJSON(*queries, query_json);
+  return Status(0, "OK");
+}
+
+Status TLSDistributedProvider::writeResultsJSON(const std::string& results) {
+  auto uri =
+      "https://" + FLAGS_tls_hostname + FLAGS_distributed_tls_write_endpoint;
+  if (results.size() < 2 || results[0] != '{') {
+    return Status(1, "Distributed results are not a JSON object");
+  }
+
+  // The node key is added as the first member of the results document.
+  std::string body = "{\"node_key\":\"";
+  auto key = getKey();
+  escapeJSONString(key.data(), key.size(), body);
+  body += "\",";
+  body.append(results, 1, std::string::npos);
+
+  auto request = Request<TLSTransport, JSONSerializer>(uri);
+  request.setCompression(FLAGS_distributed_tls_compress);
+  auto status = request.callSerialized(body);
+  if (!status.ok()) {
+    return status;
+  }
+
+  pt::ptree recv;
+  status = request.getResponse(recv);
+  if (status.ok() && recv.count("node_invalid") > 0) {
+    node_key_ = getNodeKey("tls", true);
+    return Status(1, "Distributed write failed: Invalid node key");
+  }
+  return status;
+}
+
+Status startTLSDistributed() {
+  if (FLAGS_distributed_tls_read_endpoint.empty()) {
+    return Status(0, "Distributed queries are not enabled");
+  }
+
+  std::unique_ptr<IDistributedProvider> provider(new TLSDistributedProvider());
+  Dispatcher::addService(
+      std::make_shared<DistributedRunner>(std::move(provider)));
+  return Status(0, "OK");
+}
+}
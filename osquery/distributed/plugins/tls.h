@@ -0,0 +1,58 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <osquery/flags.h>
+
+#include "osquery/distributed/distributed.h"
+
+namespace osquery {
+
+/// TLS endpoint (path) for distributed query reads.
+DECLARE_string(distributed_tls_read_endpoint);
+
+/**
+ * @brief A long-polling TLS/HTTPS distributed query provider.
+ *
+ * Each read posts the node key to the read endpoint with the seconds the
+ * server may hold the request open. The server replies as soon as it has
+ * queries for the node, or with an empty list when the wait passes:
+ *
+ *   {"queries": [{"id": "...", "query": "..."}]}
+ *
+ * Results are posted to the write endpoint as each query completes, with the
+ * node key added to the result chunk document.
+ */
+class TLSDistributedProvider : public IDistributedProvider {
+ public:
+  Status getQueriesJSON(std::string& query_json) override;
+  Status writeResultsJSON(const std::string& results) override;
+
+  bool supportsResultChunks() const override { return true; }
+  Status writeResultChunkJSON(const std::string& chunk) override {
+    return writeResultsJSON(chunk);
+  }
+
+  bool isLongPoll() const override { return true; }
+
+ private:
+  /// The enrolled node key, enrollment is forced again if it is rejected.
+  std::string getKey();
+
+ private:
+  std::string node_key_;
+};
+
+/**
+ * @brief Start the distributed query service if a TLS read endpoint is set.
+ */
+Status startTLSDistributed();
+}
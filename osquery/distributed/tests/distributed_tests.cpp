@@ -15,6 +15,7 @@
 #include <gtest/gtest.h>
 
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/sql.h>
 
 #include "osquery/distributed/distributed.h"
@@ -24,6 +25,10 @@ namespace pt = boost::property_tree;
 
 namespace osquery {
 
+DECLARE_int32(distributed_request_ttl);
+DECLARE_bool(distributed_persist_requests);
+DECLARE_int32(distributed_cache_ttl);
+
 // Distributed tests expect an SQL implementation for queries.
 REGISTER_INTERNAL(SQLiteSQLPlugin, "sql", "sql");
 
@@ -220,4 +225,239 @@ TEST_F(DistributedTests, test_duplicate_request) {
   ASSERT_NO_THROW(pt::read_json(json_stream, tree));
   EXPECT_EQ(0, tree.get_child("results").size());
 }
+
+TEST_F(DistributedTests, test_do_queries_chunked) {
+  auto provider_raw = new MockChunkedDistributedProvider();
+  provider_raw->queriesJSON_ =
+      "[ \
+      {\"query\": \"SELECT hour FROM time\", \"id\": \"hour\"},\
+      {\"query\": \"bad\", \"id\": \"bad\"},\
+      {\"query\": \"SELECT minutes FROM time\", \"id\": \"minutes\"}\
+    ]";
+  std::unique_ptr<MockDistributedProvider> provider(provider_raw);
+  DistributedQueryHandler handler(std::move(provider));
+
+  Status s = handler.doQueries();
+  ASSERT_EQ(Status(), s);
+  EXPECT_TRUE(provider_raw->resultsJSON_.empty());
+  ASSERT_EQ(3U, provider_raw->resultChunksJSON_.size());
+
+  // Each chunk holds a single request's results, in any order.
+  std::map<std::string, int> statuses;
+  for (const auto& chunk : provider_raw->resultChunksJSON_) {
+    pt::ptree tree;
+    std::istringstream json_stream(chunk);
+    ASSERT_NO_THROW(pt::read_json(json_stream, tree));
+    const auto& results = tree.get_child("results");
+    ASSERT_EQ(1U, results.size());
+    statuses[results.begin()->first] =
+        results.begin()->second.get<int>("status");
+  }
+  EXPECT_EQ(0, statuses["hour"]);
+  EXPECT_EQ(1, statuses["bad"]);
+  EXPECT_EQ(0, statuses["minutes"]);
+
+  // Only the failed request is executed again.
+  provider_raw->resultChunksJSON_.clear();
+  s = handler.doQueries();
+  ASSERT_EQ(Status(), s);
+  ASSERT_EQ(1U, provider_raw->resultChunksJSON_.size());
+  EXPECT_NE(std::string::npos,
+            provider_raw->resultChunksJSON_[0].find("\"bad\""));
+}
+
+TEST_F(DistributedTests, test_cached_results) {
+  DistributedResultCache::instance().clear();
+  auto provider_raw = new MockDistributedProvider();
+  provider_raw->queriesJSON_ =
+      "[{\"query\": \"SELECT hour FROM time\", \"id\": \"first\"}]";
+  std::unique_ptr<MockDistributedProvider> provider(provider_raw);
+  DistributedQueryHandler handler(std::move(provider));
+  ASSERT_EQ(Status(), handler.doQueries());
+
+  pt::ptree tree;
+  std::istringstream json_stream(provider_raw->resultsJSON_);
+  ASSERT_NO_THROW(pt::read_json(json_stream, tree));
+  EXPECT_EQ(0U, tree.get_child("results.first").count("cache_age"));
+  auto hour = tree.get<std::string>("results.first.rows..hour");
+
+  // The same normalized SQL is answered from the cache, with the rows' age.
+  provider_raw->queriesJSON_ =
+      "[{\"query\": \"SELECT hour\\n  FROM time;\", \"id\": \"second\"}]";
+  ASSERT_EQ(Status(), handler.doQueries());
+  json_stream.clear();
+  json_stream.str(provider_raw->resultsJSON_);
+  tree.clear();
+  ASSERT_NO_THROW(pt::read_json(json_stream, tree));
+  EXPECT_EQ(0, tree.get<int>("results.second.status"));
+  EXPECT_LE(tree.get<size_t>("results.second.cache_age"), 10U);
+  EXPECT_EQ(hour, tree.get<std::string>("results.second.rows..hour"));
+
+  // Without a TTL every request is executed.
+  auto ttl = FLAGS_distributed_cache_ttl;
+  FLAGS_distributed_cache_ttl = 0;
+  provider_raw->queriesJSON_ =
+      "[{\"query\": \"SELECT hour FROM time\", \"id\": \"third\"}]";
+  ASSERT_EQ(Status(), handler.doQueries());
+  FLAGS_distributed_cache_ttl = ttl;
+  json_stream.clear();
+  json_stream.str(provider_raw->resultsJSON_);
+  tree.clear();
+  ASSERT_NO_THROW(pt::read_json(json_stream, tree));
+  EXPECT_EQ(0U, tree.get_child("results.third").count("cache_age"));
+
+  // Failed queries are not cached.
+  std::string rows;
+  size_t age = 0;
+  provider_raw->queriesJSON_ = "[{\"query\": \"bad\", \"id\": \"bad\"}]";
+  ASSERT_EQ(Status(), handler.doQueries());
+  EXPECT_FALSE(DistributedResultCache::instance().get("bad", rows, age));
+  EXPECT_TRUE(
+      DistributedResultCache::instance().get("SELECT hour FROM time", rows, age));
+  DistributedResultCache::instance().clear();
+}
+
+TEST_F(DistributedTests, test_paginate_rows) {
+  QueryData rows;
+  for (size_t i = 0; i < 5; ++i) {
+    rows.push_back({{"n", std::to_string(i)}});
+  }
+
+  std::vector<std::string> pages;
+  DistributedQueryHandler::paginateRows(rows, 2, 0, pages);
+  ASSERT_EQ(3U, pages.size());
+  EXPECT_EQ("[{\"n\":\"0\"},{\"n\":\"1\"}]", pages[0]);
+  EXPECT_EQ("[{\"n\":\"4\"}]", pages[2]);
+
+  // A row larger than the page's bytes is a page alone.
+  DistributedQueryHandler::paginateRows(rows, 0, 21, pages);
+  ASSERT_EQ(3U, pages.size());
+  EXPECT_EQ("[{\"n\":\"0\"},{\"n\":\"1\"}]", pages[0]);
+  DistributedQueryHandler::paginateRows(rows, 0, 1, pages);
+  EXPECT_EQ(5U, pages.size());
+
+  // Without limits, or rows, there is a single page.
+  DistributedQueryHandler::paginateRows(rows, 0, 0, pages);
+  EXPECT_EQ(1U, pages.size());
+  DistributedQueryHandler::paginateRows({}, 2, 0, pages);
+  ASSERT_EQ(1U, pages.size());
+  EXPECT_EQ("\"\"", pages[0]);
+}
+
+TEST_F(DistributedTests, test_paged_results) {
+  auto provider_raw = new MockDistributedProvider();
+  provider_raw->queriesJSON_ =
+      "[{\"query\": \"SELECT 1 AS n UNION ALL SELECT 2 UNION ALL SELECT 3\","
+      " \"id\": \"paged\", \"limit\": 1}]";
+  std::unique_ptr<MockDistributedProvider> provider(provider_raw);
+  DistributedQueryHandler handler(std::move(provider));
+  ASSERT_EQ(Status(), handler.doQueries());
+
+  pt::ptree tree;
+  std::istringstream json_stream(provider_raw->resultsJSON_);
+  ASSERT_NO_THROW(pt::read_json(json_stream, tree));
+  EXPECT_EQ(0, tree.get<int>("results.paged.status"));
+  EXPECT_EQ(1U, tree.get_child("results.paged.rows").size());
+  EXPECT_EQ("1", tree.get<std::string>("results.paged.rows..n"));
+  auto cursor = tree.get<std::string>("results.paged.cursor");
+
+  // Each following page is read from the backing store by its cursor.
+  std::vector<std::string> values;
+  while (!cursor.empty()) {
+    provider_raw->queriesJSON_ =
+        "[{\"cursor\": \"" + cursor + "\", \"id\": \"paged\"}]";
+    ASSERT_EQ(Status(), handler.doQueries());
+    json_stream.clear();
+    json_stream.str(provider_raw->resultsJSON_);
+    tree.clear();
+    ASSERT_NO_THROW(pt::read_json(json_stream, tree));
+    EXPECT_EQ(0, tree.get<int>("results.paged.status"));
+    values.push_back(tree.get<std::string>("results.paged.rows..n"));
+
+    auto last = cursor;
+    cursor = tree.get<std::string>("results.paged.cursor", "");
+    if (cursor.empty()) {
+      // Returned pages are released, with the result after its last page.
+      provider_raw->queriesJSON_ =
+          "[{\"cursor\": \"" + last + "\", \"id\": \"paged\"}]";
+      ASSERT_EQ(Status(), handler.doQueries());
+      json_stream.clear();
+      json_stream.str(provider_raw->resultsJSON_);
+      tree.clear();
+      ASSERT_NO_THROW(pt::read_json(json_stream, tree));
+      EXPECT_EQ(1, tree.get<int>("results.paged.status"));
+    }
+  }
+  EXPECT_EQ(std::vector<std::string>({"2", "3"}), values);
+
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kDistributedResults, keys);
+  EXPECT_TRUE(keys.empty());
+}
+
+TEST_F(DistributedTests, test_distributed_backoff) {
+  // The wait doubles, and is jittered between half and all of the wait.
+  for (size_t failures = 1; failures <= 4; ++failures) {
+    size_t backoff = 1000U << (failures - 1);
+    auto wait = getDistributedBackoff(failures);
+    EXPECT_GE(wait, backoff / 2);
+    EXPECT_LE(wait, backoff);
+  }
+
+  // Many failures are capped at the maximum wait.
+  auto wait = getDistributedBackoff(64);
+  EXPECT_GE(wait, 150U * 1000);
+  EXPECT_LE(wait, 300U * 1000);
+}
+
+TEST_F(DistributedTests, test_expired_request) {
+  auto provider_raw = new MockDistributedProvider();
+  provider_raw->queriesJSON_ =
+      "[{\"query\": \"SELECT hour FROM time\", \"id\": \"hour\"}]";
+  std::unique_ptr<MockDistributedProvider> provider(provider_raw);
+  DistributedQueryHandler handler(std::move(provider));
+
+  // Executed requests are forgotten after the TTL, and executed again.
+  auto ttl = FLAGS_distributed_request_ttl;
+  FLAGS_distributed_request_ttl = 0;
+  ASSERT_EQ(Status(), handler.doQueries());
+  provider_raw->resultsJSON_.clear();
+  ASSERT_EQ(Status(), handler.doQueries());
+  FLAGS_distributed_request_ttl = ttl;
+
+  pt::ptree tree;
+  std::istringstream json_stream(provider_raw->resultsJSON_);
+  ASSERT_NO_THROW(pt::read_json(json_stream, tree));
+  EXPECT_EQ(0, tree.get<int>("results.hour.status"));
+}
+
+TEST_F(DistributedTests, test_persisted_request) {
+  auto persist = FLAGS_distributed_persist_requests;
+  FLAGS_distributed_persist_requests = true;
+  auto query_json =
+      "[{\"query\": \"SELECT hour FROM time\", \"id\": \"persisted\"}]";
+
+  {
+    auto provider_raw = new MockDistributedProvider();
+    provider_raw->queriesJSON_ = query_json;
+    std::unique_ptr<MockDistributedProvider> provider(provider_raw);
+    DistributedQueryHandler handler(std::move(provider));
+    ASSERT_EQ(Status(), handler.doQueries());
+  }
+
+  // A new handler, as after a restart, does not execute the request again.
+  auto provider_raw = new MockDistributedProvider();
+  provider_raw->queriesJSON_ = query_json;
+  std::unique_ptr<MockDistributedProvider> provider(provider_raw);
+  DistributedQueryHandler handler(std::move(provider));
+  ASSERT_EQ(Status(), handler.doQueries());
+
+  pt::ptree tree;
+  std::istringstream json_stream(provider_raw->resultsJSON_);
+  ASSERT_NO_THROW(pt::read_json(json_stream, tree));
+  EXPECT_EQ(0, tree.get_child("results").size());
+
+  deleteDatabaseValue(kDistributed, "persisted");
+  FLAGS_distributed_persist_requests = persist;
+}
 }
@@ -0,0 +1,89 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <boost/filesystem/operations.hpp>
+
+#include <gtest/gtest.h>
+
+#include <osquery/events.h>
+
+#include "osquery/core/test_util.h"
+#include "osquery/database/db_handle.h"
+
+namespace osquery {
+
+const std::string kBenchmarkEventsDBPath =
+    kTestWorkingDirectory + "benchmark-events";
+
+/// The number of events read by each get benchmark iteration.
+const size_t kBenchmarkEvents = 1000;
+
+class BenchmarkEventPublisher
+    : public EventPublisher<SubscriptionContext, EventContext> {
+  DECLARE_PUBLISHER("BenchmarkPublisher");
+};
+
+class BenchmarkEventSubscriber
+    : public EventSubscriber<BenchmarkEventPublisher> {
+ public:
+  BenchmarkEventSubscriber() { setName("BenchmarkSubscriber"); }
+
+  Status benchmarkAdd(const Row& r, EventTime time) { return add(r, time); }
+
+  QueryData benchmarkGet(EventTime start, EventTime stop) {
+    return get(start, stop);
+  }
+};
+
+class EventsBenchmarks : public testing::Test {
+ protected:
+  void SetUp() {
+    boost::filesystem::remove_all(kBenchmarkEventsDBPath);
+    DBHandle::getInstanceAtPath(kBenchmarkEventsDBPath);
+
+    // A file event, as written by the file_events subscriber.
+    row_ = {{"target_path", "/etc/passwd"},
+            {"category", "etc"},
+            {"action", "UPDATED"},
+            {"transaction_id", "0"},
+            {"md5", "d41d8cd98f00b204e9800998ecf8427e"}};
+  }
+
+  void TearDown() { boost::filesystem::remove_all(kBenchmarkEventsDBPath); }
+
+  Row row_;
+};
+
+TEST_F(EventsBenchmarks, bench_add) {
+  auto sub = std::make_shared<BenchmarkEventSubscriber>();
+  auto time = getUnixTime();
+  size_t failed = 0;
+  runBenchmark([&sub, &time, &failed, this]() {
+    if (!sub->benchmarkAdd(row_, time).ok()) {
+      failed++;
+    }
+  }, 1);
+  EXPECT_EQ(failed, 0U);
+}
+
+TEST_F(EventsBenchmarks, bench_get) {
+  auto sub = std::make_shared<BenchmarkEventSubscriber>();
+  auto time = getUnixTime();
+  for (size_t i = 0; i < kBenchmarkEvents; ++i) {
+    sub->benchmarkAdd(row_, time);
+  }
+
+  size_t rows = 0;
+  runBenchmark([&sub, &time, &rows]() {
+    rows += sub->benchmarkGet(time, time).size();
+  }, kBenchmarkEvents);
+  EXPECT_EQ(rows % kBenchmarkEvents, 0U);
+}
+}
@@ -18,6 +18,7 @@
 
 #include "osquery/core/conversions.h"
 #include "osquery/events/darwin/diskarbitration.h"
+#include "osquery/events/darwin/run_loop.h"
 
 namespace fs = boost::filesystem;
 
@@ -240,13 +241,19 @@ Status DiskArbitrationEventPublisher::run() {
   return Status(0, "OK");
 }
 
+Status DiskArbitrationEventPublisher::attach() {
+  run_loop_ = getSharedRunLoop();
+  restart();
+  return Status(0, "OK");
+}
+
 void DiskArbitrationEventPublisher::stop() {
   if (session_ != nullptr) {
     DASessionUnscheduleFromRunLoop(session_, run_loop_, kCFRunLoopDefaultMode);
     session_ = nullptr;
   }
 
-  if (run_loop_ == nullptr) {
+  if (run_loop_ != nullptr && !isAttached()) {
     CFRunLoopStop(run_loop_);
   }
 }
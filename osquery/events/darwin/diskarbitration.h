@@ -74,6 +74,7 @@ class DiskArbitrationEventPublisher
   bool shouldFire(const DiskArbitrationSubscriptionContextRef &sc,
                   const DiskArbitrationEventContextRef &ec) const;
   Status run();
+  Status attach();
 
   static void DiskAppearedCallback(DADiskRef disk, void *context);
   static void DiskDisappearedCallback(DADiskRef disk, void *context);
@@ -10,12 +10,16 @@
 
 #include <fnmatch.h>
 
+#include <boost/algorithm/string/case_conv.hpp>
 #include <boost/filesystem.hpp>
 
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
 #include "osquery/events/darwin/fsevents.h"
+#include "osquery/events/darwin/run_loop.h"
 
 /**
  * @brief FSEvents needs a real/absolute path for watches.
@@ -28,8 +32,19 @@
 
 namespace fs = boost::filesystem;
 
+/// Characters ending the literal prefix of a subscription path pattern.
+const std::string kFSEventsPatternChars = "*?[";
+
+/// Seconds the run loop waits before firing expired coalesced events.
+const CFTimeInterval kFSEventsCoalesceInterval = 1.0;
+
 namespace osquery {
 
+FLAG(uint64,
+     fsevents_latency,
+     1000,
+     "Milliseconds FSEvents collects file events before delivering a batch");
+
 std::map<FSEventStreamEventFlags, std::string> kMaskActions = {
     {kFSEventStreamEventFlagItemChangeOwner, "ATTRIBUTES_MODIFIED"},
     {kFSEventStreamEventFlagItemXattrMod, "ATTRIBUTES_MODIFIED"},
@@ -56,6 +71,10 @@ void FSEventsEventPublisher::restart() {
     return;
   }
 
+  if (isAttached()) {
+    scheduleCoalescing();
+  }
+
   // Build paths as CFStrings
   std::vector<CFStringRef> cf_paths;
   for (const auto& path : paths_) {
@@ -73,15 +92,16 @@ void FSEventsEventPublisher::restart() {
   // Remove any existing stream.
   stop();
 
-  // Create the FSEvent stream
+  // Create the FSEvent stream, a restarted stream resumes after the last
+  // event delivered by the previous stream so none are replayed or missed.
+  // The stream collects events for the latency and delivers them together.
   stream_ = FSEventStreamCreate(nullptr,
                                 &FSEventsEventPublisher::Callback,
                                 nullptr,
                                 watch_list,
-                                kFSEventStreamEventIdSinceNow,
-                                1,
+                                last_event_id_,
+                                FLAGS_fsevents_latency / 1000.0,
                                 kFSEventStreamCreateFlagFileEvents |
-                                    kFSEventStreamCreateFlagNoDefer |
                                     kFSEventStreamCreateFlagWatchRoot);
   if (stream_ != nullptr) {
     // Schedule the stream on the run loop.
@@ -105,6 +125,11 @@ void FSEventsEventPublisher::restart() {
 void FSEventsEventPublisher::stop() {
   // Stop the stream.
   if (stream_ != nullptr) {
+    // Remember where the stream stopped, to resume a restarted stream.
+    last_event_id_ = FSEventStreamGetLatestEventId(stream_);
+    if (last_event_id_ == kFSEventStreamEventIdSinceNow) {
+      last_event_id_ = FSEventsGetCurrentEventId();
+    }
     FSEventStreamStop(stream_);
     stream_started_ = false;
     FSEventStreamUnscheduleFromRunLoop(
@@ -114,8 +139,8 @@ void FSEventsEventPublisher::stop() {
     stream_ = nullptr;
   }
 
-  // Stop the run loop.
-  if (run_loop_ != nullptr) {
+  // Stop the run loop, unless it is shared.
+  if (run_loop_ != nullptr && !isAttached()) {
     CFRunLoopStop(run_loop_);
   }
 }
@@ -123,15 +148,24 @@ void FSEventsEventPublisher::stop() {
 void FSEventsEventPublisher::tearDown() {
   stop();
 
+  if (coalesce_timer_ != nullptr) {
+    CFRunLoopTimerInvalidate(coalesce_timer_);
+    CFRelease(coalesce_timer_);
+    coalesce_timer_ = nullptr;
+  }
+
   // Do not keep a reference to the run loop.
   run_loop_ = nullptr;
 }
 
 void FSEventsEventPublisher::configure() {
   // Rebuild the watch paths.
-  paths_.clear();
+  std::set<std::string> paths;
+  coalescing_ = false;
+  SubscriptionPathIndex index;
   for (auto& subscription : subscriptions_) {
     auto sub = getSubscriptionContext(subscription->context);
+    coalescing_ = coalescing_ || sub->coalesce > 0;
     // Check if the requested path was a symlink at configure time.
     boost::system::error_code ec;
     size_t link_depth = 0;
@@ -151,14 +185,31 @@ void FSEventsEventPublisher::configure() {
         break;
       }
     }
-    paths_.insert(sub->path);
+    paths.insert(sub->path);
+
+    // Subscription paths are case-insensitive patterns, index the case-folded
+    // literal prefix. Every event path matching the pattern begins with it.
+    auto literal = sub->path.find_first_of(kFSEventsPatternChars);
+    auto prefix = sub->path.substr(0, literal);
+    index.add(boost::algorithm::to_lower_copy(prefix), true, subscription);
   }
+  index_.swap(index);
 
   // There were no paths in the subscriptions?
-  if (paths_.empty()) {
+  if (paths.empty()) {
+    paths_.clear();
+    return;
+  }
+
+  if (paths == paths_ && stream_started_) {
+    // The running stream already watches every path.
+    if (isAttached()) {
+      scheduleCoalescing();
+    }
     return;
   }
 
+  paths_.swap(paths);
   restart();
 }
 
@@ -171,10 +222,49 @@ Status FSEventsEventPublisher::run() {
   }
 
   // Start the run loop, it may be removed with a tearDown.
-  CFRunLoopRun();
+  if (!coalescing_) {
+    CFRunLoopRun();
+    return Status(0, "OK");
+  }
+
+  // Return periodically to fire the events held for coalescing.
+  CFRunLoopRunInMode(kCFRunLoopDefaultMode, kFSEventsCoalesceInterval, false);
+  fireCoalesced();
+  return Status(0, "OK");
+}
+
+Status FSEventsEventPublisher::attach() {
+  run_loop_ = getSharedRunLoop();
+  restart();
   return Status(0, "OK");
 }
 
+void FSEventsEventPublisher::scheduleCoalescing() {
+  if (!coalescing_) {
+    if (coalesce_timer_ != nullptr) {
+      CFRunLoopTimerInvalidate(coalesce_timer_);
+      CFRelease(coalesce_timer_);
+      coalesce_timer_ = nullptr;
+    }
+    return;
+  }
+
+  if (coalesce_timer_ == nullptr) {
+    CFRunLoopTimerContext context = {0, this, nullptr, nullptr, nullptr};
+    coalesce_timer_ = CFRunLoopTimerCreate(
+        nullptr,
+        CFAbsoluteTimeGetCurrent() + kFSEventsCoalesceInterval,
+        kFSEventsCoalesceInterval,
+        0,
+        0,
+        [](CFRunLoopTimerRef timer, void* info) {
+          static_cast<FSEventsEventPublisher*>(info)->fireCoalesced();
+        },
+        &context);
+    CFRunLoopAddTimer(run_loop_, coalesce_timer_, kCFRunLoopDefaultMode);
+  }
+}
+
 void FSEventsEventPublisher::end() { stop(); }
 
 void FSEventsEventPublisher::Callback(
@@ -184,12 +274,37 @@ void FSEventsEventPublisher::Callback(
     void* event_paths,
     const FSEventStreamEventFlags fsevent_flags[],
     const FSEventStreamEventId fsevent_ids[]) {
+  // Coalesce the entries of each path within the delivery, combining their
+  // flags into the event of the path's first entry.
+  std::vector<FSEventsEventContextRef> entries;
+  std::map<std::string, size_t> positions;
   for (size_t i = 0; i < num_events; ++i) {
+    if (fsevent_flags[i] & kFSEventStreamEventFlagHistoryDone) {
+      // A restarted stream finished delivering the events it resumed.
+      continue;
+    }
+
+    std::string path(((char**)event_paths)[i]);
+    auto position = positions.find(path);
+    if (position != positions.end()) {
+      entries[position->second]->fsevent_flags |= fsevent_flags[i];
+      entries[position->second]->transaction_id = fsevent_ids[i];
+      continue;
+    }
+
+    positions[path] = entries.size();
     auto ec = createEventContext();
     ec->fsevent_stream = stream;
     ec->fsevent_flags = fsevent_flags[i];
     ec->transaction_id = fsevent_ids[i];
-    ec->path = std::string(((char**)event_paths)[i]);
+    ec->path = std::move(path);
+    entries.push_back(ec);
+  }
+
+  std::vector<EventContextRef> batch;
+  for (const auto& ec : entries) {
+    // Cached property list parses of the changed path are stale.
+    invalidatePlistCache(ec->path);
 
     if (ec->fsevent_flags & kFSEventStreamEventFlagMustScanSubDirs) {
       // The FSEvents thread coalesced events within and will report a root.
@@ -208,9 +323,10 @@ void FSEventsEventPublisher::Callback(
     bool has_action = false;
     for (const auto& action : kMaskActions) {
       if (ec->fsevent_flags & action.first) {
-        // Actions may be multiplexed. Fire and event for each.
-        ec->action = action.second;
-        EventFactory::fire<FSEventsEventPublisher>(ec);
+        // Actions may be multiplexed. Fire an event for each.
+        auto action_ec = std::make_shared<FSEventsEventContext>(*ec);
+        action_ec->action = action.second;
+        batch.push_back(action_ec);
         has_action = true;
       }
     }
@@ -218,9 +334,51 @@ void FSEventsEventPublisher::Callback(
     if (!has_action) {
       // If no action was matched for this path event, fire and unknown.
       ec->action = "UNKNOWN";
-      EventFactory::fire<FSEventsEventPublisher>(ec);
+      batch.push_back(ec);
     }
   }
+
+  // Queue the delivery's events together.
+  EventFactory::fireBatch<FSEventsEventPublisher>(batch);
+}
+
+bool FSEventsEventPublisher::matchSubscriptions(
+    const EventContextRef& ec, SubscriptionVector& matches) const {
+  if (ec == nullptr || index_.size() != subscriptions_.size()) {
+    // Subscriptions were added without a configure, check each.
+    return false;
+  }
+  auto path = boost::algorithm::to_lower_copy(getEventContext(ec)->path);
+  index_.match(path, matches);
+  return true;
+}
+
+void FSEventsEventPublisher::fireCallback(const SubscriptionRef& sub,
+                                          const EventContextRef& ec) const {
+  auto pub_ec = getEventContext(ec);
+  if (pub_ec->subscription != nullptr) {
+    // A held event was already coalesced by this Subscription.
+    if (pub_ec->subscription == sub.get()) {
+      EventPublisher::fireCallback(sub, ec);
+    }
+    return;
+  }
+
+  auto sc = getSubscriptionContext(sub->context);
+  if (sc->coalesce > 0) {
+    if (shouldFire(sc, pub_ec) && sub->callback != nullptr) {
+      // The run loop returns periodically to fire the held event.
+      coalescer_.hold(sub, pub_ec, sc->coalesce);
+    }
+    return;
+  }
+  EventPublisher::fireCallback(sub, ec);
+}
+
+void FSEventsEventPublisher::fireCoalesced() {
+  for (const auto& ec : coalescer_.expire()) {
+    fire(ec);
+  }
 }
 
 bool FSEventsEventPublisher::shouldFire(
@@ -21,6 +21,9 @@
 #include <osquery/events.h>
 #include <osquery/status.h>
 
+#include "osquery/events/event_coalescer.h"
+#include "osquery/events/subscription_index.h"
+
 namespace osquery {
 
 extern std::map<FSEventStreamEventFlags, std::string> kMaskActions;
@@ -33,6 +36,8 @@ struct FSEventsSubscriptionContext : public SubscriptionContext {
   FSEventStreamEventFlags mask;
   // A no-op since FSEvent subscriptions are always recursive.
   bool recursive;
+  /// Coalesce events with the same path and action for this many ms (if not 0).
+  size_t coalesce;
 
   void requireAction(std::string action) {
     for (const auto& bit : kMaskActions) {
@@ -42,7 +47,7 @@ struct FSEventsSubscriptionContext : public SubscriptionContext {
     }
   }
 
-  FSEventsSubscriptionContext() : mask(0), recursive(false) {}
+  FSEventsSubscriptionContext() : mask(0), recursive(false), coalesce(0) {}
 
  private:
   /**
@@ -93,6 +98,10 @@ class FSEventsEventPublisher
 
   // Entrypoint to the run loop
   Status run();
+
+  // Schedule the sources on the shared run loop instead of a thread
+  Status attach();
+
   // Callin for stopping the streams/run loop.
   void end();
 
@@ -108,13 +117,33 @@ class FSEventsEventPublisher
  public:
   FSEventsEventPublisher() : EventPublisher() {
     stream_started_ = false;
+    coalescing_ = false;
     stream_ = nullptr;
     run_loop_ = nullptr;
+    coalesce_timer_ = nullptr;
+    last_event_id_ = kFSEventStreamEventIdSinceNow;
   }
 
   bool shouldFire(const FSEventsSubscriptionContextRef& mc,
                   const FSEventsEventContextRef& ec) const;
 
+  /// Select Subscription%s by the event path using the path index.
+  bool matchSubscriptions(const EventContextRef& ec,
+                          SubscriptionVector& matches) const;
+
+ protected:
+  /// Hold events for coalescing Subscription%s, fire held events to only
+  /// the Subscription that held them.
+  void fireCallback(const SubscriptionRef& sub,
+                    const EventContextRef& ec) const;
+
+ private:
+  /// Fire the held events whose coalescing window passed.
+  void fireCoalesced();
+
+  /// Add or remove the shared run loop's timer firing coalesced events.
+  void scheduleCoalescing();
+
  private:
   // Restart the run loop.
   void restart();
@@ -134,6 +163,21 @@ class FSEventsEventPublisher
   bool stream_started_;
   std::set<std::string> paths_;
 
+  /// The last event delivered by a stopped stream, a new stream resumes here.
+  FSEventStreamEventId last_event_id_;
+
+  /// Subscription%s indexed by a case-folded path prefix.
+  SubscriptionPathIndex index_;
+
+  /// Events held by the dispatch thread for coalescing Subscription%s.
+  mutable EventCoalescer<FSEventsEventContext> coalescer_;
+
+  /// Set if any Subscription coalesces, the run loop returns periodically.
+  bool coalescing_;
+
+  /// When attached, the shared run loop does not return, a timer fires.
+  CFRunLoopTimerRef coalesce_timer_;
+
  private:
   CFRunLoopRef run_loop_;
 
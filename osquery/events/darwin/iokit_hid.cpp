@@ -13,6 +13,7 @@
 
 #include "osquery/core/conversions.h"
 #include "osquery/events/darwin/iokit_hid.h"
+#include "osquery/events/darwin/run_loop.h"
 
 namespace osquery {
 
@@ -174,6 +175,12 @@ Status IOKitHIDEventPublisher::run() {
   return Status(0, "OK");
 }
 
+Status IOKitHIDEventPublisher::attach() {
+  run_loop_ = getSharedRunLoop();
+  restart();
+  return Status(0, "OK");
+}
+
 void IOKitHIDEventPublisher::stop() {
   // Stop the manager.
   if (manager_ != nullptr) {
@@ -184,8 +191,8 @@ void IOKitHIDEventPublisher::stop() {
     manager_ = nullptr;
   }
 
-  // Stop the run loop.
-  if (run_loop_ != nullptr) {
+  // Stop the run loop, unless it is shared.
+  if (run_loop_ != nullptr && !isAttached()) {
     CFRunLoopStop(run_loop_);
   }
 }
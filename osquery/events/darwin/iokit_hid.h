@@ -83,6 +83,9 @@ class IOKitHIDEventPublisher
   // Entrypoint to the run loop
   Status run();
 
+  // Schedule the sources on the shared run loop instead of a thread
+  Status attach();
+
  public:
   /// IOKit HID hotplugged event.
   static void MatchingCallback(void *context,
@@ -0,0 +1,430 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include <security/audit/audit_ioctl.h>
+
+#include <osquery/core.h>
+#include <osquery/logger.h>
+
+#include "osquery/events/darwin/openbsm.h"
+
+namespace osquery {
+
+FLAG(bool,
+     enable_openbsm,
+     false,
+     "Use the OpenBSM audit pipe for process and socket events");
+
+/// The audit pipe device, each open is a separate clone of the pipe.
+const std::string kAuditPipePath = "/dev/auditpipe";
+
+/// Each read returns whole records, the buffer fits several of the largest.
+const size_t kBSMBufferSize = 4 * MAX_AUDIT_RECORD_SIZE;
+
+/// The header token's fields before an _EX header's address type.
+const size_t kBSMHeaderFixed = 4 + 1 + 2 + 2;
+
+REGISTER(OpenBSMEventPublisher, "event_publisher", "openbsm");
+
+/// Read a big-endian unsigned integer, BSM tokens are in network order.
+template <typename T>
+static inline T readBig(const uint8_t* data) {
+  T value = 0;
+  for (size_t i = 0; i < sizeof(T); i++) {
+    value = static_cast<T>((value << 8) | data[i]);
+  }
+  return value;
+}
+
+/// The size of a subject or process token, from its terminal ID's format.
+static size_t subjectSize(const uint8_t* data,
+                          size_t size,
+                          size_t port,
+                          bool ex) {
+  // auid, euid, egid, ruid, rgid, pid, sid, then the terminal port.
+  size_t fixed = 7 * 4 + port;
+  if (!ex) {
+    return fixed + 4;
+  } else if (size < fixed + 4) {
+    return 0;
+  }
+  auto type = readBig<uint32_t>(data + fixed);
+  return (type == 4 || type == 16) ? fixed + 4 + type : 0;
+}
+
+/// The size of a token, or 0 if the type is unknown or the token is cut off.
+static size_t tokenSize(uint8_t id, const uint8_t* data, size_t size) {
+  size_t need = 0;
+  switch (id) {
+  case AUT_HEADER32:
+    need = kBSMHeaderFixed + 4 + 4;
+    break;
+  case AUT_HEADER64:
+    need = kBSMHeaderFixed + 8 + 8;
+    break;
+  case AUT_HEADER32_EX:
+  case AUT_HEADER64_EX: {
+    if (size < kBSMHeaderFixed + 4) {
+      return 0;
+    }
+    auto type = readBig<uint32_t>(data + kBSMHeaderFixed);
+    if (type != 4 && type != 16) {
+      return 0;
+    }
+    need = kBSMHeaderFixed + 4 + type + ((id == AUT_HEADER32_EX) ? 8 : 16);
+    break;
+  }
+  case AUT_TRAILER:
+    need = 2 + 4;
+    break;
+  case AUT_SUBJECT32:
+  case AUT_PROCESS32:
+    need = subjectSize(data, size, 4, false);
+    break;
+  case AUT_SUBJECT32_EX:
+  case AUT_PROCESS32_EX:
+    need = subjectSize(data, size, 4, true);
+    break;
+  case AUT_SUBJECT64:
+  case AUT_PROCESS64:
+    need = subjectSize(data, size, 8, false);
+    break;
+  case AUT_SUBJECT64_EX:
+  case AUT_PROCESS64_EX:
+    need = subjectSize(data, size, 8, true);
+    break;
+  case AUT_RETURN32:
+    need = 1 + 4;
+    break;
+  case AUT_RETURN64:
+    need = 1 + 8;
+    break;
+  case AUT_PATH:
+  case AUT_TEXT:
+  case AUT_ZONENAME:
+    need = (size < 2) ? 0 : 2 + readBig<uint16_t>(data);
+    break;
+  case AUT_ARG32:
+    need = (size < 7) ? 0 : 7 + readBig<uint16_t>(data + 5);
+    break;
+  case AUT_ARG64:
+    need = (size < 11) ? 0 : 11 + readBig<uint16_t>(data + 9);
+    break;
+  case AUT_ATTR32:
+    need = 4 * 4 + 8 + 4;
+    break;
+  case AUT_ATTR64:
+    need = 4 * 4 + 8 + 8;
+    break;
+  case AUT_EXIT:
+    need = 4 + 4;
+    break;
+  case AUT_SOCKINET32:
+    need = 2 + 2 + 4;
+    break;
+  case AUT_SOCKINET128:
+    need = 2 + 2 + 16;
+    break;
+  case AUT_SOCKUNIX: {
+    // The family, then a terminated path.
+    auto end = (size > 2) ? memchr(data + 2, '\0', size - 2) : nullptr;
+    need = (end == nullptr) ? 0 : static_cast<const uint8_t*>(end) - data + 1;
+    break;
+  }
+  case AUT_EXEC_ARGS:
+  case AUT_EXEC_ENV: {
+    // A count, then that many terminated strings.
+    if (size < 4) {
+      return 0;
+    }
+    need = 4;
+    for (auto count = readBig<uint32_t>(data); count > 0; count--) {
+      auto end = (need < size) ? memchr(data + need, '\0', size - need)
+                               : nullptr;
+      if (end == nullptr) {
+        return 0;
+      }
+      need = static_cast<const uint8_t*>(end) - data + 1;
+    }
+    break;
+  }
+#ifdef AUT_IDENTITY
+  case AUT_IDENTITY: {
+    // The signer type, then the signing ID, team ID, and CDHash.
+    need = 4;
+    for (size_t field = 0; field < 3; field++) {
+      if (need + 2 > size) {
+        return 0;
+      }
+      // The IDs are followed by a truncation flag.
+      need += 2 + readBig<uint16_t>(data + need) + ((field < 2) ? 1 : 0);
+    }
+    break;
+  }
+#endif
+  default:
+    return 0;
+  }
+  return (need == 0 || need > size) ? 0 : need;
+}
+
+bool BSMTokenReader::next(BSMToken& token) {
+  if (offset_ >= size_) {
+    return false;
+  }
+
+  auto id = data_[offset_];
+  auto size = tokenSize(id, data_ + offset_ + 1, size_ - offset_ - 1);
+  if (size == 0) {
+    offset_ = size_;
+    return false;
+  }
+
+  token.id = id;
+  token.data = data_ + offset_ + 1;
+  token.size = size;
+  offset_ += size + 1;
+  return true;
+}
+
+size_t getBSMRecordSize(const uint8_t* data, size_t size) {
+  if (size < 1 + 4) {
+    return 0;
+  }
+  auto id = data[0];
+  if (id != AUT_HEADER32 && id != AUT_HEADER32_EX && id != AUT_HEADER64 &&
+      id != AUT_HEADER64_EX) {
+    return 0;
+  }
+  auto record = readBig<uint32_t>(data + 1);
+  return (record < 1 + kBSMHeaderFixed || record > size) ? 0 : record;
+}
+
+uint16_t getBSMRecordEvent(const uint8_t* data, size_t size) {
+  // The event type follows the header's type, size, and version.
+  return (size < 1 + 4 + 1 + 2) ? 0 : readBig<uint16_t>(data + 1 + 4 + 1);
+}
+
+/// Read the values of a subject token.
+static void parseSubject(const BSMToken& token, OpenBSMEventContext& ec) {
+  ec.auid = readBig<uint32_t>(token.data);
+  ec.euid = readBig<uint32_t>(token.data + 4);
+  ec.egid = readBig<uint32_t>(token.data + 8);
+  ec.ruid = readBig<uint32_t>(token.data + 12);
+  ec.pid = readBig<uint32_t>(token.data + 20);
+}
+
+/// Read the strings of an exec arguments token.
+static void parseExecArgs(const BSMToken& token, OpenBSMEventContext& ec) {
+  auto count = readBig<uint32_t>(token.data);
+  auto next = reinterpret_cast<const char*>(token.data + 4);
+  ec.arguments.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    ec.arguments.push_back(next);
+    next += ec.arguments.back().size() + 1;
+  }
+}
+
+bool parseBSMRecord(const uint8_t* data, size_t size, OpenBSMEventContext& ec) {
+  BSMTokenReader reader(data, size);
+  BSMToken token;
+  if (getBSMRecordSize(data, size) == 0 || !reader.next(token)) {
+    return false;
+  }
+
+  // The header's time, seconds follow any _EX address.
+  ec.event_id = readBig<uint16_t>(token.data + 4 + 1);
+  size_t time = kBSMHeaderFixed;
+  if (token.id == AUT_HEADER32_EX || token.id == AUT_HEADER64_EX) {
+    time += 4 + readBig<uint32_t>(token.data + kBSMHeaderFixed);
+  }
+  ec.time = (token.id == AUT_HEADER64 || token.id == AUT_HEADER64_EX)
+                ? readBig<uint64_t>(token.data + time)
+                : readBig<uint32_t>(token.data + time);
+
+  while (reader.next(token)) {
+    switch (token.id) {
+    case AUT_SUBJECT32:
+    case AUT_SUBJECT32_EX:
+    case AUT_SUBJECT64:
+    case AUT_SUBJECT64_EX:
+      parseSubject(token, ec);
+      break;
+    case AUT_PATH:
+      if (ec.path.empty()) {
+        auto path = reinterpret_cast<const char*>(token.data + 2);
+        ec.path.assign(path, strnlen(path, token.size - 2));
+      }
+      break;
+    case AUT_EXEC_ARGS:
+      parseExecArgs(token, ec);
+      break;
+    case AUT_ARG32:
+      ec.args[token.data[0]] = readBig<uint32_t>(token.data + 1);
+      break;
+    case AUT_ARG64:
+      ec.args[token.data[0]] = readBig<uint64_t>(token.data + 1);
+      break;
+    case AUT_RETURN32:
+      ec.success = (token.data[0] == 0);
+      ec.return_value = static_cast<int32_t>(readBig<uint32_t>(token.data + 1));
+      break;
+    case AUT_RETURN64:
+      ec.success = (token.data[0] == 0);
+      ec.return_value = static_cast<int64_t>(readBig<uint64_t>(token.data + 1));
+      break;
+    case AUT_EXIT:
+      ec.exit_status = static_cast<int32_t>(readBig<uint32_t>(token.data));
+      break;
+    case AUT_SOCKINET32:
+    case AUT_SOCKINET128: {
+      // The port and address are copied from the sockaddr in network order.
+      char address[INET6_ADDRSTRLEN] = {0};
+      ec.family = (token.id == AUT_SOCKINET32) ? AF_INET : AF_INET6;
+      ec.port = readBig<uint16_t>(token.data + 2);
+      if (inet_ntop(ec.family, token.data + 4, address, sizeof(address))) {
+        ec.address = address;
+      }
+      break;
+    }
+    case AUT_SOCKUNIX:
+      ec.family = AF_UNIX;
+      ec.address = reinterpret_cast<const char*>(token.data + 2);
+      break;
+    default:
+      break;
+    }
+  }
+  return true;
+}
+
+Status OpenBSMEventPublisher::setUp() {
+  if (!FLAGS_enable_openbsm) {
+    return Status(1, "Publisher disabled via configuration");
+  }
+
+  pipe_ = ::open(kAuditPipePath.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (pipe_ == -1) {
+    return Status(1, "Could not open audit pipe: " + kAuditPipePath);
+  }
+
+  // Only the classes selected in configure are queued for this pipe clone.
+  int mode = AUDITPIPE_PRESELECT_MODE_LOCAL;
+  if (::ioctl(pipe_, AUDITPIPE_SET_PRESELECT_MODE, &mode) == -1) {
+    tearDown();
+    return Status(1, "Could not set audit pipe preselection");
+  }
+
+  // Absorb exec bursts between reads, a failure is not fatal.
+  u_int limit = 0;
+  if (::ioctl(pipe_, AUDITPIPE_GET_QLIMIT_MAX, &limit) == 0) {
+    ::ioctl(pipe_, AUDITPIPE_SET_QLIMIT, &limit);
+  }
+
+  buffer_.resize(kBSMBufferSize);
+  return Status(0, "OK");
+}
+
+void OpenBSMEventPublisher::configure() {
+  if (pipe_ == -1) {
+    return;
+  }
+
+  // The pipe preselects on the classes of every subscription's events.
+  std::set<uint16_t> event_ids;
+  au_class_t classes = 0;
+  for (const auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    for (const auto& event_id : sc->event_ids) {
+      event_ids.insert(event_id);
+      // The event to class mapping is read from /etc/security/audit_event.
+      auto event = getauevnum(event_id);
+      if (event == nullptr) {
+        LOG(WARNING) << "No audit class for BSM event: " << event_id;
+        continue;
+      }
+      classes |= event->ae_class;
+    }
+  }
+  event_ids_ = std::move(event_ids);
+
+  if (classes == classes_) {
+    return;
+  }
+
+  au_mask_t mask;
+  mask.am_success = classes;
+  mask.am_failure = classes;
+  if (::ioctl(pipe_, AUDITPIPE_SET_PRESELECT_FLAGS, &mask) == -1 ||
+      ::ioctl(pipe_, AUDITPIPE_SET_PRESELECT_NAFLAGS, &mask) == -1) {
+    LOG(WARNING) << "Could not set audit pipe preselection classes";
+    return;
+  }
+  classes_ = classes;
+}
+
+void OpenBSMEventPublisher::tearDown() {
+  if (pipe_ != -1) {
+    ::close(pipe_);
+    pipe_ = -1;
+  }
+}
+
+Status OpenBSMEventPublisher::readEvents() {
+  while (!isEnding()) {
+    ssize_t size = ::read(pipe_, buffer_.data(), buffer_.size());
+    if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // The pipe is drained.
+      return Status(0, "OK");
+    } else if (size == -1 && errno == EINTR) {
+      continue;
+    } else if (size <= 0) {
+      return Status(1, "Audit pipe read failed");
+    }
+    processEvents(buffer_.data(), size);
+  }
+  return Status(0, "OK");
+}
+
+void OpenBSMEventPublisher::processEvents(const uint8_t* buffer, size_t size) {
+  size_t offset = 0;
+  while (offset < size) {
+    auto record = getBSMRecordSize(buffer + offset, size - offset);
+    if (record == 0) {
+      // The pipe only returns whole records.
+      break;
+    }
+
+    // A preselected class also holds events no Subscription uses.
+    auto event_id = getBSMRecordEvent(buffer + offset, record);
+    if (event_ids_.count(event_id) > 0) {
+      auto ec = createEventContext();
+      if (parseBSMRecord(buffer + offset, record, *ec)) {
+        fire(ec);
+      }
+    }
+    offset += record;
+  }
+}
+
+bool OpenBSMEventPublisher::shouldFire(const OpenBSMSubscriptionContextRef& sc,
+                                       const OpenBSMEventContextRef& ec) const {
+  return sc->event_ids.count(ec->event_id) > 0;
+}
+}
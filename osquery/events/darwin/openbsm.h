@@ -0,0 +1,205 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <bsm/libbsm.h>
+
+#include <osquery/events.h>
+#include <osquery/flags.h>
+
+namespace osquery {
+
+DECLARE_bool(enable_openbsm);
+
+/**
+ * @brief A BSM token within a record buffer.
+ *
+ * The token is a view of the buffer, nothing is copied until the token's
+ * values are read into an event.
+ */
+struct BSMToken {
+  /// The AUT_* token type.
+  uint8_t id;
+  /// The token's bytes following the type.
+  const uint8_t* data;
+  size_t size;
+
+  BSMToken() : id(0), data(nullptr), size(0) {}
+};
+
+/**
+ * @brief Iterate the tokens of a single BSM record.
+ *
+ * Token sizes are computed from the token type, and the iteration ends at a
+ * type without a known size. The rest of that record is skipped, a record's
+ * size comes from its header.
+ */
+class BSMTokenReader {
+ public:
+  BSMTokenReader(const uint8_t* data, size_t size)
+      : data_(data), size_(size), offset_(0) {}
+
+  /// Read the next token, false at the end of the record.
+  bool next(BSMToken& token);
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+  size_t offset_;
+};
+
+/**
+ * @brief The size of the record at the start of a buffer.
+ *
+ * @return The size from the record's header token, 0 if the buffer does not
+ * start with a complete record.
+ */
+size_t getBSMRecordSize(const uint8_t* data, size_t size);
+
+/**
+ * @brief The AUE_* event type of the record at the start of a buffer.
+ *
+ * Records of events no Subscription uses are skipped without parsing.
+ */
+uint16_t getBSMRecordEvent(const uint8_t* data, size_t size);
+
+/**
+ * @brief Subscription details for OpenBSMEventPublisher events.
+ *
+ * The audit pipe preselects records by audit class, the publisher selects
+ * the classes of the union of every subscription's event types.
+ */
+struct OpenBSMSubscriptionContext : public SubscriptionContext {
+  /// The AUE_* event types reported to this subscription.
+  std::set<uint16_t> event_ids;
+};
+
+/**
+ * @brief Event details for OpenBSMEventPublisher events.
+ *
+ * The values of the tokens an exec, exit, or socket record contains.
+ */
+struct OpenBSMEventContext : public EventContext {
+  /// The AUE_* event type.
+  uint16_t event_id;
+
+  /// The subject process.
+  pid_t pid;
+  uid_t auid;
+  uid_t euid;
+  gid_t egid;
+  uid_t ruid;
+
+  /// The first path token, an exec's binary.
+  std::string path;
+  /// The arguments of an exec.
+  std::vector<std::string> arguments;
+  /// Argument tokens by argument number.
+  std::map<uint8_t, uint64_t> args;
+
+  /// True if the return token reports success.
+  bool success;
+  int64_t return_value;
+  /// The status of an exit token.
+  int32_t exit_status;
+
+  /// The socket address of a connect or bind, family is an AF_* value.
+  int family;
+  std::string address;
+  uint16_t port;
+
+  OpenBSMEventContext()
+      : event_id(0),
+        pid(0),
+        auid(0),
+        euid(0),
+        egid(0),
+        ruid(0),
+        success(false),
+        return_value(0),
+        exit_status(0),
+        family(0),
+        port(0) {}
+};
+
+typedef std::shared_ptr<OpenBSMEventContext> OpenBSMEventContextRef;
+typedef std::shared_ptr<OpenBSMSubscriptionContext>
+    OpenBSMSubscriptionContextRef;
+
+/**
+ * @brief Parse a BSM record into an event.
+ *
+ * @param data A buffer starting with a record.
+ * @param size The record size from getBSMRecordSize.
+ * @param ec The output event.
+ *
+ * @return false if the record has no header.
+ */
+bool parseBSMRecord(const uint8_t* data, size_t size, OpenBSMEventContext& ec);
+
+/**
+ * @brief An OS X OpenBSM audit pipe EventPublisher.
+ *
+ * The publisher opens a clone of /dev/auditpipe with local preselection, the
+ * pipe queues only the records of the audit classes its subscriptions use.
+ * Auditing must be enabled by auditd, and reading the pipe requires root, so
+ * the publisher is enabled with --enable_openbsm.
+ *
+ * Uses OpenBSMSubscriptionContext and OpenBSMEventContext.
+ */
+class OpenBSMEventPublisher
+    : public EventPublisher<OpenBSMSubscriptionContext, OpenBSMEventContext> {
+  DECLARE_PUBLISHER("openbsm");
+
+ public:
+  /// Open the audit pipe and enable local preselection.
+  Status setUp();
+  /// Preselect the classes of the subscribed event types.
+  void configure();
+  /// Close the audit pipe.
+  void tearDown();
+  /// The event loop waits on the audit pipe.
+  int getPollHandle() const { return pipe_; }
+  /// Drain the audit pipe.
+  Status process() { return readEvents(); }
+
+  OpenBSMEventPublisher() : EventPublisher(), pipe_(-1) {}
+
+  /// Check if the audit pipe is open.
+  bool isPipeOpen() { return pipe_ > 0; }
+
+ private:
+  /// Read from the non-blocking pipe until it is empty.
+  Status readEvents();
+  /// Parse and fire the subscribed records within a read buffer.
+  void processEvents(const uint8_t* buffer, size_t size);
+  /// Given a SubscriptionContext and OpenBSMEventContext match the event type.
+  bool shouldFire(const OpenBSMSubscriptionContextRef& sc,
+                  const OpenBSMEventContextRef& ec) const;
+
+ private:
+  int pipe_;
+  /// The read buffer, each read returns whole records.
+  std::vector<uint8_t> buffer_;
+  /// The union of the subscribed event types.
+  std::set<uint16_t> event_ids_;
+  /// The preselected audit classes.
+  au_class_t classes_{0};
+
+ private:
+  FRIEND_TEST(OpenBSMTests, test_openbsm_process_events);
+};
+}
@@ -0,0 +1,49 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <condition_variable>
+#include <mutex>
+
+#include <boost/thread.hpp>
+
+#include "osquery/events/darwin/run_loop.h"
+
+namespace osquery {
+
+static std::mutex kSharedRunLoopMutex;
+static std::condition_variable kSharedRunLoopStarted;
+static CFRunLoopRef kSharedRunLoop = nullptr;
+
+static void runSharedLoop() {
+  // A run loop without sources returns immediately, keep a distant timer.
+  auto timer = CFRunLoopTimerCreate(
+      nullptr, 1.0e10, 1.0e10, 0, 0, [](CFRunLoopTimerRef, void*) {}, nullptr);
+  CFRunLoopAddTimer(CFRunLoopGetCurrent(), timer, kCFRunLoopDefaultMode);
+
+  {
+    std::lock_guard<std::mutex> lock(kSharedRunLoopMutex);
+    kSharedRunLoop = CFRunLoopGetCurrent();
+    kSharedRunLoopStarted.notify_all();
+  }
+
+  while (true) {
+    CFRunLoopRun();
+  }
+}
+
+CFRunLoopRef getSharedRunLoop() {
+  std::unique_lock<std::mutex> lock(kSharedRunLoopMutex);
+  if (kSharedRunLoop == nullptr) {
+    boost::thread(runSharedLoop).detach();
+    kSharedRunLoopStarted.wait(lock, [] { return kSharedRunLoop != nullptr; });
+  }
+  return kSharedRunLoop;
+}
+}
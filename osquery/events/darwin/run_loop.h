@@ -0,0 +1,25 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <CoreFoundation/CoreFoundation.h>
+
+namespace osquery {
+
+/**
+ * @brief The CFRunLoop shared by callback-driven darwin publishers.
+ *
+ * The first call starts a thread running the loop for the life of the
+ * process. Publishers schedule their sources on it from `attach` and remove
+ * them in tearDown, they must not stop the shared loop.
+ */
+CFRunLoopRef getSharedRunLoop();
+}
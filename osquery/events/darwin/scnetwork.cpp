@@ -13,6 +13,7 @@
 
 #include <osquery/logger.h>
 
+#include "osquery/events/darwin/run_loop.h"
 #include "osquery/events/darwin/scnetwork.h"
 
 namespace osquery {
@@ -138,7 +139,9 @@ void SCNetworkEventPublisher::stop() {
         target, run_loop_, kCFRunLoopDefaultMode);
   }
 
-  CFRunLoopStop(run_loop_);
+  if (!isAttached()) {
+    CFRunLoopStop(run_loop_);
+  }
 }
 
 Status SCNetworkEventPublisher::run() {
@@ -154,4 +157,10 @@ Status SCNetworkEventPublisher::run() {
   osquery::publisherSleep(1000);
   return Status(0, "OK");
 }
+
+Status SCNetworkEventPublisher::attach() {
+  run_loop_ = getSharedRunLoop();
+  restart();
+  return Status(0, "OK");
+}
 };
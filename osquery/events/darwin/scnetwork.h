@@ -62,6 +62,9 @@ class SCNetworkEventPublisher
   // Entrypoint to the run loop
   Status run();
 
+  // Schedule the sources on the shared run loop instead of a thread
+  Status attach();
+
  public:
   /// SCNetwork registers a client callback instead of using a select/poll loop.
   static void Callback(const SCNetworkReachabilityRef target,
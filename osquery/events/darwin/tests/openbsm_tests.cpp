@@ -0,0 +1,148 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/events.h>
+
+#include "osquery/events/darwin/openbsm.h"
+
+namespace osquery {
+
+class OpenBSMTests : public testing::Test {};
+
+/// Build a BSM record from token bytes, as a kernel would.
+class BSMRecordWriter {
+ public:
+  BSMRecordWriter& u8(uint8_t value) {
+    bytes_.push_back(value);
+    return *this;
+  }
+
+  BSMRecordWriter& u16(uint16_t value) { return u8(value >> 8).u8(value); }
+
+  BSMRecordWriter& u32(uint32_t value) {
+    return u16(value >> 16).u16(value & 0xffff);
+  }
+
+  BSMRecordWriter& str(const std::string& value) {
+    bytes_.insert(bytes_.end(), value.begin(), value.end());
+    return u8(0);
+  }
+
+  /// Prepend a 32-bit header and append a trailer.
+  std::vector<uint8_t> record(uint16_t event, uint32_t time) {
+    BSMRecordWriter header;
+    uint32_t size = 1 + 17 + bytes_.size() + 1 + 6;
+    header.u8(AUT_HEADER32).u32(size).u8(11).u16(event).u16(0).u32(time).u32(0);
+    auto record = header.bytes_;
+    record.insert(record.end(), bytes_.begin(), bytes_.end());
+    BSMRecordWriter trailer;
+    trailer.u8(AUT_TRAILER).u16(0xb105).u32(size);
+    record.insert(record.end(), trailer.bytes_.begin(), trailer.bytes_.end());
+    return record;
+  }
+
+ private:
+  std::vector<uint8_t> bytes_;
+};
+
+static std::vector<uint8_t> createExecRecord(pid_t pid) {
+  BSMRecordWriter writer;
+  writer.u8(AUT_EXEC_ARGS).u32(2).str("ls").str("-l");
+  writer.u8(AUT_PATH).u16(8).str("/bin/ls");
+  // auid, euid, egid, ruid, rgid, pid, sid, port, address.
+  writer.u8(AUT_SUBJECT32).u32(501).u32(0).u32(0).u32(501).u32(20).u32(pid);
+  writer.u32(100001).u32(0).u32(0);
+  writer.u8(AUT_RETURN32).u8(0).u32(0);
+  return writer.record(AUE_EXECVE, 1400000000);
+}
+
+TEST_F(OpenBSMTests, test_parse_exec_record) {
+  auto record = createExecRecord(42);
+  ASSERT_EQ(getBSMRecordSize(record.data(), record.size()), record.size());
+  EXPECT_EQ(getBSMRecordEvent(record.data(), record.size()), AUE_EXECVE);
+
+  OpenBSMEventContext ec;
+  ASSERT_TRUE(parseBSMRecord(record.data(), record.size(), ec));
+  EXPECT_EQ(ec.event_id, AUE_EXECVE);
+  EXPECT_EQ(ec.time, 1400000000U);
+  EXPECT_EQ(ec.path, "/bin/ls");
+  EXPECT_EQ(ec.arguments, std::vector<std::string>({"ls", "-l"}));
+  EXPECT_EQ(ec.pid, 42);
+  EXPECT_EQ(ec.auid, 501U);
+  EXPECT_EQ(ec.euid, 0U);
+  EXPECT_TRUE(ec.success);
+
+  // A cut off record is not parsed.
+  EXPECT_EQ(getBSMRecordSize(record.data(), record.size() - 1), 0U);
+}
+
+TEST_F(OpenBSMTests, test_parse_connect_record) {
+  BSMRecordWriter writer;
+  writer.u8(AUT_ARG32).u8(1).u32(5).u16(3).str("fd");
+  writer.u8(AUT_SOCKINET32).u16(2).u16(443).u8(10).u8(0).u8(0).u8(1);
+  // An unknown token ends the record's tokens.
+  writer.u8(0xfe).u32(0);
+  writer.u8(AUT_RETURN32).u8(0).u32(0);
+  auto record = writer.record(AUE_CONNECT, 1);
+
+  OpenBSMEventContext ec;
+  ASSERT_TRUE(parseBSMRecord(record.data(), record.size(), ec));
+  EXPECT_EQ(ec.args[1], 5U);
+  EXPECT_EQ(ec.family, AF_INET);
+  EXPECT_EQ(ec.address, "10.0.0.1");
+  EXPECT_EQ(ec.port, 443);
+  EXPECT_FALSE(ec.success);
+}
+
+class TestOpenBSMEventSubscriber
+    : public EventSubscriber<OpenBSMEventPublisher> {
+ public:
+  TestOpenBSMEventSubscriber() { setName("TestOpenBSMEventSubscriber"); }
+
+  Status init() { return Status(0, "OK"); }
+};
+
+static std::vector<pid_t> kOpenBSMTestPids;
+
+static Status TestOpenBSMCallback(const EventContextRef& ec,
+                                  const void* user_data) {
+  auto bec = std::static_pointer_cast<OpenBSMEventContext>(ec);
+  kOpenBSMTestPids.push_back(bec->pid);
+  return Status(0, "OK");
+}
+
+TEST_F(OpenBSMTests, test_openbsm_process_events) {
+  auto pub = std::make_shared<OpenBSMEventPublisher>();
+  auto sub = std::make_shared<TestOpenBSMEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
+
+  auto sc = pub->createSubscriptionContext();
+  sc->event_ids = {AUE_EXECVE};
+  pub->addSubscription(Subscription::create(
+      "TestOpenBSMEventSubscriber", sc, TestOpenBSMCallback));
+  pub->event_ids_ = {AUE_EXECVE};
+
+  // A read may return several records, unsubscribed events are skipped.
+  auto buffer = createExecRecord(1);
+  BSMRecordWriter writer;
+  auto exit = writer.u8(AUT_EXIT).u32(0).u32(0).record(AUE_EXIT, 1);
+  buffer.insert(buffer.end(), exit.begin(), exit.end());
+  auto exec = createExecRecord(2);
+  buffer.insert(buffer.end(), exec.begin(), exec.end());
+  pub->processEvents(buffer.data(), buffer.size());
+
+  EXPECT_EQ(kOpenBSMTestPids, std::vector<pid_t>({1, 2}));
+}
+}
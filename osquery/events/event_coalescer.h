@@ -0,0 +1,131 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/events.h>
+
+namespace osquery {
+
+/**
+ * @brief Coalesce repeated file events for Subscription%s with a window.
+ *
+ * A single file write produces bursts of events for the same path and action.
+ * The first event is held for the Subscription's window, and later events
+ * with the same path and action only update the held event's time and count.
+ * When the window passes the publisher fires the held event again, and only
+ * the Subscription that held it receives it.
+ *
+ * Each Subscription coalesces separately, the held event is a copy of the
+ * fired event.
+ *
+ * @tparam EC A file EventContext with path and action members.
+ */
+template <class EC>
+class EventCoalescer : private boost::noncopyable {
+ public:
+  typedef std::shared_ptr<EC> ECRef;
+
+  /**
+   * @brief Hold an event for a Subscription, or coalesce it with a held event.
+   *
+   * @param subscription The Subscription the event would fire.
+   * @param ec The fired event.
+   * @param window Milliseconds to hold the first event.
+   *
+   * @return true if the event is the first held for its path and action.
+   */
+  bool hold(const SubscriptionRef& subscription,
+            const ECRef& ec,
+            size_t window) {
+    auto key = std::make_tuple(subscription.get(), ec->path, ec->action);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto held = held_.find(key);
+    if (held != held_.end()) {
+      auto& coalesced = held->second.ec;
+      coalesced->count++;
+      coalesced->time = ec->time;
+      return false;
+    }
+
+    auto coalesced = std::make_shared<EC>(*ec);
+    coalesced->count = 1;
+    coalesced->first_time = ec->time;
+    coalesced->subscription = subscription.get();
+    held_[key] = {coalesced,
+                  std::chrono::steady_clock::now() +
+                      std::chrono::milliseconds(window)};
+    return true;
+  }
+
+  /// Take the held events whose window passed, or every held event.
+  std::vector<ECRef> expire(bool all = false) {
+    std::vector<ECRef> expired;
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = held_.begin(); it != held_.end();) {
+      if (all || it->second.expire <= now) {
+        expired.push_back(std::move(it->second.ec));
+        it = held_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    return expired;
+  }
+
+  /// Milliseconds until the next held event expires, -1 if none are held.
+  int nextExpire() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (held_.empty()) {
+      return -1;
+    }
+
+    auto next = held_.begin()->second.expire;
+    for (const auto& held : held_) {
+      next = std::min(next, held.second.expire);
+    }
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    next - std::chrono::steady_clock::now())
+                    .count();
+    return (wait > 0) ? static_cast<int>(wait) : 0;
+  }
+
+  /// The number of held events.
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return held_.size();
+  }
+
+ private:
+  struct Held {
+    ECRef ec;
+    std::chrono::steady_clock::time_point expire;
+  };
+
+  /// Held events (Subscription, path, action => event).
+  std::map<std::tuple<const Subscription*, std::string, std::string>, Held>
+      held_;
+
+  /// Dispatch threads hold events while the publisher expires them.
+  mutable std::mutex mutex_;
+};
+}
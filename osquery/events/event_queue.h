@@ -0,0 +1,150 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/events.h>
+
+namespace osquery {
+
+/**
+ * @brief A bounded lock-free queue used between event threads.
+ *
+ * An EventPublisher may fire from its run loop and from OS API callback
+ * threads, so the queue accepts multiple producers. Each slot carries a
+ * sequence number that tells producers and the consumer whether the slot is
+ * free or filled for their turn, so neither side takes a lock. When the queue
+ * is full a push fails immediately and the caller accounts for the drop.
+ */
+template <typename T>
+class BoundedQueue : private boost::noncopyable {
+ public:
+  /// Create a queue holding at least capacity items, rounded to a power of 2.
+  explicit BoundedQueue(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask_ = size - 1;
+    cells_ = std::vector<Cell>(size);
+    for (size_t i = 0; i < size; i++) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  /// Add an item, returns false without blocking if the queue is full.
+  bool push(const T& value) {
+    auto position = tail_.load(std::memory_order_relaxed);
+    Cell* cell = nullptr;
+    for (;;) {
+      cell = &cells_[position & mask_];
+      auto sequence = cell->sequence.load(std::memory_order_acquire);
+      auto delta = (intptr_t)sequence - (intptr_t)position;
+      if (delta == 0) {
+        if (tail_.compare_exchange_weak(
+                position, position + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (delta < 0) {
+        return false;
+      } else {
+        position = tail_.load(std::memory_order_relaxed);
+      }
+    }
+
+    cell->value = value;
+    cell->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Remove the oldest item, returns false if the queue is empty.
+  bool pop(T& value) {
+    auto position = head_.load(std::memory_order_relaxed);
+    Cell* cell = nullptr;
+    for (;;) {
+      cell = &cells_[position & mask_];
+      auto sequence = cell->sequence.load(std::memory_order_acquire);
+      auto delta = (intptr_t)sequence - (intptr_t)(position + 1);
+      if (delta == 0) {
+        if (head_.compare_exchange_weak(
+                position, position + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (delta < 0) {
+        return false;
+      } else {
+        position = head_.load(std::memory_order_relaxed);
+      }
+    }
+
+    value = std::move(cell->value);
+    cell->value = T();
+    cell->sequence.store(position + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// The number of slots in the queue.
+  size_t capacity() const { return mask_ + 1; }
+
+  /// The approximate number of queued items.
+  size_t size() const {
+    auto head = head_.load(std::memory_order_relaxed);
+    auto tail = tail_.load(std::memory_order_relaxed);
+    return (tail > head) ? tail - head : 0;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+
+    Cell() : sequence(0) {}
+    Cell(const Cell& cell)
+        : sequence(cell.sequence.load()), value(cell.value) {}
+  };
+
+ private:
+  std::vector<Cell> cells_;
+  size_t mask_{0};
+
+  /// Producers and the consumer advance positions on separate cache lines.
+  std::atomic<size_t> tail_{0};
+  char padding_[64];
+  std::atomic<size_t> head_{0};
+};
+
+/// Fired EventContext%s waiting for a publisher's dispatch thread.
+class EventQueue : public BoundedQueue<EventContextRef> {
+ public:
+  explicit EventQueue(size_t capacity) : BoundedQueue(capacity) {}
+};
+
+/// An event matched by a Subscription, waiting for its subscriber's thread.
+struct EventDelivery {
+  /// The Subscription whose callback is called.
+  SubscriptionRef subscription;
+  /// The fired event, shared with every other subscriber.
+  EventContextRef ec;
+  /// The steady clock milliseconds when the event was queued.
+  uint64_t queued{0};
+};
+
+/// Matched events waiting for an EventSubscriber's callback thread.
+class SubscriberQueue : public BoundedQueue<EventDelivery> {
+ public:
+  explicit SubscriberQueue(size_t capacity) : BoundedQueue(capacity) {}
+};
+}
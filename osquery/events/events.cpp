@@ -8,11 +8,21 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <exception>
+#include <limits>
+#include <set>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
 
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/classification.hpp>
-#include <boost/lexical_cast.hpp>
 
 #include <osquery/core.h>
 #include <osquery/events.h>
@@ -20,27 +30,100 @@
 #include <osquery/logger.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/core/metrics.h"
+#include "osquery/core/tracing.h"
 #include "osquery/database/db_handle.h"
+#include "osquery/events/event_queue.h"
+#include "osquery/events/path_table.h"
+#include "osquery/events/subscription_index.h"
 
 namespace osquery {
 
-/// Helper cooloff (ms) macro to prevent thread failure thrashing.
+/// The longest (ms) backoff of a dispatch thread waiting for queued events.
 #define EVENTS_COOLOFF 20
 
 FLAG(bool, disable_events, false, "Disable osquery events pubsub");
 
 FLAG(int32, events_expiry, 86000, "Timeout to expire event pubsub results");
 
-const std::vector<size_t> kEventTimeLists = {
-    1 * 60 * 60, // 1 hour
-    1 * 60, // 1 minute
-    10, // 10 seconds
+FLAG(uint64,
+     events_expiry_interval,
+     300,
+     "Seconds between background expiration of event records, 0 to expire "
+     "while querying");
+
+FLAG(uint64,
+     events_queue_size,
+     4096,
+     "Events buffered between each publisher and its subscribers, 0 for none");
+
+FLAG(uint64,
+     events_subscriber_queue_size,
+     1024,
+     "Events buffered for each subscriber's callback thread, 0 to call "
+     "subscribers from the publisher's dispatch thread");
+
+FLAG(bool,
+     events_shared_loop,
+     true,
+     "Service pollable and callback-driven publishers from one shared loop");
+
+FLAG(uint64,
+     file_events_coalesce,
+     0,
+     "Milliseconds to coalesce repeated file events with the same path and "
+     "action, 0 for none");
+
+/// Set while the expiration service removes expired records.
+static std::atomic<bool> kEventsExpiring(false);
+
+/// Seconds between warnings about events dropped from a full queue.
+const size_t kEventDropWarningInterval = 60;
+
+/// Event records are stored using "event.<namespace>.<time>.<eid>" keys.
+const std::string kEventRecordPrefix = "event.";
+
+/// Zero-padded widths so record keys sort by time, then by EventID.
+const int kEventTimeWidth = 10;
+const int kEventIDWidth = 20;
+
+/// Records decoded by each read of an event table's time range.
+const size_t kEventReadChunkSize = 1024;
+
+/// EventIDs are reserved in the backing store in blocks of this size.
+const size_t kEventIDBlockSize = 10000;
+
+/// Usage is tracked, and quotas enforced, for partitions of this many seconds.
+const EventTime kEventPartitionSeconds = 3600;
+
+/// Partition usage is stored using "usage.<namespace>.<time>" keys.
+const std::string kEventUsagePrefix = "usage.";
+
+/// Bin lists and data keys used by previous versions of the event store.
+const std::vector<std::string> kLegacyEventPrefixes = {
+    "indexes.", "records.", "data.",
 };
 
 void publisherSleep(size_t milli) {
   boost::this_thread::sleep(boost::posix_time::milliseconds(milli));
 }
 
+/// Events fired and dropped by every publisher, and dispatch latencies.
+static MetricCounter kEventsFired("events.fired");
+static MetricCounter kEventsDropped("events.dropped");
+static MetricHistogram kEventsDispatchLatency("events.dispatch");
+
+/// Events dropped, or shed, for subscribers, and their queue lag.
+static MetricCounter kEventsSubscriberDropped("events.subscriber.dropped");
+static MetricHistogram kEventsSubscriberLag("events.subscriber.lag");
+
+/// The steady clock milliseconds used to measure a subscriber's lag.
+static uint64_t getLagTime() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
 void EventPublisherPlugin::fire(const EventContextRef& ec, EventTime time) {
   EventContextID ec_id;
 
@@ -53,7 +136,36 @@ void EventPublisherPlugin::fire(const EventContextRef& ec, EventTime time) {
     boost::lock_guard<boost::mutex> lock(ec_id_lock_);
     ec_id = next_ec_id_++;
   }
+  enqueue(ec, ec_id, time);
+}
+
+void EventPublisherPlugin::fireBatch(const std::vector<EventContextRef>& ecs,
+                                     EventTime time) {
+  EventContextID ec_id;
+
+  if (isEnding() || ecs.empty()) {
+    return;
+  }
 
+  // Reserve the batch's IDs and look up the time once.
+  {
+    boost::lock_guard<boost::mutex> lock(ec_id_lock_);
+    ec_id = next_ec_id_;
+    next_ec_id_ += ecs.size();
+  }
+
+  if (time == 0) {
+    time = getUnixTime();
+  }
+
+  for (const auto& ec : ecs) {
+    enqueue(ec, ec_id++, time);
+  }
+}
+
+void EventPublisherPlugin::enqueue(const EventContextRef& ec,
+                                   EventContextID ec_id,
+                                   EventTime time) {
   // Fill in EventContext ID and time if needed.
   if (ec != nullptr) {
     ec->id = ec_id;
@@ -69,313 +181,876 @@ void EventPublisherPlugin::fire(const EventContextRef& ec, EventTime time) {
     ec->time_string = std::to_string(ec->time);
   }
 
-  for (const auto& subscription : subscriptions_) {
+  kEventsFired.add();
+  if (dispatching_) {
+    // The publisher continues immediately, subscribers run in the dispatcher.
+    if (!queue_->push(ec)) {
+      dropped_++;
+      kEventsDropped.add();
+      return;
+    }
+    auto queued = queue_->size();
+    auto peak = peak_queued_.load();
+    while (queued > peak && !peak_queued_.compare_exchange_weak(peak, queued)) {
+    }
+    return;
+  }
+  dispatch(ec);
+}
+
+void EventPublisherPlugin::dispatch(const EventContextRef& ec) {
+  MetricTimer timer(kEventsDispatchLatency);
+  TraceSpan span("events", "dispatch");
+  SubscriptionVector matches;
+  const auto& subscriptions =
+      (matchSubscriptions(ec, matches)) ? matches : subscriptions_;
+  // Low priority subscribers shed events while the publisher is behind.
+  bool backlog = dispatching_ && queue_->size() * 2 > queue_->capacity();
+  for (const auto& subscription : subscriptions) {
     auto es = EventFactory::getEventSubscriber(subscription->subscriber_name);
-    if (es->state() == SUBSCRIBER_RUNNING) {
+    if (es->state() != SUBSCRIBER_RUNNING) {
+      continue;
+    }
+    if (es->consuming_) {
+      // The subscriber's own thread calls the callback.
+      if (shouldFireCallback(subscription, ec)) {
+        es->deliver(subscription, ec, backlog);
+      }
+    } else {
       fireCallback(subscription, ec);
     }
   }
 }
 
-std::vector<std::string> EventSubscriberPlugin::getIndexes(EventTime start,
-                                                           EventTime stop,
-                                                           int list_key) {
+inline std::string padded(size_t value, int width) {
+  auto digits = std::to_string(value);
+  if (digits.size() < (size_t)width) {
+    digits.insert(0, width - digits.size(), '0');
+  }
+  return digits;
+}
+
+std::string EventSubscriberPlugin::recordPrefix() const {
+  return kEventRecordPrefix + dbNamespace() + ".";
+}
+
+std::string EventSubscriberPlugin::recordKey(EventTime time,
+                                             const std::string& eid) const {
+  size_t id = 0;
+  if (!parseInteger(eid, id)) {
+    // Non-numeric IDs still sort after the time.
+    return recordPrefix() + padded(time, kEventTimeWidth) + "." + eid;
+  }
+  return recordPrefix() + padded(time, kEventTimeWidth) + "." +
+         padded(id, kEventIDWidth);
+}
+
+Status EventSubscriberPlugin::scanRecords(
+    EventTime start,
+    EventTime stop,
+    bool values,
+    std::vector<std::pair<std::string, std::string>>& records) {
   auto db = DBHandle::getInstance();
-  auto index_key = "indexes." + dbNamespace();
-  std::vector<std::string> indexes;
-
-  // Keep track of the tail/head of account time while bin searching.
-  EventTime start_max = stop, stop_min = stop, local_start, local_stop;
-  auto types = kEventTimeLists.size();
-  // List types are sized bins of time containing records for this namespace.
-  for (size_t i = 0; i < types; ++i) {
-    auto size = kEventTimeLists[i];
-    if (list_key > 0 && i != list_key) {
-      // A specific list_type was requested, only return bins of this key.
+  auto prefix = recordPrefix();
+  // The '/' follows the '.' separator and precedes every digit, so a range
+  // ending at "<stop>/" includes every EventID recorded at time stop.
+  // A stop of 0 means no upper bound, ':' follows every time digit.
+  auto start_key = prefix + padded(start, kEventTimeWidth);
+  auto stop_key = (stop == 0) ? prefix + ":"
+                              : prefix + padded(stop, kEventTimeWidth) + "/";
+  return db->ScanRange(kEvents, start_key, stop_key, records, values);
+}
+
+std::vector<EventRecord> EventSubscriberPlugin::getRecords(EventTime start,
+                                                           EventTime stop) {
+  std::vector<EventRecord> records;
+  std::vector<std::pair<std::string, std::string>> keys;
+  scanRecords(start, stop, false, keys);
+
+  auto prefix_size = recordPrefix().size();
+  for (const auto& key : keys) {
+    // Each key is tokenized into <prefix><time>.<eid>.
+    auto time = key.first.substr(prefix_size, kEventTimeWidth);
+    auto eid = key.first.substr(prefix_size + kEventTimeWidth + 1);
+    eid.erase(0, std::min(eid.find_first_not_of('0'), eid.size() - 1));
+    EventTime event_time = 0;
+    if (parseInteger(time, event_time)) {
+      records.push_back(std::make_pair(eid, event_time));
+    }
+  }
+  return records;
+}
+
+std::string EventSubscriberPlugin::usageKey(EventTime partition) const {
+  return kEventUsagePrefix + dbNamespace() + "." +
+         padded(partition, kEventTimeWidth);
+}
+
+void EventSubscriberPlugin::loadUsage() {
+  if (usage_loaded_) {
+    return;
+  }
+  usage_loaded_ = true;
+
+  std::vector<std::pair<std::string, std::string>> keys;
+  auto prefix = kEventUsagePrefix + dbNamespace() + ".";
+  DBHandle::getInstance()->ScanRange(
+      kEvents, prefix, kEventUsagePrefix + dbNamespace() + "/", keys, true);
+  for (const auto& key : keys) {
+    // Each value is "<events>:<bytes>".
+    auto usage = split(key.second, ":");
+    if (usage.size() != 2) {
       continue;
     }
+    EventTime partition = 0;
+    size_t events = 0;
+    size_t bytes = 0;
+    if (parseInteger(key.first.substr(prefix.size()), partition) &&
+        parseInteger(usage[0], events) && parseInteger(usage[1], bytes)) {
+      partitions_[partition].events = events;
+      partitions_[partition].bytes = bytes;
+    }
+  }
+}
+
+EventUsage EventSubscriberPlugin::getUsage() {
+  boost::lock_guard<boost::mutex> lock(usage_lock_);
+  loadUsage();
+  EventUsage total;
+  for (const auto& partition : partitions_) {
+    total.events += partition.second.events;
+    total.bytes += partition.second.bytes;
+  }
+  return total;
+}
+
+Status EventSubscriberPlugin::expireRecords(EventTime expire_time) {
+  if (expire_time == 0) {
+    return Status(0, "OK");
+  }
+
+  // Every record before the expire time is a contiguous range of keys.
+  auto db = DBHandle::getInstance();
+  auto prefix = recordPrefix();
+  auto status = db->DeleteRange(
+      kEvents, prefix, prefix + padded(expire_time, kEventTimeWidth));
+  if (!status.ok()) {
+    return status;
+  }
+
+  // The usage of partitions that ended before the expire time is removed.
+  // A partially expired partition is counted until it ends.
+  DatabaseBatch batch;
+  boost::lock_guard<boost::mutex> lock(usage_lock_);
+  loadUsage();
+  auto it = partitions_.begin();
+  while (it != partitions_.end() &&
+         it->first + kEventPartitionSeconds <= expire_time) {
+    batch.remove(kEvents, usageKey(it->first));
+    it = partitions_.erase(it);
+  }
+  return (batch.empty()) ? Status(0, "OK") : db->Write(batch);
+}
+
+EventTime EventSubscriberPlugin::getAgeExpireTime(
+    const EventRetention& retention) const {
+  size_t age = retention.max_age;
+  if (age == 0 && FLAGS_events_expiry > 0) {
+    age = FLAGS_events_expiry;
+  }
+
+  auto now = getUnixTime();
+  if (age == 0 || age >= now) {
+    return 0;
+  }
+  return now - age;
+}
+
+EventTime EventSubscriberPlugin::getQuotaExpireTime(
+    const EventRetention& retention) {
+  if (retention.max_events == 0 && retention.max_bytes == 0) {
+    return 0;
+  }
 
-    std::string time_list;
-    auto list_type = boost::lexical_cast<std::string>(size);
-    auto status = db->Get(kEvents, index_key + "." + list_type, time_list);
-    if (time_list.length() == 0) {
-      // No events in this binning size.
-      return indexes;
+  // Sum the partitions from newest to oldest, the first partition exceeding
+  // a quota is removed with every older partition.
+  boost::lock_guard<boost::mutex> lock(usage_lock_);
+  loadUsage();
+  EventUsage total;
+  for (auto it = partitions_.rbegin(); it != partitions_.rend(); ++it) {
+    total.events += it->second.events;
+    total.bytes += it->second.bytes;
+    if (it == partitions_.rbegin()) {
+      // The newest partition is kept, even when it exceeds a quota.
+      continue;
     }
 
-    if (list_key == 0 && i == (types - 1) && types > 1) {
-      // Relax the requested start/stop bounds.
-      if (start != start_max) {
-        start = (start / size) * size;
-        start_max = ((start / size) + 1) * size;
-        if (start_max < stop) {
-          start_max = start + kEventTimeLists[types - 2];
-        }
-      }
+    if ((retention.max_events > 0 && total.events > retention.max_events) ||
+        (retention.max_bytes > 0 && total.bytes > retention.max_bytes)) {
+      return it->first + kEventPartitionSeconds;
+    }
+  }
+  return 0;
+}
 
-      if (stop != stop_min) {
-        stop = ((stop / size) + 1) * size;
-        stop_min = (stop / size) * size;
-        if (stop_min > start) {
-          stop_min = stop_min - kEventTimeLists[types - 1];
-        }
-      }
-    } else if (list_key > 0 || types == 1) {
-      // Relax the requested bounds to fit the requested/only index.
-      start = (start / size) * size;
-      start_max = ((start_max / size) + 1) * size;
-    }
-
-    // (1) The first iteration will have 1 range (start to start_max=stop).
-    // (2) Intermediate iterations will have 2 (start-start_max, stop-stop_min).
-    // For each iteration the range collapses based on the coverage using
-    // the first bin's start time and the last bin's stop time.
-    // (3) The last iteration's range includes relaxed bounds outside the
-    // requested start to stop range.
-    std::vector<std::string> all_bins, bins, expirations;
-    boost::split(all_bins, time_list, boost::is_any_of(","));
-    for (const auto& bin : all_bins) {
-      // Bins are identified by the binning size step.
-      auto step = boost::lexical_cast<EventTime>(bin);
-      // Check if size * step -> size * (step + 1) is within a range.
-      int bin_start = size * step, bin_stop = size * (step + 1);
-      if (expire_events_ && bin_stop - size < expire_time_) {
-        expirations.push_back(bin);
-      } else if (bin_start >= start && bin_stop <= start_max) {
-        bins.push_back(bin);
-      } else if ((bin_start >= stop_min && bin_stop <= stop) || stop == 0) {
-        bins.push_back(bin);
+void EventSubscriberPlugin::expire() {
+  if (!expire_events_) {
+    return;
+  }
+
+  expireLegacyRecords();
+  auto retention = EventFactory::getRetention(getName());
+  expire_time_ =
+      std::max(getAgeExpireTime(retention), getQuotaExpireTime(retention));
+  auto status = expireRecords(expire_time_);
+  if (!status.ok()) {
+    VLOG(1) << "Could not expire " << dbNamespace()
+            << " records: " << status.getMessage();
+  }
+}
+
+void SubscriptionPathIndex::add(const std::string& path,
+                                bool prefix,
+                                const SubscriptionRef& subscription) {
+  boost::unique_lock<boost::shared_mutex> lock(lock_);
+  auto node = &root_;
+  for (const auto& c : path) {
+    auto& child = node->children[c];
+    if (child == nullptr) {
+      child = std::unique_ptr<Node>(new Node());
+    }
+    node = child.get();
+  }
+
+  auto& subscriptions = (prefix) ? node->prefix : node->exact;
+  subscriptions.push_back(std::make_pair(size_++, subscription));
+}
+
+void SubscriptionPathIndex::clear() {
+  boost::unique_lock<boost::shared_mutex> lock(lock_);
+  root_.children.clear();
+  root_.exact.clear();
+  root_.prefix.clear();
+  size_ = 0;
+}
+
+void SubscriptionPathIndex::swap(SubscriptionPathIndex& other) {
+  boost::unique_lock<boost::shared_mutex> lock(lock_);
+  boost::unique_lock<boost::shared_mutex> other_lock(other.lock_);
+  std::swap(root_.children, other.root_.children);
+  std::swap(root_.exact, other.root_.exact);
+  std::swap(root_.prefix, other.root_.prefix);
+  std::swap(size_, other.size_);
+}
+
+void SubscriptionPathIndex::match(const std::string& path,
+                                  SubscriptionVector& matches) const {
+  std::vector<IndexedSubscription> found;
+  {
+    boost::shared_lock<boost::shared_mutex> lock(lock_);
+    // Every prefix Subscription along the path matches.
+    auto node = &root_;
+    found.insert(found.end(), node->prefix.begin(), node->prefix.end());
+    for (const auto& c : path) {
+      auto child = node->children.find(c);
+      if (child == node->children.end()) {
+        node = nullptr;
+        break;
       }
+      node = child->second.get();
+      found.insert(found.end(), node->prefix.begin(), node->prefix.end());
     }
 
-    // Rewrite the index lists and delete each expired item.
-    if (expirations.size() > 0) {
-      expireIndexes(list_type, all_bins, expirations);
+    if (node != nullptr) {
+      found.insert(found.end(), node->exact.begin(), node->exact.end());
     }
+  }
+
+  // Keep the order Subscription%s were added, the unindexed dispatch order.
+  std::sort(found.begin(),
+            found.end(),
+            [](const IndexedSubscription& l, const IndexedSubscription& r) {
+              return l.first < r.first;
+            });
+  for (const auto& subscription : found) {
+    matches.push_back(subscription.second);
+  }
+}
+
+size_t SubscriptionPathIndex::size() const {
+  boost::shared_lock<boost::shared_mutex> lock(lock_);
+  return size_;
+}
+
+const PathTable::NodeID PathTable::kNoNode;
+
+PathTable::PathTable() { clear(); }
+
+PathTable::NodeID PathTable::findChild(NodeID parent,
+                                       const std::string& name) const {
+  auto component = components_.find(name);
+  if (component == components_.end()) {
+    return kNoNode;
+  }
+
+  auto child = children_.find(childKey(parent, component->second));
+  return (child == children_.end()) ? kNoNode : child->second;
+}
 
-    if (bins.size() != 0) {
-      // If more precision was achieved though this list's binning.
-      local_start = boost::lexical_cast<EventTime>(bins.front()) * size;
-      start_max = (local_start < start_max) ? local_start : start_max;
-      local_stop = (boost::lexical_cast<EventTime>(bins.back()) + 1) * size;
-      stop_min = (local_stop < stop_min) ? local_stop : stop_min;
+PathTable::NodeID PathTable::addChild(NodeID parent, const std::string& name) {
+  uint32_t component = 0;
+  auto existing = components_.find(name);
+  if (existing != components_.end()) {
+    component = existing->second;
+    auto child = children_.find(childKey(parent, component));
+    if (child != children_.end()) {
+      return child->second;
     }
+  } else if (!free_components_.empty()) {
+    component = free_components_.back();
+    free_components_.pop_back();
+    component_names_[component] = name;
+    components_[name] = component;
+  } else {
+    component = component_names_.size();
+    component_names_.push_back(name);
+    component_refs_.push_back(0);
+    components_[name] = component;
+  }
+  component_refs_[component]++;
+
+  NodeID node = 0;
+  if (!free_nodes_.empty()) {
+    node = free_nodes_.back();
+    free_nodes_.pop_back();
+  } else {
+    node = nodes_.size();
+    nodes_.push_back(Node());
+  }
+  nodes_[node] = {parent, component, -1, 0, false};
+  nodes_[parent].children++;
+  children_[childKey(parent, component)] = node;
+  return node;
+}
 
-    for (const auto& bin : bins) {
-      indexes.push_back(list_type + "." + bin);
+PathTable::NodeID PathTable::find(const std::string& path) const {
+  NodeID node = 0;
+  std::string name;
+  size_t start = 0;
+  while (true) {
+    auto end = path.find('/', start);
+    name.assign(path, start, end - start);
+    node = findChild(node, name);
+    if (node == kNoNode || end == std::string::npos) {
+      return node;
     }
+    start = end + 1;
+  }
+}
 
-    if (start == start_max && stop == stop_min) {
+PathTable::NodeID PathTable::setWatch(const std::string& path, int watch) {
+  NodeID node = 0;
+  std::string name;
+  size_t start = 0;
+  while (true) {
+    auto end = path.find('/', start);
+    name.assign(path, start, end - start);
+    node = addChild(node, name);
+    if (end == std::string::npos) {
       break;
     }
+    start = end + 1;
   }
 
-  // Update the new time that events expire to now - expiry.
-  return indexes;
+  nodes_[node].watch = watch;
+  return node;
 }
 
-Status EventSubscriberPlugin::expireIndexes(
-    const std::string& list_type,
-    const std::vector<std::string>& indexes,
-    const std::vector<std::string>& expirations) {
-  auto db = DBHandle::getInstance();
-  auto index_key = "indexes." + dbNamespace();
-  auto record_key = "records." + dbNamespace();
-  auto data_key = "data." + dbNamespace();
+int PathTable::getWatch(NodeID node) const {
+  return (node == kNoNode) ? -1 : nodes_[node].watch;
+}
+
+int PathTable::getWatch(const std::string& path) const {
+  return getWatch(find(path));
+}
 
-  // Get the records list for the soon-to-be expired records.
-  std::vector<std::string> record_indexes;
-  for (const auto& bin : expirations) {
-    record_indexes.push_back(list_type + "." + bin);
+void PathTable::removeWatch(NodeID node) {
+  if (node == kNoNode) {
+    return;
   }
-  auto expired_records = getRecords(record_indexes);
-  // Construct a mutable list of persisting indexes to rewrite as records.
-  std::vector<std::string> persisting_indexes = indexes;
 
-  // Remove the records using the list of expired indexes.
-  for (const auto& bin : expirations) {
-    db->Delete(kEvents, record_key + "." + list_type + "." + bin);
-    persisting_indexes.erase(
-        std::remove(persisting_indexes.begin(), persisting_indexes.end(), bin),
-        persisting_indexes.end());
+  // A directory watched again has children to crawl again.
+  nodes_[node].watch = -1;
+  nodes_[node].crawled = false;
+  prune(node);
+}
+
+void PathTable::setCrawled(NodeID node, bool crawled) {
+  if (node != kNoNode) {
+    nodes_[node].crawled = crawled;
   }
+}
+
+bool PathTable::isCrawled(NodeID node) const {
+  return node != kNoNode && nodes_[node].crawled;
+}
 
-  // Update the list of indexes with the non-expired indexes.
-  auto new_indexes = boost::algorithm::join(persisting_indexes, ",");
-  db->Put(kEvents, index_key + "." + list_type, new_indexes);
+void PathTable::prune(NodeID node) {
+  while (node != kNoNode && nodes_[node].watch == -1 &&
+         nodes_[node].children == 0) {
+    auto& removed = nodes_[node];
+    children_.erase(childKey(removed.parent, removed.component));
+    if (--component_refs_[removed.component] == 0) {
+      // Names of removed directories are not kept.
+      auto& name = component_names_[removed.component];
+      components_.erase(name);
+      std::string().swap(name);
+      free_components_.push_back(removed.component);
+    }
 
-  // Delete record events.
-  for (const auto& record : expired_records) {
-    db->Delete(kEvents, data_key + "." + record.first);
+    free_nodes_.push_back(node);
+    node = removed.parent;
+    nodes_[node].children--;
   }
+}
 
-  return Status(0, "OK");
+void PathTable::getPath(NodeID node, std::string& path) const {
+  path.clear();
+  if (node == kNoNode) {
+    return;
+  }
+
+  // Measure the path, then write each component from the last.
+  size_t length = 0;
+  for (auto n = node; n != kNoNode; n = nodes_[n].parent) {
+    length += component_names_[nodes_[n].component].size() + 1;
+  }
+  path.resize(length - 1);
+
+  for (auto n = node; n != kNoNode; n = nodes_[n].parent) {
+    const auto& name = component_names_[nodes_[n].component];
+    length -= name.size() + 1;
+    name.copy(&path[length], name.size());
+    if (length > 0) {
+      path[length - 1] = '/';
+    }
+  }
 }
 
-std::vector<EventRecord> EventSubscriberPlugin::getRecords(
-    const std::vector<std::string>& indexes) {
-  auto db = DBHandle::getInstance();
-  auto record_key = "records." + dbNamespace();
-  std::vector<EventRecord> records;
+bool PathTable::isWithin(NodeID node, NodeID ancestor) const {
+  if (ancestor == kNoNode) {
+    return false;
+  }
 
-  for (const auto& index : indexes) {
-    std::string record_value;
-    if (!db->Get(kEvents, record_key + "." + index, record_value).ok()) {
-      return records;
+  for (; node != kNoNode; node = nodes_[node].parent) {
+    if (node == ancestor) {
+      return true;
     }
+  }
+  return false;
+}
+
+void PathTable::clear() {
+  nodes_.assign(1, Node{0, 0, -1, 0, false});
+  free_nodes_.clear();
+  children_.clear();
+  component_names_.clear();
+  component_refs_.clear();
+  components_.clear();
+  free_components_.clear();
+}
+
+size_t EventPublisherPlugin::numQueued() const {
+  return (queue_ != nullptr) ? queue_->size() : 0;
+}
+
+void EventPublisherPlugin::startDispatch(size_t capacity) {
+  if (dispatching_ || capacity == 0) {
+    return;
+  }
+
+  queue_ = std::make_shared<EventQueue>(capacity);
+  dispatching_ = true;
+  dispatcher_ = std::make_shared<boost::thread>(
+      boost::bind(&EventPublisherPlugin::dispatchQueue, this));
+  setSubscriberQueues(true);
+}
 
-    if (record_value.length() == 0) {
-      // There are actually no events in this bin, interesting error case.
+void EventPublisherPlugin::stopDispatch() {
+  if (!dispatching_) {
+    return;
+  }
+
+  dispatching_ = false;
+  dispatcher_->join();
+  dispatcher_ = nullptr;
+
+  // Events queued before the dispatcher stopped are still delivered.
+  EventContextRef ec;
+  while (queue_->pop(ec)) {
+    dispatch(ec);
+  }
+  setSubscriberQueues(false);
+}
+
+void EventPublisherPlugin::setSubscriberQueues(bool start) {
+  std::set<std::string> names;
+  for (const auto& subscription : subscriptions_) {
+    names.insert(subscription->subscriber_name);
+  }
+
+  for (const auto& name : names) {
+    auto es = EventFactory::getEventSubscriber(name);
+    if (es == nullptr) {
       continue;
     }
-
-    // Each list is tokenized into a record=event_id:time.
-    std::vector<std::string> bin_records;
-    boost::split(bin_records, record_value, boost::is_any_of(",:"));
-    auto bin_it = bin_records.begin();
-    for (; bin_it != bin_records.end(); bin_it++) {
-      std::string eid = *bin_it;
-      EventTime time = boost::lexical_cast<EventTime>(*(++bin_it));
-      records.push_back(std::make_pair(eid, time));
+    if (start) {
+      es->startQueue(FLAGS_events_subscriber_queue_size);
+    } else {
+      es->stopQueue();
     }
   }
+}
 
-  return records;
+size_t EventSubscriberPlugin::numQueued() const {
+  return (queue_ != nullptr) ? queue_->size() : 0;
 }
 
-Status EventSubscriberPlugin::recordEvent(EventID& eid, EventTime time) {
-  Status status;
-  auto db = DBHandle::getInstance();
-  std::string time_value = boost::lexical_cast<std::string>(time);
-
-  // The record is identified by the event type then module name.
-  std::string index_key = "indexes." + dbNamespace();
-  std::string record_key = "records." + dbNamespace();
-  // The list key includes the list type (bin size) and the list ID (bin).
-  std::string list_key;
-  std::string list_id;
-
-  for (auto time_list : kEventTimeLists) {
-    // The list_id is the MOST-Specific key ID, the bin for this list.
-    // If the event time was 13 and the time_list is 5 seconds, lid = 2.
-    list_id = boost::lexical_cast<std::string>(time / time_list);
-    // The list name identifies the 'type' of list.
-    list_key = boost::lexical_cast<std::string>(time_list);
-    // list_key = list_key + "." + list_id;
-
-    {
-      boost::lock_guard<boost::mutex> lock(event_record_lock_);
-      // Append the record (eid, unix_time) to the list bin.
-      std::string record_value;
-      status = db->Get(
-          kEvents, record_key + "." + list_key + "." + list_id, record_value);
-
-      if (record_value.length() == 0) {
-        // This is a new list_id for list_key, append the ID to the indirect
-        // lookup for this list_key.
-        std::string index_value;
-        status = db->Get(kEvents, index_key + "." + list_key, index_value);
-        if (index_value.length() == 0) {
-          // A new index.
-          index_value = list_id;
-        } else {
-          index_value += "," + list_id;
-        }
-        status = db->Put(kEvents, index_key + "." + list_key, index_value);
-        record_value = eid + ":" + time_value;
-      } else {
-        // Tokenize a record using ',' and the EID/time using ':'.
-        record_value += "," + eid + ":" + time_value;
-      }
-      status = db->Put(
-          kEvents, record_key + "." + list_key + "." + list_id, record_value);
-      if (!status.ok()) {
-        LOG(ERROR) << "Could not put Event Record key: " << record_key << "."
-                   << list_key << "." << list_id;
-      }
+void EventSubscriberPlugin::startQueue(size_t capacity) {
+  if (consuming_ || capacity == 0) {
+    return;
+  }
+
+  queue_ = std::make_shared<SubscriberQueue>(capacity);
+  consuming_ = true;
+  consumer_ = std::make_shared<boost::thread>(
+      boost::bind(&EventSubscriberPlugin::consumeQueue, this));
+}
+
+void EventSubscriberPlugin::stopQueue() {
+  if (!consuming_) {
+    return;
+  }
+
+  consuming_ = false;
+  consumer_->join();
+  consumer_ = nullptr;
+
+  // Events queued before the thread stopped are still delivered.
+  EventDelivery delivery;
+  while (queue_->pop(delivery)) {
+    callback(delivery);
+  }
+}
+
+bool EventSubscriberPlugin::deliver(const SubscriptionRef& sub,
+                                    const EventContextRef& ec,
+                                    bool shed) {
+  // A low priority subscriber sheds events before its queue is full.
+  if (low_priority_ && (shed || queue_->size() * 2 > queue_->capacity())) {
+    dropped_++;
+    kEventsSubscriberDropped.add();
+    return false;
+  }
+
+  EventDelivery delivery;
+  delivery.subscription = sub;
+  delivery.ec = ec;
+  delivery.queued = getLagTime();
+  if (!queue_->push(delivery)) {
+    dropped_++;
+    kEventsSubscriberDropped.add();
+    return false;
+  }
+  return true;
+}
+
+void EventSubscriberPlugin::callback(const EventDelivery& delivery) {
+  auto now = getLagTime();
+  size_t lag = (now > delivery.queued) ? now - delivery.queued : 0;
+  lag_ = lag;
+  auto peak = peak_lag_.load();
+  while (lag > peak && !peak_lag_.compare_exchange_weak(peak, lag)) {
+  }
+  kEventsSubscriberLag.record(lag);
+
+  const auto& sub = delivery.subscription;
+  if (sub->callback != nullptr) {
+    sub->callback(delivery.ec, sub->user_data);
+  }
+}
+
+void EventSubscriberPlugin::consumeQueue() {
+  size_t idle = 0;
+  size_t reported = 0;
+  size_t last_report = 0;
+  EventDelivery delivery;
+  while (consuming_) {
+    size_t dropped = dropped_;
+    if (dropped > reported &&
+        getUnixTime() - last_report >= kEventDropWarningInterval) {
+      LOG(WARNING) << "Event subscriber " << getName() << " dropped "
+                   << dropped - reported << " events: callbacks are slow";
+      reported = dropped;
+      last_report = getUnixTime();
     }
+
+    if (queue_->pop(delivery)) {
+      callback(delivery);
+      delivery = EventDelivery();
+      idle = 0;
+      continue;
+    }
+
+    // Back off while the queue is empty, up to the publisher cooloff.
+    idle = std::min(idle + 1, (size_t)EVENTS_COOLOFF);
+    osquery::publisherSleep(idle);
   }
+}
 
-  return Status(0, "OK");
+void EventPublisherPlugin::dispatchQueue() {
+  size_t idle = 0;
+  size_t reported = 0;
+  size_t last_report = 0;
+  EventContextRef ec;
+  while (dispatching_) {
+    size_t dropped = dropped_;
+    if (dropped > reported &&
+        getUnixTime() - last_report >= kEventDropWarningInterval) {
+      LOG(WARNING) << "Event publisher " << type() << " dropped "
+                   << dropped - reported << " events: subscribers are slow";
+      reported = dropped;
+      last_report = getUnixTime();
+    }
+
+    if (queue_->pop(ec)) {
+      dispatch(ec);
+      idle = 0;
+      continue;
+    }
+
+    // Back off while the queue is empty, up to the publisher cooloff.
+    idle = std::min(idle + 1, (size_t)EVENTS_COOLOFF);
+    osquery::publisherSleep(idle);
+  }
 }
 
-EventID EventSubscriberPlugin::getEventID() {
-  Status status;
+void EventSubscriberPlugin::expireLegacyRecords() {
+  if (legacy_expired_) {
+    return;
+  }
+  legacy_expired_ = true;
+
   auto db = DBHandle::getInstance();
-  // First get an event ID from the meta key.
-  std::string eid_key = "eid." + dbNamespace();
-  std::string last_eid_value;
-  std::string eid_value;
+  DatabaseBatch batch;
+  for (const auto& legacy : kLegacyEventPrefixes) {
+    std::vector<std::pair<std::string, std::string>> keys;
+    auto prefix = legacy + dbNamespace() + ".";
+    db->ScanRange(kEvents, prefix, legacy + dbNamespace() + "/", keys, false);
+    for (const auto& key : keys) {
+      batch.remove(kEvents, key.first);
+    }
+  }
+  db->Write(batch);
+}
 
-  {
+EventID EventSubscriberPlugin::getEventID() {
+  if (!eid_loaded_) {
+    // The first EventID follows the last reservation from the meta key.
     boost::lock_guard<boost::mutex> lock(event_id_lock_);
-    status = db->Get(kEvents, eid_key, last_eid_value);
-    if (!status.ok()) {
-      last_eid_value = "0";
+    if (!eid_loaded_) {
+      std::string last_eid_value;
+      auto status = DBHandle::getInstance()->Get(
+          kEvents, "eid." + dbNamespace(), last_eid_value);
+      size_t last_eid = 0;
+      if (status.ok()) {
+        if (!parseInteger(last_eid_value, last_eid)) {
+          LOG(WARNING) << "Invalid EventID reservation for " << dbNamespace();
+        }
+      }
+      eid_next_ = last_eid;
+      eid_reserved_ = last_eid;
+      eid_loaded_ = true;
     }
-
-    size_t eid = boost::lexical_cast<size_t>(last_eid_value) + 1;
-    eid_value = boost::lexical_cast<std::string>(eid);
-    status = db->Put(kEvents, eid_key, eid_value);
   }
 
-  if (!status.ok()) {
-    return "0";
+  size_t eid = ++eid_next_;
+  if (eid > eid_reserved_) {
+    // Reserve the next block, so only one in every block touches the store.
+    boost::lock_guard<boost::mutex> lock(event_id_lock_);
+    if (eid > eid_reserved_) {
+      size_t reserved = ((eid / kEventIDBlockSize) + 1) * kEventIDBlockSize;
+      auto status = DBHandle::getInstance()->Put(
+          kEvents, "eid." + dbNamespace(), std::to_string(reserved));
+      if (!status.ok()) {
+        return "0";
+      }
+      eid_reserved_ = reserved;
+    }
   }
 
-  return eid_value;
+  return std::to_string(eid);
+}
+
+/// Decode a record's block of rows, records before blocks are a JSON row.
+static Status deserializeRecord(const std::string& data, QueryData& rows) {
+  if (data[0] != '\0') {
+    Row r;
+    auto status = deserializeRowJSON(data, r);
+    if (status.ok()) {
+      rows.push_back(std::move(r));
+    }
+    return status;
+  }
+  return deserializeQueryDataBinary(data, rows);
 }
 
 QueryData EventSubscriberPlugin::get(EventTime start, EventTime stop) {
   QueryData results;
-  Status status;
+  get(start, stop, [&results](Row& r) {
+    results.push_back(std::move(r));
+    return true;
+  });
+  return results;
+}
 
+void EventSubscriberPlugin::get(EventTime start,
+                                EventTime stop,
+                                const RowYield& yield) {
   std::shared_ptr<DBHandle> db;
   try {
     db = DBHandle::getInstance();
   } catch (const std::runtime_error& e) {
     LOG(ERROR) << "Cannot retrieve subscriber results database is locked";
-    return results;
+    return;
   }
 
-  // Get the records for this time range.
-  auto indexes = getIndexes(start, stop);
-  auto records = getRecords(indexes);
-
-  std::vector<EventRecord> mapped_records;
-  for (const auto& record : records) {
-    if (record.second >= start && (record.second <= stop || stop == 0)) {
-      mapped_records.push_back(record);
+  if (expire_events_) {
+    // Records are time-ordered, expiration removes a leading range of keys.
+    // The expiration service removes them between queries when it runs.
+    if (!kEventsExpiring) {
+      expire();
+    } else {
+      auto age_time = getAgeExpireTime(EventFactory::getRetention(getName()));
+      if (age_time > expire_time_) {
+        expire_time_ = age_time;
+      }
+    }
+    if (start < expire_time_) {
+      start = expire_time_;
     }
   }
 
-  std::string events_key = "data." + dbNamespace();
-  if (FLAGS_events_expiry > 0) {
-    // Set the expire time to NOW - "configured lifetime".
-    // Index retrieval will apply the constraints checking and auto-expire.
-    expire_time_ = getUnixTime() - FLAGS_events_expiry;
+  if (stop != 0 && start > stop) {
+    return;
   }
 
-  // Select mapped_records using event_ids as keys.
-  std::string data_value;
-  for (const auto& record : mapped_records) {
-    Row r;
-    status = db->Get(kEvents, events_key + "." + record.first, data_value);
-    if (data_value.length() == 0) {
-      // THere is no record here, interesting error case.
-      continue;
+  // Read the time range in chunks, each continues after the last key read,
+  // so only the records within the range are decoded and a yield returning
+  // false stops the read.
+  auto prefix = recordPrefix();
+  auto next_key = prefix + padded(start, kEventTimeWidth);
+  auto stop_key = (stop == 0) ? prefix + ":"
+                              : prefix + padded(stop, kEventTimeWidth) + "/";
+  std::vector<std::pair<std::string, std::string>> records;
+  do {
+    records.clear();
+    auto status = db->ScanRange(
+        kEvents, next_key, stop_key, records, true, kEventReadChunkSize);
+    if (!status.ok()) {
+      return;
     }
-    status = deserializeRowJSON(data_value, r);
-    if (status.ok()) {
-      results.push_back(r);
+
+    QueryData block;
+    for (const auto& record : records) {
+      if (record.second.length() == 0) {
+        // There is no record data here, interesting error case.
+        continue;
+      }
+
+      block.clear();
+      if (!deserializeRecord(record.second, block).ok()) {
+        continue;
+      }
+      for (auto& r : block) {
+        if (!yield(r)) {
+          return;
+        }
+      }
+    }
+
+    if (!records.empty()) {
+      // The smallest key following the last key read.
+      next_key = records.back().first + '\0';
     }
+  } while (records.size() == kEventReadChunkSize);
+}
+
+void EventSubscriberPlugin::genTable(QueryContext& context,
+                                     const RowYield& yield) {
+  EventTime start, stop;
+  if (getTimeRange(context, start, stop)) {
+    get(start, stop, yield);
   }
-  return results;
+}
+
+bool EventSubscriberPlugin::getTimeRange(const QueryContext& context,
+                                         EventTime& start,
+                                         EventTime& stop) {
+  start = 0;
+  stop = 0;
+  auto constraints = context.constraints.find("time");
+  if (constraints == context.constraints.end()) {
+    return true;
+  }
+
+  // Each constraint narrows the range, SQLite still filters every row.
+  long long lower = 0;
+  long long upper = std::numeric_limits<EventTime>::max();
+  for (const auto& op : {EQUALS,
+                         GREATER_THAN,
+                         GREATER_THAN_OR_EQUALS,
+                         LESS_THAN,
+                         LESS_THAN_OR_EQUALS}) {
+    for (const auto& expr : constraints->second.getAll(op)) {
+      char* end = nullptr;
+      auto value = strtoll(expr.c_str(), &end, 10);
+      if (end == expr.c_str() || *end != '\0') {
+        // Only integer times bound the range.
+        continue;
+      }
+
+      if (op == EQUALS || op == GREATER_THAN_OR_EQUALS) {
+        lower = std::max(lower, value);
+      } else if (op == GREATER_THAN) {
+        lower = std::max(lower, value + 1);
+      }
+      if (op == EQUALS || op == LESS_THAN_OR_EQUALS) {
+        upper = std::min(upper, value);
+      } else if (op == LESS_THAN) {
+        upper = std::min(upper, value - 1);
+      }
+    }
+  }
+
+  if (upper < lower || upper < 1 ||
+      lower > std::numeric_limits<EventTime>::max()) {
+    // No record time matches, a stop of 0 would not bound the range.
+    return false;
+  }
+  start = static_cast<EventTime>(lower);
+  stop = (upper == std::numeric_limits<EventTime>::max())
+             ? 0
+             : static_cast<EventTime>(upper);
+  return true;
 }
 
 Status EventSubscriberPlugin::add(const Row& r, EventTime time) {
-  Status status;
+  return addBatch({r}, time);
+}
 
+Status EventSubscriberPlugin::addBatch(const std::vector<Row>& rows,
+                                       EventTime time) {
   std::shared_ptr<DBHandle> db;
   try {
     db = DBHandle::getInstance();
@@ -383,22 +1058,37 @@ Status EventSubscriberPlugin::add(const Row& r, EventTime time) {
     return Status(1, e.what());
   }
 
-  // Get and increment the EID for this module.
-  EventID eid = getEventID();
+  if (rows.empty()) {
+    return Status(0, "OK");
+  }
 
-  std::string event_key = "data." + dbNamespace() + "." + eid;
+  // The batch is stored as one column-major block, so repeated values and
+  // column names are encoded once. Each row still consumes an EventID.
   std::string data;
-
-  status = serializeRowJSON(r, data);
+  auto status = serializeQueryDataColumnar(rows, data);
   if (!status.ok()) {
     return status;
   }
 
-  // Store the event data.
-  status = db->Put(kEvents, event_key, data);
-  // Record the event in the indexing bins.
-  recordEvent(eid, time);
-  return status;
+  // The time-ordered record key, using the first EventID, is also the index.
+  EventID eid = getEventID();
+  for (size_t i = 1; i < rows.size(); ++i) {
+    getEventID();
+  }
+
+  // The record and its partition's usage are written together.
+  DatabaseBatch batch;
+  batch.put(kEvents, recordKey(time, eid), data);
+  auto partition = time - (time % kEventPartitionSeconds);
+  boost::lock_guard<boost::mutex> lock(usage_lock_);
+  loadUsage();
+  auto& usage = partitions_[partition];
+  usage.events += rows.size();
+  usage.bytes += data.size();
+  batch.put(kEvents,
+            usageKey(partition),
+            std::to_string(usage.events) + ":" + std::to_string(usage.bytes));
+  return db->Write(batch);
 }
 
 void EventFactory::delay() {
@@ -407,13 +1097,69 @@ void EventFactory::delay() {
     return;
   }
 
-  // Create a thread for each event publisher.
+  // Create a thread for each event publisher with a run loop, publishers
+  // with a pollable handle share a single event loop thread and publishers
+  // with callbacks attach to a shared platform run loop.
   auto& ef = EventFactory::getInstance();
+  std::vector<EventPublisherRef> polled;
   for (const auto& publisher : EventFactory::getInstance().event_pubs_) {
+    if (FLAGS_events_shared_loop && !publisher.second->hasStarted()) {
+      // The publisher may check isAttached while scheduling its sources.
+      publisher.second->attached_ = true;
+      if (publisher.second->attach().ok()) {
+        VLOG(1) << "Attached event publisher to the shared run loop: "
+                << publisher.first;
+        publisher.second->hasStarted(true);
+        publisher.second->startDispatch(FLAGS_events_queue_size);
+        continue;
+      }
+      publisher.second->attached_ = false;
+    }
+
+    if (FLAGS_events_shared_loop && publisher.second->getPollHandle() >= 0 &&
+        !publisher.second->hasStarted()) {
+      VLOG(1) << "Adding event publisher to the event loop: "
+              << publisher.first;
+      publisher.second->hasStarted(true);
+      publisher.second->startDispatch(FLAGS_events_queue_size);
+      polled.push_back(publisher.second);
+      continue;
+    }
+
     auto thread_ = std::make_shared<boost::thread>(
         boost::bind(&EventFactory::run, publisher.first));
     ef.threads_.push_back(thread_);
   }
+
+  if (!polled.empty()) {
+    ef.threads_.push_back(std::make_shared<boost::thread>(
+        boost::bind(&EventFactory::runEventLoop, polled)));
+  }
+
+  if (FLAGS_events_expiry_interval > 0 && ef.expire_thread_ == nullptr) {
+    ef.expire_thread_ =
+        std::make_shared<boost::thread>(&EventFactory::expireLoop);
+  }
+}
+
+void EventFactory::expire() {
+  for (const auto& subscriber : EventFactory::getInstance().event_subs_) {
+    subscriber.second->expire();
+  }
+}
+
+void EventFactory::expireLoop() {
+  kEventsExpiring = true;
+  try {
+    while (true) {
+      expire();
+      boost::this_thread::sleep(
+          boost::posix_time::seconds(FLAGS_events_expiry_interval));
+    }
+  } catch (const boost::thread_interrupted& e) {
+    // The factory is ending.
+  }
+  kEventsExpiring = false;
 }
 
 Status EventFactory::run(EventPublisherID& type_id) {
@@ -438,22 +1184,182 @@ Status EventFactory::run(EventPublisherID& type_id) {
   }
   VLOG(1) << "Starting event publisher run loop: " + type_id;
   publisher->hasStarted(true);
+  publisher->startDispatch(FLAGS_events_queue_size);
+
+  if (publisher->getPollHandle() >= 0) {
+    // The publisher's handle is waited on by an event loop of its own.
+    runEventLoop({publisher});
+    return Status(0, "OK");
+  }
 
+  // Each step blocks until the publisher has events.
   auto status = Status(0, "OK");
   while (!publisher->isEnding() && status.ok()) {
-    // Can optionally implement a global cooloff latency here.
     status = publisher->run();
-    osquery::publisherSleep(EVENTS_COOLOFF);
   }
+  endPublisher(publisher, status);
+  return Status(0, "OK");
+}
+
+void EventFactory::endPublisher(const EventPublisherRef& publisher,
+                                const Status& status) {
   // The runloop status is not reflective of the event type's.
   VLOG(1) << "Event publisher " << publisher->type()
           << " run loop terminated for reason: " << status.getMessage();
+  // Deliver queued events before the publisher tears down.
+  publisher->stopDispatch();
   // Publishers auto tear down when their run loop stops.
   publisher->tearDown();
 
   // TODO: The event factory dtor will also remove every publisher.
-  ef.event_pubs_.erase(type_id);
-  return Status(0, "OK");
+  getInstance().event_pubs_.erase(publisher->type());
+}
+
+Status EventFactory::runEventLoop(std::vector<EventPublisherRef> publishers) {
+#ifdef __linux__
+  auto& ef = EventFactory::getInstance();
+
+  // The loop waits on each publisher's handle and a wake handle, used when a
+  // publisher ends or its timeout changes.
+  auto status = Status(0, "OK");
+  int epoll_handle = ::epoll_create1(EPOLL_CLOEXEC);
+  int wake_handle = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (epoll_handle == -1 || wake_handle == -1) {
+    status = Status(1, "Could not create event loop handles");
+  }
+
+  std::vector<int> handles = {wake_handle};
+  for (const auto& publisher : publishers) {
+    handles.push_back(publisher->getPollHandle());
+  }
+  for (const auto& handle : handles) {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = handle;
+    if (status.ok() &&
+        ::epoll_ctl(epoll_handle, EPOLL_CTL_ADD, handle, &event) == -1) {
+      status = Status(1, "Could not add an event loop handle");
+    }
+  }
+
+  if (status.ok()) {
+    boost::lock_guard<boost::mutex> lock(ef.wake_lock_);
+    ef.wake_handles_.insert(wake_handle);
+  }
+
+  std::vector<struct epoll_event> events(handles.size());
+  std::vector<int> timeouts;
+  while (status.ok()) {
+    // Publishers ending before the wake handle was added are removed here.
+    std::vector<EventPublisherRef> running;
+    for (const auto& publisher : publishers) {
+      if (publisher->isEnding()) {
+        ::epoll_ctl(
+            epoll_handle, EPOLL_CTL_DEL, publisher->getPollHandle(), nullptr);
+        endPublisher(publisher, Status(0, "Ending"));
+      } else {
+        running.push_back(publisher);
+      }
+    }
+    publishers.swap(running);
+    if (publishers.empty()) {
+      break;
+    }
+
+    // The wait ends at the nearest publisher timeout.
+    timeouts.resize(publishers.size());
+    int timeout = -1;
+    for (size_t i = 0; i < publishers.size(); ++i) {
+      timeouts[i] = publishers[i]->getPollTimeout();
+      if (timeouts[i] >= 0 && (timeout == -1 || timeouts[i] < timeout)) {
+        timeout = timeouts[i];
+      }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int ready =
+        ::epoll_wait(epoll_handle, events.data(), events.size(), timeout);
+    if (ready == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      status = Status(1, "Could not wait on the event loop");
+      break;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - start).count();
+
+    std::set<int> readable;
+    for (int i = 0; i < ready; ++i) {
+      if (events[i].data.fd != wake_handle) {
+        readable.insert(events[i].data.fd);
+        continue;
+      }
+
+      uint64_t wakes = 0;
+      if (::read(wake_handle, &wakes, sizeof(wakes)) == -1) {
+        VLOG(1) << "Could not read the event loop wake handle";
+      }
+    }
+
+    // Each readable publisher, or publisher whose timeout passed, drains all
+    // of its pending events before the next wait.
+    running.clear();
+    for (size_t i = 0; i < publishers.size(); ++i) {
+      const auto& publisher = publishers[i];
+      auto handle = publisher->getPollHandle();
+      auto publisher_status = Status(0, "OK");
+      if (!publisher->isEnding() &&
+          (readable.count(handle) > 0 ||
+           (timeouts[i] >= 0 && elapsed >= timeouts[i]))) {
+        TraceSpan span("events", "process", publisher->type());
+        publisher_status = publisher->process();
+      }
+
+      if (!publisher_status.ok()) {
+        ::epoll_ctl(epoll_handle, EPOLL_CTL_DEL, handle, nullptr);
+        endPublisher(publisher, publisher_status);
+      } else {
+        running.push_back(publisher);
+      }
+    }
+    publishers.swap(running);
+  }
+
+  for (const auto& publisher : publishers) {
+    endPublisher(publisher, status);
+  }
+
+  {
+    boost::lock_guard<boost::mutex> lock(ef.wake_lock_);
+    ef.wake_handles_.erase(wake_handle);
+  }
+  for (const auto& handle : {epoll_handle, wake_handle}) {
+    if (handle != -1) {
+      ::close(handle);
+    }
+  }
+  return status;
+#else
+  auto status = Status(1, "Event loops are not supported");
+  for (const auto& publisher : publishers) {
+    endPublisher(publisher, status);
+  }
+  return status;
+#endif
+}
+
+void EventFactory::wake() {
+#ifdef __linux__
+  auto& ef = EventFactory::getInstance();
+  boost::lock_guard<boost::mutex> lock(ef.wake_lock_);
+  for (const auto& handle : ef.wake_handles_) {
+    uint64_t wake = 1;
+    if (::write(handle, &wake, sizeof(wake)) == -1) {
+      VLOG(1) << "Could not wake an event loop";
+    }
+  }
+#endif
 }
 
 // There's no reason for the event factory to keep multiple instances.
@@ -511,6 +1417,11 @@ Status EventFactory::registerEventSubscriber(const PluginRef& sub) {
 
   auto& ef = EventFactory::getInstance();
   ef.event_subs_[specialized_sub->getName()] = specialized_sub;
+  {
+    boost::lock_guard<boost::mutex> lock(ef.retention_lock_);
+    specialized_sub->isLowPriority(
+        ef.low_priority_.count(specialized_sub->getName()) > 0);
+  }
 
   // Set state of subscriber.
   if (!status.ok()) {
@@ -596,8 +1507,13 @@ Status EventFactory::deregisterEventPublisher(EventPublisherID& type_id) {
     // If the run loop did run the tear down and erase will happen in the event
     // thread wrapper when isEnding is next checked.
     ef.event_pubs_.erase(type_id);
+  } else if (publisher->isAttached()) {
+    // Attached publishers have no thread to stop, remove their sources.
+    endPublisher(publisher, Status(0, "Ending"));
   } else {
     publisher->end();
+    // Publishers within an event loop stop when the loop wakes.
+    wake();
   }
   return Status(0, "OK");
 }
@@ -610,6 +1526,29 @@ std::vector<std::string> EventFactory::publisherTypes() {
   return types;
 }
 
+void EventFactory::setRetention(
+    const std::map<std::string, EventRetention>& limits) {
+  auto& ef = EventFactory::getInstance();
+  boost::lock_guard<boost::mutex> lock(ef.retention_lock_);
+  ef.retention_ = limits;
+}
+
+void EventFactory::setLowPriority(const std::set<std::string>& names) {
+  auto& ef = EventFactory::getInstance();
+  boost::lock_guard<boost::mutex> lock(ef.retention_lock_);
+  ef.low_priority_ = names;
+  for (const auto& subscriber : ef.event_subs_) {
+    subscriber.second->isLowPriority(names.count(subscriber.first) > 0);
+  }
+}
+
+EventRetention EventFactory::getRetention(const std::string& name) {
+  auto& ef = EventFactory::getInstance();
+  boost::lock_guard<boost::mutex> lock(ef.retention_lock_);
+  auto limits = ef.retention_.find(name);
+  return (limits == ef.retention_.end()) ? EventRetention() : limits->second;
+}
+
 std::vector<std::string> EventFactory::subscriberNames() {
   std::vector<std::string> names;
   for (const auto& subscriber : getInstance().event_subs_) {
@@ -635,6 +1574,13 @@ void EventFactory::end(bool join) {
     }
   }
 
+  // The expiration service only waits between expirations.
+  if (ef.expire_thread_ != nullptr) {
+    ef.expire_thread_->interrupt();
+    ef.expire_thread_->join();
+    ef.expire_thread_ = nullptr;
+  }
+
   // A small cool off helps OS API event publisher flushing.
   ::usleep(400);
   ef.threads_.clear();
@@ -0,0 +1,474 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/events/freebsd/kqueue.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     kqueue_max_descriptors,
+     4096,
+     "Maximum descriptors opened for kqueue file watches");
+
+/// Directories per second added to recursive kqueue watches.
+const size_t kKqueueCrawlRate = 1000;
+
+/// Interval between steps of the recursive watch crawl (ms).
+const int kKqueueCrawlInterval = 100;
+
+/// Directories crawled immediately when a subscription is configured.
+const size_t kKqueueCrawlInline = 64;
+
+/// Events read from the handle with each kevent call.
+const size_t kKqueueEventBatch = 64;
+
+/// Vnode changes registered for every watch.
+const uint32_t kKqueueWatchFlags = NOTE_DELETE | NOTE_WRITE | NOTE_EXTEND |
+                                   NOTE_ATTRIB | NOTE_LINK | NOTE_RENAME |
+                                   NOTE_REVOKE;
+
+std::map<uint32_t, std::string> kKqueueMaskActions = {
+    {NOTE_DELETE, "DELETED"},
+    {NOTE_WRITE, "UPDATED"},
+    {NOTE_EXTEND, "UPDATED"},
+    {NOTE_ATTRIB, "ATTRIBUTES_MODIFIED"},
+    {NOTE_RENAME, "MOVED_FROM"},
+    {kKqueueNoteCreate, "CREATED"},
+};
+
+REGISTER(KqueueEventPublisher, "event_publisher", "kqueue");
+
+/// Check if a path is at or below a directory path.
+static inline bool isPathWithin(const std::string& directory,
+                                const std::string& path) {
+  if (path.compare(0, directory.size(), directory) != 0) {
+    return false;
+  }
+  return path.size() == directory.size() || directory.empty() ||
+         directory.back() == '/' || path[directory.size()] == '/';
+}
+
+static inline std::string joinPath(const std::string& directory,
+                                   const std::string& name) {
+  if (!directory.empty() && directory.back() == '/') {
+    return directory + name;
+  }
+  return directory + "/" + name;
+}
+
+/// List the names within a directory, excluding the dot entries.
+static bool listEntries(const std::string& path, std::set<std::string>& names) {
+  auto dir = ::opendir(path.c_str());
+  if (dir == nullptr) {
+    return false;
+  }
+
+  struct dirent* entry = nullptr;
+  while ((entry = ::readdir(dir)) != nullptr) {
+    if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+      names.insert(entry->d_name);
+    }
+  }
+  ::closedir(dir);
+  return true;
+}
+
+Status KqueueEventPublisher::setUp() {
+  kqueue_handle_ = ::kqueue();
+  if (kqueue_handle_ == -1) {
+    return Status(1, "Could not init kqueue");
+  }
+  ::fcntl(kqueue_handle_, F_SETFD, FD_CLOEXEC);
+
+  events_.resize(kKqueueEventBatch);
+  return Status(0, "OK");
+}
+
+void KqueueEventPublisher::configure() {
+  boost::lock_guard<boost::recursive_mutex> lock(monitor_lock_);
+  SubscriptionPathIndex index;
+  for (const auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    addMonitor(sc->path, sc->recursive);
+    index.add(sc->path, sc->recursive, sub);
+  }
+  index_.swap(index);
+
+  // Close the descriptors of paths that are no longer subscribed.
+  std::vector<int> unused;
+  for (const auto& watched : path_descriptors_) {
+    if (!isPathSubscribed(watched.first)) {
+      unused.push_back(watched.second);
+    }
+  }
+  for (const auto& fd : unused) {
+    removeWatch(fd);
+  }
+
+  crawl(kKqueueCrawlInline);
+}
+
+void KqueueEventPublisher::tearDown() {
+  boost::lock_guard<boost::recursive_mutex> lock(monitor_lock_);
+  for (const auto& watch : watches_) {
+    ::close(watch.first);
+  }
+  watches_.clear();
+  path_descriptors_.clear();
+  crawl_queue_.clear();
+  crawled_.clear();
+
+  if (kqueue_handle_ != -1) {
+    ::close(kqueue_handle_);
+    kqueue_handle_ = -1;
+  }
+}
+
+size_t KqueueEventPublisher::crawl(size_t max) {
+  boost::lock_guard<boost::recursive_mutex> lock(monitor_lock_);
+  size_t count = 0;
+  while (!crawl_queue_.empty() && count < max) {
+    auto path = crawl_queue_.front();
+    crawl_queue_.pop_front();
+    auto fd = path_descriptors_.find(path);
+    if (crawled_.count(path) > 0 || fd == path_descriptors_.end()) {
+      // Already crawled, or removed while pending.
+      continue;
+    }
+    crawled_.insert(path);
+    count++;
+
+    // Entries were listed when the directory's watch was added.
+    auto entries = watches_[fd->second].entries;
+    for (const auto& name : entries) {
+      addMonitor(joinPath(path, name), true, false);
+    }
+  }
+  return crawl_queue_.size();
+}
+
+int KqueueEventPublisher::getPollTimeout() {
+  int timeout = coalescer_.nextExpire();
+  if (hasPendingCrawl()) {
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - last_crawl_).count();
+    int crawl = std::max(0, kKqueueCrawlInterval - (int)elapsed);
+    timeout = (timeout == -1) ? crawl : std::min(timeout, crawl);
+  }
+  return timeout;
+}
+
+Status KqueueEventPublisher::process() {
+  fireCoalesced();
+  if (hasPendingCrawl()) {
+    auto now = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       now - last_crawl_).count();
+    if (elapsed >= kKqueueCrawlInterval) {
+      crawl(kKqueueCrawlRate * kKqueueCrawlInterval / 1000);
+      last_crawl_ = now;
+    }
+  }
+  return readEvents();
+}
+
+Status KqueueEventPublisher::readEvents() {
+  struct timespec timeout = {0, 0};
+  while (!isEnding()) {
+    int count = ::kevent(
+        kqueue_handle_, nullptr, 0, events_.data(), events_.size(), &timeout);
+    if (count == -1 && errno == EINTR) {
+      continue;
+    } else if (count == -1) {
+      return Status(1, "kqueue read failed");
+    }
+
+    for (int i = 0; i < count; i++) {
+      processEvent(events_[i]);
+    }
+    if ((size_t)count < events_.size()) {
+      // The handle is drained.
+      break;
+    }
+  }
+  return Status(0, "OK");
+}
+
+void KqueueEventPublisher::processEvent(const struct kevent& event) {
+  boost::lock_guard<boost::recursive_mutex> lock(monitor_lock_);
+  auto watch = watches_.find((int)event.ident);
+  if (watch == watches_.end() ||
+      watch->second.id != reinterpret_cast<uintptr_t>(event.udata)) {
+    // The watch was removed, and the descriptor may have been reused.
+    return;
+  }
+
+  auto path = watch->second.path;
+  auto flags = event.fflags;
+  if (watch->second.directory && (flags & (NOTE_WRITE | NOTE_LINK))) {
+    diffDirectory(watch->first);
+  }
+
+  if (flags & (NOTE_DELETE | NOTE_RENAME | NOTE_REVOKE)) {
+    // The watched vnode is gone or moved, the path may be replaced.
+    bool recursive = watch->second.recursive;
+    removeMonitor(path);
+    std::string parent = path.substr(0, path.find_last_of('/'));
+    if (pathExists(path).ok() && addMonitor(path, recursive)) {
+      fireAction(path, kKqueueNoteCreate);
+    } else if (path_descriptors_.count(parent) == 0) {
+      // A watched parent directory reports the entry it no longer lists.
+      fireAction(path, (flags & NOTE_RENAME) ? NOTE_RENAME : NOTE_DELETE);
+    }
+    return;
+  }
+
+  if (!watch->second.directory && (flags & (NOTE_WRITE | NOTE_EXTEND))) {
+    fireAction(path, NOTE_WRITE);
+  }
+  if (flags & NOTE_ATTRIB) {
+    fireAction(path, NOTE_ATTRIB);
+  }
+}
+
+void KqueueEventPublisher::diffDirectory(int fd) {
+  std::set<std::string> entries;
+  auto& watch = watches_[fd];
+  if (!listEntries(watch.path, entries)) {
+    return;
+  }
+
+  auto path = watch.path;
+  auto recursive = watch.recursive;
+  std::vector<std::string> created;
+  std::vector<std::string> deleted;
+  std::set_difference(entries.begin(),
+                      entries.end(),
+                      watch.entries.begin(),
+                      watch.entries.end(),
+                      std::back_inserter(created));
+  std::set_difference(watch.entries.begin(),
+                      watch.entries.end(),
+                      entries.begin(),
+                      entries.end(),
+                      std::back_inserter(deleted));
+  // The watch reference is not used after watches change.
+  watch.entries.swap(entries);
+
+  for (const auto& name : deleted) {
+    auto child = joinPath(path, name);
+    removeMonitor(child);
+    fireAction(child, NOTE_DELETE);
+  }
+  for (const auto& name : created) {
+    auto child = joinPath(path, name);
+    if (recursive) {
+      addMonitor(child, true, false);
+    }
+    fireAction(child, kKqueueNoteCreate);
+  }
+}
+
+void KqueueEventPublisher::fireAction(const std::string& path,
+                                      uint32_t fflags) {
+  auto ec = createEventContext();
+  ec->path = path;
+  ec->fflags = fflags;
+  ec->action = kKqueueMaskActions[fflags];
+  fire(ec);
+}
+
+bool KqueueEventPublisher::addMonitor(const std::string& path,
+                                      bool recursive,
+                                      bool follow) {
+  boost::lock_guard<boost::recursive_mutex> lock(monitor_lock_);
+  auto existing = path_descriptors_.find(path);
+  if (existing != path_descriptors_.end()) {
+    auto& watch = watches_[existing->second];
+    if (recursive && !watch.recursive) {
+      watch.recursive = true;
+      if (watch.directory) {
+        crawl_queue_.push_back(path);
+      }
+    }
+    return true;
+  }
+
+  if (path_descriptors_.size() >= FLAGS_kqueue_max_descriptors) {
+    if (failed_.empty()) {
+      LOG(WARNING) << "Reached the kqueue_max_descriptors limit, not watching: "
+                   << path;
+    }
+    failed_.insert(path);
+    return false;
+  }
+
+  // Only regular files and directories are opened, a FIFO or device may
+  // block or have side effects.
+  struct stat st;
+  int status = (follow) ? ::stat(path.c_str(), &st) : ::lstat(path.c_str(), &st);
+  if (status != 0 || !(S_ISREG(st.st_mode) || S_ISDIR(st.st_mode))) {
+    failed_.insert(path);
+    return false;
+  }
+
+  int flags = O_RDONLY | O_CLOEXEC | O_NONBLOCK | ((follow) ? 0 : O_NOFOLLOW);
+  int fd = ::open(path.c_str(), flags);
+  if (fd == -1) {
+    VLOG(1) << "Could not open kqueue watch on: " << path;
+    failed_.insert(path);
+    return false;
+  }
+
+  KqueueWatch watch;
+  watch.id = ++next_id_;
+  watch.path = path;
+  watch.directory = S_ISDIR(st.st_mode);
+  watch.recursive = recursive;
+
+  struct kevent change;
+  EV_SET(&change,
+         fd,
+         EVFILT_VNODE,
+         EV_ADD | EV_CLEAR,
+         kKqueueWatchFlags,
+         0,
+         reinterpret_cast<void*>(watch.id));
+  if (::kevent(kqueue_handle_, &change, 1, nullptr, 0, nullptr) == -1) {
+    LOG(ERROR) << "Could not add kqueue watch on: " << path;
+    ::close(fd);
+    failed_.insert(path);
+    return false;
+  }
+
+  if (watch.directory) {
+    listEntries(path, watch.entries);
+  }
+  watches_[fd] = watch;
+  path_descriptors_[path] = fd;
+  failed_.erase(path);
+
+  if (recursive && watch.directory && crawled_.count(path) == 0) {
+    // Entries of this directory are watched incrementally by the crawl.
+    crawl_queue_.push_back(path);
+  }
+  return true;
+}
+
+void KqueueEventPublisher::removeMonitor(const std::string& path) {
+  boost::lock_guard<boost::recursive_mutex> lock(monitor_lock_);
+  // Paths below a directory sort after it, with other paths sharing its prefix.
+  std::vector<int> removed;
+  for (auto it = path_descriptors_.lower_bound(path);
+       it != path_descriptors_.end() &&
+           it->first.compare(0, path.size(), path) == 0;
+       ++it) {
+    if (isPathWithin(path, it->first)) {
+      removed.push_back(it->second);
+    }
+  }
+  for (const auto& fd : removed) {
+    removeWatch(fd);
+  }
+}
+
+void KqueueEventPublisher::removeWatch(int fd) {
+  boost::lock_guard<boost::recursive_mutex> lock(monitor_lock_);
+  auto watch = watches_.find(fd);
+  if (watch == watches_.end()) {
+    return;
+  }
+
+  // Closing the descriptor removes its kevent registration.
+  ::close(fd);
+  path_descriptors_.erase(watch->second.path);
+  crawled_.erase(watch->second.path);
+  watches_.erase(watch);
+}
+
+bool KqueueEventPublisher::isPathSubscribed(const std::string& path) const {
+  for (const auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    if (sc->path == path || (sc->recursive && isPathWithin(sc->path, path))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool KqueueEventPublisher::matchSubscriptions(
+    const EventContextRef& ec, SubscriptionVector& matches) const {
+  if (ec == nullptr || index_.size() != subscriptions_.size()) {
+    // Subscriptions were added without a configure, check each.
+    return false;
+  }
+  index_.match(getEventContext(ec)->path, matches);
+  return true;
+}
+
+void KqueueEventPublisher::fireCallback(const SubscriptionRef& sub,
+                                        const EventContextRef& ec) const {
+  auto pub_ec = getEventContext(ec);
+  if (pub_ec->subscription != nullptr) {
+    // A held event was already coalesced by this Subscription.
+    if (pub_ec->subscription == sub.get()) {
+      EventPublisher::fireCallback(sub, ec);
+    }
+    return;
+  }
+
+  auto sc = getSubscriptionContext(sub->context);
+  if (sc->coalesce > 0) {
+    if (shouldFire(sc, pub_ec) && sub->callback != nullptr &&
+        coalescer_.hold(sub, pub_ec, sc->coalesce)) {
+      EventFactory::wake();
+    }
+    return;
+  }
+  EventPublisher::fireCallback(sub, ec);
+}
+
+void KqueueEventPublisher::fireCoalesced() {
+  for (const auto& ec : coalescer_.expire()) {
+    fire(ec);
+  }
+}
+
+bool KqueueEventPublisher::shouldFire(const KqueueSubscriptionContextRef& sc,
+                                      const KqueueEventContextRef& ec) const {
+  if (!sc->recursive && sc->path != ec->path) {
+    return false;
+  }
+
+  if (!isPathWithin(sc->path, ec->path)) {
+    return false;
+  }
+
+  // The subscription may supply a required event mask.
+  if (sc->mask != 0 && !(ec->fflags & sc->mask)) {
+    return false;
+  }
+  return true;
+}
+}
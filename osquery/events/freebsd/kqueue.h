@@ -0,0 +1,223 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/event.h>
+
+#include <boost/thread/recursive_mutex.hpp>
+
+#include <osquery/events.h>
+
+#include "osquery/events/event_coalescer.h"
+#include "osquery/events/subscription_index.h"
+
+namespace osquery {
+
+/**
+ * @brief A synthesized action bit for new directory entries.
+ *
+ * `kqueue` reports that a directory was written, the publisher finds the new
+ * entries by listing it. The bit is above the vnode filter's flags.
+ */
+const uint32_t kKqueueNoteCreate = 0x01000000;
+
+extern std::map<uint32_t, std::string> kKqueueMaskActions;
+
+/**
+ * @brief Subscriptioning details for KqueueEventPublisher events.
+ *
+ * This mirrors INotifySubscriptionContext: a path (file or directory), an
+ * optional action mask of `NOTE_*` bits and kKqueueNoteCreate, recursion,
+ * and a coalescing window.
+ */
+struct KqueueSubscriptionContext : public SubscriptionContext {
+  /// Subscription the following filesystem path.
+  std::string path;
+  /// Limit the `kqueue` actions to the subscriptioned mask (if not 0).
+  uint32_t mask;
+  /// Treat this path as a directory and subscription recursively.
+  bool recursive;
+  /// Coalesce events with the same path and action for this many ms (if not 0).
+  size_t coalesce;
+
+  KqueueSubscriptionContext() : mask(0), recursive(false), coalesce(0) {}
+
+  /**
+   * @brief Helper method to map a string action to a `kqueue` action mask bit.
+   *
+   * @param action The string action, a value in kKqueueMaskActions.
+   */
+  void requireAction(const std::string& action) {
+    for (const auto& bit : kKqueueMaskActions) {
+      if (action == bit.second) {
+        mask = mask | bit.first;
+      }
+    }
+  }
+};
+
+/**
+ * @brief Event details for KqueueEventPublisher events.
+ */
+struct KqueueEventContext : public EventContext {
+  /// The path of the changed file or directory entry.
+  std::string path;
+  /// A string action representing the event action bit.
+  std::string action;
+  /// The single action bit, a `NOTE_*` flag or kKqueueNoteCreate.
+  uint32_t fflags;
+  /// A no-op event transaction id.
+  uint32_t transaction_id;
+
+  KqueueEventContext() : fflags(0), transaction_id(0) {}
+};
+
+typedef std::shared_ptr<KqueueEventContext> KqueueEventContextRef;
+typedef std::shared_ptr<KqueueSubscriptionContext> KqueueSubscriptionContextRef;
+
+/// An open descriptor registered with the vnode filter.
+struct KqueueWatch {
+  /// Identifies the watch in queued events, descriptors are reused.
+  uintptr_t id;
+  std::string path;
+  bool directory;
+  bool recursive;
+  /// The names within a watched directory, compared when it is written.
+  std::set<std::string> entries;
+
+  KqueueWatch() : id(0), directory(false), recursive(false) {}
+};
+
+/**
+ * @brief A BSD `kqueue` EventPublisher for file changes.
+ *
+ * The vnode filter needs an open descriptor for each watched file, unlike
+ * `inotify` a directory's watch does not report changes to its files. The
+ * publisher opens every file within a recursive subscription, up to the
+ * kqueue_max_descriptors flag, and keeps each descriptor until the path is
+ * removed or no longer subscribed.
+ *
+ * Recursive subscriptions are watched incrementally by a crawl, and a written
+ * directory is listed and compared with its known entries to report created
+ * and deleted paths. Events use the INotifyEventPublisher action strings.
+ */
+class KqueueEventPublisher
+    : public EventPublisher<KqueueSubscriptionContext, KqueueEventContext> {
+  DECLARE_PUBLISHER("kqueue");
+
+ public:
+  /// Create the `kqueue` handle descriptor.
+  Status setUp();
+  void configure();
+  /// Close the `kqueue` handle and every watched descriptor.
+  void tearDown();
+
+  /// The event loop waits on the `kqueue` handle.
+  int getPollHandle() const { return kqueue_handle_; }
+  /// Fire held events, step the crawl, and drain the `kqueue` handle.
+  Status process();
+  /// Milliseconds until a held event expires or the next crawl step.
+  int getPollTimeout();
+
+  KqueueEventPublisher() : EventPublisher(), kqueue_handle_(-1), next_id_(0) {}
+  /// The number of events held for coalescing Subscription%s.
+  size_t numCoalesced() const { return coalescer_.size(); }
+
+  /// Check if the `kqueue` handle is alive.
+  bool isHandleOpen() { return kqueue_handle_ > 0; }
+
+ private:
+  /// Read from the `kqueue` handle, without waiting, until it is empty.
+  Status readEvents();
+  /// Handle one vnode event, the watch may have been removed since.
+  void processEvent(const struct kevent& event);
+  /// List a changed directory and report its created and deleted entries.
+  void diffDirectory(int fd);
+  /// Fire an event for a path and a single action bit.
+  void fireAction(const std::string& path, uint32_t fflags);
+
+  /**
+   * @brief Open and register a descriptor for a file or directory.
+   *
+   * @param path The path to watch.
+   * @param recursive Crawl the directory's entries.
+   * @param follow Follow a symlink, only subscription paths are followed.
+   */
+  bool addMonitor(const std::string& path, bool recursive, bool follow = true);
+  /// Close the descriptor of a path and the descriptors below it.
+  void removeMonitor(const std::string& path);
+  /// Close a single watched descriptor.
+  void removeWatch(int fd);
+  /// Check if a path is at or below a Subscription's path.
+  bool isPathSubscribed(const std::string& path) const;
+
+  /// Given a SubscriptionContext and KqueueEventContext match path and action.
+  bool shouldFire(const KqueueSubscriptionContextRef& sc,
+                  const KqueueEventContextRef& ec) const;
+  /// Select Subscription%s by the event path using the path index.
+  bool matchSubscriptions(const EventContextRef& ec,
+                          SubscriptionVector& matches) const;
+  /// Hold events for coalescing Subscription%s.
+  void fireCallback(const SubscriptionRef& sub,
+                    const EventContextRef& ec) const;
+  /// Fire the held events whose coalescing window passed.
+  void fireCoalesced();
+
+  /**
+   * @brief Watch the entries of pending recursive directories.
+   *
+   * @param max The maximum number of directories to crawl.
+   *
+   * @return The number of directories still pending.
+   */
+  size_t crawl(size_t max);
+
+  /// Check if recursive watches are still being added.
+  bool hasPendingCrawl() {
+    boost::lock_guard<boost::recursive_mutex> lock(monitor_lock_);
+    return !crawl_queue_.empty();
+  }
+
+  int kqueue_handle_;
+  /// The last assigned KqueueWatch id.
+  uintptr_t next_id_;
+  /// Watched descriptors by path, and watches by descriptor.
+  std::map<std::string, int> path_descriptors_;
+  std::map<int, KqueueWatch> watches_;
+  /// The last step of the recursive watch crawl.
+  std::chrono::steady_clock::time_point last_crawl_;
+  /// The kevent output buffer.
+  std::vector<struct kevent> events_;
+  /// Subscription%s indexed by path, rebuilt in configure.
+  SubscriptionPathIndex index_;
+  /// Watched directories whose entries have not been watched.
+  std::deque<std::string> crawl_queue_;
+  /// Directories whose entries were watched.
+  std::set<std::string> crawled_;
+  /// Paths that could not be watched.
+  std::set<std::string> failed_;
+  /// Configure and the event loop both change the watches.
+  boost::recursive_mutex monitor_lock_;
+  /// Events held by the dispatch thread for coalescing Subscription%s.
+  mutable EventCoalescer<KqueueEventContext> coalescer_;
+
+ public:
+  FRIEND_TEST(KqueueTests, test_kqueue_crawl);
+  FRIEND_TEST(KqueueTests, test_kqueue_descriptor_limit);
+};
+}
@@ -0,0 +1,131 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <stdio.h>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <gtest/gtest.h>
+
+#include <osquery/events.h>
+#include <osquery/flags.h>
+
+#include "osquery/events/freebsd/kqueue.h"
+#include "osquery/core/test_util.h"
+
+namespace osquery {
+
+DECLARE_uint64(kqueue_max_descriptors);
+
+const std::string kRealTestDir = kTestWorkingDirectory + "kqueue-triggers";
+const std::string kRealTestPath = kRealTestDir + "/1";
+const std::string kRealTestSubDir = kRealTestDir + "/2";
+
+class KqueueTests : public testing::Test {
+ protected:
+  void SetUp() {
+    boost::filesystem::create_directories(kRealTestSubDir + "/a");
+    TriggerEvent(kRealTestPath);
+    TriggerEvent(kRealTestSubDir + "/a/1");
+  }
+
+  void TearDown() { boost::filesystem::remove_all(kRealTestDir); }
+
+  void TriggerEvent(const std::string& path) {
+    FILE* fd = fopen(path.c_str(), "w");
+    fputs("kqueue", fd);
+    fclose(fd);
+  }
+};
+
+class TestKqueueEventSubscriber
+    : public EventSubscriber<KqueueEventPublisher> {
+ public:
+  TestKqueueEventSubscriber() { setName("TestKqueueEventSubscriber"); }
+
+  Status init() { return Status(0, "OK"); }
+
+  Status Callback(const KqueueEventContextRef& ec, const void* user_data) {
+    actions_[ec->path] = ec->action;
+    return Status(0, "OK");
+  }
+
+  std::map<std::string, std::string> actions_;
+};
+
+TEST_F(KqueueTests, test_kqueue_init) {
+  auto pub = std::make_shared<KqueueEventPublisher>();
+  EXPECT_FALSE(pub->isHandleOpen());
+
+  auto status = EventFactory::registerEventPublisher(pub);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(pub->isHandleOpen());
+
+  EventFactory::deregisterEventPublisher("kqueue");
+  EXPECT_FALSE(pub->isHandleOpen());
+}
+
+TEST_F(KqueueTests, test_kqueue_crawl) {
+  auto pub = std::make_shared<KqueueEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+
+  // Each directory and file has a descriptor, added one listing at a time.
+  EXPECT_TRUE(pub->addMonitor(kRealTestDir, true));
+  EXPECT_EQ(pub->watches_.size(), 1U);
+  EXPECT_EQ(pub->crawl(1), 1U);
+  EXPECT_EQ(pub->watches_.size(), 3U);
+  EXPECT_EQ(pub->crawl(10), 0U);
+  EXPECT_EQ(pub->watches_.size(), 5U);
+  EXPECT_FALSE(pub->hasPendingCrawl());
+
+  // Removing a directory closes the descriptors below it.
+  pub->removeMonitor(kRealTestSubDir);
+  EXPECT_EQ(pub->watches_.size(), 2U);
+  EventFactory::deregisterEventPublisher("kqueue");
+}
+
+TEST_F(KqueueTests, test_kqueue_descriptor_limit) {
+  auto limit = FLAGS_kqueue_max_descriptors;
+  FLAGS_kqueue_max_descriptors = 2;
+
+  auto pub = std::make_shared<KqueueEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+  EXPECT_TRUE(pub->addMonitor(kRealTestDir, true));
+  pub->crawl(10);
+  EXPECT_EQ(pub->watches_.size(), 2U);
+  EXPECT_FALSE(pub->failed_.empty());
+
+  EventFactory::deregisterEventPublisher("kqueue");
+  FLAGS_kqueue_max_descriptors = limit;
+}
+
+TEST_F(KqueueTests, test_kqueue_directory_events) {
+  auto pub = std::make_shared<KqueueEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+
+  auto sub = std::make_shared<TestKqueueEventSubscriber>();
+  auto sc = sub->createSubscriptionContext();
+  sc->path = kRealTestDir;
+  sc->recursive = true;
+  sub->subscribe(&TestKqueueEventSubscriber::Callback, sc, nullptr);
+  pub->configure();
+
+  // New entries are found by listing the written directory.
+  TriggerEvent(kRealTestSubDir + "/2");
+  TriggerEvent(kRealTestPath);
+  boost::filesystem::remove(kRealTestSubDir + "/a/1");
+  pub->process();
+
+  EXPECT_EQ(sub->actions_[kRealTestSubDir + "/2"], "CREATED");
+  EXPECT_EQ(sub->actions_[kRealTestPath], "UPDATED");
+  EXPECT_EQ(sub->actions_[kRealTestSubDir + "/a/1"], "DELETED");
+  EventFactory::deregisterEventPublisher("kqueue");
+}
+}
@@ -0,0 +1,447 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+#include <linux/netlink.h>
+
+#include <osquery/core.h>
+#include <osquery/logger.h>
+
+#include "osquery/events/linux/audit.h"
+
+namespace osquery {
+
+FLAG(bool,
+     enable_audit,
+     false,
+     "Use the Linux audit netlink socket for process and socket events");
+
+/// Each read returns a single record, the buffer fits the largest (libaudit's
+/// MAX_AUDIT_MESSAGE_LENGTH).
+const size_t kAuditBufferSize = NLMSG_SPACE(8970);
+
+/// Request a larger socket buffer to absorb exec bursts between reads.
+const int kAuditSocketBuffer = 4 * 1024 * 1024;
+
+const size_t kAuditPendingMax = 1024;
+
+REGISTER(AuditEventPublisher, "event_publisher", "audit");
+
+/// Remove the quotes of a quoted field value.
+static std::string unquote(const std::string& value) {
+  if (value.size() >= 2 && (value[0] == '"' || value[0] == '\'') &&
+      value.back() == value[0]) {
+    return value.substr(1, value.size() - 2);
+  }
+  return value;
+}
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  } else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+std::string decodeAuditValue(const std::string& value) {
+  if (value.size() >= 2 && value[0] == '"') {
+    return unquote(value);
+  } else if (value == "(null)") {
+    return "";
+  } else if (value.size() % 2 != 0) {
+    return value;
+  }
+
+  std::string decoded;
+  decoded.reserve(value.size() / 2);
+  for (size_t i = 0; i < value.size(); i += 2) {
+    int high = hexValue(value[i]);
+    int low = hexValue(value[i + 1]);
+    if (high == -1 || low == -1) {
+      // Not an encoded string.
+      return value;
+    }
+    decoded.push_back(static_cast<char>((high << 4) | low));
+  }
+  return decoded;
+}
+
+bool parseAuditRecord(const char* data,
+                      size_t size,
+                      uint64_t& serial,
+                      EventTime& time,
+                      AuditRecord& record) {
+  std::string text(data, strnlen(data, size));
+
+  // audit(<sec>.<msec>:<serial>): ...
+  auto start = text.find("audit(");
+  auto end = text.find("):", start);
+  if (start == std::string::npos || end == std::string::npos) {
+    return false;
+  }
+
+  char* next = nullptr;
+  auto header = text.c_str() + start + 6;
+  time = static_cast<EventTime>(strtoul(header, &next, 10));
+  if (*next != '.') {
+    return false;
+  }
+  strtoul(next + 1, &next, 10);
+  if (*next != ':') {
+    return false;
+  }
+  serial = strtoull(next + 1, &next, 10);
+
+  // Fields are separated by spaces, quoted values do not contain quotes.
+  size_t i = end + 2;
+  while (i < text.size()) {
+    while (i < text.size() && text[i] == ' ') {
+      i++;
+    }
+    auto equal = text.find('=', i);
+    auto space = text.find(' ', i);
+    if (equal == std::string::npos) {
+      break;
+    } else if (space != std::string::npos && space < equal) {
+      // A token without a value.
+      i = space;
+      continue;
+    }
+
+    auto key = text.substr(i, equal - i);
+    i = equal + 1;
+    size_t value_end = std::string::npos;
+    if (i < text.size() && (text[i] == '"' || text[i] == '\'')) {
+      value_end = text.find(text[i], i + 1);
+      if (value_end != std::string::npos) {
+        value_end++;
+      }
+    } else {
+      value_end = text.find(' ', i);
+    }
+    if (value_end == std::string::npos) {
+      value_end = text.size();
+    }
+    record.fields[key] = text.substr(i, value_end - i);
+    i = value_end;
+  }
+  return true;
+}
+
+void AuditAssembler::add(uint64_t serial,
+                         EventTime time,
+                         AuditRecord record,
+                         std::vector<AuditEventContextRef>& completed) {
+  if (record.type == AUDIT_EOE) {
+    auto pending = pending_.find(serial);
+    if (pending != pending_.end()) {
+      auto& event = pending->second;
+      auto ec = assemble(serial, event.time, event.records);
+      if (ec != nullptr) {
+        completed.push_back(ec);
+      }
+      pending_.erase(pending);
+    }
+    return;
+  }
+
+  auto& pending = pending_[serial];
+  if (pending.records.empty()) {
+    pending.time = time;
+  }
+  pending.records.push_back(std::move(record));
+
+  // A lost end of event record must not hold events forever.
+  while (pending_.size() > max_) {
+    auto oldest = pending_.begin();
+    auto& event = oldest->second;
+    auto ec = assemble(oldest->first, event.time, event.records);
+    if (ec != nullptr) {
+      completed.push_back(ec);
+    }
+    pending_.erase(oldest);
+  }
+}
+
+AuditEventContextRef AuditAssembler::assemble(
+    uint64_t serial, EventTime time, std::vector<AuditRecord>& records) {
+  auto ec = std::make_shared<AuditEventContext>();
+  ec->serial = serial;
+  ec->time = time;
+
+  // Large argument lists are split across several EXECVE records.
+  std::map<std::string, std::string> execve;
+  for (auto& record : records) {
+    if (record.type == AUDIT_SYSCALL) {
+      for (auto& field : record.fields) {
+        if (field.first == "exe" || field.first == "comm" ||
+            field.first == "key") {
+          ec->fields[field.first] = decodeAuditValue(field.second);
+        } else {
+          ec->fields[field.first] = unquote(field.second);
+        }
+      }
+      ec->syscall = atoi(ec->fields["syscall"].c_str());
+    } else if (record.type == AUDIT_EXECVE) {
+      execve.insert(record.fields.begin(), record.fields.end());
+    } else if (record.type == AUDIT_CWD) {
+      ec->cwd = decodeAuditValue(record.fields["cwd"]);
+    } else if (record.type == AUDIT_SOCKADDR) {
+      ec->sockaddr = record.fields["saddr"];
+    }
+  }
+
+  if (ec->syscall == -1) {
+    return nullptr;
+  }
+
+  size_t argc = strtoul(execve["argc"].c_str(), nullptr, 10);
+  for (size_t i = 0; i < argc; i++) {
+    auto key = "a" + std::to_string(i);
+    if (execve.count(key) > 0) {
+      ec->arguments.push_back(decodeAuditValue(execve[key]));
+      continue;
+    }
+
+    // Long arguments are logged as a%d[k] chunks.
+    std::string argument;
+    for (size_t k = 0;; k++) {
+      auto chunk = execve.find(key + "[" + std::to_string(k) + "]");
+      if (chunk == execve.end()) {
+        break;
+      }
+      argument += decodeAuditValue(chunk->second);
+    }
+    ec->arguments.push_back(std::move(argument));
+  }
+  return ec;
+}
+
+Status AuditEventPublisher::setUp() {
+  if (!FLAGS_enable_audit) {
+    return Status(1, "Publisher disabled via configuration");
+  }
+
+  socket_ = ::socket(
+      PF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_AUDIT);
+  if (socket_ == -1) {
+    return Status(1, "Could not create audit netlink socket");
+  }
+
+  // The kernel caps the buffer at net.core.rmem_max, a failure is not fatal.
+  ::setsockopt(socket_,
+               SOL_SOCKET,
+               SO_RCVBUF,
+               &kAuditSocketBuffer,
+               sizeof(kAuditSocketBuffer));
+
+  struct sockaddr_nl address;
+  memset(&address, 0, sizeof(address));
+  address.nl_family = AF_NETLINK;
+  if (::bind(socket_, (struct sockaddr*)&address, sizeof(address)) == -1) {
+    tearDown();
+    return Status(1, "Could not bind audit netlink socket");
+  }
+
+  // Enable auditing and receive its records, this requires CAP_AUDIT_CONTROL.
+  struct audit_status status;
+  memset(&status, 0, sizeof(status));
+  status.mask = AUDIT_STATUS_ENABLED | AUDIT_STATUS_PID;
+  status.enabled = 1;
+  status.pid = ::getpid();
+  auto s = control(AUDIT_SET, &status, sizeof(status));
+  if (!s.ok()) {
+    tearDown();
+    return s;
+  }
+
+  buffer_.resize(kAuditBufferSize);
+  return Status(0, "OK");
+}
+
+Status AuditEventPublisher::control(int type, const void* data, size_t size) {
+  std::vector<char> message(NLMSG_SPACE(size), 0);
+  auto header = reinterpret_cast<struct nlmsghdr*>(message.data());
+  header->nlmsg_len = NLMSG_LENGTH(size);
+  header->nlmsg_type = type;
+  header->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+  memcpy(NLMSG_DATA(header), data, size);
+
+  struct sockaddr_nl address;
+  memset(&address, 0, sizeof(address));
+  address.nl_family = AF_NETLINK;
+  if (::sendto(socket_,
+               header,
+               header->nlmsg_len,
+               0,
+               (struct sockaddr*)&address,
+               sizeof(address)) == -1) {
+    return Status(1, "Could not send audit control");
+  }
+  // Acknowledgements arrive with the records and are checked by the event loop.
+  return Status(0, "OK");
+}
+
+Status AuditEventPublisher::controlRule(int type,
+                                        const std::set<int>& syscalls) {
+  struct audit_rule_data rule;
+  memset(&rule, 0, sizeof(rule));
+  rule.flags = AUDIT_FILTER_EXIT;
+  rule.action = AUDIT_ALWAYS;
+  for (const auto& syscall : syscalls) {
+    if (syscall >= 0 && AUDIT_WORD(syscall) < AUDIT_BITMASK_SIZE) {
+      rule.mask[AUDIT_WORD(syscall)] |= AUDIT_BIT(syscall);
+    }
+  }
+  return control(type, &rule, sizeof(rule));
+}
+
+void AuditEventPublisher::configure() {
+  if (socket_ == -1) {
+    return;
+  }
+
+  // The kernel filters on the union of every subscription's syscalls.
+  std::set<int> syscalls;
+  for (const auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    syscalls.insert(sc->syscalls.begin(), sc->syscalls.end());
+  }
+
+  if (syscalls == syscalls_) {
+    return;
+  }
+
+  if (!syscalls_.empty()) {
+    controlRule(AUDIT_DEL_RULE, syscalls_);
+  }
+  syscalls_.clear();
+  if (!syscalls.empty()) {
+    auto status = controlRule(AUDIT_ADD_RULE, syscalls);
+    if (!status.ok()) {
+      LOG(WARNING) << "Could not add audit rule: " << status.getMessage();
+      return;
+    }
+    syscalls_ = std::move(syscalls);
+  }
+}
+
+void AuditEventPublisher::tearDown() {
+  if (socket_ != -1) {
+    if (!syscalls_.empty()) {
+      controlRule(AUDIT_DEL_RULE, syscalls_);
+      syscalls_.clear();
+    }
+
+    // Stop sending records to this process.
+    struct audit_status status;
+    memset(&status, 0, sizeof(status));
+    status.mask = AUDIT_STATUS_PID;
+    status.pid = 0;
+    control(AUDIT_SET, &status, sizeof(status));
+  }
+
+  if (socket_ != -1) {
+    ::close(socket_);
+    socket_ = -1;
+  }
+}
+
+Status AuditEventPublisher::readEvents() {
+  while (!isEnding()) {
+    struct sockaddr_nl sender;
+    socklen_t sender_size = sizeof(sender);
+    ssize_t size = ::recvfrom(socket_,
+                              buffer_.data(),
+                              buffer_.size(),
+                              0,
+                              (struct sockaddr*)&sender,
+                              &sender_size);
+    if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // The socket is drained.
+      return Status(0, "OK");
+    } else if (size == -1 && errno == EINTR) {
+      continue;
+    } else if (size == -1 && errno == ENOBUFS) {
+      // Records were lost, the kernel keeps reporting.
+      LOG(WARNING) << "Audit netlink socket buffer overflowed";
+      continue;
+    } else if (size <= 0) {
+      return Status(1, "Audit read failed");
+    }
+
+    if (sender.nl_pid != 0) {
+      // Only the kernel publishes audit records.
+      continue;
+    }
+    processEvents(buffer_.data(), size);
+  }
+  return Status(0, "OK");
+}
+
+void AuditEventPublisher::processEvents(const char* buffer, size_t size) {
+  if (size < NLMSG_HDRLEN) {
+    return;
+  }
+
+  // The kernel sends one record per message, and some kernels do not count
+  // the header in a record's nlmsg_len, so the read size bounds the record.
+  auto header = reinterpret_cast<const struct nlmsghdr*>(buffer);
+  auto type = header->nlmsg_type;
+  if (type == NLMSG_NOOP || type == NLMSG_DONE) {
+    return;
+  } else if (type == NLMSG_ERROR) {
+    auto error = reinterpret_cast<const struct nlmsgerr*>(NLMSG_DATA(header));
+    if (size >= NLMSG_LENGTH(sizeof(struct nlmsgerr)) && error->error != 0) {
+      LOG(WARNING) << "Audit control failed: " << strerror(-error->error);
+    }
+    return;
+  }
+
+  // Only the records of syscall events are reassembled.
+  if (type != AUDIT_SYSCALL && type != AUDIT_EXECVE && type != AUDIT_CWD &&
+      type != AUDIT_SOCKADDR && type != AUDIT_EOE) {
+    return;
+  }
+
+  AuditRecord record;
+  record.type = type;
+  uint64_t serial = 0;
+  EventTime time = 0;
+  if (!parseAuditRecord(static_cast<const char*>(NLMSG_DATA(header)),
+                        size - NLMSG_HDRLEN,
+                        serial,
+                        time,
+                        record)) {
+    return;
+  }
+
+  std::vector<AuditEventContextRef> completed;
+  assembler_.add(serial, time, std::move(record), completed);
+  for (const auto& ec : completed) {
+    fire(ec);
+  }
+}
+
+bool AuditEventPublisher::shouldFire(const AuditSubscriptionContextRef& sc,
+                                     const AuditEventContextRef& ec) const {
+  return sc->syscalls.count(ec->syscall) > 0;
+}
+}
@@ -0,0 +1,204 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <linux/audit.h>
+
+#include <osquery/events.h>
+#include <osquery/flags.h>
+
+namespace osquery {
+
+DECLARE_bool(enable_audit);
+
+/// Incomplete events buffered before the oldest is completed.
+extern const size_t kAuditPendingMax;
+
+/// A single audit record, the fields of one netlink message.
+struct AuditRecord {
+  /// The AUDIT_* record type.
+  int type;
+  /// The record's key=value fields, quoted values keep their quotes.
+  std::map<std::string, std::string> fields;
+
+  AuditRecord() : type(0) {}
+};
+
+/**
+ * @brief Parse an audit record's text into an event serial, time, and fields.
+ *
+ * Records are formatted: audit(<sec>.<msec>:<serial>): key=value key="value".
+ *
+ * @return false if the record does not have an audit(...) header.
+ */
+bool parseAuditRecord(const char* data,
+                      size_t size,
+                      uint64_t& serial,
+                      EventTime& time,
+                      AuditRecord& record);
+
+/**
+ * @brief Decode a string field, such as an EXECVE argument or exe.
+ *
+ * The kernel quotes strings, or hex encodes strings containing spaces,
+ * quotes, or control characters.
+ */
+std::string decodeAuditValue(const std::string& value);
+
+/**
+ * @brief Subscription details for AuditEventPublisher events.
+ *
+ * The publisher installs an exit filter rule for the union of every
+ * subscription's syscalls, the kernel does not report other syscalls.
+ */
+struct AuditSubscriptionContext : public SubscriptionContext {
+  /// The syscall numbers reported to this subscription.
+  std::set<int> syscalls;
+};
+
+/**
+ * @brief Event details for AuditEventPublisher events.
+ *
+ * A syscall produces several records with the same serial, they are
+ * reassembled into one event when the end of event record arrives.
+ */
+struct AuditEventContext : public EventContext {
+  /// The event serial, unique until the kernel restarts.
+  uint64_t serial;
+  /// The syscall number.
+  int syscall;
+
+  /// The fields of the SYSCALL record: pid, ppid, uid, exe, success, etc.
+  std::map<std::string, std::string> fields;
+
+  /// The decoded arguments of an EXECVE record.
+  std::vector<std::string> arguments;
+  /// The working directory from the CWD record.
+  std::string cwd;
+  /// The hex encoded address from the SOCKADDR record.
+  std::string sockaddr;
+
+  AuditEventContext() : serial(0), syscall(-1) {}
+};
+
+typedef std::shared_ptr<AuditEventContext> AuditEventContextRef;
+typedef std::shared_ptr<AuditSubscriptionContext> AuditSubscriptionContextRef;
+
+/**
+ * @brief Reassemble the records of each audit event.
+ *
+ * Records of concurrent syscalls interleave, so each serial's records are
+ * buffered until its end of event record. The buffer is bounded, when it is
+ * full the oldest event is completed with the records it has.
+ */
+class AuditAssembler {
+ public:
+  explicit AuditAssembler(size_t max) : max_(max) {}
+
+  /**
+   * @brief Add a record, returning the events completed by it.
+   *
+   * @param serial The record's event serial.
+   * @param time The record's event time.
+   * @param record The parsed record.
+   * @param completed Output events that are complete or were evicted.
+   */
+  void add(uint64_t serial,
+           EventTime time,
+           AuditRecord record,
+           std::vector<AuditEventContextRef>& completed);
+
+  /// The number of incomplete events.
+  size_t size() const { return pending_.size(); }
+
+ private:
+  /// Build an event from a serial's records, nullptr if there is no syscall.
+  AuditEventContextRef assemble(uint64_t serial,
+                                EventTime time,
+                                std::vector<AuditRecord>& records);
+
+ private:
+  struct PendingEvent {
+    EventTime time;
+    std::vector<AuditRecord> records;
+  };
+
+  /// Incomplete events by serial, serials increase so the first is oldest.
+  std::map<uint64_t, PendingEvent> pending_;
+
+  size_t max_;
+};
+
+/**
+ * @brief A Linux audit netlink EventPublisher.
+ *
+ * The publisher registers itself as the audit daemon on the kernel's audit
+ * netlink socket, and installs exit filter rules for the syscalls of its
+ * subscriptions. This requires root, and replaces auditd while osquery runs,
+ * so the publisher is enabled with --enable_audit.
+ *
+ * Uses AuditSubscriptionContext and AuditEventContext.
+ */
+class AuditEventPublisher
+    : public EventPublisher<AuditSubscriptionContext, AuditEventContext> {
+  DECLARE_PUBLISHER("audit");
+
+ public:
+  /// Open the audit netlink socket and register as the audit daemon.
+  Status setUp();
+  /// Install the audit rules for the subscribed syscalls.
+  void configure();
+  /// Remove the installed rules and unregister.
+  void tearDown();
+  /// The event loop waits on the netlink socket.
+  int getPollHandle() const { return socket_; }
+  /// Drain the netlink socket.
+  Status process() { return readEvents(); }
+
+  AuditEventPublisher()
+      : EventPublisher(),
+        socket_(-1),
+        assembler_(kAuditPendingMax) {}
+
+  /// Check if the netlink socket is alive.
+  bool isSocketOpen() { return socket_ > 0; }
+
+ private:
+  /// Send an audit control message.
+  Status control(int type, const void* data, size_t size);
+  /// Add or delete an exit filter rule for a set of syscalls.
+  Status controlRule(int type, const std::set<int>& syscalls);
+  /// Read from the non-blocking socket until it is empty.
+  Status readEvents();
+  /// Reassemble and fire the events within a read buffer.
+  void processEvents(const char* buffer, size_t size);
+  /// Given a SubscriptionContext and AuditEventContext match the syscall.
+  bool shouldFire(const AuditSubscriptionContextRef& sc,
+                  const AuditEventContextRef& ec) const;
+
+ private:
+  int socket_;
+  /// The read buffer for netlink messages.
+  std::vector<char> buffer_;
+  /// The syscalls of the installed rule.
+  std::set<int> syscalls_;
+  /// Records waiting for the rest of their event.
+  AuditAssembler assembler_;
+
+ private:
+  FRIEND_TEST(AuditTests, test_audit_process_events);
+};
+}
@@ -0,0 +1,190 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/events/linux/fanotify.h"
+
+namespace osquery {
+
+FLAG(bool,
+     enable_fanotify,
+     false,
+     "Use fanotify mount marks for file events (Linux, requires root)");
+
+/// The actions reported when a subscription does not supply a mask.
+const uint64_t kFanotifyDefaultMask = FAN_MODIFY | FAN_CLOSE_WRITE;
+
+/// Event metadata is a fixed size, the buffer holds many events per read.
+const size_t kFanotifyBufferSize = 64 * 1024;
+
+std::map<uint64_t, std::string> kFanotifyMaskActions = {
+    {FAN_ACCESS, "ACCESSED"},
+    {FAN_MODIFY, "UPDATED"},
+    {FAN_CLOSE_WRITE, "UPDATED"},
+    {FAN_CLOSE_NOWRITE, "CLOSED"},
+    {FAN_OPEN, "OPENED"},
+};
+
+REGISTER(FanotifyEventPublisher, "event_publisher", "fanotify");
+
+Status FanotifyEventPublisher::setUp() {
+  if (!FLAGS_enable_fanotify) {
+    return Status(1, "Publisher disabled via configuration");
+  }
+
+  fanotify_handle_ =
+      ::fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK,
+                      O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+  if (fanotify_handle_ == -1) {
+    return Status(1, "Could not init fanotify");
+  }
+
+  buffer_.resize(kFanotifyBufferSize);
+  return Status(0, "OK");
+}
+
+void FanotifyEventPublisher::configure() {
+  SubscriptionPathIndex index;
+  for (const auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    index.add(sc->path, true, sub);
+
+    // A mount mark reports every file in the filesystem containing the path.
+    auto mask = (sc->mask != 0) ? sc->mask : kFanotifyDefaultMask;
+    if (marks_.count(sc->path) > 0 && (marks_[sc->path] & mask) == mask) {
+      continue;
+    }
+
+    if (::fanotify_mark(fanotify_handle_,
+                        FAN_MARK_ADD | FAN_MARK_MOUNT,
+                        mask,
+                        AT_FDCWD,
+                        sc->path.c_str()) == -1) {
+      LOG(ERROR) << "Could not add fanotify mount mark on: " << sc->path;
+      continue;
+    }
+    marks_[sc->path] |= mask;
+  }
+  index_.swap(index);
+}
+
+void FanotifyEventPublisher::tearDown() {
+  if (fanotify_handle_ != -1) {
+    ::close(fanotify_handle_);
+    fanotify_handle_ = -1;
+  }
+  marks_.clear();
+}
+
+Status FanotifyEventPublisher::readEvents() {
+  while (!isEnding()) {
+    ssize_t size = ::read(fanotify_handle_, buffer_.data(), buffer_.size());
+    if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // The handle is drained.
+      return Status(0, "OK");
+    } else if (size == -1 && errno == EINTR) {
+      continue;
+    } else if (size <= 0) {
+      return Status(1, "Fanotify read failed");
+    }
+
+    processEvents(buffer_.data(), size);
+  }
+  return Status(0, "OK");
+}
+
+void FanotifyEventPublisher::processEvents(char* buffer, size_t size) {
+  auto self = ::getpid();
+  auto event = reinterpret_cast<struct fanotify_event_metadata*>(buffer);
+  ssize_t remaining = size;
+  for (; FAN_EVENT_OK(event, remaining);
+       event = FAN_EVENT_NEXT(event, remaining)) {
+    if (event->vers != FANOTIFY_METADATA_VERSION) {
+      LOG(ERROR) << "Unexpected fanotify metadata version";
+      return;
+    }
+
+    if (event->mask & FAN_Q_OVERFLOW) {
+      // Events were lost, the marks remain and reporting continues.
+      LOG(WARNING) << "fanotify event queue overflowed";
+      continue;
+    }
+
+    if (event->pid == self) {
+      // Hashing or reading files from osquery should not be reported.
+      if (event->fd >= 0) {
+        ::close(event->fd);
+      }
+      continue;
+    }
+
+    auto ec = createEventContextFrom(event);
+    if (!ec->path.empty()) {
+      fire(ec);
+    }
+  }
+}
+
+FanotifyEventContextRef FanotifyEventPublisher::createEventContextFrom(
+    const struct fanotify_event_metadata* event) {
+  auto ec = createEventContext();
+  ec->mask = event->mask;
+  ec->pid = event->pid;
+  if (event->fd >= 0) {
+    // The descriptor is only used to resolve the path, queued events must not
+    // hold descriptors open.
+    char path[PATH_MAX] = {0};
+    auto link = "/proc/self/fd/" + std::to_string(event->fd);
+    auto length = ::readlink(link.c_str(), path, sizeof(path) - 1);
+    if (length > 0) {
+      ec->path = std::string(path, length);
+    }
+    ::close(event->fd);
+  }
+
+  for (const auto& action : kFanotifyMaskActions) {
+    if (event->mask & action.first) {
+      ec->action = action.second;
+      break;
+    }
+  }
+  return ec;
+}
+
+bool FanotifyEventPublisher::matchSubscriptions(
+    const EventContextRef& ec, SubscriptionVector& matches) const {
+  if (ec == nullptr || index_.size() != subscriptions_.size()) {
+    // Subscriptions were added without a configure, check each.
+    return false;
+  }
+  index_.match(getEventContext(ec)->path, matches);
+  return true;
+}
+
+bool FanotifyEventPublisher::shouldFire(
+    const FanotifySubscriptionContextRef& sc,
+    const FanotifyEventContextRef& ec) const {
+  if (ec->path.find(sc->path) != 0) {
+    // The mount mark reports paths outside of the subscription.
+    return false;
+  }
+
+  auto mask = (sc->mask != 0) ? sc->mask : kFanotifyDefaultMask;
+  return (ec->mask & mask) != 0;
+}
+}
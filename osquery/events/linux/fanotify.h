@@ -0,0 +1,129 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include <sys/fanotify.h>
+#include <sys/types.h>
+
+#include <osquery/events.h>
+#include <osquery/flags.h>
+
+#include "osquery/events/subscription_index.h"
+
+namespace osquery {
+
+DECLARE_bool(enable_fanotify);
+
+extern std::map<uint64_t, std::string> kFanotifyMaskActions;
+
+/**
+ * @brief Subscription details for FanotifyEventPublisher events.
+ *
+ * The mount containing the path is marked, so a single mark reports every
+ * file on that filesystem. Events are passed to the EventSubscriber if the
+ * event path is within the subscription path and the action is part of the
+ * mask. If the mask is 0 then modifications are passed.
+ */
+struct FanotifySubscriptionContext : public SubscriptionContext {
+  /// Subscribe to files within this filesystem path.
+  std::string path;
+  /// Limit the fanotify actions to the subscribed mask (if not 0).
+  uint64_t mask;
+
+  FanotifySubscriptionContext() : mask(0) {}
+};
+
+/**
+ * @brief Event details for FanotifyEventPublisher events.
+ */
+struct FanotifyEventContext : public EventContext {
+  /// The path of the file, resolved from the event descriptor.
+  std::string path;
+  /// A string action representing the fanotify event bit.
+  std::string action;
+  /// The fanotify event mask.
+  uint64_t mask;
+  /// The process causing the event.
+  pid_t pid;
+
+  FanotifyEventContext() : mask(0), pid(0) {}
+};
+
+typedef std::shared_ptr<FanotifyEventContext> FanotifyEventContextRef;
+typedef std::shared_ptr<FanotifySubscriptionContext>
+    FanotifySubscriptionContextRef;
+
+/**
+ * @brief A Linux `fanotify` EventPublisher.
+ *
+ * Unlike `inotify`, which requires a watch on every directory, `fanotify`
+ * mount marks report events for an entire filesystem at a fixed kernel cost.
+ * Notification-class mount marks report access, modification, and close
+ * events, but not creation or deletion. A `fanotify` handle requires
+ * CAP_SYS_ADMIN, so the publisher is enabled with --enable_fanotify.
+ *
+ * Uses FanotifySubscriptionContext and FanotifyEventContext.
+ */
+class FanotifyEventPublisher
+    : public EventPublisher<FanotifySubscriptionContext, FanotifyEventContext> {
+  DECLARE_PUBLISHER("fanotify");
+
+ public:
+  /// Create a `fanotify` handle descriptor.
+  Status setUp();
+  /// Mark the mount of each subscription path.
+  void configure();
+  /// Release the `fanotify` handle descriptor.
+  void tearDown();
+  /// The event loop waits on the `fanotify` handle.
+  int getPollHandle() const { return fanotify_handle_; }
+  /// Drain the `fanotify` handle.
+  Status process() { return readEvents(); }
+
+  FanotifyEventPublisher()
+      : EventPublisher(), fanotify_handle_(-1) {}
+
+  /// Check if the `fanotify` handle is alive.
+  bool isHandleOpen() { return fanotify_handle_ > 0; }
+
+ private:
+  /// Read from the non-blocking `fanotify` handle until it is empty.
+  Status readEvents();
+  /// Fire each event within a read buffer.
+  void processEvents(char* buffer, size_t size);
+  /// Create an event context, resolving and closing the event descriptor.
+  FanotifyEventContextRef createEventContextFrom(
+      const struct fanotify_event_metadata* event);
+  /// Given a SubscriptionContext and FanotifyEventContext match path and mask.
+  bool shouldFire(const FanotifySubscriptionContextRef& sc,
+                  const FanotifyEventContextRef& ec) const;
+  /// Select Subscription%s by the event path using the path index.
+  bool matchSubscriptions(const EventContextRef& ec,
+                          SubscriptionVector& matches) const;
+
+ private:
+  int fanotify_handle_;
+  /// The read buffer for event metadata.
+  std::vector<char> buffer_;
+  /// Paths whose mount is marked, with the marked mask.
+  std::map<std::string, uint64_t> marks_;
+  /// Subscription%s indexed by path, rebuilt in configure.
+  SubscriptionPathIndex index_;
+
+ private:
+  FRIEND_TEST(FanotifyTests, test_fanotify_should_fire);
+  FRIEND_TEST(FanotifyTests, test_fanotify_subscription_index);
+};
+}
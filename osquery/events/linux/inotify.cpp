@@ -8,21 +8,44 @@
  *
  */
 
-#include <sstream>
+#include <algorithm>
+#include <chrono>
+
+#include <errno.h>
+#include <unistd.h>
 
 #include <linux/limits.h>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
 #include "osquery/events/linux/inotify.h"
 
 namespace osquery {
 
-int kINotifyMLatency = 200;
+FLAG(uint64,
+     inotify_buffer_kb,
+     64,
+     "Size of the buffer for each read of the inotify handle (KB)");
+
+FLAG(uint64,
+     inotify_crawl_rate,
+     1000,
+     "Directories per second added to recursive inotify watches");
+
+/// Interval between steps of the recursive watch crawl (ms).
+const int kINotifyCrawlInterval = 100;
 
-static const uint32_t BUFFER_SIZE =
-    (10 * ((sizeof(struct inotify_event)) + NAME_MAX + 1));
+/// Directories crawled immediately when a subscription is configured.
+const size_t kINotifyCrawlInline = 64;
+
+/// Events every watch needs to maintain recursive and moved watches.
+const uint32_t kINotifyWatchMask = IN_CREATE | IN_DELETE_SELF | IN_MOVE_SELF;
+
+/// A read buffer must hold at least one event with the longest name.
+static const size_t kINotifyMinBufferSize =
+    sizeof(struct inotify_event) + NAME_MAX + 1;
 
 std::map<int, std::string> kMaskActions = {
     {IN_ACCESS, "ACCESSED"},
@@ -39,27 +62,57 @@ std::map<int, std::string> kMaskActions = {
 REGISTER(INotifyEventPublisher, "event_publisher", "inotify");
 
 Status INotifyEventPublisher::setUp() {
-  inotify_handle_ = ::inotify_init();
+  inotify_handle_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
   // If this does not work throw an exception.
   if (inotify_handle_ == -1) {
     return Status(1, "Could not init inotify");
   }
+
+  buffer_.resize(std::max(kINotifyMinBufferSize,
+                          (size_t)FLAGS_inotify_buffer_kb * 1024));
   return Status(0, "OK");
 }
 
 void INotifyEventPublisher::configure() {
+  boost::lock_guard<boost::recursive_mutex> lock(monitor_lock_);
+  mask_paths_.clear();
+  for (const auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    mask_paths_.push_back(std::make_pair(sc->path, sc->mask));
+  }
+
+  SubscriptionPathIndex index;
   for (const auto& sub : subscriptions_) {
     // Anytime a configure is called, try to monitor all subscriptions.
     // Configure is called as a response to removing/adding subscriptions.
     // This means recalculating all monitored paths.
     auto sc = getSubscriptionContext(sub->context);
     addMonitor(sc->path, sc->recursive);
+    // Non-recursive subscriptions only fire for their exact path.
+    index.add(sc->path, sc->recursive, sub);
+  }
+  index_.swap(index);
+
+  // Existing watches may need a wider or narrower mask.
+  for (const auto& watched : descriptor_nodes_) {
+    paths_.getPath(watched.second, path_buffer_);
+    auto mask = watchMask(path_buffer_);
+    if (watch_masks_[watched.first] != mask &&
+        ::inotify_add_watch(getHandle(), path_buffer_.c_str(), mask) != -1) {
+      watch_masks_[watched.first] = mask;
+    }
   }
+
+  // Small recursive subscriptions are watched before configure returns, the
+  // event loop crawls the remaining directories.
+  crawl(kINotifyCrawlInline);
 }
 
 void INotifyEventPublisher::tearDown() {
-  ::close(inotify_handle_);
-  inotify_handle_ = -1;
+  if (inotify_handle_ != -1) {
+    ::close(inotify_handle_);
+    inotify_handle_ = -1;
+  }
 }
 
 Status INotifyEventPublisher::restartMonitoring(){
@@ -68,40 +121,144 @@ Status INotifyEventPublisher::restartMonitoring(){
   }
   last_restart_ = getUnixTime();
   VLOG(1) << "inotify was overflown, attempting to restart handle";
-  for(const auto& desc : descriptors_){
+  boost::lock_guard<boost::recursive_mutex> lock(monitor_lock_);
+  std::vector<int> descriptors;
+  for (const auto& watched : descriptor_nodes_) {
+    descriptors.push_back(watched.first);
+  }
+  for (const auto& desc : descriptors) {
     removeMonitor(desc, 1);
   }
-  path_descriptors_.clear();
-  descriptor_paths_.clear();
+  paths_.clear();
+  descriptor_nodes_.clear();
+  watch_masks_.clear();
+  crawl_queue_.clear();
+  failed_.clear();
   configure();
   return Status(0, "OK");
 }
 
-Status INotifyEventPublisher::run() {
-  // Get a while wrapper for free.
-  char buffer[BUFFER_SIZE];
-  fd_set set;
+size_t INotifyEventPublisher::crawl(size_t max) {
+  boost::lock_guard<boost::recursive_mutex> lock(monitor_lock_);
+  size_t count = 0;
+  while (!crawl_queue_.empty() && count < max) {
+    auto path = crawl_queue_.front();
+    crawl_queue_.pop_front();
+    auto node = paths_.find(path);
+    if (paths_.getWatch(node) == -1 || paths_.isCrawled(node)) {
+      // A previous configure already watched this directory's children, or
+      // the directory is no longer watched.
+      continue;
+    }
+    paths_.setCrawled(node, true);
+    count++;
 
-  FD_ZERO(&set);
-  FD_SET(getHandle(), &set);
+    std::vector<std::string> children;
+    listDirectoriesInDirectory(path, children);
+    for (const auto& child : children) {
+      addMonitor(child, true);
+    }
+  }
+  return crawl_queue_.size();
+}
 
-  struct timeval timeout = {3, 3000};
-  int selector = ::select(getHandle() + 1, &set, nullptr, nullptr, &timeout);
-  if (selector == -1) {
-    LOG(ERROR) << "Could not read inotify handle";
-    return Status(1, "INotify handle failed");
+std::vector<INotifyWatchStatus> INotifyEventPublisher::watchStatus() {
+  boost::lock_guard<boost::recursive_mutex> lock(monitor_lock_);
+  std::vector<INotifyWatchStatus> statuses;
+  for (const auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    INotifyWatchStatus status;
+    status.path = sc->path;
+    status.recursive = sc->recursive;
+    if (!sc->recursive) {
+      status.watches = (paths_.getWatch(sc->path) != -1) ? 1 : 0;
+      status.failed = failed_.count(sc->path);
+      statuses.push_back(status);
+      continue;
+    }
+
+    // Count the watches below the path's node, the children of "/tmp/" are
+    // below the "/tmp" node.
+    auto root = sc->path;
+    if (!root.empty() && root.back() == '/') {
+      root.pop_back();
+    }
+    auto root_node = paths_.find(root);
+    for (const auto& watched : descriptor_nodes_) {
+      if (paths_.isWithin(watched.second, root_node)) {
+        status.watches++;
+      }
+    }
+
+    // Failed paths are ordered, count the range below the path.
+    for (auto it = failed_.lower_bound(sc->path);
+         it != failed_.end() && it->find(sc->path) == 0;
+         ++it) {
+      status.failed++;
+    }
+    for (const auto& pending : crawl_queue_) {
+      if (pending.find(sc->path) == 0 &&
+          !paths_.isCrawled(paths_.find(pending))) {
+        status.pending++;
+      }
+    }
+    statuses.push_back(status);
   }
+  return statuses;
+}
 
-  if (selector == 0) {
-    // Read timeout.
-    return Status(0, "Continue");
+int INotifyEventPublisher::getPollTimeout() {
+  // Wake to fire held events, and for each step of a pending crawl.
+  int timeout = coalescer_.nextExpire();
+  if (hasPendingCrawl()) {
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - last_crawl_).count();
+    int crawl = std::max(0, kINotifyCrawlInterval - (int)elapsed);
+    timeout = (timeout == -1) ? crawl : std::min(timeout, crawl);
   }
-  ssize_t record_num = ::read(getHandle(), buffer, BUFFER_SIZE);
-  if (record_num == 0 || record_num == -1) {
-    return Status(1, "INotify read failed");
+  return timeout;
+}
+
+Status INotifyEventPublisher::process() {
+  fireCoalesced();
+  if (hasPendingCrawl()) {
+    auto now = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       now - last_crawl_).count();
+    if (elapsed >= kINotifyCrawlInterval) {
+      // Each crawl step adds a rate-limited number of directories.
+      crawl(std::max((size_t)1,
+                     (size_t)FLAGS_inotify_crawl_rate * kINotifyCrawlInterval /
+                         1000));
+      last_crawl_ = now;
+    }
   }
+  return readEvents();
+}
 
-  for (char* p = buffer; p < buffer + record_num;) {
+Status INotifyEventPublisher::readEvents() {
+  while (!isEnding()) {
+    ssize_t record_num = ::read(getHandle(), buffer_.data(), buffer_.size());
+    if (record_num == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // The handle is drained.
+      return Status(0, "OK");
+    } else if (record_num == -1 && errno == EINTR) {
+      continue;
+    } else if (record_num <= 0) {
+      return Status(1, "INotify read failed");
+    }
+
+    auto status = processEvents(buffer_.data(), record_num);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status INotifyEventPublisher::processEvents(char* buffer, size_t size) {
+  boost::lock_guard<boost::recursive_mutex> lock(monitor_lock_);
+  for (char* p = buffer; p < buffer + size;) {
     // Cast the inotify struct, make shared pointer, and append to contexts.
     auto event = reinterpret_cast<struct inotify_event*>(p);
     if (event->mask & IN_Q_OVERFLOW) {
@@ -131,9 +288,7 @@ Status INotifyEventPublisher::run() {
     // Continue to iterate
     p += (sizeof(struct inotify_event)) + event->len;
   }
-
-  osquery::publisherSleep(kINotifyMLatency);
-  return Status(0, "Continue");
+  return Status(0, "OK");
 }
 
 INotifyEventContextRef INotifyEventPublisher::createEventContextFrom(
@@ -142,13 +297,18 @@ INotifyEventContextRef INotifyEventPublisher::createEventContextFrom(
   auto ec = createEventContext();
   ec->event = shared_event;
 
-  // Get the pathname the watch fired on.
-  std::ostringstream path;
-  path << descriptor_paths_[event->wd];
+  // Rebuild the pathname the watch fired on.
+  auto watched = descriptor_nodes_.find(event->wd);
+  if (watched != descriptor_nodes_.end()) {
+    paths_.getPath(watched->second, path_buffer_);
+  } else {
+    path_buffer_.clear();
+  }
   if (event->len > 1) {
-    path << "/" << event->name;
+    path_buffer_.push_back('/');
+    path_buffer_.append(event->name);
   }
-  ec->path = path.str();
+  ec->path = path_buffer_;
   for (const auto& action : kMaskActions) {
     if (event->mask & action.first) {
       ec->action = action.second;
@@ -158,6 +318,45 @@ INotifyEventContextRef INotifyEventPublisher::createEventContextFrom(
   return ec;
 }
 
+bool INotifyEventPublisher::matchSubscriptions(
+    const EventContextRef& ec, SubscriptionVector& matches) const {
+  if (ec == nullptr || index_.size() != subscriptions_.size()) {
+    // Subscriptions were added without a configure, check each.
+    return false;
+  }
+  index_.match(getEventContext(ec)->path, matches);
+  return true;
+}
+
+void INotifyEventPublisher::fireCallback(const SubscriptionRef& sub,
+                                         const EventContextRef& ec) const {
+  auto pub_ec = getEventContext(ec);
+  if (pub_ec->subscription != nullptr) {
+    // A held event was already coalesced by this Subscription.
+    if (pub_ec->subscription == sub.get()) {
+      EventPublisher::fireCallback(sub, ec);
+    }
+    return;
+  }
+
+  auto sc = getSubscriptionContext(sub->context);
+  if (sc->coalesce > 0) {
+    if (shouldFire(sc, pub_ec) && sub->callback != nullptr &&
+        coalescer_.hold(sub, pub_ec, sc->coalesce)) {
+      // The event loop may be waiting longer than the new event's window.
+      EventFactory::wake();
+    }
+    return;
+  }
+  EventPublisher::fireCallback(sub, ec);
+}
+
+void INotifyEventPublisher::fireCoalesced() {
+  for (const auto& ec : coalescer_.expire()) {
+    fire(ec);
+  }
+}
+
 bool INotifyEventPublisher::shouldFire(const INotifySubscriptionContextRef& sc,
                                        const INotifyEventContextRef& ec) const {
   if (!sc->recursive && sc->path != ec->path) {
@@ -179,46 +378,69 @@ bool INotifyEventPublisher::shouldFire(const INotifySubscriptionContextRef& sc,
 
 bool INotifyEventPublisher::addMonitor(const std::string& path,
                                        bool recursive) {
+  boost::lock_guard<boost::recursive_mutex> lock(monitor_lock_);
   if (!isPathMonitored(path)) {
-    int watch = ::inotify_add_watch(getHandle(), path.c_str(), IN_ALL_EVENTS);
+    auto mask = watchMask(path);
+    int watch = ::inotify_add_watch(getHandle(), path.c_str(), mask);
     if (watch == -1) {
       LOG(ERROR) << "Could not add inotify watch on: " << path;
+      failed_.insert(path);
       return false;
     }
 
-    // Keep a list of the watch descriptors
-    descriptors_.push_back(watch);
-    // Keep a map of the path -> watch descriptor
-    path_descriptors_[path] = watch;
-    // Keep a map of the opposite (descriptor -> path)
-    descriptor_paths_[watch] = path;
+    // Keep the path's node for each watch descriptor.
+    descriptor_nodes_[watch] = paths_.setWatch(path, watch);
+    watch_masks_[watch] = mask;
   }
 
-  if (recursive && isDirectory(path).ok()) {
-    std::vector<std::string> children;
-    // Get a list of children of this directory (requesed recursive watches).
-    listDirectoriesInDirectory(path, children);
-
-    for (const auto& child : children) {
-      addMonitor(child, recursive);
-    }
+  if (recursive && !paths_.isCrawled(paths_.find(path)) &&
+      isDirectory(path).ok()) {
+    // Children of this directory are watched incrementally by the crawl.
+    crawl_queue_.push_back(path);
   }
 
   return true;
 }
 
+/// Check if a path is at or below a directory path.
+inline bool isPathWithin(const std::string& directory, const std::string& path) {
+  if (path.compare(0, directory.size(), directory) != 0) {
+    return false;
+  }
+  return path.size() == directory.size() || directory.empty() ||
+         directory.back() == '/' ||
+         path[directory.size()] == '/';
+}
+
+uint32_t INotifyEventPublisher::watchMask(const std::string& path) const {
+  uint32_t mask = 0;
+  for (const auto& subscription : mask_paths_) {
+    // A watch reports its path and a directory's children, so subscriptions
+    // above or below the watched path may use its events.
+    if (!isPathWithin(subscription.first, path) &&
+        !isPathWithin(path, subscription.first)) {
+      continue;
+    }
+    if (subscription.second == 0) {
+      return IN_ALL_EVENTS;
+    }
+    mask |= subscription.second;
+  }
+  return (mask == 0) ? IN_ALL_EVENTS : (mask | kINotifyWatchMask);
+}
+
 bool INotifyEventPublisher::removeMonitor(const std::string& path, bool force) {
+  boost::lock_guard<boost::recursive_mutex> lock(monitor_lock_);
   // If force then remove from INotify, otherwise cleanup file descriptors.
-  if (path_descriptors_.find(path) == path_descriptors_.end()) {
+  auto node = paths_.find(path);
+  int watch = paths_.getWatch(node);
+  if (watch == -1) {
     return false;
   }
 
-  int watch = path_descriptors_[path];
-  path_descriptors_.erase(path);
-  descriptor_paths_.erase(watch);
-
-  auto position = std::find(descriptors_.begin(), descriptors_.end(), watch);
-  descriptors_.erase(position);
+  paths_.removeWatch(node);
+  descriptor_nodes_.erase(watch);
+  watch_masks_.erase(watch);
 
   if (force) {
     ::inotify_rm_watch(getHandle(), watch);
@@ -227,18 +449,29 @@ bool INotifyEventPublisher::removeMonitor(const std::string& path, bool force) {
 }
 
 bool INotifyEventPublisher::removeMonitor(int watch, bool force) {
-  if (descriptor_paths_.find(watch) == descriptor_paths_.end()) {
+  boost::lock_guard<boost::recursive_mutex> lock(monitor_lock_);
+  auto watched = descriptor_nodes_.find(watch);
+  if (watched == descriptor_nodes_.end()) {
     return false;
   }
 
-  auto path = descriptor_paths_[watch];
-  return removeMonitor(path, force);
+  if (paths_.getWatch(watched->second) == watch) {
+    paths_.removeWatch(watched->second);
+  }
+  descriptor_nodes_.erase(watched);
+  watch_masks_.erase(watch);
+
+  if (force) {
+    ::inotify_rm_watch(getHandle(), watch);
+  }
+  return true;
 }
 
 bool INotifyEventPublisher::isPathMonitored(const std::string& path) {
+  boost::lock_guard<boost::recursive_mutex> lock(monitor_lock_);
   boost::filesystem::path parent_path;
   if (!isDirectory(path).ok()) {
-    if (path_descriptors_.find(path) != path_descriptors_.end()) {
+    if (paths_.getWatch(path) != -1) {
       // Path is a file, and is directly monitored.
       return true;
     }
@@ -251,7 +484,6 @@ bool INotifyEventPublisher::isPathMonitored(const std::string& path) {
   }
 
   // Directory or parent of file monitoring
-  auto path_iterator = path_descriptors_.find(parent_path.string());
-  return (path_iterator != path_descriptors_.end());
+  return (paths_.getWatch(parent_path.string()) != -1);
 }
 }
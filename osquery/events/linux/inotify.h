@@ -10,14 +10,24 @@
 
 #pragma once
 
+#include <chrono>
+#include <deque>
 #include <map>
+#include <set>
+#include <unordered_map>
 #include <vector>
 
 #include <sys/inotify.h>
 #include <sys/stat.h>
 
+#include <boost/thread/recursive_mutex.hpp>
+
 #include <osquery/events.h>
 
+#include "osquery/events/event_coalescer.h"
+#include "osquery/events/path_table.h"
+#include "osquery/events/subscription_index.h"
+
 namespace osquery {
 
 extern std::map<int, std::string> kMaskActions;
@@ -41,8 +51,10 @@ struct INotifySubscriptionContext : public SubscriptionContext {
   uint32_t mask;
   /// Treat this path as a directory and subscription recursively.
   bool recursive;
+  /// Coalesce events with the same path and action for this many ms (if not 0).
+  size_t coalesce;
 
-  INotifySubscriptionContext() : mask(0), recursive(false) {}
+  INotifySubscriptionContext() : mask(0), recursive(false), coalesce(0) {}
 
   /**
    * @brief Helper method to map a string action to `inotify` action mask bit.
@@ -80,10 +92,28 @@ typedef std::shared_ptr<INotifyEventContext> INotifyEventContextRef;
 typedef std::shared_ptr<INotifySubscriptionContext>
     INotifySubscriptionContextRef;
 
-// Thread-safe containers
-typedef std::vector<int> DescriptorVector;
-typedef std::map<std::string, int> PathDescriptorMap;
-typedef std::map<int, std::string> DescriptorPathMap;
+/**
+ * @brief The progress of watching a subscription path.
+ *
+ * Recursive subscriptions are watched incrementally, the pending directories
+ * have a watch but their children are not yet watched.
+ */
+struct INotifyWatchStatus {
+  std::string path;
+  bool recursive;
+  /// Watched paths at or below the subscription path.
+  size_t watches;
+  /// Directories waiting for the crawl.
+  size_t pending;
+  /// Paths that could not be watched.
+  size_t failed;
+
+  INotifyWatchStatus()
+      : recursive(false), watches(0), pending(0), failed(0) {}
+};
+
+/// The watched path node of each watch descriptor.
+typedef std::unordered_map<int, PathTable::NodeID> DescriptorNodeMap;
 
 /**
  * @brief A Linux `inotify` EventPublisher.
@@ -108,40 +138,115 @@ class INotifyEventPublisher
   /// Release the `inotify` handle descriptor.
   void tearDown();
 
-  Status run();
+  /// The event loop waits on the `inotify` handle.
+  int getPollHandle() const { return inotify_handle_; }
+  /// Fire held events, step the crawl, and drain the `inotify` handle.
+  Status process();
+  /// Milliseconds until a held event expires or the next crawl step.
+  int getPollTimeout();
 
   INotifyEventPublisher()
       : EventPublisher(), inotify_handle_(-1), last_restart_(-1) {}
+  /// The number of events held for coalescing Subscription%s.
+  size_t numCoalesced() const { return coalescer_.size(); }
+
   /// Check if the application-global `inotify` handle is alive.
   bool isHandleOpen() { return inotify_handle_ > 0; }
 
+  /// Report the watch coverage of each Subscription.
+  std::vector<INotifyWatchStatus> watchStatus();
+
  private:
   INotifyEventContextRef createEventContextFrom(struct inotify_event* event);
+  /// Read from the non-blocking `inotify` handle until it is empty.
+  Status readEvents();
+  /// Fire each event within a read buffer.
+  Status processEvents(char* buffer, size_t size);
   /// Check all added Subscription%s for a path.
   bool isPathMonitored(const std::string& path);
   /// Add an INotify watch (monitor) on this path.
   bool addMonitor(const std::string& path, bool recursive);
+  /**
+   * @brief The union of the masks of Subscription%s using a watched path.
+   *
+   * Only these events are read from the kernel, events for other actions are
+   * never queued. Subscriptions without a mask use every event.
+   */
+  uint32_t watchMask(const std::string& path) const;
   /// Remove an INotify watch (monitor) from our tracking.
   bool removeMonitor(const std::string& path, bool force = false);
   bool removeMonitor(int watch, bool force = false);
   /// Given a SubscriptionContext and INotifyEventContext match path and action.
   bool shouldFire(const INotifySubscriptionContextRef& mc,
                   const INotifyEventContextRef& ec) const;
+  /// Select Subscription%s by the event path using the path index.
+  bool matchSubscriptions(const EventContextRef& ec,
+                          SubscriptionVector& matches) const;
+  /// Hold events for coalescing Subscription%s, fire held events to only
+  /// the Subscription that held them.
+  void fireCallback(const SubscriptionRef& sub,
+                    const EventContextRef& ec) const;
+  /// Fire the held events whose coalescing window passed.
+  void fireCoalesced();
   /// Get the INotify file descriptor.
   int getHandle() { return inotify_handle_; }
   /// Get the number of actual INotify active descriptors.
-  int numDescriptors() { return descriptors_.size(); }
+  int numDescriptors() { return descriptor_nodes_.size(); }
+  /// The watch descriptor of a path, -1 if the path is not watched.
+  int getWatch(const std::string& path) const { return paths_.getWatch(path); }
   /// If we overflow, try and restart the monitor
   Status restartMonitoring();
 
-  // Consider an event queue if separating buffering from firing/servicing.
-  DescriptorVector descriptors_;
-  PathDescriptorMap path_descriptors_;
-  DescriptorPathMap descriptor_paths_;
+  /**
+   * @brief Watch the children of pending recursive directories.
+   *
+   * Recursive watches are added breadth-first, each newly watched directory
+   * is appended to the crawl. Directories already crawled are skipped.
+   *
+   * @param max The maximum number of directories to list.
+   *
+   * @return The number of directories still pending.
+   */
+  size_t crawl(size_t max);
+
+  /// Check if recursive watches are still being added.
+  bool hasPendingCrawl() {
+    boost::lock_guard<boost::recursive_mutex> lock(monitor_lock_);
+    return !crawl_queue_.empty();
+  }
+
+  /// The watched paths, interned by component.
+  PathTable paths_;
+  /// The path node of each watch descriptor.
+  DescriptorNodeMap descriptor_nodes_;
+  /// The event mask installed for each watch descriptor.
+  std::unordered_map<int, uint32_t> watch_masks_;
+  /// Event paths are rebuilt into this buffer.
+  std::string path_buffer_;
+  /// Each Subscription's path and mask, copied in configure for watchMask.
+  std::vector<std::pair<std::string, uint32_t>> mask_paths_;
   int inotify_handle_;
   int last_restart_;
+  /// The last step of the recursive watch crawl.
+  std::chrono::steady_clock::time_point last_crawl_;
+  /// The read buffer, sized by the inotify_buffer_kb flag.
+  std::vector<char> buffer_;
+  /// Subscription%s indexed by path, rebuilt in configure.
+  SubscriptionPathIndex index_;
+  /// Watched directories whose children have not been watched.
+  std::deque<std::string> crawl_queue_;
+  /// Paths that could not be watched.
+  std::set<std::string> failed_;
+  /// Configure and the event loop both change the watches.
+  boost::recursive_mutex monitor_lock_;
+  /// Events held by the dispatch thread for coalescing Subscription%s.
+  mutable EventCoalescer<INotifyEventContext> coalescer_;
 
  public:
   FRIEND_TEST(INotifyTests, test_inotify_optimization);
+  FRIEND_TEST(INotifyTests, test_inotify_subscription_index);
+  FRIEND_TEST(INotifyTests, test_inotify_crawl);
+  FRIEND_TEST(INotifyTests, test_inotify_coalesce);
+  FRIEND_TEST(INotifyTests, test_inotify_watch_mask);
 };
 }
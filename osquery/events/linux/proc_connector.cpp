@@ -0,0 +1,264 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+#include <linux/connector.h>
+#include <linux/netlink.h>
+
+#include <boost/algorithm/string/trim.hpp>
+
+#include <osquery/core.h>
+#include <osquery/filesystem.h>
+#include <osquery/logger.h>
+
+#include "osquery/events/linux/proc_connector.h"
+
+namespace osquery {
+
+/// The process events reported when a subscription does not supply a mask.
+const uint32_t kProcConnectorDefaultMask = proc_event::PROC_EVENT_FORK |
+                                           proc_event::PROC_EVENT_EXEC |
+                                           proc_event::PROC_EVENT_EXIT;
+
+/// Each read returns a single netlink message, the buffer fits the largest.
+const size_t kProcConnectorBufferSize = 4096;
+
+/// Request a larger socket buffer to absorb fork bursts between reads.
+const int kProcConnectorSocketBuffer = 1024 * 1024;
+
+std::map<uint32_t, std::string> kProcConnectorActions = {
+    {proc_event::PROC_EVENT_FORK, "fork"},
+    {proc_event::PROC_EVENT_EXEC, "exec"},
+    {proc_event::PROC_EVENT_EXIT, "exit"},
+};
+
+REGISTER(ProcConnectorEventPublisher, "event_publisher", "proc_connector");
+
+Status ProcConnectorEventPublisher::setUp() {
+  socket_ = ::socket(PF_NETLINK,
+                     SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                     NETLINK_CONNECTOR);
+  if (socket_ == -1) {
+    return Status(1, "Could not create netlink connector socket");
+  }
+
+  // The kernel caps the buffer at net.core.rmem_max, a failure is not fatal.
+  ::setsockopt(socket_,
+               SOL_SOCKET,
+               SO_RCVBUF,
+               &kProcConnectorSocketBuffer,
+               sizeof(kProcConnectorSocketBuffer));
+
+  struct sockaddr_nl address;
+  memset(&address, 0, sizeof(address));
+  address.nl_family = AF_NETLINK;
+  address.nl_groups = CN_IDX_PROC;
+  address.nl_pid = 0;
+  if (::bind(socket_, (struct sockaddr*)&address, sizeof(address)) == -1) {
+    tearDown();
+    return Status(1, "Could not bind netlink connector socket");
+  }
+
+  // Listening to the connector requires CAP_NET_ADMIN.
+  auto status = control(PROC_CN_MCAST_LISTEN);
+  if (!status.ok()) {
+    tearDown();
+    return status;
+  }
+
+  buffer_.resize(kProcConnectorBufferSize);
+  return Status(0, "OK");
+}
+
+Status ProcConnectorEventPublisher::control(enum proc_cn_mcast_op op) {
+  char message[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(op))];
+  memset(message, 0, sizeof(message));
+
+  auto header = reinterpret_cast<struct nlmsghdr*>(message);
+  header->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+  header->nlmsg_type = NLMSG_DONE;
+  header->nlmsg_pid = ::getpid();
+
+  auto cn = reinterpret_cast<struct cn_msg*>(NLMSG_DATA(header));
+  cn->id.idx = CN_IDX_PROC;
+  cn->id.val = CN_VAL_PROC;
+  cn->len = sizeof(op);
+  memcpy(cn->data, &op, sizeof(op));
+
+  if (::send(socket_, header, header->nlmsg_len, 0) == -1) {
+    return Status(1, "Could not send netlink connector control");
+  }
+  return Status(0, "OK");
+}
+
+void ProcConnectorEventPublisher::tearDown() {
+  if (socket_ != -1) {
+    control(PROC_CN_MCAST_IGNORE);
+  }
+
+  if (socket_ != -1) {
+    ::close(socket_);
+    socket_ = -1;
+  }
+}
+
+Status ProcConnectorEventPublisher::readEvents() {
+  while (!isEnding()) {
+    struct sockaddr_nl sender;
+    socklen_t sender_size = sizeof(sender);
+    ssize_t size = ::recvfrom(socket_,
+                              buffer_.data(),
+                              buffer_.size(),
+                              0,
+                              (struct sockaddr*)&sender,
+                              &sender_size);
+    if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // The socket is drained.
+      return Status(0, "OK");
+    } else if (size == -1 && errno == EINTR) {
+      continue;
+    } else if (size == -1 && errno == ENOBUFS) {
+      // Events were lost, the listener remains and reporting continues.
+      LOG(WARNING) << "Netlink connector socket buffer overflowed";
+      continue;
+    } else if (size <= 0) {
+      return Status(1, "Netlink read failed");
+    }
+
+    if (sender.nl_pid != 0) {
+      // Only the kernel publishes process events.
+      continue;
+    }
+    processEvents(buffer_.data(), size);
+  }
+  return Status(0, "OK");
+}
+
+void ProcConnectorEventPublisher::processEvents(const char* buffer,
+                                                size_t size) {
+  auto header = reinterpret_cast<const struct nlmsghdr*>(buffer);
+  size_t remaining = size;
+  for (; NLMSG_OK(header, remaining); header = NLMSG_NEXT(header, remaining)) {
+    if (header->nlmsg_type == NLMSG_NOOP) {
+      continue;
+    } else if (header->nlmsg_type == NLMSG_ERROR ||
+               header->nlmsg_type == NLMSG_OVERRUN) {
+      LOG(WARNING) << "Unexpected netlink connector message";
+      return;
+    }
+
+    if (header->nlmsg_len <
+        NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(struct proc_event))) {
+      continue;
+    }
+
+    auto cn = reinterpret_cast<const struct cn_msg*>(NLMSG_DATA(header));
+    if (cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC) {
+      continue;
+    }
+
+    auto ec = createEventContextFrom(
+        reinterpret_cast<const struct proc_event*>(cn->data));
+    if (ec != nullptr) {
+      fire(ec);
+    }
+  }
+}
+
+/// Read the parent and real user ID from /proc/<pid>/status.
+static void getProcStatus(pid_t pid, pid_t& parent, std::string& uid) {
+  std::string content;
+  auto path = "/proc/" + std::to_string(pid) + "/status";
+  if (!readFile(path, content).ok()) {
+    return;
+  }
+
+  for (const auto& line : osquery::split(content, "\n")) {
+    // Status lines are formatted: Key: Value....\n.
+    auto detail = osquery::split(line, ":", 1);
+    if (detail.size() != 2) {
+      continue;
+    }
+
+    if (detail.at(0) == "PPid") {
+      parent = std::atoi(detail.at(1).c_str());
+    } else if (detail.at(0) == "Uid") {
+      // Format is: R E - -
+      auto uid_detail = osquery::split(detail.at(1), "\t");
+      if (uid_detail.size() == 4) {
+        uid = uid_detail.at(0);
+      }
+    }
+  }
+}
+
+ProcConnectorEventContextRef
+ProcConnectorEventPublisher::createEventContextFrom(
+    const struct proc_event* event) {
+  auto ec = createEventContext();
+  ec->what = event->what;
+  if (event->what == proc_event::PROC_EVENT_FORK) {
+    if (event->event_data.fork.child_pid !=
+        event->event_data.fork.child_tgid) {
+      // A new thread within an existing process.
+      return nullptr;
+    }
+    ec->pid = event->event_data.fork.child_tgid;
+    ec->parent = event->event_data.fork.parent_tgid;
+  } else if (event->what == proc_event::PROC_EVENT_EXEC) {
+    ec->pid = event->event_data.exec.process_tgid;
+
+    // The process may exit before it is read, later reads see the next image.
+    auto pid = std::to_string(ec->pid);
+    char path[PATH_MAX] = {0};
+    auto link = "/proc/" + pid + "/exe";
+    auto length = ::readlink(link.c_str(), path, sizeof(path) - 1);
+    if (length > 0) {
+      ec->path = std::string(path, length);
+    }
+
+    if (readFile("/proc/" + pid + "/cmdline", ec->cmdline).ok()) {
+      // Replace the \0 argument delimiters.
+      std::replace(ec->cmdline.begin(), ec->cmdline.end(), '\0', ' ');
+      boost::algorithm::trim(ec->cmdline);
+    }
+    getProcStatus(ec->pid, ec->parent, ec->uid);
+  } else if (event->what == proc_event::PROC_EVENT_EXIT) {
+    if (event->event_data.exit.process_pid !=
+        event->event_data.exit.process_tgid) {
+      // A thread exited, the process continues.
+      return nullptr;
+    }
+    ec->pid = event->event_data.exit.process_tgid;
+    ec->exit_code = event->event_data.exit.exit_code;
+  } else {
+    // UID, GID, session, and other changes are not reported.
+    return nullptr;
+  }
+
+  ec->action = kProcConnectorActions[event->what];
+  return ec;
+}
+
+bool ProcConnectorEventPublisher::shouldFire(
+    const ProcConnectorSubscriptionContextRef& sc,
+    const ProcConnectorEventContextRef& ec) const {
+  auto mask = (sc->mask != 0) ? sc->mask : kProcConnectorDefaultMask;
+  return (ec->what & mask) != 0;
+}
+}
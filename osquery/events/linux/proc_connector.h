@@ -0,0 +1,128 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include <sys/types.h>
+
+#include <linux/cn_proc.h>
+
+#include <osquery/events.h>
+
+namespace osquery {
+
+extern std::map<uint32_t, std::string> kProcConnectorActions;
+
+/**
+ * @brief Subscription details for ProcConnectorEventPublisher events.
+ *
+ * Events are passed to the EventSubscriber if the process event type is part
+ * of the mask. If the mask is 0 then fork, exec, and exit events are passed.
+ */
+struct ProcConnectorSubscriptionContext : public SubscriptionContext {
+  /// Limit the process events to the subscribed PROC_EVENT_* mask (if not 0).
+  uint32_t mask;
+
+  ProcConnectorSubscriptionContext() : mask(0) {}
+};
+
+/**
+ * @brief Event details for ProcConnectorEventPublisher events.
+ *
+ * Only thread group (process) creation and exit are reported, thread events
+ * are filtered by the publisher. The binary path, arguments, and owner are
+ * read from /proc when the exec event is received, short lived processes may
+ * have exited already and leave these empty.
+ */
+struct ProcConnectorEventContext : public EventContext {
+  /// The PROC_EVENT_* event type.
+  uint32_t what;
+  /// A string action representing the event type.
+  std::string action;
+  /// The process ID, for forks the new child process ID.
+  pid_t pid;
+  /// The parent process ID, known for forks and read from /proc for execs.
+  pid_t parent;
+  /// The process exit code, for exits.
+  uint32_t exit_code;
+
+  /// The binary path, for execs.
+  std::string path;
+  /// The process arguments, for execs.
+  std::string cmdline;
+  /// The process real user ID, for execs.
+  std::string uid;
+
+  ProcConnectorEventContext() : what(0), pid(0), parent(0), exit_code(0) {}
+};
+
+typedef std::shared_ptr<ProcConnectorEventContext> ProcConnectorEventContextRef;
+typedef std::shared_ptr<ProcConnectorSubscriptionContext>
+    ProcConnectorSubscriptionContextRef;
+
+/**
+ * @brief A Linux netlink process connector EventPublisher.
+ *
+ * The kernel multicasts a message for every fork, exec, and exit to listeners
+ * of the CN_IDX_PROC connector. This replaces polling /proc for process
+ * lifecycle changes, the publisher idles in a wait and sees processes that
+ * start and exit between polls. Listening requires CAP_NET_ADMIN, so setUp
+ * fails when osquery is not running as root.
+ *
+ * Uses ProcConnectorSubscriptionContext and ProcConnectorEventContext.
+ */
+class ProcConnectorEventPublisher
+    : public EventPublisher<ProcConnectorSubscriptionContext,
+                            ProcConnectorEventContext> {
+  DECLARE_PUBLISHER("proc_connector");
+
+ public:
+  /// Bind a netlink connector socket and start listening.
+  Status setUp();
+  /// Stop listening and close the socket.
+  void tearDown();
+  /// The event loop waits on the netlink socket.
+  int getPollHandle() const { return socket_; }
+  /// Drain the netlink socket.
+  Status process() { return readEvents(); }
+
+  ProcConnectorEventPublisher()
+      : EventPublisher(), socket_(-1) {}
+
+  /// Check if the netlink socket is alive.
+  bool isSocketOpen() { return socket_ > 0; }
+
+ private:
+  /// Send a PROC_CN_MCAST_* control operation to the connector.
+  Status control(enum proc_cn_mcast_op op);
+  /// Read from the non-blocking socket until it is empty.
+  Status readEvents();
+  /// Fire each process event within a read buffer.
+  void processEvents(const char* buffer, size_t size);
+  /// Create an event context, returns nullptr for thread events.
+  ProcConnectorEventContextRef createEventContextFrom(
+      const struct proc_event* event);
+  /// Given a SubscriptionContext and ProcConnectorEventContext match the mask.
+  bool shouldFire(const ProcConnectorSubscriptionContextRef& sc,
+                  const ProcConnectorEventContextRef& ec) const;
+
+ private:
+  int socket_;
+  /// The read buffer for netlink messages.
+  std::vector<char> buffer_;
+
+ private:
+  FRIEND_TEST(ProcConnectorTests, test_proc_connector_should_fire);
+  FRIEND_TEST(ProcConnectorTests, test_proc_connector_process_events);
+};
+}
@@ -0,0 +1,206 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+#include <osquery/logger.h>
+
+#include "osquery/events/linux/rtnetlink.h"
+
+namespace osquery {
+
+const uint32_t kRtnetlinkGroups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR |
+                                  RTMGRP_IPV6_IFADDR | RTMGRP_IPV4_ROUTE |
+                                  RTMGRP_IPV6_ROUTE | RTMGRP_NEIGH;
+
+/// Each read may return several messages, the kernel fills at most a page.
+const size_t kRtnetlinkBufferSize = 32 * 1024;
+
+/// Request a larger socket buffer to absorb route table floods between reads.
+const int kRtnetlinkSocketBuffer = 1024 * 1024;
+
+REGISTER(RtnetlinkEventPublisher, "event_publisher", "rtnetlink");
+
+Status RtnetlinkEventPublisher::setUp() {
+  socket_ = ::socket(
+      PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (socket_ == -1) {
+    return Status(1, "Could not create netlink route socket");
+  }
+
+  // The kernel caps the buffer at net.core.rmem_max, a failure is not fatal.
+  ::setsockopt(socket_,
+               SOL_SOCKET,
+               SO_RCVBUF,
+               &kRtnetlinkSocketBuffer,
+               sizeof(kRtnetlinkSocketBuffer));
+
+  struct sockaddr_nl address;
+  memset(&address, 0, sizeof(address));
+  address.nl_family = AF_NETLINK;
+  address.nl_groups = kRtnetlinkGroups;
+  if (::bind(socket_, (struct sockaddr*)&address, sizeof(address)) == -1) {
+    tearDown();
+    return Status(1, "Could not bind netlink route socket");
+  }
+
+  buffer_.resize(kRtnetlinkBufferSize);
+  return Status(0, "OK");
+}
+
+void RtnetlinkEventPublisher::tearDown() {
+  bool listening = (socket_ != -1 && !buffer_.empty());
+  if (socket_ != -1) {
+    ::close(socket_);
+    socket_ = -1;
+  }
+
+  if (listening) {
+    // Subscribers mirroring network state cannot trust it anymore.
+    fireNotice(NLMSG_DONE);
+  }
+  buffer_.clear();
+}
+
+Status RtnetlinkEventPublisher::readEvents() {
+  while (!isEnding()) {
+    struct sockaddr_nl sender;
+    socklen_t sender_size = sizeof(sender);
+    ssize_t size = ::recvfrom(socket_,
+                              buffer_.data(),
+                              buffer_.size(),
+                              0,
+                              (struct sockaddr*)&sender,
+                              &sender_size);
+    if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // The socket is drained.
+      return Status(0, "OK");
+    } else if (size == -1 && errno == EINTR) {
+      continue;
+    } else if (size == -1 && errno == ENOBUFS) {
+      // Changes were lost, the listener remains and reporting continues.
+      LOG(WARNING) << "Netlink route socket buffer overflowed";
+      fireNotice(NLMSG_OVERRUN);
+      continue;
+    } else if (size <= 0) {
+      return Status(1, "Netlink read failed");
+    }
+
+    if (sender.nl_pid != 0) {
+      // Only the kernel publishes network changes.
+      continue;
+    }
+    processEvents(buffer_.data(), size);
+  }
+  return Status(0, "OK");
+}
+
+void RtnetlinkEventPublisher::processEvents(const char* buffer, size_t size) {
+  auto header = reinterpret_cast<const struct nlmsghdr*>(buffer);
+  size_t remaining = size;
+  for (; NLMSG_OK(header, remaining); header = NLMSG_NEXT(header, remaining)) {
+    if (header->nlmsg_type == NLMSG_NOOP) {
+      continue;
+    } else if (header->nlmsg_type == NLMSG_ERROR ||
+               header->nlmsg_type == NLMSG_OVERRUN) {
+      LOG(WARNING) << "Unexpected netlink route message";
+      return;
+    }
+
+    auto ec = createEventContextFrom(header);
+    if (ec != nullptr) {
+      fire(ec);
+    }
+  }
+}
+
+void RtnetlinkEventPublisher::fireNotice(uint16_t type) {
+  auto ec = createEventContext();
+  ec->type = type;
+  ec->action = (type == NLMSG_OVERRUN) ? "overrun" : "stopped";
+  fire(ec);
+}
+
+/// The address family of a message's payload, or AF_UNSPEC.
+static int getMessageFamily(const struct nlmsghdr* header, size_t length) {
+  if (header->nlmsg_len < NLMSG_LENGTH(length)) {
+    return AF_UNSPEC;
+  }
+  // Each payload (ifinfomsg, ifaddrmsg, rtmsg, ndmsg) starts with a family.
+  return *reinterpret_cast<const unsigned char*>(NLMSG_DATA(header));
+}
+
+RtnetlinkEventContextRef RtnetlinkEventPublisher::createEventContextFrom(
+    const struct nlmsghdr* header) {
+  auto ec = createEventContext();
+  ec->type = header->nlmsg_type;
+  switch (header->nlmsg_type) {
+  case RTM_NEWLINK:
+  case RTM_DELLINK:
+    if (header->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg))) {
+      return nullptr;
+    }
+    ec->group = RTMGRP_LINK;
+    break;
+  case RTM_NEWADDR:
+  case RTM_DELADDR: {
+    auto family = getMessageFamily(header, sizeof(struct ifaddrmsg));
+    if (family == AF_INET) {
+      ec->group = RTMGRP_IPV4_IFADDR;
+    } else if (family == AF_INET6) {
+      ec->group = RTMGRP_IPV6_IFADDR;
+    }
+    break;
+  }
+  case RTM_NEWROUTE:
+  case RTM_DELROUTE: {
+    auto family = getMessageFamily(header, sizeof(struct rtmsg));
+    if (family == AF_INET) {
+      ec->group = RTMGRP_IPV4_ROUTE;
+    } else if (family == AF_INET6) {
+      ec->group = RTMGRP_IPV6_ROUTE;
+    }
+    break;
+  }
+  case RTM_NEWNEIGH:
+  case RTM_DELNEIGH:
+    if (header->nlmsg_len < NLMSG_LENGTH(sizeof(struct ndmsg))) {
+      return nullptr;
+    }
+    ec->group = RTMGRP_NEIGH;
+    break;
+  }
+
+  if (ec->group == 0) {
+    // Rules, qdiscs, and other families are not reported.
+    return nullptr;
+  }
+
+  // Each RTM_NEW* type is even, followed by its RTM_DEL* type.
+  ec->action = (ec->type % 2 == 0) ? "added" : "removed";
+  auto data = reinterpret_cast<const char*>(header);
+  ec->message.assign(data, data + header->nlmsg_len);
+  return ec;
+}
+
+bool RtnetlinkEventPublisher::shouldFire(
+    const RtnetlinkSubscriptionContextRef& sc,
+    const RtnetlinkEventContextRef& ec) const {
+  if (ec->group == 0) {
+    // Notices are sent to every subscription.
+    return true;
+  }
+  return sc->groups == 0 || (ec->group & sc->groups) != 0;
+}
+}
@@ -0,0 +1,125 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <osquery/events.h>
+
+namespace osquery {
+
+/// The RTMGRP_* multicast groups joined by the publisher.
+extern const uint32_t kRtnetlinkGroups;
+
+/**
+ * @brief Subscription details for RtnetlinkEventPublisher events.
+ *
+ * Events are passed to the EventSubscriber if their RTMGRP_* multicast group
+ * is part of the groups mask. If the mask is 0 then every group is passed.
+ * Overrun and stop notices are passed to every subscription.
+ */
+struct RtnetlinkSubscriptionContext : public SubscriptionContext {
+  /// Limit the events to the subscribed RTMGRP_* groups (if not 0).
+  uint32_t groups;
+
+  RtnetlinkSubscriptionContext() : groups(0) {}
+};
+
+/**
+ * @brief Event details for RtnetlinkEventPublisher events.
+ *
+ * The publisher does not parse the link, address, route, or neighbor, the
+ * message is copied to the context for the subscriber to read. Two notices
+ * carry no message: NLMSG_OVERRUN when the socket buffer overflowed and
+ * changes were lost, and NLMSG_DONE when the publisher stopped listening.
+ */
+struct RtnetlinkEventContext : public EventContext {
+  /// The RTM_* message type, or NLMSG_OVERRUN and NLMSG_DONE notices.
+  uint16_t type;
+  /// The RTMGRP_* multicast group of the message type and family.
+  uint32_t group;
+  /// A string action: added, removed, overrun, or stopped.
+  std::string action;
+  /// A copy of the netlink message, header included.
+  std::vector<char> message;
+
+  RtnetlinkEventContext() : type(0), group(0) {}
+
+  /// The message header, or nullptr for notices.
+  const struct nlmsghdr* header() const {
+    return (message.empty())
+               ? nullptr
+               : reinterpret_cast<const struct nlmsghdr*>(message.data());
+  }
+};
+
+typedef std::shared_ptr<RtnetlinkEventContext> RtnetlinkEventContextRef;
+typedef std::shared_ptr<RtnetlinkSubscriptionContext>
+    RtnetlinkSubscriptionContextRef;
+
+/**
+ * @brief A Linux rtnetlink EventPublisher.
+ *
+ * The kernel multicasts a message to NETLINK_ROUTE listeners when a link,
+ * address, route, or neighbor is added, changed, or removed. Listening to
+ * these groups replaces polling full dumps of the network state tables. Any
+ * user may listen.
+ *
+ * Uses RtnetlinkSubscriptionContext and RtnetlinkEventContext.
+ */
+class RtnetlinkEventPublisher
+    : public EventPublisher<RtnetlinkSubscriptionContext,
+                            RtnetlinkEventContext> {
+  DECLARE_PUBLISHER("rtnetlink");
+
+ public:
+  /// Bind a netlink route socket to the multicast groups.
+  Status setUp();
+  /// Close the socket and notify subscribers that changes are not reported.
+  void tearDown();
+  /// The event loop waits on the netlink socket.
+  int getPollHandle() const { return socket_; }
+  /// Drain the netlink socket.
+  Status process() { return readEvents(); }
+
+  RtnetlinkEventPublisher()
+      : EventPublisher(), socket_(-1) {}
+
+  /// Check if the netlink socket is alive.
+  bool isSocketOpen() { return socket_ > 0; }
+
+ private:
+  /// Read from the non-blocking socket until it is empty.
+  Status readEvents();
+  /// Fire each change within a read buffer.
+  void processEvents(const char* buffer, size_t size);
+  /// Fire a notice without a message.
+  void fireNotice(uint16_t type);
+  /// Create an event context, returns nullptr for unhandled messages.
+  RtnetlinkEventContextRef createEventContextFrom(
+      const struct nlmsghdr* header);
+  /// Given a SubscriptionContext and RtnetlinkEventContext match the groups.
+  bool shouldFire(const RtnetlinkSubscriptionContextRef& sc,
+                  const RtnetlinkEventContextRef& ec) const;
+
+ private:
+  int socket_;
+  /// The read buffer for netlink messages.
+  std::vector<char> buffer_;
+
+ private:
+  FRIEND_TEST(RtnetlinkTests, test_rtnetlink_should_fire);
+  FRIEND_TEST(RtnetlinkTests, test_rtnetlink_process_events);
+};
+}
@@ -0,0 +1,156 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <string.h>
+
+#include <linux/netlink.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/events.h>
+
+#include "osquery/events/linux/audit.h"
+
+namespace osquery {
+
+class AuditTests : public testing::Test {};
+
+/// Build an audit netlink message holding a single record.
+static std::vector<char> createMessage(int type, const std::string& text) {
+  std::vector<char> message(NLMSG_SPACE(text.size()), 0);
+  auto header = reinterpret_cast<struct nlmsghdr*>(message.data());
+  header->nlmsg_len = NLMSG_LENGTH(text.size());
+  header->nlmsg_type = type;
+  memcpy(NLMSG_DATA(header), text.data(), text.size());
+  return message;
+}
+
+TEST_F(AuditTests, test_parse_audit_record) {
+  std::string text =
+      "audit(1364481363.243:24287): arch=c000003e syscall=59 success=yes "
+      "exit=0 ppid=1 pid=100 uid=0 comm=\"ls\" exe=\"/bin/ls\" key=(null)";
+
+  uint64_t serial = 0;
+  EventTime time = 0;
+  AuditRecord record;
+  ASSERT_TRUE(
+      parseAuditRecord(text.c_str(), text.size(), serial, time, record));
+  EXPECT_EQ(serial, 24287U);
+  EXPECT_EQ(time, 1364481363U);
+  EXPECT_EQ(record.fields["syscall"], "59");
+  EXPECT_EQ(record.fields["exe"], "\"/bin/ls\"");
+  EXPECT_EQ(record.fields["key"], "(null)");
+
+  // Records without a header are not parsed.
+  text = "arch=c000003e syscall=59";
+  EXPECT_FALSE(
+      parseAuditRecord(text.c_str(), text.size(), serial, time, record));
+}
+
+TEST_F(AuditTests, test_decode_audit_value) {
+  EXPECT_EQ(decodeAuditValue("\"/bin/ls\""), "/bin/ls");
+  // Strings with spaces are hex encoded.
+  EXPECT_EQ(decodeAuditValue("612062"), "a b");
+  EXPECT_EQ(decodeAuditValue("(null)"), "");
+  EXPECT_EQ(decodeAuditValue("12x"), "12x");
+}
+
+TEST_F(AuditTests, test_audit_assembler) {
+  AuditAssembler assembler(2);
+  std::vector<AuditEventContextRef> completed;
+
+  AuditRecord syscall;
+  syscall.type = AUDIT_SYSCALL;
+  syscall.fields = {{"syscall", "59"}, {"exe", "\"/bin/ls\""}, {"pid", "10"}};
+  AuditRecord execve;
+  execve.type = AUDIT_EXECVE;
+  execve.fields = {{"argc", "3"},
+                   {"a0", "\"ls\""},
+                   {"a1", "612062"},
+                   {"a2[0]", "\"long\""},
+                   {"a2[1]", "\"arg\""}};
+  AuditRecord cwd;
+  cwd.type = AUDIT_CWD;
+  cwd.fields = {{"cwd", "\"/tmp\""}};
+  AuditRecord eoe;
+  eoe.type = AUDIT_EOE;
+
+  // Records of concurrent events interleave.
+  assembler.add(1, 100, syscall, completed);
+  assembler.add(2, 101, syscall, completed);
+  assembler.add(1, 100, execve, completed);
+  assembler.add(1, 100, cwd, completed);
+  EXPECT_EQ(assembler.size(), 2U);
+  EXPECT_TRUE(completed.empty());
+
+  assembler.add(1, 100, eoe, completed);
+  ASSERT_EQ(completed.size(), 1U);
+  auto& ec = completed[0];
+  EXPECT_EQ(ec->serial, 1U);
+  EXPECT_EQ(ec->time, 100U);
+  EXPECT_EQ(ec->syscall, 59);
+  EXPECT_EQ(ec->fields["exe"], "/bin/ls");
+  EXPECT_EQ(ec->fields["pid"], "10");
+  EXPECT_EQ(ec->arguments,
+            std::vector<std::string>({"ls", "a b", "longarg"}));
+  EXPECT_EQ(ec->cwd, "/tmp");
+
+  // When the buffer is full the oldest event is completed.
+  completed.clear();
+  assembler.add(3, 102, syscall, completed);
+  assembler.add(4, 103, syscall, completed);
+  ASSERT_EQ(completed.size(), 1U);
+  EXPECT_EQ(completed[0]->serial, 2U);
+  EXPECT_EQ(assembler.size(), 2U);
+}
+
+class TestAuditEventSubscriber : public EventSubscriber<AuditEventPublisher> {
+ public:
+  TestAuditEventSubscriber() { setName("TestAuditEventSubscriber"); }
+
+  Status init() { return Status(0, "OK"); }
+};
+
+static std::vector<std::string> kAuditTestExes;
+
+static Status TestAuditCallback(const EventContextRef& ec,
+                                const void* user_data) {
+  auto aec = std::static_pointer_cast<AuditEventContext>(ec);
+  kAuditTestExes.push_back(aec->fields["exe"]);
+  return Status(0, "OK");
+}
+
+TEST_F(AuditTests, test_audit_process_events) {
+  auto pub = std::make_shared<AuditEventPublisher>();
+  auto sub = std::make_shared<TestAuditEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
+
+  auto sc = pub->createSubscriptionContext();
+  sc->syscalls = {59};
+  pub->addSubscription(
+      Subscription::create("TestAuditEventSubscriber", sc, TestAuditCallback));
+
+  // An execve is fired when its end of event record arrives.
+  auto message = createMessage(
+      AUDIT_SYSCALL, "audit(1.0:7): syscall=59 exe=\"/bin/ls\" success=yes");
+  pub->processEvents(message.data(), message.size());
+  EXPECT_TRUE(kAuditTestExes.empty());
+  message = createMessage(AUDIT_EOE, "audit(1.0:7): ");
+  pub->processEvents(message.data(), message.size());
+
+  // Other syscalls are not.
+  message = createMessage(AUDIT_SYSCALL, "audit(1.0:8): syscall=42 exe=\"a\"");
+  pub->processEvents(message.data(), message.size());
+  message = createMessage(AUDIT_EOE, "audit(1.0:8): ");
+  pub->processEvents(message.data(), message.size());
+
+  EXPECT_EQ(kAuditTestExes, std::vector<std::string>({"/bin/ls"}));
+}
+}
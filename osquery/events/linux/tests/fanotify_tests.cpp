@@ -0,0 +1,69 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/events.h>
+
+#include "osquery/events/linux/fanotify.h"
+
+namespace osquery {
+
+class FanotifyTests : public testing::Test {};
+
+TEST_F(FanotifyTests, test_fanotify_disabled) {
+  // The publisher requires root and is enabled explicitly.
+  auto pub = std::make_shared<FanotifyEventPublisher>();
+  FLAGS_enable_fanotify = false;
+  auto status = EventFactory::registerEventPublisher(pub);
+  EXPECT_FALSE(status.ok());
+  EXPECT_FALSE(pub->isHandleOpen());
+}
+
+TEST_F(FanotifyTests, test_fanotify_should_fire) {
+  auto pub = std::make_shared<FanotifyEventPublisher>();
+  auto sc = pub->createSubscriptionContext();
+  sc->path = "/etc";
+
+  auto ec = pub->createEventContext();
+  ec->path = "/etc/passwd";
+  ec->mask = FAN_CLOSE_WRITE;
+  EXPECT_TRUE(pub->shouldFire(sc, ec));
+
+  // The default mask does not include reads.
+  ec->mask = FAN_ACCESS;
+  EXPECT_FALSE(pub->shouldFire(sc, ec));
+  sc->mask = FAN_ACCESS;
+  EXPECT_TRUE(pub->shouldFire(sc, ec));
+
+  // The mount mark reports paths outside of the subscription.
+  ec->path = "/var/log/messages";
+  EXPECT_FALSE(pub->shouldFire(sc, ec));
+}
+
+TEST_F(FanotifyTests, test_fanotify_subscription_index) {
+  auto pub = std::make_shared<FanotifyEventPublisher>();
+  auto sc = pub->createSubscriptionContext();
+  sc->path = "/etc";
+  auto etc_subscription = Subscription::create("TestSubscriber", sc);
+  pub->addSubscription(etc_subscription);
+
+  sc = pub->createSubscriptionContext();
+  sc->path = "/var";
+  pub->addSubscription(Subscription::create("TestSubscriber", sc));
+  pub->configure();
+
+  auto ec = pub->createEventContext();
+  ec->path = "/etc/hosts";
+  SubscriptionVector matches;
+  EXPECT_TRUE(pub->matchSubscriptions(ec, matches));
+  EXPECT_EQ(matches, SubscriptionVector({etc_subscription}));
+}
+}
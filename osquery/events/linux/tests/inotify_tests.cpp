@@ -173,6 +173,7 @@ class TestINotifyEventSubscriber
 
     // Normally would call Add here.
     actions_.push_back(ec->action);
+    counts_.push_back(ec->count);
     callback_count_ += 1;
     return Status(0, "OK");
   }
@@ -202,6 +203,7 @@ class TestINotifyEventSubscriber
  public:
   int callback_count_;
   std::vector<std::string> actions_;
+  std::vector<size_t> counts_;
 };
 
 TEST_F(INotifyTests, test_inotify_run) {
@@ -278,6 +280,32 @@ TEST_F(INotifyTests, test_inotify_event_action) {
   StopEventLoop();
 }
 
+TEST_F(INotifyTests, test_inotify_coalesce) {
+  StartEventLoop();
+  auto sub = std::make_shared<TestINotifyEventSubscriber>();
+  sub->init();
+
+  auto sc = sub->GetSubscription(kRealTestPath, 0);
+  sc->coalesce = 100;
+  sub->subscribe(&TestINotifyEventSubscriber::Callback, sc, nullptr);
+
+  TriggerEvent(kRealTestPath);
+  sub->WaitForEvents(kMaxEventLatency, 2);
+  EXPECT_EQ(event_pub_->numCoalesced(), 0U);
+
+  // The repeated updates are coalesced into one event.
+  ASSERT_EQ(sub->actions().size(), 2U);
+  for (size_t i = 0; i < sub->actions().size(); ++i) {
+    if (sub->actions()[i] == "UPDATED") {
+      EXPECT_GE(sub->counts_[i], 2U);
+    } else {
+      EXPECT_EQ(sub->actions()[i], "OPENED");
+      EXPECT_EQ(sub->counts_[i], 1U);
+    }
+  }
+  StopEventLoop();
+}
+
 TEST_F(INotifyTests, test_inotify_optimization) {
   // Assume event type is registered.
   StartEventLoop();
@@ -316,4 +344,114 @@ TEST_F(INotifyTests, test_inotify_recursion) {
   EXPECT_TRUE(sub->count() > 0);
   StopEventLoop();
 }
+
+TEST_F(INotifyTests, test_inotify_end_wakes) {
+  StartEventLoop();
+  SubscriptionAction(kRealTestPath);
+  while (!event_pub_->hasStarted()) {
+    ::usleep(20);
+  }
+
+  // Ending does not wait for the run loop's inotify timeout.
+  auto start = getUnixTime();
+  StopEventLoop();
+  EXPECT_LT(getUnixTime() - start, 2U);
+}
+
+TEST_F(INotifyTests, test_inotify_subscription_index) {
+  auto pub = std::make_shared<INotifyEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+  boost::filesystem::create_directory(kRealTestDir);
+
+  auto mc = std::make_shared<INotifySubscriptionContext>();
+  mc->path = kRealTestDir;
+  mc->recursive = true;
+  auto dir_subscription = Subscription::create("TestSubscriber", mc);
+  EventFactory::addSubscription("inotify", dir_subscription);
+
+  mc = std::make_shared<INotifySubscriptionContext>();
+  mc->path = kRealTestPath;
+  auto file_subscription = Subscription::create("TestSubscriber", mc);
+  EventFactory::addSubscription("inotify", file_subscription);
+
+  // Only the subscriptions along the event path are candidates.
+  auto ec = pub->createEventContext();
+  ec->path = kRealTestSubDirPath;
+  SubscriptionVector matches;
+  EXPECT_TRUE(pub->matchSubscriptions(ec, matches));
+  EXPECT_EQ(matches, SubscriptionVector({dir_subscription}));
+
+  matches.clear();
+  ec->path = kRealTestPath;
+  EXPECT_TRUE(pub->matchSubscriptions(ec, matches));
+  EXPECT_EQ(matches, SubscriptionVector({file_subscription}));
+  EventFactory::deregisterEventPublisher("inotify");
+}
+
+TEST_F(INotifyTests, test_inotify_watch_mask) {
+  auto pub = std::make_shared<INotifyEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+  FILE* fd = fopen(kRealTestPath.c_str(), "w");
+  fclose(fd);
+  boost::filesystem::create_directory(kRealTestDir);
+
+  auto mc = std::make_shared<INotifySubscriptionContext>();
+  mc->path = kRealTestPath;
+  mc->mask = IN_CLOSE_WRITE;
+  EventFactory::addSubscription(
+      "inotify", Subscription::create("TestSubscriber", mc));
+  int watch = pub->getWatch(kRealTestPath);
+  EXPECT_EQ(pub->watch_masks_[watch] & (IN_CLOSE_WRITE | IN_OPEN),
+            (uint32_t)IN_CLOSE_WRITE);
+
+  // The watch's mask is the union of each subscription's mask.
+  mc = std::make_shared<INotifySubscriptionContext>();
+  mc->path = kRealTestPath;
+  mc->mask = IN_MODIFY;
+  EventFactory::addSubscription(
+      "inotify", Subscription::create("TestSubscriber", mc));
+  EXPECT_EQ(pub->watch_masks_[watch] & (IN_CLOSE_WRITE | IN_MODIFY | IN_OPEN),
+            (uint32_t)(IN_CLOSE_WRITE | IN_MODIFY));
+
+  // Subscriptions on other paths do not widen the mask.
+  mc = std::make_shared<INotifySubscriptionContext>();
+  mc->path = kRealTestDir;
+  EventFactory::addSubscription(
+      "inotify", Subscription::create("TestSubscriber", mc));
+  EXPECT_EQ(pub->watch_masks_[watch] & IN_OPEN, 0U);
+  EXPECT_EQ(pub->watch_masks_[pub->getWatch(kRealTestDir)],
+            (uint32_t)IN_ALL_EVENTS);
+  EventFactory::deregisterEventPublisher("inotify");
+}
+
+TEST_F(INotifyTests, test_inotify_crawl) {
+  auto pub = std::make_shared<INotifyEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+  boost::filesystem::create_directories(kRealTestSubDir + "/a/b");
+
+  // Recursive watches are added one directory listing at a time.
+  EXPECT_TRUE(pub->addMonitor(kRealTestDir, true));
+  EXPECT_EQ(pub->numDescriptors(), 1);
+  EXPECT_EQ(pub->crawl(1), 1U);
+  EXPECT_EQ(pub->numDescriptors(), 2);
+  EXPECT_EQ(pub->crawl(10), 0U);
+  EXPECT_EQ(pub->numDescriptors(), 4);
+  EXPECT_FALSE(pub->hasPendingCrawl());
+
+  // Crawled directories are not listed again.
+  pub->addMonitor(kRealTestDir, true);
+  EXPECT_FALSE(pub->hasPendingCrawl());
+
+  auto mc = std::make_shared<INotifySubscriptionContext>();
+  mc->path = kRealTestDir;
+  mc->recursive = true;
+  EventFactory::addSubscription(
+      "inotify", Subscription::create("TestSubscriber", mc));
+  auto statuses = pub->watchStatus();
+  ASSERT_EQ(statuses.size(), 1U);
+  EXPECT_EQ(statuses[0].watches, 4U);
+  EXPECT_EQ(statuses[0].pending, 0U);
+  EXPECT_EQ(statuses[0].failed, 0U);
+  EventFactory::deregisterEventPublisher("inotify");
+}
 }
@@ -0,0 +1,124 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/connector.h>
+#include <linux/netlink.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/events.h>
+
+#include "osquery/events/linux/proc_connector.h"
+
+namespace osquery {
+
+class ProcConnectorTests : public testing::Test {};
+
+/// Build a netlink connector message holding a single process event.
+static std::vector<char> createMessage(const struct proc_event& event) {
+  std::vector<char> message(
+      NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(struct proc_event)), 0);
+  auto header = reinterpret_cast<struct nlmsghdr*>(message.data());
+  header->nlmsg_len =
+      NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(struct proc_event));
+  header->nlmsg_type = NLMSG_DONE;
+
+  auto cn = reinterpret_cast<struct cn_msg*>(NLMSG_DATA(header));
+  cn->id.idx = CN_IDX_PROC;
+  cn->id.val = CN_VAL_PROC;
+  cn->len = sizeof(struct proc_event);
+  memcpy(cn->data, &event, sizeof(event));
+  return message;
+}
+
+TEST_F(ProcConnectorTests, test_proc_connector_should_fire) {
+  auto pub = std::make_shared<ProcConnectorEventPublisher>();
+  auto sc = pub->createSubscriptionContext();
+  auto ec = pub->createEventContext();
+
+  // The default mask includes fork, exec, and exit.
+  ec->what = proc_event::PROC_EVENT_EXIT;
+  EXPECT_TRUE(pub->shouldFire(sc, ec));
+
+  sc->mask = proc_event::PROC_EVENT_EXEC;
+  EXPECT_FALSE(pub->shouldFire(sc, ec));
+  ec->what = proc_event::PROC_EVENT_EXEC;
+  EXPECT_TRUE(pub->shouldFire(sc, ec));
+}
+
+class TestProcConnectorEventSubscriber
+    : public EventSubscriber<ProcConnectorEventPublisher> {
+ public:
+  TestProcConnectorEventSubscriber() {
+    setName("TestProcConnectorEventSubscriber");
+  }
+
+  Status init() { return Status(0, "OK"); }
+};
+
+static std::vector<std::string> kProcConnectorTestActions;
+
+static Status TestProcConnectorCallback(const EventContextRef& ec,
+                                        const void* user_data) {
+  auto pec = std::static_pointer_cast<ProcConnectorEventContext>(ec);
+  kProcConnectorTestActions.push_back(pec->action);
+  return Status(0, "OK");
+}
+
+TEST_F(ProcConnectorTests, test_proc_connector_process_events) {
+  auto pub = std::make_shared<ProcConnectorEventPublisher>();
+  auto sub = std::make_shared<TestProcConnectorEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
+
+  auto sc = pub->createSubscriptionContext();
+  pub->addSubscription(Subscription::create(
+      "TestProcConnectorEventSubscriber", sc, TestProcConnectorCallback));
+
+  // A process fork is reported.
+  struct proc_event event;
+  memset(&event, 0, sizeof(event));
+  event.what = proc_event::PROC_EVENT_FORK;
+  event.event_data.fork.parent_tgid = 1;
+  event.event_data.fork.child_pid = 100;
+  event.event_data.fork.child_tgid = 100;
+  auto message = createMessage(event);
+  pub->processEvents(message.data(), message.size());
+
+  // A thread creation within the process is not.
+  event.event_data.fork.child_pid = 101;
+  message = createMessage(event);
+  pub->processEvents(message.data(), message.size());
+
+  // An exec is enriched from /proc, use this process.
+  memset(&event, 0, sizeof(event));
+  event.what = proc_event::PROC_EVENT_EXEC;
+  event.event_data.exec.process_pid = ::getpid();
+  event.event_data.exec.process_tgid = ::getpid();
+  auto ec = pub->createEventContextFrom(&event);
+  ASSERT_NE(ec, nullptr);
+  EXPECT_EQ(ec->action, "exec");
+  EXPECT_EQ(ec->parent, ::getppid());
+  EXPECT_FALSE(ec->path.empty());
+  EXPECT_EQ(ec->uid, std::to_string(::getuid()));
+
+  memset(&event, 0, sizeof(event));
+  event.what = proc_event::PROC_EVENT_EXIT;
+  event.event_data.exit.process_pid = 100;
+  event.event_data.exit.process_tgid = 100;
+  event.event_data.exit.exit_code = 256;
+  message = createMessage(event);
+  pub->processEvents(message.data(), message.size());
+
+  EXPECT_EQ(kProcConnectorTestActions, std::vector<std::string>({"fork", "exit"}));
+}
+}
@@ -0,0 +1,111 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <string.h>
+
+#include <sys/socket.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/events.h>
+
+#include "osquery/events/linux/rtnetlink.h"
+
+namespace osquery {
+
+class RtnetlinkTests : public testing::Test {};
+
+/// Build a netlink route message holding an empty payload of a family.
+template <typename T>
+static std::vector<char> createMessage(uint16_t type, unsigned char family) {
+  std::vector<char> message(NLMSG_SPACE(sizeof(T)), 0);
+  auto header = reinterpret_cast<struct nlmsghdr*>(message.data());
+  header->nlmsg_len = NLMSG_LENGTH(sizeof(T));
+  header->nlmsg_type = type;
+  *reinterpret_cast<unsigned char*>(NLMSG_DATA(header)) = family;
+  return message;
+}
+
+TEST_F(RtnetlinkTests, test_rtnetlink_should_fire) {
+  auto pub = std::make_shared<RtnetlinkEventPublisher>();
+  auto sc = pub->createSubscriptionContext();
+  auto ec = pub->createEventContext();
+
+  // The default groups include every change.
+  ec->group = RTMGRP_NEIGH;
+  EXPECT_TRUE(pub->shouldFire(sc, ec));
+
+  sc->groups = RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+  EXPECT_FALSE(pub->shouldFire(sc, ec));
+  ec->group = RTMGRP_IPV6_ROUTE;
+  EXPECT_TRUE(pub->shouldFire(sc, ec));
+
+  // Notices are sent to every subscription.
+  ec->group = 0;
+  ec->type = NLMSG_OVERRUN;
+  EXPECT_TRUE(pub->shouldFire(sc, ec));
+}
+
+class TestRtnetlinkEventSubscriber
+    : public EventSubscriber<RtnetlinkEventPublisher> {
+ public:
+  TestRtnetlinkEventSubscriber() { setName("TestRtnetlinkEventSubscriber"); }
+
+  Status init() { return Status(0, "OK"); }
+};
+
+static std::vector<std::string> kRtnetlinkTestActions;
+
+static Status TestRtnetlinkCallback(const EventContextRef& ec,
+                                    const void* user_data) {
+  auto rec = std::static_pointer_cast<RtnetlinkEventContext>(ec);
+  kRtnetlinkTestActions.push_back(rec->action + " " +
+                                  std::to_string(rec->message.size()));
+  return Status(0, "OK");
+}
+
+TEST_F(RtnetlinkTests, test_rtnetlink_process_events) {
+  auto pub = std::make_shared<RtnetlinkEventPublisher>();
+  auto sub = std::make_shared<TestRtnetlinkEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
+
+  auto sc = pub->createSubscriptionContext();
+  sc->groups = RTMGRP_IPV4_ROUTE | RTMGRP_NEIGH;
+  pub->addSubscription(Subscription::create(
+      "TestRtnetlinkEventSubscriber", sc, TestRtnetlinkCallback));
+
+  // Several messages are read at once.
+  auto buffer = createMessage<struct rtmsg>(RTM_NEWROUTE, AF_INET);
+  auto message = createMessage<struct ndmsg>(RTM_DELNEIGH, AF_INET);
+  buffer.insert(buffer.end(), message.begin(), message.end());
+  pub->processEvents(buffer.data(), buffer.size());
+
+  // IPv6 routes and links are not subscribed.
+  message = createMessage<struct rtmsg>(RTM_NEWROUTE, AF_INET6);
+  pub->processEvents(message.data(), message.size());
+  message = createMessage<struct ifinfomsg>(RTM_NEWLINK, AF_UNSPEC);
+  pub->processEvents(message.data(), message.size());
+
+  // Truncated messages are not reported.
+  message = createMessage<struct rtmsg>(RTM_DELROUTE, AF_INET);
+  auto header = reinterpret_cast<struct nlmsghdr*>(message.data());
+  header->nlmsg_len = NLMSG_LENGTH(0);
+  pub->processEvents(message.data(), message.size());
+
+  // Lost changes are reported.
+  pub->fireNotice(NLMSG_OVERRUN);
+
+  auto route = std::to_string(NLMSG_LENGTH(sizeof(struct rtmsg)));
+  auto neighbor = std::to_string(NLMSG_LENGTH(sizeof(struct ndmsg)));
+  EXPECT_EQ(kRtnetlinkTestActions,
+            std::vector<std::string>(
+                {"added " + route, "removed " + neighbor, "overrun 0"}));
+}
+}
@@ -0,0 +1,157 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <string.h>
+
+#include <linux/perf_event.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/events.h>
+
+#include "osquery/events/linux/tracepoints.h"
+
+namespace osquery {
+
+/// A format file as read from tracefs, with tab separated attributes.
+const std::string kExecFormat =
+    "name: sched_process_exec\n"
+    "ID: 311\n"
+    "format:\n"
+    "\tfield:unsigned short common_type;\toffset:0;\tsize:2;\tsigned:0;\n"
+    "\tfield:int common_pid;\toffset:4;\tsize:4;\tsigned:1;\n"
+    "\n"
+    "\tfield:__data_loc char[] filename;\toffset:8;\tsize:4;\tsigned:1;\n"
+    "\tfield:pid_t pid;\toffset:12;\tsize:4;\tsigned:1;\n"
+    "\tfield:__u8 saddr[4];\toffset:16;\tsize:4;\tsigned:0;\n"
+    "\n"
+    "print fmt: \"filename=%s pid=%d\", __get_str(filename), REC->pid\n";
+
+class TracepointTests : public testing::Test {
+ protected:
+  void SetUp() {
+    source_ = std::make_shared<TracepointSource>();
+    source_->tracepoint = "sched/sched_process_exec";
+    ASSERT_TRUE(source_->format.parse(kExecFormat).ok());
+  }
+
+  /// Build a raw record: the filename follows the fixed fields.
+  std::string createRecord(const std::string& filename, int32_t pid) {
+    std::string data(20, '\0');
+    uint32_t location = ((filename.size() + 1) << 16) | data.size();
+    memcpy(&data[8], &location, sizeof(location));
+    memcpy(&data[12], &pid, sizeof(pid));
+    data[16] = 10;
+    data[19] = 1;
+    data.append(filename);
+    data.push_back('\0');
+    return data;
+  }
+
+  /// Append a perf sample holding a raw record to a ring.
+  void appendSample(std::string& ring, const std::string& raw, uint32_t pid) {
+    std::string sample(36, '\0');
+    uint32_t fields[7] = {pid, pid, 0, 0, 2, 0, (uint32_t)raw.size()};
+    memcpy(&sample[8], fields, sizeof(fields));
+    sample.append(raw);
+    sample.resize((sample.size() + 7) & ~7);
+
+    struct perf_event_header header;
+    header.type = PERF_RECORD_SAMPLE;
+    header.misc = 0;
+    header.size = sample.size();
+    memcpy(&sample[0], &header, sizeof(header));
+    ring.append(sample);
+  }
+
+ protected:
+  std::shared_ptr<TracepointSource> source_;
+};
+
+TEST_F(TracepointTests, test_parse_format) {
+  const auto& format = source_->format;
+  EXPECT_EQ(311U, format.id);
+  ASSERT_EQ(5U, format.fields.size());
+
+  auto filename = format.find("filename");
+  ASSERT_NE(nullptr, filename);
+  EXPECT_TRUE(filename->dynamic);
+  EXPECT_EQ(8U, filename->offset);
+
+  auto saddr = format.find("saddr");
+  ASSERT_NE(nullptr, saddr);
+  EXPECT_FALSE(saddr->dynamic);
+  EXPECT_EQ(4U, saddr->size);
+  EXPECT_EQ(nullptr, format.find("missing"));
+
+  TracepointFormat invalid;
+  EXPECT_FALSE(invalid.parse("name: missing_id\n").ok());
+}
+
+TEST_F(TracepointTests, test_event_fields) {
+  TracepointEventContext ec;
+  ec.source = source_;
+  ec.data = createRecord("/bin/true", -5);
+  EXPECT_EQ("/bin/true", ec.getString("filename"));
+  EXPECT_EQ(-5, ec.getInteger("pid"));
+  EXPECT_EQ(std::string("\x0a\x00\x00\x01", 4), ec.getBytes("saddr"));
+  EXPECT_EQ(0, ec.getInteger("missing"));
+
+  // Truncated records have no fields beyond their end.
+  ec.data.resize(14);
+  EXPECT_EQ("", ec.getString("filename"));
+  EXPECT_EQ(0, ec.getInteger("pid"));
+}
+
+TEST_F(TracepointTests, test_read_records) {
+  auto pub = std::make_shared<TracepointEventPublisher>();
+
+  std::string ring;
+  appendSample(ring, createRecord("/bin/ls", 100), 100);
+  appendSample(ring, createRecord("/usr/bin/env", 200), 200);
+
+  // Rotate the ring so a sample wraps around its end.
+  auto first = ring.size() / 2 + 8;
+  std::string wrapped = ring.substr(ring.size() - first) +
+                        ring.substr(0, ring.size() - first);
+  std::vector<EventContextRef> ecs;
+  uint64_t tail = wrapped.size() * 3 + first;
+  pub->readRecords(wrapped.data(),
+                   wrapped.size(),
+                   tail,
+                   tail + ring.size(),
+                   source_,
+                   ecs);
+
+  ASSERT_EQ(2U, ecs.size());
+  auto ec = std::static_pointer_cast<TracepointEventContext>(ecs[1]);
+  EXPECT_EQ("/usr/bin/env", ec->getString("filename"));
+  EXPECT_EQ(200, ec->pid);
+  EXPECT_EQ(2U, ec->cpu);
+
+  // A partly written record is left for the next read.
+  ecs.clear();
+  pub->readRecords(ring.data(), ring.size(), 0, ring.size() - 8, source_, ecs);
+  EXPECT_EQ(1U, ecs.size());
+}
+
+TEST_F(TracepointTests, test_should_fire) {
+  auto pub = std::make_shared<TracepointEventPublisher>();
+  auto sc = pub->createSubscriptionContext();
+  sc->tracepoint = "sched/sched_process_exec";
+  auto ec = pub->createEventContext();
+  ec->source = source_;
+  EXPECT_TRUE(pub->shouldFire(sc, ec));
+
+  // Subscriptions with another filter receive their own events.
+  sc->filter = "pid == 1";
+  EXPECT_FALSE(pub->shouldFire(sc, ec));
+}
+}
@@ -0,0 +1,84 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/events.h>
+
+#include "osquery/events/linux/udev.h"
+
+namespace osquery {
+
+class UdevTests : public testing::Test {};
+
+static UdevEventContextRef createUdevEvent(const std::string& syspath,
+                                           udev_event_action action,
+                                           EventTime time) {
+  auto ec = UdevEventPublisher::createEventContext();
+  ec->syspath = syspath;
+  ec->action = action;
+  ec->action_string = (action == UDEV_EVENT_ACTION_ADD)
+                          ? "add"
+                          : (action == UDEV_EVENT_ACTION_REMOVE) ? "remove"
+                                                                 : "change";
+  ec->time = time;
+  return ec;
+}
+
+TEST_F(UdevTests, test_debounce) {
+  auto held = createUdevEvent("/sys/a", UDEV_EVENT_ACTION_ADD, 1);
+  held->first_time = 1;
+
+  // Changes following an add are reported as the add, with the newest device.
+  auto change = createUdevEvent("/sys/a", UDEV_EVENT_ACTION_CHANGE, 2);
+  change->devnode = "/dev/a";
+  EXPECT_TRUE(UdevEventPublisher::debounce(held, change));
+  EXPECT_EQ(UDEV_EVENT_ACTION_ADD, held->action);
+  EXPECT_EQ("add", held->action_string);
+  EXPECT_EQ("/dev/a", held->devnode);
+  EXPECT_EQ(2U, held->count);
+  EXPECT_EQ(1U, held->first_time);
+  EXPECT_EQ(2U, held->time);
+
+  // A short-lived device is still reported as added and removed.
+  auto remove = createUdevEvent("/sys/a", UDEV_EVENT_ACTION_REMOVE, 3);
+  EXPECT_FALSE(UdevEventPublisher::debounce(held, remove));
+  EXPECT_EQ(UDEV_EVENT_ACTION_ADD, held->action);
+
+  // A change followed by a remove is reported as the remove.
+  held = createUdevEvent("/sys/b", UDEV_EVENT_ACTION_CHANGE, 4);
+  held->first_time = 4;
+  remove = createUdevEvent("/sys/b", UDEV_EVENT_ACTION_REMOVE, 5);
+  EXPECT_TRUE(UdevEventPublisher::debounce(held, remove));
+  EXPECT_EQ(UDEV_EVENT_ACTION_REMOVE, held->action);
+  EXPECT_EQ(4U, held->first_time);
+
+  // A device added again after its remove is reported again.
+  auto add = createUdevEvent("/sys/b", UDEV_EVENT_ACTION_ADD, 6);
+  EXPECT_FALSE(UdevEventPublisher::debounce(held, add));
+}
+
+TEST_F(UdevTests, test_hold) {
+  UdevEventPublisher pub;
+  pub.hold(createUdevEvent("/sys/a", UDEV_EVENT_ACTION_ADD, 1));
+  pub.hold(createUdevEvent("/sys/b", UDEV_EVENT_ACTION_CHANGE, 1));
+  pub.hold(createUdevEvent("/sys/a", UDEV_EVENT_ACTION_CHANGE, 2));
+  pub.hold(createUdevEvent("/sys/a", UDEV_EVENT_ACTION_REMOVE, 3));
+  pub.hold(createUdevEvent("/sys/b", UDEV_EVENT_ACTION_CHANGE, 3));
+
+  // The burst is held as an add and a remove of a, and one change of b.
+  EXPECT_EQ(3U, pub.numHeld());
+  EXPECT_GE(pub.getPollTimeout(), 0);
+
+  pub.flush();
+  EXPECT_EQ(0U, pub.numHeld());
+  EXPECT_EQ(-1, pub.getPollTimeout());
+}
+}
@@ -0,0 +1,507 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/perf_event.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/trim.hpp>
+
+#include <osquery/core.h>
+#include <osquery/filesystem.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/metrics.h"
+#include "osquery/events/linux/tracepoints.h"
+
+namespace osquery {
+
+FLAG(bool,
+     enable_tracepoints,
+     false,
+     "Use Linux kernel tracepoints for events (Linux, requires root)");
+
+FLAG(uint64,
+     tracepoints_buffer_pages,
+     64,
+     "Pages of each CPU's ring buffer for each tracepoint, a power of 2");
+
+FLAG(uint64,
+     tracepoints_flush_ms,
+     1000,
+     "Milliseconds between draining partly filled tracepoint ring buffers");
+
+/// The tracefs events directories, the first that exists is used.
+const std::vector<std::string> kTracepointEventsPaths = {
+    "/sys/kernel/tracing/events", "/sys/kernel/debug/tracing/events",
+};
+
+/// The size of a sample's fields before its raw data.
+const size_t kTracepointSampleHeader =
+    sizeof(struct perf_event_header) + 4 * sizeof(uint32_t) +
+    sizeof(uint64_t) + sizeof(uint32_t);
+
+static MetricCounter kTracepointsEvents("tracepoints.events");
+static MetricCounter kTracepointsLost("tracepoints.lost");
+
+REGISTER(TracepointEventPublisher, "event_publisher", "tracepoints");
+
+Status TracepointFormat::parse(const std::string& content) {
+  id = 0;
+  fields.clear();
+  for (const auto& line : osquery::split(content, "\n")) {
+    auto trimmed = boost::algorithm::trim_copy(line);
+    if (boost::algorithm::starts_with(trimmed, "ID:")) {
+      id = strtoull(trimmed.c_str() + 3, nullptr, 10);
+      continue;
+    } else if (!boost::algorithm::starts_with(trimmed, "field:")) {
+      continue;
+    }
+
+    // field:__u8 saddr[4];	offset:28;	size:4;	signed:0;
+    TracepointField field;
+    for (auto part : osquery::split(trimmed, ";")) {
+      boost::algorithm::trim(part);
+      auto colon = part.find(':');
+      if (colon == std::string::npos) {
+        continue;
+      }
+
+      auto key = part.substr(0, colon);
+      auto value = part.substr(colon + 1);
+      if (key == "field") {
+        field.dynamic = boost::algorithm::starts_with(value, "__data_loc");
+        auto name = value.substr(value.find_last_of(" \t") + 1);
+        field.name = name.substr(0, name.find('['));
+      } else if (key == "offset") {
+        field.offset = strtoul(value.c_str(), nullptr, 10);
+      } else if (key == "size") {
+        field.size = strtoul(value.c_str(), nullptr, 10);
+      } else if (key == "signed") {
+        field.is_signed = (value == "1");
+      }
+    }
+
+    if (!field.name.empty() && field.size > 0) {
+      fields.push_back(std::move(field));
+    }
+  }
+
+  if (id == 0) {
+    return Status(1, "Tracepoint format has no ID");
+  }
+  return Status(0, "OK");
+}
+
+const TracepointField* TracepointFormat::find(const std::string& name) const {
+  for (const auto& field : fields) {
+    if (field.name == name) {
+      return &field;
+    }
+  }
+  return nullptr;
+}
+
+/// Find the bounds of a field's data within a record, false if outside.
+static bool getFieldData(const TracepointEventContext& ec,
+                         const std::string& name,
+                         size_t& offset,
+                         size_t& size) {
+  if (ec.source == nullptr) {
+    return false;
+  }
+
+  auto field = ec.source->format.find(name);
+  if (field == nullptr || field->offset + field->size > ec.data.size()) {
+    return false;
+  }
+
+  offset = field->offset;
+  size = field->size;
+  if (field->dynamic) {
+    // The field holds the size and offset of the data.
+    uint32_t location = 0;
+    memcpy(&location, ec.data.data() + offset, sizeof(location));
+    offset = location & 0xffff;
+    size = location >> 16;
+  }
+  return (offset + size <= ec.data.size());
+}
+
+int64_t TracepointEventContext::getInteger(const std::string& name) const {
+  size_t offset = 0;
+  size_t size = 0;
+  if (!getFieldData(*this, name, offset, size)) {
+    return 0;
+  }
+
+  auto field = source->format.find(name);
+  auto value = data.data() + offset;
+  if (size == 1) {
+    int8_t integer;
+    memcpy(&integer, value, size);
+    return (field->is_signed) ? (int64_t)integer : (int64_t)(uint8_t)integer;
+  } else if (size == 2) {
+    int16_t integer;
+    memcpy(&integer, value, size);
+    return (field->is_signed) ? (int64_t)integer : (int64_t)(uint16_t)integer;
+  } else if (size == 4) {
+    int32_t integer;
+    memcpy(&integer, value, size);
+    return (field->is_signed) ? (int64_t)integer : (int64_t)(uint32_t)integer;
+  } else if (size == 8) {
+    int64_t integer;
+    memcpy(&integer, value, size);
+    return integer;
+  }
+  return 0;
+}
+
+std::string TracepointEventContext::getString(const std::string& name) const {
+  auto bytes = getBytes(name);
+  auto end = bytes.find('\0');
+  if (end != std::string::npos) {
+    bytes.resize(end);
+  }
+  return bytes;
+}
+
+std::string TracepointEventContext::getBytes(const std::string& name) const {
+  size_t offset = 0;
+  size_t size = 0;
+  if (!getFieldData(*this, name, offset, size)) {
+    return "";
+  }
+  return data.substr(offset, size);
+}
+
+Status TracepointEventPublisher::setUp() {
+  if (!FLAGS_enable_tracepoints) {
+    return Status(1, "Publisher disabled via configuration");
+  }
+
+  for (const auto& path : kTracepointEventsPaths) {
+    if (isReadable(path + "/sched/sched_process_exit/format").ok()) {
+      events_path_ = path;
+      break;
+    }
+  }
+  if (events_path_.empty()) {
+    return Status(1, "Cannot find tracefs events");
+  }
+
+  // Opening perf events for every process usually requires root.
+  TracepointFormat format;
+  auto status = getFormat("sched/sched_process_exit", format);
+  if (!status.ok()) {
+    return status;
+  }
+  auto probe = openEvent(format.id, 0);
+  if (probe == -1) {
+    return Status(1,
+                  std::string("Cannot open tracepoints: ") + strerror(errno));
+  }
+  ::close(probe);
+
+  // Ring buffers are a power of 2 pages.
+  page_size_ = ::sysconf(_SC_PAGESIZE);
+  pages_ = 1;
+  while (pages_ * 2 <= FLAGS_tracepoints_buffer_pages) {
+    pages_ *= 2;
+  }
+
+  epoll_ = ::epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_ == -1) {
+    return Status(1, "Could not create tracepoints handle");
+  }
+
+  flush_time_ = std::chrono::steady_clock::now() +
+                std::chrono::milliseconds(FLAGS_tracepoints_flush_ms);
+  return Status(0, "OK");
+}
+
+Status TracepointEventPublisher::getFormat(const std::string& tracepoint,
+                                           TracepointFormat& format) {
+  if (std::count(tracepoint.begin(), tracepoint.end(), '/') != 1 ||
+      tracepoint.find("..") != std::string::npos) {
+    return Status(1, "Invalid tracepoint: " + tracepoint);
+  }
+
+  std::string content;
+  if (!readFile(events_path_ + "/" + tracepoint + "/format", content).ok()) {
+    return Status(1, "Unknown tracepoint: " + tracepoint);
+  }
+  return format.parse(content);
+}
+
+int TracepointEventPublisher::openEvent(uint64_t id, int cpu) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_TRACEPOINT;
+  attr.config = id;
+  attr.sample_period = 1;
+  attr.sample_type =
+      PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CPU | PERF_SAMPLE_RAW;
+  attr.disabled = 1;
+
+  // Wake the event loop once the ring is a quarter full, not for each event.
+  attr.watermark = 1;
+  attr.wakeup_watermark = ::sysconf(_SC_PAGESIZE) *
+                          std::max(FLAGS_tracepoints_buffer_pages / 4,
+                                   (uint64_t)1);
+
+  // Every process on the CPU.
+  return (int)::syscall(
+      __NR_perf_event_open, &attr, -1, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+/// Unmap and close a ring buffer, closing also removes it from the handle.
+static void closeBuffer(int fd, char* base, size_t size) {
+  if (base != nullptr) {
+    ::munmap(base, size);
+  }
+  if (fd != -1) {
+    ::close(fd);
+  }
+}
+
+Status TracepointEventPublisher::open(const TracepointSourceRef& source) {
+  std::vector<Buffer> buffers;
+  auto status = Status(0, "OK");
+  auto cpus = ::sysconf(_SC_NPROCESSORS_CONF);
+  for (int cpu = 0; cpu < cpus && status.ok(); ++cpu) {
+    Buffer buffer;
+    buffer.source = source;
+    buffer.fd = openEvent(source->format.id, cpu);
+    if (buffer.fd == -1) {
+      if (errno != ENODEV) {
+        status = Status(1, std::string("Cannot open: ") + strerror(errno));
+      }
+      // Offline CPUs are skipped.
+      continue;
+    }
+
+    buffer.size = (pages_ + 1) * page_size_;
+    auto base = ::mmap(nullptr,
+                       buffer.size,
+                       PROT_READ | PROT_WRITE,
+                       MAP_SHARED,
+                       buffer.fd,
+                       0);
+    if (base == MAP_FAILED) {
+      status = Status(1, std::string("Cannot map: ") + strerror(errno));
+      closeBuffer(buffer.fd, nullptr, 0);
+      continue;
+    }
+    buffer.base = static_cast<char*>(base);
+    buffers.push_back(buffer);
+
+    if (!source->filter.empty() &&
+        ::ioctl(buffer.fd, PERF_EVENT_IOC_SET_FILTER, source->filter.c_str()) ==
+            -1) {
+      status = Status(1, "Invalid filter: " + source->filter);
+      continue;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = buffer.fd;
+    if (::epoll_ctl(epoll_, EPOLL_CTL_ADD, buffer.fd, &event) == -1 ||
+        ::ioctl(buffer.fd, PERF_EVENT_IOC_ENABLE, 0) == -1) {
+      status = Status(1, std::string("Cannot enable: ") + strerror(errno));
+    }
+  }
+
+  if (status.ok() && buffers.empty()) {
+    status = Status(1, "No CPUs");
+  }
+  if (!status.ok()) {
+    for (const auto& buffer : buffers) {
+      closeBuffer(buffer.fd, buffer.base, buffer.size);
+    }
+    return status;
+  }
+
+  buffers_.insert(buffers_.end(), buffers.begin(), buffers.end());
+  return Status(0, "OK");
+}
+
+void TracepointEventPublisher::configure() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (epoll_ == -1) {
+    return;
+  }
+
+  for (const auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    auto opened = std::find_if(sources_.begin(),
+                               sources_.end(),
+                               [&sc](const TracepointSourceRef& source) {
+                                 return source->tracepoint == sc->tracepoint &&
+                                        source->filter == sc->filter;
+                               });
+    if (opened != sources_.end()) {
+      continue;
+    }
+
+    // A source that cannot be opened is kept, and not opened again.
+    auto source = std::make_shared<TracepointSource>();
+    source->tracepoint = sc->tracepoint;
+    source->filter = sc->filter;
+    auto status = getFormat(sc->tracepoint, source->format);
+    if (status.ok()) {
+      status = open(source);
+    }
+    if (!status.ok()) {
+      LOG(WARNING) << "Cannot trace " << sc->tracepoint << ": "
+                   << status.getMessage();
+    }
+    sources_.push_back(source);
+  }
+}
+
+void TracepointEventPublisher::tearDown() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& buffer : buffers_) {
+    closeBuffer(buffer.fd, buffer.base, buffer.size);
+  }
+  buffers_.clear();
+  sources_.clear();
+
+  if (epoll_ != -1) {
+    ::close(epoll_);
+    epoll_ = -1;
+  }
+}
+
+int TracepointEventPublisher::getPollTimeout() {
+  auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  flush_time_ - std::chrono::steady_clock::now())
+                  .count();
+  return (wait > 0) ? static_cast<int>(wait) : 0;
+}
+
+/// Copy bytes from a ring, wrapping at its end.
+static void copyRing(const char* ring,
+                     size_t ring_size,
+                     uint64_t position,
+                     void* output,
+                     size_t size) {
+  auto offset = position % ring_size;
+  auto first = std::min(size, ring_size - offset);
+  memcpy(output, ring + offset, first);
+  memcpy(static_cast<char*>(output) + first, ring, size - first);
+}
+
+void TracepointEventPublisher::readRecords(const char* ring,
+                                           size_t ring_size,
+                                           uint64_t tail,
+                                           uint64_t head,
+                                           const TracepointSourceRef& source,
+                                           std::vector<EventContextRef>& ecs) {
+  auto time = getUnixTime();
+  std::string record;
+  while (head - tail >= sizeof(struct perf_event_header)) {
+    struct perf_event_header header;
+    copyRing(ring, ring_size, tail, &header, sizeof(header));
+    if (header.size < sizeof(header) || header.size > head - tail) {
+      break;
+    }
+
+    record.resize(header.size);
+    copyRing(ring, ring_size, tail, &record[0], header.size);
+    tail += header.size;
+    if (header.type == PERF_RECORD_LOST &&
+        header.size >= sizeof(header) + 2 * sizeof(uint64_t)) {
+      // The kernel dropped records while the ring was full.
+      uint64_t lost = 0;
+      memcpy(&lost, &record[sizeof(header) + sizeof(uint64_t)], sizeof(lost));
+      kTracepointsLost.add(lost);
+      continue;
+    } else if (header.type != PERF_RECORD_SAMPLE ||
+               header.size < kTracepointSampleHeader) {
+      continue;
+    }
+
+    // The sample's pid, tid, time, cpu, reserved, and raw size precede it.
+    uint32_t fields[7];
+    memcpy(fields, &record[sizeof(header)], sizeof(fields));
+    auto raw_size = fields[6];
+    if (raw_size > header.size - kTracepointSampleHeader) {
+      continue;
+    }
+
+    auto ec = createEventContext();
+    ec->source = source;
+    ec->pid = fields[0];
+    ec->tid = fields[1];
+    ec->cpu = fields[4];
+    ec->time = time;
+    ec->data.assign(&record[kTracepointSampleHeader], raw_size);
+    ecs.push_back(ec);
+  }
+}
+
+Status TracepointEventPublisher::process() {
+  std::vector<EventContextRef> ecs;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Reset the readiness of each buffer, every buffer is drained.
+    struct epoll_event events[64];
+    while (::epoll_wait(epoll_, events, 64, 0) == 64) {
+    }
+
+    for (const auto& buffer : buffers_) {
+      auto page = reinterpret_cast<struct perf_event_mmap_page*>(buffer.base);
+      auto head = __atomic_load_n(&page->data_head, __ATOMIC_ACQUIRE);
+      auto tail = page->data_tail;
+      if (head == tail) {
+        continue;
+      }
+
+      readRecords(buffer.base + page_size_,
+                  pages_ * page_size_,
+                  tail,
+                  head,
+                  buffer.source,
+                  ecs);
+      // The kernel may reuse the space once the tail is written.
+      __atomic_store_n(&page->data_tail, head, __ATOMIC_RELEASE);
+    }
+
+    flush_time_ = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(FLAGS_tracepoints_flush_ms);
+  }
+
+  if (!ecs.empty()) {
+    kTracepointsEvents.add(ecs.size());
+    fireBatch(ecs);
+  }
+  return Status(0, "OK");
+}
+
+bool TracepointEventPublisher::shouldFire(
+    const TracepointSubscriptionContextRef& sc,
+    const TracepointEventContextRef& ec) const {
+  return (ec->source != nullptr && sc->tracepoint == ec->source->tracepoint &&
+          sc->filter == ec->source->filter);
+}
+}
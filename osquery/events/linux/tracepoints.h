@@ -0,0 +1,192 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <osquery/events.h>
+#include <osquery/flags.h>
+#include <osquery/status.h>
+
+namespace osquery {
+
+DECLARE_bool(enable_tracepoints);
+
+/// A field of a tracepoint's records.
+struct TracepointField {
+  std::string name;
+  size_t offset{0};
+  size_t size{0};
+  bool is_signed{false};
+
+  /// A __data_loc field, a 32-bit size << 16 | offset of the data.
+  bool dynamic{false};
+};
+
+/// A tracepoint's ID and record layout, read from its tracefs format file.
+struct TracepointFormat {
+  uint64_t id{0};
+  std::vector<TracepointField> fields;
+
+  /// Parse the content of a format file.
+  Status parse(const std::string& content);
+
+  /// Find a field, nullptr if the tracepoint has no such field.
+  const TracepointField* find(const std::string& name) const;
+};
+
+/// The events of one tracepoint passing one kernel filter.
+struct TracepointSource {
+  /// The tracepoint's system and name, such as "sched/sched_process_exec".
+  std::string tracepoint;
+  std::string filter;
+  TracepointFormat format;
+};
+
+typedef std::shared_ptr<const TracepointSource> TracepointSourceRef;
+
+/**
+ * @brief Subscription details for TracepointEventPublisher events.
+ *
+ * The filter is an ftrace filter expression of the tracepoint's fields, such
+ * as "protocol == 6 && newstate == 1". It is evaluated by the kernel, records
+ * that do not pass are never copied to osquery. Subscriptions with the same
+ * tracepoint and filter share the kernel's events.
+ */
+struct TracepointSubscriptionContext : public SubscriptionContext {
+  /// The tracepoint's system and name, such as "sock/inet_sock_set_state".
+  std::string tracepoint;
+
+  /// An ftrace filter expression, empty for every event.
+  std::string filter;
+};
+
+/// Event details for TracepointEventPublisher events.
+struct TracepointEventContext : public EventContext {
+  /// The tracepoint and filter that reported the event.
+  TracepointSourceRef source;
+
+  /// The current process and thread when the tracepoint was hit.
+  pid_t pid{0};
+  pid_t tid{0};
+  uint32_t cpu{0};
+
+  /// The record's raw fields, see the source's format.
+  std::string data;
+
+  /// Read an integer field, 0 if the record has no such field.
+  int64_t getInteger(const std::string& name) const;
+
+  /// Read a character array or __data_loc string field, up to a NUL.
+  std::string getString(const std::string& name) const;
+
+  /// Read an array field's bytes, such as an address.
+  std::string getBytes(const std::string& name) const;
+};
+
+typedef std::shared_ptr<TracepointEventContext> TracepointEventContextRef;
+typedef std::shared_ptr<TracepointSubscriptionContext>
+    TracepointSubscriptionContextRef;
+
+/**
+ * @brief A Linux kernel tracepoint EventPublisher.
+ *
+ * Each subscribed tracepoint is opened as a perf event on every CPU, with a
+ * memory-mapped ring buffer the kernel writes records into without a syscall
+ * for each event. The subscription's filter is set on the perf event, so the
+ * kernel drops records that are not needed. The event loop waits on an epoll
+ * handle of every ring buffer, which is readable once a buffer is a quarter
+ * full, and the buffers are drained at least every --tracepoints_flush_ms.
+ *
+ * Tracepoints require tracefs and permission to open perf events, normally
+ * root or CAP_SYS_ADMIN. When either is missing setUp fails, and subscribers
+ * keep using their other publishers.
+ *
+ * Uses TracepointSubscriptionContext and TracepointEventContext.
+ */
+class TracepointEventPublisher
+    : public EventPublisher<TracepointSubscriptionContext,
+                            TracepointEventContext> {
+  DECLARE_PUBLISHER("tracepoints");
+
+ public:
+  /// Find tracefs, check perf events may be opened, and create the handle.
+  Status setUp();
+  /// Open a ring buffer on each CPU for each new tracepoint and filter.
+  void configure();
+  /// Close every ring buffer and the handle.
+  void tearDown();
+  /// The event loop waits on the epoll handle of every ring buffer.
+  int getPollHandle() const { return epoll_; }
+  /// Wake when the ring buffers should be drained.
+  int getPollTimeout();
+  /// Drain every ring buffer.
+  Status process();
+
+  /// Read a tracepoint's format file.
+  Status getFormat(const std::string& tracepoint, TracepointFormat& format);
+
+ private:
+  /// A ring buffer of one CPU's records of a source.
+  struct Buffer {
+    int fd{-1};
+    /// The mapping, a metadata page followed by the ring.
+    char* base{nullptr};
+    size_t size{0};
+    TracepointSourceRef source;
+  };
+
+  /// Open a source's ring buffers, one for each CPU.
+  Status open(const TracepointSourceRef& source);
+
+  /// Open a perf event of a tracepoint on a CPU, -1 if it failed.
+  static int openEvent(uint64_t id, int cpu);
+
+  /// Create an event context for each sample within a range of a ring.
+  void readRecords(const char* ring,
+                   size_t ring_size,
+                   uint64_t tail,
+                   uint64_t head,
+                   const TracepointSourceRef& source,
+                   std::vector<EventContextRef>& ecs);
+
+  /// Compare the subscription's tracepoint and filter to the event's source.
+  bool shouldFire(const TracepointSubscriptionContextRef& sc,
+                  const TracepointEventContextRef& ec) const;
+
+ private:
+  /// The tracefs events directory.
+  std::string events_path_;
+
+  int epoll_{-1};
+
+  /// The page size, and the pages of each ring.
+  size_t page_size_{0};
+  size_t pages_{0};
+
+  std::vector<Buffer> buffers_;
+  std::vector<TracepointSourceRef> sources_;
+
+  /// When the ring buffers are next drained without being readable.
+  std::chrono::steady_clock::time_point flush_time_;
+
+  /// Guards the buffers, configure runs on the subscribing thread.
+  std::mutex mutex_;
+
+ private:
+  FRIEND_TEST(TracepointTests, test_read_records);
+  FRIEND_TEST(TracepointTests, test_should_fire);
+};
+}
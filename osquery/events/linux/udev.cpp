@@ -8,6 +8,8 @@
  *
  */
 
+#include <errno.h>
+
 #include <osquery/events.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
@@ -16,10 +18,13 @@
 
 namespace osquery {
 
-int kUdevMLatency = 200;
-
 REGISTER(UdevEventPublisher, "event_publisher", "udev");
 
+FLAG(uint64,
+     udev_debounce_ms,
+     100,
+     "Milliseconds to hold udev events and merge each device's changes");
+
 Status UdevEventPublisher::setUp() {
   // Create the udev object.
   handle_ = udev_new();
@@ -31,53 +36,113 @@ Status UdevEventPublisher::setUp() {
   monitor_ = udev_monitor_new_from_netlink(handle_, "udev");
   udev_monitor_enable_receiving(monitor_);
 
+  // Devices reported from now on keep the inventory up to date.
+  UdevDeviceInventory::instance().setMonitored(true);
   return Status(0, "OK");
 }
 
 void UdevEventPublisher::configure() {}
 
 void UdevEventPublisher::tearDown() {
+  held_.clear();
+  held_paths_.clear();
+  UdevDeviceInventory::instance().setMonitored(false);
   if (monitor_ != nullptr) {
     udev_monitor_unref(monitor_);
+    monitor_ = nullptr;
   }
 
   if (handle_ != nullptr) {
     udev_unref(handle_);
+    handle_ = nullptr;
   }
 }
 
-Status UdevEventPublisher::run() {
-  int fd = udev_monitor_get_fd(monitor_);
-  fd_set set;
+int UdevEventPublisher::getPollHandle() const {
+  return (monitor_ != nullptr) ? udev_monitor_get_fd(monitor_) : -1;
+}
 
-  FD_ZERO(&set);
-  FD_SET(fd, &set);
+int UdevEventPublisher::getPollTimeout() {
+  if (held_.empty()) {
+    return -1;
+  }
+
+  auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  flush_time_ - std::chrono::steady_clock::now())
+                  .count();
+  return (wait > 0) ? static_cast<int>(wait) : 0;
+}
+
+Status UdevEventPublisher::process() {
+  // The monitor socket is non-blocking, receive every pending device.
+  while (!isEnding()) {
+    errno = 0;
+    struct udev_device* device = udev_monitor_receive_device(monitor_);
+    if (device == nullptr) {
+      if (errno == ENOBUFS) {
+        // Devices were reported while the socket was full, and were missed.
+        UdevDeviceInventory::instance().setMonitored(true);
+      }
+      // The socket is drained.
+      break;
+    }
 
-  struct timeval timeout = {3, 3000};
-  int selector = ::select(fd + 1, &set, nullptr, nullptr, &timeout);
-  if (selector == -1) {
-    LOG(ERROR) << "Could not read udev monitor";
-    return Status(1, "udev monitor failed.");
+    UdevDeviceInventory::instance().update(device);
+    hold(createEventContextFrom(device));
   }
 
-  if (selector == 0 || !FD_ISSET(fd, &set)) {
-    // Read timeout.
-    return Status(0, "Timeout");
+  if (!held_.empty() && (isEnding() || FLAGS_udev_debounce_ms == 0 ||
+                         std::chrono::steady_clock::now() >= flush_time_)) {
+    flush();
   }
+  return Status(0, "OK");
+}
 
-  struct udev_device *device = udev_monitor_receive_device(monitor_);
-  if (device == nullptr) {
-    LOG(ERROR) << "udev monitor returned invalid device.";
-    return Status(1, "udev monitor failed.");
+bool UdevEventPublisher::debounce(UdevEventContextRef& held,
+                                  const UdevEventContextRef& ec) {
+  if (ec->action == UDEV_EVENT_ACTION_CHANGE) {
+    if (held->action != UDEV_EVENT_ACTION_ADD &&
+        held->action != UDEV_EVENT_ACTION_CHANGE) {
+      return false;
+    }
+    // Keep the first action with the newest device details.
+    ec->action = held->action;
+    ec->action_string = held->action_string;
+  } else if (ec->action == UDEV_EVENT_ACTION_REMOVE) {
+    if (held->action != UDEV_EVENT_ACTION_CHANGE) {
+      return false;
+    }
+  } else {
+    return false;
   }
 
-  auto ec = createEventContextFrom(device);
-  fire(ec);
+  ec->count = held->count + 1;
+  ec->first_time = held->first_time;
+  held = ec;
+  return true;
+}
 
-  udev_device_unref(device);
+void UdevEventPublisher::hold(const UdevEventContextRef& ec) {
+  ec->count = 1;
+  ec->first_time = ec->time;
+  if (held_.empty()) {
+    flush_time_ = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(FLAGS_udev_debounce_ms);
+  }
 
-  osquery::publisherSleep(kUdevMLatency);
-  return Status(0, "Continue");
+  auto path = held_paths_.find(ec->syspath);
+  if (path != held_paths_.end() && debounce(held_[path->second], ec)) {
+    return;
+  }
+  held_paths_[ec->syspath] = held_.size();
+  held_.push_back(ec);
+}
+
+void UdevEventPublisher::flush() {
+  std::vector<EventContextRef> batch(held_.begin(), held_.end());
+  held_.clear();
+  held_paths_.clear();
+  fireBatch(batch);
 }
 
 std::string UdevEventPublisher::getValue(struct udev_device* device,
@@ -102,9 +167,11 @@ UdevEventContextRef UdevEventPublisher::createEventContextFrom(
     struct udev_device* device) {
   auto ec = createEventContext();
   ec->device = device;
+  ec->time = getUnixTime();
   // Map the action string to the eventing enum.
   ec->action = UDEV_EVENT_ACTION_UNKNOWN;
-  ec->action_string = std::string(udev_device_get_action(device));
+  auto action = udev_device_get_action(device);
+  ec->action_string = (action != nullptr) ? action : "";
   if (ec->action_string == "add") {
     ec->action = UDEV_EVENT_ACTION_ADD;
   } else if (ec->action_string == "remove") {
@@ -114,7 +181,12 @@ UdevEventContextRef UdevEventPublisher::createEventContextFrom(
   }
 
   // Set the subscription-aware variables for the event.
-  auto value = udev_device_get_subsystem(device);
+  auto value = udev_device_get_syspath(device);
+  if (value != nullptr) {
+    ec->syspath = std::string(value);
+  }
+
+  value = udev_device_get_subsystem(device);
   if (value != nullptr) {
     ec->subsystem = std::string(value);
   }
@@ -134,6 +206,16 @@ UdevEventContextRef UdevEventPublisher::createEventContextFrom(
     ec->driver = std::string(value);
   }
 
+  // Copy the properties in one pass, subscribers do not search the device.
+  struct udev_list_entry* entry = nullptr;
+  auto properties = udev_device_get_properties_list_entry(device);
+  udev_list_entry_foreach(entry, properties) {
+    auto name = udev_list_entry_get_name(entry);
+    auto property = udev_list_entry_get_value(entry);
+    if (name != nullptr && property != nullptr) {
+      ec->properties[name] = property;
+    }
+  }
   return ec;
 }
 
@@ -157,4 +239,123 @@ bool UdevEventPublisher::shouldFire(const UdevSubscriptionContextRef& sc,
 
   return true;
 }
+
+UdevDeviceInventory::~UdevDeviceInventory() {
+  if (handle_ != nullptr) {
+    udev_unref(handle_);
+  }
+}
+
+bool UdevDeviceInventory::generate(const std::string& syspath,
+                                   const UdevDeviceRowGenerator& generator,
+                                   Row& row) {
+  auto device = udev_device_new_from_syspath(handle_, syspath.c_str());
+  if (device == nullptr) {
+    return false;
+  }
+
+  bool generated = generator(device, row);
+  udev_device_unref(device);
+  return generated;
+}
+
+void UdevDeviceInventory::getRows(const std::string& subsystem,
+                                  const UdevDeviceRowGenerator& generator,
+                                  QueryData& results,
+                                  const std::string& view) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (handle_ == nullptr) {
+    handle_ = udev_new();
+    if (handle_ == nullptr) {
+      VLOG(1) << "Could not get udev handle";
+      return;
+    }
+  }
+
+  const auto& name = (view.empty()) ? subsystem : view;
+  auto inventory = subsystems_.find(name);
+  if (inventory == subsystems_.end() || !monitored_) {
+    // Enumerate the subsystem, it is kept if the publisher reports changes.
+    Subsystem devices;
+    devices.name = subsystem;
+    auto enumerate = udev_enumerate_new(handle_);
+    udev_enumerate_add_match_subsystem(enumerate, subsystem.c_str());
+    udev_enumerate_scan_devices(enumerate);
+
+    struct udev_list_entry* entry = nullptr;
+    udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(enumerate)) {
+      const char* syspath = udev_list_entry_get_name(entry);
+      Row row;
+      if (syspath != nullptr && generate(syspath, generator, row)) {
+        devices.rows[syspath] = std::move(row);
+      }
+    }
+    udev_enumerate_unref(enumerate);
+
+    if (!monitored_) {
+      for (auto& device : devices.rows) {
+        results.push_back(std::move(device.second));
+      }
+      return;
+    }
+    inventory = subsystems_.emplace(name, std::move(devices)).first;
+  }
+
+  // Generate rows for the devices reported since the last read.
+  auto& devices = inventory->second;
+  for (const auto& syspath : devices.dirty) {
+    Row row;
+    if (generate(syspath, generator, row)) {
+      devices.rows[syspath] = std::move(row);
+    } else {
+      devices.rows.erase(syspath);
+    }
+  }
+  devices.dirty.clear();
+
+  for (const auto& device : devices.rows) {
+    results.push_back(device.second);
+  }
+}
+
+void UdevDeviceInventory::update(struct udev_device* device) {
+  auto subsystem = udev_device_get_subsystem(device);
+  auto syspath = udev_device_get_syspath(device);
+  if (subsystem == nullptr || syspath == nullptr) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto action = udev_device_get_action(device);
+  for (auto& inventory : subsystems_) {
+    // Views of subsystems that have not been read are enumerated.
+    auto& devices = inventory.second;
+    if (devices.name != subsystem) {
+      continue;
+    }
+
+    if (action != nullptr && std::string(action) == "remove") {
+      devices.rows.erase(syspath);
+      devices.dirty.erase(syspath);
+      continue;
+    }
+
+    if (action != nullptr && std::string(action) == "move") {
+      // A moved device is no longer at its old syspath.
+      auto old_path = udev_device_get_property_value(device, "DEVPATH_OLD");
+      if (old_path != nullptr) {
+        auto old_syspath = std::string("/sys") + old_path;
+        devices.rows.erase(old_syspath);
+        devices.dirty.erase(old_syspath);
+      }
+    }
+    devices.dirty.insert(syspath);
+  }
+}
+
+void UdevDeviceInventory::setMonitored(bool monitored) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  monitored_ = monitored;
+  subsystems_.clear();
+}
 }
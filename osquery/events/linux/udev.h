@@ -10,13 +10,27 @@
 
 #pragma once
 
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
 #include <libudev.h>
 
+#include <boost/noncopyable.hpp>
+
+#include <osquery/database.h>
 #include <osquery/events.h>
+#include <osquery/flags.h>
 #include <osquery/status.h>
 
 namespace osquery {
 
+DECLARE_uint64(udev_debounce_ms);
+
 enum udev_event_action {
   UDEV_EVENT_ACTION_ADD = 1,
   UDEV_EVENT_ACTION_REMOVE = 2,
@@ -47,19 +61,35 @@ struct UdevSubscriptionContext : public SubscriptionContext {
 
 /**
  * @brief Event details for UdevEventPublisher events.
+ *
+ * The context holds a reference to its device until the last subscriber
+ * queue releases it.
  */
 struct UdevEventContext : public EventContext {
+  UdevEventContext() {}
+  UdevEventContext(const UdevEventContext&) = delete;
+  UdevEventContext& operator=(const UdevEventContext&) = delete;
+  ~UdevEventContext() {
+    if (device != nullptr) {
+      udev_device_unref(device);
+    }
+  }
+
   /// A pointer to the device object, most subscribers will only use device.
-  struct udev_device* device;
+  struct udev_device* device{nullptr};
   /// The udev_event_action identifier.
   udev_event_action action;
   /// Action as a string (as given by udev).
   std::string action_string;
 
+  std::string syspath;
   std::string subsystem;
   std::string devnode;
   std::string devtype;
   std::string driver;
+
+  /// The device's udev properties, read once when the event is received.
+  std::map<std::string, std::string> properties;
 };
 
 typedef std::shared_ptr<UdevEventContext> UdevEventContextRef;
@@ -78,7 +108,12 @@ class UdevEventPublisher
   void configure();
   void tearDown();
 
-  Status run();
+  /// The event loop waits on the monitor's netlink socket.
+  int getPollHandle() const;
+  /// Wake when the held device events are due.
+  int getPollTimeout();
+  /// Receive every pending device, then fire held events that are due.
+  Status process();
 
   UdevEventPublisher() : EventPublisher() {
     handle_ = nullptr;
@@ -105,16 +140,128 @@ class UdevEventPublisher
   static std::string getAttr(struct udev_device* device,
                              const std::string& attr);
 
+  /**
+   * @brief Debounce a device event with the device's last held event.
+   *
+   * An add or change followed by changes is held as the newest change, with
+   * the first action, and a change followed by a remove is held as the
+   * remove. An add and a remove are never merged, so short-lived devices are
+   * still reported.
+   *
+   * @param held The device's last held event, replaced if ec is merged.
+   * @param ec The received event.
+   * @return true if ec was merged into held.
+   */
+  static bool debounce(UdevEventContextRef& held,
+                       const UdevEventContextRef& ec);
+
+  /**
+   * @brief Hold a received event until the debounce window passes.
+   *
+   * The window starts with the first held event, when it passes every held
+   * event is fired as one batch in the order the devices were reported.
+   */
+  void hold(const UdevEventContextRef& ec);
+
+  /// Fire the held events as a batch.
+  void flush();
+
+  /// The number of held events.
+  size_t numHeld() const { return held_.size(); }
+
  private:
   /// udev handle (socket descriptor contained within).
   struct udev *handle_;
   struct udev_monitor *monitor_;
 
+  /// Events held for the debounce window, in the order they were received.
+  std::vector<UdevEventContextRef> held_;
+
+  /// The index within held_ of the last event for each syspath.
+  std::map<std::string, size_t> held_paths_;
+
+  /// When the held events are fired.
+  std::chrono::steady_clock::time_point flush_time_;
+
  private:
   /// Check subscription details.
   bool shouldFire(const UdevSubscriptionContextRef& mc,
                   const UdevEventContextRef& ec) const;
-  /// Helper function to create an EventContext using a udev_device pointer.
+  /// Create an EventContext that owns a udev_device reference.
   UdevEventContextRef createEventContextFrom(struct udev_device* device);
 };
+
+/// Generate a table row for a udev device, false to skip the device.
+typedef std::function<bool(struct udev_device*, Row&)> UdevDeviceRowGenerator;
+
+/**
+ * @brief An in-memory inventory of the devices within udev subsystems.
+ *
+ * Device tables read their rows from the inventory instead of enumerating a
+ * subsystem and reading every device's properties for each query. The first
+ * read of a subsystem enumerates it, then the UdevEventPublisher reports
+ * devices that were added, changed, or removed. Only those devices' rows are
+ * generated again, by the next read.
+ *
+ * Updates are trusted while the publisher is monitoring, without a publisher
+ * (for example with --disable_events) every read enumerates the subsystem.
+ */
+class UdevDeviceInventory : private boost::noncopyable {
+ public:
+  static UdevDeviceInventory& instance() {
+    static UdevDeviceInventory inventory;
+    return inventory;
+  }
+
+  /**
+   * @brief Get the rows of every device within a subsystem.
+   *
+   * Rows are kept for each view of a subsystem, tables generating different
+   * rows from the same subsystem use a view each.
+   *
+   * @param subsystem The udev subsystem name.
+   * @param generator Generate the row of a new or changed device.
+   * @param results Output rows, ordered by the device's syspath.
+   * @param view The name of the rows, by default the subsystem's name.
+   */
+  void getRows(const std::string& subsystem,
+               const UdevDeviceRowGenerator& generator,
+               QueryData& results,
+               const std::string& view = "");
+
+  /// Record a device reported by the udev publisher.
+  void update(struct udev_device* device);
+
+  /// Start or stop trusting publisher updates, forgetting every device.
+  void setMonitored(bool monitored);
+
+ private:
+  UdevDeviceInventory() {}
+  ~UdevDeviceInventory();
+
+  /// Generate a row for a syspath, false if the device is gone or skipped.
+  bool generate(const std::string& syspath,
+                const UdevDeviceRowGenerator& generator,
+                Row& row);
+
+ private:
+  struct Subsystem {
+    /// The udev subsystem name.
+    std::string name;
+    /// Rows by device syspath, skipped devices have no row.
+    std::map<std::string, Row> rows;
+    /// Devices added or changed since the last read.
+    std::set<std::string> dirty;
+  };
+
+  /// Subsystems that were enumerated, by view.
+  std::map<std::string, Subsystem> subsystems_;
+
+  /// The udev context used to enumerate and read devices.
+  struct udev* handle_{nullptr};
+
+  bool monitored_{false};
+
+  std::mutex mutex_;
+};
 }
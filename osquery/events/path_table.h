@@ -0,0 +1,135 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace osquery {
+
+/**
+ * @brief An interned table of watched paths for filesystem EventPublisher%s.
+ *
+ * Each path is stored as a node holding one component and a pointer to its
+ * parent node, so paths sharing a directory share its nodes, and component
+ * names are stored once. A path is rebuilt from its node into a reused
+ * buffer when an event needs it.
+ *
+ * A path is split on every '/', so "/tmp" and "/tmp/" are distinct paths and
+ * each path is rebuilt exactly as it was inserted. A node is kept while it
+ * has a watch, or a child that is kept.
+ */
+class PathTable : private boost::noncopyable {
+ public:
+  /// A node identifier, stable while the node is kept.
+  typedef uint32_t NodeID;
+
+  /// No node, returned by find for paths that are not in the table.
+  static const NodeID kNoNode = 0;
+
+  PathTable();
+
+  /// Find the node of a path, kNoNode if the path is not in the table.
+  NodeID find(const std::string& path) const;
+
+  /**
+   * @brief Set the watch of a path, inserting the path's nodes.
+   *
+   * @param path The watched path.
+   * @param watch The path's watch descriptor, not -1.
+   * @return The path's node.
+   */
+  NodeID setWatch(const std::string& path, int watch);
+
+  /// The watch of a node, -1 if the node is not watched.
+  int getWatch(NodeID node) const;
+
+  /// The watch of a path, -1 if the path is not watched.
+  int getWatch(const std::string& path) const;
+
+  /// Remove a node's watch, and the nodes no longer kept.
+  void removeWatch(NodeID node);
+
+  /// Mark a watched directory whose children were watched.
+  void setCrawled(NodeID node, bool crawled);
+
+  /// Check if a watched directory's children were watched.
+  bool isCrawled(NodeID node) const;
+
+  /**
+   * @brief Rebuild the path of a node.
+   *
+   * @param node The node of a path in the table.
+   * @param path Output path, its capacity is reused between calls.
+   */
+  void getPath(NodeID node, std::string& path) const;
+
+  /// Check if a node is, or is below, another node.
+  bool isWithin(NodeID node, NodeID ancestor) const;
+
+  /// Remove every path.
+  void clear();
+
+  /// The number of nodes, including those only kept for their children.
+  size_t size() const { return nodes_.size() - free_nodes_.size() - 1; }
+
+  /// The number of distinct component names.
+  size_t components() const {
+    return component_names_.size() - free_components_.size();
+  }
+
+ private:
+  /// A path component and its parent, 20 bytes for each node.
+  struct Node {
+    NodeID parent;
+    uint32_t component;
+    int watch;
+    uint32_t children;
+    bool crawled;
+  };
+
+  /// The key of a child node, its parent node and component.
+  static uint64_t childKey(NodeID parent, uint32_t component) {
+    return ((uint64_t)parent << 32) | component;
+  }
+
+  /// Find a node's child, kNoNode if it has none with the name.
+  NodeID findChild(NodeID parent, const std::string& name) const;
+
+  /// Find or add a node's child.
+  NodeID addChild(NodeID parent, const std::string& name);
+
+  /// Remove nodes that have no watch and no children, from a node upward.
+  void prune(NodeID node);
+
+ private:
+  /// Every node, indexed by NodeID, the first is the root.
+  std::vector<Node> nodes_;
+  /// Removed nodes, reused by the next insert.
+  std::vector<NodeID> free_nodes_;
+
+  /// The node of each parent and component.
+  std::unordered_map<uint64_t, NodeID> children_;
+
+  /// The interned component names, indexed by component.
+  std::vector<std::string> component_names_;
+  /// The number of nodes using each component.
+  std::vector<uint32_t> component_refs_;
+  /// The component of each name.
+  std::unordered_map<std::string, uint32_t> components_;
+  /// Components no longer used by any node.
+  std::vector<uint32_t> free_components_;
+};
+}
@@ -0,0 +1,85 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/shared_mutex.hpp>
+
+#include <osquery/events.h>
+
+namespace osquery {
+
+/**
+ * @brief A path trie of Subscription%s for filesystem EventPublisher%s.
+ *
+ * Publishers with path-based SubscriptionContext%s rebuild the index in
+ * `configure`. When an event fires only the Subscription%s stored along the
+ * event path are checked with `shouldFire`, instead of every Subscription.
+ *
+ * A Subscription is either an exact match for its path, or a prefix match
+ * for every path beginning with its path. The index may return more
+ * candidates than actually match, but never fewer, so publishers with
+ * additional matching rules (globs, case folding) index a conservative key.
+ */
+class SubscriptionPathIndex : private boost::noncopyable {
+ public:
+  /**
+   * @brief Index a Subscription by a path.
+   *
+   * @param path The exact path, or path prefix, the Subscription matches.
+   * @param prefix Set to true to match every path beginning with path.
+   * @param subscription The indexed Subscription.
+   */
+  void add(const std::string& path,
+           bool prefix,
+           const SubscriptionRef& subscription);
+
+  /// Remove every Subscription.
+  void clear();
+
+  /// Replace the content of this index with another, for atomic rebuilds.
+  void swap(SubscriptionPathIndex& other);
+
+  /**
+   * @brief Find the Subscription%s that may match an event path.
+   *
+   * @param path The event path.
+   * @param matches Output candidate Subscription%s in the order they were
+   * added to the index.
+   */
+  void match(const std::string& path, SubscriptionVector& matches) const;
+
+  /// The number of indexed Subscription%s.
+  size_t size() const;
+
+ private:
+  /// A Subscription and the order it was added.
+  typedef std::pair<size_t, SubscriptionRef> IndexedSubscription;
+
+  struct Node {
+    std::map<char, std::unique_ptr<Node>> children;
+    std::vector<IndexedSubscription> exact;
+    std::vector<IndexedSubscription> prefix;
+  };
+
+ private:
+  Node root_;
+  size_t size_{0};
+
+  /// Dispatch threads match while configure rebuilds.
+  mutable boost::shared_mutex lock_;
+};
+}
@@ -8,8 +8,11 @@
  *
  */
 
-#include <boost/algorithm/string.hpp>
+#include <set>
+#include <thread>
+
 #include <boost/filesystem/operations.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include <gtest/gtest.h>
 
@@ -60,6 +63,34 @@ TEST_F(EventsDatabaseTests, test_event_module_id) {
   EXPECT_EQ(event_id1, "1");
   auto event_id2 = sub->getEventID();
   EXPECT_EQ(event_id2, "2");
+
+  // A new instance continues after the reserved block of IDs.
+  auto sub2 = std::make_shared<FakeEventSubscriber>();
+  sub2->doNotExpire();
+  auto event_id3 = sub2->getEventID();
+  EXPECT_EQ(event_id3, "10001");
+}
+
+TEST_F(EventsDatabaseTests, test_event_id_concurrency) {
+  auto sub = std::make_shared<FakeEventSubscriber>();
+  std::vector<std::string> ids[4];
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < 4; ++i) {
+    threads.push_back(std::thread([&sub, &ids, i]() {
+      for (size_t j = 0; j < 5000; ++j) {
+        ids[i].push_back(sub->getEventID());
+      }
+    }));
+  }
+
+  std::set<std::string> unique;
+  for (size_t i = 0; i < 4; ++i) {
+    threads[i].join();
+    unique.insert(ids[i].begin(), ids[i].end());
+  }
+  // Every ID is unique, across several reserved blocks.
+  EXPECT_EQ(unique.size(), 20000U);
+  EXPECT_EQ(unique.count("0"), 0U);
 }
 
 TEST_F(EventsDatabaseTests, test_event_add) {
@@ -68,7 +99,7 @@ TEST_F(EventsDatabaseTests, test_event_add) {
   EXPECT_TRUE(status.ok());
 }
 
-TEST_F(EventsDatabaseTests, test_record_indexing) {
+TEST_F(EventsDatabaseTests, test_record_keys) {
   auto sub = std::make_shared<FakeEventSubscriber>();
   auto status = sub->testAdd(2);
   status = sub->testAdd(11);
@@ -76,76 +107,152 @@ TEST_F(EventsDatabaseTests, test_record_indexing) {
   status = sub->testAdd((1 * 3600) + 1);
   status = sub->testAdd((2 * 3600) + 1);
 
-  // An "all" range, will pick up everything in the largest index.
-  auto indexes = sub->getIndexes(0, 3 * 3600);
-  auto output = boost::algorithm::join(indexes, ", ");
-  EXPECT_EQ(output, "3600.0, 3600.1, 3600.2");
-
-  // Restrict range to "most specific".
-  indexes = sub->getIndexes(0, 5);
-  output = boost::algorithm::join(indexes, ", ");
-  EXPECT_EQ(output, "10.0");
+  // Keys are ordered by time, then by EventID.
+  auto key = sub->recordKey(11, "3");
+  EXPECT_EQ(key.find(sub->recordPrefix()), 0U);
+  EXPECT_LT(sub->recordKey(2, "4"), key);
+  EXPECT_LT(key, sub->recordKey(11, "20"));
+  EXPECT_LT(sub->recordKey(11, "20"), sub->recordKey(61, "1"));
 
-  // Get a mix of indexes for the lower bounding.
-  indexes = sub->getIndexes(2, (3 * 3600));
-  output = boost::algorithm::join(indexes, ", ");
-  EXPECT_EQ(output, "3600.1, 3600.2, 60.1, 10.0, 10.1");
+  // Records are returned in time order.
+  auto records = sub->getRecords(0, 3 * 3600);
+  ASSERT_EQ(records.size(), 6U); // 1, 2, 11, 61, 3601, 7201
+  EXPECT_EQ(records[0].second, 1U);
+  EXPECT_EQ(records[1].second, 2U);
+  EXPECT_EQ(records[5].second, 7201U);
+  EXPECT_LT(boost::lexical_cast<size_t>(records[1].first),
+            boost::lexical_cast<size_t>(records[2].first));
 
-  // Rare, but test ONLY intermediate indexes.
-  indexes = sub->getIndexes(2, (3 * 3600), 1);
-  output = boost::algorithm::join(indexes, ", ");
-  EXPECT_EQ(output, "60.0, 60.1, 60.60, 60.120");
-
-  // Add specific indexes to the upper bound.
+  // Add specific records to the upper bound.
   status = sub->testAdd((2 * 3600) + 11);
   status = sub->testAdd((2 * 3600) + 61);
-  indexes = sub->getIndexes(2 * 3600, (2 * 3600) + 62);
-  output = boost::algorithm::join(indexes, ", ");
-  EXPECT_EQ(output, "60.120, 10.726");
-
-  // Request specific lower and upper bounding.
-  indexes = sub->getIndexes(2, (2 * 3600) + 62);
-  output = boost::algorithm::join(indexes, ", ");
-  EXPECT_EQ(output, "3600.1, 60.1, 60.120, 10.0, 10.1, 10.726");
+  records = sub->getRecords(2 * 3600, (2 * 3600) + 62);
+  EXPECT_EQ(records.size(), 3U); // 7201, 7211, 7261
 }
 
 TEST_F(EventsDatabaseTests, test_record_range) {
   auto sub = std::make_shared<FakeEventSubscriber>();
 
   // Search within a specific record range.
-  auto indexes = sub->getIndexes(0, 10);
-  auto records = sub->getRecords(indexes);
-  EXPECT_EQ(records.size(), 2); // 1, 2
+  auto records = sub->getRecords(0, 10);
+  EXPECT_EQ(records.size(), 2U); // 1, 2
 
-  // Search within a large bound.
-  indexes = sub->getIndexes(3, 3601);
-  // This will include the 0-10 bucket meaning 1, 2 will show up.
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(records.size(), 5); // 1, 2, 11, 61, 3601
+  // Search within a large bound, the bounds are inclusive.
+  records = sub->getRecords(3, 3601);
+  EXPECT_EQ(records.size(), 3U); // 11, 61, 3601
 
   // Get all of the records.
-  indexes = sub->getIndexes(0, 3 * 3600);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(records.size(), 8); // 1, 2, 11, 61, 3601, 7201, 7211, 7261
+  records = sub->getRecords(0, 3 * 3600);
+  EXPECT_EQ(records.size(), 8U); // 1, 2, 11, 61, 3601, 7201, 7211, 7261
 
   // stop = 0 is an alias for everything.
-  indexes = sub->getIndexes(0, 0);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(records.size(), 8);
+  records = sub->getRecords(0, 0);
+  EXPECT_EQ(records.size(), 8U);
+
+  // The event data is read with the same range.
+  sub->doNotExpire();
+  auto results = sub->get(0, 61);
+  ASSERT_EQ(results.size(), 4U);
+  EXPECT_EQ(results[0]["testing"], "hello from space");
+
+  // The streaming read stops when the yield returns false.
+  size_t yielded = 0;
+  sub->get(0, 0, [&yielded](Row& r) { return ++yielded < 2; });
+  EXPECT_EQ(yielded, 2U);
+
+  // Time constraints select the range read by the table.
+  QueryContext context;
+  context.constraints["time"].add(Constraint(GREATER_THAN, "11"));
+  context.constraints["time"].add(Constraint(LESS_THAN_OR_EQUALS, "3601"));
+  yielded = 0;
+  sub->genTable(context, [&yielded](Row& r) { return ++yielded > 0; });
+  EXPECT_EQ(yielded, 2U); // 61, 3601
 }
 
 TEST_F(EventsDatabaseTests, test_record_expiration) {
   auto sub = std::make_shared<FakeEventSubscriber>();
 
   // No expiration
-  auto indexes = sub->getIndexes(0, 60);
-  auto records = sub->getRecords(indexes);
-  EXPECT_EQ(records.size(), 3); // 1, 2, 11
-
-  sub->expire_events_ = true;
-  sub->expire_time_ = 10;
-  indexes = sub->getIndexes(0, 60);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(records.size(), 1); // 11
+  auto records = sub->getRecords(0, 60);
+  EXPECT_EQ(records.size(), 3U); // 1, 2, 11
+
+  EXPECT_TRUE(sub->expireRecords(10).ok());
+  records = sub->getRecords(0, 60);
+  EXPECT_EQ(records.size(), 1U); // 11
+
+  // Records after the expire time are not touched.
+  records = sub->getRecords(0, 0);
+  EXPECT_EQ(records.size(), 6U);
+}
+
+TEST_F(EventsDatabaseTests, test_expire) {
+  auto sub = std::make_shared<FakeEventSubscriber>();
+  sub->testAdd(getUnixTime() - 10);
+  sub->testAdd(getUnixTime());
+  auto records = sub->getRecords(0, 0);
+  ASSERT_GE(records.size(), 2U);
+
+  // Every record older than the events expiry is removed.
+  sub->expire();
+  records = sub->getRecords(0, 0);
+  EXPECT_EQ(records.size(), 2U);
+
+  // Subscribers that do not expire keep their records.
+  sub->doNotExpire();
+  sub->testAdd(1);
+  sub->expire();
+  EXPECT_EQ(sub->getRecords(0, 0).size(), 3U);
+}
+
+TEST_F(EventsDatabaseTests, test_add_batch) {
+  auto sub = std::make_shared<FakeEventSubscriber>();
+  sub->doNotExpire();
+  auto first = sub->getRecords(0, 0).size();
+
+  // A batch is stored as one record and read as each of its rows.
+  QueryData rows = {{{"action", "CREATED"}, {"path", "/tmp/a"}},
+                    {{"action", "CREATED"}, {"path", "/tmp/b"}}};
+  EXPECT_TRUE(sub->addBatch(rows, 5).ok());
+  EXPECT_EQ(sub->getRecords(0, 0).size(), first + 1);
+
+  auto results = sub->get(5, 5);
+  EXPECT_EQ(results, rows);
+}
+
+TEST_F(EventsDatabaseTests, test_retention) {
+  auto sub = std::make_shared<FakeEventSubscriber>();
+  sub->setName("RetentionSubscriber");
+  auto now = getUnixTime();
+  auto hour = now - (now % 3600);
+
+  // Usage is counted for each hourly partition.
+  sub->testAdd(hour - 7200);
+  sub->testAdd(hour - 3600);
+  sub->testAdd(hour);
+  sub->testAdd(hour);
+  auto usage = sub->getUsage();
+  EXPECT_EQ(usage.events, 4U);
+  EXPECT_GT(usage.bytes, 0U);
+
+  // Exceeding the events quota removes the oldest partitions.
+  EventRetention retention;
+  retention.max_events = 3;
+  EventFactory::setRetention({{"RetentionSubscriber", retention}});
+  sub->expire();
+  EXPECT_EQ(sub->getRecords(0, 0).size(), 3U);
+  EXPECT_EQ(sub->getUsage().events, 3U);
+
+  // The newest partition is kept even when it exceeds the quota.
+  retention.max_events = 1;
+  EventFactory::setRetention({{"RetentionSubscriber", retention}});
+  sub->expire();
+  EXPECT_EQ(sub->getRecords(0, 0).size(), 2U);
+  EXPECT_EQ(sub->getUsage().events, 2U);
+
+  // A retention age replaces the events expiry.
+  retention.max_events = 0;
+  retention.max_age = 60;
+  EXPECT_GE(sub->getAgeExpireTime(retention), now - 60);
+  EventFactory::setRetention({});
 }
 }
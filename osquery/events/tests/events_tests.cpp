@@ -10,6 +10,11 @@
 
 #include <typeinfo>
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include <boost/filesystem/operations.hpp>
 
 #include <gtest/gtest.h>
@@ -18,6 +23,9 @@
 #include <osquery/tables.h>
 
 #include "osquery/database/db_handle.h"
+#include "osquery/events/event_queue.h"
+#include "osquery/events/path_table.h"
+#include "osquery/events/subscription_index.h"
 
 namespace osquery {
 
@@ -382,4 +390,432 @@ TEST_F(EventsTests, test_fire_event) {
   pub->fire(ec, 0);
   EXPECT_EQ(kBellHathTolled, 4);
 }
+
+TEST_F(EventsTests, test_fire_batch) {
+  auto pub = std::make_shared<BasicEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+
+  auto subscription = Subscription::create("FakeSubscriber");
+  subscription->callback = TestTheeCallback;
+  EventFactory::addSubscription("publisher", subscription);
+
+  // Each event in the batch is dispatched with consecutive IDs.
+  kBellHathTolled = 0;
+  std::vector<EventContextRef> ecs = {pub->createEventContext(),
+                                      pub->createEventContext(),
+                                      pub->createEventContext()};
+  ecs[1]->time = 10;
+  pub->fireBatch(ecs, 20);
+  EXPECT_EQ(kBellHathTolled, 3);
+  EXPECT_EQ(ecs[1]->id, ecs[0]->id + 1);
+  EXPECT_EQ(ecs[2]->id, ecs[0]->id + 2);
+
+  // Events keep their own time, others use the batch time.
+  EXPECT_EQ(ecs[0]->time, 20U);
+  EXPECT_EQ(ecs[1]->time, 10U);
+  EXPECT_EQ(ecs[2]->time_string, "20");
+}
+
+TEST_F(EventsTests, test_event_queue) {
+  // The capacity is rounded to a power of 2.
+  EventQueue queue(3);
+  EXPECT_EQ(queue.capacity(), 4U);
+
+  std::vector<EventContextRef> events;
+  for (size_t i = 0; i < 5; i++) {
+    auto ec = std::make_shared<EventContext>();
+    ec->id = i;
+    events.push_back(ec);
+  }
+
+  for (size_t i = 0; i < 4; i++) {
+    EXPECT_TRUE(queue.push(events[i]));
+  }
+  EXPECT_EQ(queue.size(), 4U);
+  EXPECT_FALSE(queue.push(events[4]));
+
+  // Events are removed in the order they were added.
+  EventContextRef ec;
+  EXPECT_TRUE(queue.pop(ec));
+  EXPECT_EQ(ec->id, 0U);
+  EXPECT_TRUE(queue.push(events[4]));
+  for (size_t i = 1; i < 5; i++) {
+    EXPECT_TRUE(queue.pop(ec));
+    EXPECT_EQ(ec->id, i);
+  }
+  EXPECT_FALSE(queue.pop(ec));
+  EXPECT_EQ(queue.size(), 0U);
+}
+
+DECLARE_uint64(events_subscriber_queue_size);
+
+static std::atomic<size_t> kQueuedEvents(0);
+static std::atomic<bool> kQueueBlocked(false);
+
+Status QueuedCallback(EventContextRef context, const void* user_data) {
+  while (kQueueBlocked) {
+    ::usleep(1000);
+  }
+  kQueuedEvents++;
+  return Status(0, "OK");
+}
+
+TEST_F(EventsTests, test_fire_queued_event) {
+  auto pub = std::make_shared<BasicEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+  auto subscription = Subscription::create("FakeSubscriber");
+  subscription->callback = QueuedCallback;
+  EventFactory::addSubscription("publisher", subscription);
+
+  kQueuedEvents = 0;
+  pub->startDispatch(16);
+  for (size_t i = 0; i < 10; i++) {
+    pub->fire(pub->createEventContext(), 0);
+  }
+
+  // Stopping the dispatcher delivers every queued event.
+  pub->stopDispatch();
+  EXPECT_EQ(kQueuedEvents, 10U);
+  EXPECT_EQ(pub->numDropped(), 0U);
+  EXPECT_EQ(pub->numQueued(), 0U);
+
+  // Without a dispatcher events are delivered immediately.
+  pub->fire(pub->createEventContext(), 0);
+  EXPECT_EQ(kQueuedEvents, 11U);
+}
+
+TEST_F(EventsTests, test_fire_queue_drops) {
+  auto pub = std::make_shared<BasicEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+  auto subscription = Subscription::create("FakeSubscriber");
+  subscription->callback = QueuedCallback;
+  EventFactory::addSubscription("publisher", subscription);
+
+  // Call the subscriber from the dispatch thread, so the publisher's queue
+  // fills behind a blocked subscriber.
+  auto queue_size = FLAGS_events_subscriber_queue_size;
+  FLAGS_events_subscriber_queue_size = 0;
+
+  // A blocked subscriber holds at most one event, the queue holds two more.
+  kQueuedEvents = 0;
+  kQueueBlocked = true;
+  pub->startDispatch(2);
+  for (size_t i = 0; i < 6; i++) {
+    pub->fire(pub->createEventContext(), 0);
+  }
+  EXPECT_GE(pub->numDropped(), 3U);
+  EXPECT_EQ(pub->peakQueued(), 2U);
+
+  kQueueBlocked = false;
+  pub->stopDispatch();
+  EXPECT_EQ(kQueuedEvents + pub->numDropped(), 6U);
+  FLAGS_events_subscriber_queue_size = queue_size;
+}
+
+class QueuedEventSubscriber : public EventSubscriber<BasicEventPublisher> {
+ public:
+  QueuedEventSubscriber() : callbacks(0) { setName("QueuedSubscriber"); }
+
+  Status Callback(const EventContextRef& ec, const void* user_data) {
+    while (kQueueBlocked) {
+      ::usleep(1000);
+    }
+    callbacks++;
+    return Status(0, "OK");
+  }
+
+  void lateInit() {
+    subscribe(&QueuedEventSubscriber::Callback,
+              createSubscriptionContext(),
+              nullptr);
+  }
+
+  std::atomic<size_t> callbacks;
+};
+
+/// Wait for the publisher's dispatch thread to empty its queue.
+static void waitForDispatch(const std::shared_ptr<BasicEventPublisher>& pub) {
+  for (size_t i = 0; i < 1000 && pub->numQueued() > 0; i++) {
+    ::usleep(1000);
+  }
+}
+
+TEST_F(EventsTests, test_subscriber_queue) {
+  auto pub = std::make_shared<BasicEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+  auto sub = std::make_shared<QueuedEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
+  sub->lateInit();
+
+  // The dispatch thread keeps matching events while the callbacks block.
+  kQueueBlocked = true;
+  pub->startDispatch(16);
+  EXPECT_TRUE(sub->consuming_);
+  for (size_t i = 0; i < 10; i++) {
+    pub->fire(pub->createEventContext(), 0);
+  }
+  waitForDispatch(pub);
+  EXPECT_EQ(pub->numDropped(), 0U);
+  EXPECT_GE(sub->numQueued(), 9U);
+
+  // Stopping the dispatcher delivers every event queued for the subscriber.
+  ::usleep(5 * 1000);
+  kQueueBlocked = false;
+  pub->stopDispatch();
+  EXPECT_FALSE(sub->consuming_);
+  EXPECT_EQ(sub->callbacks, 10U);
+  EXPECT_EQ(sub->numQueued(), 0U);
+  EXPECT_EQ(sub->numDropped(), 0U);
+  EXPECT_GE(sub->peakLag(), 5U);
+
+  // Without a dispatcher callbacks are called immediately.
+  pub->fire(pub->createEventContext(), 0);
+  EXPECT_EQ(sub->callbacks, 11U);
+}
+
+TEST_F(EventsTests, test_subscriber_queue_shed) {
+  auto pub = std::make_shared<BasicEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+  auto sub = std::make_shared<QueuedEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
+  sub->lateInit();
+
+  EventFactory::setLowPriority({"QueuedSubscriber"});
+  EXPECT_TRUE(sub->isLowPriority());
+
+  // A low priority subscriber sheds events once its queue is half full.
+  auto queue_size = FLAGS_events_subscriber_queue_size;
+  FLAGS_events_subscriber_queue_size = 4;
+  kQueueBlocked = true;
+  pub->startDispatch(64);
+  for (size_t i = 0; i < 10; i++) {
+    pub->fire(pub->createEventContext(), 0);
+  }
+  waitForDispatch(pub);
+  EXPECT_LE(sub->numQueued(), 3U);
+  EXPECT_GE(sub->numDropped(), 6U);
+
+  kQueueBlocked = false;
+  pub->stopDispatch();
+  EXPECT_EQ(sub->callbacks + sub->numDropped(), 10U);
+
+  EventFactory::setLowPriority({});
+  EXPECT_FALSE(sub->isLowPriority());
+  FLAGS_events_subscriber_queue_size = queue_size;
+}
+
+TEST_F(EventsTests, test_subscription_path_index) {
+  SubscriptionPathIndex index;
+  auto etc = Subscription::create("etc");
+  auto hosts = Subscription::create("hosts");
+  auto tmp = Subscription::create("tmp");
+  index.add("/etc", true, etc);
+  index.add("/etc/hosts", false, hosts);
+  index.add("/tmp", false, tmp);
+  EXPECT_EQ(index.size(), 3U);
+
+  // Prefix subscriptions match every path below, exact only their path.
+  SubscriptionVector matches;
+  index.match("/etc/hosts", matches);
+  EXPECT_EQ(matches, SubscriptionVector({etc, hosts}));
+
+  matches.clear();
+  index.match("/etc/passwd", matches);
+  EXPECT_EQ(matches, SubscriptionVector({etc}));
+
+  matches.clear();
+  index.match("/tmp/file", matches);
+  EXPECT_TRUE(matches.empty());
+
+  // A rebuilt index replaces the previous subscriptions.
+  SubscriptionPathIndex rebuilt;
+  rebuilt.add("/tmp", true, tmp);
+  index.swap(rebuilt);
+  EXPECT_EQ(index.size(), 1U);
+  index.match("/tmp/file", matches);
+  EXPECT_EQ(matches, SubscriptionVector({tmp}));
+}
+
+TEST_F(EventsTests, test_path_table) {
+  PathTable paths;
+  auto etc = paths.setWatch("/etc", 1);
+  auto hosts = paths.setWatch("/etc/hosts", 2);
+  auto tmp = paths.setWatch("/tmp/", 3);
+
+  // Paths share their parent nodes, and are rebuilt exactly.
+  EXPECT_EQ(5U, paths.size());
+  EXPECT_EQ(hosts, paths.find("/etc/hosts"));
+  EXPECT_EQ(2, paths.getWatch("/etc/hosts"));
+  EXPECT_EQ(-1, paths.getWatch("/tmp"));
+  EXPECT_EQ(PathTable::kNoNode, paths.find("/etc/passwd"));
+
+  std::string path;
+  paths.getPath(tmp, path);
+  EXPECT_EQ("/tmp/", path);
+  paths.getPath(hosts, path);
+  EXPECT_EQ("/etc/hosts", path);
+  EXPECT_TRUE(paths.isWithin(hosts, etc));
+  EXPECT_FALSE(paths.isWithin(tmp, etc));
+
+  // A node is kept while it has children, its crawl ends with its watch.
+  paths.setCrawled(etc, true);
+  paths.removeWatch(etc);
+  EXPECT_FALSE(paths.isCrawled(etc));
+  EXPECT_EQ(hosts, paths.find("/etc/hosts"));
+  EXPECT_EQ(-1, paths.getWatch("/etc"));
+
+  // Unused nodes and names are removed, and reused.
+  auto components = paths.components();
+  paths.removeWatch(hosts);
+  EXPECT_EQ(PathTable::kNoNode, paths.find("/etc"));
+  EXPECT_EQ(3U, paths.size());
+  EXPECT_EQ(components - 2, paths.components());
+  auto var = paths.setWatch("/var/etc", 4);
+  paths.getPath(var, path);
+  EXPECT_EQ("/var/etc", path);
+  EXPECT_EQ(5U, paths.size());
+}
+
+TEST_F(EventsTests, test_time_range) {
+  QueryContext context;
+  EventTime start = 1;
+  EventTime stop = 1;
+  EXPECT_TRUE(EventSubscriberPlugin::getTimeRange(context, start, stop));
+  EXPECT_EQ(start, 0U);
+  EXPECT_EQ(stop, 0U);
+
+  context.constraints["time"].add(Constraint(GREATER_THAN, "100"));
+  context.constraints["time"].add(Constraint(GREATER_THAN_OR_EQUALS, "50"));
+  context.constraints["time"].add(Constraint(LESS_THAN, "200"));
+  EXPECT_TRUE(EventSubscriberPlugin::getTimeRange(context, start, stop));
+  EXPECT_EQ(start, 101U);
+  EXPECT_EQ(stop, 199U);
+
+  // Non-integer expressions do not bound the range.
+  context.constraints["time"].add(Constraint(LESS_THAN, "150.5"));
+  EXPECT_TRUE(EventSubscriberPlugin::getTimeRange(context, start, stop));
+  EXPECT_EQ(stop, 199U);
+
+  // Conflicting constraints match no records.
+  context.constraints["time"].add(Constraint(EQUALS, "10"));
+  EXPECT_FALSE(EventSubscriberPlugin::getTimeRange(context, start, stop));
+}
+
+#ifdef __linux__
+class PollEventPublisher
+    : public EventPublisher<SubscriptionContext, EventContext> {
+  DECLARE_PUBLISHER("PollPublisher");
+
+ public:
+  Status setUp() {
+    if (::pipe2(pipe_, O_NONBLOCK | O_CLOEXEC) == -1) {
+      return Status(1, "Could not create pipe");
+    }
+    return Status(0, "OK");
+  }
+
+  void tearDown() {
+    ::close(pipe_[0]);
+    ::close(pipe_[1]);
+  }
+
+  int getPollHandle() const { return pipe_[0]; }
+
+  Status process() {
+    char buffer[16];
+    while (::read(pipe_[0], buffer, sizeof(buffer)) > 0) {
+    }
+    processed++;
+    return Status(0, "OK");
+  }
+
+  int getPollTimeout() { return timeout; }
+
+  /// Make the poll handle readable.
+  void notify() { EXPECT_EQ(::write(pipe_[1], "x", 1), 1); }
+
+  /// Wait for the event loop to process the publisher.
+  bool waitForProcess(size_t count) {
+    for (size_t i = 0; i < 1000 && processed < count; ++i) {
+      ::usleep(1000);
+    }
+    return processed >= count;
+  }
+
+ public:
+  std::atomic<size_t> processed{0};
+  std::atomic<int> timeout{-1};
+
+ private:
+  int pipe_[2];
+};
+
+TEST_F(EventsTests, test_event_loop) {
+  auto pub = std::make_shared<PollEventPublisher>();
+  ASSERT_TRUE(EventFactory::registerEventPublisher(pub).ok());
+  boost::thread loop(EventFactory::run, "PollPublisher");
+
+  // The publisher is processed when its handle is readable.
+  pub->notify();
+  pub->notify();
+  EXPECT_TRUE(pub->waitForProcess(1));
+
+  // A wake recomputes the wait, a timeout processes without events.
+  pub->timeout = 1;
+  EventFactory::wake();
+  EXPECT_TRUE(pub->waitForProcess(3));
+
+  // Ending wakes the wait and removes the publisher.
+  pub->timeout = -1;
+  EventFactory::end();
+  loop.join();
+  EXPECT_EQ(EventFactory::numEventPublishers(), 0);
+}
+#endif
+
+DECLARE_bool(events_shared_loop);
+
+class AttachedEventPublisher
+    : public EventPublisher<SubscriptionContext, EventContext> {
+  DECLARE_PUBLISHER("AttachedPublisher");
+
+ public:
+  Status attach() {
+    attached = true;
+    return Status(0, "OK");
+  }
+
+  void tearDown() { torn_down = true; }
+
+ public:
+  bool attached{false};
+  bool torn_down{false};
+};
+
+TEST_F(EventsTests, test_attach_publisher) {
+  auto pub = std::make_shared<AttachedEventPublisher>();
+  ASSERT_TRUE(EventFactory::registerEventPublisher(pub).ok());
+
+  // An attached publisher is started without a thread.
+  EventFactory::delay();
+  EXPECT_TRUE(pub->attached);
+  EXPECT_TRUE(pub->isAttached());
+  EXPECT_TRUE(pub->hasStarted());
+
+  // Ending tears it down immediately.
+  EventFactory::end(true);
+  EXPECT_TRUE(pub->torn_down);
+  EXPECT_EQ(EventFactory::numEventPublishers(), 0);
+
+  // Without the shared loop the publisher runs in its own thread.
+  FLAGS_events_shared_loop = false;
+  pub = std::make_shared<AttachedEventPublisher>();
+  ASSERT_TRUE(EventFactory::registerEventPublisher(pub).ok());
+  EventFactory::delay();
+  EXPECT_FALSE(pub->attached);
+  EXPECT_FALSE(pub->isAttached());
+  EventFactory::end(true);
+  EXPECT_TRUE(pub->torn_down);
+  FLAGS_events_shared_loop = true;
+}
 }
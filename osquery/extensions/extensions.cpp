@@ -8,9 +8,21 @@
  *
  */
 
+#include <algorithm>
+#include <chrono>
 #include <csignal>
+#include <functional>
+
+#include <fcntl.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#else
+#include <sys/event.h>
+#endif
 
 #include <boost/algorithm/string/trim.hpp>
+#include <boost/noncopyable.hpp>
 
 #include <osquery/events.h>
 #include <osquery/filesystem.h>
@@ -19,6 +31,7 @@
 #include <osquery/sql.h>
 
 #include "osquery/extensions/interface.h"
+#include "osquery/core/metrics.h"
 #include "osquery/core/watcher.h"
 
 using namespace osquery::extensions;
@@ -30,6 +43,9 @@ namespace osquery {
 // Millisecond latency between initalizing manager pings.
 const size_t kExtensionInitializeLatencyUS = 20000;
 
+/// The status code of a call to a method the extension does not implement.
+const int kExtensionUnknownMethod = 3;
+
 #ifdef __APPLE__
 const std::string kModuleExtension = ".dylib";
 #else
@@ -58,6 +74,16 @@ CLI_FLAG(string,
          "3",
          "Seconds delay between connectivity checks")
 
+FLAG(bool,
+     extensions_shared_memory,
+     false,
+     "Receive large extension table results using shared memory");
+
+FLAG(uint64,
+     extensions_call_timeout,
+     0,
+     "Seconds to wait for an extension call, 0 for no limit");
+
 CLI_FLAG(string,
          modules_autoload,
          "/etc/osquery/modules.load",
@@ -76,6 +102,10 @@ EXTENSION_FLAG_ALIAS(socket, extensions_socket);
 EXTENSION_FLAG_ALIAS(timeout, extensions_timeout);
 EXTENSION_FLAG_ALIAS(interval, extensions_interval);
 
+static Status callPooled(const std::string& path,
+                         const std::function<void(ExtensionClient&)>& call,
+                         size_t timeout = FLAGS_extensions_call_timeout * 1000);
+
 void ExtensionWatcher::start() {
   // Watch the manager, if the socket is removed then the extension will die.
   while (true) {
@@ -93,7 +123,8 @@ void ExtensionWatcher::watch() {
   ExtensionStatus status;
   try {
     auto client = EXManagerClient(path_);
-    // Ping the extension manager until it goes down.
+    // Ping the extension manager until it goes down, or stops answering.
+    client.setTimeout(interval_);
     client.get()->ping(status);
   } catch (const std::exception& e) {
     LOG(WARNING) << "Extension watcher ending: osquery core has gone away";
@@ -112,11 +143,13 @@ void ExtensionManagerWatcher::watch() {
 
   ExtensionStatus status;
   for (const auto& uuid : uuids) {
-    try {
-      auto client = EXClient(getExtensionSocket(uuid));
-      // Ping the extension until it goes down.
-      client.get()->ping(status);
-    } catch (const std::exception& e) {
+    // Ping the extension until it goes down, reusing pooled connections.
+    // A ping that is not answered within an interval counts as a failure.
+    auto ping_status = callPooled(
+        getExtensionSocket(uuid),
+        [&status](ExtensionClient& client) { client.ping(status); },
+        interval_);
+    if (!ping_status.ok()) {
       failures_[uuid] += 1;
       continue;
     }
@@ -133,6 +166,7 @@ void ExtensionManagerWatcher::watch() {
     if (uuid.second >= 3) {
       LOG(INFO) << "Extension UUID " << uuid.first << " has gone away";
       Registry::removeBroadcast(uuid.first);
+      EXClientPool::instance().remove(getExtensionSocket(uuid.first));
       failures_[uuid.first] = 0;
     }
   }
@@ -224,34 +258,206 @@ Status loadModules(const std::string& loadfile) {
   return Status(1, "Failed reading: " + loadfile);
 }
 
-Status extensionPathActive(const std::string& path, bool use_timeout = false) {
+/// Check that an extension socket exists, is writable, and accepts.
+static Status extensionPathConnect(const std::string& path) {
   // Make sure the extension manager path exists, and is writable.
-  size_t delay = 0;
+  if (pathExists(path) && isWritable(path)) {
+    try {
+      auto client = EXManagerClient(path);
+      return Status(0, "OK");
+    } catch (const std::exception& e) {
+      // Path might exist without a connected extension or extension manager.
+    }
+  }
+  return Status(1, "Extension socket not available: " + path);
+}
+
+size_t getExtensionsTimeout() {
   // The timeout is given in seconds, but checked interval is microseconds.
   size_t timeout = atoi(FLAGS_extensions_timeout.c_str()) * 1000000;
   if (timeout < kExtensionInitializeLatencyUS * 10) {
     timeout = kExtensionInitializeLatencyUS * 10;
   }
-  do {
-    if (pathExists(path) && isWritable(path)) {
-      try {
-        auto client = EXManagerClient(path);
-        return Status(0, "OK");
-      } catch (const std::exception& e) {
-        // Path might exist without a connected extension or extension manager.
+  return timeout;
+}
+
+/**
+ * @brief Watch the directory of an extension socket for changes.
+ *
+ * An inotify (or kqueue) watch is added before the socket is first checked
+ * so a socket created between the check and the wait wakes the wait. If the
+ * directory cannot be watched, waits sleep for their full duration.
+ */
+class ExtensionPathMonitor : private boost::noncopyable {
+ public:
+  explicit ExtensionPathMonitor(const std::string& path) {
+    auto directory = fs::path(path).parent_path().string();
+    if (directory.empty()) {
+      directory = ".";
+    }
+#ifdef __linux__
+    fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd_ >= 0 &&
+        ::inotify_add_watch(
+            fd_, directory.c_str(), IN_CREATE | IN_MOVED_TO | IN_ATTRIB) < 0) {
+      ::close(fd_);
+      fd_ = -1;
+    }
+#else
+    fd_ = ::kqueue();
+#ifdef O_EVTONLY
+    directory_ = ::open(directory.c_str(), O_EVTONLY);
+#else
+    directory_ = ::open(directory.c_str(), O_RDONLY);
+#endif
+    struct kevent change;
+    EV_SET(&change,
+           directory_,
+           EVFILT_VNODE,
+           EV_ADD | EV_CLEAR,
+           NOTE_WRITE | NOTE_ATTRIB,
+           0,
+           nullptr);
+    if (fd_ < 0 || directory_ < 0 ||
+        ::kevent(fd_, &change, 1, nullptr, 0, nullptr) < 0) {
+      close();
+    }
+#endif
+  }
+
+  ~ExtensionPathMonitor() { close(); }
+
+  /// Wait up to a number of microseconds for a change in the directory.
+  void wait(size_t us) {
+    if (fd_ < 0) {
+      ::usleep(us);
+      return;
+    }
+#ifdef __linux__
+    struct pollfd event = {fd_, POLLIN, 0};
+    if (::poll(&event, 1, static_cast<int>((us + 999) / 1000)) > 0) {
+      // Drain the queued events, the caller checks the socket again.
+      char buffer[4096];
+      while (::read(fd_, buffer, sizeof(buffer)) > 0) {
       }
     }
-    // Only check active once if this check does not allow a timeout.
-    if (!use_timeout || timeout == 0) {
+#else
+    struct kevent event;
+    struct timespec timeout = {static_cast<time_t>(us / 1000000),
+                               static_cast<long>((us % 1000000) * 1000)};
+    ::kevent(fd_, nullptr, 0, &event, 1, &timeout);
+#endif
+  }
+
+ private:
+  void close() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+      fd_ = -1;
+    }
+#ifndef __linux__
+    if (directory_ >= 0) {
+      ::close(directory_);
+      directory_ = -1;
+    }
+#endif
+  }
+
+ private:
+  int fd_{-1};
+#ifndef __linux__
+  int directory_{-1};
+#endif
+};
+
+Status extensionPathActive(const std::string& path, bool use_timeout = false) {
+  // Only check active once if this check does not allow a timeout.
+  if (!use_timeout) {
+    return extensionPathConnect(path);
+  }
+
+  // Watch for the socket before the first check, then wait for it to appear.
+  ExtensionPathMonitor monitor(path);
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::microseconds(getExtensionsTimeout());
+  while (true) {
+    bool exists = pathExists(path).ok();
+    if (exists && extensionPathConnect(path).ok()) {
+      return Status(0, "OK");
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) {
       break;
     }
-    // Increase the total wait detail.
-    delay += kExtensionInitializeLatencyUS;
-    ::usleep(kExtensionInitializeLatencyUS);
-  } while (delay < timeout);
+    size_t remaining =
+        std::chrono::duration_cast<std::chrono::microseconds>(deadline - now)
+            .count();
+    // A socket that exists but does not accept is waiting for the listener,
+    // there will be no further directory event so check it again shortly.
+    monitor.wait((exists) ? std::min(remaining, kExtensionInitializeLatencyUS)
+                          : remaining);
+  }
   return Status(1, "Extension socket not available: " + path);
 }
 
+/**
+ * @brief Make a Thrift call using a pooled client for an extension socket.
+ *
+ * A reused client may have a connection the other side has since closed, the
+ * call is retried once with a new connection if a reused client fails. An
+ * application exception, such as an unknown method, is a completed call and
+ * the client is returned to the pool. A call that exceeds its millisecond
+ * timeout is not retried, its connection is dropped.
+ */
+/// Extension call latencies, and calls that failed in transport.
+static MetricHistogram kExtensionCallLatency("extensions.call");
+static MetricCounter kExtensionErrors("extensions.errors");
+
+static Status callPooled(const std::string& path,
+                         const std::function<void(ExtensionClient&)>& call,
+                         size_t timeout) {
+  MetricTimer timer(kExtensionCallLatency);
+  auto& pool = EXClientPool::instance();
+  for (size_t attempt = 0; attempt < 2; ++attempt) {
+    auto client = pool.acquire(path);
+    bool reused = (client != nullptr);
+    try {
+      if (!reused) {
+        // Make sure the extension path exists, and is writable.
+        auto status = extensionPathActive(path);
+        if (!status.ok()) {
+          return status;
+        }
+        client = std::make_shared<EXClient>(path);
+      }
+      client->setTimeout(timeout);
+      call(*client->get());
+    } catch (const TApplicationException& e) {
+      pool.release(path, client);
+      int code = (e.getType() == TApplicationException::UNKNOWN_METHOD)
+                     ? kExtensionUnknownMethod
+                     : 1;
+      return Status(code, "Extension call failed: " + std::string(e.what()));
+    } catch (const TTransportException& e) {
+      pool.fail(path);
+      kExtensionErrors.add();
+      if (reused && e.getType() != TTransportException::TIMED_OUT) {
+        continue;
+      }
+      return Status(1, "Extension call failed: " + std::string(e.what()));
+    } catch (const std::exception& e) {
+      pool.fail(path);
+      kExtensionErrors.add();
+      return Status(1, "Extension call failed: " + std::string(e.what()));
+    }
+
+    pool.release(path, client);
+    return Status(0, "OK");
+  }
+  return Status(1, "Extension call failed: " + path);
+}
+
 Status startExtension(const std::string& name, const std::string& version) {
   return startExtension(name, version, "0.0.0");
 }
@@ -338,7 +544,8 @@ Status startExtension(const std::string& manager_path,
   // Set the active config and logger plugins. The core will arbitrate if the
   // plugins are not available in the extension's local registry.
   Registry::setActive("config", options["config_plugin"].value);
-  Registry::setActive("logger", options["logger_plugin"].value);
+  auto loggers = split(options["logger_plugin"].value, ",");
+  Registry::setActive("logger", (loggers.empty()) ? "" : loggers.front());
   // Set up all lazy registry plugins and the active config/logger plugin.
   Registry::setUp();
 
@@ -415,20 +622,13 @@ Status pingExtension(const std::string& path) {
     return Status(1, "Extensions disabled");
   }
 
-  // Make sure the extension path exists, and is writable.
-  auto status = extensionPathActive(path);
+  ExtensionStatus ext_status;
+  auto status = callPooled(
+      path, [&ext_status](ExtensionClient& client) { client.ping(ext_status); });
   if (!status.ok()) {
     return status;
   }
 
-  ExtensionStatus ext_status;
-  try {
-    auto client = EXClient(path);
-    client.get()->ping(ext_status);
-  } catch (const std::exception& e) {
-    return Status(1, "Extension call failed: " + std::string(e.what()));
-  }
-
   return Status(ext_status.code, ext_status.message);
 }
 
@@ -486,19 +686,24 @@ Status callExtension(const std::string& extension_path,
                      const std::string& item,
                      const PluginRequest& request,
                      PluginResponse& response) {
-  // Make sure the extension manager path exists, and is writable.
-  auto status = extensionPathActive(extension_path);
-  if (!status.ok()) {
+  if (registry == "table" && request.count("action") > 0 &&
+      request.at("action") == "generate") {
+    // Table rows are returned by column.
+    std::vector<PluginResponse> responses;
+    auto status =
+        callExtensionTables(extension_path, {{item, request}}, responses);
+    if (!responses.empty()) {
+      response = std::move(responses[0]);
+    }
     return status;
   }
 
   ExtensionResponse ext_response;
-  try {
-    auto client = EXClient(extension_path);
-    client.get()->call(ext_response, registry, item, request);
-  }
-  catch (const std::exception& e) {
-    return Status(1, "Extension call failed: " + std::string(e.what()));
+  auto status = callPooled(extension_path, [&](ExtensionClient& client) {
+    client.call(ext_response, registry, item, request);
+  });
+  if (!status.ok()) {
+    return status;
   }
 
   // Convert from Thrift-internal list type to PluginResponse type.
@@ -510,6 +715,61 @@ Status callExtension(const std::string& extension_path,
   return Status(ext_response.status.code, ext_response.status.message);
 }
 
+Status callExtensionTables(const std::string& extension_path,
+                           const std::vector<TableRequest>& requests,
+                           std::vector<PluginResponse>& responses) {
+  responses.clear();
+  std::vector<ExtensionTableRequest> table_requests(requests.size());
+  for (size_t i = 0; i < requests.size(); ++i) {
+    table_requests[i].item = requests[i].first;
+    table_requests[i].request = requests[i].second;
+    table_requests[i].shared_memory = FLAGS_extensions_shared_memory;
+  }
+
+  std::vector<ExtensionTableResponse> table_responses;
+  auto status = callPooled(extension_path, [&](ExtensionClient& client) {
+    client.generate(table_responses, table_requests);
+  });
+  if (status.getCode() == kExtensionUnknownMethod) {
+    // The extension predates batched generate, call each table instead.
+    status = Status(0, "OK");
+    responses.resize(requests.size());
+    for (size_t i = 0; i < requests.size(); ++i) {
+      ExtensionResponse ext_response;
+      auto call_status = callPooled(extension_path, [&](ExtensionClient& c) {
+        c.call(ext_response, "table", requests[i].first, requests[i].second);
+      });
+      if (!call_status.ok()) {
+        return call_status;
+      }
+      if (ext_response.status.code != ExtensionCode::EXT_SUCCESS) {
+        status = Status(ext_response.status.code, ext_response.status.message);
+        continue;
+      }
+      for (const auto& row : ext_response.response) {
+        responses[i].push_back(row);
+      }
+    }
+    return status;
+  } else if (!status.ok()) {
+    return status;
+  }
+
+  responses.resize(requests.size());
+  for (size_t i = 0; i < table_responses.size() && i < requests.size(); ++i) {
+    const auto& table = table_responses[i];
+    if (table.status.code != ExtensionCode::EXT_SUCCESS) {
+      status = Status(table.status.code, table.status.message);
+      continue;
+    }
+    auto table_status = getTableResponse(table, responses[i]);
+    if (!table_status.ok()) {
+      status = table_status;
+    }
+  }
+  return status;
+}
+
 Status startExtensionWatcher(const std::string& manager_path,
                              size_t interval,
                              bool fatal) {
@@ -8,6 +8,16 @@
  *
  */
 
+#include <atomic>
+#include <cstring>
+#include <iterator>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <osquery/database.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 
@@ -16,6 +26,10 @@
 using namespace osquery::extensions;
 
 namespace osquery {
+
+/// Results with at least this many rows are sent using shared memory.
+const size_t kExtensionSharedMemoryRows = 1024;
+
 namespace extensions {
 
 void ExtensionHandler::ping(ExtensionStatus& _return) {
@@ -53,6 +67,33 @@ void ExtensionHandler::call(ExtensionResponse& _return,
   }
 }
 
+void ExtensionHandler::generate(
+    std::vector<ExtensionTableResponse>& _return,
+    const std::vector<ExtensionTableRequest>& requests) {
+  _return.resize(requests.size());
+  for (size_t i = 0; i < requests.size(); ++i) {
+    auto local_item = Registry::getAlias("table", requests[i].item);
+
+    PluginResponse response;
+    auto status =
+        Registry::call("table", local_item, requests[i].request, response);
+    _return[i].status.code = status.getCode();
+    _return[i].status.message = status.getMessage();
+    _return[i].status.uuid = uuid_;
+
+    if (!status.ok()) {
+      continue;
+    }
+
+    if (requests[i].shared_memory &&
+        response.size() >= kExtensionSharedMemoryRows &&
+        setSharedTableResponse(response, _return[i]).ok()) {
+      continue;
+    }
+    setTableResponse(response, _return[i]);
+  }
+}
+
 void ExtensionManagerHandler::extensions(InternalExtensionList& _return) {
   refresh();
   _return = extensions_;
@@ -173,6 +214,195 @@ bool ExtensionManagerHandler::exists(const std::string& name) {
 }
 }
 
+void setTableResponse(const PluginResponse& response,
+                      ExtensionTableResponse& table) {
+  // Rows may be sparse, the columns are the union of every row's columns.
+  std::map<std::string, size_t> columns;
+  for (const auto& row : response) {
+    for (const auto& column : row) {
+      columns.insert(std::make_pair(column.first, 0));
+    }
+  }
+
+  table.columns.clear();
+  table.columns.reserve(columns.size());
+  for (auto& column : columns) {
+    column.second = table.columns.size();
+    table.columns.push_back(column.first);
+  }
+
+  table.rows.clear();
+  table.rows.reserve(response.size());
+  table.absent.clear();
+  for (const auto& row : response) {
+    table.rows.push_back(std::vector<std::string>());
+    auto& values = table.rows.back();
+    values.reserve(columns.size());
+    // Both the row and columns are sorted by name.
+    auto value = row.begin();
+    for (const auto& column : columns) {
+      if (value != row.end() && value->first == column.first) {
+        values.push_back(value->second);
+        ++value;
+      } else {
+        table.absent.push_back(
+            (int64_t)((table.rows.size() - 1) * columns.size() +
+                      column.second));
+        values.push_back("");
+      }
+    }
+  }
+}
+
+Status setSharedTableResponse(const PluginResponse& response,
+                              ExtensionTableResponse& table) {
+  std::string raw;
+  auto status = serializeQueryDataBinary(response, raw);
+  if (!status.ok()) {
+    return status;
+  }
+
+  static std::atomic<size_t> kSharedPages{0};
+  auto name = "/osquery." + std::to_string(getpid()) + "." +
+              std::to_string(kSharedPages++);
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    return Status(1, "Cannot create shared memory: " + name);
+  }
+
+  bool written = (ftruncate(fd, raw.size()) == 0);
+  if (written && !raw.empty()) {
+    auto page = mmap(nullptr, raw.size(), PROT_WRITE, MAP_SHARED, fd, 0);
+    if (page == MAP_FAILED) {
+      written = false;
+    } else {
+      memcpy(page, raw.data(), raw.size());
+      munmap(page, raw.size());
+    }
+  }
+  close(fd);
+
+  if (!written) {
+    shm_unlink(name.c_str());
+    return Status(1, "Cannot write shared memory: " + name);
+  }
+  table.shared_memory = name;
+  return Status(0, "OK");
+}
+
+/// Read and unlink the shared memory page of a table response.
+static Status getSharedTableResponse(const std::string& name,
+                                     PluginResponse& response) {
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  // The page is only read once, unlink it whether or not it is readable.
+  shm_unlink(name.c_str());
+  if (fd < 0) {
+    return Status(1, "Cannot open shared memory: " + name);
+  }
+
+  struct stat page_stat;
+  if (fstat(fd, &page_stat) != 0) {
+    close(fd);
+    return Status(1, "Cannot stat shared memory: " + name);
+  }
+
+  std::string raw;
+  if (page_stat.st_size > 0) {
+    auto page = mmap(nullptr, page_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (page == MAP_FAILED) {
+      close(fd);
+      return Status(1, "Cannot map shared memory: " + name);
+    }
+    raw.assign(static_cast<const char*>(page), page_stat.st_size);
+    munmap(page, page_stat.st_size);
+  }
+  close(fd);
+
+  QueryData results;
+  auto status = deserializeQueryDataBinary(raw, results);
+  if (!status.ok()) {
+    return status;
+  }
+
+  if (response.empty()) {
+    response.swap(results);
+  } else {
+    std::move(results.begin(), results.end(), std::back_inserter(response));
+  }
+  return Status(0, "OK");
+}
+
+Status getTableResponse(const ExtensionTableResponse& table,
+                        PluginResponse& response) {
+  if (!table.shared_memory.empty()) {
+    return getSharedTableResponse(table.shared_memory, response);
+  }
+
+  auto absent = table.absent.begin();
+  size_t cell = 0;
+  for (const auto& values : table.rows) {
+    Row row;
+    for (size_t i = 0; i < values.size() && i < table.columns.size(); ++i) {
+      if (absent != table.absent.end() && (size_t)*absent == cell + i) {
+        ++absent;
+        continue;
+      }
+      row.emplace_hint(row.end(), table.columns[i], values[i]);
+    }
+    cell += table.columns.size();
+    response.push_back(std::move(row));
+  }
+  return Status(0, "OK");
+}
+
+/// Idle clients kept for each socket, each holds an extension server thread.
+const size_t kExtensionMaxIdleClients = 2;
+
+EXClientRef EXClientPool::acquire(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto idle = idle_.find(path);
+  if (idle == idle_.end() || idle->second.empty()) {
+    return nullptr;
+  }
+
+  auto client = idle->second.back();
+  idle->second.pop_back();
+  return client;
+}
+
+void EXClientPool::release(const std::string& path, EXClientRef client) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  failures_[path] = 0;
+  if (Registry::external()) {
+    // Extensions must not hold the extension manager's server threads.
+    return;
+  }
+
+  auto& idle = idle_[path];
+  if (idle.size() < kExtensionMaxIdleClients) {
+    idle.push_back(std::move(client));
+  }
+}
+
+void EXClientPool::fail(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  failures_[path] += 1;
+  // Other idle clients likely share the failed connection's fate.
+  idle_.erase(path);
+}
+
+void EXClientPool::remove(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  idle_.erase(path);
+  failures_.erase(path);
+}
+
+size_t EXClientPool::failures(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto failures = failures_.find(path);
+  return (failures == failures_.end()) ? 0 : failures->second;
+}
+
 ExtensionRunnerCore::~ExtensionRunnerCore() { remove(path_); }
 
 void ExtensionRunnerCore::stop() {
@@ -186,15 +416,13 @@ void ExtensionRunnerCore::startServer(TProcessorRef processor) {
   auto transport_fac = TTransportFactoryRef(new TBufferedTransportFactory());
   auto protocol_fac = TProtocolFactoryRef(new TBinaryProtocolFactory());
 
-  auto thread_manager_ =
-      ThreadManager::newSimpleThreadManager((size_t)FLAGS_worker_threads, 0);
-  auto thread_fac = ThriftThreadFactory(new PosixThreadFactory());
-  thread_manager_->threadFactory(thread_fac);
-  thread_manager_->start();
+  // A fixed pool would queue pings behind slow table calls, start a thread
+  // for each connection instead. Connections are bounded by the callers.
+  auto thread_fac = PosixThreadFactoryRef(new PosixThreadFactory());
 
   // Start the Thrift server's run loop.
-  server_ = TThreadPoolServerRef(new TThreadPoolServer(
-      processor, transport, transport_fac, protocol_fac, thread_manager_));
+  server_ = TThreadedServerRef(new TThreadedServer(
+      processor, transport, transport_fac, protocol_fac, thread_fac));
   server_->serve();
 }
 
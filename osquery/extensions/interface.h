@@ -10,6 +10,12 @@
 
 #pragma once
 
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
 #include <osquery/extensions.h>
 
 #include "osquery/dispatcher/dispatcher.h"
@@ -18,7 +24,8 @@
 // paths for their includes. Unfortunately, changing include paths is not
 // possible in every build system.
 // clang-format off
-#include CONCAT(OSQUERY_THRIFT_SERVER_LIB,/TThreadPoolServer.h)
+#include CONCAT(OSQUERY_THRIFT_LIB,/concurrency/PosixThreadFactory.h)
+#include CONCAT(OSQUERY_THRIFT_SERVER_LIB,/TThreadedServer.h)
 #include CONCAT(OSQUERY_THRIFT_LIB,/protocol/TBinaryProtocol.h)
 #include CONCAT(OSQUERY_THRIFT_LIB,/transport/TServerSocket.h)
 #include CONCAT(OSQUERY_THRIFT_LIB,/transport/TBufferTransports.h)
@@ -48,7 +55,7 @@ typedef SHARED_PTR_IMPL<TServerTransport> TServerTransportRef;
 typedef SHARED_PTR_IMPL<TTransportFactory> TTransportFactoryRef;
 typedef SHARED_PTR_IMPL<TProtocolFactory> TProtocolFactoryRef;
 typedef SHARED_PTR_IMPL<PosixThreadFactory> PosixThreadFactoryRef;
-typedef std::shared_ptr<TThreadPoolServer> TThreadPoolServerRef;
+typedef std::shared_ptr<TThreadedServer> TThreadedServerRef;
 
 namespace extensions {
 
@@ -81,6 +88,18 @@ class ExtensionHandler : virtual public ExtensionIf {
             const std::string& item,
             const ExtensionPluginRequest& request);
 
+  /**
+   * @brief The Thrift API used to generate several tables in one round trip.
+   *
+   * Each request is a table registry call, responses are returned in request
+   * order using the columnar ExtensionTableResponse.
+   *
+   * @param _return The table responses, one for each request.
+   * @param requests The table plugin names and requests.
+   */
+  void generate(std::vector<ExtensionTableResponse>& _return,
+                const std::vector<ExtensionTableRequest>& requests);
+
  protected:
   /// Transient UUID assigned to the extension after registering.
   RouteUUID uuid_;
@@ -191,6 +210,23 @@ typedef SHARED_PTR_IMPL<ExtensionHandler> ExtensionHandlerRef;
 typedef SHARED_PTR_IMPL<ExtensionManagerHandler> ExtensionManagerHandlerRef;
 }
 
+/// Convert table rows into the columnar Thrift response.
+void setTableResponse(const PluginResponse& response,
+                      extensions::ExtensionTableResponse& table);
+
+/**
+ * @brief Write table rows to a shared memory page for the caller to map.
+ *
+ * Large results are written once using the binary results encoding rather
+ * than being serialized through the Thrift protocol and socket.
+ */
+Status setSharedTableResponse(const PluginResponse& response,
+                              extensions::ExtensionTableResponse& table);
+
+/// Convert a columnar or shared memory Thrift response back into table rows.
+Status getTableResponse(const extensions::ExtensionTableResponse& table,
+                        PluginResponse& response);
+
 /// A Dispatcher service thread that watches an ExtensionManagerHandler.
 class ExtensionWatcher : public InternalRunnable {
  public:
@@ -243,7 +279,12 @@ class ExtensionRunnerCore : public InternalRunnable {
       : path_(path), server_(nullptr) {}
 
  public:
-  /// Given a handler transport and protocol start a thrift threaded server.
+  /**
+   * @brief Given a handler transport and protocol start a thrift server.
+   *
+   * Each connection is served by its own thread, a slow call only holds its
+   * own connection, and pings on other connections are answered immediately.
+   */
   void startServer(TProcessorRef processor);
 
   // The Dispatcher thread service stop point.
@@ -254,7 +295,7 @@ class ExtensionRunnerCore : public InternalRunnable {
   std::string path_;
 
   /// Server instance, will be stopped if thread service is removed.
-  TThreadPoolServerRef server_;
+  TThreadedServerRef server_;
 };
 
 /**
@@ -309,6 +350,12 @@ class EXInternal {
 
   virtual ~EXInternal() { transport_->close(); }
 
+  /// Limit the milliseconds a call may block sending or receiving, 0 for none.
+  void setTimeout(size_t timeout) {
+    socket_->setSendTimeout(static_cast<int>(timeout));
+    socket_->setRecvTimeout(static_cast<int>(timeout));
+  }
+
  protected:
   TSocketRef socket_;
   TTransportRef transport_;
@@ -345,4 +392,55 @@ class EXManagerClient : public EXInternal {
  private:
   std::shared_ptr<extensions::ExtensionManagerClient> client_;
 };
+
+/// A shared client to an extension or extension manager socket.
+typedef std::shared_ptr<EXClient> EXClientRef;
+
+/**
+ * @brief Connected extension clients, reused across calls for each socket.
+ *
+ * Opening a UNIX domain socket, transport, and protocol for every registry
+ * call is a measurable part of extension table latency. A client is held by
+ * one caller at a time and returned after a successful call. A client whose
+ * call failed is dropped so the next call reconnects.
+ *
+ * Each connection holds a Thrift server thread, so only the core keeps idle
+ * clients. The pool also tracks consecutive failed calls
+ * for each socket.
+ */
+class EXClientPool : private boost::noncopyable {
+ public:
+  static EXClientPool& instance() {
+    static EXClientPool pool;
+    return pool;
+  }
+
+  /// Take an idle client for a socket, or nullptr if there are none.
+  EXClientRef acquire(const std::string& path);
+
+  /// Return a client after a successful call.
+  void release(const std::string& path, EXClientRef client);
+
+  /// Record a failed call, the caller drops its client.
+  void fail(const std::string& path);
+
+  /// Close the idle clients of a socket, for example a removed extension.
+  void remove(const std::string& path);
+
+  /// The number of consecutive failed calls to a socket.
+  size_t failures(const std::string& path);
+
+ private:
+  EXClientPool() {}
+
+ private:
+  /// Idle connected clients for each socket path.
+  std::map<std::string, std::vector<EXClientRef>> idle_;
+
+  /// Consecutive failed calls for each socket path.
+  std::map<std::string, size_t> failures_;
+
+  /// Protects the idle clients and failure counts.
+  std::mutex mutex_;
+};
 }
@@ -14,6 +14,7 @@
 
 #include <osquery/extensions.h>
 #include <osquery/filesystem.h>
+#include <osquery/tables.h>
 
 #include "osquery/core/test_util.h"
 #include "osquery/extensions/interface.h"
@@ -114,6 +115,38 @@ TEST_F(ExtensionsTest, test_manager_runnable) {
   EXPECT_TRUE(socketExists(socket_path));
 }
 
+TEST_F(ExtensionsTest, test_client_pool) {
+  auto status = startExtensionManager(socket_path);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(socketExists(socket_path));
+
+  // A successful call returns its connected client to the pool.
+  auto& pool = EXClientPool::instance();
+  EXPECT_EQ(pool.acquire(socket_path), nullptr);
+  EXPECT_TRUE(pingExtension(socket_path).ok());
+  auto client = pool.acquire(socket_path);
+  ASSERT_NE(client, nullptr);
+
+  ExtensionStatus ext_status;
+  client->get()->ping(ext_status);
+  EXPECT_EQ(ext_status.code, ExtensionCode::EXT_SUCCESS);
+  pool.release(socket_path, client);
+
+  // The next call reuses the client.
+  EXPECT_TRUE(pingExtension(socket_path).ok());
+  EXPECT_EQ(pool.acquire(socket_path), client);
+  EXPECT_EQ(pool.failures(socket_path), 0U);
+
+  // Failures drop idle clients and are counted until a call succeeds.
+  pool.release(socket_path, client);
+  pool.fail(socket_path);
+  EXPECT_EQ(pool.failures(socket_path), 1U);
+  EXPECT_EQ(pool.acquire(socket_path), nullptr);
+  EXPECT_TRUE(pingExtension(socket_path).ok());
+  EXPECT_EQ(pool.failures(socket_path), 0U);
+  pool.remove(socket_path);
+}
+
 TEST_F(ExtensionsTest, test_extension_runnable) {
   auto status = startExtensionManager(socket_path);
   EXPECT_TRUE(status.ok());
@@ -234,6 +267,96 @@ TEST_F(ExtensionsTest, test_extension_broadcast) {
   Registry::allowDuplicates(false);
 }
 
+TEST_F(ExtensionsTest, test_table_response) {
+  PluginResponse rows = {
+      {{"a", "1"}, {"b", "2"}}, {{"b", "3"}}, {}, {{"a", ""}, {"c", "4"}},
+  };
+
+  ExtensionTableResponse table;
+  setTableResponse(rows, table);
+  EXPECT_EQ(table.columns, std::vector<std::string>({"a", "b", "c"}));
+  EXPECT_EQ(table.rows.size(), 4U);
+  EXPECT_EQ(table.rows[0], std::vector<std::string>({"1", "2", ""}));
+  // Missing cells are distinct from empty values.
+  EXPECT_EQ(table.absent, std::vector<int64_t>({2, 3, 5, 6, 7, 8, 10}));
+
+  PluginResponse output;
+  EXPECT_TRUE(getTableResponse(table, output).ok());
+  EXPECT_EQ(output, rows);
+}
+
+TEST_F(ExtensionsTest, test_shared_table_response) {
+  PluginResponse rows;
+  for (size_t i = 0; i < 2048; ++i) {
+    rows.push_back({{"id", std::to_string(i)}, {"path", "/tmp"}});
+  }
+  rows.push_back({{"id", ""}});
+
+  ExtensionTableResponse table;
+  EXPECT_TRUE(setSharedTableResponse(rows, table).ok());
+  EXPECT_FALSE(table.shared_memory.empty());
+  EXPECT_TRUE(table.rows.empty());
+
+  PluginResponse output;
+  EXPECT_TRUE(getTableResponse(table, output).ok());
+  EXPECT_EQ(output, rows);
+
+  // The page is unlinked after it is read.
+  output.clear();
+  EXPECT_FALSE(getTableResponse(table, output).ok());
+}
+
+class TestExtensionTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const { return {{"test_int", "INTEGER"}}; }
+
+  QueryData generate(QueryContext& context) {
+    return {{{"test_int", "1"}}, {{"test_int", "2"}}};
+  }
+};
+
+TEST_F(ExtensionsTest, test_extension_generate) {
+  auto status = startExtensionManager(socket_path);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(socketExists(socket_path));
+
+  Registry::add<TestExtensionTablePlugin>("table", "test_extension_table");
+  Registry::allowDuplicates(true);
+  status = startExtension(socket_path, "test", "0.1", "0.0.0", "0.0.1");
+  ASSERT_TRUE(status.ok());
+
+  RouteUUID uuid = (RouteUUID)stoi(status.getMessage(), nullptr, 0);
+  auto ext_socket = socket_path + "." + std::to_string(uuid);
+  EXPECT_TRUE(socketExists(ext_socket));
+
+  // Several tables are generated in one call.
+  PluginRequest request = {{"action", "generate"}};
+  std::vector<PluginResponse> responses;
+  status = callExtensionTables(ext_socket,
+                               {{"test_extension_table", request},
+                                {"test_extension_table", request}},
+                               responses);
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(responses.size(), 2U);
+  EXPECT_EQ(responses[1].size(), 2U);
+  EXPECT_EQ(responses[1][1]["test_int"], "2");
+
+  // A single table generate is also sent by column.
+  PluginResponse response;
+  status = callExtension(
+      ext_socket, "table", "test_extension_table", request, response);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(response, responses[0]);
+
+  // Failures are reported for the batch.
+  status = callExtensionTables(
+      ext_socket, {{"not_a_table", request}}, responses);
+  EXPECT_FALSE(status.ok());
+
+  Registry::removeBroadcast(uuid);
+  Registry::allowDuplicates(false);
+}
+
 TEST_F(ExtensionsTest, test_extension_module_search) {
   createMockFileStructure();
   EXPECT_TRUE(loadModules(kFakeDirectory));
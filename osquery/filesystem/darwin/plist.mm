@@ -8,6 +8,8 @@
  *
  */
 
+#include <map>
+#include <mutex>
 #include <sstream>
 
 #import <Foundation/Foundation.h>
@@ -22,6 +24,21 @@ namespace pt = boost::property_tree;
 
 namespace osquery {
 
+/// The most parsed property lists kept, the cache is emptied when full.
+const size_t kPlistCacheMax = 4096;
+
+/// A parsed property list and the file identity it was parsed from.
+struct PlistCacheEntry {
+  /// The file identity, see getFileIdentity.
+  std::string identity;
+  Status status;
+  pt::ptree tree;
+};
+
+/// Cached parses by path, ordered so a directory's paths are adjacent.
+static std::map<std::string, PlistCacheEntry> kPlistCache;
+static std::mutex kPlistCacheMutex;
+
 /**
  * @brief Filter selected data types from deserialized property list.
  *
@@ -193,4 +210,47 @@ Status parsePlist(const boost::filesystem::path& path, pt::ptree& tree) {
     return filterPlist(plist_data, tree);
   }
 }
+
+Status parsePlistCached(const boost::filesystem::path& path, pt::ptree& tree) {
+  std::string identity;
+  if (!getFileIdentity(path, identity).ok()) {
+    invalidatePlistCache(path.string());
+    tree.clear();
+    return Status(1, "Unable to read plist: " + path.string());
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(kPlistCacheMutex);
+    auto it = kPlistCache.find(path.string());
+    if (it != kPlistCache.end() && it->second.identity == identity) {
+      tree = it->second.tree;
+      return it->second.status;
+    }
+  }
+
+  // Parse without holding the lock, concurrent parses of a path are benign.
+  PlistCacheEntry entry;
+  entry.identity = identity;
+  entry.status = parsePlist(path, entry.tree);
+  tree = entry.tree;
+
+  std::lock_guard<std::mutex> lock(kPlistCacheMutex);
+  if (kPlistCache.size() >= kPlistCacheMax) {
+    kPlistCache.clear();
+  }
+  auto status = entry.status;
+  kPlistCache[path.string()] = std::move(entry);
+  return status;
+}
+
+void invalidatePlistCache(const std::string& path) {
+  std::lock_guard<std::mutex> lock(kPlistCacheMutex);
+  kPlistCache.erase(path);
+  auto prefix = (!path.empty() && path.back() == '/') ? path : path + "/";
+  auto it = kPlistCache.lower_bound(prefix);
+  while (it != kPlistCache.end() &&
+         it->first.compare(0, prefix.size(), prefix) == 0) {
+    it = kPlistCache.erase(it);
+  }
+}
 }
@@ -95,4 +95,26 @@ TEST_F(PlistTests, test_parse_plist_content_with_blobs) {
   // Verify we parsed the binary blob correctly
   EXPECT_NE(alias.find("Applications/Flux.app"), std::string::npos);
 }
+
+TEST_F(PlistTests, test_parse_plist_cached) {
+  auto path = kTestWorkingDirectory + "cached.plist";
+  std::string content;
+  readFile(kTestDataPath + "test.plist", content);
+  writeTextFile(path, content);
+
+  pt::ptree tree;
+  EXPECT_TRUE(parsePlistCached(path, tree).ok());
+  EXPECT_EQ(tree.get<std::string>("Label"), "com.apple.FileSyncAgent.sshd");
+
+  // A changed file is parsed again, even without an invalidation.
+  readFile(kTestDataPath + "test_array.plist", content);
+  writeTextFile(path, content);
+  EXPECT_TRUE(parsePlistCached(path, tree).ok());
+  EXPECT_THROW(tree.get<std::string>("Label"), pt::ptree_bad_path);
+
+  // Removed files are not served from the cache.
+  invalidatePlistCache(kTestWorkingDirectory);
+  fs::remove(path);
+  EXPECT_FALSE(parsePlistCached(path, tree).ok());
+}
 }
@@ -8,28 +8,43 @@
  *
  */
 
+#include <mutex>
 #include <sstream>
 
 #include <fcntl.h>
-#include <glob.h>
-#include <pwd.h>
 #include <sys/stat.h>
 
-#include <boost/algorithm/string.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 
+#include "osquery/core/users.h"
+
 namespace pt = boost::property_tree;
 namespace fs = boost::filesystem;
 
 namespace osquery {
 
+DECLARE_uint64(table_cache_max_bytes);
+
+/// Rows parsed from a file and the file identity they were parsed from.
+struct ParsedFileEntry {
+  std::string identity;
+  QueryData rows;
+  size_t bytes;
+};
+
+/// Cached rows by path, and the size of every cached row's values.
+static std::map<std::string, ParsedFileEntry> kParsedFiles;
+static size_t kParsedFileBytes = 0;
+static std::mutex kParsedFilesMutex;
+
 Status writeTextFile(const fs::path& path,
                      const std::string& content,
                      int permissions,
@@ -119,49 +134,110 @@ Status pathExists(const fs::path& path) {
   return Status(0, "1");
 }
 
-Status remove(const fs::path& path) {
-  auto status_code = std::remove(path.string().c_str());
-  return Status(status_code, "N/A");
+Status getFileIdentity(const fs::path& path, std::string& identity) {
+  struct stat file_stat;
+  if (stat(path.c_str(), &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+    return Status(1, "Cannot identify file: " + path.string());
+  }
+
+#ifdef __APPLE__
+  const auto& mtime = file_stat.st_mtimespec;
+  const auto& ctime = file_stat.st_ctimespec;
+#else
+  const auto& mtime = file_stat.st_mtim;
+  const auto& ctime = file_stat.st_ctim;
+#endif
+
+  // Nanosecond times detect writes within the same second.
+  std::stringstream stream;
+  stream << file_stat.st_dev << ":" << file_stat.st_ino << ":"
+         << file_stat.st_size << ":" << mtime.tv_sec << "." << mtime.tv_nsec
+         << ":" << ctime.tv_sec << "." << ctime.tv_nsec;
+  identity = stream.str();
+  return Status(0, "OK");
 }
 
-static void genGlobs(std::string path,
-                     std::vector<std::string>& results,
-                     GlobLimits limits) {
-  // Replace SQL-wildcard '%' with globbing wildcard '*'.
-  if (path.find("%") != std::string::npos) {
-    boost::replace_all(path, "%", "*");
-  } 
-
-  // Relative paths are a bad idea, but we try to accommodate.
-  if ((path.size() == 0 || path[0] != '/') && path[0] != '~') {
-    path = (fs::initial_path() / path).string();
+Status genParsedFile(const fs::path& path,
+                     const FileRowGenerator& generator,
+                     QueryData& results) {
+  std::string identity;
+  auto status = getFileIdentity(path, identity);
+  if (!status.ok()) {
+    return status;
   }
 
-  // Generate a glob set and recurse for double star.
-  while (true) {
-    glob_t data;
-    glob(path.c_str(), GLOB_TILDE | GLOB_MARK | GLOB_BRACE, nullptr, &data);
-    size_t count = data.gl_pathc;
-    for (size_t index = 0; index < count; index++) {
-      results.push_back(data.gl_pathv[index]);
+  {
+    std::lock_guard<std::mutex> lock(kParsedFilesMutex);
+    auto entry = kParsedFiles.find(path.string());
+    if (entry != kParsedFiles.end() && entry->second.identity == identity) {
+      results.insert(
+          results.end(), entry->second.rows.begin(), entry->second.rows.end());
+      return Status(0, "OK");
     }
-    globfree(&data);
-    // The end state is a non-recursive ending or empty set of matches.
-    size_t wild = path.rfind("**");
-    // Allow a trailing slash after the double wild indicator.
-    if (count == 0 || wild > path.size() || wild < path.size() - 3) {
-      break;
+  }
+
+  // A write after the stat changes the identity, the next query re-parses.
+  std::string content;
+  status = readFile(path, content);
+  if (!status.ok()) {
+    return status;
+  }
+
+  ParsedFileEntry parsed;
+  parsed.identity = identity;
+  parsed.bytes = 0;
+  generator(content, parsed.rows);
+  for (const auto& row : parsed.rows) {
+    for (const auto& column : row) {
+      parsed.bytes += column.first.size() + column.second.size();
     }
-    path += "/**";
   }
+  results.insert(results.end(), parsed.rows.begin(), parsed.rows.end());
 
-  // Prune results based on settings/requested glob limitations.
-  auto end = std::remove_if(
-      results.begin(), results.end(), [limits](const std::string& found) {
-        return !((found[found.length() - 1] == '/' && limits & GLOB_FOLDERS) ||
-                 (found[found.length() - 1] != '/' && limits & GLOB_FILES));
-      });
-  results.erase(end, results.end());
+  std::lock_guard<std::mutex> lock(kParsedFilesMutex);
+  auto entry = kParsedFiles.find(path.string());
+  if (entry != kParsedFiles.end()) {
+    kParsedFileBytes -= entry->second.bytes;
+    kParsedFiles.erase(entry);
+  }
+  if (parsed.bytes > FLAGS_table_cache_max_bytes) {
+    return Status(0, "OK");
+  } else if (kParsedFileBytes + parsed.bytes > FLAGS_table_cache_max_bytes) {
+    kParsedFiles.clear();
+    kParsedFileBytes = 0;
+  }
+  kParsedFileBytes += parsed.bytes;
+  kParsedFiles[path.string()] = std::move(parsed);
+  return Status(0, "OK");
+}
+
+void clearParsedFileCache() {
+  std::lock_guard<std::mutex> lock(kParsedFilesMutex);
+  kParsedFiles.clear();
+  kParsedFileBytes = 0;
+}
+
+Status remove(const fs::path& path) {
+  auto status_code = std::remove(path.string().c_str());
+  return Status(status_code, "N/A");
+}
+
+/// Collect the paths matching a pattern, none if the query is cancelled.
+static Status genGlobs(const fs::path& path,
+                       std::vector<std::string>& results,
+                       GlobLimits limits) {
+  GlobOptions options;
+  options.limits = limits;
+  auto status = resolveFilePattern(path,
+                                   [&results](const std::string& found) {
+                                     results.push_back(found);
+                                     return true;
+                                   },
+                                   options);
+  if (!status.ok()) {
+    results.clear();
+  }
+  return status;
 }
 
 Status resolveFilePattern(const fs::path& fs_path,
@@ -172,8 +248,7 @@ Status resolveFilePattern(const fs::path& fs_path,
 Status resolveFilePattern(const fs::path& fs_path,
                           std::vector<std::string>& results,
                           GlobLimits setting) {
-  genGlobs(fs_path.string(), results, setting);
-  return Status(0, "OK");
+  return genGlobs(fs_path, results, setting);
 }
 
 inline Status listInAbsoluteDirectory(const fs::path& path,
@@ -190,8 +265,7 @@ inline Status listInAbsoluteDirectory(const fs::path& path,
   } catch (const fs::filesystem_error& e) {
     return Status(1, e.what());
   }
-  genGlobs(path.string(), results, limits);
-  return Status(0, "OK");
+  return genGlobs(path, results, limits);
 }
 
 Status listFilesInDirectory(const fs::path& path,
@@ -270,12 +344,12 @@ bool safePermissions(const std::string& dir,
 const std::string& osqueryHomeDirectory() {
   static std::string homedir;
   if (homedir.size() == 0) {
-    // Try to get the caller's home directory using HOME and getpwuid.
-    auto user = getpwuid(getuid());
+    // Try to get the caller's home directory using HOME and the passwd entry.
+    UserInfo user;
     if (getenv("HOME") != nullptr && isWritable(getenv("HOME")).ok()) {
       homedir = std::string(getenv("HOME")) + "/.osquery";
-    } else if (user != nullptr && user->pw_dir != nullptr) {
-      homedir = std::string(user->pw_dir) + "/.osquery";
+    } else if (getUser(getuid(), user) && !user.directory.empty()) {
+      homedir = user.directory + "/.osquery";
     } else {
       // Failover to a temporary directory (used for the shell).
       homedir = "/tmp/osquery";
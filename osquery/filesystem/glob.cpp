@@ -0,0 +1,593 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pwd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/filesystem.h>
+#include <osquery/logger.h>
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+/// Size of the buffer directory entries are read into.
+const size_t kGlobDirentBufferSize = 32 * 1024;
+
+#if defined(__linux__)
+/// The record returned by getdents64, glibc does not declare it.
+struct LinuxDirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[1];
+};
+#endif
+
+/// A directory entry, the type is DT_UNKNOWN if it must be stat'd.
+struct GlobEntry {
+  std::string name;
+  unsigned char type;
+
+  bool operator<(const GlobEntry& other) const { return name < other.name; }
+};
+
+/// An open directory descriptor, closed when destroyed.
+class GlobDirectory : private boost::noncopyable {
+ public:
+  GlobDirectory(int parent, const std::string& name)
+      : fd_(::openat(
+            parent, name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)) {}
+
+  ~GlobDirectory() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+  }
+
+  int fd() const { return fd_; }
+  bool valid() const { return fd_ >= 0; }
+
+ private:
+  int fd_;
+};
+
+/// Directories open on the path to a recursive entry, to detect link loops.
+typedef std::vector<std::pair<dev_t, ino_t>> GlobAncestors;
+
+/// Start the ancestors of a recursion with the directory containing it.
+static void initGlobAncestors(int fd, GlobAncestors& ancestors) {
+  struct stat st;
+  if (::fstat(fd, &st) == 0) {
+    ancestors.push_back(std::make_pair(st.st_dev, st.st_ino));
+  }
+}
+
+inline bool hasGlobMagic(const std::string& component) {
+  return component.find_first_of("*?[\\") != std::string::npos;
+}
+
+/// Expand csh-style braces, "{a,b}", into each alternative pattern.
+static void expandBraces(const std::string& pattern,
+                         std::vector<std::string>& patterns) {
+  size_t open = std::string::npos;
+  size_t close = std::string::npos;
+  size_t depth = 0;
+  for (size_t i = 0; i < pattern.size() && close == std::string::npos; ++i) {
+    if (pattern[i] == '\\') {
+      i++;
+    } else if (pattern[i] == '{') {
+      if (depth++ == 0) {
+        open = i;
+      }
+    } else if (pattern[i] == '}' && depth > 0 && --depth == 0) {
+      close = i;
+    }
+  }
+
+  if (close == std::string::npos) {
+    patterns.push_back(pattern);
+    return;
+  }
+
+  std::vector<std::string> alternatives;
+  size_t start = open + 1;
+  for (size_t i = open + 1; i < close; ++i) {
+    if (pattern[i] == '\\') {
+      i++;
+    } else if (pattern[i] == '{') {
+      depth++;
+    } else if (pattern[i] == '}') {
+      depth--;
+    } else if (pattern[i] == ',' && depth == 0) {
+      alternatives.push_back(pattern.substr(start, i - start));
+      start = i + 1;
+    }
+  }
+  alternatives.push_back(pattern.substr(start, close - start));
+
+  auto prefix = pattern.substr(0, open);
+  auto suffix = pattern.substr(close + 1);
+  for (const auto& alternative : alternatives) {
+    expandBraces(prefix + alternative + suffix, patterns);
+  }
+}
+
+/// Replace a leading "~" or "~user" with the home directory.
+static std::string expandTilde(const std::string& pattern) {
+  if (pattern.empty() || pattern[0] != '~') {
+    return pattern;
+  }
+
+  auto slash = pattern.find('/');
+  auto user =
+      pattern.substr(1, (slash == std::string::npos) ? slash : slash - 1);
+  std::string home;
+  if (user.empty() && getenv("HOME") != nullptr) {
+    home = getenv("HOME");
+  } else {
+    struct passwd pwd;
+    struct passwd* result = nullptr;
+    std::vector<char> buffer(16 * 1024);
+    if (user.empty()) {
+      getpwuid_r(getuid(), &pwd, buffer.data(), buffer.size(), &result);
+    } else {
+      getpwnam_r(user.c_str(), &pwd, buffer.data(), buffer.size(), &result);
+    }
+    if (result != nullptr && result->pw_dir != nullptr) {
+      home = result->pw_dir;
+    }
+  }
+
+  if (home.empty()) {
+    return pattern;
+  }
+  return (slash == std::string::npos) ? home : home + pattern.substr(slash);
+}
+
+/**
+ * @brief Read the entries of a directory matching a component pattern.
+ *
+ * Without a pattern every entry not beginning with a '.' matches, like a '*'.
+ * Entries are read with getdents64 where available, returning each entry's
+ * type without a stat.
+ */
+static void readGlobEntries(int fd,
+                            const std::string* pattern,
+                            std::vector<char>& buffer,
+                            std::vector<GlobEntry>& entries) {
+  auto matches = [pattern](const char* name) {
+    if (name[0] == '.' &&
+        (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+      return false;
+    }
+    if (pattern == nullptr) {
+      return name[0] != '.';
+    }
+    return ::fnmatch(pattern->c_str(), name, FNM_PERIOD) == 0;
+  };
+
+#if defined(__linux__)
+  buffer.resize(kGlobDirentBufferSize);
+  while (true) {
+    auto size = ::syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+    if (size <= 0) {
+      break;
+    }
+    for (long offset = 0; offset < size;) {
+      auto entry = reinterpret_cast<LinuxDirent64*>(buffer.data() + offset);
+      offset += entry->d_reclen;
+      if (matches(entry->d_name)) {
+        entries.push_back({entry->d_name, entry->d_type});
+      }
+    }
+  }
+#else
+  // The DIR owns and closes its descriptor.
+  auto copy = ::dup(fd);
+  auto dir = (copy >= 0) ? ::fdopendir(copy) : nullptr;
+  if (dir == nullptr) {
+    if (copy >= 0) {
+      ::close(copy);
+    }
+    return;
+  }
+  struct dirent* entry = nullptr;
+  while ((entry = ::readdir(dir)) != nullptr) {
+    if (matches(entry->d_name)) {
+      entries.push_back({entry->d_name, entry->d_type});
+    }
+  }
+  ::closedir(dir);
+#endif
+
+  // Match the sorted order of glob(3).
+  std::sort(entries.begin(), entries.end());
+}
+
+/// Resolve the type of an entry, following links like glob(3) does.
+static bool isGlobDirectory(int parent, const GlobEntry& entry) {
+  if (entry.type != DT_UNKNOWN && entry.type != DT_LNK) {
+    return entry.type == DT_DIR;
+  }
+
+  struct stat st;
+  if (::fstatat(parent, entry.name.c_str(), &st, 0) != 0) {
+    return false;
+  }
+  return S_ISDIR(st.st_mode);
+}
+
+/**
+ * @brief Resolve patterns by walking directory descriptors.
+ *
+ * Each component of a pattern is matched within the descriptor of its parent,
+ * opened relative to the previous component, so paths are never re-resolved
+ * from the root. A final component ending in a double wildcard also yields
+ * every entry below its matching directories, to options.max_depth levels.
+ */
+class GlobWalker : private boost::noncopyable {
+ public:
+  GlobWalker(const GlobOptions& options, const GlobYield& yield)
+      : options_(options), yield_(yield) {}
+
+  /// Resolve an absolute pattern, returning false once the walk stops.
+  bool walk(std::string pattern);
+
+  /// Yield a directory's entries below a recursive wildcard.
+  bool recurse(int fd,
+               const std::string& prefix,
+               size_t depth,
+               GlobAncestors& ancestors);
+
+  bool cancelled() const { return cancelled_; }
+
+ private:
+  /// Match the component at index within a directory.
+  bool match(int fd, const std::string& prefix, size_t index);
+
+  /// Yield each matched final component, and the entries below them.
+  bool matchLast(int fd,
+                 const std::string& prefix,
+                 std::vector<GlobEntry>& entries);
+
+  /// Expand the subdirectories of entries with a thread per subdirectory.
+  bool matchParallel(int fd,
+                     const std::string& prefix,
+                     std::vector<GlobEntry>& entries);
+
+  /// Yield a path if it is allowed by the limits.
+  bool emit(const std::string& path, bool directory);
+
+  /// Check if the walk should stop, before reading a directory.
+  bool stopping();
+
+ private:
+  const GlobOptions& options_;
+  const GlobYield& yield_;
+
+  std::vector<std::string> components_;
+  bool recursive_{false};
+  bool folders_only_{false};
+
+  std::vector<char> buffer_;
+  size_t count_{0};
+  bool stopped_{false};
+  bool cancelled_{false};
+};
+
+bool GlobWalker::stopping() {
+  if (!stopped_ && isQueryCancelled()) {
+    cancelled_ = true;
+    stopped_ = true;
+  }
+  return stopped_;
+}
+
+bool GlobWalker::emit(const std::string& path, bool directory) {
+  if (stopped_) {
+    return false;
+  }
+
+  if (directory && (options_.limits & GLOB_FOLDERS)) {
+    stopped_ = !yield_((path.back() == '/') ? path : path + "/");
+  } else if (!directory && (options_.limits & GLOB_FILES)) {
+    stopped_ = !yield_(path);
+  } else {
+    return true;
+  }
+
+  if (options_.max_results > 0 && ++count_ >= options_.max_results) {
+    VLOG(1) << "Pattern resolution stopped at " << count_ << " results";
+    stopped_ = true;
+  }
+  return !stopped_;
+}
+
+bool GlobWalker::walk(std::string pattern) {
+  // A trailing slash only matches directories.
+  while (pattern.size() > 1 && pattern.back() == '/') {
+    folders_only_ = true;
+    pattern.pop_back();
+  }
+
+  components_.clear();
+  boost::split(components_, pattern, boost::is_any_of("/"));
+  components_.erase(
+      std::remove(components_.begin(), components_.end(), ""),
+      components_.end());
+  if (components_.empty()) {
+    return emit("/", true);
+  }
+
+  const auto& last = components_.back();
+  recursive_ =
+      (last.size() >= 2 && last.compare(last.size() - 2, 2, "**") == 0);
+  if (recursive_) {
+    // Slashes after a double wildcard do not limit the recursion.
+    folders_only_ = false;
+  }
+
+  GlobDirectory root(AT_FDCWD, "/");
+  if (!root.valid()) {
+    return true;
+  }
+  return match(root.fd(), "/", 0) && !stopped_;
+}
+
+bool GlobWalker::match(int fd, const std::string& prefix, size_t index) {
+  if (stopping()) {
+    return false;
+  }
+
+  const auto& component = components_[index];
+  bool last = (index + 1 == components_.size());
+  if (!hasGlobMagic(component)) {
+    if (!last) {
+      GlobDirectory child(fd, component);
+      return !child.valid() ||
+             match(child.fd(), prefix + component + "/", index + 1);
+    }
+
+    std::vector<GlobEntry> entries = {{component, DT_UNKNOWN}};
+    struct stat st;
+    if (::fstatat(fd, component.c_str(), &st, 0) != 0) {
+      return true;
+    }
+    entries[0].type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+    return matchLast(fd, prefix, entries);
+  }
+
+  std::vector<GlobEntry> entries;
+  readGlobEntries(fd, &component, buffer_, entries);
+  if (last) {
+    return matchLast(fd, prefix, entries);
+  }
+
+  for (const auto& entry : entries) {
+    if (entry.type != DT_UNKNOWN && entry.type != DT_LNK &&
+        entry.type != DT_DIR) {
+      continue;
+    }
+    GlobDirectory child(fd, entry.name);
+    if (child.valid() &&
+        !match(child.fd(), prefix + entry.name + "/", index + 1)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool GlobWalker::matchLast(int fd,
+                           const std::string& prefix,
+                           std::vector<GlobEntry>& entries) {
+  if (recursive_ && options_.threads > 1 && options_.max_depth > 1) {
+    return matchParallel(fd, prefix, entries);
+  }
+
+  GlobAncestors ancestors;
+  if (recursive_) {
+    initGlobAncestors(fd, ancestors);
+  }
+  for (const auto& entry : entries) {
+    bool directory = isGlobDirectory(fd, entry);
+    if (folders_only_ && !directory) {
+      continue;
+    }
+
+    auto path = prefix + entry.name;
+    if (!emit(path, directory)) {
+      return false;
+    }
+
+    if (recursive_ && directory && options_.max_depth > 1) {
+      GlobDirectory child(fd, entry.name);
+      if (child.valid() && !recurse(child.fd(), path + "/", 2, ancestors)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool GlobWalker::recurse(int fd,
+                         const std::string& prefix,
+                         size_t depth,
+                         GlobAncestors& ancestors) {
+  if (stopping()) {
+    return false;
+  }
+
+  // Do not descend into a directory linked from below itself.
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    return true;
+  }
+  auto identity = std::make_pair(st.st_dev, st.st_ino);
+  if (std::find(ancestors.begin(), ancestors.end(), identity) !=
+      ancestors.end()) {
+    return true;
+  }
+
+  std::vector<GlobEntry> entries;
+  readGlobEntries(fd, nullptr, buffer_, entries);
+
+  ancestors.push_back(identity);
+  bool walking = true;
+  for (const auto& entry : entries) {
+    bool directory = isGlobDirectory(fd, entry);
+    auto path = prefix + entry.name;
+    if (!emit(path, directory)) {
+      walking = false;
+      break;
+    }
+
+    if (directory && depth < options_.max_depth) {
+      GlobDirectory child(fd, entry.name);
+      if (child.valid() &&
+          !recurse(child.fd(), path + "/", depth + 1, ancestors)) {
+        walking = false;
+        break;
+      }
+    }
+  }
+  ancestors.pop_back();
+  return walking;
+}
+
+bool GlobWalker::matchParallel(int fd,
+                               const std::string& prefix,
+                               std::vector<GlobEntry>& entries) {
+  std::vector<char> directories;
+  for (const auto& entry : entries) {
+    directories.push_back(isGlobDirectory(fd, entry));
+  }
+
+  // Each subdirectory is walked into its own buffer, yielded in order after.
+  // Workers write separate elements, so the flags are not packed bits.
+  std::vector<std::vector<std::string>> subtrees(entries.size());
+  std::vector<char> cancelled(entries.size(), false);
+  std::atomic<size_t> next(0);
+  auto cancellation = getQueryCancellation();
+  auto worker = [&]() {
+    ScopedQueryCancellation scope(cancellation);
+    GlobOptions options = options_;
+    options.threads = 1;
+    while (true) {
+      auto index = next++;
+      if (index >= entries.size()) {
+        break;
+      }
+      if (!directories[index]) {
+        continue;
+      }
+
+      auto& subtree = subtrees[index];
+      GlobYield yield = [&subtree](const std::string& path) {
+        subtree.push_back(path);
+        return true;
+      };
+      GlobWalker walker(options, yield);
+      GlobDirectory child(fd, entries[index].name);
+      if (child.valid()) {
+        GlobAncestors ancestors;
+        initGlobAncestors(fd, ancestors);
+        walker.recurse(
+            child.fd(), prefix + entries[index].name + "/", 2, ancestors);
+        cancelled[index] = walker.cancelled();
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  auto count = std::min(options_.threads, entries.size());
+  for (size_t i = 0; i < count; ++i) {
+    threads.emplace_back(worker);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (size_t index = 0; index < entries.size(); ++index) {
+    if (cancelled[index]) {
+      cancelled_ = true;
+      stopped_ = true;
+      return false;
+    }
+    if (!emit(prefix + entries[index].name, directories[index])) {
+      return false;
+    }
+    for (const auto& path : subtrees[index]) {
+      // Paths in the subtree already passed the limits.
+      if (options_.max_results > 0 && count_ >= options_.max_results) {
+        stopped_ = true;
+        return false;
+      }
+      if (!yield_(path)) {
+        stopped_ = true;
+        return false;
+      }
+      count_++;
+    }
+  }
+  return true;
+}
+
+Status resolveFilePattern(const fs::path& fs_path,
+                          const GlobYield& yield,
+                          const GlobOptions& options) {
+  auto path = fs_path.string();
+  // Replace SQL-wildcard '%' with globbing wildcard '*'.
+  if (path.find("%") != std::string::npos) {
+    boost::replace_all(path, "%", "*");
+  }
+
+  // Relative paths are a bad idea, but we try to accommodate.
+  if ((path.size() == 0 || path[0] != '/') && path[0] != '~') {
+    path = (fs::initial_path() / path).string();
+  }
+
+  std::vector<std::string> patterns;
+  expandBraces(path, patterns);
+  GlobWalker walker(options, yield);
+  for (const auto& pattern : patterns) {
+    auto absolute = expandTilde(pattern);
+    if (absolute.empty() || absolute[0] != '/') {
+      continue;
+    }
+    if (!walker.walk(absolute)) {
+      break;
+    }
+  }
+
+  if (walker.cancelled()) {
+    return Status(1, "Query cancelled");
+  }
+  return Status(0, "OK");
+}
+}
@@ -13,8 +13,11 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <string.h>
 #include <unistd.h>
 
+#include <vector>
+
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
@@ -35,13 +38,14 @@ Status readMem(int fd, size_t base, size_t length, uint8_t* buffer) {
   // Read from raw memory until an unrecoverable read error or the all of the
   // requested bytes are read.
   size_t total_read = 0;
-  size_t bytes_read = 0;
-  while (total_read != length && bytes_read != 0) {
-    bytes_read = read(fd, buffer + total_read, length - total_read);
+  while (total_read != length) {
+    auto bytes_read = read(fd, buffer + total_read, length - total_read);
     if (bytes_read == -1) {
       if (errno != EINTR) {
         return Status(1, "Cannot read requested length");
       }
+    } else if (bytes_read == 0) {
+      break;
     } else {
       total_read += bytes_read;
     }
@@ -55,9 +59,7 @@ Status readMem(int fd, size_t base, size_t length, uint8_t* buffer) {
   return Status(0, "OK");
 }
 
-Status readRawMem(size_t base, size_t length, void** buffer) {
-  *buffer = 0;
-
+Status mapRawMem(size_t base, size_t length, const RawMemVisitor& visitor) {
   if (FLAGS_disable_memory) {
     return Status(1, "Configuration has disabled physical memory reads");
   }
@@ -72,16 +74,11 @@ Status readRawMem(size_t base, size_t length, void** buffer) {
     return status;
   }
 
-  int fd = open(kLinuxMemPath.c_str(), O_RDONLY);
+  int fd = open(kLinuxMemPath.c_str(), O_RDONLY | O_CLOEXEC);
   if (fd < 0) {
     return Status(1, std::string("Cannot open ") + kLinuxMemPath);
   }
 
-  if ((*buffer = malloc(length)) == nullptr) {
-    close(fd);
-    return Status(1, "Cannot allocate memory for read");
-  }
-
 #ifdef _SC_PAGESIZE
   size_t offset = base % sysconf(_SC_PAGESIZE);
 #else
@@ -89,24 +86,46 @@ Status readRawMem(size_t base, size_t length, void** buffer) {
   size_t offset = base % getpagesize();
 #endif
 
-  // Use memmap for maximum portability over read().
+  // The window covers the requested pages only, and is read in place.
   auto map = mmap(0, offset + length, PROT_READ, MAP_SHARED, fd, base - offset);
-  if (map == MAP_FAILED) {
-    // Could fallback to a lseek/read.
-    if (!readMem(fd, base, length, (uint8_t*)*buffer).ok()) {
-      close(fd);
-      free(*buffer);
-      return Status(1, "Cannot memory map or seek/read memory");
-    }
-  } else {
-    // Memory map succeeded, copy and unmap.
-    memcpy(*buffer, (uint8_t*)map + offset, length);
+  if (map != MAP_FAILED) {
+    close(fd);
+    visitor((const uint8_t*)map + offset, length);
     if (munmap(map, offset + length) == -1) {
       LOG(WARNING) << "Unable to unmap raw memory";
     }
+    return Status(0, "OK");
   }
 
+  // Some kernels restrict mapping /dev/mem, fallback to a lseek/read.
+  std::vector<uint8_t> buffer(length);
+  status = readMem(fd, base, length, buffer.data());
   close(fd);
+  if (!status.ok()) {
+    return Status(1, "Cannot memory map or seek/read memory");
+  }
+  visitor(buffer.data(), length);
+  return Status(0, "OK");
+}
+
+Status readRawMem(size_t base, size_t length, void** buffer) {
+  *buffer = 0;
+
+  void* copy = nullptr;
+  auto status = mapRawMem(base, length, [&copy](const uint8_t* data,
+                                                size_t size) {
+    if ((copy = malloc(size)) != nullptr) {
+      memcpy(copy, data, size);
+    }
+  });
+  if (!status.ok()) {
+    return status;
+  }
+
+  if (copy == nullptr) {
+    return Status(1, "Cannot allocate memory for read");
+  }
+  *buffer = copy;
   return Status(0, "OK");
 }
 }
@@ -8,10 +8,18 @@
  *
  */
 
+#include <dirent.h>
+#include <fcntl.h>
 #include <linux/limits.h>
+#include <sys/resource.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
 #include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
 
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
@@ -20,6 +28,15 @@ namespace osquery {
 
 const std::string kLinuxProcPath = "/proc";
 
+/// Seconds a shared descriptor index of every process is reused.
+const size_t kProcDescriptorIndexTTL = 1;
+
+/// Seconds a shared snapshot of every process is reused.
+const size_t kProcSnapshotTTL = 1;
+
+/// Process directories a snapshot keeps open, at most a quarter of the limit.
+const size_t kProcSnapshotMaxOpen = 1024;
+
 Status procProcesses(std::set<std::string>& processes) {
   // Iterate over each process-like directory in proc.
   boost::filesystem::directory_iterator it(kLinuxProcPath), end;
@@ -40,41 +57,179 @@ Status procProcesses(std::set<std::string>& processes) {
   return Status(0, "OK");
 }
 
-Status procDescriptors(const std::string& process,
-                       std::map<std::string, std::string>& descriptors) {
-  auto descriptors_path = kLinuxProcPath + "/" + process + "/fd";
-  try {
-    // Access to the process' /fd may be restricted.
-    boost::filesystem::directory_iterator it(descriptors_path), end;
-    for (; it != end; ++it) {
-      auto fd = it->path().leaf().string();
-      std::string linkname;
-      if (procReadDescriptor(process, fd, linkname).ok()) {
-        descriptors[fd] = linkname;
+ProcDirectory::ProcDirectory(const std::string& pid) {
+  auto path = kLinuxProcPath + "/" + pid;
+  fd_ = ::open(path.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+}
+
+ProcDirectory::~ProcDirectory() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+int ProcDirectory::open(const char* attr) const {
+  return ::openat(fd_, attr, O_RDONLY | O_CLOEXEC);
+}
+
+Status ProcDirectory::readLink(const char* attr, std::string& target) const {
+  char link[PATH_MAX];
+  auto size = ::readlinkat(fd_, attr, link, sizeof(link) - 1);
+  if (size < 0) {
+    return Status(1, "Could not read path");
+  }
+  target.assign(link, size);
+  return Status(0, "OK");
+}
+
+Status ProcDirectory::descriptors(
+    std::map<std::string, std::string>& descriptors) const {
+  // Access to the process' /fd may be restricted.
+  int fd = ::openat(fd_, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return Status(1, "Cannot access descriptors");
+  }
+  auto dir = ::fdopendir(fd);
+  if (dir == nullptr) {
+    ::close(fd);
+    return Status(1, "Cannot access descriptors");
+  }
+
+  char link[PATH_MAX];
+  struct dirent* entry = nullptr;
+  while ((entry = ::readdir(dir)) != nullptr) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    auto size = ::readlinkat(fd, entry->d_name, link, sizeof(link) - 1);
+    if (size >= 0) {
+      descriptors[entry->d_name] = std::string(link, size);
+    }
+  }
+  ::closedir(dir);
+  return Status(0, "OK");
+}
+
+ProcSnapshot::ProcSnapshot(const std::set<std::string>& pids) {
+  // Keep directories open within a share of the descriptor limit.
+  size_t open_max = kProcSnapshotMaxOpen;
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+      limit.rlim_cur != RLIM_INFINITY) {
+    open_max = std::min(open_max, (size_t)limit.rlim_cur / 4);
+  }
+
+  for (const auto& pid : pids) {
+    if (directories_.size() < open_max) {
+      auto directory = std::make_shared<ProcDirectory>(pid);
+      if (!directory->ok()) {
+        // The process exited, or the pid was never a process.
+        continue;
       }
+      directories_[pid] = directory;
     }
-  } catch (boost::filesystem::filesystem_error& e) {
-    return Status(1, "Cannot access descriptors for " + process);
+    pids_.insert(pid);
+  }
+}
+
+ProcDirectoryRef ProcSnapshot::directory(const std::string& pid) const {
+  auto directory = directories_.find(pid);
+  if (directory != directories_.end()) {
+    return directory->second;
   }
+  return std::make_shared<ProcDirectory>(pid);
+}
 
+ProcSnapshotRef procSnapshot(const std::set<std::string>& pids) {
+  return std::make_shared<ProcSnapshot>(pids);
+}
+
+ProcSnapshotRef procSnapshot() {
+  static boost::mutex lock;
+  static ProcSnapshotRef snapshot;
+  static std::chrono::steady_clock::time_point taken;
+
+  boost::lock_guard<boost::mutex> guard(lock);
+  auto now = std::chrono::steady_clock::now();
+  if (snapshot == nullptr ||
+      now - taken > std::chrono::seconds(kProcSnapshotTTL)) {
+    // Release the previous snapshot's directories before opening more.
+    snapshot = nullptr;
+    std::set<std::string> pids;
+    procProcesses(pids);
+    snapshot = procSnapshot(pids);
+    taken = std::chrono::steady_clock::now();
+  }
+  return snapshot;
+}
+
+Status procDescriptors(const std::string& process,
+                       std::map<std::string, std::string>& descriptors) {
+  ProcDirectory directory(process);
+  if (!directory.ok() || !directory.descriptors(descriptors).ok()) {
+    return Status(1, "Cannot access descriptors for " + process);
+  }
   return Status(0, "OK");
 }
 
 Status procReadDescriptor(const std::string& process,
                           const std::string& descriptor,
                           std::string& result) {
-  auto link = kLinuxProcPath + "/" + process + "/fd/" + descriptor;
+  ProcDirectory directory(process);
+  return directory.readLink(("fd/" + descriptor).c_str(), result);
+}
+
+ProcDescriptorIndexRef procDescriptorIndex(const std::set<std::string>& pids) {
+  return procDescriptorIndex(*procSnapshot(pids));
+}
+
+ProcDescriptorIndexRef procDescriptorIndex(const ProcSnapshot& snapshot) {
+  // Each shard indexes a contiguous, ordered, range of pids.
+  const auto& pids = snapshot.pids();
+  std::vector<ProcDescriptorIndex> shards(procShardCount(pids.size()));
+  procShardProcesses(pids, [&shards, &snapshot](size_t shard,
+                                                const std::string& pid) {
+    auto& index = shards[shard];
+    auto& descriptors = index.descriptors[pid];
+    auto directory = snapshot.directory(pid);
+    if (!directory->ok() || !directory->descriptors(descriptors).ok()) {
+      index.descriptors.erase(pid);
+      return;
+    }
 
-  char result_path[PATH_MAX] = {0};
-  auto size = readlink(link.c_str(), result_path, sizeof(result_path) - 1);
-  if (size >= 0) {
-    result = std::string(result_path);
+    for (const auto& fd : descriptors) {
+      if (fd.second.find("socket:[") == 0) {
+        // See #792: std::regex is incomplete until GCC 4.9 (skip 8 chars)
+        auto inode = fd.second.substr(8);
+        index.sockets[inode.substr(0, inode.size() - 1)] = pid;
+      }
+    }
+  });
+
+  auto index = std::make_shared<ProcDescriptorIndex>();
+  for (auto& shard : shards) {
+    index->descriptors.insert(shard.descriptors.begin(),
+                              shard.descriptors.end());
+    for (const auto& socket : shard.sockets) {
+      index->sockets[socket.first] = socket.second;
+    }
   }
+  return index;
+}
 
-  if (size >= 0) {
-    return Status(0, "OK");
-  } else {
-    return Status(1, "Could not read path");
+ProcDescriptorIndexRef procDescriptorIndex() {
+  static boost::mutex lock;
+  static ProcDescriptorIndexRef index;
+  static std::chrono::steady_clock::time_point built;
+
+  // Concurrent callers wait for a single index build.
+  boost::lock_guard<boost::mutex> guard(lock);
+  auto now = std::chrono::steady_clock::now();
+  if (index == nullptr ||
+      now - built > std::chrono::seconds(kProcDescriptorIndexTTL)) {
+    index = procDescriptorIndex(*procSnapshot());
+    built = std::chrono::steady_clock::now();
   }
+  return index;
 }
 }
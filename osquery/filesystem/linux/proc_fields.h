@@ -0,0 +1,253 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <initializer_list>
+#include <string>
+#include <utility>
+
+#include <ctype.h>
+#include <string.h>
+
+#include <osquery/tables.h>
+
+namespace osquery {
+
+/// A field of a /proc text line, pointing into the read content.
+typedef std::pair<const char*, size_t> ProcTextField;
+
+/**
+ * @brief Split a /proc text line into its leading fields without copying.
+ *
+ * Fields are separated by runs of the delimiter, leading delimiters are
+ * skipped. Only the first Count fields are found, the rest of the line may be
+ * read from the last field with rest.
+ */
+template <size_t Count, char Delimiter = ' '>
+class ProcTextLine {
+ public:
+  /// Split a line, returning the number of fields found.
+  size_t split(const char* line, size_t length) {
+    const char* position = line;
+    end_ = line + length;
+    count_ = 0;
+    while (count_ < Count) {
+      while (position < end_ && *position == Delimiter) {
+        position++;
+      }
+      if (position == end_) {
+        break;
+      }
+      auto next = static_cast<const char*>(
+          memchr(position, Delimiter, end_ - position));
+      if (next == nullptr) {
+        next = end_;
+      }
+      fields_[count_++] = ProcTextField(position, next - position);
+      position = next;
+    }
+    return count_;
+  }
+
+  /// A field found by the last split.
+  const ProcTextField& operator[](size_t index) const { return fields_[index]; }
+
+  /// The number of fields found by the last split.
+  size_t size() const { return count_; }
+
+  /// The line from the start of a field, which may contain delimiters.
+  ProcTextField rest(size_t index) const {
+    if (index >= count_) {
+      return ProcTextField(end_, 0);
+    }
+    return ProcTextField(fields_[index].first, end_ - fields_[index].first);
+  }
+
+ private:
+  std::array<ProcTextField, Count> fields_;
+  const char* end_{nullptr};
+  size_t count_{0};
+};
+
+/// How a ProcField is converted into its column.
+enum ProcFieldFormat {
+  /// The field's text.
+  PROC_FIELD_TEXT,
+  /// A decimal integer, the line is skipped if the field is not a number.
+  PROC_FIELD_DECIMAL,
+  /// A hex integer, such as an address or inode, reported in decimal.
+  PROC_FIELD_HEX,
+  /// The line from the start of the field, empty if the line is shorter.
+  PROC_FIELD_REST,
+};
+
+/**
+ * @brief The layout of one column parsed from a /proc text line.
+ *
+ * @tparam Index The 0-based field index within the line.
+ * @tparam Format The conversion of the field's text.
+ * @tparam Trim A trailing character removed from text, such as a ','.
+ */
+template <size_t Index,
+          ProcFieldFormat Format = PROC_FIELD_TEXT,
+          char Trim = '\0'>
+struct ProcField {
+  static const size_t index = Index;
+
+  /// The fields a line needs for this column to be parsed.
+  static const size_t required = (Format == PROC_FIELD_REST) ? 0 : Index + 1;
+
+  template <typename Line>
+  static bool convert(const Line& line, std::string& column) {
+    auto field = (Format == PROC_FIELD_REST) ? line.rest(Index) : line[Index];
+    if (Format == PROC_FIELD_DECIMAL) {
+      for (size_t i = 0; i < field.second; ++i) {
+        if (!isdigit(field.first[i]) && !(i == 0 && field.first[i] == '-')) {
+          return false;
+        }
+      }
+    } else if (Format == PROC_FIELD_HEX) {
+      unsigned long long number = 0;
+      for (size_t i = 0; i < field.second; ++i) {
+        auto c = field.first[i];
+        if (!isxdigit(c)) {
+          return false;
+        }
+        number = (number << 4) |
+                 (isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+      }
+      column = std::to_string(number);
+      return field.second > 0;
+    }
+
+    if (Trim != '\0' && field.second > 0 &&
+        field.first[field.second - 1] == Trim) {
+      field.second--;
+    }
+    column.assign(field.first, field.second);
+    return Format != PROC_FIELD_DECIMAL || field.second > 0;
+  }
+};
+
+/// The number of fields a line needs for every ProcField in a layout.
+template <typename... Fields>
+struct ProcFieldsRequired {
+  static const size_t value = 0;
+};
+
+template <typename Field, typename... Fields>
+struct ProcFieldsRequired<Field, Fields...> {
+  static const size_t rest = ProcFieldsRequired<Fields...>::value;
+  static const size_t value =
+      (Field::required > rest) ? Field::required : rest;
+};
+
+/// The number of fields split from a line for every ProcField in a layout.
+template <typename... Fields>
+struct ProcFieldsCount {
+  static const size_t value = 0;
+};
+
+template <typename Field, typename... Fields>
+struct ProcFieldsCount<Field, Fields...> {
+  static const size_t rest = ProcFieldsCount<Fields...>::value;
+  static const size_t value =
+      (Field::index + 1 > rest) ? Field::index + 1 : rest;
+};
+
+/**
+ * @brief A parser for the rows of a /proc text table.
+ *
+ * A table declares the column layout of its /proc file as a list of
+ * ProcField%s, and the parser is specialized for that layout when it is
+ * compiled. Each line is split once, only up to the last declared field, and
+ * only the declared fields are copied into the row.
+ *
+ * @code{.cpp}
+ *   const ProcTextParser<' ', ProcField<0>, ProcField<1, PROC_FIELD_DECIMAL>>
+ *       parser({"name", "size"});
+ *   parser.parseLines(content, results);
+ * @endcode
+ *
+ * @tparam Delimiter The field delimiter, repeated delimiters are one.
+ * @tparam Fields The ProcField of each column, in column name order.
+ */
+template <char Delimiter, typename... Fields>
+class ProcTextParser {
+ public:
+  typedef std::array<const char*, sizeof...(Fields)> Columns;
+  typedef ProcTextLine<ProcFieldsCount<Fields...>::value, Delimiter> Line;
+
+  /// The column names, one for each ProcField.
+  ProcTextParser(std::initializer_list<const char*> columns) {
+    columns_.fill("");
+    std::copy_n(columns.begin(),
+                std::min(columns.size(), columns_.size()),
+                columns_.begin());
+  }
+
+  /// Parse one line into a row, false if the line is missing fields.
+  bool parse(const char* line, size_t length, Row& r) const {
+    Line fields;
+    if (fields.split(line, length) < ProcFieldsRequired<Fields...>::value) {
+      return false;
+    }
+    return convert<0, Fields...>(fields, r);
+  }
+
+  /**
+   * @brief Parse the lines of a /proc file.
+   *
+   * @param content The file's content.
+   * @param results Output rows, one for each well-formed line.
+   * @param header The number of leading header lines to skip.
+   */
+  void parseLines(const std::string& content,
+                  QueryData& results,
+                  size_t header = 0) const {
+    const char* position = content.data();
+    const char* end = position + content.size();
+    while (position < end) {
+      auto line = static_cast<const char*>(
+          memchr(position, '\n', end - position));
+      if (line == nullptr) {
+        line = end;
+      }
+      Row r;
+      if (header > 0) {
+        header--;
+      } else if (parse(position, line - position, r)) {
+        results.push_back(std::move(r));
+      }
+      position = line + 1;
+    }
+  }
+
+ private:
+  template <size_t Column>
+  bool convert(const Line& fields, Row& r) const {
+    return true;
+  }
+
+  template <size_t Column, typename Field, typename... Rest>
+  bool convert(const Line& fields, Row& r) const {
+    if (!Field::convert(fields, r[columns_[Column]])) {
+      return false;
+    }
+    return convert<Column + 1, Rest...>(fields, r);
+  }
+
+ private:
+  Columns columns_;
+};
+}
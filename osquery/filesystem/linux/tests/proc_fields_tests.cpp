@@ -0,0 +1,69 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include "osquery/filesystem/linux/proc_fields.h"
+
+namespace osquery {
+
+class ProcFieldsTests : public testing::Test {};
+
+TEST_F(ProcFieldsTests, test_proc_text_line) {
+  std::string line = "  sl  local_address  rem address   with spaces";
+  ProcTextLine<4> fields;
+  ASSERT_EQ(4U, fields.split(line.data(), line.size()));
+  EXPECT_EQ("sl", std::string(fields[0].first, fields[0].second));
+  EXPECT_EQ("rem", std::string(fields[2].first, fields[2].second));
+
+  // The rest of the line keeps its delimiters.
+  auto rest = fields.rest(3);
+  EXPECT_EQ("address   with spaces", std::string(rest.first, rest.second));
+  EXPECT_EQ(0U, fields.rest(4).second);
+
+  line = "a:b";
+  ProcTextLine<3, ':'> short_fields;
+  EXPECT_EQ(2U, short_fields.split(line.data(), line.size()));
+  EXPECT_EQ(0U, short_fields.rest(2).second);
+}
+
+TEST_F(ProcFieldsTests, test_proc_text_parser) {
+  const ProcTextParser<' ',
+                       ProcField<0>,
+                       ProcField<1, PROC_FIELD_DECIMAL>,
+                       ProcField<3, PROC_FIELD_TEXT, ','>,
+                       ProcField<4, PROC_FIELD_HEX>,
+                       ProcField<5, PROC_FIELD_REST>>
+      parser({"name", "size", "used_by", "inode", "path"});
+
+  std::string content =
+      "header line\n"
+      "nf_nat 45056 2 xt_nat,nf_conntrack, 1f /a path\n"
+      "short 1 2\n"
+      "bad_size 4k 1 -, 10\n"
+      "bad_inode 1 1 -, zz\n"
+      "no_path 8 0 -, A";
+
+  QueryData results;
+  parser.parseLines(content, results, 1);
+  ASSERT_EQ(2U, results.size());
+  EXPECT_EQ("nf_nat", results[0]["name"]);
+  EXPECT_EQ("45056", results[0]["size"]);
+  EXPECT_EQ("xt_nat,nf_conntrack", results[0]["used_by"]);
+  EXPECT_EQ("31", results[0]["inode"]);
+  EXPECT_EQ("/a path", results[0]["path"]);
+
+  // A trailing rest field is optional.
+  EXPECT_EQ("no_path", results[1]["name"]);
+  EXPECT_EQ("-", results[1]["used_by"]);
+  EXPECT_EQ("10", results[1]["inode"]);
+  EXPECT_EQ("", results[1]["path"]);
+}
+}
@@ -0,0 +1,107 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+
+#include <boost/thread.hpp>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+
+namespace osquery {
+
+FLAG(uint64,
+     proc_scan_threads,
+     0,
+     "Threads generating process table rows (0 uses the watchdog level)");
+
+DECLARE_int32(watchdog_level);
+DECLARE_bool(disable_watchdog);
+
+/// Do not start a scanning thread for fewer pids.
+const size_t kProcScanMinPids = 128;
+
+/**
+ * @brief Default scanning threads for each watchdog level.
+ *
+ * A parallel scan uses the same CPU time as a serial scan in less wall time,
+ * but the watchdog measures utilization across every thread, so restrictive
+ * levels scan with fewer threads.
+ */
+const std::vector<size_t> kScanThreads = {4, 2, 1, 8};
+
+size_t scanThreadCount(size_t threads) {
+  if (threads == 0) {
+    auto level = (FLAGS_disable_watchdog) ? 3 : FLAGS_watchdog_level;
+    level = std::min(std::max(level, 0), (int)kScanThreads.size() - 1);
+    threads = kScanThreads[level];
+  }
+
+  size_t cores = boost::thread::hardware_concurrency();
+  threads = std::min(threads, std::max(cores, (size_t)1));
+  return std::max(threads, (size_t)1);
+}
+
+size_t procShardCount(size_t pids) {
+  auto threads = scanThreadCount(FLAGS_proc_scan_threads);
+  threads = std::min(threads, (pids + kProcScanMinPids - 1) / kProcScanMinPids);
+  return std::max(threads, (size_t)1);
+}
+
+void procShardProcesses(const std::set<std::string>& pids,
+                        const ProcessIterator& iterator) {
+  auto shards = procShardCount(pids.size());
+  if (shards == 1) {
+    for (const auto& pid : pids) {
+      iterator(0, pid);
+    }
+    return;
+  }
+
+  // Find the first pid of each contiguous shard.
+  std::vector<std::set<std::string>::const_iterator> bounds;
+  auto it = pids.begin();
+  for (size_t shard = 0; shard < shards; ++shard) {
+    bounds.push_back(it);
+    auto size = pids.size() / shards;
+    std::advance(it, (shard < pids.size() % shards) ? size + 1 : size);
+  }
+  bounds.push_back(pids.end());
+
+  std::vector<std::exception_ptr> errors(shards);
+  auto scan = [&bounds, &errors, &iterator](size_t shard) {
+    try {
+      for (auto pid = bounds[shard]; pid != bounds[shard + 1]; ++pid) {
+        iterator(shard, *pid);
+      }
+    } catch (...) {
+      errors[shard] = std::current_exception();
+    }
+  };
+
+  // The calling thread scans the first shard.
+  std::vector<std::unique_ptr<boost::thread>> threads;
+  for (size_t shard = 1; shard < shards; ++shard) {
+    threads.emplace_back(new boost::thread(scan, shard));
+  }
+  scan(0);
+  for (auto& thread : threads) {
+    thread->join();
+  }
+
+  for (const auto& error : errors) {
+    if (error != nullptr) {
+      std::rethrow_exception(error);
+    }
+  }
+}
+}
@@ -0,0 +1,247 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+
+#include <sys/stat.h>
+
+#include <osquery/core.h>
+#include <osquery/database.h>
+#include <osquery/filesystem.h>
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+/// Tailed file positions are stored in the file cache with this prefix.
+const std::string kTailCachePrefix = "tail.";
+
+/// The most bytes read by one call, the remainder is read by the next.
+const size_t kTailMaxRead = 4 * 1024 * 1024;
+
+/// A tailed file's inode and the offset after its last complete line.
+struct TailPosition {
+  ino_t inode{0};
+  size_t offset{0};
+
+  /// A hash of the last line read, found again in a rewritten file.
+  uint64_t anchor{0};
+
+  /// The size of the last line read, without its newline.
+  size_t anchor_size{0};
+};
+
+/// FNV-1a, stored with the position so it must be stable across restarts.
+inline uint64_t hashTailLine(const char* data, size_t size) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static std::string getTailKey(const std::string& name, const fs::path& path) {
+  return kTailCachePrefix + name + "." + path.string();
+}
+
+static TailPosition getTailPosition(const std::string& key) {
+  TailPosition position;
+  std::string content;
+  if (getDatabaseValue(kFileCache, key, content).ok()) {
+    auto values = split(content, " ");
+    if (values.size() >= 2) {
+      position.inode = std::strtoull(values[0].c_str(), nullptr, 10);
+      position.offset = std::strtoull(values[1].c_str(), nullptr, 10);
+    }
+    if (values.size() == 4) {
+      position.anchor = std::strtoull(values[2].c_str(), nullptr, 10);
+      position.anchor_size = std::strtoull(values[3].c_str(), nullptr, 10);
+    }
+  }
+  return position;
+}
+
+static Status setTailPosition(const std::string& key,
+                              const TailPosition& position) {
+  return setDatabaseValue(kFileCache,
+                          key,
+                          std::to_string(position.inode) + " " +
+                              std::to_string(position.offset) + " " +
+                              std::to_string(position.anchor) + " " +
+                              std::to_string(position.anchor_size));
+}
+
+/// Check that the last line read still ends at the offset, if it is known.
+static bool hasTailAnchor(const fs::path& path, const TailPosition& position) {
+  if (position.anchor == 0 || position.offset <= position.anchor_size) {
+    return true;
+  }
+
+  std::ifstream stream(path.string(), std::ios::in | std::ios::binary);
+  if (!stream.is_open()) {
+    return true;
+  }
+
+  std::string content(position.anchor_size + 1, '\0');
+  stream.seekg(position.offset - content.size());
+  stream.read(&content[0], content.size());
+  return (size_t)stream.gcount() == content.size() && content.back() == '\n' &&
+         hashTailLine(content.data(), position.anchor_size) == position.anchor;
+}
+
+/**
+ * @brief Find where to continue reading a replaced or truncated file.
+ *
+ * Tools such as shells rewrite a history file with its old lines, trimmed
+ * and followed by new lines. Reading continues after the last line matching
+ * the last line read, within the final read-sized part of the file. If no
+ * line matches, the existing lines are skipped and the last of them becomes
+ * the anchor.
+ */
+static void findTailAnchor(const fs::path& path,
+                           size_t size,
+                           TailPosition& position) {
+  position.offset = size;
+  std::ifstream stream(path.string(), std::ios::in | std::ios::binary);
+  if (!stream.is_open()) {
+    return;
+  }
+
+  size_t base = (size > kTailMaxRead) ? size - kTailMaxRead : 0;
+  std::string content(size - base, '\0');
+  stream.seekg(base);
+  stream.read(&content[0], content.size());
+  content.resize(stream.gcount());
+
+  // A part starting within the file may start within a line.
+  size_t start = 0;
+  if (base > 0) {
+    start = content.find('\n');
+    start = (start == std::string::npos) ? content.size() : start + 1;
+  }
+
+  size_t found = std::string::npos;
+  size_t last = std::string::npos;
+  size_t last_size = 0;
+  uint64_t last_hash = 0;
+  while (start < content.size()) {
+    size_t newline = content.find('\n', start);
+    if (newline == std::string::npos) {
+      break;
+    }
+    last_size = newline - start;
+    last_hash = hashTailLine(content.data() + start, last_size);
+    if (position.anchor != 0 && last_hash == position.anchor &&
+        last_size == position.anchor_size) {
+      found = newline + 1;
+    }
+    last = newline + 1;
+    start = newline + 1;
+  }
+
+  if (found != std::string::npos) {
+    position.offset = base + found;
+  } else if (last != std::string::npos) {
+    // Skip to the end of the last complete line, a partial line is read once
+    // it is complete.
+    position.offset = base + last;
+    position.anchor = last_hash;
+    position.anchor_size = last_size;
+  }
+}
+
+Status readTailedFile(const std::string& name,
+                      const fs::path& path,
+                      std::vector<std::string>& lines) {
+  struct stat file_stat;
+  if (stat(path.c_str(), &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+    return Status(1, "Cannot tail file: " + path.string());
+  }
+
+  auto key = getTailKey(name, path);
+  auto position = getTailPosition(key);
+  if (position.inode == 0) {
+    // A file tailed for the first time is read from the start.
+    position.inode = file_stat.st_ino;
+  } else if (position.inode != file_stat.st_ino ||
+      position.offset > (size_t)file_stat.st_size ||
+      !hasTailAnchor(path, position)) {
+    // The file was replaced, truncated, or rewritten in place, do not read
+    // its old lines again.
+    position.inode = file_stat.st_ino;
+    findTailAnchor(path, (size_t)file_stat.st_size, position);
+    if (position.offset == (size_t)file_stat.st_size) {
+      return setTailPosition(key, position);
+    }
+  }
+
+  if (position.offset == (size_t)file_stat.st_size) {
+    return Status(0, "OK");
+  }
+
+  std::ifstream stream(path.string(), std::ios::in | std::ios::binary);
+  if (!stream.is_open()) {
+    return Status(1, "Cannot tail file: " + path.string());
+  }
+
+  size_t size = std::min((size_t)file_stat.st_size - position.offset,
+                         kTailMaxRead);
+  std::string content(size, '\0');
+  stream.seekg(position.offset);
+  stream.read(&content[0], size);
+  content.resize(stream.gcount());
+
+  // Only complete lines are read, unless one line is larger than a read.
+  size_t end = content.rfind('\n');
+  if (end == std::string::npos) {
+    if (content.size() < kTailMaxRead) {
+      return Status(0, "OK");
+    }
+    end = content.size();
+  }
+
+  size_t start = 0;
+  while (start < end) {
+    size_t newline = std::min(content.find('\n', start), end);
+    lines.push_back(content.substr(start, newline - start));
+    position.anchor = hashTailLine(content.data() + start, newline - start);
+    position.anchor_size = newline - start;
+    start = newline + 1;
+  }
+  if (end == content.size()) {
+    // Part of a line larger than a read does not end at a newline.
+    position.anchor = 0;
+  }
+
+  position.offset += std::min(end + 1, content.size());
+  return setTailPosition(key, position);
+}
+
+Status initTailedFile(const std::string& name, const fs::path& path) {
+  auto key = getTailKey(name, path);
+  std::string content;
+  if (getDatabaseValue(kFileCache, key, content).ok()) {
+    return Status(0, "OK");
+  }
+
+  struct stat file_stat;
+  if (stat(path.c_str(), &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+    return Status(1, "Cannot tail file: " + path.string());
+  }
+
+  TailPosition position;
+  position.inode = file_stat.st_ino;
+  findTailAnchor(path, (size_t)file_stat.st_size, position);
+  return setTailPosition(key, position);
+}
+}
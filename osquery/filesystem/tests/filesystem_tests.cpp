@@ -11,12 +11,15 @@
 #include <fstream>
 
 #include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <gtest/gtest.h>
 
 #include <boost/property_tree/ptree.hpp>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
 #include "osquery/core/test_util.h"
@@ -24,6 +27,12 @@
 namespace pt = boost::property_tree;
 
 namespace osquery {
+
+DECLARE_uint64(table_cache_max_bytes);
+#if defined(__linux__) || defined(__FreeBSD__)
+DECLARE_uint64(proc_scan_threads);
+#endif
+
 class FilesystemTests : public testing::Test {
 
  protected:
@@ -204,6 +213,140 @@ TEST_F(FilesystemTests, test_no_wild) {
   EXPECT_TRUE(contains(results, kFakeDirectory + "/roto.txt"));
 }
 
+TEST_F(FilesystemTests, test_wildcard_braces) {
+  std::vector<std::string> results;
+  auto status =
+      resolveFilePattern(kFakeDirectory + "/{root,door}.txt", results);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 2U);
+  EXPECT_TRUE(contains(results, kFakeDirectory + "/door.txt"));
+}
+
+TEST_F(FilesystemTests, test_wildcard_yield) {
+  // A yield returning false stops the resolution.
+  std::vector<std::string> results;
+  auto status = resolveFilePattern(kFakeDirectory + "/%%",
+                                   [&results](const std::string& path) {
+                                     results.push_back(path);
+                                     return results.size() < 3;
+                                   },
+                                   GlobOptions());
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 3U);
+}
+
+TEST_F(FilesystemTests, test_wildcard_limits) {
+  std::vector<std::string> results;
+  auto collect = [&results](const std::string& path) {
+    results.push_back(path);
+    return true;
+  };
+
+  GlobOptions options;
+  options.max_results = 4;
+  auto status = resolveFilePattern(kFakeDirectory + "/%%", collect, options);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 4U);
+
+  // Only the first level below the recursive wildcard.
+  results.clear();
+  options.max_results = 0;
+  options.max_depth = 1;
+  resolveFilePattern(kFakeDirectory + "/%%", collect, options);
+  EXPECT_EQ(results.size(), 5U);
+  EXPECT_FALSE(contains(results, kFakeDirectory + "/deep1/level1.txt"));
+
+  options.max_depth = 2;
+  results.clear();
+  resolveFilePattern(kFakeDirectory + "/%%", collect, options);
+  EXPECT_EQ(results.size(), 10U);
+  EXPECT_TRUE(contains(results, kFakeDirectory + "/deep1/level1.txt"));
+}
+
+TEST_F(FilesystemTests, test_wildcard_link_loop) {
+  // A link to a parent is yielded, but not followed.
+  ASSERT_EQ(symlink("..", (kFakeDirectory + "/deep1/loop").c_str()), 0);
+  std::vector<std::string> results;
+  auto status = resolveFilePattern(kFakeDirectory + "/%%", results);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(contains(results, kFakeDirectory + "/deep1/loop/"));
+  EXPECT_FALSE(contains(results, kFakeDirectory + "/deep1/loop/roto.txt"));
+}
+
+TEST_F(FilesystemTests, test_wildcard_parallel) {
+  std::vector<std::string> expected;
+  resolveFilePattern(kFakeDirectory + "/%%", expected);
+
+  // Subdirectories expanded by threads are yielded in the serial order.
+  std::vector<std::string> results;
+  GlobOptions options;
+  options.threads = 4;
+  auto status = resolveFilePattern(kFakeDirectory + "/%%",
+                                   [&results](const std::string& path) {
+                                     results.push_back(path);
+                                     return true;
+                                   },
+                                   options);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results, expected);
+}
+
+TEST_F(FilesystemTests, test_walk_file_tree) {
+  // The link is visited, but the walk does not descend into it.
+  ASSERT_EQ(symlink("..", (kFakeDirectory + "/deep1/loop").c_str()), 0);
+
+  for (size_t threads = 1; threads <= 4; threads += 3) {
+    FileTreeOptions options;
+    options.threads = threads;
+    std::vector<std::set<std::string>> found(threads);
+    auto status = walkFileTree(kFakeDirectory,
+                               [&found](size_t worker,
+                                        const FileTreeEntry& entry) {
+                                 found[worker].insert(entry.path);
+                                 return true;
+                               },
+                               options);
+    EXPECT_TRUE(status.ok());
+
+    std::set<std::string> paths;
+    for (const auto& worker : found) {
+      paths.insert(worker.begin(), worker.end());
+    }
+    EXPECT_EQ(paths.size(), 15U);
+    EXPECT_EQ(paths.count(kFakeDirectory + "/deep1/loop"), 1U);
+    EXPECT_EQ(paths.count(kFakeDirectory + "/deep11/deep2/deep3/level3.txt"),
+              1U);
+  }
+}
+
+TEST_F(FilesystemTests, test_walk_file_tree_limits) {
+  FileTreeOptions options;
+  options.threads = 2;
+  options.max_depth = 1;
+  std::vector<size_t> counts(2, 0);
+  auto counter = [&counts](size_t worker, const FileTreeEntry& entry) {
+    counts[worker]++;
+    return true;
+  };
+  auto status = walkFileTree(kFakeDirectory, counter, options);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(counts[0] + counts[1], 5U);
+
+  // The visitor stops the walk.
+  options.threads = 1;
+  options.max_depth = kMaxDirectoryTraversalDepth;
+  size_t visited = 0;
+  walkFileTree(kFakeDirectory,
+               [&visited](size_t worker, const FileTreeEntry& entry) {
+                 return ++visited < 3;
+               },
+               options);
+  EXPECT_EQ(visited, 3U);
+
+  status = walkFileTree(kFakeDirectory + "/root.txt", counter, options);
+  EXPECT_FALSE(status.ok());
+}
+
 TEST_F(FilesystemTests, test_safe_permissions) {
   // For testing we can request a different directory path.
   EXPECT_TRUE(safePermissions("/", kFakeDirectory + "/door.txt"));
@@ -214,4 +357,209 @@ TEST_F(FilesystemTests, test_safe_permissions) {
   // A root-owned file is appropriate
   EXPECT_TRUE(safePermissions("/", "/dev/zero"));
 }
+
+TEST_F(FilesystemTests, test_get_file_identity) {
+  auto path = kTestWorkingDirectory + "fstests-identity";
+  writeTextFile(path, "test");
+
+  std::string identity;
+  EXPECT_TRUE(getFileIdentity(path, identity).ok());
+  std::string same;
+  EXPECT_TRUE(getFileIdentity(path, same).ok());
+  EXPECT_EQ(identity, same);
+
+  // A write changes the identity.
+  writeTextFile(path, "test content");
+  std::string changed;
+  EXPECT_TRUE(getFileIdentity(path, changed).ok());
+  EXPECT_NE(identity, changed);
+
+  // Only regular files are identified.
+  EXPECT_FALSE(getFileIdentity(kTestWorkingDirectory, identity).ok());
+  remove(path);
+}
+
+TEST_F(FilesystemTests, test_gen_parsed_file) {
+  auto path = kTestWorkingDirectory + "fstests-parsed";
+  writeTextFile(path, "first");
+
+  size_t parsed = 0;
+  auto generator = [&parsed](const std::string& content, QueryData& rows) {
+    parsed++;
+    rows.push_back({{"content", content}});
+  };
+
+  QueryData results;
+  EXPECT_TRUE(genParsedFile(path, generator, results).ok());
+  EXPECT_TRUE(genParsedFile(path, generator, results).ok());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[1]["content"], "first");
+  EXPECT_EQ(parsed, 1U);
+
+  // A write changes the file's identity, the content is parsed again.
+  writeTextFile(path, " second");
+  results.clear();
+  EXPECT_TRUE(genParsedFile(path, generator, results).ok());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["content"], "first second");
+  EXPECT_EQ(parsed, 2U);
+
+  // Rows larger than the cache are not kept.
+  auto max_bytes = FLAGS_table_cache_max_bytes;
+  FLAGS_table_cache_max_bytes = 4;
+  clearParsedFileCache();
+  EXPECT_TRUE(genParsedFile(path, generator, results).ok());
+  EXPECT_TRUE(genParsedFile(path, generator, results).ok());
+  EXPECT_EQ(parsed, 4U);
+  FLAGS_table_cache_max_bytes = max_bytes;
+
+  remove(path);
+  results.clear();
+  EXPECT_FALSE(genParsedFile(path, generator, results).ok());
+  EXPECT_TRUE(results.empty());
+  clearParsedFileCache();
+}
+
+TEST_F(FilesystemTests, test_read_tailed_file) {
+  auto path = kTestWorkingDirectory + "fstests-tail";
+  writeTextFile(path, "first\nsecond\npartial");
+
+  // Only complete lines are read.
+  std::vector<std::string> lines;
+  EXPECT_TRUE(readTailedFile("test", path, lines).ok());
+  EXPECT_EQ(lines, std::vector<std::string>({"first", "second"}));
+
+  // Appended lines, and the completed partial line, are read once.
+  {
+    std::ofstream stream(path, std::ios::app);
+    stream << " line\nthird\n";
+  }
+  lines.clear();
+  EXPECT_TRUE(readTailedFile("test", path, lines).ok());
+  EXPECT_EQ(lines, std::vector<std::string>({"partial line", "third"}));
+  lines.clear();
+  EXPECT_TRUE(readTailedFile("test", path, lines).ok());
+  EXPECT_TRUE(lines.empty());
+
+  // Each name keeps an offset, and may start at the end of the file.
+  EXPECT_TRUE(initTailedFile("events", path).ok());
+  EXPECT_TRUE(readTailedFile("events", path, lines).ok());
+  EXPECT_TRUE(lines.empty());
+
+  // A rewritten file is read after the last line read.
+  {
+    std::ofstream stream(path, std::ios::trunc);
+    stream << "second\npartial line\nthird\nfourth\n";
+  }
+  EXPECT_TRUE(readTailedFile("test", path, lines).ok());
+  EXPECT_EQ(lines, std::vector<std::string>({"fourth"}));
+
+  // A truncated file without that line is not read again.
+  lines.clear();
+  {
+    std::ofstream stream(path, std::ios::trunc);
+    stream << "new\n";
+  }
+  EXPECT_TRUE(readTailedFile("test", path, lines).ok());
+  EXPECT_TRUE(lines.empty());
+  {
+    std::ofstream stream(path, std::ios::app);
+    stream << "newer\n";
+  }
+  EXPECT_TRUE(readTailedFile("test", path, lines).ok());
+  EXPECT_EQ(lines, std::vector<std::string>({"newer"}));
+  remove(path);
+
+  EXPECT_FALSE(readTailedFile("test", path, lines).ok());
+}
+
+#if defined(__linux__) || defined(__FreeBSD__)
+TEST_F(FilesystemTests, test_proc_shard_processes) {
+  std::set<std::string> pids;
+  for (size_t i = 0; i < 1000; i++) {
+    pids.insert(std::to_string(10000 + i));
+  }
+
+  // Small process lists are not sharded.
+  FLAGS_proc_scan_threads = 4;
+  EXPECT_EQ(procShardCount(10), 1U);
+  auto shards = procShardCount(pids.size());
+  EXPECT_GE(shards, 1U);
+  EXPECT_LE(shards, 4U);
+
+  // Each pid is visited once and shards merge in pid order.
+  std::vector<std::vector<std::string>> visited(shards);
+  procShardProcesses(pids, [&visited](size_t shard, const std::string& pid) {
+    visited[shard].push_back(pid);
+  });
+  std::vector<std::string> merged;
+  for (const auto& shard : visited) {
+    merged.insert(merged.end(), shard.begin(), shard.end());
+  }
+  EXPECT_EQ(merged, std::vector<std::string>(pids.begin(), pids.end()));
+
+  // Iterator exceptions are raised to the caller.
+  EXPECT_THROW(procShardProcesses(pids,
+                                  [](size_t shard, const std::string& pid) {
+                                    if (pid == "10999") {
+                                      throw std::runtime_error("failed");
+                                    }
+                                  }),
+               std::runtime_error);
+  FLAGS_proc_scan_threads = 0;
+}
+#endif
+
+#ifdef __linux__
+TEST_F(FilesystemTests, test_proc_descriptor_index) {
+  // The shared index is reused by callers within a short period.
+  auto index = procDescriptorIndex();
+  EXPECT_EQ(index, procDescriptorIndex());
+
+  auto pid = std::to_string(getpid());
+  EXPECT_EQ(index->descriptors.count(pid), 1U);
+
+  // An index of specific processes is not shared.
+  auto process = procDescriptorIndex({pid});
+  EXPECT_NE(index, process);
+  EXPECT_EQ(process->descriptors.size(), 1U);
+  EXPECT_EQ(process->descriptors.count(pid), 1U);
+}
+
+TEST_F(FilesystemTests, test_proc_snapshot) {
+  // The shared snapshot is reused by callers within a short period.
+  auto snapshot = procSnapshot();
+  EXPECT_EQ(snapshot, procSnapshot());
+
+  auto pid = std::to_string(getpid());
+  ASSERT_EQ(snapshot->pids().count(pid), 1U);
+  auto directory = snapshot->directory(pid);
+  ASSERT_TRUE(directory->ok());
+  std::string exe;
+  EXPECT_TRUE(directory->readLink("exe", exe).ok());
+  EXPECT_FALSE(exe.empty());
+  std::map<std::string, std::string> descriptors;
+  EXPECT_TRUE(directory->descriptors(descriptors).ok());
+  EXPECT_GT(descriptors.size(), 0U);
+
+  // Pids that are not processes are not part of a snapshot.
+  auto process = procSnapshot({pid, "0"});
+  EXPECT_EQ(process->pids(), std::set<std::string>({pid}));
+
+  // A directory opened before its process exits is not reused by the pid.
+  auto child = fork();
+  if (child == 0) {
+    ::_exit(0);
+  }
+  auto exited = procSnapshot({std::to_string(child)});
+  ::waitpid(child, nullptr, 0);
+  directory = exited->directory(std::to_string(child));
+  ASSERT_TRUE(directory->ok());
+  int fd = directory->open("status");
+  EXPECT_LT(fd, 0);
+  if (fd >= 0) {
+    ::close(fd);
+  }
+}
+#endif
 }
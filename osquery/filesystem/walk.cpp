@@ -0,0 +1,269 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+
+namespace osquery {
+
+FLAG(uint64,
+     crawl_threads,
+     0,
+     "Threads walking directory trees for crawling tables (0 uses the "
+     "watchdog level)");
+
+/// Milliseconds an idle thread waits for another thread to queue directories.
+const size_t kFileTreeIdleWait = 10;
+
+size_t fileTreeThreadCount() {
+  return scanThreadCount(FLAGS_crawl_threads);
+}
+
+/// A directory waiting to be walked.
+struct FileTreeDirectory {
+  std::string path;
+  size_t depth;
+};
+
+/// A thread's directories, the owner takes the newest and thieves the oldest.
+struct FileTreeQueue {
+  std::mutex mutex;
+  std::deque<FileTreeDirectory> directories;
+};
+
+class FileTreeWalker : private boost::noncopyable {
+ public:
+  FileTreeWalker(const FileTreeVisitor& visitor,
+                 const FileTreeOptions& options,
+                 dev_t device,
+                 size_t threads)
+      : visitor_(visitor),
+        options_(options),
+        device_(device),
+        queues_(threads),
+        errors_(threads),
+        cancellation_(getQueryCancellation()) {}
+
+  /// Queue a directory on a thread's queue.
+  void push(size_t worker, FileTreeDirectory directory);
+
+  /// Walk directories until every queue is empty, or the walk stops.
+  void run(size_t worker);
+
+  /// Rethrow the first exception thrown by a visitor.
+  void rethrow() const;
+
+  bool cancelled() const { return cancelled_; }
+
+ private:
+  /// Take a directory from the thread's queue, or steal one.
+  bool pop(size_t worker, FileTreeDirectory& directory);
+
+  /// Visit each entry of a directory, queueing its subdirectories.
+  void walk(size_t worker, const FileTreeDirectory& directory);
+
+  /// Stop every thread.
+  void stop();
+
+ private:
+  const FileTreeVisitor& visitor_;
+  const FileTreeOptions& options_;
+
+  /// The root's device, for options.same_device.
+  dev_t device_;
+
+  std::vector<FileTreeQueue> queues_;
+  std::vector<std::exception_ptr> errors_;
+
+  /// Directories queued or being walked, the walk is done at 0.
+  std::atomic<size_t> pending_{0};
+  std::atomic<bool> stopped_{false};
+  std::atomic<bool> cancelled_{false};
+
+  /// Idle threads wait for new directories.
+  std::mutex idle_mutex_;
+  std::condition_variable idle_;
+
+  /// The walking query's cancellation, shared with each thread.
+  const QueryCancellation* cancellation_;
+};
+
+void FileTreeWalker::push(size_t worker, FileTreeDirectory directory) {
+  pending_++;
+  {
+    std::lock_guard<std::mutex> lock(queues_[worker].mutex);
+    queues_[worker].directories.push_back(std::move(directory));
+  }
+  idle_.notify_one();
+}
+
+bool FileTreeWalker::pop(size_t worker, FileTreeDirectory& directory) {
+  {
+    auto& queue = queues_[worker];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.directories.empty()) {
+      directory = std::move(queue.directories.back());
+      queue.directories.pop_back();
+      return true;
+    }
+  }
+
+  for (size_t i = 1; i < queues_.size(); ++i) {
+    auto& queue = queues_[(worker + i) % queues_.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.directories.empty()) {
+      directory = std::move(queue.directories.front());
+      queue.directories.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void FileTreeWalker::stop() {
+  stopped_ = true;
+  idle_.notify_all();
+}
+
+void FileTreeWalker::run(size_t worker) {
+  ScopedQueryCancellation scope(cancellation_);
+  try {
+    FileTreeDirectory directory;
+    while (!stopped_) {
+      if (pop(worker, directory)) {
+        walk(worker, directory);
+        if (--pending_ == 0) {
+          idle_.notify_all();
+        }
+        continue;
+      }
+
+      if (pending_ == 0) {
+        break;
+      }
+      // Another thread is walking a directory and may queue more.
+      std::unique_lock<std::mutex> lock(idle_mutex_);
+      idle_.wait_for(lock, std::chrono::milliseconds(kFileTreeIdleWait));
+    }
+  } catch (...) {
+    errors_[worker] = std::current_exception();
+    stop();
+  }
+}
+
+void FileTreeWalker::walk(size_t worker, const FileTreeDirectory& directory) {
+  if (isQueryCancelled()) {
+    cancelled_ = true;
+    stop();
+    return;
+  }
+
+  // The root may be a symlink, but links below it are not followed.
+  int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+  if (directory.depth > 0) {
+    flags |= O_NOFOLLOW;
+  }
+  int fd = ::open(directory.path.c_str(), flags);
+  if (fd < 0) {
+    return;
+  }
+  auto dir = ::fdopendir(fd);
+  if (dir == nullptr) {
+    ::close(fd);
+    return;
+  }
+
+  auto prefix = directory.path;
+  if (prefix.empty() || prefix.back() != '/') {
+    prefix += '/';
+  }
+
+  FileTreeEntry entry;
+  entry.depth = directory.depth + 1;
+  struct dirent* result = nullptr;
+  while (!stopped_ && (result = ::readdir(dir)) != nullptr) {
+    const char* name = result->d_name;
+    if (name[0] == '.' &&
+        (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+      continue;
+    }
+
+    if (::fstatat(::dirfd(dir), name, &entry.status, AT_SYMLINK_NOFOLLOW) !=
+        0) {
+      continue;
+    }
+    entry.path = prefix + name;
+    if (!visitor_(worker, entry)) {
+      stop();
+      break;
+    }
+
+    if (S_ISDIR(entry.status.st_mode) && entry.depth < options_.max_depth &&
+        (!options_.same_device || entry.status.st_dev == device_)) {
+      push(worker, {entry.path, entry.depth});
+    }
+  }
+  ::closedir(dir);
+}
+
+void FileTreeWalker::rethrow() const {
+  for (const auto& error : errors_) {
+    if (error != nullptr) {
+      std::rethrow_exception(error);
+    }
+  }
+}
+
+Status walkFileTree(const std::string& root,
+                    const FileTreeVisitor& visitor,
+                    const FileTreeOptions& options) {
+  struct stat status;
+  if (::stat(root.c_str(), &status) != 0 || !S_ISDIR(status.st_mode)) {
+    return Status(1, "Not a directory: " + root);
+  }
+
+  size_t threads =
+      (options.threads == 0) ? fileTreeThreadCount() : options.threads;
+  FileTreeWalker walker(visitor, options, status.st_dev, threads);
+  walker.push(0, {root, 0});
+
+  // The calling thread is the first walking thread.
+  std::vector<std::thread> workers;
+  for (size_t worker = 1; worker < threads; ++worker) {
+    workers.emplace_back(&FileTreeWalker::run, &walker, worker);
+  }
+  walker.run(0);
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  walker.rethrow();
+  if (walker.cancelled()) {
+    return Status(1, "Query cancelled");
+  }
+  return Status(0, "OK");
+}
+}
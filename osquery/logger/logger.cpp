@@ -9,16 +9,35 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <thread>
 
 #include <boost/noncopyable.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
+#include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/extensions.h>
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/json.h"
+#include "osquery/core/metrics.h"
+#include "osquery/core/profiler.h"
+#include "osquery/core/tracing.h"
+#include "osquery/dispatcher/dispatcher.h"
+#include "osquery/logger/result_stream.h"
+
 namespace pt = boost::property_tree;
 
 namespace osquery {
@@ -29,10 +48,352 @@ FLAG_ALIAS(bool, debug, verbose);
 
 FLAG(bool, disable_logging, false, "Disable ERROR/INFO logging");
 
-FLAG(string, logger_plugin, "filesystem", "Logger plugin name");
+FLAG(string,
+     logger_plugin,
+     "filesystem",
+     "Comma-separated logger plugin names, the first is the active plugin");
 
 FLAG(bool, log_result_events, true, "Log scheduled results as events");
 
+FLAG(bool,
+     log_result_columns,
+     false,
+     "Log scheduled results as one columnar line per query execution");
+
+FLAG(bool,
+     log_result_delta,
+     false,
+     "Omit columnar result values equal to the previous row's");
+
+FLAG(bool,
+     logger_async,
+     false,
+     "Send results and status logs to the logger from a background thread");
+
+FLAG(int32, logger_async_max, 4096, "Maximum number of queued logs");
+
+FLAG(string,
+     logger_async_overflow,
+     "block",
+     "When the log queue is full: block, drop_oldest, or spill");
+
+FLAG(int32,
+     logger_status_max,
+     4096,
+     "Maximum number of status logs buffered before they are sent");
+
+FLAG(int32,
+     logger_status_rate,
+     100,
+     "Maximum status logs per second from each source line, 0 for no limit");
+
+/// The maximum number of spilled logs read from the backing store at once.
+const size_t kLoggerQueueSpillBatch = 1024;
+
+/// Spilled log keys use a prefix distinct from the TLS logger's buffer.
+const std::string kLoggerQueueSpillPrefix = "q";
+
+class LoggerQueue;
+
+/// The queue flushed by this thread, which sends its own requests directly.
+static thread_local LoggerQueue* kLoggerQueueThread = nullptr;
+
+/// Milliseconds the flushing thread may wait before relaying status logs.
+const size_t kLoggerQueueStatusLatency = 100;
+
+/// Set on a thread sending buffered status logs to the logger plugin.
+static thread_local bool kStatusLogRelayThread = false;
+
+/// Send the status logs buffered by a forwarding BufferedLogSink.
+static void relayForwardedStatusLogs();
+
+/// Check if a forwarding BufferedLogSink has status logs to send.
+static bool hasForwardedStatusLogs();
+
+/// The logger plugins whose init accepted forwarded status logs.
+static std::vector<std::string> kStatusReceivers;
+static std::mutex kStatusReceiversMutex;
+
+/**
+ * @brief A serialized log, shared by every logger plugin's queued request.
+ *
+ * The queues hold one copy of the log, each PluginRequest copies it when the
+ * request is sent.
+ */
+typedef std::shared_ptr<const std::string> LoggerData;
+
+/// A logger plugin request waiting in the asynchronous log queue.
+struct LoggerQueueItem {
+  /// The request type: string, snapshot, health, or status.
+  std::string type;
+
+  /// The logger plugin receiving the request.
+  std::string receiver;
+
+  /// The category of a logged string.
+  std::string category;
+
+  /// The logged string, or a single JSON-serialized status log line.
+  LoggerData data;
+};
+
+/**
+ * @brief A bounded queue of one logger plugin's requests.
+ *
+ * When --logger_async is set, results and forwarded status logs are added to
+ * the receiving plugin's queue instead of calling the logger plugin on the
+ * scheduler or Glog caller's thread. A LoggerQueueRunner service drains each
+ * queue, sending consecutive status logs in a single request.
+ *
+ * If a queue is full the --logger_async_overflow policy decides to block
+ * the caller, drop the oldest queued log, or spill logs into the backing
+ * store. Spilled logs are sent after the queue drains, logs are queued to the
+ * backing store until then to keep their order. Each plugin's queue fills,
+ * drops, and spills independently of the others.
+ */
+class LoggerQueue : private boost::noncopyable {
+ public:
+  /// The queue of a logger plugin, created on first use.
+  static LoggerQueue& instance(const std::string& receiver);
+
+  /// Queue a request, or send it now if the queue is not running.
+  Status add(LoggerQueueItem item);
+
+  /// Allow requests to queue before the flushing thread starts.
+  bool start();
+
+  /// The flushing thread's run loop.
+  void run();
+
+  /// Stop queueing, the run loop sends the remaining requests and returns.
+  void stop();
+
+  /// Check if the flushing thread is sending requests.
+  bool running() const { return running_ && FLAGS_logger_async; }
+
+  /// Wake the flushing thread to relay forwarded status logs.
+  void notify() { not_empty_.notify_one(); }
+
+ private:
+  explicit LoggerQueue(const std::string& receiver);
+
+  /// Store a request in the backing store, the lock must be held.
+  Status spill(const LoggerQueueItem& item);
+
+  /// Send spilled requests, in order, until the backing store has none.
+  void unspill();
+
+ private:
+  std::mutex mutex_;
+
+  /// Signal the flushing thread that requests were added or spilled.
+  std::condition_variable not_empty_;
+
+  /// Signal blocked callers that the queue was drained.
+  std::condition_variable not_full_;
+
+  std::deque<LoggerQueueItem> items_;
+
+  /// Requests are in the backing store, new requests are spilled after them.
+  bool spilling_{false};
+
+  /// An auto-incrementing counter ordering spilled requests.
+  size_t spill_index_{0};
+
+  /// The key prefix of this queue's spilled requests.
+  std::string spill_prefix_;
+
+  /// The number of requests dropped by the drop_oldest policy.
+  size_t dropped_{0};
+
+  std::atomic<bool> running_{false};
+};
+
+/// The Dispatcher service running a LoggerQueue's flushing thread.
+class LoggerQueueRunner : public InternalRunnable {
+ public:
+  explicit LoggerQueueRunner(LoggerQueue& queue) : queue_(queue) {}
+
+  void start() { queue_.run(); }
+  void stop() { queue_.stop(); }
+
+ private:
+  LoggerQueue& queue_;
+};
+
+/**
+ * @brief A bounded, lock-free ring of status log lines.
+ *
+ * Glog callers on any thread add lines while a single relaying thread removes
+ * them. Each slot's sequence number says whether it may be written or read,
+ * so neither side takes a lock.
+ *
+ * Lines are admitted by severity: INFO lines may use half of the ring and
+ * WARNING lines three quarters, so a burst of verbose logs leaves room for
+ * the errors explaining it.
+ */
+class StatusLogRing : private boost::noncopyable {
+ public:
+  /// Create a ring holding at least capacity lines.
+  explicit StatusLogRing(size_t capacity);
+
+  /// Add a line, false if the ring is too full for the line's severity.
+  bool push(StatusLogLine&& line);
+
+  /// Remove the oldest line, false if the ring is empty.
+  bool pop(StatusLogLine& line);
+
+  /// The approximate number of lines in the ring.
+  size_t size() const;
+
+  /// The maximum number of lines in the ring.
+  size_t capacity() const { return mask_ + 1; }
+
+ private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    StatusLogLine line;
+  };
+
+  std::unique_ptr<Slot[]> slots_;
+  size_t mask_;
+
+  /// The position of the next line to remove.
+  std::atomic<size_t> head_{0};
+
+  /// The position of the next line to add.
+  std::atomic<size_t> tail_{0};
+};
+
+StatusLogRing::StatusLogRing(size_t capacity) {
+  size_t size = 2;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  slots_.reset(new Slot[size]);
+  mask_ = size - 1;
+  for (size_t i = 0; i < size; ++i) {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+bool StatusLogRing::push(StatusLogLine&& line) {
+  size_t limit = capacity();
+  if (line.severity == O_INFO) {
+    limit /= 2;
+  } else if (line.severity == O_WARNING) {
+    limit -= limit / 4;
+  }
+
+  auto pos = tail_.load(std::memory_order_relaxed);
+  while (true) {
+    auto head = head_.load(std::memory_order_acquire);
+    if (pos >= head && pos - head >= limit) {
+      return false;
+    }
+
+    auto& slot = slots_[pos & mask_];
+    auto sequence = slot.sequence.load(std::memory_order_acquire);
+    auto dif = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+    if (dif == 0) {
+      if (tail_.compare_exchange_weak(
+              pos, pos + 1, std::memory_order_relaxed)) {
+        slot.line = std::move(line);
+        slot.sequence.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (dif < 0) {
+      // The slot has not been read since the ring wrapped, it is full.
+      return false;
+    } else {
+      pos = tail_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+bool StatusLogRing::pop(StatusLogLine& line) {
+  auto pos = head_.load(std::memory_order_relaxed);
+  while (true) {
+    auto& slot = slots_[pos & mask_];
+    auto sequence = slot.sequence.load(std::memory_order_acquire);
+    auto dif = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+    if (dif == 0) {
+      if (head_.compare_exchange_weak(
+              pos, pos + 1, std::memory_order_relaxed)) {
+        line = std::move(slot.line);
+        slot.sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (dif < 0) {
+      // The slot has not been written, the ring is empty.
+      return false;
+    } else {
+      pos = head_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+size_t StatusLogRing::size() const {
+  auto head = head_.load(std::memory_order_acquire);
+  auto tail = tail_.load(std::memory_order_acquire);
+  return (tail > head) ? tail - head : 0;
+}
+
+/// The number of per-second counters shared by status log source lines.
+const size_t kStatusLogLimiterSlots = 1024;
+
+/**
+ * @brief Limit the status logs per second from each source file and line.
+ *
+ * Sources are hashed into a fixed table of counters, a rare collision shares
+ * one source's budget with another. ERROR and FATAL lines are not limited.
+ */
+class StatusLogLimiter : private boost::noncopyable {
+ public:
+  StatusLogLimiter() {
+    for (auto& slot : slots_) {
+      slot.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  /// Count a line, false if its source exceeded --logger_status_rate.
+  bool allow(google::LogSeverity severity, const char* filename, int line);
+
+ private:
+  /// The low 32 bits of a second, then the count of lines within it.
+  std::atomic<uint64_t> slots_[kStatusLogLimiterSlots];
+};
+
+bool StatusLogLimiter::allow(google::LogSeverity severity,
+                             const char* filename,
+                             int line) {
+  if (FLAGS_logger_status_rate <= 0 ||
+      (StatusLogSeverity)severity >= O_ERROR) {
+    return true;
+  }
+
+  // Glog passes each source's static file name, its address is the key.
+  auto hash = std::hash<const void*>()(filename) ^ (line * 0x9E3779B1U);
+  auto& slot = slots_[hash % kStatusLogLimiterSlots];
+  uint64_t second = getUnixTime() & 0xFFFFFFFF;
+  auto value = slot.load(std::memory_order_relaxed);
+  while (true) {
+    uint64_t next = (second << 32) | 1;
+    if ((value >> 32) == second) {
+      if ((value & 0xFFFFFFFF) >= (uint64_t)FLAGS_logger_status_rate) {
+        return false;
+      }
+      next = value + 1;
+    }
+    if (slot.compare_exchange_weak(value, next, std::memory_order_relaxed)) {
+      return true;
+    }
+  }
+}
+
+/// Status logs dropped by the buffer or rate limit.
+static MetricCounter kLoggerStatusDropped("logger.status_dropped");
+
 /**
  * @brief A custom Glog log sink for forwarding or buffering status logs.
  *
@@ -66,12 +427,24 @@ class BufferedLogSink : public google::LogSink, private boost::noncopyable {
             const char* message,
             size_t message_len);
 
-  /// Accessor/mutator to dump all of the buffered logs.
-  static std::vector<StatusLogLine>& dump() { return instance().logs_; }
+  /// Remove and return all of the buffered logs.
+  static std::vector<StatusLogLine> dump();
+
+  /// Send the buffered logs to the active logger in one request.
+  static void relay();
+
+  /// Check if there are buffered logs.
+  static bool empty() { return instance().ring_.size() == 0; }
+
+  /// The maximum number of buffered logs.
+  static size_t capacity() { return instance().ring_.capacity(); }
 
   /// Set the forwarding mode of the buffering sink.
   static void forward(bool forward = false) { instance().forward_ = forward; }
 
+  /// Check if logs are forwarded to an initialized logger.
+  static bool forwarding() { return instance().forward_; }
+
   /// Remove the buffered log sink from Glog.
   static void disable() {
     if (instance().enabled_) {
@@ -90,7 +463,10 @@ class BufferedLogSink : public google::LogSink, private boost::noncopyable {
 
  private:
   /// Create the log sink as buffering or forwarding.
-  BufferedLogSink() : forward_(false), enabled_(false) {}
+  BufferedLogSink()
+      : ring_((FLAGS_logger_status_max > 0) ? FLAGS_logger_status_max : 1),
+        forward_(false),
+        enabled_(false) {}
 
   /// Remove the log sink.
   ~BufferedLogSink() { disable(); }
@@ -99,9 +475,14 @@ class BufferedLogSink : public google::LogSink, private boost::noncopyable {
   void operator=(BufferedLogSink const&);
 
  private:
-  /// Intermediate log storage until an osquery logger is initialized.
-  std::vector<StatusLogLine> logs_;
-  bool forward_;
+  /// Logs buffered until an osquery logger is initialized or relayed.
+  StatusLogRing ring_;
+  StatusLogLimiter limiter_;
+
+  /// Set while a thread is relaying the buffered logs.
+  std::atomic_flag relaying_ = ATOMIC_FLAG_INIT;
+
+  std::atomic<bool> forward_;
   bool enabled_;
 };
 
@@ -166,6 +547,253 @@ static void deserializeIntermediateLog(const PluginRequest& request,
   }
 }
 
+/// Serialize a status log line as serializeIntermediateLog writes each item.
+static std::string serializeStatusLine(const StatusLogLine& line) {
+  std::string json;
+  JSONWriter writer(json);
+  writer.startObject();
+  writer.key("s");
+  writer.value(std::to_string(line.severity));
+  writer.key("f");
+  writer.value(line.filename);
+  writer.key("i");
+  writer.value(std::to_string(line.line));
+  writer.key("m");
+  writer.value(line.message);
+  writer.endObject();
+  return json;
+}
+
+/// Logger plugin call latencies, and the state of the asynchronous queue.
+static MetricHistogram kLoggerCallLatency("logger.call");
+static MetricGauge kLoggerQueueSize("logger.queue");
+static MetricCounter kLoggerDropped("logger.dropped");
+static MetricCounter kLoggerSpilled("logger.spilled");
+
+/// Send queued requests, consecutive status logs are sent as one request.
+static Status sendLoggerItems(const std::deque<LoggerQueueItem>& items) {
+  MetricTimer timer(kLoggerCallLatency);
+  TraceSpan span("logger", "send");
+  Status status;
+  for (size_t i = 0; i < items.size();) {
+    const auto& item = items[i];
+    if (item.type == "status") {
+      std::string log = "[";
+      size_t next = i;
+      for (; next < items.size() && items[next].type == "status" &&
+             items[next].receiver == item.receiver;
+           ++next) {
+        if (next > i) {
+          log.push_back(',');
+        }
+        log.append(*items[next].data);
+      }
+      log.append("]\n");
+      status = Registry::call(
+          "logger", item.receiver, {{"status", "true"}, {"log", log}});
+      i = next;
+      continue;
+    }
+
+    PluginRequest request = {{item.type, *item.data}};
+    if (item.type == "string") {
+      request["category"] = item.category;
+    }
+    status = Registry::call("logger", item.receiver, request);
+    ++i;
+  }
+  return status;
+}
+
+LoggerQueue& LoggerQueue::instance(const std::string& receiver) {
+  static std::mutex mutex;
+  static std::map<std::string, std::unique_ptr<LoggerQueue>> queues;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto& queue = queues[receiver];
+  if (queue == nullptr) {
+    queue.reset(new LoggerQueue(receiver));
+  }
+  return *queue;
+}
+
+LoggerQueue::LoggerQueue(const std::string& receiver) {
+  // The active plugin's queue keeps the prefix used before there were
+  // several queues, so its spilled requests survive an upgrade.
+  spill_prefix_ = kLoggerQueueSpillPrefix;
+  if (receiver != Registry::getActive("logger")) {
+    spill_prefix_ += receiver + ":";
+  }
+}
+
+Status LoggerQueue::add(LoggerQueueItem item) {
+  std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+  if (kLoggerQueueThread != this) {
+    lock.lock();
+  }
+  if (lock.owns_lock() && running_ && FLAGS_logger_async) {
+    size_t max = (FLAGS_logger_async_max > 0) ? FLAGS_logger_async_max : 1;
+    bool spill_policy = (FLAGS_logger_async_overflow == "spill");
+    if (spill_policy && (spilling_ || items_.size() >= max)) {
+      // Once spilling, continue until the flushing thread sends the spill.
+      auto status = spill(item);
+      if (status.ok()) {
+        kLoggerSpilled.add();
+        spilling_ = true;
+        not_empty_.notify_one();
+      }
+      return status;
+    }
+
+    if (items_.size() >= max) {
+      if (FLAGS_logger_async_overflow == "drop_oldest") {
+        items_.pop_front();
+        ++dropped_;
+        kLoggerDropped.add();
+      } else {
+        not_full_.wait(
+            lock, [this, max]() { return items_.size() < max || !running_; });
+      }
+    }
+
+    if (running_) {
+      items_.push_back(std::move(item));
+      kLoggerQueueSize.set(items_.size());
+      not_empty_.notify_one();
+      return Status(0, "OK");
+    }
+  }
+  if (lock.owns_lock()) {
+    lock.unlock();
+  }
+
+  // The flushing thread itself, and callers without a running queue, send
+  // requests directly.
+  std::deque<LoggerQueueItem> items;
+  items.push_back(std::move(item));
+  return sendLoggerItems(items);
+}
+
+bool LoggerQueue::start() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (running_) {
+    return false;
+  }
+  running_ = true;
+  // Send requests spilled, but not sent, before the last shutdown.
+  spilling_ = true;
+  return true;
+}
+
+void LoggerQueue::run() {
+  kLoggerQueueThread = this;
+  while (true) {
+    std::deque<LoggerQueueItem> items;
+    bool unspill_items = false;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      // Status logs are added without the lock, so their wakeup may be
+      // missed, the wait is bounded to relay them anyway.
+      not_empty_.wait_for(
+          lock, std::chrono::milliseconds(kLoggerQueueStatusLatency), [this]() {
+            return !items_.empty() || spilling_ || !running_ ||
+                   hasForwardedStatusLogs();
+          });
+      items.swap(items_);
+      kLoggerQueueSize.set(0);
+      unspill_items = spilling_;
+      if (items.empty() && !unspill_items && !running_) {
+        relayForwardedStatusLogs();
+        break;
+      }
+    }
+    not_full_.notify_all();
+
+    // Queued requests are older than spilled requests.
+    sendLoggerItems(items);
+    if (unspill_items) {
+      unspill();
+    }
+    relayForwardedStatusLogs();
+  }
+}
+
+void LoggerQueue::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = false;
+  }
+  not_empty_.notify_all();
+  not_full_.notify_all();
+}
+
+Status LoggerQueue::spill(const LoggerQueueItem& item) {
+  auto index = std::to_string(++spill_index_);
+  auto key = spill_prefix_ + std::to_string(getUnixTime()) + "_" +
+             std::string(20 - std::min<size_t>(index.size(), 20), '0') + index;
+
+  // Status logs from the backing store must not re-enter the locked queue.
+  auto previous = kLoggerQueueThread;
+  kLoggerQueueThread = this;
+  auto status = setDatabaseValue(kLogs,
+                                 key,
+                                 item.type + "\n" + item.receiver + "\n" +
+                                     item.category + "\n" + *item.data);
+  kLoggerQueueThread = previous;
+  return status;
+}
+
+void LoggerQueue::unspill() {
+  while (true) {
+    std::vector<std::string> keys;
+    {
+      // Callers spill while holding the lock, an empty scan ends spilling.
+      std::lock_guard<std::mutex> lock(mutex_);
+      scanDatabaseKeys(kLogs, keys, spill_prefix_, kLoggerQueueSpillBatch);
+      // Other queues' keys follow this queue's under the active prefix.
+      auto size = spill_prefix_.size();
+      auto other = std::find_if(
+          keys.begin(), keys.end(), [size](const std::string& key) {
+            return key.size() <= size || !isdigit(key[size]);
+          });
+      keys.erase(other, keys.end());
+      if (keys.empty()) {
+        spilling_ = false;
+        return;
+      }
+    }
+
+    std::deque<LoggerQueueItem> items;
+    DatabaseBatch batch;
+    for (const auto& key : keys) {
+      std::string value;
+      if (getDatabaseValue(kLogs, key, value)) {
+        auto type_end = value.find('\n');
+        auto receiver_end = value.find('\n', type_end + 1);
+        auto category_end = value.find('\n', receiver_end + 1);
+        if (type_end != std::string::npos &&
+            receiver_end != std::string::npos &&
+            category_end != std::string::npos) {
+          items.push_back(
+              {value.substr(0, type_end),
+               value.substr(type_end + 1, receiver_end - type_end - 1),
+               value.substr(receiver_end + 1, category_end - receiver_end - 1),
+               std::make_shared<const std::string>(
+                   value.substr(category_end + 1))});
+        }
+      }
+      batch.remove(kLogs, key);
+    }
+
+    sendLoggerItems(items);
+    if (!writeDatabaseBatch(batch).ok()) {
+      // Do not resend the same spilled requests forever.
+      std::lock_guard<std::mutex> lock(mutex_);
+      spilling_ = false;
+      return;
+    }
+  }
+}
+
 void setVerboseLevel() {
   if (Flag::getValue("verbose") == "true") {
     // Turn verbosity up to 1.
@@ -218,23 +846,48 @@ void initLogger(const std::string& name, bool forward_all) {
 
   // Stop the buffering sink and store the intermediate logs.
   BufferedLogSink::disable();
-  auto intermediate_logs = std::move(BufferedLogSink::dump());
+  auto intermediate_logs = BufferedLogSink::dump();
   auto& logger_plugin = Registry::getActive("logger");
   if (!Registry::exists("logger", logger_plugin)) {
     return;
   }
 
-  // Start the custom status logging facilities, which may instruct Glog as is
-  // the case with filesystem logging.
+  // Start the custom status logging facilities of each plugin, which may
+  // instruct Glog as is the case with filesystem logging.
   PluginRequest request = {{"init", name}};
   serializeIntermediateLog(intermediate_logs, request);
-  auto status = Registry::call("logger", request);
-  if (status.ok() || forward_all) {
+  std::vector<std::string> plugins;
+  std::vector<std::string> status_receivers;
+  for (const auto& plugin : getLoggerPlugins()) {
+    if (!Registry::exists("logger", plugin)) {
+      LOG(ERROR) << "Logger plugin not found: " << plugin;
+      continue;
+    }
+    plugins.push_back(plugin);
+    auto status = Registry::call("logger", plugin, request);
+    if (status.ok() || forward_all) {
+      status_receivers.push_back(plugin);
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(kStatusReceiversMutex);
+    kStatusReceivers = status_receivers;
+  }
+  if (!status_receivers.empty()) {
     // When LoggerPlugin::init returns success we enable the log sink in
     // forwarding mode. Then Glog status logs are forwarded to logStatus.
     BufferedLogSink::forward(true);
     BufferedLogSink::enable();
   }
+
+  for (const auto& plugin : plugins) {
+    auto& queue = LoggerQueue::instance(plugin);
+    if (FLAGS_logger_async && queue.start()) {
+      // Send results and forwarded status logs from a background thread.
+      Dispatcher::addService(std::make_shared<LoggerQueueRunner>(queue));
+    }
+  }
 }
 
 void BufferedLogSink::send(google::LogSeverity severity,
@@ -244,25 +897,87 @@ void BufferedLogSink::send(google::LogSeverity severity,
                            const struct ::tm* tm_time,
                            const char* message,
                            size_t message_len) {
-  // Either forward the log to an enabled logger or buffer until one exists.
-  if (forward_) {
-    // May use the logs_ storage to buffer/delay sending logs.
-    std::vector<StatusLogLine> log;
-    log.push_back({(StatusLogSeverity)severity,
+  // Drop repeated lines before copying them.
+  if (!limiter_.allow(severity, base_filename, line)) {
+    kLoggerStatusDropped.add();
+    return;
+  }
+
+  if (!ring_.push({(StatusLogSeverity)severity,
                    std::string(base_filename),
                    line,
-                   std::string(message, message_len)});
-    PluginRequest request = {{"status", "true"}};
-    serializeIntermediateLog(log, request);
-    Registry::call("logger", request);
-  } else {
-    logs_.push_back({(StatusLogSeverity)severity,
-                     std::string(base_filename),
-                     line,
-                     std::string(message, message_len)});
+                   std::string(message, message_len)})) {
+    kLoggerStatusDropped.add();
+    return;
+  }
+
+  // Either forward the log to an enabled logger or buffer until one exists.
+  if (forward_) {
+    auto& queue = LoggerQueue::instance(Registry::getActive("logger"));
+    if (queue.running()) {
+      queue.notify();
+    } else {
+      relay();
+    }
+  }
+}
+
+std::vector<StatusLogLine> BufferedLogSink::dump() {
+  std::vector<StatusLogLine> log;
+  StatusLogLine line;
+  while (log.size() < capacity() && instance().ring_.pop(line)) {
+    log.push_back(std::move(line));
+  }
+  return log;
+}
+
+void BufferedLogSink::relay() {
+  auto& sink = instance();
+  // Lines added while another thread relays are sent by that thread. Lines
+  // logged by the logger plugin itself wait for the next relay.
+  for (size_t pass = 0; pass < 2 && !empty(); ++pass) {
+    if (kStatusLogRelayThread ||
+        sink.relaying_.test_and_set(std::memory_order_acquire)) {
+      return;
+    }
+
+    kStatusLogRelayThread = true;
+    std::string data;
+    StatusLogLine line;
+    for (size_t count = 0; count < capacity() && sink.ring_.pop(line);
+         ++count) {
+      if (count > 0) {
+        data.push_back(',');
+      }
+      data.append(serializeStatusLine(line));
+    }
+    if (!data.empty()) {
+      // The lines are serialized once and added to each receiver's queue.
+      auto shared = std::make_shared<const std::string>(std::move(data));
+      std::vector<std::string> receivers;
+      {
+        std::lock_guard<std::mutex> lock(kStatusReceiversMutex);
+        receivers = kStatusReceivers;
+      }
+      for (const auto& receiver : receivers) {
+        LoggerQueue::instance(receiver).add({"status", receiver, "", shared});
+      }
+    }
+    kStatusLogRelayThread = false;
+    sink.relaying_.clear(std::memory_order_release);
   }
 }
 
+static void relayForwardedStatusLogs() {
+  if (BufferedLogSink::forwarding()) {
+    BufferedLogSink::relay();
+  }
+}
+
+static bool hasForwardedStatusLogs() {
+  return BufferedLogSink::forwarding() && !BufferedLogSink::empty();
+}
+
 Status LoggerPlugin::call(const PluginRequest& request,
                           PluginResponse& response) {
   QueryLogItem item;
@@ -284,48 +999,110 @@ Status LoggerPlugin::call(const PluginRequest& request,
   }
 }
 
+std::vector<std::string> getLoggerPlugins() {
+  std::vector<std::string> plugins = {Registry::getActive("logger")};
+  auto names = split(FLAGS_logger_plugin, ",");
+  for (size_t i = 1; i < names.size(); ++i) {
+    if (std::find(plugins.begin(), plugins.end(), names[i]) == plugins.end()) {
+      plugins.push_back(names[i]);
+    }
+  }
+  return plugins;
+}
+
+/// Queue a serialized log for each receiver, the queues share the data.
+static Status logData(const std::string& type,
+                      const std::vector<std::string>& receivers,
+                      const std::string& category,
+                      const LoggerData& data) {
+  auto status = Status(0, "OK");
+  for (const auto& receiver : receivers) {
+    if (!Registry::exists("logger", receiver)) {
+      LOG(ERROR) << "Logger receiver " << receiver << " not found";
+      status = Status(1, "Logger receiver not found");
+      continue;
+    }
+
+    // A logged string only fails for a missing receiver, plugins report their
+    // own errors.
+    auto added =
+        LoggerQueue::instance(receiver).add({type, receiver, category, data});
+    if (!added.ok() && type != "string") {
+      status = added;
+    }
+  }
+  return status;
+}
+
 Status logString(const std::string& message, const std::string& category) {
-  return logString(message, category, Registry::getActive("logger"));
+  return logData("string",
+                 getLoggerPlugins(),
+                 category,
+                 std::make_shared<const std::string>(message));
 }
 
 Status logString(const std::string& message,
                  const std::string& category,
                  const std::string& receiver) {
-  if (!Registry::exists("logger", receiver)) {
-    LOG(ERROR) << "Logger receiver " << receiver << " not found";
-    return Status(1, "Logger receiver not found");
+  return logData("string",
+                 {receiver},
+                 category,
+                 std::make_shared<const std::string>(message));
+}
+
+/// Serialize results once for every receiver.
+static Status logQueryLogItem(const QueryLogItem& results,
+                              const std::vector<std::string>& receivers) {
+  std::string json;
+  Status status;
+  {
+    ProfilePhase phase(&QueryProfile::serialize_time);
+    if (FLAGS_log_result_columns) {
+      status = serializeQueryLogItemAsColumnsJSON(
+          results, json, FLAGS_log_result_delta);
+    } else if (FLAGS_log_result_events) {
+      status = serializeQueryLogItemAsEventsJSON(results, json);
+    } else {
+      status = serializeQueryLogItemJSON(results, json);
+    }
+  }
+  if (!status.ok()) {
+    return status;
   }
 
-  auto status = Registry::call(
-      "logger", receiver, {{"string", message}, {"category", category}});
-  return Status(0, "OK");
+  ProfilePhase phase(&QueryProfile::log_time);
+  return logData("string",
+                 receivers,
+                 "event",
+                 std::make_shared<const std::string>(std::move(json)));
 }
 
 Status logQueryLogItem(const QueryLogItem& results) {
-  return logQueryLogItem(results, Registry::getActive("logger"));
+  ResultStream::instance().publish(results, false);
+  return logQueryLogItem(results, getLoggerPlugins());
 }
 
 Status logQueryLogItem(const QueryLogItem& results,
                        const std::string& receiver) {
-  std::string json;
-  Status status;
-  if (FLAGS_log_result_events) {
-    status = serializeQueryLogItemAsEventsJSON(results, json);
-  } else {
-    status = serializeQueryLogItemJSON(results, json);
-  }
-  if (!status.ok()) {
-    return status;
-  }
-  return logString(json, "event", receiver);
+  return logQueryLogItem(results, std::vector<std::string>{receiver});
 }
 
 Status logSnapshotQuery(const QueryLogItem& item) {
+  ResultStream::instance().publish(item, true);
+
   std::string json;
-  if (!serializeQueryLogItemJSON(item, json)) {
-    return Status(1, "Could not serialize snapshot");
+  {
+    ProfilePhase phase(&QueryProfile::serialize_time);
+    if (!serializeQueryLogItemJSON(item, json)) {
+      return Status(1, "Could not serialize snapshot");
+    }
   }
-  return Registry::call("logger", {{"snapshot", json}});
+
+  ProfilePhase phase(&QueryProfile::log_time);
+  return logData("snapshot",
+                 getLoggerPlugins(),
+                 "",
+                 std::make_shared<const std::string>(std::move(json)));
 }
 
 Status logHealthStatus(const QueryLogItem& item) {
@@ -333,24 +1110,38 @@ Status logHealthStatus(const QueryLogItem& item) {
   if (!serializeQueryLogItemJSON(item, json)) {
     return Status(1, "Could not serialize health");
   }
-  return Registry::call("logger", {{"health", json}});
+  return logData("health",
+                 getLoggerPlugins(),
+                 "",
+                 std::make_shared<const std::string>(std::move(json)));
 }
 
 void relayStatusLogs() {
   // Prevent out dumping and registry calling from producing additional logs.
   LoggerDisabler disabler;
 
-  // Construct a status log plugin request.
-  PluginRequest req = {{"status", "true"}};
-  auto& status_logs = BufferedLogSink::dump();
+  // Lines of a failed relay are sent again, before newer lines.
+  static std::vector<StatusLogLine> status_logs;
+  for (auto& line : BufferedLogSink::dump()) {
+    status_logs.push_back(std::move(line));
+  }
+  if (status_logs.size() > BufferedLogSink::capacity()) {
+    kLoggerStatusDropped.add(status_logs.size() - BufferedLogSink::capacity());
+    status_logs.erase(status_logs.begin(),
+                      status_logs.end() - BufferedLogSink::capacity());
+  }
   if (status_logs.size() == 0) {
     return;
   }
 
+  // Construct a status log plugin request.
+  PluginRequest req = {{"status", "true"}};
+
   // Skip the registry's logic, and send directly to the core's logger.
   PluginResponse resp;
   serializeIntermediateLog(status_logs, req);
-  auto status = callExtension(0, "logger", FLAGS_logger_plugin, req, resp);
+  auto status =
+      callExtension(0, "logger", Registry::getActive("logger"), req, resp);
   if (status.ok()) {
     // Flush the buffered status logs.
     // Otherwise the extension call failed and the buffering should continue.
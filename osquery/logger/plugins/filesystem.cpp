@@ -8,13 +8,24 @@
  *
  */
 
+#include <algorithm>
+#include <cerrno>
 #include <exception>
+#include <map>
 #include <mutex>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/noncopyable.hpp>
+
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/dispatcher/dispatcher.h"
+
 namespace pt = boost::property_tree;
 namespace fs = boost::filesystem;
 
@@ -27,15 +38,74 @@ FLAG(string,
 /// Legacy, backward compatible "osquery_log_dir" CLI option.
 FLAG_ALIAS(std::string, osquery_log_dir, logger_path);
 
+FLAG(int32,
+     logger_flush_size,
+     65536,
+     "Bytes of results buffered before writing to log files, 0 to disable");
+
+FLAG(int32,
+     logger_flush_interval,
+     1,
+     "Seconds between writing buffered results to log files");
+
+FLAG(int32,
+     logger_rotate_size,
+     0,
+     "Rotate results log files larger than this many bytes, 0 to disable");
+
+FLAG(int32, logger_rotate_max, 10, "Number of rotated results logs to keep");
+
 const std::string kFilesystemLoggerFilename = "osqueryd.results.log";
 const std::string kFilesystemLoggerSnapshots = "osqueryd.snapshots.log";
 const std::string kFilesystemLoggerHealth = "osqueryd.health.log";
 
 std::mutex filesystemLoggerPluginMutex;
 
+/**
+ * @brief A results log file kept open, with a userspace write buffer.
+ *
+ * Logs are appended to a buffer and written once the buffer holds at least
+ * --logger_flush_size bytes, or when the plugin's periodic flush runs. After
+ * a write, if the file is larger than --logger_rotate_size, it is renamed
+ * with a ".1" suffix and older rotations are shifted up to
+ * --logger_rotate_max. If the file is moved or removed by another process,
+ * such as logrotate, the next write creates it again.
+ */
+class FilesystemLogFile : private boost::noncopyable {
+ public:
+  explicit FilesystemLogFile(const fs::path& path) : path_(path) {}
+  ~FilesystemLogFile();
+
+  /// Append a log to the buffer, and write the buffer if it is full.
+  Status write(const std::string& s);
+
+  /// Write the buffer to the file.
+  Status flush();
+
+ private:
+  Status open();
+  void close();
+
+  /// Rename the file and its previous rotations, the file is closed.
+  Status rotate();
+
+ private:
+  fs::path path_;
+
+  /// The open file descriptor, or -1.
+  int fd_{-1};
+
+  /// The size of the open file.
+  size_t size_{0};
+
+  /// Logs not yet written.
+  std::string buffer_;
+};
+
 class FilesystemLoggerPlugin : public LoggerPlugin {
  public:
   Status setUp();
+  void tearDown();
   Status logString(const std::string& s);
   Status logStringToFile(const std::string& s, const std::string& filename);
   Status logSnapshot(const std::string& s);
@@ -43,17 +113,180 @@ class FilesystemLoggerPlugin : public LoggerPlugin {
   Status init(const std::string& name, const std::vector<StatusLogLine>& log);
   Status logStatus(const std::vector<StatusLogLine>& log);
 
+  /// Write the buffered logs for every file.
+  Status flush();
+
  private:
   fs::path log_path_;
+
+  /// The open results, snapshot, and health log files.
+  std::map<std::string, std::unique_ptr<FilesystemLogFile>> files_;
+};
+
+/**
+ * @brief A service writing buffered filesystem logs on an interval.
+ *
+ * The service also flushes when stopped, during shutdown.
+ */
+class FilesystemLogFlusher : public InternalRunnable {
+ public:
+  void start();
+  void stop() { flush(); }
+
+ private:
+  void flush();
 };
 
 REGISTER(FilesystemLoggerPlugin, "logger", "filesystem");
 
+FilesystemLogFile::~FilesystemLogFile() {
+  flush();
+  close();
+}
+
+Status FilesystemLogFile::write(const std::string& s) {
+  buffer_.append(s);
+  if (FLAGS_logger_flush_size <= 0 ||
+      buffer_.size() >= (size_t)FLAGS_logger_flush_size) {
+    return flush();
+  }
+  return Status(0, "OK");
+}
+
+Status FilesystemLogFile::open() {
+  // The results log may contain sensitive information if run as root.
+  fd_ = ::open(path_.c_str(), O_CREAT | O_APPEND | O_WRONLY, 0640);
+  if (fd_ < 0) {
+    return Status(1, "Could not create file: " + path_.string());
+  }
+
+  // If the file existed with different permissions before our open
+  // they must be restricted.
+  struct stat file_stat;
+  if (fchmod(fd_, 0640) != 0 || fstat(fd_, &file_stat) != 0) {
+    close();
+    return Status(1,
+                  "Failed to change permissions for file: " + path_.string());
+  }
+  size_ = file_stat.st_size;
+  return Status(0, "OK");
+}
+
+void FilesystemLogFile::close() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+Status FilesystemLogFile::flush() {
+  if (buffer_.empty()) {
+    return Status(0, "OK");
+  }
+
+  if (fd_ >= 0) {
+    // Reopen the path if the open file was moved or removed.
+    struct stat path_stat, file_stat;
+    if (::stat(path_.c_str(), &path_stat) != 0 ||
+        fstat(fd_, &file_stat) != 0 || path_stat.st_ino != file_stat.st_ino ||
+        path_stat.st_dev != file_stat.st_dev) {
+      close();
+    }
+  }
+
+  if (fd_ < 0) {
+    auto status = open();
+    if (!status.ok()) {
+      // Drop the logs rather than buffer without a bound.
+      buffer_.clear();
+      return status;
+    }
+  }
+
+  size_t written = 0;
+  while (written < buffer_.size()) {
+    auto bytes =
+        ::write(fd_, buffer_.data() + written, buffer_.size() - written);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    } else if (bytes <= 0) {
+      buffer_.clear();
+      return Status(1, "Failed to write contents to file: " + path_.string());
+    }
+    written += bytes;
+  }
+  size_ += written;
+  buffer_.clear();
+
+  if (FLAGS_logger_rotate_size > 0 &&
+      size_ >= (size_t)FLAGS_logger_rotate_size) {
+    return rotate();
+  }
+  return Status(0, "OK");
+}
+
+Status FilesystemLogFile::rotate() {
+  close();
+
+  // Shift the previous rotations, the oldest is replaced.
+  auto path = path_.string();
+  for (int i = FLAGS_logger_rotate_max - 1; i > 0; --i) {
+    auto from = path + "." + std::to_string(i);
+    auto to = path + "." + std::to_string(i + 1);
+    // The rotation may not exist yet.
+    ::rename(from.c_str(), to.c_str());
+  }
+
+  if (FLAGS_logger_rotate_max <= 0) {
+    ::unlink(path.c_str());
+  } else if (::rename(path.c_str(), (path + ".1").c_str()) != 0) {
+    return Status(1, "Could not rotate file: " + path);
+  }
+  return Status(0, "OK");
+}
+
 Status FilesystemLoggerPlugin::setUp() {
   log_path_ = fs::path(FLAGS_logger_path);
   return Status(0, "OK");
 }
 
+void FilesystemLoggerPlugin::tearDown() {
+  std::lock_guard<std::mutex> lock(filesystemLoggerPluginMutex);
+  // Closing each file writes its buffered logs.
+  files_.clear();
+}
+
+Status FilesystemLoggerPlugin::flush() {
+  std::lock_guard<std::mutex> lock(filesystemLoggerPluginMutex);
+  Status status;
+  for (auto& file : files_) {
+    auto file_status = file.second->flush();
+    if (!file_status.ok()) {
+      status = file_status;
+    }
+  }
+  return status;
+}
+
+void FilesystemLogFlusher::start() {
+  while (true) {
+    auto interval = std::max(FLAGS_logger_flush_interval, 1);
+    osquery::interruptableSleep(interval * 1000);
+    flush();
+  }
+}
+
+void FilesystemLogFlusher::flush() {
+  if (!Registry::exists("logger", "filesystem")) {
+    return;
+  }
+  auto plugin = std::dynamic_pointer_cast<FilesystemLoggerPlugin>(
+      Registry::get("logger", "filesystem"));
+  if (plugin != nullptr) {
+    plugin->flush();
+  }
+}
+
 Status FilesystemLoggerPlugin::logString(const std::string& s) {
   return logStringToFile(s, kFilesystemLoggerFilename);
 }
@@ -62,15 +295,14 @@ Status FilesystemLoggerPlugin::logStringToFile(const std::string& s,
                                                const std::string& filename) {
   std::lock_guard<std::mutex> lock(filesystemLoggerPluginMutex);
   try {
-    // The results log may contain sensitive information if run as root.
-    auto status = writeTextFile((log_path_ / filename).string(), s, 0640, true);
-    if (!status.ok()) {
-      return status;
+    auto& file = files_[filename];
+    if (file == nullptr) {
+      file.reset(new FilesystemLogFile(log_path_ / filename));
     }
+    return file->write(s);
   } catch (const std::exception& e) {
     return Status(1, e.what());
   }
-  return Status(0, "OK");
 }
 
 Status FilesystemLoggerPlugin::logStatus(
@@ -114,6 +346,12 @@ Status FilesystemLoggerPlugin::init(const std::string& name,
   // Restart the Glog facilities using the name `init` was provided.
   google::InitGoogleLogging(name.c_str());
 
+  // Start writing buffered results on an interval, once.
+  static std::once_flag flusher_started;
+  std::call_once(flusher_started, []() {
+    Dispatcher::addService(std::make_shared<FilesystemLogFlusher>());
+  });
+
   // We may violate Glog global object assumptions. So set names manually.
   auto basename = (log_path_ / name).string();
   google::SetLogDestination(google::INFO, (basename + ".INFO.").c_str());
@@ -8,11 +8,31 @@
  *
  */
 
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
 #include <syslog.h>
+#include <time.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
+
+#include <osquery/core.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/metrics.h"
+#include "osquery/logger/plugins/syslog.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 namespace osquery {
 
 FLAG(int32,
@@ -20,23 +40,390 @@ FLAG(int32,
      LOG_LOCAL3 >> 3,
      "Syslog facility for status and results logs (0-23, default 19)");
 
+FLAG(string,
+     logger_syslog_target,
+     "",
+     "Send RFC 5424 syslog messages directly to a socket path, or to "
+     "udp://host:port or tcp://host:port, instead of using syslog(3)");
+
+FLAG(uint64,
+     logger_syslog_queue_max,
+     8192,
+     "Maximum messages waiting for logger_syslog_target, later are dropped");
+
+const size_t kSyslogBatchMax = 64;
+
+/// The longest wait between reconnecting to a syslog target.
+const size_t kSyslogBackoffMax = 30000;
+
+static MetricCounter kSyslogDropped("logger.syslog_dropped");
+static MetricGauge kSyslogQueueSize("logger.syslog_queue");
+
+Status parseSyslogTarget(const std::string& target, SyslogTarget& parsed) {
+  if (target.empty()) {
+    return Status(1, "Empty syslog target");
+  }
+
+  auto scheme = target.find("://");
+  if (scheme == std::string::npos) {
+    parsed.transport = SyslogTarget::SYSLOG_UNIX;
+    parsed.address = target;
+    parsed.port.clear();
+    if (target.size() >= sizeof(sockaddr_un::sun_path)) {
+      return Status(1, "Syslog socket path is too long: " + target);
+    }
+    return Status(0, "OK");
+  }
+
+  auto protocol = target.substr(0, scheme);
+  if (protocol == "udp") {
+    parsed.transport = SyslogTarget::SYSLOG_UDP;
+  } else if (protocol == "tcp") {
+    parsed.transport = SyslogTarget::SYSLOG_TCP;
+  } else {
+    return Status(1, "Unknown syslog transport: " + protocol);
+  }
+
+  // The host may be a bracketed IPv6 address.
+  auto host = target.substr(scheme + 3);
+  auto colon = host.rfind(':');
+  if (colon == std::string::npos || colon == 0 || colon + 1 == host.size() ||
+      (host.find(':') != colon && host[colon - 1] != ']')) {
+    return Status(1, "Syslog target requires host:port: " + target);
+  }
+  parsed.port = host.substr(colon + 1);
+  parsed.address = host.substr(0, colon);
+  if (parsed.address.front() == '[' && parsed.address.back() == ']') {
+    parsed.address = parsed.address.substr(1, parsed.address.size() - 2);
+  }
+  return Status(0, "OK");
+}
+
+void formatSyslogMessage(int priority,
+                         const std::string& header,
+                         const char* msgid,
+                         const char* message,
+                         size_t size,
+                         std::string& output) {
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  struct tm utc;
+  gmtime_r(&now.tv_sec, &utc);
+
+  // <PRI>VERSION TIMESTAMP HOSTNAME APP-NAME PROCID MSGID STRUCTURED-DATA MSG
+  char prefix[64];
+  auto length = snprintf(prefix,
+                         sizeof(prefix),
+                         "<%d>1 %04d-%02d-%02dT%02d:%02d:%02d.%06ldZ ",
+                         priority,
+                         utc.tm_year + 1900,
+                         utc.tm_mon + 1,
+                         utc.tm_mday,
+                         utc.tm_hour,
+                         utc.tm_min,
+                         utc.tm_sec,
+                         (long)now.tv_usec);
+  output.reserve(output.size() + length + header.size() + strlen(msgid) +
+                 size + 4);
+  output.append(prefix, length);
+  output.append(header);
+  output.push_back(' ');
+  output.append(msgid);
+  output.append(" - ", 3);
+  output.append(message, size);
+}
+
+SyslogSender::SyslogSender(const SyslogTarget& target, size_t max_queued)
+    : target_(target), max_queued_(std::max(max_queued, (size_t)1)) {}
+
+bool SyslogSender::add(std::string message) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (queue_.size() >= max_queued_) {
+      kSyslogDropped.add();
+      return false;
+    }
+    queue_.push_back(std::move(message));
+  }
+  not_empty_.notify_one();
+  return true;
+}
+
+size_t SyslogSender::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return queue_.size();
+}
+
+void SyslogSender::start() {
+  std::vector<std::string> batch;
+  size_t failures = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (batch.empty()) {
+        not_empty_.wait(lock,
+                        [this]() { return stopping_ || !queue_.empty(); });
+        if (queue_.empty()) {
+          break;
+        }
+        while (batch.size() < kSyslogBatchMax && !queue_.empty()) {
+          batch.push_back(std::move(queue_.front()));
+          queue_.pop_front();
+        }
+        kSyslogQueueSize.set(queue_.size());
+      }
+    }
+
+    auto status = send(batch);
+    if (status.ok()) {
+      failures = 0;
+      continue;
+    }
+
+    disconnect();
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stopping_) {
+      // Remaining messages are sent once while stopping.
+      kSyslogDropped.add(batch.size());
+      batch.clear();
+      continue;
+    }
+
+    if (failures++ == 0) {
+      // The warning may be relayed back to this sender's add.
+      lock.unlock();
+      LOG(WARNING) << "Cannot send to syslog target: " << status.getMessage();
+      lock.lock();
+    }
+    auto backoff = std::min((size_t)100 << std::min(failures, (size_t)10),
+                            kSyslogBackoffMax);
+    not_empty_.wait_for(lock,
+                        std::chrono::milliseconds(backoff),
+                        [this]() { return stopping_; });
+  }
+  disconnect();
+}
+
+void SyslogSender::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  not_empty_.notify_all();
+}
+
+Status SyslogSender::connect() {
+  if (socket_ >= 0) {
+    return Status(0, "OK");
+  }
+
+  if (target_.transport == SyslogTarget::SYSLOG_UNIX) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path,
+            target_.address.c_str(),
+            sizeof(address.sun_path) - 1);
+
+    // Most local receivers use datagrams, some only listen on a stream.
+    for (int type : {SOCK_DGRAM, SOCK_STREAM}) {
+      socket_ = ::socket(AF_UNIX, type, 0);
+      if (socket_ < 0) {
+        return Status(1, std::string("Cannot open socket: ") + strerror(errno));
+      }
+      if (::connect(socket_, (struct sockaddr*)&address, sizeof(address)) ==
+          0) {
+        stream_ = (type == SOCK_STREAM);
+        return Status(0, "OK");
+      }
+      auto error = errno;
+      disconnect();
+      if (error != EPROTOTYPE) {
+        return Status(1, target_.address + ": " + strerror(error));
+      }
+    }
+    return Status(1, target_.address + ": " + strerror(EPROTOTYPE));
+  }
+
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  stream_ = (target_.transport == SyslogTarget::SYSLOG_TCP);
+  hints.ai_socktype = (stream_) ? SOCK_STREAM : SOCK_DGRAM;
+
+  struct addrinfo* addresses = nullptr;
+  auto result = ::getaddrinfo(
+      target_.address.c_str(), target_.port.c_str(), &hints, &addresses);
+  if (result != 0) {
+    return Status(1, target_.address + ": " + gai_strerror(result));
+  }
+
+  auto error = 0;
+  for (auto address = addresses; address != nullptr;
+       address = address->ai_next) {
+    socket_ = ::socket(
+        address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (socket_ < 0) {
+      error = errno;
+      continue;
+    }
+    if (::connect(socket_, address->ai_addr, address->ai_addrlen) == 0) {
+      break;
+    }
+    error = errno;
+    disconnect();
+  }
+  ::freeaddrinfo(addresses);
+
+  if (socket_ < 0) {
+    return Status(1, target_.address + ": " + strerror(error));
+  }
+  return Status(0, "OK");
+}
+
+void SyslogSender::disconnect() {
+  if (socket_ >= 0) {
+    ::close(socket_);
+    socket_ = -1;
+  }
+}
+
+Status SyslogSender::send(std::vector<std::string>& batch) {
+  auto status = connect();
+  if (!status.ok()) {
+    return status;
+  }
+
+  if (stream_) {
+    // Octet-counted framing, a message may contain newlines.
+    std::string buffer;
+    size_t size = 0;
+    for (const auto& message : batch) {
+      size += message.size() + 12;
+    }
+    buffer.reserve(size);
+    std::vector<size_t> ends;
+    ends.reserve(batch.size());
+    for (const auto& message : batch) {
+      buffer.append(std::to_string(message.size()));
+      buffer.push_back(' ');
+      buffer.append(message);
+      ends.push_back(buffer.size());
+    }
+
+    size_t sent = 0;
+    while (sent < buffer.size()) {
+      auto result = ::send(
+          socket_, buffer.data() + sent, buffer.size() - sent, MSG_NOSIGNAL);
+      if (result < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        // Only the frames not completely sent are sent again, a partial frame
+        // is sent from its start on the next connection.
+        auto error = errno;
+        auto done = std::upper_bound(ends.begin(), ends.end(), sent);
+        batch.erase(batch.begin(), batch.begin() + (done - ends.begin()));
+        return Status(1, std::string("Cannot send: ") + strerror(error));
+      }
+      sent += result;
+    }
+    batch.clear();
+    return Status(0, "OK");
+  }
+
+  while (!batch.empty()) {
+#ifdef __linux__
+    struct mmsghdr messages[kSyslogBatchMax];
+    struct iovec vectors[kSyslogBatchMax];
+    auto count = std::min(batch.size(), kSyslogBatchMax);
+    memset(messages, 0, sizeof(messages[0]) * count);
+    for (size_t i = 0; i < count; ++i) {
+      vectors[i].iov_base = (void*)batch[i].data();
+      vectors[i].iov_len = batch[i].size();
+      messages[i].msg_hdr.msg_iov = &vectors[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    auto result = ::sendmmsg(socket_, messages, count, MSG_NOSIGNAL);
+#else
+    auto result = ::send(
+        socket_, batch[0].data(), batch[0].size(), MSG_NOSIGNAL) < 0 ? -1 : 1;
+#endif
+    if (result > 0) {
+      batch.erase(batch.begin(), batch.begin() + result);
+    } else if (result < 0 && errno == EMSGSIZE) {
+      // A message too large for a datagram is never sent.
+      kSyslogDropped.add();
+      batch.erase(batch.begin());
+    } else if (result < 0 && errno != EINTR) {
+      return Status(1, std::string("Cannot send: ") + strerror(errno));
+    }
+  }
+  return Status(0, "OK");
+}
+
 class SyslogLoggerPlugin : public LoggerPlugin {
  public:
   Status logString(const std::string& s);
   Status init(const std::string& name, const std::vector<StatusLogLine>& log);
   Status logStatus(const std::vector<StatusLogLine>& log);
+
+ private:
+  /// Queue a message for the target, or write it with syslog(3).
+  void write(int severity,
+             const char* msgid,
+             const char* message,
+             size_t size);
+
+ private:
+  /// The target's sender, nullptr when using syslog(3).
+  std::shared_ptr<SyslogSender> sender_{nullptr};
+
+  /// The HOSTNAME, APP-NAME, and PROCID of each message.
+  std::string header_;
 };
 
 REGISTER(SyslogLoggerPlugin, "logger", "syslog");
 
+void SyslogLoggerPlugin::write(int severity,
+                               const char* msgid,
+                               const char* message,
+                               size_t size) {
+  if (sender_ == nullptr) {
+    syslog(severity, "%.*s", (int)size, message);
+    return;
+  }
+
+  std::string framed;
+  formatSyslogMessage((FLAGS_logger_syslog_facility << 3) | severity,
+                      header_,
+                      msgid,
+                      message,
+                      size,
+                      framed);
+  sender_->add(std::move(framed));
+}
+
 Status SyslogLoggerPlugin::logString(const std::string& s) {
-  for (const auto& line : osquery::split(s, "\n")) {
-    syslog(LOG_INFO, "result=%s", line.c_str());
+  // Each line is a message, prefixed as "result=" for existing parsers.
+  std::string line;
+  const char* start = s.data();
+  const char* end = start + s.size();
+  while (start < end) {
+    auto newline = (const char*)memchr(start, '\n', end - start);
+    auto size = ((newline == nullptr) ? end : newline) - start;
+    if (size > 0) {
+      line.assign("result=", 7);
+      line.append(start, size);
+      write(LOG_INFO, "result", line.data(), line.size());
+    }
+    start += size + 1;
   }
   return Status(0, "OK");
 }
 
 Status SyslogLoggerPlugin::logStatus(const std::vector<StatusLogLine>& log) {
+  std::string line;
   for (const auto& item : log) {
     int severity = LOG_NOTICE;
     if (item.severity == O_INFO) {
@@ -49,11 +436,15 @@ Status SyslogLoggerPlugin::logStatus(const std::vector<StatusLogLine>& log) {
       severity = LOG_CRIT;
     }
 
-    std::string line = "severity=" + std::to_string(item.severity)
-                    + " location=" + item.filename + ":" + std::to_string(item.line) +
-                      " message=" + item.message;
-
-    syslog(severity, "%s", line.c_str());
+    line.assign("severity=", 9);
+    line.append(std::to_string(item.severity));
+    line.append(" location=", 10);
+    line.append(item.filename);
+    line.push_back(':');
+    line.append(std::to_string(item.line));
+    line.append(" message=", 9);
+    line.append(item.message);
+    write(severity, "status", line.data(), line.size());
   }
   return Status(0, "OK");
 }
@@ -67,7 +458,31 @@ Status SyslogLoggerPlugin::init(const std::string& name,
       FLAGS_logger_syslog_facility > 23) {
     FLAGS_logger_syslog_facility = LOG_LOCAL3 >> 3;
   }
-  openlog(name.c_str(), LOG_PID | LOG_CONS, FLAGS_logger_syslog_facility << 3);
+
+  if (FLAGS_logger_syslog_target.empty()) {
+    openlog(
+        name.c_str(), LOG_PID | LOG_CONS, FLAGS_logger_syslog_facility << 3);
+  } else if (sender_ == nullptr) {
+    SyslogTarget target;
+    auto status = parseSyslogTarget(FLAGS_logger_syslog_target, target);
+    if (!status.ok()) {
+      return status;
+    }
+
+    auto hostname = getHostname();
+    std::replace(hostname.begin(), hostname.end(), ' ', '-');
+    header_ = ((hostname.empty()) ? "-" : hostname) + " " +
+              ((name.empty()) ? "-" : name.substr(0, 48)) + " " +
+              std::to_string(::getpid());
+
+    auto sender = std::make_shared<SyslogSender>(
+        target, FLAGS_logger_syslog_queue_max);
+    status = Dispatcher::addService(sender);
+    if (!status.ok()) {
+      return status;
+    }
+    sender_ = sender;
+  }
 
   // Now funnel the intermediate status logs provided to `init`.
   return logStatus(log);
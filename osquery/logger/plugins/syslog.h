@@ -0,0 +1,117 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <osquery/status.h>
+
+#include "osquery/dispatcher/dispatcher.h"
+
+namespace osquery {
+
+/// The most messages sent to a syslog socket in one call.
+extern const size_t kSyslogBatchMax;
+
+/// A syslog receiver parsed from --logger_syslog_target.
+struct SyslogTarget {
+  enum Transport {
+    SYSLOG_UNIX,
+    SYSLOG_UDP,
+    SYSLOG_TCP,
+  };
+
+  Transport transport{SYSLOG_UNIX};
+
+  /// A socket path, or a remote host.
+  std::string address;
+
+  /// A remote port.
+  std::string port;
+};
+
+/**
+ * @brief Parse a syslog target.
+ *
+ * A target is a local socket path, such as /dev/log, or udp://host:port or
+ * tcp://host:port for a remote receiver.
+ */
+Status parseSyslogTarget(const std::string& target, SyslogTarget& parsed);
+
+/**
+ * @brief Append an RFC 5424 message.
+ *
+ * @param priority The facility multiplied by 8, plus the severity.
+ * @param header The hostname, app-name, and procid, separated by spaces.
+ * @param msgid The message ID, such as "result" or "status".
+ * @param message The message text.
+ * @param size The size of the message text.
+ * @param output The framed message is appended.
+ */
+void formatSyslogMessage(int priority,
+                         const std::string& header,
+                         const char* msgid,
+                         const char* message,
+                         size_t size,
+                         std::string& output);
+
+/**
+ * @brief Send syslog messages directly to a socket from its own thread.
+ *
+ * Messages wait in a bounded queue, new messages are dropped while the queue
+ * is full. The sending thread takes up to kSyslogBatchMax messages at a time:
+ * datagram sockets receive the batch with one sendmmsg, stream sockets
+ * receive octet-counted frames (RFC 6587) in one buffer. When a send fails
+ * the socket is reconnected with a backoff, and the batch is sent again.
+ */
+class SyslogSender : public InternalRunnable {
+ public:
+  SyslogSender(const SyslogTarget& target, size_t max_queued);
+
+  /// Queue a framed message, false if the queue is full.
+  bool add(std::string message);
+
+  /// The number of queued messages.
+  size_t size();
+
+  /// Send messages until stopped, then send the remaining messages once.
+  void start();
+
+  void stop();
+
+  /// Send a batch, removing the messages that were sent.
+  Status send(std::vector<std::string>& batch);
+
+ private:
+  Status connect();
+
+  void disconnect();
+
+ private:
+  SyslogTarget target_;
+  size_t max_queued_;
+
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::deque<std::string> queue_;
+  bool stopping_{false};
+
+  /// The connected socket, or -1.
+  int socket_{-1};
+
+  /// The socket is a stream, messages are octet-counted.
+  bool stream_{false};
+};
+}
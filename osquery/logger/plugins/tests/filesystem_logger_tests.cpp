@@ -0,0 +1,103 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <boost/filesystem/operations.hpp>
+
+#include <gtest/gtest.h>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/test_util.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+DECLARE_string(logger_path);
+DECLARE_int32(logger_flush_size);
+DECLARE_int32(logger_rotate_size);
+DECLARE_int32(logger_rotate_max);
+
+class FilesystemLoggerTests : public testing::Test {
+ public:
+  void SetUp() {
+    log_path_ = kTestWorkingDirectory + "filesystem_logger/";
+    fs::remove_all(log_path_);
+    fs::create_directories(log_path_);
+    results_path_ = log_path_ + "osqueryd.results.log";
+
+    logger_path_ = FLAGS_logger_path;
+    flush_size_ = FLAGS_logger_flush_size;
+    rotate_size_ = FLAGS_logger_rotate_size;
+    rotate_max_ = FLAGS_logger_rotate_max;
+    FLAGS_logger_path = log_path_;
+
+    plugin_ = Registry::get("logger", "filesystem");
+    plugin_->setUp();
+  }
+
+  void TearDown() {
+    plugin_->tearDown();
+    FLAGS_logger_path = logger_path_;
+    FLAGS_logger_flush_size = flush_size_;
+    FLAGS_logger_rotate_size = rotate_size_;
+    FLAGS_logger_rotate_max = rotate_max_;
+    fs::remove_all(log_path_);
+  }
+
+ protected:
+  std::string log_path_;
+  std::string results_path_;
+  PluginRef plugin_;
+
+ private:
+  std::string logger_path_;
+  int flush_size_;
+  int rotate_size_;
+  int rotate_max_;
+};
+
+TEST_F(FilesystemLoggerTests, test_buffered_write) {
+  FLAGS_logger_flush_size = 1024;
+  auto s = Registry::call("logger", "filesystem", {{"string", "{\"a\":1}\n"}});
+  EXPECT_TRUE(s.ok());
+
+  // The log is buffered until the buffer fills or the logger flushes.
+  EXPECT_FALSE(pathExists(results_path_).ok());
+  plugin_->tearDown();
+
+  std::string content;
+  EXPECT_TRUE(readFile(results_path_, content).ok());
+  EXPECT_EQ(content, "{\"a\":1}\n");
+}
+
+TEST_F(FilesystemLoggerTests, test_rotate) {
+  FLAGS_logger_flush_size = 0;
+  FLAGS_logger_rotate_size = 100;
+  FLAGS_logger_rotate_max = 2;
+
+  auto line = std::string(60, 'a') + "\n";
+  for (size_t i = 0; i < 5; ++i) {
+    auto s = Registry::call("logger", "filesystem", {{"string", line}});
+    EXPECT_TRUE(s.ok());
+  }
+
+  // Every second line exceeds the rotation size, the oldest is removed.
+  std::string content;
+  EXPECT_TRUE(readFile(results_path_, content).ok());
+  EXPECT_EQ(content, line);
+  EXPECT_TRUE(readFile(results_path_ + ".1", content).ok());
+  EXPECT_EQ(content, line + line);
+  EXPECT_TRUE(pathExists(results_path_ + ".2").ok());
+  EXPECT_FALSE(pathExists(results_path_ + ".3").ok());
+}
+}
@@ -0,0 +1,124 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/test_util.h"
+#include "osquery/logger/plugins/syslog.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+class SyslogLoggerTests : public testing::Test {};
+
+TEST_F(SyslogLoggerTests, test_format_message) {
+  std::string output;
+  std::string message = "result={\"name\":\"pack\"}";
+  formatSyslogMessage(
+      (19 << 3) | 6, "host osqueryd 42", "result", message.data(), 8, output);
+
+  // <PRI>1 YYYY-MM-DDTHH:MM:SS.uuuuuuZ HOST APP PID MSGID - MSG
+  EXPECT_EQ(0U, output.find("<158>1 "));
+  EXPECT_EQ('T', output[17]);
+  EXPECT_EQ('Z', output[33]);
+  EXPECT_EQ("host osqueryd 42 result - result={", output.substr(35));
+}
+
+TEST_F(SyslogLoggerTests, test_parse_target) {
+  SyslogTarget target;
+  EXPECT_TRUE(parseSyslogTarget("/dev/log", target).ok());
+  EXPECT_EQ(SyslogTarget::SYSLOG_UNIX, target.transport);
+  EXPECT_EQ("/dev/log", target.address);
+
+  EXPECT_TRUE(parseSyslogTarget("udp://127.0.0.1:514", target).ok());
+  EXPECT_EQ(SyslogTarget::SYSLOG_UDP, target.transport);
+  EXPECT_EQ("127.0.0.1", target.address);
+  EXPECT_EQ("514", target.port);
+
+  EXPECT_TRUE(parseSyslogTarget("tcp://[::1]:6514", target).ok());
+  EXPECT_EQ(SyslogTarget::SYSLOG_TCP, target.transport);
+  EXPECT_EQ("::1", target.address);
+  EXPECT_EQ("6514", target.port);
+
+  EXPECT_FALSE(parseSyslogTarget("", target).ok());
+  EXPECT_FALSE(parseSyslogTarget("tls://host:6514", target).ok());
+  EXPECT_FALSE(parseSyslogTarget("udp://host", target).ok());
+  EXPECT_FALSE(parseSyslogTarget("tcp://::1:514", target).ok());
+}
+
+TEST_F(SyslogLoggerTests, test_sender) {
+  auto path = kTestWorkingDirectory + "syslog.sock";
+  fs::remove(path);
+
+  int receiver = ::socket(AF_UNIX, SOCK_DGRAM, 0);
+  ASSERT_GE(receiver, 0);
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  ASSERT_EQ(0, ::bind(receiver, (struct sockaddr*)&address, sizeof(address)));
+
+  SyslogTarget target;
+  ASSERT_TRUE(parseSyslogTarget(path, target).ok());
+
+  // Messages beyond the queue's bound are dropped.
+  auto sender = std::make_shared<SyslogSender>(target, 100);
+  for (size_t i = 0; i < 101; ++i) {
+    EXPECT_EQ(i < 100, sender->add("message " + std::to_string(i)));
+  }
+  EXPECT_EQ(100U, sender->size());
+
+  // Messages are sent in batches, a receiver may hold only a few at a time.
+  struct timeval timeout = {5, 0};
+  ::setsockopt(
+      receiver, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  std::thread thread([sender]() { sender->run(); });
+  char buffer[64];
+  for (size_t i = 0; i < 100; ++i) {
+    auto size = ::recv(receiver, buffer, sizeof(buffer), 0);
+    ASSERT_GT(size, 0);
+    EXPECT_EQ("message " + std::to_string(i), std::string(buffer, size));
+  }
+  EXPECT_EQ(0U, sender->size());
+
+  // Messages queued before stopping are sent before the thread returns.
+  EXPECT_TRUE(sender->add("last"));
+  sender->stop();
+  thread.join();
+  auto size = ::recv(receiver, buffer, sizeof(buffer), MSG_DONTWAIT);
+  EXPECT_EQ("last", std::string(buffer, std::max(size, (ssize_t)0)));
+
+  ::close(receiver);
+  fs::remove(path);
+}
+
+TEST_F(SyslogLoggerTests, test_sender_failure) {
+  SyslogTarget target;
+  ASSERT_TRUE(
+      parseSyslogTarget(kTestWorkingDirectory + "missing.sock", target).ok());
+
+  SyslogSender sender(target, 10);
+  std::vector<std::string> batch = {"first", "second"};
+  EXPECT_FALSE(sender.send(batch).ok());
+  EXPECT_EQ(2U, batch.size());
+}
+}
@@ -0,0 +1,177 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/database.h>
+#include <osquery/flags.h>
+
+#include "osquery/core/test_util.h"
+#include "osquery/database/db_handle.h"
+#include "osquery/logger/plugins/tls.h"
+
+namespace osquery {
+
+DECLARE_uint64(logger_tls_max_buffer_bytes);
+
+class TLSLoggerTests : public testing::Test {
+ protected:
+  void SetUp() {
+    max_buffer_bytes_ = FLAGS_logger_tls_max_buffer_bytes;
+    clearLogs();
+  }
+
+  void TearDown() {
+    FLAGS_logger_tls_max_buffer_bytes = max_buffer_bytes_;
+    clearLogs();
+  }
+
+  /// Remove the buffered logs and cursors, and forget the buffer state.
+  void clearLogs() {
+    auto db = DBHandle::getInstance();
+    for (const auto& type : {kTLSResultLog, kTLSStatusLog}) {
+      db->DeleteRange(kLogs, std::string(1, type), std::string(1, type + 1));
+      deleteDatabaseValue(kPersistentSettings, kTLSLogCursorPrefix + type);
+    }
+    TLSLoggerPlugin::sequence = 0;
+    TLSLoggerPlugin::buffered_bytes = 0;
+  }
+
+  /// The buffered log key of a type and sequence number.
+  std::string getLogIndex(char type, uint64_t sequence) {
+    auto number = std::to_string(sequence);
+    return type + std::string(kTLSLogIndexWidth - number.size(), '0') + number;
+  }
+
+  /// The buffered logs of a type, in key order.
+  std::vector<std::pair<std::string, std::string>> getLogs(char type) {
+    std::vector<std::pair<std::string, std::string>> logs;
+    DBHandle::getInstance()->ScanPrefix(kLogs, std::string(1, type), logs);
+    return logs;
+  }
+
+ private:
+  uint64_t max_buffer_bytes_{0};
+};
+
+TEST_F(TLSLoggerTests, test_recover_legacy_keys) {
+  // A previous run buffered logs with sequence keys and time-based keys.
+  setDatabaseValue(kLogs, getLogIndex(kTLSResultLog, 4), "four");
+  setDatabaseValue(kLogs, "r1445000000_1", "legacy1");
+  setDatabaseValue(kLogs, "r1445000000_2", "legacy2");
+  setDatabaseValue(kLogs, "s1445000000_1", "status");
+
+  TLSLoggerPlugin::recover();
+
+  // The time-based keys are renumbered after the sequence, in order.
+  auto results = getLogs(kTLSResultLog);
+  ASSERT_EQ(results.size(), 3U);
+  EXPECT_EQ(results[0].first, getLogIndex(kTLSResultLog, 4));
+  EXPECT_EQ(results[1].first, getLogIndex(kTLSResultLog, 5));
+  EXPECT_EQ(results[1].second, "legacy1");
+  EXPECT_EQ(results[2].first, getLogIndex(kTLSResultLog, 6));
+  EXPECT_EQ(results[2].second, "legacy2");
+
+  auto statuses = getLogs(kTLSStatusLog);
+  ASSERT_EQ(statuses.size(), 1U);
+  EXPECT_EQ(statuses[0].first, getLogIndex(kTLSStatusLog, 7));
+  EXPECT_EQ(statuses[0].second, "status");
+
+  EXPECT_EQ(TLSLoggerPlugin::sequence, 7U);
+  EXPECT_EQ(TLSLoggerPlugin::buffered_bytes, 4U + 7U + 7U + 6U);
+
+  // A second recovery has nothing left to migrate.
+  TLSLoggerPlugin::recover();
+  EXPECT_EQ(getLogs(kTLSResultLog), results);
+  EXPECT_EQ(TLSLoggerPlugin::sequence, 7U);
+}
+
+TEST_F(TLSLoggerTests, test_cursor_resume) {
+  TLSLoggerPlugin plugin;
+  for (const auto& log : {"one", "two", "three", "four"}) {
+    EXPECT_TRUE(plugin.logString(log).ok());
+  }
+  EXPECT_EQ(TLSLoggerPlugin::buffered_bytes, 15U);
+
+  // The endpoint acknowledged the first two logs.
+  TLSLogForwarderRunner runner("");
+  runner.acknowledge(kTLSResultLog, 0, 2, 6);
+  EXPECT_EQ(TLSLoggerPlugin::buffered_bytes, 9U);
+  auto logs = getLogs(kTLSResultLog);
+  ASSERT_EQ(logs.size(), 2U);
+  EXPECT_EQ(logs[0].first, getLogIndex(kTLSResultLog, 3));
+
+  // A failed send leaves the cursor and the buffered logs in place.
+  EXPECT_FALSE(runner.send("https://127.0.0.1:1/", kTLSResultLog, "result"));
+  EXPECT_EQ(getLogs(kTLSResultLog), logs);
+  std::string cursor;
+  getDatabaseValue(
+      kPersistentSettings, kTLSLogCursorPrefix + kTLSResultLog, cursor);
+  EXPECT_EQ(cursor, "2");
+
+  // A restart interrupted the removal of the third acknowledged log.
+  setDatabaseValue(
+      kPersistentSettings, kTLSLogCursorPrefix + kTLSResultLog, "3");
+  TLSLoggerPlugin::sequence = 0;
+  TLSLoggerPlugin::buffered_bytes = 0;
+  TLSLoggerPlugin::recover();
+
+  // Only the unacknowledged log remains, and the sequence continues after it.
+  logs = getLogs(kTLSResultLog);
+  ASSERT_EQ(logs.size(), 1U);
+  EXPECT_EQ(logs[0].first, getLogIndex(kTLSResultLog, 4));
+  EXPECT_EQ(TLSLoggerPlugin::buffered_bytes, 4U);
+
+  EXPECT_TRUE(plugin.logString("five").ok());
+  logs = getLogs(kTLSResultLog);
+  ASSERT_EQ(logs.size(), 2U);
+  EXPECT_EQ(logs[1].first, getLogIndex(kTLSResultLog, 5));
+
+  // A cursor past every buffered log still keeps the sequence ahead of it.
+  setDatabaseValue(
+      kPersistentSettings, kTLSLogCursorPrefix + kTLSStatusLog, "9");
+  TLSLoggerPlugin::recover();
+  EXPECT_EQ(TLSLoggerPlugin::sequence, 9U);
+  EXPECT_TRUE(getLogs(kTLSStatusLog).empty());
+}
+
+TEST_F(TLSLoggerTests, test_buffer_bytes_drop) {
+  FLAGS_logger_tls_max_buffer_bytes = 10;
+  TLSLoggerPlugin plugin;
+  EXPECT_TRUE(plugin.logString("12345").ok());
+  EXPECT_TRUE(plugin.logString("1234").ok());
+
+  // A log that does not fit in the remaining byte is dropped.
+  EXPECT_FALSE(plugin.logString("12").ok());
+  EXPECT_EQ(getLogs(kTLSResultLog).size(), 2U);
+  EXPECT_EQ(TLSLoggerPlugin::buffered_bytes, 9U);
+  EXPECT_TRUE(plugin.logString("1").ok());
+  EXPECT_EQ(TLSLoggerPlugin::buffered_bytes, 10U);
+
+  // Acknowledged logs release their bytes.
+  TLSLogForwarderRunner runner("");
+  runner.acknowledge(kTLSResultLog, 0, 3, 10);
+  EXPECT_EQ(TLSLoggerPlugin::buffered_bytes, 0U);
+
+  // Status lines are buffered until the first line that does not fit.
+  FLAGS_logger_tls_max_buffer_bytes = 150;
+  std::vector<StatusLogLine> log = {
+      {O_INFO, "file.cpp", 1, "first"},
+      {O_INFO, "file.cpp", 2, "second"},
+      {O_INFO, "file.cpp", 3, "third"},
+  };
+  EXPECT_FALSE(plugin.logStatus(log).ok());
+  auto statuses = getLogs(kTLSStatusLog);
+  ASSERT_EQ(statuses.size(), 2U);
+  EXPECT_NE(statuses[1].second.find("second"), std::string::npos);
+  EXPECT_EQ(TLSLoggerPlugin::buffered_bytes,
+            statuses[0].second.size() + statuses[1].second.size());
+}
+}
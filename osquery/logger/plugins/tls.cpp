@@ -8,9 +8,12 @@
  *
  */
 
-#include <vector>
+#include <cctype>
+#include <mutex>
 #include <string>
+#include <vector>
 
+#include <boost/lexical_cast.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
@@ -20,7 +23,11 @@
 #include <osquery/registry.h>
 #include <osquery/database.h>
 
+#include "osquery/core/conversions.h"
+#include "osquery/core/json.h"
+#include "osquery/database/db_handle.h"
 #include "osquery/dispatcher/dispatcher.h"
+#include "osquery/logger/plugins/tls.h"
 #include "osquery/remote/requests.h"
 #include "osquery/remote/transports/tls.h"
 #include "osquery/remote/serializers/json.h"
@@ -34,136 +41,162 @@ FLAG(int32,
      logger_tls_period,
      4,
      "Seconds between flushing logs over TLS/HTTPS");
+FLAG(bool,
+     logger_tls_compress,
+     false,
+     "GZip compress TLS/HTTPS request body");
+FLAG(uint64,
+     logger_tls_max_buffer_bytes,
+     16 * 1024 * 1024,
+     "Maximum bytes of buffered TLS/HTTPS logs, new logs drop when full");
 
-/**
- * @brief Control the number of backing-store buffered logs.
- *
- * The TLSLogForwarderRunner run loop requests the set of log indexes before
- * sending logs to a TLS handler. If the number of indexes exceeds
- * kTLSLoggerBufferMax the thread will set TLSLoggerPlugin::stop_buffering.
- * Then the logger plugin stops buffering, and new logs will drop.
- */
-const size_t kTLSLoggerBufferMax = 1024;
-
-class TLSLogForwarderRunner;
-
-class TLSLoggerPlugin : public LoggerPlugin {
- public:
-  TLSLoggerPlugin() : log_index_(0) {}
-
-  /**
-   * @brief The osquery logger initialization method.
-   *
-   * LoggerPlugin::init is optionally used by logger plugins to receive a
-   * buffer of status logs generated between application start and logger
-   * initialization. TLSLoggerPlugin will further buffer these logs into the
-   * backing store. They will flush to a TLS endpoint under normal conditions
-   * in a supporting/asynchronous thread.
-   */
-  Status init(const std::string& name, const std::vector<StatusLogLine>& log);
-
- public:
-  /// Log a result string. This is the basic catch-all for snapshots and events.
-  Status logString(const std::string& s);
-
-  /// Log a status (ERROR/WARNING/INFO) message.
-  Status logStatus(const std::vector<StatusLogLine>& log);
-
- private:
-  /**
-   * @brief Hold an auto-incrementing offset for buffered logs.
-   *
-   * Logs are buffered to a backing store until they can be flushed to a TLS
-   * endpoint (based on latency/retry/etc options). Buffering uses a UNIX time
-   * second precision for indexing and ordering. log_index_ helps prevent
-   * collisions by appending an auto-increment counter.
-   */
-  unsigned long log_index_;
-
-  /**
-   * @brief Start dropping logs by preventing buffering.
-   *
-   * If the TLS endpoint goes down while running and the backing store of log
-   * buffers fills up (exceeds a maximum number of log lines) then logs will
-   * start dropping.
-   */
-  static bool stop_buffering;
-
- private:
-  /// Allow the TLSLogForwardRunner thread to disable log buffering.
-  friend class TLSLogForwarderRunner;
-};
-
-/// Initialize the buffering stop to false.
-bool TLSLoggerPlugin::stop_buffering = false;
+const size_t kTLSLogIndexWidth = 20;
+
+const char kTLSResultLog = 'r';
+const char kTLSStatusLog = 's';
+
+/// The most buffered logs read from the backing store at a time.
+const size_t kTLSLoggerScanMax = 256;
+
+const std::string kTLSLogCursorPrefix = "tls_log_cursor.";
 
 /**
- * @brief A log forwarder thread flushing database-buffered logs.
+ * @brief The approximate maximum size of a single request body.
  *
- * The TLSLogForwarderRunner flushes buffered result and status logs based
- * on CLI/options settings. If an enrollment key is set (and checked) during
- * startup, this Dispatcher service is started.
+ * Buffered logs are sent in batches, each request stops adding logs once its
+ * body exceeds this size. A single log larger than the maximum is still sent.
  */
-class TLSLogForwarderRunner : public InternalRunnable {
- public:
-  explicit TLSLogForwarderRunner(const std::string& node_key)
-      : node_key_(node_key) {}
+const size_t kTLSLoggerBatchMax = 1024 * 1024;
 
-  /// A simple wait lock, and flush based on settings.
-  void start();
+/// Bytes of a compressed batch's body held before they are compressed.
+const size_t kTLSLoggerCompressChunk = 64 * 1024;
 
- private:
-  /// Send labeled result logs.
-  Status send(const std::string& uri,
-              const std::string& log_data,
-              const std::string& log_type);
-
-  /// Receive an enrollment/node key from the backing store cache.
-  std::string node_key_;
-};
+uint64_t TLSLoggerPlugin::sequence = 0;
+size_t TLSLoggerPlugin::buffered_bytes = 0;
+std::mutex TLSLoggerPlugin::buffer_mutex;
 
 REGISTER(TLSLoggerPlugin, "logger", "tls");
 
-static inline std::string genLogIndex(bool results, unsigned long& counter) {
-  return ((results) ? "r" : "s") + std::to_string(getUnixTime()) + "_" +
-         std::to_string(++counter);
+static inline std::string genLogIndex(char type, uint64_t sequence) {
+  auto number = std::to_string(sequence);
+  return type + std::string(kTLSLogIndexWidth - number.size(), '0') + number;
+}
+
+/// Parse the sequence number of a buffered log key.
+static bool parseLogIndex(const std::string& index, uint64_t& sequence) {
+  if (index.size() != kTLSLogIndexWidth + 1) {
+    return false;
+  }
+  for (size_t i = 1; i < index.size(); ++i) {
+    if (!std::isdigit(static_cast<unsigned char>(index[i]))) {
+      return false;
+    }
+  }
+  sequence = std::stoull(index.substr(1));
+  return true;
+}
+
+/// The sequence number of the last log of a type the endpoint acknowledged.
+static uint64_t getLogCursor(char type) {
+  std::string value;
+  getDatabaseValue(kPersistentSettings, kTLSLogCursorPrefix + type, value);
+  try {
+    return boost::lexical_cast<uint64_t>(value);
+  } catch (const boost::bad_lexical_cast& e) {
+    return 0;
+  }
 }
 
 Status TLSLoggerPlugin::logString(const std::string& s) {
-  if (stop_buffering) {
-    return Status(1, "Buffer is paused, dropping logs");
+  std::lock_guard<std::mutex> lock(buffer_mutex);
+  if (buffered_bytes + s.size() > FLAGS_logger_tls_max_buffer_bytes) {
+    return Status(1, "Buffer is full, dropping logs");
   }
 
-  auto index = genLogIndex(true, log_index_);
-  return setDatabaseValue(kLogs, index, s);
+  auto status =
+      setDatabaseValue(kLogs, genLogIndex(kTLSResultLog, ++sequence), s);
+  if (status.ok()) {
+    buffered_bytes += s.size();
+  }
+  return status;
 }
 
 Status TLSLoggerPlugin::logStatus(const std::vector<StatusLogLine>& log) {
-  if (stop_buffering) {
-    return Status(1, "Buffer is paused, dropping logs");
-  }
+  std::lock_guard<std::mutex> lock(buffer_mutex);
 
+  // Store every status line in the backing store with a single write.
+  DatabaseBatch batch;
+  size_t bytes = 0;
   for (const auto& item : log) {
-    // Convert the StatusLogLine into ptree format, to convert to JSON.
-    pt::ptree buffer;
-    buffer.put("severity", (google::LogSeverity)item.severity);
-    buffer.put("filename", item.filename);
-    buffer.put("line", item.line);
-    buffer.put("message", item.message);
-    // Convert to JSON, for storing a string-representation in the database.
-    std::stringstream json_output;
-    write_json(json_output, buffer, false);
-
-    // Store the status line in a backing store.
-    auto index = genLogIndex(false, log_index_);
-    auto status = setDatabaseValue(kLogs, index, json_output.str());
-    if (!status.ok()) {
-      // Do not continue if any line fails.
-      return status;
+    // Written as a property tree would be, every value is a string.
+    std::string json;
+    JSONWriter writer(json);
+    writer.startObject();
+    writer.key("severity");
+    writer.value(std::to_string(item.severity));
+    writer.key("filename");
+    writer.value(item.filename);
+    writer.key("line");
+    writer.value(std::to_string(item.line));
+    writer.key("message");
+    writer.value(item.message);
+    writer.endObject();
+    writer.endDocument();
+    if (buffered_bytes + bytes + json.size() >
+        FLAGS_logger_tls_max_buffer_bytes) {
+      break;
     }
+    bytes += json.size();
+    batch.put(kLogs, genLogIndex(kTLSStatusLog, ++sequence), json);
   }
 
-  return Status(0, "OK");
+  auto status = writeDatabaseBatch(batch);
+  if (status.ok()) {
+    buffered_bytes += bytes;
+  }
+  if (batch.size() < log.size()) {
+    return Status(1, "Buffer is full, dropping logs");
+  }
+  return status;
+}
+
+void TLSLoggerPlugin::recover() {
+  std::lock_guard<std::mutex> lock(buffer_mutex);
+  auto db = DBHandle::getInstance();
+  buffered_bytes = 0;
+
+  for (const auto& type : {kTLSResultLog, kTLSStatusLog}) {
+    // Logs up to the cursor were sent before the range was removed.
+    auto cursor = getLogCursor(type);
+    sequence = std::max(sequence, cursor);
+    db->DeleteRange(
+        kLogs, genLogIndex(type, 0), genLogIndex(type, cursor + 1));
+
+    std::vector<std::pair<std::string, std::string>> logs;
+    db->ScanPrefix(kLogs, std::string(1, type), logs);
+    DatabaseBatch legacy;
+    for (const auto& log : logs) {
+      uint64_t index = 0;
+      if (parseLogIndex(log.first, index)) {
+        sequence = std::max(sequence, index);
+        buffered_bytes += log.second.size();
+      } else {
+        legacy.remove(kLogs, log.first);
+      }
+    }
+
+    // Time-based keys sort after the sequence, they are renumbered in order.
+    for (const auto& log : logs) {
+      uint64_t index = 0;
+      if (!parseLogIndex(log.first, index)) {
+        legacy.put(kLogs, genLogIndex(type, ++sequence), log.second);
+        buffered_bytes += log.second.size();
+      }
+    }
+    if (!legacy.empty()) {
+      writeDatabaseBatch(legacy);
+    }
+  }
 }
 
 Status TLSLoggerPlugin::init(const std::string& name,
@@ -180,87 +213,135 @@ Status TLSLoggerPlugin::init(const std::string& name,
   // Restart the glog facilities using the name init was provided.
   google::ShutdownGoogleLogging();
   google::InitGoogleLogging(name.c_str());
+  recover();
   return logStatus(log);
 }
 
-Status TLSLogForwarderRunner::send(const std::string& uri,
-                                   const std::string& log_data,
-                                   const std::string& log_type) {
-  pt::ptree params;
-  params.put<std::string>("node_key", node_key_);
-  params.put<std::string>("log_type", log_type);
-
-  // Handle single log requests that were delimited with newlines (event-based).
-  auto log_data_items = osquery::split(log_data, "\n");
-  // Then re-tokenize with comma to json-decode.
-  auto log_data_string = osquery::join(log_data_items, ",");
-  try {
-    std::stringstream json_input;
-    json_input << "[" + log_data_string + "]";
-
-    pt::ptree tree;
-    pt::read_json(json_input, tree);
-    params.put_child("data", tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    // If the tokenization failed, add the log data (most likely string JSON).
-    params.put("data", log_data);
+/**
+ * @brief Append a buffered log value to the request's data array.
+ *
+ * Event-based results are buffered as newline-delimited JSON documents. Each
+ * document is written into the request as-is, without a reparse. Anything
+ * else is written as a JSON string.
+ */
+static void writeLogData(JSONWriter& writer, const std::string& value) {
+  size_t start = 0;
+  while (start < value.size()) {
+    auto end = value.find('\n', start);
+    if (end == std::string::npos) {
+      end = value.size();
+    }
+    if (end > start) {
+      if (value[start] == '{' || value[start] == '[') {
+        writer.raw(value.data() + start, end - start);
+      } else {
+        writer.value(value.data() + start, end - start);
+      }
+    }
+    start = end + 1;
   }
+}
 
-  auto request = Request<TLSTransport, JSONSerializer>(uri);
-  return request.call(params);
+void TLSLogForwarderRunner::acknowledge(char type,
+                                        uint64_t previous,
+                                        uint64_t cursor,
+                                        size_t bytes) {
+  setDatabaseValue(
+      kPersistentSettings, kTLSLogCursorPrefix + type, std::to_string(cursor));
+  DBHandle::getInstance()->DeleteRange(
+      kLogs, genLogIndex(type, previous + 1), genLogIndex(type, cursor + 1));
+
+  std::lock_guard<std::mutex> lock(TLSLoggerPlugin::buffer_mutex);
+  TLSLoggerPlugin::buffered_bytes -=
+      std::min(bytes, TLSLoggerPlugin::buffered_bytes);
 }
 
-inline void clearLogs(bool results, const std::vector<std::string>& indexes) {
-  for (const auto& index : indexes) {
-    if (results && index.at(0) != 'r') {
-      continue;
+Status TLSLogForwarderRunner::send(const std::string& uri,
+                                   char type,
+                                   const std::string& log_type) {
+  auto db = DBHandle::getInstance();
+  auto cursor = getLogCursor(type);
+  // The keys of a type sort before the next type's prefix.
+  auto stop = std::string(1, type + 1);
+
+  std::vector<std::pair<std::string, std::string>> logs;
+  do {
+    // Read the logs after the cursor, and their values, with a single scan.
+    logs.clear();
+    db->ScanRange(kLogs,
+                  genLogIndex(type, cursor + 1),
+                  stop,
+                  logs,
+                  true,
+                  kTLSLoggerScanMax);
+
+    size_t next = 0;
+    while (next < logs.size()) {
+      std::string body;
+      JSONWriter writer(body);
+      writer.startObject();
+      writer.key("node_key");
+      writer.value(node_key_);
+      writer.key("log_type");
+      writer.value(log_type);
+      writer.key("data");
+      writer.startArray();
+
+      // Write logs directly into the body. A compressed body is compressed as
+      // it is written, in pieces.
+      std::string compressed;
+      GzipCompressor compressor(compressed);
+      size_t size = body.size();
+      size_t bytes = 0;
+      while (next < logs.size() && size < kTLSLoggerBatchMax) {
+        writeLogData(writer, logs[next].second);
+        bytes += logs[next++].second.size();
+
+        size = compressor.size() + body.size();
+        if (FLAGS_logger_tls_compress &&
+            body.size() >= kTLSLoggerCompressChunk) {
+          compressor.compress(body);
+          body.clear();
+        }
+      }
+      writer.endArray();
+      writer.endObject();
+      writer.endDocument();
+
+      auto request = Request<TLSTransport, JSONSerializer>(uri);
+      if (FLAGS_logger_tls_compress) {
+        if (!compressor.compress(body).ok() || !compressor.finish().ok()) {
+          return Status(1, "Cannot compress logs");
+        }
+        body.clear();
+        request.setContentEncoding("gzip");
+      }
+      auto status = request.callSerialized(
+          (FLAGS_logger_tls_compress) ? compressed : body);
+      if (!status.ok()) {
+        return status;
+      }
+
+      // Advance the cursor past the sent logs, and remove them.
+      uint64_t sent = cursor;
+      parseLogIndex(logs[next - 1].first, sent);
+      acknowledge(type, cursor, sent, bytes);
+      cursor = sent;
     }
-    // If the value was flushed, remove from the backing store.
-    deleteDatabaseValue(kLogs, index);
-  }
+  } while (logs.size() == kTLSLoggerScanMax);
+  return Status(0, "OK");
 }
 
 void TLSLogForwarderRunner::start() {
   auto uri = "https://" + FLAGS_tls_hostname + FLAGS_logger_tls_endpoint;
 
   while (true) {
-    // Get a list of all the buffered log items.
-    std::vector<std::string> indexes;
-    auto status = scanDatabaseKeys(kLogs, indexes);
-    if (indexes.size() > kTLSLoggerBufferMax) {
-      // The log buffer is filled. Stop buffering and start dropping logs.
-      TLSLoggerPlugin::stop_buffering = true;
-    } else if (TLSLoggerPlugin::stop_buffering == true) {
-      // If the buffering was paused, resume.
-      TLSLoggerPlugin::stop_buffering = false;
+    // Send the result and status logs buffered since the last flush.
+    if (!send(uri, kTLSResultLog, "result")) {
+      VLOG(1) << "Could not send results to logger URI: " << uri;
     }
-
-    std::string results, statuses;
-    for (const auto& index : indexes) {
-      std::string value;
-      auto& target = ((index.at(0) == 'r') ? results : statuses);
-      if (getDatabaseValue(kLogs, index, value)) {
-        // Resist failure, only append delimiters if the value get succeeded.
-        target += value;
-      }
-    }
-
-    // If any results/statuses were found in the flushed buffer, send.
-    if (results.size() > 0) {
-      if (!send(uri, results, "result")) {
-        VLOG(1) << "Could not send results to logger URI: " << uri;
-      } else {
-        // Clear the results logs once they were sent.
-        clearLogs(true, indexes);
-      }
-    }
-    if (statuses.size() > 0) {
-      if (!send(uri, statuses, "status")) {
-        VLOG(1) << "Could not send status logs to logger URI: " << uri;
-      } else {
-        // Clear the status logs once they were sent.
-        clearLogs(false, indexes);
-      }
+    if (!send(uri, kTLSStatusLog, "status")) {
+      VLOG(1) << "Could not send status logs to logger URI: " << uri;
     }
 
     // Cool off and time wait the configured period.
@@ -0,0 +1,136 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <osquery/logger.h>
+
+#include "osquery/dispatcher/dispatcher.h"
+
+namespace osquery {
+
+/// Buffered log keys are a type and a zero-padded sequence number.
+extern const size_t kTLSLogIndexWidth;
+
+/// Buffered log type prefixes.
+extern const char kTLSResultLog;
+extern const char kTLSStatusLog;
+
+/// The persisted key prefix of each log type's acknowledged sequence number.
+extern const std::string kTLSLogCursorPrefix;
+
+class TLSLogForwarderRunner;
+
+class TLSLoggerPlugin : public LoggerPlugin {
+ public:
+  /**
+   * @brief The osquery logger initialization method.
+   *
+   * LoggerPlugin::init is optionally used by logger plugins to receive a
+   * buffer of status logs generated between application start and logger
+   * initialization. TLSLoggerPlugin will further buffer these logs into the
+   * backing store. They will flush to a TLS endpoint under normal conditions
+   * in a supporting/asynchronous thread.
+   */
+  Status init(const std::string& name, const std::vector<StatusLogLine>& log);
+
+ public:
+  /// Log a result string. This is the basic catch-all for snapshots and events.
+  Status logString(const std::string& s);
+
+  /// Log a status (ERROR/WARNING/INFO) message.
+  Status logStatus(const std::vector<StatusLogLine>& log);
+
+ private:
+  /**
+   * @brief Continue the sequence and buffer size of a previous run.
+   *
+   * Logs acknowledged before a restart are removed, and logs buffered with
+   * the older time-based keys are moved into the sequence.
+   */
+  static void recover();
+
+ private:
+  /**
+   * @brief The sequence number of the last buffered log.
+   *
+   * Logs are buffered to a backing store until they can be flushed to a TLS
+   * endpoint (based on latency/retry/etc options). Each key is a type prefix
+   * and a fixed-width sequence number, so keys sort in the order logs were
+   * buffered and the forwarder reads only the logs after its cursor.
+   */
+  static uint64_t sequence;
+
+  /**
+   * @brief The bytes of buffered log values.
+   *
+   * If the TLS endpoint goes down while running and the buffered logs exceed
+   * logger_tls_max_buffer_bytes then new logs will drop.
+   */
+  static size_t buffered_bytes;
+
+  /**
+   * @brief Logs are numbered and written while holding the buffer mutex.
+   *
+   * Every sequence number before a buffered log is written, or failed, before
+   * that log, so the forwarder's cursor does not pass a log being written.
+   */
+  static std::mutex buffer_mutex;
+
+ private:
+  /// Allow the TLSLogForwardRunner thread to release acknowledged logs.
+  friend class TLSLogForwarderRunner;
+
+ private:
+  friend class TLSLoggerTests;
+  FRIEND_TEST(TLSLoggerTests, test_recover_legacy_keys);
+  FRIEND_TEST(TLSLoggerTests, test_cursor_resume);
+  FRIEND_TEST(TLSLoggerTests, test_buffer_bytes_drop);
+};
+
+/**
+ * @brief A log forwarder thread flushing database-buffered logs.
+ *
+ * The TLSLogForwarderRunner flushes buffered result and status logs based
+ * on CLI/options settings. If an enrollment key is set (and checked) during
+ * startup, this Dispatcher service is started.
+ */
+class TLSLogForwarderRunner : public InternalRunnable {
+ public:
+  explicit TLSLogForwarderRunner(const std::string& node_key)
+      : node_key_(node_key) {}
+
+  /// A simple wait lock, and flush based on settings.
+  void start();
+
+ private:
+  /// Send the logs of a type after its cursor in bounded batches.
+  Status send(const std::string& uri, char type, const std::string& log_type);
+
+  /**
+   * @brief Persist a type's acknowledged cursor, and remove the sent logs.
+   *
+   * The cursor is written before the logs are removed, a restart removes the
+   * logs up to the cursor if the removal did not complete.
+   */
+  void acknowledge(char type, uint64_t previous, uint64_t cursor, size_t bytes);
+
+  /// Receive an enrollment/node key from the backing store cache.
+  std::string node_key_;
+
+ private:
+  FRIEND_TEST(TLSLoggerTests, test_cursor_resume);
+  FRIEND_TEST(TLSLoggerTests, test_buffer_bytes_drop);
+};
+}
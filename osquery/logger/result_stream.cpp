@@ -0,0 +1,334 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <boost/thread.hpp>
+
+#include <osquery/logger.h>
+
+#include "osquery/logger/result_stream.h"
+
+namespace osquery {
+
+FLAG(string,
+     logger_stream_socket,
+     "",
+     "UNIX domain socket path publishing scheduled results to local readers");
+
+FLAG(uint64,
+     logger_stream_max_bytes,
+     8 * 1024 * 1024,
+     "Maximum bytes of result stream frames queued for each reader");
+
+/// The most connected result stream subscribers.
+const size_t kResultStreamSubscribersMax = 16;
+
+/// Milliseconds the service waits for a socket before checking interruption.
+const int kResultStreamPollMS = 500;
+
+#ifdef MSG_NOSIGNAL
+const int kResultStreamSendFlags = MSG_NOSIGNAL;
+#else
+const int kResultStreamSendFlags = 0;
+#endif
+
+/// Append a big-endian integer of a number of bytes.
+static void writeInteger(std::string& frame, uint64_t value, size_t size) {
+  for (size_t i = size; i > 0; --i) {
+    frame.push_back(static_cast<char>((value >> ((i - 1) * 8)) & 0xff));
+  }
+}
+
+static ResultStreamFrame makeFrame(ResultStreamType type,
+                                   const std::string& name,
+                                   uint64_t time,
+                                   const std::string& payload) {
+  auto name_size = std::min(name.size(), (size_t)UINT16_MAX);
+  auto frame = std::make_shared<std::string>();
+  size_t length = 1 + 8 + 2 + name_size + payload.size();
+  frame->reserve(4 + length);
+  writeInteger(*frame, length, 4);
+  frame->push_back(static_cast<char>(type));
+  writeInteger(*frame, time, 8);
+  writeInteger(*frame, name_size, 2);
+  frame->append(name, 0, name_size);
+  frame->append(payload);
+  return frame;
+}
+
+ResultStreamFrame makeResultStreamFrame(ResultStreamType type,
+                                        const std::string& name,
+                                        uint64_t time,
+                                        const QueryData& rows) {
+  std::string payload;
+  serializeQueryDataColumnar(rows, payload);
+  return makeFrame(type, name, time, payload);
+}
+
+/// Set a descriptor non-blocking and close-on-exec.
+static bool setNonBlocking(int fd) {
+  auto flags = ::fcntl(fd, F_GETFL, 0);
+  return flags >= 0 && ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0 &&
+         ::fcntl(fd, F_SETFD, FD_CLOEXEC) == 0;
+}
+
+Status ResultStream::listen(const std::string& path) {
+  close();
+
+  struct sockaddr_un addr;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    return Status(1, "Socket path is too long: " + path);
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path.c_str(), path.size());
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return Status(1, "Cannot create socket");
+  }
+
+  // A socket left by a previous worker is replaced, results are only
+  // readable by the owner.
+  ::unlink(path.c_str());
+  if (::bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+      ::chmod(path.c_str(), S_IRUSR | S_IWUSR) != 0 ||
+      ::listen(fd, kResultStreamSubscribersMax) != 0 || !setNonBlocking(fd)) {
+    ::close(fd);
+    return Status(1, "Cannot listen on " + path);
+  }
+
+  if (::pipe(wake_) != 0) {
+    ::close(fd);
+    ::unlink(path.c_str());
+    return Status(1, "Cannot create a wake pipe");
+  }
+  setNonBlocking(wake_[0]);
+  setNonBlocking(wake_[1]);
+  server_ = fd;
+  path_ = path;
+  return Status(0, "OK");
+}
+
+void ResultStream::publish(const QueryLogItem& item, bool snapshot) {
+  if (count_ == 0) {
+    // Without subscribers results are not serialized.
+    return;
+  }
+
+  std::vector<ResultStreamFrame> frames;
+  uint64_t time = (item.time > 0) ? item.time : 0;
+  if (snapshot) {
+    frames.push_back(makeResultStreamFrame(
+        STREAM_SNAPSHOT, item.name, time, item.snapshot_results));
+  } else {
+    if (!item.results.added.empty()) {
+      frames.push_back(makeResultStreamFrame(
+          STREAM_ADDED, item.name, time, item.results.added));
+    }
+    if (!item.results.removed.empty()) {
+      frames.push_back(makeResultStreamFrame(
+          STREAM_REMOVED, item.name, time, item.results.removed));
+    }
+    if (!item.results.changed.empty()) {
+      frames.push_back(makeResultStreamFrame(
+          STREAM_CHANGED, item.name, time, item.results.changed));
+    }
+  }
+  if (frames.empty()) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& subscriber : subscribers_) {
+    for (const auto& frame : frames) {
+      enqueue(subscriber.second, frame);
+    }
+  }
+  if (wake_[1] >= 0) {
+    char wake = 0;
+    (void)::write(wake_[1], &wake, 1);
+  }
+}
+
+void ResultStream::enqueue(Subscriber& subscriber,
+                           const ResultStreamFrame& frame) {
+  if (subscriber.bytes + frame->size() > FLAGS_logger_stream_max_bytes) {
+    subscriber.dropped++;
+    return;
+  }
+
+  if (subscriber.dropped > 0) {
+    // Tell the subscriber how many frames it missed.
+    std::string count;
+    writeInteger(count, subscriber.dropped, 8);
+    auto dropped = makeFrame(STREAM_DROPPED, "", getUnixTime(), count);
+    subscriber.bytes += dropped->size();
+    subscriber.frames.push_back(std::move(dropped));
+    subscriber.dropped = 0;
+  }
+  subscriber.bytes += frame->size();
+  subscriber.frames.push_back(frame);
+}
+
+bool ResultStream::flush(int fd, Subscriber& subscriber) {
+  while (!subscriber.frames.empty()) {
+    const auto& frame = *subscriber.frames.front();
+    auto written = ::send(fd,
+                          frame.data() + subscriber.offset,
+                          frame.size() - subscriber.offset,
+                          kResultStreamSendFlags);
+    if (written < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+
+    subscriber.offset += written;
+    if (subscriber.offset == frame.size()) {
+      subscriber.bytes -= frame.size();
+      subscriber.offset = 0;
+      subscriber.frames.pop_front();
+    }
+  }
+  return true;
+}
+
+void ResultStream::accept() {
+  while (true) {
+    int fd = ::accept(server_, nullptr, nullptr);
+    if (fd < 0) {
+      break;
+    }
+    if (subscribers_.size() >= kResultStreamSubscribersMax ||
+        !setNonBlocking(fd)) {
+      ::close(fd);
+      continue;
+    }
+#ifdef SO_NOSIGPIPE
+    int enable = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+    subscribers_[fd];
+    count_ = subscribers_.size();
+  }
+}
+
+bool ResultStream::step(int timeout) {
+  std::vector<struct pollfd> fds;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (server_ < 0) {
+      return false;
+    }
+    fds.push_back({server_, POLLIN, 0});
+    fds.push_back({wake_[0], POLLIN, 0});
+    for (const auto& subscriber : subscribers_) {
+      short events = POLLIN;
+      if (!subscriber.second.frames.empty()) {
+        events |= POLLOUT;
+      }
+      fds.push_back({subscriber.first, events, 0});
+    }
+  }
+
+  if (::poll(fds.data(), fds.size(), timeout) <= 0) {
+    return true;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (server_ < 0) {
+    return false;
+  }
+  if (fds[1].revents & POLLIN) {
+    char buffer[64];
+    while (::read(wake_[0], buffer, sizeof(buffer)) > 0) {
+    }
+  }
+
+  for (size_t i = 2; i < fds.size(); ++i) {
+    auto subscriber = subscribers_.find(fds[i].fd);
+    if (subscriber == subscribers_.end() || fds[i].revents == 0) {
+      continue;
+    }
+
+    // Subscribers only read, input is discarded until the peer closes.
+    bool open = true;
+    if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+      char buffer[256];
+      auto size = ::recv(fds[i].fd, buffer, sizeof(buffer), 0);
+      open = size > 0 || (size < 0 && (errno == EAGAIN ||
+                                       errno == EWOULDBLOCK || errno == EINTR));
+    }
+    if (open) {
+      // Write whatever was queued since the poll started.
+      open = flush(fds[i].fd, subscriber->second);
+    }
+    if (!open) {
+      ::close(fds[i].fd);
+      subscribers_.erase(subscriber);
+    }
+  }
+  count_ = subscribers_.size();
+
+  if (fds[0].revents & POLLIN) {
+    accept();
+  }
+  return true;
+}
+
+void ResultStream::close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& subscriber : subscribers_) {
+    ::close(subscriber.first);
+  }
+  subscribers_.clear();
+  count_ = 0;
+
+  if (server_ >= 0) {
+    ::close(server_);
+    ::unlink(path_.c_str());
+    server_ = -1;
+  }
+  for (auto& fd : wake_) {
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+}
+
+void ResultStreamRunner::start() {
+  while (ResultStream::instance().step(kResultStreamPollMS)) {
+    boost::this_thread::interruption_point();
+  }
+}
+
+void startResultStream() {
+  if (FLAGS_logger_stream_socket.empty()) {
+    return;
+  }
+
+  auto status = ResultStream::instance().listen(FLAGS_logger_stream_socket);
+  if (!status.ok()) {
+    LOG(WARNING) << "Cannot start the result stream: " << status.getMessage();
+    return;
+  }
+  Dispatcher::addService(std::make_shared<ResultStreamRunner>());
+}
+}
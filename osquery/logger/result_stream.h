@@ -0,0 +1,154 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/database.h>
+#include <osquery/flags.h>
+
+#include "osquery/dispatcher/dispatcher.h"
+
+namespace osquery {
+
+DECLARE_string(logger_stream_socket);
+DECLARE_uint64(logger_stream_max_bytes);
+
+/// The type byte of a result stream frame.
+enum ResultStreamType {
+  /// The rows of a snapshot query.
+  STREAM_SNAPSHOT = 0,
+  /// Rows added since the query's previous execution.
+  STREAM_ADDED = 1,
+  /// Rows removed since the query's previous execution.
+  STREAM_REMOVED = 2,
+  /// Rows with changed values, matched by the query's key columns.
+  STREAM_CHANGED = 3,
+  /// Frames dropped for a subscriber that did not read them, the payload is
+  /// an 8-byte count.
+  STREAM_DROPPED = 4,
+};
+
+/// A frame shared by every subscriber it is queued for.
+typedef std::shared_ptr<const std::string> ResultStreamFrame;
+
+/**
+ * @brief Build a result stream frame.
+ *
+ * A frame is a 4-byte length of the rest of the frame, the type byte, an
+ * 8-byte UNIX time, a 2-byte name length and the query name, then the rows
+ * in the column-major binary format of serializeQueryDataColumnar. Integers
+ * are big-endian.
+ */
+ResultStreamFrame makeResultStreamFrame(ResultStreamType type,
+                                        const std::string& name,
+                                        uint64_t time,
+                                        const QueryData& rows);
+
+/**
+ * @brief Publish scheduled query results to local consumers.
+ *
+ * Consumers on the host connect to the --logger_stream_socket UNIX domain
+ * socket and read frames, without a disk round trip through a logger or a
+ * JSON parse. The rows of each query execution are serialized once and the
+ * frame is shared by every subscriber's queue.
+ *
+ * Each subscriber queues at most --logger_stream_max_bytes of frames. Frames
+ * for a subscriber that does not keep up are dropped, without slowing the
+ * scheduler or other subscribers, and the subscriber receives a
+ * STREAM_DROPPED frame before the next frame it is sent.
+ */
+class ResultStream : private boost::noncopyable {
+ public:
+  static ResultStream& instance() {
+    static ResultStream stream;
+    return stream;
+  }
+
+  /// Bind and listen on a socket path, an existing socket is replaced.
+  Status listen(const std::string& path);
+
+  /// Publish the differential or snapshot rows of a log item.
+  void publish(const QueryLogItem& item, bool snapshot);
+
+  /**
+   * @brief Accept subscribers and write their queued frames.
+   *
+   * @param timeout Milliseconds to wait for a socket to be ready.
+   * @return false if the stream is not listening.
+   */
+  bool step(int timeout);
+
+  /// Close the socket and every subscriber.
+  void close();
+
+  /// The number of connected subscribers.
+  size_t subscribers() const { return count_; }
+
+ private:
+  ResultStream() {}
+
+  struct Subscriber {
+    /// Frames waiting to be written, the first may be partially written.
+    std::deque<ResultStreamFrame> frames;
+    /// The bytes of the first frame already written.
+    size_t offset{0};
+    /// The bytes of every queued frame.
+    size_t bytes{0};
+    /// Frames dropped since the last frame queued.
+    size_t dropped{0};
+  };
+
+  /// Queue a frame for a subscriber, or drop it if the queue is full.
+  void enqueue(Subscriber& subscriber, const ResultStreamFrame& frame);
+
+  /// Write queued frames until the socket would block, false on error.
+  bool flush(int fd, Subscriber& subscriber);
+
+  /// Accept pending connections from the listening socket.
+  void accept();
+
+ private:
+  /// The listening socket.
+  int server_{-1};
+
+  /// The socket path, removed when the stream is closed.
+  std::string path_;
+
+  /// A pipe waking step when frames are published.
+  int wake_[2]{-1, -1};
+
+  /// Subscribers by socket descriptor.
+  std::map<int, Subscriber> subscribers_;
+
+  /// The number of subscribers, checked without the lock before publishing.
+  std::atomic<size_t> count_{0};
+
+  std::mutex mutex_;
+};
+
+/// The Dispatcher service stepping the ResultStream.
+class ResultStreamRunner : public InternalRunnable {
+ public:
+  void start();
+  void stop() { ResultStream::instance().close(); }
+};
+
+/// Start the result stream service if --logger_stream_socket is set.
+void startResultStream();
+}
@@ -14,9 +14,13 @@
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/dispatcher/dispatcher.h"
+
 namespace osquery {
 
 DECLARE_string(logger_plugin);
+DECLARE_bool(logger_async);
+DECLARE_int32(logger_status_rate);
 
 class LoggerTests : public testing::Test {
  public:
@@ -27,6 +31,7 @@ class LoggerTests : public testing::Test {
     log_lines.clear();
     status_messages.clear();
     statuses_logged = 0;
+    status_lines = 0;
     last_status = {O_INFO, "", -1, ""};
   }
 
@@ -41,6 +46,8 @@ class LoggerTests : public testing::Test {
 
   // Count calls to logStatus
   static int statuses_logged;
+  // Count the lines sent to logStatus
+  static size_t status_lines;
   // Count added and removed snapshot rows
   static int snapshot_rows_added;
   static int snapshot_rows_removed;
@@ -56,6 +63,7 @@ std::vector<std::string> LoggerTests::log_lines;
 StatusLogLine LoggerTests::last_status;
 std::vector<std::string> LoggerTests::status_messages;
 int LoggerTests::statuses_logged = 0;
+size_t LoggerTests::status_lines = 0;
 int LoggerTests::snapshot_rows_added = 0;
 int LoggerTests::snapshot_rows_removed = 0;
 int LoggerTests::health_status_rows = 0;
@@ -87,6 +95,7 @@ class TestLoggerPlugin : public LoggerPlugin {
 
   Status logStatus(const std::vector<StatusLogLine>& log) {
     ++LoggerTests::statuses_logged;
+    LoggerTests::status_lines += log.size();
     return Status(0, "OK");
   }
 
@@ -174,4 +183,63 @@ TEST_F(LoggerTests, test_logger_snapshots) {
   logHealthStatus(item);
   EXPECT_EQ(LoggerTests::health_status_rows, 1);
 }
+
+TEST_F(LoggerTests, test_logger_async) {
+  FLAGS_logger_async = true;
+  initLogger("logger_test");
+  for (size_t i = 0; i < 10; ++i) {
+    EXPECT_TRUE(logString(std::to_string(i), "event", "test").ok());
+  }
+
+  // Stopping the queue's service sends the remaining logs, in order.
+  Dispatcher::stopServices();
+  Dispatcher::joinServices();
+  FLAGS_logger_async = false;
+
+  ASSERT_EQ(LoggerTests::log_lines.size(), 10U);
+  EXPECT_EQ(LoggerTests::log_lines.front(), "0");
+  EXPECT_EQ(LoggerTests::log_lines.back(), "9");
+}
+
+TEST_F(LoggerTests, test_logger_status_rate) {
+  initLogger("logger_test");
+  auto rate = FLAGS_logger_status_rate;
+  FLAGS_logger_status_rate = 10;
+  for (size_t i = 0; i < 100; ++i) {
+    LOG(WARNING) << "Logger test is generating a repeated warning";
+  }
+  FLAGS_logger_status_rate = rate;
+
+  // Only the first lines of each second are sent to the logger plugin.
+  EXPECT_GE(LoggerTests::status_lines, 10U);
+  EXPECT_LE(LoggerTests::status_lines, 20U);
+}
+
+TEST_F(LoggerTests, test_logger_plugins) {
+  Registry::add<TestLoggerPlugin>("logger", "test_second");
+  auto plugins = FLAGS_logger_plugin;
+  FLAGS_logger_plugin = "test, test_second, test";
+  EXPECT_EQ(getLoggerPlugins(),
+            std::vector<std::string>({"test", "test_second"}));
+
+  // Results are sent to every logger plugin.
+  QueryLogItem item;
+  item.name = "test_query";
+  item.results.added.push_back({{"test_column", "test_value"}});
+  EXPECT_TRUE(logQueryLogItem(item).ok());
+  ASSERT_EQ(LoggerTests::log_lines.size(), 2U);
+  EXPECT_EQ(LoggerTests::log_lines[0], LoggerTests::log_lines[1]);
+
+  // Each plugin has its own queue.
+  FLAGS_logger_async = true;
+  initLogger("logger_test");
+  EXPECT_TRUE(logString("async", "event").ok());
+  Dispatcher::stopServices();
+  Dispatcher::joinServices();
+  FLAGS_logger_async = false;
+  FLAGS_logger_plugin = plugins;
+
+  ASSERT_EQ(LoggerTests::log_lines.size(), 4U);
+  EXPECT_EQ(LoggerTests::log_lines.back(), "async");
+}
 }
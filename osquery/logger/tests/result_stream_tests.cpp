@@ -0,0 +1,154 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/database.h>
+
+#include "osquery/core/test_util.h"
+#include "osquery/logger/result_stream.h"
+
+namespace osquery {
+
+class ResultStreamTests : public testing::Test {
+ public:
+  void SetUp() {
+    path_ = kTestWorkingDirectory + "result_stream.sock";
+    ASSERT_TRUE(ResultStream::instance().listen(path_).ok());
+  }
+
+  void TearDown() { ResultStream::instance().close(); }
+
+ protected:
+  /// Connect a subscriber and wait for the stream to accept it.
+  int subscribe() {
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path_.c_str(), path_.size());
+    EXPECT_EQ(0, ::connect(fd, (struct sockaddr*)&addr, sizeof(addr)));
+
+    auto subscribers = ResultStream::instance().subscribers();
+    for (size_t i = 0; i < 10; ++i) {
+      ResultStream::instance().step(100);
+      if (ResultStream::instance().subscribers() > subscribers) {
+        break;
+      }
+    }
+    return fd;
+  }
+
+  /// Read a frame's type, name, and payload.
+  bool readFrame(int fd,
+                 ResultStreamType& type,
+                 std::string& name,
+                 std::string& payload) {
+    for (size_t i = 0; i < 10; ++i) {
+      ResultStream::instance().step(10);
+    }
+
+    unsigned char header[4];
+    if (::recv(fd, header, 4, MSG_WAITALL) != 4) {
+      return false;
+    }
+    size_t length = (header[0] << 24) | (header[1] << 16) | (header[2] << 8) |
+                    header[3];
+    std::string frame(length, '\0');
+    if (::recv(fd, &frame[0], length, MSG_WAITALL) != (ssize_t)length) {
+      return false;
+    }
+
+    type = static_cast<ResultStreamType>(frame[0]);
+    size_t name_size = ((unsigned char)frame[9] << 8) | (unsigned char)frame[10];
+    name = frame.substr(11, name_size);
+    payload = frame.substr(11 + name_size);
+    return true;
+  }
+
+ protected:
+  std::string path_;
+};
+
+TEST_F(ResultStreamTests, test_publish) {
+  // Without subscribers nothing is serialized or queued.
+  QueryLogItem item;
+  item.name = "processes";
+  item.time = 1000;
+  item.results.added = {{{"pid", "1"}, {"name", "init"}}};
+  item.results.removed = {{{"pid", "2"}, {"name", "gone"}}};
+  ResultStream::instance().publish(item, false);
+
+  int fd = subscribe();
+  ASSERT_EQ(1U, ResultStream::instance().subscribers());
+  ResultStream::instance().publish(item, false);
+
+  ResultStreamType type;
+  std::string name, payload;
+  ASSERT_TRUE(readFrame(fd, type, name, payload));
+  EXPECT_EQ(STREAM_ADDED, type);
+  EXPECT_EQ("processes", name);
+  QueryData rows;
+  ASSERT_TRUE(deserializeQueryDataBinary(payload, rows).ok());
+  EXPECT_EQ(item.results.added, rows);
+
+  ASSERT_TRUE(readFrame(fd, type, name, payload));
+  EXPECT_EQ(STREAM_REMOVED, type);
+  rows.clear();
+  ASSERT_TRUE(deserializeQueryDataBinary(payload, rows).ok());
+  EXPECT_EQ(item.results.removed, rows);
+
+  // A closed subscriber is removed.
+  ::close(fd);
+  ResultStream::instance().step(100);
+  EXPECT_EQ(0U, ResultStream::instance().subscribers());
+}
+
+TEST_F(ResultStreamTests, test_subscriber_backpressure) {
+  int fd = subscribe();
+  ASSERT_EQ(1U, ResultStream::instance().subscribers());
+
+  // Frames beyond a subscriber's queue limit are dropped, and counted.
+  QueryLogItem item;
+  item.name = "snapshot";
+  item.snapshot_results = {{{"value", std::string(1024, 'a')}}};
+  auto frame_size = makeResultStreamFrame(
+                        STREAM_SNAPSHOT, item.name, 0, item.snapshot_results)
+                        ->size();
+  auto max_bytes = FLAGS_logger_stream_max_bytes;
+  FLAGS_logger_stream_max_bytes = frame_size * 2;
+  for (size_t i = 0; i < 5; ++i) {
+    ResultStream::instance().publish(item, true);
+  }
+
+  ResultStreamType type;
+  std::string name, payload;
+  ASSERT_TRUE(readFrame(fd, type, name, payload));
+  EXPECT_EQ(STREAM_SNAPSHOT, type);
+  ASSERT_TRUE(readFrame(fd, type, name, payload));
+  EXPECT_EQ(STREAM_SNAPSHOT, type);
+
+  // The next frame queued follows a count of the dropped frames.
+  ResultStream::instance().publish(item, true);
+  ASSERT_TRUE(readFrame(fd, type, name, payload));
+  EXPECT_EQ(STREAM_DROPPED, type);
+  ASSERT_EQ(8U, payload.size());
+  EXPECT_EQ(3, payload[7]);
+  ASSERT_TRUE(readFrame(fd, type, name, payload));
+  EXPECT_EQ(STREAM_SNAPSHOT, type);
+
+  FLAGS_logger_stream_max_bytes = max_bytes;
+  ::close(fd);
+}
+}
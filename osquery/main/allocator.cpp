@@ -0,0 +1,59 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <new>
+
+#include "osquery/core/profiler.h"
+
+/*
+ * Replace the global allocation functions so the bytes allocated by a
+ * profiled query are counted. This is linked into osquery's executables only,
+ * never libosquery. Every form allocates with malloc, so memory from any form
+ * may be freed by any other.
+ */
+void* operator new(size_t size) {
+  void* ptr = osquery::allocateProfiled(size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void* operator new[](size_t size) {
+  void* ptr = osquery::allocateProfiled(size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return osquery::allocateProfiled(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return osquery::allocateProfiled(size);
+}
+
+void operator delete(void* ptr) noexcept {
+  osquery::deallocateProfiled(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  osquery::deallocateProfiled(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+  osquery::deallocateProfiled(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+  osquery::deallocateProfiled(ptr);
+}
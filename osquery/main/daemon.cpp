@@ -13,6 +13,7 @@
 #include <osquery/core.h>
 
 #include "osquery/dispatcher/scheduler.h"
+#include "osquery/distributed/plugins/tls.h"
 
 const std::string kWatcherWorkerName = "osqueryd: worker";
 
@@ -30,6 +31,9 @@ int main(int argc, char* argv[]) {
   // Start osquery work.
   runner.start();
 
+  // Read distributed queries, if a distributed endpoint is configured.
+  osquery::startTLSDistributed();
+
   // Begin the schedule runloop.
   osquery::startScheduler();
 
@@ -10,6 +10,7 @@
 
 #include <cstdlib>
 #include <sstream>
+#include <stdexcept>
 
 #include <dlfcn.h>
 
@@ -21,10 +22,18 @@
 
 namespace osquery {
 
+std::atomic<size_t> RegistryHelperCore::generation_{1};
+
 void RegistryHelperCore::remove(const std::string& item_name) {
+  std::lock_guard<std::recursive_mutex> lock(items_mutex_);
   if (items_.count(item_name) > 0) {
-    items_[item_name]->tearDown();
+    // Items that were never used have nothing to tear down.
+    if (items_[item_name] != nullptr) {
+      items_[item_name]->tearDown();
+    }
     items_.erase(item_name);
+    creators_.erase(item_name);
+    generation_++;
   }
 
   // Populate list of aliases to remove (those that mask item_name).
@@ -49,14 +58,19 @@ bool RegistryHelperCore::isInternal(const std::string& item_name) const {
 }
 
 Status RegistryHelperCore::setActive(const std::string& item_name) {
-  if (items_.count(item_name) == 0 && external_.count(item_name) == 0) {
+  if (!exists(item_name, true) && external_.count(item_name) == 0) {
     return Status(1, "Unknown registry item");
   }
 
   active_ = item_name;
-  // The active plugin is setup when initialized.
+  // The active plugin is constructed and setup when initialized.
   if (exists(item_name, true)) {
-    Registry::get(name_, item_name)->setUp();
+    bool constructed = this->constructed(item_name);
+    auto plugin = getPlugin(item_name);
+    // A lazy registry's items are set up when constructed after its setUp.
+    if (plugin != nullptr && (constructed || !setup_)) {
+      plugin->setUp();
+    }
   }
   return Status(0, "OK");
 }
@@ -65,34 +79,62 @@ const std::string& RegistryHelperCore::getActive() const { return active_; }
 
 RegistryRoutes RegistryHelperCore::getRoutes() const {
   RegistryRoutes route_table;
-  for (const auto& item : items_) {
-    if (isInternal(item.first)) {
+  for (const auto& item_name : localNames()) {
+    if (isInternal(item_name)) {
       // This is an internal plugin, do not include the route.
       continue;
     }
 
+    // Broadcasting a route requires the plugin's route info.
+    std::shared_ptr<Plugin> plugin;
+    if (!findPlugin(item_name, plugin) || plugin == nullptr) {
+      continue;
+    }
+
     bool has_alias = false;
     for (const auto& alias : aliases_) {
-      if (alias.second == item.first) {
+      if (alias.second == item_name) {
         // If the item name is masked by at least one alias, it will not
         // broadcast under the internal item name.
-        route_table[alias.first] = item.second->routeInfo();
+        route_table[alias.first] = plugin->routeInfo();
         has_alias = true;
       }
     }
 
     if (!has_alias) {
-      route_table[item.first] = item.second->routeInfo();
+      route_table[item_name] = plugin->routeInfo();
     }
   }
   return route_table;
 }
 
+Status RegistryHelperCore::getRoute(const std::string& item_name,
+                                    PluginResponse& route) const {
+  std::shared_ptr<Plugin> plugin;
+  if (findPlugin(item_name, plugin)) {
+    if (plugin == nullptr) {
+      return Status(1, "Registry item failed to set up: " + item_name);
+    }
+    route = plugin->routeInfo();
+    return Status(0, "OK");
+  }
+
+  if (routes_.count(item_name) > 0) {
+    route = routes_.at(item_name);
+    return Status(0, "OK");
+  }
+  return Status(1, "No route for registry item: " + item_name);
+}
+
 Status RegistryHelperCore::call(const std::string& item_name,
                                 const PluginRequest& request,
                                 PluginResponse& response) {
-  if (items_.count(item_name) > 0) {
-    return items_.at(item_name)->call(request, response);
+  std::shared_ptr<Plugin> plugin;
+  if (findPlugin(item_name, plugin)) {
+    if (plugin == nullptr) {
+      return Status(1, "Registry item failed to set up: " + item_name);
+    }
+    return plugin->call(request, response);
   }
 
   if (external_.count(item_name) > 0) {
@@ -134,18 +176,25 @@ void RegistryHelperCore::setUp() {
     return;
   }
 
+  std::lock_guard<std::recursive_mutex> lock(items_mutex_);
+  setup_ = true;
+
   // If the registry is using a single 'active' plugin, setUp that plugin.
   // For config and logger, only setUp the selected plugin.
   if (active_.size() != 0 && exists(active_, true)) {
-    items_.at(active_)->setUp();
+    if (constructed(active_)) {
+      items_.at(active_)->setUp();
+    } else {
+      getPlugin(active_);
+    }
     return;
   }
 
-  // Try to set up each of the registry items.
-  // If they fail, remove them from the registry.
+  // Try to set up each of the constructed registry items, the rest are set
+  // up when they are first used. If they fail, remove them from the registry.
   std::vector<std::string> failed;
   for (auto& item : items_) {
-    if (!item.second->setUp().ok()) {
+    if (item.second != nullptr && !item.second->setUp().ok()) {
       failed.push_back(item.first);
     }
   }
@@ -158,18 +207,66 @@ void RegistryHelperCore::setUp() {
 /// Facility method to check if a registry item exists.
 bool RegistryHelperCore::exists(const std::string& item_name,
                                 bool local) const {
-  bool has_local = (items_.count(item_name) > 0);
+  bool has_local = false;
+  {
+    std::lock_guard<std::recursive_mutex> lock(items_mutex_);
+    has_local = (items_.count(item_name) > 0);
+  }
   bool has_external = (external_.count(item_name) > 0);
   bool has_route = (routes_.count(item_name) > 0);
   return (local) ? has_local : has_local || has_external || has_route;
 }
 
+std::shared_ptr<Plugin> RegistryHelperCore::getPlugin(
+    const std::string& item_name) const {
+  std::shared_ptr<Plugin> plugin;
+  if (!findPlugin(item_name, plugin)) {
+    throw std::out_of_range("No registry item: " + item_name);
+  }
+  return plugin;
+}
+
+bool RegistryHelperCore::findPlugin(const std::string& item_name,
+                                    std::shared_ptr<Plugin>& plugin) const {
+  // Callers hold their own reference, the item may be removed meanwhile.
+  std::lock_guard<std::recursive_mutex> lock(items_mutex_);
+  auto item = items_.find(item_name);
+  if (item == items_.end()) {
+    return false;
+  }
+
+  if (item->second != nullptr) {
+    plugin = item->second;
+    return true;
+  }
+
+  auto created = creators_.at(item_name)();
+  created->setName(item_name);
+  if (setup_) {
+    auto status = created->setUp();
+    if (!status.ok()) {
+      VLOG(1) << "Removing " << name_ << " registry item " << item_name
+              << " that failed to set up: " << status.getMessage();
+      items_.erase(item);
+      creators_.erase(item_name);
+      generation_++;
+      plugin = nullptr;
+      return true;
+    }
+  }
+  item->second = created;
+  plugin = std::move(created);
+  return true;
+}
+
+bool RegistryHelperCore::constructed(const std::string& item_name) const {
+  std::lock_guard<std::recursive_mutex> lock(items_mutex_);
+  return (items_.count(item_name) > 0 && items_.at(item_name) != nullptr);
+}
+
 /// Facility method to list the registry item identifiers.
 std::vector<std::string> RegistryHelperCore::names() const {
-  std::vector<std::string> names;
-  for (const auto& item : items_) {
-    names.push_back(item.first);
-  }
+  auto names = localNames();
 
   // Also add names of external plugins.
   for (const auto& item : external_) {
@@ -178,8 +275,20 @@ std::vector<std::string> RegistryHelperCore::names() const {
   return names;
 }
 
+std::vector<std::string> RegistryHelperCore::localNames() const {
+  std::vector<std::string> names;
+  std::lock_guard<std::recursive_mutex> lock(items_mutex_);
+  for (const auto& item : items_) {
+    names.push_back(item.first);
+  }
+  return names;
+}
+
 /// Facility method to count the number of items in this registry.
-size_t RegistryHelperCore::count() const { return items_.size(); }
+size_t RegistryHelperCore::count() const {
+  std::lock_guard<std::recursive_mutex> lock(items_mutex_);
+  return items_.size();
+}
 
 /// Allow the registry to introspect into the registered name (for logging).
 void RegistryHelperCore::setName(const std::string& name) { name_ = name; }
@@ -315,6 +424,15 @@ Status RegistryFactory::call(const std::string& registry_name,
   return call(registry_name, item_name, request, response);
 }
 
+Status RegistryFactory::getRoute(const std::string& registry_name,
+                                 const std::string& item_name,
+                                 PluginResponse& route) {
+  if (instance().registries_.count(registry_name) == 0) {
+    return Status(1, "Unknown registry: " + registry_name);
+  }
+  return registry(registry_name)->getRoute(item_name, route);
+}
+
 Status RegistryFactory::call(const std::string& registry_name,
                              const PluginRequest& request,
                              PluginResponse& response) {
@@ -392,7 +510,16 @@ size_t RegistryFactory::count(const std::string& registry_name) {
   return instance().registry(registry_name)->count();
 }
 
-Status RegistryHelperCore::add(const std::string& item_name, bool internal) {
+Status RegistryHelperCore::add(const std::string& item_name,
+                               const PluginCreator& creator,
+                               bool internal) {
+  {
+    std::lock_guard<std::recursive_mutex> lock(items_mutex_);
+    items_[item_name] = nullptr;
+    creators_[item_name] = creator;
+  }
+  generation_++;
+
   // The item can be listed as internal, meaning it does not broadcast.
   if (internal) {
     internal_.push_back(item_name);
@@ -521,4 +648,38 @@ void Plugin::setResponse(const std::string& key,
   boost::property_tree::write_json(output, tree, false);
   response.push_back({{key, output.str()}});
 }
+
+const PluginRef& PluginHandle::get() {
+  auto generation = RegistryHelperCore::generation();
+  if (generation != generation_) {
+    // Resolve the item again, it may have been added, removed, or replaced.
+    generation_ = generation;
+    plugin_.reset();
+    if (Registry::exists(registry_name_, item_name_, true)) {
+      plugin_ = Registry::get(registry_name_, item_name_);
+    }
+  }
+  return plugin_;
+}
+
+Status PluginHandle::call(const PluginRequest& request,
+                          PluginResponse& response) {
+  const auto& plugin = get();
+  if (plugin == nullptr) {
+    // Extension items are routed, and unknown items fail, by the registry.
+    return Registry::call(registry_name_, item_name_, request, response);
+  }
+
+  try {
+    return plugin->call(request, response);
+  } catch (const std::exception& e) {
+    LOG(ERROR) << registry_name_ << " registry " << item_name_
+               << " plugin caused exception: " << e.what();
+    return Status(1, e.what());
+  } catch (...) {
+    LOG(ERROR) << registry_name_ << " registry " << item_name_
+               << " plugin caused unknown exception";
+    return Status(2, "Unknown exception");
+  }
+}
 }
@@ -8,6 +8,8 @@
  *
  */
 
+#include <stdexcept>
+
 #include <gtest/gtest.h>
 
 #include <osquery/logger.h>
@@ -124,9 +126,11 @@ TEST_F(RegistryTests, test_persistant_registries) {
 
 TEST_F(RegistryTests, test_registry_exceptions) {
   EXPECT_TRUE(TestCoreRegistry::add<Doge>("dog", "duplicate_dog").ok());
-  // Bad dog will be added fine, but when setup is run, it will be removed.
+  // Bad dog will be added fine, but when it is set up, it will be removed.
   EXPECT_TRUE(TestCoreRegistry::add<BadDoge>("dog", "bad_doge").ok());
   TestCoreRegistry::registry("dog")->setUp();
+  // The registry is set up, so bad dog is set up when first used.
+  EXPECT_EQ(nullptr, TestCoreRegistry::get("dog", "bad_doge"));
   // Make sure bad dog does not exist.
   EXPECT_FALSE(TestCoreRegistry::exists("dog", "bad_doge"));
   EXPECT_EQ(TestCoreRegistry::count("dog"), 2);
@@ -147,6 +151,56 @@ TEST_F(RegistryTests, test_registry_exceptions) {
   EXPECT_EQ(exception_count, 2);
 }
 
+class LazyDog : public DogPlugin {
+ public:
+  LazyDog() { constructions++; }
+  Status setUp() {
+    setups++;
+    return Status(0, "OK");
+  }
+
+  static size_t constructions;
+  static size_t setups;
+};
+
+size_t LazyDog::constructions = 0;
+size_t LazyDog::setups = 0;
+
+TEST_F(RegistryTests, test_lazy_construction) {
+  TestCoreRegistry::create<DogPlugin>("lazy_dog", true);
+  EXPECT_TRUE(TestCoreRegistry::add<LazyDog>("lazy_dog", "lazy").ok());
+  EXPECT_TRUE(TestCoreRegistry::add<LazyDog>("lazy_dog", "unused").ok());
+
+  // Adding, listing, and setting up the registry constructs nothing.
+  TestCoreRegistry::registry("lazy_dog")->setUp();
+  EXPECT_TRUE(TestCoreRegistry::exists("lazy_dog", "lazy", true));
+  EXPECT_EQ(2U, TestCoreRegistry::names("lazy_dog").size());
+  EXPECT_EQ(0U, LazyDog::constructions);
+
+  // The first use constructs and sets up the plugin, once.
+  auto plugin = TestCoreRegistry::get("lazy_dog", "lazy");
+  EXPECT_NE(nullptr, plugin);
+  EXPECT_EQ(plugin, TestCoreRegistry::get("lazy_dog", "lazy"));
+  EXPECT_EQ(1U, LazyDog::constructions);
+  EXPECT_EQ(1U, LazyDog::setups);
+  EXPECT_FALSE(TestCoreRegistry::registry("lazy_dog")->constructed("unused"));
+}
+
+TEST_F(RegistryTests, test_removed_plugin) {
+  TestCoreRegistry::create<DogPlugin>("removed_dog", true);
+  EXPECT_TRUE(TestCoreRegistry::add<LazyDog>("removed_dog", "lazy").ok());
+  auto registry = TestCoreRegistry::registry("removed_dog");
+  auto plugin = registry->getPlugin("lazy");
+  ASSERT_NE(nullptr, plugin);
+
+  // A plugin in use outlives its removal from the registry.
+  registry->remove("lazy");
+  EXPECT_FALSE(registry->exists("lazy", true));
+  EXPECT_EQ(0U, registry->count());
+  EXPECT_EQ("lazy", plugin->getName());
+  EXPECT_THROW(registry->getPlugin("lazy"), std::out_of_range);
+}
+
 class WidgetPlugin : public Plugin {
  public:
   /// The route information will usually be provided by the plugin type.
@@ -214,6 +268,47 @@ TEST_F(RegistryTests, test_registry_api) {
   request["secret_power"] = "magic";
   status = TestCoreRegistry::call("widgets", "special", request, response);
   EXPECT_EQ(response[0].at("secret_power"), "magic");
+
+  // Route info is read without calling the item.
+  PluginResponse route;
+  EXPECT_TRUE(TestCoreRegistry::getRoute("widgets", "special", route).ok());
+  EXPECT_EQ(route[0].at("name"), "special");
+  EXPECT_FALSE(TestCoreRegistry::getRoute("widgets", "unknown", route).ok());
+
+  // An extension's items use the route info from its broadcast.
+  RegistryBroadcast broadcast = {
+      {"widgets", {{"external", {{{"name", "from_broadcast"}}}}}}};
+  EXPECT_TRUE(TestCoreRegistry::addBroadcast(1024, broadcast).ok());
+  EXPECT_TRUE(TestCoreRegistry::getRoute("widgets", "external", route).ok());
+  EXPECT_EQ(route[0].at("name"), "from_broadcast");
+  EXPECT_TRUE(TestCoreRegistry::removeBroadcast(1024).ok());
+  EXPECT_FALSE(TestCoreRegistry::getRoute("widgets", "external", route).ok());
+}
+
+TEST_F(RegistryTests, test_plugin_handle) {
+  auto AutoWidgetRegistry = TestCoreRegistry::create<WidgetPlugin>("gadgets");
+  UNUSED(AutoWidgetRegistry);
+
+  // A handle to an item that does not exist fails like a registry call.
+  PluginHandle handle("gadgets", "special");
+  EXPECT_EQ(handle.get(), nullptr);
+  PluginResponse response;
+  EXPECT_FALSE(handle.call({}, response).ok());
+
+  // Adding the item changes the generation, and the handle resolves it.
+  auto generation = RegistryHelperCore::generation();
+  TestCoreRegistry::add<SpecialWidget>("gadgets", "special");
+  EXPECT_NE(RegistryHelperCore::generation(), generation);
+  auto plugin = handle.get();
+  EXPECT_EQ(plugin, TestCoreRegistry::get("gadgets", "special"));
+
+  EXPECT_TRUE(handle.call({{"secret_power", "magic"}}, response).ok());
+  EXPECT_EQ(response[0].at("from"), "special");
+  EXPECT_EQ(response[0].at("secret_power"), "magic");
+
+  // Removing the item is seen by the handle.
+  TestCoreRegistry::registry("gadgets")->remove("special");
+  EXPECT_EQ(handle.get(), nullptr);
 }
 
 TEST_F(RegistryTests, test_real_registry) {
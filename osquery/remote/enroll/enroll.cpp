@@ -8,13 +8,18 @@
  *
  */
 
+#include <mutex>
+
 #include <boost/algorithm/string/trim.hpp>
 
+#include <osquery/core.h>
 #include <osquery/database.h>
 #include <osquery/enroll.h>
 #include <osquery/flags.h>
 #include <osquery/filesystem.h>
 
+#include "osquery/core/watcher.h"
+
 namespace osquery {
 
 /// Allow users to disable enrollment features.
@@ -29,7 +34,38 @@ CLI_FLAG(string,
          "",
          "Path to an optional client enrollment-auth secret");
 
+/// Seconds a class worker uses the default worker's node key before rereading.
+const size_t kDefaultWorkerNodeKeyTTL = 60;
+
+/**
+ * @brief The default worker's node key, read by a class worker.
+ *
+ * The default worker is the only process that enrolls. A class worker rereads
+ * the key when asked to force, or when its copy is stale, to follow the
+ * default worker's re-enrollment.
+ */
+static std::string getDefaultWorkerNodeKey(bool force) {
+  static std::mutex mutex;
+  static std::string node_key;
+  static size_t read_time = 0;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto now = getUnixTime();
+  if (force || node_key.empty() || read_time + kDefaultWorkerNodeKeyTTL < now) {
+    std::string value;
+    if (getDefaultWorkerSetting("nodeKey", value).ok()) {
+      node_key = value;
+      read_time = now;
+    }
+  }
+  return node_key;
+}
+
 std::string getNodeKey(const std::string& enroll_plugin, bool force) {
+  if (!getWorkerClass().empty()) {
+    return getDefaultWorkerNodeKey(force);
+  }
+
   std::string node_key;
   getDatabaseValue(kPersistentSettings, "nodeKey", node_key);
   if (node_key.size() > 0) {
@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <map>
 #include <memory>
 #include <utility>
 #include <string>
@@ -54,6 +55,45 @@ class Transport {
     serializer_ = serializer;
   }
 
+  /**
+   * @brief Compress request bodies, if the transport supports compression
+   *
+   * @param compress True to compress bodies sent with parameters
+   */
+  virtual void setCompression(bool compress) { compress_ = compress; }
+
+  /**
+   * @brief Label request bodies the caller already encoded
+   *
+   * Large bodies may be compressed as they are built, see GzipCompressor,
+   * and sent with a Content-Encoding without being compressed again.
+   *
+   * @param encoding The content encoding of request bodies, e.g. "gzip"
+   */
+  virtual void setContentEncoding(const std::string& encoding) {
+    content_encoding_ = encoding;
+  }
+
+  /**
+   * @brief Add a header to requests, such as a conditional If-None-Match
+   *
+   * @param name The header name
+   * @param value The header value
+   */
+  virtual void setHeader(const std::string& name, const std::string& value) {
+    headers_[name] = value;
+  }
+
+  /**
+   * @brief Set the seconds a request may wait for a response
+   *
+   * Long-polling requests are held open by the remote end until it has a
+   * response, and need a timeout longer than the default.
+   *
+   * @param timeout Seconds before the request fails
+   */
+  virtual void setTimeout(size_t timeout) { timeout_ = timeout; }
+
   /**
    * @brief Send a simple request to the destination with no parameters
    *
@@ -89,6 +129,24 @@ class Transport {
     return response_params_;
   }
 
+  /**
+   * @brief Get the response's protocol status code, such as 200 or 304
+   *
+   * A 304 (Not Modified) response to a conditional request has no params.
+   */
+  size_t getResponseCode() const { return response_code_; }
+
+  /**
+   * @brief Get a header of the response
+   *
+   * @param name The lowercase header name
+   * @return The header value, empty if the response had no such header
+   */
+  std::string getResponseHeader(const std::string& name) const {
+    auto header = response_headers_.find(name);
+    return (header == response_headers_.end()) ? "" : header->second;
+  }
+
   /**
    * @brief Virtual destructor
    */
@@ -101,11 +159,29 @@ class Transport {
   /// storage for the serializer reference
   std::shared_ptr<Serializer> serializer_;
 
+  /// compress request bodies
+  bool compress_{false};
+
+  /// the encoding of request bodies encoded by the caller
+  std::string content_encoding_;
+
+  /// additional request headers
+  std::map<std::string, std::string> headers_;
+
+  /// seconds to wait for a response
+  size_t timeout_{4};
+
   /// storage for response status
   Status response_status_;
 
   /// storage for response parameters
   boost::property_tree::ptree response_params_;
+
+  /// storage for the response status code
+  size_t response_code_{0};
+
+  /// storage for response headers, by lowercase name
+  std::map<std::string, std::string> response_headers_;
 };
 
 /**
@@ -242,6 +318,62 @@ class Request {
     return transport_->sendRequest(serialized);
   }
 
+  /**
+   * @brief Send a request with parameters that are already serialized
+   *
+   * Callers that build large bodies, such as batches of buffered logs, can
+   * write the serializer's format directly and avoid a property tree.
+   *
+   * @param serialized A string of parameters in the serializer's format
+   *
+   * @return An instance of osquery::Status indicating the success or failure
+   * of the operation
+   */
+  Status callSerialized(const std::string& serialized) {
+    return transport_->sendRequest(serialized);
+  }
+
+  /**
+   * @brief Compress the request body, if the transport supports compression
+   *
+   * @param compress True to compress the body
+   */
+  void setCompression(bool compress) { transport_->setCompression(compress); }
+
+  /**
+   * @brief Label request bodies the caller already encoded
+   *
+   * @param encoding The content encoding of request bodies, e.g. "gzip"
+   */
+  void setContentEncoding(const std::string& encoding) {
+    transport_->setContentEncoding(encoding);
+  }
+
+  /**
+   * @brief Add a header to the request
+   *
+   * @param name The header name
+   * @param value The header value
+   */
+  void setHeader(const std::string& name, const std::string& value) {
+    transport_->setHeader(name, value);
+  }
+
+  /// Get the response's protocol status code.
+  size_t getResponseCode() const { return transport_->getResponseCode(); }
+
+  /// Get a header of the response by its lowercase name, or empty.
+  std::string getResponseHeader(const std::string& name) const {
+    return transport_->getResponseHeader(name);
+  }
+
+  /**
+   * @brief Set the seconds the request may wait for a response
+   *
+   * @param timeout Seconds before the request fails
+   */
+  void setTimeout(size_t timeout) { transport_->setTimeout(timeout); }
+
   /**
    * @brief Get the request response
    *
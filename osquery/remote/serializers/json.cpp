@@ -8,8 +8,7 @@
  *
  */
 
-#include <boost/property_tree/json_parser.hpp>
-
+#include "osquery/core/json.h"
 #include "osquery/remote/serializers/json.h"
 
 namespace pt = boost::property_tree;
@@ -18,21 +17,13 @@ namespace osquery {
 
 Status JSONSerializer::serialize(const pt::ptree& params,
                                  std::string& serialized) {
-  std::ostringstream output;
-  pt::write_json(output, params, false);
-  serialized = output.str();
+  serialized.clear();
+  writePtreeJSON(params, serialized);
   return Status(0, "OK");
 }
 
 Status JSONSerializer::deserialize(const std::string& serialized,
                                    pt::ptree& params) {
-  try {
-    std::stringstream input;
-    input << serialized;
-    pt::read_json(input, params);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    return Status(1, e.what());
-  }
-  return Status(0, "OK");
+  return readPtreeJSON(serialized, params);
 }
 }
@@ -8,6 +8,10 @@
  *
  */
 
+#include <map>
+#include <mutex>
+
+#include <boost/algorithm/string/case_conv.hpp>
 #include <boost/asio/ssl/context_base.hpp>
 
 #ifndef OPENSSL_NO_SSL2
@@ -20,6 +24,7 @@
 
 #include <osquery/filesystem.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/remote/transports/tls.h"
 
 namespace http = boost::network::http;
@@ -31,6 +36,9 @@ const std::string kTLSCiphers =
     "DH+3DES:RSA+AESGCM:RSA+AES:RSA+3DES:!aNULL:!MD5";
 const std::string kTLSUserAgent = "osquery/" STR(OSQUERY_BUILD_VERSION);
 
+/// The largest decompressed response body, in bytes.
+const size_t kTLSResponseMax = 64 * 1024 * 1024;
+
 /// TLS server hostname.
 CLI_FLAG(string,
          tls_hostname,
@@ -72,11 +80,64 @@ void TLSTransport::decorateRequest(http::client::request& r) {
   r << boost::network::header("Accept", serializer_->getContentType());
   r << boost::network::header("Host", FLAGS_tls_hostname);
   r << boost::network::header("User-Agent", kTLSUserAgent);
+  r << boost::network::header("Accept-Encoding", "gzip");
+  if (compress_) {
+    r << boost::network::header("Content-Encoding", "gzip");
+  } else if (!content_encoding_.empty()) {
+    r << boost::network::header("Content-Encoding", content_encoding_);
+  }
+
+  for (const auto& header : headers_) {
+    r << boost::network::header(header.first, header.second);
+  }
+}
+
+Status TLSTransport::deserializeResponse() {
+  response_code_ = status(response_);
+  response_headers_.clear();
+  std::multimap<std::string, std::string> response_headers =
+      headers(response_);
+  for (const auto& header : response_headers) {
+    response_headers_[boost::to_lower_copy(header.first)] = header.second;
+  }
+
+  response_params_.clear();
+  if (response_code_ == 304) {
+    // A conditional request's resource did not change, there is no body.
+    return Status(0, "Not Modified");
+  }
+
+  auto encoding = getResponseHeader("content-encoding");
+
+  if (encoding.empty() || encoding == "identity") {
+    return serializer_->deserialize(body(response_), response_params_);
+  } else if (encoding != "gzip") {
+    return Status(1, "Unsupported response encoding: " + encoding);
+  }
+
+  std::string decompressed;
+  auto status = decompressGzip(body(response_), decompressed, kTLSResponseMax);
+  if (!status.ok()) {
+    return status;
+  }
+  return serializer_->deserialize(decompressed, response_params_);
 }
 
+/**
+ * @brief Clients shared by every transport with the same options.
+ *
+ * Each http::client runs its own io_service thread and resolver. Requests
+ * made with the same options share one client, so periodic requests do not
+ * start a thread, resolve the host, and read certificates each time. Copies
+ * of a client share its implementation, and clients are thread safe.
+ */
+static std::map<std::string, http::client> kTLSClients;
+static std::mutex kTLSClientsMutex;
+
 http::client TLSTransport::getClient() {
   http::client::options options;
-  options.follow_redirects(true).always_verify_peer(verify_peer_).timeout(4);
+  options.follow_redirects(true).always_verify_peer(verify_peer_);
+  options.timeout(timeout_).cache_resolved(true);
 
   std::string ciphers = kTLSCiphers;
   // Some Ubuntu 12.04 clients exhaust their cipher suites without SHA.
@@ -88,6 +149,8 @@ http::client TLSTransport::getClient() {
   options.openssl_ciphers(ciphers);
   options.openssl_options(SSL_OP_NO_SSLv3 | SSL_OP_NO_SSLv2 | SSL_OP_ALL);
 
+  // The options applied to the client identify the shared client.
+  auto key = std::to_string(verify_peer_) + "/" + std::to_string(timeout_);
   if (server_certificate_file_.size() > 0) {
     if (!osquery::isReadable(server_certificate_file_).ok()) {
       LOG(WARNING) << "Cannot read TLS server certificate(s): "
@@ -96,8 +159,10 @@ http::client TLSTransport::getClient() {
       // There is a non-default server certificate set.
       options.openssl_verify_path(server_certificate_file_);
       options.openssl_certificate(server_certificate_file_);
+      key += "/" + server_certificate_file_;
     }
   }
+  key += "/";
 
   if (client_certificate_file_.size() > 0) {
     if (!osquery::isReadable(client_certificate_file_).ok()) {
@@ -109,11 +174,16 @@ http::client TLSTransport::getClient() {
     } else {
       options.openssl_certificate_file(client_certificate_file_);
       options.openssl_private_key_file(client_private_key_file_);
+      key += client_certificate_file_ + "/" + client_private_key_file_;
     }
   }
 
-  http::client client(options);
-  return client;
+  std::lock_guard<std::mutex> lock(kTLSClientsMutex);
+  auto client = kTLSClients.find(key);
+  if (client == kTLSClients.end()) {
+    client = kTLSClients.emplace(key, http::client(options)).first;
+  }
+  return client->second;
 }
 
 inline bool tlsFailure(const std::string& what) {
@@ -135,8 +205,7 @@ Status TLSTransport::sendRequest() {
   try {
     VLOG(1) << "TLS/HTTPS GET request to URI: " << destination_;
     response_ = client.get(r);
-    response_status_ =
-        serializer_->deserialize(body(response_), response_params_);
+    response_status_ = deserializeResponse();
   } catch (const std::exception& e) {
     return Status((tlsFailure(e.what())) ? 2 : 1,
                   std::string("Request error: ") + e.what());
@@ -149,15 +218,22 @@ Status TLSTransport::sendRequest(const std::string& params) {
     return Status(1, "Cannot create TLS request for non-HTTPS protocol URI");
   }
 
+  std::string compressed;
+  if (compress_) {
+    auto status = compressGzip(params, compressed);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
   auto client = getClient();
   http::client::request r(destination_);
   decorateRequest(r);
 
   try {
     VLOG(1) << "TLS/HTTPS POST request to URI: " << destination_;
-    response_ = client.post(r, params);
-    response_status_ =
-        serializer_->deserialize(body(response_), response_params_);
+    response_ = client.post(r, (compress_) ? compressed : params);
+    response_status_ = deserializeResponse();
   } catch (const std::exception& e) {
     return Status((tlsFailure(e.what())) ? 2 : 1,
                   std::string("Request error: ") + e.what());
@@ -70,6 +70,7 @@ class TLSTransport : public Transport {
   TLSTransport();
 
  protected:
+  /// Get the client shared by transports with the same TLS options.
   boost::network::http::client getClient();
 
  private:
@@ -109,6 +110,9 @@ class TLSTransport : public Transport {
     */
   void decorateRequest(boost::network::http::client::request& r);
 
+  /// Deserialize the response body, decompressing an encoded body.
+  Status deserializeResponse();
+
  protected:
   /// Storage for the HTTP response object
   boost::network::http::client::response response_;
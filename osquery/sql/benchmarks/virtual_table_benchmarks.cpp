@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/registry.h>
+#include <osquery/sql.h>
+
+#include "osquery/core/test_util.h"
+#include "osquery/sql/virtual_table.h"
+
+namespace osquery {
+
+const size_t kBenchmarkTableRows = 1000;
+
+/// A table generating rows from memory, such that only SQLite is measured.
+class benchmarkTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {{"id", "INTEGER"}, {"name", "TEXT"}, {"path", "TEXT"}};
+  }
+
+ public:
+  void generateRows(QueryContext& context, const RowYield& yield) {
+    for (size_t i = 0; i < kBenchmarkTableRows; ++i) {
+      Row r = {{"id", std::to_string(i)},
+               {"name", "process" + std::to_string(i)},
+               {"path", "/usr/local/bin/process"}};
+      if (!yield(r)) {
+        break;
+      }
+    }
+  }
+};
+
+class VirtualTableBenchmarks : public testing::Test {
+ protected:
+  void SetUp() { Registry::add<benchmarkTablePlugin>("table", "benchmark"); }
+
+  void query(const std::string& sql, size_t expected) {
+    auto dbc = SQLiteDBManager::get();
+    attachTableInternal(
+        "benchmark", "(id INTEGER, name TEXT, path TEXT)", dbc.db());
+
+    size_t rows = 0;
+    runBenchmark([&dbc, &sql, &rows]() {
+      QueryData results;
+      queryInternal(sql, results, dbc.db());
+      rows += results.size();
+    }, expected);
+    EXPECT_EQ(rows % expected, 0U);
+  }
+};
+
+TEST_F(VirtualTableBenchmarks, bench_select_all) {
+  // Every row through xFilter, xNext, and each column's xColumn.
+  query("SELECT * FROM benchmark", kBenchmarkTableRows);
+}
+
+TEST_F(VirtualTableBenchmarks, bench_select_column) {
+  query("SELECT id FROM benchmark", kBenchmarkTableRows);
+}
+
+TEST_F(VirtualTableBenchmarks, bench_select_limit) {
+  // The generator stops once the limit is reached.
+  query("SELECT id FROM benchmark LIMIT 1", 1);
+}
+
+TEST_F(VirtualTableBenchmarks, bench_count) {
+  query("SELECT COUNT(*) FROM benchmark", 1);
+}
+
+TEST_F(VirtualTableBenchmarks, bench_select_all_result_set) {
+  // The same rows stepped into a ResultSet, without a Row per result.
+  auto dbc = SQLiteDBManager::get();
+  attachTableInternal(
+      "benchmark", "(id INTEGER, name TEXT, path TEXT)", dbc.db());
+
+  size_t rows = 0;
+  ResultSet results;
+  runBenchmark([&dbc, &results, &rows]() {
+    results.reset(nullptr);
+    queryInternal("SELECT * FROM benchmark", results, dbc.db());
+    rows += results.rows();
+  }, kBenchmarkTableRows);
+  EXPECT_EQ(rows % kBenchmarkTableRows, 0U);
+}
+
+TEST_F(VirtualTableBenchmarks, bench_buffer_append) {
+  auto rows = generateBenchmarkRows(kBenchmarkTableRows, 3, 16);
+  TableColumns columns = {{"column_0", "INTEGER"},
+                          {"column_1", "TEXT"},
+                          {"column_2", "TEXT"}};
+
+  VirtualTableBuffer buffer;
+  buffer.reset({INTEGER_TYPE, TEXT_TYPE, TEXT_TYPE});
+  runBenchmark([&]() {
+    buffer.clear();
+    for (const auto& row : rows) {
+      buffer.append(row, columns);
+    }
+  }, kBenchmarkTableRows);
+  EXPECT_EQ(buffer.rows(), kBenchmarkTableRows);
+}
+}
@@ -20,6 +20,9 @@ namespace osquery {
 
 FLAG(int32, value_max, 512, "Maximum returned row value size");
 
+const std::string kQueryResultsLimitError =
+    "Query results exceeded the size limit: ";
+
 const std::map<ConstraintOperator, std::string> kSQLOperatorRepr = {
     {EQUALS, "="},
     {GREATER_THAN, ">"},
@@ -30,13 +33,33 @@ const std::map<ConstraintOperator, std::string> kSQLOperatorRepr = {
 
 SQL::SQL(const std::string& q) { status_ = query(q, results_); }
 
-const QueryData& SQL::rows() { return results_; }
+SQL::SQL(const std::string& q, size_t timeout) {
+  status_ = query(q, results_, timeout);
+}
+
+SQL::SQL(const std::string& q, size_t timeout, size_t max_bytes) {
+  if (max_bytes == 0) {
+    status_ = query(q, results_, timeout);
+    return;
+  }
+
+  QueryDataSink sink(results_, max_bytes);
+  status_ = query(q, sink, timeout);
+  if (!status_.ok()) {
+    // Rows of an interrupted or oversized query are incomplete.
+    results_.clear();
+  }
+}
+
+const QueryData& SQL::rows() const & { return results_; }
 
-bool SQL::ok() { return status_.ok(); }
+QueryData SQL::rows() && { return std::move(results_); }
 
-Status SQL::getStatus() { return status_; }
+bool SQL::ok() const { return status_.ok(); }
 
-std::string SQL::getMessageString() { return status_.toString(); }
+Status SQL::getStatus() const { return status_; }
+
+std::string SQL::getMessageString() const { return status_.toString(); }
 
 const std::string SQL::kHostColumnName = "_source_host";
 void SQL::annotateHostInfo() {
@@ -56,10 +79,9 @@ std::vector<std::string> SQL::getTableNames() {
 
 QueryData SQL::selectAllFrom(const std::string& table) {
   PluginResponse response;
-  PluginRequest request;
-  request["action"] = "generate";
+  QueryContext ctx;
 
-  Registry::call("table", table, request, response);
+  TablePlugin::generateFromContext(table, ctx, response);
   return response;
 }
 
@@ -68,12 +90,10 @@ QueryData SQL::selectAllFrom(const std::string& table,
                              ConstraintOperator op,
                              const std::string& expr) {
   PluginResponse response;
-  PluginRequest request = {{"action", "generate"}};
   QueryContext ctx;
   ctx.constraints[column].add(Constraint(op, expr));
 
-  TablePlugin::setRequestFromContext(ctx, request);
-  Registry::call("table", table, request, response);
+  TablePlugin::generateFromContext(table, ctx, response);
   return response;
 }
 
@@ -84,7 +104,19 @@ Status SQLPlugin::call(const PluginRequest& request, PluginResponse& response) {
   }
 
   if (request.at("action") == "query") {
+    if (request.count("timeout") > 0) {
+      size_t timeout = 0;
+      try {
+        timeout = AS_LITERAL(size_t, request.at("timeout"));
+      } catch (const boost::bad_lexical_cast& e) {
+        return Status(1, "Invalid query timeout");
+      }
+      return this->query(request.at("query"), response, timeout);
+    }
     return this->query(request.at("query"), response);
+  } else if (request.at("action") == "interrupt") {
+    response.push_back({{"interrupted", TEXT(this->interruptExpired())}});
+    return Status(0, "OK");
   } else if (request.at("action") == "columns") {
     TableColumns columns;
     auto status = this->getQueryColumns(request.at("query"), columns);
@@ -93,6 +125,13 @@ Status SQLPlugin::call(const PluginRequest& request, PluginResponse& response) {
       response.push_back({{"n", column.first}, {"t", column.second}});
     }
     return status;
+  } else if (request.at("action") == "keys") {
+    std::vector<std::string> keys;
+    auto status = this->getQueryKeys(request.at("query"), keys);
+    for (const auto& key : keys) {
+      response.push_back({{"n", key}});
+    }
+    return status;
   } else if (request.at("action") == "attach") {
     // Attach a virtual table name using an optional included definition.
     return this->attach(request.at("table"));
@@ -108,6 +147,48 @@ Status query(const std::string& q, QueryData& results) {
       "sql", "sql", {{"action", "query"}, {"query", q}}, results);
 }
 
+Status query(const std::string& q, QueryData& results, size_t timeout) {
+  return Registry::call("sql",
+                        "sql",
+                        {{"action", "query"},
+                         {"query", q},
+                         {"timeout", std::to_string(timeout)}},
+                        results);
+}
+
+Status query(const std::string& q, ResultSink& results, size_t timeout) {
+  // The internal SQL plugin is called directly, without a QueryData response.
+  if (Registry::exists("sql", "sql", true)) {
+    auto plugin =
+        std::dynamic_pointer_cast<SQLPlugin>(Registry::get("sql", "sql"));
+    if (plugin != nullptr) {
+      return plugin->query(q, results, timeout);
+    }
+  }
+
+  QueryData rows;
+  auto status = query(q, rows, timeout);
+  if (status.ok()) {
+    sendResultSet(ResultSet::fromQueryData(rows), results);
+  }
+  return status;
+}
+
+size_t interruptExpiredQueries() {
+  PluginResponse response;
+  auto status =
+      Registry::call("sql", "sql", {{"action", "interrupt"}}, response);
+  if (!status.ok() || response.size() == 0) {
+    return 0;
+  }
+
+  try {
+    return AS_LITERAL(size_t, response[0]["interrupted"]);
+  } catch (const boost::bad_lexical_cast& e) {
+    return 0;
+  }
+}
+
 Status getQueryColumns(const std::string& q, TableColumns& columns) {
   PluginResponse response;
   auto status = Registry::call(
@@ -119,4 +200,19 @@ Status getQueryColumns(const std::string& q, TableColumns& columns) {
   }
   return status;
 }
+
+Status getQueryKeyColumns(const std::string& q,
+                          std::vector<std::string>& keys) {
+  PluginResponse response;
+  auto status = Registry::call(
+      "sql", "sql", {{"action", "keys"}, {"query", q}}, response);
+
+  keys.clear();
+  for (const auto& item : response) {
+    if (item.count("n") > 0) {
+      keys.push_back(item.at("n"));
+    }
+  }
+  return status;
+}
 }
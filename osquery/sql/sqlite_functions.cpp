@@ -0,0 +1,329 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <memory>
+#include <regex>
+#include <string>
+
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "osquery/sql/sqlite_util.h"
+
+namespace osquery {
+
+#ifdef SQLITE_DETERMINISTIC
+const int kSQLFunctionFlags = SQLITE_UTF8 | SQLITE_DETERMINISTIC;
+#else
+const int kSQLFunctionFlags = SQLITE_UTF8;
+#endif
+
+/// A parsed network and prefix length.
+struct CIDRNetwork {
+  int family;
+  unsigned char address[16];
+  size_t bits;
+};
+
+/// Read a text argument, false if it is NULL.
+static bool getText(sqlite3_value* value, std::string& text) {
+  if (sqlite3_value_type(value) == SQLITE_NULL) {
+    return false;
+  }
+  auto data = sqlite3_value_text(value);
+  text.assign(reinterpret_cast<const char*>(data), sqlite3_value_bytes(value));
+  return true;
+}
+
+template <typename T>
+static void deleteAuxData(void* data) {
+  delete static_cast<T*>(data);
+}
+
+/**
+ * @brief Get the compiled form of a pattern argument.
+ *
+ * SQLite keeps auxiliary data for a constant argument across the rows of a
+ * statement, so each statement compiles its pattern once. The compiled
+ * pattern is owned by compiled until it is given to SQLite with saveCompiled.
+ */
+template <typename T, typename Compile>
+static const T* getCompiled(sqlite3_context* context,
+                            int arg,
+                            const std::string& pattern,
+                            std::unique_ptr<T>& compiled,
+                            Compile compile) {
+  auto cached = static_cast<const T*>(sqlite3_get_auxdata(context, arg));
+  if (cached != nullptr) {
+    return cached;
+  }
+
+  compiled.reset(new T());
+  if (!compile(pattern, *compiled)) {
+    compiled.reset();
+    return nullptr;
+  }
+  return compiled.get();
+}
+
+/// Give a compiled pattern to SQLite, after its last use by this call.
+template <typename T>
+static void saveCompiled(sqlite3_context* context,
+                         int arg,
+                         std::unique_ptr<T>& compiled) {
+  if (compiled != nullptr) {
+    sqlite3_set_auxdata(context, arg, compiled.release(), deleteAuxData<T>);
+  }
+}
+
+static bool compileRegex(const std::string& pattern, std::regex& regex) {
+  try {
+    regex.assign(pattern, std::regex::ECMAScript | std::regex::optimize);
+  } catch (const std::regex_error&) {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Compile a path glob into a regex.
+ *
+ * A '*' or '?' does not match a '/', '**' matches across directories.
+ */
+static bool compileGlob(const std::string& glob, std::regex& regex) {
+  std::string pattern = "^";
+  for (size_t i = 0; i < glob.size(); ++i) {
+    auto c = glob[i];
+    if (c == '*' && i + 1 < glob.size() && glob[i + 1] == '*') {
+      pattern += ".*";
+      ++i;
+    } else if (c == '*') {
+      pattern += "[^/]*";
+    } else if (c == '?') {
+      pattern += "[^/]";
+    } else if (c == '[') {
+      auto end = glob.find(']', i + 2);
+      if (end == std::string::npos) {
+        pattern += "\\[";
+        continue;
+      }
+      auto set = glob.substr(i + 1, end - i - 1);
+      if (set[0] == '!') {
+        set[0] = '^';
+      }
+      // Backslashes are literal within a glob's set.
+      for (size_t b = set.find('\\'); b != std::string::npos;
+           b = set.find('\\', b + 2)) {
+        set.insert(b, "\\");
+      }
+      pattern += "[" + set + "]";
+      i = end;
+    } else if (strchr(".^$|()+{}\\", c) != nullptr) {
+      pattern += '\\';
+      pattern += c;
+    } else {
+      pattern += c;
+    }
+  }
+  return compileRegex(pattern + "$", regex);
+}
+
+/// Parse an IPv4 or IPv6 address.
+static bool parseAddress(const std::string& text,
+                         int& family,
+                         unsigned char* address) {
+  if (inet_pton(AF_INET, text.c_str(), address) == 1) {
+    family = AF_INET;
+    return true;
+  }
+  // A scoped IPv6 address compares without its zone.
+  auto zone = text.find('%');
+  if (inet_pton(AF_INET6, text.substr(0, zone).c_str(), address) == 1) {
+    family = AF_INET6;
+    return true;
+  }
+  return false;
+}
+
+static bool compileCIDR(const std::string& cidr, CIDRNetwork& network) {
+  auto slash = cidr.find('/');
+  if (!parseAddress(cidr.substr(0, slash), network.family, network.address)) {
+    return false;
+  }
+
+  size_t max = (network.family == AF_INET) ? 32 : 128;
+  network.bits = max;
+  if (slash != std::string::npos) {
+    char* end = nullptr;
+    auto bits = strtoul(cidr.c_str() + slash + 1, &end, 10);
+    if (end == cidr.c_str() + slash + 1 || *end != '\0' || bits > max) {
+      return false;
+    }
+    network.bits = bits;
+  }
+  return true;
+}
+
+static bool inNetwork(const CIDRNetwork& network, const std::string& text) {
+  int family = 0;
+  unsigned char address[16];
+  if (!parseAddress(text, family, address)) {
+    return false;
+  }
+
+  const unsigned char* bytes = address;
+  if (family == AF_INET6 && network.family == AF_INET &&
+      IN6_IS_ADDR_V4MAPPED(reinterpret_cast<struct in6_addr*>(address))) {
+    // Compare the IPv4 address of a mapped IPv6 address.
+    bytes = address + 12;
+  } else if (family != network.family) {
+    return false;
+  }
+
+  size_t whole = network.bits / 8;
+  if (memcmp(bytes, network.address, whole) != 0) {
+    return false;
+  }
+  size_t rest = network.bits % 8;
+  if (rest == 0) {
+    return true;
+  }
+  unsigned char mask = static_cast<unsigned char>(0xff << (8 - rest));
+  return (bytes[whole] & mask) == (network.address[whole] & mask);
+}
+
+/// regex_match(value, pattern): 1 if an ECMAScript regex matches in value.
+static void sqliteRegexMatch(sqlite3_context* context,
+                             int argc,
+                             sqlite3_value** argv) {
+  std::string value, pattern;
+  if (!getText(argv[0], value) || !getText(argv[1], pattern)) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  std::unique_ptr<std::regex> compiled;
+  auto regex = getCompiled(context, 1, pattern, compiled, compileRegex);
+  if (regex == nullptr) {
+    sqlite3_result_error(context, "Invalid regex_match pattern", -1);
+    return;
+  }
+  sqlite3_result_int(context, std::regex_search(value, *regex) ? 1 : 0);
+  saveCompiled(context, 1, compiled);
+}
+
+/// in_cidr(address, cidr): 1 if an IPv4 or IPv6 address is within a network.
+static void sqliteInCIDR(sqlite3_context* context,
+                         int argc,
+                         sqlite3_value** argv) {
+  std::string address, cidr;
+  if (!getText(argv[0], address) || !getText(argv[1], cidr)) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  std::unique_ptr<CIDRNetwork> compiled;
+  auto network = getCompiled(context, 1, cidr, compiled, compileCIDR);
+  if (network == nullptr) {
+    sqlite3_result_error(context, "Invalid in_cidr network", -1);
+    return;
+  }
+  sqlite3_result_int(context, inNetwork(*network, address) ? 1 : 0);
+  saveCompiled(context, 1, compiled);
+}
+
+/// path_glob(path, glob): 1 if a path matches a glob.
+static void sqlitePathGlob(sqlite3_context* context,
+                           int argc,
+                           sqlite3_value** argv) {
+  std::string path, glob;
+  if (!getText(argv[0], path) || !getText(argv[1], glob)) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  std::unique_ptr<std::regex> compiled;
+  auto regex = getCompiled(context, 1, glob, compiled, compileGlob);
+  if (regex == nullptr) {
+    sqlite3_result_error(context, "Invalid path_glob pattern", -1);
+    return;
+  }
+  sqlite3_result_int(context, std::regex_match(path, *regex) ? 1 : 0);
+  saveCompiled(context, 1, compiled);
+}
+
+/// split_part(value, delimiter, index): the 1-based part of a split string.
+static void sqliteSplitPart(sqlite3_context* context,
+                            int argc,
+                            sqlite3_value** argv) {
+  std::string value, delimiter;
+  if (!getText(argv[0], value) || !getText(argv[1], delimiter) ||
+      delimiter.empty()) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  auto index = sqlite3_value_int64(argv[2]);
+  size_t start = 0;
+  for (; index > 1; --index) {
+    start = value.find(delimiter, start);
+    if (start == std::string::npos) {
+      break;
+    }
+    start += delimiter.size();
+  }
+  if (index < 1 || start == std::string::npos) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  auto end = value.find(delimiter, start);
+  auto part = value.substr(start, end - start);
+  sqlite3_result_text(
+      context, part.c_str(), static_cast<int>(part.size()), SQLITE_TRANSIENT);
+}
+
+void registerFunctions(sqlite3* db) {
+  sqlite3_create_function(db,
+                          "regex_match",
+                          2,
+                          kSQLFunctionFlags,
+                          nullptr,
+                          sqliteRegexMatch,
+                          nullptr,
+                          nullptr);
+  sqlite3_create_function(db,
+                          "in_cidr",
+                          2,
+                          kSQLFunctionFlags,
+                          nullptr,
+                          sqliteInCIDR,
+                          nullptr,
+                          nullptr);
+  sqlite3_create_function(db,
+                          "path_glob",
+                          2,
+                          kSQLFunctionFlags,
+                          nullptr,
+                          sqlitePathGlob,
+                          nullptr,
+                          nullptr);
+  sqlite3_create_function(db,
+                          "split_part",
+                          3,
+                          kSQLFunctionFlags,
+                          nullptr,
+                          sqliteSplitPart,
+                          nullptr,
+                          nullptr);
+}
+}
@@ -8,11 +8,18 @@
  *
  */
 
+#include <ctype.h>
+
+#include <algorithm>
+#include <chrono>
+#include <set>
+
 #include <osquery/core.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 
+#include "osquery/core/profiler.h"
 #include "osquery/sql/sqlite_util.h"
 #include "osquery/sql/virtual_table.h"
 
@@ -20,6 +27,17 @@ namespace osquery {
 /// SQL provider for osquery internal/core.
 REGISTER_INTERNAL(SQLiteSQLPlugin, "sql", "sql");
 
+/// Maximum number of cached prepared statements for the primary database.
+const size_t kMaxCachedStatements = 256;
+
+/// Time to wait for a pooled database before opening a transient.
+const std::chrono::milliseconds kPoolWaitTimeout(200);
+
+FLAG(int32,
+     sqlite_pool_size,
+     4,
+     "Number of pooled SQLite databases for concurrent queries");
+
 FLAG(string,
      disable_tables,
      "Not Specified",
@@ -75,6 +93,11 @@ std::string getStringForSQLiteReturnCode(int code) {
 }
 
 Status SQLiteSQLPlugin::attach(const std::string& name) {
+  // Pooled databases will be reopened with the new table.
+  SQLiteDBManager::resetPool();
+  // A re-registered extension table may have new columns.
+  clearTableDefinition(name);
+
   // This may be the managed DB, or a transient.
   auto dbc = SQLiteDBManager::get();
   if (!dbc.isPrimary()) {
@@ -82,18 +105,20 @@ Status SQLiteSQLPlugin::attach(const std::string& name) {
     return Status(0, "OK");
   }
 
-  PluginResponse response;
-  auto status =
-      Registry::call("table", name, {{"action", "columns"}}, response);
+  TableDefinition definition;
+  auto status = getTableDefinition(name, definition);
   if (!status.ok()) {
     return status;
   }
 
-  auto statement = columnDefinition(response);
+  auto statement = columnDefinition(definition.columns);
   return attachTableInternal(name, statement, dbc.db());
 }
 
 void SQLiteSQLPlugin::detach(const std::string& name) {
+  SQLiteDBManager::resetPool();
+  clearTableDefinition(name);
+
   auto dbc = SQLiteDBManager::get();
   if (!dbc.isPrimary()) {
     return;
@@ -101,24 +126,112 @@ void SQLiteSQLPlugin::detach(const std::string& name) {
   detachTableInternal(name, dbc.db());
 }
 
+/// Databases running queries with a deadline, and their cancellations.
+static std::map<sqlite3*, QueryCancellation*> kDeadlines;
+/// Mutex protecting the deadlines, and the databases' open state.
+static std::mutex kDeadlinesMutex;
+
+/// Run a query into a sink, expired is set if it exceeded the timeout.
+static Status queryDeadline(const std::string& q,
+                            ResultSink& results,
+                            size_t timeout,
+                            bool& expired) {
+  expired = false;
+  auto dbc = SQLiteDBManager::get();
+  if (timeout == 0) {
+    return queryInternal(q, results, dbc.db());
+  }
+
+  // Table generators on this thread stop early once the deadline passes.
+  QueryCancellation cancellation(timeout);
+  ScopedQueryCancellation scope(&cancellation);
+  {
+    std::lock_guard<std::mutex> lock(kDeadlinesMutex);
+    kDeadlines[dbc.db()] = &cancellation;
+  }
+
+  auto status = queryInternal(q, results, dbc.db());
+  {
+    // The database must not be interrupted after it is returned.
+    std::lock_guard<std::mutex> lock(kDeadlinesMutex);
+    kDeadlines.erase(dbc.db());
+  }
+
+  if (cancellation.cancelled() ||
+      (!status.ok() && sqlite3_errcode(dbc.db()) == SQLITE_INTERRUPT)) {
+    expired = true;
+    return Status(1, "Query exceeded timeout: " + q);
+  }
+  return status;
+}
+
+Status SQLiteSQLPlugin::query(const std::string& q,
+                              QueryData& results,
+                              size_t timeout) const {
+  QueryDataSink sink(results);
+  bool expired = false;
+  auto status = queryDeadline(q, sink, timeout, expired);
+  if (expired) {
+    // Rows generated before the cancellation are incomplete.
+    results.clear();
+  }
+  return status;
+}
+
+Status SQLiteSQLPlugin::query(const std::string& q,
+                              ResultSink& results,
+                              size_t timeout) const {
+  // The sink sees rows as they are produced, an expired query's rows are
+  // incomplete and the caller must discard them.
+  bool expired = false;
+  return queryDeadline(q, results, timeout, expired);
+}
+
+size_t SQLiteSQLPlugin::interruptExpired() const {
+  size_t interrupted = 0;
+  std::lock_guard<std::mutex> lock(kDeadlinesMutex);
+  for (const auto& deadline : kDeadlines) {
+    if (deadline.second->cancelled()) {
+      deadline.second->cancel();
+      sqlite3_interrupt(deadline.first);
+      interrupted++;
+    }
+  }
+  return interrupted;
+}
+
 SQLiteDBInstance::SQLiteDBInstance() {
   primary_ = false;
+  pooled_ = false;
+  generation_ = 0;
   sqlite3_open(":memory:", &db_);
   attachVirtualTables(db_);
+  registerFunctions(db_);
 }
 
 SQLiteDBInstance::SQLiteDBInstance(sqlite3*& db) {
   primary_ = true;
+  pooled_ = false;
+  generation_ = 0;
+  db_ = db;
+}
+
+SQLiteDBInstance::SQLiteDBInstance(sqlite3* db, size_t generation) {
+  primary_ = false;
+  pooled_ = true;
+  generation_ = generation;
   db_ = db;
 }
 
 SQLiteDBInstance::~SQLiteDBInstance() {
-  if (!primary_) {
-    sqlite3_close(db_);
-  } else {
+  if (primary_) {
     SQLiteDBManager::unlock();
-    db_ = nullptr;
+  } else if (pooled_) {
+    SQLiteDBManager::release(db_, generation_);
+  } else {
+    sqlite3_close(db_);
   }
+  db_ = nullptr;
 }
 
 void SQLiteDBManager::unlock() { instance().lock_.unlock(); }
@@ -144,20 +257,164 @@ SQLiteDBInstance SQLiteDBManager::get() {
       // Create primary sqlite DB instance.
       sqlite3_open(":memory:", &self.db_);
       attachVirtualTables(self.db_);
+      registerFunctions(self.db_);
     }
     return SQLiteDBInstance(self.db_);
   } else {
-    // If this thread or another has the lock, return a transient db.
+    // If this thread or another has the lock, use a pooled db.
+    return getPooled();
+  }
+}
+
+SQLiteDBInstance SQLiteDBManager::getPooled() {
+  auto& self = instance();
+  std::unique_lock<std::mutex> lock(self.pool_mutex_);
+  size_t limit = (FLAGS_sqlite_pool_size > 0) ? FLAGS_sqlite_pool_size : 0;
+  auto available = [&self, limit]() {
+    return (!self.pool_.empty() || self.pool_size_ < limit);
+  };
+
+  if (!available() && limit > 0) {
+    auto start = std::chrono::steady_clock::now();
+    bool returned = self.pool_cv_.wait_for(lock, kPoolWaitTimeout, available);
+    self.pool_stats_.waits++;
+    self.pool_stats_.wait_usec +=
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    if (!returned) {
+      self.pool_stats_.exhausted++;
+    }
+  }
+
+  if (!available()) {
+    // The pool is disabled or exhausted, the transient is not pooled.
+    lock.unlock();
     VLOG(1) << "DBManager contention: opening transient SQLite database";
     return SQLiteDBInstance();
   }
+
+  self.pool_stats_.checkouts++;
+  auto generation = self.pool_generation_;
+  if (!self.pool_.empty()) {
+    auto db = self.pool_.back();
+    self.pool_.pop_back();
+    return SQLiteDBInstance(db, generation);
+  }
+
+  // Open and attach outside of the pool lock, this is the expensive step.
+  self.pool_size_++;
+  self.pool_stats_.opened++;
+  lock.unlock();
+  sqlite3* db = nullptr;
+  sqlite3_open(":memory:", &db);
+  attachVirtualTables(db);
+  registerFunctions(db);
+  return SQLiteDBInstance(db, generation);
+}
+
+void SQLiteDBManager::release(sqlite3* db, size_t generation) {
+  auto& self = instance();
+  {
+    std::lock_guard<std::mutex> lock(self.pool_mutex_);
+    if (generation == self.pool_generation_) {
+      self.pool_.push_back(db);
+      db = nullptr;
+    } else {
+      self.pool_size_--;
+    }
+  }
+
+  if (db != nullptr) {
+    // Tables were attached or detached while this db was checked out.
+    sqlite3_close(db);
+  }
+  self.pool_cv_.notify_one();
+}
+
+void SQLiteDBManager::resetPool() {
+  auto& self = instance();
+  std::vector<sqlite3*> idle;
+  {
+    std::lock_guard<std::mutex> lock(self.pool_mutex_);
+    idle.swap(self.pool_);
+    self.pool_size_ -= idle.size();
+    self.pool_generation_++;
+  }
+
+  for (auto& db : idle) {
+    sqlite3_close(db);
+  }
+  self.pool_cv_.notify_all();
+}
+
+SQLiteDBPoolStats SQLiteDBManager::getPoolStats() {
+  auto& self = instance();
+  std::lock_guard<std::mutex> lock(self.pool_mutex_);
+  return self.pool_stats_;
+}
+
+sqlite3_stmt* SQLiteDBManager::getStatement(sqlite3* db, const std::string& q) {
+  auto& self = instance();
+  if (db == nullptr || db != self.db_) {
+    return nullptr;
+  }
+
+  auto cached = self.statements_.find(q);
+  if (cached != self.statements_.end()) {
+    return cached->second;
+  }
+
+  sqlite3_stmt* stmt = nullptr;
+  const char* tail = nullptr;
+  int rc = SQLITE_OK;
+  {
+    ProfilePhase phase(&QueryProfile::plan_time);
+    rc = sqlite3_prepare_v2(db, q.c_str(), q.size() + 1, &stmt, &tail);
+  }
+  if (rc != SQLITE_OK || stmt == nullptr) {
+    sqlite3_finalize(stmt);
+    return nullptr;
+  }
+
+  // Only single-statement queries are cached.
+  for (; tail != nullptr && *tail != 0; ++tail) {
+    if (!isspace(*tail) && *tail != ';') {
+      sqlite3_finalize(stmt);
+      return nullptr;
+    }
+  }
+
+  if (self.statements_.size() >= kMaxCachedStatements) {
+    clearStatements(db);
+  }
+  self.statements_[q] = stmt;
+  return stmt;
+}
+
+void SQLiteDBManager::clearStatements(sqlite3* db) {
+  auto& self = instance();
+  if (db == nullptr || db != self.db_) {
+    return;
+  }
+
+  for (auto& statement : self.statements_) {
+    sqlite3_finalize(statement.second);
+  }
+  self.statements_.clear();
 }
 
 SQLiteDBManager::~SQLiteDBManager() {
   if (db_ != nullptr) {
+    // Statements must be finalized before the database is closed.
+    clearStatements(db_);
     sqlite3_close(db_);
     db_ = nullptr;
   }
+
+  for (auto& db : pool_) {
+    sqlite3_close(db);
+  }
+  pool_.clear();
 }
 
 int queryDataCallback(void* argument, int argc, char* argv[], char* column[]) {
@@ -177,17 +434,109 @@ int queryDataCallback(void* argument, int argc, char* argv[], char* column[]) {
   return 0;
 }
 
-Status queryInternal(const std::string& q, QueryData& results, sqlite3* db) {
-  char* err = nullptr;
-  sqlite3_exec(db, q.c_str(), queryDataCallback, &results, &err);
-  if (err != nullptr) {
-    sqlite3_free(err);
-    return Status(1, "Error running query: " + q);
+/// Step a prepared statement to completion, sending each row to a sink.
+static int stepStatement(sqlite3_stmt* stmt, ResultSink& sink) {
+  // Resolve the result columns once, not for every row. Unnamed columns are
+  // omitted, and a repeated name takes the last column's value, as in a Row.
+  std::vector<std::string> names;
+  std::vector<int> indexes;
+  int count = sqlite3_column_count(stmt);
+  for (int i = 0; i < count; i++) {
+    const char* name = sqlite3_column_name(stmt, i);
+    if (name == nullptr) {
+      continue;
+    }
+    auto repeated = std::find(names.begin(), names.end(), name);
+    if (repeated != names.end()) {
+      indexes[repeated - names.begin()] = i;
+    } else {
+      names.push_back(name);
+      indexes.push_back(i);
+    }
+  }
+
+  if (!sink.begin(ColumnSchema::get(names))) {
+    // Every statement in a query must return the same result columns.
+    return SQLITE_MISMATCH;
+  }
+
+  // Tables filtered more than once see the same generated rows.
+  ScopedStatementMemo memo;
+  std::vector<ResultValue> values(indexes.size());
+  int rc;
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    for (size_t i = 0; i < indexes.size(); i++) {
+      auto value = (const char*)sqlite3_column_text(stmt, indexes[i]);
+      if (value != nullptr) {
+        values[i] = ResultValue{value,
+                                (size_t)sqlite3_column_bytes(stmt, indexes[i])};
+      } else {
+        values[i] = ResultValue{"", 0};
+      }
+    }
+    sink.row(values.data());
+    if (sink.full()) {
+      // The caller fails the query, the sink's rows are incomplete.
+      return SQLITE_OK;
+    }
+  }
+  return (rc == SQLITE_DONE) ? SQLITE_OK : rc;
+}
+
+Status queryInternal(const std::string& q, ResultSink& results, sqlite3* db) {
+  // Scheduled queries execute the same text, reuse the parsed query plan.
+  auto cached = SQLiteDBManager::getStatement(db, q);
+  if (cached != nullptr) {
+    int rc = stepStatement(cached, results);
+    sqlite3_reset(cached);
+    if (rc != SQLITE_OK) {
+      return Status(1, "Error running query: " + q);
+    } else if (results.full()) {
+      return Status(1, kQueryResultsLimitError + q);
+    }
+    return Status(0, "OK");
+  }
+
+  // Otherwise prepare and step each statement in the query text.
+  const char* sql = q.c_str();
+  while (sql != nullptr && *sql != 0) {
+    sqlite3_stmt* stmt = nullptr;
+    const char* tail = nullptr;
+    int rc = SQLITE_OK;
+    {
+      ProfilePhase phase(&QueryProfile::plan_time);
+      rc = sqlite3_prepare_v2(db, sql, -1, &stmt, &tail);
+    }
+    if (rc != SQLITE_OK) {
+      return Status(1, "Error running query: " + q);
+    }
+
+    if (stmt != nullptr) {
+      // A null statement is a comment or whitespace.
+      rc = stepStatement(stmt, results);
+      sqlite3_finalize(stmt);
+      if (rc != SQLITE_OK) {
+        return Status(1, "Error running query: " + q);
+      } else if (results.full()) {
+        return Status(1, kQueryResultsLimitError + q);
+      }
+    }
+    sql = tail;
   }
 
   return Status(0, "OK");
 }
 
+Status queryInternal(const std::string& q, QueryData& results, sqlite3* db) {
+  QueryDataSink sink(results);
+  return queryInternal(q, sink, db);
+}
+
+Status queryInternal(const std::string& q, ResultSet& results, sqlite3* db) {
+  ResultSetSink sink(results);
+  return queryInternal(q, sink, db);
+}
+
 Status getQueryColumnsInternal(const std::string& q,
                                TableColumns& columns,
                                sqlite3* db) {
@@ -230,4 +579,72 @@ Status getQueryColumnsInternal(const std::string& q,
 
   return Status(0, "OK");
 }
+
+/// Collect the tables read by a statement while it is prepared.
+static int tableReadAuthorizer(void* argument,
+                               int action,
+                               const char* table,
+                               const char* column,
+                               const char* database,
+                               const char* trigger) {
+  if (action == SQLITE_READ && table != nullptr) {
+    static_cast<std::set<std::string>*>(argument)->insert(table);
+  }
+  return SQLITE_OK;
+}
+
+Status getQueryKeysInternal(const std::string& q,
+                            std::vector<std::string>& keys,
+                            sqlite3* db) {
+  keys.clear();
+
+  std::set<std::string> tables;
+  sqlite3_stmt* stmt = nullptr;
+  sqlite3_set_authorizer(db, tableReadAuthorizer, &tables);
+  int rc = sqlite3_prepare_v2(db, q.c_str(), q.length() + 1, &stmt, nullptr);
+  sqlite3_set_authorizer(db, nullptr, nullptr);
+  if (rc != SQLITE_OK) {
+    sqlite3_finalize(stmt);
+    return Status(1, sqlite3_errmsg(db));
+  }
+
+  std::set<std::string> result_columns;
+  for (int i = 0; i < sqlite3_column_count(stmt); ++i) {
+    result_columns.insert(sqlite3_column_name(stmt, i));
+  }
+  sqlite3_finalize(stmt);
+
+  // Rows of joins and subqueries are not identified by one table's key.
+  if (tables.size() != 1) {
+    return Status(0, "OK");
+  }
+
+  TableDefinition definition;
+  if (!getTableDefinition(*tables.begin(), definition).ok()) {
+    // Only virtual tables declare key columns.
+    return Status(0, "OK");
+  }
+
+  std::vector<std::string> table_keys;
+  for (const auto& column : definition.columns) {
+    if (column.count("op") == 0 || column.count("name") == 0) {
+      continue;
+    }
+    int options = 0;
+    try {
+      options = AS_LITERAL(int, column.at("op"));
+    } catch (const boost::bad_lexical_cast& e) {
+      continue;
+    }
+    if (options & COLUMN_KEY) {
+      if (result_columns.count(column.at("name")) == 0) {
+        // A key column that is not selected cannot identify a row.
+        return Status(0, "OK");
+      }
+      table_keys.push_back(column.at("name"));
+    }
+  }
+  keys = std::move(table_keys);
+  return Status(0, "OK");
+}
 }
@@ -10,9 +10,11 @@
 
 #pragma once
 
+#include <condition_variable>
 #include <map>
 #include <mutex>
 #include <unordered_set>
+#include <vector>
 
 #include <sqlite3.h>
 
@@ -38,11 +40,16 @@ class SQLiteDBInstance {
  public:
   SQLiteDBInstance();
   explicit SQLiteDBInstance(sqlite3*& db);
+  /// Wrap a pooled database, returned to the pool when destructed.
+  SQLiteDBInstance(sqlite3* db, size_t generation);
   ~SQLiteDBInstance();
 
   /// Check if the instance is the osquery primary.
   bool isPrimary() { return primary_; }
 
+  /// Check if the instance was checked out of the connection pool.
+  bool isPooled() { return pooled_; }
+
   /**
    * @brief Accessor to the internal `sqlite3` object, do not store references
    * to the object within osquery code.
@@ -51,9 +58,29 @@ class SQLiteDBInstance {
 
  private:
   bool primary_;
+  bool pooled_;
+  /// The pool generation, tables attached since then invalidate the database.
+  size_t generation_;
   sqlite3* db_;
 };
 
+/// Counters describing the SQLite connection pool use.
+struct SQLiteDBPoolStats {
+  /// Number of pooled connections checked out.
+  size_t checkouts;
+  /// Number of pooled connections opened and attached.
+  size_t opened;
+  /// Number of checkouts that waited for a connection to be returned.
+  size_t waits;
+  /// Total time spent waiting for a pooled connection, in microseconds.
+  size_t wait_usec;
+  /// Number of checkouts that timed out and used a transient database.
+  size_t exhausted;
+
+  SQLiteDBPoolStats()
+      : checkouts(0), opened(0), waits(0), wait_usec(0), exhausted(0) {}
+};
+
 /**
  * @brief osquery internal SQLite DB abstraction resource management.
  *
@@ -91,6 +118,17 @@ class SQLiteDBManager : private boost::noncopyable {
   /// See `get` but always return a transient DB connection (for testing).
   static SQLiteDBInstance getUnique();
 
+  /**
+   * @brief Close idle pooled connections and invalidate checked out ones.
+   *
+   * Pooled connections attach every table when opened, call this when tables
+   * are attached or detached such that future checkouts see the change.
+   */
+  static void resetPool();
+
+  /// Return a copy of the connection pool counters.
+  static SQLiteDBPoolStats getPoolStats();
+
   /**
    * @brief Check if `table_name` is disabled.
    *
@@ -105,6 +143,27 @@ class SQLiteDBManager : private boost::noncopyable {
   /// When the primary SQLiteDBInstance is destructed it will unlock.
   static void unlock();
 
+  /**
+   * @brief Get a cached prepared statement for a query.
+   *
+   * Statements are only cached for the primary database, keyed by the query
+   * text. The caller must hold the primary SQLiteDBInstance and should reset,
+   * not finalize, the statement after stepping.
+   *
+   * @param db The database the query will execute on.
+   * @param q A single-statement SQL query.
+   * @return A prepared statement, or nullptr if the query is not cacheable.
+   */
+  static sqlite3_stmt* getStatement(sqlite3* db, const std::string& q);
+
+  /**
+   * @brief Finalize the cached prepared statements.
+   *
+   * Attaching and detaching tables changes the schema, cached statements
+   * are removed if db is the primary database.
+   */
+  static void clearStatements(sqlite3* db);
+
  protected:
   SQLiteDBManager() : db_(nullptr), lock_(mutex_, boost::defer_lock) {
     disabled_tables_ = parseDisableTablesFlag(Flag::getValue("disable_tables"));
@@ -113,6 +172,12 @@ class SQLiteDBManager : private boost::noncopyable {
   SQLiteDBManager& operator=(SQLiteDBManager const&);
   virtual ~SQLiteDBManager();
 
+  /// Check out a pooled connection, waiting briefly if all are in use.
+  static SQLiteDBInstance getPooled();
+
+  /// Return a pooled connection from a SQLiteDBInstance.
+  static void release(sqlite3* db, size_t generation);
+
  private:
   /// Primary (managed) sqlite3 database.
   sqlite3* db_;
@@ -122,6 +187,23 @@ class SQLiteDBManager : private boost::noncopyable {
   boost::unique_lock<boost::mutex> lock_;
   /// Member variable to hold set of disabled tables.
   std::unordered_set<std::string> disabled_tables_;
+  /// Prepared statements for the primary database, keyed by query text.
+  std::map<std::string, sqlite3_stmt*> statements_;
+
+  /// Idle pooled databases with all virtual tables attached.
+  std::vector<sqlite3*> pool_;
+  /// Number of pooled databases, idle and checked out.
+  size_t pool_size_{0};
+  /// Incremented when tables attach or detach, stale databases are closed.
+  size_t pool_generation_{0};
+  /// Mutex and condition around pool access.
+  std::mutex pool_mutex_;
+  std::condition_variable pool_cv_;
+  /// Pool usage counters.
+  SQLiteDBPoolStats pool_stats_;
+
+ private:
+  friend class SQLiteDBInstance;
   /// Parse a comma-delimited set of tables names, passed in as a flag.
   std::unordered_set<std::string> parseDisableTablesFlag(const std::string& s);
 };
@@ -141,6 +223,22 @@ class SQLiteDBManager : private boost::noncopyable {
  */
 Status queryInternal(const std::string& q, QueryData& results, sqlite3* db);
 
+/**
+ * @brief SQLite Internal: Execute a query into a ResultSet
+ *
+ * Values are copied from SQLite into the result set's arena without a Row
+ * per result. Every statement in the query must return the same columns.
+ */
+Status queryInternal(const std::string& q, ResultSet& results, sqlite3* db);
+
+/**
+ * @brief SQLite Internal: Execute a query, sending each row to a sink
+ *
+ * The column names of each statement are resolved once into a shared
+ * ColumnSchema, and values are passed from SQLite's buffers without a copy.
+ */
+Status queryInternal(const std::string& q, ResultSink& results, sqlite3* db);
+
 /**
  * @brief SQLite Intern: Analyze a query, providing information about the
  * result columns
@@ -160,25 +258,65 @@ Status getQueryColumnsInternal(const std::string& q,
                                TableColumns& columns,
                                sqlite3* db);
 
+/**
+ * @brief SQLite Intern: Get the key columns of a query's results
+ *
+ * A query reading a single table has that table's key columns, if every key
+ * column is a result column. Other queries have no key columns.
+ *
+ * @param q the query to analyze
+ * @param keys the output key column names
+ * @param db the SQLite3 database to perform the analysis on
+ *
+ * @return status indicating success or failure of the operation
+ */
+Status getQueryKeysInternal(const std::string& q,
+                            std::vector<std::string>& keys,
+                            sqlite3* db);
+
 /// The SQLiteSQLPlugin implements the "sql" registry for internal/core.
-class SQLiteSQLPlugin : SQLPlugin {
+class SQLiteSQLPlugin : public SQLPlugin {
  public:
   Status query(const std::string& q, QueryData& results) const {
     auto dbc = SQLiteDBManager::get();
     return queryInternal(q, results, dbc.db());
   }
 
+  /// Run a query, the database is interrupted if it exceeds the timeout.
+  Status query(const std::string& q, QueryData& results, size_t timeout) const;
+
+  /// Run a query, sending each row to a sink as SQLite steps.
+  Status query(const std::string& q, ResultSink& results, size_t timeout) const;
+
+  /// Call sqlite3_interrupt for each query that exceeded its timeout.
+  size_t interruptExpired() const;
+
   Status getQueryColumns(const std::string& q, TableColumns& columns) const {
     auto dbc = SQLiteDBManager::get();
     return getQueryColumnsInternal(q, columns, dbc.db());
   }
 
+  Status getQueryKeys(const std::string& q,
+                      std::vector<std::string>& keys) const {
+    auto dbc = SQLiteDBManager::get();
+    return getQueryKeysInternal(q, keys, dbc.db());
+  }
+
   /// Create a SQLite module and attach (CREATE).
   Status attach(const std::string& name);
   /// Detach a virtual table (DROP).
   void detach(const std::string& name);
 };
 
+/**
+ * @brief Register osquery's scalar SQL functions with a database.
+ *
+ * Queries filter rows on the host with regex_match, in_cidr, path_glob, and
+ * split_part, instead of logging every row. A constant pattern is compiled
+ * once for each statement.
+ */
+void registerFunctions(sqlite3* db);
+
 /**
  * @brief Get a string representation of a SQLite return code
  */
@@ -63,4 +63,22 @@ TEST_F(SQLTests, test_raw_access_context) {
   EXPECT_EQ(results.size(), 2);
   EXPECT_EQ(results[0]["test_int"], "0");
 }
+
+TEST_F(SQLTests, test_generate_from_context) {
+  Registry::add<TestTablePlugin>("table", "test_context");
+
+  // Local tables are passed the context without serializing it.
+  QueryContext ctx;
+  ctx.constraints["test_int"].add(Constraint(EQUALS, "1"));
+  PluginResponse response;
+  auto status =
+      TablePlugin::generateFromContext("test_context", ctx, response);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(response.size(), 2U);
+  EXPECT_EQ(response[0]["test_int"], "1");
+
+  status = TablePlugin::generateFromContext("not_a_table", ctx, response);
+  EXPECT_FALSE(status.ok());
+  EXPECT_TRUE(response.empty());
+}
 }
@@ -8,7 +8,10 @@
  *
  */
 
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <thread>
 
 #include <gtest/gtest.h>
 
@@ -20,6 +23,8 @@
 
 namespace osquery {
 
+DECLARE_int32(sqlite_pool_size);
+
 class SQLiteUtilTests : public testing::Test {};
 
 SQLiteDBInstance getTestDBC() {
@@ -70,6 +75,46 @@ TEST_F(SQLiteUtilTests, test_sqlite_instance) {
   EXPECT_EQ(internal_db, SQLiteDBManager::get().db());
 }
 
+TEST_F(SQLiteUtilTests, test_sqlite_pool) {
+  auto primary = SQLiteDBManager::get();
+  ASSERT_TRUE(primary.isPrimary());
+
+  sqlite3* pooled_db = nullptr;
+  {
+    // Contended requests check out pooled databases.
+    auto dbc = SQLiteDBManager::get();
+    EXPECT_TRUE(dbc.isPooled());
+    pooled_db = dbc.db();
+  }
+
+  auto stats = SQLiteDBManager::getPoolStats();
+  {
+    // The returned database is reused without attaching tables again.
+    auto dbc = SQLiteDBManager::get();
+    EXPECT_TRUE(dbc.isPooled());
+    EXPECT_EQ(dbc.db(), pooled_db);
+  }
+  EXPECT_EQ(SQLiteDBManager::getPoolStats().opened, stats.opened);
+  EXPECT_EQ(SQLiteDBManager::getPoolStats().checkouts, stats.checkouts + 1);
+
+  // An exhausted pool falls back to a transient database.
+  FLAGS_sqlite_pool_size = 1;
+  {
+    auto dbc1 = SQLiteDBManager::get();
+    auto dbc2 = SQLiteDBManager::get();
+    EXPECT_TRUE(dbc1.isPooled());
+    EXPECT_FALSE(dbc2.isPooled());
+    EXPECT_FALSE(dbc2.isPrimary());
+  }
+  EXPECT_EQ(SQLiteDBManager::getPoolStats().exhausted, stats.exhausted + 1);
+  FLAGS_sqlite_pool_size = 4;
+
+  // Resetting the pool closes idle databases.
+  SQLiteDBManager::resetPool();
+  auto dbc = SQLiteDBManager::get();
+  EXPECT_EQ(SQLiteDBManager::getPoolStats().opened, stats.opened + 1);
+}
+
 TEST_F(SQLiteUtilTests, test_direct_query_execution) {
   auto dbc = getTestDBC();
   QueryData results;
@@ -78,6 +123,127 @@ TEST_F(SQLiteUtilTests, test_direct_query_execution) {
   EXPECT_EQ(results, getTestDBExpectedResults());
 }
 
+TEST_F(SQLiteUtilTests, test_multiple_statement_query) {
+  auto dbc = getTestDBC();
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT 1 AS a; SELECT 2 AS a, NULL AS b;", results, dbc.db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[1]["a"], "2");
+  EXPECT_EQ(results[1]["b"], "");
+
+  status = queryInternal("SELECT * FROM not_a_table", results, dbc.db());
+  EXPECT_FALSE(status.ok());
+}
+
+TEST_F(SQLiteUtilTests, test_result_set_query) {
+  auto dbc = getTestDBC();
+  ResultSet results;
+  auto status = queryInternal(kTestQuery, results, dbc.db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.toQueryData(), getTestDBExpectedResults());
+
+  // Statements with different result columns cannot share a ResultSet.
+  ResultSet mixed;
+  status = queryInternal(
+      "SELECT 1 AS a; SELECT 2 AS a, NULL AS b;", mixed, dbc.db());
+  EXPECT_FALSE(status.ok());
+}
+
+/// A ResultSink counting rows and values.
+class CountingResultSink : public ResultSink {
+ public:
+  bool begin(const ColumnSchemaRef& schema) {
+    schema_ = schema;
+    return true;
+  }
+
+  void row(const ResultValue* values) {
+    rows++;
+    for (size_t i = 0; i < schema_->size(); ++i) {
+      bytes += values[i].size;
+    }
+  }
+
+  size_t rows{0};
+  size_t bytes{0};
+
+ private:
+  ColumnSchemaRef schema_{nullptr};
+};
+
+TEST_F(SQLiteUtilTests, test_result_sink_query) {
+  auto dbc = getTestDBC();
+  CountingResultSink sink;
+  auto status = queryInternal(kTestQuery, sink, dbc.db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(sink.rows, getTestDBExpectedResults().size());
+  EXPECT_GT(sink.bytes, 0U);
+
+  // A repeated column name takes the last value, as it would in a Row.
+  QueryData results;
+  status = queryInternal("SELECT 1 AS a, 2 AS b, 3 AS a", results, dbc.db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results, QueryData({{{"a", "3"}, {"b", "2"}}}));
+
+  ResultSet rs;
+  status = queryInternal("SELECT 1 AS a, 2 AS b, 3 AS a", rs, dbc.db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(rs.columns(), 2U);
+  EXPECT_EQ(rs.toQueryData(), results);
+}
+
+TEST_F(SQLiteUtilTests, test_result_size_limit) {
+  auto dbc = getTestDBC();
+  QueryData results;
+  QueryDataSink sink(results, 1);
+  auto status = queryInternal(kTestQuery, sink, dbc.db());
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(status.getMessage().find(kQueryResultsLimitError), 0U);
+  EXPECT_TRUE(sink.full());
+  EXPECT_LT(results.size(), getTestDBExpectedResults().size());
+
+  // The limit stops a ResultSet too.
+  ResultSet rs;
+  ResultSetSink rs_sink(rs, 1);
+  status = queryInternal(kTestQuery, rs_sink, dbc.db());
+  EXPECT_FALSE(status.ok());
+  EXPECT_TRUE(rs_sink.full());
+
+  // Without a limit the results are complete.
+  results.clear();
+  QueryDataSink unlimited(results);
+  status = queryInternal(kTestQuery, unlimited, dbc.db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_FALSE(unlimited.full());
+  EXPECT_EQ(results.size(), getTestDBExpectedResults().size());
+}
+
+TEST_F(SQLiteUtilTests, test_statement_cache) {
+  auto dbc = SQLiteDBManager::get();
+  ASSERT_TRUE(dbc.isPrimary());
+
+  // Only primary database statements are cached.
+  auto transient = SQLiteDBManager::getUnique();
+  EXPECT_EQ(SQLiteDBManager::getStatement(transient.db(), "SELECT 1"),
+            nullptr);
+  EXPECT_EQ(SQLiteDBManager::getStatement(dbc.db(), "SELECT 1; SELECT 2"),
+            nullptr);
+
+  auto stmt = SQLiteDBManager::getStatement(dbc.db(), "SELECT 1 AS one");
+  ASSERT_NE(stmt, nullptr);
+  EXPECT_EQ(SQLiteDBManager::getStatement(dbc.db(), "SELECT 1 AS one"), stmt);
+
+  QueryData results;
+  EXPECT_TRUE(queryInternal("SELECT 1 AS one", results, dbc.db()).ok());
+  EXPECT_TRUE(queryInternal("SELECT 1 AS one", results, dbc.db()).ok());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[1]["one"], "1");
+
+  SQLiteDBManager::clearStatements(dbc.db());
+}
+
 TEST_F(SQLiteUtilTests, test_passing_callback_no_data_param) {
   char* err = nullptr;
   auto dbc = getTestDBC();
@@ -140,4 +306,86 @@ TEST_F(SQLiteUtilTests, test_get_query_columns) {
   status = getQueryColumnsInternal(query, results, dbc.db());
   ASSERT_FALSE(status.ok());
 }
+
+TEST_F(SQLiteUtilTests, test_query_timeout) {
+  SQLiteSQLPlugin plugin;
+  // Nothing is running, there is nothing to interrupt.
+  EXPECT_EQ(plugin.interruptExpired(), 0U);
+
+  Status status;
+  std::atomic<bool> done(false);
+  std::thread runner([&plugin, &status, &done]() {
+    QueryData results;
+    status = plugin.query(
+        "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c) "
+        "SELECT count(*) FROM c",
+        results,
+        1);
+    done = true;
+  });
+
+  // The query never completes, it must be interrupted after its deadline.
+  size_t interrupted = 0;
+  for (size_t i = 0; i < 100 && !done; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    interrupted += plugin.interruptExpired();
+  }
+  runner.join();
+  EXPECT_GT(interrupted, 0U);
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(plugin.interruptExpired(), 0U);
+}
+
+TEST_F(SQLiteUtilTests, test_sql_functions) {
+  auto dbc = SQLiteDBManager::getUnique();
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT regex_match('osqueryd', '^os.*d$') AS a, "
+      "regex_match('osquery', '[0-9]+') AS b, "
+      "in_cidr('10.1.2.3', '10.0.0.0/8') AS c, "
+      "in_cidr('11.1.2.3', '10.0.0.0/8') AS d, "
+      "in_cidr('::ffff:192.168.1.5', '192.168.0.0/23') AS e, "
+      "in_cidr('fe80::1', 'fe80::/10') AS f, "
+      "path_glob('/usr/bin/ls', '/usr/*/ls') AS g, "
+      "path_glob('/usr/local/bin/ls', '/usr/*/ls') AS h, "
+      "path_glob('/usr/local/bin/ls', '/usr/**/l[!x]') AS i, "
+      "split_part('a:b::c', ':', 2) AS j, "
+      "split_part('a:b::c', ':', 4) AS k, "
+      "split_part('a:b', ':', 3) AS l",
+      results,
+      dbc.db());
+  ASSERT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 1U);
+  auto& r = results[0];
+  EXPECT_EQ(r["a"], "1");
+  EXPECT_EQ(r["b"], "0");
+  EXPECT_EQ(r["c"], "1");
+  EXPECT_EQ(r["d"], "0");
+  EXPECT_EQ(r["e"], "1");
+  EXPECT_EQ(r["f"], "1");
+  EXPECT_EQ(r["g"], "1");
+  EXPECT_EQ(r["h"], "0");
+  EXPECT_EQ(r["i"], "1");
+  EXPECT_EQ(r["j"], "b");
+  EXPECT_EQ(r["k"], "c");
+  EXPECT_EQ(r["l"], "");
+
+  // A pattern is compiled once for the rows of a statement.
+  results.clear();
+  status = queryInternal(
+      "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c "
+      "LIMIT 1000) SELECT count(*) AS n FROM c "
+      "WHERE in_cidr('10.0.' || (x % 256) || '.1', '10.0.0.0/24')",
+      results,
+      dbc.db());
+  ASSERT_TRUE(status.ok());
+  EXPECT_EQ(results[0]["n"], "3");
+
+  // Invalid patterns fail the query.
+  results.clear();
+  EXPECT_FALSE(
+      queryInternal("SELECT regex_match('a', '(')", results, dbc.db()).ok());
+  EXPECT_FALSE(
+      queryInternal("SELECT in_cidr('a', '10/33')", results, dbc.db()).ok());
+}
 }
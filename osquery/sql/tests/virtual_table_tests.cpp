@@ -14,6 +14,7 @@
 #include <osquery/registry.h>
 #include <osquery/sql.h>
 
+#include "osquery/core/profiler.h"
 #include "osquery/sql/virtual_table.h"
 
 namespace osquery {
@@ -64,4 +65,808 @@ TEST_F(VirtualTableTests, test_sqlite3_attach_vtable) {
   EXPECT_EQ("CREATE VIRTUAL TABLE sample USING sample(foo INTEGER, bar TEXT)",
             results[0]["sql"]);
 }
+
+TEST_F(VirtualTableTests, test_virtual_table_buffer) {
+  TableColumns columns = {
+      {"i", "INTEGER"}, {"t", "TEXT"}, {"b", "BIGINT"}, {"d", "DOUBLE"}};
+  VirtualTableBuffer buffer;
+  buffer.reset({INTEGER_TYPE, TEXT_TYPE, BIGINT_TYPE, DOUBLE_TYPE});
+  buffer.append({{"i", "1"}, {"t", "hello"}, {"b", "4294967296"}, {"d", "1.5"}},
+                columns);
+  // Missing and invalid values are cast using the column type defaults.
+  buffer.append({{"i", "not_int"}, {"d", "0.25"}}, columns);
+  EXPECT_EQ(buffer.rows(), 2U);
+
+  EXPECT_EQ(buffer.value(0, 0).integer, 1);
+  const auto& text = buffer.value(0, 1);
+  EXPECT_EQ(std::string(buffer.text(text), text.text.size), "hello");
+  EXPECT_EQ(buffer.value(0, 2).integer, 4294967296LL);
+  EXPECT_EQ(buffer.value(0, 3).real, 1.5);
+
+  EXPECT_EQ(buffer.value(1, 0).integer, -1);
+  EXPECT_EQ(buffer.value(1, 1).text.size, 0U);
+  EXPECT_EQ(buffer.value(1, 2).integer, -1);
+  EXPECT_EQ(buffer.value(1, 3).real, 0.25);
+
+  buffer.clear();
+  EXPECT_EQ(buffer.rows(), 0U);
+}
+
+class typedTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {
+        {"i", "INTEGER"}, {"t", "TEXT"}, {"b", "BIGINT"}, {"d", "DOUBLE"},
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) {
+    QueryData results;
+    results.push_back({{"i", "1"}, {"t", "a"}, {"b", "10"}, {"d", "0.5"}});
+    results.push_back({{"i", "2"}, {"t", "b"}, {"b", "20"}, {"d", "1.5"}});
+    return results;
+  }
+};
+
+TEST_F(VirtualTableTests, test_typed_columns) {
+  Registry::add<typedTablePlugin>("table", "typed");
+  auto dbc = SQLiteDBManager::get();
+  attachTableInternal("typed", "(i INTEGER, t TEXT, b BIGINT, d DOUBLE)",
+                      dbc.db());
+
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT i + 1 AS i, t, b * 2 AS b, d FROM typed WHERE i > 1",
+      results,
+      dbc.db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["i"], "3");
+  EXPECT_EQ(results[0]["t"], "b");
+  EXPECT_EQ(results[0]["b"], "40");
+  EXPECT_EQ(results[0]["d"], "1.5");
+}
+
+class nativeTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {
+        {"i", "INTEGER"}, {"t", "TEXT"}, {"b", "BIGINT"}, {"d", "DOUBLE"},
+    };
+  }
+
+ public:
+  bool typedRows() const { return true; }
+
+  void generateTypedRows(QueryContext& context, const TypedRowYield& yield) {
+    for (int i = 1; i <= 3; ++i) {
+      TypedRow r;
+      r["i"] = i;
+      r["t"] = i * 100;
+      r["b"] = (long long)i << 40;
+      r["d"] = i + 0.5;
+      if (!yield(r)) {
+        break;
+      }
+    }
+  }
+};
+
+TEST_F(VirtualTableTests, test_native_columns) {
+  Registry::add<nativeTablePlugin>("table", "native");
+  auto dbc = SQLiteDBManager::get();
+  attachTableInternal("native", "(i INTEGER, t TEXT, b BIGINT, d DOUBLE)",
+                      dbc.db());
+
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT i, t, b, d, typeof(t) AS tt FROM native WHERE b > 1099511627776",
+      results,
+      dbc.db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[0]["i"], "2");
+  EXPECT_EQ(results[0]["t"], "200");
+  EXPECT_EQ(results[0]["tt"], "text");
+  EXPECT_EQ(results[0]["b"], "2199023255552");
+  EXPECT_EQ(results[0]["d"], "2.5");
+
+  // Serialized generation formats the native values.
+  auto plugin = std::make_shared<nativeTablePlugin>();
+  PluginResponse response;
+  status = plugin->call({{"action", "generate"}}, response);
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(response.size(), 3U);
+  EXPECT_EQ(response[2]["i"], "3");
+  EXPECT_EQ(response[2]["b"], "3298534883328");
+  EXPECT_EQ(response[2]["d"], "3.5");
+}
+
+class columnTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {
+        {"i", "INTEGER"}, {"t", "TEXT"}, {"d", "DOUBLE"},
+    };
+  }
+
+ public:
+  bool columnRows() const { return true; }
+
+  void generateColumnRows(QueryContext& context, const ColumnRowYield& yield) {
+    for (int i = 1; i <= 3; ++i) {
+      // Values are set by ordinal, as a generated row struct sets them.
+      ColumnRow r(3);
+      r[0] = i;
+      r[1] = "row" + std::to_string(i);
+      if (i != 2) {
+        r[2] = i + 0.5;
+      }
+      if (!yield(r)) {
+        break;
+      }
+    }
+  }
+};
+
+TEST_F(VirtualTableTests, test_column_rows) {
+  Registry::add<columnTablePlugin>("table", "column_rows");
+  auto dbc = SQLiteDBManager::get();
+  attachTableInternal(
+      "column_rows", "(i INTEGER, t TEXT, d DOUBLE)", dbc.db());
+
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT i, t, d FROM column_rows WHERE i >= 2", results, dbc.db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[0]["i"], "2");
+  EXPECT_EQ(results[0]["t"], "row2");
+  EXPECT_EQ(results[1]["d"], "3.5");
+
+  // Serialized generation names each value by its column.
+  auto plugin = std::make_shared<columnTablePlugin>();
+  PluginResponse response;
+  status = plugin->call({{"action", "generate"}}, response);
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(response.size(), 3U);
+  EXPECT_EQ(response[0]["t"], "row1");
+  EXPECT_EQ(response[0]["d"], "1.5");
+  EXPECT_EQ(response[1]["d"], "");
+}
+
+class streamingTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const { return {{"n", "INTEGER"}}; }
+
+ public:
+  void generateRows(QueryContext& context, const RowYield& yield) {
+    for (size_t i = 0; i < 10; ++i) {
+      Row r = {{"n", std::to_string(i)}};
+      generated++;
+      if (!yield(r)) {
+        break;
+      }
+    }
+  }
+
+  size_t generated{0};
+};
+
+TEST_F(VirtualTableTests, test_streaming_generate) {
+  auto plugin = std::make_shared<streamingTablePlugin>();
+
+  // The serialized plugin call collects every yielded row.
+  PluginResponse response;
+  auto status = plugin->call({{"action", "generate"}}, response);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(response.size(), 10U);
+  EXPECT_EQ(plugin->generated, 10U);
+
+  // A yield returning false stops the generator.
+  plugin->generated = 0;
+  QueryContext context;
+  plugin->generateRows(context, [](Row& row) { return row["n"] != "2"; });
+  EXPECT_EQ(plugin->generated, 3U);
+}
+
+TEST_F(VirtualTableTests, test_streaming_table) {
+  Registry::add<streamingTablePlugin>("table", "streaming");
+  auto dbc = SQLiteDBManager::get();
+  attachTableInternal("streaming", "(n INTEGER)", dbc.db());
+
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT n FROM streaming WHERE n > 6", results, dbc.db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 3U);
+  EXPECT_EQ(results[0]["n"], "7");
+}
+
+class endlessTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const { return {{"n", "INTEGER"}}; }
+
+ public:
+  void generateRows(QueryContext& context, const RowYield& yield) {
+    // Generate until the yield stops, only a cancellation stops it.
+    for (size_t i = 0;; ++i) {
+      Row r = {{"n", std::to_string(i)}};
+      if (!yield(r)) {
+        break;
+      }
+    }
+  }
+};
+
+TEST_F(VirtualTableTests, test_cancelled_table) {
+  Registry::add<endlessTablePlugin>("table", "endless");
+  auto dbc = SQLiteDBManager::get();
+  attachTableInternal("endless", "(n INTEGER)", dbc.db());
+
+  // A cancelled query stops the generator and returns no partial results.
+  QueryCancellation cancellation(0);
+  cancellation.cancel();
+  ScopedQueryCancellation scope(&cancellation);
+  QueryData results;
+  auto status = queryInternal("SELECT n FROM endless", results, dbc.db());
+  EXPECT_FALSE(status.ok());
+  EXPECT_TRUE(results.empty());
+}
+
+TEST_F(VirtualTableTests, test_query_deadline) {
+  QueryCancellation cancellation(0);
+  EXPECT_FALSE(cancellation.cancelled());
+  EXPECT_FALSE(isQueryCancelled());
+
+  {
+    ScopedQueryCancellation scope(&cancellation);
+    EXPECT_EQ(getQueryCancellation(), &cancellation);
+    cancellation.cancel();
+    EXPECT_TRUE(isQueryCancelled());
+  }
+  EXPECT_EQ(getQueryCancellation(), nullptr);
+
+  // The plugin's timeout cancels an endless generator at its deadline.
+  Registry::add<endlessTablePlugin>("table", "endless_deadline");
+  {
+    auto dbc = SQLiteDBManager::get();
+    attachTableInternal("endless_deadline", "(n INTEGER)", dbc.db());
+  }
+  QueryData results;
+  auto status =
+      SQLiteSQLPlugin().query("SELECT n FROM endless_deadline", results, 1);
+  EXPECT_FALSE(status.ok());
+  EXPECT_TRUE(results.empty());
+}
+
+class limitedTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const { return {{"n", "INTEGER"}}; }
+
+ public:
+  void generateRows(QueryContext& context, const RowYield& yield) {
+    for (size_t i = 0; i < 10; ++i) {
+      Row r = {{"n", std::to_string(i)}};
+      generated++;
+      if (!yield(r)) {
+        break;
+      }
+    }
+  }
+
+  static size_t generated;
+};
+
+size_t limitedTablePlugin::generated = 0;
+
+TEST_F(VirtualTableTests, test_limit_pushdown) {
+  Registry::add<limitedTablePlugin>("table", "limited");
+  auto dbc = SQLiteDBManager::get();
+  attachTableInternal("limited", "(n INTEGER)", dbc.db());
+
+  QueryData results;
+  limitedTablePlugin::generated = 0;
+  auto status = queryInternal(
+      "SELECT n FROM limited WHERE n > 5 LIMIT 2", results, dbc.db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[1]["n"], "7");
+#ifdef SQLITE_INDEX_CONSTRAINT_LIMIT
+  // Only rows matching the constraints count toward the limit.
+  EXPECT_EQ(limitedTablePlugin::generated, 8U);
+#endif
+
+  results.clear();
+  status = queryInternal(
+      "SELECT n FROM limited LIMIT 2 OFFSET 3", results, dbc.db());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[0]["n"], "3");
+
+  // The limit cannot be applied if SQLite must filter the rows.
+  results.clear();
+  limitedTablePlugin::generated = 0;
+  status = queryInternal(
+      "SELECT n FROM limited WHERE n LIKE '%9' LIMIT 1", results, dbc.db());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["n"], "9");
+  EXPECT_EQ(limitedTablePlugin::generated, 10U);
+}
+
+class indexedTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {{"pid", "INTEGER"}, {"path", "TEXT"}};
+  }
+
+  TableColumnOptions columnOptions() const {
+    return {{"pid", COLUMN_INDEX}};
+  }
+
+  size_t cardinality() const { return 100; }
+
+ public:
+  QueryData generate(QueryContext& context) {
+    QueryData results;
+    if (!context.constraints["pid"].exists(EQUALS) &&
+        !context.constraints["path"].exists(EQUALS)) {
+      scans++;
+      return results;
+    }
+
+    for (const auto& pid : context.constraints["pid"].getAll(EQUALS)) {
+      results.push_back({{"pid", pid}, {"path", "/"}});
+    }
+    for (const auto& path : context.constraints["path"].getAll(EQUALS)) {
+      results.push_back({{"pid", "1"}, {"path", path}});
+    }
+    return results;
+  }
+
+  static size_t scans;
+};
+
+size_t indexedTablePlugin::scans = 0;
+
+class requiredTablePlugin : public indexedTablePlugin {
+ private:
+  TableColumnOptions columnOptions() const {
+    return {{"path", COLUMN_REQUIRED}};
+  }
+};
+
+TEST_F(VirtualTableTests, test_index_hints) {
+  auto table = std::make_shared<indexedTablePlugin>();
+  PluginResponse response;
+  EXPECT_TRUE(table->call({{"action", "columns"}}, response).ok());
+  ASSERT_EQ(response.size(), 2U);
+  EXPECT_EQ(response[0]["op"], std::to_string(COLUMN_INDEX));
+  EXPECT_TRUE(table->call({{"action", "attributes"}}, response).ok());
+  ASSERT_EQ(response.size(), 1U);
+  EXPECT_EQ(response[0]["cardinality"], "100");
+
+  Registry::add<indexedTablePlugin>("table", "indexed");
+  auto dbc = SQLiteDBManager::get();
+  attachTableInternal("indexed", "(pid INTEGER, path TEXT)", dbc.db());
+  Registry::add<requiredTablePlugin>("table", "required");
+  attachTableInternal("required", "(pid INTEGER, path TEXT)", dbc.db());
+  attachTableInternal("typed", "(i INTEGER, t TEXT, b BIGINT, d DOUBLE)",
+                      dbc.db());
+
+  // The indexed table should be planned as the inner loop, using lookups.
+  QueryData results;
+  indexedTablePlugin::scans = 0;
+  auto status = queryInternal(
+      "SELECT i, path FROM indexed JOIN typed ON indexed.pid = typed.i",
+      results,
+      dbc.db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 2U);
+  EXPECT_EQ(indexedTablePlugin::scans, 0U);
+
+  results.clear();
+  status = queryInternal(
+      "SELECT i, path FROM required JOIN typed ON required.path = typed.t",
+      results,
+      dbc.db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(indexedTablePlugin::scans, 0U);
+}
+
+TEST_F(VirtualTableTests, test_query_profile_plans) {
+  Registry::add<indexedTablePlugin>("table", "indexed");
+  auto dbc = SQLiteDBManager::get();
+  attachTableInternal("indexed", "(pid INTEGER, path TEXT)", dbc.db());
+  attachTableInternal("typed", "(i INTEGER, t TEXT, b BIGINT, d DOUBLE)",
+                      dbc.db());
+
+  QueryProfile profile;
+  QueryData results;
+  {
+    ScopedQueryProfile profiler(profile);
+    auto status = queryInternal(
+        "SELECT i, pid FROM indexed JOIN typed ON indexed.pid = typed.i "
+        "WHERE typed.b > 0",
+        results,
+        dbc.db());
+    EXPECT_TRUE(status.ok());
+  }
+
+  // The indexed table is filtered once for each row of the outer table.
+  ASSERT_EQ(profile.tables.count("indexed"), 1U);
+  const auto& indexed = profile.tables["indexed"];
+  EXPECT_EQ(indexed.filters, 2U);
+  EXPECT_EQ(indexed.rows, results.size());
+  bool lookup = false;
+  for (const auto& plan : indexed.plans) {
+    if (plan.constraints == "pid =") {
+      lookup = true;
+      EXPECT_EQ(plan.filters, 2U);
+    } else {
+      EXPECT_EQ(plan.filters, 0U);
+    }
+  }
+  EXPECT_TRUE(lookup);
+
+  ASSERT_EQ(profile.tables.count("typed"), 1U);
+  EXPECT_EQ(profile.tables["typed"].filters, 1U);
+  EXPECT_EQ(profile.table_times.size(), 2U);
+}
+
+class cachedTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const { return {{"n", "INTEGER"}}; }
+
+  size_t cacheTTL() const { return 60; }
+
+ public:
+  QueryData generate(QueryContext& context) {
+    generated++;
+    return {{{"n", std::to_string(generated)}}};
+  }
+
+  static size_t generated;
+};
+
+size_t cachedTablePlugin::generated = 0;
+
+TEST_F(VirtualTableTests, test_table_cache) {
+  Registry::add<cachedTablePlugin>("table", "cached");
+  auto dbc = SQLiteDBManager::get();
+  attachTableInternal("cached", "(n INTEGER)", dbc.db());
+
+  QueryData results;
+  auto status = queryInternal("SELECT n FROM cached", results, dbc.db());
+  EXPECT_TRUE(status.ok());
+  status = queryInternal("SELECT n FROM cached", results, dbc.db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 2U);
+  // The second query within the TTL is served the cached results.
+  EXPECT_EQ(results[1]["n"], "1");
+  EXPECT_EQ(cachedTablePlugin::generated, 1U);
+
+  // Both invocations, and the rows and bytes returned, are recorded.
+  auto stats = VirtualTableStatsRegistry::instance().get();
+  ASSERT_EQ(stats.count("cached"), 1U);
+  EXPECT_EQ(stats["cached"].invocations, 2U);
+  EXPECT_EQ(stats["cached"].cache_hits, 1U);
+  EXPECT_EQ(stats["cached"].rows, 2U);
+  EXPECT_EQ(stats["cached"].bytes, 2U);
+
+  // Results are cached per-context.
+  results.clear();
+  status = queryInternal(
+      "SELECT n FROM cached WHERE n > 0", results, dbc.db());
+  EXPECT_EQ(cachedTablePlugin::generated, 2U);
+
+  // The flag overrides the table's TTL.
+  FLAGS_table_cache_ttl = "cached:0";
+  results.clear();
+  status = queryInternal("SELECT n FROM cached", results, dbc.db());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["n"], "3");
+  FLAGS_table_cache_ttl = "";
+  VirtualTableCache::instance().clear();
+}
+
+class hotplugTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const { return {{"n", "INTEGER"}}; }
+
+  TableCacheable cacheable() const { return CACHE_HOTPLUG; }
+
+ public:
+  QueryData generate(QueryContext& context) {
+    generated++;
+    if (generated == 1) {
+      // The first read fails.
+      return {};
+    }
+    return {{{"n", std::to_string(generated)}}};
+  }
+
+  static size_t generated;
+};
+
+size_t hotplugTablePlugin::generated = 0;
+
+TEST_F(VirtualTableTests, test_table_cacheable) {
+  Registry::add<hotplugTablePlugin>("table", "hotplug");
+  auto dbc = SQLiteDBManager::get();
+  attachTableInternal("hotplug", "(n INTEGER)", dbc.db());
+
+  // Empty results are not cached, the read is tried again.
+  QueryData results;
+  auto status = queryInternal("SELECT n FROM hotplug", results, dbc.db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(results.empty());
+  status = queryInternal("SELECT n FROM hotplug", results, dbc.db());
+  status = queryInternal("SELECT n FROM hotplug", results, dbc.db());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[1]["n"], "2");
+  EXPECT_EQ(hotplugTablePlugin::generated, 2U);
+
+  // A hotplug event removes the cached results.
+  VirtualTableCache::instance().invalidateHotplug();
+  results.clear();
+  status = queryInternal("SELECT n FROM hotplug", results, dbc.db());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["n"], "3");
+  VirtualTableCache::instance().clear();
+}
+
+TEST_F(VirtualTableTests, test_table_cache_max_bytes) {
+  auto& cache = VirtualTableCache::instance();
+  cache.clear();
+  auto max_bytes = FLAGS_table_cache_max_bytes;
+  FLAGS_table_cache_max_bytes = 8;
+
+  VirtualTableBuffer first;
+  first.reset({TEXT_TYPE});
+  first.append({{"n", "four"}}, {{"n", "TEXT"}});
+  VirtualTableBuffer second = first;
+
+  // Results are evicted, soonest to expire first, to make room.
+  cache.set("first", 10, first);
+  cache.set("second", 20, second);
+  VirtualTableBuffer data;
+  EXPECT_TRUE(cache.get("first", data));
+  cache.set("third", 30, second);
+  EXPECT_FALSE(cache.get("first", data));
+  EXPECT_TRUE(cache.get("second", data));
+  EXPECT_TRUE(cache.get("third", data));
+
+  // Results larger than the cache are not kept.
+  VirtualTableBuffer large;
+  large.reset({TEXT_TYPE});
+  large.append({{"n", "too large"}}, {{"n", "TEXT"}});
+  cache.set("large", 10, large);
+  EXPECT_FALSE(cache.get("large", data));
+
+  FLAGS_table_cache_max_bytes = max_bytes;
+  cache.clear();
+}
+
+class memoTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {{"pid", "INTEGER"}, {"n", "INTEGER"}};
+  }
+
+  TableColumnOptions columnOptions() const {
+    return {{"pid", COLUMN_INDEX}};
+  }
+
+  size_t cardinality() const { return 20; }
+
+ public:
+  QueryData generate(QueryContext& context) {
+    generated++;
+    QueryData results;
+    auto pids = context.constraints["pid"].getAll(EQUALS);
+    for (size_t pid = 1; pid <= 20; ++pid) {
+      if (pids.empty() || pids.count(std::to_string(pid)) > 0) {
+        results.push_back(
+            {{"pid", std::to_string(pid)}, {"n", std::to_string(generated)}});
+      }
+    }
+    return results;
+  }
+
+  static size_t generated;
+};
+
+size_t memoTablePlugin::generated = 0;
+
+TEST_F(VirtualTableTests, test_statement_memo) {
+  Registry::add<memoTablePlugin>("table", "memo");
+  auto dbc = SQLiteDBManager::get();
+  attachTableInternal("memo", "(pid INTEGER, n INTEGER)", dbc.db());
+
+  // A table scanned for every outer row is generated once per statement.
+  QueryData results;
+  memoTablePlugin::generated = 0;
+  auto status = queryInternal(
+      "WITH o(x) AS (VALUES(1), (2), (3)) "
+      "SELECT o.x, m.n FROM o CROSS JOIN memo m",
+      results,
+      dbc.db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 60U);
+  EXPECT_EQ(memoTablePlugin::generated, 1U);
+
+  // The next statement generates new results.
+  results.clear();
+  status = queryInternal("SELECT n FROM memo", results, dbc.db());
+  ASSERT_EQ(results.size(), 20U);
+  EXPECT_EQ(results[0]["n"], "2");
+
+  // Lookups are memoized, then the table is generated once without
+  // constraints, after a tenth of its estimated rows were looked up.
+  results.clear();
+  memoTablePlugin::generated = 0;
+  status = queryInternal(
+      "WITH o(pid) AS (VALUES(1), (2), (1), (3), (4), (5)) "
+      "SELECT o.pid, m.n FROM o CROSS JOIN memo m USING (pid)",
+      results,
+      dbc.db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 6U);
+  EXPECT_EQ(results[2]["n"], "1");
+  EXPECT_EQ(results[5]["n"], "3");
+  EXPECT_EQ(memoTablePlugin::generated, 3U);
+}
+
+class usedColumnsTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {{"a", "INTEGER"}, {"b", "TEXT"}, {"c", "TEXT"}};
+  }
+
+ public:
+  void generateRows(QueryContext& context, const RowYield& yield) {
+    used_columns = context.used_columns;
+    all_columns_used = context.all_columns_used;
+
+    // Columns the query does not use may be skipped.
+    Row r = {{"a", "1"}};
+    if (context.isColumnUsed("b")) {
+      r["b"] = "expensive";
+    }
+    yield(r);
+  }
+
+  static std::set<std::string> used_columns;
+  static bool all_columns_used;
+};
+
+std::set<std::string> usedColumnsTablePlugin::used_columns;
+bool usedColumnsTablePlugin::all_columns_used = true;
+
+TEST_F(VirtualTableTests, test_used_columns) {
+  Registry::add<usedColumnsTablePlugin>("table", "used_columns");
+  auto dbc = SQLiteDBManager::get();
+  attachTableInternal(
+      "used_columns", "(a INTEGER, b TEXT, c TEXT)", dbc.db());
+
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT * FROM used_columns", results, dbc.db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["b"], "expensive");
+  EXPECT_TRUE(usedColumnsTablePlugin::all_columns_used);
+
+#if SQLITE_VERSION_NUMBER >= 3010000
+  // Constrained columns are used, even if not selected.
+  results.clear();
+  status = queryInternal(
+      "SELECT a FROM used_columns WHERE c = ''", results, dbc.db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_FALSE(usedColumnsTablePlugin::all_columns_used);
+  EXPECT_EQ(usedColumnsTablePlugin::used_columns,
+            std::set<std::string>({"a", "c"}));
+#endif
+
+  // The used columns are part of a serialized context.
+  QueryContext context;
+  context.all_columns_used = false;
+  context.used_columns = {"a"};
+  PluginRequest request;
+  TablePlugin::setRequestFromContext(context, request);
+  QueryContext copy;
+  TablePlugin::setContextFromRequest(request, copy);
+  EXPECT_FALSE(copy.all_columns_used);
+  EXPECT_TRUE(copy.isColumnUsed("a"));
+  EXPECT_FALSE(copy.isColumnUsed("b"));
+}
+
+static size_t kLazyColumnsCalls = 0;
+
+class lazyTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    kLazyColumnsCalls++;
+    return {{"x", "INTEGER"}};
+  }
+
+ public:
+  QueryData generate(QueryContext& context) { return {{{"x", "1"}}}; }
+};
+
+TEST_F(VirtualTableTests, test_lazy_attach) {
+  Registry::add<lazyTablePlugin>("table", "lazy");
+
+  // Attaching only registers the modules, no table is created.
+  sqlite3* db = nullptr;
+  sqlite3_open(":memory:", &db);
+  attachVirtualTables(db);
+  EXPECT_EQ(kLazyColumnsCalls, 0U);
+
+  QueryData results;
+  auto status = queryInternal("SELECT * FROM sqlite_temp_master", results, db);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(results.empty());
+
+  // The first reference creates the table.
+  EXPECT_TRUE(queryInternal("SELECT x FROM lazy", results, db).ok());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["x"], "1");
+  EXPECT_EQ(kLazyColumnsCalls, 1U);
+  sqlite3_close(db);
+
+  // Other databases reuse the table definition.
+  sqlite3_open(":memory:", &db);
+  attachVirtualTables(db);
+  results.clear();
+  EXPECT_TRUE(queryInternal("SELECT x FROM lazy", results, db).ok());
+  EXPECT_EQ(results.size(), 1U);
+  EXPECT_EQ(kLazyColumnsCalls, 1U);
+  sqlite3_close(db);
+}
+
+class keyedTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {{"pid", "INTEGER"}, {"path", "TEXT"}};
+  }
+
+  TableColumnOptions columnOptions() const { return {{"pid", COLUMN_KEY}}; }
+
+ public:
+  QueryData generate(QueryContext& context) {
+    return {{{"pid", "1"}, {"path", "/"}}};
+  }
+};
+
+TEST_F(VirtualTableTests, test_query_keys) {
+  Registry::add<keyedTablePlugin>("table", "keyed");
+  auto dbc = SQLiteDBManager::get();
+  attachTableInternal("keyed", "(pid INTEGER, path TEXT)", dbc.db());
+  attachTableInternal("typed", "(i INTEGER, t TEXT, b BIGINT, d DOUBLE)",
+                      dbc.db());
+
+  std::vector<std::string> keys;
+  auto status = getQueryKeysInternal("SELECT * FROM keyed", keys, dbc.db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(keys, std::vector<std::string>({"pid"}));
+
+  // The key column must be selected.
+  status = getQueryKeysInternal("SELECT path FROM keyed", keys, dbc.db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(keys.empty());
+
+  // Rows of a join are not identified by one table's key.
+  status = getQueryKeysInternal(
+      "SELECT pid, path FROM keyed JOIN typed ON keyed.pid = typed.i",
+      keys,
+      dbc.db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(keys.empty());
+
+  status = getQueryKeysInternal("SELECT * FROM missing", keys, dbc.db());
+  EXPECT_FALSE(status.ok());
+}
 }
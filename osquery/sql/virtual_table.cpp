@@ -8,11 +8,405 @@
  *
  */
 
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+
 #include <osquery/logger.h>
 
+#include "osquery/core/conversions.h"
+#include "osquery/core/metrics.h"
+#include "osquery/core/profiler.h"
+#include "osquery/core/tracing.h"
 #include "osquery/sql/virtual_table.h"
 
 namespace osquery {
+
+FLAG(string,
+     table_cache_ttl,
+     "",
+     "Comma-delimited list of table:seconds result cache TTL overrides");
+
+FLAG(uint64,
+     table_cache_max_bytes,
+     16 * 1024 * 1024,
+     "Maximum bytes of cached table results, and of cached parsed files");
+
+ColumnType columnTypeFromName(const std::string &type) {
+  if (type == "TEXT") {
+    return TEXT_TYPE;
+  } else if (type == "INTEGER") {
+    return INTEGER_TYPE;
+  } else if (type == "BIGINT" || type == "UNSIGNED_BIGINT") {
+    return BIGINT_TYPE;
+  } else if (type == "DOUBLE") {
+    return DOUBLE_TYPE;
+  }
+  return UNKNOWN_TYPE;
+}
+
+void VirtualTableBuffer::reset(const std::vector<ColumnType> &types) {
+  types_ = types;
+  values_.clear();
+  text_.clear();
+  rows_ = 0;
+  bytes_ = 0;
+}
+
+void VirtualTableBuffer::clear() {
+  values_.clear();
+  text_.clear();
+  rows_ = 0;
+  bytes_ = 0;
+}
+
+void VirtualTableBuffer::append(const Row &row,
+                                const TableColumns &columns,
+                                const QueryContext *context) {
+  for (size_t i = 0; i < types_.size() && i < columns.size(); ++i) {
+    auto value = row.find(columns[i].first);
+    if (value == row.end()) {
+      if (context == nullptr || context->isColumnUsed(columns[i].first)) {
+        VLOG(1) << "Table row " << rows_ << " did not include column "
+                << columns[i].first;
+      }
+      appendValue("", columns[i].first, i);
+    } else {
+      appendValue(value->second, columns[i].first, i);
+    }
+  }
+  rows_++;
+}
+
+void VirtualTableBuffer::append(TypedRow &row,
+                                const TableColumns &columns,
+                                const QueryContext *context) {
+  for (size_t i = 0; i < types_.size() && i < columns.size(); ++i) {
+    auto value = row.find(columns[i].first);
+    if (value == row.end()) {
+      if (context == nullptr || context->isColumnUsed(columns[i].first)) {
+        VLOG(1) << "Table row " << rows_ << " did not include column "
+                << columns[i].first;
+      }
+      appendValue("", columns[i].first, i);
+    } else if (value->second.type() == RowValue::TEXT_VALUE) {
+      appendValue(value->second.text(), columns[i].first, i);
+    } else {
+      appendNative(value->second, columns[i].first, i);
+    }
+  }
+  rows_++;
+}
+
+void VirtualTableBuffer::append(ColumnRow &row,
+                                const TableColumns &columns) {
+  for (size_t i = 0; i < types_.size() && i < columns.size(); ++i) {
+    if (i >= row.size()) {
+      appendValue("", columns[i].first, i);
+    } else if (row[i].type() == RowValue::TEXT_VALUE) {
+      appendValue(row[i].text(), columns[i].first, i);
+    } else {
+      appendNative(row[i], columns[i].first, i);
+    }
+  }
+  rows_++;
+}
+
+void VirtualTableBuffer::appendNative(const RowValue &value,
+                                      const std::string &column_name,
+                                      size_t index) {
+  VirtualTableValue cell;
+  bool is_integer = (value.type() == RowValue::INTEGER_VALUE);
+  switch (types_[index]) {
+  case INTEGER_TYPE:
+    if (is_integer && value.integer() >= std::numeric_limits<int>::min() &&
+        value.integer() <= std::numeric_limits<int>::max()) {
+      cell.integer = value.integer();
+    } else if (is_integer) {
+      cell.integer = -1;
+      VLOG(1) << "Error casting " << column_name << " (" << value.integer()
+              << ") to INTEGER";
+    } else {
+      cell.integer = static_cast<long long int>(value.real());
+    }
+    break;
+  case BIGINT_TYPE:
+    cell.integer = (is_integer) ? value.integer()
+                                : static_cast<long long int>(value.real());
+    break;
+  case DOUBLE_TYPE:
+    cell.real = (is_integer) ? static_cast<double>(value.integer())
+                             : value.real();
+    break;
+  default:
+    // TEXT columns store the formatted value.
+    appendValue(value.toString(), column_name, index);
+    return;
+  }
+  // Numeric values are counted as the size of the cell.
+  bytes_ += sizeof(cell);
+  values_.push_back(cell);
+}
+
+void VirtualTableBuffer::appendValue(const std::string &value,
+                                     const std::string &column_name,
+                                     size_t index) {
+  bytes_ += std::min(value.size(), (size_t)FLAGS_value_max);
+  VirtualTableValue cell;
+  switch (types_[index]) {
+  case TEXT_TYPE:
+    cell.text.offset = text_.size();
+    cell.text.size = (value.size() > FLAGS_value_max) ? FLAGS_value_max
+                                                       : value.size();
+    text_.append(value, 0, cell.text.size);
+    break;
+  case INTEGER_TYPE: {
+    int integer = -1;
+    if (!parseInteger(value, integer)) {
+      VLOG(1) << "Error casting " << column_name << " (" << value
+              << ") to INTEGER";
+    }
+    cell.integer = integer;
+    break;
+  }
+  case BIGINT_TYPE: {
+    long long integer = -1;
+    if (!parseInteger(value, integer)) {
+      VLOG(1) << "Error casting " << column_name << " (" << value
+              << ") to BIGINT";
+    }
+    cell.integer = integer;
+    break;
+  }
+  case DOUBLE_TYPE:
+    cell.real = 0;
+    if (!parseDouble(value, cell.real)) {
+      VLOG(1) << "Error casting " << column_name << " (" << value
+              << ") to DOUBLE";
+    }
+    break;
+  default:
+    cell.integer = 0;
+    break;
+  }
+  values_.push_back(cell);
+}
+
+bool VirtualTableCache::get(const std::string &key, VirtualTableBuffer &data) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto entry = entries_.find(key);
+  if (entry == entries_.end()) {
+    return false;
+  }
+
+  if (entry->second.first <= Clock::now()) {
+    erase(entry);
+    return false;
+  }
+
+  data = entry->second.second;
+  return true;
+}
+
+void VirtualTableCache::set(const std::string &key,
+                            size_t ttl,
+                            const VirtualTableBuffer &data,
+                            bool hotplug) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto now = Clock::now();
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (it->second.first <= now || it->first == key) {
+      it = erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  if (data.bytes() > FLAGS_table_cache_max_bytes) {
+    return;
+  }
+
+  // Evict the results expiring soonest until these results fit.
+  while (bytes_ + data.bytes() > FLAGS_table_cache_max_bytes) {
+    auto soonest = entries_.begin();
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      if (it->second.first < soonest->second.first) {
+        soonest = it;
+      }
+    }
+    erase(soonest);
+  }
+
+  auto expires = (ttl == kTableCacheForever)
+                     ? Clock::time_point::max()
+                     : now + std::chrono::seconds(ttl);
+  entries_[key] = std::make_pair(expires, data);
+  bytes_ += data.bytes();
+  if (hotplug) {
+    hotplug_.insert(key);
+  }
+}
+
+VirtualTableCache::EntryIterator VirtualTableCache::erase(EntryIterator it) {
+  bytes_ -= it->second.second.bytes();
+  hotplug_.erase(it->first);
+  return entries_.erase(it);
+}
+
+static thread_local ScopedStatementMemo *kStatementMemo = nullptr;
+
+ScopedStatementMemo::ScopedStatementMemo() : previous_(kStatementMemo) {
+  kStatementMemo = this;
+}
+
+ScopedStatementMemo::~ScopedStatementMemo() {
+  for (auto *content : contents_) {
+    content->memo.clear();
+    content->memo_owner = nullptr;
+  }
+  kStatementMemo = previous_;
+}
+
+ScopedStatementMemo *ScopedStatementMemo::current() {
+  return kStatementMemo;
+}
+
+bool ScopedStatementMemo::own(VirtualTableContent *content) {
+  if (content->memo_owner == this) {
+    return true;
+  } else if (content->memo_owner != nullptr) {
+    return false;
+  }
+  content->memo_owner = this;
+  contents_.push_back(content);
+  return true;
+}
+
+void VirtualTableCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+  hotplug_.clear();
+  bytes_ = 0;
+}
+
+void VirtualTableCache::invalidateHotplug() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &key : hotplug_) {
+    auto entry = entries_.find(key);
+    if (entry != entries_.end()) {
+      bytes_ -= entry->second.second.bytes();
+      entries_.erase(entry);
+    }
+  }
+  hotplug_.clear();
+}
+
+void VirtualTableStatsRegistry::record(const std::string &name,
+                                       const VirtualTableBuffer &data,
+                                       size_t wall_time,
+                                       bool cached,
+                                       const PerfCounters *counters) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto &stats = stats_[name];
+  stats.invocations++;
+  stats.rows += data.rows();
+  stats.bytes += data.bytes();
+  if (cached) {
+    stats.cache_hits++;
+    return;
+  }
+  stats.wall_time += wall_time;
+  stats.max_wall_time = std::max(stats.max_wall_time, wall_time);
+  if (counters != nullptr) {
+    stats.counters += *counters;
+  }
+}
+
+std::map<std::string, VirtualTableStats> VirtualTableStatsRegistry::get() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void VirtualTableStatsRegistry::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.clear();
+}
+
+const size_t kTableCacheForever = std::numeric_limits<size_t>::max();
+
+size_t getTableCacheTTL(const VirtualTableContent &content) {
+  auto ttl = (content.cacheable != CACHE_NONE) ? kTableCacheForever
+                                               : content.cache_ttl;
+  if (FLAGS_table_cache_ttl.empty()) {
+    return ttl;
+  }
+
+  for (const auto &item : split(FLAGS_table_cache_ttl, ",")) {
+    auto delim = item.find(':');
+    if (delim == std::string::npos || item.substr(0, delim) != content.name) {
+      continue;
+    }
+
+    try {
+      return AS_LITERAL(size_t, item.substr(delim + 1));
+    } catch (const boost::bad_lexical_cast &e) {
+      LOG(WARNING) << "Invalid table cache TTL: " << item;
+    }
+  }
+  return ttl;
+}
+
+/// Column and attribute responses of tables that were created.
+static std::map<std::string, TableDefinition> kTableDefinitions;
+/// Mutex protecting the table definitions, created from many databases.
+static std::mutex kTableDefinitionsMutex;
+
+Status getTableDefinition(const std::string &name,
+                          TableDefinition &definition) {
+  {
+    std::lock_guard<std::mutex> lock(kTableDefinitionsMutex);
+    auto cached = kTableDefinitions.find(name);
+    if (cached != kTableDefinitions.end()) {
+      definition = cached->second;
+      return Status(0, "OK");
+    }
+  }
+
+  // The columns are the table's route info, an extension broadcasts them when
+  // it registers. Otherwise the table is requested with an extension call.
+  TableDefinition requested;
+  auto status = Registry::getRoute("table", name, requested.columns);
+  if (!status.ok() || requested.columns.size() == 0) {
+    status = Registry::call(
+        "table", name, {{"action", "columns"}}, requested.columns);
+  }
+  if (!status.ok() || requested.columns.size() == 0) {
+    return Status(1, "Cannot get columns for table: " + name);
+  }
+
+  // Table-level planner and cache hints are optional, and may not be
+  // supported by an extension's table.
+  status = Registry::call(
+      "table", name, {{"action", "attributes"}}, requested.attributes);
+  if (!status.ok()) {
+    requested.attributes.clear();
+  }
+
+  std::lock_guard<std::mutex> lock(kTableDefinitionsMutex);
+  kTableDefinitions[name] = requested;
+  definition = requested;
+  return Status(0, "OK");
+}
+
+void clearTableDefinition(const std::string &name) {
+  std::lock_guard<std::mutex> lock(kTableDefinitionsMutex);
+  kTableDefinitions.erase(name);
+}
+
 namespace tables {
 
 int xOpen(sqlite3_vtab *pVTab, sqlite3_vtab_cursor **ppCursor) {
@@ -39,8 +433,7 @@ int xClose(sqlite3_vtab_cursor *cur) {
 
 int xEof(sqlite3_vtab_cursor *cur) {
   BaseCursor *pCur = (BaseCursor *)cur;
-  auto *pVtab = (VirtualTable *)cur->pVtab;
-  return pCur->row >= pVtab->content->n;
+  return pCur->data == nullptr || pCur->row >= pCur->data->rows();
 }
 
 int xDestroy(sqlite3_vtab *p) {
@@ -77,30 +470,65 @@ int xCreate(sqlite3 *db,
   memset(pVtab, 0, sizeof(VirtualTable));
   pVtab->content = new VirtualTableContent;
 
-  PluginResponse response;
   pVtab->content->name = std::string(argv[0]);
+  pVtab->content->plugin = PluginHandle("table", pVtab->content->name);
 
-  // Get the table column information.
-  auto status = Registry::call(
-      "table", pVtab->content->name, {{"action", "columns"}}, response);
-  if (!status.ok() || response.size() == 0) {
+  // Get the table column information, requested once for every database.
+  TableDefinition definition;
+  auto status = getTableDefinition(pVtab->content->name, definition);
+  if (!status.ok()) {
     return SQLITE_ERROR;
   }
 
-  auto statement =
-      "CREATE TABLE " + pVtab->content->name + columnDefinition(response);
+  auto statement = "CREATE TABLE " + pVtab->content->name +
+                   columnDefinition(definition.columns);
   int rc = sqlite3_declare_vtab(db, statement.c_str());
   if (rc != SQLITE_OK) {
     return rc;
   }
 
-  if (!status.ok() || response.size() == 0) {
-    return SQLITE_ERROR;
-  }
-
-  for (const auto &column : response) {
+  std::vector<ColumnType> types;
+  for (const auto &column : definition.columns) {
     pVtab->content->columns.push_back(
         std::make_pair(column.at("name"), column.at("type")));
+    types.push_back(columnTypeFromName(column.at("type")));
+
+    unsigned char options = COLUMN_DEFAULT;
+    if (column.count("op") > 0) {
+      try {
+        options = AS_LITERAL(int, column.at("op"));
+      } catch (const boost::bad_lexical_cast &e) {
+        // Ignore malformed planner hints.
+      }
+    }
+    pVtab->content->options.push_back(options);
+  }
+  pVtab->content->data.reset(types);
+
+  // Use the default table attributes if the table has none.
+  pVtab->content->cardinality = 0;
+  pVtab->content->cache_ttl = 0;
+  pVtab->content->cacheable = CACHE_NONE;
+  const auto &response = definition.attributes;
+  if (response.size() > 0) {
+    try {
+      if (response[0].count("cardinality") > 0) {
+        pVtab->content->cardinality =
+            AS_LITERAL(size_t, response[0].at("cardinality"));
+      }
+      if (response[0].count("cache_ttl") > 0) {
+        pVtab->content->cache_ttl =
+            AS_LITERAL(size_t, response[0].at("cache_ttl"));
+      }
+      if (response[0].count("cacheable") > 0) {
+        auto cacheable = AS_LITERAL(int, response[0].at("cacheable"));
+        if (cacheable == CACHE_BOOT || cacheable == CACHE_HOTPLUG) {
+          pVtab->content->cacheable = (TableCacheable)cacheable;
+        }
+      }
+    } catch (const boost::bad_lexical_cast &e) {
+      // Use the default table attributes.
+    }
   }
 
   *ppVtab = (sqlite3_vtab *)pVtab;
@@ -110,80 +538,474 @@ int xCreate(sqlite3 *db,
 int xColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int col) {
   BaseCursor *pCur = (BaseCursor *)cur;
   auto *pVtab = (VirtualTable *)cur->pVtab;
-
-  if (col >= pVtab->content->columns.size()) {
+  if (pCur->data == nullptr) {
     return SQLITE_ERROR;
   }
+  const auto &data = *pCur->data;
 
-  const auto &column_name = pVtab->content->columns[col].first;
-  const auto &type = pVtab->content->columns[col].second;
-  if (pCur->row >= pVtab->content->data[column_name].size()) {
+  if (col >= pVtab->content->columns.size() || pCur->row >= data.rows()) {
     return SQLITE_ERROR;
   }
 
-  const auto &value = pVtab->content->data[column_name][pCur->row];
-  if (type == "TEXT") {
-    sqlite3_result_text(ctx, value.c_str(), -1, nullptr);
-  } else if (type == "INTEGER") {
-    int afinite;
-    try {
-      afinite = boost::lexical_cast<int>(value);
-    } catch (const boost::bad_lexical_cast &e) {
-      afinite = -1;
-      VLOG(1) << "Error casting " << column_name << " (" << value
-              << ") to INTEGER";
+  // Values were cast to the column type when the table generated rows.
+  const auto &value = data.value(pCur->row, col);
+  switch (data.type(col)) {
+  case TEXT_TYPE:
+    sqlite3_result_text(ctx, data.text(value), value.text.size, nullptr);
+    break;
+  case INTEGER_TYPE:
+    sqlite3_result_int(ctx, (int)value.integer);
+    break;
+  case BIGINT_TYPE:
+    sqlite3_result_int64(ctx, value.integer);
+    break;
+  case DOUBLE_TYPE:
+    sqlite3_result_double(ctx, value.real);
+    break;
+  default:
+    break;
+  }
+
+  return SQLITE_OK;
+}
+
+/// Check if SQLite reports a LIMIT or OFFSET within the index constraints.
+static inline bool isLimitConstraint(unsigned char op) {
+#ifdef SQLITE_INDEX_CONSTRAINT_LIMIT
+  return (op == SQLITE_INDEX_CONSTRAINT_LIMIT ||
+          op == SQLITE_INDEX_CONSTRAINT_OFFSET);
+#else
+  return false;
+#endif
+}
+
+/// Check if ConstraintList::matches fully evaluates an operator.
+static inline bool isComparableConstraint(unsigned char op) {
+  ConstraintList list;
+  list.add(Constraint(op));
+  return list.comparable();
+}
+
+/// Estimated rows for tables that do not declare a cardinality.
+static const double kDefaultCardinality = 1000;
+
+/// Fraction of a table's rows expected from a single index lookup.
+static const double kIndexSelectivity = 0.01;
+
+/// Cost of a plan that does not constrain any of a table's required columns.
+static const double kRequiredCost = 1e9;
+
+/// Plan flags reported as the xBestIndex idxNum.
+enum PlanFlags {
+  PLAN_SCAN = 0,
+  PLAN_INDEX = 1,
+  PLAN_LIMIT = 2,
+};
+
+/// The SQL operator of a constraint, for query profiles.
+static std::string constraintOperatorName(unsigned char op) {
+  switch (op) {
+  case EQUALS:
+    return "=";
+  case GREATER_THAN:
+    return ">";
+  case LESS_THAN_OR_EQUALS:
+    return "<=";
+  case LESS_THAN:
+    return "<";
+  case GREATER_THAN_OR_EQUALS:
+    return ">=";
+  case MATCHES:
+    return "MATCH";
+  case LIKE:
+    return "LIKE";
+  case GLOB:
+    return "GLOB";
+  case REGEXP:
+    return "REGEXP";
+  case NOT_EQUALS:
+    return "!=";
+#ifdef SQLITE_INDEX_CONSTRAINT_LIMIT
+  case SQLITE_INDEX_CONSTRAINT_LIMIT:
+    return "LIMIT";
+  case SQLITE_INDEX_CONSTRAINT_OFFSET:
+    return "OFFSET";
+#endif
+  default:
+    return std::to_string(op);
+  }
+}
+
+static ConstraintSet constraintsFromPlan(const VirtualTableContent *content,
+                                         const char *idxStr);
+
+/// Add a plan to the thread's query profile, if the query is profiled.
+static void profilePlan(const VirtualTableContent *content,
+                        const std::string &plan,
+                        double cost,
+                        double rows) {
+  auto profile = getQueryProfile();
+  if (profile == nullptr) {
+    return;
+  }
+
+  auto &table = profile->tables[content->name];
+  for (const auto &existing : table.plans) {
+    if (existing.plan == plan) {
+      return;
     }
-    sqlite3_result_int(ctx, afinite);
-  } else if (type == "BIGINT") {
-    long long int afinite;
-    try {
-      afinite = boost::lexical_cast<long long int>(value);
-    } catch (const boost::bad_lexical_cast &e) {
-      afinite = -1;
-      VLOG(1) << "Error casting " << column_name << " (" << value
-              << ") to BIGINT";
+  }
+
+  TablePlanProfile plan_profile;
+  plan_profile.plan = plan;
+  for (const auto &constraint : constraintsFromPlan(content, plan.c_str())) {
+    if (!plan_profile.constraints.empty()) {
+      plan_profile.constraints += ", ";
     }
-    sqlite3_result_int64(ctx, afinite);
-  } else if (type == "DOUBLE") {
-    double afinite;
-    try {
-      afinite = boost::lexical_cast<double>(value);
-    } catch (const boost::bad_lexical_cast &e) {
-      afinite = 0;
-      VLOG(1) << "Error casting" << column_name << " (" << value
-              << ") to DOUBLE";
+    if (!constraint.first.empty()) {
+      plan_profile.constraints += constraint.first + " ";
     }
-    sqlite3_result_double(ctx, afinite);
+    plan_profile.constraints += constraintOperatorName(constraint.second.op);
   }
-
-  return SQLITE_OK;
+  plan_profile.cost = cost;
+  plan_profile.estimated_rows = static_cast<uint64_t>(rows);
+  table.plans.push_back(std::move(plan_profile));
 }
 
 static int xBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
   auto *pVtab = (VirtualTable *)tab;
-  pVtab->content->constraints.clear();
+  const auto *content = pVtab->content;
 
+  // The plan is a comma-separated list of "column:op" terms passed to xFilter
+  // as the idxStr, in the order of the constraint expressions (argv).
+  std::string plan;
   int expr_index = 0;
-  int cost = 0;
+  size_t lookups = 0;
+  size_t filters = 0;
+  // The LIMIT is only passed to the generator if the generator's rows can be
+  // counted against it, meaning SQLite will not filter them further.
+  bool limitable = true;
+  bool required = false;
+  std::vector<size_t> limits;
   for (size_t i = 0; i < pIdxInfo->nConstraint; ++i) {
-    if (!pIdxInfo->aConstraint[i].usable) {
-      // A higher cost less priority, prefer more usable query constraints.
-      cost += 10;
+    const auto &constraint = pIdxInfo->aConstraint[i];
+    if (!constraint.usable) {
       // TODO: OR is not usable.
+      limitable = false;
       continue;
     }
 
-    const auto &name =
-        pVtab->content->columns[pIdxInfo->aConstraint[i].iColumn].first;
-    pVtab->content->constraints.push_back(
-        std::make_pair(name, Constraint(pIdxInfo->aConstraint[i].op)));
+    if (isLimitConstraint(constraint.op)) {
+      // LIMIT and OFFSET do not have a left-hand column.
+      limits.push_back(i);
+      continue;
+    }
+
+    if (constraint.iColumn < 0 ||
+        constraint.iColumn >= (int)content->columns.size()) {
+      // Constraints on the rowid are applied by SQLite.
+      limitable = false;
+      continue;
+    }
+
+    limitable = limitable && isComparableConstraint(constraint.op);
+    auto options = content->options[constraint.iColumn];
+    if (constraint.op == EQUALS &&
+        (options & (COLUMN_INDEX | COLUMN_REQUIRED)) > 0) {
+      // Each EQUALS expression on an index column is a generator lookup.
+      lookups++;
+      required = required || (options & COLUMN_REQUIRED) > 0;
+    } else {
+      filters++;
+    }
+
+    plan += std::to_string(constraint.iColumn) + ":" +
+            std::to_string(constraint.op) + ",";
     pIdxInfo->aConstraintUsage[i].argvIndex = ++expr_index;
   }
 
+  int flags = (lookups > 0) ? PLAN_INDEX : PLAN_SCAN;
+  if (limitable && limits.size() > 0) {
+    flags |= PLAN_LIMIT;
+    for (const auto &i : limits) {
+      plan += "-1:" + std::to_string(pIdxInfo->aConstraint[i].op) + ",";
+      pIdxInfo->aConstraintUsage[i].argvIndex = ++expr_index;
+    }
+  }
+
+  double rows = (content->cardinality > 0) ? content->cardinality
+                                           : kDefaultCardinality;
+  if (lookups > 0) {
+    rows = lookups * std::max(1.0, rows * kIndexSelectivity);
+  }
+
+  // Other constraints may be used by the generator, prefer passing them.
+  double cost = rows * std::pow(0.9, filters);
+  if (!required) {
+    for (const auto &options : content->options) {
+      if ((options & COLUMN_REQUIRED) > 0) {
+        // The table cannot generate rows without a required constraint.
+        cost = kRequiredCost;
+        break;
+      }
+    }
+  }
+
+  if (!plan.empty()) {
+    plan.pop_back();
+  }
+
+#if SQLITE_VERSION_NUMBER >= 3010000
+  // The columns read by the statement follow the constraint terms, bit N is
+  // column N and the last bit is any column beyond.
+  plan += ";" + std::to_string(pIdxInfo->colUsed);
+#endif
+
+  pIdxInfo->idxNum = flags;
+  if (!plan.empty()) {
+    pIdxInfo->idxStr = sqlite3_mprintf("%s", plan.c_str());
+    pIdxInfo->needToFreeIdxStr = 1;
+  }
   pIdxInfo->estimatedCost = cost;
+  pIdxInfo->estimatedRows = (sqlite3_int64)rows;
+  profilePlan(content, plan, cost, rows);
   return SQLITE_OK;
 }
 
+/// Recover the constraint columns and operators from an xBestIndex plan.
+static ConstraintSet constraintsFromPlan(const VirtualTableContent *content,
+                                         const char *idxStr) {
+  ConstraintSet constraints;
+  if (idxStr == nullptr) {
+    return constraints;
+  }
+
+  std::string terms(idxStr);
+  std::stringstream plan(terms.substr(0, terms.find(';')));
+  std::string term;
+  while (std::getline(plan, term, ',')) {
+    auto delim = term.find(':');
+    if (delim == std::string::npos) {
+      continue;
+    }
+
+    int column = std::atoi(term.substr(0, delim).c_str());
+    auto op = (unsigned char)std::atoi(term.substr(delim + 1).c_str());
+    if (column >= 0 && column < (int)content->columns.size()) {
+      constraints.push_back(
+          std::make_pair(content->columns[column].first, Constraint(op)));
+    } else {
+      // LIMIT and OFFSET terms do not apply to a column.
+      constraints.push_back(std::make_pair("", Constraint(op)));
+    }
+  }
+  return constraints;
+}
+
+/// Recover the columns read by the statement from an xBestIndex plan.
+static void usedColumnsFromPlan(const VirtualTableContent *content,
+                                const char *idxStr,
+                                QueryContext &context) {
+  const char *used = (idxStr != nullptr) ? strchr(idxStr, ';') : nullptr;
+  if (used == nullptr) {
+    // SQLite did not report column usage.
+    return;
+  }
+
+  auto mask = strtoull(used + 1, nullptr, 10);
+  const size_t last = sizeof(mask) * 8 - 1;
+  for (size_t i = 0; i < content->columns.size(); ++i) {
+    if ((mask & (1ULL << std::min(i, last))) > 0) {
+      context.used_columns.insert(content->columns[i].first);
+    }
+  }
+  context.all_columns_used =
+      (context.used_columns.size() == content->columns.size());
+  if (context.all_columns_used) {
+    context.used_columns.clear();
+  }
+}
+
+static void generateLocal(VirtualTableContent *content,
+                          QueryContext &context) {
+  auto &data = content->data;
+  const auto &columns = content->columns;
+  size_t matched = 0;
+  try {
+    auto plugin =
+        std::dynamic_pointer_cast<TablePlugin>(content->plugin.get());
+    if (plugin == nullptr) {
+      return;
+    }
+
+    if (plugin->columnRows()) {
+      // Values are buffered by column index, without name lookups.
+      plugin->generateColumnRows(
+          context, [&data, &columns, &context, &matched](ColumnRow &row) {
+            data.append(row, columns);
+            if (context.limit > 0 && context.matchesColumns(row, columns)) {
+              matched++;
+            }
+            return !context.limitReached(matched) && !context.isCancelled();
+          });
+      return;
+    }
+
+    if (plugin->typedRows()) {
+      // Native values are buffered without formatting them as TEXT.
+      plugin->generateTypedRows(
+          context, [&data, &columns, &context, &matched](TypedRow &row) {
+            data.append(row, columns, &context);
+            if (context.limit > 0 && context.matchesTyped(row)) {
+              matched++;
+            }
+            return !context.limitReached(matched) && !context.isCancelled();
+          });
+      return;
+    }
+
+    plugin->generateRows(context, [&data, &columns, &context, &matched](
+        Row &row) {
+      data.append(row, columns, &context);
+      if (context.limit > 0 && context.matches(row)) {
+        matched++;
+      }
+      // Returning false stops the generator once the limit is satisfied, or
+      // the query is cancelled.
+      return !context.limitReached(matched) && !context.isCancelled();
+    });
+  } catch (const std::exception &e) {
+    LOG(ERROR) << "table registry " << content->name
+               << " plugin caused exception: " << e.what();
+  } catch (...) {
+    LOG(ERROR) << "table registry " << content->name
+               << " plugin caused unknown exception";
+  }
+}
+
+static void generateExternal(VirtualTableContent *content,
+                             QueryContext &context) {
+  // Extension tables receive the context serialized in the request.
+  PluginRequest request = {{"action", "generate"}};
+  TablePlugin::setRequestFromContext(context, request);
+  PluginResponse response;
+  content->plugin.call(request, response);
+
+  // Now copy and cast the response rows into the typed row buffer.
+  for (const auto &row : response) {
+    content->data.append(row, content->columns, &context);
+  }
+}
+
+/// Latencies, in microseconds, of table generation and the rows generated.
+static MetricHistogram kTableGenerateLatency("table.generate");
+static MetricCounter kTableRows("table.rows");
+static MetricCounter kTableCacheHits("table.cache_hits");
+static MetricCounter kTableMemoHits("table.memo_hits");
+
+/// Memoized results of a table generated without constraints.
+static const std::string kMaterializedKey = "*\n";
+
+/// Fraction of a table's estimated rows looked up before it is materialized.
+static const double kMaterializeFraction = 0.1;
+
+/// The QueryContext as serialized for an extension, used as a results key.
+static std::string serializeContext(const QueryContext &context) {
+  PluginRequest request;
+  TablePlugin::setRequestFromContext(context, request);
+  return std::move(request["context"]);
+}
+
+/**
+ * @brief Check if a table's unconstrained rows should replace a lookup.
+ *
+ * Index columns are used by generators for lookups, while every row is
+ * generated without constraints. Once a statement has looked up a fraction
+ * of the table's estimated rows, generating every row is cheaper than the
+ * remaining lookups. Required and additional columns change which rows are
+ * generated, and a limit stops the generator early.
+ */
+static bool isMaterializable(const VirtualTableContent &content,
+                             const QueryContext &context) {
+  double rows =
+      (content.cardinality > 0) ? content.cardinality : kDefaultCardinality;
+  if (context.limit > 0 ||
+      content.memo.size() < std::max(1.0, rows * kMaterializeFraction)) {
+    return false;
+  }
+
+  bool constrained = false;
+  for (size_t i = 0; i < content.columns.size(); ++i) {
+    auto options = (i < content.options.size()) ? content.options[i] : 0;
+    if (options & COLUMN_REQUIRED) {
+      return false;
+    }
+
+    auto constraints = context.constraints.find(content.columns[i].first);
+    if (constraints == context.constraints.end() ||
+        !constraints->second.exists()) {
+      continue;
+    }
+    if (!(options & COLUMN_INDEX) || (options & COLUMN_ADDITIONAL)) {
+      return false;
+    }
+    constrained = true;
+  }
+  return constrained;
+}
+
+/// A copy of the context without constraints, for a materialized table.
+static QueryContext materializedContext(const VirtualTableContent *content,
+                                        const QueryContext &context) {
+  QueryContext materialized;
+  materialized.cancellation = context.cancellation;
+  materialized.used_columns = context.used_columns;
+  materialized.all_columns_used = context.all_columns_used;
+  for (const auto &column : content->columns) {
+    materialized.constraints[column.first].affinity = column.second;
+  }
+  materialized.compile();
+  return materialized;
+}
+
+/// Keep generated results for the rest of the statement.
+static void memoize(VirtualTableContent *content,
+                    const std::string &key,
+                    BaseCursor *cursor) {
+  if (content->memo_owner == nullptr || key.empty()) {
+    return;
+  }
+  auto &results = content->memo[key];
+  results = content->data;
+  cursor->data = &results;
+}
+
+/// Add an xFilter call to the thread's query profile, if it is profiled.
+static void profileFilter(const VirtualTableContent *content,
+                          const char *idxStr,
+                          const VirtualTableBuffer &data,
+                          uint64_t TableProfile::*hits = nullptr) {
+  auto profile = getQueryProfile();
+  if (profile == nullptr) {
+    return;
+  }
+
+  auto &table = profile->tables[content->name];
+  table.filters++;
+  table.rows += data.rows();
+  if (hits != nullptr) {
+    table.*hits += 1;
+  }
+
+  std::string plan = (idxStr != nullptr) ? idxStr : "";
+  for (auto &plan_profile : table.plans) {
+    if (plan_profile.plan == plan) {
+      plan_profile.filters++;
+      break;
+    }
+  }
+}
+
 static int xFilter(sqlite3_vtab_cursor *pVtabCursor,
                    int idxNum,
                    const char *idxStr,
@@ -191,70 +1013,148 @@ static int xFilter(sqlite3_vtab_cursor *pVtabCursor,
                    sqlite3_value **argv) {
   BaseCursor *pCur = (BaseCursor *)pVtabCursor;
   auto *pVtab = (VirtualTable *)pVtabCursor->pVtab;
+  TraceSpan span("sql", "xFilter", pVtab->content->name);
 
   pCur->row = 0;
-  pVtab->content->n = 0;
+  pCur->data = &pVtab->content->data;
+  pVtab->content->data.clear();
   QueryContext context;
+  context.cancellation = getQueryCancellation();
 
   for (size_t i = 0; i < pVtab->content->columns.size(); ++i) {
-    pVtab->content->data[pVtab->content->columns[i].first].clear();
     context.constraints[pVtab->content->columns[i].first].affinity =
         pVtab->content->columns[i].second;
   }
 
+  auto constraints = constraintsFromPlan(pVtab->content, idxStr);
+  if (constraints.size() != argc) {
+    LOG(ERROR) << "Invalid query plan for table " << pVtab->content->name;
+    return SQLITE_ERROR;
+  }
+  usedColumnsFromPlan(pVtab->content, idxStr, context);
+
+  // A negative LIMIT means no limit.
+  bool unlimited = false;
   for (size_t i = 0; i < argc; ++i) {
+    if (isLimitConstraint(constraints[i].second.op)) {
+      // The generator limit includes any OFFSET.
+      auto value = sqlite3_value_int(argv[i]);
+      unlimited = unlimited || value < 0;
+      context.limit += (value > 0) ? value : 0;
+      continue;
+    }
+
     auto expr = (const char *)sqlite3_value_text(argv[i]);
     if (expr == nullptr) {
       // SQLite did not expose the expression value.
       continue;
     }
     // Set the expression from SQLite's now-populated argv.
-    pVtab->content->constraints[i].second.expr = std::string(expr);
+    constraints[i].second.expr = std::string(expr);
     // Add the constraint to the column-sorted query request map.
-    context.constraints[pVtab->content->constraints[i].first].add(
-        pVtab->content->constraints[i].second);
+    context.constraints[constraints[i].first].add(constraints[i].second);
   }
 
-  PluginRequest request;
-  PluginResponse response;
-  request["action"] = "generate";
-  TablePlugin::setRequestFromContext(context, request);
-  Registry::call("table", pVtab->content->name, request, response);
+  if (unlimited) {
+    context.limit = 0;
+  }
+  // Parse each constraint once, generators may match every row.
+  context.compile();
 
-  // Now organize the response rows by column instead of row.
-  auto &data = pVtab->content->data;
-  for (const auto &row : response) {
-    for (const auto &column : pVtab->content->columns) {
-      try {
-        auto &value = row.at(column.first);
-        if (value.size() > FLAGS_value_max) {
-          data[column.first].push_back(value.substr(0, FLAGS_value_max));
-        } else {
-          data[column.first].push_back(value);
-        }
-      } catch (const std::out_of_range &e) {
-        VLOG(1) << "Table " << pVtab->content->name << " row "
-                << pVtab->content->n << " did not include column "
-                << column.first;
-        data[column.first].push_back("");
+  // Results are memoized for the executing statement, by serialized context.
+  auto *content = pVtab->content;
+  auto memo = ScopedStatementMemo::current();
+  if (memo != nullptr && !memo->own(content)) {
+    memo = nullptr;
+  }
+  std::string memo_key;
+  if (memo != nullptr) {
+    memo_key = serializeContext(context);
+    auto results = content->memo.find(memo_key);
+    if (results == content->memo.end() && isMaterializable(*content, context)) {
+      // Generate every row once and let SQLite apply the constraints.
+      auto materialized = materializedContext(content, context);
+      auto key = kMaterializedKey + serializeContext(materialized);
+      results = content->memo.find(key);
+      if (results == content->memo.end()) {
+        context = std::move(materialized);
+        memo_key = std::move(key);
       }
     }
+    if (results != content->memo.end()) {
+      kTableMemoHits.add();
+      pCur->data = &results->second;
+      profileFilter(content, idxStr, results->second, &TableProfile::memo_hits);
+      return SQLITE_OK;
+    }
+  }
+
+  // Cached results are keyed by the table and serialized context.
+  std::string cache_key;
+  auto ttl = getTableCacheTTL(*pVtab->content);
+  if (ttl > 0) {
+    cache_key = pVtab->content->name + "\n" + serializeContext(context);
+    if (VirtualTableCache::instance().get(cache_key, pVtab->content->data)) {
+      kTableCacheHits.add();
+      VirtualTableStatsRegistry::instance().record(
+          pVtab->content->name, pVtab->content->data, 0, true);
+      profileFilter(content, idxStr, content->data, &TableProfile::cache_hits);
+      memoize(content, memo_key, pCur);
+      return SQLITE_OK;
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  PerfCounters counters;
+  bool counted = false;
+  {
+    MetricTimer timer(kTableGenerateLatency);
+    ProfilePhase phase(&QueryProfile::generate_time, pVtab->content->name);
+    ScopedPerfCounters perf(counters);
+    counted = perf.counting();
+    if (pVtab->content->plugin.get() != nullptr) {
+      // Tables implemented by this process stream rows directly into the
+      // cursor buffer without a serialized request or an intermediate
+      // QueryData.
+      generateLocal(pVtab->content, context);
+    } else {
+      generateExternal(pVtab->content, context);
+    }
+  }
+  if (context.isCancelled()) {
+    // Partial results are neither returned nor cached.
+    pVtab->content->data.clear();
+    return SQLITE_INTERRUPT;
+  }
 
-    pVtab->content->n++;
+  kTableRows.add(pVtab->content->data.rows());
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+  VirtualTableStatsRegistry::instance().record(pVtab->content->name,
+                                               pVtab->content->data,
+                                               elapsed.count(),
+                                               false,
+                                               (counted) ? &counters : nullptr);
+  if (counted && getQueryProfile() != nullptr) {
+    getQueryProfile()->table_counters[pVtab->content->name] += counters;
   }
+  profileFilter(content, idxStr, content->data);
 
+  // Cacheable results are kept until a reboot, a failed read is tried again.
+  if (ttl > 0 && (ttl != kTableCacheForever ||
+                  pVtab->content->data.rows() > 0)) {
+    VirtualTableCache::instance().set(
+        cache_key,
+        ttl,
+        pVtab->content->data,
+        pVtab->content->cacheable == CACHE_HOTPLUG);
+  }
+  memoize(content, memo_key, pCur);
   return SQLITE_OK;
 }
 }
 
-Status attachTableInternal(const std::string &name,
-                           const std::string &statement,
-                           sqlite3 *db) {
-  if (SQLiteDBManager::isDisabled(name)) {
-    VLOG(0) << "Table " << name << " is disabled, not attaching";
-    return Status(0, getStringForSQLiteReturnCode(0));
-  }
-
+Status attachTableModule(const std::string &name, sqlite3 *db) {
   // A static module structure does not need specific logic per-table.
   // clang-format off
   static sqlite3_module module = {
@@ -282,21 +1182,40 @@ Status attachTableInternal(const std::string &name,
   // clang-format on
 
   // Note, if the clientData API is used then this will save a registry call
-  // within xCreate.
+  // within xCreate. A module may already exist if it was attached before.
   int rc = sqlite3_create_module(db, name.c_str(), &module, 0);
-  if (rc == SQLITE_OK || rc == SQLITE_MISUSE) {
-    auto format =
-        "CREATE VIRTUAL TABLE temp." + name + " USING " + name + statement;
-    rc = sqlite3_exec(db, format.c_str(), nullptr, nullptr, 0);
-  } else {
+  if (rc == SQLITE_MISUSE) {
+    rc = SQLITE_OK;
+  } else if (rc != SQLITE_OK) {
     LOG(ERROR) << "Error attaching table: " << name << " (" << rc << ")";
   }
   return Status(rc, getStringForSQLiteReturnCode(rc));
 }
 
+Status attachTableInternal(const std::string &name,
+                           const std::string &statement,
+                           sqlite3 *db) {
+  if (SQLiteDBManager::isDisabled(name)) {
+    VLOG(0) << "Table " << name << " is disabled, not attaching";
+    return Status(0, getStringForSQLiteReturnCode(0));
+  }
+
+  auto status = attachTableModule(name, db);
+  if (!status.ok()) {
+    return status;
+  }
+
+  auto format =
+      "CREATE VIRTUAL TABLE temp." + name + " USING " + name + statement;
+  int rc = sqlite3_exec(db, format.c_str(), nullptr, nullptr, 0);
+  SQLiteDBManager::clearStatements(db);
+  return Status(rc, getStringForSQLiteReturnCode(rc));
+}
+
 Status detachTableInternal(const std::string &name, sqlite3 *db) {
   auto format = "DROP TABLE IF EXISTS temp." + name;
   int rc = sqlite3_exec(db, format.c_str(), nullptr, nullptr, 0);
+  SQLiteDBManager::clearStatements(db);
   if (rc != SQLITE_OK) {
     LOG(ERROR) << "Error detaching table: " << name << " (" << rc << ")";
   }
@@ -305,15 +1224,24 @@ Status detachTableInternal(const std::string &name, sqlite3 *db) {
 }
 
 void attachVirtualTables(sqlite3 *db) {
-  PluginResponse response;
+#if SQLITE_VERSION_NUMBER >= 3009000
+  // Each module has an eponymous table, SQLite creates it when a query first
+  // references the table, and only then are its columns requested.
+  for (const auto &name : Registry::names("table")) {
+    if (!SQLiteDBManager::isDisabled(name)) {
+      attachTableModule(name, db);
+    }
+  }
+#else
+  TableDefinition definition;
   for (const auto &name : Registry::names("table")) {
     // Column information is nice for virtual table create call.
-    auto status =
-        Registry::call("table", name, {{"action", "columns"}}, response);
+    auto status = getTableDefinition(name, definition);
     if (status.ok()) {
-      auto statement = columnDefinition(response);
+      auto statement = columnDefinition(definition.columns);
       attachTableInternal(name, statement, db);
     }
   }
+#endif
 }
 }
@@ -10,32 +10,348 @@
 
 #pragma once
 
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/flags.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/profiler.h"
 #include "osquery/sql/sqlite_util.h"
 
 namespace osquery {
 
+DECLARE_string(table_cache_ttl);
+DECLARE_uint64(table_cache_max_bytes);
+
 /**
  * @brief osquery cursor object.
  *
  * Only used in the SQLite virtual table module methods.
  */
+class VirtualTableBuffer;
+
 struct BaseCursor {
   /// SQLite virtual table cursor.
   sqlite3_vtab_cursor base;
   /// Current cursor position.
   int row;
+  /// The filtered results, the table's buffer or memoized statement results.
+  const VirtualTableBuffer *data;
+};
+
+/// The SQLite column type affinities understood by the virtual table module.
+enum ColumnType {
+  TEXT_TYPE = 0,
+  INTEGER_TYPE,
+  BIGINT_TYPE,
+  DOUBLE_TYPE,
+  UNKNOWN_TYPE,
+};
+
+/// Convert a table plugin column type string into a ColumnType.
+ColumnType columnTypeFromName(const std::string &type);
+
+/**
+ * @brief A single pre-typed virtual table cell.
+ *
+ * Values are cast once, when a table generator's rows are buffered, using the
+ * column's type. TEXT values are offsets into the owning buffer's text storage.
+ */
+struct VirtualTableValue {
+  union {
+    long long int integer;
+    double real;
+    struct {
+      size_t offset;
+      size_t size;
+    } text;
+  };
+};
+
+/**
+ * @brief A row-major, column-index addressed result buffer.
+ *
+ * Table plugins generate rows as maps of column name to string values. The
+ * virtual table module copies each row into this buffer once, casting values
+ * to their column type, such that xColumn is a constant-time array access.
+ */
+class VirtualTableBuffer {
+ public:
+  VirtualTableBuffer() : rows_(0), bytes_(0) {}
+
+  /// Set the column types, this also clears any buffered rows.
+  void reset(const std::vector<ColumnType> &types);
+
+  /// Remove all buffered rows but keep the allocated storage and types.
+  void clear();
+
+  /**
+   * @brief Append a generated row, values are cast using each column's type.
+   *
+   * @param row The generated row.
+   * @param columns The table columns, in buffer order.
+   * @param context Optional query context, columns the query does not use
+   * may be missing from the row.
+   */
+  void append(const Row &row,
+              const TableColumns &columns,
+              const QueryContext *context = nullptr);
+
+  /**
+   * @brief Append a typed row, native values are stored without casting.
+   *
+   * TEXT values are cast as they are for a Row. Integer and double values in
+   * TEXT columns are formatted.
+   */
+  void append(TypedRow &row,
+              const TableColumns &columns,
+              const QueryContext *context = nullptr);
+
+  /**
+   * @brief Append a row of column ordered values, see the TypedRow append.
+   *
+   * Values are stored by column index, a row with fewer values than the
+   * table's columns is padded with empty values.
+   */
+  void append(ColumnRow &row, const TableColumns &columns);
+
+  /// Access a pre-typed cell.
+  const VirtualTableValue &value(size_t row, size_t column) const {
+    return values_[row * types_.size() + column];
+  }
+
+  /// Access the text storage for a TEXT cell.
+  const char *text(const VirtualTableValue &value) const {
+    return text_.data() + value.text.offset;
+  }
+
+  /// The number of buffered rows.
+  size_t rows() const { return rows_; }
+
+  /// The size of every appended value, after truncation to value_max.
+  size_t bytes() const { return bytes_; }
+
+  /// The column type for a column index.
+  ColumnType type(size_t column) const { return types_[column]; }
+
+ private:
+  /// Cast and append a single value for a column.
+  void appendValue(const std::string &value,
+                   const std::string &column_name,
+                   size_t index);
+
+  /// Append a native integer or double value for a column.
+  void appendNative(const RowValue &value,
+                    const std::string &column_name,
+                    size_t index);
+
+ private:
+  /// Per-column types, indexed by the column's CREATE TABLE position.
+  std::vector<ColumnType> types_;
+  /// Contiguous row-major cells.
+  std::vector<VirtualTableValue> values_;
+  /// Contiguous storage for all TEXT values.
+  std::string text_;
+  /// Number of buffered rows.
+  size_t rows_;
+  /// Total size of the appended values.
+  size_t bytes_;
 };
 
+class ScopedStatementMemo;
+
 struct VirtualTableContent {
   TableName name;
+  /// The table's plugin, resolved once rather than for every filter.
+  PluginHandle plugin;
   TableColumns columns;
-  TableData data;
-  ConstraintSet constraints;
-  size_t n;
+  /// Per-column ColumnOptions bitmask, indexed like the columns.
+  std::vector<unsigned char> options;
+  /// The table's estimated unconstrained row count, 0 if unknown.
+  size_t cardinality;
+  /// The table's declared result cache TTL in seconds, 0 disables caching.
+  size_t cache_ttl;
+  /// Results cached until a reboot or hotplug event, instead of a TTL.
+  TableCacheable cacheable;
+  VirtualTableBuffer data;
+
+  /// Results memoized for the executing statement, keyed by query context.
+  std::map<std::string, VirtualTableBuffer> memo;
+  /// The statement scope that owns the memoized results, if any.
+  ScopedStatementMemo *memo_owner{nullptr};
+};
+
+/**
+ * @brief Memoize virtual table results while a statement executes.
+ *
+ * SQLite may filter the inner table of a join once for every outer row.
+ * Within a scope each table's results are kept by serialized query context,
+ * repeated filters reuse them and see the same snapshot of generated rows.
+ * A table with index columns, and no required columns, is generated once
+ * without constraints when it is filtered with a second set of constraints,
+ * SQLite applies the constraints to the materialized rows.
+ *
+ * Memoized results are released when the scope ends.
+ */
+class ScopedStatementMemo : private boost::noncopyable {
+ public:
+  ScopedStatementMemo();
+  ~ScopedStatementMemo();
+
+  /// The innermost scope on this thread, nullptr if there is no scope.
+  static ScopedStatementMemo *current();
+
+  /**
+   * @brief Take ownership of a table's memoized results.
+   *
+   * @return false if the results are owned by an enclosing scope.
+   */
+  bool own(VirtualTableContent *content);
+
+ private:
+  ScopedStatementMemo *previous_;
+  /// Tables with results memoized by this scope.
+  std::vector<VirtualTableContent *> contents_;
 };
 
+/**
+ * @brief A process-wide cache of generated virtual table results.
+ *
+ * Tables opt into caching by declaring a TTL, or with the `--table_cache_ttl`
+ * flag. Results are keyed by the table name and serialized QueryContext, such
+ * that every query within the TTL, from any SQLite database, reuses the same
+ * generated (and already typed) rows.
+ *
+ * Cacheable tables use the kTableCacheForever TTL, their results do not
+ * expire. Hotplug results are removed by invalidateHotplug.
+ */
+class VirtualTableCache : private boost::noncopyable {
+ public:
+  static VirtualTableCache &instance() {
+    static VirtualTableCache instance;
+    return instance;
+  }
+
+  /**
+   * @brief Copy cached results into a result buffer.
+   *
+   * @param key The table name and serialized query context.
+   * @param data The output result buffer.
+   * @return true if the key was cached and has not expired.
+   */
+  bool get(const std::string &key, VirtualTableBuffer &data);
+
+  /**
+   * @brief Cache results for a key, expired entries are removed.
+   *
+   * The cache holds at most --table_cache_max_bytes of result values, the
+   * entries expiring soonest are evicted to make room.
+   */
+  void set(const std::string &key,
+           size_t ttl,
+           const VirtualTableBuffer &data,
+           bool hotplug = false);
+
+  /// Remove all cached results.
+  void clear();
+
+  /// Remove the results of hotplug cacheable tables, hardware has changed.
+  void invalidateHotplug();
+
+ private:
+  VirtualTableCache() : bytes_(0) {}
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+  typedef std::map<std::string,
+                   std::pair<Clock::time_point, VirtualTableBuffer> >
+      EntryMap;
+  typedef EntryMap::iterator EntryIterator;
+
+  /// Remove an entry and account for its size.
+  EntryIterator erase(EntryIterator it);
+
+ private:
+  /// Map of cache key to the expiration time and cached results.
+  EntryMap entries_;
+  /// The size of every cached entry's values.
+  size_t bytes_;
+  /// Cache keys of hotplug cacheable tables.
+  std::set<std::string> hotplug_;
+  /// Mutex around cache access, tables may be queried from many threads.
+  std::mutex mutex_;
+};
+
+/// Generation statistics for a table, accumulated across every query.
+struct VirtualTableStats {
+  /// The number of times SQLite filtered (scanned) the table.
+  size_t invocations{0};
+
+  /// Invocations answered by the result cache, without generating.
+  size_t cache_hits{0};
+
+  /// Rows and value bytes returned to SQLite.
+  size_t rows{0};
+  size_t bytes{0};
+
+  /// Total and longest generation time in microseconds.
+  size_t wall_time{0};
+  size_t max_wall_time{0};
+
+  /// Event counts while generating, if --enable_perf_counters is set.
+  PerfCounters counters;
+};
+
+/**
+ * @brief Process-wide statistics for each virtual table.
+ *
+ * The virtual table module records every xFilter, such that a table scanned
+ * repeatedly by a poor join plan is visible in the osquery_tables table.
+ */
+class VirtualTableStatsRegistry : private boost::noncopyable {
+ public:
+  static VirtualTableStatsRegistry &instance() {
+    static VirtualTableStatsRegistry instance;
+    return instance;
+  }
+
+  /// Record a table invocation, the results returned, and its event counts.
+  void record(const std::string &name,
+              const VirtualTableBuffer &data,
+              size_t wall_time,
+              bool cached,
+              const PerfCounters *counters = nullptr);
+
+  /// Copy the statistics of every invoked table.
+  std::map<std::string, VirtualTableStats> get();
+
+  /// Reset all statistics.
+  void clear();
+
+ private:
+  VirtualTableStatsRegistry() {}
+
+ private:
+  std::map<std::string, VirtualTableStats> stats_;
+  std::mutex mutex_;
+};
+
+/// The cache TTL of cacheable tables, their results do not expire.
+extern const size_t kTableCacheForever;
+
+/**
+ * @brief Get the result cache TTL in seconds for a virtual table.
+ *
+ * The `--table_cache_ttl` flag, a comma-delimited list of table:seconds,
+ * overrides the TTL declared by the table, or its cacheable lifetime.
+ */
+size_t getTableCacheTTL(const VirtualTableContent &content);
+
 /**
  * @brief osquery virtual table object
  *
@@ -47,6 +363,33 @@ struct VirtualTable {
   VirtualTableContent *content;
 };
 
+/// The column and attribute responses used to create a virtual table.
+struct TableDefinition {
+  PluginResponse columns;
+  PluginResponse attributes;
+};
+
+/**
+ * @brief Get a table's columns and attributes.
+ *
+ * Every database creating the table uses the same definition. The columns
+ * are the table's route info, which an extension broadcasts when it
+ * registers, and the attributes are requested once.
+ */
+Status getTableDefinition(const std::string &name,
+                          TableDefinition &definition);
+
+/// Forget a table's definition, call when an extension's table changes.
+void clearTableDefinition(const std::string &name);
+
+/**
+ * @brief Register a table plugin's module with an in-memory SQLite database.
+ *
+ * With SQLite 3.9.0 or later the module's eponymous table is created when a
+ * query first references it.
+ */
+Status attachTableModule(const std::string &name, sqlite3 *db);
+
 /// Attach a table plugin name to an in-memory SQLite database.
 Status attachTableInternal(const std::string &name,
                            const std::string &statement,
@@ -14,6 +14,8 @@
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/applications/browser_utils.h"
+
 namespace fs = boost::filesystem;
 namespace pt = boost::property_tree;
 
@@ -50,9 +52,10 @@ const std::map<std::string, std::string> kFirefoxAddonKeys = {
 };
 
 void genFirefoxAddonsFromExtensions(const std::string& path,
+                                    const std::string& content,
                                     QueryData& results) {
   pt::ptree tree;
-  if (!osquery::parseJSON(path + kFirefoxExtensionsFile, tree).ok()) {
+  if (!osquery::parseJSONContent(content, tree).ok()) {
     TLOG << "Could not parse JSON from: " << path + kFirefoxExtensionsFile;
     return;
   }
@@ -90,19 +93,26 @@ void genFirefoxAddonsFromExtensions(const std::string& path,
 QueryData genFirefoxAddons(QueryContext& context) {
   QueryData results;
 
-  auto homes = osquery::getHomeDirectories();
-  for (const auto& home : homes) {
+  genBrowserHomes([](const fs::path& home, QueryData& rows) {
     // For each user, enumerate all of their Firefox profiles.
     std::vector<std::string> profiles;
     if (!listDirectoriesInDirectory(home / kFirefoxPath, profiles).ok()) {
-      continue;
+      return;
     }
 
     // Generate an addons list from their extensions JSON.
     for (const auto& profile : profiles) {
-      genFirefoxAddonsFromExtensions(profile, results);
+      auto status = genParsedFile(
+          profile + kFirefoxExtensionsFile,
+          [&profile](const std::string& content, QueryData& addons) {
+            genFirefoxAddonsFromExtensions(profile, content, addons);
+          },
+          rows);
+      if (!status.ok()) {
+        TLOG << "Could not read file: " << profile + kFirefoxExtensionsFile;
+      }
     }
-  }
+  }, results);
 
   return results;
 }
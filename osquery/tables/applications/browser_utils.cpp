@@ -8,6 +8,9 @@
  *
  */
 
+#include <atomic>
+#include <thread>
+
 #include <osquery/logger.h>
 #include <osquery/tables/applications/browser_utils.h>
 
@@ -26,13 +29,40 @@ const std::map<std::string, std::string> kExtensionKeys = {
     {"background.persistent", "persistent"},
 };
 
-void genExtension(const std::string& path, QueryData& results) {
-  std::string json_data;
-  if (!readFile(path + kManifestFile, json_data).ok()) {
-    VLOG(1) << "Could not read file: " << path + kManifestFile;
-    return;
+void genBrowserHomes(const BrowserHomeGenerator& generator,
+                     QueryData& results) {
+  auto homes = osquery::getHomeDirectories();
+  std::vector<fs::path> paths(homes.begin(), homes.end());
+  std::vector<QueryData> rows(paths.size());
+
+  std::atomic<size_t> next(0);
+  auto scan = [&paths, &rows, &next, &generator]() {
+    for (size_t i = next++; i < paths.size(); i = next++) {
+      generator(paths[i], rows[i]);
+    }
+  };
+
+  // The calling thread scans with the others.
+  auto threads = std::min(fileTreeThreadCount(), paths.size());
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < threads; ++i) {
+    workers.emplace_back(scan);
   }
+  scan();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  for (auto& home : rows) {
+    results.insert(results.end(),
+                   std::make_move_iterator(home.begin()),
+                   std::make_move_iterator(home.end()));
+  }
+}
 
+void genExtension(const std::string& path,
+                  const std::string& json_data,
+                  QueryData& results) {
   // Read the extensions data into a JSON blob, then property tree.
   pt::ptree tree;
   std::stringstream json_stream;
@@ -74,13 +104,12 @@ void genExtension(const std::string& path, QueryData& results) {
 QueryData genChromeBasedExtensions(QueryContext& context, const fs::path sub_dir) {
   QueryData results;
 
-  auto homes = osquery::getHomeDirectories();
-  for (const auto& home : homes) {
+  genBrowserHomes([&sub_dir](const fs::path& home, QueryData& rows) {
     // For each user, enumerate all of their chrome profiles.
     std::vector<std::string> profiles;
     fs::path extension_path = home / sub_dir;
     if (!resolveFilePattern(extension_path, profiles, GLOB_FOLDERS).ok()) {
-      continue;
+      return;
     }
 
     // For each profile list each extension in the Extensions directory.
@@ -97,9 +126,17 @@ QueryData genChromeBasedExtensions(QueryContext& context, const fs::path sub_dir
 
     // Extensions use /<EXTENSION>/<VERSION>/manifest.json.
     for (const auto& version : versions) {
-      genExtension(version, results);
+      auto status = genParsedFile(
+          version + kManifestFile,
+          [&version](const std::string& content, QueryData& manifest) {
+            genExtension(version, content, manifest);
+          },
+          rows);
+      if (!status.ok()) {
+        VLOG(1) << "Could not read file: " << version + kManifestFile;
+      }
     }
-  }
+  }, results);
 
   return results;
 }
@@ -7,6 +7,12 @@
  *  of patent rights can be found in the PATENTS file in the same directory.
  *
  */
+
+#pragma once
+
+#include <functional>
+#include <string>
+
 #include <boost/property_tree/json_parser.hpp>
 
 #include <osquery/filesystem.h>
@@ -18,7 +24,18 @@ namespace pt = boost::property_tree;
 namespace osquery {
 namespace tables {
 
-QueryData genChromeBasedExtensions(QueryContext& context, const fs::path sub_dir);
+/// Generate the rows of a single home directory.
+typedef std::function<void(const fs::path& home, QueryData& results)>
+    BrowserHomeGenerator;
 
+/**
+ * @brief Generate rows for every home directory in parallel.
+ *
+ * Homes are scanned by up to fileTreeThreadCount threads, and their rows are
+ * merged in home directory order.
+ */
+void genBrowserHomes(const BrowserHomeGenerator& generator, QueryData& results);
+
+QueryData genChromeBasedExtensions(QueryContext& context, const fs::path sub_dir);
+}
 }
-}
\ No newline at end of file
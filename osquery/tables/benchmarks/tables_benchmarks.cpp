@@ -0,0 +1,62 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <iostream>
+
+#include <gtest/gtest.h>
+
+#include <osquery/registry.h>
+#include <osquery/tables.h>
+
+#include "osquery/core/test_util.h"
+
+namespace osquery {
+
+class TablesBenchmarks : public testing::Test {
+ protected:
+  /// Measure a table's generator alone, without SQLite or serialization.
+  void generate(const std::string& name) {
+    if (!Registry::exists("table", name)) {
+      std::cout << "[ SKIPPED  ] Table " << name << " is not registered\n";
+      return;
+    }
+
+    auto plugin =
+        std::dynamic_pointer_cast<TablePlugin>(Registry::get("table", name));
+    ASSERT_NE(plugin, nullptr);
+
+    size_t rows = 0;
+    runBenchmark([&plugin, &rows]() {
+      QueryContext context;
+      plugin->generateRows(context, [&rows](Row& row) {
+        rows++;
+        return true;
+      });
+    });
+    std::cout << "[ BENCH    ] " << rows << " rows generated\n";
+  }
+};
+
+TEST_F(TablesBenchmarks, bench_time) { generate("time"); }
+
+TEST_F(TablesBenchmarks, bench_processes) { generate("processes"); }
+
+TEST_F(TablesBenchmarks, bench_users) { generate("users"); }
+
+TEST_F(TablesBenchmarks, bench_interface_addresses) {
+  generate("interface_addresses");
+}
+
+TEST_F(TablesBenchmarks, bench_listening_ports) {
+  generate("listening_ports");
+}
+
+TEST_F(TablesBenchmarks, bench_etc_hosts) { generate("etc_hosts"); }
+}
@@ -9,10 +9,12 @@
  */
 
 #include <vector>
+#include <set>
 #include <string>
 
 #include <osquery/core.h>
 #include <osquery/config.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 #include <osquery/hash.h>
@@ -21,6 +23,8 @@
 
 namespace osquery {
 
+DECLARE_uint64(file_events_coalesce);
+
 /**
  * @brief Track time, action changes to /etc/passwd
  *
@@ -40,6 +44,10 @@ class FileEventSubscriber
    * @return Was the callback successful.
    */
   Status Callback(const FSEventsEventContextRef& ec, const void* user_data);
+
+ private:
+  /// Categories passed to Callback, config snapshots do not outlive init.
+  std::set<std::string> categories_;
 };
 
 /**
@@ -54,12 +62,13 @@ REGISTER(FileEventSubscriber, "event_subscriber", "file_events");
 Status FileEventSubscriber::init() {
   ConfigDataInstance config;
   for (const auto& element_kv : config.files()) {
+    const auto& category = *categories_.insert(element_kv.first).first;
     for (const auto& file : element_kv.second) {
       VLOG(1) << "Added listener to: " << file;
       auto mc = createSubscriptionContext();
       mc->path = file;
-      subscribe(&FileEventSubscriber::Callback, mc,
-                (void*)(&element_kv.first));
+      mc->coalesce = FLAGS_file_events_coalesce;
+      subscribe(&FileEventSubscriber::Callback, mc, (void*)(&category));
     }
   }
 
@@ -78,9 +87,11 @@ Status FileEventSubscriber::Callback(const FSEventsEventContextRef& ec,
     r["category"] = "Undefined";
   }
   r["transaction_id"] = INTEGER(ec->transaction_id);
-  r["md5"] = hashFromFile(HASH_TYPE_MD5, ec->path);
-  r["sha1"] = hashFromFile(HASH_TYPE_SHA1, ec->path);
-  r["sha256"] = hashFromFile(HASH_TYPE_SHA256, ec->path);
+  auto hashes = hashMultiFromFile(
+      HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, ec->path);
+  r["md5"] = std::move(hashes.md5);
+  r["sha1"] = std::move(hashes.sha1);
+  r["sha256"] = std::move(hashes.sha256);
   if (ec->action != "") {
     add(r, ec->time);
   }
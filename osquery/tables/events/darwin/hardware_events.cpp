@@ -13,6 +13,7 @@
 #include <osquery/tables.h>
 
 #include "osquery/events/darwin/iokit_hid.h"
+#include "osquery/sql/virtual_table.h"
 
 namespace osquery {
 
@@ -40,6 +41,9 @@ Status HardwareEventSubscriber::init() {
 
 Status HardwareEventSubscriber::Callback(const IOKitHIDEventContextRef& ec,
                                          const void* user_data) {
+  // Added or removed devices may change the hotplug cacheable tables.
+  VirtualTableCache::instance().invalidateHotplug();
+
   Row r;
 
   r["action"] = ec->action;
@@ -0,0 +1,74 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <string>
+
+#include <libproc.h>
+
+#include <boost/algorithm/string/join.hpp>
+
+#include <osquery/core.h>
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/events/darwin/openbsm.h"
+
+namespace osquery {
+
+/**
+ * @brief Track process execution and exit as they happen.
+ *
+ * Unlike scheduled queries of the `processes` table this does not list every
+ * process, and reports processes that execute and exit between intervals.
+ */
+class ProcessEventSubscriber : public EventSubscriber<OpenBSMEventPublisher> {
+ public:
+  Status init();
+
+  /// Store each successful exec and each exit.
+  Status Callback(const OpenBSMEventContextRef& ec, const void* user_data);
+};
+
+REGISTER(ProcessEventSubscriber, "event_subscriber", "process_events");
+
+Status ProcessEventSubscriber::init() {
+  auto sc = createSubscriptionContext();
+  sc->event_ids = {AUE_EXEC, AUE_EXECVE, AUE_POSIX_SPAWN, AUE_EXIT};
+  subscribe(&ProcessEventSubscriber::Callback, sc, nullptr);
+  return Status(0, "OK");
+}
+
+Status ProcessEventSubscriber::Callback(const OpenBSMEventContextRef& ec,
+                                        const void* user_data) {
+  bool exit = (ec->event_id == AUE_EXIT);
+  if (!exit && !ec->success) {
+    return Status(0, "OK");
+  }
+
+  Row r;
+  r["action"] = (exit) ? "exit" : "exec";
+  r["pid"] = INTEGER(ec->pid);
+  // Records do not include the parent, an exec's process is usually running.
+  struct proc_bsdinfo info;
+  if (!exit && proc_pidinfo(ec->pid, PROC_PIDTBSDINFO, 0, &info,
+                            PROC_PIDTBSDINFO_SIZE) == PROC_PIDTBSDINFO_SIZE) {
+    r["parent"] = INTEGER(info.pbi_ppid);
+  } else {
+    r["parent"] = "";
+  }
+  r["path"] = ec->path;
+  r["cmdline"] = boost::algorithm::join(ec->arguments, " ");
+  r["uid"] = BIGINT(ec->euid);
+  r["exit_code"] = INTEGER(ec->exit_status);
+  r["time"] = INTEGER(ec->time);
+  add(r, ec->time);
+  return Status(0, "OK");
+}
+}
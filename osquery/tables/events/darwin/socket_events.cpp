@@ -0,0 +1,61 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <string>
+
+#include <osquery/core.h>
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/events/darwin/openbsm.h"
+
+namespace osquery {
+
+/**
+ * @brief Track socket connects and binds as they happen.
+ *
+ * The audit pipe preselects the network class, other events of the class are
+ * skipped by the publisher.
+ */
+class SocketEventSubscriber : public EventSubscriber<OpenBSMEventPublisher> {
+ public:
+  Status init();
+
+  /// Store each connect and bind.
+  Status Callback(const OpenBSMEventContextRef& ec, const void* user_data);
+};
+
+REGISTER(SocketEventSubscriber, "event_subscriber", "socket_events");
+
+Status SocketEventSubscriber::init() {
+  auto sc = createSubscriptionContext();
+  sc->event_ids = {AUE_CONNECT, AUE_BIND};
+  subscribe(&SocketEventSubscriber::Callback, sc, nullptr);
+  return Status(0, "OK");
+}
+
+Status SocketEventSubscriber::Callback(const OpenBSMEventContextRef& ec,
+                                       const void* user_data) {
+  Row r;
+  r["action"] = (ec->event_id == AUE_BIND) ? "bind" : "connect";
+  r["pid"] = INTEGER(ec->pid);
+  r["path"] = ec->path;
+  // The first argument token is the socket.
+  auto fd = ec->args.find(1);
+  r["fd"] = (fd != ec->args.end()) ? std::to_string(fd->second) : "";
+  r["family"] = INTEGER(ec->family);
+  r["remote_address"] = ec->address;
+  r["remote_port"] = INTEGER(ec->port);
+  r["success"] = (ec->success) ? INTEGER(1) : INTEGER(0);
+  r["time"] = INTEGER(ec->time);
+  add(r, ec->time);
+  return Status(0, "OK");
+}
+}
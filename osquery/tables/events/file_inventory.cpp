@@ -0,0 +1,337 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <boost/filesystem/path.hpp>
+
+#include <osquery/config.h>
+#include <osquery/database.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/hash.h>
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/dispatcher/dispatcher.h"
+
+/// The file change event publishers are slightly different in OS X and Linux.
+#ifdef __APPLE__
+#include "osquery/events/darwin/fsevents.h"
+#else
+#include "osquery/events/linux/inotify.h"
+#endif
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+FLAG(bool,
+     enable_file_inventory,
+     false,
+     "Index file_paths once and update the index from file events");
+
+namespace tables {
+
+/// The file change event publishers are slightly different in OS X and Linux.
+#ifdef __APPLE__
+typedef EventSubscriber<FSEventsEventPublisher> InventoryEventSubscriber;
+typedef FSEventsEventContextRef InventoryEventContextRef;
+#else
+typedef EventSubscriber<INotifyEventPublisher> InventoryEventSubscriber;
+typedef INotifyEventContextRef InventoryEventContextRef;
+#define INVENTORY_CHANGE_MASK \
+  IN_ATTRIB | IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE | \
+  IN_MOVED_FROM | IN_MOVED_TO
+#endif
+
+/// Inventory writes are committed in batches while crawling.
+const size_t kFileInventoryBatchSize = 256;
+
+/// Inventory keys do not include a trailing slash for directories.
+inline std::string getInventoryKey(const std::string& path) {
+  if (path.size() > 1 && path.back() == '/') {
+    return path.substr(0, path.size() - 1);
+  }
+  return path;
+}
+
+/**
+ * @brief Build a path's inventory entry from the filesystem.
+ *
+ * Hashes are copied from the previous entry when the file's identity, its
+ * inode, size, mtime, and ctime, did not change.
+ *
+ * @return false if the path no longer exists.
+ */
+static bool genInventoryEntry(const std::string& path,
+                              const std::string& category,
+                              const Row& previous,
+                              Row& r) {
+  struct stat file_stat;
+  if (stat(path.c_str(), &file_stat) != 0) {
+    return false;
+  }
+
+  fs::path fs_path = path;
+  r["path"] = path;
+  r["directory"] = fs_path.parent_path().string();
+  r["filename"] = fs_path.filename().string();
+  r["category"] = category;
+  r["inode"] = BIGINT(file_stat.st_ino);
+  r["uid"] = BIGINT(file_stat.st_uid);
+  r["gid"] = BIGINT(file_stat.st_gid);
+  r["mode"] = lsperms(file_stat.st_mode);
+  r["size"] = BIGINT(file_stat.st_size);
+  r["mtime"] = BIGINT(file_stat.st_mtime);
+  r["ctime"] = BIGINT(file_stat.st_ctime);
+  r["is_dir"] = (S_ISDIR(file_stat.st_mode)) ? "1" : "0";
+
+  bool unchanged = !previous.empty();
+  for (const auto& column : {"inode", "size", "mtime", "ctime"}) {
+    auto it = previous.find(column);
+    if (it == previous.end() || it->second != r.at(column)) {
+      unchanged = false;
+      break;
+    }
+  }
+
+  if (unchanged) {
+    r["md5"] = previous.at("md5");
+    r["sha1"] = previous.at("sha1");
+    r["sha256"] = previous.at("sha256");
+    r["updated"] = previous.at("updated");
+    return true;
+  }
+
+  if (S_ISREG(file_stat.st_mode)) {
+    auto hashes = hashMultiFromFile(
+        HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path);
+    r["md5"] = std::move(hashes.md5);
+    r["sha1"] = std::move(hashes.sha1);
+    r["sha256"] = std::move(hashes.sha256);
+  } else {
+    r["md5"] = "";
+    r["sha1"] = "";
+    r["sha256"] = "";
+  }
+  r["updated"] = BIGINT(getUnixTime());
+  return true;
+}
+
+/// Read a path's inventory entry, empty if the path is not inventoried.
+static void getInventoryEntry(const std::string& key, Row& r) {
+  std::string content;
+  if (getDatabaseValue(kFileInventory, key, content).ok()) {
+    deserializeRowJSON(content, r);
+  }
+}
+
+/**
+ * @brief Add a path's inventory changes to a batch.
+ *
+ * Missing paths are removed, along with any inventoried paths below them.
+ * Unchanged entries are not rewritten.
+ */
+static void updateInventory(const std::string& path,
+                            const std::string& category,
+                            DatabaseBatch& batch) {
+  auto key = getInventoryKey(path);
+  Row previous;
+  getInventoryEntry(key, previous);
+
+  Row r;
+  if (!genInventoryEntry(key, category, previous, r)) {
+    batch.remove(kFileInventory, key);
+    std::vector<std::string> children;
+    scanDatabaseKeys(kFileInventory, children, key + "/");
+    for (const auto& child : children) {
+      batch.remove(kFileInventory, child);
+    }
+    return;
+  }
+
+  if (r != previous) {
+    std::string content;
+    if (serializeRowJSON(r, content).ok()) {
+      batch.put(kFileInventory, key, content);
+    }
+  }
+}
+
+/**
+ * @brief Apply a file change event to the inventory.
+ *
+ * @param action The event's action, reads and empty actions are ignored.
+ * @param path The changed path.
+ * @param user_data The subscription's category, or nullptr.
+ */
+Status applyInventoryEvent(const std::string& action,
+                           const std::string& path,
+                           const void* user_data) {
+  if (action == "" || action == "OPENED" || action == "ACCESSED") {
+    return Status(0, "OK");
+  }
+
+  // The event only names the path, its entry is read from the filesystem.
+  std::string category = "Undefined";
+  if (user_data != nullptr) {
+    category = *(const std::string*)user_data;
+  }
+  DatabaseBatch batch;
+  updateInventory(path, category, batch);
+  return writeDatabaseBatch(batch);
+}
+
+/**
+ * @brief Crawl every file_paths pattern once, reconciling the inventory.
+ *
+ * Entries of crawled categories whose paths no longer match are removed.
+ * Unchanged files are only stat'd, so restarting the daemon does not re-hash
+ * the inventory.
+ */
+class FileInventoryCrawler : public InternalRunnable {
+ public:
+  explicit FileInventoryCrawler(
+      const std::map<std::string, std::vector<std::string>>& files)
+      : files_(files) {}
+
+  void start();
+
+ private:
+  std::map<std::string, std::vector<std::string>> files_;
+};
+
+void FileInventoryCrawler::start() {
+  std::set<std::string> seen;
+  DatabaseBatch batch;
+  for (const auto& category : files_) {
+    for (const auto& pattern : category.second) {
+      resolveFilePattern(pattern,
+                         [&](const std::string& path) {
+                           seen.insert(getInventoryKey(path));
+                           updateInventory(path, category.first, batch);
+                           if (batch.size() >= kFileInventoryBatchSize) {
+                             writeDatabaseBatch(batch);
+                             batch.clear();
+                           }
+                           return true;
+                         },
+                         GlobOptions());
+    }
+  }
+
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kFileInventory, keys);
+  for (const auto& key : keys) {
+    Row r;
+    getInventoryEntry(key, r);
+    if (seen.count(key) == 0 && files_.count(r["category"]) > 0) {
+      batch.remove(kFileInventory, key);
+    }
+  }
+
+  writeDatabaseBatch(batch);
+  VLOG(1) << "File inventory crawled " << seen.size() << " paths";
+}
+
+/**
+ * @brief Keep an inventory of file_paths up to date from file events.
+ *
+ * The inventory is crawled once when the subscriber starts, then each change
+ * event updates the changed path's entry. The file_inventory table reads the
+ * inventory instead of the filesystem.
+ */
+class FileInventorySubscriber : public InventoryEventSubscriber {
+ public:
+  Status init();
+
+ private:
+  Status Callback(const InventoryEventContextRef& ec, const void* user_data);
+
+  /// Categories referenced by subscriptions, copied out of the config.
+  std::set<std::string> categories_;
+};
+
+REGISTER(FileInventorySubscriber, "event_subscriber", "file_inventory");
+
+Status FileInventorySubscriber::init() {
+  if (!FLAGS_enable_file_inventory) {
+    return Status(0, "OK");
+  }
+
+  ConfigDataInstance config;
+  for (const auto& element_kv : config.files()) {
+    const auto& category = *categories_.insert(element_kv.first).first;
+    for (const auto& file : element_kv.second) {
+      VLOG(1) << "Added file inventory listener to: " << file;
+      auto mc = createSubscriptionContext();
+      mc->path = file;
+#ifndef __APPLE__
+      mc->mask = INVENTORY_CHANGE_MASK;
+      mc->recursive = true;
+#endif
+      subscribe(&FileInventorySubscriber::Callback, mc, (void*)(&category));
+    }
+  }
+
+  // Changes during the crawl are also applied by events.
+  auto crawler = std::make_shared<FileInventoryCrawler>(config.files());
+  if (!Dispatcher::add(crawler).ok()) {
+    crawler->run();
+  }
+  return Status(0, "OK");
+}
+
+Status FileInventorySubscriber::Callback(const InventoryEventContextRef& ec,
+                                         const void* user_data) {
+  return applyInventoryEvent(ec->action, ec->path, user_data);
+}
+
+QueryData genFileInventory(QueryContext& context) {
+  QueryData results;
+  if (!FLAGS_enable_file_inventory) {
+    VLOG(1) << "Table file_inventory requires --enable_file_inventory";
+    return results;
+  }
+
+  std::vector<std::string> keys;
+  auto paths = context.constraints["path"].getAll(EQUALS);
+  auto directories = context.constraints["directory"].getAll(EQUALS);
+  if (!paths.empty()) {
+    for (const auto& path : paths) {
+      keys.push_back(getInventoryKey(path));
+    }
+  } else if (!directories.empty()) {
+    // Descendants are scanned, and filtered to the directory by SQLite.
+    for (const auto& directory : directories) {
+      scanDatabaseKeys(
+          kFileInventory, keys, getInventoryKey(directory) + "/");
+    }
+  } else {
+    scanDatabaseKeys(kFileInventory, keys);
+  }
+
+  for (const auto& key : keys) {
+    Row r;
+    getInventoryEntry(key, r);
+    if (!r.empty()) {
+      results.push_back(std::move(r));
+    }
+  }
+  return results;
+}
+}
+}
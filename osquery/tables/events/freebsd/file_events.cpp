@@ -0,0 +1,95 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <osquery/core.h>
+#include <osquery/config.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+#include <osquery/hash.h>
+
+#include "osquery/events/freebsd/kqueue.h"
+
+namespace osquery {
+
+DECLARE_uint64(file_events_coalesce);
+
+/**
+ * @brief Track time, action changes to configured file paths.
+ *
+ * The same rows as the Linux inotify file_events subscriber.
+ */
+class FileEventSubscriber : public EventSubscriber<KqueueEventPublisher> {
+ public:
+  Status init();
+
+  /**
+   * @brief This exports a single Callback for KqueueEventPublisher events.
+   *
+   * @param ec The EventCallback type receives an EventContextRef substruct
+   * for the KqueueEventPublisher declared in this EventSubscriber subclass.
+   *
+   * @return Was the callback successful.
+   */
+  Status Callback(const KqueueEventContextRef& ec, const void* user_data);
+
+ private:
+  /// Category strings referenced by each subscription's user data.
+  std::set<std::string> categories_;
+};
+
+REGISTER(FileEventSubscriber, "event_subscriber", "file_events");
+
+Status FileEventSubscriber::init() {
+  ConfigDataInstance config;
+  for (const auto& element_kv : config.files()) {
+    const auto& category = *categories_.insert(element_kv.first).first;
+    for (const auto& file : element_kv.second) {
+      VLOG(1) << "Added listener to: " << file;
+      auto mc = createSubscriptionContext();
+      mc->recursive = 1;
+      mc->path = file;
+      mc->mask = NOTE_ATTRIB | NOTE_WRITE | NOTE_DELETE | kKqueueNoteCreate;
+      mc->coalesce = FLAGS_file_events_coalesce;
+      subscribe(&FileEventSubscriber::Callback, mc, (void*)(&category));
+    }
+  }
+
+  return Status(0, "OK");
+}
+
+Status FileEventSubscriber::Callback(const KqueueEventContextRef& ec,
+                                     const void* user_data) {
+  Row r;
+  r["action"] = ec->action;
+  r["time"] = ec->time_string;
+  r["target_path"] = ec->path;
+  if (user_data != nullptr) {
+    r["category"] = *(std::string*)user_data;
+  } else {
+    r["category"] = "Undefined";
+  }
+  r["transaction_id"] = INTEGER(ec->transaction_id);
+  auto hashes = hashMultiFromFile(
+      HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, ec->path);
+  r["md5"] = std::move(hashes.md5);
+  r["sha1"] = std::move(hashes.sha1);
+  r["sha256"] = std::move(hashes.sha256);
+  if (ec->action != "") {
+    add(r, ec->time);
+  }
+  return Status(0, "OK");
+}
+}
@@ -0,0 +1,85 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <string>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <osquery/core.h>
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/events/linux/tracepoints.h"
+#include "osquery/tables/networking/linux/netlink.h"
+
+namespace osquery {
+
+/**
+ * @brief Track TCP connections as they are established and closed.
+ *
+ * The kernel reports each TCP state change to the inet_sock_set_state
+ * tracepoint, the filter passes only changes to established and closed TCP
+ * sockets. Unlike socket_events this does not need audit, and it reports
+ * accepted connections. State changes are often made while handling a packet,
+ * so the process is not known.
+ */
+class ConnectionEventSubscriber
+    : public EventSubscriber<TracepointEventPublisher> {
+ public:
+  Status init();
+
+  /// Store each established or closed connection.
+  Status Callback(const TracepointEventContextRef& ec, const void* user_data);
+};
+
+REGISTER(ConnectionEventSubscriber, "event_subscriber", "connection_events");
+
+Status ConnectionEventSubscriber::init() {
+  auto sc = createSubscriptionContext();
+  sc->tracepoint = "sock/inet_sock_set_state";
+  sc->filter = "protocol == " + std::to_string(IPPROTO_TCP) +
+               " && (newstate == " + std::to_string(TCP_ESTABLISHED) +
+               " || newstate == " + std::to_string(TCP_CLOSE) + ")";
+  subscribe(&ConnectionEventSubscriber::Callback, sc, nullptr);
+  return Status(0, "OK");
+}
+
+Status ConnectionEventSubscriber::Callback(const TracepointEventContextRef& ec,
+                                           const void* user_data) {
+  Row r;
+  if (ec->getInteger("newstate") == TCP_CLOSE) {
+    r["action"] = "close";
+  } else if (ec->getInteger("oldstate") == TCP_SYN_SENT) {
+    r["action"] = "connect";
+  } else {
+    r["action"] = "accept";
+  }
+
+  // Both address families are recorded, the family selects one.
+  auto family = ec->getInteger("family");
+  auto local = ec->getBytes((family == AF_INET6) ? "saddr_v6" : "saddr");
+  auto remote = ec->getBytes((family == AF_INET6) ? "daddr_v6" : "daddr");
+  auto size = (family == AF_INET6) ? sizeof(struct in6_addr)
+                                   : sizeof(struct in_addr);
+  r["family"] = INTEGER(family);
+  r["local_address"] =
+      (local.size() == size) ? tables::getNetlinkIP(family, local.data()) : "";
+  r["local_port"] = INTEGER(ec->getInteger("sport"));
+  r["remote_address"] =
+      (remote.size() == size) ? tables::getNetlinkIP(family, remote.data())
+                              : "";
+  r["remote_port"] = INTEGER(ec->getInteger("dport"));
+  r["time"] = INTEGER(ec->time);
+  add(r, ec->time);
+  return Status(0, "OK");
+}
+}
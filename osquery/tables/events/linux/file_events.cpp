@@ -8,19 +8,25 @@
  *
  */
 
-#include <vector>
+#include <algorithm>
+#include <set>
 #include <string>
+#include <vector>
 
 #include <osquery/core.h>
 #include <osquery/config.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 #include <osquery/hash.h>
 
+#include "osquery/events/linux/fanotify.h"
 #include "osquery/events/linux/inotify.h"
 
 namespace osquery {
 
+DECLARE_uint64(file_events_coalesce);
+
 /**
  * @brief Track time, action changes to /etc/passwd
  *
@@ -40,6 +46,16 @@ class FileEventSubscriber
    * @return Was the callback successful.
    */
   Status Callback(const INotifyEventContextRef& ec, const void* user_data);
+
+  /// The Callback for FanotifyEventPublisher events, with the same rows.
+  Status FanotifyCallback(const EventContextRef& ec, const void* user_data);
+
+ private:
+  /// Subscribe every configured path to the fanotify publisher.
+  Status initFanotify();
+
+  /// Subscription categories, owned here since published configs are freed.
+  std::set<std::string> categories_;
 };
 
 /**
@@ -52,19 +68,79 @@ class FileEventSubscriber
 REGISTER(FileEventSubscriber, "event_subscriber", "file_events");
 
 Status FileEventSubscriber::init() {
+  if (FLAGS_enable_fanotify) {
+    auto status = initFanotify();
+    if (status.ok()) {
+      return status;
+    }
+    LOG(WARNING) << "Cannot use fanotify for file events: "
+                 << status.getMessage();
+  }
+
   ConfigDataInstance config;
   for (const auto& element_kv : config.files()) {
+    const auto& category = *categories_.insert(element_kv.first).first;
     for (const auto& file : element_kv.second) {
       VLOG(1) << "Added listener to: " << file;
       auto mc = createSubscriptionContext();
       mc->recursive = 1;
       mc->path = file;
       mc->mask = IN_ATTRIB | IN_MODIFY | IN_DELETE | IN_CREATE;
-      subscribe(&FileEventSubscriber::Callback, mc,
-                (void*)(&element_kv.first));
+      mc->coalesce = FLAGS_file_events_coalesce;
+      subscribe(&FileEventSubscriber::Callback, mc, (void*)(&category));
+    }
+  }
+
+  return Status(0, "OK");
+}
+
+Status FileEventSubscriber::initFanotify() {
+  auto types = EventFactory::publisherTypes();
+  if (std::find(types.begin(), types.end(), "fanotify") == types.end()) {
+    return Status(1, "The fanotify publisher is not available");
+  }
+
+  // Mount marks replace the per-directory inotify watches.
+  ConfigDataInstance config;
+  for (const auto& element_kv : config.files()) {
+    const auto& category = *categories_.insert(element_kv.first).first;
+    for (const auto& file : element_kv.second) {
+      VLOG(1) << "Added fanotify listener to: " << file;
+      auto mc = std::make_shared<FanotifySubscriptionContext>();
+      mc->path = file;
+      auto cb = std::bind(&FileEventSubscriber::FanotifyCallback, this, _1, _2);
+      auto status = EventFactory::addSubscription(
+          "fanotify", getName(), mc, cb, (void*)(&category));
+      if (!status.ok()) {
+        return status;
+      }
     }
   }
+  return Status(0, "OK");
+}
 
+Status FileEventSubscriber::FanotifyCallback(const EventContextRef& ec,
+                                             const void* user_data) {
+  auto fec = std::static_pointer_cast<FanotifyEventContext>(ec);
+  Row r;
+  r["action"] = fec->action;
+  r["time"] = fec->time_string;
+  r["target_path"] = fec->path;
+  if (user_data != nullptr) {
+    r["category"] = *(std::string*)user_data;
+  } else {
+    r["category"] = "Undefined";
+  }
+  // fanotify events are not grouped into transactions.
+  r["transaction_id"] = INTEGER(0);
+  auto hashes = hashMultiFromFile(
+      HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, fec->path);
+  r["md5"] = std::move(hashes.md5);
+  r["sha1"] = std::move(hashes.sha1);
+  r["sha256"] = std::move(hashes.sha256);
+  if (fec->action != "" && fec->action != "OPENED") {
+    add(r, fec->time);
+  }
   return Status(0, "OK");
 }
 
@@ -80,9 +156,11 @@ Status FileEventSubscriber::Callback(const INotifyEventContextRef& ec,
     r["category"] = "Undefined";
   }
   r["transaction_id"] = INTEGER(ec->event->cookie);
-  r["md5"] = hashFromFile(HASH_TYPE_MD5, ec->path);
-  r["sha1"] = hashFromFile(HASH_TYPE_SHA1, ec->path);
-  r["sha256"] = hashFromFile(HASH_TYPE_SHA256, ec->path);
+  auto hashes = hashMultiFromFile(
+      HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, ec->path);
+  r["md5"] = std::move(hashes.md5);
+  r["sha1"] = std::move(hashes.sha1);
+  r["sha256"] = std::move(hashes.sha256);
   if (ec->action != "" && ec->action != "OPENED") {
     // A callback is somewhat useless unless it changes the EventSubscriber
     // state
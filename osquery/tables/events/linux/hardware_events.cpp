@@ -8,17 +8,24 @@
  *
  */
 
-#include <vector>
+#include <set>
 #include <string>
+#include <vector>
 
 #include <osquery/core.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
 #include "osquery/events/linux/udev.h"
+#include "osquery/sql/virtual_table.h"
 
 namespace osquery {
 
+/// Hotplug of these subsystems may change the hotplug cacheable tables.
+const std::set<std::string> kHotplugSubsystems = {
+    "acpi", "cpu", "dmi", "memory", "pci",
+};
+
 /**
  * @brief Track udev events in Linux
  */
@@ -31,6 +38,13 @@ class HardwareEventSubscriber : public EventSubscriber<UdevEventPublisher> {
 
 REGISTER(HardwareEventSubscriber, "event_subscriber", "hardware_events");
 
+/// Get a property the publisher read from the event's device.
+static std::string getProperty(const UdevEventContextRef& ec,
+                               const std::string& property) {
+  auto value = ec->properties.find(property);
+  return (value != ec->properties.end()) ? value->second : "";
+}
+
 Status HardwareEventSubscriber::init() {
   auto subscription = createSubscriptionContext();
   subscription->action = UDEV_EVENT_ACTION_ALL;
@@ -41,6 +55,10 @@ Status HardwareEventSubscriber::init() {
 
 Status HardwareEventSubscriber::Callback(const UdevEventContextRef& ec,
                                          const void* user_data) {
+  if (kHotplugSubsystems.count(ec->subsystem) > 0) {
+    VirtualTableCache::instance().invalidateHotplug();
+  }
+
   Row r;
 
   if (ec->devtype.empty()) {
@@ -50,26 +68,23 @@ Status HardwareEventSubscriber::Callback(const UdevEventContextRef& ec,
     return Status(0, "Missing node and driver.");
   }
 
-  struct udev_device *device = ec->device;
   r["action"] = ec->action_string;
   r["path"] = ec->devnode;
   r["type"] = ec->devtype;
   r["driver"] = ec->driver;
 
   // UDEV properties.
-  r["model"] = UdevEventPublisher::getValue(device, "ID_MODEL_FROM_DATABASE");
+  r["model"] = getProperty(ec, "ID_MODEL_FROM_DATABASE");
   if (r["path"].empty() && r["model"].empty()) {
     // Don't emit mising path/model combos.
     return Status(0, "Missing path and model.");
   }
 
-  r["model_id"] = INTEGER(UdevEventPublisher::getValue(device, "ID_MODEL_ID"));
-  r["vendor"] = UdevEventPublisher::getValue(device, "ID_VENDOR_FROM_DATABASE");
-  r["vendor_id"] =
-      INTEGER(UdevEventPublisher::getValue(device, "ID_VENDOR_ID"));
-  r["serial"] =
-      INTEGER(UdevEventPublisher::getValue(device, "ID_SERIAL_SHORT"));
-  r["revision"] = INTEGER(UdevEventPublisher::getValue(device, "ID_REVISION"));
+  r["model_id"] = INTEGER(getProperty(ec, "ID_MODEL_ID"));
+  r["vendor"] = getProperty(ec, "ID_VENDOR_FROM_DATABASE");
+  r["vendor_id"] = INTEGER(getProperty(ec, "ID_VENDOR_ID"));
+  r["serial"] = INTEGER(getProperty(ec, "ID_SERIAL_SHORT"));
+  r["revision"] = INTEGER(getProperty(ec, "ID_REVISION"));
 
   r["time"] = INTEGER(ec->time);
   add(r, ec->time);
@@ -0,0 +1,50 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#include <osquery/events.h>
+#include <osquery/tables.h>
+
+#include "osquery/events/linux/inotify.h"
+
+namespace osquery {
+namespace tables {
+
+QueryData genINotifyWatches(QueryContext& context) {
+  QueryData results;
+
+  auto types = EventFactory::publisherTypes();
+  if (std::find(types.begin(), types.end(), "inotify") == types.end()) {
+    // Events may be disabled.
+    return results;
+  }
+
+  auto base = std::static_pointer_cast<EventPublisherPlugin>(
+      EventFactory::getEventPublisher("inotify"));
+  auto publisher = std::dynamic_pointer_cast<INotifyEventPublisher>(base);
+  if (publisher == nullptr) {
+    return results;
+  }
+
+  for (const auto& status : publisher->watchStatus()) {
+    Row r;
+    r["path"] = status.path;
+    r["recursive"] = INTEGER(status.recursive);
+    r["watches"] = INTEGER(status.watches);
+    r["pending"] = INTEGER(status.pending);
+    r["failed"] = INTEGER(status.failed);
+    r["complete"] = INTEGER(status.pending == 0 && status.failed == 0);
+    results.push_back(r);
+  }
+  return results;
+}
+}
+}
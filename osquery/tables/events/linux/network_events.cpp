@@ -0,0 +1,149 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <string>
+
+#include <net/if.h>
+#include <linux/if_addr.h>
+
+#include <osquery/core.h>
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/events/linux/rtnetlink.h"
+#include "osquery/tables/networking/linux/netlink.h"
+#include "osquery/tables/networking/utils.h"
+
+namespace osquery {
+
+/// Read a link's name and MAC address.
+static void genLinkRow(const struct nlmsghdr* header, Row& r) {
+  auto message = (struct ifinfomsg*)NLMSG_DATA(header);
+  auto attr = (struct rtattr*)IFLA_RTA(message);
+  int attr_size = IFLA_PAYLOAD(header);
+  for (; RTA_OK(attr, attr_size); attr = RTA_NEXT(attr, attr_size)) {
+    if (attr->rta_type == IFLA_IFNAME) {
+      r["interface"] = std::string((char*)RTA_DATA(attr));
+    } else if (attr->rta_type == IFLA_ADDRESS && RTA_PAYLOAD(attr) == 6) {
+      r["mac"] = tables::macAsString((char*)RTA_DATA(attr));
+    }
+  }
+}
+
+/// Read an interface address and its prefix length.
+static void genAddressRow(const struct nlmsghdr* header, Row& r) {
+  auto message = (struct ifaddrmsg*)NLMSG_DATA(header);
+  auto attr = (struct rtattr*)IFA_RTA(message);
+  int attr_size = IFA_PAYLOAD(header);
+  for (; RTA_OK(attr, attr_size); attr = RTA_NEXT(attr, attr_size)) {
+    // Point-to-point links report the peer as IFA_ADDRESS, prefer IFA_LOCAL.
+    if (attr->rta_type == IFA_LOCAL ||
+        (attr->rta_type == IFA_ADDRESS && r.count("address") == 0)) {
+      r["address"] =
+          tables::getNetlinkIP(message->ifa_family, (char*)RTA_DATA(attr));
+    }
+  }
+
+  char interface[IF_NAMESIZE] = {0};
+  if (if_indextoname(message->ifa_index, interface) != nullptr) {
+    r["interface"] = std::string(interface);
+  }
+  r["netmask"] = INTEGER((int)message->ifa_prefixlen);
+}
+
+/**
+ * @brief Track link, address, route, and neighbor changes as they happen.
+ *
+ * Each change is stored for the network_events table, and route and neighbor
+ * changes are applied to the mirrors serving the routes and arp_cache tables.
+ * Link and address changes may remove routes without a message, so they
+ * invalidate the routes mirror.
+ */
+class NetworkEventSubscriber
+    : public EventSubscriber<RtnetlinkEventPublisher> {
+ public:
+  Status init();
+
+  /// Store each change and keep the mirrors current.
+  Status Callback(const RtnetlinkEventContextRef& ec, const void* user_data);
+};
+
+REGISTER(NetworkEventSubscriber, "event_subscriber", "network_events");
+
+Status NetworkEventSubscriber::init() {
+  auto sc = createSubscriptionContext();
+  sc->groups = kRtnetlinkGroups;
+  subscribe(&NetworkEventSubscriber::Callback, sc, nullptr);
+
+  // Without a listening publisher the tables dump for every query.
+  auto types = EventFactory::publisherTypes();
+  if (std::find(types.begin(), types.end(), "rtnetlink") != types.end()) {
+    tables::getRouteMirror().enable();
+    tables::getNeighborMirror().enable();
+  }
+  return Status(0, "OK");
+}
+
+Status NetworkEventSubscriber::Callback(const RtnetlinkEventContextRef& ec,
+                                        const void* user_data) {
+  auto header = ec->header();
+  if (header == nullptr) {
+    if (ec->type == NLMSG_OVERRUN) {
+      tables::getRouteMirror().invalidate();
+      tables::getNeighborMirror().invalidate();
+    } else {
+      tables::getRouteMirror().disable();
+      tables::getNeighborMirror().disable();
+    }
+    return Status(0, "OK");
+  }
+
+  Row r;
+  std::string key;
+  if (ec->group == RTMGRP_LINK) {
+    r["kind"] = "link";
+    genLinkRow(header, r);
+    tables::getRouteMirror().invalidate();
+    if (ec->type == RTM_DELLINK) {
+      tables::getNeighborMirror().invalidate();
+    }
+  } else if (ec->group & (RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR)) {
+    r["kind"] = "address";
+    genAddressRow(header, r);
+    tables::getRouteMirror().invalidate();
+  } else if (ec->group & (RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE)) {
+    tables::getRouteMirror().apply(header);
+    if (!tables::parseNetlinkRoute(header, key, r)) {
+      return Status(0, "OK");
+    }
+    r["kind"] = "route";
+    r["address"] = r["destination"];
+  } else if (ec->group == RTMGRP_NEIGH) {
+    tables::getNeighborMirror().apply(header);
+    if (!tables::parseNetlinkNeighbor(header, key, r)) {
+      return Status(0, "OK");
+    }
+    r["kind"] = "neighbor";
+  }
+
+  Row event;
+  event["action"] = ec->action;
+  event["kind"] = r["kind"];
+  event["interface"] = r["interface"];
+  event["address"] = r["address"];
+  event["netmask"] = r["netmask"];
+  event["gateway"] = r["gateway"];
+  event["mac"] = r["mac"];
+  event["time"] = INTEGER(ec->time);
+  add(event, ec->time);
+  return Status(0, "OK");
+}
+}
@@ -15,6 +15,7 @@
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/users.h"
 #include "osquery/events/linux/inotify.h"
 
 namespace osquery {
@@ -59,6 +60,9 @@ Status PasswdChangesEventSubscriber::init() {
 
 Status PasswdChangesEventSubscriber::Callback(const INotifyEventContextRef& ec,
                                               const void* user_data) {
+  // Cached user names and passwd entries may have changed.
+  invalidateUserCache();
+
   Row r;
   r["action"] = ec->action;
   r["time"] = ec->time_string;
@@ -0,0 +1,116 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <string>
+
+#include <sys/syscall.h>
+
+#include <boost/algorithm/string/join.hpp>
+
+#include <osquery/core.h>
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/events/linux/audit.h"
+#include "osquery/events/linux/proc_connector.h"
+
+namespace osquery {
+
+/**
+ * @brief Track process fork, exec, and exit as they happen.
+ *
+ * Unlike scheduled queries of the `processes` table this does not walk /proc,
+ * and reports processes that are created and exit between query intervals.
+ */
+class ProcessEventSubscriber
+    : public EventSubscriber<ProcConnectorEventPublisher> {
+ public:
+  Status init();
+
+  /// Store each process lifecycle event.
+  Status Callback(const ProcConnectorEventContextRef& ec,
+                  const void* user_data);
+
+  /// Store each successful execve reported by the audit publisher.
+  Status AuditCallback(const EventContextRef& ec, const void* user_data);
+
+ private:
+  /// Subscribe to execve syscalls from the audit publisher.
+  Status initAudit();
+};
+
+REGISTER(ProcessEventSubscriber, "event_subscriber", "process_events");
+
+Status ProcessEventSubscriber::init() {
+  auto sc = createSubscriptionContext();
+  sc->mask = proc_event::PROC_EVENT_FORK | proc_event::PROC_EVENT_EXIT;
+  if (FLAGS_enable_audit) {
+    auto status = initAudit();
+    if (!status.ok()) {
+      LOG(WARNING) << "Cannot use audit for process events: "
+                   << status.getMessage();
+      sc->mask |= proc_event::PROC_EVENT_EXEC;
+    }
+  } else {
+    sc->mask |= proc_event::PROC_EVENT_EXEC;
+  }
+  subscribe(&ProcessEventSubscriber::Callback, sc, nullptr);
+  return Status(0, "OK");
+}
+
+Status ProcessEventSubscriber::initAudit() {
+  auto types = EventFactory::publisherTypes();
+  if (std::find(types.begin(), types.end(), "audit") == types.end()) {
+    return Status(1, "The audit publisher is not available");
+  }
+
+  // Audit reports the exec arguments without racing the process for /proc.
+  auto sc = std::make_shared<AuditSubscriptionContext>();
+  sc->syscalls = {__NR_execve};
+  auto cb = std::bind(&ProcessEventSubscriber::AuditCallback, this, _1, _2);
+  return EventFactory::addSubscription("audit", getName(), sc, cb, nullptr);
+}
+
+Status ProcessEventSubscriber::Callback(const ProcConnectorEventContextRef& ec,
+                                        const void* user_data) {
+  Row r;
+  r["action"] = ec->action;
+  r["pid"] = INTEGER(ec->pid);
+  r["parent"] = INTEGER(ec->parent);
+  r["path"] = ec->path;
+  r["cmdline"] = ec->cmdline;
+  r["uid"] = ec->uid;
+  r["exit_code"] = INTEGER(ec->exit_code);
+  r["time"] = INTEGER(ec->time);
+  add(r, ec->time);
+  return Status(0, "OK");
+}
+
+Status ProcessEventSubscriber::AuditCallback(const EventContextRef& ec,
+                                             const void* user_data) {
+  auto aec = std::static_pointer_cast<AuditEventContext>(ec);
+  if (aec->fields["success"] != "yes") {
+    return Status(0, "OK");
+  }
+
+  Row r;
+  r["action"] = "exec";
+  r["pid"] = aec->fields["pid"];
+  r["parent"] = aec->fields["ppid"];
+  r["path"] = aec->fields["exe"];
+  r["cmdline"] = boost::algorithm::join(aec->arguments, " ");
+  r["uid"] = aec->fields["uid"];
+  r["exit_code"] = INTEGER(0);
+  r["time"] = INTEGER(aec->time);
+  add(r, aec->time);
+  return Status(0, "OK");
+}
+}
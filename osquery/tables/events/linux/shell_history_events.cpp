@@ -0,0 +1,121 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <pwd.h>
+
+#include <boost/filesystem/path.hpp>
+
+#include <osquery/core.h>
+#include <osquery/filesystem.h>
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/events/linux/inotify.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+namespace tables {
+extern const std::vector<std::string> kShellHistoryFiles;
+}
+
+/// Each history file's read offset is kept under this tail name.
+const std::string kShellHistoryTail = "shell_history_events";
+
+/**
+ * @brief Report commands as they are appended to shell history files.
+ *
+ * Each home directory containing a history file is watched, since shells may
+ * replace the file rather than append to it. Only lines written after the
+ * subscriber first saw a file are reported, the offset of each file is kept
+ * in the backing store so restarts do not report lines twice.
+ */
+class ShellHistoryEventSubscriber
+    : public EventSubscriber<INotifyEventPublisher> {
+ public:
+  Status init();
+
+  /// Read the lines appended to a changed history file.
+  Status Callback(const INotifyEventContextRef& ec, const void* user_data);
+
+ private:
+  /// Watched home directories and their owner's username.
+  std::map<std::string, std::string> homes_;
+};
+
+REGISTER(ShellHistoryEventSubscriber,
+         "event_subscriber",
+         "shell_history_events");
+
+Status ShellHistoryEventSubscriber::init() {
+  struct passwd* pwd = nullptr;
+  setpwent();
+  while ((pwd = getpwent()) != nullptr) {
+    if (pwd->pw_name == nullptr || pwd->pw_dir == nullptr) {
+      continue;
+    }
+
+    bool history = false;
+    for (const auto& hfile : tables::kShellHistoryFiles) {
+      auto history_file = fs::path(pwd->pw_dir) / hfile;
+      if (initTailedFile(kShellHistoryTail, history_file).ok()) {
+        history = true;
+      }
+    }
+
+    if (history && homes_.count(pwd->pw_dir) == 0) {
+      homes_[pwd->pw_dir] = pwd->pw_name;
+    }
+  }
+  endpwent();
+
+  for (const auto& home : homes_) {
+    VLOG(1) << "Added shell history listener to: " << home.first;
+    auto mc = createSubscriptionContext();
+    mc->path = home.first;
+    mc->mask = IN_MODIFY | IN_CREATE | IN_MOVED_TO;
+    subscribe(&ShellHistoryEventSubscriber::Callback,
+              mc,
+              (void*)(&home.second));
+  }
+  return Status(0, "OK");
+}
+
+Status ShellHistoryEventSubscriber::Callback(const INotifyEventContextRef& ec,
+                                             const void* user_data) {
+  auto filename = fs::path(ec->path).filename().string();
+  if (user_data == nullptr ||
+      std::find(tables::kShellHistoryFiles.begin(),
+                tables::kShellHistoryFiles.end(),
+                filename) == tables::kShellHistoryFiles.end()) {
+    return Status(0, "OK");
+  }
+
+  std::vector<std::string> lines;
+  if (!readTailedFile(kShellHistoryTail, ec->path, lines).ok()) {
+    return Status(0, "OK");
+  }
+
+  for (const auto& line : lines) {
+    Row r;
+    r["username"] = *(const std::string*)user_data;
+    r["command"] = line;
+    r["history_file"] = ec->path;
+    r["time"] = INTEGER(ec->time);
+    add(r, ec->time);
+  }
+  return Status(0, "OK");
+}
+}
@@ -0,0 +1,96 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <string>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#include <osquery/core.h>
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/events/linux/audit.h"
+#include "osquery/tables/networking/utils.h"
+
+namespace osquery {
+
+/**
+ * @brief Track socket connects and binds as they happen.
+ *
+ * The audit publisher's exit filter only reports the subscribed syscalls, the
+ * SOCKADDR record holds the hex encoded address argument.
+ */
+class SocketEventSubscriber : public EventSubscriber<AuditEventPublisher> {
+ public:
+  Status init();
+
+  /// Store each connect and bind.
+  Status Callback(const AuditEventContextRef& ec, const void* user_data);
+};
+
+REGISTER(SocketEventSubscriber, "event_subscriber", "socket_events");
+
+/// Add the family, address, and port of an encoded socket address to a row.
+static void genSocketAddress(const std::string& encoded, Row& r) {
+  auto address = decodeAuditValue(encoded);
+  if (address.size() < sizeof(sa_family_t)) {
+    return;
+  }
+
+  auto family = reinterpret_cast<const struct sockaddr*>(address.data());
+  r["family"] = INTEGER(family->sa_family);
+  if (family->sa_family == AF_INET &&
+      address.size() >= sizeof(struct sockaddr_in)) {
+    auto in = reinterpret_cast<const struct sockaddr_in*>(address.data());
+    r["remote_address"] =
+        tables::ipAsString(reinterpret_cast<const struct sockaddr*>(in));
+    r["remote_port"] = INTEGER(ntohs(in->sin_port));
+  } else if (family->sa_family == AF_INET6 &&
+             address.size() >= sizeof(struct sockaddr_in6)) {
+    auto in6 = reinterpret_cast<const struct sockaddr_in6*>(address.data());
+    r["remote_address"] =
+        tables::ipAsString(reinterpret_cast<const struct sockaddr*>(in6));
+    r["remote_port"] = INTEGER(ntohs(in6->sin6_port));
+  } else if (family->sa_family == AF_UNIX) {
+    // The path is not terminated when it fills the address.
+    auto path = address.substr(offsetof(struct sockaddr_un, sun_path));
+    r["remote_address"] = path.substr(0, path.find('\0'));
+  }
+}
+
+Status SocketEventSubscriber::init() {
+  auto sc = createSubscriptionContext();
+  sc->syscalls = {__NR_connect, __NR_bind};
+  subscribe(&SocketEventSubscriber::Callback, sc, nullptr);
+  return Status(0, "OK");
+}
+
+Status SocketEventSubscriber::Callback(const AuditEventContextRef& ec,
+                                       const void* user_data) {
+  Row r;
+  r["action"] = (ec->syscall == __NR_bind) ? "bind" : "connect";
+  r["pid"] = ec->fields["pid"];
+  r["path"] = ec->fields["exe"];
+  // Syscall arguments are hex, the first is the socket.
+  r["fd"] = std::to_string(strtoul(ec->fields["a0"].c_str(), nullptr, 16));
+  r["family"] = INTEGER(0);
+  r["remote_address"] = "";
+  r["remote_port"] = INTEGER(0);
+  genSocketAddress(ec->sockaddr, r);
+  r["success"] = (ec->fields["success"] == "yes") ? INTEGER(1) : INTEGER(0);
+  r["time"] = INTEGER(ec->time);
+  add(r, ec->time);
+  return Status(0, "OK");
+}
+}
@@ -0,0 +1,122 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <boost/filesystem/operations.hpp>
+
+#include <gtest/gtest.h>
+
+#include <osquery/database.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/tables.h>
+
+#include "osquery/core/test_util.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+DECLARE_bool(enable_file_inventory);
+
+namespace tables {
+
+Status applyInventoryEvent(const std::string& action,
+                           const std::string& path,
+                           const void* user_data);
+QueryData genFileInventory(QueryContext& context);
+
+class FileInventoryTests : public testing::Test {
+ protected:
+  void SetUp() {
+    FLAGS_enable_file_inventory = true;
+    root_ = kTestWorkingDirectory + "file-inventory";
+    fs::create_directories(root_ + "/dir");
+  }
+
+  void TearDown() {
+    fs::remove_all(root_);
+    std::vector<std::string> keys;
+    scanDatabaseKeys(kFileInventory, keys, root_);
+    for (const auto& key : keys) {
+      deleteDatabaseValue(kFileInventory, key);
+    }
+    FLAGS_enable_file_inventory = false;
+  }
+
+  /// The inventory's rows by path.
+  std::map<std::string, Row> getInventory() {
+    QueryContext context;
+    std::map<std::string, Row> rows;
+    for (const auto& row : genFileInventory(context)) {
+      rows[row.at("path")] = row;
+    }
+    return rows;
+  }
+
+  std::string root_;
+};
+
+TEST_F(FileInventoryTests, test_update_and_remove) {
+  std::string category = "config";
+  auto path = root_ + "/dir/file";
+  writeTextFile(path, "content");
+  EXPECT_TRUE(applyInventoryEvent("CREATED", path, &category).ok());
+
+  auto rows = getInventory();
+  ASSERT_EQ(rows.count(path), 1U);
+  EXPECT_EQ(rows[path]["directory"], root_ + "/dir");
+  EXPECT_EQ(rows[path]["size"], "7");
+  EXPECT_EQ(rows[path]["md5"], "9a0364b9e99bb480dd25e1f0284c8555");
+
+  // A changed file is hashed again.
+  writeTextFile(path, " more");
+  EXPECT_TRUE(applyInventoryEvent("UPDATED", path, &category).ok());
+  rows = getInventory();
+  EXPECT_EQ(rows[path]["size"], "12");
+  EXPECT_EQ(rows[path]["md5"], "6c9f5acf84590078f3b78d1a29322fed");
+
+  // A removed directory removes the paths inventoried below it.
+  EXPECT_TRUE(applyInventoryEvent("CREATED", root_ + "/dir/", &category).ok());
+  rows = getInventory();
+  ASSERT_EQ(rows.count(root_ + "/dir"), 1U);
+  EXPECT_EQ(rows[root_ + "/dir"]["is_dir"], "1");
+
+  fs::remove_all(root_ + "/dir");
+  EXPECT_TRUE(applyInventoryEvent("DELETED", root_ + "/dir", &category).ok());
+  rows = getInventory();
+  EXPECT_EQ(rows.count(root_ + "/dir"), 0U);
+  EXPECT_EQ(rows.count(path), 0U);
+}
+
+TEST_F(FileInventoryTests, test_event_category) {
+  auto path = root_ + "/dir/file";
+  writeTextFile(path, "content");
+
+  // Reads do not change the inventory.
+  std::string category = "config";
+  EXPECT_TRUE(applyInventoryEvent("OPENED", path, &category).ok());
+  EXPECT_EQ(getInventory().count(path), 0U);
+
+  // A path is attributed to its subscription's category.
+  EXPECT_TRUE(applyInventoryEvent("CREATED", path, &category).ok());
+  EXPECT_EQ(getInventory()[path]["category"], "config");
+
+  std::string other = "binaries";
+  writeTextFile(path, " more");
+  EXPECT_TRUE(applyInventoryEvent("UPDATED", path, &other).ok());
+  EXPECT_EQ(getInventory()[path]["category"], "binaries");
+
+  // Events without a subscription category are undefined.
+  writeTextFile(path, " again");
+  EXPECT_TRUE(applyInventoryEvent("UPDATED", path, nullptr).ok());
+  EXPECT_EQ(getInventory()[path]["category"], "Undefined");
+}
+}
+}
@@ -8,12 +8,20 @@
  *
  */
 
+#include <atomic>
 #include <map>
+#include <set>
 #include <string>
 
+#include <sys/stat.h>
+
 #include <osquery/config.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/metrics.h"
+#include "osquery/dispatcher/dispatcher.h"
+
 /// The file change event publishers are slightly different in OS X and Linux.
 #ifdef __APPLE__
 #include "osquery/events/darwin/fsevents.h"
@@ -29,8 +37,29 @@
 #include <yara.h>
 
 namespace osquery {
+
+FLAG(uint64,
+     yara_events_threads,
+     2,
+     "Threads scanning files changed under yara_events paths");
+
+FLAG(uint64,
+     yara_events_queue_max,
+     1024,
+     "Maximum files waiting for a yara_events scan, later changes are dropped");
+
+FLAG(uint64,
+     yara_events_coalesce,
+     1000,
+     "Milliseconds to wait for more changes to a file before a YARA scan");
+
 namespace tables {
 
+/// The state of the yara_events scan queue.
+static MetricGauge kYARAEventsQueueSize("yara_events.queue");
+static MetricCounter kYARAEventsDropped("yara_events.dropped");
+static MetricHistogram kYARAEventsScanLatency("yara_events.scan");
+
 /// The file change event publishers are slightly different in OS X and Linux.
 #ifdef __APPLE__
 typedef EventSubscriber<FSEventsEventPublisher> FileEventSubscriber;
@@ -51,6 +80,14 @@ class YARAEventSubscriber : public FileEventSubscriber {
  public:
   Status init();
 
+  /// Scan a queued file with its category's signature groups and add the
+  /// event with the matches.
+  Status scan(const YARAScanRequest& request);
+
+ private:
+  /// Start the scanning threads, once.
+  void startWorkers();
+
  private:
   /**
    * @brief This exports a single Callback for FSEventsEventPublisher events.
@@ -61,6 +98,10 @@ class YARAEventSubscriber : public FileEventSubscriber {
    * @return Status
    */
   Status Callback(const FileEventContextRef& ec, const void* user_data);
+
+ private:
+  /// Categories referenced by subscriptions, copied from the yara config.
+  std::set<std::string> categories_;
 };
 
 /**
@@ -72,6 +113,54 @@ class YARAEventSubscriber : public FileEventSubscriber {
  */
 REGISTER(YARAEventSubscriber, "event_subscriber", "yara_events");
 
+/// Changed files waiting to be scanned, the publisher thread only queues.
+static YARAScanQueue kYARAScanQueue;
+
+/// The running scan threads, events are scanned in the callback without any.
+static std::atomic<size_t> kYARAScanWorkers(0);
+
+/// A scanning thread, taking the smallest ready file from the queue.
+class YARAScanRunner : public InternalRunnable {
+ public:
+  explicit YARAScanRunner(YARAEventSubscriber* subscriber)
+      : subscriber_(subscriber) {}
+
+  void start();
+
+  void stop() { kYARAScanQueue.stop(); }
+
+ private:
+  /// The registered subscriber, subscribers are not removed.
+  YARAEventSubscriber* subscriber_;
+};
+
+void YARAScanRunner::start() {
+  YARAScanRequest request;
+  while (kYARAScanQueue.take(request)) {
+    kYARAEventsQueueSize.set(kYARAScanQueue.size());
+    MetricTimer timer(kYARAEventsScanLatency);
+    auto status = subscriber_->scan(request);
+    if (!status.ok()) {
+      VLOG(1) << status.getMessage();
+    }
+  }
+  kYARAScanWorkers--;
+}
+
+void YARAEventSubscriber::startWorkers() {
+  static std::once_flag started;
+  std::call_once(started, [this]() {
+    size_t threads = std::max(FLAGS_yara_events_threads, (uint64_t)1);
+    for (size_t i = 0; i < threads; ++i) {
+      kYARAScanWorkers++;
+      if (!Dispatcher::addService(std::make_shared<YARAScanRunner>(this))
+               .ok()) {
+        kYARAScanWorkers--;
+      }
+    }
+  });
+}
+
 Status YARAEventSubscriber::init() {
   Status status;
 
@@ -89,18 +178,18 @@ Status YARAEventSubscriber::init() {
       continue;
     }
 
+    const auto& category = *categories_.insert(yara_path_element.first).first;
     for (const auto& file : file_map.at(yara_path_element.first)) {
       VLOG(1) << "Added YARA listener to: " << file;
       auto mc = createSubscriptionContext();
       mc->path = file;
       mc->mask = FILE_CHANGE_MASK;
       mc->recursive = true;
-      subscribe(&YARAEventSubscriber::Callback,
-                mc,
-                (void*)(&yara_path_element.first));
+      subscribe(&YARAEventSubscriber::Callback, mc, (void*)(&category));
     }
   }
 
+  startWorkers();
   return Status(0, "OK");
 }
 
@@ -110,15 +199,45 @@ Status YARAEventSubscriber::Callback(const FileEventContextRef& ec,
     return Status(1, "No YARA category string provided");
   }
 
-  Row r;
+  YARAScanRequest request;
+  request.path = ec->path;
+  request.category = *(std::string*)user_data;
+  request.time = ec->time;
+
+  struct stat file_stat;
+  if (stat(ec->path.c_str(), &file_stat) != 0) {
+    // The file was removed before it could be scanned.
+    return Status(0, "OK");
+  }
+  request.size = file_stat.st_size;
+
+  auto& r = request.r;
   r["action"] = ec->action;
   r["time"] = ec->time_string;
   r["target_path"] = ec->path;
-  r["category"] = *(std::string*)user_data;
+  r["category"] = request.category;
 
   // Only FSEvents transactions updates (inotify is a no-op).
   r["transaction_id"] = INTEGER(ec->transaction_id);
 
+  if (kYARAScanWorkers == 0) {
+    return scan(request);
+  }
+
+  size_t max = std::max(FLAGS_yara_events_queue_max, (uint64_t)1);
+  if (!kYARAScanQueue.add(std::move(request),
+                          max,
+                          std::chrono::milliseconds(
+                              FLAGS_yara_events_coalesce))) {
+    kYARAEventsDropped.add();
+  }
+  kYARAEventsQueueSize.set(kYARAScanQueue.size());
+  return Status(0, "OK");
+}
+
+Status YARAEventSubscriber::scan(const YARAScanRequest& request) {
+  Row r = request.r;
+
   // These are default values, to be updated in YARACallback.
   r["count"] = INTEGER(0);
   r["matches"] = std::string("");
@@ -132,26 +251,26 @@ Status YARAEventSubscriber::Callback(const FileEventContextRef& ec,
 
   // Use the category as a lookup into the yara file_paths. The value will be
   // a list of signature groups to scan with.
-  auto category = r.at("category");
   const auto& yara_config = config.getParsedData("yara");
   const auto& yara_paths = yara_config.get_child("file_paths");
-  const auto& sig_groups = yara_paths.find(category);
+  const auto& sig_groups = yara_paths.find(request.category);
+  if (sig_groups == yara_paths.not_found()) {
+    return Status(1, "Unknown YARA category: " + request.category);
+  }
   for (const auto& rule : sig_groups->second) {
     const std::string group = rule.second.data();
-    int result = yr_rules_scan_file(rules[group],
-                                    ec->path.c_str(),
-                                    SCAN_FLAGS_FAST_MODE,
-                                    YARACallback,
-                                    (void*)&r,
-                                    0);
-
-    if (result != ERROR_SUCCESS) {
-      return Status(1, "YARA error: " + std::to_string(result));
+    if (rules.count(group) == 0) {
+      // The group has not been compiled yet.
+      continue;
+    }
+    auto status = scanYARAFile(rules.at(group).get(), request.path, r);
+    if (!status.ok()) {
+      return Status(1, "YARA error: " + status.getMessage());
     }
   }
 
-  if (ec->action != "") {
-    add(r, ec->time);
+  if (r["action"] != "") {
+    add(r, request.time);
   }
 
   return Status(0, "OK");
@@ -197,31 +197,43 @@ void genRouteTableType(RouteType type, InterfaceMap ifmap, QueryData &results) {
   free(table);
 }
 
-QueryData genArpCache(QueryContext &context) {
-  QueryData results;
+/// Yield rows of a sysctl route table, which is read as a whole.
+static bool yieldRouteRows(QueryData &results, const RowYield &yield) {
+  for (auto &r : results) {
+    if (!yield(r)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void genArpCache(QueryContext &context, const RowYield &yield) {
   InterfaceMap ifmap;
 
   ifmap = genInterfaceMap();
   for (const auto &arp_type : kArpTypes) {
+    QueryData results;
     genRouteTableType(arp_type, ifmap, results);
+    if (!yieldRouteRows(results, yield)) {
+      return;
+    }
   }
-
-  return results;
 }
 
-QueryData genRoutes(QueryContext &context) {
-  QueryData results;
+void genRoutes(QueryContext &context, const RowYield &yield) {
   InterfaceMap ifmap;
 
   // Need a map from index->name for each route entry.
   ifmap = genInterfaceMap();
   for (const auto &route_type : kRouteTypes) {
     if (context.constraints["type"].notExistsOrMatches(route_type.second)) {
+      QueryData results;
       genRouteTableType(route_type, ifmap, results);
+      if (!yieldRouteRows(results, yield)) {
+        return;
+      }
     }
   }
-
-  return results;
 }
 }
 }
@@ -49,14 +49,17 @@ QueryData parseEtcHostsContent(const std::string& content) {
 }
 
 QueryData genEtcHosts(QueryContext& context) {
-  std::string content;
-  auto s = osquery::readFile("/etc/hosts", content);
-  if (s.ok()) {
-    return parseEtcHostsContent(content);
-  } else {
+  QueryData results;
+  auto s = genParsedFile(
+      "/etc/hosts",
+      [](const std::string& content, QueryData& rows) {
+        rows = parseEtcHostsContent(content);
+      },
+      results);
+  if (!s.ok()) {
     LOG(ERROR) << "Error reading /etc/hosts: " << s.toString();
-    return {};
   }
+  return results;
 }
 }
 }
@@ -64,14 +64,17 @@ QueryData parseEtcProtocolsContent(const std::string& content) {
 }
 
 QueryData genEtcProtocols(QueryContext& context) {
-  std::string content;
-  auto s = osquery::readFile("/etc/protocols", content);
-  if (s.ok()) {
-    return parseEtcProtocolsContent(content);
-  } else {
+  QueryData results;
+  auto s = genParsedFile(
+      "/etc/protocols",
+      [](const std::string& content, QueryData& rows) {
+        rows = parseEtcProtocolsContent(content);
+      },
+      results);
+  if (!s.ok()) {
     TLOG << "Error reading /etc/protocols: " << s.toString();
-    return {};
   }
+  return results;
 }
 }
 }
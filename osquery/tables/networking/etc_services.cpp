@@ -78,14 +78,17 @@ QueryData parseEtcServicesContent(const std::string& content) {
 }
 
 QueryData genEtcServices(QueryContext& context) {
-  std::string content;
-  auto s = osquery::readFile("/etc/services", content);
-  if (s.ok()) {
-    return parseEtcServicesContent(content);
-  } else {
+  QueryData results;
+  auto s = genParsedFile(
+      "/etc/services",
+      [](const std::string& content, QueryData& rows) {
+        rows = parseEtcServicesContent(content);
+      },
+      results);
+  if (!s.ok()) {
     LOG(ERROR) << "Error reading /etc/services: " << s.toString();
-    return {};
   }
+  return results;
 }
 }
 }
@@ -14,20 +14,12 @@
 namespace osquery {
 namespace tables {
 
-QueryData genArpCache() {
-  QueryData results;
-
+void genArpCache(QueryContext& context, const RowYield& yield) {
   throw std::domain_error("Table not implemented for FreeBSD");
-
-  return results;
 }
 
-QueryData genRoutes() {
-  QueryData results;
-
+void genRoutes(QueryContext& context, const RowYield& yield) {
   throw std::domain_error("Table not implemented for FreeBSD");
-
-  return results;
 }
 }
 }
@@ -8,72 +8,85 @@
  *
  */
 
-#include <fstream>
+#include <net/if.h>
+#include <linux/neighbour.h>
 
-#include <boost/algorithm/string/split.hpp>
-#include <boost/algorithm/string/trim.hpp>
-
-#include <osquery/tables.h>
-#include <osquery/filesystem.h>
 #include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/tables/networking/linux/netlink.h"
+#include "osquery/tables/networking/utils.h"
 
 namespace osquery {
 namespace tables {
 
-const std::string kLinuxArpTable = "/proc/net/arp";
-
-QueryData genArpCache(QueryContext& context) {
-  QueryData results;
-
-  boost::filesystem::path arp_path = kLinuxArpTable;
-  if (!osquery::isReadable(arp_path).ok()) {
-    VLOG(1) << "Cannot read arp table.";
-    return results;
+/// Parse an IPv4 neighbor message into a row.
+static bool genNetlinkNeighbor(const struct nlmsghdr* netlink_msg, Row& r) {
+  struct ndmsg* message = (struct ndmsg*)NLMSG_DATA(netlink_msg);
+  if (message->ndm_family != AF_INET || (message->ndm_state & NUD_NOARP)) {
+    // Like /proc/net/arp, the table only includes ARP entries.
+    return false;
   }
 
-  std::ifstream fd(arp_path.string(), std::ios::in | std::ios::binary);
-  std::string line;
+  struct rtattr* attr =
+      (struct rtattr*)((char*)message + NLMSG_ALIGN(sizeof(struct ndmsg)));
+  int attr_size = netlink_msg->nlmsg_len - NLMSG_LENGTH(sizeof(struct ndmsg));
 
-  if (fd.fail() || fd.eof()) {
-    VLOG(1) << "Empty or failed arp table.";
-    return results;
+  r["mac"] = "00:00:00:00:00:00";
+  while (RTA_OK(attr, attr_size)) {
+    if (attr->rta_type == NDA_DST) {
+      r["address"] = getNetlinkIP(AF_INET, (char*)RTA_DATA(attr));
+    } else if (attr->rta_type == NDA_LLADDR && RTA_PAYLOAD(attr) == 6) {
+      r["mac"] = macAsString((char*)RTA_DATA(attr));
+    }
+    attr = RTA_NEXT(attr, attr_size);
   }
 
-  // Read the header line.
-  std::getline(fd, line, '\n');
-  while (!(fd.fail() || fd.eof())) {
-    std::getline(fd, line, '\n');
-
-    // IP address, HW type, Flags, HW address, Mask Device
-    std::vector<std::string> fields;
-    boost::split(fields, line, boost::is_any_of(" "), boost::token_compress_on);
-    for (auto& f : fields) {
-      // Inline trim each split.
-      boost::trim(f);
-    }
+  char interface[IF_NAMESIZE] = {0};
+  if (if_indextoname(message->ndm_ifindex, interface) != nullptr) {
+    r["interface"] = std::string(interface);
+  }
+  r["permanent"] = (message->ndm_state & NUD_PERMANENT) ? "1" : "0";
+  return (r.count("address") > 0);
+}
 
-    if (fields.size() != 6) {
-      // An unhandled error case.
-      continue;
-    }
+/// Parse any ARP entry, with an identity from its interface and address.
+bool parseNetlinkNeighbor(const struct nlmsghdr* netlink_msg,
+                          std::string& key,
+                          Row& r) {
+  if (netlink_msg->nlmsg_len < NLMSG_LENGTH(sizeof(struct ndmsg)) ||
+      !genNetlinkNeighbor(netlink_msg, r)) {
+    return false;
+  }
 
-    Row r;
-    r["address"] = fields[0];
-    r["mac"] = fields[3];
-    r["interface"] = fields[5];
+  struct ndmsg* message = (struct ndmsg*)NLMSG_DATA(netlink_msg);
+  key = std::to_string(message->ndm_ifindex) + " " + r["address"];
+  return true;
+}
 
-    // Note: it's also possible to detect publish entries (ATF_PUB).
-    if (fields[2] == "0x6") {
-      // The string representation of ATF_COM | ATF_PERM.
-      r["permanent"] = "1";
-    } else {
-      r["permanent"] = "0";
-    }
+NetlinkMirror& getNeighborMirror() {
+  static NetlinkMirror mirror(RTM_GETNEIGH, AF_INET, parseNetlinkNeighbor);
+  return mirror;
+}
 
-    results.push_back(r);
+void genArpCache(QueryContext& context, const RowYield& yield) {
+  // Serve the cache from the mirror when changes are published.
+  if (getNeighborMirror().generate(yield)) {
+    return;
   }
 
-  return results;
+  auto status = dumpNetlinkRoute(
+      RTM_GETNEIGH, AF_INET, [&yield](const struct nlmsghdr* msg) {
+        Row r;
+        if (msg->nlmsg_type != RTM_NEWNEIGH || !genNetlinkNeighbor(msg, r)) {
+          return true;
+        }
+        return yield(r);
+      });
+
+  if (!status.ok()) {
+    VLOG(1) << "Cannot dump NETLINK neighbors: " << status.getMessage();
+  }
 }
 }
 }
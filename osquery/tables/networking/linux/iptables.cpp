@@ -8,10 +8,19 @@
  *
  */
 
-#include <sstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <arpa/inet.h>
-#include <libiptc/libiptc.h>
+#include <sys/socket.h>
+
+#include <linux/netfilter_ipv4/ip_tables.h>
 
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/trim.hpp>
@@ -30,6 +39,23 @@ const char MAP[] = {'0','1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', '
 const int HIGH_BITS = 4;
 const int LOW_BITS = 15;
 
+/// Built-in chain names by netfilter hook.
+const std::vector<std::string> kIptablesHookChains = {
+    "PREROUTING", "INPUT", "FORWARD", "OUTPUT", "POSTROUTING"};
+
+/// Retry a snapshot when the rules are replaced between getsockopt calls.
+const size_t kIptablesSnapshotAttempts = 3;
+
+/// A filter table's rules without counters, and the rows parsed from them.
+struct IptablesCache {
+  std::vector<char> entries;
+  QueryData rows;
+};
+
+/// Parsed rows by filter table name.
+static std::map<std::string, IptablesCache> kIptablesCache;
+static std::mutex kIptablesCacheMutex;
+
 void parseIpEntry(ipt_ip *ip, Row &r) {
   r["protocol"] = INTEGER(ip->proto);
   if (strlen(ip->iniface)) {
@@ -69,83 +95,295 @@ void parseIpEntry(ipt_ip *ip, Row &r) {
   r["outiface_mask"] = TEXT(outiface_mask);
 }
 
-void genIPTablesRules(const std::string &filter, QueryData &results) {
-  Row r;
-  r["filter_name"] = filter;
+/// Name a standard target's verdict, like iptc_get_target.
+static std::string getStandardTarget(
+    int verdict,
+    size_t next_offset,
+    const std::map<size_t, std::string>& jumps) {
+  if (verdict == -NF_ACCEPT - 1) {
+    return "ACCEPT";
+  } else if (verdict == -NF_DROP - 1) {
+    return "DROP";
+  } else if (verdict == -NF_QUEUE - 1) {
+    return "QUEUE";
+  } else if (verdict == XT_RETURN) {
+    return "RETURN";
+  } else if (verdict >= 0 && (size_t)verdict == next_offset) {
+    // A fall through to the next rule.
+    return "";
+  }
 
-  // Initialize the access to iptc
-  auto handle = (struct iptc_handle *)iptc_init(filter.c_str());
-  if (handle == nullptr) {
-    return;
+  auto jump = jumps.find((size_t)verdict);
+  return (jump != jumps.end()) ? jump->second : "";
+}
+
+/// The entry at an offset, or nullptr if it does not fit the snapshot.
+static const struct ipt_entry* getIptablesEntry(const char* entries,
+                                                size_t size,
+                                                size_t offset) {
+  if (offset + sizeof(struct ipt_entry) > size) {
+    return nullptr;
+  }
+  auto entry = reinterpret_cast<const struct ipt_entry*>(entries + offset);
+  if (entry->next_offset < sizeof(struct ipt_entry) ||
+      offset + entry->next_offset > size ||
+      entry->target_offset + sizeof(struct xt_entry_target) >
+          entry->next_offset) {
+    return nullptr;
+  }
+  return entry;
+}
+
+/// Check if an entry is a user chain head, or the table's final entry.
+static bool isIptablesError(const struct ipt_entry* entry) {
+  auto target = reinterpret_cast<const struct xt_entry_target*>(
+      (const char*)entry + entry->target_offset);
+  return strcmp(target->u.user.name, XT_ERROR_TARGET) == 0;
+}
+
+void parseIptablesEntries(const std::string& filter,
+                          const struct ipt_getinfo& info,
+                          const char* entries,
+                          size_t size,
+                          QueryData& results) {
+  // Find the chains: built-in chains start at their hook, user chains start
+  // after their ERROR head. Jumps to a user chain target its first rule.
+  std::map<size_t, std::string> starts;
+  std::map<size_t, std::string> jumps;
+  std::map<std::string, std::string> policies;
+  std::set<size_t> ends;
+  for (size_t hook = 0; hook < NF_INET_NUMHOOKS; ++hook) {
+    if ((info.valid_hooks & (1 << hook)) != 0) {
+      starts[info.hook_entry[hook]] = kIptablesHookChains[hook];
+      ends.insert(info.underflow[hook]);
+    }
+  }
+
+  size_t previous = 0;
+  for (size_t offset = 0; offset < size;) {
+    auto entry = getIptablesEntry(entries, size, offset);
+    if (entry == nullptr) {
+      return;
+    }
+
+    if (isIptablesError(entry)) {
+      auto target = reinterpret_cast<const struct xt_error_target*>(
+          (const char*)entry + entry->target_offset);
+      auto next = offset + entry->next_offset;
+      if (next < size) {
+        std::string name(target->errorname,
+                         strnlen(target->errorname, XT_FUNCTION_MAXNAMELEN));
+        starts[next] = name;
+        jumps[next] = name;
+      }
+      if (offset > 0 && ends.count(previous) == 0) {
+        // The RETURN ending the previous user chain.
+        ends.insert(previous);
+      }
+    }
+    previous = offset;
+    offset += entry->next_offset;
   }
 
-  // Iterate through chains
-  for (auto chain = iptc_first_chain(handle); chain != nullptr;
-       chain = iptc_next_chain(handle)) {
-    r["chain"] = TEXT(chain);
+  // Built-in chain policies are their final entry's verdict.
+  for (size_t hook = 0; hook < NF_INET_NUMHOOKS; ++hook) {
+    if ((info.valid_hooks & (1 << hook)) == 0) {
+      continue;
+    }
+    auto entry = getIptablesEntry(entries, size, info.underflow[hook]);
+    if (entry != nullptr) {
+      auto target = reinterpret_cast<const struct xt_standard_target*>(
+          (const char*)entry + entry->target_offset);
+      policies[kIptablesHookChains[hook]] = getStandardTarget(
+          target->verdict, info.underflow[hook] + entry->next_offset, jumps);
+    }
+  }
 
-    struct ipt_counters counters;
-    auto policy = iptc_get_policy(chain, &counters, handle);
+  Row r;
+  r["filter_name"] = filter;
+  bool in_chain = false;
+  for (size_t offset = 0; offset < size;) {
+    auto entry = getIptablesEntry(entries, size, offset);
+    if (entry == nullptr) {
+      return;
+    }
+    size_t next_offset = offset + entry->next_offset;
 
-    if (policy != nullptr) {
-      r["policy"] = TEXT(policy);
-      r["packets"] = INTEGER(counters.pcnt);
-      r["bytes"] = INTEGER(counters.bcnt);
-    } else {
-      r["policy"] = "";
+    auto start = starts.find(offset);
+    if (start != starts.end()) {
+      in_chain = true;
+      r["chain"] = start->second;
+      auto policy = policies.find(start->second);
+      r["policy"] = (policy != policies.end()) ? policy->second : "";
+      // Counters are set for each query from the snapshot.
       r["packets"] = "0";
       r["bytes"] = "0";
     }
 
-    struct ipt_entry *prev_rule = nullptr;
-    // Iterating through all the rules per chain
-    for (auto chain_rule = iptc_first_rule(chain, handle); chain_rule;
-         chain_rule = iptc_next_rule(prev_rule, handle)) {
-      prev_rule = (struct ipt_entry *)chain_rule;
-
-      auto target = iptc_get_target(chain_rule, handle);
-      if (target != nullptr) {
-        r["target"] = TEXT(target);
-      } else {
-        r["target"] = "";
+    if (ends.count(offset) > 0) {
+      // Each chain also has a row of its own, following its rules.
+      if (in_chain) {
+        results.push_back(r);
       }
-
-      if (chain_rule->target_offset) {
-        r["match"] = "yes";
+      in_chain = false;
+    } else if (in_chain && !isIptablesError(entry)) {
+      auto target = reinterpret_cast<const struct xt_entry_target*>(
+          (const char*)entry + entry->target_offset);
+      if (target->u.user.name[0] == 0) {
+        auto standard = reinterpret_cast<const struct xt_standard_target*>(
+            target);
+        r["target"] = getStandardTarget(standard->verdict, next_offset, jumps);
       } else {
-        r["match"] = "no";
+        r["target"] = std::string(
+            target->u.user.name,
+            strnlen(target->u.user.name, XT_EXTENSION_MAXNAMELEN));
       }
 
-      struct ipt_ip *ip = (struct ipt_ip *)&chain_rule->ip;
-      parseIpEntry(ip, r);
-
+      r["match"] = (entry->target_offset) ? "yes" : "no";
+      parseIpEntry((ipt_ip*)&entry->ip, r);
       results.push_back(r);
-    } // Rule iteration
-    results.push_back(r);
-  } // Chain iteration
+    }
+    offset = next_offset;
+  }
+}
 
-  iptc_free(handle);
+/**
+ * @brief Read a filter table's rules and counters with getsockopt.
+ *
+ * This is the snapshot libiptc reads, without building its chain cache.
+ */
+static Status readIptablesSnapshot(const std::string& filter,
+                                   struct ipt_getinfo& info,
+                                   std::vector<char>& buffer) {
+  int socket_fd = ::socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_RAW);
+  if (socket_fd < 0) {
+    return Status(1, "Cannot open iptables socket");
+  }
+
+  for (size_t attempt = 0; attempt < kIptablesSnapshotAttempts; ++attempt) {
+    memset(&info, 0, sizeof(info));
+    strncpy(info.name, filter.c_str(), sizeof(info.name) - 1);
+    socklen_t length = sizeof(info);
+    if (::getsockopt(socket_fd, SOL_IP, IPT_SO_GET_INFO, &info, &length) !=
+        0) {
+      ::close(socket_fd);
+      return Status(1, "Cannot read iptables info for " + filter);
+    }
+
+    buffer.assign(sizeof(struct ipt_get_entries) + info.size, 0);
+    auto request = reinterpret_cast<struct ipt_get_entries*>(buffer.data());
+    strncpy(request->name, filter.c_str(), sizeof(request->name) - 1);
+    request->size = info.size;
+    length = buffer.size();
+    if (::getsockopt(
+            socket_fd, SOL_IP, IPT_SO_GET_ENTRIES, request, &length) == 0) {
+      ::close(socket_fd);
+      return Status(0, "OK");
+    } else if (errno != EAGAIN) {
+      break;
+    }
+  }
+
+  ::close(socket_fd);
+  return Status(1, "Cannot read iptables entries for " + filter);
 }
 
-QueryData genIptables(QueryContext& context) {
-  QueryData results;
+/**
+ * @brief Generate a filter table's rows, reusing rows of unchanged rules.
+ *
+ * ip_tables does not expose a generation counter, a snapshot's entries with
+ * their counters cleared identify the rules. Only built-in chain policy
+ * counters are reported, they are read from each snapshot.
+ */
+static bool genIptablesRules(const std::string& filter,
+                             const std::set<std::string>& chains,
+                             const RowYield& yield) {
+  struct ipt_getinfo info;
+  std::vector<char> buffer;
+  auto status = readIptablesSnapshot(filter, info, buffer);
+  if (!status.ok()) {
+    VLOG(1) << status.getMessage();
+    return true;
+  }
+
+  auto request = reinterpret_cast<struct ipt_get_entries*>(buffer.data());
+  char* entries = (char*)request->entrytable;
+  size_t size = request->size;
+
+  std::map<std::string, struct xt_counters> counters;
+  for (size_t hook = 0; hook < NF_INET_NUMHOOKS; ++hook) {
+    auto entry = getIptablesEntry(entries, size, info.underflow[hook]);
+    if ((info.valid_hooks & (1 << hook)) != 0 && entry != nullptr) {
+      counters[kIptablesHookChains[hook]] = entry->counters;
+    }
+  }
+
+  for (size_t offset = 0; offset < size;) {
+    auto entry = (struct ipt_entry*)getIptablesEntry(entries, size, offset);
+    if (entry == nullptr) {
+      break;
+    }
+    memset(&entry->counters, 0, sizeof(entry->counters));
+    offset += entry->next_offset;
+  }
+
+  QueryData rows;
+  {
+    std::lock_guard<std::mutex> lock(kIptablesCacheMutex);
+    auto& cache = kIptablesCache[filter];
+    if (cache.entries.size() != size ||
+        memcmp(cache.entries.data(), entries, size) != 0) {
+      cache.rows.clear();
+      parseIptablesEntries(filter, info, entries, size, cache.rows);
+      cache.entries.assign(entries, entries + size);
+    }
 
+    for (const auto& row : cache.rows) {
+      if (chains.empty() || chains.count(row.at("chain")) > 0) {
+        rows.push_back(row);
+      }
+    }
+  }
+
+  for (auto& r : rows) {
+    auto chain_counters = counters.find(r["chain"]);
+    if (chain_counters != counters.end()) {
+      r["packets"] = INTEGER(chain_counters->second.pcnt);
+      r["bytes"] = INTEGER(chain_counters->second.bcnt);
+    }
+    if (!yield(r)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void genIptables(QueryContext& context, const RowYield& yield) {
   // Read in table names
   std::string content;
   auto s = osquery::readFile(kLinuxIpTablesNames, content);
-  if (s.ok()) {
-    for (auto &line : split(content, "\n")) {
-      boost::trim(line);
-      if (line.size() > 0) {
-        genIPTablesRules(line, results);
-      }
-    }
-  } else {
+  if (!s.ok()) {
     // Permissions issue or iptables modules are not loaded.
     TLOG << "Error reading " << kLinuxIpTablesNames << " : " << s.toString();
+    return;
   }
 
-  return results;
+  auto filters = context.constraints["filter_name"].getAll(EQUALS);
+  auto chains = context.constraints["chain"].getAll(EQUALS);
+  bool filter_filters = context.constraints["filter_name"].exists(EQUALS);
+  if (context.constraints["chain"].exists(EQUALS) && chains.empty()) {
+    return;
+  }
+
+  for (auto& line : split(content, "\n")) {
+    boost::trim(line);
+    if (line.empty() || (filter_filters && filters.count(line) == 0)) {
+      continue;
+    }
+    if (!genIptablesRules(line, chains, yield)) {
+      return;
+    }
+  }
 }
 }
 }
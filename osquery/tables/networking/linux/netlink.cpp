@@ -0,0 +1,234 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <osquery/logger.h>
+
+#include "osquery/tables/networking/linux/netlink.h"
+
+namespace osquery {
+namespace tables {
+
+const size_t kNetlinkReceiveBuffer = 4 * 1024 * 1024;
+
+/// Each recv reads many messages, the kernel fills at most a few pages.
+const size_t kNetlinkReadSize = 64 * 1024;
+
+/// The reused route socket, or -1 if it is not open.
+static int kNetlinkRouteSocket = -1;
+
+/// The sequence number of the last dump request.
+static uint32_t kNetlinkSequence = 0;
+
+/// Serializes dumps, the socket carries one dump at a time.
+static std::mutex kNetlinkRouteMutex;
+
+std::string getNetlinkIP(int family, const char* buffer) {
+  char dst[INET6_ADDRSTRLEN] = {0};
+  inet_ntop(family, buffer, dst, INET6_ADDRSTRLEN);
+  return std::string(dst);
+}
+
+static void closeNetlinkRoute() {
+  if (kNetlinkRouteSocket >= 0) {
+    ::close(kNetlinkRouteSocket);
+    kNetlinkRouteSocket = -1;
+  }
+}
+
+static Status openNetlinkRoute() {
+  if (kNetlinkRouteSocket >= 0) {
+    return Status(0, "OK");
+  }
+
+  kNetlinkRouteSocket =
+      ::socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (kNetlinkRouteSocket < 0) {
+    return Status(1, "Cannot open NETLINK socket");
+  }
+
+  // A forced buffer is allowed with CAP_NET_ADMIN, otherwise rmem_max limits.
+  int size = kNetlinkReceiveBuffer;
+  if (::setsockopt(kNetlinkRouteSocket,
+                   SOL_SOCKET,
+                   SO_RCVBUFFORCE,
+                   &size,
+                   sizeof(size)) != 0) {
+    ::setsockopt(
+        kNetlinkRouteSocket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  }
+  return Status(0, "OK");
+}
+
+/// Read a dump's reply, returns false if the dump was stopped or failed.
+static bool readNetlinkDump(uint32_t sequence,
+                            const NetlinkMessageHandler& handler,
+                            Status& status) {
+  std::vector<char> buffer(kNetlinkReadSize);
+  for (;;) {
+    auto size = ::recv(kNetlinkRouteSocket, buffer.data(), buffer.size(), 0);
+    if (size < 0 && errno == EINTR) {
+      continue;
+    } else if (size <= 0) {
+      status = Status(1, "Could not read from NETLINK");
+      return false;
+    }
+
+    auto header = reinterpret_cast<struct nlmsghdr*>(buffer.data());
+    for (; NLMSG_OK(header, size); header = NLMSG_NEXT(header, size)) {
+      if (header->nlmsg_seq != sequence) {
+        // A reply to an earlier dump, which was stopped.
+        continue;
+      } else if (header->nlmsg_type == NLMSG_DONE) {
+        status = Status(0, "OK");
+        return true;
+      } else if (header->nlmsg_type == NLMSG_ERROR) {
+        status = Status(1, "Read NETLINK error message");
+        return false;
+      }
+
+      if (!handler(header)) {
+        status = Status(0, "OK");
+        return false;
+      }
+    }
+  }
+}
+
+Status dumpNetlinkRoute(int type,
+                        unsigned char family,
+                        const NetlinkMessageHandler& handler) {
+  std::lock_guard<std::mutex> lock(kNetlinkRouteMutex);
+  auto status = openNetlinkRoute();
+  if (!status.ok()) {
+    return status;
+  }
+
+  // The rtgenmsg family selects the dumped address family for any table.
+  struct {
+    struct nlmsghdr header;
+    struct rtgenmsg message;
+  } request;
+  memset(&request, 0, sizeof(request));
+  request.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtgenmsg));
+  request.header.nlmsg_type = type;
+  request.header.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST;
+  request.header.nlmsg_seq = ++kNetlinkSequence;
+  request.message.rtgen_family = family;
+
+  struct sockaddr_nl address;
+  memset(&address, 0, sizeof(address));
+  address.nl_family = AF_NETLINK;
+  if (::sendto(kNetlinkRouteSocket,
+               &request,
+               request.header.nlmsg_len,
+               0,
+               (struct sockaddr*)&address,
+               sizeof(address)) < 0) {
+    closeNetlinkRoute();
+    return Status(1, "Cannot write NETLINK request header to socket");
+  }
+
+  if (!readNetlinkDump(request.header.nlmsg_seq, handler, status)) {
+    // The rest of a stopped or failed dump would be read by the next dump.
+    closeNetlinkRoute();
+  }
+  return status;
+}
+
+void NetlinkMirror::enable() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  enabled_ = true;
+}
+
+void NetlinkMirror::disable() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  enabled_ = false;
+  filled_ = false;
+  rows_.clear();
+}
+
+void NetlinkMirror::invalidate() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  filled_ = false;
+  rows_.clear();
+}
+
+void NetlinkMirror::apply(const struct nlmsghdr* message) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!filled_) {
+    // The next fill dumps the change.
+    return;
+  }
+
+  std::string key;
+  Row r;
+  if (!parser_(message, key, r)) {
+    return;
+  }
+
+  // Each RTM_NEW* type is even, followed by its RTM_DEL* type.
+  if (message->nlmsg_type % 2 == 0) {
+    rows_[key] = std::move(r);
+  } else {
+    rows_.erase(key);
+  }
+}
+
+bool NetlinkMirror::generate(const RowYield& yield) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!enabled_) {
+    return false;
+  }
+
+  if (!filled_) {
+    // Changes are applied after the fill, while the lock is held.
+    rows_.clear();
+    auto status =
+        dumpNetlinkRoute(type_, family_, [this](const struct nlmsghdr* msg) {
+          std::string key;
+          Row r;
+          if (msg->nlmsg_type % 2 == 0 && parser_(msg, key, r)) {
+            rows_[key] = std::move(r);
+          }
+          return true;
+        });
+    if (!status.ok()) {
+      rows_.clear();
+      return false;
+    }
+    filled_ = true;
+  }
+
+  // Rows are copied so the yield runs without the lock.
+  std::vector<Row> rows;
+  rows.reserve(rows_.size());
+  for (const auto& row : rows_) {
+    rows.push_back(row.second);
+  }
+  lock.unlock();
+
+  for (auto& r : rows) {
+    if (!yield(r)) {
+      break;
+    }
+  }
+  return true;
+}
+}
+}
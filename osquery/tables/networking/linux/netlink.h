@@ -0,0 +1,128 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <sys/socket.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/status.h>
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+/// The receive buffer requested for the route socket, for large dumps.
+extern const size_t kNetlinkReceiveBuffer;
+
+/// Called for each message of a dump, return false to stop the dump.
+typedef std::function<bool(const struct nlmsghdr*)> NetlinkMessageHandler;
+
+/**
+ * @brief Dump a NETLINK_ROUTE table, streaming each message to a handler.
+ *
+ * A single route socket is kept open and reused by every dump, dumps are
+ * serialized. Each recv may return several messages of a multi-part reply,
+ * the dump ends at NLMSG_DONE. Messages of an earlier, abandoned dump are
+ * discarded by their sequence number.
+ *
+ * @param type The dump request type, such as RTM_GETROUTE or RTM_GETNEIGH.
+ * @param family The address family, or AF_UNSPEC for every family.
+ * @param handler Called with each message of the reply.
+ * @return Failure if the socket could not be used or the kernel returned an
+ * error. Stopping the dump with the handler is not a failure.
+ */
+Status dumpNetlinkRoute(int type,
+                        unsigned char family,
+                        const NetlinkMessageHandler& handler);
+
+/// Format a binary address from a route attribute.
+std::string getNetlinkIP(int family, const char* buffer);
+
+/**
+ * @brief Parse a dumped or multicast message into a row and its identity.
+ *
+ * @return false if the message does not describe a row of the table.
+ */
+typedef std::function<bool(const struct nlmsghdr*, std::string&, Row&)>
+    NetlinkRowParser;
+
+/**
+ * @brief An in-memory copy of a route netlink table.
+ *
+ * The rtnetlink events subscriber enables a mirror and applies each change
+ * message to it. An enabled mirror is filled with a single dump, then serves
+ * every query without dumping again. If changes are lost, or the publisher
+ * stops, the mirror is invalidated and the next query dumps again. A mirror
+ * that is not enabled is never used, tables dump for every query.
+ */
+class NetlinkMirror : private boost::noncopyable {
+ public:
+  NetlinkMirror(int type, unsigned char family, NetlinkRowParser parser)
+      : type_(type), family_(family), parser_(std::move(parser)) {}
+
+  /// Start applying changes, the mirror is filled by the next query.
+  void enable();
+
+  /// Stop using the mirror, for example when changes are not published.
+  void disable();
+
+  /// Dump the table again on the next query.
+  void invalidate();
+
+  /// Add, replace, or remove the row of a RTM_NEW* or RTM_DEL* message.
+  void apply(const struct nlmsghdr* message);
+
+  /**
+   * @brief Yield the mirrored rows, filling the mirror if needed.
+   *
+   * @return false if the mirror is not enabled, the caller should dump.
+   */
+  bool generate(const RowYield& yield);
+
+ private:
+  /// The dump request type and family.
+  int type_;
+  unsigned char family_;
+  NetlinkRowParser parser_;
+
+  /// The mirrored rows by their identity.
+  std::map<std::string, Row> rows_;
+  bool enabled_{false};
+  bool filled_{false};
+  std::mutex mutex_;
+};
+
+/// Parse a route into a routes row, see NetlinkRowParser.
+bool parseNetlinkRoute(const struct nlmsghdr* netlink_msg,
+                       std::string& key,
+                       Row& r);
+
+/// Parse an IPv4 neighbor into an arp_cache row, see NetlinkRowParser.
+bool parseNetlinkNeighbor(const struct nlmsghdr* netlink_msg,
+                          std::string& key,
+                          Row& r);
+
+/// The mirror of the routes table.
+NetlinkMirror& getRouteMirror();
+
+/// The mirror of the arp_cache table.
+NetlinkMirror& getNeighborMirror();
+}
+}
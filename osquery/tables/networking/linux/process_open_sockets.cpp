@@ -9,14 +9,26 @@
  */
 
 #include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
 
-#include <boost/algorithm/string/split.hpp>
+#include <sys/socket.h>
+
+#include <linux/netlink.h>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/filesystem/linux/proc_fields.h"
+#include "osquery/tables/networking/linux/inet_diag.h"
+
+#ifndef SOCK_DIAG_BY_FAMILY
+#define SOCK_DIAG_BY_FAMILY 20
+#endif
+
 namespace osquery {
 namespace tables {
 
@@ -61,9 +73,40 @@ unsigned short portFromHex(const std::string &encoded_port) {
   return decoded;
 }
 
+/// Compare the start of a /proc/net table line with a literal.
+inline bool isPrefix(const Tokenizer &line, const char *prefix) {
+  size_t length = strlen(prefix);
+  return line.size() >= length && memcmp(line.data(), prefix, length) == 0;
+}
+
+/// Split an "address:port" field, false if the field is malformed.
+inline bool splitAddress(const ProcTextField &field,
+                         std::string &address,
+                         std::string &port) {
+  const char *end = field.first + field.second;
+  auto colon = static_cast<const char *>(memchr(field.first, ':', field.second));
+  if (colon == nullptr || colon == field.first || colon + 1 == end ||
+      memchr(colon + 1, ':', end - colon - 1) != nullptr) {
+    return false;
+  }
+
+  address.assign(field.first, colon);
+  port.assign(colon + 1, end);
+  return true;
+}
+
+/// Protocols with sock_diag support, others are always read from /proc.
+const std::set<int> kLinuxDiagProtocols = {
+    IPPROTO_TCP, IPPROTO_UDP, IPPROTO_UDPLITE,
+};
+
+/// Netlink replies are read in chunks of many inet_diag_msg%s.
+const size_t kDiagBufferSize = 32 * 1024;
+
 void genSocketsFromProc(const std::map<std::string, std::string> &inodes,
                         int protocol,
                         int family,
+                        const QueryContext &context,
                         QueryData &results) {
   std::string path = "/proc/net/";
   if (family == AF_UNIX) {
@@ -80,20 +123,20 @@ void genSocketsFromProc(const std::map<std::string, std::string> &inodes,
   }
 
   // The system's socket information is tokenized by line.
-  size_t index = 0;
-  for (const auto &line : osquery::split(content, "\n")) {
-    if (++index == 1) {
-      // The first line is a textual header and will be ignored.
-      if (line.find("sl") != 0 && line.find("sk") != 0 &&
-          line.find("Num") != 0) {
-        // Header fields are unknown, stop parsing.
-        break;
-      }
-      continue;
-    }
+  Tokenizer lines(content, "\n");
+  if (!lines.next() ||
+      !(isPrefix(lines, "sl") || isPrefix(lines, "sk") ||
+        isPrefix(lines, "Num"))) {
+    // The first line is a textual header, if the fields are unknown stop.
+    return;
+  }
 
+  // Fields point into the content, only the reported fields are copied.
+  ProcTextLine<10> fields;
+  std::string local_address, local_port, remote_address, remote_port;
+  while (lines.next()) {
     // The socket information is tokenized by spaces, each a field.
-    auto fields = osquery::split(line, " ");
+    fields.split(lines.data(), lines.size());
     // UNIX socket reporting has a smaller number of fields.
     size_t min_fields = (family == AF_UNIX) ? 7 : 10;
     if (fields.size() < min_fields) {
@@ -101,81 +144,195 @@ void genSocketsFromProc(const std::map<std::string, std::string> &inodes,
       continue;
     }
 
-
     Row r;
     if (family == AF_UNIX) {
-      r["socket"] = fields[6];
+      r["socket"] = std::string(fields[6].first, fields[6].second);
       r["family"] = "0";
-      r["protocol"] = fields[2];
+      r["protocol"] = std::string(fields[2].first, fields[2].second);
       r["local_address"] = "";
       r["local_port"] = "0";
       r["remote_address"] = "";
       r["remote_port"] = "0";
-      r["path"] = (fields.size() >= 8) ? fields[7] : "";
+      // The path is the rest of the line, and may contain spaces.
+      auto path = fields.rest(7);
+      r["path"] = std::string(path.first, path.second);
     } else {
       // Two of the fields are the local/remote address/port pairs.
-      auto locals = osquery::split(fields[1], ":");
-      auto remotes = osquery::split(fields[2], ":");
-      if (locals.size() != 2 || remotes.size() != 2) {
+      if (!splitAddress(fields[1], local_address, local_port) ||
+          !splitAddress(fields[2], remote_address, remote_port)) {
         // Unknown/malformed socket information.
         continue;
       }
 
-      r["socket"] = fields[9];
+      r["socket"] = std::string(fields[9].first, fields[9].second);
       r["family"] = INTEGER(family);
       r["protocol"] = INTEGER(protocol);
-      r["local_address"] = addressFromHex(locals[0], family);
-      r["local_port"] = INTEGER(portFromHex(locals[1]));
-      r["remote_address"] = addressFromHex(remotes[0], family);
-      r["remote_port"] = INTEGER(portFromHex(remotes[1]));
+      if (context.isColumnUsed("local_address")) {
+        r["local_address"] = addressFromHex(local_address, family);
+      }
+      r["local_port"] = INTEGER(portFromHex(local_port));
+      if (context.isColumnUsed("remote_address")) {
+        r["remote_address"] = addressFromHex(remote_address, family);
+      }
+      r["remote_port"] = INTEGER(portFromHex(remote_port));
       // Path is only used for UNIX domain sockets.
       r["path"] = "";
     }
 
-    if (inodes.count(r["socket"]) > 0) {
-      r["pid"] = inodes.at(r["socket"]);
-    } else {
-      r["pid"] = "-1";
+    if (context.isColumnUsed("pid")) {
+      auto inode = inodes.find(r["socket"]);
+      r["pid"] = (inode != inodes.end()) ? inode->second : "-1";
     }
 
     results.push_back(r);
   }
 }
 
+/**
+ * @brief Request a dump of every socket for a family and protocol.
+ *
+ * The sock_diag netlink interface returns binary socket information, which
+ * avoids formatting and parsing the /proc/net text tables.
+ *
+ * @return false if the request failed and /proc should be used.
+ */
+bool genSocketsFromNetlink(int handle,
+                           const std::map<std::string, std::string> &inodes,
+                           int protocol,
+                           int family,
+                           const QueryContext &context,
+                           QueryData &results) {
+  struct {
+    struct nlmsghdr header;
+    struct inet_diag_req_v2 request;
+  } message;
+  memset(&message, 0, sizeof(message));
+  message.header.nlmsg_len = sizeof(message);
+  message.header.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+  message.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  message.header.nlmsg_seq = (protocol << 8) | family;
+  message.request.sdiag_family = family;
+  message.request.sdiag_protocol = protocol;
+  // Report sockets in every state, like /proc.
+  message.request.idiag_states = ~0U;
+
+  struct sockaddr_nl address;
+  memset(&address, 0, sizeof(address));
+  address.nl_family = AF_NETLINK;
+  if (::sendto(handle,
+               &message,
+               sizeof(message),
+               0,
+               (struct sockaddr *)&address,
+               sizeof(address)) < 0) {
+    return false;
+  }
+
+  std::vector<char> buffer(kDiagBufferSize);
+  size_t start = results.size();
+  for (;;) {
+    auto size = ::recv(handle, buffer.data(), buffer.size(), 0);
+    if (size < 0 && errno == EINTR) {
+      continue;
+    } else if (size <= 0) {
+      break;
+    }
+
+    auto header = reinterpret_cast<struct nlmsghdr *>(buffer.data());
+    for (; NLMSG_OK(header, size); header = NLMSG_NEXT(header, size)) {
+      if (header->nlmsg_seq != message.header.nlmsg_seq) {
+        continue;
+      } else if (header->nlmsg_type == NLMSG_DONE) {
+        return true;
+      } else if (header->nlmsg_type == NLMSG_ERROR) {
+        // The protocol is not supported (e.g., the diag module is missing).
+        // Discard partial results so /proc may report every socket.
+        results.resize(start);
+        return false;
+      } else if (header->nlmsg_type != SOCK_DIAG_BY_FAMILY ||
+                 header->nlmsg_len < NLMSG_LENGTH(sizeof(inet_diag_msg))) {
+        continue;
+      }
+
+      auto diag = reinterpret_cast<struct inet_diag_msg *>(NLMSG_DATA(header));
+      Row r;
+      r["socket"] = INTEGER(diag->idiag_inode);
+      r["family"] = INTEGER(family);
+      r["protocol"] = INTEGER(protocol);
+
+      char address_buffer[INET6_ADDRSTRLEN] = {0};
+      if (context.isColumnUsed("local_address")) {
+        inet_ntop(family,
+                  diag->id.idiag_src,
+                  address_buffer,
+                  sizeof(address_buffer));
+        r["local_address"] = TEXT(address_buffer);
+      }
+      r["local_port"] = INTEGER(ntohs(diag->id.idiag_sport));
+      if (context.isColumnUsed("remote_address")) {
+        inet_ntop(family,
+                  diag->id.idiag_dst,
+                  address_buffer,
+                  sizeof(address_buffer));
+        r["remote_address"] = TEXT(address_buffer);
+      }
+      r["remote_port"] = INTEGER(ntohs(diag->id.idiag_dport));
+      // Path is only used for UNIX domain sockets.
+      r["path"] = "";
+
+      if (context.isColumnUsed("pid")) {
+        auto inode = inodes.find(r["socket"]);
+        r["pid"] = (inode != inodes.end()) ? inode->second : "-1";
+      }
+      results.push_back(std::move(r));
+    }
+  }
+
+  // The dump ended without an NLMSG_DONE.
+  results.resize(start);
+  return false;
+}
+
 QueryData genOpenSockets(QueryContext &context) {
   QueryData results;
 
-  // If a pid is given then set that as the only item in processes.
-  std::set<std::string> pids;
+  // If a pid is given then only index the descriptors of those processes.
+  // Reading every process's descriptors is only needed for the pid column.
+  ProcDescriptorIndexRef index;
   if (context.constraints["pid"].exists(EQUALS)) {
-    pids = context.constraints["pid"].getAll(EQUALS);
+    index = procDescriptorIndex(context.constraints["pid"].getAll(EQUALS));
+  } else if (context.isColumnUsed("pid")) {
+    index = procDescriptorIndex();
   } else {
-    osquery::procProcesses(pids);
+    index = std::make_shared<ProcDescriptorIndex>();
   }
+  const auto &socket_inodes = index->sockets;
 
-  // Generate a map of socket inode to process tid.
-  std::map<std::string, std::string> socket_inodes;
-  for (const auto &process : pids) {
-    std::map<std::string, std::string> descriptors;
-    if (osquery::procDescriptors(process, descriptors).ok()) {
-      for (const auto& fd : descriptors) {
-        if (fd.second.find("socket:[") == 0) {
-          // See #792: std::regex is incomplete until GCC 4.9 (skip 8 chars)
-          auto inode = fd.second.substr(8);
-          socket_inodes[inode.substr(0, inode.size() - 1)] = process;
-        }
+  // Request TCP and UDP socket information with sock_diag netlink messages
+  // (Ref: #1094), if the socket or a request fails use /proc messages.
+  int handle =
+      ::socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_INET_DIAG);
+  for (const auto &protocol : kLinuxProtocolNames) {
+    for (const auto &family : {AF_INET, AF_INET6}) {
+      if (handle >= 0 && kLinuxDiagProtocols.count(protocol.first) > 0 &&
+          genSocketsFromNetlink(handle,
+                                socket_inodes,
+                                protocol.first,
+                                family,
+                                context,
+                                results)) {
+        continue;
       }
+      genSocketsFromProc(
+          socket_inodes, protocol.first, family, context, results);
     }
   }
 
-  // This used to use netlink (Ref: #1094) to request socket information.
-  // Use proc messages to query socket information.
-  for (const auto &protocol : kLinuxProtocolNames) {
-    genSocketsFromProc(socket_inodes, protocol.first, AF_INET, results);
-    genSocketsFromProc(socket_inodes, protocol.first, AF_INET6, results);
+  if (handle >= 0) {
+    ::close(handle);
   }
 
-  genSocketsFromProc(socket_inodes, IPPROTO_IP, AF_UNIX, results);
+  genSocketsFromProc(socket_inodes, IPPROTO_IP, AF_UNIX, context, results);
   return results;
 }
 }
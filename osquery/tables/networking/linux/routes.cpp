@@ -8,112 +8,89 @@
  *
  */
 
-#include <sys/socket.h>
-#include <linux/netlink.h>
-#include <linux/rtnetlink.h>
-#include <net/if.h>
+#include <set>
 
-#include <boost/algorithm/string/trim.hpp>
+#include <net/if.h>
 
 #include <osquery/core.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/networking/linux/netlink.h"
 #include "osquery/tables/networking/utils.h"
 
 namespace osquery {
 namespace tables {
 
-#define MAX_NETLINK_SIZE 8192
-#define MAX_NETLINK_LATENCY 2000
-
-std::string getNetlinkIP(int family, const char* buffer) {
-  char dst[INET6_ADDRSTRLEN];
-  memset(dst, 0, INET6_ADDRSTRLEN);
-
-  inet_ntop(family, buffer, dst, INET6_ADDRSTRLEN);
-  std::string address(dst);
-  boost::trim(address);
-
-  return address;
-}
+/// Route filters pushed down from the query's constraints.
+struct RouteFilter {
+  std::set<int> interfaces;
+  std::set<std::string> interface_names;
+  std::set<std::string> destinations;
+  bool filter_interfaces{false};
+  bool filter_destinations{false};
+};
+
+/**
+ * @brief Parse a route message into a row.
+ *
+ * @return false if the route is filtered and not parsed.
+ */
+static bool genNetlinkRoute(const struct nlmsghdr* netlink_msg,
+                            const RouteFilter& filter,
+                            Row& r) {
+  struct rtmsg* message = (struct rtmsg*)NLMSG_DATA(netlink_msg);
+  struct rtattr* attr = (struct rtattr*)RTM_RTA(message);
+  int attr_size = RTM_PAYLOAD(netlink_msg);
 
-Status readNetlink(int socket_fd, int seq, char* output, size_t* size) {
-  struct nlmsghdr* nl_hdr;
-
-  size_t message_size = 0;
-  do {
-    int latency = 0;
-    int bytes = 0;
-    while (bytes == 0) {
-      bytes = recv(socket_fd, output, MAX_NETLINK_SIZE - message_size, 0);
-      if (bytes < 0) {
-        return Status(1, "Could not read from NETLINK");
-      } else if (latency >= MAX_NETLINK_LATENCY) {
-        return Status(1, "Netlink timeout");
-      } else if (bytes == 0) {
-        ::usleep(20);
-        latency += 20;
-      }
+  // Filter on the interface and destination before formatting the route.
+  int index = -1;
+  const char* destination = nullptr;
+  for (auto it = attr; RTA_OK(it, attr_size); it = RTA_NEXT(it, attr_size)) {
+    if (it->rta_type == RTA_OIF) {
+      index = *(int*)RTA_DATA(it);
+    } else if (it->rta_type == RTA_DST) {
+      destination = (char*)RTA_DATA(it);
     }
+  }
+  attr_size = RTM_PAYLOAD(netlink_msg);
 
-    // Assure valid header response, and not an error type.
-    nl_hdr = (struct nlmsghdr*)output;
-    if (NLMSG_OK(nl_hdr, bytes) == 0 || nl_hdr->nlmsg_type == NLMSG_ERROR) {
-      return Status(1, "Read invalid NETLINK message");
-    }
+  if (filter.filter_interfaces && filter.interfaces.count(index) == 0) {
+    return false;
+  }
 
-    if (nl_hdr->nlmsg_type == NLMSG_DONE) {
-      break;
+  int mask = 0;
+  if (destination != nullptr) {
+    if (message->rtm_dst_len != 32 && message->rtm_dst_len != 128) {
+      mask = (int)message->rtm_dst_len;
     }
-
-    // Move the buffer pointer
-    output += bytes;
-    message_size += bytes;
-    if ((nl_hdr->nlmsg_flags & NLM_F_MULTI) == 0) {
-      break;
+    r["destination"] = getNetlinkIP(message->rtm_family, destination);
+  } else {
+    r["destination"] = "0.0.0.0";
+    if (message->rtm_dst_len) {
+      mask = (int)message->rtm_dst_len;
     }
-  } while (nl_hdr->nlmsg_seq != seq || nl_hdr->nlmsg_pid != getpid());
-
-  *size = message_size;
-  return Status(0, "OK");
-}
-
-void genNetlinkRoutes(const struct nlmsghdr* netlink_msg, QueryData& results) {
-  std::string address;
-  int mask = 0;
-  char interface[IF_NAMESIZE];
-
-  struct rtmsg* message = (struct rtmsg*)NLMSG_DATA(netlink_msg);
-  struct rtattr* attr = (struct rtattr*)RTM_RTA(message);
-  int attr_size = RTM_PAYLOAD(netlink_msg);
+  }
 
-  Row r;
+  if (filter.filter_destinations &&
+      filter.destinations.count(r.at("destination")) == 0) {
+    return false;
+  }
 
-  // Iterate over each route in the netlink message
-  bool has_destination = false;
   r["metric"] = "0";
+  char interface[IF_NAMESIZE] = {0};
   while (RTA_OK(attr, attr_size)) {
     switch (attr->rta_type) {
     case RTA_OIF:
-      if_indextoname(*(int*)RTA_DATA(attr), interface);
-      r["interface"] = std::string(interface);
+      if (if_indextoname(index, interface) != nullptr) {
+        r["interface"] = std::string(interface);
+      }
       break;
     case RTA_GATEWAY:
-      address = getNetlinkIP(message->rtm_family, (char*)RTA_DATA(attr));
-      r["gateway"] = address;
+      r["gateway"] = getNetlinkIP(message->rtm_family, (char*)RTA_DATA(attr));
       break;
     case RTA_PREFSRC:
-      address = getNetlinkIP(message->rtm_family, (char*)RTA_DATA(attr));
-      r["source"] = address;
-      break;
-    case RTA_DST:
-      if (message->rtm_dst_len != 32 && message->rtm_dst_len != 128) {
-        mask = (int)message->rtm_dst_len;
-      }
-      address = getNetlinkIP(message->rtm_family, (char*)RTA_DATA(attr));
-      r["destination"] = address;
-      has_destination = true;
+      r["source"] = getNetlinkIP(message->rtm_family, (char*)RTA_DATA(attr));
       break;
     case RTA_PRIORITY:
       r["metric"] = INTEGER(*(int*)RTA_DATA(attr));
@@ -122,13 +99,6 @@ void genNetlinkRoutes(const struct nlmsghdr* netlink_msg, QueryData& results) {
     attr = RTA_NEXT(attr, attr_size);
   }
 
-  if (!has_destination) {
-    r["destination"] = "0.0.0.0";
-    if (message->rtm_dst_len) {
-      mask = (int)message->rtm_dst_len;
-    }
-  }
-
   // Route type determination
   if (message->rtm_type == RTN_UNICAST) {
     r["type"] = "gateway";
@@ -149,58 +119,95 @@ void genNetlinkRoutes(const struct nlmsghdr* netlink_msg, QueryData& results) {
 
   // Fields not supported by Linux routes:
   r["mtu"] = "0";
-  results.push_back(r);
+  return true;
 }
 
-QueryData genRoutes(QueryContext& context) {
-  QueryData results;
+/// Parse any route, with an identity from the kernel's route table key.
+bool parseNetlinkRoute(const struct nlmsghdr* netlink_msg,
+                       std::string& key,
+                       Row& r) {
+  if (netlink_msg->nlmsg_len < NLMSG_LENGTH(sizeof(struct rtmsg)) ||
+      !genNetlinkRoute(netlink_msg, RouteFilter(), r)) {
+    return false;
+  }
 
-  int socket_fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE);
-  if (socket_fd < 0) {
-    VLOG(1) << "Cannot open NETLINK socket";
-    return {};
+  // The interface may be removed already, use its index.
+  struct rtmsg* message = (struct rtmsg*)NLMSG_DATA(netlink_msg);
+  struct rtattr* attr = (struct rtattr*)RTM_RTA(message);
+  int attr_size = RTM_PAYLOAD(netlink_msg);
+  int index = -1;
+  for (; RTA_OK(attr, attr_size); attr = RTA_NEXT(attr, attr_size)) {
+    if (attr->rta_type == RTA_OIF) {
+      index = *(int*)RTA_DATA(attr);
+    }
   }
 
-  // Create netlink message header
-  void* netlink_buffer = malloc(MAX_NETLINK_SIZE);
-  struct nlmsghdr* netlink_msg = (struct nlmsghdr*)netlink_buffer;
-  if (netlink_msg == nullptr) {
-    close(socket_fd);
-    return {};
+  key = std::to_string(message->rtm_family) + " " +
+        std::to_string(message->rtm_table) + " " +
+        std::to_string(message->rtm_tos) + " " + r["destination"] + "/" +
+        r["netmask"] + " " + r["metric"] + " " + std::to_string(index);
+  return true;
+}
+
+NetlinkMirror& getRouteMirror() {
+  static NetlinkMirror mirror(RTM_GETROUTE, AF_UNSPEC, parseNetlinkRoute);
+  return mirror;
+}
+
+/// Apply the pushed down filters to a mirrored route.
+static bool matchesRouteFilter(const RouteFilter& filter, const Row& r) {
+  if (filter.filter_interfaces &&
+      filter.interface_names.count(r.count("interface") ? r.at("interface")
+                                                        : "") == 0) {
+    return false;
   }
+  return !filter.filter_destinations ||
+         filter.destinations.count(r.at("destination")) > 0;
+}
 
-  netlink_msg->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
-  netlink_msg->nlmsg_type = RTM_GETROUTE; // routes from kernel routing table
-  netlink_msg->nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST;
-  netlink_msg->nlmsg_seq = 0;
-  netlink_msg->nlmsg_pid = getpid();
-
-  // Send the netlink request to the kernel
-  if (send(socket_fd, netlink_msg, netlink_msg->nlmsg_len, 0) < 0) {
-    VLOG(1) << "Cannot write NETLINK request header to socket";
-    close(socket_fd);
-    free(netlink_buffer);
-    return {};
+void genRoutes(QueryContext& context, const RowYield& yield) {
+  RouteFilter filter;
+  if (context.constraints["interface"].exists(EQUALS)) {
+    filter.filter_interfaces = true;
+    filter.interface_names = context.constraints["interface"].getAll(EQUALS);
+    for (const auto& name : filter.interface_names) {
+      auto index = if_nametoindex(name.c_str());
+      if (index != 0) {
+        filter.interfaces.insert(index);
+      }
+    }
+    if (filter.interfaces.empty()) {
+      return;
+    }
   }
 
-  // Wrap the read socket to support multi-netlink messages
-  size_t size = 0;
-  if (!readNetlink(socket_fd, 1, (char*)netlink_msg, &size).ok()) {
-    VLOG(1) << "Cannot read NETLINK response from socket";
-    close(socket_fd);
-    free(netlink_buffer);
-    return {};
+  if (context.constraints["destination"].exists(EQUALS)) {
+    filter.filter_destinations = true;
+    filter.destinations = context.constraints["destination"].getAll(EQUALS);
   }
 
-  // Treat the netlink response as route information
-  while (NLMSG_OK(netlink_msg, size)) {
-    genNetlinkRoutes(netlink_msg, results);
-    netlink_msg = NLMSG_NEXT(netlink_msg, size);
+  // Serve the routes from the mirror when changes are published.
+  if (getRouteMirror().generate([&filter, &yield](Row& r) {
+        return !matchesRouteFilter(filter, r) || yield(r);
+      })) {
+    return;
   }
 
-  close(socket_fd);
-  free(netlink_buffer);
-  return results;
+  auto status = dumpNetlinkRoute(
+      RTM_GETROUTE, AF_UNSPEC, [&filter, &yield](const struct nlmsghdr* msg) {
+        if (msg->nlmsg_type != RTM_NEWROUTE) {
+          return true;
+        }
+        Row r;
+        if (!genNetlinkRoute(msg, filter, r)) {
+          return true;
+        }
+        return yield(r);
+      });
+
+  if (!status.ok()) {
+    VLOG(1) << "Cannot dump NETLINK routes: " << status.getMessage();
+  }
 }
 }
 }
@@ -12,8 +12,8 @@
 
 #include <osquery/logger.h>
 
-#include <libiptc/libiptc.h>
 #include <arpa/inet.h>
+#include <linux/netfilter_ipv4/ip_tables.h>
 
 #include "osquery/core/test_util.h"
 
@@ -21,6 +21,11 @@ namespace osquery {
 namespace tables {
 
 void parseIpEntry(ipt_ip *ip, Row &row);
+void parseIptablesEntries(const std::string& filter,
+                          const struct ipt_getinfo& info,
+                          const char* entries,
+                          size_t size,
+                          QueryData& results);
 
 ipt_ip* getIpEntryContent() {
   static ipt_ip ip_entry;
@@ -61,5 +66,64 @@ TEST_F(IptablesTests, test_iptables_ip_entry) {
   parseIpEntry(getIpEntryContent(), row);
   EXPECT_EQ(row, getIpEntryExpectedResults());
 }
+/// Append a rule with a standard verdict, or an error target naming a chain.
+static size_t addEntry(std::vector<char>& entries,
+                       int verdict,
+                       const std::string& error = "") {
+  size_t offset = entries.size();
+  size_t target_size = (error.empty())
+                           ? XT_ALIGN(sizeof(struct xt_standard_target))
+                           : XT_ALIGN(sizeof(struct xt_error_target));
+  entries.resize(offset + sizeof(struct ipt_entry) + target_size, 0);
+
+  auto entry = reinterpret_cast<struct ipt_entry*>(entries.data() + offset);
+  entry->target_offset = sizeof(struct ipt_entry);
+  entry->next_offset = sizeof(struct ipt_entry) + target_size;
+  entry->ip.proto = 6;
+  if (error.empty()) {
+    auto target = reinterpret_cast<struct xt_standard_target*>(entry->elems);
+    target->verdict = verdict;
+  } else {
+    auto target = reinterpret_cast<struct xt_error_target*>(entry->elems);
+    strcpy(target->target.u.user.name, XT_ERROR_TARGET);
+    strcpy(target->errorname, error.c_str());
+  }
+  return offset;
+}
+
+TEST_F(IptablesTests, test_iptables_entries) {
+  // An INPUT rule jumping to a user chain, followed by the INPUT policy.
+  std::vector<char> entries;
+  struct ipt_getinfo info;
+  memset(&info, 0, sizeof(info));
+  info.valid_hooks = 1 << NF_INET_LOCAL_IN;
+  info.hook_entry[NF_INET_LOCAL_IN] = addEntry(entries, 0);
+  info.underflow[NF_INET_LOCAL_IN] = addEntry(entries, -NF_ACCEPT - 1);
+
+  // The user chain drops, then returns.
+  addEntry(entries, 0, "KUBE");
+  auto kube = addEntry(entries, -NF_DROP - 1);
+  addEntry(entries, XT_RETURN);
+  addEntry(entries, 0, XT_ERROR_TARGET);
+  reinterpret_cast<struct xt_standard_target*>(
+      reinterpret_cast<struct ipt_entry*>(entries.data())->elems)
+      ->verdict = kube;
+
+  QueryData results;
+  parseIptablesEntries("filter", info, entries.data(), entries.size(), results);
+  ASSERT_EQ(results.size(), 4U);
+
+  // Each chain's rules are followed by a row of the chain.
+  EXPECT_EQ(results[0]["chain"], "INPUT");
+  EXPECT_EQ(results[0]["policy"], "ACCEPT");
+  EXPECT_EQ(results[0]["target"], "KUBE");
+  EXPECT_EQ(results[0]["protocol"], "6");
+  EXPECT_EQ(results[1]["chain"], "INPUT");
+  EXPECT_EQ(results[2]["chain"], "KUBE");
+  EXPECT_EQ(results[2]["policy"], "");
+  EXPECT_EQ(results[2]["target"], "DROP");
+  EXPECT_EQ(results[3]["chain"], "KUBE");
+  EXPECT_EQ(results[3]["filter_name"], "filter");
+}
 }
 }
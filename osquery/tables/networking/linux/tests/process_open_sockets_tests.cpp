@@ -0,0 +1,91 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+#include <linux/netlink.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+void genSocketsFromProc(const std::map<std::string, std::string> &inodes,
+                        int protocol,
+                        int family,
+                        const QueryContext &context,
+                        QueryData &results);
+
+bool genSocketsFromNetlink(int handle,
+                           const std::map<std::string, std::string> &inodes,
+                           int protocol,
+                           int family,
+                           const QueryContext &context,
+                           QueryData &results);
+
+class ProcessOpenSocketsTests : public testing::Test {};
+
+TEST_F(ProcessOpenSocketsTests, test_netlink_matches_proc) {
+  // Open a listening socket to guarantee a result.
+  int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_GE(listener, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(::bind(listener, (struct sockaddr *)&address, sizeof(address)), 0);
+  ASSERT_EQ(::listen(listener, 1), 0);
+
+  int handle = ::socket(AF_NETLINK, SOCK_DGRAM, NETLINK_INET_DIAG);
+  if (handle < 0) {
+    ::close(listener);
+    return;
+  }
+
+  QueryContext context;
+  QueryData netlink_results;
+  auto netlink = genSocketsFromNetlink(
+      handle, {}, IPPROTO_TCP, AF_INET, context, netlink_results);
+  ::close(handle);
+
+  QueryData proc_results;
+  genSocketsFromProc({}, IPPROTO_TCP, AF_INET, context, proc_results);
+  ::close(listener);
+  if (!netlink) {
+    // The sock_diag module is not available.
+    return;
+  }
+
+  // Both backends report the same listening socket identically.
+  auto find = [](const QueryData &results, const std::string &port) {
+    for (const auto &r : results) {
+      if (r.at("local_port") == port && r.at("remote_port") == "0") {
+        return r;
+      }
+    }
+    return Row();
+  };
+
+  ASSERT_FALSE(proc_results.empty());
+  for (const auto &r : proc_results) {
+    if (r.at("remote_port") != "0" || r.at("local_address") != "127.0.0.1") {
+      continue;
+    }
+    auto match = find(netlink_results, r.at("local_port"));
+    EXPECT_EQ(match, r);
+  }
+}
+}
+}
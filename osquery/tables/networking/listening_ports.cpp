@@ -20,7 +20,12 @@ typedef std::map<std::string, std::vector<ProtoFamilyPair> > PortMap;
 QueryData genListeningPorts(QueryContext& context) {
   QueryData results;
 
-  auto sockets = SQL::selectAllFrom("process_open_sockets");
+  // Only select the used columns, sockets are not resolved to remote addresses
+  // or UNIX domain paths.
+  SQL sql(
+      "SELECT pid, local_port, protocol, family, local_address, remote_port "
+      "FROM process_open_sockets");
+  const auto& sockets = sql.rows();
 
   PortMap ports;
   for (const auto& socket : sockets) {
@@ -73,4 +73,96 @@ TEST_F(YARATest, test_match_false) {
   // Should have 0 count
   EXPECT_TRUE(r["count"] == "0");
 }
+
+TEST_F(YARATest, test_compiled_rules_reuse) {
+  EXPECT_TRUE(yr_initialize() == ERROR_SUCCESS);
+  writeTextFile(ruleFile, alwaysTrue);
+
+  YARARulesRef rules;
+  std::string content_hash;
+  EXPECT_TRUE(getCompiledRules(ruleFile, rules, content_hash).ok());
+  EXPECT_FALSE(content_hash.empty());
+
+  // The same content reuses the compiled rules.
+  YARARulesRef same;
+  std::string same_hash;
+  EXPECT_TRUE(getCompiledRules(ruleFile, same, same_hash).ok());
+  EXPECT_EQ(rules.get(), same.get());
+  EXPECT_EQ(content_hash, same_hash);
+
+  // Changed content is compiled again.
+  writeTextFile(ruleFile, alwaysFalse);
+  YARARulesRef changed;
+  std::string changed_hash;
+  EXPECT_TRUE(getCompiledRules(ruleFile, changed, changed_hash).ok());
+  EXPECT_NE(content_hash, changed_hash);
+
+  Row r;
+  r["count"] = "0";
+  r["matches"] = "";
+  EXPECT_TRUE(scanYARAFile(changed.get(), ls, r).ok());
+  EXPECT_TRUE(r["count"] == "0");
+}
+
+TEST_F(YARATest, test_rule_group_hash) {
+  EXPECT_TRUE(yr_initialize() == ERROR_SUCCESS);
+  writeTextFile(ruleFile, alwaysTrue);
+
+  pt::ptree rule_files;
+  pt::ptree rule_file;
+  rule_file.put("", ruleFile);
+  rule_files.push_back(std::make_pair("", rule_file));
+
+  // The hash only changes with the rule files' content.
+  auto content_hash = getRuleGroupHash(rule_files);
+  EXPECT_EQ(content_hash, getRuleGroupHash(rule_files));
+
+  YARARulesRef rules;
+  EXPECT_TRUE(
+      getCompiledRuleGroup("test", rule_files, content_hash, rules).ok());
+  Row r;
+  r["count"] = "0";
+  r["matches"] = "";
+  EXPECT_TRUE(scanYARAFile(rules.get(), ls, r).ok());
+  EXPECT_TRUE(r["count"] == "1");
+
+  writeTextFile(ruleFile, alwaysFalse);
+  EXPECT_NE(content_hash, getRuleGroupHash(rule_files));
+}
+
+TEST_F(YARATest, test_scan_queue) {
+  YARAScanQueue queue;
+  auto window = std::chrono::milliseconds(0);
+
+  YARAScanRequest large;
+  large.path = "/large";
+  large.size = 1000;
+  EXPECT_TRUE(queue.add(large, 2, window));
+
+  YARAScanRequest small;
+  small.path = "/small";
+  small.size = 10;
+  EXPECT_TRUE(queue.add(small, 2, window));
+
+  // Another event for a queued path is coalesced.
+  large.r["action"] = "UPDATED";
+  EXPECT_TRUE(queue.add(large, 2, window));
+  EXPECT_EQ(queue.size(), 2U);
+
+  // New paths are dropped when the queue is full.
+  YARAScanRequest dropped;
+  dropped.path = "/dropped";
+  EXPECT_FALSE(queue.add(dropped, 2, window));
+
+  // The smallest file is scanned first.
+  YARAScanRequest request;
+  EXPECT_TRUE(queue.take(request));
+  EXPECT_EQ(request.path, "/small");
+  EXPECT_TRUE(queue.take(request));
+  EXPECT_EQ(request.path, "/large");
+  EXPECT_EQ(request.r["action"], "UPDATED");
+
+  queue.stop();
+  EXPECT_FALSE(queue.take(request));
+}
 }
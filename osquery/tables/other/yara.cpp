@@ -8,9 +8,16 @@
  *
  */
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
 #include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
 
+#include <osquery/database.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 #include <osquery/status.h>
@@ -25,39 +32,111 @@
 namespace osquery {
 namespace tables {
 
-Status doYARAScan(YR_RULES* rules,
-                  const std::string& path,
-                  const std::string& pattern,
-                  QueryData& results,
-                  const std::string& group,
-                  const std::string& sigfile) {
-  Row r;
+DECLARE_bool(disable_hash_cache);
+
+/// Cached scan results are keyed by the rules and scanned path.
+const std::string kYARACachePrefix = "yara.";
+
+/// Scan files concurrently, each thread scans the next file and rule set.
+const size_t kYARAScanThreads = 4;
+
+/// A file and the rules to scan it with, from a sig_group or sigfile.
+struct YARAScanTask {
+  std::string path;
+  std::string pattern;
+  std::string group;
+  std::string sigfile;
+  YARARulesRef rules;
+  std::string rules_identity;
+};
 
+Status doYARAScan(const YARAScanTask& task, Row& r) {
   // These are default values, to be updated in YARACallback.
   r["count"] = INTEGER(0);
   r["matches"] = std::string("");
 
   // XXX: use target_path instead to be consistent with yara_events?
-  r["path"] = path;
-
-  r["pattern"] = pattern;
+  r["path"] = task.path;
+
+  r["pattern"] = task.pattern;
+
+  r["sig_group"] = task.group;
+  r["sigfile"] = task.sigfile;
+
+  // Reuse the results of unchanged rules scanning an unchanged file.
+  // A cache entry is formatted: identity, rules identity, count, matches.
+  std::string identity;
+  auto key =
+      kYARACachePrefix + task.group + ":" + task.sigfile + ":" + task.path;
+  if (!FLAGS_disable_hash_cache && !task.rules_identity.empty() &&
+      getFileIdentity(task.path, identity).ok()) {
+    std::string content;
+    if (getDatabaseValue(kFileCache, key, content).ok()) {
+      auto cached = osquery::split(content, "\n", 3);
+      if (cached.size() >= 3 && cached[0] == identity &&
+          cached[1] == task.rules_identity) {
+        r["count"] = cached[2];
+        r["matches"] = (cached.size() == 4) ? cached[3] : "";
+        return Status(0, "OK");
+      }
+    }
+  }
 
-  r["sig_group"] = std::string(group);
-  r["sigfile"] = std::string(sigfile);
+  auto status = scanYARAFile(task.rules.get(), task.path, r);
+  if (!status.ok()) {
+    return status;
+  }
 
-  int result = yr_rules_scan_file(rules,
-                                  path.c_str(),
-                                  SCAN_FLAGS_FAST_MODE,
-                                  YARACallback,
-                                  (void*)&r,
-                                  0);
+  if (!identity.empty()) {
+    setDatabaseValue(kFileCache,
+                     key,
+                     identity + "\n" + task.rules_identity + "\n" +
+                         r["count"] + "\n" + r["matches"]);
+  }
+  return Status(0, "OK");
+}
 
-  if (result != ERROR_SUCCESS) {
-    return Status(1, "Scan error (" + std::to_string(result) + ")");
+void doYARAScans(const std::vector<YARAScanTask>& tasks,
+                 const QueryContext& context,
+                 QueryData& results) {
+  std::vector<Row> rows(tasks.size());
+  std::vector<Status> statuses(tasks.size());
+  std::atomic<size_t> next(0);
+  auto scan = [&tasks, &context, &rows, &statuses, &next]() {
+    // File sizes vary, each thread takes the next unscanned task.
+    for (size_t i = next++; i < tasks.size(); i = next++) {
+      if (context.isCancelled()) {
+        statuses[i] = Status(1, "Query cancelled");
+        continue;
+      }
+      statuses[i] = doYARAScan(tasks[i], rows[i]);
+    }
+  };
+
+  size_t threads = std::max(boost::thread::hardware_concurrency(), 1U);
+  threads = std::min(std::min(threads, kYARAScanThreads), tasks.size());
+
+  // The calling thread also scans, YARA keeps per-thread scan state.
+  std::vector<std::unique_ptr<boost::thread>> workers;
+  for (size_t i = 1; i < threads; ++i) {
+    workers.emplace_back(new boost::thread([&scan]() {
+      scan();
+      yr_finalize_thread();
+    }));
+  }
+  scan();
+  for (auto& worker : workers) {
+    worker->join();
   }
 
-  results.push_back(r);
-  return Status(0, "OK");
+  // Results keep the order of the scanned paths.
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    if (statuses[i].ok()) {
+      results.push_back(std::move(rows[i]));
+    } else {
+      VLOG(1) << "YARA error: " << statuses[i].toString();
+    }
+  }
 }
 
 QueryData genYara(QueryContext& context) {
@@ -116,27 +195,21 @@ QueryData genYara(QueryContext& context) {
     path_pairs.push_back(make_pair(path_string, ""));
   }
 
-  // Compile all sigfiles into a map.
-  std::map<std::string, YR_RULES*> compiled_rules;
+  // Compile all sigfiles, or reuse rules compiled from the same content.
+  std::map<std::string, YARARulesRef> compiled_rules;
+  std::map<std::string, std::string> compiled_hashes;
   for (const auto& file : sigfiles) {
-    YR_RULES *rules = nullptr;
-
-    std::string full_path;
-    if (file[0] != '/') {
-      full_path = std::string("/etc/osquery/yara/") + file;
-    } else {
-      full_path = file;
-    }
-
-    status = compileSingleFile(full_path, &rules);
+    auto full_path = getYARARulePath(file);
+    status = getCompiledRules(
+        full_path, compiled_rules[file], compiled_hashes[file]);
     if (!status.ok()) {
       VLOG(1) << "YARA error: " << status.toString();
-    } else {
-      compiled_rules[file] = rules;
+      compiled_rules.erase(file);
     }
   }
 
   // Scan every path pair.
+  std::vector<YARAScanTask> tasks;
   for (const auto& path_pair : path_pairs) {
     // Scan using siggroups.
     for (const auto& group : groups) {
@@ -145,37 +218,29 @@ QueryData genYara(QueryContext& context) {
       }
 
       VLOG(1) << "Scanning with group: " << group;
-      status = doYARAScan(rules[group],
-                          path_pair.first.c_str(),
-                          path_pair.second,
-                          results,
-                          group,
-                          "");
-      if (!status.ok()) {
-        VLOG(1) << "YARA error: " << status.toString();
-      }
+      YARAScanTask task;
+      task.path = path_pair.first;
+      task.pattern = path_pair.second;
+      task.group = group;
+      task.rules = rules[group];
+      task.rules_identity = yaraParser->rulesIdentity(group);
+      tasks.push_back(std::move(task));
     }
 
     // Scan using files.
     for (const auto& element : compiled_rules) {
       VLOG(1) << "Scanning with file: " << element.first;
-      status = doYARAScan(element.second,
-                          path_pair.first.c_str(),
-                          path_pair.second,
-                          results,
-                          "",
-                          element.first);
-      if (!status.ok()) {
-        VLOG(1) << "YARA error: " << status.toString();
-      }
+      YARAScanTask task;
+      task.path = path_pair.first;
+      task.pattern = path_pair.second;
+      task.sigfile = element.first;
+      task.rules = element.second;
+      task.rules_identity = compiled_hashes[element.first];
+      tasks.push_back(std::move(task));
     }
   }
 
-  // Cleanup compiled rules
-  for (const auto& element : compiled_rules) {
-    yr_rules_destroy(element.second);
-  }
-
+  doYARAScans(tasks, context, results);
   return results;
 }
 }
@@ -8,16 +8,49 @@
  *
  */
 
+#include <sys/stat.h>
+
+#include <algorithm>
 #include <map>
+#include <mutex>
 #include <string>
 
 #include <osquery/config.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/hash.h>
 #include <osquery/logger.h>
 
+#include "osquery/dispatcher/dispatcher.h"
 #include "osquery/tables/other/yara_utils.h"
 
 namespace osquery {
 
+FLAG(uint64,
+     yara_scan_timeout,
+     60,
+     "Seconds a YARA scan of a single file may take, 0 for no limit");
+
+FLAG(uint64,
+     yara_max_file_size,
+     64 * 1024 * 1024,
+     "Bytes of the largest file scanned with YARA, 0 for no limit");
+
+FLAG(string,
+     yara_rules_cache,
+     "",
+     "Directory of compiled YARA signature groups, loaded instead of "
+     "compiling");
+
+/// Compiled sigfile rules (content hash => rules).
+static std::map<std::string, YARARulesRef> kCompiledRules;
+
+/// The content hash last compiled for each sigfile path (path => hash).
+static std::map<std::string, std::string> kCompiledRulesHashes;
+
+/// Protects the compiled sigfile rules, a sigfile is compiled once.
+static std::mutex kCompiledRulesMutex;
+
 /**
  * The callback used when there are compilation problems in the rules.
  */
@@ -126,12 +159,7 @@ Status handleRuleFiles(const std::string& category,
     const auto rule = item.second.get("", "");
     VLOG(1) << "Loading " << rule;
 
-    std::string full_path;
-    if (rule[0] != '/') {
-      full_path = std::string("/etc/osquery/yara/") + rule;
-    } else {
-      full_path = rule;
-    }
+    auto full_path = getYARARulePath(rule);
 
     // First attempt to load the file, in case it is saved (pre-compiled)
     // rules. Sadly there is no way to load multiple compiled rules in
@@ -200,6 +228,225 @@ Status handleRuleFiles(const std::string& category,
   return Status(0, "OK");
 }
 
+std::string getYARARulePath(const std::string& rule) {
+  if (rule[0] != '/') {
+    return std::string("/etc/osquery/yara/") + rule;
+  }
+  return rule;
+}
+
+Status getCompiledRules(const std::string& file,
+                        YARARulesRef& rules,
+                        std::string& content_hash) {
+  content_hash = hashFromFile(HASH_TYPE_SHA256, file);
+  if (content_hash.empty()) {
+    return Status(1, "Could not read file: " + file);
+  }
+
+  std::lock_guard<std::mutex> lock(kCompiledRulesMutex);
+  auto previous = kCompiledRulesHashes.find(file);
+  if (previous != kCompiledRulesHashes.end() &&
+      previous->second != content_hash) {
+    // Scans in progress keep a reference to the replaced rules.
+    kCompiledRules.erase(previous->second);
+  }
+  kCompiledRulesHashes[file] = content_hash;
+
+  if (kCompiledRules.count(content_hash) > 0) {
+    rules = kCompiledRules.at(content_hash);
+    return Status(0, "OK");
+  }
+
+  YR_RULES* compiled = nullptr;
+  auto status = compileSingleFile(file, &compiled);
+  if (!status.ok()) {
+    kCompiledRulesHashes.erase(file);
+    return status;
+  }
+
+  rules = YARARulesRef(compiled, yr_rules_destroy);
+  kCompiledRules[content_hash] = rules;
+  return Status(0, "OK");
+}
+
+std::string getRuleGroupHash(const pt::ptree& rule_files) {
+  std::string contents;
+  for (const auto& item : rule_files) {
+    auto full_path = getYARARulePath(item.second.get("", ""));
+    contents += full_path + ":" + hashFromFile(HASH_TYPE_SHA256, full_path);
+    contents += ";";
+  }
+  return hashFromBuffer(HASH_TYPE_SHA256, contents.data(), contents.size());
+}
+
+Status getCompiledRuleGroup(const std::string& group,
+                            const pt::ptree& rule_files,
+                            const std::string& content_hash,
+                            YARARulesRef& rules) {
+  std::string cache_path;
+  if (!FLAGS_yara_rules_cache.empty()) {
+    cache_path = FLAGS_yara_rules_cache + "/" + content_hash + ".yarc";
+    YR_RULES* saved = nullptr;
+    if (pathExists(cache_path).ok() &&
+        yr_rules_load(cache_path.c_str(), &saved) == ERROR_SUCCESS) {
+      VLOG(1) << "Loaded YARA signature group " << group << " from cache";
+      rules = YARARulesRef(saved, yr_rules_destroy);
+      return Status(0, "OK");
+    }
+  }
+
+  std::map<std::string, YR_RULES*> compiled;
+  auto status = handleRuleFiles(group, rule_files, &compiled);
+  if (!status.ok() || compiled.count(group) == 0) {
+    if (compiled.count(group) > 0) {
+      yr_rules_destroy(compiled.at(group));
+    }
+    return (status.ok()) ? Status(1, "No YARA rules") : status;
+  }
+
+  rules = YARARulesRef(compiled.at(group), yr_rules_destroy);
+  if (!cache_path.empty()) {
+    // Saving is best effort, the group is compiled again on failure.
+    auto result = yr_rules_save(rules.get(), cache_path.c_str());
+    if (result != ERROR_SUCCESS) {
+      VLOG(1) << "Could not save YARA rules to " << cache_path << " ("
+              << result << ")";
+    }
+  }
+  return Status(0, "OK");
+}
+
+/**
+ * @brief Compile signature groups in a dispatcher thread.
+ *
+ * Compiles of large rule sets may take seconds, so they are not done while
+ * the config is being updated.
+ */
+class YARACompilerRunner : public InternalRunnable {
+ public:
+  YARACompilerRunner(YARAConfigParserPlugin* parser,
+                     const pt::ptree& signatures,
+                     const std::map<std::string, std::string>& hashes)
+      : parser_(parser), signatures_(signatures), hashes_(hashes) {}
+
+  void start();
+
+ private:
+  /// The registered parser, config parsers are not removed.
+  YARAConfigParserPlugin* parser_;
+
+  /// The groups to compile, and their content hashes.
+  pt::ptree signatures_;
+  std::map<std::string, std::string> hashes_;
+};
+
+void YARACompilerRunner::start() {
+  for (const auto& element : signatures_) {
+    if (hashes_.count(element.first) == 0) {
+      continue;
+    }
+
+    VLOG(1) << "Compiling YARA signature group: " << element.first;
+    const auto& content_hash = hashes_.at(element.first);
+    YARARulesRef rules;
+    auto status =
+        getCompiledRuleGroup(element.first, element.second, content_hash, rules);
+    if (!status.ok()) {
+      // The group keeps its previous rules, if any.
+      LOG(WARNING) << "YARA rule compile error in " << element.first << ": "
+                   << status.getMessage();
+      continue;
+    }
+    parser_->setRules(element.first, content_hash, rules);
+  }
+}
+
+Status scanYARAFile(YR_RULES* rules, const std::string& path, Row& r) {
+  struct stat file_stat;
+  if (stat(path.c_str(), &file_stat) != 0) {
+    return Status(1, "Cannot stat file: " + path);
+  }
+
+  if (FLAGS_yara_max_file_size > 0 &&
+      static_cast<uint64_t>(file_stat.st_size) > FLAGS_yara_max_file_size) {
+    return Status(1, "File exceeds YARA scan size limit: " + path);
+  }
+
+  int result = yr_rules_scan_file(rules,
+                                  path.c_str(),
+                                  SCAN_FLAGS_FAST_MODE,
+                                  YARACallback,
+                                  (void*)&r,
+                                  static_cast<int>(FLAGS_yara_scan_timeout));
+  if (result == ERROR_SCAN_TIMEOUT) {
+    return Status(1, "Scan timeout: " + path);
+  } else if (result != ERROR_SUCCESS) {
+    return Status(1, "Scan error (" + std::to_string(result) + ")");
+  }
+  return Status(0, "OK");
+}
+
+bool YARAScanQueue::add(YARAScanRequest request,
+                        size_t max,
+                        std::chrono::milliseconds window) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto queued = requests_.find(request.path);
+    if (queued != requests_.end()) {
+      // The window starts at the first event, a busy file is still scanned.
+      request.ready = queued->second.ready;
+      queued->second = std::move(request);
+      return true;
+    }
+
+    if (requests_.size() >= max) {
+      return false;
+    }
+    request.ready = std::chrono::steady_clock::now() + window;
+    requests_[request.path] = std::move(request);
+  }
+  ready_.notify_one();
+  return true;
+}
+
+bool YARAScanQueue::take(YARAScanRequest& request) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopped_) {
+    auto now = std::chrono::steady_clock::now();
+    auto next = requests_.end();
+    auto wake = now + std::chrono::seconds(1);
+    for (auto it = requests_.begin(); it != requests_.end(); ++it) {
+      if (it->second.ready > now) {
+        wake = std::min(wake, it->second.ready);
+      } else if (next == requests_.end() ||
+                 it->second.size < next->second.size) {
+        next = it;
+      }
+    }
+
+    if (next != requests_.end()) {
+      request = std::move(next->second);
+      requests_.erase(next);
+      return true;
+    }
+    ready_.wait_until(lock, wake);
+  }
+  return false;
+}
+
+void YARAScanQueue::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  ready_.notify_all();
+}
+
+size_t YARAScanQueue::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return requests_.size();
+}
+
 /**
  * This is the YARA callback. Used to store matching rules in the row which is
  * passed in as user_data.
@@ -229,21 +476,70 @@ Status YARAConfigParserPlugin::setUp() {
   return Status(0, "OK");
 }
 
+std::map<std::string, YARARulesRef> YARAConfigParserPlugin::rules() {
+  std::lock_guard<std::mutex> lock(rules_mutex_);
+  return rules_;
+}
+
+std::string YARAConfigParserPlugin::rulesIdentity(const std::string& group) {
+  std::lock_guard<std::mutex> lock(rules_mutex_);
+  return (identities_.count(group) > 0) ? identities_.at(group) : "";
+}
+
+void YARAConfigParserPlugin::setRules(const std::string& group,
+                                      const std::string& content_hash,
+                                      const YARARulesRef& rules) {
+  std::lock_guard<std::mutex> lock(rules_mutex_);
+  if (pending_.count(group) == 0 || pending_.at(group) != content_hash) {
+    return;
+  }
+  rules_[group] = rules;
+  identities_[group] = content_hash;
+}
+
 Status YARAConfigParserPlugin::update(const std::map<std::string, ConfigTree>& config) {
-  Status status;
   const auto& yara_config = config.at("yara");
+  pt::ptree changed;
+  std::map<std::string, std::string> hashes;
   if (yara_config.count("signatures") > 0) {
     const auto& signatures = yara_config.get_child("signatures");
     data_.add_child("signatures", signatures);
     for (const auto& element : signatures) {
-      VLOG(1) << "Compiling YARA signature group: " << element.first;
-      status = handleRuleFiles(element.first, element.second, &rules_);
-      if (!status.ok()) {
-        VLOG(1) << "YARA rule compile error: " << status.getMessage();
-        return status;
+      hashes[element.first] = getRuleGroupHash(element.second);
+    }
+  }
+
+  {
+    // Only groups whose rule file contents changed are compiled.
+    std::lock_guard<std::mutex> lock(rules_mutex_);
+    pending_ = hashes;
+    for (auto it = rules_.begin(); it != rules_.end();) {
+      if (hashes.count(it->first) == 0) {
+        identities_.erase(it->first);
+        it = rules_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    if (yara_config.count("signatures") > 0) {
+      for (const auto& element : yara_config.get_child("signatures")) {
+        if (identities_.count(element.first) == 0 ||
+            identities_.at(element.first) != hashes.at(element.first)) {
+          changed.push_back(element);
+        }
       }
     }
   }
+
+  if (!changed.empty()) {
+    auto compiler =
+        std::make_shared<YARACompilerRunner>(this, changed, hashes);
+    if (!Dispatcher::add(compiler).ok()) {
+      compiler->run();
+    }
+  }
+
   if (yara_config.count("file_paths") > 0) {
     const auto& file_paths = yara_config.get_child("file_paths");
     data_.add_child("file_paths", file_paths);
@@ -8,7 +8,14 @@
  *
  */
 
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+
 #include <osquery/config.h>
+#include <osquery/events.h>
 #include <osquery/tables.h>
 
 #ifdef CONCAT
@@ -32,6 +39,112 @@ Status handleRuleFiles(const std::string& category,
 
 int YARACallback(int message, void *message_data, void *user_data);
 
+/// Rule file paths are relative to /etc/osquery/yara unless absolute.
+std::string getYARARulePath(const std::string& rule);
+
+/// Compiled rules shared between queries, destroyed with the last reference.
+typedef std::shared_ptr<YR_RULES> YARARulesRef;
+
+/**
+ * @brief Compile a sigfile, or reuse the rules compiled from the same content.
+ *
+ * Rules are cached by the SHA256 of the sigfile's content. When a sigfile
+ * changes it is compiled again and the previous rules are released.
+ *
+ * @param file The full path to a source or saved rule file.
+ * @param rules Output compiled rules.
+ * @param content_hash Output SHA256 of the compiled content.
+ */
+Status getCompiledRules(const std::string& file,
+                        YARARulesRef& rules,
+                        std::string& content_hash);
+
+/**
+ * @brief The SHA256 of a signature group's rule file paths and contents.
+ *
+ * A group is compiled again only when this hash changes.
+ */
+std::string getRuleGroupHash(const pt::ptree& rule_files);
+
+/**
+ * @brief Compile a signature group, or load it from --yara_rules_cache.
+ *
+ * When --yara_rules_cache is set, newly compiled rules are saved there, named
+ * by the group's content hash, so a restart loads them without compiling.
+ *
+ * @param group The signature group name, for logging.
+ * @param rule_files The group's rule file paths.
+ * @param content_hash The group's hash from getRuleGroupHash.
+ * @param rules Output compiled rules.
+ */
+Status getCompiledRuleGroup(const std::string& group,
+                            const pt::ptree& rule_files,
+                            const std::string& content_hash,
+                            YARARulesRef& rules);
+
+/**
+ * @brief Scan a file within the --yara_max_file_size and --yara_scan_timeout
+ * budgets, updating the count and matches columns of a row.
+ */
+Status scanYARAFile(YR_RULES* rules, const std::string& path, Row& r);
+
+/// A file event waiting to be scanned by yara_events.
+struct YARAScanRequest {
+  std::string path;
+  std::string category;
+
+  /// The file's size when the event was queued, smaller files scan first.
+  uint64_t size{0};
+
+  /// The event's columns, without scan results.
+  Row r;
+  EventTime time{0};
+
+  /// Scanning waits until no events for the path arrive for the window.
+  std::chrono::steady_clock::time_point ready;
+};
+
+/**
+ * @brief A bounded queue of file scans between file events and YARA workers.
+ *
+ * Repeated events for a queued path are coalesced into one scan of the latest
+ * event. A path is ready to scan once the coalescing window passes, and the
+ * smallest ready file is scanned first. New paths are dropped when the queue
+ * is full, so the event publisher never waits for scans.
+ */
+class YARAScanQueue {
+ public:
+  /**
+   * @brief Queue a scan, or coalesce it with a queued scan of the same path.
+   *
+   * @param window The coalescing window.
+   * @return false if the queue is full and the scan was dropped.
+   */
+  bool add(YARAScanRequest request,
+           size_t max,
+           std::chrono::milliseconds window);
+
+  /**
+   * @brief Wait for the smallest ready scan.
+   *
+   * @return false if the queue was stopped.
+   */
+  bool take(YARAScanRequest& request);
+
+  /// Wake and stop every waiting worker.
+  void stop();
+
+  size_t size();
+
+ private:
+  /// Queued scans (path => request).
+  std::map<std::string, YARAScanRequest> requests_;
+
+  bool stopped_{false};
+  std::mutex mutex_;
+  std::condition_variable ready_;
+};
+
 /**
  * @brief A simple ConfigParserPlugin for a "yara" dictionary key.
  *
@@ -47,16 +160,47 @@ class YARAConfigParserPlugin : public ConfigParserPlugin {
   /// Request a single "yara" top level key.
   std::vector<std::string> keys() { return {"yara"}; }
 
-  // Retrieve compiled rules.
-  std::map<std::string, YR_RULES *> rules() { return rules_; }
+  /**
+   * @brief Retrieve compiled rules.
+   *
+   * Groups are missing until their first compile completes. Scans keep a
+   * reference to the rules they use, so a recompile does not free them.
+   */
+  std::map<std::string, YARARulesRef> rules();
+
+  /// The content hash of a group's compiled rules, for caching scans.
+  std::string rulesIdentity(const std::string& group);
+
+  /**
+   * @brief Replace a group's rules with compiled rules.
+   *
+   * Rules are ignored if the group changed again while they were compiling.
+   */
+  void setRules(const std::string& group,
+                const std::string& content_hash,
+                const YARARulesRef& rules);
 
   Status setUp();
 
  private:
   // Store compiled rules in a map (group => rules).
-  std::map<std::string, YR_RULES *> rules_;
+  std::map<std::string, YARARulesRef> rules_;
+
+  /// The content hash of each group's compiled rules (group => hash).
+  std::map<std::string, std::string> identities_;
+
+  /// The content hash of each group in the latest config (group => hash).
+  std::map<std::string, std::string> pending_;
+
+  /// Protects rules, updated by compiles while tables scan.
+  std::mutex rules_mutex_;
 
-  /// Store the signatures and file_paths and compile the rules.
+  /**
+   * @brief Store the signatures and file_paths and compile changed groups.
+   *
+   * Groups are compiled in a dispatcher thread, not while the config is
+   * locked for the update. Unchanged groups keep their compiled rules.
+   */
   Status update(const std::map<std::string, ConfigTree>& config);
 };
 }
@@ -11,6 +11,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <mutex>
+
 #include <rpm/rpmlib.h>
 #include <rpm/header.h>
 #include <rpm/rpmts.h>
@@ -65,23 +67,62 @@ static std::string getRpmAttribute(const Header& header,
   return result;
 }
 
-QueryData genRpmPackages(QueryContext& context) {
-  QueryData results;
+/// RPM databases, by backend, package lists change when they are written.
+const std::vector<std::string> kRpmDatabasePaths = {
+    "/var/lib/rpm/Packages", "/var/lib/rpm/rpmdb.sqlite",
+};
+
+/// Cached package rows, valid while the RPM database identity is unchanged.
+struct RpmCache {
+  std::string identity;
+
+  /// Every installed package, if the packages were loaded.
+  QueryData packages;
+  bool packages_loaded{false};
+
+  /// Each loaded package's files by package name.
+  std::map<std::string, QueryData> files;
+  bool files_loaded{false};
+};
+
+static RpmCache kRpmCache;
+
+/// Protects the RPM cache and librpm's global configuration.
+static std::mutex kRpmCacheMutex;
+
+/// Empty the RPM cache if the database was written since it was filled.
+static void checkRpmCache() {
+  std::string identity;
+  for (const auto& path : kRpmDatabasePaths) {
+    if (getFileIdentity(path, identity).ok()) {
+      break;
+    }
+  }
+
+  if (identity.empty() || identity != kRpmCache.identity) {
+    kRpmCache = RpmCache();
+    kRpmCache.identity = identity;
+  }
+}
+
+/// Iterate over every package header, or the headers of a package name.
+static rpmdbMatchIterator initRpmIterator(rpmts ts, const std::string* name) {
+  if (name != nullptr) {
+    return rpmtsInitIterator(ts, RPMTAG_NAME, name->c_str(), name->size());
+  }
+  return rpmtsInitIterator(ts, RPMTAG_NAME, nullptr, 0);
+}
+
+static void genRpmPackageRows(QueryData& results) {
   // The following implementation uses http://rpm.org/api/4.11.1/
   rpmInitCrypto();
   if (rpmReadConfigFiles(nullptr, nullptr) != 0) {
     TLOG << "Cannot read RPM configuration files.";
-    return results;
+    return;
   }
 
   rpmts ts = rpmtsCreate();
-  rpmdbMatchIterator matches;
-  if (context.constraints["name"].exists(EQUALS)) {
-    auto name = (*context.constraints["name"].getAll(EQUALS).begin());
-    matches = rpmtsInitIterator(ts, RPMTAG_NAME, name.c_str(), name.size());
-  } else {
-    matches = rpmtsInitIterator(ts, RPMTAG_NAME, nullptr, 0);
-  }
+  auto matches = initRpmIterator(ts, nullptr);
 
   Header header;
   while ((header = rpmdbNextIterator(matches)) != nullptr) {
@@ -103,41 +144,62 @@ QueryData genRpmPackages(QueryContext& context) {
   rpmtsFree(ts);
   rpmFreeCrypto();
   rpmFreeRpmrc();
-
-  return results;
 }
 
-QueryData genRpmPackageFiles(QueryContext& context) {
+QueryData genRpmPackages(QueryContext& context) {
+  std::lock_guard<std::mutex> lock(kRpmCacheMutex);
+  checkRpmCache();
+  if (!kRpmCache.packages_loaded) {
+    genRpmPackageRows(kRpmCache.packages);
+    kRpmCache.packages_loaded = true;
+  }
+
+  if (!context.constraints["name"].exists(EQUALS)) {
+    return kRpmCache.packages;
+  }
+
+  // Point lookups by name are answered from the cached packages.
   QueryData results;
-  if (rpmReadConfigFiles(nullptr, nullptr) != 0) {
-    TLOG << "Cannot read RPM configuration files.";
-    return results;
+  auto names = context.constraints["name"].getAll(EQUALS);
+  for (const auto& row : kRpmCache.packages) {
+    auto name = row.find("name");
+    if (name != row.end() && names.count(name->second) > 0) {
+      results.push_back(row);
+    }
   }
+  return results;
+}
 
-  rpmts ts = rpmtsCreate();
-  rpmdbMatchIterator matches;
-  if (context.constraints["package"].exists(EQUALS)) {
-    auto name = (*context.constraints["package"].getAll(EQUALS).begin());
-    matches = rpmtsInitIterator(ts, RPMTAG_NAME, name.c_str(), name.size());
-  } else {
-    matches = rpmtsInitIterator(ts, RPMTAG_NAME, nullptr, 0);
+/**
+ * @brief Load the files of every package, or of a single package name.
+ *
+ * Files are added to the cache by package name, a package without files, or
+ * with too many files, is cached without rows.
+ */
+static void genRpmPackageFileRows(rpmts ts, const std::string* package) {
+  auto matches = initRpmIterator(ts, package);
+  if (package != nullptr) {
+    kRpmCache.files[*package];
   }
 
   Header header;
   while ((header = rpmdbNextIterator(matches)) != nullptr) {
     rpmtd td = rpmtdNew();
+    auto name = getRpmAttribute(header, RPMTAG_NAME, td);
+    auto& results = kRpmCache.files[name];
     rpmfi fi = rpmfiNew(ts, header, RPMTAG_BASENAMES, RPMFI_NOHEADER);
     auto file_count = rpmfiFC(fi);
     if (file_count <= 0 || file_count > MAX_RPM_FILES) {
       // This package contains no or too many files.
       rpmfiFree(fi);
+      rpmtdFree(td);
       continue;
     }
 
     // Iterate over every file in this package.
     for (size_t i = 0; rpmfiNext(fi) >= 0 && i < file_count; i++) {
       Row r;
-      r["package"] = getRpmAttribute(header, RPMTAG_NAME, td);
+      r["package"] = name;
       auto path = rpmfiFN(fi);
       r["path"] = (path != nullptr) ? path : "";
       auto username = rpmfiFUser(fi);
@@ -166,9 +228,54 @@ QueryData genRpmPackageFiles(QueryContext& context) {
   }
 
   rpmdbFreeIterator(matches);
-  rpmtsFree(ts);
-  rpmFreeRpmrc();
+}
 
+QueryData genRpmPackageFiles(QueryContext& context) {
+  QueryData results;
+  std::lock_guard<std::mutex> lock(kRpmCacheMutex);
+  checkRpmCache();
+
+  std::set<std::string> packages;
+  bool lookup = context.constraints["package"].exists(EQUALS);
+  if (lookup) {
+    packages = context.constraints["package"].getAll(EQUALS);
+  }
+
+  // Only open the RPM database for packages that are not cached.
+  bool cached = kRpmCache.files_loaded;
+  for (const auto& package : packages) {
+    cached = cached && kRpmCache.files.count(package) > 0;
+  }
+
+  if (!cached) {
+    if (rpmReadConfigFiles(nullptr, nullptr) != 0) {
+      TLOG << "Cannot read RPM configuration files.";
+      return results;
+    }
+
+    // One transaction set is reused for each package lookup.
+    rpmts ts = rpmtsCreate();
+    if (!lookup) {
+      kRpmCache.files.clear();
+      genRpmPackageFileRows(ts, nullptr);
+      kRpmCache.files_loaded = true;
+    } else {
+      for (const auto& package : packages) {
+        if (kRpmCache.files.count(package) == 0) {
+          genRpmPackageFileRows(ts, &package);
+        }
+      }
+    }
+    rpmtsFree(ts);
+    rpmFreeRpmrc();
+  }
+
+  for (const auto& package : kRpmCache.files) {
+    if (!lookup || packages.count(package.first) > 0) {
+      results.insert(
+          results.end(), package.second.begin(), package.second.end());
+    }
+  }
   return results;
 }
 }
@@ -26,17 +26,8 @@ const std::vector<std::string> kUserCronPaths = {
     "/var/at/tabs/", "/var/spool/cron/", "/var/spool/cron/crontabs/",
 };
 
-std::vector<std::string> cronFromFile(const std::string& path) {
-  std::string content;
+std::vector<std::string> cronFromContent(const std::string& content) {
   std::vector<std::string> cron_lines;
-  if (!isReadable(path).ok()) {
-    return cron_lines;
-  }
-
-  if (!readFile(path, content).ok()) {
-    return cron_lines;
-  }
-
   auto lines = split(content, "\n");
 
   // Only populate the lines that are not comments or blank.
@@ -95,13 +86,20 @@ void genCronLine(const std::string& path,
   results.push_back(r);
 }
 
+/// Generate the rows of a crontab, reusing the rows of an unchanged file.
+void genCronFile(const std::string& path, QueryData& results) {
+  genParsedFile(path,
+                [&path](const std::string& content, QueryData& rows) {
+                  for (const auto& line : cronFromContent(content)) {
+                    genCronLine(path, line, rows);
+                  }
+                },
+                results);
+}
+
 QueryData genCronTab(QueryContext& context) {
   QueryData results;
-
-  auto system_lines = cronFromFile(kSystemCron);
-  for (const auto& line : system_lines) {
-    genCronLine(kSystemCron, line, results);
-  }
+  genCronFile(kSystemCron, results);
 
   std::vector<std::string> user_crons;
   for (const auto cron_path : kUserCronPaths) {
@@ -110,10 +108,7 @@ QueryData genCronTab(QueryContext& context) {
 
   // The user-based crons are identified by their path.
   for (const auto& user_path : user_crons) {
-    auto user_lines = cronFromFile(user_path);
-    for (const auto& line : user_lines) {
-      genCronLine(user_path, line, results);
-    }
+    genCronFile(user_path, results);
   }
 
   return results;
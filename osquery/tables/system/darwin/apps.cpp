@@ -218,14 +218,14 @@ QueryData genApps(QueryContext& context) {
     }
   }
 
-  // The osquery::parsePlist method will reset/clear a property tree.
+  // The osquery::parsePlistCached method will reset/clear a property tree.
   // Keeping the data structure in a larger scope preserves allocations
   // between similar-sized trees.
   pt::ptree tree;
 
   // For each found application (path with an Info.plist) parse the plist.
   for (const auto& path : apps) {
-    if (!osquery::parsePlist(path, tree).ok()) {
+    if (!osquery::parsePlistCached(path, tree).ok()) {
       TLOG << "Error parsing application plist: " << path;
       continue;
     }
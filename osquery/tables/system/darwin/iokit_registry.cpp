@@ -8,6 +8,9 @@
  *
  */
 
+#include <set>
+#include <string>
+
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
@@ -16,28 +19,48 @@
 namespace osquery {
 namespace tables {
 
+/// The entry details needed by the columns a query uses.
+struct IOKitColumns {
+  bool name;
+  bool device_class;
+  bool device_path;
+  bool service;
+  bool busy_state;
+  bool retain_count;
+
+  explicit IOKitColumns(const QueryContext& context) {
+    name = context.isColumnUsed("name");
+    device_class = context.isColumnUsed("class");
+    device_path = context.isColumnUsed("device_path");
+    service = context.isColumnUsed("service");
+    busy_state = context.isColumnUsed("busy_state");
+    retain_count = context.isColumnUsed("retain_count");
+  }
+};
+
 void genIOKitDevice(const io_service_t& device,
                     const io_service_t& parent,
                     const io_name_t plane,
                     int depth,
+                    const IOKitColumns& columns,
                     QueryData& results) {
   Row r;
 
-  // Get the device details
-  CFMutableDictionaryRef details;
-  IORegistryEntryCreateCFProperties(
-      device, &details, kCFAllocatorDefault, kNilOptions);
-
   io_name_t name, device_class;
-  auto kr = IORegistryEntryGetName(device, name);
-  if (kr == KERN_SUCCESS) {
-    r["name"] = std::string(name);
+  kern_return_t kr;
+  if (columns.name) {
+    kr = IORegistryEntryGetName(device, name);
+    if (kr == KERN_SUCCESS) {
+      r["name"] = std::string(name);
+    }
   }
 
   // Get the device class.
-  kr = IOObjectGetClass(device, device_class);
-  if (kr == KERN_SUCCESS) {
-    r["class"] = std::string(device_class);
+  if (columns.device_class) {
+    kr = IOObjectGetClass(device, device_class);
+    if (kr == KERN_SUCCESS) {
+      r["class"] = std::string(device_class);
+    }
   }
 
   // The entry into the registry is the ID, and is used for children as parent.
@@ -58,7 +81,8 @@ void genIOKitDevice(const io_service_t& device,
 
   r["depth"] = INTEGER(depth);
 
-  if (IORegistryEntryInPlane(device, kIODeviceTreePlane)) {
+  if (columns.device_path &&
+      IORegistryEntryInPlane(device, kIODeviceTreePlane)) {
     io_string_t device_path;
     kr = IORegistryEntryGetPath(device, kIODeviceTreePlane, device_path);
     if (kr == KERN_SUCCESS) {
@@ -68,30 +92,36 @@ void genIOKitDevice(const io_service_t& device,
   }
 
   // Fill in service bits and busy/latency time.
-  if (IOObjectConformsTo(device, "IOService")) {
-    r["service"] = "1";
-  } else {
-    r["service"] = "0";
+  if (columns.service) {
+    if (IOObjectConformsTo(device, "IOService")) {
+      r["service"] = "1";
+    } else {
+      r["service"] = "0";
+    }
   }
 
-  uint32_t busy_state;
-  kr = IOServiceGetBusyState(device, &busy_state);
-  if (kr == KERN_SUCCESS) {
-    r["busy_state"] = INTEGER(busy_state);
-  } else {
-    r["busy_state"] = "0";
+  if (columns.busy_state) {
+    uint32_t busy_state;
+    kr = IOServiceGetBusyState(device, &busy_state);
+    if (kr == KERN_SUCCESS) {
+      r["busy_state"] = INTEGER(busy_state);
+    } else {
+      r["busy_state"] = "0";
+    }
   }
 
-  auto retain_count = IOObjectGetKernelRetainCount(device);
-  r["retain_count"] = INTEGER(retain_count);
+  if (columns.retain_count) {
+    auto retain_count = IOObjectGetKernelRetainCount(device);
+    r["retain_count"] = INTEGER(retain_count);
+  }
 
   results.push_back(r);
-  CFRelease(details);
 }
 
 void genIOKitDeviceChildren(const io_registry_entry_t& service,
                             const io_name_t plane,
                             int depth,
+                            const IOKitColumns& columns,
                             QueryData& results) {
   io_iterator_t it;
   auto kr = IORegistryEntryGetChildIterator(service, plane, &it);
@@ -102,8 +132,77 @@ void genIOKitDeviceChildren(const io_registry_entry_t& service,
   io_service_t device;
   while ((device = IOIteratorNext(it))) {
     // Use this entry as the parent, and generate a result row.
-    genIOKitDevice(device, service, plane, depth, results);
-    genIOKitDeviceChildren(device, plane, depth + 1, results);
+    genIOKitDevice(device, service, plane, depth, columns, results);
+    genIOKitDeviceChildren(device, plane, depth + 1, columns, results);
+    IOObjectRelease(device);
+  }
+
+  IOObjectRelease(it);
+}
+
+/// The depth of an entry within a plane, children of the root are depth 0.
+static int getIOKitDepth(const io_registry_entry_t& device,
+                         const io_name_t plane) {
+  int depth = -1;
+  io_registry_entry_t entry = device;
+  IOObjectRetain(entry);
+  io_registry_entry_t parent;
+  while (IORegistryEntryGetParentEntry(entry, plane, &parent) ==
+         KERN_SUCCESS) {
+    IOObjectRelease(entry);
+    entry = parent;
+    depth++;
+  }
+  IOObjectRelease(entry);
+  return depth;
+}
+
+/**
+ * @brief Generate the IOService plane entries matching a class or name.
+ *
+ * Matching dictionaries let IOKit find the entries instead of walking every
+ * entry of the plane. Classes match subclasses and names match compatible
+ * names, so entries without the exact class or name are skipped.
+ */
+static void genIOKitMatching(CFMutableDictionaryRef matching,
+                             const std::set<std::string>& classes,
+                             const std::set<std::string>& names,
+                             const IOKitColumns& columns,
+                             QueryData& results) {
+  if (matching == nullptr) {
+    return;
+  }
+
+  io_iterator_t it;
+  auto kr = IOServiceGetMatchingServices(kIOMasterPortDefault, matching, &it);
+  if (kr != KERN_SUCCESS) {
+    return;
+  }
+
+  io_service_t device;
+  while ((device = IOIteratorNext(it))) {
+    io_name_t value;
+    if (!classes.empty() &&
+        (IOObjectGetClass(device, value) != KERN_SUCCESS ||
+         classes.count(value) == 0)) {
+      IOObjectRelease(device);
+      continue;
+    }
+
+    if (!names.empty() &&
+        (IORegistryEntryGetName(device, value) != KERN_SUCCESS ||
+         names.count(value) == 0)) {
+      IOObjectRelease(device);
+      continue;
+    }
+
+    io_registry_entry_t parent;
+    if (IORegistryEntryGetParentEntry(device, kIOServicePlane, &parent) ==
+        KERN_SUCCESS) {
+      auto depth = getIOKitDepth(device, kIOServicePlane);
+      genIOKitDevice(device, parent, kIOServicePlane, depth, columns, results);
+      IOObjectRelease(parent);
+    }
     IOObjectRelease(device);
   }
 
@@ -117,7 +216,8 @@ QueryData genIOKitDeviceTree(QueryContext& context) {
   auto service = IORegistryGetRootEntry(kIOMasterPortDefault);
 
   // Begin recursing along the IODeviceTree "plane".
-  genIOKitDeviceChildren(service, kIODeviceTreePlane, 0, results);
+  IOKitColumns columns(context);
+  genIOKitDeviceChildren(service, kIODeviceTreePlane, 0, columns, results);
 
   IOObjectRelease(service);
   return results;
@@ -126,11 +226,38 @@ QueryData genIOKitDeviceTree(QueryContext& context) {
 QueryData genIOKitRegistry(QueryContext& context) {
   QueryData results;
 
+  IOKitColumns columns(context);
+  std::set<std::string> classes, names;
+  if (context.constraints["class"].exists(EQUALS)) {
+    classes = context.constraints["class"].getAll(EQUALS);
+  }
+  if (context.constraints["name"].exists(EQUALS)) {
+    names = context.constraints["name"].getAll(EQUALS);
+  }
+
+  // Every entry in the IOService plane is a service, look up the entries.
+  if (!classes.empty()) {
+    for (const auto& device_class : classes) {
+      genIOKitMatching(IOServiceMatching(device_class.c_str()),
+                       {device_class},
+                       names,
+                       columns,
+                       results);
+    }
+    return results;
+  } else if (!names.empty()) {
+    for (const auto& name : names) {
+      genIOKitMatching(
+          IOServiceNameMatching(name.c_str()), {}, {name}, columns, results);
+    }
+    return results;
+  }
+
   // Get the IO registry root node.
   auto service = IORegistryGetRootEntry(kIOMasterPortDefault);
 
-  // Begin recursing along the IODeviceTree "plane".
-  genIOKitDeviceChildren(service, kIOServicePlane, 0, results);
+  // Begin recursing along the IOService "plane".
+  genIOKitDeviceChildren(service, kIOServicePlane, 0, columns, results);
 
   IOObjectRelease(service);
   return results;
@@ -8,13 +8,17 @@
  *
  */
 
+#include <functional>
 #include <map>
 #include <set>
+#include <string>
 #include <vector>
 
 #include <CoreFoundation/CoreFoundation.h>
 #include <Security/Security.h>
 
+#include <osquery/tables.h>
+
 #include "osquery/core/conversions.h"
 
 namespace osquery {
@@ -33,6 +37,13 @@ struct CertProperty {
 extern const std::vector<std::string> kSystemKeychainPaths;
 extern const std::vector<std::string> kUserKeychainPaths;
 
+/// Keychain files cached, the cache is emptied when full.
+extern const size_t kKeychainCacheMax;
+
+/// List the keychain files of a search path, a directory or file.
+void listKeychainFiles(const std::string& path,
+                       std::vector<std::string>& files);
+
 void genKeychains(const std::string& path, CFMutableArrayRef& keychains);
 std::string getKeychainPath(const SecKeychainItemRef& item);
 
@@ -55,6 +66,27 @@ CFArrayRef CreateKeychainItems(const std::set<std::string>& paths,
 
 std::set<std::string> getKeychainPaths();
 
+/// Generate the rows of a single keychain file.
+typedef std::function<void(const std::string& path, QueryData& results)>
+    KeychainGenerator;
+
+/**
+ * @brief Generate a keychain file's rows, reusing them while it is unchanged.
+ *
+ * Reading a keychain asks securityd for every item, not the file's content,
+ * so genParsedFile does not apply. Rows are cached with the file's identity,
+ * see getFileIdentity, and regenerated once it changes.
+ *
+ * @param key Identifies the table and the columns the rows include.
+ * @param path The keychain file.
+ * @param generator Called with the path when the cached rows are stale.
+ * @param results Output rows, appended to.
+ */
+void genKeychainCached(const std::string& key,
+                       const std::string& path,
+                       const KeychainGenerator& generator,
+                       QueryData& results);
+
 // From SecCertificatePriv.h
 typedef uint32_t SecKeyUsage;
 enum {
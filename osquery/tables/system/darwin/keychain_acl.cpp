@@ -170,6 +170,7 @@ static std::string attributeBufferToString(const void *data, UInt32 length) {
 Status genKeychainACLAppsForEntry(SecKeychainRef keychain,
                                   SecKeychainItemRef item,
                                   const std::string &path,
+                                  bool label,
                                   QueryData &results) {
   KeychainItemMetadata item_metadata;
   item_metadata.keychain_path = path;
@@ -196,63 +197,66 @@ Status genKeychainACLAppsForEntry(SecKeychainRef keychain,
     return s;
   }
 
-  UInt32 item_id;
-  switch (item_class) {
-  case kSecInternetPasswordItemClass:
-    item_id = CSSM_DL_DB_RECORD_INTERNET_PASSWORD;
-    break;
-  case kSecGenericPasswordItemClass:
-    item_id = CSSM_DL_DB_RECORD_GENERIC_PASSWORD;
-    break;
-  case 'ashp':
-    item_id = CSSM_DL_DB_RECORD_APPLESHARE_PASSWORD;
-    break;
-  default:
-    item_id = item_class;
-    break;
-  }
+  // The label is one of every attribute of the item, only read it if used.
+  if (label) {
+    UInt32 item_id;
+    switch (item_class) {
+    case kSecInternetPasswordItemClass:
+      item_id = CSSM_DL_DB_RECORD_INTERNET_PASSWORD;
+      break;
+    case kSecGenericPasswordItemClass:
+      item_id = CSSM_DL_DB_RECORD_GENERIC_PASSWORD;
+      break;
+    case 'ashp':
+      item_id = CSSM_DL_DB_RECORD_APPLESHARE_PASSWORD;
+      break;
+    default:
+      item_id = item_class;
+      break;
+    }
 
-  SecKeychainAttributeInfo *info = nullptr;
-  SecKeychainAttributeInfoForItemID(keychain, item_id, &info);
+    SecKeychainAttributeInfo *info = nullptr;
+    SecKeychainAttributeInfoForItemID(keychain, item_id, &info);
 
-  SecKeychainAttributeList *attr_list = nullptr;
-  os_status = SecKeychainItemCopyAttributesAndData(
-      item, info, &item_class, &attr_list, nullptr, nullptr);
-  if (os_status != noErr || attr_list == nullptr || info == nullptr) {
-    if (attr_list != nullptr) {
-      SecKeychainItemFreeAttributesAndData(attr_list, nullptr);
+    SecKeychainAttributeList *attr_list = nullptr;
+    os_status = SecKeychainItemCopyAttributesAndData(
+        item, info, &item_class, &attr_list, nullptr, nullptr);
+    if (os_status != noErr || attr_list == nullptr || info == nullptr) {
+      if (attr_list != nullptr) {
+        SecKeychainItemFreeAttributesAndData(attr_list, nullptr);
+      }
+      if (info != nullptr) {
+        SecKeychainFreeAttributeInfo(info);
+      }
+      return Status(os_status,
+                    "Could not copy attributes and data from the keychain");
     }
-    if (info != nullptr) {
+
+    // Bail if the number of elements from the info/Attr list do not match.
+    if (info->count != attr_list->count) {
+      SecKeychainItemFreeAttributesAndData(attr_list, nullptr);
       SecKeychainFreeAttributeInfo(info);
+      return Status(1, "Info and attributes do not match");
     }
-    return Status(os_status,
-                  "Could not copy attributes and data from the keychain");
-  }
 
-  // Bail if the number of elements from the info/Attr list do not match.
-  if (info->count != attr_list->count) {
-    SecKeychainItemFreeAttributesAndData(attr_list, nullptr);
-    SecKeychainFreeAttributeInfo(info);
-    return Status(1, "Info and attributes do not match");
-  }
+    for (int i = 0; i < info->count; ++i) {
+      SecKeychainAttribute *attribute = &attr_list->attr[i];
+      if (attribute->length == 0) {
+        continue;
+      }
 
-  for (int i = 0; i < info->count; ++i) {
-    SecKeychainAttribute *attribute = &attr_list->attr[i];
-    if (attribute->length == 0) {
-      continue;
+      UInt32 tag = info->tag[i];
+      if (tag == 7) {
+        item_metadata.label =
+            attributeBufferToString(attribute->data, attribute->length);
+      }
     }
 
-    UInt32 tag = info->tag[i];
-    if (tag == 7) {
-      item_metadata.label =
-          attributeBufferToString(attribute->data, attribute->length);
-    }
+    // Finally, release/free the info/Attr lists.
+    SecKeychainItemFreeAttributesAndData(attr_list, nullptr);
+    SecKeychainFreeAttributeInfo(info);
   }
 
-  // Finally, release/free the info/Attr lists.
-  SecKeychainItemFreeAttributesAndData(attr_list, nullptr);
-  SecKeychainFreeAttributeInfo(info);
-
   for (const auto &acl_data : acl) {
     for (const auto &app_path : acl_data.applications) {
       Row r;
@@ -268,7 +272,9 @@ Status genKeychainACLAppsForEntry(SecKeychainRef keychain,
   return Status(0, "OK");
 }
 
-Status genKeychainACLApps(const std::string &path, QueryData &results) {
+Status genKeychainACLApps(const std::string &path,
+                          bool label,
+                          QueryData &results) {
   SecKeychainRef keychain = nullptr;
   OSStatus os_status = 0;
 
@@ -300,7 +306,7 @@ Status genKeychainACLApps(const std::string &path, QueryData &results) {
       break;
     }
 
-    auto s = genKeychainACLAppsForEntry(keychain, item, path, results);
+    auto s = genKeychainACLAppsForEntry(keychain, item, path, label, results);
     CFRelease(item);
     if (!s.ok()) {
       TLOG << "Error parsing keychain at " << path << ": " << s.toString();
@@ -315,6 +321,10 @@ Status genKeychainACLApps(const std::string &path, QueryData &results) {
 QueryData genKeychainACLApps(QueryContext &context) {
   QueryData results;
 
+  // Each keychain file's entries are reused until the file changes.
+  bool label = context.isColumnUsed("label");
+  auto key = (label) ? "keychain_acls label" : "keychain_acls";
+
   SecKeychainSetUserInteractionAllowed(false);
   for (const auto &path : getKeychainPaths()) {
     std::vector<std::string> ls_results;
@@ -325,11 +335,17 @@ QueryData genKeychainACLApps(QueryContext &context) {
     }
     for (const auto &keychain : ls_results) {
       TLOG << "Checking directory: " << keychain;
-      auto gen_status = genKeychainACLApps(keychain, results);
-      if (!gen_status.ok()) {
-        TLOG << "Could not list items from " << keychain << ": "
-             << gen_status.toString();
-      }
+      genKeychainCached(
+          key,
+          keychain,
+          [label](const std::string &keychain_path, QueryData &rows) {
+            auto gen_status = genKeychainACLApps(keychain_path, label, rows);
+            if (!gen_status.ok()) {
+              TLOG << "Could not list items from " << keychain_path << ": "
+                   << gen_status.toString();
+            }
+          },
+          results);
     }
   }
   SecKeychainSetUserInteractionAllowed(true);
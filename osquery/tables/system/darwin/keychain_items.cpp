@@ -41,36 +41,59 @@ const std::map<SecItemClass, std::string> kKeychainItemClasses = {
     {kSecPrivateKeyItemClass, "private key"},
     {kSecSymmetricKeyItemClass, "symmetric key"}};
 
-void genKeychainItem(const SecKeychainItemRef& item, QueryData& results) {
-  Row r;
-
-  // Create an info structure with 1 tag, then iterate over setting the tag
-  // type to assure maximum compatibility with the various Keychain items.
+/// Copy string attributes of an item into a row, false if a tag is missing.
+static bool genKeychainItemAttributes(const SecKeychainItemRef& item,
+                                      std::vector<UInt32>& tags,
+                                      const std::vector<std::string>& names,
+                                      SecItemClass& item_class,
+                                      Row& r) {
   SecKeychainAttributeInfo info;
-  UInt32 tags[1];
-  info.count = sizeof(tags) / sizeof(UInt32);
-  info.tag = tags;
+  info.count = tags.size();
+  info.tag = tags.data();
   info.format = nullptr;
 
-  SecItemClass item_class = 0;
   SecKeychainAttributeList* attr_list = nullptr;
+  auto status = SecKeychainItemCopyAttributesAndData(
+      item, &info, &item_class, &attr_list, 0, nullptr);
+  if (status != errSecSuccess || attr_list == nullptr) {
+    return false;
+  }
 
-  // Any tag that does not exist for the item will prevent the entire result.
-  for (const auto& attr_tag : kKeychainItemAttrs) {
-    tags[0] = attr_tag.first;
+  // Expect each specific tag to return string data.
+  for (UInt32 i = 0; i < attr_list->count && i < names.size(); ++i) {
+    SecKeychainAttribute* attr = &attr_list->attr[i];
+    if (attr->length > 0) {
+      r[names[i]] = std::string((char*)attr->data, attr->length);
+    }
+  }
+  SecKeychainItemFreeAttributesAndData(attr_list, nullptr);
+  return true;
+}
+
+void genKeychainItem(const SecKeychainItemRef& item,
+                     const std::string& path,
+                     const std::map<SecItemAttr, std::string>& attrs,
+                     QueryData& results) {
+  Row r;
+
+  // Request every attribute the query uses in a single call.
+  std::vector<UInt32> tags;
+  std::vector<std::string> names;
+  for (const auto& attr_tag : attrs) {
+    tags.push_back(attr_tag.first);
+    names.push_back(attr_tag.second);
+  }
+
+  SecItemClass item_class = 0;
+  if (tags.empty()) {
     SecKeychainItemCopyAttributesAndData(
-        item, &info, &item_class, &attr_list, 0, nullptr);
-
-    if (attr_list != nullptr) {
-      // Expect each specific tag to return string data.
-      for (int i = 0; i < attr_list->count; ++i) {
-        SecKeychainAttribute* attr = &attr_list->attr[i];
-        if (attr->length > 0) {
-          r[attr_tag.second] = std::string((char*)attr->data, attr->length);
-        }
-      }
-      SecKeychainItemFreeAttributesAndData(attr_list, nullptr);
-      attr_list = nullptr;
+        item, nullptr, &item_class, nullptr, 0, nullptr);
+  } else if (!genKeychainItemAttributes(item, tags, names, item_class, r)) {
+    // Any tag that does not exist for the item will prevent the entire
+    // result, request each tag on its own to keep the others.
+    for (size_t i = 0; i < tags.size(); ++i) {
+      std::vector<UInt32> tag = {tags[i]};
+      genKeychainItemAttributes(item, tag, {names[i]}, item_class, r);
     }
   }
 
@@ -79,10 +102,31 @@ void genKeychainItem(const SecKeychainItemRef& item, QueryData& results) {
     r["type"] = kKeychainItemClasses.at(item_class);
   }
 
-  r["path"] = getKeychainPath(item);
+  r["path"] = path;
   results.push_back(r);
 }
 
+/// Generate the items of a single keychain file.
+void genKeychainFileItems(const std::string& path,
+                          const std::map<SecItemAttr, std::string>& attrs,
+                          QueryData& results) {
+  for (const auto& item_type : kKeychainItemTypes) {
+    CFArrayRef items = CreateKeychainItems({path}, item_type);
+    if (items == nullptr) {
+      continue;
+    }
+    auto count = CFArrayGetCount(items);
+    for (CFIndex i = 0; i < count; i++) {
+      genKeychainItem((SecKeychainItemRef)CFArrayGetValueAtIndex(items, i),
+                      path,
+                      attrs,
+                      results);
+    }
+
+    CFRelease(items);
+  }
+}
+
 QueryData genKeychainItems(QueryContext& context) {
   QueryData results;
 
@@ -94,18 +138,28 @@ QueryData genKeychainItems(QueryContext& context) {
     keychain_paths = getKeychainPaths();
   }
 
-  for (const auto& item_type : kKeychainItemTypes) {
-    CFArrayRef items = CreateKeychainItems(keychain_paths, item_type);
-    if (items == nullptr) {
-      continue;
-    }
-    auto count = CFArrayGetCount(items);
-    for (CFIndex i = 0; i < count; i++) {
-      genKeychainItem((SecKeychainItemRef)CFArrayGetValueAtIndex(items, i),
-                      results);
+  // Only request the attributes the query uses, the key separates their rows.
+  std::map<SecItemAttr, std::string> attrs;
+  std::string key = "keychain_items";
+  for (const auto& attr_tag : kKeychainItemAttrs) {
+    if (context.isColumnUsed(attr_tag.second)) {
+      attrs.insert(attr_tag);
+      key += " " + attr_tag.second;
     }
+  }
 
-    CFRelease(items);
+  // Each keychain file's items are reused until the file changes.
+  for (const auto& search_path : keychain_paths) {
+    std::vector<std::string> files;
+    listKeychainFiles(search_path, files);
+    for (const auto& file : files) {
+      genKeychainCached(key,
+                        file,
+                        [&attrs](const std::string& path, QueryData& rows) {
+                          genKeychainFileItems(path, attrs, rows);
+                        },
+                        results);
+    }
   }
 
   return results;
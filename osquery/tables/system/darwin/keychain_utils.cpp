@@ -8,8 +8,9 @@
  *
  */
 
-#include <string>
 #include <iomanip>
+#include <mutex>
+#include <string>
 
 #include <boost/lexical_cast.hpp>
 
@@ -29,19 +30,34 @@ const std::vector<std::string> kUserKeychainPaths = {
     "/Library/Keychains",
 };
 
-void genKeychains(const std::string& path, CFMutableArrayRef& keychains) {
-  std::vector<std::string> paths;
+const size_t kKeychainCacheMax = 256;
+
+/// Rows generated from a keychain file and the file identity they came from.
+struct KeychainCacheEntry {
+  /// The file identity, see getFileIdentity.
+  std::string identity;
+  QueryData results;
+};
 
+/// Cached rows by key and keychain path.
+static std::map<std::string, KeychainCacheEntry> kKeychainCache;
+static std::mutex kKeychainCacheMutex;
+
+void listKeychainFiles(const std::string& path,
+                       std::vector<std::string>& files) {
   // Support both a directory and explicit path search.
   if (isDirectory(path).ok()) {
     // Try to list every file in the given keychain search path.
-    if (!listFilesInDirectory(path, paths).ok()) {
-      return;
-    }
+    listFilesInDirectory(path, files);
   } else {
     // The explicit path search comes from a query predicate.
-    paths.push_back(path);
+    files.push_back(path);
   }
+}
+
+void genKeychains(const std::string& path, CFMutableArrayRef& keychains) {
+  std::vector<std::string> paths;
+  listKeychainFiles(path, paths);
 
   for (const auto& keychain_path : paths) {
     SecKeychainRef keychain = nullptr;
@@ -296,5 +312,39 @@ std::set<std::string> getKeychainPaths() {
 
   return keychain_paths;
 }
+
+void genKeychainCached(const std::string& key,
+                       const std::string& path,
+                       const KeychainGenerator& generator,
+                       QueryData& results) {
+  std::string identity;
+  if (!getFileIdentity(path, identity).ok()) {
+    return;
+  }
+
+  auto cache_key = key + "\n" + path;
+  {
+    std::lock_guard<std::mutex> lock(kKeychainCacheMutex);
+    auto it = kKeychainCache.find(cache_key);
+    if (it != kKeychainCache.end() && it->second.identity == identity) {
+      results.insert(results.end(),
+                     it->second.results.begin(),
+                     it->second.results.end());
+      return;
+    }
+  }
+
+  // Generate without holding the lock, the file identity is from before.
+  KeychainCacheEntry entry;
+  entry.identity = identity;
+  generator(path, entry.results);
+  results.insert(results.end(), entry.results.begin(), entry.results.end());
+
+  std::lock_guard<std::mutex> lock(kKeychainCacheMutex);
+  if (kKeychainCache.size() >= kKeychainCacheMax) {
+    kKeychainCache.clear();
+  }
+  kKeychainCache[cache_key] = std::move(entry);
+}
 }
 }
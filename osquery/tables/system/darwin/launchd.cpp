@@ -107,7 +107,7 @@ QueryData genLaunchd(QueryContext& context) {
     }
   }
 
-  // The osquery::parsePlist method will reset/clear a property tree.
+  // The osquery::parsePlistCached method will reset/clear a property tree.
   // Keeping the data structure in a larger scope preserves allocations
   // between similar-sized trees.
   pt::ptree tree;
@@ -119,7 +119,7 @@ QueryData genLaunchd(QueryContext& context) {
       continue;
     }
 
-    if (!osquery::parsePlist(path, tree).ok()) {
+    if (!osquery::parsePlistCached(path, tree).ok()) {
       TLOG << "Error parsing launch daemon/agent plist: " << path;
       continue;
     }
@@ -139,7 +139,7 @@ void genLaunchdOverride(const fs::path& path, QueryData& results) {
   r["uid"] = (group.size() == 5) ? BIGINT(group.at(4)) : "0";
 
   pt::ptree tree;
-  if (!osquery::parsePlist(path, tree).ok()) {
+  if (!osquery::parsePlistCached(path, tree).ok()) {
     return;
   }
 
@@ -8,6 +8,11 @@
  *
  */
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/hash.h>
@@ -39,6 +44,32 @@ namespace fs = boost::filesystem;
 namespace osquery {
 namespace tables {
 
+BOMMapping::BOMMapping(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+
+  struct stat file_stat;
+  if (::fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) &&
+      file_stat.st_size > 0) {
+    void* data = ::mmap(
+        nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      data_ = (const char*)data;
+      size_ = file_stat.st_size;
+    }
+  }
+  // The mapping remains valid after the descriptor is closed.
+  ::close(fd);
+}
+
+BOMMapping::~BOMMapping() {
+  if (data_ != nullptr) {
+    ::munmap((void*)data_, size_);
+  }
+}
+
 BOM::BOM(const char* data, size_t size)
     : data_(data), size_(size), valid_(false) {
   if (size_ < sizeof(BOMHeader)) {
@@ -86,7 +117,7 @@ const char* BOM::getPointer(int index, size_t* length) const {
   }
 
   const BOMPointer* pointer = Table->blockPointers + ntohl(index);
-  uint32_t addr = ntohl(pointer->address);
+  size_t addr = ntohl(pointer->address);
   if (size_ < addr + ntohl(pointer->length)) {
     // Address value is out of range.
     return nullptr;
@@ -110,7 +141,8 @@ const BOMVar* BOM::getVariable(size_t* offset) const {
   }
 
   const BOMVar* var = (BOMVar*)((char*)Vars->list + *offset);
-  if (var == nullptr) {
+  if (size_ < vars_offset_ + *offset + sizeof(BOMVar) + var->length) {
+    // The variable name overflows the variable list.
     *offset = 0;
     return nullptr;
   }
@@ -127,34 +159,45 @@ const BOMPaths* BOM::getPaths(int index) const {
   }
 
   // Check the number of indexes.
-  if (paths_size < ntohs(paths->count) * sizeof(BOMPathIndices)) {
+  if (paths_size <
+      sizeof(BOMPaths) + ntohs(paths->count) * sizeof(BOMPathIndices)) {
     return nullptr;
   }
   return paths;
 }
 
-void genBOMPaths(const std::string& path,
+/**
+ * @brief Yield a row for each path in a BOM's path leaves.
+ *
+ * Each path's full name is kept by BOM file id, so a child's name is its
+ * parent's full name and the child's filename.
+ *
+ * @return false if the yield stopped the generation.
+ */
+bool genBOMPaths(const std::string& path,
                  const BOM& bom,
                  const BOMPaths* paths,
-                 QueryData& results) {
+                 const TypedRowYield& yield) {
   std::map<uint32_t, std::string> filenames;
-  std::map<uint32_t, uint32_t> parents;
 
   while (paths != nullptr) {
     for (unsigned j = 0; j < ntohs(paths->count); j++) {
       uint32_t index0 = paths->indices[j].index0;
       uint32_t index1 = paths->indices[j].index1;
 
-      auto info1 = (const BOMPathInfo1*)bom.getPointer(index0);
-      if (info1 == nullptr) {
+      size_t info1_size = 0;
+      auto info1 = (const BOMPathInfo1*)bom.getPointer(index0, &info1_size);
+      if (info1 == nullptr || info1_size < sizeof(BOMPathInfo1)) {
         // Invalid BOMPathInfo1 structure.
-        return;
+        return true;
       }
 
-      auto info2 = (const BOMPathInfo2*)bom.getPointer(info1->index);
-      if (info2 == nullptr) {
+      size_t info2_size = 0;
+      auto info2 =
+          (const BOMPathInfo2*)bom.getPointer(info1->index, &info2_size);
+      if (info2 == nullptr || info2_size < sizeof(BOMPathInfo2)) {
         // Invalid BOMPathInfo2 structure.
-        return;
+        return true;
       }
 
       // Compute full name using pointer size.
@@ -162,53 +205,52 @@ void genBOMPaths(const std::string& path,
       auto file = (const BOMFile*)bom.getPointer(index1, &file_size);
       if (file == nullptr || file_size <= sizeof(BOMFile)) {
         // Invalid BOMFile structure or size out of bounds.
-        return;
+        return true;
       }
-      std::string filename(file->name, file_size - sizeof(BOMFile));
-      filename = std::string(filename.c_str());
+      size_t name_size = file_size - sizeof(BOMFile);
+      std::string filename(file->name, strnlen(file->name, name_size));
 
-      // Maintain a lookup from BOM file index to filename.
-      filenames[info1->id] = filename;
+      // Maintain a lookup from BOM file index to full filename.
       if (file->parent) {
-        parents[info1->id] = file->parent;
-      }
-
-      auto it = parents.find(info1->id);
-      while (it != parents.end()) {
-        filename = filenames[it->second] + "/" + filename;
-        it = parents.find(it->second);
+        auto parent = filenames.find(file->parent);
+        filename = ((parent != filenames.end()) ? parent->second : "") + "/" +
+                   filename;
       }
+      filenames[info1->id] = filename;
 
-      Row r;
-      r["filepath"] = filename;
-      r["uid"] = INTEGER(ntohl(info2->user));
-      r["gid"] = INTEGER(ntohl(info2->group));
-      r["mode"] = INTEGER(ntohs(info2->mode));
-      r["size"] = INTEGER(ntohl(info2->size));
-      r["modified_time"] = INTEGER(ntohl(info2->modtime));
+      TypedRow r;
+      r["filepath"] = std::move(filename);
+      r["uid"] = ntohl(info2->user);
+      r["gid"] = ntohl(info2->group);
+      r["mode"] = ntohs(info2->mode);
+      r["size"] = ntohl(info2->size);
+      r["modified_time"] = ntohl(info2->modtime);
       r["path"] = path;
-      results.push_back(r);
+      if (!yield(r)) {
+        return false;
+      }
     }
 
     if (paths->forward == htonl(0)) {
-      return;
+      return true;
     } else {
       paths = bom.getPaths(paths->forward);
     }
   }
+  return true;
 }
 
-void genPackageBOM(const std::string& path, QueryData& results) {
-  std::string content;
-  // Read entire BOM file.
-  if (!readFile(path, content).ok()) {
-    return;
+bool genPackageBOM(const std::string& path, const TypedRowYield& yield) {
+  // Map the BOM file, the structures are read in place.
+  BOMMapping mapping(path);
+  if (!mapping.isValid()) {
+    return true;
   }
 
   // Create a BOM representation.
-  BOM bom(content.c_str(), content.size());
+  BOM bom(mapping.data(), mapping.size());
   if (!bom.isValid()) {
-    return;
+    return true;
   }
 
   size_t var_offset = 0;
@@ -234,28 +276,28 @@ void genPackageBOM(const std::string& path, QueryData& results) {
     const BOMTree* tree = (const BOMTree*)var_data;
     auto paths = bom.getPaths(tree->child);
     while (paths != nullptr && paths->isLeaf == htons(0)) {
-      if ((BOMPathIndices*)paths->indices == nullptr) {
+      if ((BOMPathIndices*)paths->indices == nullptr ||
+          ntohs(paths->count) == 0) {
         break;
       }
       paths = bom.getPaths(paths->indices[0].index0);
     }
 
-    genBOMPaths(path, bom, paths, results);
-    break;
+    return genBOMPaths(path, bom, paths, yield);
   }
+  return true;
 }
 
-QueryData genPackageBOM(QueryContext& context) {
-  QueryData results;
+void genPackageBOM(QueryContext& context, const TypedRowYield& yield) {
   if (context.constraints["path"].exists(EQUALS)) {
     // If an explicit path was given, generate and return.
     auto paths = context.constraints["path"].getAll(EQUALS);
     for (const auto& path : paths) {
-      genPackageBOM(path, results);
+      if (!genPackageBOM(path, yield)) {
+        break;
+      }
     }
   }
-
-  return results;
 }
 
 void genPackageReceipt(const std::string& path, QueryData& results) {
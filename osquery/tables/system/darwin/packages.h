@@ -14,6 +14,8 @@
 #include <map>
 #include <string>
 
+#include <boost/noncopyable.hpp>
+
 namespace osquery {
 namespace tables {
 
@@ -113,6 +115,28 @@ struct BOMFile {
   char name[];
 } __attribute__((packed));
 
+/**
+ * @brief A read-only memory mapping of a BOM file.
+ *
+ * BOM files may be many megabytes, the BOM structures index directly into
+ * the mapping rather than a copy of the file content.
+ */
+class BOMMapping : private boost::noncopyable {
+ public:
+  explicit BOMMapping(const std::string& path);
+  ~BOMMapping();
+
+  /// Helper to check if the file was mapped.
+  bool isValid() const { return data_ != nullptr; }
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const char* data_{nullptr};
+  size_t size_{0};
+};
+
 class BOM {
  public:
   BOM(const char* data, size_t size);
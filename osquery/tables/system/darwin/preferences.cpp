@@ -219,7 +219,7 @@ void genOSXPlistPreferences(const std::string& path, QueryData& results) {
   }
 
   pt::ptree tree;
-  if (!osquery::parsePlist(path, tree).ok()) {
+  if (!osquery::parsePlistCached(path, tree).ok()) {
     VLOG(1) << "Could not parse plist: " + path;
     return;
   }
@@ -9,6 +9,7 @@
  */
 
 #include <set>
+#include <vector>
 
 // Keep sys/socket first.
 #include <sys/socket.h>
@@ -35,6 +36,46 @@ enum descriptor_type {
 // From processes.cpp
 std::set<int> getProcList(const QueryContext &context);
 
+/// Descriptors listed before the first pid's list needs a larger buffer.
+const size_t kDescriptorsInitial = 256;
+
+/**
+ * @brief The descriptors of each process, listed into one reused buffer.
+ *
+ * A query lists the descriptors of every process. The buffer grows until it
+ * fits the process with the most descriptors, each later process is listed
+ * with a single PROC_PIDLISTFDS call instead of a size call and a list call.
+ */
+class DescriptorSnapshot {
+ public:
+  DescriptorSnapshot() : fds_(kDescriptorsInitial) {}
+
+  /// List a process's descriptors, false if the process cannot be inspected.
+  bool list(int pid) {
+    count_ = 0;
+    while (true) {
+      int size = static_cast<int>(fds_.size() * PROC_PIDLISTFD_SIZE);
+      int bytes = proc_pidinfo(pid, PROC_PIDLISTFDS, 0, fds_.data(), size);
+      if (bytes <= 0) {
+        return false;
+      } else if (bytes < size) {
+        count_ = bytes / PROC_PIDLISTFD_SIZE;
+        return true;
+      }
+      // A full buffer may be truncated.
+      fds_.resize(fds_.size() * 2);
+    }
+  }
+
+  size_t size() const { return count_; }
+
+  const struct proc_fdinfo &at(size_t index) const { return fds_[index]; }
+
+ private:
+  std::vector<struct proc_fdinfo> fds_;
+  size_t count_{0};
+};
+
 inline std::string socketIpAsString(const struct in_sockinfo *in,
                                     int type,
                                     int family) {
@@ -153,23 +194,24 @@ void genSocketDescriptor(int pid, int descriptor, QueryData &results) {
   }
 }
 
-void genOpenDescriptors(int pid, descriptor_type type, QueryData &results) {
-  int bufsize = proc_pidinfo(pid, PROC_PIDLISTFDS, 0, 0, 0);
-  if (bufsize == -1) {
+void genOpenDescriptors(int pid,
+                        descriptor_type type,
+                        DescriptorSnapshot &snapshot,
+                        QueryData &results) {
+  if (!snapshot.list(pid)) {
     VLOG(1) << "Could not list descriptors for pid: " << pid;
     return;
   }
 
-  // Allocate structs for each descriptor.
-  proc_fdinfo fds[bufsize / PROC_PIDLISTFD_SIZE];
-  proc_pidinfo(pid, PROC_PIDLISTFDS, 0, fds, bufsize);
-
-  for (auto fd_info : fds) {
-    if (type == DESCRIPTORS_TYPE_VNODE &&
-        fd_info.proc_fdtype == PROX_FDTYPE_VNODE) {
+  auto fdtype =
+      (type == DESCRIPTORS_TYPE_VNODE) ? PROX_FDTYPE_VNODE : PROX_FDTYPE_SOCKET;
+  for (size_t i = 0; i < snapshot.size(); ++i) {
+    const auto &fd_info = snapshot.at(i);
+    if (fd_info.proc_fdtype != fdtype) {
+      continue;
+    } else if (type == DESCRIPTORS_TYPE_VNODE) {
       genFileDescriptor(pid, fd_info.proc_fd, results);
-    } else if (type == DESCRIPTORS_TYPE_SOCKET &&
-        fd_info.proc_fdtype == PROX_FDTYPE_SOCKET) {
+    } else {
       genSocketDescriptor(pid, fd_info.proc_fd, results);
     }
   }
@@ -178,13 +220,14 @@ void genOpenDescriptors(int pid, descriptor_type type, QueryData &results) {
 QueryData genOpenSockets(QueryContext &context) {
   QueryData results;
 
+  DescriptorSnapshot snapshot;
   auto pidlist = getProcList(context);
   for (auto &pid : pidlist) {
     if (!context.constraints["pid"].matches(pid)) {
       // Optimize by not searching when a pid is a constraint.
       continue;
     }
-    genOpenDescriptors(pid, DESCRIPTORS_TYPE_SOCKET, results);
+    genOpenDescriptors(pid, DESCRIPTORS_TYPE_SOCKET, snapshot, results);
   }
 
   return results;
@@ -193,6 +236,7 @@ QueryData genOpenSockets(QueryContext &context) {
 QueryData genOpenFiles(QueryContext &context) {
   QueryData results;
 
+  DescriptorSnapshot snapshot;
   auto pidlist = getProcList(context);
   for (auto &pid : pidlist) {
     if (!context.constraints["pid"].matches(pid)) {
@@ -200,7 +244,7 @@ QueryData genOpenFiles(QueryContext &context) {
       continue;
     }
 
-    genOpenDescriptors(pid, DESCRIPTORS_TYPE_VNODE, results);
+    genOpenDescriptors(pid, DESCRIPTORS_TYPE_VNODE, snapshot, results);
   }
 
   return results;
@@ -8,11 +8,15 @@
  *
  */
 
+#include <algorithm>
 #include <map>
+#include <mutex>
 #include <set>
+#include <vector>
 
 #include <libproc.h>
 #include <mach/mach.h>
+#include <mach/mach_vm.h>
 #include <sys/sysctl.h>
 
 #include <mach-o/dyld_images.h>
@@ -33,6 +37,9 @@ namespace tables {
 // The maximum number of expected memory regions per process.
 #define MAX_MEMORY_MAPS 512
 
+/// The most dyld images read from a process, the count is process memory.
+const uint32_t kMaxProcessLibraries = 16384;
+
 std::set<int> getProcList(const QueryContext &context) {
   std::set<int> pidlist;
   if (context.constraints.count("pid") > 0 &&
@@ -77,26 +84,6 @@ std::set<int> getProcList(const QueryContext &context) {
   return pidlist;
 }
 
-std::map<int, int> getParentMap(const std::set<int> &pidlist) {
-  std::map<int, int> pidmap;
-
-  struct kinfo_proc proc;
-  size_t size = sizeof(proc);
-
-  for (const auto &pid : pidlist) {
-    int name[] = {CTL_KERN, KERN_PROC, KERN_PROC_PID, pid};
-    if (sysctl((int *)name, 4, &proc, &size, nullptr, 0) == -1) {
-      break;
-    }
-
-    if (size > 0) {
-      pidmap[pid] = (int)proc.kp_eproc.e_ppid;
-    }
-  }
-
-  return pidmap;
-}
-
 inline std::string getProcPath(int pid) {
   char path[PROC_PIDPATHINFO_MAXSIZE] = "\0";
   int bufsize = proc_pidpath(pid, path, sizeof(path));
@@ -112,17 +99,35 @@ struct proc_cred {
     uid_t uid;
     gid_t gid;
   } real, effective;
+  pid_t parent;
 };
 
+/**
+ * @brief Read a process's credentials and parent with one proc_pidinfo call.
+ *
+ * PROC_PIDTASKALLINFO is only allowed for the caller's own processes unless
+ * running as root, the short BSD info is used for the remaining processes.
+ */
 inline bool getProcCred(int pid, proc_cred &cred) {
-  struct proc_bsdshortinfo bsdinfo;
+  struct proc_taskallinfo info;
+  if (proc_pidinfo(pid, PROC_PIDTASKALLINFO, 0, &info, sizeof(info)) ==
+      sizeof(info)) {
+    cred.real.uid = info.pbsd.pbi_ruid;
+    cred.real.gid = info.pbsd.pbi_rgid;
+    cred.effective.uid = info.pbsd.pbi_uid;
+    cred.effective.gid = info.pbsd.pbi_gid;
+    cred.parent = info.pbsd.pbi_ppid;
+    return true;
+  }
 
+  struct proc_bsdshortinfo bsdinfo;
   if (proc_pidinfo(pid, PROC_PIDT_SHORTBSDINFO, 0, &bsdinfo, sizeof(bsdinfo)) ==
       sizeof(bsdinfo)) {
     cred.real.uid = bsdinfo.pbsi_ruid;
     cred.real.gid = bsdinfo.pbsi_rgid;
     cred.effective.uid = bsdinfo.pbsi_uid;
     cred.effective.gid = bsdinfo.pbsi_gid;
+    cred.parent = bsdinfo.pbsi_ppid;
     return true;
   }
   return false;
@@ -142,7 +147,7 @@ static int genMaxArgs() {
   return argmax;
 }
 
-void genProcRootAndCWD(int pid, Row &r) {
+void genProcRootAndCWD(int pid, TypedRow &r) {
   r["cwd"] = "";
   r["root"] = "";
 
@@ -165,13 +170,20 @@ struct proc_args {
   std::map<std::string, std::string> env;
 };
 
-proc_args getProcRawArgs(int pid, size_t argmax) {
+/**
+ * @brief Parse a process's arguments and environment.
+ *
+ * The KERN_PROCARGS2 buffer is sized to the max args space by the caller and
+ * reused for every pid. The environment is only parsed when requested.
+ */
+proc_args getProcRawArgs(int pid, std::vector<char> &procargs, bool env) {
   proc_args args;
-  uid_t euid = geteuid();
-  char procargs[argmax];
+  size_t size = procargs.size();
   int mib[3] = {CTL_KERN, KERN_PROCARGS2, pid};
-  if (sysctl(mib, 3, &procargs, &argmax, nullptr, 0) == -1 || argmax == 0) {
-    if (euid == 0) {
+  if (size == 0 ||
+      sysctl(mib, 3, procargs.data(), &size, nullptr, 0) == -1 ||
+      size < sizeof(int)) {
+    if (geteuid() == 0) {
       TLOG << "An error occurred retrieving the env for pid: " << pid;
     }
     return args;
@@ -179,31 +191,32 @@ proc_args getProcRawArgs(int pid, size_t argmax) {
 
   // The number of arguments is an integer in front of the result buffer.
   int nargs = 0;
-  memcpy(&nargs, procargs, sizeof(nargs));
+  memcpy(&nargs, procargs.data(), sizeof(nargs));
   // Walk the \0-tokenized list of arguments until reaching the returned 'max'
   // number of arguments or the number appended to the front.
-  const char *current_arg = &procargs[0] + sizeof(nargs);
+  const char *end = procargs.data() + size;
+  const char *current_arg = procargs.data() + sizeof(nargs);
   // Then skip the exec/program name.
-  auto exec_name = std::string(current_arg);
-  current_arg += exec_name.size() + 1;
-  while (current_arg < &procargs[argmax]) {
+  current_arg += strnlen(current_arg, end - current_arg) + 1;
+  while (current_arg < end) {
     // Skip optional null-character padding.
     if (*current_arg == '\0') {
       current_arg++;
       continue;
     }
 
-    auto string_arg = std::string(current_arg);
-    if (string_arg.size() > 0) {
-      if (nargs > 0) {
-        // The first nargs are CLI arguments, afterward they are environment.
-        args.args.push_back(string_arg);
-        nargs--;
-      } else {
-        size_t idx = string_arg.find_first_of("=");
-        if (idx != std::string::npos && idx > 0) {
-          args.env[string_arg.substr(0, idx)] = string_arg.substr(idx + 1);
-        }
+    auto string_arg =
+        std::string(current_arg, strnlen(current_arg, end - current_arg));
+    if (nargs > 0) {
+      // The first nargs are CLI arguments, afterward they are environment.
+      args.args.push_back(string_arg);
+      nargs--;
+    } else if (!env) {
+      break;
+    } else {
+      size_t idx = string_arg.find_first_of("=");
+      if (idx != std::string::npos && idx > 0) {
+        args.env[string_arg.substr(0, idx)] = string_arg.substr(idx + 1);
       }
     }
     current_arg += string_arg.size() + 1;
@@ -212,49 +225,54 @@ proc_args getProcRawArgs(int pid, size_t argmax) {
   return args;
 }
 
-QueryData genProcesses(QueryContext &context) {
-  QueryData results;
-
+void genProcesses(QueryContext &context, const TypedRowYield &yield) {
   auto pidlist = getProcList(context);
-  auto parent_pid = getParentMap(pidlist);
-  int argmax = genMaxArgs();
+
+  // One args buffer is reused for every pid, only if the cmdline is used.
+  std::vector<char> procargs;
+  bool cmdline = context.isColumnUsed("cmdline");
+  if (cmdline) {
+    procargs.resize(genMaxArgs());
+  }
+  bool paths = context.isColumnUsed("cwd") || context.isColumnUsed("root");
 
   for (auto &pid : pidlist) {
-    Row r;
-    r["pid"] = INTEGER(pid);
-    r["path"] = getProcPath(pid);
+    TypedRow r;
+    r["pid"] = pid;
+    auto path = getProcPath(pid);
+    r["path"] = path;
     // OS X proc_name only returns 16 bytes, use the basename of the path.
-    r["name"] = fs::path(r["path"]).filename().string();
+    r["name"] = fs::path(path).filename().string();
 
-    {
+    if (cmdline) {
       // The command line invocation including arguments.
-      auto args = getProcRawArgs(pid, argmax);
-      std::string cmdline = boost::algorithm::join(args.args, " ");
-      r["cmdline"] = cmdline;
+      auto args = getProcRawArgs(pid, procargs, false);
+      r["cmdline"] = boost::algorithm::join(args.args, " ");
+    } else {
+      r["cmdline"] = "";
     }
 
     // The process relative root and current working directory.
-    genProcRootAndCWD(pid, r);
-
-    proc_cred cred;
-    if (getProcCred(pid, cred)) {
-      r["uid"] = BIGINT(cred.real.uid);
-      r["gid"] = BIGINT(cred.real.gid);
-      r["euid"] = BIGINT(cred.effective.uid);
-      r["egid"] = BIGINT(cred.effective.gid);
+    if (paths) {
+      genProcRootAndCWD(pid, r);
     } else {
-      r["uid"] = "-1";
-      r["gid"] = "-1";
-      r["euid"] = "-1";
-      r["egid"] = "-1";
+      r["cwd"] = "";
+      r["root"] = "";
     }
 
-    // Find the parent process.
-    const auto parent_it = parent_pid.find(pid);
-    if (parent_it != parent_pid.end()) {
-      r["parent"] = INTEGER(parent_it->second);
+    proc_cred cred;
+    if (getProcCred(pid, cred)) {
+      r["uid"] = cred.real.uid;
+      r["gid"] = cred.real.gid;
+      r["euid"] = cred.effective.uid;
+      r["egid"] = cred.effective.gid;
+      r["parent"] = cred.parent;
     } else {
-      r["parent"] = "-1";
+      r["uid"] = -1;
+      r["gid"] = -1;
+      r["euid"] = -1;
+      r["egid"] = -1;
+      r["parent"] = -1;
     }
 
     // If the path of the executable that started the process is available and
@@ -262,7 +280,7 @@ QueryData genProcesses(QueryContext &context) {
     // available, set on_disk to -1. If, and only if, the path of the
     // executable is available and the file does NOT exist on disk, set on_disk
     // to 0.
-    r["on_disk"] = osquery::pathExists(r["path"]).toString();
+    r["on_disk"] = osquery::pathExists(path).toString();
 
     // systems usage and time information
     struct rusage_info_v2 rusage_info_data;
@@ -288,19 +306,19 @@ QueryData genProcesses(QueryContext &context) {
       r["start_time"] = "-1";
     }
 
-    results.push_back(r);
+    if (!yield(r)) {
+      break;
+    }
   }
-
-  return results;
 }
 
 QueryData genProcessEnvs(QueryContext &context) {
   QueryData results;
 
   auto pidlist = getProcList(context);
-  int argmax = genMaxArgs();
+  std::vector<char> procargs(genMaxArgs());
   for (const auto &pid : pidlist) {
-    auto args = getProcRawArgs(pid, argmax);
+    auto args = getProcRawArgs(pid, procargs, true);
     for (const auto &env : args.env) {
       Row r;
       r["pid"] = INTEGER(pid);
@@ -313,19 +331,62 @@ QueryData genProcessEnvs(QueryContext &context) {
   return results;
 }
 
+/// The library paths of a process, by process-mapped load address.
+typedef std::map<mach_vm_address_t, std::string> ProcessLibraries;
+
+/// Library paths cached by pid and process start time (usec).
+static std::mutex kProcessLibrariesMutex;
+static std::map<std::pair<int, uint64_t>, ProcessLibraries> kProcessLibraries;
+
+static std::string getRegionPath(int pid,
+                                 mach_vm_address_t address,
+                                 struct vm_region_submap_info_64 &info,
+                                 bool &pseudo) {
+  char filename[PATH_MAX] = {0};
+  // Eventually we'll arrive at dynamic memory COW regions.
+  // OS X will return a dyld_shared_cache[...] substitute alias.
+  int bytes = proc_regionfilename(pid, address, filename, sizeof(filename));
+  if (bytes > 0 && filename[0] != 0) {
+    // The share mode is not a mutex for having a filled-in path.
+    pseudo = false;
+    return filename;
+  }
+
+  // Labeling all non-path regions pseudo is not 100% appropriate.
+  // Practically, pivoting on non-meta (actual) paths is helpful.
+  pseudo = true;
+  switch (info.share_mode) {
+  case SM_COW:
+    return "[cow]";
+  case SM_PRIVATE:
+    return "[private]";
+  case SM_EMPTY:
+    return "[null]";
+  case SM_SHARED:
+  case SM_TRUESHARED:
+    return "[shared]";
+  case SM_PRIVATE_ALIASED:
+    return "[private_aliased]";
+  case SM_SHARED_ALIASED:
+    return "[shared_aliased]";
+  default:
+    return "[unknown]";
+  }
+}
+
 void genMemoryRegion(int pid,
-                     const vm_address_t &address,
-                     const vm_size_t &size,
+                     mach_vm_address_t address,
+                     mach_vm_size_t size,
                      struct vm_region_submap_info_64 &info,
-                     const std::map<vm_address_t, std::string> &libraries,
+                     const ProcessLibraries *libraries,
                      QueryData &results) {
   Row r;
   r["pid"] = INTEGER(pid);
 
   char addr_str[17] = {0};
-  sprintf(addr_str, "%016lx", address);
+  sprintf(addr_str, "%016llx", (unsigned long long)address);
   r["start"] = "0x" + std::string(addr_str);
-  sprintf(addr_str, "%016lx", address + size);
+  sprintf(addr_str, "%016llx", (unsigned long long)(address + size));
   r["end"] = "0x" + std::string(addr_str);
 
   char perms[5] = {0};
@@ -337,47 +398,15 @@ void genMemoryRegion(int pid,
   // Mimic Linux permissions reporting.
   r["permissions"] = std::string(perms) + 'p';
 
-  char filename[PATH_MAX] = {0};
-  // Eventually we'll arrive at dynamic memory COW regions.
-  // OS X will return a dyld_shared_cache[...] substitute alias.
-  int bytes = proc_regionfilename(pid, address, filename, sizeof(filename));
-
   if (info.share_mode == SM_COW && info.ref_count == 1) {
     // (psutil) Treat single reference SM_COW as SM_PRIVATE
     info.share_mode = SM_PRIVATE;
   }
 
-  if (bytes == 0 || filename[0] == 0) {
-    switch (info.share_mode) {
-    case SM_COW:
-      r["path"] = "[cow]";
-      break;
-    case SM_PRIVATE:
-      r["path"] = "[private]";
-      break;
-    case SM_EMPTY:
-      r["path"] = "[null]";
-      break;
-    case SM_SHARED:
-    case SM_TRUESHARED:
-      r["path"] = "[shared]";
-      break;
-    case SM_PRIVATE_ALIASED:
-      r["path"] = "[private_aliased]";
-      break;
-    case SM_SHARED_ALIASED:
-      r["path"] = "[shared_aliased]";
-      break;
-    default:
-      r["path"] = "[unknown]";
-    }
-    // Labeling all non-path regions pseudo is not 100% appropriate.
-    // Practically, pivoting on non-meta (actual) paths is helpful.
-    r["pseudo"] = "1";
-  } else {
-    // The share mode is not a mutex for having a filled-in path.
-    r["path"] = std::string(filename);
-    r["pseudo"] = "0";
+  if (libraries != nullptr) {
+    bool pseudo = true;
+    r["path"] = getRegionPath(pid, address, info, pseudo);
+    r["pseudo"] = (pseudo) ? "1" : "0";
   }
 
   r["offset"] = INTEGER(info.offset);
@@ -385,40 +414,86 @@ void genMemoryRegion(int pid,
 
   // Fields not applicable to OS X maps.
   r["inode"] = "0";
-
-  // Increment the address/region request offset.
   results.push_back(r);
 
+  if (libraries == nullptr) {
+    return;
+  }
+
   // Submaps or offsets into regions may contain libraries mapped from the
   // dyld cache.
-  for (const auto &library : libraries) {
-    if (library.first > address && library.first < (address + size)) {
-      r["offset"] = INTEGER(info.offset + (library.first - address));
-      r["path"] = library.second;
-      r["pseudo"] = "0";
-      results.push_back(r);
-    }
+  for (auto library = libraries->upper_bound(address);
+       library != libraries->end() && library->first < address + size;
+       ++library) {
+    r["offset"] = INTEGER(info.offset + (library->first - address));
+    r["path"] = library->second;
+    r["pseudo"] = "0";
+    results.push_back(r);
   }
 }
 
 static bool readProcessMemory(const mach_port_t &task,
-                              const vm_address_t &from,
-                              const vm_size_t &size,
-                              vm_address_t to) {
-  vm_size_t bytes;
-  auto status = vm_read_overwrite(task, from, size, to, &bytes);
-  if (status != KERN_SUCCESS) {
-    return false;
-  }
+                              mach_vm_address_t from,
+                              mach_vm_size_t size,
+                              void *to) {
+  mach_vm_size_t bytes = 0;
+  auto status = mach_vm_read_overwrite(
+      task, from, size, (mach_vm_address_t)to, &bytes);
+  return (status == KERN_SUCCESS && bytes == size);
+}
+
+/**
+ * @brief Walk the memory regions and dyld images of processes.
+ *
+ * One walker is used for each query, the dyld image array is read with one
+ * read into a buffer that is reused for every process.
+ */
+class MemoryMapWalker {
+ public:
+  /// Read the dyld image list of a process.
+  void genLibraries(const mach_port_t &task, ProcessLibraries &libraries);
+
+  /// Emit the rows of each region, libraries is nullptr to skip paths.
+  void genRegions(int pid,
+                  const mach_port_t &task,
+                  const ProcessLibraries *libraries,
+                  QueryData &results);
+
+ private:
+  /// Read a terminated path, without reading past a mapped page needlessly.
+  bool readPath(const mach_port_t &task,
+                mach_vm_address_t address,
+                std::string &path);
+
+ private:
+  std::vector<struct dyld_image_info> images_;
+  char path_[PATH_MAX];
+};
+
+bool MemoryMapWalker::readPath(const mach_port_t &task,
+                               mach_vm_address_t address,
+                               std::string &path) {
+  // Most paths end within the first page, and the next page may be unmapped.
+  size_t offset = 0;
+  while (offset < sizeof(path_)) {
+    auto page = vm_page_size - ((address + offset) % vm_page_size);
+    auto size = std::min(sizeof(path_) - offset, (size_t)page);
+    if (!readProcessMemory(task, address + offset, size, path_ + offset)) {
+      return false;
+    }
 
-  if (bytes != size) {
-    return false;
+    auto end = (const char *)memchr(path_ + offset, '\0', size);
+    if (end != nullptr) {
+      path.assign(path_, end - path_);
+      return true;
+    }
+    offset += size;
   }
-  return true;
+  return false;
 }
 
-void genProcessLibraries(const mach_port_t &task,
-                         std::map<vm_address_t, std::string> &libraries) {
+void MemoryMapWalker::genLibraries(const mach_port_t &task,
+                                   ProcessLibraries &libraries) {
   struct task_dyld_info dyld_info;
   mach_msg_type_number_t count = TASK_DYLD_INFO_COUNT;
   auto status =
@@ -428,112 +503,138 @@ void genProcessLibraries(const mach_port_t &task,
     return;
   }
 
-  // The info struct is a pointer to another process's virtual space.
-  auto all_info = (struct dyld_all_image_infos *)dyld_info.all_image_info_addr;
-  uint64_t image_offset = (uint64_t)all_info;
   if (dyld_info.all_image_info_format != TASK_DYLD_ALL_IMAGE_INFO_64) {
     // Only support 64bit process images.
     return;
   }
 
-  // Skip the 32-bit integer version field.
-  image_offset += sizeof(uint32_t);
-  uint32_t info_array_count = 0;
-  // Read the process's 32-bit integer infoArrayCount (number of libraries).
+  // The version, infoArrayCount, and infoArray fields are read at once.
+  struct {
+    uint32_t version;
+    uint32_t info_array_count;
+    uint64_t info_array;
+  } all_info;
   if (!readProcessMemory(task,
-                         image_offset,
-                         sizeof(uint32_t),
-                         (vm_address_t)&info_array_count)) {
+                         dyld_info.all_image_info_addr,
+                         sizeof(all_info),
+                         &all_info) ||
+      all_info.info_array == 0 ||
+      all_info.info_array_count > kMaxProcessLibraries) {
     return;
   }
 
-  image_offset += sizeof(uint32_t);
-  vm_address_t info_array = 0;
-  // Read the process's infoArray address field.
-  if (!readProcessMemory(task,
-                         image_offset,
-                         sizeof(vm_address_t),
-                         (vm_address_t)&info_array)) {
+  images_.resize(all_info.info_array_count);
+  if (images_.empty() ||
+      !readProcessMemory(task,
+                         all_info.info_array,
+                         images_.size() * sizeof(struct dyld_image_info),
+                         images_.data())) {
     return;
   }
 
-  // Loop over the array of dyld_image_info structures.
-  // Read the process-mapped address and pointer to the library path.
-  for (uint32_t i = 0; i < info_array_count; i++) {
-    dyld_image_info image;
-    if (!readProcessMemory(task,
-                           info_array + (i * sizeof(struct dyld_image_info)),
-                           sizeof(dyld_image_info),
-                           (vm_address_t)&image)) {
-      return;
-    }
-
-    // It's possible to optimize for smaller reads by chucking the memory reads.
-    char path[PATH_MAX] = {0};
-    if (!readProcessMemory(task,
-                           (vm_address_t)image.imageFilePath,
-                           PATH_MAX,
-                           (vm_address_t)&path)) {
-      continue;
+  for (const auto &image : images_) {
+    std::string path;
+    if (readPath(task, (mach_vm_address_t)image.imageFilePath, path)) {
+      // Keep the process-mapped address as the library index.
+      libraries[(mach_vm_address_t)image.imageLoadAddress] = std::move(path);
     }
-
-    // Keep the process-mapped address as the library index.
-    libraries[(vm_address_t)image.imageLoadAddress] = path;
   }
 }
 
-void genProcessMemoryMap(int pid, QueryData &results) {
-  mach_port_t task = MACH_PORT_NULL;
-  kern_return_t status = task_for_pid(mach_task_self(), pid, &task);
-  if (status != KERN_SUCCESS) {
-    // Cannot request memory map for pid (permissions, invalid).
-    return;
-  }
-
-  // Create a map of library paths from the dyld cache.
-  std::map<vm_address_t, std::string> libraries;
-  genProcessLibraries(task, libraries);
-
-  // Use address offset (starting at 0) to count memory maps.
-  vm_address_t address = 0;
+void MemoryMapWalker::genRegions(int pid,
+                                 const mach_port_t &task,
+                                 const ProcessLibraries *libraries,
+                                 QueryData &results) {
+  mach_vm_address_t address = 0;
+  natural_t depth = 0;
   size_t map_count = 0;
-  uint32_t depth = 0;
-
-  while (map_count++ < MAX_MEMORY_MAPS) {
+  while (map_count < MAX_MEMORY_MAPS) {
     struct vm_region_submap_info_64 info;
     mach_msg_type_number_t count = VM_REGION_SUBMAP_INFO_COUNT_64;
-
-    vm_size_t size = 0;
-    status = vm_region_recurse_64(
-        task, &address, &size, &depth, (vm_region_info_64_t)&info, &count);
-
-    if (status == KERN_INVALID_ADDRESS) {
+    mach_vm_size_t size = 0;
+    auto status = mach_vm_region_recurse(
+        task, &address, &size, &depth, (vm_region_recurse_info_t)&info, &count);
+    if (status != KERN_SUCCESS) {
       // Reached the end of the memory map.
       break;
     }
 
     if (info.is_submap) {
-      // A submap increments the depth search to vm_region_recurse.
-      // Use the same address to continue a recursive search within the region.
+      // Descend into the submap at the same address.
       depth++;
       continue;
     }
 
     genMemoryRegion(pid, address, size, info, libraries, results);
     address += size;
+    map_count++;
   }
+}
 
-  if (task != MACH_PORT_NULL) {
-    mach_port_deallocate(mach_task_self(), task);
+/// The start time of a process, which identifies it with its pid.
+static uint64_t getProcStartTime(int pid) {
+  struct proc_bsdinfo info;
+  if (proc_pidinfo(pid, PROC_PIDTBSDINFO, 0, &info, PROC_PIDTBSDINFO_SIZE) !=
+      PROC_PIDTBSDINFO_SIZE) {
+    return 0;
   }
+  return info.pbi_start_tvsec * 1000000 + info.pbi_start_tvusec;
+}
+
+void genProcessMemoryMap(int pid,
+                         bool paths,
+                         MemoryMapWalker &walker,
+                         std::set<std::pair<int, uint64_t>> &seen,
+                         QueryData &results) {
+  mach_port_t task = MACH_PORT_NULL;
+  kern_return_t status = task_for_pid(mach_task_self(), pid, &task);
+  if (status != KERN_SUCCESS) {
+    // Cannot request memory map for pid (permissions, invalid).
+    return;
+  }
+
+  // Libraries are loaded at launch, the paths are read once per process.
+  ProcessLibraries libraries;
+  if (paths) {
+    auto key = std::make_pair(pid, getProcStartTime(pid));
+    std::unique_lock<std::mutex> lock(kProcessLibrariesMutex);
+    auto cached = kProcessLibraries.find(key);
+    if (key.second != 0 && cached != kProcessLibraries.end()) {
+      libraries = cached->second;
+    } else {
+      lock.unlock();
+      walker.genLibraries(task, libraries);
+      lock.lock();
+      if (key.second != 0) {
+        kProcessLibraries[key] = libraries;
+      }
+    }
+    seen.insert(key);
+  }
+
+  walker.genRegions(pid, task, (paths) ? &libraries : nullptr, results);
+  mach_port_deallocate(mach_task_self(), task);
 }
 
 QueryData genProcessMemoryMap(QueryContext& context) {
   QueryData results;
 
+  // Region paths and the dyld images are only read for the path columns.
+  bool paths = context.isColumnUsed("path") || context.isColumnUsed("pseudo");
+
+  MemoryMapWalker walker;
+  std::set<std::pair<int, uint64_t>> seen;
   auto pidlist = getProcList(context);
   for (const auto &pid : pidlist) {
-    genProcessMemoryMap(pid, results);
+    genProcessMemoryMap(pid, paths, walker, seen, results);
+  }
+
+  if (paths && context.constraints["pid"].getAll(EQUALS).empty()) {
+    // Forget the libraries of processes that exited.
+    std::lock_guard<std::mutex> lock(kProcessLibrariesMutex);
+    for (auto it = kProcessLibraries.begin(); it != kProcessLibraries.end();) {
+      it = (seen.count(it->first) == 0) ? kProcessLibraries.erase(it) : ++it;
+    }
   }
 
   return results;
@@ -60,11 +60,11 @@ QueryData genGroups(QueryContext &context) {
     auto gids = context.constraints["gid"].getAll<long long>(EQUALS);
     for (const auto &gid : gids) {
       Row r;
-      struct group *grp = getgrgid(gid);
+      GroupInfo group;
       r["gid"] = BIGINT(gid);
-      if (grp != nullptr) {
-        r["groupname"] = std::string(grp->gr_name);
-        r["gid_signed"] = BIGINT((int32_t)grp->gr_gid);
+      if (getGroup(gid, group)) {
+        r["groupname"] = group.name;
+        r["gid_signed"] = BIGINT((int32_t)group.gid);
       }
       results.push_back(r);
     }
@@ -73,11 +73,11 @@ QueryData genGroups(QueryContext &context) {
     genODEntries(kODRecordTypeGroups, groupnames);
     for (const auto &groupname : groupnames) {
       Row r;
-      struct group *grp = getgrnam(groupname.c_str());
+      GroupInfo group;
       r["groupname"] = groupname;
-      if (grp != nullptr) {
-        r["gid"] = BIGINT(grp->gr_gid);
-        r["gid_signed"] = BIGINT((int32_t)grp->gr_gid);
+      if (getGroupByName(groupname, group)) {
+        r["gid"] = BIGINT(group.gid);
+        r["gid_signed"] = BIGINT((int32_t)group.gid);
       }
       results.push_back(r);
     }
@@ -91,16 +91,16 @@ QueryData genUsers(QueryContext &context) {
     auto uids = context.constraints["uid"].getAll<long long>(EQUALS);
     for (const auto &uid : uids) {
       Row r;
-      struct passwd *pwd = getpwuid(uid);
+      UserInfo user;
       r["uid"] = BIGINT(uid);
-      if (pwd != nullptr) {
-        r["username"] = std::string(pwd->pw_name);
-        r["gid"] = BIGINT(pwd->pw_gid);
-        r["uid_signed"] = BIGINT((int32_t)pwd->pw_uid);
-        r["gid_signed"] = BIGINT((int32_t)pwd->pw_gid);
-        r["description"] = TEXT(pwd->pw_gecos);
-        r["directory"] = TEXT(pwd->pw_dir);
-        r["shell"] = TEXT(pwd->pw_shell);
+      if (getUser(uid, user)) {
+        r["username"] = user.name;
+        r["gid"] = BIGINT(user.gid);
+        r["uid_signed"] = BIGINT((int32_t)user.uid);
+        r["gid_signed"] = BIGINT((int32_t)user.gid);
+        r["description"] = user.description;
+        r["directory"] = user.directory;
+        r["shell"] = user.shell;
       }
       results.push_back(r);
     }
@@ -110,15 +110,15 @@ QueryData genUsers(QueryContext &context) {
     for (const auto &username : usernames) {
       Row r;
       r["username"] = username;
-      struct passwd *pwd = getpwnam(username.c_str());
-      if (pwd != nullptr) {
-        r["uid"] = BIGINT(pwd->pw_uid);
-        r["gid"] = BIGINT(pwd->pw_gid);
-        r["uid_signed"] = BIGINT((int32_t)pwd->pw_uid);
-        r["gid_signed"] = BIGINT((int32_t)pwd->pw_gid);
-        r["description"] = TEXT(pwd->pw_gecos);
-        r["directory"] = TEXT(pwd->pw_dir);
-        r["shell"] = TEXT(pwd->pw_shell);
+      UserInfo user;
+      if (getUserByName(username, user)) {
+        r["uid"] = BIGINT(user.uid);
+        r["gid"] = BIGINT(user.gid);
+        r["uid_signed"] = BIGINT((int32_t)user.uid);
+        r["gid_signed"] = BIGINT((int32_t)user.gid);
+        r["description"] = user.description;
+        r["directory"] = user.directory;
+        r["shell"] = user.shell;
       }
       results.push_back(r);
     }
@@ -132,12 +132,12 @@ QueryData genUserGroups(QueryContext &context) {
     // Use UID as the index.
     auto uids = context.constraints["uid"].getAll<long long>(EQUALS);
     for (const auto &uid : uids) {
-      struct passwd *pwd = getpwuid(uid);
-      if (pwd != nullptr) {
+      UserInfo info;
+      if (getUser(uid, info)) {
         user_t<int, int> user;
-        user.name = pwd->pw_name;
-        user.uid = pwd->pw_uid;
-        user.gid = pwd->pw_gid;
+        user.name = info.name.c_str();
+        user.uid = info.uid;
+        user.gid = info.gid;
         getGroupsForUser<int, int>(results, user);
       }
     }
@@ -145,12 +145,12 @@ QueryData genUserGroups(QueryContext &context) {
     std::set<std::string> usernames;
     genODEntries(kODRecordTypeUsers, usernames);
     for (const auto &username : usernames) {
-      struct passwd *pwd = getpwnam(username.c_str());
-      if (pwd != nullptr) {
+      UserInfo info;
+      if (getUserByName(username, info)) {
         user_t<int, int> user;
-        user.name = pwd->pw_name;
-        user.uid = pwd->pw_uid;
-        user.gid = pwd->pw_gid;
+        user.name = info.name.c_str();
+        user.uid = info.uid;
+        user.gid = info.gid;
         getGroupsForUser<int, int>(results, user);
       }
     }
@@ -106,7 +106,7 @@ std::vector<std::string> getXProtectReportFiles(const std::string& home_dir) {
 void genXProtectReport(const std::string& path, QueryData& results) {
   pt::ptree report;
 
-  if (!osquery::parsePlist(path, report).ok()) {
+  if (!osquery::parsePlistCached(path, report).ok()) {
     // Failed to read the XProtect plist format.
     return;
   }
@@ -153,7 +153,7 @@ QueryData genXProtectEntries(QueryContext& context) {
     return results;
   }
 
-  if (!osquery::parsePlist(xprotect_path, tree).ok()) {
+  if (!osquery::parsePlistCached(xprotect_path, tree).ok()) {
     VLOG(1) << "Could not parse the XProtect.plist";
     return results;
   }
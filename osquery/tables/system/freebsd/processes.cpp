@@ -8,8 +8,9 @@
  *
  */
 
-#include <string>
 #include <map>
+#include <string>
+#include <vector>
 
 #include <stdlib.h>
 #include <unistd.h>
@@ -107,11 +108,29 @@ void genProcessMap(struct procstat* pstat,
   }
 }
 
-void genProcess(struct procstat* pstat,
+/// The process details needed by the columns a query uses.
+struct ProcessColumns {
+  bool path;
+  bool on_disk;
+  bool cmdline;
+  bool files;
+  bool resident_size;
+
+  explicit ProcessColumns(const QueryContext& context) {
+    on_disk = context.isColumnUsed("on_disk");
+    path = on_disk || context.isColumnUsed("path");
+    cmdline = context.isColumnUsed("cmdline");
+    files = context.isColumnUsed("cwd") || context.isColumnUsed("root");
+    resident_size = context.isColumnUsed("resident_size");
+  }
+};
+
+bool genProcess(struct procstat* pstat,
                 struct kinfo_proc* proc,
-                QueryData& results) {
-  Row r;
-  static char path[PATH_MAX];
+                const ProcessColumns& columns,
+                const TypedRowYield& yield) {
+  TypedRow r;
+  char path[PATH_MAX];
   char** args;
   struct filestat_list* files = nullptr;
   struct filestat* file = nullptr;
@@ -120,38 +139,44 @@ void genProcess(struct procstat* pstat,
   unsigned int cnt = 0;
   unsigned int pages = 0;
 
-  r["pid"] = INTEGER(proc->ki_pid);
-  r["parent"] = INTEGER(proc->ki_ppid);
+  // Identity and times are within the snapshot's kinfo_proc.
+  r["pid"] = proc->ki_pid;
+  r["parent"] = proc->ki_ppid;
   r["name"] = TEXT(proc->ki_comm);
-  r["uid"] = INTEGER(proc->ki_ruid);
-  r["euid"] = INTEGER(proc->ki_svuid);
-  r["gid"] = INTEGER(proc->ki_rgid);
-  r["egid"] = INTEGER(proc->ki_svgid);
+  r["uid"] = proc->ki_ruid;
+  r["euid"] = proc->ki_svuid;
+  r["gid"] = proc->ki_rgid;
+  r["egid"] = proc->ki_svgid;
 
-  if (procstat_getpathname(pstat, proc, path, sizeof(path)) == 0) {
+  if (columns.path &&
+      procstat_getpathname(pstat, proc, path, sizeof(path)) == 0) {
     r["path"] = TEXT(path);
     // If the path of the executable that started the process is available and
     // the path exists on disk, set on_disk to 1. If the path is not
     // available, set on_disk to -1. If, and only if, the path of the
     // executable is available and the file does NOT exist on disk, set on_disk
     // to 0.
-    r["on_disk"] = TEXT(osquery::pathExists(r["path"]).toString());
+    if (columns.on_disk) {
+      r["on_disk"] = TEXT(osquery::pathExists(path).toString());
+    }
   }
 
-  args = procstat_getargv(pstat, proc, 0);
+  args = (columns.cmdline) ? procstat_getargv(pstat, proc, 0) : nullptr;
   if (args != nullptr) {
+    std::string cmdline;
     for (i = 0; args[i] != NULL; i++) {
-      r["cmdline"] += TEXT(args[i]);
+      cmdline += TEXT(args[i]);
       // Need to add spaces between arguments, except last one.
       if (args[i + 1] != NULL) {
-        r["cmdline"] += TEXT(" ");
+        cmdline += TEXT(" ");
       }
     }
+    r["cmdline"] = std::move(cmdline);
 
     procstat_freeargv(pstat);
   }
 
-  files = procstat_getfiles(pstat, proc, 0);
+  files = (columns.files) ? procstat_getfiles(pstat, proc, 0) : nullptr;
   if (files != nullptr) {
     STAILQ_FOREACH(file, files, next) {
       if (file->fs_uflags & PS_FST_UFLAG_CDIR) {
@@ -165,7 +190,8 @@ void genProcess(struct procstat* pstat,
     procstat_freefiles(pstat, files);
   }
 
-  vmentry = procstat_getvmmap(pstat, proc, &cnt);
+  vmentry =
+      (columns.resident_size) ? procstat_getvmmap(pstat, proc, &cnt) : nullptr;
   if (vmentry != nullptr) {
     // Add up all the resident pages for each vmmap entry.
     for (i = 0; i < cnt; i++) {
@@ -173,7 +199,7 @@ void genProcess(struct procstat* pstat,
     }
 
     // The column is in bytes.
-    r["resident_size"] += INTEGER(pages * getpagesize());
+    r["resident_size"] = INTEGER(pages * getpagesize());
 
     procstat_freevmmap(pstat, vmentry);
   }
@@ -186,51 +212,90 @@ void genProcess(struct procstat* pstat,
   r["user_time"] = INTEGER(proc->ki_rusage.ru_utime.tv_sec);
   r["start_time"] = INTEGER(proc->ki_start.tv_sec);
 
-  results.push_back(r);
+  return yield(r);
 }
 
-QueryData genProcesses(QueryContext& context) {
-  QueryData results;
+void genProcesses(QueryContext& context, const TypedRowYield& yield) {
   struct kinfo_proc* procs = nullptr;
   struct procstat* pstat = nullptr;
 
   auto cnt = getProcesses(context, &pstat, &procs);
 
-  for (size_t i = 0; i < cnt; i++) {
-    genProcess(pstat, &procs[i], results);
+  // Only request the details needed by the columns used by the query.
+  ProcessColumns columns(context);
+  if (context.limit > 0 || procShardCount(cnt) == 1) {
+    // Stream rows when the query may stop early.
+    for (size_t i = 0; i < cnt; i++) {
+      if (!genProcess(pstat, &procs[i], columns, yield)) {
+        break;
+      }
+    }
+    procstatCleanup(pstat, procs);
+    return;
   }
 
+  ProcstatIndex index;
+  procstatIndex(procs, cnt, index);
+  std::vector<TypedRow> results;
+  procProcessRows(index.pids,
+                  [&index, &columns](const std::string& pid,
+                                     std::vector<TypedRow>& rows) {
+                    auto handle = procstatThreadHandle();
+                    if (handle == nullptr) {
+                      return;
+                    }
+                    genProcess(handle,
+                               index.procs.at(pid),
+                               columns,
+                               [&rows](TypedRow& r) {
+                                 rows.push_back(std::move(r));
+                                 return true;
+                               });
+                  },
+                  results);
   procstatCleanup(pstat, procs);
-  return results;
+
+  for (auto& r : results) {
+    if (!yield(r)) {
+      break;
+    }
+  }
 }
 
-QueryData genProcessEnvs(QueryContext& context) {
-  QueryData results;
+/// Generate the rows of each process in a snapshot, in parallel.
+template <typename Generator>
+static void genProcstatRows(QueryContext& context,
+                            const Generator& generator,
+                            QueryData& results) {
   struct kinfo_proc* procs = nullptr;
   struct procstat* pstat = nullptr;
 
   auto cnt = getProcesses(context, &pstat, &procs);
 
-  for (size_t i = 0; i < cnt; i++) {
-    genProcessEnvironment(pstat, &procs[i], results);
-  }
+  ProcstatIndex index;
+  procstatIndex(procs, cnt, index);
+  procProcessRows(index.pids,
+                  [&index, &generator](const std::string& pid,
+                                       QueryData& rows) {
+                    auto handle = procstatThreadHandle();
+                    if (handle != nullptr) {
+                      generator(handle, index.procs.at(pid), rows);
+                    }
+                  },
+                  results);
 
   procstatCleanup(pstat, procs);
+}
+
+QueryData genProcessEnvs(QueryContext& context) {
+  QueryData results;
+  genProcstatRows(context, genProcessEnvironment, results);
   return results;
 }
 
 QueryData genProcessMemoryMap(QueryContext& context) {
   QueryData results;
-  struct kinfo_proc* procs = nullptr;
-  struct procstat* pstat = nullptr;
-
-  auto cnt = getProcesses(context, &pstat, &procs);
-
-  for (size_t i = 0; i < cnt; i++) {
-    genProcessMap(pstat, &procs[i], results);
-  }
-
-  procstatCleanup(pstat, procs);
+  genProcstatRows(context, genProcessMap, results);
   return results;
 }
 }
@@ -16,9 +16,14 @@
 #include <sys/queue.h>
 #include <libprocstat.h>
 
+#include <set>
+#include <string>
+
 #include <osquery/tables.h>
 #include <osquery/logger.h>
 
+#include "osquery/tables/system/freebsd/procstat.h"
+
 namespace osquery {
 namespace tables {
 
@@ -30,6 +35,9 @@ namespace tables {
  * Returns the number of processes in the "procs" list. On failure, returns 0
  * and sets pstat and procs to NULL.
  *
+ * The list is a single snapshot. When the query constrains pids, every
+ * process is retrieved once and the list is reduced to the requested pids.
+ *
  * Errors are not well exposed in some of the calls in libprocstat(3). This is
  * a bit of a bummer as libkvm(3) is much better in that respect but I would
  * rather use libprocstat(3) as it provides a nicer abstraction.
@@ -37,7 +45,6 @@ namespace tables {
 unsigned int getProcesses(QueryContext& context,
                           struct procstat** pstat,
                           struct kinfo_proc** procs) {
-  std::set<std::string> pids;
   unsigned int cnt = 0;
 
   *pstat = procstat_open_sysctl();
@@ -46,35 +53,74 @@ unsigned int getProcesses(QueryContext& context,
     return 0;
   }
 
+  std::set<int> pids;
   if (context.constraints["pid"].exists(EQUALS)) {
-    pids = context.constraints["pid"].getAll(EQUALS);
-
-    // Generate data for all pids in the vector.
-    // If there are comparison constraints this could apply the operator
-    // before generating the process structure.
-    for (const auto& pid : pids) {
-      *procs = procstat_getprocs(*pstat, KERN_PROC_PID, std::stoi(pid), &cnt);
-      if (*procs == nullptr) {
-        TLOG << "Problem retrieving processes.";
-        procstat_close(*pstat);
-        *pstat = nullptr;
-        return 0;
-      }
+    for (const auto& pid : context.constraints["pid"].getAll(EQUALS)) {
+      pids.insert(std::atoi(pid.c_str()));
     }
-  } else {
-    // Get all PIDS.
-    *procs = procstat_getprocs(*pstat, KERN_PROC_PROC, 0, &cnt);
+  }
+
+  if (pids.size() == 1) {
+    *procs = procstat_getprocs(*pstat, KERN_PROC_PID, *pids.begin(), &cnt);
     if (*procs == nullptr) {
-      TLOG << "Problem retrieving processes.";
+      // The process does not exist.
       procstat_close(*pstat);
       *pstat = nullptr;
       return 0;
     }
+    return cnt;
   }
 
+  // Get all PIDS.
+  *procs = procstat_getprocs(*pstat, KERN_PROC_PROC, 0, &cnt);
+  if (*procs == nullptr) {
+    TLOG << "Problem retrieving processes.";
+    procstat_close(*pstat);
+    *pstat = nullptr;
+    return 0;
+  }
+
+  if (!pids.empty()) {
+    // Keep the requested processes at the front of the list.
+    unsigned int kept = 0;
+    for (unsigned int i = 0; i < cnt; i++) {
+      if (pids.count((*procs)[i].ki_pid) > 0) {
+        (*procs)[kept++] = (*procs)[i];
+      }
+    }
+    cnt = kept;
+  }
   return cnt;
 }
 
+void procstatIndex(struct kinfo_proc* procs,
+                   unsigned int cnt,
+                   ProcstatIndex& index) {
+  for (unsigned int i = 0; i < cnt; i++) {
+    index.pids.insert(std::to_string(procs[i].ki_pid));
+    index.procs[std::to_string(procs[i].ki_pid)] = &procs[i];
+  }
+}
+
+struct procstat* procstatThreadHandle() {
+  // Closes the calling thread's handle when the thread exits.
+  struct ThreadHandle {
+    struct procstat* pstat{nullptr};
+
+    ~ThreadHandle() {
+      if (pstat != nullptr) {
+        procstat_close(pstat);
+      }
+    }
+  };
+
+  static thread_local ThreadHandle handle;
+  if (handle.pstat == nullptr) {
+    handle.pstat = procstat_open_sysctl();
+  }
+  return handle.pstat;
+}
+
 /**
  * Helper function to cleanup the libprocstat(3) pointers used.
  */
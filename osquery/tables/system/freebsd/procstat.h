@@ -14,6 +14,10 @@
 #include <sys/user.h>
 #include <libprocstat.h>
 
+#include <map>
+#include <set>
+#include <string>
+
 #include <osquery/tables.h>
 
 namespace osquery {
@@ -25,5 +29,27 @@ unsigned int getProcesses(QueryContext& context,
 
 void procstatCleanup(struct procstat* pstat, struct kinfo_proc* procs);
 
+/// The processes of a getProcesses snapshot by string pid.
+struct ProcstatIndex {
+  /// The pids, ordered for procProcessRows.
+  std::set<std::string> pids;
+  /// Each pid's process within the snapshot.
+  std::map<std::string, struct kinfo_proc*> procs;
+};
+
+/// Index the processes of a snapshot, the index is valid until cleanup.
+void procstatIndex(struct kinfo_proc* procs,
+                   unsigned int cnt,
+                   ProcstatIndex& index);
+
+/**
+ * @brief A libprocstat(3) handle owned by the calling thread.
+ *
+ * The per-process calls, such as procstat_getargv(), keep their buffers in
+ * the handle. Threads generating rows in parallel read a shared snapshot's
+ * processes using their own handle. Returns nullptr if it cannot be opened.
+ */
+struct procstat* procstatThreadHandle();
+
 }
 }
@@ -8,17 +8,135 @@
  *
  */
 
+#include <algorithm>
+#include <mutex>
 #include <vector>
 #include <string>
 
 #include <utmpx.h>
 
 #include <osquery/core.h>
+#include <osquery/flags.h>
 #include <osquery/tables.h>
 
+#ifdef __linux__
+#include <utmp.h>
+
+#include "osquery/tables/system/linux/utmp.h"
+#endif
+
 namespace osquery {
+
+DECLARE_uint64(table_cache_max_bytes);
+
 namespace tables {
 
+#ifdef __linux__
+/**
+ * @brief Rows generated from the start of the wtmp file.
+ *
+ * wtmp is append-only until it is rotated, so a query only generates the rows
+ * of records written since the last query. The last record read is kept to
+ * detect a file truncated and rewritten in place.
+ */
+struct WtmpCache {
+  dev_t device{0};
+  ino_t inode{0};
+  size_t records{0};
+  struct utmpx last;
+
+  QueryData rows;
+  size_t bytes{0};
+};
+
+static WtmpCache kWtmpCache;
+static std::mutex kWtmpCacheMutex;
+
+static void genLastRecord(const struct utmpx& ut, QueryData& results) {
+  Row r;
+  r["username"] = utmpString(ut.ut_user);
+  r["tty"] = utmpString(ut.ut_line);
+  r["pid"] = INTEGER(ut.ut_pid);
+  r["type"] = INTEGER(ut.ut_type);
+  r["time"] = INTEGER(ut.ut_tv.tv_sec);
+  r["host"] = utmpString(ut.ut_host);
+  results.push_back(r);
+}
+
+/// The lowest integer time a query's constraints allow, 0 for any time.
+static long long getLowerTime(QueryContext& context) {
+  long long lower = 0;
+  for (const auto& op : {EQUALS, GREATER_THAN, GREATER_THAN_OR_EQUALS}) {
+    for (const auto& expr : context.constraints["time"].getAll(op)) {
+      char* end = nullptr;
+      auto value = strtoll(expr.c_str(), &end, 10);
+      if (end == expr.c_str() || *end != '\0') {
+        continue;
+      }
+      lower = std::max(lower, (op == GREATER_THAN) ? value + 1 : value);
+    }
+  }
+  return lower;
+}
+
+QueryData genLastAccess(QueryContext& context) {
+  QueryData results;
+  UtmpMapping wtmp(_PATH_WTMP);
+  if (!wtmp.valid()) {
+    return results;
+  }
+
+  auto lower = getLowerTime(context);
+  if (lower > 0) {
+    // Records are written in time order, scan back to the lower bound.
+    // SQLite filters the rows, a clock set backwards may hide older records.
+    for (size_t i = wtmp.size(); i > 0; --i) {
+      const auto& ut = wtmp.at(i - 1);
+      if (ut.ut_tv.tv_sec < lower) {
+        break;
+      }
+      genLastRecord(ut, results);
+    }
+    std::reverse(results.begin(), results.end());
+    return results;
+  }
+
+  std::lock_guard<std::mutex> lock(kWtmpCacheMutex);
+  auto& cache = kWtmpCache;
+  if (cache.device != wtmp.device() || cache.inode != wtmp.inode() ||
+      cache.records > wtmp.size() ||
+      (cache.records > 0 &&
+       memcmp(&cache.last, &wtmp.at(cache.records - 1), sizeof(cache.last)) !=
+           0)) {
+    // The file was rotated or rewritten, generate every record.
+    cache.rows.clear();
+    cache.records = 0;
+    cache.bytes = 0;
+  }
+
+  for (size_t i = cache.records; i < wtmp.size(); ++i) {
+    genLastRecord(wtmp.at(i), cache.rows);
+    for (const auto& column : cache.rows.back()) {
+      cache.bytes += column.first.size() + column.second.size();
+    }
+  }
+
+  if (cache.bytes > FLAGS_table_cache_max_bytes) {
+    // Too many records to keep, the next query generates every record.
+    results = std::move(cache.rows);
+    cache = WtmpCache();
+    return results;
+  }
+
+  cache.device = wtmp.device();
+  cache.inode = wtmp.inode();
+  cache.records = wtmp.size();
+  if (cache.records > 0) {
+    cache.last = wtmp.at(cache.records - 1);
+  }
+  return cache.rows;
+}
+#else
 QueryData genLastAccess(QueryContext& context) {
   QueryData results;
   struct utmpx *ut;
@@ -27,10 +145,6 @@ QueryData genLastAccess(QueryContext& context) {
 
   while ((ut = getutxent_wtmp()) != nullptr) {
 #else
-
-#ifndef __FreeBSD__
-  utmpxname("/var/log/wtmpx");
-#endif
   setutxent();
 
   while ((ut = getutxent()) != nullptr) {
@@ -55,5 +169,6 @@ QueryData genLastAccess(QueryContext& context) {
 
   return results;
 }
+#endif
 }
 }
@@ -10,10 +10,13 @@
 
 #include <unistd.h>
 
+#include <libudev.h>
+
 #include <osquery/core.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
-#include <osquery/sql.h>
+
+#include "osquery/events/linux/udev.h"
 
 extern "C" {
 #include <libcryptsetup.h>
@@ -22,21 +25,18 @@ extern "C" {
 namespace osquery {
 namespace tables {
 
-void genFDEStatusForBlockDevice(const std::string &name,
-                                const std::string &uuid,
-                                QueryData &results) {
-  Row r;
-  r["name"] = name;
-  r["uuid"] = uuid;
+/// Generate a block_devices row, defined by the block_devices table.
+bool getBlockDevice(struct udev_device *dev, Row &r);
 
+/// Read the status of a device-mapper mapping, and its cipher if encrypted.
+static void genFDEStatusForMapping(const std::string &mapping, Row &r) {
   struct crypt_device *cd = nullptr;
   struct crypt_active_device cad;
-  crypt_status_info ci;
   std::string type;
   std::string cipher;
   std::string cipher_mode;
 
-  ci = crypt_status(cd, name.c_str());
+  auto ci = crypt_status(cd, mapping.c_str());
   switch (ci) {
   case CRYPT_ACTIVE:
   case CRYPT_BUSY:
@@ -44,33 +44,56 @@ void genFDEStatusForBlockDevice(const std::string &name,
 
     int crypt_init;
 #if defined(CENTOS_CENTOS6) || defined(RHEL_RHEL6)
-    crypt_init = crypt_init_by_name(&cd, name.c_str());
+    crypt_init = crypt_init_by_name(&cd, mapping.c_str());
 #else
     crypt_init =
-      crypt_init_by_name_and_header(&cd, name.c_str(), nullptr);
+      crypt_init_by_name_and_header(&cd, mapping.c_str(), nullptr);
 #endif
 
     if (crypt_init < 0) {
-      VLOG(1) << "Unable to initialize crypt device for " << name;
+      VLOG(1) << "Unable to initialize crypt device for " << mapping;
       crypt_free(cd);
       break;
     }
 
     type = crypt_get_type(cd);
-    if (crypt_get_active_device(cd, name.c_str(), &cad) < 0) {
-      VLOG(1) << "Unable to get active device for " << name;
+    if (crypt_get_active_device(cd, mapping.c_str(), &cad) < 0) {
+      VLOG(1) << "Unable to get active device for " << mapping;
       crypt_free(cd);
       break;
     }
     cipher = crypt_get_cipher(cd);
     cipher_mode = crypt_get_cipher_mode(cd);
     r["type"] = type + "-" + cipher + "-" + cipher_mode;
+    crypt_free(cd);
     break;
   default:
     r["encrypted"] = "0";
   }
+}
 
-  results.push_back(r);
+/**
+ * @brief Generate the encryption status of a block device.
+ *
+ * Only device-mapper devices may be dm-crypt mappings, other devices are not
+ * passed to libcryptsetup. The row is kept by the udev device inventory, and
+ * generated again only when udev reports the device changed, as it does when
+ * a mapping is loaded, resumed, or removed.
+ */
+static bool genFDEStatusForBlockDevice(struct udev_device *dev, Row &r) {
+  Row device;
+  if (!getBlockDevice(dev, device)) {
+    return false;
+  }
+
+  r["name"] = device["name"];
+  r["uuid"] = device["uuid"];
+  r["encrypted"] = "0";
+  auto mapping = udev_device_get_sysattr_value(dev, "dm/name");
+  if (mapping != nullptr) {
+    genFDEStatusForMapping(mapping, r);
+  }
+  return true;
 }
 
 QueryData genFDEStatus(QueryContext &context) {
@@ -81,12 +104,8 @@ QueryData genFDEStatus(QueryContext &context) {
     return results;
   }
 
-  auto block_devices = SQL::selectAllFrom("block_devices");
-  for (const auto &row : block_devices) {
-    const auto name = (row.count("name") > 0) ? row.at("name") : "";
-    const auto uuid = (row.count("uuid") > 0) ? row.at("uuid") : "";
-    genFDEStatusForBlockDevice(name, uuid, results);
-  }
+  UdevDeviceInventory::instance().getRows(
+      "block", genFDEStatusForBlockDevice, results, "disk_encryption");
   return results;
 }
 }
@@ -10,19 +10,27 @@
 
 #include <fstream>
 
-#include <boost/algorithm/string/split.hpp>
-#include <boost/algorithm/string/trim.hpp>
-
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/filesystem/linux/proc_fields.h"
+
 namespace osquery {
 namespace tables {
 
 const std::string kKernelModulePath = "/proc/modules";
 
+/// Each line is: name size instances used_by, status address.
+typedef ProcTextParser<' ',
+                       ProcField<0>,
+                       ProcField<1, PROC_FIELD_DECIMAL>,
+                       ProcField<3, PROC_FIELD_TEXT, ','>,
+                       ProcField<4, PROC_FIELD_TEXT, ','>,
+                       ProcField<5>>
+    KernelModuleParser;
+
 QueryData genKernelModules(QueryContext& context) {
   QueryData results;
 
@@ -41,30 +49,9 @@ QueryData genKernelModules(QueryContext& context) {
   auto module_info = std::string(std::istreambuf_iterator<char>(fd),
                                  std::istreambuf_iterator<char>());
 
-  for (const auto& module : split(module_info, "\n")) {
-    Row r;
-    auto module_info = split(module, " ");
-    if (module_info.size() < 6) {
-      // Interesting error case, this module line is not well formed.
-      continue;
-    }
-
-    for (auto& detail : module_info) {
-      // Clean up the delimiters
-      boost::trim(detail);
-      if (detail.back() == ',') {
-        detail.pop_back();
-      }
-    }
-
-    r["name"] = module_info[0];
-    r["size"] = module_info[1];
-    r["used_by"] = module_info[3];
-    r["status"] = module_info[4];
-    r["address"] = module_info[5];
-    results.push_back(r);
-  }
-
+  static const KernelModuleParser parser(
+      {"name", "size", "used_by", "status", "address"});
+  parser.parseLines(module_info, results);
   return results;
 }
 }
@@ -9,11 +9,17 @@
  */
 
 #include <dirent.h>
-#include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <set>
+#include <thread>
+
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
@@ -93,7 +99,17 @@ const static msr_record_t fields[] = {
      .mask = NO_MASK,
      .is_flag = false}};
 
-void getModelSpecificRegisterData(QueryData &results, int cpu_number) {
+/// Do not start more reading threads than this, each CPU is read once.
+const size_t kMsrReadThreads = 8;
+
+/**
+ * @brief Read every register in fields from a single CPU.
+ *
+ * The device is opened once and each register is read with a pread. The
+ * calling thread should be pinned to the CPU, the kernel then reads the
+ * registers locally instead of interrupting the target CPU for each one.
+ */
+static bool getModelSpecificRegisterData(int cpu_number, Row &r) {
   auto msr_filename =
     std::string("/dev/cpu/") + std::to_string(cpu_number) + "/msr";
 
@@ -105,28 +121,43 @@ void getModelSpecificRegisterData(QueryData &results, int cpu_number) {
     if (err == EACCES) {
       LOG(WARNING) << "Could not access msr device.  Run osquery as root.";
     }
-    return;
+    return false;
+  }
+
+  const size_t count = sizeof(fields) / sizeof(fields[0]);
+  uint64_t output[count];
+  bool present[count];
+  for (size_t i = 0; i < count; ++i) {
+    ssize_t size = pread(fd, &output[i], sizeof(uint64_t), fields[i].offset);
+    // Processor does not have a record of this type.
+    present[i] = (size == sizeof(uint64_t));
   }
+  close(fd);
 
-  Row r;
   r["processor_number"] = BIGINT(cpu_number);
-  for (const msr_record_t &field : fields) {
-    uint64_t output;
-    ssize_t size = pread(fd, &output, sizeof(uint64_t), field.offset);
-    if (size != sizeof(uint64_t)) {
-      // Processor does not have a record of this type.
+  for (size_t i = 0; i < count; ++i) {
+    if (!present[i]) {
       continue;
     }
+    const msr_record_t &field = fields[i];
     if (field.is_flag) {
-      r[field.name] = BIGINT((output & field.mask) ? 1 : 0);
+      r[field.name] = BIGINT((output[i] & field.mask) ? 1 : 0);
     } else {
-      r[field.name] = BIGINT(output & field.mask);
+      r[field.name] = BIGINT(output[i] & field.mask);
     }
   }
-  results.push_back(r);
-  close(fd);
+  return true;
+}
 
-  return;
+/// Pin the calling thread to a CPU, failures leave the thread unpinned.
+static void pinToCPU(int cpu_number) {
+  if (cpu_number >= CPU_SETSIZE) {
+    return;
+  }
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu_number, &cpus);
+  pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
 }
 
 // Filter only for filenames starting with a digit.
@@ -147,12 +178,55 @@ QueryData genModelSpecificRegister(QueryContext &context) {
     LOG(WARNING) << "No msr information check msr kernel module is enabled.";
     return results;
   }
+
+  std::set<int> cpus;
   while (num_entries--) {
-    getModelSpecificRegisterData(results, atoi(entries[num_entries]->d_name));
+    cpus.insert(atoi(entries[num_entries]->d_name));
     free(entries[num_entries]);
   }
   free(entries);
 
+  // Only read the requested processors.
+  if (context.constraints["processor_number"].exists(EQUALS)) {
+    std::set<int> requested;
+    for (const auto &cpu :
+         context.constraints["processor_number"].getAll(EQUALS)) {
+      auto number = std::atoi(cpu.c_str());
+      if (cpus.count(number) > 0) {
+        requested.insert(number);
+      }
+    }
+    cpus.swap(requested);
+  }
+
+  std::vector<int> numbers(cpus.begin(), cpus.end());
+  std::vector<Row> rows(numbers.size());
+  std::vector<char> found(numbers.size(), 0);
+  std::atomic<size_t> next(0);
+  auto reader = [&numbers, &rows, &found, &next]() {
+    for (size_t i = next++; i < numbers.size(); i = next++) {
+      pinToCPU(numbers[i]);
+      found[i] = getModelSpecificRegisterData(numbers[i], rows[i]);
+    }
+  };
+
+  // The calling thread is not pinned, it waits for the readers.
+  size_t cores = std::thread::hardware_concurrency();
+  size_t threads = std::min(kMsrReadThreads, std::max(cores, (size_t)1));
+  threads = std::min(threads, numbers.size());
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < threads; ++i) {
+    workers.emplace_back(reader);
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  for (size_t i = 0; i < numbers.size(); ++i) {
+    if (found[i]) {
+      results.push_back(std::move(rows[i]));
+    }
+  }
   return results;
 }
 }
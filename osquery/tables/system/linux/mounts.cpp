@@ -8,6 +8,15 @@
  *
  */
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+
 #include <mntent.h>
 #include <sys/vfs.h>
 
@@ -18,37 +27,202 @@
 namespace osquery {
 namespace tables {
 
+/// Threads calling statfs for a query's mounts.
+const size_t kMountStatfsThreads = 4;
+
+/// Milliseconds a query waits for the statfs calls of its mounts.
+const size_t kMountStatfsTimeout = 1000;
+
+/// Seconds the statfs of a network filesystem mount is reused.
+const size_t kNetworkStatfsTTL = 10;
+
+/// Filesystem types that may be slow, or hang, when the remote is gone.
+const std::set<std::string> kNetworkFilesystems = {
+    "nfs", "nfs4", "cifs", "smbfs", "smb3", "afs", "9p", "ceph", "glusterfs",
+};
+
+/// The statfs results of a query's mounts, shared with the calling threads.
+struct StatfsBatch {
+  std::mutex mutex;
+  std::condition_variable done;
+
+  std::vector<std::string> paths;
+  std::vector<struct statfs> stats;
+  /// 0 while pending, 1 if statfs succeeded, 2 if it failed.
+  std::vector<int> states;
+
+  size_t next{0};
+  size_t remaining{0};
+};
+
+/**
+ * @brief Mount paths with a statfs call in progress.
+ *
+ * A statfs of a hung mount may never return, the thread calling it is left
+ * behind when the query times out. Later queries skip the mount until that
+ * call returns, instead of leaving another thread behind.
+ */
+static std::mutex kStatfsPendingMutex;
+static std::set<std::string> kStatfsPending;
+
+/// Cached statfs results of network filesystem mounts.
+static std::mutex kNetworkStatfsMutex;
+static std::map<std::string,
+                std::pair<std::chrono::steady_clock::time_point, struct statfs>>
+    kNetworkStatfs;
+
+static bool isNetworkFilesystem(const std::string& type) {
+  return kNetworkFilesystems.count(type) > 0 || type.find("fuse.") == 0;
+}
+
+static void statfsWorker(std::shared_ptr<StatfsBatch> batch) {
+  while (true) {
+    size_t index;
+    std::string path;
+    {
+      std::lock_guard<std::mutex> lock(batch->mutex);
+      if (batch->next >= batch->paths.size()) {
+        return;
+      }
+      index = batch->next++;
+      path = batch->paths[index];
+    }
+
+    struct statfs st;
+    bool ok = (statfs(path.c_str(), &st) == 0);
+    {
+      std::lock_guard<std::mutex> lock(kStatfsPendingMutex);
+      kStatfsPending.erase(path);
+    }
+
+    std::lock_guard<std::mutex> lock(batch->mutex);
+    batch->stats[index] = st;
+    batch->states[index] = (ok) ? 1 : 2;
+    if (--batch->remaining == 0) {
+      batch->done.notify_all();
+    }
+  }
+}
+
+/**
+ * @brief Call statfs for a set of mount paths, waiting up to a timeout.
+ *
+ * Calls run on a few detached threads. Paths that do not finish in time, or
+ * are still pending from an earlier query, are missing from the results.
+ */
+static void statfsMounts(const std::vector<std::string>& paths,
+                         std::map<std::string, struct statfs>& results) {
+  auto batch = std::make_shared<StatfsBatch>();
+  {
+    std::lock_guard<std::mutex> lock(kStatfsPendingMutex);
+    for (const auto& path : paths) {
+      if (kStatfsPending.insert(path).second) {
+        batch->paths.push_back(path);
+      }
+    }
+  }
+  if (batch->paths.empty()) {
+    return;
+  }
+
+  batch->stats.resize(batch->paths.size());
+  batch->states.resize(batch->paths.size(), 0);
+  batch->remaining = batch->paths.size();
+  auto threads = std::min(kMountStatfsThreads, batch->paths.size());
+  for (size_t i = 0; i < threads; ++i) {
+    std::thread(statfsWorker, batch).detach();
+  }
+
+  std::unique_lock<std::mutex> lock(batch->mutex);
+  batch->done.wait_for(lock,
+                       std::chrono::milliseconds(kMountStatfsTimeout),
+                       [&batch]() { return batch->remaining == 0; });
+  for (size_t i = 0; i < batch->paths.size(); ++i) {
+    if (batch->states[i] == 1) {
+      results[batch->paths[i]] = batch->stats[i];
+    }
+  }
+  // Threads still calling statfs own the batch until their calls return.
+}
+
 QueryData genMounts(QueryContext &context) {
   QueryData results;
   FILE *mounts;
   struct mntent *ent;
   char real_path[PATH_MAX];
-  struct statfs st;
+
+  // The device, path, type, and flags are read from the mount table.
+  bool use_statfs = context.isColumnUsed("blocks_size") ||
+                    context.isColumnUsed("blocks") ||
+                    context.isColumnUsed("blocks_free") ||
+                    context.isColumnUsed("blocks_available") ||
+                    context.isColumnUsed("inodes") ||
+                    context.isColumnUsed("inodes_free");
+  bool use_alias = context.isColumnUsed("device_alias");
 
   if ((mounts = setmntent("/proc/mounts", "r"))) {
     while ((ent = getmntent(mounts))) {
       Row r;
 
       r["device"] = std::string(ent->mnt_fsname);
-      r["device_alias"] = std::string(
-          realpath(ent->mnt_fsname, real_path) ? real_path : ent->mnt_fsname);
+      if (use_alias) {
+        r["device_alias"] = std::string(
+            realpath(ent->mnt_fsname, real_path) ? real_path : ent->mnt_fsname);
+      }
       r["path"] = std::string(ent->mnt_dir);
       r["type"] = std::string(ent->mnt_type);
       r["flags"] = std::string(ent->mnt_opts);
-      if (!statfs(ent->mnt_dir, &st)) {
-        r["blocks_size"] = BIGINT(st.f_bsize);
-        r["blocks"] = BIGINT(st.f_blocks);
-        r["blocks_free"] = BIGINT(st.f_bfree);
-        r["blocks_available"] = BIGINT(st.f_bavail);
-        r["inodes"] = BIGINT(st.f_files);
-        r["inodes_free"] = BIGINT(st.f_ffree);
-      }
-
       results.push_back(r);
     }
     endmntent(mounts);
   }
 
+  if (!use_statfs) {
+    return results;
+  }
+
+  // Reuse recent results of network mounts, statfs the other mounts.
+  std::map<std::string, struct statfs> stats;
+  std::vector<std::string> paths;
+  auto now = std::chrono::steady_clock::now();
+  {
+    std::lock_guard<std::mutex> lock(kNetworkStatfsMutex);
+    for (const auto& r : results) {
+      const auto& path = r.at("path");
+      if (isNetworkFilesystem(r.at("type"))) {
+        auto cached = kNetworkStatfs.find(path);
+        if (cached != kNetworkStatfs.end() &&
+            now - cached->second.first <
+                std::chrono::seconds(kNetworkStatfsTTL)) {
+          stats[path] = cached->second.second;
+          continue;
+        }
+      }
+      if (stats.count(path) == 0) {
+        paths.push_back(path);
+      }
+    }
+  }
+  statfsMounts(paths, stats);
+
+  std::lock_guard<std::mutex> lock(kNetworkStatfsMutex);
+  for (auto& r : results) {
+    auto st = stats.find(r["path"]);
+    if (st == stats.end()) {
+      continue;
+    }
+
+    if (isNetworkFilesystem(r["type"])) {
+      kNetworkStatfs[st->first] = std::make_pair(now, st->second);
+    }
+    r["blocks_size"] = BIGINT(st->second.f_bsize);
+    r["blocks"] = BIGINT(st->second.f_blocks);
+    r["blocks_free"] = BIGINT(st->second.f_bfree);
+    r["blocks_available"] = BIGINT(st->second.f_bavail);
+    r["inodes"] = BIGINT(st->second.f_files);
+    r["inodes_free"] = BIGINT(st->second.f_ffree);
+  }
+
   return results;
 }
 }
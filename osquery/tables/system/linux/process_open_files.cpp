@@ -40,18 +40,16 @@ void genDescriptors(const std::string& process,
 QueryData genOpenFiles(QueryContext& context) {
   QueryData results;
 
-  std::set<std::string> pids;
+  // The index of every process is shared with process_open_sockets.
+  ProcDescriptorIndexRef index;
   if (context.constraints["pid"].exists(EQUALS)) {
-    pids = context.constraints["pid"].getAll(EQUALS);
+    index = procDescriptorIndex(context.constraints["pid"].getAll(EQUALS));
   } else {
-    osquery::procProcesses(pids);
+    index = procDescriptorIndex();
   }
 
-  for (const auto& process : pids) {
-    std::map<std::string, std::string> descriptors;
-    if (osquery::procDescriptors(process, descriptors).ok()) {
-      genDescriptors(process, descriptors, results);
-    }
+  for (const auto& process : index->descriptors) {
+    genDescriptors(process.first, process.second, results);
   }
 
   return results;
@@ -8,270 +8,571 @@
  *
  */
 
+#include <algorithm>
 #include <string>
 #include <map>
 
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
-#include <boost/algorithm/string/trim.hpp>
-
 #include <osquery/core.h>
 #include <osquery/tables.h>
 #include <osquery/filesystem.h>
 
+#include "osquery/filesystem/linux/proc_fields.h"
+
 namespace osquery {
 namespace tables {
 
-inline std::string getProcAttr(const std::string& attr, const std::string& pid) {
-  return "/proc/" + pid + "/" + attr;
-}
+/**
+ * @brief A reusable reader and tokenizer for /proc/<pid> files.
+ *
+ * A process listing reads several small files for every pid. Each generator
+ * thread reuses one read buffer, and fields are parsed in place instead of
+ * splitting the content into vectors of strings.
+ */
+class ProcReader {
+ public:
+  /// Read a process attribute into the buffer, /proc files do not report size.
+  bool read(const ProcDirectory& directory, const char* attr) {
+    int fd = directory.open(attr);
+    if (fd < 0) {
+      return false;
+    }
 
-inline std::string readProcCMDLine(const std::string& pid) {
-  auto attr = getProcAttr("cmdline", pid);
-
-  std::string content;
-  readFile(attr, content);
-  // Remove \0 delimiters.
-  std::replace_if(content.begin(),
-                  content.end(),
-                  [](const char& c) { return c == 0; },
-                  ' ');
-  // Remove trailing delimiter.
-  boost::algorithm::trim(content);
-  return content;
-}
+    size_ = 0;
+    for (;;) {
+      if (buffer_.size() - size_ < kProcReadSize) {
+        buffer_.resize(buffer_.size() + kProcReadSize);
+      }
+      auto bytes = ::read(fd, &buffer_[size_], buffer_.size() - size_);
+      if (bytes < 0 && errno == EINTR) {
+        continue;
+      } else if (bytes <= 0) {
+        break;
+      }
+      size_ += bytes;
+    }
+    ::close(fd);
+    return size_ > 0;
+  }
 
-inline std::string readProcLink(const std::string& attr, const std::string& pid) {
-  // The exe is a symlink to the binary on-disk.
-  auto attr_path = getProcAttr(attr, pid);
+  /// The space separated fields of /proc/<pid>/stat, after the "(comm)".
+  std::vector<std::pair<const char*, size_t>>& statFields() {
+    fields_.clear();
+    const char* begin = buffer_.data();
+    const char* end = begin + size_;
+    // The comm field may contain spaces and parentheses.
+    const char* field = end;
+    while (field > begin && *(field - 1) != ')') {
+      field--;
+    }
 
-  std::string result;
-  char link_path[PATH_MAX] = {0};
-  auto bytes = readlink(attr_path.c_str(), link_path, sizeof(link_path) - 1);
-  if (bytes >= 0) {
-    result = std::string(link_path);
+    Tokenizer fields(field, end - field, " \n");
+    while (fields.next()) {
+      fields_.push_back(std::make_pair(fields.data(), fields.size()));
+    }
+    return fields_;
   }
 
-  return result;
-}
+  /**
+   * @brief Call a function for every "Key: Value" line.
+   *
+   * The key and value are not copied, the value is trimmed of whitespace.
+   */
+  template <typename T>
+  void statusLines(const T& line) {
+    const char* position = buffer_.data();
+    const char* end = position + size_;
+    while (position < end) {
+      auto eol =
+          static_cast<const char*>(memchr(position, '\n', end - position));
+      if (eol == nullptr) {
+        eol = end;
+      }
 
-void genProcessEnvironment(const std::string& pid, QueryData& results) {
-  auto attr = getProcAttr("environ", pid);
+      auto delim =
+          static_cast<const char*>(memchr(position, ':', eol - position));
+      if (delim != nullptr) {
+        const char* value = delim + 1;
+        const char* value_end = eol;
+        while (value < value_end && isspace(*value)) {
+          value++;
+        }
+        while (value_end > value && isspace(*(value_end - 1))) {
+          value_end--;
+        }
+        line(position, delim - position, value, value_end - value);
+      }
+      position = eol + 1;
+    }
+  }
 
-  std::string content;
-  readFile(attr, content);
-  for (const auto& buf : osquery::split(content, "\n")) {
-    size_t idx = buf.find_first_of("=");
+  /// Read /proc/<pid>/cmdline with the argument delimiters replaced.
+  std::string cmdline(const ProcDirectory& directory) {
+    if (!read(directory, "cmdline")) {
+      return "";
+    }
 
-    Row r;
-    r["pid"] = pid;
-    r["key"] = buf.substr(0, idx);
-    r["value"] = buf.substr(idx + 1);
-    results.push_back(r);
+    // Remove \0 delimiters and the trailing delimiter.
+    std::replace(buffer_.begin(), buffer_.begin() + size_, '\0', ' ');
+    size_t length = size_;
+    while (length > 0 && isspace(buffer_[length - 1])) {
+      length--;
+    }
+    return std::string(buffer_.data(), length);
+  }
+
+  /**
+   * @brief Call a function for every delimited record, such as a line.
+   *
+   * Records are not copied, empty records are skipped.
+   */
+  template <typename T>
+  void records(char delimiter, const T& record) {
+    const char* position = buffer_.data();
+    const char* end = position + size_;
+    while (position < end) {
+      auto next = static_cast<const char*>(
+          memchr(position, delimiter, end - position));
+      if (next == nullptr) {
+        next = end;
+      }
+      if (next > position) {
+        record(position, next - position);
+      }
+      position = next + 1;
+    }
   }
-}
 
-void genProcessMap(const std::string& pid, QueryData& results) {
-  auto map = getProcAttr("maps", pid);
+  /// Read the target of a /proc/<pid>/<attr> symlink.
+  std::string link(const ProcDirectory& directory, const char* attr) {
+    std::string target;
+    directory.readLink(attr, target);
+    return target;
+  }
 
-  std::string content;
-  readFile(map, content);
-  for (auto& line : osquery::split(content, "\n")) {
-    auto fields = osquery::split(line, " ");
+ private:
+  /// Grow the buffer by this amount when a file does not fit.
+  static const size_t kProcReadSize = 4096;
 
-    Row r;
-    r["pid"] = pid;
+  std::vector<char> buffer_;
+  size_t size_{0};
+  std::vector<std::pair<const char*, size_t>> fields_;
+};
 
-    // If can't read address, not sure.
-    if (fields.size() < 5) {
-      continue;
-    }
+/// Compare a non-terminated status key with a literal.
+inline bool isKey(const char* key, size_t length, const char* expected) {
+  return strlen(expected) == length && memcmp(key, expected, length) == 0;
+}
+
+/**
+ * @brief Set a non-terminated decimal field as a native integer.
+ *
+ * Fields that are not a (reasonably sized) number are kept as TEXT.
+ */
+inline void setInteger(RowValue& column, const char* value, size_t length) {
+  size_t i = (length > 0 && value[0] == '-') ? 1 : 0;
+  if (length <= i || length > 18) {
+    column = std::string(value, length);
+    return;
+  }
 
-    if (fields[0].size() > 0) {
-      auto addresses = osquery::split(fields[0], "-");
-      r["start"] = "0x" + addresses[0];
-      r["end"] = "0x" + addresses[1];
+  long long number = 0;
+  for (size_t digit = i; digit < length; ++digit) {
+    if (!isdigit(value[digit])) {
+      column = std::string(value, length);
+      return;
     }
+    number = number * 10 + (value[digit] - '0');
+  }
+  column = (i == 1) ? -number : number;
+}
 
-    r["permissions"] = fields[1];
-    r["offset"] = BIGINT(std::stoll(fields[2], nullptr, 16));
-    r["device"] = fields[3];
-    r["inode"] = fields[4];
+/// The first and second tab separated values of a Uid or Gid status line.
+inline void getIds(const char* value,
+                   size_t length,
+                   RowValue& real,
+                   RowValue& effective) {
+  auto tab = static_cast<const char*>(memchr(value, '\t', length));
+  if (tab == nullptr) {
+    return;
+  }
+  setInteger(real, value, tab - value);
 
-    // Path name must be trimmed.
-    if (fields.size() > 5) {
-      boost::trim(fields[5]);
-      r["path"] = fields[5];
-    }
+  auto rest = tab + 1;
+  auto rest_length = length - (rest - value);
+  auto next = static_cast<const char*>(memchr(rest, '\t', rest_length));
+  setInteger(effective, rest, (next != nullptr) ? next - rest : rest_length);
+}
 
-    // BSS with name in pathname.
-    r["pseudo"] = (fields[4] == "0" && r["path"].size() > 0) ? "1" : "0";
-    results.push_back(r);
+/// Memory values are reported in kB, e.g., "1234 kB".
+inline std::string getBytes(const char* value, size_t length) {
+  auto digits = length;
+  while (digits > 0 && !isdigit(value[digits - 1])) {
+    digits--;
   }
+  return std::string(value, digits) + "000";
 }
 
-struct SimpleProcStat {
-  // Output from string parsing /proc/<pid>/status.
-  std::string parent; // PPid:
-  std::string name; // Name:
-  std::string real_uid; // Uid: * - - -
-  std::string real_gid; // Gid: * - - -
-  std::string effective_uid; // Uid: - * - -
-  std::string effective_gid; // Gid: - * - -
-
-  std::string resident_size; // VmRSS:
-  std::string phys_footprint;  // VmSize:
-
-  // Output from sring parsing /proc/<pid>/stat.
-  std::string user_time;
-  std::string system_time;
-  std::string start_time;
+/// The /proc reads required by the columns referenced in a query.
+struct ProcessColumns {
+  bool stat;
+  bool status;
+  bool path;
+  bool cmdline;
+  bool cwd;
+  bool root;
+  bool on_disk;
+
+  explicit ProcessColumns(const QueryContext& context) {
+    stat = context.isColumnUsed("parent") ||
+           context.isColumnUsed("user_time") ||
+           context.isColumnUsed("system_time") ||
+           context.isColumnUsed("start_time");
+    status = context.isColumnUsed("name") || context.isColumnUsed("uid") ||
+             context.isColumnUsed("euid") || context.isColumnUsed("gid") ||
+             context.isColumnUsed("egid") ||
+             context.isColumnUsed("resident_size") ||
+             context.isColumnUsed("phys_footprint");
+    on_disk = context.isColumnUsed("on_disk");
+    path = on_disk || context.isColumnUsed("path");
+    cmdline = context.isColumnUsed("cmdline");
+    cwd = context.isColumnUsed("cwd");
+    root = context.isColumnUsed("root");
+  }
 };
 
-SimpleProcStat getProcStat(const std::string& pid) {
-  SimpleProcStat stat;
-  std::string content;
-  if (readFile(getProcAttr("stat", pid), content).ok()) {
-    auto detail_start = content.find_last_of(")");
-    // Start parsing stats from ") <MODE>..."
-    auto details = osquery::split(content.substr(detail_start + 2), " ");
-    stat.parent = details.at(1);
-    stat.user_time = details.at(11);
-    stat.system_time = details.at(12);
-    stat.start_time = details.at(19);
+bool genProcess(const std::string& pid,
+                const ProcDirectory& directory,
+                const ProcessColumns& columns,
+                const TypedRowYield& yield) {
+  static thread_local ProcReader reader;
+
+  // Integer columns are parsed once, into native values.
+  TypedRow r;
+  setInteger(r["pid"], pid.data(), pid.size());
+  if (columns.stat && reader.read(directory, "stat")) {
+    // Fields start after "(comm) ": <MODE> <PPID> ...
+    const auto& fields = reader.statFields();
+    if (fields.size() > 19) {
+      setInteger(r["parent"], fields[1].first, fields[1].second);
+      r["user_time"] = std::string(fields[11].first, fields[11].second);
+      r["system_time"] = std::string(fields[12].first, fields[12].second);
+      r["start_time"] = std::string(fields[19].first, fields[19].second);
+    }
   }
 
-  if (readFile(getProcAttr("status", pid), content).ok()) {
-    for (const auto& line : osquery::split(content, "\n")) {
-      // Status lines are formatted: Key: Value....\n.
-      auto detail = osquery::split(line, ":", 1);
-      if (detail.size() != 2) {
-        continue;
-      }
-
+  if (columns.status && reader.read(directory, "status")) {
+    reader.statusLines([&r](const char* key,
+                            size_t key_length,
+                            const char* value,
+                            size_t value_length) {
       // There are specific fields from each detail.
-      if (detail.at(0) == "Name") {
-        stat.name = detail.at(1);
-      } else if (detail.at(0) == "VmRSS") {
-        detail[1].erase(detail.at(1).end() - 3, detail.at(1).end());
-        // Memory is reported in kB.
-        stat.resident_size = detail.at(1) + "000";
-      } else if (detail.at(0) == "VmSize") {
-        detail[1].erase(detail.at(1).end() - 3, detail.at(1).end());
-        // Memory is reported in kB.
-        stat.phys_footprint = detail.at(1) + "000";
-      } else if (detail.at(0) == "Gid") {
+      if (isKey(key, key_length, "Name")) {
+        r["name"] = std::string(value, value_length);
+      } else if (isKey(key, key_length, "VmRSS")) {
+        r["resident_size"] = getBytes(value, value_length);
+      } else if (isKey(key, key_length, "VmSize")) {
+        r["phys_footprint"] = getBytes(value, value_length);
+      } else if (isKey(key, key_length, "Gid")) {
         // Format is: R E - -
-        auto gid_detail = osquery::split(detail.at(1), "\t");
-        if (gid_detail.size() == 4) {
-          stat.real_gid = gid_detail.at(0);
-          stat.effective_gid = gid_detail.at(1);
-        }
-      } else if (detail.at(0) == "Uid") {
-        auto uid_detail = osquery::split(detail.at(1), "\t");
-        if (uid_detail.size() == 4) {
-          stat.real_uid = uid_detail.at(0);
-          stat.effective_uid = uid_detail.at(1);
-        }
+        getIds(value, value_length, r["gid"], r["egid"]);
+      } else if (isKey(key, key_length, "Uid")) {
+        getIds(value, value_length, r["uid"], r["euid"]);
       }
-    }
+    });
   }
 
-  return stat;
-}
+  if (columns.path) {
+    // The exe is a symlink to the binary on-disk.
+    r["path"] = reader.link(directory, "exe");
+  }
 
-void genProcess(const std::string& pid, QueryData& results) {
-  // Parse the process stat and status.
-  auto proc_stat = getProcStat(pid);
-
-  Row r;
-  r["pid"] = pid;
-  r["parent"] = proc_stat.parent;
-  r["path"] = readProcLink("exe", pid);
-  r["name"] = proc_stat.name;
-
-  // Read/parse cmdline arguments.
-  r["cmdline"] = readProcCMDLine(pid);
-  r["cwd"] = readProcLink("cwd", pid);
-  r["root"] = readProcLink("root", pid);
-
-  r["uid"] = proc_stat.real_uid;
-  r["euid"] = proc_stat.effective_uid;
-  r["gid"] = proc_stat.real_gid;
-  r["egid"] = proc_stat.effective_gid;
-
-  // If the path of the executable that started the process is available and
-  // the path exists on disk, set on_disk to 1. If the path is not
-  // available, set on_disk to -1. If, and only if, the path of the
-  // executable is available and the file does NOT exist on disk, set on_disk
-  // to 0.
-  r["on_disk"] = osquery::pathExists(r["path"]).toString();
-
-  // size/memory information
-  r["wired_size"] = "0"; // No support for unpagable counters in linux.
-  r["resident_size"] = proc_stat.resident_size;
-  r["phys_footprint"] = proc_stat.phys_footprint;
-
-  // time information
-  r["user_time"] = proc_stat.user_time;
-  r["system_time"] = proc_stat.system_time;
-  r["start_time"] = proc_stat.start_time;
-
-  results.push_back(r);
-}
+  if (columns.cmdline) {
+    // Read/parse cmdline arguments.
+    r["cmdline"] = reader.cmdline(directory);
+  }
 
-QueryData genProcesses(QueryContext& context) {
-  QueryData results;
+  if (columns.cwd) {
+    r["cwd"] = reader.link(directory, "cwd");
+  }
+
+  if (columns.root) {
+    r["root"] = reader.link(directory, "root");
+  }
 
-  std::set<std::string> pids;
+  if (columns.on_disk) {
+    // If the path of the executable that started the process is available and
+    // the path exists on disk, set on_disk to 1. If the path is not
+    // available, set on_disk to -1. If, and only if, the path of the
+    // executable is available and the file does NOT exist on disk, set
+    // on_disk to 0.
+    r["on_disk"] = osquery::pathExists(r["path"].text()).toString();
+  }
+
+  // No support for unpagable counters in linux.
+  r["wired_size"] = "0";
+  return yield(r);
+}
+
+/// The snapshot of the processes a query's pid constraints select.
+static ProcSnapshotRef getProcSnapshot(QueryContext& context) {
   if (context.constraints["pid"].exists(EQUALS)) {
-    pids = context.constraints["pid"].getAll(EQUALS);
-  } else {
-    osquery::procProcesses(pids);
+    return procSnapshot(context.constraints["pid"].getAll(EQUALS));
   }
+  // Process tables used within a query share a snapshot of every process.
+  return procSnapshot();
+}
+
+/**
+ * @brief Generate rows for each process of a query's snapshot.
+ *
+ * Each row is generated from the process directory opened by the snapshot.
+ */
+template <typename Generator>
+static void genProcessRows(QueryContext& context,
+                           const Generator& generator,
+                           QueryData& results) {
+  auto snapshot = getProcSnapshot(context);
+  procProcessRows(
+      snapshot->pids(),
+      [&snapshot, &generator](const std::string& pid, QueryData& rows) {
+        auto directory = snapshot->directory(pid);
+        if (directory->ok()) {
+          generator(pid, *directory, rows);
+        }
+      },
+      results);
+}
+
+void genProcesses(QueryContext& context, const TypedRowYield& yield) {
+  auto snapshot = getProcSnapshot(context);
+  const auto& pids = snapshot->pids();
 
   // Generate data for all pids in the vector.
   // If there are comparison constraints this could apply the operator
   // before generating the process structure.
-  for (const auto& pid : pids) {
-    genProcess(pid, results);
+  // Only read the /proc files needed for the columns used by the query.
+  ProcessColumns columns(context);
+  if (context.limit > 0 || procShardCount(pids.size()) == 1) {
+    // Stream rows when the query may stop early.
+    for (const auto& pid : pids) {
+      auto directory = snapshot->directory(pid);
+      if (directory->ok() && !genProcess(pid, *directory, columns, yield)) {
+        break;
+      }
+    }
+    return;
   }
 
-  return results;
+  std::vector<TypedRow> results;
+  procProcessRows(pids,
+                  [&snapshot, &columns](const std::string& pid,
+                                        std::vector<TypedRow>& rows) {
+                    auto directory = snapshot->directory(pid);
+                    if (!directory->ok()) {
+                      return;
+                    }
+                    genProcess(pid,
+                               *directory,
+                               columns,
+                               [&rows](TypedRow& r) {
+                                 rows.push_back(std::move(r));
+                                 return true;
+                               });
+                  },
+                  results);
+  for (auto& r : results) {
+    if (!yield(r)) {
+      break;
+    }
+  }
 }
 
-QueryData genProcessEnvs(QueryContext& context) {
-  QueryData results;
+void genProcessEnvironment(const std::string& pid,
+                           const ProcDirectory& directory,
+                           QueryData& results) {
+  static thread_local ProcReader reader;
+  if (!reader.read(directory, "environ")) {
+    return;
+  }
 
-  std::set<std::string> pids;
-  if (context.constraints["pid"].exists(EQUALS)) {
-    pids = context.constraints["pid"].getAll(EQUALS);
-  } else {
-    osquery::procProcesses(pids);
+  // Variables are NUL-delimited, values may contain newlines.
+  reader.records('\0', [&pid, &results](const char* entry, size_t length) {
+    auto idx = static_cast<const char*>(memchr(entry, '=', length));
+    size_t key = (idx != nullptr) ? idx - entry : length;
+
+    Row r;
+    r["pid"] = pid;
+    r["key"] = std::string(entry, key);
+    r["value"] = (idx != nullptr) ? std::string(idx + 1, length - key - 1)
+                                  : std::string(entry, length);
+    results.push_back(std::move(r));
+  });
+}
+
+/// Parse a non-terminated hex field, such as a mapping address.
+inline unsigned long long parseHex(const char* value, size_t length) {
+  unsigned long long number = 0;
+  for (size_t i = 0; i < length && isxdigit(value[i]); ++i) {
+    int digit =
+        isdigit(value[i]) ? value[i] - '0' : tolower(value[i]) - 'a' + 10;
+    number = (number << 4) | digit;
   }
+  return number;
+}
 
-  for (const auto& pid : pids) {
-    genProcessEnvironment(pid, results);
+/// The fields of a /proc/<pid>/maps line, pointing into the read buffer.
+struct ProcMapping {
+  const char* start{nullptr};
+  size_t start_size{0};
+  const char* end{nullptr};
+  size_t end_size{0};
+  const char* permissions{nullptr};
+  size_t permissions_size{0};
+  const char* offset{nullptr};
+  size_t offset_size{0};
+  const char* device{nullptr};
+  size_t device_size{0};
+  const char* inode{nullptr};
+  size_t inode_size{0};
+  const char* path{nullptr};
+  size_t path_size{0};
+
+  /// Parse "start-end perms offset dev inode [path]", false if truncated.
+  bool parse(const char* line, size_t length) {
+    if (fields_.split(line, length) < 5) {
+      return false;
+    }
+    auto dash = static_cast<const char*>(
+        memchr(fields_[0].first, '-', fields_[0].second));
+    if (dash == nullptr) {
+      return false;
+    }
+    start = fields_[0].first;
+    start_size = dash - start;
+    end = dash + 1;
+    end_size = fields_[0].second - start_size - 1;
+
+    permissions = fields_[1].first;
+    permissions_size = fields_[1].second;
+    offset = fields_[2].first;
+    offset_size = fields_[2].second;
+    device = fields_[3].first;
+    device_size = fields_[3].second;
+    inode = fields_[4].first;
+    inode_size = fields_[4].second;
+
+    // The path is the rest of the line, and may contain spaces.
+    auto rest = fields_.rest(5);
+    path = rest.first;
+    path_size = rest.second;
+    return true;
   }
 
-  return results;
+  /// BSS with name in pathname.
+  bool pseudo() const {
+    return inode_size == 1 && inode[0] == '0' && path_size > 0;
+  }
+
+ private:
+  ProcTextLine<6> fields_;
+};
+
+void genProcessMap(const std::string& pid,
+                   const ProcDirectory& directory,
+                   QueryData& results) {
+  static thread_local ProcReader reader;
+  if (!reader.read(directory, "maps")) {
+    return;
+  }
+
+  ProcMapping mapping;
+  reader.records('\n', [&](const char* line, size_t length) {
+    if (!mapping.parse(line, length)) {
+      return;
+    }
+
+    Row r;
+    r["pid"] = pid;
+    r["start"] = "0x" + std::string(mapping.start, mapping.start_size);
+    r["end"] = "0x" + std::string(mapping.end, mapping.end_size);
+    r["permissions"] =
+        std::string(mapping.permissions, mapping.permissions_size);
+    r["offset"] = BIGINT(parseHex(mapping.offset, mapping.offset_size));
+    r["device"] = std::string(mapping.device, mapping.device_size);
+    r["inode"] = std::string(mapping.inode, mapping.inode_size);
+    r["path"] = std::string(mapping.path, mapping.path_size);
+    r["pseudo"] = mapping.pseudo() ? "1" : "0";
+    results.push_back(std::move(r));
+  });
 }
 
-QueryData genProcessMemoryMap(QueryContext& context) {
-  QueryData results;
+/// The totals of one path's mappings within a process.
+struct ProcMappingTotals {
+  size_t mappings{0};
+  unsigned long long size{0};
+  bool executable{false};
+};
 
-  std::set<std::string> pids;
-  if (context.constraints["pid"].exists(EQUALS)) {
-    pids = context.constraints["pid"].getAll(EQUALS);
-  } else {
-    osquery::procProcesses(pids);
+void genProcessMapTotals(const std::string& pid,
+                         const ProcDirectory& directory,
+                         QueryData& results) {
+  static thread_local ProcReader reader;
+  if (!reader.read(directory, "maps")) {
+    return;
   }
 
-  for (const auto& pid : pids) {
-    genProcessMap(pid, results);
+  // Processes such as JVMs have many mappings for few paths.
+  std::map<std::string, ProcMappingTotals> totals;
+  ProcMapping mapping;
+  reader.records('\n', [&](const char* line, size_t length) {
+    if (!mapping.parse(line, length)) {
+      return;
+    }
+
+    auto& path = totals[std::string(mapping.path, mapping.path_size)];
+    path.mappings++;
+    path.size += parseHex(mapping.end, mapping.end_size) -
+                 parseHex(mapping.start, mapping.start_size);
+    if (mapping.permissions_size > 2 && mapping.permissions[2] == 'x') {
+      path.executable = true;
+    }
+  });
+
+  for (const auto& path : totals) {
+    Row r;
+    r["pid"] = pid;
+    r["path"] = path.first;
+    r["mappings"] = INTEGER(path.second.mappings);
+    r["size"] = BIGINT(path.second.size);
+    r["executable"] = (path.second.executable) ? "1" : "0";
+    results.push_back(std::move(r));
   }
+}
 
+QueryData genProcessEnvs(QueryContext& context) {
+  QueryData results;
+  genProcessRows(context, genProcessEnvironment, results);
+  return results;
+}
+
+QueryData genProcessMemoryMap(QueryContext& context) {
+  QueryData results;
+  genProcessRows(context, genProcessMap, results);
+  return results;
+}
+
+QueryData genProcessMemoryTotals(QueryContext& context) {
+  QueryData results;
+  genProcessRows(context, genProcessMapTotals, results);
   return results;
 }
 }
@@ -9,13 +9,15 @@
  */
 
 #include <sys/shm.h>
-#include <pwd.h>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/users.h"
+#include "rows/shared_memory.h"
+
 namespace osquery {
 namespace tables {
 
@@ -28,15 +30,13 @@ struct shm_info {
   unsigned long swap_successes;
 } __attribute__((unused));
 
-QueryData genSharedMemory(QueryContext &context) {
-  QueryData results;
-
+void genSharedMemory(QueryContext &context, const ColumnRowYield &yield) {
   // Use shared memory control (shmctl) to get the max SHMID.
   struct shm_info shm_info;
   int maxid = shmctl(0, SHM_INFO, (struct shmid_ds *)(void *)&shm_info);
   if (maxid < 0) {
     VLOG(1) << "Linux kernel not configured for shared memory";
-    return {};
+    return;
   }
 
   // Use a static pointer to access IPC permissions structure.
@@ -50,38 +50,38 @@ QueryData genSharedMemory(QueryContext &context) {
       continue;
     }
 
-    Row r;
-    r["shmid"] = INTEGER(shmid);
+    // Values are set natively by column ordinal.
+    SharedMemoryRow r;
+    r.setShmid(shmid);
 
-    struct passwd *pw = getpwuid(shmseg.shm_perm.uid);
-    if (pw != nullptr) {
-      r["owner_uid"] = BIGINT(pw->pw_uid);
+    UserInfo user;
+    if (getUser(shmseg.shm_perm.uid, user)) {
+      r.setOwnerUid(user.uid);
     }
 
-    pw = getpwuid(shmseg.shm_perm.cuid);
-    if (pw != nullptr) {
-      r["creator_uid"] = BIGINT(pw->pw_uid);
+    if (getUser(shmseg.shm_perm.cuid, user)) {
+      r.setCreatorUid(user.uid);
     }
 
     // Accessor, creator pids.
-    r["pid"] = BIGINT(shmseg.shm_lpid);
-    r["creator_pid"] = BIGINT(shmseg.shm_cpid);
+    r.setPid(shmseg.shm_lpid);
+    r.setCreatorPid(shmseg.shm_cpid);
 
     // Access, detached, creator times
-    r["atime"] = BIGINT(shmseg.shm_atime);
-    r["dtime"] = BIGINT(shmseg.shm_dtime);
-    r["ctime"] = BIGINT(shmseg.shm_ctime);
-
-    r["permissions"] = lsperms(ipcp->mode);
-    r["size"] = BIGINT(shmseg.shm_segsz);
-    r["attached"] = INTEGER(shmseg.shm_nattch);
-    r["status"] = (ipcp->mode & SHM_DEST) ? "dest" : "";
-    r["locked"] = (ipcp->mode & SHM_LOCKED) ? "1" : "0";
-
-    results.push_back(r);
+    r.setAtime(shmseg.shm_atime);
+    r.setDtime(shmseg.shm_dtime);
+    r.setCtime(shmseg.shm_ctime);
+
+    r.setPermissions(lsperms(ipcp->mode));
+    r.setSize(shmseg.shm_segsz);
+    r.setAttached(shmseg.shm_nattch);
+    r.setStatus((ipcp->mode & SHM_DEST) ? "dest" : "");
+    r.setLocked((ipcp->mode & SHM_LOCKED) ? 1 : 0);
+
+    if (!yield(r.values)) {
+      break;
+    }
   }
-
-  return results;
 }
 }
-}
\ No newline at end of file
+}
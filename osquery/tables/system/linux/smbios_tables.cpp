@@ -21,6 +21,7 @@ namespace tables {
 #define kLinuxSMBIOSRawAddress_ 0xF0000
 #define kLinuxSMBIOSRawLength_ 0x10000
 
+const std::string kLinuxDMITablesPath = "/sys/firmware/dmi/tables/DMI";
 const std::string kLinuxEFISystabPath = "/sys/firmware/efi/systab";
 const std::string kLinuxLegacyEFISystabPath = "/proc/efi/systab";
 
@@ -28,16 +29,14 @@ void genSMBIOSFromDMI(size_t base, size_t length, QueryData& results) {
   // Linux will expose the SMBIOS/DMI entry point structures, which contain
   // a member variable with the DMI tables start address and size.
   // This applies to both the EFI-variable and physical memory search.
-  uint8_t* data;
-  auto status = osquery::readRawMem(base, length, (void**)&data);
+  auto status = osquery::mapRawMem(
+      base, length, [&results](const uint8_t* data, size_t size) {
+        // Attempt to parse tables from the mapped data.
+        genSMBIOSTables(data, size, results);
+      });
   if (!status.ok()) {
     VLOG(1) << "Could not read DMI tables memory";
-    return;
   }
-
-  // Attempt to parse tables from allocated data.
-  genSMBIOSTables(data, length, results);
-  free(data);
 }
 
 void genEFISystabTables(QueryData& results) {
@@ -46,33 +45,36 @@ void genEFISystabTables(QueryData& results) {
 }
 
 void genRawSMBIOSTables(QueryData& results) {
-  uint8_t* data;
-  auto status = osquery::readRawMem(
-      kLinuxSMBIOSRawAddress_, kLinuxSMBIOSRawLength_, (void**)&data);
+  auto status = osquery::mapRawMem(
+      kLinuxSMBIOSRawAddress_,
+      kLinuxSMBIOSRawLength_,
+      [&results](const uint8_t* data, size_t size) {
+        // Search for the SMBIOS/DMI tables magic header string.
+        for (size_t offset = 0; offset + sizeof(DMIEntryPoint) <= size;
+             offset += 16) {
+          // Could look for "_SM_" for the SMBIOS header, but the DMI header
+          // exists in both SMBIOS and the legacy DMI spec.
+          if (memcmp(data + offset, "_DMI_", 5) == 0) {
+            auto dmi_data = (const DMIEntryPoint*)(data + offset);
+            genSMBIOSFromDMI(
+                dmi_data->tableAddress, dmi_data->tableLength, results);
+          }
+        }
+      });
   if (!status.ok()) {
     VLOG(1) << "Could not read SMBIOS memory";
-    return;
-  }
-
-  // Search for the SMBIOS/DMI tables magic header string.
-  size_t offset;
-  for (offset = 0; offset <= 0xFFF0; offset += 16) {
-    // Could look for "_SM_" for the SMBIOS header, but the DMI header exists
-    // in both SMBIOS and the legacy DMI spec.
-    if (memcmp(data + offset, "_DMI_", 5) == 0) {
-      auto dmi_data = (DMIEntryPoint*)(data + offset);
-      genSMBIOSFromDMI(dmi_data->tableAddress, dmi_data->tableLength, results);
-    }
   }
-
-  free(data);
 }
 
 QueryData genSMBIOSTables(QueryContext& context) {
   QueryData results;
-
-  if (osquery::isReadable(kLinuxEFISystabPath).ok() ||
-      osquery::isReadable(kLinuxLegacyEFISystabPath).ok()) {
+  // Newer kernels expose the DMI tables, avoiding physical memory reads.
+  std::string content;
+  if (osquery::readFile(kLinuxDMITablesPath, content).ok()) {
+    genSMBIOSTables(
+        (const uint8_t*)content.data(), content.size(), results);
+  } else if (osquery::isReadable(kLinuxEFISystabPath).ok() ||
+             osquery::isReadable(kLinuxLegacyEFISystabPath).ok()) {
     genEFISystabTables(results);
   } else {
     genRawSMBIOSTables(results);
@@ -0,0 +1,56 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+#include <osquery/filesystem.h>
+
+#include "osquery/core/test_util.h"
+#include "osquery/tables/system/linux/utmp.h"
+
+namespace osquery {
+namespace tables {
+
+class UtmpTests : public testing::Test {};
+
+TEST_F(UtmpTests, test_utmp_mapping) {
+  auto path = kTestWorkingDirectory + "utmp-tests";
+  {
+    struct utmpx records[2];
+    memset(records, 0, sizeof(records));
+    strcpy(records[0].ut_user, "first");
+    records[0].ut_tv.tv_sec = 10;
+    // A field filling its array is not terminated.
+    memset(records[1].ut_line, 'x', sizeof(records[1].ut_line));
+    records[1].ut_tv.tv_sec = 20;
+
+    std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+    stream.write((const char*)records, sizeof(records));
+    // A partially written record is not mapped.
+    stream.write((const char*)records, 16);
+  }
+
+  UtmpMapping utmp(path);
+  ASSERT_TRUE(utmp.valid());
+  ASSERT_EQ(utmp.size(), 2U);
+  EXPECT_EQ(utmpString(utmp.at(0).ut_user), "first");
+  EXPECT_EQ(utmp.at(1).ut_tv.tv_sec, 20);
+  EXPECT_EQ(utmpString(utmp.at(1).ut_line),
+            std::string(sizeof(utmp.at(1).ut_line), 'x'));
+  remove(path);
+
+  UtmpMapping missing(path);
+  EXPECT_FALSE(missing.valid());
+  EXPECT_EQ(missing.size(), 0U);
+}
+}
+}
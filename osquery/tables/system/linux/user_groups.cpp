@@ -22,12 +22,12 @@ QueryData genUserGroups(QueryContext &context) {
   if (context.constraints["uid"].exists(EQUALS)) {
     std::set<std::string> uids = context.constraints["uid"].getAll(EQUALS);
     for (const auto &uid : uids) {
-      pwd = getpwuid(std::strtol(uid.c_str(), NULL, 10));
-      if (pwd != nullptr) {
+      UserInfo info;
+      if (getUser(std::strtol(uid.c_str(), NULL, 10), info)) {
         user_t<uid_t, gid_t> user;
-        user.name = pwd->pw_name;
-        user.uid = pwd->pw_uid;
-        user.gid = pwd->pw_gid;
+        user.name = info.name.c_str();
+        user.uid = info.uid;
+        user.gid = info.gid;
         getGroupsForUser<uid_t, gid_t>(results, user);
       }
     }
@@ -0,0 +1,50 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "osquery/tables/system/linux/utmp.h"
+
+namespace osquery {
+namespace tables {
+
+UtmpMapping::UtmpMapping(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+
+  struct stat file_stat;
+  if (::fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) &&
+      file_stat.st_size >= static_cast<off_t>(sizeof(struct utmpx))) {
+    // Only map the complete records, a login may be writing the next.
+    size_ = file_stat.st_size - (file_stat.st_size % sizeof(struct utmpx));
+    void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      records_ = static_cast<const struct utmpx*>(data);
+      count_ = size_ / sizeof(struct utmpx);
+      device_ = file_stat.st_dev;
+      inode_ = file_stat.st_ino;
+    }
+  }
+  // The mapping remains valid after the descriptor is closed.
+  ::close(fd);
+}
+
+UtmpMapping::~UtmpMapping() {
+  if (records_ != nullptr) {
+    ::munmap((void*)records_, size_);
+  }
+}
+}
+}
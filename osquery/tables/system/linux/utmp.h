@@ -0,0 +1,66 @@
+/*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <string>
+
+#include <string.h>
+#include <sys/types.h>
+#include <utmpx.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/database.h>
+
+namespace osquery {
+namespace tables {
+
+/**
+ * @brief A read-only mapping of the records in a utmp or wtmp file.
+ *
+ * glibc stores fixed-size utmpx records, so the records are read in place
+ * rather than copied one at a time by getutxent. A partially written record
+ * at the end of the file is not included.
+ */
+class UtmpMapping : private boost::noncopyable {
+ public:
+  explicit UtmpMapping(const std::string& path);
+  ~UtmpMapping();
+
+  /// True if the file was mapped, an empty file is not mapped.
+  bool valid() const { return records_ != nullptr; }
+
+  /// The number of complete records.
+  size_t size() const { return count_; }
+
+  /// Access a record, records are in the order they were written.
+  const struct utmpx& at(size_t index) const { return records_[index]; }
+
+  /// The device and inode of the mapped file.
+  dev_t device() const { return device_; }
+  ino_t inode() const { return inode_; }
+
+ private:
+  const struct utmpx* records_{nullptr};
+  size_t count_{0};
+  size_t size_{0};
+
+  dev_t device_{0};
+  ino_t inode_{0};
+};
+
+/// Copy a fixed-size utmpx string field, which may not be terminated.
+template <size_t N>
+inline std::string utmpString(const char (&field)[N]) {
+  return std::string(field, strnlen(field, N));
+}
+}
+}
@@ -15,9 +15,36 @@
 
 #include <utmpx.h>
 
+#ifdef __linux__
+#include <utmp.h>
+
+#include "osquery/tables/system/linux/utmp.h"
+#endif
+
 namespace osquery {
 namespace tables {
 
+#ifdef __linux__
+QueryData genLoggedInUsers(QueryContext& context) {
+  QueryData results;
+  UtmpMapping utmp(_PATH_UTMP);
+  for (size_t i = 0; i < utmp.size(); ++i) {
+    const auto& entry = utmp.at(i);
+    if (entry.ut_pid == 1) {
+      continue;
+    }
+    Row r;
+    r["user"] = utmpString(entry.ut_user);
+    r["tty"] = utmpString(entry.ut_line);
+    r["host"] = utmpString(entry.ut_host);
+    r["time"] = INTEGER(entry.ut_tv.tv_sec);
+    r["pid"] = INTEGER(entry.ut_pid);
+    results.push_back(r);
+  }
+
+  return results;
+}
+#else
 std::mutex utmpxEnumerationMutex;
 
 QueryData genLoggedInUsers(QueryContext& context) {
@@ -41,5 +68,6 @@ QueryData genLoggedInUsers(QueryContext& context) {
 
   return results;
 }
+#endif
 }
 }
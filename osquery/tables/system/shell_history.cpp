@@ -22,7 +22,8 @@
 namespace osquery {
 namespace tables {
 
-const std::vector<std::string> kShellHistoryFiles = {
+/// History files within each user's home, shared with shell_history_events.
+extern const std::vector<std::string> kShellHistoryFiles = {
     ".bash_history", ".zsh_history", ".zhistory", ".history",
 };
 
@@ -8,17 +8,15 @@
  *
  */
 
-#include <pwd.h>
-#include <grp.h>
 #include <sys/stat.h>
 
-#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
-namespace fs = boost::filesystem;
+#include "osquery/core/users.h"
 
 namespace osquery {
 namespace tables {
@@ -33,43 +31,33 @@ std::vector<std::string> kBinarySearchPaths = {
   "/tmp",
 };
 
-Status genBin(const fs::path& path, int perms, QueryData& results) {
-  struct stat info;
-  // store user and group
-  if (stat(path.c_str(), &info) != 0) {
-    return Status(1, "stat failed");
-  }
-
+Status genBin(const std::string& path,
+              const struct stat& info,
+              QueryData& results) {
   // store path
   Row r;
-  r["path"] = path.string();
-  struct passwd *pw = getpwuid(info.st_uid);
-  struct group *gr = getgrgid(info.st_gid);
-
+  r["path"] = path;
   // get user name + group
-  std::string user;
-  if (pw != nullptr) {
-    user = std::string(pw->pw_name);
+  UserInfo user;
+  if (getUser(info.st_uid, user)) {
+    r["username"] = user.name;
   } else {
-    user = boost::lexical_cast<std::string>(info.st_uid);
+    r["username"] = boost::lexical_cast<std::string>(info.st_uid);
   }
 
-  std::string group;
-  if (gr != nullptr) {
-    group = std::string(gr->gr_name);
+  GroupInfo group;
+  if (getGroup(info.st_gid, group)) {
+    r["groupname"] = group.name;
   } else {
-    group = boost::lexical_cast<std::string>(info.st_gid);
+    r["groupname"] = boost::lexical_cast<std::string>(info.st_gid);
   }
 
-  r["username"] = user;
-  r["groupname"] = group;
-
   r["permissions"] = "";
-  if ((perms & 04000) == 04000) {
+  if ((info.st_mode & 04000) == 04000) {
     r["permissions"] += "S";
   }
 
-  if ((perms & 02000) == 02000) {
+  if ((info.st_mode & 02000) == 02000) {
     r["permissions"] += "G";
   }
 
@@ -77,45 +65,50 @@ Status genBin(const fs::path& path, int perms, QueryData& results) {
   return Status(0, "OK");
 }
 
-bool isSuidBin(const fs::path& path, int perms) {
-  if (!fs::is_regular_file(path)) {
+bool isSuidBin(const struct stat& info) {
+  if (!S_ISREG(info.st_mode)) {
     return false;
   }
 
-  if ((perms & 04000) == 04000 || (perms & 02000) == 02000) {
+  if ((info.st_mode & 04000) == 04000 || (info.st_mode & 02000) == 02000) {
     return true;
   }
   return false;
 }
 
 void genSuidBinsFromPath(const std::string& path, QueryData& results) {
-  if (!pathExists(path).ok()) {
-    // Creating an iterator on a missing path will except.
+  FileTreeOptions options;
+  options.threads = fileTreeThreadCount();
+  // Mounts below a search path, such as network shares, are not searched.
+  options.same_device = true;
+
+  // Each walking thread keeps the suid binaries it finds.
+  std::vector<std::vector<std::pair<std::string, struct stat>>> found(
+      options.threads);
+  auto status = walkFileTree(
+      path,
+      [&found](size_t worker, const FileTreeEntry& entry) {
+        if (S_ISLNK(entry.status.st_mode)) {
+          // Links to binaries are reported, but only links need a second stat.
+          struct stat info;
+          if (stat(entry.path.c_str(), &info) == 0 && isSuidBin(info)) {
+            found[worker].push_back(std::make_pair(entry.path, info));
+          }
+        } else if (isSuidBin(entry.status)) {
+          found[worker].push_back(std::make_pair(entry.path, entry.status));
+        }
+        return true;
+      },
+      options);
+  if (!status.ok()) {
+    VLOG(1) << "Cannot search for binaries: " << status.getMessage();
     return;
   }
 
-  auto it = fs::recursive_directory_iterator(fs::path(path));
-  fs::recursive_directory_iterator end;
-  while (it != end) {
-    fs::path path = *it;
-    try {
-      // Do not traverse symlinked directories.
-      if (fs::is_directory(path) && fs::is_symlink(path)) {
-        it.no_push();
-      }
-
-      int perms = it.status().permissions();
-      if (isSuidBin(path, perms)) {
-        // Only emit suid bins.
-        genBin(path, perms, results);
-      }
-
-      ++it;
-    } catch (fs::filesystem_error& e) {
-      VLOG(1) << "Cannot read binary from " << path;
-      it.no_push();
-      // Try to recover, otherwise break.
-      try { ++it; } catch(fs::filesystem_error& e) { break; }
+  // Owner names are resolved after the walk, most binaries share an owner.
+  for (const auto& binaries : found) {
+    for (const auto& binary : binaries) {
+      genBin(binary.first, binary.second, results);
     }
   }
 }
@@ -8,7 +8,11 @@
 *
 */
 
+#include <mutex>
+
 #include <boost/algorithm/string.hpp>
+
+#include <osquery/filesystem.h>
 #include <osquery/tables.h>
 
 // see README.api of libdpkg-dev
@@ -172,9 +176,25 @@ void extractDebPackageInfo(const struct pkginfo *pkg, QueryData &results) {
   results.push_back(r);
 }
 
-QueryData genDebs(QueryContext &context) {
-  QueryData results;
+/// The dpkg status database, package lists change when it is written.
+const std::string kDPKGStatusPath = "/var/lib/dpkg/status";
+
+/// Installed packages from the last dpkg database load.
+static QueryData kDebPackages;
 
+/// The identity of the dpkg status database the packages were loaded from.
+static std::string kDebPackagesIdentity;
+
+/// Protects the package cache and libdpkg, which is not thread safe.
+static std::mutex kDebPackagesMutex;
+
+/**
+ * @brief Load every installed package from the dpkg database.
+ *
+ * Loading the database parses the entire status file, the results are kept
+ * until the status file's identity changes.
+ */
+static void genDebPackages(QueryData &results) {
   struct pkg_array packages;
   dpkg_setup(&packages);
   for (int i = 0; i < packages.n_pkgs; i++) {
@@ -187,6 +207,31 @@ QueryData genDebs(QueryContext &context) {
   }
 
   dpkg_teardown(&packages);
+}
+
+QueryData genDebs(QueryContext &context) {
+  std::lock_guard<std::mutex> lock(kDebPackagesMutex);
+  std::string identity;
+  if (!getFileIdentity(kDPKGStatusPath, identity).ok() ||
+      identity != kDebPackagesIdentity) {
+    kDebPackages.clear();
+    genDebPackages(kDebPackages);
+    kDebPackagesIdentity = identity;
+  }
+
+  if (!context.constraints["name"].exists(EQUALS)) {
+    return kDebPackages;
+  }
+
+  // Point lookups by name are answered from the cached packages.
+  QueryData results;
+  auto names = context.constraints["name"].getAll(EQUALS);
+  for (const auto &row : kDebPackages) {
+    auto name = row.find("name");
+    if (name != row.end() && names.count(name->second) > 0) {
+      results.push_back(row);
+    }
+  }
   return results;
 }
 }
@@ -19,6 +19,8 @@
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/users.h"
+
 // This is also the max supported number for OS X right now.
 #define EXPECTED_GROUPS_MAX 64
 
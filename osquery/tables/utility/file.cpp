@@ -8,7 +8,16 @@
  *
  */
 
+#include <cerrno>
+
+#include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/sysmacros.h>
+#endif
 
 #include <boost/filesystem.hpp>
 
@@ -18,57 +27,214 @@
 
 namespace fs = boost::filesystem;
 
+// statx requests only the fields of used columns, glibc added it in 2.28.
+#if defined(__linux__) && defined(__GLIBC__) && defined(STATX_BASIC_STATS)
+#if __GLIBC_PREREQ(2, 28)
+#define OSQUERY_FILE_STATX
+#endif
+#endif
+
 namespace osquery {
 namespace tables {
 
-void genFileInfo(const std::string& path,
+/// The columns referenced by a query, checked once rather than for each file.
+struct FileColumns {
+  explicit FileColumns(const QueryContext& context)
+      : inode(context.isColumnUsed("inode")),
+        uid(context.isColumnUsed("uid")),
+        gid(context.isColumnUsed("gid")),
+        mode(context.isColumnUsed("mode")),
+        device(context.isColumnUsed("device")),
+        size(context.isColumnUsed("size")),
+        block_size(context.isColumnUsed("block_size")),
+        hard_links(context.isColumnUsed("hard_links")),
+        atime(context.isColumnUsed("atime")),
+        mtime(context.isColumnUsed("mtime")),
+        ctime(context.isColumnUsed("ctime")),
+        is_link(context.isColumnUsed("is_link")) {
+#if defined(OSQUERY_FILE_STATX)
+    mask = STATX_TYPE;
+    mask |= (inode) ? STATX_INO : 0;
+    mask |= (uid) ? STATX_UID : 0;
+    mask |= (gid) ? STATX_GID : 0;
+    mask |= (mode) ? STATX_MODE : 0;
+    mask |= (size) ? STATX_SIZE : 0;
+    mask |= (hard_links) ? STATX_NLINK : 0;
+    mask |= (atime) ? STATX_ATIME : 0;
+    mask |= (mtime) ? STATX_MTIME : 0;
+    mask |= (ctime) ? STATX_CTIME : 0;
+#endif
+  }
+
+  bool inode;
+  bool uid;
+  bool gid;
+  bool mode;
+  bool device;
+  bool size;
+  bool block_size;
+  bool hard_links;
+  bool atime;
+  bool mtime;
+  bool ctime;
+  bool is_link;
+
+  /// The statx fields needed by the used columns.
+  unsigned int mask{0};
+};
+
+/// Stat a path relative to a directory descriptor.
+static bool statFile(int dirfd,
+                     const std::string& name,
+                     int flags,
+                     const FileColumns& columns,
+                     struct stat& file_stat) {
+#if defined(OSQUERY_FILE_STATX)
+  struct statx stx;
+  if (::statx(dirfd, name.c_str(), flags, columns.mask, &stx) == 0) {
+    file_stat.st_mode = stx.stx_mode;
+    file_stat.st_ino = stx.stx_ino;
+    file_stat.st_uid = stx.stx_uid;
+    file_stat.st_gid = stx.stx_gid;
+    file_stat.st_rdev = makedev(stx.stx_rdev_major, stx.stx_rdev_minor);
+    file_stat.st_size = stx.stx_size;
+    file_stat.st_blksize = stx.stx_blksize;
+    file_stat.st_nlink = stx.stx_nlink;
+    file_stat.st_atime = stx.stx_atime.tv_sec;
+    file_stat.st_mtime = stx.stx_mtime.tv_sec;
+    file_stat.st_ctime = stx.stx_ctime.tv_sec;
+    return true;
+  } else if (errno != ENOSYS) {
+    return false;
+  }
+  // The kernel predates statx.
+#endif
+  return (::fstatat(dirfd, name.c_str(), &file_stat, flags) == 0);
+}
+
+/**
+ * @brief Generate a row for a path, relative to a directory descriptor.
+ *
+ * The link's own status is read first, a second stat following the link is
+ * only needed for symlinks. Columns the query does not use are not filled.
+ */
+bool genFileInfo(int dirfd,
+                 const std::string& name,
+                 const std::string& path,
                  const std::string& filename,
                  const std::string& dir,
                  const std::string& pattern,
-                 QueryData& results) {
+                 const FileColumns& columns,
+                 const TypedRowYield& yield) {
   // Must provide the path, filename, directory separate from boost path->string
   // helpers to match any explicit (query-parsed) predicate constraints.
-  struct stat file_stat, link_stat;
-  if (lstat(path.c_str(), &link_stat) < 0 || stat(path.c_str(), &file_stat)) {
+  struct stat file_stat;
+  if (!statFile(dirfd, name, AT_SYMLINK_NOFOLLOW, columns, file_stat)) {
+    return true;
+  }
+
+  bool is_link = S_ISLNK(file_stat.st_mode);
+  if (is_link && !statFile(dirfd, name, 0, columns, file_stat)) {
     // Path was not real, had too may links, or could not be accessed.
-    return;
+    return true;
   }
 
-  Row r;
+  TypedRow r;
   r["path"] = path;
   r["filename"] = filename;
   r["directory"] = dir;
 
-  r["inode"] = BIGINT(file_stat.st_ino);
-  r["uid"] = BIGINT(file_stat.st_uid);
-  r["gid"] = BIGINT(file_stat.st_gid);
-  r["mode"] = lsperms(file_stat.st_mode);
-  r["device"] = BIGINT(file_stat.st_rdev);
-  r["size"] = BIGINT(file_stat.st_size);
-  r["block_size"] = INTEGER(file_stat.st_blksize);
-  r["hard_links"] = INTEGER(file_stat.st_nlink);
+  if (columns.inode) {
+    r["inode"] = file_stat.st_ino;
+  }
+  if (columns.uid) {
+    r["uid"] = file_stat.st_uid;
+  }
+  if (columns.gid) {
+    r["gid"] = file_stat.st_gid;
+  }
+  if (columns.mode) {
+    r["mode"] = lsperms(file_stat.st_mode);
+  }
+  if (columns.device) {
+    r["device"] = file_stat.st_rdev;
+  }
+  if (columns.size) {
+    r["size"] = file_stat.st_size;
+  }
+  if (columns.block_size) {
+    r["block_size"] = file_stat.st_blksize;
+  }
+  if (columns.hard_links) {
+    r["hard_links"] = file_stat.st_nlink;
+  }
 
   // Times
-  r["atime"] = BIGINT(file_stat.st_atime);
-  r["mtime"] = BIGINT(file_stat.st_mtime);
-  r["ctime"] = BIGINT(file_stat.st_ctime);
+  if (columns.atime) {
+    r["atime"] = file_stat.st_atime;
+  }
+  if (columns.mtime) {
+    r["mtime"] = file_stat.st_mtime;
+  }
+  if (columns.ctime) {
+    r["ctime"] = file_stat.st_ctime;
+  }
 
   // Type booleans
-  r["is_file"] = (!S_ISDIR(file_stat.st_mode)) ? "1" : "0";
-  r["is_dir"] = (S_ISDIR(file_stat.st_mode)) ? "1" : "0";
-  r["is_link"] = (S_ISLNK(link_stat.st_mode)) ? "1" : "0";
-  r["is_char"] = (S_ISCHR(file_stat.st_mode)) ? "1" : "0";
-  r["is_block"] = (S_ISBLK(file_stat.st_mode)) ? "1" : "0";
+  r["is_file"] = (!S_ISDIR(file_stat.st_mode)) ? 1 : 0;
+  r["is_dir"] = (S_ISDIR(file_stat.st_mode)) ? 1 : 0;
+  r["is_link"] = (is_link) ? 1 : 0;
+  r["is_char"] = (S_ISCHR(file_stat.st_mode)) ? 1 : 0;
+  r["is_block"] = (S_ISBLK(file_stat.st_mode)) ? 1 : 0;
 
   // pattern
   r["pattern"] = pattern;
 
-  results.push_back(r);
+  // The yield returns false when no more rows are requested.
+  return yield(r);
 }
 
-QueryData genFile(QueryContext& context) {
-  QueryData results;
+/// Generate a row for each entry of a directory, false if the yield stops.
+static bool genDirectoryFiles(const std::string& directory,
+                              const FileColumns& columns,
+                              const QueryContext& context,
+                              const TypedRowYield& yield) {
+  int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return true;
+  }
 
+  // Entries are stat'd relative to the descriptor the DIR reads from.
+  auto dir = ::fdopendir(fd);
+  if (dir == nullptr) {
+    ::close(fd);
+    return true;
+  }
+  int dirfd = ::dirfd(dir);
+
+  // Paths are built from the constraint, as the boost iterator did.
+  auto prefix = directory;
+  if (prefix.empty() || prefix.back() != '/') {
+    prefix += '/';
+  }
+
+  bool generating = true;
+  struct dirent* entry = nullptr;
+  while (generating && !context.isCancelled() &&
+         (entry = ::readdir(dir)) != nullptr) {
+    std::string name = entry->d_name;
+    if (name == "." || name == "..") {
+      continue;
+    }
+    generating = genFileInfo(
+        dirfd, name, prefix + name, name, directory, "", columns, yield);
+  }
+  ::closedir(dir);
+  return generating;
+}
+
+void genFile(QueryContext& context, const TypedRowYield& yield) {
+  FileColumns columns(context);
   auto paths = context.constraints["path"].getAll(EQUALS);
   for (const auto& path_string : paths) {
     if (!isReadable(path_string)) {
@@ -76,11 +242,16 @@ QueryData genFile(QueryContext& context) {
     }
 
     fs::path path = path_string;
-    genFileInfo(path_string,
-                path.filename().string(),
-                path.parent_path().string(),
-                "",
-                results);
+    if (!genFileInfo(AT_FDCWD,
+                     path_string,
+                     path_string,
+                     path.filename().string(),
+                     path.parent_path().string(),
+                     "",
+                     columns,
+                     yield)) {
+      return;
+    }
   }
 
   // Now loop through constraints using the directory column constraint.
@@ -90,25 +261,16 @@ QueryData genFile(QueryContext& context) {
       continue;
     }
 
-    try {
-      // Iterate over the directory and generate info for each regular file.
-      fs::directory_iterator begin(directory_string), end;
-      for (; begin != end; ++begin) {
-        genFileInfo(begin->path().string(),
-                    begin->path().filename().string(),
-                    directory_string,
-                    "",
-                    results);
-      }
-    } catch (const fs::filesystem_error& e) {
-      continue;
+    // Iterate over the directory and generate info for each entry.
+    if (!genDirectoryFiles(directory_string, columns, context, yield)) {
+      return;
     }
   }
 
   // Now loop through constraints using the pattern column constraint.
   auto patterns = context.constraints["pattern"].getAll(EQUALS);
   if (patterns.size() != 1) {
-    return results;
+    return;
   }
 
   for (const auto& pattern : patterns) {
@@ -116,7 +278,7 @@ QueryData genFile(QueryContext& context) {
     auto status = resolveFilePattern(pattern, expanded_patterns);
     if (!status.ok()) {
       VLOG(1) << "Could not expand pattern properly: " << status.toString();
-      return results;
+      return;
     }
 
     for (const auto& resolved : expanded_patterns) {
@@ -124,16 +286,18 @@ QueryData genFile(QueryContext& context) {
         continue;
       }
       fs::path path = resolved;
-      genFileInfo(resolved,
-                  path.filename().string(),
-                  path.parent_path().string(),
-                  pattern,
-                  results);
-
+      if (!genFileInfo(AT_FDCWD,
+                       resolved,
+                       resolved,
+                       path.filename().string(),
+                       path.parent_path().string(),
+                       pattern,
+                       columns,
+                       yield)) {
+        return;
+      }
     }
   }
-
-  return results;
 }
 }
 }
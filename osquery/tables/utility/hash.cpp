@@ -8,7 +8,12 @@
  *
  */
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
 #include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
 
 #include <osquery/filesystem.h>
 #include <osquery/hash.h>
@@ -19,22 +24,85 @@ namespace fs = boost::filesystem;
 namespace osquery {
 namespace tables {
 
-void genHashForFile(const std::string& path,
-                    const std::string& dir,
-                    QueryData& results) {
+/// Hash files from a directory concurrently.
+const size_t kHashDirectoryThreads = 4;
+
+/// Files hashed ahead of the yield, each batch is yielded in directory order.
+const size_t kHashDirectoryBatch = 64;
+
+/// The HashType%s of the digest columns used by the query.
+int getHashMask(const QueryContext& context) {
+  int mask = 0;
+  if (context.isColumnUsed("md5")) {
+    mask |= HASH_TYPE_MD5;
+  }
+  if (context.isColumnUsed("sha1")) {
+    mask |= HASH_TYPE_SHA1;
+  }
+  if (context.isColumnUsed("sha256")) {
+    mask |= HASH_TYPE_SHA256;
+  }
+  return mask;
+}
+
+Row genHashForFile(const std::string& path, const std::string& dir, int mask) {
   // Must provide the path, filename, directory separate from boost path->string
   // helpers to match any explicit (query-parsed) predicate constraints.
   Row r;
   r["path"] = path;
   r["directory"] = dir;
-  r["md5"] = osquery::hashFromFile(HASH_TYPE_MD5, path);
-  r["sha1"] = osquery::hashFromFile(HASH_TYPE_SHA1, path);
-  r["sha256"] = osquery::hashFromFile(HASH_TYPE_SHA256, path);
-  results.push_back(r);
+
+  // Read the file once, only computing the digests the query uses. Files that
+  // have not changed since a previous scan are only stat'd.
+  auto hashes = hashMultiFromFileCached(mask, path);
+  if (mask & HASH_TYPE_MD5) {
+    r["md5"] = std::move(hashes.md5);
+  }
+  if (mask & HASH_TYPE_SHA1) {
+    r["sha1"] = std::move(hashes.sha1);
+  }
+  if (mask & HASH_TYPE_SHA256) {
+    r["sha256"] = std::move(hashes.sha256);
+  }
+  return r;
+}
+
+bool genHashForFiles(const std::vector<std::string>& paths,
+                     const std::string& dir,
+                     int mask,
+                     const RowYield& yield) {
+  std::vector<Row> rows(paths.size());
+  std::atomic<size_t> next(0);
+  auto hash = [&paths, &dir, mask, &rows, &next]() {
+    // File sizes vary, each thread takes the next unhashed file.
+    for (size_t i = next++; i < paths.size(); i = next++) {
+      rows[i] = genHashForFile(paths[i], dir, mask);
+    }
+  };
+
+  size_t threads = std::max(boost::thread::hardware_concurrency(), 1U);
+  threads = std::min(std::min(threads, kHashDirectoryThreads), paths.size());
+
+  // The calling thread also hashes.
+  std::vector<std::unique_ptr<boost::thread>> workers;
+  for (size_t i = 1; i < threads; ++i) {
+    workers.emplace_back(new boost::thread(hash));
+  }
+  hash();
+  for (auto& worker : workers) {
+    worker->join();
+  }
+
+  for (auto& r : rows) {
+    if (!yield(r)) {
+      return false;
+    }
+  }
+  return true;
 }
 
-QueryData genHash(QueryContext& context) {
-  QueryData results;
+void genHash(QueryContext& context, const RowYield& yield) {
+  auto mask = getHashMask(context);
 
   // The query must provide a predicate with constratins including path or
   // directory. We search for the parsed predicate constraints with the equals
@@ -46,7 +114,10 @@ QueryData genHash(QueryContext& context) {
       continue;
     }
 
-    genHashForFile(path_string, path.parent_path().string(), results);
+    auto r = genHashForFile(path_string, path.parent_path().string(), mask);
+    if (!yield(r)) {
+      return;
+    }
   }
 
   // Now loop through constraints using the directory column constraint.
@@ -57,16 +128,27 @@ QueryData genHash(QueryContext& context) {
       continue;
     }
 
-    // Iterate over the directory and generate a hash for each regular file.
+    // Iterate over the directory and hash batches of regular files.
+    std::vector<std::string> files;
     boost::filesystem::directory_iterator begin(directory), end;
     for (; begin != end; ++begin) {
       if (boost::filesystem::is_regular_file(begin->status())) {
-        genHashForFile(begin->path().string(), directory_string, results);
+        files.push_back(begin->path().string());
+      }
+
+      if (files.size() == kHashDirectoryBatch) {
+        if (!genHashForFiles(files, directory_string, mask, yield)) {
+          return;
+        }
+        files.clear();
       }
     }
-  }
 
-  return results;
+    if (!files.empty() &&
+        !genHashForFiles(files, directory_string, mask, yield)) {
+      return;
+    }
+  }
 }
 }
 }
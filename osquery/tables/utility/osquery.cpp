@@ -10,6 +10,7 @@
 
 #include <osquery/config.h>
 #include <osquery/core.h>
+#include <osquery/events.h>
 #include <osquery/extensions.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
@@ -18,6 +19,11 @@
 #include <osquery/tables.h>
 #include <osquery/filesystem.h>
 
+#include "osquery/core/metrics.h"
+#include "osquery/database/db_handle.h"
+#include "osquery/database/query.h"
+#include "osquery/sql/virtual_table.h"
+
 namespace osquery {
 namespace tables {
 
@@ -32,6 +38,8 @@ void genQueryPack(const tree_node& pack, QueryData& results) {
   // There are optional restrictions on the set of queries applied pack-wide.
   auto pack_wide_version = pack.second.get("version", "");
   auto pack_wide_platform = pack.second.get("platform", "");
+  auto pack_wide_shard = pack.second.get<size_t>("shard", 100);
+  auto pack_wide_worker = pack.second.get("worker", "");
 
   // Iterate through each query in the pack.
   for (auto const& query : pack.second.get_child("queries")) {
@@ -55,6 +63,9 @@ void genQueryPack(const tree_node& pack, QueryData& results) {
       r["platform"] = pack_wide_platform;
     }
 
+    r["shard"] = INTEGER(query.second.get<size_t>("shard", pack_wide_shard));
+    r["worker"] = query.second.get("worker", pack_wide_worker);
+
     // Adding a prefix to the pack queries to differentiate packs from schedule.
     r["scheduled_name"] = "pack_" + r.at("name") + "_" + r.at("query_name");
     if (Config::checkScheduledQueryName(r.at("scheduled_name"))) {
@@ -120,13 +131,13 @@ QueryData genOsqueryRegistry(QueryContext& context) {
 
   const auto& registries = RegistryFactory::all();
   for (const auto& registry : registries) {
-    const auto& plugins = registry.second->all();
-    for (const auto& plugin : plugins) {
+    // Listing the plugins does not construct those not yet used.
+    for (const auto& name : registry.second->localNames()) {
       Row r;
       r["registry"] = registry.first;
-      r["name"] = plugin.first;
+      r["name"] = name;
       r["owner_uuid"] = "0";
-      r["internal"] = (registry.second->isInternal(plugin.first)) ? "1" : "0";
+      r["internal"] = (registry.second->isInternal(name)) ? "1" : "0";
       r["active"] = "1";
       results.push_back(r);
     }
@@ -200,6 +211,19 @@ QueryData genOsqueryInfo(QueryContext& context) {
   r["build_platform"] = STR(OSQUERY_BUILD_PLATFORM);
   r["build_distro"] = STR(OSQUERY_BUILD_DISTRO);
 
+  // Report the totals of osquery_tables.
+  VirtualTableStats totals;
+  for (const auto& table : VirtualTableStatsRegistry::instance().get()) {
+    totals.invocations += table.second.invocations;
+    totals.rows += table.second.rows;
+    totals.bytes += table.second.bytes;
+    totals.wall_time += table.second.wall_time;
+  }
+  r["table_invocations"] = BIGINT(totals.invocations);
+  r["table_rows"] = BIGINT(totals.rows);
+  r["table_bytes"] = BIGINT(totals.bytes);
+  r["table_wall_time"] = BIGINT(totals.wall_time);
+
   results.push_back(r);
 
   return results;
@@ -216,17 +240,177 @@ QueryData genOsquerySchedule(QueryContext& context) {
     r["interval"] = INTEGER(query.second.interval);
 
     // Report optional performance information.
-    r["executions"] = BIGINT(query.second.executions);
-    r["output_size"] = BIGINT(query.second.output_size);
-    r["wall_time"] = BIGINT(query.second.wall_time);
-    r["user_time"] = BIGINT(query.second.user_time);
-    r["system_time"] = BIGINT(query.second.system_time);
-    r["average_memory"] = BIGINT(query.second.memory);
+    auto performance = Config::getQueryPerformance(query.first);
+    r["executions"] = BIGINT(performance.executions);
+    r["output_size"] = BIGINT(performance.output_size);
+    r["wall_time"] = BIGINT(performance.wall_time);
+    r["user_time"] = BIGINT(performance.user_time);
+    r["system_time"] = BIGINT(performance.system_time);
+    r["average_memory"] = BIGINT(performance.memory);
+    r["allocated"] = BIGINT(performance.allocated);
+    r["peak_allocated"] = BIGINT(performance.peak_allocated);
+    r["generate_allocated"] = BIGINT(performance.generate_allocated);
+    r["diff_allocated"] = BIGINT(performance.diff_allocated);
+    r["serialize_allocated"] = BIGINT(performance.serialize_allocated);
+    r["plan_time"] = BIGINT(performance.plan_time);
+    r["generate_time"] = BIGINT(performance.generate_time);
+    r["diff_time"] = BIGINT(performance.diff_time);
+    r["serialize_time"] = BIGINT(performance.serialize_time);
+    r["log_time"] = BIGINT(performance.log_time);
+    r["instructions"] = BIGINT(performance.instructions);
+    r["cycles"] = BIGINT(performance.cycles);
+    r["cache_misses"] = BIGINT(performance.cache_misses);
+    r["context_switches"] = BIGINT(performance.context_switches);
+    r["page_faults"] = BIGINT(performance.page_faults);
+
+    std::string table_times;
+    for (const auto& table : performance.table_times) {
+      if (!table_times.empty()) {
+        table_times.push_back(',');
+      }
+      table_times += table.first + ":" + std::to_string(table.second);
+    }
+    r["table_times"] = table_times;
+    r["oversized"] = BIGINT(performance.oversized);
+    r["oversized_size"] = BIGINT(performance.oversized_size);
+    results.push_back(r);
+  }
+
+  return results;
+}
+
+QueryData genQueryHistory(QueryContext& context) {
+  QueryData results;
+  auto times = context.constraints["as_of"].getAll<long long>(EQUALS);
+  if (times.empty()) {
+    times.insert(getUnixTime());
+  }
+
+  for (const auto& name : context.constraints["name"].getAll(EQUALS)) {
+    Query query(name, ScheduledQuery());
+    for (const auto& time : times) {
+      QueryData rows;
+      size_t generation = 0, generation_time = 0;
+      auto status = query.getHistoricalResults(
+          (time > 0) ? time : 0, rows, generation, generation_time);
+      if (!status.ok()) {
+        VLOG(1) << "No history for query " << name << ": "
+                << status.getMessage();
+        continue;
+      }
+
+      for (const auto& row : rows) {
+        Row r;
+        r["name"] = name;
+        r["as_of"] = BIGINT(time);
+        r["generation"] = BIGINT(generation);
+        r["time"] = BIGINT(generation_time);
+        serializeRowJSON(row, r["row"]);
+        results.push_back(r);
+      }
+    }
+  }
+  return results;
+}
+
+QueryData genOsqueryMetrics(QueryContext& context) {
+  QueryData results;
+  for (const auto& metric : getMetrics()) {
+    Row r;
+    r["name"] = TEXT(metric.name);
+    if (metric.type == METRIC_COUNTER) {
+      r["type"] = "counter";
+    } else if (metric.type == METRIC_GAUGE) {
+      r["type"] = "gauge";
+    } else {
+      r["type"] = "histogram";
+    }
+
+    r["value"] = BIGINT(metric.value);
+    r["count"] = BIGINT(metric.count);
+    r["sum"] = BIGINT(metric.sum);
+    r["min"] = BIGINT(metric.min);
+    r["max"] = BIGINT(metric.max);
+    r["p50"] = BIGINT(metric.p50);
+    r["p95"] = BIGINT(metric.p95);
+    r["p99"] = BIGINT(metric.p99);
     results.push_back(r);
   }
+  return results;
+}
+
+QueryData genOsqueryDatabase(QueryContext& context) {
+  QueryData results;
+  for (const auto& stats : DBHandle::getInstance()->getStats()) {
+    Row r;
+    r["domain"] = TEXT(stats.domain);
+    r["keys"] = BIGINT(stats.keys);
+    r["memtable_bytes"] = BIGINT(stats.memtable_bytes);
+    r["immutable_memtables"] = INTEGER(stats.immutable_memtables);
+    r["flush_pending"] = INTEGER(stats.flush_pending ? 1 : 0);
+    r["compaction_pending"] = INTEGER(stats.compaction_pending ? 1 : 0);
+    r["level0_files"] = INTEGER(stats.level0_files);
+    r["deleted_ranges"] = INTEGER(stats.deleted_ranges);
+    r["compactions"] = BIGINT(stats.compactions);
+    r["last_compaction"] = BIGINT(stats.last_compaction);
+    results.push_back(r);
+  }
+  return results;
+}
+
+QueryData genOsqueryEvents(QueryContext& context) {
+  QueryData results;
+  for (const auto& name : EventFactory::subscriberNames()) {
+    auto subscriber = EventFactory::getEventSubscriber(name);
+    if (subscriber == nullptr) {
+      continue;
+    }
 
+    Row r;
+    r["name"] = TEXT(name);
+    auto usage = subscriber->getUsage();
+    r["events"] = BIGINT(usage.events);
+    r["bytes"] = BIGINT(usage.bytes);
+    auto retention = EventFactory::getRetention(name);
+    r["max_age"] = BIGINT(retention.max_age);
+    r["max_events"] = BIGINT(retention.max_events);
+    r["max_bytes"] = BIGINT(retention.max_bytes);
+    r["queued"] = INTEGER(subscriber->numQueued());
+    r["dropped"] = BIGINT(subscriber->numDropped());
+    r["lag"] = BIGINT(subscriber->lag());
+    r["peak_lag"] = BIGINT(subscriber->peakLag());
+    r["low_priority"] = INTEGER(subscriber->isLowPriority() ? 1 : 0);
+    results.push_back(r);
+  }
   return results;
 }
 
+QueryData genOsqueryTables(QueryContext& context) {
+  auto stats = VirtualTableStatsRegistry::instance().get();
+  // Include tables that have not been invoked.
+  for (const auto& name : Registry::names("table")) {
+    stats[name];
+  }
+
+  QueryData results;
+  for (const auto& table : stats) {
+    Row r;
+    r["name"] = TEXT(table.first);
+    r["invocations"] = BIGINT(table.second.invocations);
+    r["cache_hits"] = BIGINT(table.second.cache_hits);
+    r["rows"] = BIGINT(table.second.rows);
+    r["bytes"] = BIGINT(table.second.bytes);
+    r["wall_time"] = BIGINT(table.second.wall_time);
+    r["max_wall_time"] = BIGINT(table.second.max_wall_time);
+    const auto& counters = table.second.counters;
+    r["instructions"] = BIGINT(counters.instructions);
+    r["cycles"] = BIGINT(counters.cycles);
+    r["cache_misses"] = BIGINT(counters.cache_misses);
+    r["context_switches"] = BIGINT(counters.context_switches);
+    r["page_faults"] = BIGINT(counters.page_faults);
+    results.push_back(r);
+  }
+  return results;
+}
 }
 }
@@ -0,0 +1,52 @@
+#!/usr/bin/env bash
+
+#  Copyright (c) 2014, Facebook, Inc.
+#  All rights reserved.
+#
+#  This source code is licensed under the BSD-style license found in the
+#  LICENSE file in the root directory of this source tree. An additional grant
+#  of patent rights can be found in the PATENTS file in the same directory.
+
+# Run instrumented osquery binaries to write a profile for a PGO build.
+# Usage: pgo-train.sh PGO_DIR BENCHMARKS OSQUERYD CONFIG [SECONDS]
+
+set -e
+
+if [[ $# -lt 4 ]]; then
+  echo "Usage: $0 PGO_DIR BENCHMARKS OSQUERYD CONFIG [SECONDS]"
+  exit 1
+fi
+
+PGO_DIR="$1"
+BENCHMARKS="$2"
+OSQUERYD="$3"
+CONFIG="$4"
+DURATION="${5:-60}"
+
+mkdir -p "$PGO_DIR"
+WORKING_DIR="`mktemp -d /tmp/osquery-pgo.XXXXX`"
+trap "rm -rf $WORKING_DIR" EXIT
+
+# Clang writes raw profiles per process, GCC writes into the PGO_DIR tree.
+export LLVM_PROFILE_FILE="$PGO_DIR/osquery-%p.profraw"
+
+# The benchmarks exercise the SQL, registry, and table generation paths.
+"$BENCHMARKS" --gtest_output=xml:"$WORKING_DIR/benchmarks.xml"
+
+# A representative schedule exercises the daemon, scheduler, and logger.
+# The scheduler stops after the timeout and the daemon exits.
+"$OSQUERYD" \
+  --config_path="$CONFIG" \
+  --database_path="$WORKING_DIR/osquery.db" \
+  --pidfile="$WORKING_DIR/osqueryd.pidfile" \
+  --logger_path="$WORKING_DIR" \
+  --schedule_timeout="$DURATION" \
+  --disable_watchdog \
+  --disable_extensions \
+  --disable_events
+
+# Clang profiles must be merged before they can be used.
+if ls "$PGO_DIR"/*.profraw >/dev/null 2>&1; then
+  llvm-profdata merge -output="$PGO_DIR/osquery.profdata" "$PGO_DIR"/*.profraw
+  rm -f "$PGO_DIR"/*.profraw
+fi
@@ -32,6 +32,9 @@ TEMPLATES = {}
 # Temporary reserved column names
 RESERVED = ["n", "index"]
 
+# Values of the cacheable attribute, the empty default is not cached
+CACHEABLE = ["", "boot", "hotplug"]
+
 # Set the platform in osquery-language
 PLATFORM = platform()
 
@@ -75,6 +78,11 @@ def to_camel_case(snake_case):
     return components[0] + "".join(x.title() for x in components[1:])
 
 
+def to_pascal_case(snake_case):
+    """ convert a snake_case string to PascalCase """
+    return "".join(x.title() for x in snake_case.split('_'))
+
+
 def lightred(msg):
     return "\033[1;31m %s \033[0m" % str(msg)
 
@@ -163,12 +171,24 @@ class TableState(Singleton):
     def foreign_keys(self):
         return [i for i in self.schema if isinstance(i, ForeignKey)]
 
+    def row_columns(self):
+        """The typed setter and ordinal of each column for a row struct"""
+        return [{
+            "name": column.name,
+            "description": column.description,
+            "cpp_type": column.type.type,
+            "ordinal": "k" + to_pascal_case(column.name),
+            "setter": "set" + to_pascal_case(column.name),
+        } for column in self.columns()]
+
     def generate(self, path, template="default"):
         """Generate the virtual table files"""
         logging.debug("TableState.generate")
         self.impl_content = jinja2.Template(TEMPLATES[template]).render(
             table_name=self.table_name,
             table_name_cc=to_camel_case(self.table_name),
+            row_name=to_pascal_case(self.table_name) + "Row",
+            row_columns=self.row_columns(),
             schema=self.columns(),
             header=self.header,
             impl=self.impl,
@@ -190,6 +210,15 @@ class TableState(Singleton):
                                      column.name, self.table_name))))
                 exit(1)
 
+        # Check the cache lifetime of cacheable tables
+        cacheable = self.attributes.get("cacheable", "")
+        if cacheable not in CACHEABLE:
+            print (lightred(("Invalid cacheable: %s in table: %s "
+                             "(use one of: %s)" % (
+                                 cacheable, self.table_name,
+                                 ", ".join(CACHEABLE[1:])))))
+            exit(1)
+
         path_bits = path.split("/")
         for i in range(1, len(path_bits)):
             dir_path = ""
@@ -314,6 +343,10 @@ def main(argc, argv):
     )
     parser.add_argument("--templates", default=SCRIPT_DIR + "/templates",
         help="Path to codegen output .cpp.in templates")
+    parser.add_argument(
+        "--header", default=False, action="store_true",
+        help="Generate the row struct header of a row_struct table"
+    )
     parser.add_argument("spec_file", help="Path to input .table spec file")
     parser.add_argument("output", help="Path to output .cpp file")
     args = parser.parse_args()
@@ -337,6 +370,12 @@ def main(argc, argv):
         with open(filename, "rU") as file_handle:
             tree = ast.parse(file_handle.read())
             exec(compile(tree, "<string>", "exec"))
+            if args.header:
+                # Generators include the header even if the table is
+                # blacklisted, only row_struct tables have a header.
+                if table.attributes.get("row_struct", False):
+                    table.generate(output, template="row")
+                return
             blacklisted = is_blacklisted(table.table_name, path=filename)
             if not disable_blacklist and blacklisted:
                 table.blacklist(output)
@@ -0,0 +1,371 @@
+#!/usr/bin/env python
+
+#  Copyright (c) 2014, Facebook, Inc.
+#  All rights reserved.
+#
+#  This source code is licensed under the BSD-style license found in the
+#  LICENSE file in the root directory of this source tree. An additional grant
+#  of patent rights can be found in the PATENTS file in the same directory.
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+from __future__ import unicode_literals
+
+try:
+    import argparse
+except ImportError:
+    print ("Cannot import argparse.")
+    exit(1)
+
+import json
+import os
+import psutil
+import shutil
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+# Import the testing utils
+sys.path.append(os.path.dirname(os.path.realpath(__file__)) + "/tests/")
+import utils
+
+MB = 1024 * 1024
+
+# Cheap queries cycled through to build a large schedule.
+QUERY_TEMPLATES = [
+    "SELECT * FROM time",
+    "SELECT * FROM osquery_info",
+    "SELECT pid, name, path FROM processes",
+    "SELECT * FROM listening_ports",
+    "SELECT * FROM users",
+    "SELECT * FROM interface_addresses",
+    "SELECT * FROM kernel_info",
+    "SELECT * FROM osquery_schedule",
+]
+
+# The default watchdog limits (--watchdog_level=0) workers are held to.
+WATCHDOG_MEMORY_LIMIT = 80 * MB
+WATCHDOG_UTILIZATION_LIMIT = 90
+
+
+def generate_config(root, queries, paths, interval, events_interval):
+    """Build a config with a schedule and file event subscriptions."""
+    config = {
+        "schedule": {},
+        "file_paths": {},
+    }
+    for i in range(queries):
+        config["schedule"]["load_%d" % i] = {
+            "query": QUERY_TEMPLATES[i % len(QUERY_TEMPLATES)],
+            # Spread queries over the interval so they do not run in lockstep.
+            "interval": interval + (i % interval),
+        }
+    config["schedule"]["load_file_events"] = {
+        "query": "SELECT * FROM file_events",
+        "interval": events_interval,
+    }
+    for i in range(paths):
+        path = os.path.join(root, "files", "%d" % i)
+        os.makedirs(path)
+        config["file_paths"]["load_%d" % i] = [path + "/%%"]
+    return config
+
+
+def directory_size(path):
+    size = 0
+    for base, _, files in os.walk(path):
+        for name in files:
+            try:
+                size += os.path.getsize(os.path.join(base, name))
+            except OSError:
+                # RocksDB removes files while compacting.
+                pass
+    return size
+
+
+def get_worker(proc):
+    """The watchdog's worker if there is one, otherwise the daemon."""
+    try:
+        children = proc.children()
+    except psutil.Error:
+        return proc
+    return children[0] if len(children) > 0 else proc
+
+
+class EventGenerator(threading.Thread):
+    """Write files into the monitored paths at a fixed rate."""
+
+    def __init__(self, root, paths, rate):
+        threading.Thread.__init__(self)
+        self.daemon = True
+        self.root = root
+        self.paths = paths
+        self.rate = rate
+        self.written = {}
+        self.lock = threading.Lock()
+        self.stopping = threading.Event()
+
+    def run(self):
+        count = 0
+        start = time.time()
+        while not self.stopping.is_set():
+            # Catch up to the rate rather than drifting when writes are slow.
+            expected = int((time.time() - start) * self.rate)
+            while count < expected:
+                path = os.path.join(
+                    self.root, "files", "%d" % (count % self.paths),
+                    "event_%d" % count)
+                with open(path, "w") as fh:
+                    fh.write("%d\n" % count)
+                with self.lock:
+                    self.written[path] = time.time()
+                count += 1
+            time.sleep(min(0.01, 1.0 / max(self.rate, 1)))
+
+    def stop(self):
+        self.stopping.set()
+        self.join()
+
+    def occurred(self, path):
+        with self.lock:
+            return self.written.get(path, None)
+
+    def count(self):
+        with self.lock:
+            return len(self.written)
+
+
+class ResultsReader(object):
+    """Follow the filesystem logger's results log for file event rows."""
+
+    def __init__(self, path):
+        self.path = path
+        self.offset = 0
+        self.partial = ""
+        self.seen = set()
+
+    def read(self, generator, latencies):
+        if not os.path.exists(self.path):
+            return
+        if os.path.getsize(self.path) < self.offset:
+            # The results log was rotated.
+            self.offset = 0
+        with open(self.path, "r") as fh:
+            fh.seek(self.offset)
+            data = fh.read()
+            self.offset = fh.tell()
+        now = time.time()
+        lines = (self.partial + data).split("\n")
+        self.partial = lines.pop()
+        for line in lines:
+            try:
+                item = json.loads(line)
+            except ValueError:
+                continue
+            if item.get("name", None) != "load_file_events":
+                continue
+            path = item.get("columns", {}).get("target_path", None)
+            if path is None or path in self.seen:
+                continue
+            occurred = generator.occurred(path)
+            if occurred is not None:
+                self.seen.add(path)
+                latencies.append(now - occurred)
+
+
+def percentile(values, percent):
+    if len(values) == 0:
+        return None
+    values = sorted(values)
+    index = int(percent * (len(values) - 1))
+    return values[index]
+
+
+def summary(samples, latencies, events):
+    rss = [sample["rss"] for sample in samples]
+    cpu = [sample["utilization"] for sample in samples]
+    return {
+        "events_written": events,
+        "events_logged": len(latencies),
+        "latency": {
+            "p50": percentile(latencies, 0.50),
+            "p95": percentile(latencies, 0.95),
+            "p99": percentile(latencies, 0.99),
+            "max": max(latencies) if len(latencies) > 0 else None,
+        },
+        "database_growth": (samples[-1]["database_size"] -
+                            samples[0]["database_size"]) if samples else 0,
+        "max_rss": max(rss) if rss else 0,
+        "max_utilization": max(cpu) if cpu else 0,
+        # Samples where the default watchdog limits would be exceeded.
+        "watchdog_memory_samples": len(
+            [x for x in rss if x > WATCHDOG_MEMORY_LIMIT]),
+        "watchdog_utilization_samples": len(
+            [x for x in cpu if x > WATCHDOG_UTILIZATION_LIMIT]),
+    }
+
+
+def load(daemon, root, config, rate, duration, interval, flags):
+    config_path = os.path.join(root, "osquery.conf")
+    database_path = os.path.join(root, "osquery.db")
+    logger_path = os.path.join(root, "logs")
+    os.makedirs(logger_path)
+    utils.write_config(config, config_path)
+
+    command = [
+        daemon,
+        "--config_path=%s" % config_path,
+        "--database_path=%s" % database_path,
+        "--logger_plugin=filesystem",
+        "--logger_path=%s" % logger_path,
+        "--pidfile=%s" % os.path.join(root, "osqueryd.pid"),
+        "--disable_events=false",
+        "--enable_monitor",
+    ] + flags
+    if args.verbose:
+        print (" ".join(command))
+    proc = subprocess.Popen(
+        command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+    daemon_proc = psutil.Process(proc.pid)
+
+    generator = EventGenerator(root, len(config["file_paths"]), rate)
+    reader = ResultsReader(os.path.join(logger_path, "osqueryd.results.log"))
+    latencies = []
+    samples = []
+    start = time.time()
+    generator.start()
+    try:
+        while time.time() - start < duration:
+            if proc.poll() is not None:
+                print (utils.red("osqueryd exited with %d" % proc.returncode))
+                break
+            worker = get_worker(daemon_proc)
+            try:
+                utilization = worker.cpu_percent(interval=interval)
+                memory = worker.memory_info()
+            except psutil.Error:
+                # The watchdog may be restarting the worker.
+                continue
+            reader.read(generator, latencies)
+            sample = {
+                "time": round(time.time() - start, 2),
+                "utilization": utilization,
+                "rss": memory.rss,
+                "database_size": directory_size(database_path),
+                "events_written": generator.count(),
+                "events_logged": len(latencies),
+            }
+            samples.append(sample)
+            if args.verbose:
+                print (json.dumps(sample))
+    finally:
+        generator.stop()
+        if proc.poll() is None:
+            proc.terminate()
+            proc.wait()
+    reader.read(generator, latencies)
+    return {
+        "summary": summary(samples, latencies, generator.count()),
+        "samples": samples,
+    }
+
+
+def summary_line(name, value, limit):
+    color = utils.green if value <= limit else utils.red
+    print ("  %s: %s" % (name, color(str(value))))
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=(
+        "Drive osqueryd with a generated schedule and file events, "
+        "measuring event latency, database growth, and CPU/memory."
+    ))
+    parser.add_argument(
+        "--verbose", action="store_true", default=False, help="Be verbose.")
+
+    group = parser.add_argument_group("Load Options:")
+    group.add_argument(
+        "--queries", metavar="N", default=100, type=int,
+        help="Number of generated scheduled queries."
+    )
+    group.add_argument(
+        "--paths", metavar="N", default=10, type=int,
+        help="Number of monitored file event paths."
+    )
+    group.add_argument(
+        "--rate", metavar="N", default=100, type=float,
+        help="File events generated per second."
+    )
+    group.add_argument(
+        "--interval", metavar="N", default=10, type=int,
+        help="Shortest scheduled query interval in seconds."
+    )
+    group.add_argument(
+        "--events_interval", metavar="N", default=5, type=int,
+        help="Interval of the file_events query in seconds."
+    )
+
+    group = parser.add_argument_group("Run Options:")
+    group.add_argument(
+        "--duration", metavar="N", default=60, type=int,
+        help="Seconds to run the load."
+    )
+    group.add_argument(
+        "--sample", metavar="N", default=1, type=float,
+        help="Seconds between CPU/memory/database samples."
+    )
+    group.add_argument(
+        "--daemon", metavar="PATH", default="./build/%s/osquery/osqueryd" % (
+            utils.platform()),
+        help="Path to osqueryd (./build/<sys>/osquery/osqueryd)."
+    )
+    group.add_argument(
+        "--flag", metavar="FLAG", action="append", default=[],
+        help="Additional osqueryd flag, may be repeated."
+    )
+    group.add_argument(
+        "--keep", action="store_true", default=False,
+        help="Keep the generated config, database, and logs."
+    )
+    group.add_argument(
+        "--output", metavar="FILE", default=None,
+        help="Write JSON load output to file."
+    )
+    args = parser.parse_args()
+
+    if not os.path.exists(args.daemon):
+        print ("Cannot find --daemon: %s" % (args.daemon))
+        exit(1)
+
+    root = tempfile.mkdtemp(prefix="osquery-loadtest-")
+    try:
+        config = generate_config(root, args.queries, args.paths,
+                                 max(args.interval, 1), args.events_interval)
+        results = load(args.daemon, root, config, args.rate, args.duration,
+                       args.sample, args.flag)
+    finally:
+        if args.keep:
+            print ("Kept load files: %s" % root)
+        else:
+            shutil.rmtree(root, ignore_errors=True)
+
+    result = results["summary"]
+    print ("Load: %d queries, %d paths, %.1f events/s for %ds" % (
+        args.queries, args.paths, args.rate, args.duration))
+    print ("  events: %d written, %d logged" % (
+        result["events_written"], result["events_logged"]))
+    for key in ["p50", "p95", "p99", "max"]:
+        if result["latency"][key] is not None:
+            print ("  latency %s: %.3fs" % (key, result["latency"][key]))
+    print ("  database growth: %d bytes" % result["database_growth"])
+    summary_line("max rss", result["max_rss"], WATCHDOG_MEMORY_LIMIT)
+    summary_line("max utilization", result["max_utilization"],
+                 WATCHDOG_UTILIZATION_LIMIT)
+
+    if args.output is not None:
+        with open(args.output, "w") as fh:
+            fh.write(json.dumps(results, indent=1))
+        print ("Wrote output: %s" % args.output)
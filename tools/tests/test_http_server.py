@@ -13,6 +13,7 @@ from __future__ import print_function
 from __future__ import unicode_literals
 
 import argparse
+import gzip
 import json
 import os
 import signal
@@ -21,6 +22,7 @@ import sys
 
 # Create a simple TLS/HTTP server.
 from BaseHTTPServer import BaseHTTPRequestHandler, HTTPServer
+from StringIO import StringIO
 from urlparse import parse_qs
 
 EXAMPLE_CONFIG = {
@@ -46,6 +48,12 @@ ENROLL_RESPONSE = {
     "node_key": "this_is_a_node_secret"
 }
 
+DISTRIBUTED_QUERIES = {
+    "queries": [
+        {"id": "tls_info", "query": "select * from osquery_info"},
+    ]
+}
+
 def debug(response):
     print("-- [DEBUG] %s" % str(response))
 
@@ -68,7 +76,10 @@ class RealSimpleHandler(BaseHTTPRequestHandler):
         debug("RealSimpleHandler::post %s" % self.path)
         self._set_headers()
         content_len = int(self.headers.getheader('content-length', 0))
-        request = json.loads(self.rfile.read(content_len))
+        body = self.rfile.read(content_len)
+        if self.headers.getheader('content-encoding', '') == 'gzip':
+            body = gzip.GzipFile(fileobj=StringIO(body)).read()
+        request = json.loads(body)
         debug("Request: %s" % str(request))
 
         if self.path == '/enroll':
@@ -77,6 +88,10 @@ class RealSimpleHandler(BaseHTTPRequestHandler):
             self.config(request)
         elif self.path == '/log':
             self.log(request)
+        elif self.path == '/distributed_read':
+            self.distributed_read(request)
+        elif self.path == '/distributed_write':
+            self.distributed_write(request)
         else:
             self._reply(TEST_RESPONSE)
 
@@ -117,6 +132,23 @@ class RealSimpleHandler(BaseHTTPRequestHandler):
     def log(self, request):
         self._reply({})
 
+    def distributed_read(self, request):
+        '''A basic distributed query read endpoint'''
+
+        # The read includes a "wait" in seconds. A real server holds the
+        # request open until it has queries for the node, or the wait passes,
+        # then replies with an empty list. This toy server always replies.
+        if "node_key" not in request or request["node_key"] not in NODE_KEYS:
+            self._reply(FAILED_ENROLL_RESPONSE)
+            return
+        self._reply(DISTRIBUTED_QUERIES)
+
+    def distributed_write(self, request):
+        if "node_key" not in request or request["node_key"] not in NODE_KEYS:
+            self._reply(FAILED_ENROLL_RESPONSE)
+            return
+        self._reply({})
+
     def _reply(self, response):
         debug("Replying: %s" % (str(response)))
         self.wfile.write(json.dumps(response))